@@ -0,0 +1,159 @@
+/*
+ * Copyright © 2022 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bench-helper.h"
+#include "shared/timespec-util.h"
+#include "weston-test-runner.h"
+
+static uint64_t alloc_count;
+
+#ifdef HAVE_LIBC_MALLOC
+/*
+ * Count every allocation made by the process, compositor included, by
+ * interposing the allocator entry points. glibc exports its own
+ * implementation under these names, which avoids the dlsym() bootstrap
+ * problem of calloc being needed before the lookup has finished.
+ */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+static const bool alloc_count_supported = true;
+
+void *
+malloc(size_t size)
+{
+	__atomic_fetch_add(&alloc_count, 1, __ATOMIC_RELAXED);
+	return __libc_malloc(size);
+}
+
+void *
+calloc(size_t nmemb, size_t size)
+{
+	__atomic_fetch_add(&alloc_count, 1, __ATOMIC_RELAXED);
+	return __libc_calloc(nmemb, size);
+}
+
+void *
+realloc(void *ptr, size_t size)
+{
+	__atomic_fetch_add(&alloc_count, 1, __ATOMIC_RELAXED);
+	return __libc_realloc(ptr, size);
+}
+
+void
+free(void *ptr)
+{
+	__libc_free(ptr);
+}
+#else
+static const bool alloc_count_supported = false;
+#endif
+
+static uint64_t
+bench_alloc_count(void)
+{
+	return __atomic_load_n(&alloc_count, __ATOMIC_RELAXED);
+}
+
+void
+bench_begin(struct bench_sample *sample, const char *scenario,
+	    const char *variant)
+{
+	sample->scenario = scenario;
+	sample->variant = variant;
+	sample->allocs_start = bench_alloc_count();
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &sample->cpu_start);
+	clock_gettime(CLOCK_MONOTONIC, &sample->wall_start);
+}
+
+/** Finish a measurement and report it
+ *
+ * Prints one JSON object per sample as a TAP diagnostic line, so that
+ * results can be picked out of the log with "grep '^# bench '". When
+ * WESTON_BENCH_OUTPUT names a file, the same object is also appended to
+ * it as a JSON Lines record.
+ */
+void
+bench_end(struct bench_sample *sample, unsigned iterations)
+{
+	struct timespec wall_end, cpu_end;
+	int64_t wall_ns, cpu_ns;
+	uint64_t allocs;
+	const char *path;
+	char allocs_str[64];
+	char *line;
+	FILE *fp;
+	int ret;
+
+	clock_gettime(CLOCK_MONOTONIC, &wall_end);
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu_end);
+	allocs = bench_alloc_count() - sample->allocs_start;
+
+	assert(iterations > 0);
+	wall_ns = timespec_sub_to_nsec(&wall_end, &sample->wall_start);
+	cpu_ns = timespec_sub_to_nsec(&cpu_end, &sample->cpu_start);
+
+	if (alloc_count_supported)
+		snprintf(allocs_str, sizeof allocs_str, "%.1f",
+			 (double)allocs / iterations);
+	else
+		snprintf(allocs_str, sizeof allocs_str, "null");
+
+	ret = asprintf(&line,
+		       "{\"scenario\": \"%s\", \"variant\": \"%s\", "
+		       "\"iterations\": %u, \"wall_ms\": %.3f, "
+		       "\"per_second\": %.1f, \"cpu_us_per_iteration\": %.1f, "
+		       "\"allocs_per_iteration\": %s}",
+		       sample->scenario, sample->variant ? sample->variant : "",
+		       iterations, wall_ns / 1e6,
+		       wall_ns > 0 ? iterations * 1e9 / wall_ns : 0.0,
+		       cpu_ns / 1e3 / iterations, allocs_str);
+	assert(ret > 0);
+
+	printf("# bench %s\n", line);
+	fflush(stdout);
+
+	path = getenv("WESTON_BENCH_OUTPUT");
+	if (path) {
+		fp = fopen(path, "a");
+		if (fp) {
+			fprintf(fp, "%s\n", line);
+			fclose(fp);
+		} else {
+			testlog("Failed to open %s for bench results.\n", path);
+		}
+	}
+
+	free(line);
+}
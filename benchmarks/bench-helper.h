@@ -0,0 +1,56 @@
+/*
+ * Copyright © 2022 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef WESTON_BENCH_HELPER_H
+#define WESTON_BENCH_HELPER_H
+
+#include <stdint.h>
+#include <time.h>
+
+/** Number of frames each frame-paced scenario runs for */
+#define BENCH_FRAMES 300
+
+/** One measurement of a benchmark scenario
+ *
+ * The compositor and the test client run in the same process, so the
+ * CPU time and allocation counts cover both sides of the protocol,
+ * including any renderer worker threads.
+ */
+struct bench_sample {
+	const char *scenario;
+	const char *variant;
+	struct timespec wall_start;
+	struct timespec cpu_start;
+	uint64_t allocs_start;
+};
+
+void
+bench_begin(struct bench_sample *sample, const char *scenario,
+	    const char *variant);
+
+void
+bench_end(struct bench_sample *sample, unsigned iterations);
+
+#endif /* WESTON_BENCH_HELPER_H */
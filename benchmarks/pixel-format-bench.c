@@ -0,0 +1,102 @@
+/*
+ * Copyright © 2022 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <assert.h>
+#include <stdint.h>
+
+#include "weston-test-runner.h"
+#include "libweston/pixel-formats.h"
+#include "shared/weston-drm-fourcc.h"
+#include "bench-helper.h"
+
+#define N_FRAMES 200000
+
+/* What one frame of a typical desktop looks up: a few SHM clients being
+ * attached, a video and a dmabuf client imported, the plane checks for
+ * each of them and the GBM surface format of the output. */
+static const uint32_t frame_formats[] = {
+	DRM_FORMAT_ARGB8888,
+	DRM_FORMAT_XRGB8888,
+	DRM_FORMAT_ARGB8888,
+	DRM_FORMAT_NV12,
+	DRM_FORMAT_ABGR2101010,
+	DRM_FORMAT_XRGB8888,
+	DRM_FORMAT_NV12,
+	DRM_FORMAT_ABGR2101010,
+	DRM_FORMAT_YUV420,
+	DRM_FORMAT_XRGB2101010,
+};
+
+/* Every entry of the table must be found through the index, including the
+ * ones sharing a bucket, and the first entry wins for an opaque
+ * substitute used by more than one format. */
+TEST(pixel_format_lookup_consistent)
+{
+	const struct pixel_format_info *info, *other, *first;
+	unsigned int count = pixel_format_get_info_count();
+	unsigned int i, j;
+
+	for (i = 0; i < count; i++) {
+		info = pixel_format_get_info_by_index(i);
+		assert(pixel_format_get_info(info->format) == info);
+
+		if (!info->opaque_substitute)
+			continue;
+
+		first = NULL;
+		for (j = 0; j < count && !first; j++) {
+			other = pixel_format_get_info_by_index(j);
+			if (other->opaque_substitute == info->opaque_substitute)
+				first = other;
+		}
+		other = pixel_format_get_info_by_opaque_substitute(
+				info->opaque_substitute);
+		assert(other == first);
+	}
+
+	assert(!pixel_format_get_info(0));
+	assert(!pixel_format_get_info(fourcc_code('N', 'O', 'P', 'E')));
+	assert(!pixel_format_get_info_by_opaque_substitute(0));
+}
+
+TEST(pixel_format_lookup_per_frame)
+{
+	struct bench_sample sample;
+	const struct pixel_format_info *info;
+	unsigned int i, j;
+
+	bench_begin(&sample, "pixel-format", "frame");
+	for (i = 0; i < N_FRAMES; i++) {
+		for (j = 0; j < ARRAY_LENGTH(frame_formats); j++) {
+			info = pixel_format_get_info(frame_formats[j]);
+			assert(info);
+		}
+		info = pixel_format_get_info_by_opaque_substitute(DRM_FORMAT_XRGB8888);
+		assert(info && info->format == DRM_FORMAT_ARGB8888);
+	}
+	bench_end(&sample, N_FRAMES);
+}
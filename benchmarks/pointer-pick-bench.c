@@ -0,0 +1,120 @@
+/*
+ * Copyright © 2022 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <assert.h>
+#include <stdint.h>
+
+#include "weston-test-client-helper.h"
+#include "weston-test-fixture-compositor.h"
+#include "shared/timespec-util.h"
+#include "bench-helper.h"
+
+#define GRID 16
+#define VIEW_SIZE 48
+#define VIEW_STEP 38
+#define N_MOTIONS 5000
+#define MOTIONS_PER_ROUNDTRIP 50
+
+static enum test_result_code
+fixture_setup(struct weston_test_harness *harness)
+{
+	struct compositor_setup setup;
+
+	compositor_setup_defaults(&setup);
+	setup.width = 640;
+	setup.height = 640;
+	setup.shell = SHELL_TEST_DESKTOP;
+
+	return weston_test_harness_execute_as_client(harness, &setup);
+}
+DECLARE_FIXTURE_SETUP(fixture_setup);
+
+/*
+ * Map a grid of overlapping views and sweep the pointer across them.
+ * Every motion event makes the compositor pick the view under the
+ * pointer and usually move the focus, so this measures input
+ * processing cost as the view list grows.
+ */
+TEST(pointer_pick_many_views)
+{
+	struct client *client;
+	struct surface *surfaces[GRID * GRID];
+	struct buffer *buffer;
+	pixman_color_t color;
+	struct bench_sample sample;
+	struct timespec time = { 0 };
+	uint32_t tv_sec_hi, tv_sec_lo, tv_nsec;
+	unsigned i;
+	int x, y;
+
+	client = create_client();
+	buffer = create_shm_buffer_a8r8g8b8(client, VIEW_SIZE, VIEW_SIZE);
+	color_rgb888(&color, 0x40, 0x80, 0xc0);
+	fill_image_with_color(buffer->image, &color);
+
+	for (i = 0; i < ARRAY_LENGTH(surfaces); i++) {
+		struct surface *surface = create_test_surface(client);
+
+		surface->width = VIEW_SIZE;
+		surface->height = VIEW_SIZE;
+		surface->x = (i % GRID) * VIEW_STEP;
+		surface->y = (i / GRID) * VIEW_STEP;
+		weston_test_move_surface(client->test->weston_test,
+					 surface->wl_surface,
+					 surface->x, surface->y);
+		wl_surface_attach(surface->wl_surface, buffer->proxy, 0, 0);
+		wl_surface_damage(surface->wl_surface, 0, 0,
+				  VIEW_SIZE, VIEW_SIZE);
+		wl_surface_commit(surface->wl_surface);
+		surfaces[i] = surface;
+	}
+	client_roundtrip(client);
+
+	bench_begin(&sample, "pointer-pick", "256 views");
+
+	for (i = 0; i < N_MOTIONS; i++) {
+		/* Zig-zag over the whole grid, crossing view edges often. */
+		x = (i * 7) % (GRID * VIEW_STEP);
+		y = ((i / (GRID * VIEW_STEP / 7)) * 13) % (GRID * VIEW_STEP);
+
+		timespec_add_msec(&time, &time, 1);
+		timespec_to_proto(&time, &tv_sec_hi, &tv_sec_lo, &tv_nsec);
+		weston_test_move_pointer(client->test->weston_test, tv_sec_hi,
+					 tv_sec_lo, tv_nsec, x, y);
+
+		if (i % MOTIONS_PER_ROUNDTRIP == MOTIONS_PER_ROUNDTRIP - 1)
+			client_roundtrip(client);
+	}
+	client_roundtrip(client);
+
+	bench_end(&sample, N_MOTIONS);
+
+	for (i = 0; i < ARRAY_LENGTH(surfaces); i++)
+		surface_destroy(surfaces[i]);
+	buffer_destroy(buffer);
+	client_destroy(client);
+}
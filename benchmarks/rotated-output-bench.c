@@ -0,0 +1,122 @@
+/*
+ * Copyright © 2022 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <assert.h>
+#include <stdint.h>
+
+#include "weston-test-client-helper.h"
+#include "weston-test-fixture-compositor.h"
+#include "bench-helper.h"
+
+struct setup_args {
+	struct fixture_metadata meta;
+	enum renderer_type renderer;
+	enum wl_output_transform transform;
+};
+
+static const struct setup_args my_setup_args[] = {
+	{
+		.renderer = RENDERER_PIXMAN,
+		.transform = WL_OUTPUT_TRANSFORM_NORMAL,
+		.meta.name = "pixman normal"
+	},
+	{
+		.renderer = RENDERER_PIXMAN,
+		.transform = WL_OUTPUT_TRANSFORM_90,
+		.meta.name = "pixman rotate-90"
+	},
+	{
+		.renderer = RENDERER_PIXMAN,
+		.transform = WL_OUTPUT_TRANSFORM_180,
+		.meta.name = "pixman rotate-180"
+	},
+	{
+		.renderer = RENDERER_PIXMAN,
+		.transform = WL_OUTPUT_TRANSFORM_FLIPPED_270,
+		.meta.name = "pixman flipped-rotate-270"
+	},
+	{
+		.renderer = RENDERER_GL,
+		.transform = WL_OUTPUT_TRANSFORM_90,
+		.meta.name = "GL rotate-90"
+	},
+};
+
+static enum test_result_code
+fixture_setup(struct weston_test_harness *harness, const struct setup_args *arg)
+{
+	struct compositor_setup setup;
+
+	compositor_setup_defaults(&setup);
+	setup.renderer = arg->renderer;
+	setup.width = 640;
+	setup.height = 480;
+	setup.transform = arg->transform;
+	setup.shell = SHELL_TEST_DESKTOP;
+	setup.benchmark = true;
+
+	return weston_test_harness_execute_as_client(harness, &setup);
+}
+DECLARE_FIXTURE_SETUP_WITH_ARG(fixture_setup, my_setup_args, meta);
+
+/*
+ * A large surface covering most of the output is fully redrawn every
+ * frame, so that the cost of compositing through the output transform
+ * dominates. Compare the variants against "normal" to see the price of
+ * each rotation.
+ */
+TEST(rotated_output_full_damage)
+{
+	const struct setup_args *arg = &my_setup_args[get_test_fixture_index()];
+	struct client *client;
+	struct surface *surface;
+	pixman_color_t color;
+	struct bench_sample sample;
+	unsigned frame;
+	int done;
+
+	client = create_client_and_test_surface(0, 0, 400, 400);
+	surface = client->surface;
+
+	bench_begin(&sample, "rotated-output", arg->meta.name);
+
+	for (frame = 0; frame < BENCH_FRAMES; frame++) {
+		color_rgb888(&color, frame & 0xff, 0x80, 0xff - (frame & 0xff));
+		fill_image_with_color(surface->buffer->image, &color);
+		wl_surface_attach(surface->wl_surface, surface->buffer->proxy,
+				  0, 0);
+		wl_surface_damage(surface->wl_surface, 0, 0,
+				  surface->width, surface->height);
+		frame_callback_set(surface->wl_surface, &done);
+		wl_surface_commit(surface->wl_surface);
+		frame_callback_wait(client, &done);
+	}
+
+	bench_end(&sample, BENCH_FRAMES);
+
+	client_destroy(client);
+}
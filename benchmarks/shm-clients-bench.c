@@ -0,0 +1,123 @@
+/*
+ * Copyright © 2022 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <assert.h>
+#include <stdint.h>
+
+#include "weston-test-client-helper.h"
+#include "weston-test-fixture-compositor.h"
+#include "bench-helper.h"
+
+#define SURFACE_SIZE 96
+
+struct setup_args {
+	struct fixture_metadata meta;
+	unsigned n_clients;
+};
+
+static const struct setup_args my_setup_args[] = {
+	{ .n_clients = 1, .meta.name = "1 client" },
+	{ .n_clients = 4, .meta.name = "4 clients" },
+	{ .n_clients = 16, .meta.name = "16 clients" },
+};
+
+static enum test_result_code
+fixture_setup(struct weston_test_harness *harness, const struct setup_args *arg)
+{
+	struct compositor_setup setup;
+
+	compositor_setup_defaults(&setup);
+	setup.renderer = RENDERER_PIXMAN;
+	setup.width = 640;
+	setup.height = 480;
+	setup.shell = SHELL_TEST_DESKTOP;
+	setup.benchmark = true;
+
+	return weston_test_harness_execute_as_client(harness, &setup);
+}
+DECLARE_FIXTURE_SETUP_WITH_ARG(fixture_setup, my_setup_args, meta);
+
+static void
+fill_buffer(struct buffer *buffer, unsigned frame)
+{
+	pixman_color_t color = {
+		.red = (frame * 797) & 0xffff,
+		.green = (frame * 1291) & 0xffff,
+		.blue = (frame * 2039) & 0xffff,
+		.alpha = 0xffff,
+	};
+
+	fill_image_with_color(buffer->image, &color);
+}
+
+/*
+ * Every client redraws and commits its whole surface once per frame
+ * callback. With the headless backend in benchmark mode the output
+ * repaints continuously, so this measures how fast the compositor can
+ * accept, composite and release SHM content from several clients.
+ */
+TEST(shm_clients_full_rate)
+{
+	const struct setup_args *arg = &my_setup_args[get_test_fixture_index()];
+	struct client *clients[16];
+	int done[16];
+	struct bench_sample sample;
+	unsigned frame;
+	unsigned i;
+
+	assert(arg->n_clients <= ARRAY_LENGTH(clients));
+
+	for (i = 0; i < arg->n_clients; i++)
+		clients[i] = create_client_and_test_surface((i % 4) * 150 + 10,
+							    (i / 4) * 110 + 10,
+							    SURFACE_SIZE,
+							    SURFACE_SIZE);
+
+	bench_begin(&sample, "shm-clients", arg->meta.name);
+
+	for (frame = 0; frame < BENCH_FRAMES; frame++) {
+		for (i = 0; i < arg->n_clients; i++) {
+			struct surface *surface = clients[i]->surface;
+
+			fill_buffer(surface->buffer, frame + i);
+			wl_surface_attach(surface->wl_surface,
+					  surface->buffer->proxy, 0, 0);
+			wl_surface_damage(surface->wl_surface, 0, 0,
+					  surface->width, surface->height);
+			frame_callback_set(surface->wl_surface, &done[i]);
+			wl_surface_commit(surface->wl_surface);
+		}
+
+		for (i = 0; i < arg->n_clients; i++)
+			frame_callback_wait(clients[i], &done[i]);
+	}
+
+	bench_end(&sample, BENCH_FRAMES);
+
+	for (i = 0; i < arg->n_clients; i++)
+		client_destroy(clients[i]);
+}
@@ -0,0 +1,140 @@
+/*
+ * Copyright © 2022 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <assert.h>
+#include <stdint.h>
+
+#include "weston-test-client-helper.h"
+#include "weston-test-fixture-compositor.h"
+#include "bench-helper.h"
+
+#define N_SUBSURFACES 64
+#define CHILD_SIZE 24
+
+static enum test_result_code
+fixture_setup(struct weston_test_harness *harness)
+{
+	struct compositor_setup setup;
+
+	compositor_setup_defaults(&setup);
+	setup.renderer = RENDERER_PIXMAN;
+	setup.width = 640;
+	setup.height = 480;
+	setup.shell = SHELL_TEST_DESKTOP;
+	setup.benchmark = true;
+
+	return weston_test_harness_execute_as_client(harness, &setup);
+}
+DECLARE_FIXTURE_SETUP(fixture_setup);
+
+struct child {
+	struct wl_surface *surface;
+	struct wl_subsurface *subsurface;
+	struct buffer *buffer;
+};
+
+static void
+child_position(unsigned i, unsigned frame, int *x, int *y)
+{
+	*x = (i % 8) * 36 + (int)((frame + i) % 16);
+	*y = (i / 8) * 28 + (int)((frame * 3 + i) % 12);
+}
+
+/*
+ * A single parent with many synchronized sub-surfaces that all move,
+ * restack and recommit every frame, while one sub-surface per frame is
+ * destroyed and recreated. This stresses the sub-surface cached state
+ * application, view list rebuilds and the resulting damage churn.
+ */
+TEST(subsurface_storm)
+{
+	struct client *client;
+	struct wl_subcompositor *subco;
+	struct child children[N_SUBSURFACES];
+	pixman_color_t color;
+	struct bench_sample sample;
+	unsigned frame;
+	unsigned i;
+	int done;
+	int x, y;
+
+	client = create_client_and_test_surface(20, 20, 320, 240);
+	subco = bind_to_singleton_global(client, &wl_subcompositor_interface, 1);
+
+	for (i = 0; i < N_SUBSURFACES; i++) {
+		struct child *c = &children[i];
+
+		c->surface = wl_compositor_create_surface(client->wl_compositor);
+		c->subsurface = wl_subcompositor_get_subsurface(subco,
+						c->surface,
+						client->surface->wl_surface);
+		c->buffer = create_shm_buffer_a8r8g8b8(client, CHILD_SIZE,
+						       CHILD_SIZE);
+		color_rgb888(&color, i * 4, 255 - i * 4, (i * 37) & 0xff);
+		fill_image_with_color(c->buffer->image, &color);
+	}
+
+	bench_begin(&sample, "subsurface-storm", NULL);
+
+	for (frame = 0; frame < BENCH_FRAMES; frame++) {
+		struct child *churn = &children[frame % N_SUBSURFACES];
+
+		wl_subsurface_destroy(churn->subsurface);
+		churn->subsurface = wl_subcompositor_get_subsurface(subco,
+						churn->surface,
+						client->surface->wl_surface);
+
+		for (i = 0; i < N_SUBSURFACES; i++) {
+			struct child *c = &children[i];
+
+			child_position(i, frame, &x, &y);
+			wl_subsurface_set_position(c->subsurface, x, y);
+			if (i > 0 && (frame + i) % 5 == 0)
+				wl_subsurface_place_below(c->subsurface,
+						children[i - 1].surface);
+
+			wl_surface_attach(c->surface, c->buffer->proxy, 0, 0);
+			wl_surface_damage(c->surface, 0, 0,
+					  CHILD_SIZE, CHILD_SIZE);
+			wl_surface_commit(c->surface);
+		}
+
+		frame_callback_set(client->surface->wl_surface, &done);
+		wl_surface_commit(client->surface->wl_surface);
+		frame_callback_wait(client, &done);
+	}
+
+	bench_end(&sample, BENCH_FRAMES);
+
+	for (i = 0; i < N_SUBSURFACES; i++) {
+		wl_subsurface_destroy(children[i].subsurface);
+		wl_surface_destroy(children[i].surface);
+		buffer_destroy(children[i].buffer);
+	}
+	wl_subcompositor_destroy(subco);
+	client_destroy(client);
+}
@@ -0,0 +1,184 @@
+/*
+ * Copyright © 2022 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "weston-test-client-helper.h"
+#include "wcap-decode.h"
+#include "wcap-convert.h"
+#include "bench-helper.h"
+
+#define WIDTH 1920
+#define HEIGHT 1080
+#define N_FRAMES 120
+/* Damage split into tiles, like a desktop with several busy windows */
+#define TILES_X 4
+#define TILES_Y 4
+
+static void
+write_rle(FILE *fp, int count)
+{
+	uint32_t v;
+	int j;
+
+	while (count > 0) {
+		j = rand() % 16 + 1;
+		if (j > count)
+			j = count;
+		v = (uint32_t) (j - 1) << 24 | (rand() & 0x00ffffff);
+		fwrite(&v, sizeof v, 1, fp);
+		count -= j;
+	}
+}
+
+static char *
+write_recording(void)
+{
+	struct wcap_header header = {
+		.magic = WCAP_HEADER_MAGIC,
+		.format = WCAP_FORMAT_XRGB8888,
+		.width = WIDTH,
+		.height = HEIGHT,
+	};
+	struct wcap_frame_header frame = { .nrects = TILES_X * TILES_Y };
+	struct wcap_rectangle rects[TILES_X * TILES_Y];
+	char *path = strdup("/tmp/weston-bench-XXXXXX.wcap");
+	FILE *fp;
+	int fd, f, i;
+
+	fd = mkstemps(path, strlen(".wcap"));
+	assert(fd >= 0);
+	fp = fdopen(fd, "w");
+	assert(fp);
+
+	for (i = 0; i < TILES_X * TILES_Y; i++) {
+		rects[i].x1 = (i % TILES_X) * WIDTH / TILES_X;
+		rects[i].y1 = (i / TILES_X) * HEIGHT / TILES_Y;
+		rects[i].x2 = rects[i].x1 + WIDTH / TILES_X;
+		rects[i].y2 = rects[i].y1 + HEIGHT / TILES_Y;
+	}
+
+	srand(1);
+	fwrite(&header, sizeof header, 1, fp);
+	for (f = 0; f < N_FRAMES; f++) {
+		frame.msecs = f * 16;
+		fwrite(&frame, sizeof frame, 1, fp);
+		fwrite(rects, sizeof rects, 1, fp);
+		for (i = 0; i < TILES_X * TILES_Y; i++)
+			write_rle(fp, (rects[i].x2 - rects[i].x1) *
+				      (rects[i].y2 - rects[i].y1));
+	}
+	fclose(fp);
+
+	return path;
+}
+
+static uint32_t *
+decode_all(const char *path, int threads, const char *variant)
+{
+	struct bench_sample sample;
+	struct wcap_decoder *decoder;
+	uint32_t *last;
+	int n = 0;
+
+	decoder = wcap_decoder_create(path);
+	assert(decoder);
+	assert(wcap_decoder_set_threads(decoder, threads) == 0);
+
+	bench_begin(&sample, "wcap-decode", variant);
+	while (wcap_decoder_get_frame(decoder))
+		n++;
+	bench_end(&sample, n);
+	assert(n == N_FRAMES);
+
+	last = malloc(WIDTH * HEIGHT * sizeof *last);
+	assert(last);
+	memcpy(last, decoder->frame, WIDTH * HEIGHT * sizeof *last);
+	wcap_decoder_destroy(decoder);
+
+	return last;
+}
+
+/*
+ * Decode the same recording on one thread and on four, and check that
+ * both end up with the same picture.
+ */
+TEST(wcap_decode_rectangles)
+{
+	char *path = write_recording();
+	uint32_t *serial, *parallel;
+
+	serial = decode_all(path, 1, "serial");
+	parallel = decode_all(path, 4, "4-threads");
+	assert(memcmp(serial, parallel, WIDTH * HEIGHT * sizeof *serial) == 0);
+
+	free(serial);
+	free(parallel);
+	unlink(path);
+	free(path);
+}
+
+static void
+convert_frames(const uint32_t *frame, unsigned char *out, bool simd)
+{
+	struct bench_sample sample;
+	int i;
+
+	if (wcap_convert_simd_enable(simd) != simd) {
+		testlog("no SIMD converter in this build\n");
+		return;
+	}
+
+	bench_begin(&sample, "wcap-yv12", simd ? "simd" : "scalar");
+	for (i = 0; i < N_FRAMES; i++)
+		wcap_convert_to_yv12(WCAP_FORMAT_XRGB8888, frame,
+				     WIDTH, HEIGHT, out);
+	bench_end(&sample, N_FRAMES);
+}
+
+TEST(wcap_convert_yv12)
+{
+	uint32_t *frame = malloc(WIDTH * HEIGHT * sizeof *frame);
+	unsigned char *out = malloc(WIDTH * HEIGHT * 3 / 2);
+	int i;
+
+	assert(frame && out);
+	srand(2);
+	for (i = 0; i < WIDTH * HEIGHT; i++)
+		frame[i] = (uint32_t) rand() << 16 ^ (uint32_t) rand();
+
+	convert_frames(frame, out, false);
+	convert_frames(frame, out, true);
+
+	free(frame);
+	free(out);
+}
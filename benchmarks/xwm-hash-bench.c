@@ -0,0 +1,109 @@
+/*
+ * Copyright © 2022 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <assert.h>
+#include <stdint.h>
+
+#include "weston-test-client-helper.h"
+#include "xwayland/hash.h"
+#include "bench-helper.h"
+
+#define N_TOPLEVELS 200
+#define N_POPUPS_LIVE 32
+#define N_POPUPS 200000
+#define LOOKUPS_PER_POPUP 16
+
+/* X clients allocate ids sequentially from a base the server hands out;
+ * client 0 is the window manager itself. */
+#define CLIENT_BASE(c) (0x00200000u * (uint32_t)((c) + 1))
+
+static uintptr_t
+tag(uint32_t id)
+{
+	return (uintptr_t)id | 1;
+}
+
+/*
+ * Replay the pattern the window manager produces when an X11 app keeps
+ * popping up override-redirect tooltips and menus: a set of long-lived
+ * client windows and their frames, plus a short FIFO of popups that
+ * are created, looked up by every event they receive, and destroyed.
+ * Ids only grow, so each removed id is never seen again.
+ */
+TEST(xwm_window_churn)
+{
+	struct bench_sample sample;
+	struct hash_table *ht;
+	uint32_t live[N_POPUPS_LIVE];
+	uint32_t next_id = CLIENT_BASE(1) + 2 * N_TOPLEVELS;
+	uint32_t id;
+	unsigned i, j;
+
+	ht = hash_table_create();
+	assert(ht);
+
+	for (i = 0; i < N_TOPLEVELS; i++) {
+		id = CLIENT_BASE(1) + 2 * i;
+		assert(hash_table_insert(ht, id, (void *)tag(id)) == 0);
+		/* the frame window the wm creates for it */
+		id = CLIENT_BASE(0) + i;
+		assert(hash_table_insert(ht, id, (void *)tag(id)) == 0);
+	}
+
+	for (i = 0; i < N_POPUPS_LIVE; i++) {
+		live[i] = next_id++;
+		assert(hash_table_insert(ht, live[i], (void *)tag(live[i])) == 0);
+	}
+
+	bench_begin(&sample, "xwm-hash", "churn");
+	for (i = 0; i < N_POPUPS; i++) {
+		uint32_t victim = live[i % N_POPUPS_LIVE];
+
+		for (j = 0; j < LOOKUPS_PER_POPUP; j++) {
+			id = live[(i + j) % N_POPUPS_LIVE];
+			assert(hash_table_lookup(ht, id) == (void *)tag(id));
+		}
+		/* late events for a popup destroyed before */
+		if (i >= N_POPUPS_LIVE)
+			assert(!hash_table_lookup(ht, victim - N_POPUPS_LIVE));
+
+		hash_table_remove(ht, victim);
+		live[i % N_POPUPS_LIVE] = next_id++;
+		assert(hash_table_insert(ht, live[i % N_POPUPS_LIVE],
+					 (void *)tag(live[i % N_POPUPS_LIVE])) == 0);
+	}
+	bench_end(&sample, N_POPUPS);
+
+	for (i = 0; i < N_TOPLEVELS; i++) {
+		id = CLIENT_BASE(1) + 2 * i;
+		assert(hash_table_lookup(ht, id) == (void *)tag(id));
+		id = CLIENT_BASE(0) + i;
+		assert(hash_table_lookup(ht, id) == (void *)tag(id));
+	}
+
+	hash_table_destroy(ht);
+}
@@ -0,0 +1,166 @@
+/*
+ * Copyright © 2022 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "weston-test-client-helper.h"
+#include "weston-test-fixture-compositor.h"
+#include "shared/os-compatibility.h"
+#include "shared/weston-drm-fourcc.h"
+#include "shared/xalloc.h"
+#include "bench-helper.h"
+
+#define YUV_WIDTH 512
+#define YUV_HEIGHT 384
+
+static enum test_result_code
+fixture_setup(struct weston_test_harness *harness)
+{
+	struct compositor_setup setup;
+
+	compositor_setup_defaults(&setup);
+	setup.renderer = RENDERER_GL;
+	setup.width = 640;
+	setup.height = 480;
+	setup.shell = SHELL_TEST_DESKTOP;
+	setup.benchmark = true;
+
+	return weston_test_harness_execute_as_client(harness, &setup);
+}
+DECLARE_FIXTURE_SETUP(fixture_setup);
+
+struct yuv_case {
+	uint32_t drm_format;
+	const char *drm_format_name;
+	/* bytes per row of the first plane */
+	int stride;
+	/* size of the first plane, rewritten every frame */
+	size_t plane0_bytes;
+	size_t bytes;
+};
+
+static const struct yuv_case yuv_cases[] = {
+#define FMT(x) DRM_FORMAT_ ##x, #x
+	{ FMT(YUV420), YUV_WIDTH, YUV_WIDTH * YUV_HEIGHT,
+	  YUV_WIDTH * YUV_HEIGHT * 3 / 2 },
+	{ FMT(NV12), YUV_WIDTH, YUV_WIDTH * YUV_HEIGHT,
+	  YUV_WIDTH * YUV_HEIGHT * 3 / 2 },
+	{ FMT(YUYV), YUV_WIDTH * 2, YUV_WIDTH * YUV_HEIGHT * 2,
+	  YUV_WIDTH * YUV_HEIGHT * 2 },
+#undef FMT
+};
+
+struct yuv_buffer {
+	void *data;
+	size_t bytes;
+	struct wl_buffer *proxy;
+};
+
+static struct yuv_buffer *
+yuv_buffer_create(struct client *client, const struct yuv_case *my_case)
+{
+	struct wl_shm_pool *pool;
+	struct yuv_buffer *buf;
+	int fd;
+
+	buf = xzalloc(sizeof *buf);
+	buf->bytes = my_case->bytes;
+
+	fd = os_create_anonymous_file(buf->bytes);
+	assert(fd >= 0);
+
+	buf->data = mmap(NULL, buf->bytes,
+			 PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (buf->data == MAP_FAILED) {
+		close(fd);
+		assert(buf->data != MAP_FAILED);
+	}
+
+	/* Neutral chroma, the luma is rewritten every frame. */
+	memset(buf->data, 0x80, buf->bytes);
+
+	pool = wl_shm_create_pool(client->wl_shm, fd, buf->bytes);
+	buf->proxy = wl_shm_pool_create_buffer(pool, 0, YUV_WIDTH, YUV_HEIGHT,
+					       my_case->stride,
+					       my_case->drm_format);
+	wl_shm_pool_destroy(pool);
+	close(fd);
+
+	return buf;
+}
+
+static void
+yuv_buffer_destroy(struct yuv_buffer *buf)
+{
+	wl_buffer_destroy(buf->proxy);
+	assert(munmap(buf->data, buf->bytes) == 0);
+	free(buf);
+}
+
+/*
+ * Commit freshly written YUV content every frame, measuring the upload
+ * and the colour conversion in the GL-renderer shaders. The buffers are
+ * wl_shm rather than dmabuf so that the benchmark does not depend on a
+ * buffer allocator being available to the test client.
+ */
+TEST_P(yuv_buffer_full_rate, yuv_cases)
+{
+	const struct yuv_case *my_case = data;
+	struct client *client;
+	struct yuv_buffer *buf;
+	struct bench_sample sample;
+	unsigned frame;
+	int done;
+
+	client = create_client();
+	client->surface = create_test_surface(client);
+	buf = yuv_buffer_create(client, my_case);
+
+	weston_test_move_surface(client->test->weston_test,
+				 client->surface->wl_surface, 40, 40);
+
+	bench_begin(&sample, "yuv-buffer", my_case->drm_format_name);
+
+	for (frame = 0; frame < BENCH_FRAMES; frame++) {
+		memset(buf->data, frame & 0xff, my_case->plane0_bytes);
+		wl_surface_attach(client->surface->wl_surface, buf->proxy, 0, 0);
+		wl_surface_damage(client->surface->wl_surface, 0, 0,
+				  YUV_WIDTH, YUV_HEIGHT);
+		frame_callback_set(client->surface->wl_surface, &done);
+		wl_surface_commit(client->surface->wl_surface);
+		frame_callback_wait(client, &done);
+	}
+
+	bench_end(&sample, BENCH_FRAMES);
+
+	yuv_buffer_destroy(buf);
+	client_destroy(client);
+}
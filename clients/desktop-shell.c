@@ -33,12 +33,14 @@
 #include <errno.h>
 #include <math.h>
 #include <cairo.h>
+#include <sys/stat.h>
 #include <sys/wait.h>
 #include <linux/input.h>
 #include <libgen.h>
 #include <ctype.h>
 #include <time.h>
 #include <assert.h>
+#include <pthread.h>
 
 #include <wayland-client.h>
 #include "window.h"
@@ -85,6 +87,37 @@ struct desktop {
 	enum cursor_type grab_cursor;
 
 	int painted;
+
+	struct wl_list image_cache;	/* image_cache_entry::link */
+};
+
+/* Scaled copies of a background image, one per output size in use */
+#define IMAGE_CACHE_MAX_VARIANTS 4
+
+/** A decoded image shared by the backgrounds and panels of all outputs
+ *
+ * Entries are keyed by path and invalidated when the file's modification
+ * time or size changes. The decode may still be running on a worker
+ * thread while decoding is set.
+ */
+struct image_cache_entry {
+	char *path;
+	struct timespec mtime;
+	off_t size;
+
+	cairo_surface_t *image;		/* NULL if decoding failed */
+	pthread_t thread;
+	bool decoding;
+
+	struct wl_list variant_list;	/* image_variant::link, MRU first */
+	struct wl_list link;		/* desktop::image_cache */
+};
+
+struct image_variant {
+	int32_t width, height;
+	int type;
+	cairo_surface_t *surface;
+	struct wl_list link;		/* image_cache_entry::variant_list */
 };
 
 struct surface {
@@ -141,6 +174,8 @@ struct panel_launcher {
 	struct panel *panel;
 	cairo_surface_t *icon;
 	int focused, pressed;
+	/* Only this launcher changed, see panel_launcher_schedule_redraw() */
+	int damaged;
 	char *path;
 	struct wl_list link;
 	struct wl_array envp;
@@ -153,6 +188,7 @@ struct panel_clock {
 	struct toytimer timer;
 	char *format_string;
 	time_t refresh_timer;
+	char drawn[128];
 };
 
 struct unlock_dialog {
@@ -235,6 +271,16 @@ panel_launcher_activate(struct panel_launcher *widget)
 	}
 }
 
+/* The panel is repainted as a whole, but only the launcher whose state
+ * changed is posted as damage, so the compositor does not upload the
+ * full width of the panel for a hover highlight. */
+static void
+panel_launcher_schedule_redraw(struct panel_launcher *launcher)
+{
+	launcher->damaged = 1;
+	widget_schedule_partial_redraw(launcher->widget);
+}
+
 static void
 panel_launcher_redraw_handler(struct widget *widget, void *data)
 {
@@ -245,6 +291,11 @@ panel_launcher_redraw_handler(struct widget *widget, void *data)
 	cr = widget_cairo_create(launcher->panel->widget);
 
 	widget_get_allocation(widget, &allocation);
+	if (launcher->damaged) {
+		widget_add_damage(widget, allocation.x, allocation.y,
+				  allocation.width, allocation.height);
+		launcher->damaged = 0;
+	}
 	allocation.x += allocation.width / 2 -
 		cairo_image_surface_get_width(launcher->icon) / 2;
 	if (allocation.width > allocation.height)
@@ -318,7 +369,7 @@ panel_launcher_enter_handler(struct widget *widget, struct input *input,
 	struct panel_launcher *launcher = data;
 
 	launcher->focused = 1;
-	widget_schedule_redraw(widget);
+	panel_launcher_schedule_redraw(launcher);
 
 	return CURSOR_LEFT_PTR;
 }
@@ -331,7 +382,7 @@ panel_launcher_leave_handler(struct widget *widget,
 
 	launcher->focused = 0;
 	widget_destroy_tooltip(widget);
-	widget_schedule_redraw(widget);
+	panel_launcher_schedule_redraw(launcher);
 }
 
 static void
@@ -343,7 +394,7 @@ panel_launcher_button_handler(struct widget *widget,
 	struct panel_launcher *launcher;
 
 	launcher = widget_get_user_data(widget);
-	widget_schedule_redraw(widget);
+	panel_launcher_schedule_redraw(launcher);
 	if (state == WL_POINTER_BUTTON_STATE_RELEASED)
 		panel_launcher_activate(launcher);
 
@@ -358,7 +409,7 @@ panel_launcher_touch_down_handler(struct widget *widget, struct input *input,
 
 	launcher = widget_get_user_data(widget);
 	launcher->focused = 1;
-	widget_schedule_redraw(widget);
+	panel_launcher_schedule_redraw(launcher);
 }
 
 static void
@@ -370,7 +421,7 @@ panel_launcher_touch_up_handler(struct widget *widget, struct input *input,
 
 	launcher = widget_get_user_data(widget);
 	launcher->focused = 0;
-	widget_schedule_redraw(widget);
+	panel_launcher_schedule_redraw(launcher);
 	panel_launcher_activate(launcher);
 }
 
@@ -379,7 +430,8 @@ clock_func(struct toytimer *tt)
 {
 	struct panel_clock *clock = container_of(tt, struct panel_clock, timer);
 
-	widget_schedule_redraw(clock->widget);
+	/* Only the clock text changes on a tick. */
+	widget_schedule_partial_redraw(clock->widget);
 }
 
 static void
@@ -401,6 +453,14 @@ panel_clock_redraw_handler(struct widget *widget, void *data)
 	if (allocation.width == 0)
 		return;
 
+	/* Damage the clock whenever its text changed, whichever redraw
+	 * got to draw the new time first. */
+	if (strcmp(string, clock->drawn) != 0) {
+		widget_add_damage(widget, allocation.x, allocation.y,
+				  allocation.width, allocation.height);
+		snprintf(clock->drawn, sizeof clock->drawn, "%s", string);
+	}
+
 	cr = widget_cairo_create(clock->panel->widget);
 	cairo_set_font_size(cr, 14);
 	cairo_text_extents(cr, string, &extents);
@@ -617,6 +677,7 @@ panel_create(struct desktop *desktop, struct output *output)
 	panel->owner = output;
 	panel->base.configure = panel_configure;
 	panel->window = window_create_custom(desktop->display);
+	window_set_buffer_type(panel->window, WINDOW_BUFFER_TYPE_DMABUF);
 	panel->widget = window_add_widget(panel->window, panel);
 	wl_list_init(&panel->launcher_list);
 
@@ -640,20 +701,143 @@ panel_create(struct desktop *desktop, struct output *output)
 	return panel;
 }
 
+static void *
+image_decode_thread(void *data)
+{
+	struct image_cache_entry *entry = data;
+
+	entry->image = load_cairo_surface(entry->path);
+
+	return NULL;
+}
+
+static void
+image_cache_entry_finish_decode(struct image_cache_entry *entry)
+{
+	if (!entry->decoding)
+		return;
+
+	pthread_join(entry->thread, NULL);
+	entry->decoding = false;
+}
+
+static void
+image_variant_destroy(struct image_variant *variant)
+{
+	cairo_surface_destroy(variant->surface);
+	wl_list_remove(&variant->link);
+	free(variant);
+}
+
+static void
+image_cache_entry_destroy(struct image_cache_entry *entry)
+{
+	struct image_variant *variant, *tmp;
+
+	image_cache_entry_finish_decode(entry);
+
+	wl_list_for_each_safe(variant, tmp, &entry->variant_list, link)
+		image_variant_destroy(variant);
+
+	if (entry->image)
+		cairo_surface_destroy(entry->image);
+	wl_list_remove(&entry->link);
+	free(entry->path);
+	free(entry);
+}
+
+static struct image_cache_entry *
+image_cache_add(struct desktop *desktop, const char *path,
+		const struct stat *st, bool async)
+{
+	struct image_cache_entry *entry;
+
+	entry = xzalloc(sizeof *entry);
+	entry->path = xstrdup(path);
+	entry->mtime = st->st_mtim;
+	entry->size = st->st_size;
+	wl_list_init(&entry->variant_list);
+	wl_list_insert(&desktop->image_cache, &entry->link);
+
+	if (async &&
+	    pthread_create(&entry->thread, NULL, image_decode_thread, entry) == 0)
+		entry->decoding = true;
+	else
+		entry->image = load_cairo_surface(path);
+
+	return entry;
+}
+
+/* Failures are cached too, until the file changes, so that redraws do not
+ * retry a broken file over and over. */
+static struct image_cache_entry *
+image_cache_lookup(struct desktop *desktop, const char *path, bool async)
+{
+	struct image_cache_entry *entry;
+	struct stat st;
+
+	if (stat(path, &st) < 0)
+		memset(&st, 0, sizeof st);
+
+	wl_list_for_each(entry, &desktop->image_cache, link) {
+		if (strcmp(entry->path, path) != 0)
+			continue;
+
+		if (entry->size == st.st_size &&
+		    timespec_eq(&entry->mtime, &st.st_mtim))
+			return entry;
+
+		image_cache_entry_destroy(entry);
+		break;
+	}
+
+	return image_cache_add(desktop, path, &st, async);
+}
+
+/** Start decoding an image in the background, ahead of its first use */
+static void
+image_cache_prefetch(struct desktop *desktop, const char *path)
+{
+	if (path && *path)
+		image_cache_lookup(desktop, path, true);
+}
+
+/** Get a new reference to a decoded image, or NULL */
 static cairo_surface_t *
-load_icon_or_fallback(const char *icon)
+image_cache_get(struct desktop *desktop, const char *path)
+{
+	struct image_cache_entry *entry;
+
+	if (!path || !*path)
+		return NULL;
+
+	entry = image_cache_lookup(desktop, path, false);
+	image_cache_entry_finish_decode(entry);
+	if (!entry->image)
+		return NULL;
+
+	return cairo_surface_reference(entry->image);
+}
+
+static void
+image_cache_destroy(struct desktop *desktop)
 {
-	cairo_surface_t *surface = cairo_image_surface_create_from_png(icon);
-	cairo_status_t status;
+	struct image_cache_entry *entry, *tmp;
+
+	wl_list_for_each_safe(entry, tmp, &desktop->image_cache, link)
+		image_cache_entry_destroy(entry);
+}
+
+static cairo_surface_t *
+load_icon_or_fallback(struct desktop *desktop, const char *icon)
+{
+	cairo_surface_t *surface = image_cache_get(desktop, icon);
 	cairo_t *cr;
 
-	status = cairo_surface_status(surface);
-	if (status == CAIRO_STATUS_SUCCESS)
+	if (surface)
 		return surface;
 
-	cairo_surface_destroy(surface);
-	fprintf(stderr, "ERROR loading icon from file '%s', error: '%s'\n",
-		icon, cairo_status_to_string(status));
+	fprintf(stderr, "ERROR loading icon from file '%s'\n", icon);
 
 	/* draw fallback icon */
 	surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32,
@@ -678,14 +862,15 @@ load_icon_or_fallback(const char *icon)
 }
 
 static void
-panel_add_launcher(struct panel *panel, const char *icon, const char *path)
+panel_add_launcher(struct panel *panel, struct desktop *desktop,
+		   const char *icon, const char *path)
 {
 	struct panel_launcher *launcher;
 	char *start, *p, *eq, **ps;
 	int i, j, k;
 
 	launcher = xzalloc(sizeof *launcher);
-	launcher->icon = load_icon_or_fallback(icon);
+	launcher->icon = load_icon_or_fallback(desktop, icon);
 	launcher->path = xstrdup(path);
 
 	wl_array_init(&launcher->envp);
@@ -758,18 +943,145 @@ enum {
 	BACKGROUND_CENTERED
 };
 
+/* The image to draw when no background image is configured, or NULL */
+static char *
+background_get_image_path(const char *image, uint32_t color)
+{
+	if (image)
+		return xstrdup(image);
+	if (color == 0)
+		return file_name_with_datadir("pattern.png");
+	return NULL;
+}
+
 static void
-background_draw(struct widget *widget, void *data)
+background_set_pattern_transform(cairo_pattern_t *pattern, int type,
+				 double im_w, double im_h,
+				 const struct rectangle *allocation)
 {
-	struct background *background = data;
-	cairo_surface_t *surface, *image;
-	cairo_pattern_t *pattern;
 	cairo_matrix_t matrix;
-	cairo_t *cr;
-	double im_w, im_h;
 	double sx, sy, s;
 	double tx, ty;
+
+	sx = im_w / allocation->width;
+	sy = im_h / allocation->height;
+
+	switch (type) {
+	case BACKGROUND_SCALE:
+		cairo_matrix_init_scale(&matrix, sx, sy);
+		cairo_pattern_set_matrix(pattern, &matrix);
+		cairo_pattern_set_extend(pattern, CAIRO_EXTEND_PAD);
+		break;
+	case BACKGROUND_SCALE_CROP:
+		s = (sx < sy) ? sx : sy;
+		/* align center */
+		tx = (im_w - s * allocation->width) * 0.5;
+		ty = (im_h - s * allocation->height) * 0.5;
+		cairo_matrix_init_translate(&matrix, tx, ty);
+		cairo_matrix_scale(&matrix, s, s);
+		cairo_pattern_set_matrix(pattern, &matrix);
+		cairo_pattern_set_extend(pattern, CAIRO_EXTEND_PAD);
+		break;
+	case BACKGROUND_TILE:
+		cairo_pattern_set_extend(pattern, CAIRO_EXTEND_REPEAT);
+		break;
+	case BACKGROUND_CENTERED:
+		s = (sx < sy) ? sx : sy;
+		if (s < 1.0)
+			s = 1.0;
+
+		/* align center */
+		tx = (im_w - s * allocation->width) * 0.5;
+		ty = (im_h - s * allocation->height) * 0.5;
+
+		cairo_matrix_init_translate(&matrix, tx, ty);
+		cairo_matrix_scale(&matrix, s, s);
+		cairo_pattern_set_matrix(pattern, &matrix);
+		break;
+	}
+}
+
+/** Get the background image already scaled to the allocation
+ *
+ * Tiled images are drawn from the decoded image directly. The other
+ * types are resampled once per output size, so that redraws and outputs
+ * of the same size only copy pixels.
+ */
+static cairo_pattern_t *
+background_get_pattern(struct desktop *desktop, const char *path, int type,
+		       const struct rectangle *allocation)
+{
+	struct image_cache_entry *entry;
+	struct image_variant *variant;
+	cairo_pattern_t *pattern;
+	cairo_t *cr;
+
+	entry = image_cache_lookup(desktop, path, false);
+	image_cache_entry_finish_decode(entry);
+	if (!entry->image)
+		return NULL;
+
+	if (type == BACKGROUND_TILE) {
+		pattern = cairo_pattern_create_for_surface(entry->image);
+		background_set_pattern_transform(pattern, type,
+			cairo_image_surface_get_width(entry->image),
+			cairo_image_surface_get_height(entry->image),
+			allocation);
+		return pattern;
+	}
+
+	wl_list_for_each(variant, &entry->variant_list, link) {
+		if (variant->type == type &&
+		    variant->width == allocation->width &&
+		    variant->height == allocation->height) {
+			wl_list_remove(&variant->link);
+			wl_list_insert(&entry->variant_list, &variant->link);
+			return cairo_pattern_create_for_surface(variant->surface);
+		}
+	}
+
+	if (wl_list_length(&entry->variant_list) >= IMAGE_CACHE_MAX_VARIANTS) {
+		variant = container_of(entry->variant_list.prev,
+				       struct image_variant, link);
+		image_variant_destroy(variant);
+	}
+
+	variant = xzalloc(sizeof *variant);
+	variant->type = type;
+	variant->width = allocation->width;
+	variant->height = allocation->height;
+	variant->surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32,
+						      allocation->width,
+						      allocation->height);
+	wl_list_insert(&entry->variant_list, &variant->link);
+
+	pattern = cairo_pattern_create_for_surface(entry->image);
+	background_set_pattern_transform(pattern, type,
+		cairo_image_surface_get_width(entry->image),
+		cairo_image_surface_get_height(entry->image),
+		allocation);
+
+	cr = cairo_create(variant->surface);
+	cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
+	cairo_set_source(cr, pattern);
+	cairo_paint(cr);
+	cairo_destroy(cr);
+	cairo_pattern_destroy(pattern);
+
+	return cairo_pattern_create_for_surface(variant->surface);
+}
+
+static void
+background_draw(struct widget *widget, void *data)
+{
+	struct background *background = data;
+	struct desktop *desktop =
+		display_get_user_data(window_get_display(background->window));
+	cairo_surface_t *surface;
+	cairo_pattern_t *pattern = NULL;
+	cairo_t *cr;
 	struct rectangle allocation;
+	char *path;
 
 	surface = window_get_surface(background->window);
 
@@ -782,62 +1094,16 @@ background_draw(struct widget *widget, void *data)
 	cairo_paint(cr);
 
 	widget_get_allocation(widget, &allocation);
-	image = NULL;
-	if (background->image)
-		image = load_cairo_surface(background->image);
-	else if (background->color == 0) {
-		char *name = file_name_with_datadir("pattern.png");
-
-		image = load_cairo_surface(name);
-		free(name);
-	}
-
-	if (image && background->type != -1) {
-		im_w = cairo_image_surface_get_width(image);
-		im_h = cairo_image_surface_get_height(image);
-		sx = im_w / allocation.width;
-		sy = im_h / allocation.height;
-
-		pattern = cairo_pattern_create_for_surface(image);
-
-		switch (background->type) {
-		case BACKGROUND_SCALE:
-			cairo_matrix_init_scale(&matrix, sx, sy);
-			cairo_pattern_set_matrix(pattern, &matrix);
-			cairo_pattern_set_extend(pattern, CAIRO_EXTEND_PAD);
-			break;
-		case BACKGROUND_SCALE_CROP:
-			s = (sx < sy) ? sx : sy;
-			/* align center */
-			tx = (im_w - s * allocation.width) * 0.5;
-			ty = (im_h - s * allocation.height) * 0.5;
-			cairo_matrix_init_translate(&matrix, tx, ty);
-			cairo_matrix_scale(&matrix, s, s);
-			cairo_pattern_set_matrix(pattern, &matrix);
-			cairo_pattern_set_extend(pattern, CAIRO_EXTEND_PAD);
-			break;
-		case BACKGROUND_TILE:
-			cairo_pattern_set_extend(pattern, CAIRO_EXTEND_REPEAT);
-			break;
-		case BACKGROUND_CENTERED:
-			s = (sx < sy) ? sx : sy;
-			if (s < 1.0)
-				s = 1.0;
-
-			/* align center */
-			tx = (im_w - s * allocation.width) * 0.5;
-			ty = (im_h - s * allocation.height) * 0.5;
-
-			cairo_matrix_init_translate(&matrix, tx, ty);
-			cairo_matrix_scale(&matrix, s, s);
-			cairo_pattern_set_matrix(pattern, &matrix);
-			break;
-		}
+	path = background_get_image_path(background->image, background->color);
+	if (path && background->type != -1)
+		pattern = background_get_pattern(desktop, path,
+						 background->type, &allocation);
+	free(path);
 
+	if (pattern) {
 		cairo_set_source(cr, pattern);
-		cairo_pattern_destroy (pattern);
-		cairo_surface_destroy(image);
 		cairo_mask(cr, pattern);
+		cairo_pattern_destroy(pattern);
 	}
 
 	cairo_destroy(cr);
@@ -1157,6 +1423,9 @@ background_create(struct desktop *desktop, struct output *output)
 	background->owner = output;
 	background->base.configure = background_configure;
 	background->window = window_create_custom(desktop->display);
+	/* Lets the compositor scan the background out, or at least import
+	 * it without a full-screen texture upload on every change. */
+	window_set_buffer_type(background->window, WINDOW_BUFFER_TYPE_DMABUF);
 	background->widget = window_add_widget(background->window, background);
 	window_set_user_data(background->window, background);
 	widget_set_redraw_handler(background->widget, background_draw);
@@ -1461,7 +1730,7 @@ panel_add_launchers(struct panel *panel, struct desktop *desktop)
 		weston_config_section_get_string(s, "path", &path, NULL);
 
 		if (icon != NULL && path != NULL) {
-			panel_add_launcher(panel, icon, path);
+			panel_add_launcher(panel, desktop, icon, path);
 			count++;
 		} else {
 			fprintf(stderr, "invalid launcher section\n");
@@ -1475,13 +1744,41 @@ panel_add_launchers(struct panel *panel, struct desktop *desktop)
 		char *name = file_name_with_datadir("terminal.png");
 
 		/* add default launcher */
-		panel_add_launcher(panel,
+		panel_add_launcher(panel, desktop,
 				   name,
 				   BINDIR "/weston-terminal");
 		free(name);
 	}
 }
 
+/* Decode the background and launcher icons while we connect and wait for
+ * the outputs, instead of when the first background is drawn. */
+static void
+desktop_prefetch_images(struct desktop *desktop, struct weston_config_section *s)
+{
+	struct weston_config_section *section = NULL;
+	const char *name;
+	char *image, *path;
+	uint32_t color;
+
+	weston_config_section_get_string(s, "background-image", &image, NULL);
+	weston_config_section_get_color(s, "background-color", &color,
+					0x00000000);
+	path = background_get_image_path(image, color);
+	image_cache_prefetch(desktop, path);
+	free(path);
+	free(image);
+
+	while (weston_config_next_section(desktop->config, &section, &name)) {
+		if (strcmp(name, "launcher") != 0)
+			continue;
+
+		weston_config_section_get_string(section, "icon", &path, NULL);
+		image_cache_prefetch(desktop, path);
+		free(path);
+	}
+}
+
 static void
 parse_panel_position(struct desktop *desktop, struct weston_config_section *s)
 {
@@ -1537,6 +1834,7 @@ int main(int argc, char *argv[])
 
 	desktop.unlock_task.run = unlock_dialog_finish;
 	wl_list_init(&desktop.outputs);
+	wl_list_init(&desktop.image_cache);
 
 	config_file = weston_config_get_name_from_env();
 	desktop.config = weston_config_parse(config_file);
@@ -1544,6 +1842,7 @@ int main(int argc, char *argv[])
 	weston_config_section_get_bool(s, "locking", &desktop.locking, true);
 	parse_panel_position(&desktop, s);
 	parse_clock_format(&desktop, s);
+	desktop_prefetch_images(&desktop, s);
 
 	desktop.display = display_create(&argc, argv);
 	if (desktop.display == NULL) {
@@ -1574,6 +1873,7 @@ int main(int argc, char *argv[])
 	/* Cleanup */
 	grab_surface_destroy(&desktop);
 	desktop_destroy_outputs(&desktop);
+	image_cache_destroy(&desktop);
 	if (desktop.unlock_dialog)
 		unlock_dialog_destroy(desktop.unlock_dialog);
 	weston_desktop_shell_destroy(desktop.shell);
@@ -36,6 +36,7 @@
 #include <signal.h>
 #include <time.h>
 #include <errno.h>
+#include <linux/input.h>
 
 #include <wayland-client.h>
 #include "shared/helpers.h"
@@ -43,20 +44,34 @@
 #include "shared/timespec-util.h"
 #include "shared/os-compatibility.h"
 #include "presentation-time-client-protocol.h"
+#include "weston-test-client-protocol.h"
 #include "xdg-shell-client-protocol.h"
 
 enum run_mode {
 	RUN_MODE_FEEDBACK,
 	RUN_MODE_FEEDBACK_IDLE,
 	RUN_MODE_PRESENT,
+	RUN_MODE_INPUT,
 };
 
 static const char * const run_mode_name[] = {
 	[RUN_MODE_FEEDBACK] = "feedback",
 	[RUN_MODE_FEEDBACK_IDLE] = "feedback-idle",
 	[RUN_MODE_PRESENT] = "low-lat present",
+	[RUN_MODE_INPUT] = "input",
 };
 
+/* Names of the modes in a harness script */
+static const char * const run_mode_script_name[] = {
+	[RUN_MODE_FEEDBACK] = "feedback",
+	[RUN_MODE_FEEDBACK_IDLE] = "feedback-idle",
+	[RUN_MODE_PRESENT] = "low-lat",
+	[RUN_MODE_INPUT] = "input",
+};
+
+/* Width of the latency histogram buckets */
+#define HISTOGRAM_BUCKET_USEC 1000
+
 struct output {
 	struct wl_output *output;
 	uint32_t name;
@@ -76,6 +91,12 @@ struct display {
 	clockid_t clk_id;
 
 	struct wl_list output_list; /* struct output::link */
+
+	/* only for the input mode */
+	struct weston_test *test;
+	struct wl_seat *seat;
+	uint32_t seat_caps;
+	struct wl_keyboard *keyboard;
 };
 
 struct feedback {
@@ -87,6 +108,33 @@ struct feedback {
 	uint32_t frame_stamp;
 	struct wl_list link;
 	struct timespec present;
+
+	unsigned run; /* index in harness::runs */
+	bool has_input;
+	struct timespec input;
+};
+
+/** Latencies of one mode of a harness script, in microseconds */
+struct harness_run {
+	enum run_mode mode;
+	struct wl_array commit_to_present; /* uint32_t */
+	struct wl_array input_to_present; /* uint32_t */
+	unsigned discarded;
+	int refresh_nsec;
+};
+
+/** A scripted sequence of modes, each run for a number of frames
+ *
+ * Instead of printing every frame, the collected latencies are written
+ * as one JSON object when the last mode is done.
+ */
+struct harness {
+	struct harness_run *runs;
+	unsigned run_count;
+	unsigned current;
+	unsigned frames;
+	bool finished;
+	bool reported;
 };
 
 struct buffer {
@@ -112,12 +160,24 @@ struct window {
 
 	struct wl_callback *callback;
 	struct wl_list feedback_list;
+	unsigned feedback_pending;
 
 	struct feedback *received_feedback;
+
+	struct harness *harness;
+	unsigned run_frames;
+
+	struct timespec input_time;
+	bool input_pending;
 };
 
 #define NSEC_PER_SEC 1000000000
 
+static int running = 1;
+
+static void
+window_start(struct window *window);
+
 static void
 buffer_release(void *data, struct wl_buffer *buffer)
 {
@@ -432,6 +492,135 @@ timespec_diff_to_usec(const struct timespec *a, const struct timespec *b)
 	return secs * 1000000 + nsec / 1000;
 }
 
+static int
+compare_uint32(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a;
+	uint32_t y = *(const uint32_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void
+print_latency_json(const char *name, struct wl_array *samples)
+{
+	uint32_t *v = samples->data;
+	size_t n = samples->size / sizeof *v;
+	uint32_t bucket;
+	unsigned count;
+	size_t i;
+
+	printf(",\n      \"%s\": ", name);
+	if (n == 0) {
+		printf("null");
+		return;
+	}
+
+	qsort(v, n, sizeof *v, compare_uint32);
+
+	printf("{\"count\": %zu, \"min\": %u, \"p50\": %u, "
+	       "\"p90\": %u, \"p99\": %u, \"max\": %u,\n"
+	       "        \"histogram_bucket_us\": %d, \"histogram\": [",
+	       n, v[0], v[n / 2], v[n * 9 / 10], v[n * 99 / 100], v[n - 1],
+	       HISTOGRAM_BUCKET_USEC);
+
+	/* [ bucket start, count ] for the non-empty buckets only */
+	for (i = 0; i < n; i += count) {
+		bucket = v[i] / HISTOGRAM_BUCKET_USEC;
+		for (count = 0; i + count < n; count++) {
+			if (v[i + count] / HISTOGRAM_BUCKET_USEC != bucket)
+				break;
+		}
+		printf("%s[%u, %u]", i == 0 ? "" : ", ",
+		       bucket * HISTOGRAM_BUCKET_USEC, count);
+	}
+	printf("]}");
+}
+
+static void
+harness_report(struct harness *harness)
+{
+	struct harness_run *run;
+	unsigned i;
+
+	printf("{\n  \"frames_per_run\": %u,\n  \"runs\": [", harness->frames);
+	for (i = 0; i < harness->run_count; i++) {
+		run = &harness->runs[i];
+		printf("%s\n    {\"mode\": \"%s\", \"refresh_nsec\": %d, "
+		       "\"discarded\": %u", i == 0 ? "" : ",",
+		       run_mode_script_name[run->mode], run->refresh_nsec,
+		       run->discarded);
+		print_latency_json("commit_to_present_us",
+				   &run->commit_to_present);
+		print_latency_json("input_to_present_us",
+				   &run->input_to_present);
+		printf("}");
+	}
+	printf("\n  ]\n}\n");
+	fflush(stdout);
+}
+
+static bool
+harness_run_done(struct window *window)
+{
+	return window->harness && window->run_frames >= window->harness->frames;
+}
+
+/* The report waits for the feedback of the frames already committed. */
+static void
+harness_maybe_finish(struct window *window)
+{
+	struct harness *harness = window->harness;
+
+	if (!harness || !harness->finished || harness->reported ||
+	    window->feedback_pending > 0)
+		return;
+
+	harness_report(harness);
+	harness->reported = true;
+	running = 0;
+}
+
+static void
+harness_next_run(struct window *window)
+{
+	struct harness *harness = window->harness;
+
+	harness->current++;
+	if (harness->current == harness->run_count) {
+		harness->finished = true;
+		harness_maybe_finish(window);
+		return;
+	}
+
+	window->mode = harness->runs[harness->current].mode;
+	window->run_frames = 0;
+	window_start(window);
+}
+
+static void
+harness_record(struct window *window, struct feedback *feedback)
+{
+	struct harness_run *run = &window->harness->runs[feedback->run];
+	uint32_t *v;
+
+	run->refresh_nsec = window->refresh_nsec;
+
+	v = wl_array_add(&run->commit_to_present, sizeof *v);
+	if (v)
+		*v = timespec_diff_to_usec(&feedback->present, &feedback->commit);
+
+	if (!feedback->has_input)
+		return;
+
+	v = wl_array_add(&run->input_to_present, sizeof *v);
+	if (v)
+		*v = timespec_diff_to_usec(&feedback->present, &feedback->input);
+}
+
+static void
+window_input_next(struct window *window);
+
 static void
 feedback_presented(void *data,
 		   struct wp_presentation_feedback *presentation_feedback,
@@ -468,24 +657,42 @@ feedback_presented(void *data,
 	p2p = timespec_diff_to_usec(&feedback->present, prevpresent);
 	t2p = timespec_diff_to_usec(&feedback->present, &feedback->target);
 
-	switch (window->mode) {
-	case RUN_MODE_PRESENT:
-		printf("%6u: c2p %4u ms, p2p %5d us, t2p %6d us, [%s] "
-			"seq %" PRIu64 "\n", feedback->frame_no, c2p,
-			p2p, t2p,
-			pflags_to_str(flags, flagstr, sizeof(flagstr)), seq);
-		break;
-	case RUN_MODE_FEEDBACK:
-	case RUN_MODE_FEEDBACK_IDLE:
-		printf("%6u: f2c %2u ms, c2p %2u ms, f2p %2u ms, p2p %5d us, "
-			"t2p %6d, [%s], seq %" PRIu64 "\n", feedback->frame_no,
-			f2c, c2p, f2p, p2p, t2p,
-			pflags_to_str(flags, flagstr, sizeof(flagstr)), seq);
+	window->feedback_pending--;
+
+	if (window->harness) {
+		harness_record(window, feedback);
+	} else {
+		switch (window->mode) {
+		case RUN_MODE_PRESENT:
+		case RUN_MODE_INPUT:
+			printf("%6u: c2p %4u ms, p2p %5d us, t2p %6d us, "
+				"[%s] seq %" PRIu64 "\n", feedback->frame_no,
+				c2p, p2p, t2p,
+				pflags_to_str(flags, flagstr, sizeof(flagstr)),
+				seq);
+			break;
+		case RUN_MODE_FEEDBACK:
+		case RUN_MODE_FEEDBACK_IDLE:
+			printf("%6u: f2c %2u ms, c2p %2u ms, f2p %2u ms, "
+				"p2p %5d us, t2p %6d, [%s], seq %" PRIu64 "\n",
+				feedback->frame_no, f2c, c2p, f2p, p2p, t2p,
+				pflags_to_str(flags, flagstr, sizeof(flagstr)),
+				seq);
+		}
+		if (feedback->has_input)
+			printf("%6u: i2p %6d us\n", feedback->frame_no,
+			       timespec_diff_to_usec(&feedback->present,
+						     &feedback->input));
 	}
 
 	if (window->received_feedback)
 		destroy_feedback(window->received_feedback);
 	window->received_feedback = feedback;
+
+	if (feedback->has_input)
+		window_input_next(window);
+
+	harness_maybe_finish(window);
 }
 
 static void
@@ -493,10 +700,22 @@ feedback_discarded(void *data,
 		   struct wp_presentation_feedback *presentation_feedback)
 {
 	struct feedback *feedback = data;
+	struct window *window = feedback->window;
+	bool has_input = feedback->has_input;
 
-	printf("discarded %u\n", feedback->frame_no);
+	window->feedback_pending--;
+
+	if (window->harness)
+		window->harness->runs[feedback->run].discarded++;
+	else
+		printf("discarded %u\n", feedback->frame_no);
 
 	destroy_feedback(feedback);
+
+	if (has_input)
+		window_input_next(window);
+
+	harness_maybe_finish(window);
 }
 
 static const struct wp_presentation_feedback_listener feedback_listener = {
@@ -522,7 +741,7 @@ window_emulate_rendering(struct window *window)
 		printf("nanosleep failed: %s\n", strerror(errno));
 }
 
-static void
+static struct feedback *
 window_create_feedback(struct window *window, uint32_t frame_stamp)
 {
 	static unsigned seq;
@@ -532,11 +751,11 @@ window_create_feedback(struct window *window, uint32_t frame_stamp)
 	seq++;
 
 	if (!pres)
-		return;
+		return NULL;
 
 	feedback = zalloc(sizeof *feedback);
 	if (!feedback)
-		return;
+		return NULL;
 
 	feedback->window = window;
 	feedback->feedback = wp_presentation_feedback(pres, window->surface);
@@ -544,12 +763,18 @@ window_create_feedback(struct window *window, uint32_t frame_stamp)
 					      &feedback_listener, feedback);
 
 	feedback->frame_no = seq;
+	if (window->harness)
+		feedback->run = window->harness->current;
+	window->run_frames++;
+	window->feedback_pending++;
 
 	clock_gettime(window->display->clk_id, &feedback->commit);
 	feedback->frame_stamp = frame_stamp;
 	feedback->target = feedback->commit;
 
 	wl_list_insert(&window->feedback_list, &feedback->link);
+
+	return feedback;
 }
 
 static void
@@ -579,6 +804,13 @@ redraw_mode_feedback(void *data, struct wl_callback *callback, uint32_t time)
 {
 	struct window *window = data;
 
+	if (callback && harness_run_done(window)) {
+		wl_callback_destroy(callback);
+		window->callback = NULL;
+		harness_next_run(window);
+		return;
+	}
+
 	if (callback && window->mode == RUN_MODE_FEEDBACK_IDLE)
 		sleep(1);
 
@@ -630,6 +862,10 @@ feedkick_presented(void *data,
 
 	switch (window->mode) {
 	case RUN_MODE_PRESENT:
+		if (harness_run_done(window)) {
+			harness_next_run(window);
+			break;
+		}
 		window_emulate_rendering(window);
 		window_create_feedback(window, 0);
 		window_feedkick(window);
@@ -637,6 +873,7 @@ feedkick_presented(void *data,
 		break;
 	case RUN_MODE_FEEDBACK:
 	case RUN_MODE_FEEDBACK_IDLE:
+	case RUN_MODE_INPUT:
 		assert(0 && "bad mode");
 	}
 }
@@ -651,6 +888,10 @@ feedkick_discarded(void *data,
 
 	switch (window->mode) {
 	case RUN_MODE_PRESENT:
+		if (harness_run_done(window)) {
+			harness_next_run(window);
+			break;
+		}
 		window_emulate_rendering(window);
 		window_create_feedback(window, 0);
 		window_feedkick(window);
@@ -658,6 +899,7 @@ feedkick_discarded(void *data,
 		break;
 	case RUN_MODE_FEEDBACK:
 	case RUN_MODE_FEEDBACK_IDLE:
+	case RUN_MODE_INPUT:
 		assert(0 && "bad mode");
 	}
 }
@@ -679,6 +921,7 @@ firstdraw_mode_burst(struct window *window)
 		break;
 	case RUN_MODE_FEEDBACK:
 	case RUN_MODE_FEEDBACK_IDLE:
+	case RUN_MODE_INPUT:
 		assert(0 && "bad mode");
 	}
 
@@ -686,6 +929,76 @@ firstdraw_mode_burst(struct window *window)
 	window_commit_next(window);
 }
 
+/* Inject a key press through the test protocol; the frame drawn in
+ * response is what input-to-present is measured with. */
+static void
+window_input_kick(struct window *window)
+{
+	struct weston_test *test = window->display->test;
+	uint32_t sec_hi, sec_lo, nsec;
+
+	clock_gettime(window->display->clk_id, &window->input_time);
+	timespec_to_proto(&window->input_time, &sec_hi, &sec_lo, &nsec);
+
+	window->input_pending = true;
+	weston_test_send_key(test, sec_hi, sec_lo, nsec, KEY_A,
+			     WL_KEYBOARD_KEY_STATE_PRESSED);
+	weston_test_send_key(test, sec_hi, sec_lo, nsec, KEY_A,
+			     WL_KEYBOARD_KEY_STATE_RELEASED);
+}
+
+static void
+window_input_next(struct window *window)
+{
+	if (window->mode != RUN_MODE_INPUT)
+		return;
+
+	if (harness_run_done(window))
+		harness_next_run(window);
+	else
+		window_input_kick(window);
+}
+
+static void
+window_input_draw(struct window *window)
+{
+	struct feedback *feedback;
+
+	window->input_pending = false;
+
+	window_emulate_rendering(window);
+	feedback = window_create_feedback(window, 0);
+	if (feedback) {
+		feedback->has_input = true;
+		feedback->input = window->input_time;
+	}
+	window_commit_next(window);
+}
+
+static void
+firstdraw_mode_input(struct window *window)
+{
+	weston_test_activate_surface(window->display->test, window->surface);
+	window_input_kick(window);
+}
+
+static void
+window_start(struct window *window)
+{
+	switch (window->mode) {
+	case RUN_MODE_FEEDBACK:
+	case RUN_MODE_FEEDBACK_IDLE:
+		redraw_mode_feedback(window, NULL, 0);
+		break;
+	case RUN_MODE_PRESENT:
+		firstdraw_mode_burst(window);
+		break;
+	case RUN_MODE_INPUT:
+		firstdraw_mode_input(window);
+		break;
+	}
+}
+
 static void
 window_prerender(struct window *window)
 {
@@ -727,6 +1040,66 @@ display_add_output(struct display *d, uint32_t name, uint32_t version)
 	wl_list_insert(&d->output_list, &o->link);
 }
 
+static void
+keyboard_handle_keymap(void *data, struct wl_keyboard *keyboard,
+		       uint32_t format, int fd, uint32_t size)
+{
+	close(fd);
+}
+
+static void
+keyboard_handle_enter(void *data, struct wl_keyboard *keyboard,
+		      uint32_t serial, struct wl_surface *surface,
+		      struct wl_array *keys)
+{
+}
+
+static void
+keyboard_handle_leave(void *data, struct wl_keyboard *keyboard,
+		      uint32_t serial, struct wl_surface *surface)
+{
+}
+
+static void
+keyboard_handle_key(void *data, struct wl_keyboard *keyboard,
+		    uint32_t serial, uint32_t time, uint32_t key,
+		    uint32_t state)
+{
+	struct window *window = data;
+
+	if (window->mode == RUN_MODE_INPUT && window->input_pending &&
+	    state == WL_KEYBOARD_KEY_STATE_PRESSED)
+		window_input_draw(window);
+}
+
+static void
+keyboard_handle_modifiers(void *data, struct wl_keyboard *keyboard,
+			  uint32_t serial, uint32_t mods_depressed,
+			  uint32_t mods_latched, uint32_t mods_locked,
+			  uint32_t group)
+{
+}
+
+static const struct wl_keyboard_listener keyboard_listener = {
+	keyboard_handle_keymap,
+	keyboard_handle_enter,
+	keyboard_handle_leave,
+	keyboard_handle_key,
+	keyboard_handle_modifiers,
+};
+
+static void
+seat_handle_capabilities(void *data, struct wl_seat *seat, uint32_t caps)
+{
+	struct display *d = data;
+
+	d->seat_caps = caps;
+}
+
+static const struct wl_seat_listener seat_listener = {
+	seat_handle_capabilities,
+};
+
 static void
 presentation_clock_id(void *data, struct wp_presentation *presentation,
 		      uint32_t clk_id)
@@ -778,6 +1151,13 @@ registry_handle_global(void *data, struct wl_registry *registry,
 					 name, &wp_presentation_interface, 1);
 		wp_presentation_add_listener(d->presentation,
 					     &presentation_listener, d);
+	} else if (strcmp(interface, weston_test_interface.name) == 0) {
+		d->test = wl_registry_bind(registry,
+					   name, &weston_test_interface, 1);
+	} else if (strcmp(interface, "wl_seat") == 0 && !d->seat) {
+		d->seat = wl_registry_bind(registry,
+					   name, &wl_seat_interface, 1);
+		wl_seat_add_listener(d->seat, &seat_listener, d);
 	}
 }
 
@@ -806,7 +1186,7 @@ create_display(void)
 {
 	struct display *display;
 
-	display = malloc(sizeof *display);
+	display = zalloc(sizeof *display);
 	if (display == NULL) {
 		fprintf(stderr, "out of memory\n");
 		exit(1);
@@ -848,6 +1228,15 @@ destroy_display(struct display *display)
 		output_destroy(o);
 	}
 
+	if (display->keyboard)
+		wl_keyboard_destroy(display->keyboard);
+
+	if (display->seat)
+		wl_seat_destroy(display->seat);
+
+	if (display->test)
+		weston_test_destroy(display->test);
+
 	if (display->shm)
 		wl_shm_destroy(display->shm);
 
@@ -863,8 +1252,6 @@ destroy_display(struct display *display)
 	free(display);
 }
 
-static int running = 1;
-
 static void
 signal_int(int signum)
 {
@@ -879,9 +1266,15 @@ usage(const char *prog, int exit_code)
 		"  -f\t\trun in feedback mode (default)\n"
 		"  -i\t\trun in feedback-idle mode; sleep 1s between frames\n"
 		"  -p\t\trun in low-latency presentation mode\n"
+		"  -k\t\trun in input mode; draw a frame in response to each\n"
+		"\t\tkey press injected through the weston-test protocol\n"
+		"  -s script\trun the comma separated modes of 'script' in turn,\n"
+		"\t\tchosen from feedback, feedback-idle, low-lat and input,\n"
+		"\t\tand print the latencies as JSON when done\n"
 		"and 'options' may include\n"
 		"  -d msecs\temulate the time used for rendering by a delay \n"
-		"\t\tof the given milliseconds before commit\n\n",
+		"\t\tof the given milliseconds before commit\n"
+		"  -n frames\tframes per mode of a script (default 120)\n\n",
 		prog);
 
 	fprintf(stderr, "Printed timing statistics, depending on mode:\n"
@@ -891,22 +1284,110 @@ usage(const char *prog, int exit_code)
 		"  f2p: time from frame callback timestamp to presentation\n"
 		"  p2p: time from previous presentation to this one\n"
 		"  t2p: time from target timestamp to presentation\n"
+		"  i2p: time from injecting input to presentation\n"
 		"  seq: MSC\n");
 
 
 	exit(exit_code);
 }
 
+static struct harness *
+harness_create(const char *script, unsigned frames)
+{
+	struct harness *harness;
+	char *copy, *name, *saveptr;
+	unsigned i;
+
+	harness = zalloc(sizeof *harness);
+	copy = strdup(script);
+	if (!harness || !copy)
+		goto err;
+
+	harness->frames = frames;
+	for (name = strtok_r(copy, ",", &saveptr); name;
+	     name = strtok_r(NULL, ",", &saveptr)) {
+		struct harness_run *runs, *run;
+
+		for (i = 0; i < ARRAY_LENGTH(run_mode_script_name); i++) {
+			if (strcmp(name, run_mode_script_name[i]) == 0)
+				break;
+		}
+		if (i == ARRAY_LENGTH(run_mode_script_name)) {
+			fprintf(stderr, "unknown mode '%s' in script\n", name);
+			goto err;
+		}
+
+		runs = realloc(harness->runs,
+			       (harness->run_count + 1) * sizeof *runs);
+		if (!runs)
+			goto err;
+		harness->runs = runs;
+
+		run = &harness->runs[harness->run_count++];
+		memset(run, 0, sizeof *run);
+		run->mode = i;
+		wl_array_init(&run->commit_to_present);
+		wl_array_init(&run->input_to_present);
+	}
+
+	free(copy);
+
+	if (harness->run_count == 0) {
+		fprintf(stderr, "empty script\n");
+		free(harness);
+		return NULL;
+	}
+
+	return harness;
+
+err:
+	free(copy);
+	if (harness)
+		free(harness->runs);
+	free(harness);
+	return NULL;
+}
+
+static void
+harness_destroy(struct harness *harness)
+{
+	unsigned i;
+
+	for (i = 0; i < harness->run_count; i++) {
+		wl_array_release(&harness->runs[i].commit_to_present);
+		wl_array_release(&harness->runs[i].input_to_present);
+	}
+	free(harness->runs);
+	free(harness);
+}
+
+static bool
+harness_uses_mode(struct harness *harness, enum run_mode mode)
+{
+	unsigned i;
+
+	for (i = 0; i < harness->run_count; i++) {
+		if (harness->runs[i].mode == mode)
+			return true;
+	}
+
+	return false;
+}
+
 int
 main(int argc, char **argv)
 {
 	struct sigaction sigint;
 	struct display *display;
 	struct window *window;
+	struct harness *harness = NULL;
 	int ret = 0;
 	enum run_mode mode = RUN_MODE_FEEDBACK;
 	int i;
 	int commit_delay_msecs = 0;
+	const char *script = NULL;
+	int frames = 120;
+	bool need_input;
 
 	for (i = 1; i < argc; i++) {
 		if (strcmp("-f", argv[i]) == 0)
@@ -915,6 +1396,18 @@ main(int argc, char **argv)
 			mode = RUN_MODE_FEEDBACK_IDLE;
 		else if (strcmp("-p", argv[i]) == 0)
 			mode = RUN_MODE_PRESENT;
+		else if (strcmp("-k", argv[i]) == 0)
+			mode = RUN_MODE_INPUT;
+		else if ((strcmp("-s", argv[i]) == 0) && (i + 1 < argc)) {
+			i++;
+			script = argv[i];
+		}
+		else if ((strcmp("-n", argv[i]) == 0) && (i + 1 < argc)) {
+			i++;
+			frames = atoi(argv[i]);
+			if (frames <= 0)
+				usage(argv[0], EXIT_FAILURE);
+		}
 		else if ((strcmp("-d", argv[i]) == 0) && (i + 1 < argc)) {
 			i++;
 			commit_delay_msecs = atoi(argv[i]);
@@ -923,10 +1416,40 @@ main(int argc, char **argv)
 			usage(argv[0], EXIT_FAILURE);
 	}
 
+	if (script) {
+		harness = harness_create(script, frames);
+		if (!harness)
+			usage(argv[0], EXIT_FAILURE);
+		mode = harness->runs[0].mode;
+	}
+
 	display = create_display();
+
+	if (harness && !display->presentation) {
+		fprintf(stderr, "a script needs wp_presentation\n");
+		return 1;
+	}
+
+	need_input = harness ? harness_uses_mode(harness, RUN_MODE_INPUT) :
+			       mode == RUN_MODE_INPUT;
+	if (need_input &&
+	    (!display->presentation || !display->test ||
+	     !(display->seat_caps & WL_SEAT_CAPABILITY_KEYBOARD))) {
+		fprintf(stderr, "input mode needs wp_presentation, a seat "
+			"with a keyboard and the weston-test protocol\n");
+		return 1;
+	}
+
 	window = create_window(display, 250, 250, mode, commit_delay_msecs);
 	if (!window)
 		return 1;
+	window->harness = harness;
+
+	if (need_input) {
+		display->keyboard = wl_seat_get_keyboard(display->seat);
+		wl_keyboard_add_listener(display->keyboard, &keyboard_listener,
+					 window);
+	}
 
 	sigint.sa_handler = signal_int;
 	sigemptyset(&sigint.sa_mask);
@@ -935,15 +1458,7 @@ main(int argc, char **argv)
 
 	window_prerender(window);
 
-	switch (mode) {
-	case RUN_MODE_FEEDBACK:
-	case RUN_MODE_FEEDBACK_IDLE:
-		redraw_mode_feedback(window, NULL, 0);
-		break;
-	case RUN_MODE_PRESENT:
-		firstdraw_mode_burst(window);
-		break;
-	}
+	window_start(window);
 
 	while (running && ret != -1)
 		ret = wl_display_dispatch(display->display);
@@ -951,6 +1466,8 @@ main(int argc, char **argv)
 	fprintf(stderr, "presentation-shm exiting\n");
 	destroy_window(window);
 	destroy_display(display);
+	if (harness)
+		harness_destroy(harness);
 
 	return 0;
 }
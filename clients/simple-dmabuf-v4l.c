@@ -44,14 +44,18 @@
 #include <linux/videodev2.h>
 #include <linux/input.h>
 
+#include <time.h>
+
 #include <wayland-client.h>
 #include <libweston/zalloc.h>
 #include "xdg-shell-client-protocol.h"
 #include "fullscreen-shell-unstable-v1-client-protocol.h"
 #include "linux-dmabuf-unstable-v1-client-protocol.h"
+#include "presentation-time-client-protocol.h"
 #include "weston-direct-display-client-protocol.h"
 
 #include "shared/helpers.h"
+#include "shared/timespec-util.h"
 #include "shared/weston-drm-fourcc.h"
 
 #define CLEAR(x) memset(&(x), 0, sizeof(x))
@@ -97,6 +101,67 @@ struct buffer_format {
 
 	unsigned num_planes;
 	unsigned strides[VIDEO_MAX_PLANES];
+
+	/* Planes handed to linux-dmabuf; a single-plane capture of a
+	 * multi-planar DRM format carries them all in one v4l2 plane. */
+	unsigned num_drm_planes;
+};
+
+/** The linux-dmabuf format table entry layout, see the protocol */
+struct dmabuf_format_table_entry {
+	uint32_t format;
+	uint32_t padding;
+	uint64_t modifier;
+};
+
+/** Tracks whether one dmabuf feedback object offers our format
+ *
+ * Only the LINEAR modifier matters since that is what V4L2 produces; a
+ * scanout tranche listing it means the compositor could put the stream
+ * on a plane without composition.
+ */
+struct dmabuf_feedback {
+	struct display *display;
+	struct zwp_linux_dmabuf_feedback_v1 *feedback;
+
+	struct dmabuf_format_table_entry *table;
+	size_t table_size;
+
+	bool tranche_scanout;
+	bool tranche_has_format;
+	bool pending_found;
+	bool pending_scanout;
+
+	bool received;
+	bool found;
+	bool scanout;
+};
+
+/** Samples of one latency, in microseconds */
+struct latency {
+	const char *name;
+	int64_t *usec;
+	unsigned count;
+};
+
+/** Capture-to-display latency of the stream, with --benchmark
+ *
+ * Every stage is measured from the V4L2 buffer timestamp, which marks
+ * the end of the capture in CLOCK_MONOTONIC.
+ */
+struct benchmark {
+	unsigned frames;		/* presented frames to measure */
+
+	struct latency dequeued;	/* VIDIOC_DQBUF returned */
+	struct latency committed;	/* wl_surface.commit sent */
+	struct latency presented;	/* wp_presentation_feedback */
+
+	unsigned frames_committed;
+	unsigned frames_presented;
+	unsigned frames_discarded;
+	unsigned frames_zero_copy;
+	unsigned frames_no_timestamp;
+	unsigned scanout_feedback_changes;
 };
 
 struct display {
@@ -108,10 +173,15 @@ struct display {
 	struct xdg_wm_base *wm_base;
 	struct zwp_fullscreen_shell_v1 *fshell;
 	struct zwp_linux_dmabuf_v1 *dmabuf;
+	uint32_t dmabuf_version;
 	struct weston_direct_display_v1 *direct_display;
+	struct wp_presentation *presentation;
+	clockid_t presentation_clock_id;
 	bool requested_format_found;
 	uint32_t opts;
 
+	struct benchmark *bench;
+
 	int v4l_fd;
 	struct buffer_format format;
 	uint32_t drm_format;
@@ -136,10 +206,18 @@ struct window {
 	struct xdg_toplevel *xdg_toplevel;
 	struct buffer buffers[NUM_BUFFERS];
 	struct wl_callback *callback;
+	struct dmabuf_feedback surface_feedback;
 	bool wait_for_configure;
 	bool initialized;
 };
 
+/** In-flight presentation feedback of one committed frame */
+struct frame_timing {
+	struct display *display;
+	struct wp_presentation_feedback *feedback;
+	struct timespec captured;
+};
+
 static bool running = true;
 
 static int
@@ -407,6 +485,19 @@ create_dmabuf_buffer(struct display *display, struct buffer *buffer)
 		                               display->format.strides[i],
 		                               modifier >> 32,
 		                               modifier & 0xffffffff);
+
+	/* Contiguous NV12: the CbCr plane follows the luma plane in the
+	 * same buffer, with the same stride. */
+	for (; i < display->format.num_drm_planes; ++i)
+		zwp_linux_buffer_params_v1_add(params,
+		                               buffer->dmabuf_fds[0],
+		                               i, /* plane_idx */
+		                               buffer->data_offsets[0] +
+		                               display->format.strides[0] *
+		                               display->format.height,
+		                               display->format.strides[0],
+		                               modifier >> 32,
+		                               modifier & 0xffffffff);
 	zwp_linux_buffer_params_v1_add_listener(params, &params_listener,
 	                                        buffer);
 	zwp_linux_buffer_params_v1_create(params,
@@ -467,8 +558,10 @@ queue_initial_buffers(struct display *display,
 	return 1;
 }
 
+/* Returns the dequeued buffer index, with the end of its capture in
+ * captured, or zero if the driver does not timestamp in CLOCK_MONOTONIC */
 static int
-dequeue(struct display *display)
+dequeue(struct display *display, struct timespec *captured)
 {
 	struct v4l2_buffer buf;
 	struct v4l2_plane planes[VIDEO_MAX_PLANES];
@@ -485,6 +578,15 @@ dequeue(struct display *display)
 		return -1;
 	}
 
+	if ((buf.flags & V4L2_BUF_FLAG_TIMESTAMP_MASK) ==
+	    V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC) {
+		captured->tv_sec = buf.timestamp.tv_sec;
+		captured->tv_nsec = buf.timestamp.tv_usec * 1000;
+	} else {
+		captured->tv_sec = 0;
+		captured->tv_nsec = 0;
+	}
+
 	return buf.index;
 }
 
@@ -513,6 +615,9 @@ fill_buffer_format(struct display *display)
 		       dump_format(pix->pixelformat, buf));
 
 		display->format.num_planes = 1;
+		if (display->drm_format == DRM_FORMAT_NV12 ||
+		    display->drm_format == DRM_FORMAT_NV21)
+			display->format.num_drm_planes = 2;
 		display->format.width = pix->width;
 		display->format.height = pix->height;
 		display->format.strides[0] = pix->bytesperline;
@@ -526,6 +631,8 @@ fill_buffer_format(struct display *display)
 		for (i = 0; i < pix_mp->num_planes; ++i)
 			display->format.strides[i] = pix_mp->plane_fmt[i].bytesperline;
 
+		display->format.num_drm_planes = pix_mp->num_planes;
+
 		printf("%d×%d, %.4s, %d planes\n",
 		       pix_mp->width, pix_mp->height,
 		       dump_format(pix_mp->pixelformat, buf),
@@ -537,6 +644,7 @@ fill_buffer_format(struct display *display)
 
 static int
 v4l_init(struct display *display, struct buffer buffers[NUM_BUFFERS]) {
+	display->format.num_drm_planes = 1;
 	if (!fill_buffer_format(display)) {
 		fprintf(stderr, "Failed to fill buffer format\n");
 		return 0;
@@ -598,6 +706,136 @@ static const struct xdg_toplevel_listener xdg_toplevel_listener = {
 	xdg_toplevel_handle_close,
 };
 
+static void
+dmabuf_feedback_format_table(void *data,
+			     struct zwp_linux_dmabuf_feedback_v1 *feedback,
+			     int32_t fd, uint32_t size)
+{
+	struct dmabuf_feedback *fb = data;
+	void *table;
+
+	if (fb->table)
+		munmap(fb->table, fb->table_size);
+	fb->table = NULL;
+	fb->table_size = 0;
+
+	table = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (table == MAP_FAILED) {
+		fprintf(stderr, "Failed to map the dmabuf format table\n");
+		return;
+	}
+
+	fb->table = table;
+	fb->table_size = size;
+}
+
+static void
+dmabuf_feedback_main_device(void *data,
+			    struct zwp_linux_dmabuf_feedback_v1 *feedback,
+			    struct wl_array *device)
+{
+}
+
+static void
+dmabuf_feedback_tranche_target_device(void *data,
+				      struct zwp_linux_dmabuf_feedback_v1 *feedback,
+				      struct wl_array *device)
+{
+}
+
+static void
+dmabuf_feedback_tranche_formats(void *data,
+				struct zwp_linux_dmabuf_feedback_v1 *feedback,
+				struct wl_array *indices)
+{
+	struct dmabuf_feedback *fb = data;
+	size_t count = fb->table_size / sizeof(*fb->table);
+	uint16_t *index;
+
+	wl_array_for_each(index, indices) {
+		if (*index >= count)
+			continue;
+		if (fb->table[*index].format == fb->display->drm_format &&
+		    fb->table[*index].modifier == DRM_FORMAT_MOD_LINEAR)
+			fb->tranche_has_format = true;
+	}
+}
+
+static void
+dmabuf_feedback_tranche_flags(void *data,
+			      struct zwp_linux_dmabuf_feedback_v1 *feedback,
+			      uint32_t flags)
+{
+	struct dmabuf_feedback *fb = data;
+
+	if (flags & ZWP_LINUX_DMABUF_FEEDBACK_V1_TRANCHE_FLAGS_SCANOUT)
+		fb->tranche_scanout = true;
+}
+
+static void
+dmabuf_feedback_tranche_done(void *data,
+			     struct zwp_linux_dmabuf_feedback_v1 *feedback)
+{
+	struct dmabuf_feedback *fb = data;
+
+	if (fb->tranche_has_format) {
+		fb->pending_found = true;
+		if (fb->tranche_scanout)
+			fb->pending_scanout = true;
+	}
+
+	fb->tranche_has_format = false;
+	fb->tranche_scanout = false;
+}
+
+static void
+dmabuf_feedback_done(void *data, struct zwp_linux_dmabuf_feedback_v1 *feedback)
+{
+	struct dmabuf_feedback *fb = data;
+	struct benchmark *bench = fb->display->bench;
+
+	if (fb->received && bench && fb->scanout != fb->pending_scanout)
+		bench->scanout_feedback_changes++;
+
+	fb->received = true;
+	fb->found = fb->pending_found;
+	fb->scanout = fb->pending_scanout;
+	fb->pending_found = false;
+	fb->pending_scanout = false;
+}
+
+static const struct zwp_linux_dmabuf_feedback_v1_listener dmabuf_feedback_listener = {
+	.done = dmabuf_feedback_done,
+	.format_table = dmabuf_feedback_format_table,
+	.main_device = dmabuf_feedback_main_device,
+	.tranche_done = dmabuf_feedback_tranche_done,
+	.tranche_target_device = dmabuf_feedback_tranche_target_device,
+	.tranche_formats = dmabuf_feedback_tranche_formats,
+	.tranche_flags = dmabuf_feedback_tranche_flags,
+};
+
+static void
+dmabuf_feedback_init(struct dmabuf_feedback *fb, struct display *display,
+		     struct zwp_linux_dmabuf_feedback_v1 *feedback)
+{
+	memset(fb, 0, sizeof *fb);
+	fb->display = display;
+	fb->feedback = feedback;
+	zwp_linux_dmabuf_feedback_v1_add_listener(feedback,
+						  &dmabuf_feedback_listener, fb);
+}
+
+static void
+dmabuf_feedback_fini(struct dmabuf_feedback *fb)
+{
+	if (fb->feedback)
+		zwp_linux_dmabuf_feedback_v1_destroy(fb->feedback);
+	if (fb->table)
+		munmap(fb->table, fb->table_size);
+	memset(fb, 0, sizeof *fb);
+}
+
 static struct window *
 create_window(struct display *display)
 {
@@ -611,6 +849,13 @@ create_window(struct display *display)
 	window->display = display;
 	window->surface = wl_compositor_create_surface(display->compositor);
 
+	/* Per-surface feedback tells whether the compositor would scan the
+	 * stream out, which is where zero-copy latency comes from. */
+	if (display->dmabuf_version >= ZWP_LINUX_DMABUF_V1_GET_SURFACE_FEEDBACK_SINCE_VERSION)
+		dmabuf_feedback_init(&window->surface_feedback, display,
+			zwp_linux_dmabuf_v1_get_surface_feedback(display->dmabuf,
+								 window->surface));
+
 	if (display->wm_base) {
 		window->xdg_surface =
 			xdg_wm_base_get_xdg_surface(display->wm_base,
@@ -656,6 +901,8 @@ destroy_window(struct window *window)
 	if (window->callback)
 		wl_callback_destroy(window->callback);
 
+	dmabuf_feedback_fini(&window->surface_feedback);
+
 	if (window->xdg_toplevel)
 		xdg_toplevel_destroy(window->xdg_toplevel);
 	if (window->xdg_surface)
@@ -676,12 +923,217 @@ destroy_window(struct window *window)
 	free(window);
 }
 
+static void
+latency_add(struct latency *latency, const struct timespec *captured,
+	    const struct timespec *t)
+{
+	latency->usec[latency->count++] =
+		timespec_sub_to_nsec(t, captured) / 1000;
+}
+
+static int
+compare_int64(const void *a, const void *b)
+{
+	const int64_t *x = a, *y = b;
+
+	return (*x > *y) - (*x < *y);
+}
+
+static void
+latency_print(struct latency *latency)
+{
+	int64_t sum = 0;
+	unsigned i;
+
+	if (latency->count == 0) {
+		printf("%-10s n/a\n", latency->name);
+		return;
+	}
+
+	qsort(latency->usec, latency->count, sizeof(int64_t), compare_int64);
+	for (i = 0; i < latency->count; i++)
+		sum += latency->usec[i];
+
+	printf("%-10s min %7.2f  avg %7.2f  p50 %7.2f  p99 %7.2f  max %7.2f ms\n",
+	       latency->name,
+	       latency->usec[0] / 1000.0,
+	       (double) sum / latency->count / 1000.0,
+	       latency->usec[latency->count / 2] / 1000.0,
+	       latency->usec[(latency->count - 1) * 99 / 100] / 1000.0,
+	       latency->usec[latency->count - 1] / 1000.0);
+}
+
+static bool
+latency_init(struct latency *latency, const char *name, unsigned frames)
+{
+	latency->name = name;
+	latency->count = 0;
+	latency->usec = calloc(frames, sizeof(int64_t));
+
+	return latency->usec != NULL;
+}
+
+static struct benchmark *
+benchmark_create(unsigned frames)
+{
+	struct benchmark *bench;
+
+	bench = zalloc(sizeof *bench);
+	if (!bench)
+		return NULL;
+
+	bench->frames = frames;
+
+	/* Every committed frame is measured until frames were presented,
+	 * and at most NUM_BUFFERS commits are in flight. */
+	if (!latency_init(&bench->dequeued, "dequeued", frames + NUM_BUFFERS) ||
+	    !latency_init(&bench->committed, "committed", frames + NUM_BUFFERS) ||
+	    !latency_init(&bench->presented, "presented", frames)) {
+		free(bench->dequeued.usec);
+		free(bench->committed.usec);
+		free(bench);
+		return NULL;
+	}
+
+	return bench;
+}
+
+static void
+benchmark_report(struct benchmark *bench, struct window *window)
+{
+	struct dmabuf_feedback *fb = &window->surface_feedback;
+	char fmt[4];
+
+	printf("\ncapture-to-display latency, %d×%d %.4s, %u frames\n",
+	       window->display->format.width, window->display->format.height,
+	       dump_format(window->display->drm_format, fmt),
+	       bench->frames_presented);
+	latency_print(&bench->dequeued);
+	latency_print(&bench->committed);
+	latency_print(&bench->presented);
+
+	printf("committed %u, presented %u, discarded %u, zero-copy %u, "
+	       "untimestamped %u\n",
+	       bench->frames_committed, bench->frames_presented,
+	       bench->frames_discarded, bench->frames_zero_copy,
+	       bench->frames_no_timestamp);
+
+	if (!fb->received)
+		printf("path: %s (no surface dmabuf feedback)\n",
+		       bench->frames_zero_copy ? "overlay" : "composited");
+	else
+		printf("path: %s, scanout tranche %s, %u feedback changes\n",
+		       bench->frames_zero_copy ? "overlay" : "composited",
+		       fb->scanout ? "offers the format" : "absent",
+		       bench->scanout_feedback_changes);
+}
+
+static void
+benchmark_destroy(struct benchmark *bench)
+{
+	free(bench->dequeued.usec);
+	free(bench->committed.usec);
+	free(bench->presented.usec);
+	free(bench);
+}
+
+static void
+frame_timing_destroy(struct frame_timing *timing)
+{
+	wp_presentation_feedback_destroy(timing->feedback);
+	free(timing);
+}
+
+static void
+feedback_sync_output(void *data, struct wp_presentation_feedback *feedback,
+		     struct wl_output *output)
+{
+}
+
+static void
+feedback_presented(void *data, struct wp_presentation_feedback *feedback,
+		   uint32_t tv_sec_hi, uint32_t tv_sec_lo, uint32_t tv_nsec,
+		   uint32_t refresh, uint32_t seq_hi, uint32_t seq_lo,
+		   uint32_t flags)
+{
+	struct frame_timing *timing = data;
+	struct benchmark *bench = timing->display->bench;
+	struct timespec presented;
+
+	if (bench->frames_presented < bench->frames) {
+		bench->frames_presented++;
+		if (flags & WP_PRESENTATION_FEEDBACK_KIND_ZERO_COPY)
+			bench->frames_zero_copy++;
+
+		timespec_from_proto(&presented, tv_sec_hi, tv_sec_lo, tv_nsec);
+		if (!timespec_is_zero(&timing->captured) &&
+		    timing->display->presentation_clock_id == CLOCK_MONOTONIC)
+			latency_add(&bench->presented, &timing->captured,
+				    &presented);
+
+		if (bench->frames_presented == bench->frames)
+			running = false;
+	}
+
+	frame_timing_destroy(timing);
+}
+
+static void
+feedback_discarded(void *data, struct wp_presentation_feedback *feedback)
+{
+	struct frame_timing *timing = data;
+
+	timing->display->bench->frames_discarded++;
+	frame_timing_destroy(timing);
+}
+
+static const struct wp_presentation_feedback_listener feedback_listener = {
+	feedback_sync_output,
+	feedback_presented,
+	feedback_discarded
+};
+
+static void
+benchmark_frame(struct window *window, const struct timespec *captured,
+		const struct timespec *dequeued)
+{
+	struct display *display = window->display;
+	struct benchmark *bench = display->bench;
+	struct frame_timing *timing;
+	struct timespec now;
+
+	bench->frames_committed++;
+	if (timespec_is_zero(captured)) {
+		bench->frames_no_timestamp++;
+	} else {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		latency_add(&bench->dequeued, captured, dequeued);
+		latency_add(&bench->committed, captured, &now);
+	}
+
+	if (!display->presentation)
+		return;
+
+	timing = zalloc(sizeof *timing);
+	if (!timing)
+		return;
+
+	timing->display = display;
+	timing->captured = *captured;
+	timing->feedback = wp_presentation_feedback(display->presentation,
+						    window->surface);
+	wp_presentation_feedback_add_listener(timing->feedback,
+					      &feedback_listener, timing);
+}
+
 static const struct wl_callback_listener frame_listener;
 
 static void
 redraw(void *data, struct wl_callback *callback, uint32_t time)
 {
 	struct window *window = data;
+	struct benchmark *bench = window->display->bench;
+	struct timespec captured, dequeued;
 	struct buffer *buffer;
 	int index, num_busy = 0;
 
@@ -697,7 +1149,8 @@ redraw(void *data, struct wl_callback *callback, uint32_t time)
 	 */
 	assert(num_busy < NUM_BUFFERS);
 
-	index = dequeue(window->display);
+	index = dequeue(window->display, &captured);
+	clock_gettime(CLOCK_MONOTONIC, &dequeued);
 	if (index < 0) {
 		/* We couldn’t get any buffer out of the camera, exiting. */
 		running = false;
@@ -717,6 +1170,16 @@ redraw(void *data, struct wl_callback *callback, uint32_t time)
 
 	window->callback = wl_surface_frame(window->surface);
 	wl_callback_add_listener(window->callback, &frame_listener, window);
+
+	/* Without presentation feedback, stop after as many commits. */
+	if (bench && bench->frames_committed == bench->frames &&
+	    !window->display->presentation) {
+		running = false;
+		return;
+	}
+	if (bench && bench->frames_committed < bench->frames + NUM_BUFFERS)
+		benchmark_frame(window, &captured, &dequeued);
+
 	wl_surface_commit(window->surface);
 	buffer->busy = 1;
 }
@@ -749,6 +1212,19 @@ static const struct zwp_linux_dmabuf_v1_listener dmabuf_listener = {
 	dmabuf_modifier
 };
 
+static void
+presentation_clock_id(void *data, struct wp_presentation *presentation,
+		      uint32_t clk_id)
+{
+	struct display *d = data;
+
+	d->presentation_clock_id = clk_id;
+}
+
+static const struct wp_presentation_listener presentation_listener = {
+	presentation_clock_id
+};
+
 static void
 keyboard_handle_keymap(void *data, struct wl_keyboard *keyboard,
                        uint32_t format, int fd, uint32_t size)
@@ -852,10 +1328,18 @@ registry_handle_global(void *data, struct wl_registry *registry,
 		                             id, &zwp_fullscreen_shell_v1_interface,
 		                             1);
 	} else if (strcmp(interface, "zwp_linux_dmabuf_v1") == 0) {
+		d->dmabuf_version = MIN(version, 4);
 		d->dmabuf = wl_registry_bind(registry,
-		                             id, &zwp_linux_dmabuf_v1_interface, 3);
+		                             id, &zwp_linux_dmabuf_v1_interface,
+		                             d->dmabuf_version);
 		zwp_linux_dmabuf_v1_add_listener(d->dmabuf, &dmabuf_listener,
 		                                 d);
+	} else if (strcmp(interface, "wp_presentation") == 0) {
+		d->presentation = wl_registry_bind(registry,
+		                                   id, &wp_presentation_interface,
+		                                   1);
+		wp_presentation_add_listener(d->presentation,
+		                             &presentation_listener, d);
 	} else if (strcmp(interface, "weston_direct_display_v1") == 0) {
 		d->direct_display = wl_registry_bind(registry,
 						     id, &weston_direct_display_v1_interface, 1);
@@ -897,7 +1381,20 @@ create_display(uint32_t requested_format, uint32_t opt_flags)
 		exit(1);
 	}
 
-	wl_display_roundtrip(display->display);
+	/* From version 4 formats are only advertised as feedback. */
+	if (display->dmabuf_version >= ZWP_LINUX_DMABUF_V1_GET_DEFAULT_FEEDBACK_SINCE_VERSION) {
+		struct dmabuf_feedback fb;
+
+		dmabuf_feedback_init(&fb, display,
+			zwp_linux_dmabuf_v1_get_default_feedback(display->dmabuf));
+		while (!fb.received)
+			if (wl_display_dispatch(display->display) < 0)
+				break;
+		display->requested_format_found = fb.found;
+		dmabuf_feedback_fini(&fb);
+	} else {
+		wl_display_roundtrip(display->display);
+	}
 
 	if (!display->requested_format_found) {
 		fprintf(stderr, "0x%lx requested DRM format not available\n",
@@ -916,6 +1413,9 @@ destroy_display(struct display *display)
 	if (display->dmabuf)
 		zwp_linux_dmabuf_v1_destroy(display->dmabuf);
 
+	if (display->presentation)
+		wp_presentation_destroy(display->presentation);
+
 	if (display->wm_base)
 		xdg_wm_base_destroy(display->wm_base);
 
@@ -934,7 +1434,7 @@ destroy_display(struct display *display)
 static void
 usage(const char *argv0)
 {
-	printf("Usage: %s [-v v4l2_device] [-f v4l2_format] [-d drm_format] [-i|--y-invert] [-g|--d-display]\n"
+	printf("Usage: %s [-v v4l2_device] [-f v4l2_format] [-d drm_format] [-i|--y-invert] [-g|--d-display] [-b|--benchmark frames]\n"
 	       "\n"
 	       "The default V4L2 device is /dev/video0\n"
 	       "\n"
@@ -949,7 +1449,13 @@ usage(const char *argv0)
 	       "automatically added if we detect if the camera sensor is "
 	       "y-flipped\n"
 	       "- d-display skip importing dmabuf-based buffer into the GPU\n  "
-	       "and attempt pass the buffer straight to the display controller\n",
+	       "and attempt pass the buffer straight to the display controller\n"
+	       "- benchmark measure the latency from the V4L2 capture timestamp\n  "
+	       "to dequeue, commit and presentation over that many frames,\n  "
+	       "report whether they were scanned out, then exit\n"
+	       "\n"
+	       "NV12 and NV21 from a single-plane V4L2 device are passed as two\n"
+	       "planes of the same dmabuf.\n",
 	       argv0);
 
 	printf("\n"
@@ -990,6 +1496,7 @@ main(int argc, char **argv)
 	uint32_t v4l_format = 0x0;
 	uint32_t drm_format = 0x0;
 	uint32_t opts_flags = 0x0;
+	int bench_frames = 0;
 	int c, opt_index, ret = 0;
 
 	static struct option long_options[] = {
@@ -998,11 +1505,12 @@ main(int argc, char **argv)
 		{ "drm-format",	 required_argument, NULL, 'd' },
 		{ "y-invert",    no_argument, 	    NULL, 'i' },
 		{ "d-display",   no_argument, 	    NULL, 'g' },
+		{ "benchmark",   required_argument, NULL, 'b' },
 		{ "help",        no_argument,       NULL, 'h' },
 		{ 0,             0,                 NULL,  0  }
 	};
 
-	while ((c = getopt_long(argc, argv, "hiv:d:f:g", long_options,
+	while ((c = getopt_long(argc, argv, "hiv:d:f:gb:", long_options,
 				&opt_index)) != -1) {
 		switch (c) {
 		case 'v':
@@ -1020,6 +1528,11 @@ main(int argc, char **argv)
 		case 'g':
 			opts_flags |= OPT_FLAG_DIRECT_DISPLAY;
 			break;
+		case 'b':
+			bench_frames = atoi(optarg);
+			if (bench_frames <= 0)
+				usage(argv[0]);
+			break;
 		default:
 		case 'h':
 			usage(argv[0]);
@@ -1039,6 +1552,15 @@ main(int argc, char **argv)
 	display = create_display(drm_format, opts_flags);
 	display->format.format = v4l_format;
 
+	if (bench_frames > 0) {
+		display->bench = benchmark_create(bench_frames);
+		if (!display->bench)
+			return 1;
+		if (!display->presentation)
+			fprintf(stderr, "No wp_presentation global, only "
+				"measuring up to the commit\n");
+	}
+
 	window = create_window(display);
 	if (!window)
 		return 1;
@@ -1073,6 +1595,11 @@ main(int argc, char **argv)
 	while (running && ret != -1)
 		ret = wl_display_dispatch(display->display);
 
+	if (display->bench) {
+		benchmark_report(display->bench, window);
+		benchmark_destroy(display->bench);
+	}
+
 	fprintf(stderr, "simple-dmabuf-v4l exiting\n");
 	destroy_window(window);
 	destroy_display(display);
@@ -0,0 +1,1532 @@
+/*
+ * Copyright © 2022 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * A load generator: one process opening many surfaces, so that the
+ * compositor can be driven to its scaling limits reproducibly instead of
+ * by launching dozens of demo clients by hand. The frame rate achieved
+ * by each surface is counted from presentation feedback.
+ */
+
+#include "config.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <getopt.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/timerfd.h>
+
+#include <wayland-client.h>
+
+#ifdef HAVE_SIMPLE_LOAD_EGL
+#include <wayland-egl.h>
+#include <GLES2/gl2.h>
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include "shared/platform.h"
+#include "shared/weston-egl-ext.h"
+#endif
+
+#ifdef HAVE_SIMPLE_LOAD_DMABUF
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <gbm.h>
+#include <drm_fourcc.h>
+#include <linux/dma-buf.h>
+#endif
+
+#include "shared/helpers.h"
+#include "shared/os-compatibility.h"
+#include "shared/timespec-util.h"
+#include <libweston/zalloc.h>
+#include "xdg-shell-client-protocol.h"
+#include "presentation-time-client-protocol.h"
+#include "linux-dmabuf-unstable-v1-client-protocol.h"
+
+#define LAYER_BUFFERS 2
+
+enum buffer_type {
+	BUFFER_TYPE_SHM,
+	BUFFER_TYPE_EGL,
+	BUFFER_TYPE_DMABUF,
+};
+
+enum damage_pattern {
+	/* The whole surface changes every frame */
+	DAMAGE_FULL,
+	/* A horizontal band an eighth of the height moves down the surface */
+	DAMAGE_BAND,
+	/* Surfaces commit every frame without attaching new content */
+	DAMAGE_NONE,
+};
+
+struct options {
+	int surfaces;
+	enum buffer_type buffer_type;
+	int rate;
+	enum damage_pattern damage;
+	int depth;
+	bool alpha;
+	int width, height;
+	int duration;
+	int interval;
+	const char *drm_node;
+};
+
+struct stats {
+	unsigned presented;
+	unsigned discarded;
+	unsigned commits;
+	unsigned skipped;
+};
+
+struct display {
+	struct wl_display *display;
+	struct wl_registry *registry;
+	struct wl_compositor *compositor;
+	struct wl_subcompositor *subcompositor;
+	struct xdg_wm_base *wm_base;
+	struct wl_shm *shm;
+	struct wp_presentation *presentation;
+	struct zwp_linux_dmabuf_v1 *dmabuf;
+	bool dmabuf_linear_argb, dmabuf_linear_xrgb;
+
+#ifdef HAVE_SIMPLE_LOAD_EGL
+	struct {
+		EGLDisplay dpy;
+		EGLContext ctx;
+		EGLConfig conf;
+		PFNEGLSWAPBUFFERSWITHDAMAGEEXTPROC swap_buffers_with_damage;
+	} egl;
+#endif
+
+#ifdef HAVE_SIMPLE_LOAD_DMABUF
+	int gbm_fd;
+	struct gbm_device *gbm;
+#endif
+
+	const struct options *opts;
+	struct wl_list window_list;
+	struct wl_list feedback_list;
+};
+
+struct buffer {
+	struct wl_buffer *buffer;
+	void *data;
+	size_t size;
+	int stride;
+	bool busy;
+	bool painted;
+	/* Top of the band last painted into this buffer */
+	int band_y;
+#ifdef HAVE_SIMPLE_LOAD_DMABUF
+	struct gbm_bo *bo;
+	int fd;
+#endif
+};
+
+struct layer {
+	struct window *window;
+	struct wl_surface *surface;
+	struct wl_subsurface *subsurface;
+	int width, height;
+	bool attached;
+
+	struct buffer buffers[LAYER_BUFFERS];
+
+#ifdef HAVE_SIMPLE_LOAD_EGL
+	struct wl_egl_window *native;
+	EGLSurface egl_surface;
+#endif
+};
+
+struct window {
+	struct display *display;
+	struct wl_list link;
+	int index;
+
+	struct xdg_surface *xdg_surface;
+	struct xdg_toplevel *xdg_toplevel;
+	bool configured;
+
+	/* layers[0] is the toplevel, each further one a child of the last */
+	struct layer *layers;
+	int layer_count;
+
+	struct wl_callback *callback;
+	uint32_t frame;
+
+	struct stats stats;
+};
+
+struct feedback {
+	struct window *window;
+	struct wp_presentation_feedback *feedback;
+	struct wl_list link;
+};
+
+static volatile sig_atomic_t running = 1;
+
+static void
+window_redraw(struct window *window);
+
+static void
+buffer_release(void *data, struct wl_buffer *wl_buffer)
+{
+	struct buffer *buffer = data;
+
+	buffer->busy = false;
+}
+
+static const struct wl_buffer_listener buffer_listener = {
+	buffer_release
+};
+
+static uint32_t
+layer_format(struct layer *layer)
+{
+	/* The wl_shm and DRM codes only differ for these two */
+	if (layer->window->display->opts->buffer_type == BUFFER_TYPE_SHM)
+		return layer->window->display->opts->alpha ?
+		       WL_SHM_FORMAT_ARGB8888 : WL_SHM_FORMAT_XRGB8888;
+
+#ifdef HAVE_SIMPLE_LOAD_DMABUF
+	return layer->window->display->opts->alpha ?
+	       DRM_FORMAT_ARGB8888 : DRM_FORMAT_XRGB8888;
+#else
+	return 0;
+#endif
+}
+
+static int
+create_shm_buffer(struct layer *layer, struct buffer *buffer)
+{
+	struct display *display = layer->window->display;
+	struct wl_shm_pool *pool;
+	int fd;
+
+	buffer->stride = layer->width * 4;
+	buffer->size = (size_t) buffer->stride * layer->height;
+
+	fd = os_create_anonymous_file(buffer->size);
+	if (fd < 0) {
+		fprintf(stderr, "creating a buffer file for %zu B failed: %s\n",
+			buffer->size, strerror(errno));
+		return -1;
+	}
+
+	buffer->data = mmap(NULL, buffer->size, PROT_READ | PROT_WRITE,
+			    MAP_SHARED, fd, 0);
+	if (buffer->data == MAP_FAILED) {
+		fprintf(stderr, "mmap failed: %s\n", strerror(errno));
+		buffer->data = NULL;
+		close(fd);
+		return -1;
+	}
+
+	pool = wl_shm_create_pool(display->shm, fd, buffer->size);
+	buffer->buffer = wl_shm_pool_create_buffer(pool, 0,
+						   layer->width, layer->height,
+						   buffer->stride,
+						   layer_format(layer));
+	wl_buffer_add_listener(buffer->buffer, &buffer_listener, buffer);
+	wl_shm_pool_destroy(pool);
+	close(fd);
+
+	return 0;
+}
+
+#ifdef HAVE_SIMPLE_LOAD_DMABUF
+static void
+dmabuf_sync(int fd, uint64_t flags)
+{
+	struct dma_buf_sync sync = { .flags = flags };
+	int ret;
+
+	do {
+		ret = ioctl(fd, DMA_BUF_IOCTL_SYNC, &sync);
+	} while (ret < 0 && (errno == EINTR || errno == EAGAIN));
+}
+
+static int
+create_dmabuf_buffer(struct layer *layer, struct buffer *buffer)
+{
+	struct display *display = layer->window->display;
+	struct zwp_linux_buffer_params_v1 *params;
+	uint32_t format = layer_format(layer);
+
+	buffer->fd = -1;
+	buffer->bo = gbm_bo_create(display->gbm, layer->width, layer->height,
+				   format,
+				   GBM_BO_USE_LINEAR | GBM_BO_USE_RENDERING);
+	if (!buffer->bo) {
+		fprintf(stderr, "could not allocate a %dx%d linear dmabuf\n",
+			layer->width, layer->height);
+		return -1;
+	}
+
+	buffer->stride = gbm_bo_get_stride(buffer->bo);
+	buffer->fd = gbm_bo_get_fd(buffer->bo);
+	if (buffer->fd < 0) {
+		fprintf(stderr, "could not export a dmabuf\n");
+		return -1;
+	}
+
+	buffer->size = (size_t) buffer->stride * layer->height;
+	buffer->data = mmap(NULL, buffer->size, PROT_READ | PROT_WRITE,
+			    MAP_SHARED, buffer->fd, 0);
+	if (buffer->data == MAP_FAILED) {
+		fprintf(stderr, "mmap of a dmabuf failed: %s\n",
+			strerror(errno));
+		buffer->data = NULL;
+		return -1;
+	}
+
+	params = zwp_linux_dmabuf_v1_create_params(display->dmabuf);
+	zwp_linux_buffer_params_v1_add(params, buffer->fd, 0, 0,
+				       buffer->stride,
+				       DRM_FORMAT_MOD_LINEAR >> 32,
+				       DRM_FORMAT_MOD_LINEAR & 0xffffffff);
+	buffer->buffer =
+		zwp_linux_buffer_params_v1_create_immed(params, layer->width,
+							layer->height,
+							format, 0);
+	zwp_linux_buffer_params_v1_destroy(params);
+	wl_buffer_add_listener(buffer->buffer, &buffer_listener, buffer);
+
+	return 0;
+}
+#endif
+
+static void
+buffer_fini(struct buffer *buffer, enum buffer_type type)
+{
+	if (buffer->buffer)
+		wl_buffer_destroy(buffer->buffer);
+	if (buffer->data)
+		munmap(buffer->data, buffer->size);
+#ifdef HAVE_SIMPLE_LOAD_DMABUF
+	if (type == BUFFER_TYPE_DMABUF && buffer->bo) {
+		if (buffer->fd >= 0)
+			close(buffer->fd);
+		gbm_bo_destroy(buffer->bo);
+	}
+#endif
+	memset(buffer, 0, sizeof *buffer);
+}
+
+/* Premultiplied, so that the alpha variant blends as intended */
+static uint32_t
+frame_color(const struct window *window, uint32_t frame, bool alpha)
+{
+	uint32_t a = alpha ? 0xc0 : 0xff;
+	uint32_t r = (window->index * 53 + frame * 3) & 0xff;
+	uint32_t g = (window->index * 101 + frame * 5) & 0xff;
+	uint32_t b = (window->index * 151 + frame * 7) & 0xff;
+
+	return a << 24 | (r * a / 0xff) << 16 | (g * a / 0xff) << 8 |
+	       (b * a / 0xff);
+}
+
+static void
+fill_rows(struct buffer *buffer, int width, int y, int rows, uint32_t color)
+{
+	uint32_t *row;
+	int i, j;
+
+	for (i = y; i < y + rows; i++) {
+		row = (uint32_t *)((char *) buffer->data + i * buffer->stride);
+		for (j = 0; j < width; j++)
+			row[j] = color;
+	}
+}
+
+static int
+band_rows(const struct layer *layer)
+{
+	return MAX(layer->height / 8, 1);
+}
+
+static int
+band_y(const struct layer *layer, uint32_t frame)
+{
+	int rows = band_rows(layer);
+
+	return (frame * rows) % (layer->height - rows + 1);
+}
+
+static struct buffer *
+layer_next_buffer(struct layer *layer)
+{
+	const struct options *opts = layer->window->display->opts;
+	struct buffer *buffer;
+	int i, ret = -1;
+
+	for (i = 0; i < LAYER_BUFFERS; i++) {
+		if (!layer->buffers[i].busy)
+			break;
+	}
+	if (i == LAYER_BUFFERS)
+		return NULL;
+
+	buffer = &layer->buffers[i];
+	if (buffer->buffer)
+		return buffer;
+
+	switch (opts->buffer_type) {
+	case BUFFER_TYPE_SHM:
+		ret = create_shm_buffer(layer, buffer);
+		break;
+	case BUFFER_TYPE_DMABUF:
+#ifdef HAVE_SIMPLE_LOAD_DMABUF
+		ret = create_dmabuf_buffer(layer, buffer);
+#endif
+		break;
+	case BUFFER_TYPE_EGL:
+		break;
+	}
+
+	if (ret < 0) {
+		buffer_fini(buffer, opts->buffer_type);
+		running = 0;
+		return NULL;
+	}
+
+	return buffer;
+}
+
+/*
+ * Paint with the CPU. For the band pattern the buffer has to be right
+ * outside the damage too, since a dmabuf is sampled as it is: the band
+ * this buffer showed last time is cleared as well as the one the
+ * compositor currently shows.
+ */
+static void
+layer_paint(struct layer *layer, struct buffer *buffer, uint32_t frame,
+	    int *damage_y, int *damage_rows)
+{
+	const struct options *opts = layer->window->display->opts;
+	uint32_t base = frame_color(layer->window, 0, opts->alpha);
+	int rows = band_rows(layer);
+	int y = band_y(layer, frame);
+	int prev_y = band_y(layer, frame - 1);
+
+#ifdef HAVE_SIMPLE_LOAD_DMABUF
+	if (opts->buffer_type == BUFFER_TYPE_DMABUF)
+		dmabuf_sync(buffer->fd, DMA_BUF_SYNC_START | DMA_BUF_SYNC_WRITE);
+#endif
+
+	if (opts->damage == DAMAGE_FULL || !buffer->painted) {
+		fill_rows(buffer, layer->width, 0, layer->height,
+			  opts->damage == DAMAGE_FULL ?
+			  frame_color(layer->window, frame, opts->alpha) :
+			  base);
+		*damage_y = 0;
+		*damage_rows = layer->height;
+	} else {
+		fill_rows(buffer, layer->width, buffer->band_y, rows, base);
+		fill_rows(buffer, layer->width, prev_y, rows, base);
+		*damage_y = MIN(y, prev_y);
+		*damage_rows = MAX(y, prev_y) + rows - *damage_y;
+	}
+
+	if (opts->damage == DAMAGE_BAND) {
+		fill_rows(buffer, layer->width, y, rows,
+			  frame_color(layer->window, frame, opts->alpha));
+		buffer->band_y = y;
+	}
+
+	buffer->painted = true;
+
+#ifdef HAVE_SIMPLE_LOAD_DMABUF
+	if (opts->buffer_type == BUFFER_TYPE_DMABUF)
+		dmabuf_sync(buffer->fd, DMA_BUF_SYNC_END | DMA_BUF_SYNC_WRITE);
+#endif
+}
+
+#ifdef HAVE_SIMPLE_LOAD_EGL
+static void
+egl_clear(uint32_t color)
+{
+	glClearColor((color >> 16 & 0xff) / 255.0f,
+		     (color >> 8 & 0xff) / 255.0f,
+		     (color & 0xff) / 255.0f,
+		     (color >> 24) / 255.0f);
+	glClear(GL_COLOR_BUFFER_BIT);
+}
+
+/* Redraws the whole surface, there is no buffer age to go by, but only
+ * posts the band as damage when the swap can carry it. */
+static void
+layer_draw_egl(struct layer *layer, uint32_t frame)
+{
+	struct display *display = layer->window->display;
+	const struct options *opts = display->opts;
+	int rows = band_rows(layer);
+	int y = band_y(layer, frame);
+	int prev_y = band_y(layer, frame - 1);
+	EGLint rect[4];
+	EGLBoolean ret;
+
+	ret = eglMakeCurrent(display->egl.dpy, layer->egl_surface,
+			     layer->egl_surface, display->egl.ctx);
+	assert(ret == EGL_TRUE);
+
+	glViewport(0, 0, layer->width, layer->height);
+
+	if (opts->damage == DAMAGE_FULL) {
+		egl_clear(frame_color(layer->window, frame, opts->alpha));
+	} else {
+		egl_clear(frame_color(layer->window, 0, opts->alpha));
+
+		/* GL has a bottom-left origin */
+		glEnable(GL_SCISSOR_TEST);
+		glScissor(0, layer->height - y - rows, layer->width, rows);
+		egl_clear(frame_color(layer->window, frame, opts->alpha));
+		glDisable(GL_SCISSOR_TEST);
+	}
+
+	if (opts->damage == DAMAGE_FULL || !layer->attached ||
+	    !display->egl.swap_buffers_with_damage) {
+		eglSwapBuffers(display->egl.dpy, layer->egl_surface);
+		layer->attached = true;
+		return;
+	}
+
+	rect[0] = 0;
+	rect[1] = layer->height - MAX(y, prev_y) - rows;
+	rect[2] = layer->width;
+	rect[3] = MAX(y, prev_y) + rows - MIN(y, prev_y);
+	display->egl.swap_buffers_with_damage(display->egl.dpy,
+					      layer->egl_surface, rect, 1);
+}
+#endif
+
+/* Attaches and commits one layer; children have to go first, so that
+ * their synchronized state is applied by the commit of the toplevel. */
+static void
+layer_draw(struct layer *layer, uint32_t frame)
+{
+	const struct options *opts = layer->window->display->opts;
+	struct buffer *buffer;
+	int damage_y, damage_rows;
+
+	if (opts->damage == DAMAGE_NONE && layer->attached) {
+		wl_surface_commit(layer->surface);
+		return;
+	}
+
+#ifdef HAVE_SIMPLE_LOAD_EGL
+	if (opts->buffer_type == BUFFER_TYPE_EGL) {
+		layer_draw_egl(layer, frame);
+		return;
+	}
+#endif
+
+	buffer = layer_next_buffer(layer);
+	if (!buffer) {
+		layer->window->stats.skipped++;
+		wl_surface_commit(layer->surface);
+		return;
+	}
+
+	layer_paint(layer, buffer, frame, &damage_y, &damage_rows);
+
+	wl_surface_attach(layer->surface, buffer->buffer, 0, 0);
+	wl_surface_damage(layer->surface, 0, damage_y,
+			  layer->width, damage_rows);
+	wl_surface_commit(layer->surface);
+	buffer->busy = true;
+	layer->attached = true;
+}
+
+static void
+feedback_destroy(struct feedback *feedback)
+{
+	wl_list_remove(&feedback->link);
+	wp_presentation_feedback_destroy(feedback->feedback);
+	free(feedback);
+}
+
+static void
+feedback_sync_output(void *data,
+		     struct wp_presentation_feedback *presentation_feedback,
+		     struct wl_output *output)
+{
+}
+
+static void
+feedback_presented(void *data,
+		   struct wp_presentation_feedback *presentation_feedback,
+		   uint32_t tv_sec_hi,
+		   uint32_t tv_sec_lo,
+		   uint32_t tv_nsec,
+		   uint32_t refresh_nsec,
+		   uint32_t seq_hi,
+		   uint32_t seq_lo,
+		   uint32_t flags)
+{
+	struct feedback *feedback = data;
+
+	feedback->window->stats.presented++;
+	feedback_destroy(feedback);
+}
+
+static void
+feedback_discarded(void *data,
+		   struct wp_presentation_feedback *presentation_feedback)
+{
+	struct feedback *feedback = data;
+
+	feedback->window->stats.discarded++;
+	feedback_destroy(feedback);
+}
+
+static const struct wp_presentation_feedback_listener feedback_listener = {
+	feedback_sync_output,
+	feedback_presented,
+	feedback_discarded
+};
+
+static void
+frame_done(void *data, struct wl_callback *callback, uint32_t time)
+{
+	struct window *window = data;
+
+	wl_callback_destroy(callback);
+	window->callback = NULL;
+
+	/* Without presentation feedback the frame callbacks are all there
+	 * is to count. */
+	if (!window->display->presentation)
+		window->stats.presented++;
+
+	if (running && window->display->opts->rate == 0)
+		window_redraw(window);
+}
+
+static const struct wl_callback_listener frame_listener = {
+	frame_done
+};
+
+static void
+window_redraw(struct window *window)
+{
+	struct display *display = window->display;
+	struct feedback *feedback;
+	int i;
+
+	window->frame++;
+
+	for (i = window->layer_count - 1; i > 0; i--)
+		layer_draw(&window->layers[i], window->frame);
+
+	/* Both are double-buffered state, picked up by the commit the
+	 * toplevel layer (or eglSwapBuffers) makes. */
+	window->callback = wl_surface_frame(window->layers[0].surface);
+	wl_callback_add_listener(window->callback, &frame_listener, window);
+
+	if (display->presentation) {
+		feedback = zalloc(sizeof *feedback);
+		assert(feedback);
+		feedback->window = window;
+		feedback->feedback =
+			wp_presentation_feedback(display->presentation,
+						 window->layers[0].surface);
+		wp_presentation_feedback_add_listener(feedback->feedback,
+						      &feedback_listener,
+						      feedback);
+		wl_list_insert(&display->feedback_list, &feedback->link);
+	}
+
+	layer_draw(&window->layers[0], window->frame);
+	window->stats.commits++;
+}
+
+static void
+handle_xdg_surface_configure(void *data, struct xdg_surface *surface,
+			     uint32_t serial)
+{
+	struct window *window = data;
+
+	xdg_surface_ack_configure(surface, serial);
+
+	if (window->configured)
+		return;
+
+	window->configured = true;
+
+	if (window->display->opts->rate == 0)
+		window_redraw(window);
+}
+
+static const struct xdg_surface_listener xdg_surface_listener = {
+	handle_xdg_surface_configure,
+};
+
+static void
+handle_xdg_toplevel_configure(void *data, struct xdg_toplevel *xdg_toplevel,
+			      int32_t width, int32_t height,
+			      struct wl_array *state)
+{
+}
+
+static void
+handle_xdg_toplevel_close(void *data, struct xdg_toplevel *xdg_toplevel)
+{
+	running = 0;
+}
+
+static const struct xdg_toplevel_listener xdg_toplevel_listener = {
+	handle_xdg_toplevel_configure,
+	handle_xdg_toplevel_close,
+};
+
+static int
+layer_init(struct window *window, struct layer *layer, struct layer *parent)
+{
+	struct display *display = window->display;
+	const struct options *opts = display->opts;
+	struct wl_region *opaque;
+
+	layer->window = window;
+	layer->surface = wl_compositor_create_surface(display->compositor);
+
+	if (parent) {
+		/* Each child covers the middle of its parent */
+		layer->width = MAX(parent->width * 3 / 4, 1);
+		layer->height = MAX(parent->height * 3 / 4, 1);
+		layer->subsurface =
+			wl_subcompositor_get_subsurface(display->subcompositor,
+							layer->surface,
+							parent->surface);
+		wl_subsurface_set_position(layer->subsurface,
+					   (parent->width - layer->width) / 2,
+					   (parent->height - layer->height) / 2);
+	} else {
+		layer->width = opts->width;
+		layer->height = opts->height;
+	}
+
+	if (!opts->alpha) {
+		opaque = wl_compositor_create_region(display->compositor);
+		wl_region_add(opaque, 0, 0, layer->width, layer->height);
+		wl_surface_set_opaque_region(layer->surface, opaque);
+		wl_region_destroy(opaque);
+	}
+
+#ifdef HAVE_SIMPLE_LOAD_EGL
+	if (opts->buffer_type == BUFFER_TYPE_EGL) {
+		layer->native = wl_egl_window_create(layer->surface,
+						     layer->width,
+						     layer->height);
+		layer->egl_surface =
+			weston_platform_create_egl_surface(display->egl.dpy,
+							   display->egl.conf,
+							   layer->native, NULL);
+		if (layer->egl_surface == EGL_NO_SURFACE)
+			return -1;
+
+		/* Pacing is ours, eglSwapBuffers must not wait for frames */
+		eglMakeCurrent(display->egl.dpy, layer->egl_surface,
+			       layer->egl_surface, display->egl.ctx);
+		eglSwapInterval(display->egl.dpy, 0);
+	}
+#endif
+
+	return 0;
+}
+
+static void
+layer_fini(struct layer *layer)
+{
+	const struct options *opts = layer->window->display->opts;
+	int i;
+
+	for (i = 0; i < LAYER_BUFFERS; i++)
+		buffer_fini(&layer->buffers[i], opts->buffer_type);
+
+#ifdef HAVE_SIMPLE_LOAD_EGL
+	if (layer->egl_surface) {
+		struct display *display = layer->window->display;
+
+		eglMakeCurrent(display->egl.dpy, EGL_NO_SURFACE,
+			       EGL_NO_SURFACE, EGL_NO_CONTEXT);
+		weston_platform_destroy_egl_surface(display->egl.dpy,
+						    layer->egl_surface);
+	}
+	if (layer->native)
+		wl_egl_window_destroy(layer->native);
+#endif
+
+	if (layer->subsurface)
+		wl_subsurface_destroy(layer->subsurface);
+	if (layer->surface)
+		wl_surface_destroy(layer->surface);
+}
+
+static void
+destroy_window(struct window *window)
+{
+	int i;
+
+	if (window->callback)
+		wl_callback_destroy(window->callback);
+
+	for (i = window->layer_count - 1; i > 0; i--)
+		layer_fini(&window->layers[i]);
+
+	if (window->xdg_toplevel)
+		xdg_toplevel_destroy(window->xdg_toplevel);
+	if (window->xdg_surface)
+		xdg_surface_destroy(window->xdg_surface);
+
+	if (window->layer_count > 0)
+		layer_fini(&window->layers[0]);
+
+	wl_list_remove(&window->link);
+	free(window->layers);
+	free(window);
+}
+
+static struct window *
+create_window(struct display *display, int index)
+{
+	const struct options *opts = display->opts;
+	struct window *window;
+	char title[64];
+	int i;
+
+	window = zalloc(sizeof *window);
+	if (!window)
+		return NULL;
+
+	window->display = display;
+	window->index = index;
+	wl_list_insert(display->window_list.prev, &window->link);
+
+	window->layers = zalloc((opts->depth + 1) * sizeof *window->layers);
+	if (!window->layers)
+		goto err;
+
+	for (i = 0; i <= opts->depth; i++) {
+		window->layer_count++;
+		if (layer_init(window, &window->layers[i],
+			       i > 0 ? &window->layers[i - 1] : NULL) < 0)
+			goto err;
+	}
+
+	window->xdg_surface =
+		xdg_wm_base_get_xdg_surface(display->wm_base,
+					    window->layers[0].surface);
+	xdg_surface_add_listener(window->xdg_surface,
+				 &xdg_surface_listener, window);
+
+	window->xdg_toplevel = xdg_surface_get_toplevel(window->xdg_surface);
+	xdg_toplevel_add_listener(window->xdg_toplevel,
+				  &xdg_toplevel_listener, window);
+
+	snprintf(title, sizeof title, "simple-load %d", index);
+	xdg_toplevel_set_title(window->xdg_toplevel, title);
+	xdg_toplevel_set_app_id(window->xdg_toplevel,
+				"org.freedesktop.weston.simple-load");
+
+	wl_surface_commit(window->layers[0].surface);
+
+	return window;
+
+err:
+	destroy_window(window);
+	return NULL;
+}
+
+static void
+dmabuf_modifier(void *data, struct zwp_linux_dmabuf_v1 *zwp_linux_dmabuf,
+		uint32_t format, uint32_t modifier_hi, uint32_t modifier_lo)
+{
+	struct display *d = data;
+	uint64_t modifier = ((uint64_t) modifier_hi << 32) | modifier_lo;
+
+#ifdef HAVE_SIMPLE_LOAD_DMABUF
+	if (modifier != DRM_FORMAT_MOD_LINEAR)
+		return;
+
+	if (format == DRM_FORMAT_ARGB8888)
+		d->dmabuf_linear_argb = true;
+	else if (format == DRM_FORMAT_XRGB8888)
+		d->dmabuf_linear_xrgb = true;
+#else
+	(void) d;
+	(void) modifier;
+#endif
+}
+
+static void
+dmabuf_format(void *data, struct zwp_linux_dmabuf_v1 *zwp_linux_dmabuf,
+	      uint32_t format)
+{
+	/* Superseded by the modifier events */
+}
+
+static const struct zwp_linux_dmabuf_v1_listener dmabuf_listener = {
+	dmabuf_format,
+	dmabuf_modifier
+};
+
+static void
+xdg_wm_base_ping(void *data, struct xdg_wm_base *shell, uint32_t serial)
+{
+	xdg_wm_base_pong(shell, serial);
+}
+
+static const struct xdg_wm_base_listener xdg_wm_base_listener = {
+	xdg_wm_base_ping,
+};
+
+static void
+registry_handle_global(void *data, struct wl_registry *registry,
+		       uint32_t id, const char *interface, uint32_t version)
+{
+	struct display *d = data;
+
+	if (strcmp(interface, "wl_compositor") == 0) {
+		d->compositor = wl_registry_bind(registry, id,
+						 &wl_compositor_interface, 1);
+	} else if (strcmp(interface, "wl_subcompositor") == 0) {
+		d->subcompositor = wl_registry_bind(registry, id,
+						    &wl_subcompositor_interface,
+						    1);
+	} else if (strcmp(interface, "xdg_wm_base") == 0) {
+		d->wm_base = wl_registry_bind(registry, id,
+					      &xdg_wm_base_interface, 1);
+		xdg_wm_base_add_listener(d->wm_base, &xdg_wm_base_listener, d);
+	} else if (strcmp(interface, "wl_shm") == 0) {
+		d->shm = wl_registry_bind(registry, id, &wl_shm_interface, 1);
+	} else if (strcmp(interface, "wp_presentation") == 0) {
+		d->presentation = wl_registry_bind(registry, id,
+						   &wp_presentation_interface,
+						   1);
+	} else if (strcmp(interface, "zwp_linux_dmabuf_v1") == 0 &&
+		   version >= 3) {
+		d->dmabuf = wl_registry_bind(registry, id,
+					     &zwp_linux_dmabuf_v1_interface, 3);
+		zwp_linux_dmabuf_v1_add_listener(d->dmabuf, &dmabuf_listener,
+						 d);
+	}
+}
+
+static void
+registry_handle_global_remove(void *data, struct wl_registry *registry,
+			      uint32_t name)
+{
+}
+
+static const struct wl_registry_listener registry_listener = {
+	registry_handle_global,
+	registry_handle_global_remove
+};
+
+#ifdef HAVE_SIMPLE_LOAD_EGL
+static bool
+display_init_egl(struct display *display)
+{
+	static const EGLint context_attribs[] = {
+		EGL_CONTEXT_CLIENT_VERSION, 2,
+		EGL_NONE
+	};
+	EGLint config_attribs[] = {
+		EGL_SURFACE_TYPE, EGL_WINDOW_BIT,
+		EGL_RED_SIZE, 8,
+		EGL_GREEN_SIZE, 8,
+		EGL_BLUE_SIZE, 8,
+		EGL_ALPHA_SIZE, 8,
+		EGL_RENDERABLE_TYPE, EGL_OPENGL_ES2_BIT,
+		EGL_NONE
+	};
+	const char *extensions;
+	EGLint major, minor, n;
+
+	if (!display->opts->alpha)
+		config_attribs[9] = 0;
+
+	display->egl.dpy =
+		weston_platform_get_egl_display(EGL_PLATFORM_WAYLAND_KHR,
+						display->display, NULL);
+	if (!display->egl.dpy ||
+	    !eglInitialize(display->egl.dpy, &major, &minor) ||
+	    !eglBindAPI(EGL_OPENGL_ES_API))
+		return false;
+
+	if (!eglChooseConfig(display->egl.dpy, config_attribs,
+			     &display->egl.conf, 1, &n) || n < 1)
+		return false;
+
+	display->egl.ctx = eglCreateContext(display->egl.dpy,
+					    display->egl.conf,
+					    EGL_NO_CONTEXT, context_attribs);
+	if (!display->egl.ctx)
+		return false;
+
+	extensions = eglQueryString(display->egl.dpy, EGL_EXTENSIONS);
+	if (extensions &&
+	    weston_check_egl_extension(extensions,
+				       "EGL_EXT_swap_buffers_with_damage"))
+		display->egl.swap_buffers_with_damage =
+			(PFNEGLSWAPBUFFERSWITHDAMAGEEXTPROC)
+			eglGetProcAddress("eglSwapBuffersWithDamageEXT");
+	else if (extensions &&
+		 weston_check_egl_extension(extensions,
+					    "EGL_KHR_swap_buffers_with_damage"))
+		/* The EXTPROC is identical to the KHR one */
+		display->egl.swap_buffers_with_damage =
+			(PFNEGLSWAPBUFFERSWITHDAMAGEEXTPROC)
+			eglGetProcAddress("eglSwapBuffersWithDamageKHR");
+
+	return true;
+}
+#endif
+
+#ifdef HAVE_SIMPLE_LOAD_DMABUF
+static bool
+display_init_gbm(struct display *display)
+{
+	if (!display->dmabuf ||
+	    !(display->opts->alpha ? display->dmabuf_linear_argb :
+				     display->dmabuf_linear_xrgb))
+		return false;
+
+	display->gbm_fd = open(display->opts->drm_node, O_RDWR | O_CLOEXEC);
+	if (display->gbm_fd < 0)
+		return false;
+
+	display->gbm = gbm_create_device(display->gbm_fd);
+
+	return display->gbm != NULL;
+}
+#endif
+
+static struct display *
+create_display(const struct options *opts)
+{
+	struct display *display;
+	bool ok = true;
+
+	display = zalloc(sizeof *display);
+	if (!display)
+		return NULL;
+
+	display->opts = opts;
+	wl_list_init(&display->window_list);
+	wl_list_init(&display->feedback_list);
+#ifdef HAVE_SIMPLE_LOAD_DMABUF
+	display->gbm_fd = -1;
+#endif
+
+	display->display = wl_display_connect(NULL);
+	if (!display->display) {
+		fprintf(stderr, "failed to connect to a Wayland display\n");
+		free(display);
+		return NULL;
+	}
+
+	display->registry = wl_display_get_registry(display->display);
+	wl_registry_add_listener(display->registry, &registry_listener,
+				 display);
+	/* The second roundtrip gets the events of the bound globals */
+	wl_display_roundtrip(display->display);
+	wl_display_roundtrip(display->display);
+
+	if (!display->compositor || !display->wm_base) {
+		fprintf(stderr, "wl_compositor and xdg_wm_base are required\n");
+		ok = false;
+	} else if (opts->depth > 0 && !display->subcompositor) {
+		fprintf(stderr, "subsurfaces need wl_subcompositor\n");
+		ok = false;
+	}
+
+	switch (opts->buffer_type) {
+	case BUFFER_TYPE_SHM:
+		if (!display->shm) {
+			fprintf(stderr, "wl_shm is not available\n");
+			ok = false;
+		}
+		break;
+	case BUFFER_TYPE_EGL:
+#ifdef HAVE_SIMPLE_LOAD_EGL
+		if (ok && !display_init_egl(display)) {
+			fprintf(stderr, "failed to set up EGL\n");
+			ok = false;
+		}
+#else
+		fprintf(stderr, "built without EGL support\n");
+		ok = false;
+#endif
+		break;
+	case BUFFER_TYPE_DMABUF:
+#ifdef HAVE_SIMPLE_LOAD_DMABUF
+		if (!display_init_gbm(display)) {
+			fprintf(stderr, "linear dmabufs from %s are not "
+				"usable\n", opts->drm_node);
+			ok = false;
+		}
+#else
+		fprintf(stderr, "built without dmabuf support\n");
+		ok = false;
+#endif
+		break;
+	}
+
+	if (!display->presentation)
+		fprintf(stderr, "wp_presentation is not available, counting "
+			"frame callbacks instead\n");
+
+	if (!ok) {
+		wl_display_disconnect(display->display);
+		free(display);
+		return NULL;
+	}
+
+	return display;
+}
+
+static void
+destroy_display(struct display *display)
+{
+	struct feedback *feedback, *tmp;
+
+	wl_list_for_each_safe(feedback, tmp, &display->feedback_list, link)
+		feedback_destroy(feedback);
+
+#ifdef HAVE_SIMPLE_LOAD_EGL
+	if (display->egl.dpy) {
+		if (display->egl.ctx)
+			eglDestroyContext(display->egl.dpy, display->egl.ctx);
+		eglTerminate(display->egl.dpy);
+		eglReleaseThread();
+	}
+#endif
+
+#ifdef HAVE_SIMPLE_LOAD_DMABUF
+	if (display->gbm)
+		gbm_device_destroy(display->gbm);
+	if (display->gbm_fd >= 0)
+		close(display->gbm_fd);
+#endif
+
+	if (display->dmabuf)
+		zwp_linux_dmabuf_v1_destroy(display->dmabuf);
+	if (display->presentation)
+		wp_presentation_destroy(display->presentation);
+	if (display->shm)
+		wl_shm_destroy(display->shm);
+	if (display->wm_base)
+		xdg_wm_base_destroy(display->wm_base);
+	if (display->subcompositor)
+		wl_subcompositor_destroy(display->subcompositor);
+	if (display->compositor)
+		wl_compositor_destroy(display->compositor);
+
+	wl_registry_destroy(display->registry);
+	wl_display_flush(display->display);
+	wl_display_disconnect(display->display);
+	free(display);
+}
+
+static void
+tick(struct display *display)
+{
+	struct window *window;
+
+	wl_list_for_each(window, &display->window_list, link) {
+		if (!window->configured)
+			continue;
+
+		/* Still waiting for the compositor to take the last one */
+		if (window->callback) {
+			window->stats.skipped++;
+			continue;
+		}
+
+		window_redraw(window);
+	}
+}
+
+/*
+ * Prints one line per interval: the frame rate achieved by the surfaces,
+ * with the slowest and the fastest, and what did not make it to the
+ * screen. Returns the totals of the interval.
+ */
+static void
+report(struct display *display, double secs, double elapsed,
+       struct stats *total)
+{
+	struct window *window;
+	struct stats sum = { 0 };
+	double fps, min_fps = 0.0, max_fps = 0.0;
+	bool first = true;
+
+	wl_list_for_each(window, &display->window_list, link) {
+		fps = window->stats.presented / secs;
+		if (first || fps < min_fps)
+			min_fps = fps;
+		if (first || fps > max_fps)
+			max_fps = fps;
+		first = false;
+
+		sum.presented += window->stats.presented;
+		sum.discarded += window->stats.discarded;
+		sum.commits += window->stats.commits;
+		sum.skipped += window->stats.skipped;
+		memset(&window->stats, 0, sizeof window->stats);
+	}
+
+	printf("%7.1f s: %.1f fps per surface (min %.1f, max %.1f), "
+	       "%.1f fps total, %.1f commits/s, %u discarded, %u skipped\n",
+	       elapsed, sum.presented / secs / display->opts->surfaces,
+	       min_fps, max_fps, sum.presented / secs, sum.commits / secs,
+	       sum.discarded, sum.skipped);
+	fflush(stdout);
+
+	total->presented += sum.presented;
+	total->discarded += sum.discarded;
+	total->commits += sum.commits;
+	total->skipped += sum.skipped;
+}
+
+static int
+create_timer(int hz_or_zero, int secs)
+{
+	struct itimerspec its = { 0 };
+	int fd;
+
+	fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+	if (fd < 0)
+		return -1;
+
+	if (hz_or_zero > 0)
+		timespec_from_nsec(&its.it_interval, NSEC_PER_SEC / hz_or_zero);
+	else
+		its.it_interval.tv_sec = secs;
+	its.it_value = its.it_interval;
+
+	if (timerfd_settime(fd, 0, &its, NULL) < 0) {
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+static bool
+timer_expired(int fd)
+{
+	uint64_t expirations;
+
+	return read(fd, &expirations, sizeof expirations) ==
+	       sizeof expirations;
+}
+
+static int
+run(struct display *display)
+{
+	const struct options *opts = display->opts;
+	struct pollfd fds[3];
+	struct timespec start, now, last;
+	struct stats total = { 0 };
+	double elapsed, secs;
+	int nfds = 2;
+	int ret = 0;
+
+	fds[0].fd = wl_display_get_fd(display->display);
+	fds[0].events = POLLIN;
+	fds[1].fd = create_timer(0, opts->interval);
+	fds[1].events = POLLIN;
+	if (opts->rate > 0) {
+		fds[2].fd = create_timer(opts->rate, 0);
+		fds[2].events = POLLIN;
+		nfds = 3;
+	}
+	if (fds[1].fd < 0 || (nfds == 3 && fds[2].fd < 0)) {
+		fprintf(stderr, "failed to create a timer: %s\n",
+			strerror(errno));
+		ret = -1;
+		goto out;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	last = start;
+
+	while (running) {
+		while (wl_display_prepare_read(display->display) != 0)
+			wl_display_dispatch_pending(display->display);
+
+		if (wl_display_flush(display->display) < 0 &&
+		    errno != EAGAIN) {
+			wl_display_cancel_read(display->display);
+			ret = -1;
+			break;
+		}
+
+		if (poll(fds, nfds, -1) < 0) {
+			wl_display_cancel_read(display->display);
+			if (errno == EINTR)
+				continue;
+			ret = -1;
+			break;
+		}
+
+		if (fds[0].revents & POLLIN) {
+			if (wl_display_read_events(display->display) < 0) {
+				ret = -1;
+				break;
+			}
+		} else {
+			wl_display_cancel_read(display->display);
+		}
+
+		if (fds[0].revents & (POLLERR | POLLHUP)) {
+			ret = -1;
+			break;
+		}
+
+		if (wl_display_dispatch_pending(display->display) < 0) {
+			ret = -1;
+			break;
+		}
+
+		if (nfds == 3 && (fds[2].revents & POLLIN) &&
+		    timer_expired(fds[2].fd))
+			tick(display);
+
+		if ((fds[1].revents & POLLIN) && timer_expired(fds[1].fd)) {
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			secs = timespec_sub_to_nsec(&now, &last) / 1e9;
+			elapsed = timespec_sub_to_nsec(&now, &start) / 1e9;
+			report(display, secs, elapsed, &total);
+			last = now;
+
+			if (opts->duration > 0 && elapsed >= opts->duration)
+				running = 0;
+		}
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	elapsed = timespec_sub_to_nsec(&now, &start) / 1e9;
+	if (elapsed > 0.0)
+		printf("total %.1f s: %d surfaces at %.1f fps each, "
+		       "%u discarded, %u skipped\n", elapsed, opts->surfaces,
+		       total.presented / elapsed / opts->surfaces,
+		       total.discarded, total.skipped);
+
+out:
+	if (fds[1].fd >= 0)
+		close(fds[1].fd);
+	if (nfds == 3 && fds[2].fd >= 0)
+		close(fds[2].fd);
+
+	return ret;
+}
+
+static void
+signal_int(int signum)
+{
+	running = 0;
+}
+
+static void
+usage(const char *name, int exit_code)
+{
+	fprintf(stderr, "Usage: %s [OPTIONS]\n\n"
+		"  -n, --surfaces=N       number of toplevel surfaces "
+		"(default: 16)\n"
+		"  -b, --buffer=TYPE      shm, egl or dmabuf (default: shm)\n"
+		"  -r, --rate=HZ          updates per second, 0 to redraw on "
+		"every frame\n"
+		"                         callback (default: 0)\n"
+		"  -d, --damage=PATTERN   full, band or none (default: full)\n"
+		"  -s, --depth=N          nested subsurfaces per surface "
+		"(default: 0)\n"
+		"  -a, --alpha            translucent instead of opaque "
+		"surfaces\n"
+		"  -W, --width=PIXELS     surface width (default: 128)\n"
+		"  -H, --height=PIXELS    surface height (default: 128)\n"
+		"  -t, --duration=SECS    stop after this long, 0 to run until "
+		"interrupted\n"
+		"                         (default: 0)\n"
+		"  -i, --interval=SECS    seconds between reports "
+		"(default: 1)\n"
+		"  -D, --drm-node=PATH    render node for dmabuf buffers\n"
+		"                         (default: /dev/dri/renderD128)\n"
+		"  -h, --help             show this help\n", name);
+	exit(exit_code);
+}
+
+static int
+parse_int(const char *arg, int min, const char *name)
+{
+	char *end;
+	long value;
+
+	errno = 0;
+	value = strtol(arg, &end, 10);
+	if (errno || *end != '\0' || value < min || value > 100000) {
+		fprintf(stderr, "invalid %s: %s\n", name, arg);
+		exit(EXIT_FAILURE);
+	}
+
+	return value;
+}
+
+int
+main(int argc, char **argv)
+{
+	static const struct option long_options[] = {
+		{ "surfaces", required_argument, NULL, 'n' },
+		{ "buffer", required_argument, NULL, 'b' },
+		{ "rate", required_argument, NULL, 'r' },
+		{ "damage", required_argument, NULL, 'd' },
+		{ "depth", required_argument, NULL, 's' },
+		{ "alpha", no_argument, NULL, 'a' },
+		{ "width", required_argument, NULL, 'W' },
+		{ "height", required_argument, NULL, 'H' },
+		{ "duration", required_argument, NULL, 't' },
+		{ "interval", required_argument, NULL, 'i' },
+		{ "drm-node", required_argument, NULL, 'D' },
+		{ "help", no_argument, NULL, 'h' },
+		{ 0, 0, NULL, 0 }
+	};
+	struct options opts = {
+		.surfaces = 16,
+		.buffer_type = BUFFER_TYPE_SHM,
+		.damage = DAMAGE_FULL,
+		.width = 128,
+		.height = 128,
+		.interval = 1,
+		.drm_node = "/dev/dri/renderD128",
+	};
+	struct sigaction sigint;
+	struct display *display;
+	struct window *window, *tmp;
+	int c, i, ret;
+
+	while ((c = getopt_long(argc, argv, "n:b:r:d:s:aW:H:t:i:D:h",
+				long_options, NULL)) != -1) {
+		switch (c) {
+		case 'n':
+			opts.surfaces = parse_int(optarg, 1, "surfaces");
+			break;
+		case 'b':
+			if (strcmp(optarg, "shm") == 0)
+				opts.buffer_type = BUFFER_TYPE_SHM;
+			else if (strcmp(optarg, "egl") == 0)
+				opts.buffer_type = BUFFER_TYPE_EGL;
+			else if (strcmp(optarg, "dmabuf") == 0)
+				opts.buffer_type = BUFFER_TYPE_DMABUF;
+			else
+				usage(argv[0], EXIT_FAILURE);
+			break;
+		case 'r':
+			opts.rate = parse_int(optarg, 0, "rate");
+			break;
+		case 'd':
+			if (strcmp(optarg, "full") == 0)
+				opts.damage = DAMAGE_FULL;
+			else if (strcmp(optarg, "band") == 0)
+				opts.damage = DAMAGE_BAND;
+			else if (strcmp(optarg, "none") == 0)
+				opts.damage = DAMAGE_NONE;
+			else
+				usage(argv[0], EXIT_FAILURE);
+			break;
+		case 's':
+			opts.depth = parse_int(optarg, 0, "depth");
+			break;
+		case 'a':
+			opts.alpha = true;
+			break;
+		case 'W':
+			opts.width = parse_int(optarg, 1, "width");
+			break;
+		case 'H':
+			opts.height = parse_int(optarg, 1, "height");
+			break;
+		case 't':
+			opts.duration = parse_int(optarg, 0, "duration");
+			break;
+		case 'i':
+			opts.interval = parse_int(optarg, 1, "interval");
+			break;
+		case 'D':
+			opts.drm_node = optarg;
+			break;
+		case 'h':
+			usage(argv[0], EXIT_SUCCESS);
+			break;
+		default:
+			usage(argv[0], EXIT_FAILURE);
+			break;
+		}
+	}
+
+	if (optind < argc)
+		usage(argv[0], EXIT_FAILURE);
+
+	display = create_display(&opts);
+	if (!display)
+		return EXIT_FAILURE;
+
+	for (i = 0; i < opts.surfaces; i++) {
+		window = create_window(display, i);
+		if (!window) {
+			fprintf(stderr, "failed to create surface %d\n", i);
+			running = 0;
+			break;
+		}
+	}
+
+	sigint.sa_handler = signal_int;
+	sigemptyset(&sigint.sa_mask);
+	sigint.sa_flags = SA_RESETHAND;
+	sigaction(SIGINT, &sigint, NULL);
+
+	ret = running ? run(display) : -1;
+
+	fprintf(stderr, "simple-load exiting\n");
+
+	wl_list_for_each_safe(window, tmp, &display->window_list, link)
+		destroy_window(window);
+	destroy_display(display);
+
+	return ret < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
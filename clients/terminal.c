@@ -431,6 +431,14 @@ enum {
 	SELECT_LINE
 };
 
+/* Glyphs for one ASCII cell, positioned relative to the cell origin */
+struct glyph_cache_entry {
+	int count;
+	cairo_glyph_t glyphs[4];
+};
+
+#define GLYPH_CACHE_SIZE 128
+
 struct terminal {
 	struct window *window;
 	struct widget *widget;
@@ -484,6 +492,22 @@ struct terminal {
 	int selection_end_row, selection_end_col;
 	struct wl_list link;
 	int pace_pipe;
+
+	/* The grid as last drawn into render.surface, so that a redraw
+	 * only renders the rows whose cells changed since. */
+	struct {
+		cairo_surface_t *surface;
+		int32_t width, height, scale;
+		int columns, rows;
+		double cell_width, cell_height;
+		uint32_t start;
+		int cursor_row, cursor_column, cursor_outline;
+		struct render_cell *cells;
+		char *dirty;
+	} render;
+
+	/* Indexed by [bold][character] */
+	struct glyph_cache_entry glyph_cache[2][GLYPH_CACHE_SIZE];
 };
 
 /* Create default tab stops, every 8 characters */
@@ -581,6 +605,11 @@ union decoded_attr {
 	uint32_t key;
 };
 
+struct render_cell {
+	union utf8_char ch;
+	union decoded_attr attr;
+};
+
 static void
 terminal_decode_attr(struct terminal *terminal, int row, int col,
 		     union decoded_attr *decoded)
@@ -1014,71 +1043,105 @@ glyph_run_flush(struct glyph_run *run, union decoded_attr attr)
 	run->attr = attr;
 }
 
+static int
+glyph_cache_lookup(struct terminal *terminal, cairo_scaled_font_t *font,
+		   int bold, union utf8_char *c, cairo_glyph_t **glyphs)
+{
+	struct glyph_cache_entry *entry;
+	cairo_glyph_t *g;
+	int num_glyphs;
+
+	if (c->byte[0] >= GLYPH_CACHE_SIZE ||
+	    c->byte[1] || c->byte[2] || c->byte[3])
+		return 0;
+
+	entry = &terminal->glyph_cache[bold][c->byte[0]];
+	if (entry->count == 0) {
+		g = entry->glyphs;
+		num_glyphs = ARRAY_LENGTH(entry->glyphs);
+		if (cairo_scaled_font_text_to_glyphs(font, 0, 0,
+						     (char *) c->byte, 4,
+						     &g, &num_glyphs,
+						     NULL, NULL, NULL) !=
+		    CAIRO_STATUS_SUCCESS)
+			return 0;
+		if (g != entry->glyphs) {
+			cairo_glyph_free(g);
+			return 0;
+		}
+		entry->count = num_glyphs;
+	}
+
+	*glyphs = entry->glyphs;
+	return entry->count;
+}
+
 static void
 glyph_run_add(struct glyph_run *run, int x, int y, union utf8_char *c)
 {
 	int num_glyphs;
 	cairo_scaled_font_t *font;
+	cairo_glyph_t *cached;
+	int bold, i;
 
 	num_glyphs = ARRAY_LENGTH(run->glyphs) - run->count;
 
-	if (run->attr.attr.a & (ATTRMASK_BOLD | ATTRMASK_BLINK))
+	bold = !!(run->attr.attr.a & (ATTRMASK_BOLD | ATTRMASK_BLINK));
+	if (bold)
 		font = run->terminal->font_bold;
 	else
 		font = run->terminal->font_normal;
 
 	cairo_move_to(run->cr, x, y);
-	cairo_scaled_font_text_to_glyphs (font, x, y,
-					  (char *) c->byte, 4,
-					  &run->g, &num_glyphs,
-					  NULL, NULL, NULL);
+
+	/* Shaping a cell is the same for every position, so reuse the
+	 * glyphs of plain ASCII cells, which also covers empty cells. */
+	i = glyph_cache_lookup(run->terminal, font, bold, c, &cached);
+	if (i > 0 && i <= num_glyphs) {
+		num_glyphs = i;
+		for (i = 0; i < num_glyphs; i++) {
+			run->g[i].index = cached[i].index;
+			run->g[i].x = cached[i].x + x;
+			run->g[i].y = cached[i].y + y;
+		}
+	} else {
+		cairo_scaled_font_text_to_glyphs (font, x, y,
+						  (char *) c->byte, 4,
+						  &run->g, &num_glyphs,
+						  NULL, NULL, NULL);
+	}
 	run->g += num_glyphs;
 	run->count += num_glyphs;
 }
 
-
+/* Draw rows first to last, clipped to the grid, with cr translated to the
+ * top left corner of the grid. */
 static void
-redraw_handler(struct widget *widget, void *data)
+terminal_draw_rows(struct terminal *terminal, cairo_t *cr,
+		   int first, int last)
 {
-	struct terminal *terminal = data;
-	struct rectangle allocation;
-	cairo_t *cr;
-	int top_margin, side_margin;
-	int row, col, cursor_x, cursor_y;
+	int row, col;
 	union utf8_char *p_row;
 	union decoded_attr attr;
 	int text_x, text_y;
-	cairo_surface_t *surface;
 	double d;
 	struct glyph_run run;
 	cairo_font_extents_t extents;
 	double average_width;
 	double unichar_width;
 
-	surface = window_get_surface(terminal->window);
-	widget_get_allocation(terminal->widget, &allocation);
-	cr = widget_cairo_create(terminal->widget);
-	cairo_rectangle(cr, allocation.x, allocation.y,
-			allocation.width, allocation.height);
-	cairo_clip(cr);
-	cairo_push_group(cr);
-
-	cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
-	terminal_set_color(terminal, cr, terminal->color_scheme->border);
-	cairo_paint(cr);
-
-	cairo_set_scaled_font(cr, terminal->font_normal);
-
 	extents = terminal->extents;
 	average_width = terminal->average_width;
-	side_margin = (allocation.width - terminal->width * average_width) / 2;
-	top_margin = (allocation.height - terminal->height * extents.height) / 2;
 
-	cairo_set_line_width(cr, 1.0);
-	cairo_translate(cr, allocation.x + side_margin,
-			allocation.y + top_margin);
+	if (first < 0)
+		first = 0;
+	if (last > terminal->height - 1)
+		last = terminal->height - 1;
+
+	cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
+
 	/* paint the background */
-	for (row = 0; row < terminal->height; row++) {
+	for (row = first; row <= last; row++) {
 		p_row = terminal_get_row(terminal, row);
 		for (col = 0; col < terminal->width; col++) {
 			/* get the attributes for this character cell */
@@ -1107,7 +1170,7 @@ redraw_handler(struct widget *widget, void *data)
 
 	/* paint the foreground */
 	glyph_run_init(&run, terminal, cr);
-	for (row = 0; row < terminal->height; row++) {
+	for (row = first; row <= last; row++) {
 		p_row = terminal_get_row(terminal, row);
 		for (col = 0; col < terminal->width; col++) {
 			/* get the attributes for this character cell */
@@ -1138,7 +1201,8 @@ redraw_handler(struct widget *widget, void *data)
 	glyph_run_flush(&run, attr);
 
 	if ((terminal->mode & MODE_SHOW_CURSOR) &&
-	    !window_has_focus(terminal->window)) {
+	    !window_has_focus(terminal->window) &&
+	    terminal->row >= first && terminal->row <= last) {
 		d = 0.5;
 
 		cairo_set_line_width(cr, 1);
@@ -1151,8 +1215,240 @@ redraw_handler(struct widget *widget, void *data)
 
 		cairo_stroke(cr);
 	}
+}
+
+/* Make the retained grid image match the current geometry; returns true
+ * when it was (re)created and everything has to be drawn. */
+static bool
+terminal_render_prepare(struct terminal *terminal,
+			struct rectangle *allocation, int32_t scale)
+{
+	size_t cells = (size_t) terminal->width * terminal->height;
+
+	if (terminal->render.surface &&
+	    terminal->render.width == allocation->width &&
+	    terminal->render.height == allocation->height &&
+	    terminal->render.scale == scale &&
+	    terminal->render.columns == terminal->width &&
+	    terminal->render.rows == terminal->height &&
+	    terminal->render.cell_width == terminal->average_width &&
+	    terminal->render.cell_height == terminal->extents.height)
+		return false;
+
+	if (terminal->render.surface)
+		cairo_surface_destroy(terminal->render.surface);
+	terminal->render.surface =
+		cairo_image_surface_create(CAIRO_FORMAT_ARGB32,
+					   allocation->width * scale,
+					   allocation->height * scale);
+	terminal->render.width = allocation->width;
+	terminal->render.height = allocation->height;
+	terminal->render.scale = scale;
+	terminal->render.columns = terminal->width;
+	terminal->render.rows = terminal->height;
+	terminal->render.cell_width = terminal->average_width;
+	terminal->render.cell_height = terminal->extents.height;
+
+	free(terminal->render.cells);
+	free(terminal->render.dirty);
+	terminal->render.cells = xzalloc(cells * sizeof(struct render_cell));
+	terminal->render.dirty = xzalloc(terminal->height);
+
+	return true;
+}
+
+/* Move the retained rows by the distance the view scrolled, so that
+ * only the rows scrolled into view need rendering. */
+static void
+terminal_render_scroll(struct terminal *terminal,
+		       struct rectangle *allocation, int top_margin, int d)
+{
+	struct render_cell *cells = terminal->render.cells;
+	int32_t scale = terminal->render.scale;
+	double row_pixels = terminal->extents.height * scale;
+	int rows = terminal->height;
+	size_t pitch = terminal->width;
+	unsigned char *data;
+	int stride, row_stride, n;
+
+	/* The grid only maps onto whole pixel rows with integer metrics,
+	 * which is what hinted fonts give. */
+	if (d == 0 || abs(d) >= rows || row_pixels != floor(row_pixels) ||
+	    top_margin < 0 ||
+	    (top_margin + rows * terminal->extents.height) > allocation->height)
+		return;
+
+	cairo_surface_flush(terminal->render.surface);
+	data = cairo_image_surface_get_data(terminal->render.surface);
+	stride = cairo_image_surface_get_stride(terminal->render.surface);
+	if (!data)
+		return;
+	row_stride = stride * (int) row_pixels;
+	data += (size_t) top_margin * scale * stride;
+	n = rows - abs(d);
+
+	if (d > 0) {
+		memmove(data, data + (size_t) d * row_stride,
+			(size_t) n * row_stride);
+		memmove(cells, cells + d * pitch, n * pitch * sizeof *cells);
+		memset(cells + n * pitch, 0xff, d * pitch * sizeof *cells);
+		/* It lost the glyph overhang of the row scrolled out. */
+		terminal->render.dirty[0] = 1;
+	} else {
+		memmove(data + (size_t) -d * row_stride, data,
+			(size_t) n * row_stride);
+		memmove(cells - d * pitch, cells, n * pitch * sizeof *cells);
+		memset(cells, 0xff, -d * pitch * sizeof *cells);
+		terminal->render.dirty[rows - 1] = 1;
+	}
+	cairo_surface_mark_dirty(terminal->render.surface);
 
-	cairo_pop_group_to_source(cr);
+	widget_add_damage(terminal->widget, allocation->x, allocation->y,
+			  allocation->width, allocation->height);
+
+	terminal->render.cursor_row -= d;
+}
+
+/* Compare the grid with what was drawn last, marking the rows that
+ * changed, and remember the new contents. */
+static void
+terminal_render_diff(struct terminal *terminal, bool full)
+{
+	struct render_cell cell, *cells;
+	int row, col, outline;
+	char *dirty = terminal->render.dirty;
+
+	for (row = 0; row < terminal->height; row++) {
+		union utf8_char *p_row = terminal_get_row(terminal, row);
+
+		cells = terminal->render.cells + (size_t) row * terminal->width;
+		for (col = 0; col < terminal->width; col++) {
+			cell.ch = p_row[col];
+			terminal_decode_attr(terminal, row, col, &cell.attr);
+			if (cells[col].ch.ch != cell.ch.ch ||
+			    cells[col].attr.key != cell.attr.key) {
+				cells[col] = cell;
+				dirty[row] = 1;
+			}
+		}
+		if (full)
+			dirty[row] = 1;
+	}
+
+	/* The outline cursor of an unfocused window is not part of the
+	 * cell attributes. */
+	outline = (terminal->mode & MODE_SHOW_CURSOR) &&
+		  !window_has_focus(terminal->window);
+	if (outline != terminal->render.cursor_outline ||
+	    terminal->row != terminal->render.cursor_row ||
+	    terminal->column != terminal->render.cursor_column) {
+		if (terminal->render.cursor_outline &&
+		    terminal->render.cursor_row >= 0 &&
+		    terminal->render.cursor_row < terminal->height)
+			dirty[terminal->render.cursor_row] = 1;
+		if (outline && terminal->row >= 0 &&
+		    terminal->row < terminal->height)
+			dirty[terminal->row] = 1;
+	}
+	terminal->render.cursor_outline = outline;
+	terminal->render.cursor_row = terminal->row;
+	terminal->render.cursor_column = terminal->column;
+}
+
+static bool
+terminal_row_needs_paint(struct terminal *terminal, int row)
+{
+	char *dirty = terminal->render.dirty;
+
+	return dirty[row] ||
+	       (row > 0 && dirty[row - 1]) ||
+	       (row + 1 < terminal->height && dirty[row + 1]);
+}
+
+static void
+redraw_handler(struct widget *widget, void *data)
+{
+	struct terminal *terminal = data;
+	struct rectangle allocation;
+	cairo_t *cr;
+	int top_margin, side_margin;
+	int first, last, cursor_x, cursor_y;
+	cairo_surface_t *surface;
+	cairo_font_extents_t extents;
+	double average_width;
+	double y0, y1;
+	char *dirty;
+	int32_t scale;
+	bool full;
+
+	surface = window_get_surface(terminal->window);
+	widget_get_allocation(terminal->widget, &allocation);
+	scale = window_get_buffer_scale(terminal->window);
+
+	extents = terminal->extents;
+	average_width = terminal->average_width;
+	side_margin = (allocation.width - terminal->width * average_width) / 2;
+	top_margin = (allocation.height - terminal->height * extents.height) / 2;
+
+	full = terminal_render_prepare(terminal, &allocation, scale);
+	if (!full)
+		terminal_render_scroll(terminal, &allocation, top_margin,
+				       (int32_t) (terminal->start -
+						  terminal->render.start));
+	terminal->render.start = terminal->start;
+	terminal_render_diff(terminal, full);
+
+	cr = cairo_create(terminal->render.surface);
+	cairo_scale(cr, scale, scale);
+	cairo_translate(cr, -allocation.x, -allocation.y);
+	cairo_set_scaled_font(cr, terminal->font_normal);
+	cairo_set_line_width(cr, 1.0);
+
+	/* Render each run of rows that changed or are next to one that
+	 * did: glyphs overhang into the neighbouring rows. A run is drawn
+	 * from scratch within its band, including the rows around it. */
+	dirty = terminal->render.dirty;
+	for (first = 0; first < terminal->height; first = last + 1) {
+		last = first;
+		if (!terminal_row_needs_paint(terminal, first))
+			continue;
+
+		while (last + 1 < terminal->height &&
+		       terminal_row_needs_paint(terminal, last + 1))
+			last++;
+
+		y0 = first == 0 ? 0 :
+			floor(top_margin + first * extents.height);
+		y1 = last == terminal->height - 1 ? allocation.height :
+			ceil(top_margin + (last + 1) * extents.height);
+
+		cairo_save(cr);
+		cairo_rectangle(cr, allocation.x, allocation.y + y0,
+				allocation.width, y1 - y0);
+		cairo_clip(cr);
+
+		cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
+		terminal_set_color(terminal, cr, terminal->color_scheme->border);
+		cairo_paint(cr);
+
+		cairo_translate(cr, allocation.x + side_margin,
+				allocation.y + top_margin);
+		terminal_draw_rows(terminal, cr, first - 1, last + 1);
+		cairo_restore(cr);
+
+		widget_add_damage(widget, allocation.x, allocation.y + y0,
+				  allocation.width, y1 - y0);
+	}
+	memset(dirty, 0, terminal->height);
+	cairo_destroy(cr);
+
+	cr = widget_cairo_create(terminal->widget);
+	cairo_rectangle(cr, allocation.x, allocation.y,
+			allocation.width, allocation.height);
+	cairo_clip(cr);
+	cairo_translate(cr, allocation.x, allocation.y);
+	cairo_scale(cr, 1.0 / scale, 1.0 / scale);
+	cairo_set_source_surface(cr, terminal->render.surface, 0, 0);
 	cairo_paint(cr);
 	cairo_destroy(cr);
 	cairo_surface_destroy(surface);
@@ -2182,7 +2478,7 @@ terminal_data(struct terminal *terminal, const char *data, size_t length)
 		} /* if */
 	} /* for */
 
-	window_schedule_redraw(terminal->window);
+	widget_schedule_partial_redraw(terminal->widget);
 }
 
 static void
@@ -2344,7 +2640,7 @@ handle_bound_key(struct terminal *terminal,
 		terminal->row++;
 		terminal->selection_start_row++;
 		terminal->selection_end_row++;
-		widget_schedule_redraw(terminal->widget);
+		widget_schedule_partial_redraw(terminal->widget);
 		return 1;
 
 	case XKB_KEY_Down:
@@ -2359,7 +2655,7 @@ handle_bound_key(struct terminal *terminal,
 		terminal->row--;
 		terminal->selection_start_row--;
 		terminal->selection_end_row--;
-		widget_schedule_redraw(terminal->widget);
+		widget_schedule_partial_redraw(terminal->widget);
 		return 1;
 
 	default:
@@ -2586,7 +2882,7 @@ key_handler(struct window *window, struct input *input, uint32_t time,
 			terminal->selection_end_row -= d;
 			terminal->start = terminal->saved_start;
 			terminal->scrolling = 0;
-			widget_schedule_redraw(terminal->widget);
+			widget_schedule_partial_redraw(terminal->widget);
 		}
 
 		terminal_write(terminal, ch, len);
@@ -2777,7 +3073,7 @@ click_handler(struct widget *widget, struct terminal *terminal,
 	terminal->selection_end_x = terminal->selection_start_x = x;
 	terminal->selection_end_y = terminal->selection_start_y = y;
 	if (recompute_selection(terminal))
-			widget_schedule_redraw(widget);
+			widget_schedule_partial_redraw(widget);
 }
 
 static void
@@ -2826,7 +3122,7 @@ motion_handler(struct widget *widget,
 				   &terminal->selection_end_y);
 
 		if (recompute_selection(terminal))
-			widget_schedule_redraw(widget);
+			widget_schedule_partial_redraw(widget);
 	}
 
 	return CURSOR_IBEAM;
@@ -2877,7 +3173,7 @@ axis_handler(struct widget *widget,
 		terminal->selection_start_row -= lines;
 		terminal->selection_end_row -= lines;
 
-		widget_schedule_redraw(widget);
+		widget_schedule_partial_redraw(widget);
 	}
 }
 
@@ -2924,7 +3220,7 @@ touch_motion_handler(struct widget *widget, struct input *input,
 		terminal->selection_end_y = (int)y;
 
 		if (recompute_selection(terminal))
-			widget_schedule_redraw(widget);
+			widget_schedule_partial_redraw(widget);
 	}
 }
 
@@ -3030,6 +3326,10 @@ terminal_destroy(struct terminal *terminal)
 	if (wl_list_empty(&terminal_list))
 		display_exit(terminal->display);
 
+	if (terminal->render.surface)
+		cairo_surface_destroy(terminal->render.surface);
+	free(terminal->render.cells);
+	free(terminal->render.dirty);
 	free(terminal->title);
 	free(terminal);
 }
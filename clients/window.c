@@ -40,8 +40,15 @@
 #include <sys/mman.h>
 #include <sys/epoll.h>
 #include <sys/timerfd.h>
+#include <sys/ioctl.h>
 #include <stdbool.h>
 
+#ifdef HAVE_TOYTOOLKIT_DMABUF
+#include <gbm.h>
+#include <drm_fourcc.h>
+#include <linux/dma-buf.h>
+#endif
+
 #ifdef HAVE_CAIRO_EGL
 #include <wayland-egl.h>
 
@@ -80,15 +87,23 @@ typedef void *EGLContext;
 #include "relative-pointer-unstable-v1-client-protocol.h"
 #include "shared/os-compatibility.h"
 #include "shared/string-helpers.h"
+#include "shared/timespec-util.h"
 
 #include "window.h"
 #include "viewporter-client-protocol.h"
+#include "presentation-time-client-protocol.h"
+#ifdef HAVE_TOYTOOLKIT_DMABUF
+#include "linux-dmabuf-unstable-v1-client-protocol.h"
+#endif
 
 #define ZWP_RELATIVE_POINTER_MANAGER_V1_VERSION 1
 #define ZWP_POINTER_CONSTRAINTS_V1_VERSION 1
 
 #define DEFAULT_XCURSOR_SIZE 32
 
+/* Weston's default repaint window plus a millisecond of slack */
+#define DEFAULT_REDRAW_DEADLINE_MSEC 8
+
 struct shm_pool;
 
 struct global {
@@ -102,6 +117,7 @@ struct display {
 	struct wl_display *display;
 	struct wl_registry *registry;
 	struct wl_compositor *compositor;
+	uint32_t compositor_version;
 	struct wl_subcompositor *subcompositor;
 	struct wl_shm *shm;
 	struct wl_data_device_manager *data_device_manager;
@@ -148,6 +164,21 @@ struct display {
 
 	int data_device_manager_version;
 	struct wp_viewporter *viewporter;
+
+	struct wp_presentation *presentation;
+	clockid_t presentation_clock;
+	/* Redraws start this long before the predicted presentation, see
+	 * window_defer_redraw(); zero disables the prediction. */
+	int64_t redraw_deadline_nsec;
+	bool frame_stats;
+
+#ifdef HAVE_TOYTOOLKIT_DMABUF
+	struct zwp_linux_dmabuf_v1 *dmabuf;
+	bool dmabuf_linear_argb, dmabuf_linear_xrgb;
+	struct gbm_device *gbm;
+	int gbm_fd;
+	bool gbm_failed;
+#endif
 };
 
 struct window_output {
@@ -173,9 +204,12 @@ struct toysurface {
 	 * Post the surface to the server, returning the server allocation
 	 * rectangle. The Cairo surface from prepare() must be destroyed
 	 * after calling this.
+	 * damage is the changed area in surface coordinates, or NULL
+	 * when the whole surface may have changed.
 	 */
 	void (*swap)(struct toysurface *base,
 		     enum wl_output_transform buffer_transform, int32_t buffer_scale,
+		     const struct rectangle *damage,
 		     struct rectangle *server_allocation);
 
 	/*
@@ -207,6 +241,10 @@ struct surface {
 	struct toysurface *toysurface;
 	struct widget *widget;
 	int redraw_needed;
+	/* Set by any redraw request other than a partial one; otherwise only
+	 * the area added with widget_add_damage() is posted as damage. */
+	int damage_full;
+	struct rectangle damage;
 	struct wl_callback *frame_cb;
 	uint32_t last_time;
 
@@ -226,6 +264,27 @@ struct surface {
 	struct wp_viewport *viewport;
 };
 
+/* What TOYTOOLKIT_FRAME_STATS shows over the window */
+struct window_frame_stats {
+	uint32_t presented;
+	uint32_t discarded;
+	/* Presented later than the redraw was scheduled for */
+	uint32_t missed;
+	int64_t latency_nsec;
+	double fps;
+
+	struct timespec period_start;
+	uint32_t period_frames;
+};
+
+struct window_feedback {
+	struct window *window;
+	struct wp_presentation_feedback *feedback;
+	struct timespec commit;
+	struct timespec target;
+	struct wl_list link;
+};
+
 struct window {
 	struct display *display;
 	struct wl_list window_output_list;
@@ -241,6 +300,17 @@ struct window {
 	int redraw_task_scheduled;
 	struct task redraw_task;
 	int resize_needed;
+
+	/* Presentation-paced redraws, see window_defer_redraw() */
+	struct toytimer redraw_timer;
+	bool redraw_timer_ready;
+	bool redraw_timer_armed;
+	struct timespec redraw_target;
+	struct timespec last_present;
+	uint32_t refresh_nsec;
+	int64_t draw_nsec;
+	struct wl_list feedback_list; /* window_feedback::link */
+	struct window_frame_stats frame_stats;
 	int custom;
 	int focused;
 
@@ -577,6 +647,7 @@ egl_window_surface_prepare(struct toysurface *base, int dx, int dy,
 static void
 egl_window_surface_swap(struct toysurface *base,
 			enum wl_output_transform buffer_transform, int32_t buffer_scale,
+			const struct rectangle *damage,
 			struct rectangle *server_allocation)
 {
 	struct egl_window_surface *surface = to_egl_window_surface(base);
@@ -944,7 +1015,8 @@ struct shm_surface_leaf {
 	/* 'data' is automatically destroyed, when 'cairo_surface' is */
 	struct shm_surface_data *data;
 
-	struct shm_pool *resize_pool;
+	/* Backing storage, kept across buffer size changes while it fits */
+	struct shm_pool *pool;
 	int busy;
 };
 
@@ -955,12 +1027,34 @@ shm_surface_leaf_release(struct shm_surface_leaf *leaf)
 		cairo_surface_destroy(leaf->cairo_surface);
 	/* leaf->data already destroyed via cairo private */
 
-	if (leaf->resize_pool)
-		shm_pool_destroy(leaf->resize_pool);
+	if (leaf->pool)
+		shm_pool_destroy(leaf->pool);
 
 	memset(leaf, 0, sizeof *leaf);
 }
 
+#define SHM_POOL_MIN_SIZE (64 * 1024)
+#define SHM_RESIZE_POOL_SIZE (6 * 1024 * 1024)
+
+/* Round a buffer size up to a size class: four classes per power of two,
+ * so a pool wastes at most a quarter of its size, and a buffer that
+ * changes size a little keeps fitting in the same pool. */
+static size_t
+shm_pool_size_class(size_t length)
+{
+	size_t p = SHM_POOL_MIN_SIZE;
+	size_t step;
+
+	if (length <= p)
+		return p;
+
+	while (p <= length / 2)
+		p *= 2;
+	step = p / 4;
+
+	return (length + step - 1) / step * step;
+}
+
 #define MAX_LEAVES 3
 
 struct shm_surface {
@@ -1053,6 +1147,7 @@ shm_surface_prepare(struct toysurface *base, int dx, int dy,
 	struct shm_surface *surface = to_shm_surface(base);
 	struct rectangle rect = { 0};
 	struct shm_surface_leaf *leaf = NULL;
+	size_t length, capacity;
 	int i;
 
 	surface->dx = dx;
@@ -1076,13 +1171,6 @@ shm_surface_prepare(struct toysurface *base, int dx, int dy,
 		return NULL;
 	}
 
-	if (!resize_hint && leaf->resize_pool) {
-		cairo_surface_destroy(leaf->cairo_surface);
-		leaf->cairo_surface = NULL;
-		shm_pool_destroy(leaf->resize_pool);
-		leaf->resize_pool = NULL;
-	}
-
 	surface_to_buffer_size (buffer_transform, buffer_scale, &width, &height);
 
 	if (leaf->cairo_surface &&
@@ -1090,29 +1178,41 @@ shm_surface_prepare(struct toysurface *base, int dx, int dy,
 	    cairo_image_surface_get_height(leaf->cairo_surface) == height)
 		goto out;
 
-	if (leaf->cairo_surface)
+	if (leaf->cairo_surface) {
 		cairo_surface_destroy(leaf->cairo_surface);
-
-#ifdef USE_RESIZE_POOL
-	if (resize_hint && !leaf->resize_pool) {
-		/* Create a big pool to allocate from, while continuously
-		 * resizing. Mmapping a new pool in the server
-		 * is relatively expensive, so reusing a pool performs
-		 * better, but may temporarily reserve unneeded memory.
-		 */
-		/* We should probably base this number on the output size. */
-		leaf->resize_pool = shm_pool_create(surface->display,
-						    6 * 1024 * 1024);
+		leaf->cairo_surface = NULL;
 	}
-#endif
 
 	rect.width = width;
 	rect.height = height;
+	length = data_length_for_shm_surface(&rect);
+	capacity = shm_pool_size_class(length);
+
+#ifdef USE_RESIZE_POOL
+	/* Start continuous resizing with a big pool, so that growing the
+	 * window does not have to step through the size classes. */
+	if (resize_hint && capacity < SHM_RESIZE_POOL_SIZE)
+		capacity = SHM_RESIZE_POOL_SIZE;
+#endif
+
+	/* The leaf is not busy, so its pool can be handed out again for a
+	 * buffer of the new size: mmapping a new pool in the server is
+	 * relatively expensive. Drop the pool when it is too small, or when
+	 * far too large once interactive resizing is over. */
+	if (leaf->pool &&
+	    (leaf->pool->size < length ||
+	     (!resize_hint && leaf->pool->size > 2 * capacity))) {
+		shm_pool_destroy(leaf->pool);
+		leaf->pool = NULL;
+	}
+
+	if (!leaf->pool)
+		leaf->pool = shm_pool_create(surface->display, capacity);
 
 	leaf->cairo_surface =
 		display_create_shm_surface(surface->display, &rect,
 					   surface->flags,
-					   leaf->resize_pool,
+					   leaf->pool,
 					   &leaf->data);
 	if (!leaf->cairo_surface)
 		return NULL;
@@ -1126,9 +1226,32 @@ out:
 	return cairo_surface_reference(leaf->cairo_surface);
 }
 
+static void
+surface_post_damage(struct display *display, struct wl_surface *surface,
+		    enum wl_output_transform buffer_transform,
+		    int32_t buffer_scale, const struct rectangle *damage)
+{
+	/* wl_surface.damage_buffer avoids the compositor rounding the
+	 * rectangle out to whole scaled pixels; it is only used for the
+	 * untransformed case so no rotation of the rectangle is needed. */
+	if (display->compositor_version >=
+	    WL_SURFACE_DAMAGE_BUFFER_SINCE_VERSION &&
+	    buffer_transform == WL_OUTPUT_TRANSFORM_NORMAL) {
+		wl_surface_damage_buffer(surface,
+					 damage->x * buffer_scale,
+					 damage->y * buffer_scale,
+					 damage->width * buffer_scale,
+					 damage->height * buffer_scale);
+	} else {
+		wl_surface_damage(surface, damage->x, damage->y,
+				  damage->width, damage->height);
+	}
+}
+
 static void
 shm_surface_swap(struct toysurface *base,
 		 enum wl_output_transform buffer_transform, int32_t buffer_scale,
+		 const struct rectangle *damage,
 		 struct rectangle *server_allocation)
 {
 	struct shm_surface *surface = to_shm_surface(base);
@@ -1145,8 +1268,13 @@ shm_surface_swap(struct toysurface *base,
 
 	wl_surface_attach(surface->surface, leaf->data->buffer,
 			  surface->dx, surface->dy);
-	wl_surface_damage(surface->surface, 0, 0,
-			  server_allocation->width, server_allocation->height);
+	if (damage)
+		surface_post_damage(surface->display, surface->surface,
+				    buffer_transform, buffer_scale, damage);
+	else
+		wl_surface_damage(surface->surface, 0, 0,
+				  server_allocation->width,
+				  server_allocation->height);
 	wl_surface_commit(surface->surface);
 
 	DBG_OBJ(surface->surface, "leaf %d busy\n",
@@ -1200,6 +1328,406 @@ shm_surface_create(struct display *display, struct wl_surface *wl_surface,
 	return &surface->base;
 }
 
+#ifdef HAVE_TOYTOOLKIT_DMABUF
+/*
+ * A toysurface drawn with cairo-image straight into linear dmabufs, so
+ * that the compositor can sample or scan them out without the copy it
+ * has to do for wl_shm buffers.
+ */
+struct dmabuf_surface_leaf {
+	struct gbm_bo *bo;
+	int fd;
+	void *map;
+	size_t map_size;
+	cairo_surface_t *cairo_surface;
+	struct wl_buffer *buffer;
+	int busy;
+};
+
+struct dmabuf_surface {
+	struct toysurface base;
+	struct display *display;
+	struct wl_surface *surface;
+	uint32_t flags;
+	int dx, dy;
+
+	struct dmabuf_surface_leaf leaf[MAX_LEAVES];
+	struct dmabuf_surface_leaf *current;
+
+	/* Takes over when a dmabuf could not be allocated */
+	struct toysurface *fallback;
+};
+
+static struct dmabuf_surface *
+to_dmabuf_surface(struct toysurface *base)
+{
+	return container_of(base, struct dmabuf_surface, base);
+}
+
+static void
+dmabuf_sync(int fd, uint64_t flags)
+{
+	struct dma_buf_sync sync = { .flags = flags };
+	int ret;
+
+	do {
+		ret = ioctl(fd, DMA_BUF_IOCTL_SYNC, &sync);
+	} while (ret < 0 && (errno == EINTR || errno == EAGAIN));
+}
+
+static void
+dmabuf_surface_leaf_release(struct dmabuf_surface_leaf *leaf)
+{
+	if (leaf->cairo_surface)
+		cairo_surface_destroy(leaf->cairo_surface);
+	if (leaf->map)
+		munmap(leaf->map, leaf->map_size);
+	if (leaf->buffer)
+		wl_buffer_destroy(leaf->buffer);
+	if (leaf->fd >= 0)
+		close(leaf->fd);
+	if (leaf->bo)
+		gbm_bo_destroy(leaf->bo);
+
+	memset(leaf, 0, sizeof *leaf);
+	leaf->fd = -1;
+}
+
+static void
+dmabuf_surface_buffer_release(void *data, struct wl_buffer *buffer)
+{
+	struct dmabuf_surface *surface = data;
+	struct dmabuf_surface_leaf *leaf;
+	int i;
+	int free_found;
+
+	for (i = 0; i < MAX_LEAVES; i++) {
+		leaf = &surface->leaf[i];
+		if (leaf->buffer == buffer) {
+			leaf->busy = 0;
+			break;
+		}
+	}
+	assert(i < MAX_LEAVES && "unknown buffer released");
+
+	/* Leave one free leaf with storage, release others */
+	free_found = 0;
+	for (i = 0; i < MAX_LEAVES; i++) {
+		leaf = &surface->leaf[i];
+
+		if (!leaf->cairo_surface || leaf->busy)
+			continue;
+
+		if (!free_found)
+			free_found = 1;
+		else
+			dmabuf_surface_leaf_release(leaf);
+	}
+}
+
+static const struct wl_buffer_listener dmabuf_surface_buffer_listener = {
+	dmabuf_surface_buffer_release
+};
+
+static struct gbm_bo *
+dmabuf_create_bo(struct display *display, int32_t width, int32_t height,
+		 uint32_t format)
+{
+	struct gbm_bo *bo;
+
+	/* Ask for a buffer the display controller can use too, so that
+	 * scanning it out stays possible; not every device has one. */
+	bo = gbm_bo_create(display->gbm, width, height, format,
+			   GBM_BO_USE_LINEAR | GBM_BO_USE_SCANOUT |
+			   GBM_BO_USE_RENDERING);
+	if (!bo)
+		bo = gbm_bo_create(display->gbm, width, height, format,
+				   GBM_BO_USE_LINEAR | GBM_BO_USE_RENDERING);
+
+	return bo;
+}
+
+static int
+dmabuf_surface_leaf_create(struct dmabuf_surface *surface,
+			   struct dmabuf_surface_leaf *leaf,
+			   int32_t width, int32_t height)
+{
+	struct display *display = surface->display;
+	struct zwp_linux_buffer_params_v1 *params;
+	uint32_t format, stride;
+
+	if (surface->flags & SURFACE_OPAQUE)
+		format = DRM_FORMAT_XRGB8888;
+	else
+		format = DRM_FORMAT_ARGB8888;
+
+	leaf->fd = -1;
+	leaf->bo = dmabuf_create_bo(display, width, height, format);
+	if (!leaf->bo)
+		goto err;
+
+	stride = gbm_bo_get_stride(leaf->bo);
+	leaf->fd = gbm_bo_get_fd(leaf->bo);
+	if (leaf->fd < 0)
+		goto err;
+
+	leaf->map_size = (size_t) stride * height;
+	leaf->map = mmap(NULL, leaf->map_size, PROT_READ | PROT_WRITE,
+			 MAP_SHARED, leaf->fd, 0);
+	if (leaf->map == MAP_FAILED) {
+		leaf->map = NULL;
+		goto err;
+	}
+
+	leaf->cairo_surface =
+		cairo_image_surface_create_for_data(leaf->map,
+						    CAIRO_FORMAT_ARGB32,
+						    width, height, stride);
+	if (cairo_surface_status(leaf->cairo_surface) != CAIRO_STATUS_SUCCESS)
+		goto err;
+
+	params = zwp_linux_dmabuf_v1_create_params(display->dmabuf);
+	zwp_linux_buffer_params_v1_add(params, leaf->fd, 0, 0, stride,
+				       DRM_FORMAT_MOD_LINEAR >> 32,
+				       DRM_FORMAT_MOD_LINEAR & 0xffffffff);
+	leaf->buffer = zwp_linux_buffer_params_v1_create_immed(params,
+							       width, height,
+							       format, 0);
+	zwp_linux_buffer_params_v1_destroy(params);
+	wl_buffer_add_listener(leaf->buffer,
+			       &dmabuf_surface_buffer_listener, surface);
+
+	return 0;
+
+err:
+	dmabuf_surface_leaf_release(leaf);
+	return -1;
+}
+
+static cairo_surface_t *
+dmabuf_surface_prepare(struct toysurface *base, int dx, int dy,
+		       int32_t width, int32_t height, uint32_t flags,
+		       enum wl_output_transform buffer_transform,
+		       int32_t buffer_scale)
+{
+	struct dmabuf_surface *surface = to_dmabuf_surface(base);
+	struct dmabuf_surface_leaf *leaf = NULL;
+	int32_t buffer_width = width, buffer_height = height;
+	int i;
+
+	if (surface->fallback)
+		return surface->fallback->prepare(surface->fallback, dx, dy,
+						  width, height, flags,
+						  buffer_transform,
+						  buffer_scale);
+
+	surface->dx = dx;
+	surface->dy = dy;
+
+	/* pick a free buffer, preferably one that already has storage */
+	for (i = 0; i < MAX_LEAVES; i++) {
+		if (surface->leaf[i].busy)
+			continue;
+
+		if (!leaf || surface->leaf[i].cairo_surface)
+			leaf = &surface->leaf[i];
+	}
+
+	if (!leaf) {
+		fprintf(stderr, "%s: all buffers are held by the server.\n",
+			__func__);
+		exit(1);
+		return NULL;
+	}
+
+	surface_to_buffer_size (buffer_transform, buffer_scale,
+				&buffer_width, &buffer_height);
+
+	if (leaf->cairo_surface &&
+	    (cairo_image_surface_get_width(leaf->cairo_surface) != buffer_width ||
+	     cairo_image_surface_get_height(leaf->cairo_surface) != buffer_height))
+		dmabuf_surface_leaf_release(leaf);
+
+	if (!leaf->cairo_surface &&
+	    dmabuf_surface_leaf_create(surface, leaf,
+				       buffer_width, buffer_height) < 0) {
+		fprintf(stderr, "could not allocate a %dx%d dmabuf, "
+			"falling back to wl_shm\n",
+			buffer_width, buffer_height);
+		surface->fallback = shm_surface_create(surface->display,
+						       surface->surface,
+						       surface->flags, NULL);
+		return surface->fallback->prepare(surface->fallback, dx, dy,
+						  width, height, flags,
+						  buffer_transform,
+						  buffer_scale);
+	}
+
+	dmabuf_sync(leaf->fd, DMA_BUF_SYNC_START | DMA_BUF_SYNC_RW);
+	surface->current = leaf;
+
+	return cairo_surface_reference(leaf->cairo_surface);
+}
+
+static void
+dmabuf_surface_swap(struct toysurface *base,
+		    enum wl_output_transform buffer_transform,
+		    int32_t buffer_scale,
+		    const struct rectangle *damage,
+		    struct rectangle *server_allocation)
+{
+	struct dmabuf_surface *surface = to_dmabuf_surface(base);
+	struct dmabuf_surface_leaf *leaf = surface->current;
+
+	if (surface->fallback) {
+		surface->fallback->swap(surface->fallback, buffer_transform,
+					buffer_scale, damage,
+					server_allocation);
+		return;
+	}
+
+	cairo_surface_flush(leaf->cairo_surface);
+	dmabuf_sync(leaf->fd, DMA_BUF_SYNC_END | DMA_BUF_SYNC_RW);
+
+	server_allocation->width =
+		cairo_image_surface_get_width(leaf->cairo_surface);
+	server_allocation->height =
+		cairo_image_surface_get_height(leaf->cairo_surface);
+
+	buffer_to_surface_size (buffer_transform, buffer_scale,
+				&server_allocation->width,
+				&server_allocation->height);
+
+	wl_surface_attach(surface->surface, leaf->buffer,
+			  surface->dx, surface->dy);
+	if (damage)
+		surface_post_damage(surface->display, surface->surface,
+				    buffer_transform, buffer_scale, damage);
+	else
+		wl_surface_damage(surface->surface, 0, 0,
+				  server_allocation->width,
+				  server_allocation->height);
+	wl_surface_commit(surface->surface);
+
+	leaf->busy = 1;
+	surface->current = NULL;
+}
+
+static int
+dmabuf_surface_acquire(struct toysurface *base, EGLContext ctx)
+{
+	return -1;
+}
+
+static void
+dmabuf_surface_release(struct toysurface *base)
+{
+}
+
+static void
+dmabuf_surface_destroy(struct toysurface *base)
+{
+	struct dmabuf_surface *surface = to_dmabuf_surface(base);
+	int i;
+
+	for (i = 0; i < MAX_LEAVES; i++)
+		dmabuf_surface_leaf_release(&surface->leaf[i]);
+
+	if (surface->fallback)
+		surface->fallback->destroy(surface->fallback);
+
+	free(surface);
+}
+
+/* Open the render node lazily, so that clients which never ask for a
+ * dmabuf surface do not pay for it. */
+static bool
+display_init_gbm(struct display *display)
+{
+	const char *path;
+
+	if (display->gbm)
+		return true;
+	if (display->gbm_failed || !display->dmabuf ||
+	    !display->dmabuf_linear_argb || !display->dmabuf_linear_xrgb)
+		return false;
+
+	display->gbm_failed = true;
+
+	path = getenv("TOYTOOLKIT_DRM_DEVICE");
+	if (!path)
+		path = "/dev/dri/renderD128";
+
+	display->gbm_fd = open(path, O_RDWR | O_CLOEXEC);
+	if (display->gbm_fd < 0)
+		return false;
+
+	display->gbm = gbm_create_device(display->gbm_fd);
+	if (!display->gbm) {
+		close(display->gbm_fd);
+		display->gbm_fd = -1;
+		return false;
+	}
+
+	display->gbm_failed = false;
+	return true;
+}
+
+static struct toysurface *
+dmabuf_surface_create(struct display *display, struct wl_surface *wl_surface,
+		      uint32_t flags, struct rectangle *rectangle)
+{
+	struct dmabuf_surface *surface;
+	int i;
+
+	if (!display_init_gbm(display))
+		return NULL;
+
+	surface = xzalloc(sizeof *surface);
+	surface->base.prepare = dmabuf_surface_prepare;
+	surface->base.swap = dmabuf_surface_swap;
+	surface->base.acquire = dmabuf_surface_acquire;
+	surface->base.release = dmabuf_surface_release;
+	surface->base.destroy = dmabuf_surface_destroy;
+
+	surface->display = display;
+	surface->surface = wl_surface;
+	surface->flags = flags;
+	for (i = 0; i < MAX_LEAVES; i++)
+		surface->leaf[i].fd = -1;
+
+	return &surface->base;
+}
+
+static void
+dmabuf_modifier(void *data, struct zwp_linux_dmabuf_v1 *dmabuf,
+		uint32_t format, uint32_t modifier_hi, uint32_t modifier_lo)
+{
+	struct display *d = data;
+	uint64_t modifier = ((uint64_t) modifier_hi << 32) | modifier_lo;
+
+	if (modifier != DRM_FORMAT_MOD_LINEAR)
+		return;
+
+	if (format == DRM_FORMAT_ARGB8888)
+		d->dmabuf_linear_argb = true;
+	else if (format == DRM_FORMAT_XRGB8888)
+		d->dmabuf_linear_xrgb = true;
+}
+
+static void
+dmabuf_format(void *data, struct zwp_linux_dmabuf_v1 *dmabuf,
+	      uint32_t format)
+{
+	/* deprecated, the modifier event carries the same information */
+}
+
+static const struct zwp_linux_dmabuf_v1_listener dmabuf_listener = {
+	dmabuf_format,
+	dmabuf_modifier
+};
+#endif /* HAVE_TOYTOOLKIT_DMABUF */
+
 /*
  * The following correspondences between file names and cursors was copied
  * from: https://bugs.kde.org/attachment.cgi?id=67313
@@ -1415,9 +1943,14 @@ surface_flush(struct surface *surface)
 					    widget->viewport_dest_height);
 	}
 
+	/* Every redraw repaints the whole buffer, so posting only the
+	 * reported damage is fine whichever buffer gets reused. */
 	surface->toysurface->swap(surface->toysurface,
 				  surface->buffer_transform, surface->buffer_scale,
+				  surface->damage_full ? NULL : &surface->damage,
 				  &surface->server_allocation);
+	surface->damage_full = 0;
+	memset(&surface->damage, 0, sizeof surface->damage);
 
 	cairo_surface_destroy(surface->cairo_surface);
 	surface->cairo_surface = NULL;
@@ -1459,6 +1992,18 @@ surface_create_surface(struct surface *surface, uint32_t flags)
 						  &allocation);
 	}
 
+#ifdef HAVE_TOYTOOLKIT_DMABUF
+	if (!surface->toysurface &&
+	    surface->buffer_type == WINDOW_BUFFER_TYPE_DMABUF &&
+	    !getenv("TOYTOOLKIT_NO_DMABUF")) {
+		surface->toysurface =
+			dmabuf_surface_create(display,
+					      surface->surface,
+					      flags,
+					      &allocation);
+	}
+#endif
+
 	if (!surface->toysurface)
 		surface->toysurface = shm_surface_create(display,
 							 surface->surface,
@@ -1529,6 +2074,7 @@ window_get_output_scale(struct window *window)
 }
 
 static void window_frame_destroy(struct window_frame *frame);
+static void window_feedback_destroy(struct window_feedback *feedback);
 
 static void
 surface_destroy(struct surface *surface)
@@ -1561,8 +2107,14 @@ window_destroy(struct window *window)
 	struct input *input;
 	struct window_output *window_output;
 	struct window_output *window_output_tmp;
+	struct window_feedback *feedback, *feedback_tmp;
 
 	wl_list_remove(&window->redraw_task.link);
+	if (window->redraw_timer_ready)
+		toytimer_fini(&window->redraw_timer);
+	wl_list_for_each_safe(feedback, feedback_tmp,
+			      &window->feedback_list, link)
+		window_feedback_destroy(feedback);
 
 	wl_list_for_each(input, &display->input_list, link) {
 		if (input->touch_focus == window) {
@@ -2031,9 +2583,58 @@ widget_schedule_redraw(struct widget *widget)
 {
 	DBG_OBJ(widget->surface->surface, "widget %p\n", widget);
 	widget->surface->redraw_needed = 1;
+	widget->surface->damage_full = 1;
 	window_schedule_redraw_task(widget->window);
 }
 
+/** Schedule a redraw that only changes what the widget reports
+ *
+ * The surface is repainted as for widget_schedule_redraw(), but only the
+ * rectangles the widget passes to widget_add_damage() while redrawing
+ * are posted as damage. Any other redraw request for the surface before
+ * it is drawn turns this back into a full redraw.
+ */
+void
+widget_schedule_partial_redraw(struct widget *widget)
+{
+	DBG_OBJ(widget->surface->surface, "widget %p\n", widget);
+	widget->surface->redraw_needed = 1;
+	window_schedule_redraw_task(widget->window);
+}
+
+/** Add an area changed by the current redraw, in widget coordinates */
+void
+widget_add_damage(struct widget *widget, int32_t x, int32_t y,
+		  int32_t width, int32_t height)
+{
+	struct surface *surface = widget->surface;
+	struct rectangle *damage = &surface->damage;
+	int32_t x1, y1, x2, y2;
+
+	if (width <= 0 || height <= 0)
+		return;
+
+	x -= surface->allocation.x;
+	y -= surface->allocation.y;
+
+	if (damage->width == 0 || damage->height == 0) {
+		x1 = x;
+		y1 = y;
+		x2 = x + width;
+		y2 = y + height;
+	} else {
+		x1 = MIN(damage->x, x);
+		y1 = MIN(damage->y, y);
+		x2 = MAX(damage->x + damage->width, x + width);
+		y2 = MAX(damage->y + damage->height, y + height);
+	}
+
+	damage->x = x1;
+	damage->y = y1;
+	damage->width = x2 - x1;
+	damage->height = y2 - y1;
+}
+
 void
 widget_set_use_cairo(struct widget *widget,
 		     int use_cairo)
@@ -4312,6 +4913,10 @@ window_inhibit_redraw(struct window *window)
 	wl_list_remove(&window->redraw_task.link);
 	wl_list_init(&window->redraw_task.link);
 	window->redraw_task_scheduled = 0;
+	if (window->redraw_timer_armed) {
+		toytimer_disarm(&window->redraw_timer);
+		window->redraw_timer_armed = false;
+	}
 }
 
 void
@@ -4525,6 +5130,241 @@ widget_redraw(struct widget *widget)
 		widget_redraw(child);
 }
 
+static void
+window_feedback_destroy(struct window_feedback *feedback)
+{
+	wl_list_remove(&feedback->link);
+	wp_presentation_feedback_destroy(feedback->feedback);
+	free(feedback);
+}
+
+static void
+feedback_sync_output(void *data,
+		     struct wp_presentation_feedback *presentation_feedback,
+		     struct wl_output *output)
+{
+}
+
+static void
+feedback_presented(void *data,
+		   struct wp_presentation_feedback *presentation_feedback,
+		   uint32_t tv_sec_hi,
+		   uint32_t tv_sec_lo,
+		   uint32_t tv_nsec,
+		   uint32_t refresh_nsec,
+		   uint32_t seq_hi,
+		   uint32_t seq_lo,
+		   uint32_t flags)
+{
+	struct window_feedback *feedback = data;
+	struct window *window = feedback->window;
+	struct window_frame_stats *stats = &window->frame_stats;
+	struct timespec present;
+	int64_t latency, period;
+
+	present.tv_sec = ((uint64_t) tv_sec_hi << 32) + tv_sec_lo;
+	present.tv_nsec = tv_nsec;
+
+	window->last_present = present;
+	window->refresh_nsec = refresh_nsec;
+
+	stats->presented++;
+	if (!timespec_is_zero(&feedback->target) && refresh_nsec > 0 &&
+	    timespec_sub_to_nsec(&present, &feedback->target) >
+	    refresh_nsec / 2)
+		stats->missed++;
+
+	latency = timespec_sub_to_nsec(&present, &feedback->commit);
+	if (stats->latency_nsec == 0)
+		stats->latency_nsec = latency;
+	else
+		stats->latency_nsec = (stats->latency_nsec * 7 + latency) / 8;
+
+	if (timespec_is_zero(&stats->period_start)) {
+		stats->period_start = present;
+	} else {
+		stats->period_frames++;
+		period = timespec_sub_to_nsec(&present, &stats->period_start);
+		if (period >= NSEC_PER_SEC) {
+			stats->fps = stats->period_frames * 1e9 / period;
+			stats->period_start = present;
+			stats->period_frames = 0;
+		}
+	}
+
+	window_feedback_destroy(feedback);
+}
+
+static void
+feedback_discarded(void *data,
+		   struct wp_presentation_feedback *presentation_feedback)
+{
+	struct window_feedback *feedback = data;
+
+	feedback->window->frame_stats.discarded++;
+	window_feedback_destroy(feedback);
+}
+
+static const struct wp_presentation_feedback_listener feedback_listener = {
+	feedback_sync_output,
+	feedback_presented,
+	feedback_discarded
+};
+
+/* Called right before the main surface is committed */
+static void
+window_request_feedback(struct window *window)
+{
+	struct display *display = window->display;
+	struct window_feedback *feedback;
+
+	if (!display->presentation)
+		return;
+
+	feedback = xzalloc(sizeof *feedback);
+	feedback->window = window;
+	feedback->target = window->redraw_target;
+	clock_gettime(display->presentation_clock, &feedback->commit);
+	feedback->feedback =
+		wp_presentation_feedback(display->presentation,
+					 window->main_surface->surface);
+	wp_presentation_feedback_add_listener(feedback->feedback,
+					      &feedback_listener, feedback);
+	wl_list_insert(&window->feedback_list, &feedback->link);
+}
+
+#define FRAME_STATS_WIDTH 260
+#define FRAME_STATS_HEIGHT 40
+
+/* The TOYTOOLKIT_FRAME_STATS overlay, in the top left of the content */
+static void
+window_draw_frame_stats(struct window *window)
+{
+	struct window_frame_stats *stats = &window->frame_stats;
+	struct widget *widget = window->main_surface->widget;
+	struct rectangle *area = window->frame ?
+				 &window->frame->child->allocation :
+				 &widget->allocation;
+	char line[2][64];
+	cairo_t *cr;
+	int i;
+
+	if (window->display->presentation) {
+		snprintf(line[0], sizeof line[0],
+			 "%.1f fps, %u missed, %u discarded",
+			 stats->fps, stats->missed, stats->discarded);
+		snprintf(line[1], sizeof line[1],
+			 "draw %.1f ms, latency %.1f ms",
+			 window->draw_nsec / 1e6, stats->latency_nsec / 1e6);
+	} else {
+		snprintf(line[0], sizeof line[0], "no wp_presentation");
+		line[1][0] = '\0';
+	}
+
+	cr = widget_cairo_create(widget);
+	cairo_rectangle(cr, area->x, area->y, area->width, area->height);
+	cairo_clip(cr);
+
+	cairo_rectangle(cr, area->x, area->y,
+			FRAME_STATS_WIDTH, FRAME_STATS_HEIGHT);
+	cairo_set_source_rgba(cr, 0.0, 0.0, 0.0, 0.7);
+	cairo_fill(cr);
+
+	cairo_select_font_face(cr, "monospace", CAIRO_FONT_SLANT_NORMAL,
+			       CAIRO_FONT_WEIGHT_NORMAL);
+	cairo_set_font_size(cr, 12);
+	cairo_set_source_rgb(cr, 1.0, 1.0, 1.0);
+	for (i = 0; i < 2; i++) {
+		cairo_move_to(cr, area->x + 6, area->y + 16 + i * 16);
+		cairo_show_text(cr, line[i]);
+	}
+	cairo_destroy(cr);
+
+	widget_add_damage(widget, area->x, area->y,
+			  MIN(area->width, FRAME_STATS_WIDTH),
+			  MIN(area->height, FRAME_STATS_HEIGHT));
+}
+
+static void
+idle_redraw(struct task *task, uint32_t events);
+
+static void
+window_queue_redraw_task(struct window *window)
+{
+	if (!window->redraw_task_scheduled) {
+		window->redraw_task.run = idle_redraw;
+		display_defer(window->display, &window->redraw_task);
+		window->redraw_task_scheduled = 1;
+	}
+}
+
+static void
+redraw_timer_func(struct toytimer *tt)
+{
+	struct window *window = container_of(tt, struct window, redraw_timer);
+
+	window->redraw_timer_armed = false;
+	if (!window->redraw_inhibited)
+		window_queue_redraw_task(window);
+}
+
+/*
+ * Start a redraw just in time for the next presentation rather than
+ * right away, so that the frame shows the state from as late as
+ * possible and does not sit in the compositor for most of a refresh.
+ * The last presentation and the refresh period give the next
+ * presentation time; the commit has to reach the compositor
+ * redraw_deadline_nsec before that, and drawing takes about as long as
+ * it did recently. Returns true when the redraw has been deferred.
+ */
+static bool
+window_defer_redraw(struct window *window)
+{
+	struct display *display = window->display;
+	struct timespec now, start;
+	int64_t lead, since, delay, n;
+
+	if (window->redraw_timer_armed)
+		return true;
+
+	memset(&window->redraw_target, 0, sizeof window->redraw_target);
+
+	if (!display->presentation || display->redraw_deadline_nsec == 0 ||
+	    window->refresh_nsec == 0 ||
+	    timespec_is_zero(&window->last_present) || window->resize_needed)
+		return false;
+
+	clock_gettime(display->presentation_clock, &now);
+	lead = display->redraw_deadline_nsec + window->draw_nsec;
+
+	/* An idle window's last presentation says little about the phase */
+	since = timespec_sub_to_nsec(&now, &window->last_present) + lead;
+	if (since > NSEC_PER_SEC)
+		return false;
+
+	/* The first presentation this redraw can still make */
+	n = since <= 0 ? 1 : (since + window->refresh_nsec - 1) /
+			     window->refresh_nsec;
+	timespec_add_nsec(&window->redraw_target, &window->last_present,
+			  MAX(n, 1) * window->refresh_nsec);
+
+	timespec_add_nsec(&start, &window->redraw_target, -lead);
+	delay = timespec_sub_to_nsec(&start, &now);
+	if (delay < 500000)
+		return false;
+
+	if (!window->redraw_timer_ready) {
+		toytimer_init(&window->redraw_timer, CLOCK_MONOTONIC, display,
+			      redraw_timer_func);
+		window->redraw_timer_ready = true;
+	}
+
+	toytimer_arm_once_usec(&window->redraw_timer, delay / 1000);
+	window->redraw_timer_armed = true;
+
+	return true;
+}
+
 static void
 frame_callback(void *data, struct wl_callback *callback, uint32_t time)
 {
@@ -4576,9 +5416,17 @@ surface_redraw(struct surface *surface)
 	wl_callback_add_listener(surface->frame_cb, &listener, surface);
 	DBG_OBJ(surface->frame_cb, "new\n");
 
+	if (surface->window->redraw_needed)
+		surface->damage_full = 1;
 	surface->redraw_needed = 0;
 	DBG_OBJ(surface->surface, "-> widget_redraw\n");
 	widget_redraw(surface->widget);
+
+	if (surface == surface->window->main_surface &&
+	    surface->window->display->frame_stats &&
+	    surface->window->xdg_toplevel && surface->widget->use_cairo)
+		window_draw_frame_stats(surface->window);
+
 	DBG_OBJ(surface->surface, "done\n");
 	return 0;
 }
@@ -4588,11 +5436,15 @@ idle_redraw(struct task *task, uint32_t events)
 {
 	struct window *window = container_of(task, struct window, redraw_task);
 	struct surface *surface;
+	struct timespec begin, end;
+	int64_t draw_nsec;
 	int failed = 0;
 	int resized = 0;
 
 	DBG(" --------- \n");
 
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+
 	wl_list_init(&window->redraw_task.link);
 	window->redraw_task_scheduled = 0;
 
@@ -4624,7 +5476,24 @@ idle_redraw(struct task *task, uint32_t events)
 	}
 
 	window->redraw_needed = 0;
-	window_flush(window);
+
+	/* Only a redraw of the main surface is a new frame for the stats */
+	if (window->main_surface->cairo_surface) {
+		window_request_feedback(window);
+		window_flush(window);
+
+		/* Rises at once, decays over a few frames */
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		draw_nsec = timespec_sub_to_nsec(&end, &begin);
+		if (draw_nsec > window->draw_nsec)
+			window->draw_nsec = draw_nsec;
+		else
+			window->draw_nsec = (window->draw_nsec * 7 +
+					     draw_nsec) / 8;
+	} else {
+		window_flush(window);
+	}
+	memset(&window->redraw_target, 0, sizeof window->redraw_target);
 
 	wl_list_for_each(surface, &window->subsurface_list, link)
 		surface_set_synchronized_default(surface);
@@ -4641,11 +5510,10 @@ window_schedule_redraw_task(struct window *window)
 	if (window->redraw_inhibited)
 		return;
 
-	if (!window->redraw_task_scheduled) {
-		window->redraw_task.run = idle_redraw;
-		display_defer(window->display, &window->redraw_task);
-		window->redraw_task_scheduled = 1;
-	}
+	if (window->redraw_task_scheduled || window_defer_redraw(window))
+		return;
+
+	window_queue_redraw_task(window);
 }
 
 void
@@ -4655,8 +5523,10 @@ window_schedule_redraw(struct window *window)
 
 	DBG_OBJ(window->main_surface->surface, "window %p\n", window);
 
-	wl_list_for_each(surface, &window->subsurface_list, link)
+	wl_list_for_each(surface, &window->subsurface_list, link) {
 		surface->redraw_needed = 1;
+		surface->damage_full = 1;
+	}
 
 	window_schedule_redraw_task(window);
 }
@@ -5235,6 +6105,7 @@ surface_create(struct window *window)
 	surface->window = window;
 	surface->surface = wl_compositor_create_surface(display->compositor);
 	surface->buffer_scale = 1;
+	surface->damage_full = 1;
 	wl_surface_add_listener(surface->surface, &surface_listener, window);
 
 	wl_list_insert(&window->subsurface_list, &surface->link);
@@ -5276,6 +6147,7 @@ window_create_internal(struct display *display, int custom)
 	wl_surface_set_user_data(surface->surface, window);
 	wl_list_insert(display->window_list.prev, &window->link);
 	wl_list_init(&window->redraw_task.link);
+	wl_list_init(&window->feedback_list);
 
 	wl_list_init (&window->window_output_list);
 
@@ -6023,6 +6895,19 @@ global_destroy(struct display *disp, struct global *g)
 	free(g);
 }
 
+static void
+presentation_clock_id(void *data, struct wp_presentation *presentation,
+		      uint32_t clk_id)
+{
+	struct display *display = data;
+
+	display->presentation_clock = clk_id;
+}
+
+static const struct wp_presentation_listener presentation_listener = {
+	presentation_clock_id
+};
+
 static void
 registry_handle_global(void *data, struct wl_registry *registry, uint32_t id,
 		       const char *interface, uint32_t version)
@@ -6037,8 +6922,10 @@ registry_handle_global(void *data, struct wl_registry *registry, uint32_t id,
 	wl_list_insert(d->global_list.prev, &global->link);
 
 	if (strcmp(interface, "wl_compositor") == 0) {
+		d->compositor_version = MIN(version, 4);
 		d->compositor = wl_registry_bind(registry, id,
-						 &wl_compositor_interface, 3);
+						 &wl_compositor_interface,
+						 d->compositor_version);
 	} else if (strcmp(interface, "wl_output") == 0) {
 		display_add_output(d, id);
 	} else if (strcmp(interface, "wl_seat") == 0) {
@@ -6071,10 +6958,25 @@ registry_handle_global(void *data, struct wl_registry *registry, uint32_t id,
 		d->subcompositor =
 			wl_registry_bind(registry, id,
 					 &wl_subcompositor_interface, 1);
+	} else if (!strcmp(interface, "wp_presentation")) {
+		d->presentation =
+			wl_registry_bind(registry, id,
+					 &wp_presentation_interface, 1);
+		wp_presentation_add_listener(d->presentation,
+					     &presentation_listener, d);
 	} else if (!strcmp(interface, "wp_viewporter")) {
 		d->viewporter =
 			wl_registry_bind(registry, id,
 					&wp_viewporter_interface, 1);
+#ifdef HAVE_TOYTOOLKIT_DMABUF
+	} else if (!strcmp(interface, "zwp_linux_dmabuf_v1") &&
+		   version >= 3) {
+		d->dmabuf =
+			wl_registry_bind(registry, id,
+					 &zwp_linux_dmabuf_v1_interface, 3);
+		zwp_linux_dmabuf_v1_add_listener(d->dmabuf,
+						 &dmabuf_listener, d);
+#endif
 	}
 
 	if (d->global_handler)
@@ -6257,6 +7159,8 @@ struct display *
 display_create(int *argc, char *argv[])
 {
 	struct display *d;
+	const char *str;
+	int32_t deadline_msec;
 
 	wl_log_set_handler_client(log_handler);
 
@@ -6291,6 +7195,13 @@ display_create(int *argc, char *argv[])
 	display_watch_fd(d, d->display_fd, EPOLLIN | EPOLLERR | EPOLLHUP,
 			 &d->display_task);
 
+	d->presentation_clock = CLOCK_MONOTONIC;
+	d->redraw_deadline_nsec = DEFAULT_REDRAW_DEADLINE_MSEC * 1000000LL;
+	str = getenv("TOYTOOLKIT_REDRAW_DEADLINE");
+	if (str && safe_strtoint(str, &deadline_msec) && deadline_msec >= 0)
+		d->redraw_deadline_nsec = deadline_msec * 1000000LL;
+	d->frame_stats = getenv("TOYTOOLKIT_FRAME_STATS") != NULL;
+
 	d->registry = wl_display_get_registry(d->display);
 	wl_registry_add_listener(d->registry, &registry_listener, d);
 
@@ -6379,6 +7290,18 @@ display_destroy(struct display *display)
 	if (display->viewporter)
 		wp_viewporter_destroy(display->viewporter);
 
+	if (display->presentation)
+		wp_presentation_destroy(display->presentation);
+
+#ifdef HAVE_TOYTOOLKIT_DMABUF
+	if (display->gbm) {
+		gbm_device_destroy(display->gbm);
+		close(display->gbm_fd);
+	}
+	if (display->dmabuf)
+		zwp_linux_dmabuf_v1_destroy(display->dmabuf);
+#endif
+
 	if (display->subcompositor)
 		wl_subcompositor_destroy(display->subcompositor);
 
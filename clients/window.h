@@ -418,6 +418,8 @@ widget_get_wl_subsurface(struct widget *widget);
 enum window_buffer_type {
 	WINDOW_BUFFER_TYPE_EGL_WINDOW,
 	WINDOW_BUFFER_TYPE_SHM,
+	/* CPU-drawn linear dmabufs, falling back to SHM when unavailable */
+	WINDOW_BUFFER_TYPE_DMABUF,
 };
 
 void
@@ -606,6 +608,11 @@ window_uninhibit_redraw(struct window *window);
 void
 widget_schedule_redraw(struct widget *widget);
 void
+widget_schedule_partial_redraw(struct widget *widget);
+void
+widget_add_damage(struct widget *widget, int32_t x, int32_t y,
+		  int32_t width, int32_t height);
+void
 widget_set_use_cairo(struct widget *widget, int use_cairo);
 
 /*
@@ -34,6 +34,7 @@
 #include <signal.h>
 #include <errno.h>
 #include <dlfcn.h>
+#include <sched.h>
 #include <stdint.h>
 #include <string.h>
 #include <sys/utsname.h>
@@ -51,6 +52,7 @@
 #include "shared/os-compatibility.h"
 #include "shared/helpers.h"
 #include "shared/string-helpers.h"
+#include "shared/timespec-util.h"
 #include "git-version.h"
 #include <libweston/version.h>
 #include "weston.h"
@@ -69,7 +71,9 @@
 #define WINDOW_TITLE "Weston Compositor"
 /* flight recorder size (in bytes) */
 #define DEFAULT_FLIGHT_REC_SIZE (5 * 1024 * 1024)
-#define DEFAULT_FLIGHT_REC_SCOPES "log,drm-backend"
+/* what the flight recorder keeps after memory pressure */
+#define LOW_MEMORY_FLIGHT_REC_SIZE (512 * 1024)
+#define DEFAULT_FLIGHT_REC_SCOPES "log,drm-backend,watchdog"
 
 struct wet_output_config {
 	int width;
@@ -127,13 +131,65 @@ struct wet_compositor {
 	pid_t autolaunch_pid;
 	bool autolaunch_watch;
 	bool use_color_manager;
+
+	struct weston_log_subscriber *flight_rec;
+	struct wl_listener memory_pressure_listener;
+	struct wl_listener primary_client_destroyed;
+
+	/** Fast-start mode: non-critical work waits for the first frame */
+	struct {
+		bool enabled;
+		struct timespec start;
+		struct wl_array modules;	/**< char *, deferred modules */
+		bool xwayland;
+		bool autolaunch;
+		struct wl_list frame_listener_list; /**< wet_first_frame_listener::link */
+		struct wl_event_source *timer;
+		struct wl_event_source *idle;
+	} fast_start;
 };
 
+/** Waits for the first frame of one output in fast-start mode */
+struct wet_first_frame_listener {
+	struct wet_compositor *wet;
+	struct wl_listener frame_listener;
+	struct wl_listener output_destroy_listener;
+	struct wl_list link;	/**< in wet_compositor::fast_start */
+};
+
+/* Load the deferred work even if no output ever gets to draw. */
+#define WET_FAST_START_TIMEOUT_MSEC 2000
+
 static FILE *weston_logfile = NULL;
 static struct weston_log_scope *log_scope;
 static struct weston_log_scope *protocol_scope;
+static struct weston_log_scope *protocol_capture_scope;
 static int cached_tm_mday = -1;
 
+/** One message in the "proto-capture" scope
+ *
+ * Written in host byte order, all records the same size, so a capture is
+ * just an array of these and can be decoded offline against the protocol
+ * XML: interface_hash is the 32-bit FNV-1a hash of the interface name.
+ */
+struct proto_capture_record {
+	uint64_t timestamp_nsec;	/* CLOCK_MONOTONIC */
+	uint32_t client_pid;
+	uint32_t object_id;
+	uint32_t interface_hash;
+	uint32_t size;			/* bytes on the wire, fds excluded */
+	uint16_t opcode;
+	uint8_t direction;		/* 0 for requests, 1 for events */
+	uint8_t n_fds;
+	uint32_t reserved;
+};
+
+static struct {
+	pid_t pid;		/* only capture this client, unless 0 */
+	uint32_t sample;	/* capture one out of every sample messages */
+	uint32_t counter;
+} proto_capture;
+
 static char *
 weston_log_timestamp(char *buf, size_t len)
 {
@@ -260,6 +316,74 @@ get_next_argument(const char *signature, char* type)
 	return signature;
 }
 
+static uint32_t
+hash_interface_name(const char *name)
+{
+	uint32_t hash = 2166136261u;
+
+	for (; *name; name++)
+		hash = (hash ^ (uint8_t) *name) * 16777619u;
+
+	return hash;
+}
+
+static void
+protocol_capture(enum wl_protocol_logger_type direction,
+		 const struct wl_protocol_logger_message *message)
+{
+	struct proto_capture_record rec = { 0 };
+	struct wl_resource *res = message->resource;
+	const char *signature = message->message->signature;
+	struct timespec now;
+	pid_t pid;
+	int i;
+	char type;
+
+	wl_client_get_credentials(wl_resource_get_client(res), &pid, NULL, NULL);
+	if (proto_capture.pid && pid != proto_capture.pid)
+		return;
+
+	if (proto_capture.sample > 1 &&
+	    proto_capture.counter++ % proto_capture.sample != 0)
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	rec.timestamp_nsec = timespec_to_nsec(&now);
+	rec.client_pid = pid;
+	rec.object_id = wl_resource_get_id(res);
+	rec.interface_hash = hash_interface_name(wl_resource_get_class(res));
+	rec.opcode = message->message_opcode;
+	rec.direction = direction == WL_PROTOCOL_LOGGER_REQUEST ? 0 : 1;
+
+	/* The 8-byte header, then each argument padded to 32 bits */
+	rec.size = 8;
+	for (i = 0; i < message->arguments_count; i++) {
+		signature = get_next_argument(signature, &type);
+
+		switch (type) {
+		case 's':
+			rec.size += 4;
+			if (message->arguments[i].s)
+				rec.size += (strlen(message->arguments[i].s) + 4) & ~3u;
+			break;
+		case 'a':
+			rec.size += 4;
+			if (message->arguments[i].a)
+				rec.size += (message->arguments[i].a->size + 3) & ~3u;
+			break;
+		case 'h':
+			rec.n_fds++;
+			break;
+		default:
+			rec.size += 4;
+			break;
+		}
+	}
+
+	weston_log_scope_write(protocol_capture_scope,
+			       (const char *) &rec, sizeof rec);
+}
+
 static void
 protocol_log_fn(void *user_data,
 		enum wl_protocol_logger_type direction,
@@ -274,6 +398,9 @@ protocol_log_fn(void *user_data,
 	int i;
 	char type;
 
+	if (weston_log_scope_is_enabled(protocol_capture_scope))
+		protocol_capture(direction, message);
+
 	if (!weston_log_scope_is_enabled(protocol_scope))
 		return;
 
@@ -366,7 +493,7 @@ sigchld_handler(int signal_number, void *data)
 	while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
 		if (wet->autolaunch_pid != -1 && wet->autolaunch_pid == pid) {
 			if (wet->autolaunch_watch)
-				wl_display_terminate(wet->compositor->wl_display);
+				weston_compositor_terminate(wet->compositor);
 			wet->autolaunch_pid = -1;
 			continue;
 		}
@@ -669,6 +796,11 @@ usage(int error_code)
 #endif
 		"  --modules\t\tLoad the comma-separated list of modules\n"
 		"  --log=FILE\t\tLog to the given file\n"
+		"  --log-async=KB\tWrite the log from a thread, buffering up "
+			"to\n\t\t\tKB kilobytes and dropping messages beyond\n"
+		"  --log-fsync=MSEC\tWith --log-async, fsync the log at "
+			"least every\n\t\t\tMSEC milliseconds, 0 after every "
+			"write\n"
 		"  -c, --config=FILE\tConfig file to load, defaults to weston.ini\n"
 		"  --no-config\t\tDo not read weston.ini\n"
 		"  --wait-for-debugger\tRaise SIGSTOP on start-up\n"
@@ -676,9 +808,17 @@ usage(int error_code)
 		"  -l, --logger-scopes=SCOPE\n\t\t\tSpecify log scopes to "
 			"subscribe to.\n\t\t\tCan specify multiple scopes, "
 			"each followed by comma\n"
+			"\t\t\tand optionally by :N to keep one out of\n"
+			"\t\t\tevery N repaints\n"
 		"  -f, --flight-rec-scopes=SCOPE\n\t\t\tSpecify log scopes to "
 			"subscribe to.\n\t\t\tCan specify multiple scopes, "
 			"each followed by comma\n"
+		"  --proto-capture=KB\tKeep a binary record of the last "
+			"protocol\n\t\t\tmessages in a ring of KB kilobytes\n"
+		"  --proto-capture-pid=PID\n\t\t\tOnly capture messages of "
+			"this client\n"
+		"  --proto-capture-sample=N\n\t\t\tCapture one out of every "
+			"N messages\n"
 		"  -h, --help\t\tThis help message\n\n");
 
 #if defined(BUILD_DRM_COMPOSITOR)
@@ -687,6 +827,7 @@ usage(int error_code)
 		"  --seat=SEAT\t\tThe seat that weston should run on, instead of the seat defined in XDG_SEAT\n"
 		"  --tty=TTY\t\tThe tty to use\n"
 		"  --drm-device=CARD\tThe DRM device to use, e.g. \"card0\".\n"
+		"  --render-device=NODE\tRender on a separate DRM device, e.g. \"renderD128\".\n"
 		"  --use-pixman\t\tUse the pixman (CPU) renderer\n"
 		"  --current-mode\tPrefer current KMS mode over EDID preferred mode\n"
 		"  --continue-without-input\tAllow the compositor to start without input devices\n\n");
@@ -712,6 +853,9 @@ usage(int error_code)
 		"  --use-pixman\t\tUse the pixman (CPU) renderer (default: no rendering)\n"
 		"  --use-gl\t\tUse the GL renderer (default: no rendering)\n"
 		"  --no-outputs\t\tDo not create any virtual outputs\n"
+		"  --refresh-rate=RATE\tSynthetic refresh rate in Hz (default: 60)\n"
+		"  --benchmark\t\tRepaint continuously, flat out unless a\n"
+		"\t\t\trefresh rate is given, and log frame timing on exit\n"
 		"\n");
 #endif
 
@@ -727,6 +871,7 @@ usage(int error_code)
 		"  --rdp4-key=FILE\tThe file containing the key for RDP4 encryption\n"
 		"  --rdp-tls-cert=FILE\tThe file containing the certificate for TLS encryption\n"
 		"  --rdp-tls-key=FILE\tThe file containing the private key for TLS encryption\n"
+		"  --use-gl\t\tUse the GL renderer and read the frames back from the GPU\n"
 		"\n");
 #endif
 
@@ -740,6 +885,7 @@ usage(int error_code)
 		"  --use-pixman\t\tUse the pixman (CPU) renderer\n"
 		"  --output-count=COUNT\tCreate multiple outputs\n"
 		"  --sprawl\t\tCreate one fullscreen output for every parent output\n"
+		"  --passthrough\t\tForward fullscreen client dmabufs to the parent\n"
 		"  --display=DISPLAY\tWayland display to connect to\n\n");
 #endif
 
@@ -760,10 +906,10 @@ usage(int error_code)
 
 static int on_term_signal(int signal_number, void *data)
 {
-	struct wl_display *display = data;
+	struct wet_compositor *wet = data;
 
 	weston_log("caught signal %d\n", signal_number);
-	wl_display_terminate(display);
+	weston_compositor_terminate(wet->compositor);
 
 	return 1;
 }
@@ -859,11 +1005,13 @@ check_compositor_capabilities(struct weston_compositor *compositor,
 static void
 handle_primary_client_destroyed(struct wl_listener *listener, void *data)
 {
-	struct wl_client *client = data;
+	struct wet_compositor *wet =
+		container_of(listener, struct wet_compositor,
+			     primary_client_destroyed);
 
 	weston_log("Primary client died.  Closing...\n");
 
-	wl_display_terminate(wl_client_get_display(client));
+	weston_compositor_terminate(wet->compositor);
 }
 
 static int
@@ -1000,12 +1148,31 @@ wet_get_bindir_path(const char *name)
 	return wet_get_binary_path(name, BINDIR);
 }
 
+/** Modules that nothing on the way to the first frame depends on */
+static bool
+wet_module_is_deferrable(const char *name)
+{
+	static const char * const deferrable[] = {
+		"screen-share.so",
+	};
+	unsigned i;
+
+	for (i = 0; i < ARRAY_LENGTH(deferrable); i++) {
+		if (strcmp(name, deferrable[i]) == 0)
+			return true;
+	}
+
+	return false;
+}
+
 static int
 load_modules(struct weston_compositor *ec, const char *modules,
 	     int *argc, char *argv[], bool *xwayland)
 {
+	struct wet_compositor *wet = to_wet_compositor(ec);
 	const char *p, *end;
 	char buffer[256];
+	char **deferred;
 
 	if (modules == NULL)
 		return 0;
@@ -1021,6 +1188,17 @@ load_modules(struct weston_compositor *ec, const char *modules,
 				   "or set xwayland=true in the [core] section "
 				   "in weston.ini\n");
 			*xwayland = true;
+		} else if (wet->fast_start.enabled &&
+			   wet_module_is_deferrable(buffer)) {
+			deferred = wl_array_add(&wet->fast_start.modules,
+						sizeof *deferred);
+			if (!deferred)
+				return -1;
+			*deferred = strdup(buffer);
+			if (!*deferred) {
+				wet->fast_start.modules.size -= sizeof *deferred;
+				return -1;
+			}
 		} else {
 			if (wet_load_module(ec, buffer, argc, argv) < 0)
 				return -1;
@@ -1100,7 +1278,12 @@ weston_compositor_init_config(struct weston_compositor *ec,
 	struct xkb_rule_names xkb_names;
 	struct weston_config_section *s;
 	int repaint_msec;
+	int repaint_percentile;
 	bool color_management;
+	bool shm_udmabuf;
+	uint32_t memory_pressure_msec;
+	uint32_t watchdog_msec;
+	uint32_t client_request_budget;
 	bool cal;
 
 	/* weston.ini [keyboard] */
@@ -1140,6 +1323,73 @@ weston_compositor_init_config(struct weston_compositor *ec,
 	weston_log("Output repaint window is %d ms maximum.\n",
 		   ec->repaint_msec);
 
+	weston_config_section_get_bool(s, "repaint-window-adaptive",
+				       &ec->repaint_window_adaptive, false);
+	weston_config_section_get_int(s, "repaint-window-percentile",
+				      &repaint_percentile,
+				      ec->repaint_window_percentile);
+	if (repaint_percentile < 50 || repaint_percentile > 100) {
+		weston_log("Invalid repaint-window-percentile value in config: %d\n",
+			   repaint_percentile);
+	} else {
+		ec->repaint_window_percentile = repaint_percentile;
+	}
+	if (ec->repaint_window_adaptive)
+		weston_log("Output repaint window adapts to the %dth percentile "
+			   "of repaint times.\n", ec->repaint_window_percentile);
+
+	weston_config_section_get_int(s, "occluded-frame-interval",
+				      &ec->occluded_frame_interval_msec, 0);
+	if (ec->occluded_frame_interval_msec > 0)
+		weston_log("Frame callbacks of occluded surfaces are sent "
+			   "every %d ms.\n", ec->occluded_frame_interval_msec);
+	else if (ec->occluded_frame_interval_msec < 0)
+		weston_log("Frame callbacks of occluded surfaces are paused.\n");
+
+	weston_config_section_get_uint(s, "texture-evict-frames",
+				       &ec->texture_evict_frames, 0);
+	weston_config_section_get_uint(s, "texture-budget",
+				       &ec->texture_budget_mib, 0);
+	if (ec->texture_evict_frames > 0)
+		weston_log("Textures of surfaces hidden for %u frames are "
+			   "released above %u MiB.\n",
+			   ec->texture_evict_frames, ec->texture_budget_mib);
+
+	weston_config_section_get_uint(s, "client-memory-budget",
+				       &ec->client_memory_budget_mib, 0);
+
+	weston_config_section_get_uint(s, "damage-merge-pixels",
+				       &ec->damage_merge_pixels, 0);
+
+	weston_config_section_get_bool(s, "shm-content-hash",
+				       &ec->shm_content_hash, false);
+	if (ec->shm_content_hash)
+		weston_log("Commits of unchanged wl_shm content are not "
+			   "repainted.\n");
+
+	weston_config_section_get_bool(s, "shm-udmabuf", &shm_udmabuf, false);
+	if (shm_udmabuf && weston_compositor_enable_shm_udmabuf(ec) == 0)
+		weston_log("wl_shm buffers are imported through udmabuf.\n");
+
+	weston_config_section_get_uint(s, "memory-pressure-threshold",
+				       &memory_pressure_msec, 0);
+	if (memory_pressure_msec > 0 &&
+	    weston_compositor_enable_memory_pressure(ec,
+						     memory_pressure_msec) == 0)
+		weston_log("Caches are trimmed when tasks stall on memory for "
+			   "%u ms per second.\n", memory_pressure_msec);
+
+	weston_config_section_get_uint(s, "watchdog-threshold",
+				       &watchdog_msec, 0);
+	if (watchdog_msec > 0 &&
+	    weston_compositor_enable_watchdog(ec, watchdog_msec) == 0)
+		weston_log("Main loop stalls over %u ms are logged to the "
+			   "'watchdog' scope.\n", watchdog_msec);
+
+	weston_config_section_get_uint(s, "client-request-budget",
+				       &client_request_budget, 0);
+	weston_compositor_set_client_request_budget(ec, client_request_budget);
+
 	weston_config_section_get_bool(s, "color-management",
 				       &color_management, false);
 	if (color_management) {
@@ -1155,6 +1405,14 @@ weston_compositor_init_config(struct weston_compositor *ec,
 	if (cal)
 		weston_compositor_enable_touch_calibrator(ec,
 						save_touch_device_calibration);
+	weston_config_section_get_bool(s, "coalesce-motion",
+				       &ec->input_coalesce, false);
+	weston_config_section_get_uint(s, "coalesce-deadline",
+				       &ec->input_coalesce_msec, 0);
+	weston_config_section_get_bool(s, "input-thread",
+				       &ec->input_thread, false);
+	weston_config_section_get_bool(s, "defer-enumeration",
+				       &ec->input_deferred_enumeration, false);
 
 	return 0;
 }
@@ -1252,7 +1510,7 @@ load_configuration(struct weston_config **config, int32_t noconfig,
 static void
 handle_exit(struct weston_compositor *c)
 {
-	wl_display_terminate(c->wl_display);
+	weston_compositor_terminate(c);
 }
 
 static void
@@ -1817,6 +2075,9 @@ drm_backend_output_configure(struct weston_output *output,
 	char *modeline = NULL;
 	char *gbm_format = NULL;
 	char *seat = NULL;
+	char *mirror_of = NULL;
+	uint32_t idle_refresh;
+	bool vrr;
 
 	api = weston_drm_output_get_api(output->compositor);
 	if (!api) {
@@ -1869,6 +2130,17 @@ drm_backend_output_configure(struct weston_output *output,
 	api->set_seat(output, seat);
 	free(seat);
 
+	weston_config_section_get_bool(section, "vrr", &vrr, false);
+	api->set_vrr(output, vrr);
+
+	weston_config_section_get_uint(section, "idle-refresh-timeout",
+				       &idle_refresh, 0);
+	api->set_idle_refresh(output, idle_refresh * 1000);
+
+	weston_config_section_get_string(section, "mirror-of", &mirror_of, NULL);
+	api->set_mirror_of(output, mirror_of);
+	free(mirror_of);
+
 	allow_content_protection(output, section);
 
 	return 0;
@@ -2340,7 +2612,10 @@ drm_backend_remoted_output_configure(struct weston_output *output,
 	char *seat = NULL;
 	char *host = NULL;
 	char *pipeline = NULL;
-	int port, ret;
+	char *encoder = NULL;
+	char *mirror_of = NULL;
+	uint32_t queue_depth;
+	int port, bitrate, ret;
 
 	ret = api->set_mode(output, modeline);
 	if (ret < 0) {
@@ -2370,6 +2645,21 @@ drm_backend_remoted_output_configure(struct weston_output *output,
 	api->set_seat(output, seat);
 	free(seat);
 
+	weston_config_section_get_string(section, "encoder", &encoder, NULL);
+	api->set_encoder(output, encoder);
+	free(encoder);
+
+	weston_config_section_get_int(section, "bitrate", &bitrate, 0);
+	api->set_bitrate(output, bitrate);
+
+	weston_config_section_get_uint(section, "buffer-queue-depth",
+				       &queue_depth, 0);
+	api->set_buffer_queue_depth(output, queue_depth);
+
+	weston_config_section_get_string(section, "mirror-of", &mirror_of, NULL);
+	api->set_mirror_of(output, mirror_of);
+	free(mirror_of);
+
 	weston_config_section_get_string(section, "gst-pipeline", &pipeline,
 					 NULL);
 	if (pipeline) {
@@ -2494,6 +2784,8 @@ drm_backend_pipewire_output_configure(struct weston_output *output,
 				     const struct weston_pipewire_api *api)
 {
 	char *seat = NULL;
+	char *mirror_of = NULL;
+	bool damage_tracking;
 	int ret;
 
 	ret = api->set_mode(output, modeline);
@@ -2519,6 +2811,14 @@ drm_backend_pipewire_output_configure(struct weston_output *output,
 	api->set_seat(output, seat);
 	free(seat);
 
+	weston_config_section_get_bool(section, "damage-tracking",
+				       &damage_tracking, false);
+	api->set_damage_tracking(output, damage_tracking);
+
+	weston_config_section_get_string(section, "mirror-of", &mirror_of, NULL);
+	api->set_mirror_of(output, mirror_of);
+	free(mirror_of);
+
 	return 0;
 }
 
@@ -2637,6 +2937,7 @@ load_drm_backend(struct weston_compositor *c,
 		{ WESTON_OPTION_STRING, "seat", 0, &config.seat_id },
 		{ WESTON_OPTION_INTEGER, "tty", 0, &config.tty },
 		{ WESTON_OPTION_STRING, "drm-device", 0, &config.specific_device },
+		{ WESTON_OPTION_STRING, "render-device", 0, &config.render_device },
 		{ WESTON_OPTION_BOOLEAN, "current-mode", 0, &wet->drm_use_current_mode },
 		{ WESTON_OPTION_BOOLEAN, "use-pixman", 0, &config.use_pixman },
 		{ WESTON_OPTION_BOOLEAN, "continue-without-input", false, &without_input }
@@ -2650,8 +2951,20 @@ load_drm_backend(struct weston_compositor *c,
 					 NULL);
 	weston_config_section_get_uint(section, "pageflip-timeout",
 	                               &config.pageflip_timeout, 0);
+	weston_config_section_get_bool(section, "pageflip-timeout-recovery",
+				       &config.pageflip_timeout_recovery, false);
 	weston_config_section_get_bool(section, "pixman-shadow",
 				       &config.use_pixman_shadow, true);
+	weston_config_section_get_bool(section, "cursor-late-latch",
+				       &config.cursor_late_latch, false);
+	weston_config_section_get_uint(section, "pixman-repaint-threads",
+				       &config.pixman_repaint_threads, 1);
+	weston_config_section_get_string(section, "recorder-output",
+					 &config.recorder_output, NULL);
+	weston_config_section_get_uint(section, "recorder-queue-depth",
+				       &config.recorder_queue_depth, 4);
+	weston_config_section_get_bool(section, "commit-thread",
+				       &config.commit_thread, false);
 	if (without_input)
 		c->require_input = !without_input;
 
@@ -2675,6 +2988,8 @@ load_drm_backend(struct weston_compositor *c,
 	free(config.gbm_format);
 	free(config.seat_id);
 	free(config.specific_device);
+	free(config.render_device);
+	free(config.recorder_output);
 
 	return ret;
 }
@@ -2700,6 +3015,7 @@ load_headless_backend(struct weston_compositor *c,
 	struct weston_headless_backend_config config = {{ 0, }};
 	struct weston_config_section *section;
 	bool no_outputs = false;
+	int refresh_rate = 0;
 	int ret = 0;
 	char *transform = NULL;
 
@@ -2721,6 +3037,8 @@ load_headless_backend(struct weston_compositor *c,
 		{ WESTON_OPTION_BOOLEAN, "use-gl", 0, &config.use_gl },
 		{ WESTON_OPTION_STRING, "transform", 0, &transform },
 		{ WESTON_OPTION_BOOLEAN, "no-outputs", 0, &no_outputs },
+		{ WESTON_OPTION_INTEGER, "refresh-rate", 0, &refresh_rate },
+		{ WESTON_OPTION_BOOLEAN, "benchmark", 0, &config.benchmark },
 	};
 
 	parse_options(options, ARRAY_LENGTH(options), argc, argv);
@@ -2733,6 +3051,9 @@ load_headless_backend(struct weston_compositor *c,
 		free(transform);
 	}
 
+	if (refresh_rate > 0)
+		config.refresh = refresh_rate * 1000;
+
 	config.base.struct_version = WESTON_HEADLESS_BACKEND_CONFIG_VERSION;
 	config.base.struct_size = sizeof(struct weston_headless_backend_config);
 
@@ -2808,6 +3129,7 @@ weston_rdp_backend_config_init(struct weston_rdp_backend_config *config)
 	config->env_socket = 0;
 	config->no_clients_resize = 0;
 	config->force_no_compression = 0;
+	config->use_gl = false;
 }
 
 static int
@@ -2834,6 +3156,7 @@ load_rdp_backend(struct weston_compositor *c,
 		{ WESTON_OPTION_STRING,  "rdp-tls-cert", 0, &config.server_cert },
 		{ WESTON_OPTION_STRING,  "rdp-tls-key", 0, &config.server_key },
 		{ WESTON_OPTION_BOOLEAN, "force-no-compression", 0, &config.force_no_compression },
+		{ WESTON_OPTION_BOOLEAN, "use-gl", 0, &config.use_gl },
 	};
 
 	parse_options(rdp_options, ARRAY_LENGTH(rdp_options), argc, argv);
@@ -3055,6 +3378,7 @@ load_wayland_backend(struct weston_compositor *c,
 		{ WESTON_OPTION_INTEGER, "output-count", 0, &count },
 		{ WESTON_OPTION_BOOLEAN, "fullscreen", 0, &config.fullscreen },
 		{ WESTON_OPTION_BOOLEAN, "sprawl", 0, &config.sprawl },
+		{ WESTON_OPTION_BOOLEAN, "passthrough", 0, &config.passthrough },
 	};
 
 	parse_options(wayland_options, ARRAY_LENGTH(wayland_options), argc, argv);
@@ -3224,6 +3548,198 @@ out:
 	return ret;
 }
 
+/** Log a step of the startup timeline in fast-start mode */
+static void
+wet_startup_phase(struct wet_compositor *wet, const char *phase)
+{
+	struct timespec now;
+
+	if (!wet->fast_start.enabled)
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	weston_log("Startup: %s after %.1f ms\n", phase,
+		   timespec_sub_to_nsec(&now, &wet->fast_start.start) / 1e6);
+}
+
+static void
+wet_first_frame_listener_destroy(struct wet_first_frame_listener *l)
+{
+	wl_list_remove(&l->frame_listener.link);
+	wl_list_remove(&l->output_destroy_listener.link);
+	wl_list_remove(&l->link);
+	free(l);
+}
+
+static void
+wet_fast_start_release_listeners(struct wet_compositor *wet)
+{
+	struct wet_first_frame_listener *l, *tmp;
+
+	wl_list_for_each_safe(l, tmp, &wet->fast_start.frame_listener_list, link)
+		wet_first_frame_listener_destroy(l);
+
+	if (wet->fast_start.timer) {
+		wl_event_source_remove(wet->fast_start.timer);
+		wet->fast_start.timer = NULL;
+	}
+}
+
+/** Run the work that fast-start mode held back until the first frame
+ *
+ * Failures here are as fatal as they would have been during startup, but
+ * the event loop is already running, so exit through the compositor.
+ */
+static void
+wet_fast_start_run_deferred(void *data)
+{
+	struct wet_compositor *wet = data;
+	struct weston_compositor *ec = wet->compositor;
+	static char program[] = "weston";
+	char *argv[] = { program, NULL };
+	int argc = 1;
+	char **name;
+
+	wet->fast_start.idle = NULL;
+	wet_fast_start_release_listeners(wet);
+
+	wl_array_for_each(name, &wet->fast_start.modules) {
+		if (wet_load_module(ec, *name, &argc, argv) < 0)
+			goto err;
+	}
+
+	if (wet->fast_start.xwayland && wet_load_xwayland(ec) < 0)
+		goto err;
+
+	if (wet->fast_start.autolaunch &&
+	    execute_autolaunch(wet, wet->config) < 0)
+		goto err;
+
+	wet_startup_phase(wet, "deferred modules loaded");
+	return;
+
+err:
+	weston_log("fatal: failed to load deferred modules\n");
+	weston_compositor_exit_with_code(ec, EXIT_FAILURE);
+}
+
+static void
+wet_fast_start_schedule_deferred(struct wet_compositor *wet)
+{
+	struct wl_event_loop *loop =
+		wl_display_get_event_loop(wet->compositor->wl_display);
+
+	if (wet->fast_start.idle)
+		return;
+
+	/* Not from within the repaint that reported the frame */
+	wet->fast_start.idle =
+		wl_event_loop_add_idle(loop, wet_fast_start_run_deferred, wet);
+}
+
+static void
+wet_first_frame_notify(struct wl_listener *listener, void *data)
+{
+	struct wet_first_frame_listener *l =
+		container_of(listener, struct wet_first_frame_listener,
+			     frame_listener);
+	struct wet_compositor *wet = l->wet;
+
+	wet_startup_phase(wet, "first frame");
+
+	/* Frees l */
+	wet_fast_start_release_listeners(wet);
+	wet_fast_start_schedule_deferred(wet);
+}
+
+static void
+wet_first_frame_output_destroy(struct wl_listener *listener, void *data)
+{
+	struct wet_first_frame_listener *l =
+		container_of(listener, struct wet_first_frame_listener,
+			     output_destroy_listener);
+	struct wet_compositor *wet = l->wet;
+
+	wet_first_frame_listener_destroy(l);
+	if (wl_list_empty(&wet->fast_start.frame_listener_list))
+		wet_fast_start_schedule_deferred(wet);
+}
+
+static int
+wet_fast_start_timeout(void *data)
+{
+	struct wet_compositor *wet = data;
+
+	weston_log("Startup: no frame after %d ms, loading deferred modules\n",
+		   WET_FAST_START_TIMEOUT_MSEC);
+	wet_fast_start_schedule_deferred(wet);
+
+	return 0;
+}
+
+/** Hold the deferred startup work back until some output draws */
+static int
+wet_fast_start_arm(struct wet_compositor *wet)
+{
+	struct weston_compositor *ec = wet->compositor;
+	struct wl_event_loop *loop = wl_display_get_event_loop(ec->wl_display);
+	struct wet_first_frame_listener *l;
+	struct weston_output *output;
+
+	if (!wet->fast_start.enabled)
+		return 0;
+
+	if (wet->fast_start.modules.size == 0 && !wet->fast_start.xwayland &&
+	    !wet->fast_start.autolaunch)
+		return 0;
+
+	wl_list_for_each(output, &ec->output_list, link) {
+		l = zalloc(sizeof *l);
+		if (!l)
+			return -1;
+
+		l->wet = wet;
+		l->frame_listener.notify = wet_first_frame_notify;
+		wl_signal_add(&output->frame_signal, &l->frame_listener);
+		l->output_destroy_listener.notify =
+			wet_first_frame_output_destroy;
+		wl_signal_add(&output->destroy_signal,
+			      &l->output_destroy_listener);
+		wl_list_insert(&wet->fast_start.frame_listener_list, &l->link);
+	}
+
+	if (wl_list_empty(&wet->fast_start.frame_listener_list)) {
+		wet_fast_start_schedule_deferred(wet);
+		return 0;
+	}
+
+	wet->fast_start.timer =
+		wl_event_loop_add_timer(loop, wet_fast_start_timeout, wet);
+	if (!wet->fast_start.timer)
+		return -1;
+	wl_event_source_timer_update(wet->fast_start.timer,
+				     WET_FAST_START_TIMEOUT_MSEC);
+
+	return 0;
+}
+
+static void
+wet_fast_start_release(struct wet_compositor *wet)
+{
+	char **name;
+
+	wet_fast_start_release_listeners(wet);
+
+	if (wet->fast_start.idle) {
+		wl_event_source_remove(wet->fast_start.idle);
+		wet->fast_start.idle = NULL;
+	}
+
+	wl_array_for_each(name, &wet->fast_start.modules)
+		free(*name);
+	wl_array_release(&wet->fast_start.modules);
+}
+
 static void
 weston_log_setup_scopes(struct weston_log_context *log_ctx,
 			struct weston_log_subscriber *subscriber,
@@ -3234,7 +3750,23 @@ weston_log_setup_scopes(struct weston_log_context *log_ctx,
 
 	char *tokenize = strdup(names);
 	char *token = strtok(tokenize, ",");
+	char *interval, *end;
+	unsigned long n;
+
 	while (token) {
+		/* "scope:N" keeps one out of every N repaint cycles */
+		interval = strchr(token, ':');
+		if (interval) {
+			*interval++ = '\0';
+			errno = 0;
+			n = strtoul(interval, &end, 10);
+			if (errno == 0 && end != interval && *end == '\0')
+				weston_log_ctx_set_sample_interval(log_ctx,
+								   token, n);
+			else
+				weston_log("Invalid sample interval for "
+					   "scope %s: %s\n", token, interval);
+		}
 		weston_log_subscribe(log_ctx, subscriber, token);
 		token = strtok(NULL, ",");
 	}
@@ -3250,6 +3782,50 @@ flight_rec_key_binding_handler(struct weston_keyboard *keyboard,
 	weston_log_subscriber_display_flight_rec(flight_rec);
 }
 
+static void
+wet_memory_pressure_handler(struct wl_listener *listener, void *data)
+{
+	struct wet_compositor *wet =
+		container_of(listener, struct wet_compositor,
+			     memory_pressure_listener);
+	struct weston_memory_trim *trim = data;
+
+	trim->heap_bytes +=
+		weston_log_subscriber_shrink_flight_rec(wet->flight_rec,
+							LOW_MEMORY_FLIGHT_REC_SIZE);
+}
+
+static void
+proto_capture_key_binding_handler(struct weston_keyboard *keyboard,
+				  const struct timespec *time, uint32_t key,
+				  void *data)
+{
+	struct weston_log_subscriber *capture_rec = data;
+	const char *dir = getenv("XDG_RUNTIME_DIR");
+	char *path;
+	FILE *fp;
+
+	if (!dir)
+		dir = "/tmp";
+
+	str_printf(&path, "%s/weston-proto-capture-%ld.bin", dir,
+		   (long) getpid());
+	if (!path)
+		return;
+
+	fp = fopen(path, "w");
+	if (fp) {
+		weston_log_subscriber_dump_flight_rec(capture_rec, fp);
+		fclose(fp);
+		weston_log("Protocol capture written to %s\n", path);
+	} else {
+		weston_log("Failed to write protocol capture to %s: %s\n",
+			   path, strerror(errno));
+	}
+
+	free(path);
+}
+
 static void
 weston_log_subscribe_to_scopes(struct weston_log_context *log_ctx,
 			       struct weston_log_subscriber *logger,
@@ -3266,6 +3842,31 @@ weston_log_subscribe_to_scopes(struct weston_log_context *log_ctx,
 		weston_log_setup_scopes(log_ctx, flight_rec, flight_rec_scopes);
 }
 
+/*
+ * Keeps vblank deadlines when background tasks compete for the CPU. The
+ * process needs RLIMIT_RTPRIO, e.g. from LimitRTPRIO= of its systemd
+ * unit. SCHED_RESET_ON_FORK keeps threads and clients started from now
+ * on out of the realtime class, so only the compositor thread is in it.
+ */
+static void
+wet_set_realtime(int priority)
+{
+	struct sched_param param = { 0 };
+
+	param.sched_priority = MAX(sched_get_priority_min(SCHED_FIFO),
+				   MIN(priority, sched_get_priority_max(SCHED_FIFO)));
+	if (sched_setscheduler(0, SCHED_FIFO | SCHED_RESET_ON_FORK,
+			       &param) < 0) {
+		weston_log("Failed to run the compositor with SCHED_FIFO "
+			   "priority %d: %s\n", param.sched_priority,
+			   strerror(errno));
+		return;
+	}
+
+	weston_log("Compositor thread runs with SCHED_FIFO priority %d.\n",
+		   param.sched_priority);
+}
+
 WL_EXPORT int
 wet_main(int argc, char *argv[], const struct weston_testsuite_data *test_data)
 {
@@ -3295,12 +3896,18 @@ wet_main(int argc, char *argv[], const struct weston_testsuite_data *test_data)
 	struct weston_config *config = NULL;
 	struct weston_config_section *section;
 	struct wl_client *primary_client;
-	struct wl_listener primary_client_destroyed;
 	struct weston_seat *seat;
 	struct wet_compositor wet = { 0 };
 	struct weston_log_context *log_ctx = NULL;
 	struct weston_log_subscriber *logger = NULL;
 	struct weston_log_subscriber *flight_rec = NULL;
+	struct weston_log_subscriber *capture_rec = NULL;
+	int32_t log_async_kb = 0;
+	int32_t log_fsync_msec = -1;
+	int32_t realtime_priority = 0;
+	int32_t proto_capture_kb = 0;
+	int32_t proto_capture_pid = 0;
+	int32_t proto_capture_sample = 1;
 	sigset_t mask;
 
 	bool wait_for_debugger = false;
@@ -3316,6 +3923,8 @@ wet_main(int argc, char *argv[], const struct weston_testsuite_data *test_data)
 #endif
 		{ WESTON_OPTION_STRING, "modules", 0, &option_modules },
 		{ WESTON_OPTION_STRING, "log", 0, &log },
+		{ WESTON_OPTION_INTEGER, "log-async", 0, &log_async_kb },
+		{ WESTON_OPTION_INTEGER, "log-fsync", 0, &log_fsync_msec },
 		{ WESTON_OPTION_BOOLEAN, "help", 'h', &help },
 		{ WESTON_OPTION_BOOLEAN, "version", 0, &version },
 		{ WESTON_OPTION_BOOLEAN, "no-config", 0, &noconfig },
@@ -3324,9 +3933,15 @@ wet_main(int argc, char *argv[], const struct weston_testsuite_data *test_data)
 		{ WESTON_OPTION_BOOLEAN, "debug", 0, &debug_protocol },
 		{ WESTON_OPTION_STRING, "logger-scopes", 'l', &log_scopes },
 		{ WESTON_OPTION_STRING, "flight-rec-scopes", 'f', &flight_rec_scopes },
+		{ WESTON_OPTION_INTEGER, "proto-capture", 0, &proto_capture_kb },
+		{ WESTON_OPTION_INTEGER, "proto-capture-pid", 0, &proto_capture_pid },
+		{ WESTON_OPTION_INTEGER, "proto-capture-sample", 0, &proto_capture_sample },
 	};
 
 	wl_list_init(&wet.layoutput_list);
+	wl_list_init(&wet.fast_start.frame_listener_list);
+	wl_array_init(&wet.fast_start.modules);
+	clock_gettime(CLOCK_MONOTONIC, &wet.fast_start.start);
 
 	os_fd_set_cloexec(fileno(stdin));
 
@@ -3359,7 +3974,13 @@ wet_main(int argc, char *argv[], const struct weston_testsuite_data *test_data)
 
 	weston_log_set_handler(vlog, vlog_continue);
 
-	logger = weston_log_subscriber_create_log(weston_logfile);
+	/* A stalled disk then only costs dropped messages, never a frame. */
+	if (log_async_kb > 0)
+		logger = weston_log_subscriber_create_log_async(weston_logfile,
+								(size_t) log_async_kb * 1024,
+								log_fsync_msec);
+	if (!logger)
+		logger = weston_log_subscriber_create_log(weston_logfile);
 
 	if (!flight_rec_scopes)
 		flight_rec_scopes = DEFAULT_FLIGHT_REC_SCOPES;
@@ -3370,6 +3991,19 @@ wet_main(int argc, char *argv[], const struct weston_testsuite_data *test_data)
 	weston_log_subscribe_to_scopes(log_ctx, logger, flight_rec,
 				       log_scopes, flight_rec_scopes);
 
+	if (proto_capture_kb > 0) {
+		size_t size = (size_t) proto_capture_kb * 1024;
+
+		/* whole records only, so none is split when the ring wraps */
+		size -= size % sizeof(struct proto_capture_record);
+		capture_rec = weston_log_subscriber_create_binary_flight_rec(size);
+		if (capture_rec)
+			weston_log_subscribe(log_ctx, capture_rec,
+					     "proto-capture");
+	}
+	proto_capture.pid = MAX(proto_capture_pid, 0);
+	proto_capture.sample = MAX(proto_capture_sample, 1);
+
 	weston_log("%s\n"
 		   STAMP_SPACE "%s\n"
 		   STAMP_SPACE "Bug reports to: %s\n"
@@ -3391,11 +4025,11 @@ wet_main(int argc, char *argv[], const struct weston_testsuite_data *test_data)
 
 	loop = wl_display_get_event_loop(display);
 	signals[0] = wl_event_loop_add_signal(loop, SIGTERM, on_term_signal,
-					      display);
+					      &wet);
 	signals[1] = wl_event_loop_add_signal(loop, SIGINT, on_term_signal,
-					      display);
+					      &wet);
 	signals[2] = wl_event_loop_add_signal(loop, SIGQUIT, on_term_signal,
-					      display);
+					      &wet);
 
 	wl_list_init(&wet.child_process_list);
 	signals[3] = wl_event_loop_add_signal(loop, SIGCHLD, sigchld_handler,
@@ -3419,6 +4053,10 @@ wet_main(int argc, char *argv[], const struct weston_testsuite_data *test_data)
 
 	section = weston_config_get_section(config, "core", NULL, NULL);
 
+	weston_config_section_get_bool(section, "fast-start",
+				       &wet.fast_start.enabled, false);
+	wet_startup_phase(&wet, "configuration loaded");
+
 	if (!wait_for_debugger) {
 		weston_config_section_get_bool(section, "wait-for-debugger",
 					       &wait_for_debugger, false);
@@ -3448,17 +4086,35 @@ wet_main(int argc, char *argv[], const struct weston_testsuite_data *test_data)
 					     "Wayland protocol dump for all clients.\n",
 					     NULL, NULL, NULL);
 
+	protocol_capture_scope =
+		weston_log_ctx_add_log_scope(log_ctx, "proto-capture",
+					     "Binary protocol capture, see "
+					     "--proto-capture in weston(1).\n",
+					     NULL, NULL, NULL);
+
 	protologger = wl_display_add_protocol_logger(display,
 						     protocol_log_fn,
 						     NULL);
 	if (debug_protocol)
 		weston_compositor_enable_debug_protocol(wet.compositor);
 
-	if (flight_rec)
+	if (flight_rec) {
 		weston_compositor_add_debug_binding(wet.compositor, KEY_D,
 						    flight_rec_key_binding_handler,
 						    flight_rec);
 
+		wet.flight_rec = flight_rec;
+		wet.memory_pressure_listener.notify =
+			wet_memory_pressure_handler;
+		wl_signal_add(&wet.compositor->memory_pressure_signal,
+			      &wet.memory_pressure_listener);
+	}
+
+	if (capture_rec)
+		weston_compositor_add_debug_binding(wet.compositor, KEY_P,
+						    proto_capture_key_binding_handler,
+						    capture_rec);
+
 	if (weston_compositor_init_config(wet.compositor, config) < 0)
 		goto out;
 
@@ -3469,6 +4125,7 @@ wet_main(int argc, char *argv[], const struct weston_testsuite_data *test_data)
 		weston_log("fatal: failed to create compositor backend\n");
 		goto out;
 	}
+	wet_startup_phase(&wet, "backend loaded");
 
 	if (test_data && !check_compositor_capabilities(wet.compositor,
 				test_data->test_quirks.required_capabilities)) {
@@ -3479,6 +4136,7 @@ wet_main(int argc, char *argv[], const struct weston_testsuite_data *test_data)
 	weston_compositor_flush_heads_changed(wet.compositor);
 	if (wet.init_failed)
 		goto out;
+	wet_startup_phase(&wet, "outputs configured");
 
 	if (idle_time < 0)
 		weston_config_section_get_int(section, "idle-time", &idle_time, -1);
@@ -3507,10 +4165,10 @@ wet_main(int argc, char *argv[], const struct weston_testsuite_data *test_data)
 				   strerror(errno));
 			goto out;
 		}
-		primary_client_destroyed.notify =
+		wet.primary_client_destroyed.notify =
 			handle_primary_client_destroyed;
 		wl_client_add_destroy_listener(primary_client,
-					       &primary_client_destroyed);
+					       &wet.primary_client_destroyed);
 	} else if (weston_create_listening_socket(display, socket_name)) {
 		goto out;
 	}
@@ -3521,6 +4179,7 @@ wet_main(int argc, char *argv[], const struct weston_testsuite_data *test_data)
 
 	if (wet_load_shell(wet.compositor, shell, &argc, argv) < 0)
 		goto out;
+	wet_startup_phase(&wet, "shell loaded");
 
 	weston_config_section_get_string(section, "modules", &modules, "");
 	if (load_modules(wet.compositor, modules, &argc, argv, &xwayland) < 0)
@@ -3533,10 +4192,13 @@ wet_main(int argc, char *argv[], const struct weston_testsuite_data *test_data)
 		weston_config_section_get_bool(section, "xwayland", &xwayland,
 					       false);
 	}
-	if (xwayland) {
+	if (xwayland && wet.fast_start.enabled) {
+		wet.fast_start.xwayland = true;
+	} else if (xwayland) {
 		if (wet_load_xwayland(wet.compositor) < 0)
 			goto out;
 	}
+	wet_startup_phase(&wet, "modules loaded");
 
 	section = weston_config_get_section(config, "keyboard", NULL, NULL);
 	weston_config_section_get_bool(section, "numlock-on", &numlock_on, false);
@@ -3559,13 +4221,25 @@ wet_main(int argc, char *argv[], const struct weston_testsuite_data *test_data)
 
 	weston_compositor_wake(wet.compositor);
 
-	if (execute_autolaunch(&wet, config) < 0)
+	if (wet.fast_start.enabled)
+		wet.fast_start.autolaunch = true;
+	else if (execute_autolaunch(&wet, config) < 0)
+		goto out;
+
+	if (wet_fast_start_arm(&wet) < 0)
 		goto out;
+	section = weston_config_get_section(config, "core", NULL, NULL);
+	weston_config_section_get_int(section, "realtime-priority",
+				      &realtime_priority, 0);
+	if (realtime_priority > 0)
+		wet_set_realtime(realtime_priority);
+
+	wet_startup_phase(&wet, "entering event loop");
 
-	wl_display_run(display);
+	weston_compositor_run(wet.compositor);
 
 	/* Allow for setting return exit code after
-	* wl_display_run returns normally. This is
+	* weston_compositor_run returns normally. This is
 	* useful for devs/testers and automated tests
 	* that want to indicate failure status to
 	* testing infrastructure above
@@ -3573,6 +4247,7 @@ wet_main(int argc, char *argv[], const struct weston_testsuite_data *test_data)
 	ret = wet.compositor->exit_code;
 
 out:
+	wet_fast_start_release(&wet);
 	wet_compositor_destroy_layout(&wet);
 
 	/* free(NULL) is valid, and it won't be NULL if it's used */
@@ -3584,6 +4259,8 @@ out:
 	weston_compositor_destroy(wet.compositor);
 	weston_log_scope_destroy(protocol_scope);
 	protocol_scope = NULL;
+	weston_log_scope_destroy(protocol_capture_scope);
+	protocol_capture_scope = NULL;
 
 out_signals:
 	for (i = ARRAY_LENGTH(signals) - 1; i >= 0; i--)
@@ -3598,6 +4275,8 @@ out_display:
 	weston_log_subscriber_destroy(logger);
 	if (flight_rec)
 		weston_log_subscriber_destroy(flight_rec);
+	if (capture_rec)
+		weston_log_subscriber_destroy(capture_rec);
 	weston_log_ctx_destroy(log_ctx);
 	weston_log_file_close();
 
@@ -0,0 +1,364 @@
+/*
+ * Copyright © 2022 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <wayland-server.h>
+
+#include <libweston/libweston.h>
+#include <libweston/config-parser.h>
+#include <libweston/zalloc.h>
+#include "shared/helpers.h"
+#include "weston.h"
+
+/*
+ * Serves the counters of weston_compositor_write_metrics() to monitoring
+ * agents, in the OpenMetrics text format:
+ *
+ *	[core]
+ *	modules=openmetrics.so
+ *
+ *	[openmetrics]
+ *	socket=/run/user/1000/weston-metrics
+ *
+ * Every connection to the socket gets one exposition and is closed, e.g.
+ * "socat - UNIX-CONNECT:$XDG_RUNTIME_DIR/weston-metrics". With file= set,
+ * the exposition is also rewritten every file-interval milliseconds, for
+ * node exporters that pick up text files. Nothing is formatted while
+ * nobody asks.
+ */
+
+#define OPENMETRICS_FILE_INTERVAL_DEFAULT 10000
+
+struct openmetrics {
+	struct weston_compositor *compositor;
+	struct wl_listener compositor_destroy_listener;
+
+	char *socket_path;
+	int socket_fd;
+	struct wl_event_source *socket_source;
+	struct wl_list connection_list; /* openmetrics_connection::link */
+
+	char *file_path;
+	int32_t file_interval;
+	struct wl_event_source *file_timer;
+};
+
+/* A scraper the exposition did not fit into the socket buffer for */
+struct openmetrics_connection {
+	struct wl_list link;
+	int fd;
+	struct wl_event_source *source;
+	char *data;
+	size_t size;
+	size_t offset;
+};
+
+static char *
+openmetrics_format(struct openmetrics *om, size_t *size)
+{
+	char *data = NULL;
+	FILE *fp;
+
+	fp = open_memstream(&data, size);
+	if (!fp)
+		return NULL;
+
+	weston_compositor_write_metrics(om->compositor, fp);
+
+	if (fclose(fp) != 0) {
+		free(data);
+		return NULL;
+	}
+
+	return data;
+}
+
+static void
+openmetrics_connection_destroy(struct openmetrics_connection *conn)
+{
+	if (conn->source)
+		wl_event_source_remove(conn->source);
+	close(conn->fd);
+	wl_list_remove(&conn->link);
+	free(conn->data);
+	free(conn);
+}
+
+/* Returns true when the connection is done with. */
+static bool
+openmetrics_connection_flush(struct openmetrics_connection *conn)
+{
+	ssize_t len;
+
+	while (conn->offset < conn->size) {
+		len = send(conn->fd, conn->data + conn->offset,
+			   conn->size - conn->offset, MSG_NOSIGNAL);
+		if (len < 0 && errno == EINTR)
+			continue;
+		if (len < 0 && errno == EAGAIN)
+			return false;
+		if (len <= 0)
+			return true;
+
+		conn->offset += len;
+	}
+
+	return true;
+}
+
+static int
+openmetrics_connection_writable(int fd, uint32_t mask, void *data)
+{
+	struct openmetrics_connection *conn = data;
+
+	if ((mask & (WL_EVENT_HANGUP | WL_EVENT_ERROR)) ||
+	    openmetrics_connection_flush(conn))
+		openmetrics_connection_destroy(conn);
+
+	return 0;
+}
+
+static int
+openmetrics_socket_accept(int fd, uint32_t mask, void *data)
+{
+	struct openmetrics *om = data;
+	struct openmetrics_connection *conn;
+	struct wl_event_loop *loop;
+
+	conn = zalloc(sizeof *conn);
+	if (!conn)
+		return 0;
+
+	conn->fd = accept4(fd, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK);
+	if (conn->fd < 0) {
+		free(conn);
+		return 0;
+	}
+	wl_list_insert(&om->connection_list, &conn->link);
+
+	conn->data = openmetrics_format(om, &conn->size);
+	if (!conn->data || openmetrics_connection_flush(conn)) {
+		openmetrics_connection_destroy(conn);
+		return 0;
+	}
+
+	loop = wl_display_get_event_loop(om->compositor->wl_display);
+	conn->source = wl_event_loop_add_fd(loop, conn->fd, WL_EVENT_WRITABLE,
+					    openmetrics_connection_writable,
+					    conn);
+	if (!conn->source)
+		openmetrics_connection_destroy(conn);
+
+	return 0;
+}
+
+static int
+openmetrics_socket_init(struct openmetrics *om)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	struct wl_event_loop *loop;
+
+	if (strlen(om->socket_path) >= sizeof addr.sun_path) {
+		weston_log("openmetrics: socket path %s is too long\n",
+			   om->socket_path);
+		return -1;
+	}
+	strcpy(addr.sun_path, om->socket_path);
+
+	om->socket_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC |
+			       SOCK_NONBLOCK, 0);
+	if (om->socket_fd < 0)
+		return -1;
+
+	/* a stale socket of a previous instance */
+	unlink(om->socket_path);
+	if (bind(om->socket_fd, (struct sockaddr *) &addr, sizeof addr) < 0 ||
+	    listen(om->socket_fd, 4) < 0) {
+		weston_log("openmetrics: cannot listen on %s: %s\n",
+			   om->socket_path, strerror(errno));
+		close(om->socket_fd);
+		om->socket_fd = -1;
+		return -1;
+	}
+
+	loop = wl_display_get_event_loop(om->compositor->wl_display);
+	om->socket_source = wl_event_loop_add_fd(loop, om->socket_fd,
+						 WL_EVENT_READABLE,
+						 openmetrics_socket_accept, om);
+	if (!om->socket_source)
+		return -1;
+
+	weston_log("openmetrics: serving metrics on %s\n", om->socket_path);
+
+	return 0;
+}
+
+/* Written next to the target and renamed, so readers never see half. */
+static int
+openmetrics_file_timer(void *data)
+{
+	struct openmetrics *om = data;
+	char *tmp_path = NULL;
+	char *text;
+	size_t size;
+	FILE *fp;
+	bool ok;
+
+	wl_event_source_timer_update(om->file_timer, om->file_interval);
+
+	text = openmetrics_format(om, &size);
+	if (!text || asprintf(&tmp_path, "%s.tmp", om->file_path) < 0) {
+		free(text);
+		return 0;
+	}
+
+	fp = fopen(tmp_path, "we");
+	ok = fp && fwrite(text, 1, size, fp) == size;
+	if (fp && fclose(fp) != 0)
+		ok = false;
+	if (ok && rename(tmp_path, om->file_path) == 0) {
+		free(tmp_path);
+		free(text);
+		return 0;
+	}
+
+	weston_log("openmetrics: cannot write %s: %s\n", om->file_path,
+		   strerror(errno));
+	unlink(tmp_path);
+	free(tmp_path);
+	free(text);
+
+	return 0;
+}
+
+static void
+openmetrics_destroy(struct openmetrics *om)
+{
+	struct openmetrics_connection *conn, *tmp;
+
+	wl_list_for_each_safe(conn, tmp, &om->connection_list, link)
+		openmetrics_connection_destroy(conn);
+
+	if (om->socket_source)
+		wl_event_source_remove(om->socket_source);
+	if (om->socket_fd >= 0) {
+		close(om->socket_fd);
+		unlink(om->socket_path);
+	}
+	if (om->file_timer)
+		wl_event_source_remove(om->file_timer);
+
+	free(om->socket_path);
+	free(om->file_path);
+	free(om);
+}
+
+static void
+openmetrics_compositor_destroy(struct wl_listener *listener, void *data)
+{
+	struct openmetrics *om =
+		container_of(listener, struct openmetrics,
+			     compositor_destroy_listener);
+
+	wl_list_remove(&om->compositor_destroy_listener.link);
+	openmetrics_destroy(om);
+}
+
+WL_EXPORT int
+wet_module_init(struct weston_compositor *compositor,
+		int *argc, char *argv[])
+{
+	struct weston_config_section *section;
+	struct wl_event_loop *loop;
+	struct openmetrics *om;
+	const char *runtime_dir;
+
+	om = zalloc(sizeof *om);
+	if (!om)
+		return -1;
+
+	if (!weston_compositor_add_destroy_listener_once(compositor,
+						&om->compositor_destroy_listener,
+						openmetrics_compositor_destroy)) {
+		free(om);
+		return 0;
+	}
+
+	om->compositor = compositor;
+	om->socket_fd = -1;
+	wl_list_init(&om->connection_list);
+
+	section = weston_config_get_section(wet_get_config(compositor),
+					    "openmetrics", NULL, NULL);
+	weston_config_section_get_string(section, "socket",
+					 &om->socket_path, NULL);
+	weston_config_section_get_string(section, "file",
+					 &om->file_path, NULL);
+	weston_config_section_get_int(section, "file-interval",
+				      &om->file_interval,
+				      OPENMETRICS_FILE_INTERVAL_DEFAULT);
+
+	runtime_dir = getenv("XDG_RUNTIME_DIR");
+	if (!om->socket_path && !om->file_path && runtime_dir &&
+	    asprintf(&om->socket_path, "%s/weston-metrics", runtime_dir) < 0)
+		om->socket_path = NULL;
+
+	if (!om->socket_path && !om->file_path) {
+		weston_log("openmetrics: neither socket nor file configured\n");
+		goto err;
+	}
+
+	if (om->socket_path && openmetrics_socket_init(om) < 0)
+		goto err;
+
+	if (om->file_path) {
+		if (om->file_interval <= 0)
+			om->file_interval = OPENMETRICS_FILE_INTERVAL_DEFAULT;
+
+		loop = wl_display_get_event_loop(compositor->wl_display);
+		om->file_timer = wl_event_loop_add_timer(loop,
+							 openmetrics_file_timer,
+							 om);
+		if (!om->file_timer)
+			goto err;
+		wl_event_source_timer_update(om->file_timer, om->file_interval);
+	}
+
+	return 0;
+
+err:
+	wl_list_remove(&om->compositor_destroy_listener.link);
+	openmetrics_destroy(om);
+	return -1;
+}
@@ -41,13 +41,16 @@
 #include <wayland-client.h>
 
 #include <libweston/libweston.h>
+#include <libweston/backend-drm.h>
 #include "backend.h"
 #include "libweston-internal.h"
 #include "weston.h"
 #include "shared/helpers.h"
 #include "shared/os-compatibility.h"
 #include "shared/timespec-util.h"
+#include "shared/weston-drm-fourcc.h"
 #include "fullscreen-shell-unstable-v1-client-protocol.h"
+#include "linux-dmabuf-unstable-v1-client-protocol.h"
 
 struct shared_output {
 	struct weston_output *output;
@@ -58,8 +61,11 @@ struct shared_output {
 		struct wl_display *display;
 		struct wl_registry *registry;
 		struct wl_compositor *compositor;
+		uint32_t compositor_version;
 		struct wl_shm *shm;
 		uint32_t shm_formats;
+		struct zwp_linux_dmabuf_v1 *dmabuf;
+		struct wl_array dmabuf_formats; /* uint32_t, linear only */
 		struct zwp_fullscreen_shell_v1 *fshell;
 		struct wl_output *output;
 		struct wl_surface *surface;
@@ -77,6 +83,17 @@ struct shared_output {
 		struct wl_list free_buffers;
 	} shm;
 
+	/* Frames captured by DRM writeback go to the parent as they are,
+	 * planes included, instead of being read back into shm buffers. */
+	struct {
+		const struct weston_drm_output_capture_api *api;
+		bool active;
+		struct ss_dmabuf_capture *capture;
+		/* output damage not yet sent to the parent */
+		pixman_region32_t damage;
+		struct wl_list buffers; /* ss_dmabuf_buffer::link */
+	} dmabuf;
+
 	int cache_dirty;
 	pixman_image_t *cache_image;
 	uint32_t *tmp_data;
@@ -112,6 +129,18 @@ struct ss_shm_buffer {
 	pixman_image_t *pm_image;
 };
 
+struct ss_dmabuf_buffer {
+	struct wl_buffer *buffer;
+	struct wl_list link;
+};
+
+struct ss_dmabuf_capture {
+	/* NULL once the output is no longer shared */
+	struct shared_output *output;
+	/* damage up to the capture request */
+	pixman_region32_t damage;
+};
+
 struct screen_share {
 	struct weston_compositor *compositor;
 	/* XXX: missing compositor destroy listener
@@ -615,6 +644,193 @@ shared_output_ensure_tmp_data(struct shared_output *so,
 static void
 shared_output_update(struct shared_output *so);
 
+static void
+ss_dmabuf_buffer_destroy(struct ss_dmabuf_buffer *db)
+{
+	wl_buffer_destroy(db->buffer);
+	wl_list_remove(&db->link);
+	free(db);
+}
+
+static void
+dmabuf_buffer_release(void *data, struct wl_buffer *buffer)
+{
+	ss_dmabuf_buffer_destroy(data);
+}
+
+static const struct wl_buffer_listener dmabuf_buffer_listener = {
+	dmabuf_buffer_release
+};
+
+static bool
+shared_output_dmabuf_has_format(struct shared_output *so, uint32_t format)
+{
+	uint32_t *f;
+
+	wl_array_for_each(f, &so->parent.dmabuf_formats) {
+		if (*f == format)
+			return true;
+	}
+
+	return false;
+}
+
+/* The capture is in the output's buffer orientation, which the parent can
+ * only undo with wl_surface.set_buffer_transform and set_buffer_scale. */
+static bool
+shared_output_dmabuf_supported(struct shared_output *so)
+{
+	if (!so->dmabuf.api || !so->parent.dmabuf ||
+	    !so->dmabuf.api->is_supported(so->output))
+		return false;
+
+	return so->parent.compositor_version >= 3 ||
+	       (so->output->transform == WL_OUTPUT_TRANSFORM_NORMAL &&
+		so->output->current_scale == 1);
+}
+
+/* Go back to reading pixels from the renderer, which does not see planes. */
+static void
+shared_output_dmabuf_stop(struct shared_output *so)
+{
+	weston_log("Screen share: sharing %s through shm buffers\n",
+		   so->output->name);
+
+	so->dmabuf.active = false;
+	if (so->parent.compositor_version >= 3) {
+		wl_surface_set_buffer_transform(so->parent.surface,
+						WL_OUTPUT_TRANSFORM_NORMAL);
+		wl_surface_set_buffer_scale(so->parent.surface, 1);
+	}
+
+	weston_output_disable_planes_incr(so->output);
+	weston_output_damage(so->output);
+}
+
+static const struct wl_callback_listener shared_output_frame_listener;
+
+static void
+shared_output_capture_done(struct weston_output *output, int fd,
+			   uint32_t format, int width, int height, int stride,
+			   void *data)
+{
+	struct ss_dmabuf_capture *capture = data;
+	struct shared_output *so = capture->output;
+	struct zwp_linux_buffer_params_v1 *params;
+	struct ss_dmabuf_buffer *db;
+	pixman_box32_t *r;
+	int i, nrects;
+
+	if (!so)
+		goto out;
+
+	so->dmabuf.capture = NULL;
+
+	if (fd < 0 || !shared_output_dmabuf_has_format(so, format)) {
+		shared_output_dmabuf_stop(so);
+		goto out;
+	}
+
+	db = zalloc(sizeof *db);
+	if (!db) {
+		shared_output_dmabuf_stop(so);
+		goto out;
+	}
+
+	params = zwp_linux_dmabuf_v1_create_params(so->parent.dmabuf);
+	zwp_linux_buffer_params_v1_add(params, fd, 0, 0, stride,
+				       DRM_FORMAT_MOD_LINEAR >> 32,
+				       DRM_FORMAT_MOD_LINEAR & 0xffffffff);
+	db->buffer = zwp_linux_buffer_params_v1_create_immed(params, width,
+							     height, format,
+							     0);
+	zwp_linux_buffer_params_v1_destroy(params);
+	wl_buffer_add_listener(db->buffer, &dmabuf_buffer_listener, db);
+	wl_list_insert(&so->dmabuf.buffers, &db->link);
+
+	/* Damage that came in after the request may or may not be in this
+	 * frame, so it is sent now and kept for the next one as well. */
+	pixman_region32_union(&capture->damage, &capture->damage,
+			      &so->dmabuf.damage);
+	r = pixman_region32_rectangles(&capture->damage, &nrects);
+	for (i = 0; i < nrects; ++i)
+		wl_surface_damage(so->parent.surface, r[i].x1, r[i].y1,
+				  r[i].x2 - r[i].x1, r[i].y2 - r[i].y1);
+
+	if (so->parent.compositor_version >= 3) {
+		wl_surface_set_buffer_transform(so->parent.surface,
+						so->output->transform);
+		wl_surface_set_buffer_scale(so->parent.surface,
+					    so->output->current_scale);
+	}
+	wl_surface_attach(so->parent.surface, db->buffer, 0, 0);
+
+	so->parent.frame_cb = wl_surface_frame(so->parent.surface);
+	wl_callback_add_listener(so->parent.frame_cb,
+				 &shared_output_frame_listener, so);
+
+	wl_surface_commit(so->parent.surface);
+	wl_display_flush(so->parent.display);
+
+out:
+	if (fd >= 0)
+		close(fd);
+	pixman_region32_fini(&capture->damage);
+	free(capture);
+}
+
+/* Writeback would capture protected content as is; the renderer path
+ * censors it. */
+static bool
+shared_output_has_protected_content(struct shared_output *so)
+{
+	struct weston_paint_node *pnode;
+
+	wl_list_for_each(pnode, &so->output->paint_node_z_order_list,
+			 z_order_link) {
+		if (pnode->surface->desired_protection > WESTON_HDCP_DISABLE)
+			return true;
+	}
+
+	return false;
+}
+
+static void
+shared_output_start_capture(struct shared_output *so)
+{
+	struct ss_dmabuf_capture *capture;
+
+	if (so->dmabuf.capture || so->parent.frame_cb ||
+	    !pixman_region32_not_empty(&so->dmabuf.damage))
+		return;
+
+	if (shared_output_has_protected_content(so)) {
+		shared_output_dmabuf_stop(so);
+		return;
+	}
+
+	capture = zalloc(sizeof *capture);
+	if (!capture) {
+		shared_output_dmabuf_stop(so);
+		return;
+	}
+
+	capture->output = so;
+	pixman_region32_init(&capture->damage);
+	pixman_region32_copy(&capture->damage, &so->dmabuf.damage);
+
+	if (so->dmabuf.api->capture(so->output, shared_output_capture_done,
+				    capture) < 0) {
+		pixman_region32_fini(&capture->damage);
+		free(capture);
+		shared_output_dmabuf_stop(so);
+		return;
+	}
+
+	pixman_region32_clear(&so->dmabuf.damage);
+	so->dmabuf.capture = capture;
+}
+
 static void
 shared_output_frame_callback(void *data, struct wl_callback *cb, uint32_t time)
 {
@@ -641,6 +857,11 @@ shared_output_update(struct shared_output *so)
 	int i, nrects;
 	pixman_transform_t transform;
 
+	if (so->dmabuf.active) {
+		shared_output_start_capture(so);
+		return;
+	}
+
 	/* Only update if we need to */
 	if (!so->cache_dirty || so->parent.frame_cb)
 		return;
@@ -709,6 +930,36 @@ struct wl_shm_listener shm_listener = {
 	shm_handle_format
 };
 
+static void
+dmabuf_handle_format(void *data, struct zwp_linux_dmabuf_v1 *zdmabuf,
+		     uint32_t format)
+{
+	/* superseded by the modifier event */
+}
+
+static void
+dmabuf_handle_modifier(void *data, struct zwp_linux_dmabuf_v1 *zdmabuf,
+		       uint32_t format, uint32_t modifier_hi,
+		       uint32_t modifier_lo)
+{
+	struct shared_output *so = data;
+	uint64_t modifier = ((uint64_t) modifier_hi << 32) | modifier_lo;
+	uint32_t *f;
+
+	/* writeback captures are linear */
+	if (modifier != DRM_FORMAT_MOD_LINEAR)
+		return;
+
+	f = wl_array_add(&so->parent.dmabuf_formats, sizeof *f);
+	if (f)
+		*f = format;
+}
+
+static const struct zwp_linux_dmabuf_v1_listener dmabuf_listener = {
+	dmabuf_handle_format,
+	dmabuf_handle_modifier
+};
+
 static void
 registry_handle_global(void *data, struct wl_registry *registry,
 		       uint32_t id, const char *interface, uint32_t version)
@@ -716,9 +967,11 @@ registry_handle_global(void *data, struct wl_registry *registry,
 	struct shared_output *so = data;
 
 	if (strcmp(interface, "wl_compositor") == 0) {
+		so->parent.compositor_version = MIN(version, 3);
 		so->parent.compositor =
 			wl_registry_bind(registry,
-					 id, &wl_compositor_interface, 1);
+					 id, &wl_compositor_interface,
+					 so->parent.compositor_version);
 	} else if (strcmp(interface, "wl_output") == 0 && !so->parent.output) {
 		so->parent.output =
 			wl_registry_bind(registry,
@@ -730,6 +983,14 @@ registry_handle_global(void *data, struct wl_registry *registry,
 			wl_registry_bind(registry,
 					 id, &wl_shm_interface, 1);
 		wl_shm_add_listener(so->parent.shm, &shm_listener, so);
+	} else if (strcmp(interface, "zwp_linux_dmabuf_v1") == 0 &&
+		   version >= 3) {
+		so->parent.dmabuf =
+			wl_registry_bind(registry,
+					 id, &zwp_linux_dmabuf_v1_interface,
+					 3);
+		zwp_linux_dmabuf_v1_add_listener(so->parent.dmabuf,
+						 &dmabuf_listener, so);
 	} else if (strcmp(interface, "zwp_fullscreen_shell_v1") == 0) {
 		so->parent.fshell =
 			wl_registry_bind(registry,
@@ -829,6 +1090,20 @@ shared_output_repainted(struct wl_listener *listener, void *data)
 	pixman_image_t *damaged_image;
 	pixman_transform_t transform;
 
+	if (so->dmabuf.active) {
+		pixman_region32_init(&damage);
+		pixman_region32_intersect(&damage, &so->output->region,
+					  current_damage);
+		pixman_region32_translate(&damage,
+					  -so->output->x, -so->output->y);
+		pixman_region32_union(&so->dmabuf.damage, &so->dmabuf.damage,
+				      &damage);
+		pixman_region32_fini(&damage);
+
+		shared_output_update(so);
+		return;
+	}
+
 	width = so->output->current_mode->width;
 	height = so->output->current_mode->height;
 	stride = width;
@@ -941,6 +1216,7 @@ shared_output_create(struct weston_output *output, int parent_fd)
 		goto err_close;
 
 	wl_list_init(&so->seat_list);
+	wl_array_init(&so->parent.dmabuf_formats);
 
 	so->parent.display = wl_display_connect_to_fd(parent_fd);
 	if (!so->parent.display)
@@ -1008,14 +1284,24 @@ shared_output_create(struct weston_output *output, int parent_fd)
 	/* Ok, everything's created.  We should be good to go */
 	wl_list_init(&so->shm.buffers);
 	wl_list_init(&so->shm.free_buffers);
+	wl_list_init(&so->dmabuf.buffers);
+	pixman_region32_init_rect(&so->dmabuf.damage, 0, 0,
+				  output->width, output->height);
 
 	so->output = output;
 	so->output_destroyed.notify = output_destroyed;
 	wl_signal_add(&so->output->destroy_signal, &so->output_destroyed);
 
+	so->dmabuf.api = weston_drm_output_capture_get_api(output->compositor);
+	so->dmabuf.active = shared_output_dmabuf_supported(so);
+	if (so->dmabuf.active)
+		weston_log("Screen share: sharing %s through writeback "
+			   "dmabufs\n", output->name);
+
 	so->frame_listener.notify = shared_output_repainted;
 	wl_signal_add(&output->frame_signal, &so->frame_listener);
-	weston_output_disable_planes_incr(output);
+	if (!so->dmabuf.active)
+		weston_output_disable_planes_incr(output);
 	weston_output_damage(output);
 
 	return so;
@@ -1025,6 +1311,7 @@ err_display:
 		ss_seat_destroy(seat);
 	wl_display_disconnect(so->parent.display);
 err_alloc:
+	wl_array_release(&so->parent.dmabuf_formats);
 	free(so);
 err_close:
 	close(parent_fd);
@@ -1035,13 +1322,23 @@ static void
 shared_output_destroy(struct shared_output *so)
 {
 	struct ss_shm_buffer *buffer, *bnext;
+	struct ss_dmabuf_buffer *db, *dbnext;
+
+	if (!so->dmabuf.active)
+		weston_output_disable_planes_decr(so->output);
 
-	weston_output_disable_planes_decr(so->output);
+	/* The capture completes later, with nobody to send it to. */
+	if (so->dmabuf.capture)
+		so->dmabuf.capture->output = NULL;
 
 	wl_list_for_each_safe(buffer, bnext, &so->shm.buffers, link)
 		ss_shm_buffer_destroy(buffer);
 	wl_list_for_each_safe(buffer, bnext, &so->shm.free_buffers, free_link)
 		ss_shm_buffer_destroy(buffer);
+	wl_list_for_each_safe(db, dbnext, &so->dmabuf.buffers, link)
+		ss_dmabuf_buffer_destroy(db);
+	pixman_region32_fini(&so->dmabuf.damage);
+	wl_array_release(&so->parent.dmabuf_formats);
 
 	wl_display_disconnect(so->parent.display);
 	wl_event_source_remove(so->event_source);
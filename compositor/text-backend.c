@@ -27,6 +27,7 @@
 #include "config.h"
 
 #include <stdbool.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
@@ -34,6 +35,7 @@
 #include <time.h>
 
 #include <libweston/libweston.h>
+#include <libweston/weston-log.h>
 #include "weston.h"
 #include "text-input-unstable-v1-server-protocol.h"
 #include "input-method-unstable-v1-server-protocol.h"
@@ -89,6 +91,9 @@ struct input_method {
 	struct text_backend *text_backend;
 };
 
+/* Number of keys sent to the input method whose forwarding back is timed */
+#define INPUT_METHOD_PENDING_KEYS 8
+
 struct input_method_context {
 	struct wl_resource *resource;
 
@@ -96,6 +101,15 @@ struct input_method_context {
 	struct input_method *input_method;
 
 	struct wl_resource *keyboard;
+
+	/* Keys sent through the keyboard grab, oldest first, only recorded
+	 * while the text-input-latency scope has subscribers. */
+	struct {
+		uint32_t key;
+		uint32_t state;
+		struct timespec sent;
+	} pending_keys[INPUT_METHOD_PENDING_KEYS];
+	unsigned int pending_count;
 };
 
 struct text_backend {
@@ -112,6 +126,8 @@ struct text_backend {
 
 	struct wl_listener client_listener;
 	struct wl_listener seat_created_listener;
+
+	struct weston_log_scope *latency_scope;
 };
 
 static void
@@ -488,6 +504,119 @@ input_method_context_destroy(struct wl_client *client,
 	wl_resource_destroy(resource);
 }
 
+/* Every hop of a key through the input method is latency the user sees,
+ * so events are written out as soon as they are queued instead of
+ * waiting for the flush at the end of the event loop iteration. */
+static void
+flush_resource_client(struct wl_resource *resource)
+{
+	if (resource)
+		wl_client_flush(wl_resource_get_client(resource));
+}
+
+static void
+flush_keyboard_focus(struct weston_keyboard *keyboard)
+{
+	if (keyboard->focus)
+		flush_resource_client(keyboard->focus->resource);
+}
+
+static double
+input_method_msec_since(uint32_t time, const struct timespec *now)
+{
+	return (uint32_t)(timespec_to_msec(now) - time);
+}
+
+static void
+input_method_context_record_key(struct input_method_context *context,
+				uint32_t key, uint32_t state)
+{
+	struct weston_log_scope *scope =
+		context->input_method->text_backend->latency_scope;
+	unsigned int n = context->pending_count;
+
+	if (!weston_log_scope_is_enabled(scope))
+		return;
+
+	if (n == INPUT_METHOD_PENDING_KEYS) {
+		/* The input method dropped or consumed the oldest one */
+		memmove(&context->pending_keys[0], &context->pending_keys[1],
+			--n * sizeof context->pending_keys[0]);
+	}
+
+	context->pending_keys[n].key = key;
+	context->pending_keys[n].state = state;
+	clock_gettime(CLOCK_MONOTONIC, &context->pending_keys[n].sent);
+	context->pending_count = n + 1;
+}
+
+static void
+input_method_context_log_key(struct input_method_context *context,
+			     uint32_t time, uint32_t key, uint32_t state)
+{
+	struct weston_log_scope *scope =
+		context->input_method->text_backend->latency_scope;
+	struct timespec now;
+	double ime_ms = -1.0;
+	unsigned int i;
+
+	if (!weston_log_scope_is_enabled(scope))
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	for (i = 0; i < context->pending_count; i++) {
+		if (context->pending_keys[i].key != key ||
+		    context->pending_keys[i].state != state)
+			continue;
+
+		ime_ms = timespec_sub_to_nsec(&now,
+					      &context->pending_keys[i].sent) / 1e6;
+		context->pending_count--;
+		memmove(&context->pending_keys[i], &context->pending_keys[i + 1],
+			(context->pending_count - i) *
+			sizeof context->pending_keys[0]);
+		break;
+	}
+
+	if (ime_ms < 0.0) {
+		weston_log_scope_printf(scope,
+					"key %u %s: %.0f ms since input\n", key,
+					state ? "pressed" : "released",
+					input_method_msec_since(time, &now));
+		return;
+	}
+
+	weston_log_scope_printf(scope,
+				"key %u %s: %.3f ms in input method, "
+				"%.0f ms since input\n", key,
+				state ? "pressed" : "released", ime_ms,
+				input_method_msec_since(time, &now));
+}
+
+static void
+input_method_context_log_text(struct input_method_context *context,
+			      const char *what, uint32_t time)
+{
+	struct weston_log_scope *scope =
+		context->input_method->text_backend->latency_scope;
+	struct timespec now;
+
+	if (!weston_log_scope_is_enabled(scope))
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	/* commit_string carries no timestamp */
+	if (time == 0) {
+		weston_log_scope_printf(scope, "%s forwarded\n", what);
+		return;
+	}
+
+	weston_log_scope_printf(scope, "%s: %.0f ms since input\n", what,
+				input_method_msec_since(time, &now));
+}
+
 static void
 input_method_context_commit_string(struct wl_client *client,
 				   struct wl_resource *resource,
@@ -497,9 +626,13 @@ input_method_context_commit_string(struct wl_client *client,
 	struct input_method_context *context =
 		wl_resource_get_user_data(resource);
 
-	if (context->input)
-		zwp_text_input_v1_send_commit_string(context->input->resource,
-						     serial, text);
+	if (!context->input)
+		return;
+
+	zwp_text_input_v1_send_commit_string(context->input->resource,
+					     serial, text);
+	flush_resource_client(context->input->resource);
+	input_method_context_log_text(context, "commit_string", 0);
 }
 
 static void
@@ -512,9 +645,12 @@ input_method_context_preedit_string(struct wl_client *client,
 	struct input_method_context *context =
 		wl_resource_get_user_data(resource);
 
-	if (context->input)
-		zwp_text_input_v1_send_preedit_string(context->input->resource,
-						      serial, text, commit);
+	if (!context->input)
+		return;
+
+	zwp_text_input_v1_send_preedit_string(context->input->resource,
+					      serial, text, commit);
+	flush_resource_client(context->input->resource);
 }
 
 static void
@@ -598,10 +734,19 @@ input_method_context_keysym(struct wl_client *client,
 	struct input_method_context *context =
 		wl_resource_get_user_data(resource);
 
-	if (context->input)
-		zwp_text_input_v1_send_keysym(context->input->resource,
-					      serial, time,
-					      sym, state, modifiers);
+	char what[32];
+
+	if (!context->input)
+		return;
+
+	zwp_text_input_v1_send_keysym(context->input->resource,
+				      serial, time,
+				      sym, state, modifiers);
+	flush_resource_client(context->input->resource);
+
+	snprintf(what, sizeof what, "keysym 0x%x %s", sym,
+		 state ? "pressed" : "released");
+	input_method_context_log_text(context, what, time);
 }
 
 static void
@@ -633,6 +778,11 @@ input_method_context_grab_key(struct weston_keyboard_grab *grab,
 	msecs = timespec_to_msec(time);
 	wl_keyboard_send_key(keyboard->input_method_resource,
 			     serial, msecs, key, state_w);
+	flush_resource_client(keyboard->input_method_resource);
+
+	input_method_context_record_key(
+		wl_resource_get_user_data(keyboard->input_method_resource),
+		key, state_w);
 }
 
 static void
@@ -651,6 +801,7 @@ input_method_context_grab_modifier(struct weston_keyboard_grab *grab,
 	wl_keyboard_send_modifiers(keyboard->input_method_resource,
 				   serial, mods_depressed, mods_latched,
 				   mods_locked, group);
+	flush_resource_client(keyboard->input_method_resource);
 }
 
 static void
@@ -711,6 +862,9 @@ input_method_context_key(struct wl_client *client,
 	timespec_from_msec(&ts, time);
 
 	default_grab->interface->key(default_grab, &ts, key, state_w);
+	flush_keyboard_focus(keyboard);
+
+	input_method_context_log_key(context, time, key, state_w);
 }
 
 static void
@@ -733,6 +887,7 @@ input_method_context_modifiers(struct wl_client *client,
 					   serial, mods_depressed,
 					   mods_latched, mods_locked,
 					   group);
+	flush_keyboard_focus(keyboard);
 }
 
 static void
@@ -1084,6 +1239,7 @@ text_backend_destroy(struct text_backend *text_backend)
 		wl_client_destroy(text_backend->input_method.client);
 	}
 
+	weston_log_scope_destroy(text_backend->latency_scope);
 	free(text_backend->input_method.path);
 	free(text_backend);
 }
@@ -1099,6 +1255,11 @@ text_backend_init(struct weston_compositor *ec)
 		return NULL;
 
 	text_backend->compositor = ec;
+	text_backend->latency_scope =
+		weston_compositor_add_log_scope(ec, "text-input-latency",
+						"Keys and text forwarded by the "
+						"input method\n",
+						NULL, NULL, NULL);
 
 	text_backend_configuration(text_backend);
 
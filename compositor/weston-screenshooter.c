@@ -41,6 +41,7 @@ struct screenshooter {
 	struct weston_process process;
 	struct wl_listener destroy_listener;
 	struct weston_recorder *recorder;
+	uint32_t keyframe_interval;
 };
 
 static void
@@ -69,7 +70,8 @@ screenshooter_take_shot(struct wl_client *client,
 	struct weston_output *output =
 		weston_head_from_resource(output_resource)->output;
 	struct weston_buffer *buffer =
-		weston_buffer_from_resource(buffer_resource);
+		weston_buffer_from_resource(output->compositor,
+					    buffer_resource);
 
 	if (buffer == NULL) {
 		wl_resource_post_no_memory(resource);
@@ -160,7 +162,13 @@ recorder_binding(struct weston_keyboard *keyboard, const struct timespec *time,
 			output = container_of(ec->output_list.next,
 					      struct weston_output, link);
 
-		shooter->recorder = weston_recorder_start(output, filename);
+		if (shooter->keyframe_interval > 0)
+			shooter->recorder =
+				weston_recorder_start_v2(output, filename,
+							 shooter->keyframe_interval);
+		else
+			shooter->recorder = weston_recorder_start(output,
+								  filename);
 	}
 }
 
@@ -180,6 +188,7 @@ WL_EXPORT void
 screenshooter_create(struct weston_compositor *ec)
 {
 	struct screenshooter *shooter;
+	struct weston_config_section *section;
 
 	shooter = zalloc(sizeof *shooter);
 	if (shooter == NULL)
@@ -187,6 +196,11 @@ screenshooter_create(struct weston_compositor *ec)
 
 	shooter->ec = ec;
 
+	section = weston_config_get_section(wet_get_config(ec), "core",
+					    NULL, NULL);
+	weston_config_section_get_uint(section, "wcap-keyframe-interval",
+				       &shooter->keyframe_interval, 0);
+
 	shooter->global = wl_global_create(ec->wl_display,
 					   &weston_screenshooter_interface, 1,
 					   shooter, bind_shooter);
@@ -44,6 +44,7 @@ struct wet_xwayland {
 	struct wl_client *client;
 	int wm_fd;
 	struct weston_process process;
+	bool warm_standby;
 };
 
 static int
@@ -165,6 +166,27 @@ spawn_xserver(void *user_data, const char *display, int abstract_fd, int unix_fd
 	return pid;
 }
 
+static void
+xwayland_warm_standby(void *data)
+{
+	struct wet_xwayland *wxw = data;
+
+	if (wxw->api->spawn(wxw->xwayland) < 0)
+		weston_log("Failed to start Xwayland in warm standby\n");
+}
+
+/* Start the server once the event loop has nothing else to do, so that it
+ * stays out of the way of whatever is starting up right now. */
+static void
+xwayland_schedule_warm_standby(struct wet_xwayland *wxw)
+{
+	struct wl_event_loop *loop =
+		wl_display_get_event_loop(wxw->compositor->wl_display);
+
+	if (wxw->warm_standby)
+		wl_event_loop_add_idle(loop, xwayland_warm_standby, wxw);
+}
+
 static void
 xserver_cleanup(struct weston_process *process, int status)
 {
@@ -177,6 +199,8 @@ xserver_cleanup(struct weston_process *process, int status)
 	wxw->sigusr1_source = wl_event_loop_add_signal(loop, SIGUSR1,
 	                                               handle_sigusr1, wxw);
 	wxw->client = NULL;
+
+	xwayland_schedule_warm_standby(wxw);
 }
 
 int
@@ -186,6 +210,7 @@ wet_load_xwayland(struct weston_compositor *comp)
 	struct weston_xwayland *xwayland;
 	struct wet_xwayland *wxw;
 	struct wl_event_loop *loop;
+	struct weston_config_section *section;
 
 	if (weston_compositor_load_xwayland(comp) < 0)
 		return -1;
@@ -217,5 +242,11 @@ wet_load_xwayland(struct weston_compositor *comp)
 	wxw->sigusr1_source = wl_event_loop_add_signal(loop, SIGUSR1,
 						       handle_sigusr1, wxw);
 
+	section = weston_config_get_section(wet_get_config(comp),
+					    "xwayland", NULL, NULL);
+	weston_config_section_get_bool(section, "warm-standby",
+				       &wxw->warm_standby, false);
+	xwayland_schedule_warm_standby(wxw);
+
 	return 0;
 }
@@ -48,10 +48,14 @@ struct exposay_surface {
 	int row;
 	int column;
 
-	/* The animations only apply a transformation for their own lifetime,
-	 * and don't have an option to indefinitely maintain the
-	 * transformation in a steady state - so, we apply our own once the
-	 * animation has finished. */
+	/* Offset from the view position to its slot, fixed at layout time
+	 * so that the per-frame update is only a matrix build. */
+	int dx;
+	int dy;
+
+	/* Applied for as long as the surface is part of the exposay; the
+	 * shared animation updates it every frame and leaves it at the
+	 * overview position once it settles. */
 	struct weston_transform transform;
 };
 
@@ -65,6 +69,7 @@ exposay_surface_destroy(struct exposay_surface *esurface)
 {
 	wl_list_remove(&esurface->link);
 	wl_list_remove(&esurface->view_destroy_listener.link);
+	wl_list_remove(&esurface->transform.link);
 
 	if (esurface->shell->exposay.focus_current == esurface->view)
 		esurface->shell->exposay.focus_current = NULL;
@@ -90,64 +95,133 @@ exposay_in_flight_dec(struct desktop_shell *shell)
 }
 
 static void
-exposay_animate_in_done(struct weston_view_animation *animation, void *data)
+exposay_surface_set_progress(struct exposay_surface *esurface,
+			     float progress)
 {
-	struct exposay_surface *esurface = data;
+	float scale = 1.0f + (esurface->scale - 1.0f) * progress;
 
-	wl_list_insert(&esurface->view->geometry.transformation_list,
-	               &esurface->transform.link);
 	weston_matrix_init(&esurface->transform.matrix);
-	weston_matrix_scale(&esurface->transform.matrix,
-	                    esurface->scale, esurface->scale, 1.0f);
+	weston_matrix_scale(&esurface->transform.matrix, scale, scale, 1.0f);
 	weston_matrix_translate(&esurface->transform.matrix,
-	                        esurface->x - esurface->view->geometry.x,
-				esurface->y - esurface->view->geometry.y,
-				0);
-
+				esurface->dx * progress,
+				esurface->dy * progress, 0);
 	weston_view_geometry_dirty(esurface->view);
-	weston_compositor_schedule_repaint(esurface->view->surface->compositor);
-
-	exposay_in_flight_dec(esurface->shell);
 }
 
 static void
-exposay_animate_in(struct exposay_surface *esurface)
+exposay_animation_done(struct desktop_shell *shell)
 {
-	exposay_in_flight_inc(esurface->shell);
+	struct exposay_surface *esurface, *next;
+	struct weston_view *view;
+
+	wl_list_remove(&shell->exposay.anim.animation.link);
+	wl_list_init(&shell->exposay.anim.animation.link);
+	shell->exposay.anim.output = NULL;
+
+	if (shell->exposay.anim.reverse) {
+		wl_list_for_each_safe(esurface, next,
+				      &shell->exposay.surface_list, link) {
+			view = esurface->view;
+			exposay_surface_destroy(esurface);
+			weston_view_geometry_dirty(view);
+		}
+	} else {
+		wl_list_for_each(esurface, &shell->exposay.surface_list, link)
+			exposay_surface_set_progress(esurface, 1.0f);
+	}
+
+	weston_compositor_schedule_repaint(shell->compositor);
 
-	weston_move_scale_run(esurface->view,
-	                      esurface->x - esurface->view->geometry.x,
-	                      esurface->y - esurface->view->geometry.y,
-			      1.0, esurface->scale, 0,
-	                      exposay_animate_in_done, esurface);
+	exposay_in_flight_dec(shell);
 }
 
 static void
-exposay_animate_out_done(struct weston_view_animation *animation, void *data)
+idle_animation_done(void *data)
 {
-	struct exposay_surface *esurface = data;
-	struct desktop_shell *shell = esurface->shell;
+	exposay_animation_done(data);
+}
 
-	exposay_surface_destroy(esurface);
+static void
+exposay_animation_frame(struct weston_animation *animation,
+			struct weston_output *output,
+			const struct timespec *time)
+{
+	struct desktop_shell *shell =
+		container_of(animation, struct desktop_shell,
+			     exposay.anim.animation);
+	struct exposay_surface *esurface;
+	float progress;
 
-	exposay_in_flight_dec(shell);
+	if (animation->frame_counter <= 1)
+		shell->exposay.anim.spring.timestamp = *time;
+
+	weston_spring_update(&shell->exposay.anim.spring, time);
+
+	if (weston_spring_done(&shell->exposay.anim.spring)) {
+		exposay_animation_done(shell);
+		return;
+	}
+
+	progress = shell->exposay.anim.spring.current;
+	if (shell->exposay.anim.reverse)
+		progress = 1.0f - progress;
+
+	wl_list_for_each(esurface, &shell->exposay.surface_list, link)
+		exposay_surface_set_progress(esurface, progress);
+
+	weston_compositor_schedule_repaint(shell->compositor);
 }
 
+/* Start the shared animation towards the overview, or back out of it
+ * when reverse is set. Surfaces must already have their transform
+ * applied. */
 static void
-exposay_animate_out(struct exposay_surface *esurface)
+exposay_animation_start(struct desktop_shell *shell, bool reverse)
 {
-	exposay_in_flight_inc(esurface->shell);
+	struct weston_output *output = NULL;
+	struct shell_output *shell_output;
 
-	/* Remove the static transformation set up by
-	 * exposay_transform_in_done(). */
-	wl_list_remove(&esurface->transform.link);
-	weston_view_geometry_dirty(esurface->view);
+	wl_list_for_each(shell_output, &shell->output_list, link) {
+		if (shell_output->output->enabled) {
+			output = shell_output->output;
+			break;
+		}
+	}
+
+	exposay_in_flight_inc(shell);
+
+	shell->exposay.anim.reverse = reverse;
+	weston_spring_init(&shell->exposay.anim.spring, 400.0, 0.0, 1.0);
+	shell->exposay.anim.spring.friction = 1150;
+
+	/* Nothing will repaint; settle on the next loop iteration, as
+	 * weston_view_animation does for views without an output. */
+	if (!output) {
+		struct wl_event_loop *loop =
+			wl_display_get_event_loop(shell->compositor->wl_display);
+
+		wl_event_loop_add_idle(loop, idle_animation_done, shell);
+		return;
+	}
+
+	wl_list_remove(&shell->exposay.anim.animation.link);
+	wl_list_insert(&output->animation_list,
+		       &shell->exposay.anim.animation.link);
+	shell->exposay.anim.output = output;
+	shell->exposay.anim.animation.frame_counter = 0;
+
+	weston_compositor_schedule_repaint(shell->compositor);
+}
+
+static void
+exposay_animate_in(struct exposay_surface *esurface)
+{
+	esurface->dx = esurface->x - esurface->view->geometry.x;
+	esurface->dy = esurface->y - esurface->view->geometry.y;
 
-	weston_move_scale_run(esurface->view,
-	                      esurface->x - esurface->view->geometry.x,
-	                      esurface->y - esurface->view->geometry.y,
-			      1.0, esurface->scale, 1,
-			      exposay_animate_out_done, esurface);
+	wl_list_insert(&esurface->view->geometry.transformation_list,
+		       &esurface->transform.link);
+	exposay_surface_set_progress(esurface, 0.0f);
 }
 
 static void
@@ -363,12 +437,6 @@ exposay_layout(struct desktop_shell *shell, struct shell_output *shell_output)
 
 		exposay_animate_in(esurface);
 
-		/* We want our destroy handler to be after the animation
-		 * destroy handler in the list, this way when the view is
-		 * destroyed, the animation can safely call the animation
-		 * completion callback before we free the esurface in our
-		 * destroy handler.
-		 */
 		esurface->view_destroy_listener.notify = handle_view_destroy;
 		wl_signal_add(&view->destroy_signal, &esurface->view_destroy_listener);
 
@@ -624,9 +692,8 @@ exposay_transition_inactive(struct desktop_shell *shell, int switch_focus)
 		         shell->exposay.seat,
 			 WESTON_ACTIVATE_FLAG_CONFIGURE);
 
-	wl_list_for_each(esurface, &shell->exposay.surface_list, link)
-		exposay_animate_out(esurface);
-	weston_compositor_schedule_repaint(shell->compositor);
+	if (!wl_list_empty(&shell->exposay.surface_list))
+		exposay_animation_start(shell, true);
 
 	return EXPOSAY_LAYOUT_ANIMATE_TO_INACTIVE;
 }
@@ -667,6 +734,9 @@ exposay_transition_active(struct desktop_shell *shell)
 			animate = true;
 	}
 
+	if (animate)
+		exposay_animation_start(shell, false);
+
 	return animate ? EXPOSAY_LAYOUT_ANIMATE_TO_OVERVIEW
 		       : EXPOSAY_LAYOUT_OVERVIEW;
 }
@@ -735,3 +805,23 @@ exposay_binding(struct weston_keyboard *keyboard, enum weston_keyboard_modifier
 
 	exposay_set_state(shell, EXPOSAY_TARGET_OVERVIEW, keyboard->seat);
 }
+
+void
+exposay_init(struct desktop_shell *shell)
+{
+	shell->exposay.state_cur = EXPOSAY_LAYOUT_INACTIVE;
+	shell->exposay.state_target = EXPOSAY_TARGET_CANCEL;
+	shell->exposay.anim.animation.frame = exposay_animation_frame;
+	wl_list_init(&shell->exposay.anim.animation.link);
+	wl_list_init(&shell->exposay.surface_list);
+}
+
+/* The driving output is going away: settle the animation now rather than
+ * leave it on a list that will never run again. */
+void
+exposay_output_destroy(struct desktop_shell *shell,
+		       struct weston_output *output)
+{
+	if (shell->exposay.anim.output == output)
+		exposay_animation_done(shell);
+}
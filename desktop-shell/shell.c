@@ -124,7 +124,10 @@ struct shell_surface {
 		struct weston_view *black_view;
 	} fullscreen;
 
+	/* Keeps the surface in place while the workspace it was taken to
+	 * slides in, linked in workspaces.anim_sticky_list when in use. */
 	struct weston_transform workspace_transform;
+	struct wl_list workspace_sticky_link;
 
 	struct weston_output *fullscreen_output;
 	struct weston_output *output;
@@ -261,6 +264,7 @@ desktop_shell_destroy_surface(struct shell_surface *shsurf)
 		wl_list_init(&shsurf_child->children_link);
 	}
 	wl_list_remove(&shsurf->children_link);
+	wl_list_remove(&shsurf->workspace_sticky_link);
 
 	wl_signal_emit(&shsurf->destroy_signal, shsurf);
 
@@ -528,15 +532,6 @@ focus_surface_committed(struct weston_surface *es, int32_t sx, int32_t sy)
 {
 }
 
-static struct focus_surface *
-get_focus_surface(struct weston_surface *surface)
-{
-	if (surface->committed == focus_surface_committed)
-		return surface->committed_private;
-	else
-		return NULL;
-}
-
 static bool
 is_focus_surface (struct weston_surface *es)
 {
@@ -591,8 +586,6 @@ create_focus_surface(struct weston_compositor *ec,
 	pixman_region32_fini(&surface->input);
 	pixman_region32_init(&surface->input);
 
-	wl_list_init(&fsurf->workspace_transform.link);
-
 	return fsurf;
 }
 
@@ -967,74 +960,70 @@ get_output_height(struct weston_output *output)
 	return abs(output->region.extents.y1 - output->region.extents.y2);
 }
 
-static struct weston_transform *
-view_get_transform(struct weston_view *view)
+/* Workspaces slide as a whole layer, so they move by the tallest output
+ * to leave every output entirely. */
+static unsigned int
+get_workspace_slide_height(struct desktop_shell *shell)
 {
-	struct focus_surface *fsurf = NULL;
-	struct shell_surface *shsurf = NULL;
-
-	if (is_focus_view(view)) {
-		fsurf = get_focus_surface(view->surface);
-		return &fsurf->workspace_transform;
-	}
+	struct weston_output *output;
+	unsigned int height = 0;
 
-	shsurf = get_shell_surface(view->surface);
-	if (shsurf)
-		return &shsurf->workspace_transform;
+	wl_list_for_each(output, &shell->compositor->output_list, link)
+		height = MAX(height, get_output_height(output));
 
-	return NULL;
+	return height;
 }
 
 static void
-view_translate(struct workspace *ws, struct weston_view *view, double d)
+workspace_translate_out(struct desktop_shell *shell, struct workspace *ws,
+			double fraction)
 {
-	struct weston_transform *transform = view_get_transform(view);
-
-	if (!transform)
-		return;
-
-	if (wl_list_empty(&transform->link))
-		wl_list_insert(view->geometry.transformation_list.prev,
-			       &transform->link);
+	unsigned int height = get_workspace_slide_height(shell);
 
-	weston_matrix_init(&transform->matrix);
-	weston_matrix_translate(&transform->matrix,
-				0.0, d, 0.0);
-	weston_view_geometry_dirty(view);
+	weston_layer_set_offset(&ws->layer, 0, height * fraction);
 }
 
+/* Counter the offset of the workspace a surface was just taken to, so
+ * it stays put while its new workspace slides in around it. */
 static void
-workspace_translate_out(struct workspace *ws, double fraction)
+workspace_update_sticky_surfaces(struct desktop_shell *shell,
+				 struct workspace *ws)
 {
+	struct shell_surface *shsurf;
 	struct weston_view *view;
-	unsigned int height;
-	double d;
 
-	wl_list_for_each(view, &ws->layer.view_list.link, layer_link.link) {
-		height = get_output_height(view->surface->output);
-		d = height * fraction;
+	wl_list_for_each(shsurf, &shell->workspaces.anim_sticky_list,
+			 workspace_sticky_link) {
+		view = shsurf->view;
+		if (view->layer_link.layer != &ws->layer)
+			continue;
+
+		if (wl_list_empty(&shsurf->workspace_transform.link))
+			wl_list_insert(view->geometry.transformation_list.prev,
+				       &shsurf->workspace_transform.link);
 
-		view_translate(ws, view, d);
+		weston_matrix_init(&shsurf->workspace_transform.matrix);
+		weston_matrix_translate(&shsurf->workspace_transform.matrix,
+					-ws->layer.offset.x,
+					-ws->layer.offset.y, 0.0);
+		weston_view_geometry_dirty(view);
 	}
 }
 
 static void
-workspace_translate_in(struct workspace *ws, double fraction)
+workspace_translate_in(struct desktop_shell *shell, struct workspace *ws,
+		       double fraction)
 {
-	struct weston_view *view;
-	unsigned int height;
+	unsigned int height = get_workspace_slide_height(shell);
 	double d;
 
-	wl_list_for_each(view, &ws->layer.view_list.link, layer_link.link) {
-		height = get_output_height(view->surface->output);
-
-		if (fraction > 0)
-			d = -(height - height * fraction);
-		else
-			d = height + height * fraction;
+	if (fraction > 0)
+		d = -(height - height * fraction);
+	else
+		d = height + height * fraction;
 
-		view_translate(ws, view, d);
-	}
+	weston_layer_set_offset(&ws->layer, 0, d);
+	workspace_update_sticky_surfaces(shell, ws);
 }
 
 static void
@@ -1059,19 +1048,23 @@ reverse_workspace_change_animation(struct desktop_shell *shell,
 static void
 workspace_deactivate_transforms(struct workspace *ws)
 {
-	struct weston_view *view;
-	struct weston_transform *transform;
+	weston_layer_set_offset(&ws->layer, 0, 0);
+}
 
-	wl_list_for_each(view, &ws->layer.view_list.link, layer_link.link) {
-		transform = view_get_transform(view);
-		if (!transform)
-			continue;
+static void
+release_sticky_surfaces(struct desktop_shell *shell)
+{
+	struct shell_surface *shsurf, *tmp;
 
-		if (!wl_list_empty(&transform->link)) {
-			wl_list_remove(&transform->link);
-			wl_list_init(&transform->link);
+	wl_list_for_each_safe(shsurf, tmp, &shell->workspaces.anim_sticky_list,
+			      workspace_sticky_link) {
+		if (!wl_list_empty(&shsurf->workspace_transform.link)) {
+			wl_list_remove(&shsurf->workspace_transform.link);
+			wl_list_init(&shsurf->workspace_transform.link);
+			weston_view_geometry_dirty(shsurf->view);
 		}
-		weston_view_geometry_dirty(view);
+		wl_list_remove(&shsurf->workspace_sticky_link);
+		wl_list_init(&shsurf->workspace_sticky_link);
 	}
 }
 
@@ -1094,6 +1087,7 @@ finish_workspace_change_animation(struct desktop_shell *shell,
 	wl_list_remove(&shell->workspaces.animation.link);
 	workspace_deactivate_transforms(from);
 	workspace_deactivate_transforms(to);
+	release_sticky_surfaces(shell);
 	shell->workspaces.anim_to = NULL;
 
 	weston_layer_unset_position(&shell->workspaces.anim_from->layer);
@@ -1141,8 +1135,10 @@ animate_workspace_change_frame(struct weston_animation *animation,
 	if (t < DEFAULT_WORKSPACE_CHANGE_ANIMATION_LENGTH) {
 		weston_compositor_schedule_repaint(shell->compositor);
 
-		workspace_translate_out(from, shell->workspaces.anim_dir * y);
-		workspace_translate_in(to, shell->workspaces.anim_dir * y);
+		workspace_translate_out(shell, from,
+					shell->workspaces.anim_dir * y);
+		workspace_translate_in(shell, to,
+				       shell->workspaces.anim_dir * y);
 		shell->workspaces.anim_current = y;
 
 		weston_compositor_schedule_repaint(shell->compositor);
@@ -1182,7 +1178,7 @@ animate_workspace_change(struct desktop_shell *shell,
 	weston_layer_set_position(&to->layer, WESTON_LAYER_POSITION_NORMAL);
 	weston_layer_set_position(&from->layer, WESTON_LAYER_POSITION_NORMAL - 1);
 
-	workspace_translate_in(to, 0);
+	workspace_translate_in(shell, to, 0);
 
 	restore_focus_state(shell, to);
 
@@ -1334,9 +1330,9 @@ take_surface_to_workspace_by_seat(struct desktop_shell *shell,
 		update_workspace(shell, index, from, to);
 	else {
 		if (shsurf != NULL &&
-		    wl_list_empty(&shsurf->workspace_transform.link))
+		    wl_list_empty(&shsurf->workspace_sticky_link))
 			wl_list_insert(&shell->workspaces.anim_sticky_list,
-				       &shsurf->workspace_transform.link);
+				       &shsurf->workspace_sticky_link);
 
 		animate_workspace_change(shell, index, from, to);
 	}
@@ -2321,6 +2317,7 @@ desktop_surface_added(struct weston_desktop_surface *desktop_surface,
 	weston_matrix_init(&shsurf->rotation.rotation);
 
 	wl_list_init(&shsurf->workspace_transform.link);
+	wl_list_init(&shsurf->workspace_sticky_link);
 
 	/*
 	 * initialize list as well as link. The latter allows to use
@@ -2799,14 +2796,20 @@ end_busy_cursor(struct weston_compositor *compositor,
 }
 
 static void
-desktop_surface_set_unresponsive(struct weston_desktop_surface *desktop_surface,
-				 void *user_data)
+desktop_client_set_unresponsive(struct weston_desktop_client *desktop_client,
+				bool unresponsive)
 {
-	struct shell_surface *shsurf =
-		weston_desktop_surface_get_user_data(desktop_surface);
-	bool *unresponsive = user_data;
+	struct weston_desktop_surface *desktop_surface;
+	struct shell_surface *shsurf;
 
-	shsurf->unresponsive = *unresponsive;
+	for (desktop_surface = weston_desktop_client_get_first_surface(desktop_client);
+	     desktop_surface;
+	     desktop_surface = weston_desktop_client_get_next_surface(desktop_client,
+								      desktop_surface)) {
+		shsurf = weston_desktop_surface_get_user_data(desktop_surface);
+		if (shsurf)
+			shsurf->unresponsive = unresponsive;
+	}
 }
 
 static void
@@ -2816,12 +2819,8 @@ desktop_surface_ping_timeout(struct weston_desktop_client *desktop_client,
 	struct desktop_shell *shell = shell_;
 	struct shell_surface *shsurf;
 	struct weston_seat *seat;
-	bool unresponsive = true;
-
-	weston_desktop_client_for_each_surface(desktop_client,
-					       desktop_surface_set_unresponsive,
-					       &unresponsive);
 
+	desktop_client_set_unresponsive(desktop_client, true);
 
 	wl_list_for_each(seat, &shell->compositor->seat_list, link) {
 		struct weston_pointer *pointer = weston_seat_get_pointer(seat);
@@ -2846,11 +2845,8 @@ desktop_surface_pong(struct weston_desktop_client *desktop_client,
 		     void *shell_)
 {
 	struct desktop_shell *shell = shell_;
-	bool unresponsive = false;
 
-	weston_desktop_client_for_each_surface(desktop_client,
-					       desktop_surface_set_unresponsive,
-					       &unresponsive);
+	desktop_client_set_unresponsive(desktop_client, false);
 	end_busy_cursor(shell->compositor, desktop_client);
 }
 
@@ -2938,10 +2934,17 @@ background_committed(struct weston_surface *es, int32_t sx, int32_t sy)
 {
 	struct desktop_shell *shell = es->committed_private;
 	struct weston_view *view;
+	/* The wallpaper covers the output beneath everything else: it can
+	 * be scanned out when nothing above needs composition, and a full
+	 * output's worth of area must not crowd out windows on overlays. */
+	const struct weston_view_plane_hint hint = {
+		.preference = WESTON_VIEW_PLANE_PREFER_PRIMARY,
+	};
 
 	view = container_of(es->views.next, struct weston_view, surface_link);
 
 	configure_static_view(view, &shell->background_layer, 0, 0);
+	weston_view_set_plane_hint(view, &hint);
 }
 
 static void
@@ -4786,6 +4789,7 @@ shell_output_destroy(struct shell_output *shell_output)
 		wl_list_remove(&shell_output->background_surface_listener.link);
 	wl_list_remove(&shell_output->destroy_listener.link);
 	wl_list_remove(&shell_output->link);
+	exposay_output_destroy(shell, shell_output->output);
 	free(shell_output);
 }
 
@@ -5146,8 +5150,7 @@ wet_shell_init(struct weston_compositor *ec,
 
 	shell_configuration(shell);
 
-	shell->exposay.state_cur = EXPOSAY_LAYOUT_INACTIVE;
-	shell->exposay.state_target = EXPOSAY_TARGET_CANCEL;
+	exposay_init(shell);
 
 	for (i = 0; i < shell->workspaces.num; i++) {
 		pws = wl_array_add(&shell->workspaces.array, sizeof *pws);
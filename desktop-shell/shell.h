@@ -82,6 +82,16 @@ struct exposay {
 	enum exposay_layout_state state_cur;
 	int in_flight; /* number of animations still running */
 
+	/* One animation drives every exposay surface, so a frame costs a
+	 * single spring update and a matrix per view rather than one
+	 * weston_view_animation per window. */
+	struct {
+		struct weston_animation animation;
+		struct weston_spring spring;
+		struct weston_output *output;
+		bool reverse;
+	} anim;
+
 	int row_current;
 	int column_current;
 	struct exposay_output *cur_output;
@@ -93,7 +103,6 @@ struct exposay {
 struct focus_surface {
 	struct weston_surface *surface;
 	struct weston_view *view;
-	struct weston_transform workspace_transform;
 };
 
 struct workspace {
@@ -250,6 +259,11 @@ void
 exposay_binding(struct weston_keyboard *keyboard,
 		enum weston_keyboard_modifier modifier,
 		void *data);
+void
+exposay_init(struct desktop_shell *shell);
+void
+exposay_output_destroy(struct desktop_shell *shell,
+		       struct weston_output *output);
 int
 input_panel_setup(struct desktop_shell *shell);
 void
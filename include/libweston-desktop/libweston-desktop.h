@@ -130,6 +130,11 @@ void
 weston_desktop_client_for_each_surface(struct weston_desktop_client *client,
 				       void (*callback)(struct weston_desktop_surface *surface, void *user_data),
 				       void *user_data);
+struct weston_desktop_surface *
+weston_desktop_client_get_first_surface(struct weston_desktop_client *client);
+struct weston_desktop_surface *
+weston_desktop_client_get_next_surface(struct weston_desktop_client *client,
+				       struct weston_desktop_surface *surface);
 int
 weston_desktop_client_ping(struct weston_desktop_client *client);
 
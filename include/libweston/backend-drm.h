@@ -35,7 +35,7 @@
 extern "C" {
 #endif
 
-#define WESTON_DRM_BACKEND_CONFIG_VERSION 4
+#define WESTON_DRM_BACKEND_CONFIG_VERSION 8
 
 struct libinput_device;
 
@@ -78,6 +78,29 @@ struct weston_drm_output_api {
 	 */
 	void (*set_seat)(struct weston_output *output,
 			 const char *seat);
+
+	/** Allow variable refresh rate on the output. It is only used when
+	 *  every head reports the "vrr_capable" connector property, and only
+	 *  while a single opaque view covers the whole output.
+	 */
+	void (*set_vrr)(struct weston_output *output, bool enable);
+
+	/** Lower the refresh rate of an output after it did not repaint for
+	 *  timeout_msec milliseconds, through VRR if the display supports
+	 *  it, or else a lower refresh mode of the same size. The full rate
+	 *  is restored on the next repaint. 0 disables this.
+	 */
+	void (*set_idle_refresh)(struct weston_output *output,
+				 uint32_t timeout_msec);
+
+	/** Show the framebuffer of the output called name, scaled by the
+	 *  display controller if the modes differ, instead of compositing
+	 *  this output: the scene is rendered once for both. A mirror has
+	 *  no place in the layout and is not advertised to clients. NULL
+	 *  makes it a regular output again.
+	 */
+	void (*set_mirror_of)(struct weston_output *output,
+			      const char *name);
 };
 
 static inline const struct weston_drm_output_api *
@@ -93,6 +116,7 @@ weston_drm_output_get_api(struct weston_compositor *compositor)
 #define WESTON_DRM_VIRTUAL_OUTPUT_API_NAME "weston_drm_virtual_output_api_v1"
 
 struct drm_fb;
+struct weston_drm_virtual_buffer;
 typedef int (*submit_frame_cb)(struct weston_output *output, int fd,
 			       int stride, struct drm_fb *buffer);
 
@@ -151,6 +175,59 @@ struct weston_drm_virtual_output_api {
 	void (*finish_frame)(struct weston_output *output,
 			     struct timespec *stamp,
 			     uint32_t presented_flags);
+
+	/** Allocate a buffer the virtual output can render into.
+	 * The buffer is a linear dmabuf of the current mode size in the
+	 * output's GBM format. The output must be enabled.
+	 *
+	 * On success, fd is a new dmabuf fd owned by the caller, and stride,
+	 * offset and modifier describe its single plane.
+	 *
+	 * Returns the buffer on success, NULL on failure.
+	 */
+	struct weston_drm_virtual_buffer *
+	(*create_buffer)(struct weston_output *output, int *fd,
+			 uint32_t *stride, uint32_t *offset,
+			 uint64_t *modifier);
+
+	/** Destroy a buffer from create_buffer(). */
+	void (*destroy_buffer)(struct weston_drm_virtual_buffer *buffer);
+
+	/** Render the following frames into buffer instead of the output's
+	 * GBM surface, or back into the GBM surface if buffer is NULL.
+	 * Frames are still delivered through the submit_frame_cb, with the
+	 * buffer's drm_fb.
+	 *
+	 * Returns 0 on success, -1 on failure.
+	 */
+	int (*set_render_buffer)(struct weston_output *output,
+				 struct weston_drm_virtual_buffer *buffer);
+
+	/** Render into a queue of depth buffers owned by the backend
+	 * instead of the output's GBM surface.
+	 *
+	 * Each frame goes into the least recently submitted buffer that has
+	 * been released with buffer_released(), and only the damage since
+	 * that buffer was last drawn is repainted. When the owner still
+	 * holds all of them, the frame is dropped. A depth of 0 goes back
+	 * to the GBM surface. The queue overrides set_render_buffer().
+	 *
+	 * If the output is disabled, the queue is allocated on enable.
+	 *
+	 * Returns 0 on success, -1 on failure.
+	 */
+	int (*set_buffer_queue_depth)(struct weston_output *output,
+				      unsigned int depth);
+
+	/** Fill the frames with what the DRM output called name shows
+	 * instead of compositing them, through a GPU blit scaled to this
+	 * output's mode. A new frame follows each repaint of that output
+	 * which changed its framebuffer. Frames go into the buffer queue,
+	 * or else the buffer set with set_render_buffer(); without either,
+	 * they are dropped. NULL goes back to compositing. Must be called
+	 * before the output is enabled.
+	 */
+	void (*set_mirror_of)(struct weston_output *output, const char *name);
 };
 
 static inline const struct weston_drm_virtual_output_api *
@@ -163,6 +240,49 @@ weston_drm_virtual_output_get_api(struct weston_compositor *compositor)
 	return (const struct weston_drm_virtual_output_api *)api;
 }
 
+#define WESTON_DRM_OUTPUT_CAPTURE_API_NAME "weston_drm_output_capture_api_v1"
+
+/** Called when a writeback capture has completed or failed.
+ *
+ * On success, fd is a new linear dmabuf fd owned by the callee holding
+ * one frame as composed by the display controller, planes included,
+ * with the given DRM format, size and stride in bytes. On failure, fd
+ * is -1.
+ */
+typedef void (*weston_drm_capture_done_func_t)(struct weston_output *output,
+					       int fd, uint32_t format,
+					       int width, int height,
+					       int stride, void *data);
+
+struct weston_drm_output_capture_api {
+	/** Whether the output's CRTC can be routed to a free writeback
+	 *  connector. Requires atomic modesetting.
+	 */
+	bool (*is_supported)(struct weston_output *output);
+
+	/** Capture the next frame the output scans out.
+	 *
+	 * The capture happens in the display controller, without any
+	 * renderer pass or CPU copy, and schedules a repaint so that the
+	 * frame comes even if nothing is damaged. Only one capture per output
+	 * can be in flight; done is called exactly once on success.
+	 *
+	 * Returns 0 on success, -1 on failure.
+	 */
+	int (*capture)(struct weston_output *output,
+		       weston_drm_capture_done_func_t done, void *data);
+};
+
+static inline const struct weston_drm_output_capture_api *
+weston_drm_output_capture_get_api(struct weston_compositor *compositor)
+{
+	const void *api;
+	api = weston_plugin_api_get(compositor,
+				    WESTON_DRM_OUTPUT_CAPTURE_API_NAME,
+				    sizeof(struct weston_drm_output_capture_api));
+	return (const struct weston_drm_output_capture_api *)api;
+}
+
 /** The backend configuration struct.
  *
  * weston_drm_backend_config contains the configuration used by a DRM
@@ -223,6 +343,65 @@ struct weston_drm_backend_config {
 
 	/** Use shadow buffer if using Pixman-renderer. */
 	bool use_pixman_shadow;
+
+	/** Separate DRM device to render on
+	 *
+	 * A DRM device node name, like "renderD128", or an absolute path.
+	 * If set, the GL renderer runs on this device and every frame is
+	 * imported as a dmabuf on the KMS device for scanout. If NULL, the
+	 * KMS device also renders. Ignored with the Pixman renderer.
+	 */
+	char *render_device;
+
+	/** Move the cursor plane into an already queued frame
+	 *
+	 * If true, pointer motion arriving while a page flip is pending moves
+	 * the KMS cursor immediately through the legacy cursor ioctl instead
+	 * of waiting for the next repaint. This requires a driver which
+	 * applies cursor-only updates asynchronously; others may block the
+	 * compositor until the pending flip completes.
+	 */
+	bool cursor_late_latch;
+
+	/** Threads compositing each output if using Pixman-renderer
+	 *
+	 * The damaged area is split into this many horizontal bands which
+	 * are painted in parallel. 0 or 1 keeps painting on the compositor
+	 * thread only.
+	 */
+	uint32_t pixman_repaint_threads;
+
+	/** Where the VA-API recorder writes its H.264 stream
+	 *
+	 * A file name, or "unix:" followed by the path of a listening
+	 * stream socket. If NULL, "capture.h264" is used. The backend makes
+	 * its own copy.
+	 */
+	char *recorder_output;
+
+	/** Frames the VA-API recorder queues for its encoder
+	 *
+	 * Frames arriving while this many are still waiting are dropped.
+	 * 0 picks the default of 4.
+	 */
+	uint32_t recorder_queue_depth;
+
+	/** Make non-blocking atomic commits from a separate thread
+	 *
+	 * Keeps the compositor responsive with drivers which block in
+	 * DRM_MODE_ATOMIC_NONBLOCK commits, e.g. on fences. Commits needing
+	 * a modeset or an out-fence are still made from the main loop.
+	 * Ignored without atomic modesetting.
+	 */
+	bool commit_thread;
+
+	/** Recover from page flip timeouts instead of exiting
+	 *
+	 * When pageflip_timeout expires, the flip is given up on and the
+	 * whole KMS state is programmed again on the next repaint. The
+	 * compositor still exits after a few timeouts in a row.
+	 */
+	bool pageflip_timeout_recovery;
 };
 
 #ifdef  __cplusplus
@@ -34,7 +34,7 @@ extern "C" {
 
 #include <libweston/libweston.h>
 
-#define WESTON_HEADLESS_BACKEND_CONFIG_VERSION 2
+#define WESTON_HEADLESS_BACKEND_CONFIG_VERSION 3
 
 struct weston_headless_backend_config {
 	struct weston_backend_config base;
@@ -44,6 +44,14 @@ struct weston_headless_backend_config {
 
 	/** Whether to use the GL renderer, conflicts with use_pixman */
 	bool use_gl;
+
+	/** Synthetic vblank rate of the outputs in mHz, 0 for 60 Hz */
+	uint32_t refresh;
+
+	/** Repaint the whole output every frame and log frame timing on
+	 * exit. Without a refresh, frames complete as soon as they are
+	 * painted, so repaints run flat out. */
+	bool benchmark;
 };
 
 #ifdef  __cplusplus
@@ -54,7 +54,7 @@ weston_rdp_output_get_api(struct weston_compositor *compositor)
 	return (const struct weston_rdp_output_api *)api;
 }
 
-#define WESTON_RDP_BACKEND_CONFIG_VERSION 2
+#define WESTON_RDP_BACKEND_CONFIG_VERSION 3
 
 struct weston_rdp_backend_config {
 	struct weston_backend_config base;
@@ -66,6 +66,7 @@ struct weston_rdp_backend_config {
 	int env_socket;
 	int no_clients_resize;
 	int force_no_compression;
+	bool use_gl;
 };
 
 #ifdef  __cplusplus
@@ -34,7 +34,7 @@ extern "C" {
 
 #include <stdint.h>
 
-#define WESTON_WAYLAND_BACKEND_CONFIG_VERSION 2
+#define WESTON_WAYLAND_BACKEND_CONFIG_VERSION 3
 
 struct weston_wayland_backend_config {
 	struct weston_backend_config base;
@@ -44,6 +44,15 @@ struct weston_wayland_backend_config {
 	bool fullscreen;
 	char *cursor_theme;
 	int cursor_size;
+
+	/** Hand a fullscreen client's dmabuf to the parent compositor
+	 *
+	 * When the topmost view covers an output exactly with a dmabuf the
+	 * parent can import, it is shown on a subsurface of the output
+	 * window instead of being composited. Needs wl_subcompositor and
+	 * zwp_linux_dmabuf_v1 version 3 from the parent.
+	 */
+	bool passthrough;
 };
 
 #ifdef  __cplusplus
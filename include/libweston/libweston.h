@@ -34,6 +34,7 @@ extern "C" {
 
 #include <stdbool.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <time.h>
 #include <pixman.h>
 #include <xkbcommon/xkbcommon.h>
@@ -117,6 +118,14 @@ enum weston_surface_protection_mode {
 	WESTON_SURFACE_PROTECTION_MODE_ENFORCED
 };
 
+/** What a surface shows, as hinted by its client */
+enum weston_surface_content_type {
+	WESTON_SURFACE_CONTENT_TYPE_NONE,
+	WESTON_SURFACE_CONTENT_TYPE_PHOTO,
+	WESTON_SURFACE_CONTENT_TYPE_VIDEO,
+	WESTON_SURFACE_CONTENT_TYPE_GAME,
+};
+
 struct weston_mode {
 	uint32_t flags;
 	enum weston_mode_aspect_ratio aspect_ratio;
@@ -133,6 +142,20 @@ struct weston_animation {
 	struct wl_list link;
 };
 
+/** View animations of one output, stepped together
+ *
+ * Holds a dense array of weston_view_animation pointers and a single
+ * weston_animation on the output's animation_list, so a frame costs one
+ * pass over the array and one repaint request per affected output
+ * rather than one hook and one repaint request per animation.
+ */
+struct weston_animation_timeline {
+	struct weston_animation animation;
+	struct wl_array entries; /* struct weston_view_animation * */
+	bool stepping;
+	bool has_holes;
+};
+
 enum {
 	WESTON_SPRING_OVERSHOOT,
 	WESTON_SPRING_CLAMP,
@@ -163,6 +186,17 @@ struct weston_output_zoom {
 	struct weston_animation animation_z;
 	struct weston_spring spring_z;
 	struct wl_listener motion_listener;
+
+	/* Set by the backend if its scanout plane can magnify the frame. */
+	bool scanout_capable;
+	/* While zoomed through the scanout plane, output->matrix leaves
+	 * the zoom out, the renderer draws the frame at native scale and
+	 * area is the part of it to show, in output-local coordinates.
+	 * Panning and zooming then only move the plane source rectangle. */
+	bool scanout;
+	struct {
+		float x, y, width, height;
+	} area;
 };
 
 /* bit compatible with drm definitions. */
@@ -263,6 +297,10 @@ struct weston_head {
 	enum weston_hdcp_protection current_protection;
 };
 
+/** Number of repaint durations kept per output for the adaptive repaint
+ * window, see weston_compositor::repaint_window_adaptive */
+#define WESTON_REPAINT_TIME_SAMPLES 64
+
 /** Content producer for heads
  *
  * \rst
@@ -291,6 +329,7 @@ struct weston_output {
 	struct weston_matrix inverse_matrix;
 
 	struct wl_list animation_list;
+	struct weston_animation_timeline view_timeline;
 	int32_t x, y, width, height;
 
 	/** List of paint nodes in z-order, from top to bottom, maybe pruned
@@ -299,6 +338,40 @@ struct weston_output {
 	 */
 	struct wl_list paint_node_z_order_list;
 
+	/** The topmost view if it opaquely covers the whole output, else NULL
+	 *
+	 * Found at the start of every repaint and only valid until its end.
+	 * Nothing below this view can show, so the damage and plane passes
+	 * stop looking further down the z-order list.
+	 */
+	struct weston_view *fullscreen_view;
+
+	/** Recent repaint durations, for the adaptive repaint window
+	 *
+	 * Each sample runs from the start of weston_output_repaint() to the
+	 * end of CPU work or, when the renderer reports it, the end of GPU
+	 * rendering, whichever is later.
+	 */
+	struct {
+		struct timespec start;		/* CLOCK_MONOTONIC */
+		int64_t nsec[WESTON_REPAINT_TIME_SAMPLES];
+		unsigned int count;
+		unsigned int next;
+		/* The renderer may still extend the latest sample. */
+		bool last_pending;
+		int32_t window_msec;
+	} repaint_time;
+
+	/** Frame timing histograms, see the 'frame-stats' debug scope */
+	struct weston_output_frame_stats *frame_stats;
+
+	/** Scratch memory of the current repaint, see frame-arena.h */
+	struct weston_frame_arena *frame_arena;
+
+	/** True if paint_node_z_order_list must be rebuilt from
+	 * weston_compositor::view_list before the next repaint. */
+	bool paint_node_z_order_dirty;
+
 	/** Output area in global coordinates, simple rect */
 	pixman_region32_t region;
 
@@ -321,6 +394,12 @@ struct weston_output {
 	 *  next repaint should be run */
 	struct timespec next_repaint;
 
+	/** Set by the backend for outputs nobody watches the vblank of, such
+	 *  as streaming outputs: when due together with other outputs, they
+	 *  are repainted in a cycle of their own once the others have been
+	 *  flushed, so that their rendering cannot delay the others. */
+	bool repaint_background;
+
 	/** For cancelling the idle_repaint callback on output destruction. */
 	struct wl_event_source *idle_repaint_source;
 
@@ -331,8 +410,16 @@ struct weston_output {
 	int move_x, move_y;
 	struct timespec frame_time; /* presentation timestamp */
 	uint64_t msc;        /* media stream counter */
+	/* Set by the backend while the display runs at a variable refresh
+	 * rate: a repaint starting after an idle period is then not
+	 * delayed to the fixed vblank grid. */
+	bool vrr_enabled;
 	int disable_planes;
 	int destroying;
+	/* Set by the backend's enable hook when the output shows another
+	 * output's framebuffer: it is never composited, takes no part in
+	 * the layout and is not advertised to clients. */
+	bool mirror;
 	struct wl_list feedback_list;
 
 	uint32_t transform;
@@ -643,7 +730,8 @@ struct weston_touch {
 
 	struct wl_list device_list;	/* struct weston_touch_device::link */
 
-	struct wl_list resource_list;
+	/* Resources not in focus, grouped by client */
+	struct wl_list resource_clients; /* weston_input_resource_client::link */
 	struct wl_list focus_resource_list;
 	struct weston_view *focus;
 	struct wl_listener focus_view_listener;
@@ -764,6 +852,7 @@ struct weston_xkb_info {
 	struct xkb_keymap *keymap;
 	struct ro_anonymous_file *keymap_rofile;
 	int32_t ref_count;
+	struct wl_list link; /* weston_compositor::xkb_info_list */
 	xkb_mod_index_t shift_mod;
 	xkb_mod_index_t caps_mod;
 	xkb_mod_index_t ctrl_mod;
@@ -780,7 +869,8 @@ struct weston_xkb_info {
 struct weston_keyboard {
 	struct weston_seat *seat;
 
-	struct wl_list resource_list;
+	/* Resources not in focus, grouped by client */
+	struct wl_list resource_clients; /* weston_input_resource_client::link */
 	struct wl_list focus_resource_list;
 	struct weston_surface *focus;
 	struct wl_listener focus_resource_listener;
@@ -925,26 +1015,91 @@ struct weston_layer {
 	enum weston_layer_position position;
 	pixman_box32_t mask;
 	struct weston_layer_entry view_list;
+
+	/* Translation applied on top of every view's own transform, in
+	 * global coordinates; see weston_layer_set_offset() */
+	struct {
+		float x, y;
+	} offset;
 };
 
 struct weston_plane {
 	struct weston_compositor *compositor;
 	pixman_region32_t damage; /**< in global coords */
-	pixman_region32_t clip;
+	pixman_region32_t clip; /**< opaque area of the planes above, global */
 	int32_t x, y;
 	struct wl_list link;
 };
 
 struct weston_drm_format_array;
 
+/** Completion of weston_renderer::read_pixels_async
+ *
+ * \param pixels The pixels, in rows of width * bpp bytes, or NULL if the
+ * read-back failed or was cancelled. Only valid during the call.
+ */
+typedef void (*weston_renderer_read_pixels_done_func_t)(void *data,
+							 const void *pixels);
+
+/** Completion of weston_surface_copy_content_async()
+ *
+ * \param pixels The copied area as weston_surface_copy_content() would
+ * have written it, or NULL if the copy failed or the surface went away
+ * first. Only valid during the call.
+ */
+typedef void (*weston_surface_copy_content_done_func_t)(void *data,
+							 const void *pixels);
+
+/** Completion of weston_renderer::import_dmabuf_async
+ *
+ * \param success Whether the buffer was imported, as import_dmabuf()
+ * would have returned. False also if the renderer went away first.
+ */
+typedef void (*weston_renderer_import_dmabuf_done_func_t)(
+					struct linux_dmabuf_buffer *buffer,
+					bool success, void *data);
+
+/** What weston_compositor_trim_memory() released
+ *
+ * Sizes are known for the copies libweston makes itself, everything else
+ * is counted in objects. Listeners of memory_pressure_signal add what
+ * they release.
+ */
+struct weston_memory_trim {
+	size_t texture_bytes;		/**< renderer copies of wl_shm buffers */
+	size_t heap_bytes;		/**< recycled objects and log buffers */
+	unsigned int programs;		/**< shader programs */
+	unsigned int dmabuf_imports;	/**< cached renderer and KMS imports */
+	unsigned int kms_objects;	/**< cached mode blobs and EDIDs */
+};
+
 struct weston_renderer {
 	int (*read_pixels)(struct weston_output *output,
 			       pixman_format_code_t format, void *pixels,
 			       uint32_t x, uint32_t y,
 			       uint32_t width, uint32_t height);
+
+	/** Start a read-back that does not wait for the GPU. Optional.
+	 *
+	 * Returns -1 if it could not be started, in which case done is
+	 * never called. Otherwise done is called exactly once, also with
+	 * NULL pixels if the output goes away first.
+	 */
+	int (*read_pixels_async)(struct weston_output *output,
+				 pixman_format_code_t format,
+				 uint32_t x, uint32_t y,
+				 uint32_t width, uint32_t height,
+				 weston_renderer_read_pixels_done_func_t done,
+				 void *data);
 	void (*repaint_output)(struct weston_output *output,
 			       pixman_region32_t *output_damage);
-	void (*flush_damage)(struct weston_surface *surface);
+	/** Copy the damaged contents of a SHM buffer
+	 *
+	 * Returns true if the renderer holds its own copy of the contents
+	 * afterwards and will not read the buffer again, so that it may go
+	 * back to the client before the next attach.
+	 */
+	bool (*flush_damage)(struct weston_surface *surface);
 	void (*attach)(struct weston_surface *es, struct weston_buffer *buffer);
 	void (*surface_set_color)(struct weston_surface *surface,
 			       float red, float green,
@@ -962,12 +1117,44 @@ struct weston_renderer {
 				    int src_x, int src_y,
 				    int width, int height);
 
+	/** See weston_surface_copy_content_async(). Optional.
+	 *
+	 * Returns -1 if the copy could not be started, in which case done
+	 * is never called.
+	 */
+	int (*surface_copy_content_async)(struct weston_surface *surface,
+					  int src_x, int src_y,
+					  int width, int height,
+					  weston_surface_copy_content_done_func_t done,
+					  void *data);
+
 	/** See weston_compositor_import_dmabuf() */
 	bool (*import_dmabuf)(struct weston_compositor *ec,
 			      struct linux_dmabuf_buffer *buffer);
 
 	const struct weston_drm_format_array *
 			(*get_supported_formats)(struct weston_compositor *ec);
+
+	/** Copy the current output contents into a dmabuf on the GPU.
+	 * Optional, see weston_screenshooter_shoot(). */
+	int (*blit_to_dmabuf)(struct weston_output *output,
+			      struct linux_dmabuf_buffer *dmabuf);
+
+	/** Import a dmabuf without blocking the main loop. Optional.
+	 *
+	 * Returns false if the import could not be started, in which case
+	 * done is never called and import_dmabuf() is to be used instead.
+	 * Otherwise done is called exactly once, from the main loop.
+	 */
+	bool (*import_dmabuf_async)(struct weston_compositor *ec,
+				    struct linux_dmabuf_buffer *buffer,
+				    weston_renderer_import_dmabuf_done_func_t done,
+				    void *data);
+
+	/** Release what can be recreated on demand, adding it to trim.
+	 * Optional, see weston_compositor_trim_memory(). */
+	void (*trim_memory)(struct weston_compositor *ec,
+			    struct weston_memory_trim *trim);
 };
 
 enum weston_capability {
@@ -1104,6 +1291,25 @@ struct weston_compositor {
 	struct wl_list seat_list;
 	struct wl_list layer_list;	/* struct weston_layer::link */
 	struct wl_list view_list;	/* struct weston_view::link */
+	/* True if the layer or sub-surface stacking has changed since
+	 * view_list was last built. */
+	bool view_list_needs_rebuild;
+	/* struct weston_view *, the views marked dirty since the last
+	 * weston_compositor_build_view_list(), in marking order; NULL for
+	 * views destroyed since */
+	struct wl_array transform_dirty_views;
+
+	/* Uniform grid over the output area that buckets view_list by
+	 * transform.boundingbox for weston_compositor_pick_view(). Rebuilt
+	 * lazily when dirty. */
+	struct {
+		bool dirty;
+		pixman_box32_t extents;
+		int cols, rows;
+		uint32_t *cell_start;		/* cols * rows + 1 entries */
+		struct weston_view **views;	/* per cell, in view_list order */
+	} pick_grid;
+
 	struct wl_list plane_list;
 	struct wl_list key_binding_list;
 	struct wl_list modifier_binding_list;
@@ -1117,6 +1323,7 @@ struct weston_compositor {
 	uint32_t idle_inhibit;
 	int idle_time;			/* timeout, s */
 	struct wl_event_source *repaint_timer;
+	struct wl_event_source *repaint_background_idle;
 
 	const struct weston_pointer_grab_interface *default_pointer_grab;
 
@@ -1141,6 +1348,8 @@ struct weston_compositor {
 	struct xkb_rule_names xkb_names;
 	struct xkb_context *xkb_context;
 	struct weston_xkb_info *xkb_info;
+	struct wl_list xkb_info_list; /* weston_xkb_info::link */
+	struct wl_list xkb_keymap_cache; /* weston_xkb_keymap_entry::link */
 
 	int32_t kb_repeat_rate;
 	int32_t kb_repeat_delay;
@@ -1149,8 +1358,38 @@ struct weston_compositor {
 
 	clockid_t presentation_clock;
 	int32_t repaint_msec;
+	/* If true, each output's repaint window is the given percentile
+	 * of its recent repaint times, with repaint_msec as the maximum. */
+	bool repaint_window_adaptive;
+	int32_t repaint_window_percentile;
 	struct timespec last_repaint_start;
 
+	/* Frame callbacks of fully occluded surfaces: 0 sends them with
+	 * every repaint as usual, a positive value at most once per that
+	 * many milliseconds, a negative value not until visible again. */
+	int32_t occluded_frame_interval_msec;
+	struct wl_list frame_throttle_list; /* weston_surface::frame_throttle_link */
+	struct wl_event_source *frame_throttle_timer;
+
+	/* Renderer textures of wl_shm surfaces that were not drawn for
+	 * this many output repaints may be released while the renderer
+	 * holds more than texture_budget_mib of them; 0 disables it. */
+	uint32_t texture_evict_frames;
+	uint32_t texture_budget_mib;
+	/* Renderer memory a single client may use before it gets
+	 * disconnected; 0 means unlimited. */
+	uint32_t client_memory_budget_mib;
+	/* The GL renderer draws damage boxes as their bounding box while
+	 * that covers at most this many more pixels per box saved. */
+	uint32_t damage_merge_pixels;
+	/* Hash the damaged pixels of each new wl_shm buffer and drop the
+	 * damage of commits which did not change any of them. */
+	bool shm_content_hash;
+
+	/* weston_commit_timing_v1 */
+	struct wl_list commit_queue_list; /* weston_surface::commit_queue_link */
+	struct wl_event_source *commit_timing_timer;
+
 	unsigned int activate_serial;
 
 	struct wl_global *pointer_constraints;
@@ -1163,6 +1402,21 @@ struct weston_compositor {
 	/* Whether to let the compositor run without any input device. */
 	bool require_input;
 
+	/* Coalesce relative pointer motion and touch motion coming from
+	 * libinput devices. Held back events are delivered at the end of
+	 * each libinput dispatch, or at most input_coalesce_msec later if
+	 * that is non-zero, and before any other input event. */
+	bool input_coalesce;
+	uint32_t input_coalesce_msec;
+
+	/* Read libinput devices on a dedicated thread, so that a busy main
+	 * loop does not delay draining the kernel event buffers. */
+	bool input_thread;
+
+	/* Open and probe libinput devices only after the backend has shown
+	 * its first frame, instead of before it. */
+	bool input_deferred_enumeration;
+
 	/* Test suite data */
 	struct weston_testsuite_data test_data;
 
@@ -1182,6 +1436,50 @@ struct weston_compositor {
 	struct weston_log_context *weston_log_ctx;
 	struct weston_log_scope *debug_scene;
 	struct weston_log_scope *timeline;
+	struct weston_log_scope *timeline_binary;
+	struct weston_log_scope *frame_stats;
+	/* struct weston_frame_stats_client::link */
+	struct wl_list frame_stats_client_list;
+
+	/* Focused clients flushed ahead of the others at the end of a
+	 * dispatch cycle, see weston_compositor_schedule_flush() */
+	struct wl_event_source *flush_idle_source;
+	struct weston_log_scope *client_flush_scope;
+	struct {
+		uint64_t cycles;
+		uint64_t focused_flushes;
+		uint64_t frame_callbacks;
+		uint32_t max_frame_callbacks;
+	} flush_stats;
+
+	/* Recyclers for the objects which come and go with popups and
+	 * tooltips, see object-pool.h */
+	struct weston_object_pool *surface_pool;
+	struct weston_object_pool *view_pool;
+	struct weston_object_pool *paint_node_pool;
+	struct weston_object_pool *buffer_pool;
+	struct weston_log_scope *object_pool_scope;
+
+	/* /dev/udmabuf while wl_shm buffers are imported as dmabufs, -1
+	 * otherwise, see shm-udmabuf.c */
+	int udmabuf_fd;
+
+	/* PSI trigger on /proc/pressure/memory, see memory-pressure.c */
+	struct weston_memory_pressure *memory_pressure;
+	struct wl_signal memory_pressure_signal; /* arg: weston_memory_trim */
+
+	/* see weston_compositor_write_metrics() */
+	struct wl_signal metrics_signal; /* arg: struct weston_metrics */
+
+	/* Event loops dispatched ahead of the display's, see event-loop.c */
+	struct weston_priority_loops *priority_loops;
+	bool running;
+
+	/* Request counters and budget per client, see client-budget.c */
+	struct weston_client_budget *client_budget;
+
+	/* Main loop stall detection, see watchdog.c */
+	struct weston_watchdog *watchdog;
 
 	struct content_protection *content_protection;
 };
@@ -1199,11 +1497,19 @@ struct weston_buffer {
 	uint32_t busy_count;
 	int y_inverted;
 	void *backend_private;
+
+	/* wl_shm buffer wrapped as a dmabuf, see shm-udmabuf.c */
+	struct linux_dmabuf_buffer *udmabuf;
+	bool udmabuf_failed;
 };
 
 struct weston_buffer_reference {
 	struct weston_buffer *buffer;
 	struct wl_listener destroy_listener;
+	/* The buffer contents have been copied out and the client was sent
+	 * wl_buffer.release, while the pointer is kept for the surface's
+	 * size and state. Does not count towards busy_count. */
+	bool released_early;
 };
 
 struct weston_buffer_viewport {
@@ -1285,6 +1591,30 @@ struct weston_region {
  *    Mparent * Mn * ... * M2 * M1
  */
 
+/** How a shell would like a view to be composited
+ *
+ * Backends with hardware planes use these in preference to their own
+ * heuristics; others ignore them.
+ */
+enum weston_view_plane_preference {
+	/** Let the backend decide. */
+	WESTON_VIEW_PLANE_PREFER_NONE = 0,
+	/** Worth a hardware plane before any other view, e.g. video. */
+	WESTON_VIEW_PLANE_PREFER_OVERLAY,
+	/** Always composite with the renderer. */
+	WESTON_VIEW_PLANE_PREFER_RENDERER,
+	/** Only worth the primary plane, beneath everything else, e.g. a
+	 * wallpaper; it does not compete for overlay planes. */
+	WESTON_VIEW_PLANE_PREFER_PRIMARY,
+};
+
+struct weston_view_plane_hint {
+	enum weston_view_plane_preference preference;
+	/** Only accept a plane that can be stacked at exactly zpos. */
+	bool fixed_zpos;
+	uint64_t zpos;
+};
+
 struct weston_view {
 	struct weston_surface *surface;
 	struct wl_list surface_link;
@@ -1331,6 +1661,9 @@ struct weston_view {
 	 */
 	struct {
 		int dirty;
+		/* 1 + index in weston_compositor::transform_dirty_views,
+		 * or 0 if not queued there */
+		size_t dirty_slot;
 
 		/* Approximations in global coordinates:
 		 * - boundingbox is guaranteed to include the whole view in
@@ -1368,6 +1701,9 @@ struct weston_view {
 	/* Per-surface Presentation feedback flags, controlled by backend. */
 	uint32_t psf_flags;
 
+	/* managed by weston_view_set_plane_hint() */
+	struct weston_view_plane_hint plane_hint;
+
 	bool is_mapped;
 };
 
@@ -1390,6 +1726,11 @@ struct weston_surface_state {
 	/* wl_surface.set_input_region */
 	pixman_region32_t input;
 
+	/* Bumped for every request setting the region, so that unchanged
+	 * regions are neither copied into caches nor applied again. */
+	uint32_t opaque_serial;
+	uint32_t input_serial;
+
 	/* wl_surface.frame */
 	struct wl_list frame_callback_list;
 
@@ -1413,6 +1754,19 @@ struct weston_surface_state {
 
 	/* weston_protected_surface.enforced/relaxed */
 	enum weston_surface_protection_mode protection_mode;
+
+	/* weston_tearing_control_v1.set_presentation_hint */
+	bool async_present;
+
+	/* weston_content_type_v1.set_content_type */
+	enum weston_surface_content_type content_type;
+
+	/* weston_commit_timer_v1.set_timestamp */
+	/* weston_commit_timer_v1.set_target_msc */
+	bool has_target;
+	bool target_is_msc;
+	struct timespec target_time;
+	uint64_t target_msc;
 };
 
 struct weston_surface_activation_data {
@@ -1470,6 +1824,12 @@ struct weston_surface {
 
 	void *renderer_state;
 
+	/** Commit-to-present accounting, see the 'frame-stats' scope */
+	struct weston_surface_frame_stats *frame_stats;
+
+	/** Tile hashes of the last wl_shm content, with shm_content_hash */
+	struct weston_content_hash *content_hash;
+
 	struct wl_list views;
 
 	/*
@@ -1489,6 +1849,10 @@ struct weston_surface {
 	struct wl_list frame_callback_list;
 	struct wl_list feedback_list;
 
+	/* In weston_compositor::frame_throttle_list while frame callbacks
+	 * are held back because the surface is occluded. */
+	struct wl_list frame_throttle_link;
+
 	struct weston_buffer_reference buffer_ref;
 	struct weston_buffer_viewport buffer_viewport;
 	int32_t width_from_buffer; /* before applying viewport */
@@ -1500,6 +1864,11 @@ struct weston_surface {
 
 	/* All the pending state, that wl_surface.commit will apply. */
 	struct weston_surface_state pending;
+	/* Region serials of the applied state and the size opaque and
+	 * input were clipped to. */
+	uint32_t opaque_serial;
+	uint32_t input_serial;
+	int32_t region_width, region_height;
 
 	/* Matrices representing of the full transformation between
 	 * buffer and surface coordinates.  These matrices are updated
@@ -1549,6 +1918,23 @@ struct weston_surface {
 	enum weston_hdcp_protection desired_protection;
 	enum weston_hdcp_protection current_protection;
 	enum weston_surface_protection_mode protection_mode;
+
+	/* weston_tearing_control_v1 resource for this surface */
+	struct wl_resource *tearing_control_resource;
+	/* The client prefers tearing to added latency */
+	bool async_present;
+
+	/* weston_content_type_v1 resource for this surface */
+	struct wl_resource *content_type_resource;
+	enum weston_surface_content_type content_type;
+
+	/* weston_commit_timer_v1 resource for this surface */
+	struct wl_resource *commit_timer_resource;
+	/* Commits held back until their target, oldest first */
+	struct wl_list commit_queue; /* weston_commit_queue_entry::link */
+	/* In weston_compositor::commit_queue_list while commit_queue is
+	 * not empty */
+	struct wl_list commit_queue_link;
 };
 
 struct weston_subsurface {
@@ -1668,6 +2054,9 @@ weston_layer_set_mask_infinite(struct weston_layer *layer);
 bool
 weston_layer_mask_is_infinite(struct weston_layer *layer);
 
+void
+weston_layer_set_offset(struct weston_layer *layer, float x, float y);
+
 /* An invalid flag in presented_flags to catch logic errors. */
 #define WP_PRESENTATION_FEEDBACK_INVALID (1U << 31)
 
@@ -1779,6 +2168,10 @@ weston_view_set_mask(struct weston_view *view,
 void
 weston_view_set_mask_infinite(struct weston_view *view);
 
+void
+weston_view_set_plane_hint(struct weston_view *view,
+			   const struct weston_view_plane_hint *hint);
+
 bool
 weston_view_is_mapped(struct weston_view *view);
 
@@ -1833,8 +2226,54 @@ weston_surface_copy_content(struct weston_surface *surface,
 			    int src_x, int src_y,
 			    int width, int height);
 
+int
+weston_surface_copy_content_async(struct weston_surface *surface,
+				  int src_x, int src_y,
+				  int width, int height,
+				  weston_surface_copy_content_done_func_t done,
+				  void *data);
+
 struct weston_buffer *
-weston_buffer_from_resource(struct wl_resource *resource);
+weston_buffer_from_resource(struct weston_compositor *compositor,
+			    struct wl_resource *resource);
+
+int
+weston_compositor_enable_shm_udmabuf(struct weston_compositor *ec);
+
+int
+weston_compositor_enable_memory_pressure(struct weston_compositor *ec,
+					 uint32_t stall_msec);
+
+void
+weston_compositor_trim_memory(struct weston_compositor *ec);
+
+int
+weston_compositor_enable_watchdog(struct weston_compositor *ec,
+				  uint32_t threshold_msec);
+
+struct weston_metrics;
+
+void
+weston_compositor_write_metrics(struct weston_compositor *compositor,
+				FILE *fp);
+
+void
+weston_metrics_family(struct weston_metrics *m, const char *name,
+		      const char *type, const char *unit, const char *help);
+
+void
+weston_metrics_sample(struct weston_metrics *m, const char *name,
+		      double value, ...);
+
+void
+weston_compositor_run(struct weston_compositor *ec);
+
+void
+weston_compositor_terminate(struct weston_compositor *ec);
+
+void
+weston_compositor_set_client_request_budget(struct weston_compositor *ec,
+					    uint32_t budget);
 
 void
 weston_compositor_get_time(struct timespec *time);
@@ -1919,6 +2358,9 @@ weston_screenshooter_shoot(struct weston_output *output, struct weston_buffer *b
 			   weston_screenshooter_done_func_t done, void *data);
 struct weston_recorder *
 weston_recorder_start(struct weston_output *output, const char *filename);
+struct weston_recorder *
+weston_recorder_start_v2(struct weston_output *output, const char *filename,
+			 uint32_t keyframe_interval);
 void
 weston_recorder_stop(struct weston_recorder *recorder);
 
@@ -47,6 +47,20 @@ struct weston_pipewire_api {
 
 	/** Set seat */
 	void (*set_seat)(struct weston_output *output, const char *seat);
+
+	/** Enable damage tracking
+	 *
+	 * Buffers carry the damaged regions as SPA_META_VideoDamage
+	 * metadata, and repaints without damage queue no buffer.
+	 */
+	void (*set_damage_tracking)(struct weston_output *output, bool enable);
+
+	/** Stream what the DRM output called name shows, copied and
+	 *  scaled by the GPU after each of its repaints instead of
+	 *  compositing the scene again. NULL composites the output as
+	 *  usual.
+	 */
+	void (*set_mirror_of)(struct weston_output *output, const char *name);
 };
 
 static inline const struct weston_pipewire_api *
@@ -63,6 +63,33 @@ struct weston_remoting_api {
 	/** Set the pipeline for gstreamer */
 	void (*set_gst_pipeline)(struct weston_output *output,
 				 char *gst_pipeline);
+
+	/** Set the gstreamer encoder element, e.g. "v4l2h264enc"
+	 *
+	 * Used to build the default pipeline instead of JPEG.
+	 */
+	void (*set_encoder)(struct weston_output *output,
+			    const char *encoder);
+
+	/** Set the target bitrate in kbit/s, 0 for the encoder default */
+	void (*set_bitrate)(struct weston_output *output, int kbps);
+
+	/** Set the number of buffers rendered into ahead of the encoder
+	 *
+	 * With a non-zero depth, frames are rendered into a queue of
+	 * dmabufs which only get the damage repainted. 0 uses the output's
+	 * GBM surface.
+	 */
+	void (*set_buffer_queue_depth)(struct weston_output *output,
+				       unsigned int depth);
+
+	/** Stream what the DRM output called name shows, copied and
+	 * scaled by the GPU after each of its repaints instead of
+	 * compositing the scene again. NULL composites the output as
+	 * usual. A mirror always renders into a buffer queue, of depth 2
+	 * unless set otherwise.
+	 */
+	void (*set_mirror_of)(struct weston_output *output, const char *name);
 };
 
 static inline const struct weston_remoting_api *
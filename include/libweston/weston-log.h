@@ -84,6 +84,17 @@ weston_log_scope_destroy(struct weston_log_scope *scope);
 bool
 weston_log_scope_is_enabled(struct weston_log_scope *scope);
 
+bool
+weston_log_scope_is_sampled(struct weston_log_scope *scope);
+
+void
+weston_log_scope_next_sample(struct weston_log_scope *scope);
+
+void
+weston_log_ctx_set_sample_interval(struct weston_log_context *log_ctx,
+				   const char *scope_name,
+				   unsigned int interval);
+
 void
 weston_log_scope_write(struct weston_log_scope *scope,
 			 const char *data, size_t len);
@@ -96,6 +107,20 @@ int
 weston_log_scope_printf(struct weston_log_scope *scope,
 			  const char *fmt, ...)
 			  __attribute__ ((format (printf, 2, 3)));
+
+/** Print to a scope, evaluating the arguments only when it is sampled
+ *
+ * Expensive arguments, like strings built for the message, cost nothing
+ * while nobody listens to the scope. The macro is a statement and has no
+ * value.
+ */
+#define weston_log_scope_lazy_printf(scope, ...)			\
+	do {								\
+		struct weston_log_scope *scope_ = (scope);		\
+		if (weston_log_scope_is_sampled(scope_))		\
+			weston_log_scope_printf(scope_, __VA_ARGS__);	\
+	} while (0)
+
 void
 weston_log_subscription_printf(struct weston_log_subscription *sub,
 				const char *fmt, ...)
@@ -121,12 +146,27 @@ weston_log_subscribe(struct weston_log_context *log_ctx,
 struct weston_log_subscriber *
 weston_log_subscriber_create_log(FILE *dump_to);
 
+struct weston_log_subscriber *
+weston_log_subscriber_create_log_async(FILE *dump_to, size_t size,
+				       int fsync_msec);
+
 struct weston_log_subscriber *
 weston_log_subscriber_create_flight_rec(size_t size);
 
 void
 weston_log_subscriber_display_flight_rec(struct weston_log_subscriber *sub);
 
+struct weston_log_subscriber *
+weston_log_subscriber_create_binary_flight_rec(size_t size);
+
+void
+weston_log_subscriber_dump_flight_rec(struct weston_log_subscriber *sub,
+				      FILE *file);
+
+size_t
+weston_log_subscriber_shrink_flight_rec(struct weston_log_subscriber *sub,
+					size_t size);
+
 struct weston_log_subscription *
 weston_log_subscription_iterate(struct weston_log_scope *scope,
 				struct weston_log_subscription *sub_iter);
@@ -109,6 +109,20 @@ struct weston_xwayland_api {
 	 */
 	void
 	(*xserver_exited)(struct weston_xwayland *xwayland, int exit_status);
+
+	/** Start the Xwayland server without waiting for an X client.
+	 *
+	 * Calls the spawn function given to \a listen as if a client had
+	 * connected, so that the server and the window manager are ready by
+	 * the time the first X client shows up. Does nothing if the server
+	 * is already running or the module stopped listening.
+	 *
+	 * \param xwayland The Xwayland context object.
+	 *
+	 * \return 0 on success, a negative number otherwise.
+	 */
+	int
+	(*spawn)(struct weston_xwayland *xwayland);
 };
 
 /** Retrieve the API object for the libweston Xwayland module.
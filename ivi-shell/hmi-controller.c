@@ -61,9 +61,11 @@
 #include <assert.h>
 #include <time.h>
 
+#include <libweston/weston-log.h>
 #include "ivi-layout-export.h"
 #include "ivi-hmi-controller-server-protocol.h"
 #include "shared/helpers.h"
+#include "shared/timespec-util.h"
 #include "shared/xalloc.h"
 #include "compositor/weston.h"
 
@@ -141,6 +143,13 @@ struct hmi_controller {
 	struct weston_output * workspace_background_output;
 	int32_t				    screen_num;
 
+	/* Surface notifications coalesce into one layout pass per
+	 * dispatch, see hmi_controller_schedule_layout() */
+	struct wl_event_source             *layout_idle;
+	/* ivi_layout property calls the current layout pass made */
+	uint32_t                            layout_changes;
+	struct weston_log_scope            *layout_scope;
+
 	const struct ivi_layout_interface *interface;
 };
 
@@ -197,6 +206,83 @@ compare_launcher_info(const void *lhs, const void *rhs)
 	return 0;
 }
 
+/**
+ * Layout helpers which only touch what changed
+ *
+ * Every ivi_layout property call marks the surface dirty for the next
+ * commit_changes, so the layout modes compare with the committed
+ * properties first and leave surfaces already in their slot alone.
+ */
+static void
+hmi_surface_place(struct hmi_controller *hmi_ctrl,
+		  struct ivi_layout_surface *ivisurf,
+		  int32_t x, int32_t y, int32_t width, int32_t height)
+{
+	const struct ivi_layout_surface_properties *prop;
+	const uint32_t duration = hmi_ctrl->hmi_setting->transition_duration;
+
+	prop = hmi_ctrl->interface->get_properties_of_surface(ivisurf);
+	if (prop && prop->visibility &&
+	    prop->dest_x == x && prop->dest_y == y &&
+	    prop->dest_width == width && prop->dest_height == height)
+		return;
+
+	hmi_ctrl->interface->surface_set_transition(ivisurf,
+				IVI_LAYOUT_TRANSITION_VIEW_DEFAULT,
+				duration);
+	hmi_ctrl->interface->surface_set_visibility(ivisurf, true);
+	hmi_ctrl->interface->surface_set_destination_rectangle(ivisurf,
+							       x, y,
+							       width, height);
+	hmi_ctrl->layout_changes++;
+}
+
+static void
+hmi_surface_hide(struct hmi_controller *hmi_ctrl,
+		 struct ivi_layout_surface *ivisurf,
+		 enum ivi_layout_transition_type transition)
+{
+	const struct ivi_layout_surface_properties *prop;
+	const uint32_t duration = hmi_ctrl->hmi_setting->transition_duration;
+
+	prop = hmi_ctrl->interface->get_properties_of_surface(ivisurf);
+	if (prop && !prop->visibility)
+		return;
+
+	if (transition != IVI_LAYOUT_TRANSITION_NONE)
+		hmi_ctrl->interface->surface_set_transition(ivisurf,
+							    transition,
+							    duration);
+	hmi_ctrl->interface->surface_set_visibility(ivisurf, false);
+	hmi_ctrl->layout_changes++;
+}
+
+/* Returns true if the render order changed. */
+static bool
+hmi_layer_set_order(struct hmi_controller *hmi_ctrl,
+		    struct ivi_layout_layer *ivilayer,
+		    struct ivi_layout_surface **order, int32_t length)
+{
+	struct ivi_layout_surface **current = NULL;
+	int32_t current_length = 0;
+	bool same;
+
+	hmi_ctrl->interface->get_surfaces_on_layer(ivilayer, &current_length,
+						   &current);
+	same = current_length == length &&
+	       (length == 0 ||
+		memcmp(current, order, length * sizeof(*order)) == 0);
+	free(current);
+
+	if (same)
+		return false;
+
+	hmi_ctrl->interface->layer_set_render_order(ivilayer, order, length);
+	hmi_ctrl->layout_changes++;
+
+	return true;
+}
+
 /**
  * Internal methods called by mainly ivi_hmi_controller_switch_mode
  * This reference shows 4 examples how to use ivi_layout APIs.
@@ -255,24 +341,20 @@ mode_divided_into_tiling(struct hmi_controller *hmi_ctrl,
 				surface_y = (int32_t)surface_height;
 			}
 
-			hmi_ctrl->interface->surface_set_transition(ivisurf,
-					IVI_LAYOUT_TRANSITION_VIEW_DEFAULT,
-					duration);
-			hmi_ctrl->interface->surface_set_visibility(ivisurf, true);
-			hmi_ctrl->interface->surface_set_destination_rectangle(ivisurf,
-					surface_x, surface_y,
-					(int32_t)surface_width,
-					(int32_t)surface_height);
-
+			hmi_surface_place(hmi_ctrl, ivisurf,
+					  surface_x, surface_y,
+					  (int32_t)surface_width,
+					  (int32_t)surface_height);
 		}
-		hmi_ctrl->interface->layer_set_render_order(ivilayer, new_order, i);
 
-		hmi_ctrl->interface->layer_set_transition(ivilayer,
+		if (hmi_layer_set_order(hmi_ctrl, ivilayer, new_order, i))
+			hmi_ctrl->interface->layer_set_transition(ivilayer,
 					IVI_LAYOUT_TRANSITION_LAYER_VIEW_ORDER,
 					duration);
 	}
 	for (i = idx; i < surf_num; i++)
-		hmi_ctrl->interface->surface_set_visibility(surfaces[i], false);
+		hmi_surface_hide(hmi_ctrl, surfaces[i],
+				 IVI_LAYOUT_TRANSITION_NONE);
 
 	free(surfaces);
 	free(new_order);
@@ -289,7 +371,6 @@ mode_divided_into_sidebyside(struct hmi_controller *hmi_ctrl,
 	int32_t surface_height = layer->height;
 	struct ivi_layout_surface *ivisurf  = NULL;
 
-	const uint32_t duration = hmi_ctrl->hmi_setting->transition_duration;
 	int32_t i = 0;
 	struct ivi_layout_surface **surfaces;
 	struct ivi_layout_surface **new_order;
@@ -323,25 +404,16 @@ mode_divided_into_sidebyside(struct hmi_controller *hmi_ctrl,
 			ivisurf = surfaces[idx];
 			new_order[i] = ivisurf;
 
-			hmi_ctrl->interface->surface_set_transition(ivisurf,
-					IVI_LAYOUT_TRANSITION_VIEW_DEFAULT,
-					duration);
-			hmi_ctrl->interface->surface_set_visibility(ivisurf, true);
-
-			hmi_ctrl->interface->surface_set_destination_rectangle(ivisurf,
-								i * surface_width, 0,
-								surface_width,
-								surface_height);
+			hmi_surface_place(hmi_ctrl, ivisurf,
+					  i * surface_width, 0,
+					  surface_width, surface_height);
 		}
-		hmi_ctrl->interface->layer_set_render_order(ivilayer, new_order, i);
+		hmi_layer_set_order(hmi_ctrl, ivilayer, new_order, i);
 	}
 
-	for (i = idx; i < surf_num; i++) {
-		hmi_ctrl->interface->surface_set_transition(surfaces[i],
-						IVI_LAYOUT_TRANSITION_VIEW_FADE_ONLY,
-						duration);
-		hmi_ctrl->interface->surface_set_visibility(surfaces[i], false);
-	}
+	for (i = idx; i < surf_num; i++)
+		hmi_surface_hide(hmi_ctrl, surfaces[i],
+				 IVI_LAYOUT_TRANSITION_VIEW_FADE_ONLY);
 
 	free(surfaces);
 	free(new_order);
@@ -358,7 +430,6 @@ mode_fullscreen_someone(struct hmi_controller *hmi_ctrl,
 	const int32_t  surface_height = layer->height;
 	struct ivi_layout_surface *ivisurf  = NULL;
 	int32_t i = 0;
-	const uint32_t duration = hmi_ctrl->hmi_setting->transition_duration;
 	int32_t surf_num = 0;
 	struct ivi_layout_surface **surfaces;
 
@@ -373,23 +444,19 @@ mode_fullscreen_someone(struct hmi_controller *hmi_ctrl,
 
 		surfaces[surf_num++] = ivisurf;
 	}
-	hmi_ctrl->interface->layer_set_render_order(layer->ivilayer, surfaces, surf_num);
+	hmi_layer_set_order(hmi_ctrl, layer->ivilayer, surfaces, surf_num);
 
 	for (i = 0; i < surf_num; i++) {
 		ivisurf = surfaces[i];
 
 		if ((i > 0) && (i < hmi_ctrl->screen_num)) {
 			layer = wl_container_of(layer->link.prev, layer, link);
-			hmi_ctrl->interface->layer_set_render_order(layer->ivilayer, &ivisurf, 1);
+			hmi_layer_set_order(hmi_ctrl, layer->ivilayer,
+					    &ivisurf, 1);
 		}
 
-		hmi_ctrl->interface->surface_set_transition(ivisurf,
-					IVI_LAYOUT_TRANSITION_VIEW_DEFAULT,
-					duration);
-		hmi_ctrl->interface->surface_set_visibility(ivisurf, true);
-		hmi_ctrl->interface->surface_set_destination_rectangle(ivisurf, 0, 0,
-							     surface_width,
-							     surface_height);
+		hmi_surface_place(hmi_ctrl, ivisurf, 0, 0,
+				  surface_width, surface_height);
 	}
 
 	free(surfaces);
@@ -447,6 +514,7 @@ mode_random_replace(struct hmi_controller *hmi_ctrl,
 							     surface_height);
 
 		hmi_ctrl->interface->layer_add_surface(layers[layer_idx]->ivilayer, ivisurf);
+		hmi_ctrl->layout_changes++;
 	}
 
 	free(layers);
@@ -485,11 +553,20 @@ switch_mode(struct hmi_controller *hmi_ctrl,
 	struct ivi_layout_surface **pp_surface = NULL;
 	int32_t surface_length = 0;
 	int32_t ret = 0;
+	struct timespec begin, end;
 
 	if (!hmi_ctrl->is_initialized)
 		return;
 
+	/* This pass covers any layout still waiting to run. */
+	if (hmi_ctrl->layout_idle) {
+		wl_event_source_remove(hmi_ctrl->layout_idle);
+		hmi_ctrl->layout_idle = NULL;
+	}
+
 	hmi_ctrl->layout_mode = layout_mode;
+	hmi_ctrl->layout_changes = 0;
+	clock_gettime(CLOCK_MONOTONIC, &begin);
 
 	ret = hmi_ctrl->interface->get_surfaces(&surface_length, &pp_surface);
 	assert(!ret);
@@ -519,10 +596,50 @@ switch_mode(struct hmi_controller *hmi_ctrl,
 		break;
 	}
 
-	hmi_ctrl->interface->commit_changes();
+	if (hmi_ctrl->layout_changes > 0)
+		hmi_ctrl->interface->commit_changes();
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	weston_log_scope_printf(hmi_ctrl->layout_scope,
+				"layout mode %d: %d surfaces, %u changes, "
+				"%.3f ms\n", layout_mode, surface_length,
+				hmi_ctrl->layout_changes,
+				timespec_sub_to_nsec(&end, &begin) / 1e6);
+
 	free(pp_surface);
 }
 
+static void
+hmi_controller_layout_idle(void *data)
+{
+	struct hmi_controller *hmi_ctrl = data;
+
+	hmi_ctrl->layout_idle = NULL;
+	switch_mode(hmi_ctrl, hmi_ctrl->layout_mode);
+}
+
+/**
+ * Run the current layout mode once the current dispatch is done
+ *
+ * Applications starting or going away together, e.g. at boot, then cost
+ * one layout pass and one commit_changes instead of one each.
+ */
+static void
+hmi_controller_schedule_layout(struct hmi_controller *hmi_ctrl)
+{
+	struct wl_event_loop *loop;
+
+	if (hmi_ctrl->layout_idle)
+		return;
+
+	loop = wl_display_get_event_loop(hmi_ctrl->compositor->wl_display);
+	hmi_ctrl->layout_idle =
+		wl_event_loop_add_idle(loop, hmi_controller_layout_idle,
+				       hmi_ctrl);
+	if (!hmi_ctrl->layout_idle)
+		switch_mode(hmi_ctrl, hmi_ctrl->layout_mode);
+}
+
 /**
  * Internal method for transition
  */
@@ -586,7 +703,7 @@ set_notification_remove_surface(struct wl_listener *listener, void *data)
 					surface_removed);
 	(void)data;
 
-	switch_mode(hmi_ctrl, hmi_ctrl->layout_mode);
+	hmi_controller_schedule_layout(hmi_ctrl);
 }
 
 static void
@@ -642,7 +759,7 @@ set_notification_configure_surface(struct wl_listener *listener, void *data)
 		ivisurfs = NULL;
 	}
 
-	switch_mode(hmi_ctrl, hmi_ctrl->layout_mode);
+	hmi_controller_schedule_layout(hmi_ctrl);
 }
 
 static void
@@ -678,7 +795,7 @@ set_notification_configure_desktop_surface(struct wl_listener *listener, void *d
 	}
 
 	hmi_ctrl->interface->commit_changes();
-	switch_mode(hmi_ctrl, hmi_ctrl->layout_mode);
+	hmi_controller_schedule_layout(hmi_ctrl);
 }
 
 /**
@@ -745,6 +862,10 @@ hmi_controller_destroy(struct wl_listener *listener, void *data)
 	struct hmi_controller *hmi_ctrl =
 		container_of(listener, struct hmi_controller, destroy_listener);
 
+	if (hmi_ctrl->layout_idle)
+		wl_event_source_remove(hmi_ctrl->layout_idle);
+	weston_log_scope_destroy(hmi_ctrl->layout_scope);
+
 	wl_list_for_each_safe(link, next,
 			      &hmi_ctrl->workspace_fade.layer_list, link) {
 		wl_list_remove(&link->link);
@@ -813,6 +934,10 @@ hmi_controller_create(struct weston_compositor *ec)
 	hmi_ctrl->compositor = ec;
 	hmi_ctrl->screen_num = wl_list_length(&ec->output_list);
 	hmi_ctrl->interface = interface;
+	hmi_ctrl->layout_scope =
+		weston_compositor_add_log_scope(ec, "hmi-controller",
+						"HMI controller layout passes\n",
+						NULL, NULL, NULL);
 
 	/* init base ivi_layer*/
 	wl_list_init(&hmi_ctrl->base_layer_list);
@@ -591,6 +591,19 @@ struct ivi_layout_interface {
 	 */
 	int32_t (*screen_remove_layer)(struct weston_output *output,
 				       struct ivi_layout_layer *removelayer);
+
+	/**
+	 * \brief Set how the surfaces of an ivi_layer should be composited
+	 *
+	 * The hint is passed to the views of the ivi_layer, so backends with
+	 * hardware planes can e.g. keep a video or camera layer on an
+	 * overlay at a fixed zpos. NULL clears it.
+	 *
+	 * \return IVI_SUCCEEDED if the method call was successful
+	 * \return IVI_FAILED if the method call was failed
+	 */
+	int32_t (*layer_set_plane_hint)(struct ivi_layout_layer *ivilayer,
+					const struct weston_view_plane_hint *hint);
 };
 
 static inline const struct ivi_layout_interface *
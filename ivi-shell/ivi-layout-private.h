@@ -43,10 +43,31 @@ struct ivi_layout_view {
 
 	struct ivi_layout_surface *ivisurf;
 	struct ivi_layout_layer *on_layer;
+
+	/* ivi_layout::commit_serial of the last commit that updated it */
+	uint32_t commit_serial;
+};
+
+/* Chained hash from object id to surface or layer. It starts on the
+ * inline buckets, so inserting never fails; failing to grow only makes
+ * the chains longer. */
+#define IVI_LAYOUT_ID_TABLE_INLINE 16
+
+struct ivi_layout_id_entry {
+	uint32_t id;
+	struct wl_list link;	/* ivi_layout_id_table::buckets */
+};
+
+struct ivi_layout_id_table {
+	struct wl_list *buckets;
+	struct wl_list inline_buckets[IVI_LAYOUT_ID_TABLE_INLINE];
+	uint32_t mask;
+	uint32_t count;
 };
 
 struct ivi_layout_surface {
 	struct wl_list link;	/* ivi_layout::surface_list */
+	struct ivi_layout_id_entry id_entry; /* ivi_layout::surface_ids */
 	struct wl_signal property_changed;
 	int32_t update_count;
 	uint32_t id_surface;
@@ -62,10 +83,14 @@ struct ivi_layout_surface {
 	} pending;
 
 	struct wl_list view_list;	/* ivi_layout_view::surf_link */
+
+	struct wl_list dirty_link;	/* ivi_layout::dirty_surface_list */
+	struct wl_list commit_link;	/* ivi_layout::commit_surface_list */
 };
 
 struct ivi_layout_layer {
 	struct wl_list link;	/* ivi_layout::layer_list */
+	struct ivi_layout_id_entry id_entry; /* ivi_layout::layer_ids */
 	struct wl_signal property_changed;
 	uint32_t id_layer;
 
@@ -74,8 +99,11 @@ struct ivi_layout_layer {
 
 	struct ivi_layout_layer_properties prop;
 
+	struct weston_view_plane_hint plane_hint;
+
 	struct {
 		struct ivi_layout_layer_properties prop;
+		struct weston_view_plane_hint plane_hint;
 		struct wl_list view_list;	/* ivi_layout_view::pending_link */
 		struct wl_list link;	/* ivi_layout_screen::pending.layer_list */
 	} pending;
@@ -86,6 +114,9 @@ struct ivi_layout_layer {
 		struct wl_list link;	/* ivi_layout_screen::order.layer_list */
 	} order;
 
+	struct wl_list dirty_link;	/* ivi_layout::dirty_layer_list */
+	struct wl_list commit_link;	/* ivi_layout::commit_layer_list */
+
 	int32_t ref_count;
 };
 
@@ -97,6 +128,21 @@ struct ivi_layout {
 	struct wl_list screen_list;	/* ivi_layout_screen::link */
 	struct wl_list view_list;	/* ivi_layout_view::link */
 
+	struct ivi_layout_id_table surface_ids;	/* ivi_layout_surface::id_entry */
+	struct ivi_layout_id_table layer_ids;	/* ivi_layout_layer::id_entry */
+
+	/* Objects with pending changes since the last commit. */
+	struct wl_list dirty_surface_list;	/* ivi_layout_surface::dirty_link */
+	struct wl_list dirty_layer_list;	/* ivi_layout_layer::dirty_link */
+
+	/* Objects touched by the current or latest commit; only these can
+	 * have a non-zero prop.event_mask. */
+	struct wl_list commit_surface_list;	/* ivi_layout_surface::commit_link */
+	struct wl_list commit_layer_list;	/* ivi_layout_layer::commit_link */
+
+	uint32_t commit_serial;
+	bool scene_dirty;	/* layout_layer view list must be rebuilt */
+
 	struct {
 		struct wl_signal created;
 		struct wl_signal removed;
@@ -112,7 +158,7 @@ struct ivi_layout {
 	struct weston_layer layout_layer;
 
 	struct ivi_layout_transition_set *transitions;
-	struct wl_list pending_transition_list;	/* transition_node::link */
+	struct wl_list pending_transition_list;	/* ivi_layout_transition::link */
 };
 
 struct ivi_layout *get_instance(void);
@@ -121,7 +167,7 @@ struct ivi_layout_transition;
 
 struct ivi_layout_transition_set {
 	struct wl_event_source  *event_source;
-	struct wl_list          transition_list;
+	struct wl_list          transition_list; /* ivi_layout_transition::link */
 };
 
 typedef void (*ivi_layout_transition_destroy_user_func)(void *user_data);
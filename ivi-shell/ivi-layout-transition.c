@@ -56,13 +56,13 @@ struct ivi_layout_transition {
 	ivi_layout_is_transition_func is_transition_func;
 	ivi_layout_transition_frame_func frame_func;
 	ivi_layout_transition_destroy_func destroy_func;
-};
-
-struct transition_node {
-	struct ivi_layout_transition *transition;
 
 	/* ivi_layout::pending_transition_list
 	 * ivi_layout_transition_set::transition_list
+	 *
+	 * Embedded rather than held by a separate node, so registering
+	 * costs no allocation and finishing a transition does not have to
+	 * search both lists for it.
 	 */
 	struct wl_list link;
 };
@@ -74,12 +74,9 @@ get_transition_from_type_and_id(enum ivi_layout_transition_type type,
 				void *id_data)
 {
 	struct ivi_layout *layout = get_instance();
-	struct transition_node *node;
 	struct ivi_layout_transition *tran;
 
-	wl_list_for_each(node, &layout->transitions->transition_list, link) {
-		tran = node->transition;
-
+	wl_list_for_each(tran, &layout->transitions->transition_list, link) {
 		if (tran->type == type &&
 		    tran->is_transition_func(tran->private_data, id_data))
 			return tran;
@@ -92,12 +89,9 @@ int32_t
 is_surface_transition(struct ivi_layout_surface *surface)
 {
 	struct ivi_layout *layout = get_instance();
-	struct transition_node *node;
 	struct ivi_layout_transition *tran;
 
-	wl_list_for_each(node, &layout->transitions->transition_list, link) {
-		tran = node->transition;
-
+	wl_list_for_each(tran, &layout->transitions->transition_list, link) {
 		if ((tran->type == IVI_LAYOUT_TRANSITION_VIEW_MOVE_RESIZE ||
 		     tran->type == IVI_LAYOUT_TRANSITION_VIEW_RESIZE) &&
 		    tran->is_transition_func(tran->private_data, surface))
@@ -111,12 +105,10 @@ void
 ivi_layout_remove_all_surface_transitions(struct ivi_layout_surface *surface)
 {
 	struct ivi_layout *layout = get_instance();
-	struct transition_node *node;
-	struct transition_node *tmp;
 	struct ivi_layout_transition *tran;
+	struct ivi_layout_transition *tmp;
 
-	wl_list_for_each_safe(node, tmp, &layout->transitions->transition_list, link) {
-		tran = node->transition;
+	wl_list_for_each_safe(tran, tmp, &layout->transitions->transition_list, link) {
 		if (tran->is_transition_func(tran->private_data, surface)) {
 			layout_transition_destroy(tran);
 		}
@@ -163,8 +155,8 @@ layout_transition_frame(void *data)
 	uint32_t fps = 30;
 	struct timespec timestamp = {};
 	uint32_t msec = 0;
-	struct transition_node *node = NULL;
-	struct transition_node *next = NULL;
+	struct ivi_layout_transition *transition;
+	struct ivi_layout_transition *next;
 
 	if (wl_list_empty(&transitions->transition_list)) {
 		wl_event_source_timer_update(transitions->event_source, 0);
@@ -176,8 +168,9 @@ layout_transition_frame(void *data)
 	clock_gettime(CLOCK_MONOTONIC, &timestamp);/* FIXME */
 	msec = (1e+3 * timestamp.tv_sec + 1e-6 * timestamp.tv_nsec);
 
-	wl_list_for_each_safe(node, next, &transitions->transition_list, link) {
-		do_transition_frame(node->transition, msec);
+	wl_list_for_each_safe(transition, next,
+			      &transitions->transition_list, link) {
+		do_transition_frame(transition, msec);
 	}
 
 	ivi_layout_commit_changes();
@@ -210,51 +203,16 @@ static bool
 layout_transition_register(struct ivi_layout_transition *trans)
 {
 	struct ivi_layout *layout = get_instance();
-	struct transition_node *node;
 
-	node = malloc(sizeof(*node));
-	if (node == NULL) {
-		weston_log("%s: memory allocation fails\n", __func__);
-		return false;
-	}
-
-	node->transition = trans;
-	wl_list_insert(&layout->pending_transition_list, &node->link);
+	wl_list_remove(&trans->link);
+	wl_list_insert(&layout->pending_transition_list, &trans->link);
 	return true;
 }
 
-static void
-remove_transition(struct ivi_layout *layout,
-		  struct ivi_layout_transition *trans)
-{
-	struct transition_node *node;
-	struct transition_node *next;
-
-	wl_list_for_each_safe(node, next,
-			      &layout->transitions->transition_list, link) {
-		if (node->transition == trans) {
-			wl_list_remove(&node->link);
-			free(node);
-			return;
-		}
-	}
-
-	wl_list_for_each_safe(node, next,
-			      &layout->pending_transition_list, link) {
-		if (node->transition == trans) {
-			wl_list_remove(&node->link);
-			free(node);
-			return;
-		}
-	}
-}
-
 static void
 layout_transition_destroy(struct ivi_layout_transition *transition)
 {
-	struct ivi_layout *layout = get_instance();
-
-	remove_transition(layout, transition);
+	wl_list_remove(&transition->link);
 	if (transition->destroy_func)
 		transition->destroy_func(transition);
 	free(transition);
@@ -283,6 +241,7 @@ create_layout_transition(void)
 
 	transition->frame_func = NULL;
 	transition->destroy_func = NULL;
+	wl_list_init(&transition->link);
 
 	return transition;
 }
@@ -108,36 +108,121 @@ get_instance(void)
 }
 
 /**
- * Internal API to add/remove an ivi_layer to/from ivi_screen.
+ * Internal API to look up ivi_surfaces and ivi_layers by id.
  */
-static struct ivi_layout_surface *
-get_surface(struct wl_list *surf_list, uint32_t id_surface)
+static uint32_t
+id_table_hash(uint32_t id)
 {
-	struct ivi_layout_surface *ivisurf;
+	/* Ids are often small and sequential; spread them over the
+	 * buckets with a multiplicative hash. */
+	id *= 0x9e3779b1u;
+
+	return id ^ (id >> 16);
+}
+
+static void
+id_table_init(struct ivi_layout_id_table *table)
+{
+	uint32_t i;
+
+	for (i = 0; i < IVI_LAYOUT_ID_TABLE_INLINE; i++)
+		wl_list_init(&table->inline_buckets[i]);
+
+	table->buckets = table->inline_buckets;
+	table->mask = IVI_LAYOUT_ID_TABLE_INLINE - 1;
+	table->count = 0;
+}
+
+static void
+id_table_grow(struct ivi_layout_id_table *table)
+{
+	struct ivi_layout_id_entry *entry, *next;
+	struct wl_list *buckets;
+	uint32_t size = (table->mask + 1) * 2;
+	uint32_t i;
+
+	buckets = malloc(size * sizeof *buckets);
+	if (!buckets)
+		return;
+
+	for (i = 0; i < size; i++)
+		wl_list_init(&buckets[i]);
 
-	wl_list_for_each(ivisurf, surf_list, link) {
-		if (ivisurf->id_surface == id_surface) {
-			return ivisurf;
+	for (i = 0; i <= table->mask; i++) {
+		wl_list_for_each_safe(entry, next, &table->buckets[i], link) {
+			wl_list_remove(&entry->link);
+			wl_list_insert(&buckets[id_table_hash(entry->id) &
+						(size - 1)],
+				       &entry->link);
 		}
 	}
 
-	return NULL;
+	if (table->buckets != table->inline_buckets)
+		free(table->buckets);
+	table->buckets = buckets;
+	table->mask = size - 1;
 }
 
-static struct ivi_layout_layer *
-get_layer(struct wl_list *layer_list, uint32_t id_layer)
+static void
+id_table_insert(struct ivi_layout_id_table *table,
+		struct ivi_layout_id_entry *entry, uint32_t id)
 {
-	struct ivi_layout_layer *ivilayer;
+	if (table->count >= table->mask + 1)
+		id_table_grow(table);
 
-	wl_list_for_each(ivilayer, layer_list, link) {
-		if (ivilayer->id_layer == id_layer) {
-			return ivilayer;
-		}
+	entry->id = id;
+	wl_list_insert(&table->buckets[id_table_hash(id) & table->mask],
+		       &entry->link);
+	table->count++;
+}
+
+static void
+id_table_remove(struct ivi_layout_id_table *table,
+		struct ivi_layout_id_entry *entry)
+{
+	wl_list_remove(&entry->link);
+	wl_list_init(&entry->link);
+	table->count--;
+}
+
+static struct ivi_layout_id_entry *
+id_table_lookup(struct ivi_layout_id_table *table, uint32_t id)
+{
+	struct ivi_layout_id_entry *entry;
+
+	wl_list_for_each(entry, &table->buckets[id_table_hash(id) & table->mask],
+			 link) {
+		if (entry->id == id)
+			return entry;
 	}
 
 	return NULL;
 }
 
+static struct ivi_layout_surface *
+get_surface(struct ivi_layout *layout, uint32_t id_surface)
+{
+	struct ivi_layout_id_entry *entry;
+
+	entry = id_table_lookup(&layout->surface_ids, id_surface);
+	if (!entry)
+		return NULL;
+
+	return container_of(entry, struct ivi_layout_surface, id_entry);
+}
+
+static struct ivi_layout_layer *
+get_layer(struct ivi_layout *layout, uint32_t id_layer)
+{
+	struct ivi_layout_id_entry *entry;
+
+	entry = id_table_lookup(&layout->layer_ids, id_layer);
+	if (!entry)
+		return NULL;
+
+	return container_of(entry, struct ivi_layout_layer, id_entry);
+}
+
 static bool
 ivi_view_is_rendered(struct ivi_layout_view *view)
 {
@@ -217,6 +302,42 @@ get_ivi_view(struct ivi_layout_layer *ivilayer,
 	return NULL;
 }
 
+/*
+ * A commit only visits the surfaces and layers that were changed since the
+ * previous one, plus those whose membership in the scene it changes.
+ */
+static void
+surface_mark_dirty(struct ivi_layout_surface *ivisurf)
+{
+	if (wl_list_empty(&ivisurf->dirty_link))
+		wl_list_insert(&ivisurf->layout->dirty_surface_list,
+			       &ivisurf->dirty_link);
+}
+
+static void
+layer_mark_dirty(struct ivi_layout_layer *ivilayer)
+{
+	if (wl_list_empty(&ivilayer->dirty_link))
+		wl_list_insert(&ivilayer->layout->dirty_layer_list,
+			       &ivilayer->dirty_link);
+}
+
+static void
+surface_mark_committed(struct ivi_layout_surface *ivisurf)
+{
+	if (wl_list_empty(&ivisurf->commit_link))
+		wl_list_insert(&ivisurf->layout->commit_surface_list,
+			       &ivisurf->commit_link);
+}
+
+static void
+layer_mark_committed(struct ivi_layout_layer *ivilayer)
+{
+	if (wl_list_empty(&ivilayer->commit_link))
+		wl_list_insert(&ivilayer->layout->commit_layer_list,
+			       &ivilayer->commit_link);
+}
+
 static struct ivi_layout_screen *
 get_screen_from_output(struct weston_output *output)
 {
@@ -246,10 +367,14 @@ ivi_layout_surface_destroy(struct ivi_layout_surface *ivisurf)
 	}
 
 	wl_list_remove(&ivisurf->link);
+	id_table_remove(&layout->surface_ids, &ivisurf->id_entry);
+	wl_list_remove(&ivisurf->dirty_link);
+	wl_list_remove(&ivisurf->commit_link);
 
 	wl_list_for_each_safe(ivi_view, next, &ivisurf->view_list, surf_link) {
 		ivi_view_destroy(ivi_view);
 	}
+	layout->scene_dirty = true;
 
 	wl_signal_emit(&layout->surface_notification.removed, ivisurf);
 
@@ -286,6 +411,8 @@ create_screen(struct weston_compositor *ec)
 
 		wl_list_insert(&layout->screen_list, &iviscrn->link);
 	}
+
+	layout->scene_dirty = true;
 }
 
 /**
@@ -560,13 +687,28 @@ update_prop(struct ivi_layout_view *ivi_view)
 	struct ivi_layout_screen *iviscrn = ivilayer->on_screen;
 	struct ivi_rectangle r;
 	bool can_calc = true;
+	bool was_opaque = ivi_view->view->alpha == 1.0;
+	uint32_t event_mask;
 
 	/*In case of no prop change, this just returns*/
-	if (!ivilayer->prop.event_mask && !ivisurf->prop.event_mask)
+	event_mask = ivilayer->prop.event_mask | ivisurf->prop.event_mask;
+	if (!event_mask)
 		return;
 
 	update_opacity(ivilayer, ivisurf, ivi_view->view);
 
+	/*
+	 * Fade frames only change the opacity: leave the geometry alone and
+	 * damage the view where it is, on whatever plane it is. The opaque
+	 * region only depends on the alpha being 1.0 or not.
+	 */
+	if (event_mask == IVI_NOTIFICATION_OPACITY &&
+	    was_opaque == (ivi_view->view->alpha == 1.0)) {
+		ivisurf->update_count++;
+		weston_view_damage_below(ivi_view->view);
+		return;
+	}
+
 	if (ivisurf->prop.source_width == 0 || ivisurf->prop.source_height == 0) {
 		weston_log("ivi-shell: source rectangle is not yet set by ivi_layout_surface_set_source_rectangle\n");
 		can_calc = false;
@@ -607,20 +749,86 @@ ivi_view_is_mapped(struct ivi_layout_view *ivi_view)
 		ivi_view->ivisurf->prop.visibility);
 }
 
+static void
+commit_view(struct ivi_layout *layout, struct ivi_layout_view *ivi_view)
+{
+	/*
+	 * If the view is not on the currently rendered scenegraph,
+	 * we do not need to update its properties.
+	 */
+	if (!ivi_view_is_mapped(ivi_view))
+		return;
+
+	/* Reachable from both its surface and its layer. */
+	if (ivi_view->commit_serial == layout->commit_serial)
+		return;
+	ivi_view->commit_serial = layout->commit_serial;
+
+	update_prop(ivi_view);
+}
+
+/*
+ * A view depends on its surface and its layer only, so the views to update
+ * are those of the surfaces and layers this commit touched.
+ */
 static void
 commit_changes(struct ivi_layout *layout)
 {
-	struct ivi_layout_view *ivi_view  = NULL;
+	struct ivi_layout_surface *ivisurf;
+	struct ivi_layout_layer *ivilayer;
+	struct ivi_layout_view *ivi_view;
 
-	wl_list_for_each(ivi_view, &layout->view_list, link) {
-		/*
-		 * If the view is not on the currently rendered scenegraph,
-		 * we do not need to update its properties.
-		 */
-		if (!ivi_view_is_mapped(ivi_view))
-			continue;
+	wl_list_for_each(ivisurf, &layout->commit_surface_list, commit_link) {
+		wl_list_for_each(ivi_view, &ivisurf->view_list, surf_link)
+			commit_view(layout, ivi_view);
+	}
+
+	wl_list_for_each(ivilayer, &layout->commit_layer_list, commit_link) {
+		wl_list_for_each(ivi_view, &ivilayer->order.view_list,
+				 order_link)
+			commit_view(layout, ivi_view);
+	}
+}
+
+/*
+ * Forget the previous commit and pick up everything marked dirty since.
+ * Event masks are only reset here, so that they stay readable through the
+ * property getters until the next commit, as before.
+ */
+static void
+begin_commit(struct ivi_layout *layout)
+{
+	struct ivi_layout_surface *ivisurf, *surf_next;
+	struct ivi_layout_layer *ivilayer, *layer_next;
+
+	layout->commit_serial++;
+
+	wl_list_for_each_safe(ivisurf, surf_next,
+			      &layout->commit_surface_list, commit_link) {
+		ivisurf->prop.event_mask = 0;
+		wl_list_remove(&ivisurf->commit_link);
+		wl_list_init(&ivisurf->commit_link);
+	}
+
+	wl_list_for_each_safe(ivilayer, layer_next,
+			      &layout->commit_layer_list, commit_link) {
+		ivilayer->prop.event_mask = 0;
+		wl_list_remove(&ivilayer->commit_link);
+		wl_list_init(&ivilayer->commit_link);
+	}
 
-		update_prop(ivi_view);
+	wl_list_for_each_safe(ivisurf, surf_next,
+			      &layout->dirty_surface_list, dirty_link) {
+		wl_list_remove(&ivisurf->dirty_link);
+		wl_list_init(&ivisurf->dirty_link);
+		surface_mark_committed(ivisurf);
+	}
+
+	wl_list_for_each_safe(ivilayer, layer_next,
+			      &layout->dirty_layer_list, dirty_link) {
+		wl_list_remove(&ivilayer->dirty_link);
+		wl_list_init(&ivilayer->dirty_link);
+		layer_mark_committed(ivilayer);
 	}
 }
 
@@ -634,7 +842,10 @@ commit_surface_list(struct ivi_layout *layout)
 	int32_t dest_height = 0;
 	int32_t configured = 0;
 
-	wl_list_for_each(ivisurf, &layout->surface_list, link) {
+	wl_list_for_each(ivisurf, &layout->commit_surface_list, commit_link) {
+		if (ivisurf->pending.prop.visibility != ivisurf->prop.visibility)
+			layout->scene_dirty = true;
+
 		if (ivisurf->pending.prop.transition_type == IVI_LAYOUT_TRANSITION_VIEW_DEFAULT) {
 			dest_x = ivisurf->prop.dest_x;
 			dest_y = ivisurf->prop.dest_y;
@@ -732,8 +943,27 @@ commit_layer_list(struct ivi_layout *layout)
 	struct ivi_layout_view *ivi_view = NULL;
 	struct ivi_layout_layer   *ivilayer = NULL;
 	struct ivi_layout_view *next     = NULL;
+	bool hint_changed;
+
+	wl_list_for_each(ivilayer, &layout->commit_layer_list, commit_link) {
+		hint_changed =
+			ivilayer->plane_hint.preference !=
+				ivilayer->pending.plane_hint.preference ||
+			ivilayer->plane_hint.fixed_zpos !=
+				ivilayer->pending.plane_hint.fixed_zpos ||
+			ivilayer->plane_hint.zpos !=
+				ivilayer->pending.plane_hint.zpos;
+		ivilayer->plane_hint = ivilayer->pending.plane_hint;
+		if (hint_changed) {
+			wl_list_for_each(ivi_view, &ivilayer->order.view_list,
+					 order_link)
+				weston_view_set_plane_hint(ivi_view->view,
+							   &ivilayer->plane_hint);
+		}
+
+		if (ivilayer->pending.prop.visibility != ivilayer->prop.visibility)
+			layout->scene_dirty = true;
 
-	wl_list_for_each(ivilayer, &layout->layer_list, link) {
 		if (ivilayer->pending.prop.transition_type == IVI_LAYOUT_TRANSITION_LAYER_MOVE) {
 			ivi_layout_transition_move_layer(ivilayer, ivilayer->pending.prop.dest_x, ivilayer->pending.prop.dest_y, ivilayer->pending.prop.transition_duration);
 		} else if (ivilayer->pending.prop.transition_type == IVI_LAYOUT_TRANSITION_LAYER_FADE) {
@@ -755,6 +985,7 @@ commit_layer_list(struct ivi_layout *layout)
 			wl_list_remove(&ivi_view->order_link);
 			wl_list_init(&ivi_view->order_link);
 			ivi_view->ivisurf->prop.event_mask |= IVI_NOTIFICATION_REMOVE;
+			surface_mark_committed(ivi_view->ivisurf);
 		}
 
 		assert(wl_list_empty(&ivilayer->order.view_list));
@@ -764,9 +995,13 @@ commit_layer_list(struct ivi_layout *layout)
 			wl_list_remove(&ivi_view->order_link);
 			wl_list_insert(&ivilayer->order.view_list, &ivi_view->order_link);
 			ivi_view->ivisurf->prop.event_mask |= IVI_NOTIFICATION_ADD;
+			surface_mark_committed(ivi_view->ivisurf);
+			weston_view_set_plane_hint(ivi_view->view,
+						   &ivilayer->plane_hint);
 		}
 
 		ivilayer->order.dirty = 0;
+		layout->scene_dirty = true;
 	}
 }
 
@@ -785,6 +1020,7 @@ commit_screen_list(struct ivi_layout *layout)
 				wl_list_remove(&ivilayer->order.link);
 				wl_list_init(&ivilayer->order.link);
 				ivilayer->prop.event_mask |= IVI_NOTIFICATION_REMOVE;
+				layer_mark_committed(ivilayer);
 			}
 
 			assert(wl_list_empty(&iviscrn->order.layer_list));
@@ -798,9 +1034,11 @@ commit_screen_list(struct ivi_layout *layout)
 					       &ivilayer->order.link);
 				ivilayer->on_screen = iviscrn;
 				ivilayer->prop.event_mask |= IVI_NOTIFICATION_ADD;
+				layer_mark_committed(ivilayer);
 			}
 
 			iviscrn->order.dirty = 0;
+			layout->scene_dirty = true;
 		}
 	}
 }
@@ -812,6 +1050,22 @@ build_view_list(struct ivi_layout *layout)
 	struct ivi_layout_layer   *ivilayer;
 	struct ivi_layout_view   *ivi_view;
 
+	/* A view of the scene may have been unmapped behind our back, for
+	 * instance by a NULL buffer attach, and has to be put back. */
+	if (!layout->scene_dirty) {
+		wl_list_for_each(ivi_view, &layout->view_list, link) {
+			if (ivi_view_is_mapped(ivi_view) &&
+			    !weston_view_is_mapped(ivi_view->view)) {
+				layout->scene_dirty = true;
+				break;
+			}
+		}
+	}
+
+	if (!layout->scene_dirty)
+		return;
+	layout->scene_dirty = false;
+
 	/* If ivi_view is not part of the scenegrapgh, we have to unmap
 	 * weston_views
 	 */
@@ -877,12 +1131,14 @@ send_prop(struct ivi_layout *layout)
 	struct ivi_layout_layer   *ivilayer = NULL;
 	struct ivi_layout_surface *ivisurf  = NULL;
 
-	wl_list_for_each_reverse(ivilayer, &layout->layer_list, link) {
+	wl_list_for_each_reverse(ivilayer, &layout->commit_layer_list,
+				 commit_link) {
 		if (ivilayer->prop.event_mask)
 			send_layer_prop(ivilayer);
 	}
 
-	wl_list_for_each_reverse(ivisurf, &layout->surface_list, link) {
+	wl_list_for_each_reverse(ivisurf, &layout->commit_surface_list,
+				 commit_link) {
 		if (ivisurf->prop.event_mask)
 			send_surface_prop(ivisurf);
 	}
@@ -1011,30 +1267,16 @@ static struct ivi_layout_layer *
 ivi_layout_get_layer_from_id(uint32_t id_layer)
 {
 	struct ivi_layout *layout = get_instance();
-	struct ivi_layout_layer *ivilayer = NULL;
-
-	wl_list_for_each(ivilayer, &layout->layer_list, link) {
-		if (ivilayer->id_layer == id_layer) {
-			return ivilayer;
-		}
-	}
 
-	return NULL;
+	return get_layer(layout, id_layer);
 }
 
 struct ivi_layout_surface *
 ivi_layout_get_surface_from_id(uint32_t id_surface)
 {
 	struct ivi_layout *layout = get_instance();
-	struct ivi_layout_surface *ivisurf = NULL;
 
-	wl_list_for_each(ivisurf, &layout->surface_list, link) {
-		if (ivisurf->id_surface == id_surface) {
-			return ivisurf;
-		}
-	}
-
-	return NULL;
+	return get_surface(layout, id_surface);
 }
 
 static int32_t
@@ -1279,7 +1521,7 @@ ivi_layout_layer_create_with_dimension(uint32_t id_layer,
 	struct ivi_layout *layout = get_instance();
 	struct ivi_layout_layer *ivilayer = NULL;
 
-	ivilayer = get_layer(&layout->layer_list, id_layer);
+	ivilayer = get_layer(layout, id_layer);
 	if (ivilayer != NULL) {
 		weston_log("id_layer is already created\n");
 		++ivilayer->ref_count;
@@ -1305,8 +1547,11 @@ ivi_layout_layer_create_with_dimension(uint32_t id_layer,
 
 	wl_list_init(&ivilayer->order.view_list);
 	wl_list_init(&ivilayer->order.link);
+	wl_list_init(&ivilayer->dirty_link);
+	wl_list_init(&ivilayer->commit_link);
 
 	wl_list_insert(&layout->layer_list, &ivilayer->link);
+	id_table_insert(&layout->layer_ids, &ivilayer->id_entry, id_layer);
 
 	wl_signal_emit(&layout->layer_notification.created, ivilayer);
 
@@ -1338,6 +1583,10 @@ ivi_layout_layer_destroy(struct ivi_layout_layer *ivilayer)
 	wl_list_remove(&ivilayer->pending.link);
 	wl_list_remove(&ivilayer->order.link);
 	wl_list_remove(&ivilayer->link);
+	id_table_remove(&layout->layer_ids, &ivilayer->id_entry);
+	wl_list_remove(&ivilayer->dirty_link);
+	wl_list_remove(&ivilayer->commit_link);
+	layout->scene_dirty = true;
 
 	free(ivilayer);
 }
@@ -1353,6 +1602,7 @@ ivi_layout_layer_set_visibility(struct ivi_layout_layer *ivilayer,
 		return IVI_FAILED;
 	}
 
+	layer_mark_dirty(ivilayer);
 	prop = &ivilayer->pending.prop;
 	prop->visibility = newVisibility;
 
@@ -1377,6 +1627,7 @@ ivi_layout_layer_set_opacity(struct ivi_layout_layer *ivilayer,
 		return IVI_FAILED;
 	}
 
+	layer_mark_dirty(ivilayer);
 	prop = &ivilayer->pending.prop;
 	prop->opacity = opacity;
 
@@ -1400,6 +1651,7 @@ ivi_layout_layer_set_source_rectangle(struct ivi_layout_layer *ivilayer,
 		return IVI_FAILED;
 	}
 
+	layer_mark_dirty(ivilayer);
 	prop = &ivilayer->pending.prop;
 	prop->source_x = x;
 	prop->source_y = y;
@@ -1428,6 +1680,7 @@ ivi_layout_layer_set_destination_rectangle(struct ivi_layout_layer *ivilayer,
 		return IVI_FAILED;
 	}
 
+	layer_mark_dirty(ivilayer);
 	prop = &ivilayer->pending.prop;
 	prop->dest_x = x;
 	prop->dest_y = y;
@@ -1444,6 +1697,27 @@ ivi_layout_layer_set_destination_rectangle(struct ivi_layout_layer *ivilayer,
 	return IVI_SUCCEEDED;
 }
 
+static int32_t
+ivi_layout_layer_set_plane_hint(struct ivi_layout_layer *ivilayer,
+				const struct weston_view_plane_hint *hint)
+{
+	if (ivilayer == NULL) {
+		weston_log("%s: invalid argument\n", __func__);
+		return IVI_FAILED;
+	}
+
+	layer_mark_dirty(ivilayer);
+
+	ivilayer->pending.plane_hint.preference =
+		hint ? hint->preference : WESTON_VIEW_PLANE_PREFER_NONE;
+	ivilayer->pending.plane_hint.fixed_zpos = hint && hint->fixed_zpos;
+	/* Normalized, so that hints compare equal field by field. */
+	ivilayer->pending.plane_hint.zpos =
+		ivilayer->pending.plane_hint.fixed_zpos ? hint->zpos : 0;
+
+	return IVI_SUCCEEDED;
+}
+
 int32_t
 ivi_layout_layer_set_render_order(struct ivi_layout_layer *ivilayer,
 				  struct ivi_layout_surface **pSurface,
@@ -1471,6 +1745,7 @@ ivi_layout_layer_set_render_order(struct ivi_layout_layer *ivilayer,
 	}
 
 	ivilayer->order.dirty = 1;
+	layer_mark_dirty(ivilayer);
 
 	return IVI_SUCCEEDED;
 }
@@ -1486,6 +1761,7 @@ ivi_layout_surface_set_visibility(struct ivi_layout_surface *ivisurf,
 		return IVI_FAILED;
 	}
 
+	surface_mark_dirty(ivisurf);
 	prop = &ivisurf->pending.prop;
 	prop->visibility = newVisibility;
 
@@ -1510,6 +1786,7 @@ ivi_layout_surface_set_opacity(struct ivi_layout_surface *ivisurf,
 		return IVI_FAILED;
 	}
 
+	surface_mark_dirty(ivisurf);
 	prop = &ivisurf->pending.prop;
 	prop->opacity = opacity;
 
@@ -1533,6 +1810,7 @@ ivi_layout_surface_set_destination_rectangle(struct ivi_layout_surface *ivisurf,
 		return IVI_FAILED;
 	}
 
+	surface_mark_dirty(ivisurf);
 	prop = &ivisurf->pending.prop;
 	prop->start_x = prop->dest_x;
 	prop->start_y = prop->dest_y;
@@ -1732,6 +2010,7 @@ ivi_layout_layer_add_surface(struct ivi_layout_layer *ivilayer,
 	wl_list_insert(&ivilayer->pending.view_list, &ivi_view->pending_link);
 
 	ivilayer->order.dirty = 1;
+	layer_mark_dirty(ivilayer);
 
 	return IVI_SUCCEEDED;
 }
@@ -1753,6 +2032,7 @@ ivi_layout_layer_remove_surface(struct ivi_layout_layer *ivilayer,
 		wl_list_init(&ivi_view->pending_link);
 
 		ivilayer->order.dirty = 1;
+		layer_mark_dirty(ivilayer);
 	}
 }
 
@@ -1768,6 +2048,7 @@ ivi_layout_surface_set_source_rectangle(struct ivi_layout_surface *ivisurf,
 		return IVI_FAILED;
 	}
 
+	surface_mark_dirty(ivisurf);
 	prop = &ivisurf->pending.prop;
 	prop->source_x = x;
 	prop->source_y = y;
@@ -1789,6 +2070,7 @@ ivi_layout_commit_changes(void)
 {
 	struct ivi_layout *layout = get_instance();
 
+	begin_commit(layout);
 	commit_surface_list(layout);
 	commit_layer_list(layout);
 	commit_screen_list(layout);
@@ -1812,6 +2094,7 @@ ivi_layout_layer_set_transition(struct ivi_layout_layer *ivilayer,
 		return -1;
 	}
 
+	layer_mark_dirty(ivilayer);
 	ivilayer->pending.prop.transition_type = type;
 	ivilayer->pending.prop.transition_duration = duration;
 
@@ -1828,6 +2111,7 @@ ivi_layout_layer_set_fade_info(struct ivi_layout_layer* ivilayer,
 		return -1;
 	}
 
+	layer_mark_dirty(ivilayer);
 	ivilayer->pending.prop.is_fade_in = is_fade_in;
 	ivilayer->pending.prop.start_alpha = start_alpha;
 	ivilayer->pending.prop.end_alpha = end_alpha;
@@ -1846,6 +2130,7 @@ ivi_layout_surface_set_transition_duration(struct ivi_layout_surface *ivisurf,
 		return -1;
 	}
 
+	surface_mark_dirty(ivisurf);
 	prop = &ivisurf->pending.prop;
 	prop->transition_duration = duration*10;
 	return 0;
@@ -1874,13 +2159,15 @@ ivi_layout_surface_set_id(struct ivi_layout_surface *ivisurf,
 		return IVI_FAILED;
 	}
 
-	search_ivisurf = get_surface(&layout->surface_list, id_surface);
+	search_ivisurf = get_surface(layout, id_surface);
 	if (search_ivisurf) {
 		weston_log("id_surface(%d) is already created\n", id_surface);
 		return IVI_FAILED;
 	}
 
+	id_table_remove(&layout->surface_ids, &ivisurf->id_entry);
 	ivisurf->id_surface = id_surface;
+	id_table_insert(&layout->surface_ids, &ivisurf->id_entry, id_surface);
 
 	wl_signal_emit(&layout->surface_notification.created, ivisurf);
 	wl_signal_emit(&layout->surface_notification.configure_changed,
@@ -1901,6 +2188,7 @@ ivi_layout_surface_set_transition(struct ivi_layout_surface *ivisurf,
 		return -1;
 	}
 
+	surface_mark_dirty(ivisurf);
 	prop = &ivisurf->pending.prop;
 	prop->transition_type = type;
 	prop->transition_duration = duration;
@@ -1961,8 +2249,11 @@ surface_create(struct weston_surface *wl_surface, uint32_t id_surface)
 	ivisurf->pending.prop = ivisurf->prop;
 
 	wl_list_init(&ivisurf->view_list);
+	wl_list_init(&ivisurf->dirty_link);
+	wl_list_init(&ivisurf->commit_link);
 
 	wl_list_insert(&layout->surface_list, &ivisurf->link);
+	id_table_insert(&layout->surface_ids, &ivisurf->id_entry, id_surface);
 
 	return ivisurf;
 }
@@ -2002,7 +2293,7 @@ ivi_layout_surface_create(struct weston_surface *wl_surface,
 	struct ivi_layout *layout = get_instance();
 	struct ivi_layout_surface *ivisurf = NULL;
 
-	ivisurf = get_surface(&layout->surface_list, id_surface);
+	ivisurf = get_surface(layout, id_surface);
 	if (ivisurf) {
 		weston_log("id_surface(%d) is already created\n", id_surface);
 		return NULL;
@@ -2029,6 +2320,13 @@ ivi_layout_init_with_compositor(struct weston_compositor *ec)
 	wl_list_init(&layout->layer_list);
 	wl_list_init(&layout->screen_list);
 	wl_list_init(&layout->view_list);
+	id_table_init(&layout->surface_ids);
+	id_table_init(&layout->layer_ids);
+	wl_list_init(&layout->dirty_surface_list);
+	wl_list_init(&layout->dirty_layer_list);
+	wl_list_init(&layout->commit_surface_list);
+	wl_list_init(&layout->commit_layer_list);
+	layout->scene_dirty = true;
 
 	wl_signal_init(&layout->layer_notification.created);
 	wl_signal_init(&layout->layer_notification.removed);
@@ -2122,6 +2420,7 @@ static struct ivi_layout_interface ivi_layout_interface = {
 	.screen_add_layer		= ivi_layout_screen_add_layer,
 	.screen_remove_layer		= ivi_layout_screen_remove_layer,
 	.screen_set_render_order	= ivi_layout_screen_set_render_order,
+	.layer_set_plane_hint		= ivi_layout_layer_set_plane_hint,
 
 	/**
 	 * animation
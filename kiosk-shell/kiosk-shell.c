@@ -34,6 +34,7 @@
 #include "compositor/weston.h"
 #include "shared/helpers.h"
 #include "shared/shell-utils.h"
+#include "shared/timespec-util.h"
 
 #include <libweston/xwayland-api.h>
 
@@ -1035,6 +1036,40 @@ kiosk_shell_handle_output_created(struct wl_listener *listener, void *data)
 	kiosk_shell_output_create(shell, output);
 }
 
+/** Send the frame callbacks of the inactive, pre-warmed surfaces
+ *
+ * Views on the hidden inactive layer are not painted, so the repaint loop
+ * never fires their frame callbacks. Release them at a low rate instead,
+ * which lets background apps keep their content current without drawing
+ * at the output refresh rate.
+ */
+static int
+kiosk_shell_inactive_frame_timer_handler(void *data)
+{
+	struct kiosk_shell *shell = data;
+	struct weston_view *view;
+	struct wl_resource *cb, *cnext;
+	struct timespec now;
+	uint32_t now_msec;
+
+	weston_compositor_read_presentation_clock(shell->compositor, &now);
+	now_msec = timespec_to_msec(&now);
+
+	wl_list_for_each(view, &shell->inactive_layer.view_list.link,
+			 layer_link.link) {
+		wl_resource_for_each_safe(cb, cnext,
+					  &view->surface->frame_callback_list) {
+			wl_callback_send_done(cb, now_msec);
+			wl_resource_destroy(cb);
+		}
+	}
+
+	wl_event_source_timer_update(shell->inactive_frame_timer,
+				     shell->inactive_frame_interval_msec);
+
+	return 0;
+}
+
 static void
 kiosk_shell_handle_output_resized(struct wl_listener *listener, void *data)
 {
@@ -1057,6 +1092,21 @@ kiosk_shell_handle_output_resized(struct wl_listener *listener, void *data)
 			continue;
 		kiosk_shell_surface_reconfigure_for_output(shsurf);
 	}
+
+	if (shell->inactive_frame_interval_msec <= 0)
+		return;
+
+	/* Keep the background apps at the new size too, so that switching
+	 * to one of them does not wait for a configure round-trip. */
+	wl_list_for_each(view, &shell->inactive_layer.view_list.link,
+			 layer_link.link) {
+		struct kiosk_shell_surface *shsurf =
+			get_kiosk_shell_surface(view->surface);
+
+		if (!shsurf || shsurf->output != output)
+			continue;
+		kiosk_shell_surface_reconfigure_for_output(shsurf);
+	}
 }
 
 static void
@@ -1084,6 +1134,21 @@ kiosk_shell_handle_output_moved(struct wl_listener *listener, void *data)
 					 view->geometry.x + output->move_x,
 					 view->geometry.y + output->move_y);
 	}
+
+	if (shell->inactive_frame_interval_msec <= 0)
+		return;
+
+	wl_list_for_each(view, &shell->inactive_layer.view_list.link,
+			 layer_link.link) {
+		struct kiosk_shell_surface *shsurf =
+			get_kiosk_shell_surface(view->surface);
+
+		if (!shsurf || shsurf->output != output)
+			continue;
+		weston_view_set_position(view,
+					 view->geometry.x + output->move_x,
+					 view->geometry.y + output->move_y);
+	}
 }
 
 static void
@@ -1125,6 +1190,9 @@ kiosk_shell_destroy(struct wl_listener *listener, void *data)
 	wl_list_remove(&shell->seat_created_listener.link);
 	wl_list_remove(&shell->transform_listener.link);
 
+	if (shell->inactive_frame_timer)
+		wl_event_source_remove(shell->inactive_frame_timer);
+
 	wl_list_for_each_safe(shoutput, tmp, &shell->output_list, link) {
 		kiosk_shell_output_destroy(shoutput);
 	}
@@ -1152,6 +1220,7 @@ wet_shell_init(struct weston_compositor *ec,
 	struct kiosk_shell *shell;
 	struct weston_seat *seat;
 	struct weston_output *output;
+	struct weston_config_section *section;
 	const char *config_file;
 
 	shell = zalloc(sizeof *shell);
@@ -1173,6 +1242,24 @@ wet_shell_init(struct weston_compositor *ec,
 	config_file = weston_config_get_name_from_env();
 	shell->config = weston_config_parse(config_file);
 
+	section = weston_config_get_section(shell->config, "shell", NULL, NULL);
+	weston_config_section_get_int(section, "inactive-frame-interval",
+				      &shell->inactive_frame_interval_msec, 0);
+	if (shell->inactive_frame_interval_msec > 0) {
+		struct wl_event_loop *loop =
+			wl_display_get_event_loop(ec->wl_display);
+
+		shell->inactive_frame_timer =
+			wl_event_loop_add_timer(loop,
+						kiosk_shell_inactive_frame_timer_handler,
+						shell);
+		if (!shell->inactive_frame_timer)
+			shell->inactive_frame_interval_msec = 0;
+		else
+			wl_event_source_timer_update(shell->inactive_frame_timer,
+						     shell->inactive_frame_interval_msec);
+	}
+
 	weston_layer_init(&shell->background_layer, ec);
 	weston_layer_init(&shell->normal_layer, ec);
 	weston_layer_init(&shell->inactive_layer, ec);
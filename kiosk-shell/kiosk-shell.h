@@ -46,6 +46,13 @@ struct kiosk_shell {
 	struct wl_list output_list;
 	struct wl_list seat_list;
 
+	/* Pre-warmed app switching: while positive, surfaces on the inactive
+	 * layer stay configured for their output and get their frame
+	 * callbacks every inactive_frame_interval_msec, so activating one
+	 * only restacks the retained buffer. */
+	int32_t inactive_frame_interval_msec;
+	struct wl_event_source *inactive_frame_timer;
+
 	const struct weston_xwayland_surface_api *xwayland_surface_api;
 	struct weston_config *config;
 };
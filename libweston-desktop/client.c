@@ -186,6 +186,40 @@ weston_desktop_client_for_each_surface(struct weston_desktop_client *client,
 			 user_data);
 }
 
+/** Start iterating over the surfaces of a client
+ *
+ * Together with weston_desktop_client_get_next_surface(), this walks the
+ * same surfaces as weston_desktop_client_for_each_surface() without a
+ * callback, so the caller can stop early or keep its state on the stack.
+ * The client's surfaces must not be destroyed during the walk.
+ *
+ * \return The first surface, or NULL if the client has none.
+ */
+WL_EXPORT struct weston_desktop_surface *
+weston_desktop_client_get_first_surface(struct weston_desktop_client *client)
+{
+	if (wl_list_empty(&client->surface_list))
+		return NULL;
+
+	return weston_desktop_surface_from_client_link(client->surface_list.next);
+}
+
+/** Continue iterating over the surfaces of a client
+ *
+ * \return The surface after \a surface, or NULL at the end of the list.
+ */
+WL_EXPORT struct weston_desktop_surface *
+weston_desktop_client_get_next_surface(struct weston_desktop_client *client,
+				       struct weston_desktop_surface *surface)
+{
+	struct wl_list *link = weston_desktop_surface_get_client_link(surface);
+
+	if (link->next == &client->surface_list)
+		return NULL;
+
+	return weston_desktop_surface_from_client_link(link->next);
+}
+
 WL_EXPORT int
 weston_desktop_client_ping(struct weston_desktop_client *client)
 {
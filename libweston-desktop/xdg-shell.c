@@ -77,6 +77,9 @@ struct weston_desktop_xdg_surface {
 	bool configured;
 	struct wl_event_source *configure_idle;
 	struct wl_list configure_list; /* weston_desktop_xdg_surface_configure::link */
+	/* A resize configure waits for the previous one to be acked and
+	 * committed, see weston_desktop_xdg_toplevel_resize_in_flight() */
+	bool configure_throttled;
 
 	bool has_next_geometry;
 	struct weston_geometry next_geometry;
@@ -1108,11 +1111,37 @@ weston_desktop_xdg_toplevel_state_compare(struct weston_desktop_xdg_toplevel *to
 	return false;
 }
 
+/* During an interactive resize, the shell asks for a new size on every
+ * pointer motion. A client slower than the pointer would get a backlog of
+ * configures and keep acking stale sizes, so while a resize configure is
+ * unacked later sizes only update the pending state. The latest one is
+ * sent once the client has acked and committed, pacing resizes to the
+ * client's commit rate. Any state change still goes out right away.
+ */
+static bool
+weston_desktop_xdg_toplevel_resize_in_flight(struct weston_desktop_xdg_toplevel *toplevel)
+{
+	struct weston_desktop_xdg_toplevel_configure *configure;
+
+	if (!toplevel->pending.state.resizing ||
+	    wl_list_empty(&toplevel->base.configure_list))
+		return false;
+
+	configure = wl_container_of(toplevel->base.configure_list.prev,
+				    configure, base.link);
+
+	return configure->state.activated == toplevel->pending.state.activated &&
+	       configure->state.fullscreen == toplevel->pending.state.fullscreen &&
+	       configure->state.maximized == toplevel->pending.state.maximized &&
+	       configure->state.resizing;
+}
+
 static void
 weston_desktop_xdg_surface_schedule_configure(struct weston_desktop_xdg_surface *surface)
 {
 	struct wl_display *display = weston_desktop_get_display(surface->desktop);
 	struct wl_event_loop *loop = wl_display_get_event_loop(display);
+	struct weston_desktop_xdg_toplevel *toplevel;
 	bool pending_same = false;
 
 	switch (surface->role) {
@@ -1120,12 +1149,20 @@ weston_desktop_xdg_surface_schedule_configure(struct weston_desktop_xdg_surface
 		assert(0 && "not reached");
 		break;
 	case WESTON_DESKTOP_XDG_SURFACE_ROLE_TOPLEVEL:
-		pending_same = weston_desktop_xdg_toplevel_state_compare((struct weston_desktop_xdg_toplevel *) surface);
+		toplevel = (struct weston_desktop_xdg_toplevel *) surface;
+		pending_same = weston_desktop_xdg_toplevel_state_compare(toplevel);
+		if (!pending_same && surface->configure_idle == NULL &&
+		    weston_desktop_xdg_toplevel_resize_in_flight(toplevel)) {
+			surface->configure_throttled = true;
+			return;
+		}
 		break;
 	case WESTON_DESKTOP_XDG_SURFACE_ROLE_POPUP:
 		break;
 	}
 
+	surface->configure_throttled = false;
+
 	if (surface->configure_idle != NULL) {
 		if (!pending_same)
 			return;
@@ -1377,6 +1414,11 @@ weston_desktop_xdg_surface_committed(struct weston_desktop_surface *dsurface,
 		weston_desktop_xdg_popup_committed((struct weston_desktop_xdg_popup *) surface);
 		break;
 	}
+
+	/* The client caught up with the last resize, send the latest. */
+	if (surface->configure_throttled &&
+	    wl_list_empty(&surface->configure_list))
+		weston_desktop_xdg_surface_schedule_configure(surface);
 }
 
 static void
@@ -25,6 +25,7 @@
 
 #include "config.h"
 
+#include <assert.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
@@ -128,7 +129,9 @@ typedef	void (*weston_view_animation_frame_func_t)(struct weston_view_animation
 
 struct weston_view_animation {
 	struct weston_view *view;
-	struct weston_animation animation;
+	struct weston_animation_timeline *timeline;
+	size_t slot; /* index in timeline->entries */
+	int frame_counter;
 	struct weston_spring spring;
 	struct weston_transform transform;
 	struct wl_listener listener;
@@ -140,10 +143,109 @@ struct weston_view_animation {
 	void *private;
 };
 
+static struct weston_view_animation **
+timeline_entries(struct weston_animation_timeline *timeline, size_t *count)
+{
+	*count = timeline->entries.size / sizeof(struct weston_view_animation *);
+
+	return timeline->entries.data;
+}
+
+static bool
+timeline_add(struct weston_animation_timeline *timeline,
+	     struct weston_output *output,
+	     struct weston_view_animation *animation)
+{
+	struct weston_view_animation **entry;
+	size_t count;
+
+	timeline_entries(timeline, &count);
+	entry = wl_array_add(&timeline->entries, sizeof *entry);
+	if (!entry)
+		return false;
+
+	*entry = animation;
+	animation->timeline = timeline;
+	animation->slot = count;
+
+	/* The timeline only unlinks itself from its own frame hook, so that
+	 * emptying it from another animation's frame cannot pull the next
+	 * element out from under the output's list walk. */
+	if (wl_list_empty(&timeline->animation.link))
+		wl_list_insert(&output->animation_list,
+			       &timeline->animation.link);
+
+	return true;
+}
+
+static void
+timeline_remove(struct weston_view_animation *animation)
+{
+	struct weston_animation_timeline *timeline = animation->timeline;
+	struct weston_view_animation **entries;
+	size_t count;
+
+	if (!timeline)
+		return;
+
+	entries = timeline_entries(timeline, &count);
+	animation->timeline = NULL;
+
+	/* Entries may be stepping right now; leave a hole and let the
+	 * timeline compact once the pass is over. */
+	if (timeline->stepping) {
+		entries[animation->slot] = NULL;
+		timeline->has_holes = true;
+		return;
+	}
+
+	entries[animation->slot] = entries[count - 1];
+	entries[animation->slot]->slot = animation->slot;
+	timeline->entries.size -= sizeof *entries;
+}
+
+static void
+timeline_compact(struct weston_animation_timeline *timeline)
+{
+	struct weston_view_animation **entries;
+	size_t count, i, n = 0;
+
+	if (!timeline->has_holes)
+		return;
+
+	entries = timeline_entries(timeline, &count);
+	for (i = 0; i < count; i++) {
+		if (!entries[i])
+			continue;
+		entries[n] = entries[i];
+		entries[n]->slot = n;
+		n++;
+	}
+
+	timeline->entries.size = n * sizeof *entries;
+	timeline->has_holes = false;
+}
+
+static void
+schedule_repaint_mask(struct weston_compositor *compositor,
+		      uint32_t output_mask, bool all)
+{
+	struct weston_output *output;
+
+	if (all) {
+		weston_compositor_schedule_repaint(compositor);
+		return;
+	}
+
+	wl_list_for_each(output, &compositor->output_list, link)
+		if (output_mask & (1u << output->id))
+			weston_output_schedule_repaint(output);
+}
+
 WL_EXPORT void
 weston_view_animation_destroy(struct weston_view_animation *animation)
 {
-	wl_list_remove(&animation->animation.link);
+	timeline_remove(animation);
 	wl_list_remove(&animation->listener.link);
 	wl_list_remove(&animation->transform.link);
 	if (animation->reset)
@@ -164,24 +266,21 @@ handle_animation_view_destroy(struct wl_listener *listener, void *data)
 	weston_view_animation_destroy(animation);
 }
 
+/* Advance one animation and collect the outputs it needs repainted
+ * instead of scheduling them right away, so that a timeline pass asks
+ * each output only once. */
 static void
-weston_view_animation_frame(struct weston_animation *base,
-			    struct weston_output *output,
-			    const struct timespec *time)
+weston_view_animation_step(struct weston_view_animation *animation,
+			   const struct timespec *time,
+			   uint32_t *repaint_mask, bool *repaint_all)
 {
-	struct weston_view_animation *animation =
-		container_of(base,
-			     struct weston_view_animation, animation);
-	struct weston_compositor *compositor =
-		animation->view->surface->compositor;
-
-	if (base->frame_counter <= 1)
+	if (animation->frame_counter <= 1)
 		animation->spring.timestamp = *time;
 
 	weston_spring_update(&animation->spring, time);
 
 	if (weston_spring_done(&animation->spring)) {
-		weston_view_schedule_repaint(animation->view);
+		*repaint_mask |= animation->view->output_mask;
 		weston_view_animation_destroy(animation);
 		return;
 	}
@@ -190,7 +289,7 @@ weston_view_animation_frame(struct weston_animation *base,
 		animation->frame(animation);
 
 	weston_view_geometry_dirty(animation->view);
-	weston_view_schedule_repaint(animation->view);
+	*repaint_mask |= animation->view->output_mask;
 
 	/* The view's output_mask will be zero if its position is
 	 * offscreen. Animations should always run but as they are also
@@ -199,7 +298,87 @@ weston_view_animation_frame(struct weston_animation *base,
 	 * and schedule a repaint on all outputs it will be avoided.
 	 */
 	if (animation->view->output_mask == 0)
-		weston_compositor_schedule_repaint(compositor);
+		*repaint_all = true;
+}
+
+static void
+weston_animation_timeline_frame(struct weston_animation *base,
+				struct weston_output *output,
+				const struct timespec *time)
+{
+	struct weston_animation_timeline *timeline =
+		container_of(base, struct weston_animation_timeline, animation);
+	struct weston_view_animation **entries;
+	struct weston_view_animation *animation;
+	uint32_t repaint_mask = 0;
+	bool repaint_all = false;
+	size_t count, i;
+
+	/* Animations started from a done callback join on the next frame,
+	 * as they did when each was its own list element. */
+	timeline_entries(timeline, &count);
+
+	timeline->stepping = true;
+	for (i = 0; i < count; i++) {
+		/* Re-read: wl_array_add() may have moved the storage. */
+		entries = timeline->entries.data;
+		animation = entries[i];
+		if (!animation)
+			continue;
+
+		animation->frame_counter++;
+		weston_view_animation_step(animation, time,
+					   &repaint_mask, &repaint_all);
+	}
+	timeline->stepping = false;
+	timeline_compact(timeline);
+
+	if (timeline->entries.size == 0) {
+		wl_list_remove(&base->link);
+		wl_list_init(&base->link);
+	}
+
+	schedule_repaint_mask(output->compositor, repaint_mask, repaint_all);
+}
+
+void
+weston_output_init_view_timeline(struct weston_output *output)
+{
+	struct weston_animation_timeline *timeline = &output->view_timeline;
+
+	timeline->animation.frame = weston_animation_timeline_frame;
+	timeline->animation.frame_counter = 0;
+	wl_list_init(&timeline->animation.link);
+	wl_array_init(&timeline->entries);
+	timeline->stepping = false;
+	timeline->has_holes = false;
+}
+
+/** Finish the view animations of an output that is going away
+ *
+ * They would never be stepped again, so run them to completion now,
+ * which resets their views and calls their done callbacks.
+ */
+void
+weston_output_release_view_timeline(struct weston_output *output)
+{
+	struct weston_animation_timeline *timeline = &output->view_timeline;
+	struct weston_view_animation **entries;
+	size_t count;
+
+	assert(!timeline->stepping);
+
+	for (;;) {
+		entries = timeline_entries(timeline, &count);
+		if (count == 0)
+			break;
+		weston_view_animation_destroy(entries[count - 1]);
+	}
+
+	wl_list_remove(&timeline->animation.link);
+	wl_list_init(&timeline->animation.link);
+	wl_array_release(&timeline->entries);
+	wl_array_init(&timeline->entries);
 }
 
 static void
@@ -240,16 +419,15 @@ weston_view_animation_create(struct weston_view *view,
 	wl_list_insert(&view->geometry.transformation_list,
 		       &animation->transform.link);
 
-	animation->animation.frame = weston_view_animation_frame;
+	animation->timeline = NULL;
+	animation->frame_counter = 0;
 
 	animation->listener.notify = handle_animation_view_destroy;
 	wl_signal_add(&view->destroy_signal, &animation->listener);
 
-	if (view->output) {
-		wl_list_insert(&view->output->animation_list,
-			       &animation->animation.link);
-	} else {
-		wl_list_init(&animation->animation.link);
+	if (!view->output ||
+	    !timeline_add(&view->output->view_timeline, view->output,
+			  animation)) {
 		loop = wl_display_get_event_loop(ec->wl_display);
 		wl_event_loop_add_idle(loop, idle_animation_destroy, animation);
 	}
@@ -260,10 +438,16 @@ weston_view_animation_create(struct weston_view *view,
 static void
 weston_view_animation_run(struct weston_view_animation *animation)
 {
+	struct weston_compositor *compositor =
+		animation->view->surface->compositor;
 	struct timespec zero_time = { 0 };
+	uint32_t repaint_mask = 0;
+	bool repaint_all = false;
 
-	animation->animation.frame_counter = 0;
-	weston_view_animation_frame(&animation->animation, NULL, &zero_time);
+	animation->frame_counter = 0;
+	weston_view_animation_step(animation, &zero_time,
+				   &repaint_mask, &repaint_all);
+	schedule_repaint_mask(compositor, repaint_mask, repaint_all);
 }
 
 static void
@@ -0,0 +1,320 @@
+/*
+ * Copyright © 2022 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+
+#include "drm-internal.h"
+#include "shared/helpers.h"
+#include "presentation-time-server-protocol.h"
+
+struct drm_commit_job {
+	struct wl_list link; /* drm_commit_thread::queue or ::done */
+
+	drmModeAtomicReq *req;
+	uint32_t flags;
+
+	/* struct drm_output *, whose states the commit carries */
+	struct wl_array outputs;
+
+	int ret;
+	int err;
+};
+
+/**
+ * A thread making non-blocking atomic commits on behalf of the main loop
+ *
+ * Some drivers still wait for fences or for the previous flip inside a
+ * DRM_MODE_ATOMIC_NONBLOCK commit. The main loop compiles the request
+ * and assigns the new output states right away, as if the commit went
+ * through; page flip events arrive on the DRM fd as usual. Only a
+ * refused commit comes back here, to finish the frame and force a fresh
+ * state on the next repaint.
+ */
+struct drm_commit_thread {
+	struct drm_backend *backend;
+
+	pthread_t thread;
+	pthread_mutex_t lock;
+	/* signalled on new jobs and on each completed one */
+	pthread_cond_t cond;
+
+	/* Protected by lock */
+	struct wl_list queue;
+	struct wl_list done;
+	bool busy;
+	bool quit;
+
+	int done_fd;
+	struct wl_event_source *done_source;
+};
+
+static void
+drm_commit_job_destroy(struct drm_commit_job *job)
+{
+	drmModeAtomicFree(job->req);
+	wl_array_release(&job->outputs);
+	free(job);
+}
+
+static void *
+drm_commit_thread_func(void *data)
+{
+	struct drm_commit_thread *ct = data;
+	struct drm_commit_job *job;
+	uint64_t value = 1;
+
+	pthread_mutex_lock(&ct->lock);
+	for (;;) {
+		while (wl_list_empty(&ct->queue) && !ct->quit)
+			pthread_cond_wait(&ct->cond, &ct->lock);
+		if (wl_list_empty(&ct->queue))
+			break;
+
+		job = container_of(ct->queue.next, struct drm_commit_job, link);
+		wl_list_remove(&job->link);
+		ct->busy = true;
+		pthread_mutex_unlock(&ct->lock);
+
+		job->ret = drmModeAtomicCommit(ct->backend->drm.fd, job->req,
+					       job->flags, ct->backend);
+		job->err = errno;
+
+		pthread_mutex_lock(&ct->lock);
+		ct->busy = false;
+		wl_list_insert(ct->done.prev, &job->link);
+		pthread_cond_broadcast(&ct->cond);
+
+		/* Only fails if the counter overflowed, which wakes the
+		 * main loop just as well. */
+		if (write(ct->done_fd, &value, sizeof value) < 0)
+			continue;
+	}
+	pthread_mutex_unlock(&ct->lock);
+
+	return NULL;
+}
+
+static void
+drm_commit_job_failed(struct drm_commit_thread *ct, struct drm_commit_job *job)
+{
+	struct drm_backend *b = ct->backend;
+	struct drm_output **output;
+	struct timespec now;
+
+	weston_log("atomic: couldn't commit new state: %s\n",
+		   strerror(job->err));
+
+	/* The states were assigned as if the commit went through. */
+	b->state_invalid = true;
+
+	wl_array_for_each(output, &job->outputs) {
+		(*output)->plane_cache.valid = false;
+		if (!(*output)->atomic_complete_pending)
+			continue;
+
+		(*output)->atomic_complete_pending = false;
+		weston_compositor_read_presentation_clock(b->compositor, &now);
+		drm_output_update_complete(*output,
+					   WP_PRESENTATION_FEEDBACK_INVALID,
+					   now.tv_sec, now.tv_nsec / 1000);
+	}
+}
+
+static void
+drm_commit_thread_reap(struct drm_commit_thread *ct)
+{
+	struct drm_commit_job *job, *tmp;
+	struct wl_list done;
+	uint64_t value;
+
+	wl_list_init(&done);
+
+	pthread_mutex_lock(&ct->lock);
+	wl_list_insert_list(&done, &ct->done);
+	wl_list_init(&ct->done);
+	if (read(ct->done_fd, &value, sizeof value) < 0 && errno != EAGAIN)
+		weston_log("atomic: failed to read commit thread events: %s\n",
+			   strerror(errno));
+	pthread_mutex_unlock(&ct->lock);
+
+	wl_list_for_each_safe(job, tmp, &done, link) {
+		if (job->ret != 0)
+			drm_commit_job_failed(ct, job);
+		wl_list_remove(&job->link);
+		drm_commit_job_destroy(job);
+	}
+}
+
+static int
+drm_commit_thread_done(int fd, uint32_t mask, void *data)
+{
+	drm_commit_thread_reap(data);
+
+	return 0;
+}
+
+/**
+ * Hand a compiled atomic request to the commit thread
+ *
+ * On success the thread owns req. The caller goes on to assign the output
+ * states of pending_state as for a successful commit.
+ *
+ * \return 0 on success, -1 if the request must be committed directly.
+ */
+int
+drm_commit_thread_queue(struct drm_commit_thread *ct, drmModeAtomicReq *req,
+			uint32_t flags, struct drm_pending_state *pending_state)
+{
+	struct drm_output_state *output_state;
+	struct drm_output **output;
+	struct drm_commit_job *job;
+
+	job = zalloc(sizeof *job);
+	if (!job)
+		return -1;
+
+	wl_array_init(&job->outputs);
+	wl_list_for_each(output_state, &pending_state->output_list, link) {
+		output = wl_array_add(&job->outputs, sizeof *output);
+		if (!output) {
+			wl_array_release(&job->outputs);
+			free(job);
+			return -1;
+		}
+		*output = output_state->output;
+	}
+
+	job->req = req;
+	job->flags = flags;
+
+	pthread_mutex_lock(&ct->lock);
+	wl_list_insert(ct->queue.prev, &job->link);
+	pthread_cond_broadcast(&ct->cond);
+	pthread_mutex_unlock(&ct->lock);
+
+	return 0;
+}
+
+/**
+ * Wait for all queued commits to reach the kernel
+ *
+ * Called before committing from the main loop, so commits hit the kernel
+ * in the order they were made, and before giving up the DRM device.
+ */
+void
+drm_commit_thread_flush(struct drm_commit_thread *ct)
+{
+	pthread_mutex_lock(&ct->lock);
+	while (!wl_list_empty(&ct->queue) || ct->busy)
+		pthread_cond_wait(&ct->cond, &ct->lock);
+	pthread_mutex_unlock(&ct->lock);
+
+	drm_commit_thread_reap(ct);
+}
+
+struct drm_commit_thread *
+drm_commit_thread_create(struct drm_backend *b)
+{
+	struct drm_commit_thread *ct;
+	struct wl_event_loop *loop;
+	sigset_t set, oldset;
+	int ret;
+
+	ct = zalloc(sizeof *ct);
+	if (!ct)
+		return NULL;
+
+	ct->backend = b;
+	wl_list_init(&ct->queue);
+	wl_list_init(&ct->done);
+
+	ct->done_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (ct->done_fd < 0)
+		goto err_free;
+
+	loop = weston_compositor_get_priority_loop(b->compositor,
+						   WESTON_EVENT_PRIORITY_FLIP);
+	ct->done_source = wl_event_loop_add_fd(loop, ct->done_fd,
+					       WL_EVENT_READABLE,
+					       drm_commit_thread_done, ct);
+	if (!ct->done_source)
+		goto err_fd;
+
+	pthread_mutex_init(&ct->lock, NULL);
+	pthread_cond_init(&ct->cond, NULL);
+
+	/* Signals are handled by the main loop only. */
+	sigfillset(&set);
+	pthread_sigmask(SIG_SETMASK, &set, &oldset);
+	ret = pthread_create(&ct->thread, NULL, drm_commit_thread_func, ct);
+	pthread_sigmask(SIG_SETMASK, &oldset, NULL);
+	if (ret != 0) {
+		weston_log("atomic: failed to start commit thread: %s\n",
+			   strerror(ret));
+		goto err_source;
+	}
+
+	return ct;
+
+err_source:
+	pthread_cond_destroy(&ct->cond);
+	pthread_mutex_destroy(&ct->lock);
+	wl_event_source_remove(ct->done_source);
+err_fd:
+	close(ct->done_fd);
+err_free:
+	free(ct);
+	return NULL;
+}
+
+void
+drm_commit_thread_destroy(struct drm_commit_thread *ct)
+{
+	drm_commit_thread_flush(ct);
+
+	pthread_mutex_lock(&ct->lock);
+	ct->quit = true;
+	pthread_cond_broadcast(&ct->cond);
+	pthread_mutex_unlock(&ct->lock);
+	pthread_join(ct->thread, NULL);
+
+	pthread_cond_destroy(&ct->cond);
+	pthread_mutex_destroy(&ct->lock);
+	wl_event_source_remove(ct->done_source);
+	close(ct->done_fd);
+	free(ct);
+}
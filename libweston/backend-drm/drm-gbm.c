@@ -29,6 +29,7 @@
 
 #include "config.h"
 
+#include <assert.h>
 #include <errno.h>
 #include <stdint.h>
 #include <stdlib.h>
@@ -68,6 +69,47 @@ create_gbm_device(int fd)
 	return gbm;
 }
 
+static void
+destroy_gbm_devices(struct drm_backend *b)
+{
+	if (b->render.gbm)
+		gbm_device_destroy(b->render.gbm);
+	b->render.gbm = NULL;
+
+	if (b->gbm)
+		gbm_device_destroy(b->gbm);
+	b->gbm = NULL;
+}
+
+/* The KMS device always gets a GBM device, for cursors and for importing
+ * buffers to scan out. With render offload, the renderer gets its own. */
+static int
+create_gbm_devices(struct drm_backend *b)
+{
+	b->gbm = create_gbm_device(b->drm.fd);
+	if (!b->gbm)
+		return -1;
+
+	if (b->render.fd < 0)
+		return 0;
+
+	b->render.gbm = create_gbm_device(b->render.fd);
+	if (!b->render.gbm) {
+		weston_log("failed to create gbm device for %s\n",
+			   b->render.filename);
+		destroy_gbm_devices(b);
+		return -1;
+	}
+
+	return 0;
+}
+
+static struct gbm_device *
+render_gbm_device(struct drm_backend *b)
+{
+	return b->render.gbm ? b->render.gbm : b->gbm;
+}
+
 /* When initializing EGL, if the preferred buffer format isn't available
  * we may be able to substitute an ARGB format for an XRGB one.
  *
@@ -100,7 +142,7 @@ drm_backend_create_gl_renderer(struct drm_backend *b)
 	};
 	struct gl_renderer_display_options options = {
 		.egl_platform = EGL_PLATFORM_GBM_KHR,
-		.egl_native_display = b->gbm,
+		.egl_native_display = render_gbm_device(b),
 		.egl_surface_type = EGL_WINDOW_BIT,
 		.drm_formats = format,
 		.drm_formats_count = 2,
@@ -118,20 +160,23 @@ drm_backend_create_gl_renderer(struct drm_backend *b)
 int
 init_egl(struct drm_backend *b)
 {
-	b->gbm = create_gbm_device(b->drm.fd);
-
-	if (!b->gbm)
+	if (create_gbm_devices(b) < 0)
 		return -1;
 
 	if (drm_backend_create_gl_renderer(b) < 0) {
-		gbm_device_destroy(b->gbm);
-		b->gbm = NULL;
+		destroy_gbm_devices(b);
 		return -1;
 	}
 
 	return 0;
 }
 
+void
+fini_egl(struct drm_backend *b)
+{
+	destroy_gbm_devices(b);
+}
+
 static void drm_output_fini_cursor_egl(struct drm_output *output)
 {
 	unsigned int i;
@@ -139,9 +184,38 @@ static void drm_output_fini_cursor_egl(struct drm_output *output)
 	for (i = 0; i < ARRAY_LENGTH(output->gbm_cursor_fb); i++) {
 		drm_fb_unref(output->gbm_cursor_fb[i]);
 		output->gbm_cursor_fb[i] = NULL;
+		output->gbm_cursor_last_use[i] = 0;
 	}
 }
 
+/** Allocate the cursor BO in slot index of the output's cursor cache */
+int
+drm_output_create_cursor_bo(struct drm_output *output, unsigned int index)
+{
+	struct drm_backend *b = output->backend;
+	struct gbm_bo *bo;
+
+	assert(index < ARRAY_LENGTH(output->gbm_cursor_fb));
+	assert(!output->gbm_cursor_fb[index]);
+
+	bo = gbm_bo_create(b->gbm, b->cursor_width, b->cursor_height,
+			   GBM_FORMAT_ARGB8888,
+			   GBM_BO_USE_CURSOR | GBM_BO_USE_WRITE);
+	if (!bo)
+		return -1;
+
+	output->gbm_cursor_fb[index] =
+		drm_fb_get_from_bo(bo, b, false, BUFFER_CURSOR);
+	if (!output->gbm_cursor_fb[index]) {
+		gbm_bo_destroy(bo);
+		return -1;
+	}
+	output->gbm_cursor_handle[index] = gbm_bo_get_handle(bo).s32;
+	output->gbm_cursor_last_use[index] = 0;
+
+	return 0;
+}
+
 static int
 drm_output_init_cursor_egl(struct drm_output *output, struct drm_backend *b)
 {
@@ -151,22 +225,11 @@ drm_output_init_cursor_egl(struct drm_output *output, struct drm_backend *b)
 	if (!output->cursor_plane)
 		return 0;
 
-	for (i = 0; i < ARRAY_LENGTH(output->gbm_cursor_fb); i++) {
-		struct gbm_bo *bo;
-
-		bo = gbm_bo_create(b->gbm, b->cursor_width, b->cursor_height,
-				   GBM_FORMAT_ARGB8888,
-				   GBM_BO_USE_CURSOR | GBM_BO_USE_WRITE);
-		if (!bo)
+	/* Two BOs to flip between; more are added as the cursor image
+	 * cycles through different content. */
+	for (i = 0; i < 2; i++) {
+		if (drm_output_create_cursor_bo(output, i) < 0)
 			goto err;
-
-		output->gbm_cursor_fb[i] =
-			drm_fb_get_from_bo(bo, b, false, BUFFER_CURSOR);
-		if (!output->gbm_cursor_fb[i]) {
-			gbm_bo_destroy(bo);
-			goto err;
-		}
-		output->gbm_cursor_handle[i] = gbm_bo_get_handle(bo).s32;
 	}
 
 	return 0;
@@ -178,9 +241,164 @@ err:
 	return -1;
 }
 
+/* Render offload: the buffers are allocated by the render device but
+ * scanned out by the KMS device, so an implicit modifier means nothing to
+ * the latter. Offer the render device the plane's explicit modifiers to
+ * choose from, and use linear buffers if it cannot use any of them. */
+static void
+create_gbm_surface_offload(struct gbm_device *gbm, struct drm_output *output,
+			   struct weston_drm_format *fmt)
+{
+	struct weston_mode *mode = output->base.current_mode;
+#ifdef HAVE_GBM_MODIFIERS
+	const uint64_t *modifiers;
+	uint64_t *explicit_mods;
+	unsigned int num_modifiers;
+	unsigned int num_explicit = 0;
+	unsigned int i;
+
+	modifiers = weston_drm_format_get_modifiers(fmt, &num_modifiers);
+	explicit_mods = zalloc((num_modifiers + 1) * sizeof(*explicit_mods));
+	if (explicit_mods) {
+		for (i = 0; i < num_modifiers; i++) {
+			if (modifiers[i] != DRM_FORMAT_MOD_INVALID)
+				explicit_mods[num_explicit++] = modifiers[i];
+		}
+		if (num_explicit == 0)
+			explicit_mods[num_explicit++] = DRM_FORMAT_MOD_LINEAR;
+
+		output->gbm_surface =
+			gbm_surface_create_with_modifiers(gbm,
+							  mode->width, mode->height,
+							  output->gbm_format,
+							  explicit_mods, num_explicit);
+		free(explicit_mods);
+	}
+#endif
+
+	if (!output->gbm_surface)
+		output->gbm_surface = gbm_surface_create(gbm,
+							 mode->width, mode->height,
+							 output->gbm_format,
+							 GBM_BO_USE_RENDERING |
+							 GBM_BO_USE_LINEAR);
+}
+
+#ifdef HAVE_GBM_MODIFIERS
+/* Whether the scanout plane of the output takes a full screen buffer
+ * allocated from the given modifiers, as a TEST_ONLY commit says. */
+static bool
+drm_output_scanout_takes_modifiers(struct gbm_device *gbm,
+				   struct drm_output *output,
+				   const uint64_t *modifiers,
+				   unsigned int count)
+{
+	struct drm_backend *b = to_drm_backend(output->base.compositor);
+	struct weston_mode *mode = output->base.current_mode;
+	struct drm_pending_state *pending_state;
+	struct drm_output_state *state;
+	struct drm_plane_state *scanout_state;
+	struct gbm_bo *bo;
+	struct drm_fb *fb;
+	int ret;
+
+	if (!b->atomic_modeset)
+		return true;
+
+	bo = gbm_bo_create_with_modifiers(gbm, mode->width, mode->height,
+					  output->gbm_format, modifiers, count);
+	if (!bo)
+		return false;
+
+	/* Destroyed along with its bo, like a client buffer. */
+	fb = drm_fb_get_from_bo(bo, b, false, BUFFER_CLIENT);
+	if (!fb) {
+		gbm_bo_destroy(bo);
+		return false;
+	}
+
+	pending_state = drm_pending_state_alloc(b);
+	state = drm_output_state_duplicate(output->state_cur, pending_state,
+					   DRM_OUTPUT_STATE_CLEAR_PLANES);
+	state->dpms = WESTON_DPMS_ON;
+
+	scanout_state = drm_output_state_get_plane(state,
+						   output->scanout_plane);
+	scanout_state->fb = fb;
+	scanout_state->output = output;
+	scanout_state->src_w = fb->width << 16;
+	scanout_state->src_h = fb->height << 16;
+	scanout_state->dest_w = mode->width;
+	scanout_state->dest_h = mode->height;
+
+	ret = drm_pending_state_test(pending_state);
+	drm_pending_state_free(pending_state);
+
+	drm_debug(b, "\t[%s] scanout of modifier 0x%llx %s\n",
+		  output->base.name, (unsigned long long) fb->modifier,
+		  ret == 0 ? "passed test" : "failed test");
+
+	return ret == 0;
+}
+
+/**
+ * Allocate the output buffers in the best layout scanout can take
+ *
+ * Compressed and tiled layouts cut the memory bandwidth of scanning out
+ * and rendering, which adds up on large outputs. Each class of the scanout
+ * plane's modifiers is tried from the best on, and only taken once a
+ * TEST_ONLY commit showed the plane accepts it; linear comes last.
+ */
+static void
+create_gbm_surface_ranked(struct gbm_device *gbm, struct drm_output *output,
+			  struct weston_drm_format *fmt)
+{
+	struct drm_backend *b = to_drm_backend(output->base.compositor);
+	struct weston_mode *mode = output->base.current_mode;
+	const uint64_t *modifiers;
+	uint64_t *ranked;
+	unsigned int num_modifiers, count, i;
+	int rank;
+
+	modifiers = weston_drm_format_get_modifiers(fmt, &num_modifiers);
+	ranked = zalloc(num_modifiers * sizeof(*ranked));
+	if (!ranked)
+		return;
+
+	for (rank = DRM_MODIFIER_RANK_COMPRESSED;
+	     rank >= DRM_MODIFIER_RANK_LINEAR && !output->gbm_surface; rank--) {
+		count = 0;
+		for (i = 0; i < num_modifiers; i++) {
+			if ((int) drm_modifier_rank(modifiers[i]) == rank)
+				ranked[count++] = modifiers[i];
+		}
+		if (count == 0)
+			continue;
+
+		if (rank != DRM_MODIFIER_RANK_LINEAR &&
+		    !drm_output_scanout_takes_modifiers(gbm, output,
+							ranked, count))
+			continue;
+
+		output->gbm_surface =
+			gbm_surface_create_with_modifiers(gbm,
+							  mode->width, mode->height,
+							  output->gbm_format,
+							  ranked, count);
+		if (output->gbm_surface)
+			drm_debug(b, "\t[%s] allocating from %u modifiers "
+				  "of rank %d\n", output->base.name, count,
+				  rank);
+	}
+
+	free(ranked);
+}
+#endif
+
 static void
 create_gbm_surface(struct gbm_device *gbm, struct drm_output *output)
 {
+	struct drm_backend *b = to_drm_backend(output->base.compositor);
 	struct weston_mode *mode = output->base.current_mode;
 	struct drm_plane *plane = output->scanout_plane;
 	struct weston_drm_format *fmt;
@@ -195,8 +413,17 @@ create_gbm_surface(struct gbm_device *gbm, struct drm_output *output)
 		return;
 	}
 
+	if (b->render.gbm) {
+		create_gbm_surface_offload(gbm, output, fmt);
+		return;
+	}
+
 #ifdef HAVE_GBM_MODIFIERS
-	if (!weston_drm_format_has_modifier(fmt, DRM_FORMAT_MOD_INVALID)) {
+	if (!weston_drm_format_has_modifier(fmt, DRM_FORMAT_MOD_INVALID))
+		create_gbm_surface_ranked(gbm, output, fmt);
+
+	if (!output->gbm_surface &&
+	    !weston_drm_format_has_modifier(fmt, DRM_FORMAT_MOD_INVALID)) {
 		modifiers = weston_drm_format_get_modifiers(fmt, &num_modifiers);
 		output->gbm_surface =
 			gbm_surface_create_with_modifiers(gbm,
@@ -235,7 +462,7 @@ drm_output_init_egl(struct drm_output *output, struct drm_backend *b)
 	};
 
 	assert(output->gbm_surface == NULL);
-	create_gbm_surface(b->gbm, output);
+	create_gbm_surface(render_gbm_device(b), output);
 	if (!output->gbm_surface) {
 		weston_log("failed to create gbm surface\n");
 		return -1;
@@ -276,6 +503,55 @@ drm_output_fini_egl(struct drm_output *output)
 	drm_output_fini_cursor_egl(output);
 }
 
+/**
+ * Reallocate the output buffers for a new mode size
+ *
+ * Only the GBM surface and the EGL surface drawing into it are replaced;
+ * the GL output state and the cursor BOs stay. On failure the output
+ * keeps its old buffers.
+ */
+int
+drm_output_resize_egl(struct drm_output *output, struct drm_backend *b)
+{
+	struct gbm_surface *old_surface = output->gbm_surface;
+	uint32_t format[2] = {
+		output->gbm_format,
+		fallback_format_for(output->gbm_format),
+	};
+	struct gl_renderer_output_options options = {
+		.drm_formats = format,
+		.drm_formats_count = 1,
+	};
+
+	if (!gl_renderer->output_window_resize)
+		return -1;
+
+	output->gbm_surface = NULL;
+	create_gbm_surface(render_gbm_device(b), output);
+	if (!output->gbm_surface) {
+		output->gbm_surface = old_surface;
+		return -1;
+	}
+
+	if (options.drm_formats[1])
+		options.drm_formats_count = 2;
+	options.window_for_legacy = (EGLNativeWindowType) output->gbm_surface;
+	options.window_for_platform = output->gbm_surface;
+	if (gl_renderer->output_window_resize(&output->base, &options) < 0) {
+		gbm_surface_destroy(output->gbm_surface);
+		output->gbm_surface = old_surface;
+		return -1;
+	}
+
+	/* As in drm_output_fini_egl(), the buffers go with their surface. */
+	if (output->scanout_plane->state_cur->fb &&
+	    output->scanout_plane->state_cur->fb->type == BUFFER_GBM_SURFACE)
+		drm_plane_reset_state(output->scanout_plane);
+	gbm_surface_destroy(old_surface);
+
+	return 0;
+}
+
 struct drm_fb *
 drm_output_render_gl(struct drm_output_state *state, pixman_region32_t *damage)
 {
@@ -287,6 +563,10 @@ drm_output_render_gl(struct drm_output_state *state, pixman_region32_t *damage)
 	output->base.compositor->renderer->repaint_output(&output->base,
 							  damage);
 
+	/* The renderer drew into the virtual output's own buffer. */
+	if (output->virtual_buffer)
+		return drm_fb_ref(output->virtual_buffer->fb);
+
 	bo = gbm_surface_lock_front_buffer(output->gbm_surface);
 	if (!bo) {
 		weston_log("failed to lock front buffer: %s\n",
@@ -295,7 +575,10 @@ drm_output_render_gl(struct drm_output_state *state, pixman_region32_t *damage)
 	}
 
 	/* The renderer always produces an opaque image. */
-	ret = drm_fb_get_from_bo(bo, b, true, BUFFER_GBM_SURFACE);
+	if (b->render.gbm)
+		ret = drm_fb_get_from_render_bo(bo, b);
+	else
+		ret = drm_fb_get_from_bo(bo, b, true, BUFFER_GBM_SURFACE);
 	if (!ret) {
 		weston_log("failed to get drm_fb for bo\n");
 		gbm_surface_release_buffer(output->gbm_surface, bo);
@@ -322,8 +605,7 @@ switch_to_gl_renderer(struct drm_backend *b)
 
 	weston_log("Switching to GL renderer\n");
 
-	b->gbm = create_gbm_device(b->drm.fd);
-	if (!b->gbm) {
+	if (create_gbm_devices(b) < 0) {
 		weston_log("Failed to create gbm device. "
 			   "Aborting renderer switch\n");
 		return;
@@ -335,7 +617,7 @@ switch_to_gl_renderer(struct drm_backend *b)
 	b->compositor->renderer->destroy(b->compositor);
 
 	if (drm_backend_create_gl_renderer(b) < 0) {
-		gbm_device_destroy(b->gbm);
+		destroy_gbm_devices(b);
 		weston_log("Failed to create GL renderer. Quitting.\n");
 		/* FIXME: we need a function to shutdown cleanly */
 		assert(0);
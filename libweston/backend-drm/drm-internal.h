@@ -59,6 +59,7 @@
 #include "libinput-seat.h"
 #include "backend.h"
 #include "libweston-internal.h"
+#include "frame-stats.h"
 
 #ifndef GBM_BO_USE_CURSOR
 #define GBM_BO_USE_CURSOR GBM_BO_USE_CURSOR_64X64
@@ -72,6 +73,10 @@
 #define DRM_PLANE_ZPOS_INVALID_PLANE	0xffffffffffffffffULL
 #endif
 
+#ifndef DRM_CAP_ATOMIC_ASYNC_PAGE_FLIP
+#define DRM_CAP_ATOMIC_ASYNC_PAGE_FLIP	0x15
+#endif
+
 /**
  * A small wrapper to print information into the 'drm-backend' debug scope.
  *
@@ -106,10 +111,17 @@
  * possible type and use a matching format specifier.
  */
 #define drm_debug(b, ...) \
-	weston_log_scope_printf((b)->debug, __VA_ARGS__)
+	weston_log_scope_lazy_printf((b)->debug, __VA_ARGS__)
 
 #define MAX_CLONED_CONNECTORS 4
 
+/* Cursor BOs per output, reused for repeating cursor images */
+#define DRM_CURSOR_CACHE_SIZE 8
+
+/* Source framebuffers a virtual mirror keeps imported, enough for the
+ * buffers of a GBM surface */
+#define DRM_MIRROR_CACHE_SIZE 4
+
 
 /**
  * Represents the values of an enum-type KMS property
@@ -162,6 +174,11 @@ enum wdrm_plane_property {
 	WDRM_PLANE_IN_FENCE_FD,
 	WDRM_PLANE_FB_DAMAGE_CLIPS,
 	WDRM_PLANE_ZPOS,
+	WDRM_PLANE_COLOR_ENCODING,
+	WDRM_PLANE_COLOR_RANGE,
+	WDRM_PLANE_ROTATION,
+	WDRM_PLANE_ALPHA,
+	WDRM_PLANE_BLEND_MODE,
 	WDRM_PLANE__COUNT
 };
 
@@ -175,6 +192,53 @@ enum wdrm_plane_type {
 	WDRM_PLANE_TYPE__COUNT
 };
 
+/**
+ * Possible values for the WDRM_PLANE_COLOR_ENCODING property.
+ */
+enum wdrm_plane_color_encoding {
+	WDRM_PLANE_COLOR_ENCODING_BT601 = 0,
+	WDRM_PLANE_COLOR_ENCODING_BT709,
+	WDRM_PLANE_COLOR_ENCODING_BT2020,
+	WDRM_PLANE_COLOR_ENCODING__COUNT
+};
+
+/**
+ * Possible values for the WDRM_PLANE_COLOR_RANGE property.
+ */
+enum wdrm_plane_color_range {
+	WDRM_PLANE_COLOR_RANGE_LIMITED = 0,
+	WDRM_PLANE_COLOR_RANGE_FULL,
+	WDRM_PLANE_COLOR_RANGE__COUNT
+};
+
+/**
+ * Possible values for the WDRM_PLANE_ROTATION property.
+ */
+enum wdrm_plane_rotation {
+	WDRM_PLANE_ROTATION_0 = 0,
+	WDRM_PLANE_ROTATION_90,
+	WDRM_PLANE_ROTATION_180,
+	WDRM_PLANE_ROTATION_270,
+	WDRM_PLANE_ROTATION_REFLECT_X,
+	WDRM_PLANE_ROTATION_REFLECT_Y,
+	WDRM_PLANE_ROTATION__COUNT
+};
+
+/**
+ * Value of the WDRM_PLANE_ALPHA property for a fully opaque plane.
+ */
+#define DRM_PLANE_ALPHA_OPAQUE 0xffff
+
+/**
+ * Possible values for the WDRM_PLANE_BLEND_MODE property.
+ */
+enum wdrm_plane_blend_mode {
+	WDRM_PLANE_BLEND_MODE_NONE = 0,
+	WDRM_PLANE_BLEND_MODE_PREMULTI,
+	WDRM_PLANE_BLEND_MODE_COVERAGE,
+	WDRM_PLANE_BLEND_MODE__COUNT
+};
+
 /**
  * List of properties attached to a DRM connector
  */
@@ -186,6 +250,10 @@ enum wdrm_connector_property {
 	WDRM_CONNECTOR_CONTENT_PROTECTION,
 	WDRM_CONNECTOR_HDCP_CONTENT_TYPE,
 	WDRM_CONNECTOR_PANEL_ORIENTATION,
+	WDRM_CONNECTOR_VRR_CAPABLE,
+	WDRM_CONNECTOR_WRITEBACK_PIXEL_FORMATS,
+	WDRM_CONNECTOR_WRITEBACK_FB_ID,
+	WDRM_CONNECTOR_WRITEBACK_OUT_FENCE_PTR,
 	WDRM_CONNECTOR__COUNT
 };
 
@@ -224,6 +292,13 @@ enum wdrm_panel_orientation {
 enum wdrm_crtc_property {
 	WDRM_CRTC_MODE_ID = 0,
 	WDRM_CRTC_ACTIVE,
+	WDRM_CRTC_OUT_FENCE_PTR,
+	WDRM_CRTC_DEGAMMA_LUT,
+	WDRM_CRTC_DEGAMMA_LUT_SIZE,
+	WDRM_CRTC_CTM,
+	WDRM_CRTC_GAMMA_LUT,
+	WDRM_CRTC_GAMMA_LUT_SIZE,
+	WDRM_CRTC_VRR_ENABLED,
 	WDRM_CRTC__COUNT
 };
 
@@ -236,8 +311,25 @@ enum try_view_on_plane_failure_reasons {
 	FAILURE_REASONS_FB_FORMAT_INCOMPATIBLE = (1 << 1),
 	FAILURE_REASONS_DMABUF_MODIFIER_INVALID = (1 << 2),
 	FAILURE_REASONS_ADD_FB_FAILED = (1 << 3),
+	FAILURE_REASONS_FB_MODIFIER_INCOMPATIBLE = (1 << 4),
+	FAILURE_REASONS_FB_SIZE_INCOMPATIBLE = (1 << 5),
+	FAILURE_REASONS_ZPOS_INCOMPATIBLE = (1 << 6),
+	FAILURE_REASONS_PLANES_REJECTED = (1 << 7),
+	FAILURE_REASONS_TRANSFORM_INCOMPATIBLE = (1 << 8),
+	FAILURE_REASONS_SCALING_INCOMPATIBLE = (1 << 9),
+	FAILURE_REASONS_FENCE_INCOMPATIBLE = (1 << 10),
+	FAILURE_REASONS_TEST_FAILED = (1 << 11),
 };
 
+#define FAILURE_REASONS__COUNT 12
+
+/* Failures a client can fix by reallocating from the scanout tranche. */
+#define FAILURE_REASONS_SCANOUT_FIXABLE \
+	(FAILURE_REASONS_FB_FORMAT_INCOMPATIBLE | \
+	 FAILURE_REASONS_FB_MODIFIER_INCOMPATIBLE | \
+	 FAILURE_REASONS_DMABUF_MODIFIER_INVALID | \
+	 FAILURE_REASONS_ADD_FB_FAILED)
+
 /**
  * We use this to keep track of actions we need to do with the dma-buf feedback
  * in order to keep it up-to-date with the info we get from the DRM-backend.
@@ -258,6 +350,19 @@ struct drm_backend {
 	struct udev_monitor *udev_monitor;
 	struct wl_event_source *udev_drm_source;
 
+	/* Hotplug uevents come in bursts; they are collected here and
+	 * handled together once the burst is over. */
+	struct {
+		struct wl_event_source *timer;
+		struct udev_device *device;	/**< latest event */
+		bool all_connectors;
+		struct wl_array connectors;	/**< uint32_t connector ids */
+	} hotplug;
+
+	/* Finishes the first frame of every output waiting for its first
+	 * modeset at once, see drm_output_defer_first_frame() */
+	struct wl_event_source *first_frame_idle;
+
 	struct {
 		int id;
 		int fd;
@@ -265,6 +370,16 @@ struct drm_backend {
 		dev_t devnum;
 	} drm;
 	struct gbm_device *gbm;
+
+	/* Render offload: the GL renderer runs on a separate device, and
+	 * its frames are imported into 'gbm' above for scanout. fd is -1
+	 * and gbm is NULL when the KMS device renders itself. */
+	struct {
+		int fd;
+		char *filename;
+		dev_t devnum;
+		struct gbm_device *gbm;
+	} render;
 	struct wl_listener session_listener;
 	uint32_t gbm_format;
 
@@ -278,9 +393,26 @@ struct drm_backend {
 	struct wl_list plane_list;
 	uint32_t next_plane_idx;
 
+	/* drm_fbs of released client dmabufs, most recently released
+	 * first, reused if the client wraps the same memory again */
+	struct wl_list dmabuf_fb_cache;
+	unsigned int dmabuf_fb_cache_len;
+
+	/* Mode property blobs of destroyed drm_modes and parsed EDIDs,
+	 * most recently used first, so that a monitor coming back does
+	 * not need new blobs nor another parse */
+	struct wl_list mode_blob_cache;
+	unsigned int mode_blob_cache_len;
+	struct wl_list edid_cache;
+	unsigned int edid_cache_len;
+
 	void *repaint_data;
 
 	bool state_invalid;
+	/* CRTC and connector routing is still ours, but another DRM
+	 * master may have left planes enabled: the next commit disables
+	 * every plane it does not use, without a modeset. */
+	bool planes_invalid;
 
 	/* drm_crtc::link */
 	struct wl_list crtc_list;
@@ -295,6 +427,10 @@ struct drm_backend {
 
 	bool use_pixman;
 	bool use_pixman_shadow;
+	uint32_t pixman_repaint_threads;
+
+	char *recorder_output;
+	uint32_t recorder_queue_depth;
 
 	struct udev_input input;
 
@@ -302,6 +438,12 @@ struct drm_backend {
 	int32_t cursor_height;
 
 	uint32_t pageflip_timeout;
+	bool pageflip_timeout_recovery;
+
+	bool cursor_late_latch;
+	/* drm_cursor_latch::link, one per seat */
+	struct wl_list cursor_latch_list;
+	struct wl_listener seat_created_listener;
 
 	bool shutting_down;
 
@@ -309,7 +451,17 @@ struct drm_backend {
 
 	bool fb_modifiers;
 
+	/* DRM_MODE_PAGE_FLIP_ASYNC works with the modesetting API in use */
+	bool async_page_flip;
+
+	/* Makes non-blocking atomic commits off the main loop, or NULL */
+	struct drm_commit_thread *commit_thread;
+
 	struct weston_log_scope *debug;
+	struct weston_log_scope *plane_stats_scope;
+	struct weston_log_scope *flip_stats_scope;
+	/* adds the plane and flip counters to weston_compositor_write_metrics() */
+	struct wl_listener metrics_listener;
 };
 
 struct drm_mode {
@@ -325,6 +477,16 @@ enum drm_fb_type {
 	BUFFER_PIXMAN_DUMB, /**< internal Pixman rendering */
 	BUFFER_GBM_SURFACE, /**< internal EGL rendering */
 	BUFFER_CURSOR, /**< internal cursor buffer */
+	BUFFER_VIRTUAL, /**< render target of a virtual output */
+};
+
+/**
+ * Memory bandwidth classes of buffer layouts, best last
+ */
+enum drm_modifier_rank {
+	DRM_MODIFIER_RANK_LINEAR = 0, /**< linear, or an implicit layout */
+	DRM_MODIFIER_RANK_TILED,
+	DRM_MODIFIER_RANK_COMPRESSED,
 };
 
 struct drm_fb {
@@ -342,18 +504,31 @@ struct drm_fb {
 	int width, height;
 	int fd;
 
+	/* Only meaningful for YUV formats */
+	enum wdrm_plane_color_encoding color_encoding;
+	enum wdrm_plane_color_range color_range;
+
 	uint32_t plane_mask;
 
 	/* Used by gbm fbs */
 	struct gbm_bo *bo;
 	struct gbm_surface *gbm_surface;
+	/* Render offload: the render device's bo that bo was imported from,
+	 * returned to gbm_surface on release */
+	struct gbm_bo *render_bo;
 
 	/* Used by dumb fbs */
 	void *map;
+
+	/* Used by virtual fbs, cleared when the buffer is destroyed */
+	struct weston_drm_virtual_buffer *virtual_buffer;
 };
 
 struct drm_buffer_fb {
+	struct drm_backend *backend;
 	struct drm_fb *fb;
+	/* set if fb was imported from a client dmabuf */
+	struct linux_dmabuf_buffer *dmabuf;
 	enum try_view_on_plane_failure_reasons failure_reasons;
 	struct wl_listener buffer_destroy_listener;
 };
@@ -392,7 +567,15 @@ struct drm_output_state {
 	struct wl_list link;
 	enum dpms_enum dpms;
 	enum weston_hdcp_protection protection;
+	bool vrr_enabled;
+	/* Flip without waiting for the vertical blank */
+	bool async_flip;
 	struct wl_list plane_list;
+
+	/* Filled in by the kernel through OUT_FENCE_PTR when the commit
+	 * releases client buffers with explicit sync; signals once the
+	 * CRTC has switched to this state */
+	int out_fence_fd;
 };
 
 /**
@@ -432,6 +615,17 @@ struct drm_plane_state {
 
 	uint64_t zpos;
 
+	/* bitmask for the rotation property, 0 for the plane default */
+	uint64_t rotation;
+
+	/* value for the alpha property, DRM_PLANE_ALPHA_OPAQUE unless the
+	 * view is translucent, e.g. during a fade */
+	uint16_t alpha;
+
+	/* how the plane blends its pixels, premultiplied unless the
+	 * buffer content is opaque */
+	enum wdrm_plane_blend_mode blend_mode;
+
 	bool complete;
 
 	/* We don't own the fd, so we shouldn't close it */
@@ -439,6 +633,9 @@ struct drm_plane_state {
 
 	uint32_t damage_blob_id; /* damage to kernel */
 
+	/* The renderer had nothing to draw and kept the fb on screen. */
+	bool fb_reused;
+
 	struct wl_list link; /* drm_output_state::plane_list */
 };
 
@@ -476,6 +673,19 @@ struct drm_plane {
 	uint64_t zpos_min;
 	uint64_t zpos_max;
 
+	/* Scaling ratios in 16.16 fixed point, up- and downscaling
+	 * respectively: the largest one a TEST_ONLY commit accepted, and
+	 * the smallest one it refused, UINT32_MAX while none was. */
+	struct {
+		uint32_t max_ok[2];
+		uint32_t min_fail[2];
+	} scaling;
+
+	/* Client view last scanned out here, its next surface damage is
+	 * relative to what the plane shows and can become damage clips */
+	struct weston_view *damage_view;
+	struct wl_listener damage_view_destroy_listener;
+
 	struct wl_list link;
 
 	struct weston_drm_format_array formats;
@@ -499,6 +709,30 @@ struct drm_writeback {
 
 	struct drm_backend *backend;
 	struct drm_connector connector;
+
+	/* Bitmask of drm_crtc::pipe the connector can be routed to */
+	uint32_t possible_crtcs;
+	/* WRITEBACK_PIXEL_FORMATS */
+	uint32_t *formats;
+	unsigned int formats_count;
+
+	/* Output capturing through, or still routed to, this connector */
+	struct drm_output *output;
+};
+
+/** One frame captured by a writeback connector into a dumb buffer */
+struct drm_writeback_capture {
+	struct drm_output *output;
+	struct drm_writeback *writeback;
+	struct drm_fb *fb;
+
+	/* Set once a non-test commit carried the capture */
+	bool committed;
+	int out_fence_fd;
+	struct wl_event_source *fence_source;
+
+	weston_drm_capture_done_func_t done;
+	void *data;
 };
 
 struct drm_head {
@@ -512,6 +746,8 @@ struct drm_head {
 
 	drmModeModeInfo inherited_mode;	/**< Original mode on the connector */
 	uint32_t inherited_crtc_id;	/**< Original CRTC assignment */
+
+	bool vrr_capable;
 };
 
 struct drm_crtc {
@@ -527,6 +763,10 @@ struct drm_crtc {
 
 	/* Holds the properties for the CRTC */
 	struct drm_property_info props_crtc[WDRM_CRTC__COUNT];
+
+	/* Entries in the color management LUTs, 0 if unsupported */
+	uint32_t degamma_lut_size;
+	uint32_t gamma_lut_size;
 };
 
 struct drm_output {
@@ -540,8 +780,13 @@ struct drm_output {
 	bool disable_pending;
 	bool dpms_off_pending;
 
-	uint32_t gbm_cursor_handle[2];
-	struct drm_fb *gbm_cursor_fb[2];
+	/* Cursor BOs, created on demand and looked up by the hash of the
+	 * image they hold, see drm_output_prepare_cursor_view() */
+	uint32_t gbm_cursor_handle[DRM_CURSOR_CACHE_SIZE];
+	struct drm_fb *gbm_cursor_fb[DRM_CURSOR_CACHE_SIZE];
+	uint64_t gbm_cursor_hash[DRM_CURSOR_CACHE_SIZE];
+	uint64_t gbm_cursor_last_use[DRM_CURSOR_CACHE_SIZE]; /* 0: no image */
+	uint64_t gbm_cursor_use_count;
 	struct drm_plane *cursor_plane;
 	struct weston_view *cursor_view;
 	struct wl_listener cursor_view_destroy_listener;
@@ -551,6 +796,33 @@ struct drm_output {
 	uint32_t gbm_format;
 	uint32_t gbm_bo_flags;
 
+	/* Variable refresh rate allowed by the configuration */
+	bool vrr_allowed;
+
+	/* Lower refresh rate after timeout_msec without a repaint, see
+	 * drm_output_idle_refresh_timeout() */
+	struct {
+		uint32_t timeout_msec;
+		struct wl_event_source *timer;
+		bool active;
+		/* the repaint turning it on is under way */
+		bool entering;
+		/* in a temporary lower refresh mode rather than VRR */
+		bool mode_switched;
+	} idle_refresh;
+	/* Show the framebuffer of the output named mirror_of instead of
+	 * compositing, see drm_output_render_mirror() */
+	char *mirror_of;
+	/* The enabled output mirror_of was found as */
+	struct drm_output *mirror_source;
+	/* The driver rejected an asynchronous flip, do not try again */
+	bool async_flip_refused;
+	/* The CRTC already scans out our mode from whoever had the device
+	 * before us, so the first commit need not be a modeset */
+	bool seamless_handoff;
+	/* Waiting for first_frame_idle to start the repaint loop */
+	bool first_frame_deferred;
+
 	/* Plane being displayed directly on the CRTC */
 	struct drm_plane *scanout_plane;
 
@@ -563,16 +835,93 @@ struct drm_output {
 	struct drm_fb *dumb[2];
 	pixman_image_t *image[2];
 	int current_image;
-	pixman_region32_t previous_damage;
+	/* Global damage accumulated since image[i] was last painted */
+	pixman_region32_t image_damage[2];
 
 	struct vaapi_recorder *recorder;
 	struct wl_listener recorder_frame_listener;
+	/* The recorder takes its frames from writeback, planes stay on */
+	bool recorder_writeback;
+
+	/* Capture waiting for, or carried by, the last commit */
+	struct drm_writeback_capture *capture;
+	/* Writeback connector routed to the CRTC, detached by the next
+	 * commit without a capture */
+	struct drm_writeback *writeback_routed;
 
 	struct wl_event_source *pageflip_timer;
 
+	/* Page flip timing, printed by the drm-flip-stats scope */
+	struct {
+		struct timespec submitted;	/* CLOCK_MONOTONIC */
+		/* the vblank the pending flip is expected at */
+		struct timespec predicted;
+		bool predicted_valid;
+		/* commit to flip completion */
+		struct weston_frame_histogram latency;
+		uint64_t late;
+		uint64_t timeouts;
+		uint64_t recoveries;
+		unsigned int consecutive_timeouts;
+		/* a timed out flip was given up on, its event may still come */
+		bool abandoned;
+	} flip_stats;
+
+	/* Blobs realizing base.from_blend_to_output on the CRTC, when
+	 * base.from_blend_to_output_by_backend; 0 for identity stages */
+	uint32_t degamma_lut_blob_id;
+	uint32_t ctm_blob_id;
+	uint32_t gamma_lut_blob_id;
+
+	/* Outcome of the last drm_assign_planes(), keyed on everything
+	 * the plane assignment depends on. */
+	struct {
+		bool valid;
+		uint64_t key;
+		int mode; /* enum drm_output_propose_state_mode */
+		uint64_t min_plane_value;
+	} plane_cache;
+
+	/* Plane assignment counters, printed by the drm-plane-stats scope */
+	struct {
+		uint64_t frames;
+		uint64_t modes[3]; /* by enum drm_output_propose_state_mode */
+		uint64_t test_commits;
+		uint64_t views_on_planes;
+		uint64_t views_on_renderer;
+		/* renderer views by bit of try_view_on_plane_failure_reasons */
+		uint64_t failures[FAILURE_REASONS__COUNT];
+	} plane_stats;
+
 	bool virtual;
 
 	submit_frame_cb virtual_submit_frame;
+
+	/* struct weston_drm_virtual_buffer::link */
+	struct wl_list virtual_buffer_list;
+	struct weston_drm_virtual_buffer *virtual_buffer;
+
+	/* Backend-owned render queue, allocated while enabled */
+	unsigned int virtual_queue_depth;
+	struct weston_drm_virtual_buffer **virtual_queue;
+	unsigned int virtual_queue_next;
+
+	/* Framebuffers of the mirror source wrapped as render targets of
+	 * the source, for a virtual mirror to blit from */
+	struct {
+		struct drm_fb *fb;
+		struct gl_renderer_dmabuf_target *target;
+	} mirror_cache[DRM_MIRROR_CACHE_SIZE];
+	unsigned int mirror_cache_next;
+};
+
+struct weston_drm_virtual_buffer {
+	struct drm_output *output;
+	struct drm_fb *fb;
+	struct gl_renderer_dmabuf_target *target;
+	/* submitted to the owner and not yet released */
+	bool busy;
+	struct wl_list link;
 };
 
 static inline struct drm_head *
@@ -621,22 +970,24 @@ drm_crtc_find(struct drm_backend *b, uint32_t crtc_id);
 struct drm_head *
 drm_head_find_by_connector(struct drm_backend *backend, uint32_t connector_id);
 
+int
+drm_plane_get_rotation(struct drm_plane *plane,
+			enum wl_output_transform transform,
+			uint64_t *rotation);
+
 static inline bool
 drm_view_transform_supported(struct weston_view *ev, struct weston_output *output)
 {
-	struct weston_buffer_viewport *viewport = &ev->surface->buffer_viewport;
-
 	/* This will incorrectly disallow cases where the combination of
 	 * buffer and view transformations match the output transform.
 	 * Fixing this requires a full analysis of the transformation
-	 * chain. */
+	 * chain. Mismatching buffer and output transforms are left to
+	 * the plane rotation property, see
+	 * drm_plane_state_coords_for_view(). */
 	if (ev->transform.enabled &&
 	    ev->transform.matrix.type >= WESTON_MATRIX_TRANSFORM_ROTATE)
 		return false;
 
-	if (viewport->buffer.transform != output->transform)
-		return false;
-
 	return true;
 }
 
@@ -652,6 +1003,9 @@ update_head_from_connector(struct drm_head *head);
 void
 drm_mode_list_destroy(struct drm_backend *backend, struct wl_list *mode_list);
 
+void
+drm_mode_cache_flush(struct drm_backend *backend);
+
 void
 drm_output_print_modes(struct drm_output *output);
 
@@ -681,6 +1035,8 @@ void
 drm_property_info_free(struct drm_property_info *info, int num_props);
 
 extern struct drm_property_enum_info plane_type_enums[];
+extern struct drm_property_enum_info plane_color_encoding_enums[];
+extern struct drm_property_enum_info plane_color_range_enums[];
 extern const struct drm_property_info plane_props[];
 extern struct drm_property_enum_info dpms_state_enums[];
 extern struct drm_property_enum_info content_protection_enums[];
@@ -693,20 +1049,44 @@ init_kms_caps(struct drm_backend *b);
 
 int
 drm_pending_state_test(struct drm_pending_state *pending_state);
+bool
+drm_backend_try_restore_state(struct drm_backend *b);
 int
 drm_pending_state_apply(struct drm_pending_state *pending_state);
 int
 drm_pending_state_apply_sync(struct drm_pending_state *pending_state);
 
+struct drm_commit_thread *
+drm_commit_thread_create(struct drm_backend *b);
+void
+drm_commit_thread_destroy(struct drm_commit_thread *ct);
+int
+drm_commit_thread_queue(struct drm_commit_thread *ct, drmModeAtomicReq *req,
+			uint32_t flags, struct drm_pending_state *pending_state);
+void
+drm_commit_thread_flush(struct drm_commit_thread *ct);
+
 void
 drm_output_set_gamma(struct weston_output *output_base,
 		     uint16_t size, uint16_t *r, uint16_t *g, uint16_t *b);
 
+void
+drm_output_offload_color_transform(struct drm_output *output);
+void
+drm_output_fini_color_transform(struct drm_output *output);
+
 void
 drm_output_update_msc(struct drm_output *output, unsigned int seq);
 void
 drm_output_update_complete(struct drm_output *output, uint32_t flags,
 			   unsigned int sec, unsigned int usec);
+void
+drm_output_flip_submitted(struct drm_output *output);
+bool
+drm_output_flip_completed(struct drm_output *output, bool pending,
+			  unsigned int sec, unsigned int usec);
+void
+drm_flip_stats_print_cb(struct weston_log_subscription *sub, void *data);
 int
 on_drm_input(int fd, uint32_t mask, void *data);
 
@@ -721,10 +1101,24 @@ drm_fb_create_dumb(struct drm_backend *b, int width, int height,
 struct drm_fb *
 drm_fb_get_from_bo(struct gbm_bo *bo, struct drm_backend *backend,
 		   bool is_opaque, enum drm_fb_type type);
+struct drm_fb *
+drm_fb_get_from_render_bo(struct gbm_bo *render_bo,
+			  struct drm_backend *backend);
 
 void
 drm_output_set_cursor_view(struct drm_output *output, struct weston_view *ev);
 
+void
+drm_plane_set_damage_view(struct drm_plane *plane, struct weston_view *ev);
+
+void
+drm_backend_init_cursor_latch(struct drm_backend *b);
+void
+drm_backend_fini_cursor_latch(struct drm_backend *b);
+
+enum drm_modifier_rank
+drm_modifier_rank(uint64_t modifier);
+
 #ifdef BUILD_DRM_GBM
 extern struct drm_fb *
 drm_fb_get_from_view(struct drm_output_state *state, struct weston_view *ev,
@@ -732,6 +1126,11 @@ drm_fb_get_from_view(struct drm_output_state *state, struct weston_view *ev,
 extern bool
 drm_can_scanout_dmabuf(struct weston_compositor *ec,
 		       struct linux_dmabuf_buffer *dmabuf);
+uint32_t
+drm_fb_plane_failure_reason(struct drm_backend *b, struct drm_fb *fb,
+			    struct drm_plane *plane);
+void
+drm_fb_cache_flush(struct drm_backend *b);
 #else
 static inline struct drm_fb *
 drm_fb_get_from_view(struct drm_output_state *state, struct weston_view *ev,
@@ -745,6 +1144,16 @@ drm_can_scanout_dmabuf(struct weston_compositor *ec,
 {
 	return false;
 }
+static inline uint32_t
+drm_fb_plane_failure_reason(struct drm_backend *b, struct drm_fb *fb,
+			    struct drm_plane *plane)
+{
+	return FAILURE_REASONS_FB_FORMAT_INCOMPATIBLE;
+}
+static inline void
+drm_fb_cache_flush(struct drm_backend *b)
+{
+}
 #endif
 
 struct drm_pending_state *
@@ -801,38 +1210,91 @@ drm_plane_reset_state(struct drm_plane *plane);
 void
 drm_assign_planes(struct weston_output *output_base, void *repaint_data);
 
+void
+drm_plane_stats_print_cb(struct weston_log_subscription *sub, void *data);
+
+void
+drm_plane_stats_write_metrics(struct weston_metrics *m, struct drm_backend *b);
+
 bool
 drm_plane_is_available(struct drm_plane *plane, struct drm_output *output);
 
 void
 drm_output_render(struct drm_output_state *state, pixman_region32_t *damage);
 
+bool
+drm_output_is_mirrored(struct drm_output *output);
+
+struct drm_fb *
+drm_output_mirror_source_fb(struct drm_output *output,
+			    struct drm_pending_state *pending_state);
+
 int
 parse_gbm_format(const char *s, uint32_t default_value, uint32_t *gbm_format);
 
 extern struct gl_renderer_interface *gl_renderer;
 
+void
+drm_writeback_update_caps(struct drm_writeback *writeback,
+			  drmModeConnector *conn);
+
+void
+drm_writeback_fini_caps(struct drm_writeback *writeback);
+
+bool
+drm_output_writeback_supported(struct drm_output *output);
+
+int
+drm_output_capture_writeback(struct weston_output *output_base,
+			     weston_drm_capture_done_func_t done, void *data);
+
+void
+drm_output_writeback_committed(struct drm_output_state *state);
+
+void
+drm_output_writeback_fini(struct drm_output *output);
+
+int
+drm_backend_init_writeback_capture_api(struct weston_compositor *compositor);
+
 #ifdef BUILD_DRM_VIRTUAL
 extern int
 drm_backend_init_virtual_output_api(struct weston_compositor *compositor);
+
+void
+drm_virtual_output_mirror_cache_flush(struct drm_output *output);
 #else
 inline static int
 drm_backend_init_virtual_output_api(struct weston_compositor *compositor)
 {
 	return 0;
 }
+
+inline static void
+drm_virtual_output_mirror_cache_flush(struct drm_output *output)
+{
+}
 #endif
 
 #ifdef BUILD_DRM_GBM
 int
 init_egl(struct drm_backend *b);
 
+void
+fini_egl(struct drm_backend *b);
+
 int
 drm_output_init_egl(struct drm_output *output, struct drm_backend *b);
 
 void
 drm_output_fini_egl(struct drm_output *output);
 
+int
+drm_output_resize_egl(struct drm_output *output, struct drm_backend *b);
+
+int
+drm_output_create_cursor_bo(struct drm_output *output, unsigned int index);
+
 struct drm_fb *
 drm_output_render_gl(struct drm_output_state *state, pixman_region32_t *damage);
 
@@ -847,6 +1309,11 @@ init_egl(struct drm_backend *b)
 	return -1;
 }
 
+inline static void
+fini_egl(struct drm_backend *b)
+{
+}
+
 inline static int
 drm_output_init_egl(struct drm_output *output, struct drm_backend *b)
 {
@@ -858,6 +1325,12 @@ drm_output_fini_egl(struct drm_output *output)
 {
 }
 
+inline static int
+drm_output_resize_egl(struct drm_output *output, struct drm_backend *b)
+{
+	return -1;
+}
+
 inline static struct drm_fb *
 drm_output_render_gl(struct drm_output_state *state, pixman_region32_t *damage)
 {
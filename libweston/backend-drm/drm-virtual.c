@@ -34,12 +34,24 @@
 #include <stdlib.h>
 #include <ctype.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "drm-internal.h"
 #include "renderer-gl/gl-renderer.h"
+#include "linux-dmabuf.h"
 
 #define POISON_PTR ((void *)8)
 
+static int
+drm_virtual_output_set_render_buffer(struct weston_output *output_base,
+				     struct weston_drm_virtual_buffer *buffer);
+
+static void
+drm_virtual_output_destroy_queue(struct drm_output *output);
+
+static int
+drm_virtual_output_create_queue(struct drm_output *output);
+
 /**
  * Create a drm_crtc for virtual output
  *
@@ -179,10 +191,184 @@ drm_virtual_output_submit_frame(struct drm_output *output,
 	if (ret < 0) {
 		drm_fb_unref(fb);
 		close(fd);
+	} else if (fb->virtual_buffer) {
+		fb->virtual_buffer->busy = true;
 	}
 	return ret;
 }
 
+/** Pick the queue buffer to render the next frame into
+ *
+ * Buffers are handed out round robin, skipping those the owner still
+ * holds, so the one chosen is the least recently submitted free buffer.
+ */
+static struct weston_drm_virtual_buffer *
+drm_virtual_output_queue_get_free(struct drm_output *output)
+{
+	struct weston_drm_virtual_buffer *buffer;
+	unsigned int i, idx;
+
+	for (i = 0; i < output->virtual_queue_depth; i++) {
+		idx = (output->virtual_queue_next + i) %
+		      output->virtual_queue_depth;
+		buffer = output->virtual_queue[idx];
+		if (!buffer->busy) {
+			output->virtual_queue_next = idx + 1;
+			return buffer;
+		}
+	}
+
+	return NULL;
+}
+
+/* Wrap a framebuffer of the mirror source as a render target of the
+ * source, so it can be blitted from. */
+static struct gl_renderer_dmabuf_target *
+drm_virtual_mirror_target_create(struct drm_output *source, struct drm_fb *fb)
+{
+	struct drm_backend *b = to_drm_backend(source->base.compositor);
+	struct gl_renderer_dmabuf_target *target = NULL;
+	struct dmabuf_attributes attributes = { 0 };
+	int i;
+
+	attributes.width = fb->width;
+	attributes.height = fb->height;
+	attributes.format = fb->format->format;
+	attributes.n_planes = fb->num_planes;
+	for (i = 0; i < fb->num_planes; i++) {
+		attributes.offset[i] = fb->offsets[i];
+		attributes.stride[i] = fb->strides[i];
+		attributes.modifier[i] = fb->modifier;
+		if (drmPrimeHandleToFD(b->drm.fd, fb->handles[i], DRM_CLOEXEC,
+				       &attributes.fd[i]) < 0) {
+			attributes.fd[i] = -1;
+			goto out;
+		}
+	}
+
+	target = gl_renderer->output_dmabuf_target_create(&source->base,
+							  &attributes);
+
+out:
+	for (i = 0; i < fb->num_planes; i++) {
+		if (attributes.fd[i] >= 0)
+			close(attributes.fd[i]);
+	}
+
+	return target;
+}
+
+/** Forget the source framebuffers a virtual mirror has imported
+ *
+ * Called before the targets go away with the source's renderer output.
+ */
+void
+drm_virtual_output_mirror_cache_flush(struct drm_output *output)
+{
+	unsigned int i;
+
+	for (i = 0; i < DRM_MIRROR_CACHE_SIZE; i++) {
+		if (output->mirror_cache[i].target)
+			gl_renderer->output_dmabuf_target_destroy(
+				output->mirror_cache[i].target);
+		output->mirror_cache[i].target = NULL;
+		output->mirror_cache[i].fb = NULL;
+	}
+	output->mirror_cache_next = 0;
+}
+
+/* Only the GBM surface buffers of the source live as long as it does;
+ * anything else is imported for a single frame. */
+static struct gl_renderer_dmabuf_target *
+drm_virtual_mirror_get_target(struct drm_output *output, struct drm_fb *fb,
+			      bool *cached)
+{
+	struct drm_output *source = output->mirror_source;
+	struct gl_renderer_dmabuf_target *target;
+	unsigned int i;
+
+	*cached = fb->type == BUFFER_GBM_SURFACE;
+	if (!*cached)
+		return drm_virtual_mirror_target_create(source, fb);
+
+	for (i = 0; i < DRM_MIRROR_CACHE_SIZE; i++) {
+		if (output->mirror_cache[i].fb == fb)
+			return output->mirror_cache[i].target;
+	}
+
+	target = drm_virtual_mirror_target_create(source, fb);
+	if (!target)
+		return NULL;
+
+	i = output->mirror_cache_next;
+	output->mirror_cache_next = (i + 1) % DRM_MIRROR_CACHE_SIZE;
+	if (output->mirror_cache[i].target)
+		gl_renderer->output_dmabuf_target_destroy(
+			output->mirror_cache[i].target);
+	output->mirror_cache[i].fb = fb;
+	output->mirror_cache[i].target = target;
+
+	return target;
+}
+
+/** Copy what the mirror source shows into a buffer of a virtual mirror
+ *
+ * The GPU blit scales to the mirror's mode; the scene is not repainted.
+ * Frames go into the render queue if there is one, else into the buffer
+ * set with set_render_buffer().
+ */
+static int
+drm_virtual_output_render_mirror(struct drm_output_state *state)
+{
+	struct drm_output *output = state->output;
+	struct drm_backend *b = to_drm_backend(output->base.compositor);
+	struct weston_drm_virtual_buffer *buffer;
+	struct gl_renderer_dmabuf_target *src;
+	struct drm_plane_state *scanout_state;
+	struct drm_fb *fb;
+	bool cached;
+	int ret;
+
+	fb = drm_output_mirror_source_fb(output, state->pending_state);
+	if (!fb)
+		return -1;
+
+	if (output->virtual_queue)
+		buffer = drm_virtual_output_queue_get_free(output);
+	else
+		buffer = output->virtual_buffer;
+	if (!buffer || !buffer->target) {
+		drm_debug(b, "\t[mirror] %s: no buffer to copy into\n",
+			  output->base.name);
+		return -1;
+	}
+
+	src = drm_virtual_mirror_get_target(output, fb, &cached);
+	if (!src)
+		return -1;
+
+	ret = gl_renderer->dmabuf_target_blit(src, buffer->target);
+	if (!cached)
+		gl_renderer->output_dmabuf_target_destroy(src);
+	if (ret < 0)
+		return -1;
+
+	scanout_state = drm_output_state_get_plane(state,
+						   output->scanout_plane);
+	scanout_state->fb = drm_fb_ref(buffer->fb);
+	scanout_state->output = output;
+	scanout_state->src_x = 0;
+	scanout_state->src_y = 0;
+	scanout_state->src_w = buffer->fb->width << 16;
+	scanout_state->src_h = buffer->fb->height << 16;
+	scanout_state->dest_x = 0;
+	scanout_state->dest_y = 0;
+	scanout_state->dest_w = buffer->fb->width;
+	scanout_state->dest_h = buffer->fb->height;
+
+	return 0;
+}
+
 static int
 drm_virtual_output_repaint(struct weston_output *output_base,
 			   pixman_region32_t *damage,
@@ -200,7 +386,20 @@ drm_virtual_output_repaint(struct weston_output *output_base,
 		goto err;
 
 	/* Drop frame if there isn't free buffers */
-	if (!gbm_surface_has_free_buffers(output->gbm_surface)) {
+	if (output_base->mirror) {
+		/* picked by drm_virtual_output_render_mirror() */
+	} else if (output->virtual_queue) {
+		struct weston_drm_virtual_buffer *buffer;
+
+		buffer = drm_virtual_output_queue_get_free(output);
+		if (!buffer ||
+		    drm_virtual_output_set_render_buffer(output_base,
+							 buffer) < 0) {
+			weston_log("%s: Drop frame!!\n", __func__);
+			return -1;
+		}
+	} else if (!output->virtual_buffer &&
+		   !gbm_surface_has_free_buffers(output->gbm_surface)) {
 		weston_log("%s: Drop frame!!\n", __func__);
 		return -1;
 	}
@@ -216,7 +415,12 @@ drm_virtual_output_repaint(struct weston_output *output_base,
 						   pending_state,
 						   DRM_OUTPUT_STATE_CLEAR_PLANES);
 
-	drm_output_render(state, damage);
+	if (output_base->mirror) {
+		if (drm_virtual_output_render_mirror(state) < 0)
+			goto err;
+	} else {
+		drm_output_render(state, damage);
+	}
 	scanout_state = drm_output_state_get_plane(state, scanout_plane);
 	if (!scanout_state || !scanout_state->fb)
 		goto err;
@@ -235,6 +439,17 @@ static void
 drm_virtual_output_deinit(struct weston_output *base)
 {
 	struct drm_output *output = to_drm_output(base);
+	struct weston_drm_virtual_buffer *buffer;
+
+	drm_virtual_output_mirror_cache_flush(output);
+	output->mirror_source = NULL;
+	drm_virtual_output_destroy_queue(output);
+
+	/* The renderer targets go away with the renderer output; the buffers
+	 * themselves stay valid until their owner destroys them. */
+	output->virtual_buffer = NULL;
+	wl_list_for_each(buffer, &output->virtual_buffer_list, link)
+		buffer->target = NULL;
 
 	drm_output_fini_egl(output);
 
@@ -256,6 +471,7 @@ drm_virtual_output_destroy(struct weston_output *base)
 
 	drm_output_state_free(output->state_cur);
 
+	free(output->mirror_of);
 	free(output);
 }
 
@@ -289,6 +505,12 @@ drm_virtual_output_enable(struct weston_output *output_base)
 		goto err;
 	}
 
+	if (output->virtual_queue_depth > 0 &&
+	    drm_virtual_output_create_queue(output) < 0)
+		weston_log("Failed to allocate %u buffers for output %s, "
+			   "rendering into its GBM surface\n",
+			   output->virtual_queue_depth, output->base.name);
+
 	output->base.start_repaint_loop = drm_virtual_output_start_repaint_loop;
 	output->base.repaint = drm_virtual_output_repaint;
 	output->base.assign_planes = drm_assign_planes;
@@ -297,6 +519,12 @@ drm_virtual_output_enable(struct weston_output *output_base)
 	output->base.gamma_size = 0;
 	output->base.set_gamma = NULL;
 
+	if (output->mirror_of) {
+		output->base.mirror = true;
+		weston_log("Output %s will mirror output %s\n",
+			   output->base.name, output->mirror_of);
+	}
+
 	weston_compositor_stack_plane(b->compositor,
 				      &output->scanout_plane->base,
 				      &b->compositor->primary_plane);
@@ -337,6 +565,7 @@ drm_virtual_output_create(struct weston_compositor *c, char *name)
 
 	output->virtual = true;
 	output->gbm_bo_flags = GBM_BO_USE_LINEAR | GBM_BO_USE_RENDERING;
+	wl_list_init(&output->virtual_buffer_list);
 
 	weston_output_init(&output->base, c, name);
 
@@ -344,6 +573,8 @@ drm_virtual_output_create(struct weston_compositor *c, char *name)
 	output->base.destroy = drm_virtual_output_destroy;
 	output->base.disable = drm_virtual_output_disable;
 	output->base.attach_head = NULL;
+	/* Streamed frames may slip; the displays' deadlines may not. */
+	output->base.repaint_background = true;
 
 	output->state_cur = drm_output_state_alloc(output, NULL);
 
@@ -383,6 +614,9 @@ drm_virtual_output_get_fence_fd(struct weston_output *output_base)
 static void
 drm_virtual_output_buffer_released(struct drm_fb *fb)
 {
+	if (fb->virtual_buffer)
+		fb->virtual_buffer->busy = false;
+
 	drm_fb_unref(fb);
 }
 
@@ -408,13 +642,220 @@ drm_virtual_output_finish_frame(struct weston_output *output_base,
 		weston_output_schedule_repaint(&output->base);
 }
 
+static struct weston_drm_virtual_buffer *
+drm_virtual_output_create_buffer(struct weston_output *output_base, int *fd,
+				 uint32_t *stride, uint32_t *offset,
+				 uint64_t *modifier)
+{
+	struct drm_output *output = to_drm_output(output_base);
+	struct drm_backend *b = to_drm_backend(output_base->compositor);
+	struct weston_mode *mode = output_base->current_mode;
+	struct weston_drm_virtual_buffer *buffer;
+	struct dmabuf_attributes attributes = { 0 };
+	struct gbm_bo *bo;
+
+	if (!output_base->enabled || !gl_renderer->output_dmabuf_target_create)
+		return NULL;
+
+	buffer = zalloc(sizeof *buffer);
+	if (!buffer)
+		return NULL;
+
+	bo = gbm_bo_create(b->gbm, mode->width, mode->height,
+			   output->gbm_format,
+			   GBM_BO_USE_LINEAR | GBM_BO_USE_RENDERING);
+	if (!bo) {
+		weston_log("failed to create virtual output buffer\n");
+		goto err;
+	}
+
+	/* The renderer always produces an opaque image. */
+	buffer->fb = drm_fb_get_from_bo(bo, b, true, BUFFER_VIRTUAL);
+	if (!buffer->fb) {
+		gbm_bo_destroy(bo);
+		goto err;
+	}
+
+	attributes.width = buffer->fb->width;
+	attributes.height = buffer->fb->height;
+	attributes.format = gbm_bo_get_format(bo);
+	attributes.n_planes = 1;
+	attributes.fd[0] = gbm_bo_get_fd(bo);
+	attributes.offset[0] = buffer->fb->offsets[0];
+	attributes.stride[0] = buffer->fb->strides[0];
+	/* A linear buffer needs no explicit modifier to be imported. */
+	attributes.modifier[0] = DRM_FORMAT_MOD_INVALID;
+	if (attributes.fd[0] < 0)
+		goto err_fb;
+
+	buffer->target =
+		gl_renderer->output_dmabuf_target_create(output_base,
+							 &attributes);
+	close(attributes.fd[0]);
+	if (!buffer->target)
+		goto err_fb;
+
+	*fd = gbm_bo_get_fd(bo);
+	if (*fd < 0)
+		goto err_target;
+	*stride = buffer->fb->strides[0];
+	*offset = buffer->fb->offsets[0];
+	*modifier = DRM_FORMAT_MOD_LINEAR;
+
+	buffer->output = output;
+	buffer->fb->virtual_buffer = buffer;
+	wl_list_insert(&output->virtual_buffer_list, &buffer->link);
+
+	return buffer;
+
+err_target:
+	gl_renderer->output_dmabuf_target_destroy(buffer->target);
+err_fb:
+	drm_fb_unref(buffer->fb);
+err:
+	free(buffer);
+	return NULL;
+}
+
+static void
+drm_virtual_output_destroy_buffer(struct weston_drm_virtual_buffer *buffer)
+{
+	struct drm_output *output = buffer->output;
+
+	if (output->virtual_buffer == buffer) {
+		output->virtual_buffer = NULL;
+		gl_renderer->output_set_dmabuf_target(&output->base, NULL);
+	}
+
+	if (buffer->target)
+		gl_renderer->output_dmabuf_target_destroy(buffer->target);
+
+	/* The fb may still be on screen; its last reference frees the bo. */
+	buffer->fb->virtual_buffer = NULL;
+	drm_fb_unref(buffer->fb);
+	wl_list_remove(&buffer->link);
+	free(buffer);
+}
+
+static int
+drm_virtual_output_set_render_buffer(struct weston_output *output_base,
+				     struct weston_drm_virtual_buffer *buffer)
+{
+	struct drm_output *output = to_drm_output(output_base);
+
+	if (buffer && (buffer->output != output || !buffer->target))
+		return -1;
+
+	if (output->virtual_buffer == buffer)
+		return 0;
+
+	if (gl_renderer->output_set_dmabuf_target(output_base,
+						  buffer ? buffer->target :
+							   NULL) < 0)
+		return -1;
+
+	output->virtual_buffer = buffer;
+
+	return 0;
+}
+
+static void
+drm_virtual_output_destroy_queue(struct drm_output *output)
+{
+	unsigned int i;
+
+	if (!output->virtual_queue)
+		return;
+
+	for (i = 0; i < output->virtual_queue_depth; i++) {
+		if (output->virtual_queue[i])
+			drm_virtual_output_destroy_buffer(output->virtual_queue[i]);
+	}
+
+	free(output->virtual_queue);
+	output->virtual_queue = NULL;
+	output->virtual_queue_next = 0;
+}
+
+static int
+drm_virtual_output_create_queue(struct drm_output *output)
+{
+	struct weston_drm_virtual_buffer *buffer;
+	uint32_t stride, offset;
+	uint64_t modifier;
+	unsigned int i;
+	int fd;
+
+	assert(!output->virtual_queue);
+
+	output->virtual_queue = zalloc(output->virtual_queue_depth *
+				       sizeof *output->virtual_queue);
+	if (!output->virtual_queue)
+		return -1;
+
+	for (i = 0; i < output->virtual_queue_depth; i++) {
+		buffer = drm_virtual_output_create_buffer(&output->base, &fd,
+							  &stride, &offset,
+							  &modifier);
+		if (!buffer) {
+			drm_virtual_output_destroy_queue(output);
+			return -1;
+		}
+
+		/* Frames reach the owner through submit_frame_cb. */
+		close(fd);
+		output->virtual_queue[i] = buffer;
+	}
+
+	return 0;
+}
+
+static int
+drm_virtual_output_set_buffer_queue_depth(struct weston_output *output_base,
+					  unsigned int depth)
+{
+	struct drm_output *output = to_drm_output(output_base);
+
+	if (output->virtual_queue_depth == depth &&
+	    (!output_base->enabled || output->virtual_queue || depth == 0))
+		return 0;
+
+	drm_virtual_output_destroy_queue(output);
+	output->virtual_queue_depth = depth;
+
+	if (!output_base->enabled || depth == 0)
+		return 0;
+
+	if (drm_virtual_output_create_queue(output) < 0) {
+		output->virtual_queue_depth = 0;
+		return -1;
+	}
+
+	return 0;
+}
+
+static void
+drm_virtual_output_set_mirror_of(struct weston_output *output_base,
+				 const char *name)
+{
+	struct drm_output *output = to_drm_output(output_base);
+
+	free(output->mirror_of);
+	output->mirror_of = name ? strdup(name) : NULL;
+}
+
 static const struct weston_drm_virtual_output_api virt_api = {
 	drm_virtual_output_create,
 	drm_virtual_output_set_gbm_format,
 	drm_virtual_output_set_submit_frame_cb,
 	drm_virtual_output_get_fence_fd,
 	drm_virtual_output_buffer_released,
-	drm_virtual_output_finish_frame
+	drm_virtual_output_finish_frame,
+	drm_virtual_output_create_buffer,
+	drm_virtual_output_destroy_buffer,
+	drm_virtual_output_set_render_buffer,
+	drm_virtual_output_set_buffer_queue_depth,
+	drm_virtual_output_set_mirror_of,
 };
 
 int drm_backend_init_virtual_output_api(struct weston_compositor *compositor)
@@ -0,0 +1,298 @@
+/*
+ * Copyright © 2022 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+
+#include "drm-internal.h"
+#include "shared/fd-util.h"
+
+/**
+ * Read the CRTCs and formats a writeback connector supports
+ *
+ * Connectors without the writeback properties are left with no possible
+ * CRTCs, so they are never picked for a capture.
+ */
+void
+drm_writeback_update_caps(struct drm_writeback *writeback,
+			  drmModeConnector *conn)
+{
+	struct drm_backend *b = writeback->backend;
+	struct drm_connector *connector = &writeback->connector;
+	drmModePropertyBlobRes *blob;
+	drmModeEncoder *encoder;
+	uint64_t blob_id;
+	int i;
+
+	drm_writeback_fini_caps(writeback);
+
+	if (connector->props[WDRM_CONNECTOR_WRITEBACK_FB_ID].prop_id == 0 ||
+	    connector->props[WDRM_CONNECTOR_WRITEBACK_OUT_FENCE_PTR].prop_id == 0)
+		return;
+
+	blob_id = drm_property_get_value(
+			&connector->props[WDRM_CONNECTOR_WRITEBACK_PIXEL_FORMATS],
+			connector->props_drm, 0);
+	blob = blob_id ? drmModeGetPropertyBlob(b->drm.fd, blob_id) : NULL;
+	if (!blob)
+		return;
+
+	writeback->formats = malloc(blob->length);
+	if (writeback->formats) {
+		memcpy(writeback->formats, blob->data, blob->length);
+		writeback->formats_count = blob->length / sizeof(uint32_t);
+	}
+	drmModeFreePropertyBlob(blob);
+
+	for (i = 0; i < conn->count_encoders; i++) {
+		encoder = drmModeGetEncoder(b->drm.fd, conn->encoders[i]);
+		if (!encoder)
+			continue;
+		writeback->possible_crtcs |= encoder->possible_crtcs;
+		drmModeFreeEncoder(encoder);
+	}
+}
+
+void
+drm_writeback_fini_caps(struct drm_writeback *writeback)
+{
+	free(writeback->formats);
+	writeback->formats = NULL;
+	writeback->formats_count = 0;
+	writeback->possible_crtcs = 0;
+}
+
+static bool
+drm_writeback_has_format(struct drm_writeback *writeback, uint32_t format)
+{
+	unsigned int i;
+
+	for (i = 0; i < writeback->formats_count; i++) {
+		if (writeback->formats[i] == format)
+			return true;
+	}
+
+	return false;
+}
+
+/* The output's own format avoids any conversion in the display
+ * controller; XRGB8888 is what every consumer understands. */
+static struct drm_writeback *
+drm_output_find_writeback(struct drm_output *output, uint32_t *format)
+{
+	struct drm_backend *b = output->backend;
+	const uint32_t candidates[] = { output->gbm_format, DRM_FORMAT_XRGB8888 };
+	struct drm_writeback *writeback;
+	unsigned int i;
+
+	if (!b->atomic_modeset || output->virtual || !output->crtc ||
+	    output->state_cur->dpms != WESTON_DPMS_ON)
+		return NULL;
+
+	for (i = 0; i < ARRAY_LENGTH(candidates); i++) {
+		wl_list_for_each(writeback, &b->writeback_connector_list, link) {
+			if (writeback->output && writeback->output != output)
+				continue;
+			if (!(writeback->possible_crtcs &
+			      (1 << output->crtc->pipe)))
+				continue;
+			if (!drm_writeback_has_format(writeback, candidates[i]))
+				continue;
+
+			*format = candidates[i];
+			return writeback;
+		}
+	}
+
+	return NULL;
+}
+
+bool
+drm_output_writeback_supported(struct drm_output *output)
+{
+	uint32_t format;
+
+	return drm_output_find_writeback(output, &format) != NULL;
+}
+
+static void
+drm_writeback_capture_finish(struct drm_writeback_capture *capture,
+			     bool success)
+{
+	struct drm_output *output = capture->output;
+	struct drm_backend *b = output->backend;
+	struct drm_fb *fb = capture->fb;
+	int fd = -1;
+
+	if (success &&
+	    drmPrimeHandleToFD(b->drm.fd, fb->handles[0], DRM_CLOEXEC, &fd) < 0) {
+		weston_log("writeback: failed to export capture of %s: %s\n",
+			   output->base.name, strerror(errno));
+		fd = -1;
+	}
+
+	if (capture->fence_source)
+		wl_event_source_remove(capture->fence_source);
+	fd_clear(&capture->out_fence_fd);
+
+	output->capture = NULL;
+	if (!output->writeback_routed)
+		capture->writeback->output = NULL;
+
+	capture->done(&output->base, fd, fb->format->format, fb->width,
+		      fb->height, fb->strides[0], capture->data);
+
+	/* The exported dmabuf keeps the buffer alive for the consumer. */
+	drm_fb_unref(fb);
+	free(capture);
+}
+
+static int
+drm_writeback_fence_done(int fd, uint32_t mask, void *data)
+{
+	struct drm_writeback_capture *capture = data;
+
+	drm_writeback_capture_finish(capture, true);
+
+	return 0;
+}
+
+int
+drm_output_capture_writeback(struct weston_output *output_base,
+			     weston_drm_capture_done_func_t done, void *data)
+{
+	struct drm_output *output = to_drm_output(output_base);
+	struct drm_backend *b = output->backend;
+	struct drm_writeback_capture *capture;
+	struct drm_writeback *writeback;
+	uint32_t format;
+
+	if (!output_base->enabled || output->capture)
+		return -1;
+
+	writeback = drm_output_find_writeback(output, &format);
+	if (!writeback)
+		return -1;
+
+	capture = zalloc(sizeof *capture);
+	if (!capture)
+		return -1;
+
+	capture->fb = drm_fb_create_dumb(b, output_base->current_mode->width,
+					 output_base->current_mode->height,
+					 format);
+	if (!capture->fb) {
+		free(capture);
+		return -1;
+	}
+
+	capture->output = output;
+	capture->writeback = writeback;
+	capture->out_fence_fd = -1;
+	capture->done = done;
+	capture->data = data;
+
+	writeback->output = output;
+	output->capture = capture;
+
+	weston_output_schedule_repaint(output_base);
+
+	return 0;
+}
+
+/**
+ * Track the writeback connector through a successful commit
+ *
+ * Called for every output state of a non-test commit before it is
+ * assigned, mirroring drm_output_add_writeback_props().
+ */
+void
+drm_output_writeback_committed(struct drm_output_state *state)
+{
+	struct drm_output *output = state->output;
+	struct drm_writeback_capture *capture = output->capture;
+	struct wl_event_loop *loop;
+
+	if (capture && !capture->committed && state->dpms == WESTON_DPMS_ON) {
+		capture->committed = true;
+		output->writeback_routed = capture->writeback;
+
+		loop = wl_display_get_event_loop(output->base.compositor->wl_display);
+		capture->fence_source =
+			wl_event_loop_add_fd(loop, capture->out_fence_fd,
+					     WL_EVENT_READABLE,
+					     drm_writeback_fence_done, capture);
+		if (!capture->fence_source)
+			drm_writeback_capture_finish(capture, false);
+	} else if (!capture && output->writeback_routed) {
+		output->writeback_routed->output = NULL;
+		output->writeback_routed = NULL;
+	}
+}
+
+/**
+ * Cancel the output's capture when it goes away
+ *
+ * A connector still routed to the CRTC would make the next commit which
+ * disables it fail, so the backend starts over from a clean state.
+ */
+void
+drm_output_writeback_fini(struct drm_output *output)
+{
+	if (output->capture)
+		drm_writeback_capture_finish(output->capture, false);
+
+	if (output->writeback_routed) {
+		output->writeback_routed->output = NULL;
+		output->writeback_routed = NULL;
+		output->backend->state_invalid = true;
+	}
+}
+
+static bool
+drm_output_capture_is_supported(struct weston_output *output_base)
+{
+	return drm_output_writeback_supported(to_drm_output(output_base));
+}
+
+static const struct weston_drm_output_capture_api capture_api = {
+	drm_output_capture_is_supported,
+	drm_output_capture_writeback,
+};
+
+int
+drm_backend_init_writeback_capture_api(struct weston_compositor *compositor)
+{
+	return weston_plugin_api_register(compositor,
+					  WESTON_DRM_OUTPUT_CAPTURE_API_NAME,
+					  &capture_api, sizeof(capture_api));
+}
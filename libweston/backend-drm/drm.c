@@ -40,6 +40,7 @@
 #include <linux/vt.h>
 #include <assert.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 #include <time.h>
 
 #include <xf86drm.h>
@@ -65,9 +66,13 @@
 #include "linux-dmabuf.h"
 #include "linux-dmabuf-unstable-v1-server-protocol.h"
 #include "linux-explicit-synchronization.h"
+#include "watchdog.h"
 
 static const char default_seat[] = "seat0";
 
+/* Hotplug uevents arriving within this window are handled together */
+#define DRM_HOTPLUG_DEBOUNCE_MSEC 50
+
 static void
 drm_backend_create_faked_zpos(struct drm_backend *b)
 {
@@ -123,24 +128,206 @@ drm_backend_create_faked_zpos(struct drm_backend *b)
 	}
 }
 
+/* Timeouts in a row after which recovery is given up on */
+#define DRM_PAGEFLIP_RECOVERY_MAX 3
+
 static int
 pageflip_timeout(void *data) {
 	/*
 	 * Our timer just went off, that means we're not receiving drm
-	 * page flip events anymore for that output. Let's gracefully exit
-	 * weston with a return value so devs can debug what's going on.
+	 * page flip events anymore for that output. Unless asked to recover,
+	 * let's gracefully exit weston with a return value so devs can debug
+	 * what's going on.
 	 */
 	struct drm_output *output = data;
 	struct weston_compositor *compositor = output->base.compositor;
+	struct drm_backend *b = to_drm_backend(compositor);
+	struct timespec now;
 
-	weston_log("Pageflip timeout reached on output %s, your "
-	           "driver is probably buggy!  Exiting.\n",
-		   output->base.name);
-	weston_compositor_exit_with_code(compositor, EXIT_FAILURE);
+	output->flip_stats.timeouts++;
+	output->flip_stats.consecutive_timeouts++;
+
+	if (!b->pageflip_timeout_recovery ||
+	    output->flip_stats.consecutive_timeouts > DRM_PAGEFLIP_RECOVERY_MAX) {
+		weston_log("Pageflip timeout reached on output %s, your "
+			   "driver is probably buggy!  Exiting.\n",
+			   output->base.name);
+		weston_compositor_exit_with_code(compositor, EXIT_FAILURE);
+		return 0;
+	}
+
+	weston_log("Pageflip timeout reached on output %s, resubmitting "
+		   "its state\n", output->base.name);
+
+	/* Give up on the stuck flip: complete the frame as not presented,
+	 * and make the next repaint program the whole KMS state again. */
+	output->flip_stats.recoveries++;
+	output->flip_stats.abandoned = true;
+	output->page_flip_pending = false;
+	output->atomic_complete_pending = false;
+	b->state_invalid = true;
+
+	weston_compositor_read_presentation_clock(compositor, &now);
+	drm_output_update_complete(output, WP_PRESENTATION_FEEDBACK_INVALID,
+				   now.tv_sec, now.tv_nsec / 1000);
+	weston_output_damage(&output->base);
 
 	return 0;
 }
 
+/**
+ * Start timing a page flip
+ *
+ * Called once a non-blocking commit including the output is queued. Arms
+ * the pageflip timer, and predicts the vblank the flip should land on
+ * from the last presentation time and the refresh rate.
+ */
+void
+drm_output_flip_submitted(struct drm_output *output)
+{
+	struct drm_backend *b = output->backend;
+	struct weston_mode *mode = output->base.current_mode;
+	int64_t period_ns, since_ns;
+
+	if (output->pageflip_timer)
+		wl_event_source_timer_update(output->pageflip_timer,
+					     b->pageflip_timeout);
+
+	weston_compositor_read_presentation_clock(b->compositor,
+						  &output->flip_stats.submitted);
+
+	output->flip_stats.predicted_valid = false;
+	if (output->base.vrr_enabled || !mode || mode->refresh == 0 ||
+	    timespec_is_zero(&output->base.frame_time))
+		return;
+
+	period_ns = millihz_to_nsec(mode->refresh);
+	since_ns = timespec_sub_to_nsec(&output->flip_stats.submitted,
+					&output->base.frame_time);
+	if (since_ns < 0)
+		return;
+
+	timespec_add_nsec(&output->flip_stats.predicted,
+			  &output->base.frame_time,
+			  (since_ns / period_ns + 1) * period_ns);
+	output->flip_stats.predicted_valid = true;
+}
+
+/**
+ * Account for a page flip event
+ *
+ * @param output The output the event is for
+ * @param pending Whether the output was waiting for a flip
+ * @param sec Seconds part of the vblank timestamp
+ * @param usec Microseconds part of the vblank timestamp
+ * @returns false if the event belongs to a flip given up on after a
+ * timeout, and must be ignored
+ */
+bool
+drm_output_flip_completed(struct drm_output *output, bool pending,
+			  unsigned int sec, unsigned int usec)
+{
+	struct timespec vblank;
+	int64_t period_ns;
+
+	if (!pending && output->flip_stats.abandoned) {
+		output->flip_stats.abandoned = false;
+		drm_debug(output->backend, "[%s] ignoring the event of an "
+			  "abandoned page flip\n", output->base.name);
+		return false;
+	}
+
+	output->flip_stats.abandoned = false;
+	output->flip_stats.consecutive_timeouts = 0;
+
+	vblank.tv_sec = sec;
+	vblank.tv_nsec = usec * 1000;
+	weston_frame_histogram_add(&output->flip_stats.latency,
+				   timespec_sub_to_nsec(&vblank,
+							&output->flip_stats.submitted));
+
+	/* Half a period of slack absorbs timestamp jitter. */
+	if (output->flip_stats.predicted_valid) {
+		period_ns = millihz_to_nsec(output->base.current_mode->refresh);
+		if (timespec_sub_to_nsec(&vblank, &output->flip_stats.predicted) >
+		    period_ns / 2)
+			output->flip_stats.late++;
+	}
+
+	return true;
+}
+
+/** The one-shot 'drm-flip-stats' scope */
+void
+drm_flip_stats_print_cb(struct weston_log_subscription *sub, void *data)
+{
+	struct drm_backend *b = data;
+	struct weston_output *base;
+
+	wl_list_for_each(base, &b->compositor->output_list, link) {
+		struct drm_output *output = to_drm_output(base);
+		struct weston_frame_histogram *lat = &output->flip_stats.latency;
+
+		weston_log_subscription_printf(sub,
+			"output %s (CRTC %u):\n"
+			"\tflips: %" PRIu64 ", late: %" PRIu64 "\n"
+			"\tlatency usec: avg %" PRIu64 ", p50 %" PRIu64
+			", p90 %" PRIu64 ", p99 %" PRIu64 ", max %" PRIu64 "\n"
+			"\ttimeouts: %" PRIu64 ", recoveries: %" PRIu64 "\n",
+			base->name, output->crtc ? output->crtc->crtc_id : 0,
+			lat->count, output->flip_stats.late,
+			lat->count ? lat->sum_usec / lat->count : 0,
+			weston_frame_histogram_percentile(lat, 50),
+			weston_frame_histogram_percentile(lat, 90),
+			weston_frame_histogram_percentile(lat, 99),
+			lat->max_usec,
+			output->flip_stats.timeouts,
+			output->flip_stats.recoveries);
+	}
+
+	weston_log_subscription_complete(sub);
+}
+
+static void
+drm_backend_write_metrics(struct wl_listener *listener, void *data)
+{
+	struct drm_backend *b =
+		container_of(listener, struct drm_backend, metrics_listener);
+	struct weston_metrics *m = data;
+	struct weston_output *base;
+	struct drm_output *output;
+
+	weston_metrics_family(m, "weston_drm_flip_latency_seconds",
+			      "histogram", "seconds",
+			      "Atomic commit or page flip to its completion");
+	wl_list_for_each(base, &b->compositor->output_list, link) {
+		output = to_drm_output(base);
+		weston_metrics_histogram(m, "weston_drm_flip_latency_seconds",
+					 &output->flip_stats.latency,
+					 "output", base->name, NULL);
+	}
+
+	weston_metrics_family(m, "weston_drm_late_flips", "counter", NULL,
+			      "Flips completing after the predicted vblank");
+	wl_list_for_each(base, &b->compositor->output_list, link) {
+		output = to_drm_output(base);
+		weston_metrics_sample(m, "weston_drm_late_flips_total",
+				      output->flip_stats.late,
+				      "output", base->name, NULL);
+	}
+
+	weston_metrics_family(m, "weston_drm_flip_timeouts", "counter", NULL,
+			      "Flips whose completion event did not arrive in time");
+	wl_list_for_each(base, &b->compositor->output_list, link) {
+		output = to_drm_output(base);
+		weston_metrics_sample(m, "weston_drm_flip_timeouts_total",
+				      output->flip_stats.timeouts,
+				      "output", base->name, NULL);
+	}
+
+	drm_plane_stats_write_metrics(m, b);
+}
+
 /* Creates the pageflip timer. Note that it isn't armed by default */
 static int
 drm_output_pageflip_timer_create(struct drm_output *output)
@@ -319,6 +506,8 @@ drm_output_update_complete(struct drm_output *output, uint32_t flags,
 		weston_output_finish_frame(&output->base, NULL,
 					   WP_PRESENTATION_FEEDBACK_INVALID);
 
+	udev_input_enumerate_deferred(&b->input);
+
 	/* We can't call this from frame_notify, because the output's
 	 * repaint needed flag is cleared just after that */
 	if (output->recorder)
@@ -331,21 +520,81 @@ drm_output_render_pixman(struct drm_output_state *state,
 {
 	struct drm_output *output = state->output;
 	struct weston_compositor *ec = output->base.compositor;
+	pixman_region32_t *age_damage;
+	unsigned int i;
 
-	output->current_image ^= 1;
+	output->current_image =
+		(output->current_image + 1) % ARRAY_LENGTH(output->image);
+
+	/* Each dumb buffer lags behind by everything painted into the
+	 * others since it was last used, so bring back only that. */
+	for (i = 0; i < ARRAY_LENGTH(output->image_damage); i++)
+		pixman_region32_union(&output->image_damage[i],
+				      &output->image_damage[i], damage);
+	age_damage = &output->image_damage[output->current_image];
 
 	pixman_renderer_output_set_buffer(&output->base,
 					  output->image[output->current_image]);
-	pixman_renderer_output_set_hw_extra_damage(&output->base,
-						   &output->previous_damage);
+	pixman_renderer_output_set_hw_extra_damage(&output->base, age_damage);
 
 	ec->renderer->repaint_output(&output->base, damage);
 
-	pixman_region32_copy(&output->previous_damage, damage);
+	pixman_region32_clear(age_damage);
 
 	return drm_fb_ref(output->dumb[output->current_image]);
 }
 
+/**
+ * Magnify the renderer's frame with the scanout plane scaler
+ *
+ * The source rectangle picks the zoomed area out of the unzoomed frame.
+ * If the kernel refuses the scaling, or the frame is also shown on
+ * mirrors or has to be rotated, the zoom goes back into the output
+ * matrix from the next repaint on, and this frame is shown unzoomed.
+ */
+static void
+drm_output_zoom_scanout(struct drm_output_state *state,
+			struct drm_plane_state *scanout_state)
+{
+	struct drm_output *output = state->output;
+	struct drm_backend *b = output->backend;
+	struct weston_output_zoom *zoom = &output->base.zoom;
+	struct drm_fb *fb = scanout_state->fb;
+	float scale = output->base.current_scale;
+	float x, y, w, h;
+
+	if (output->base.transform != WL_OUTPUT_TRANSFORM_NORMAL ||
+	    drm_output_is_mirrored(output))
+		goto fallback;
+
+	w = MIN(zoom->area.width * scale, fb->width);
+	h = MIN(zoom->area.height * scale, fb->height);
+	x = MIN(MAX(zoom->area.x * scale, 0.0f), fb->width - w);
+	y = MIN(MAX(zoom->area.y * scale, 0.0f), fb->height - h);
+
+	scanout_state->src_x = (uint32_t) (x * 65536.0f);
+	scanout_state->src_y = (uint32_t) (y * 65536.0f);
+	scanout_state->src_w = (uint32_t) (w * 65536.0f);
+	scanout_state->src_h = (uint32_t) (h * 65536.0f);
+
+	output->plane_stats.test_commits++;
+	if (drm_pending_state_test(state->pending_state) == 0)
+		return;
+
+fallback:
+	drm_debug(b, "\t[repaint] %s: cannot zoom with the scanout plane, "
+		     "zooming in the renderer\n", output->base.name);
+
+	scanout_state->src_x = 0;
+	scanout_state->src_y = 0;
+	scanout_state->src_w = fb->width << 16;
+	scanout_state->src_h = fb->height << 16;
+
+	zoom->scanout_capable = false;
+	output->base.dirty = 1;
+	weston_output_damage(&output->base);
+}
+
 void
 drm_output_render(struct drm_output_state *state, pixman_region32_t *damage)
 {
@@ -360,6 +609,7 @@ drm_output_render(struct drm_output_state *state, pixman_region32_t *damage)
 	pixman_region32_t scanout_damage;
 	pixman_box32_t *rects;
 	int n_rects;
+	bool reused = false;
 
 	/* If we already have a client buffer promoted to scanout, then we don't
 	 * want to render. */
@@ -380,6 +630,7 @@ drm_output_render(struct drm_output_state *state, pixman_region32_t *damage)
 	    (scanout_plane->state_cur->fb->type == BUFFER_GBM_SURFACE ||
 	     scanout_plane->state_cur->fb->type == BUFFER_PIXMAN_DUMB)) {
 		fb = drm_fb_ref(scanout_plane->state_cur->fb);
+		reused = true;
 	} else if (b->use_pixman) {
 		fb = drm_output_render_pixman(state, damage);
 	} else {
@@ -393,6 +644,7 @@ drm_output_render(struct drm_output_state *state, pixman_region32_t *damage)
 
 	scanout_state->fb = fb;
 	scanout_state->output = output;
+	scanout_state->fb_reused = reused;
 
 	scanout_state->src_x = 0;
 	scanout_state->src_y = 0;
@@ -403,18 +655,27 @@ drm_output_render(struct drm_output_state *state, pixman_region32_t *damage)
 	scanout_state->dest_y = 0;
 	scanout_state->dest_w = output->base.current_mode->width;
 	scanout_state->dest_h = output->base.current_mode->height;
+	scanout_state->rotation = 0;
+	scanout_state->alpha = DRM_PLANE_ALPHA_OPAQUE;
+	scanout_state->blend_mode = WDRM_PLANE_BLEND_MODE_PREMULTI;
 
 	pixman_region32_subtract(&c->primary_plane.damage,
 				 &c->primary_plane.damage, damage);
 
-	/* Don't bother calculating plane damage if the plane doesn't support it */
-	if (damage_info->prop_id == 0)
+	/* After the damage is taken off, so that a fallback to zooming in
+	 * the renderer can damage the whole output for the next repaint. */
+	if (output->base.zoom.scanout)
+		drm_output_zoom_scanout(state, scanout_state);
+
+	/* Don't bother calculating plane damage if the plane doesn't support
+	 * it, or if there is none; a reused fb stays out of the commit. */
+	if (damage_info->prop_id == 0 || reused)
 		return;
 
 	pixman_region32_init(&scanout_damage);
 	pixman_region32_copy(&scanout_damage, damage);
 
-	if (output->base.zoom.active) {
+	if (output->base.zoom.active && !output->base.zoom.scanout) {
 		pixman_region32_t clip;
 
 		weston_matrix_transform_region(&scanout_damage,
@@ -453,6 +714,426 @@ drm_output_render(struct drm_output_state *state, pixman_region32_t *damage)
 	pixman_region32_fini(&scanout_damage);
 }
 
+/** Whether any enabled mirror takes its framebuffer from this output */
+bool
+drm_output_is_mirrored(struct drm_output *output)
+{
+	struct weston_output *base;
+
+	wl_list_for_each(base, &output->base.compositor->output_list, link) {
+		if (base->mirror && to_drm_output(base)->mirror_source == output)
+			return true;
+	}
+
+	return false;
+}
+
+/* Find the mirrors of a freshly rendered output and have them pick up
+ * its framebuffer; a source enabled after its mirrors is found here.
+ * An unchanged framebuffer gives the mirrors nothing new to show. */
+static void
+drm_output_schedule_mirrors(struct drm_output_state *state)
+{
+	struct drm_output *output = state->output;
+	struct drm_plane_state *scanout_state;
+	struct weston_output *base;
+	struct drm_output *mirror;
+	bool changed;
+
+	scanout_state = drm_output_state_get_existing_plane(state,
+							    output->scanout_plane);
+	changed = scanout_state && scanout_state->fb &&
+		  !scanout_state->fb_reused;
+
+	wl_list_for_each(base, &output->base.compositor->output_list, link) {
+		if (!base->mirror)
+			continue;
+
+		mirror = to_drm_output(base);
+		if (!mirror->mirror_source &&
+		    strcmp(mirror->mirror_of, output->base.name) == 0) {
+			mirror->mirror_source = output;
+			weston_log("Output %s mirrors output %s\n",
+				   base->name, output->base.name);
+			weston_output_schedule_repaint(base);
+		} else if (mirror->mirror_source == output && changed) {
+			weston_output_schedule_repaint(base);
+		}
+	}
+}
+
+/* Drop every reference mirrors hold on the framebuffers of an output
+ * going away, its GBM surface is destroyed regardless of them. */
+static void
+drm_output_release_mirrors(struct drm_output *output)
+{
+	struct drm_backend *b = to_drm_backend(output->base.compositor);
+	struct weston_output *base;
+	struct drm_output *mirror;
+
+	wl_list_for_each(base, &output->base.compositor->output_list, link) {
+		if (!base->mirror)
+			continue;
+
+		mirror = to_drm_output(base);
+		if (mirror->mirror_source != output)
+			continue;
+
+		mirror->mirror_source = NULL;
+		if (mirror->virtual) {
+			drm_virtual_output_mirror_cache_flush(mirror);
+			continue;
+		}
+		if (mirror->scanout_plane->state_cur->fb) {
+			drm_plane_reset_state(mirror->scanout_plane);
+			b->state_invalid = true;
+		}
+	}
+}
+
+static void
+drm_mirror_fit(struct drm_plane_state *ps, struct drm_fb *fb,
+	       const struct weston_mode *mode)
+{
+	ps->src_x = 0;
+	ps->src_y = 0;
+	ps->src_w = fb->width << 16;
+	ps->src_h = fb->height << 16;
+
+	/* Scale to the largest size keeping the aspect ratio, centred. */
+	if ((int64_t) fb->width * mode->height >
+	    (int64_t) fb->height * mode->width) {
+		ps->dest_w = mode->width;
+		ps->dest_h = (int64_t) fb->height * mode->width / fb->width;
+	} else {
+		ps->dest_w = (int64_t) fb->width * mode->height / fb->height;
+		ps->dest_h = mode->height;
+	}
+	ps->dest_x = (mode->width - ps->dest_w) / 2;
+	ps->dest_y = (mode->height - ps->dest_h) / 2;
+}
+
+static void
+drm_mirror_crop(struct drm_plane_state *ps, struct drm_fb *fb,
+		const struct weston_mode *mode)
+{
+	ps->dest_x = 0;
+	ps->dest_y = 0;
+	ps->dest_w = MIN(fb->width, mode->width);
+	ps->dest_h = MIN(fb->height, mode->height);
+
+	ps->src_x = 0;
+	ps->src_y = 0;
+	ps->src_w = ps->dest_w << 16;
+	ps->src_h = ps->dest_h << 16;
+}
+
+/** The framebuffer a mirror shows next
+ *
+ * The framebuffer being committed for the source in this repaint is
+ * preferred, else the one it currently shows.
+ */
+struct drm_fb *
+drm_output_mirror_source_fb(struct drm_output *output,
+			    struct drm_pending_state *pending_state)
+{
+	struct drm_output *source = output->mirror_source;
+	struct drm_output_state *source_state;
+	struct drm_plane_state *source_ps = NULL;
+
+	if (!source)
+		return NULL;
+
+	source_state = drm_pending_state_get_output(pending_state, source);
+	if (source_state)
+		source_ps = drm_output_state_get_existing_plane(source_state,
+								source->scanout_plane);
+	if (source_ps && source_ps->fb)
+		return source_ps->fb;
+
+	return source->scanout_plane->state_cur->fb;
+}
+
+/** Put the source output's framebuffer on the scanout plane of a mirror
+ *
+ * A framebuffer of another size is scaled by the plane where the driver
+ * accepts it, and cropped otherwise; the legacy KMS API can do neither.
+ */
+static void
+drm_output_render_mirror(struct drm_output_state *state)
+{
+	struct drm_output *output = state->output;
+	struct drm_backend *b = output->backend;
+	struct weston_mode *mode = output->base.current_mode;
+	struct drm_plane_state *scanout_state;
+	struct drm_fb *fb;
+
+	fb = drm_output_mirror_source_fb(output, state->pending_state);
+	if (!fb)
+		return;
+
+	if (!b->atomic_modeset &&
+	    (fb->width != mode->width || fb->height != mode->height)) {
+		drm_debug(b, "\t[mirror] %s: cannot show %dx%d on %dx%d "
+			     "without atomic modesetting\n", output->base.name,
+			  fb->width, fb->height, mode->width, mode->height);
+		return;
+	}
+
+	scanout_state = drm_output_state_get_plane(state,
+						   output->scanout_plane);
+	scanout_state->fb = drm_fb_ref(fb);
+	scanout_state->output = output;
+	scanout_state->rotation = 0;
+	scanout_state->alpha = DRM_PLANE_ALPHA_OPAQUE;
+	scanout_state->blend_mode = WDRM_PLANE_BLEND_MODE_PREMULTI;
+	drm_mirror_fit(scanout_state, fb, mode);
+
+	if (!b->atomic_modeset ||
+	    (fb->width == mode->width && fb->height == mode->height))
+		return;
+
+	output->plane_stats.test_commits++;
+	if (drm_pending_state_test(state->pending_state) == 0)
+		return;
+
+	drm_debug(b, "\t[mirror] %s: scaling refused, cropping instead\n",
+		  output->base.name);
+	drm_mirror_crop(scanout_state, fb, mode);
+
+	output->plane_stats.test_commits++;
+	if (drm_pending_state_test(state->pending_state) == 0)
+		return;
+
+	drm_plane_state_put_back(scanout_state);
+}
+
+static bool
+drm_output_vrr_capable(struct drm_output *output)
+{
+	struct drm_backend *b = to_drm_backend(output->base.compositor);
+	struct drm_head *head;
+
+	if (!b->atomic_modeset ||
+	    output->crtc->props_crtc[WDRM_CRTC_VRR_ENABLED].prop_id == 0)
+		return false;
+
+	wl_list_for_each(head, &output->base.head_list, base.output_link) {
+		if (!head->vrr_capable)
+			return false;
+	}
+
+	return true;
+}
+
+static bool
+drm_output_vrr_possible(struct drm_output *output)
+{
+	return output->vrr_allowed && drm_output_vrr_capable(output);
+}
+
+/* The mode of the current size with the lowest refresh rate, if lower
+ * than the current one. */
+static struct drm_mode *
+drm_output_find_idle_mode(struct drm_output *output)
+{
+	struct drm_mode *current = to_drm_mode(output->base.current_mode);
+	struct drm_mode *mode, *best = NULL;
+
+	wl_list_for_each(mode, &output->base.mode_list, base.link) {
+		if (mode->base.width != current->base.width ||
+		    mode->base.height != current->base.height ||
+		    mode->base.refresh >= current->base.refresh ||
+		    (mode->mode_info.flags & DRM_MODE_FLAG_INTERLACE) !=
+		    (current->mode_info.flags & DRM_MODE_FLAG_INTERLACE))
+			continue;
+
+		if (!best || mode->base.refresh < best->base.refresh)
+			best = mode;
+	}
+
+	return best;
+}
+
+/**
+ * Let an output which has not repainted for a while refresh less often
+ *
+ * Static content does not need the display scanning it out at the full
+ * rate. With VRR, the next repaint enables it and the display waits for
+ * flips that do not come; otherwise the output switches to a lower
+ * refresh mode of the same size, a modeset on most drivers. Both are
+ * undone by drm_output_idle_refresh_leave() as soon as the repaint loop
+ * starts again.
+ */
+static int
+drm_output_idle_refresh_timeout(void *data)
+{
+	struct drm_output *output = data;
+	struct weston_compositor *ec = output->base.compositor;
+	struct drm_backend *b = to_drm_backend(ec);
+	struct drm_mode *mode;
+
+	if (output->idle_refresh.active ||
+	    output->base.repaint_status != REPAINT_NOT_SCHEDULED ||
+	    output->state_cur->dpms != WESTON_DPMS_ON ||
+	    ec->state == WESTON_COMPOSITOR_OFFSCREEN ||
+	    ec->state == WESTON_COMPOSITOR_SLEEPING)
+		return 0;
+
+	if (drm_output_vrr_capable(output)) {
+		drm_debug(b, "[idle] %s: enabling VRR while idle\n",
+			  output->base.name);
+		output->idle_refresh.active = true;
+		output->idle_refresh.entering = true;
+		weston_output_schedule_repaint(&output->base);
+		return 0;
+	}
+
+	/* Do not stack on another temporary mode, e.g. of a fullscreen
+	 * client. */
+	if (output->base.original_mode)
+		return 0;
+
+	mode = drm_output_find_idle_mode(output);
+	if (!mode)
+		return 0;
+
+	drm_debug(b, "[idle] %s: switching to %d mHz while idle\n",
+		  output->base.name, mode->base.refresh);
+	output->idle_refresh.active = true;
+	output->idle_refresh.entering = true;
+	if (weston_output_mode_switch_to_temporary(&output->base, &mode->base,
+						   output->base.current_scale) < 0) {
+		output->idle_refresh.active = false;
+		output->idle_refresh.entering = false;
+		return 0;
+	}
+	output->idle_refresh.mode_switched = true;
+	weston_output_damage(&output->base);
+
+	return 0;
+}
+
+static void
+drm_output_idle_refresh_leave(struct drm_output *output)
+{
+	struct drm_backend *b = to_drm_backend(output->base.compositor);
+
+	drm_debug(b, "[idle] %s: back to the full refresh rate\n",
+		  output->base.name);
+	output->idle_refresh.active = false;
+
+	if (!output->idle_refresh.mode_switched)
+		return;
+
+	output->idle_refresh.mode_switched = false;
+	if (weston_output_mode_switch_to_native(&output->base) < 0)
+		weston_log("%s: failed to restore the mode after idle\n",
+			   output->base.name);
+	weston_output_damage(&output->base);
+}
+
+/* Creates the idle refresh timer, armed by each repaint */
+static void
+drm_output_idle_refresh_init(struct drm_output *output)
+{
+	struct wl_event_loop *loop;
+
+	loop = wl_display_get_event_loop(output->base.compositor->wl_display);
+	output->idle_refresh.timer =
+		wl_event_loop_add_timer(loop, drm_output_idle_refresh_timeout,
+					output);
+	if (!output->idle_refresh.timer)
+		weston_log("%s: failed to create the idle refresh timer\n",
+			   output->base.name);
+}
+
+static void
+drm_output_idle_refresh_fini(struct drm_output *output)
+{
+	if (output->idle_refresh.timer)
+		wl_event_source_remove(output->idle_refresh.timer);
+	output->idle_refresh.timer = NULL;
+
+	/* Come back up in the configured mode when enabled again. */
+	if (output->idle_refresh.mode_switched) {
+		output->base.current_mode->flags = 0;
+		output->base.current_mode = output->base.original_mode;
+		output->base.current_mode->flags =
+			WL_OUTPUT_MODE_CURRENT | WL_OUTPUT_MODE_PREFERRED;
+		output->base.original_mode = NULL;
+		output->base.original_scale = 0;
+	}
+
+	output->idle_refresh.active = false;
+	output->idle_refresh.entering = false;
+	output->idle_refresh.mode_switched = false;
+}
+
+/* The topmost view on the output if it is opaque and covers all of it,
+ * like a fullscreen game or video player would. Variable refresh and
+ * asynchronous flips are only used then: the rest of the desktop expects
+ * a steady frame rate. */
+static struct weston_view *
+drm_output_get_fullscreen_view(struct drm_output *output)
+{
+	struct weston_compositor *ec = output->base.compositor;
+	struct weston_view *ev;
+	pixman_region32_t uncovered;
+	bool covered;
+
+	wl_list_for_each(ev, &ec->view_list, link) {
+		if (!(ev->output_mask & (1u << output->base.id)))
+			continue;
+
+		pixman_region32_init(&uncovered);
+		pixman_region32_subtract(&uncovered, &output->base.region,
+					 &ev->transform.boundingbox);
+		covered = !pixman_region32_not_empty(&uncovered);
+		pixman_region32_fini(&uncovered);
+
+		if (covered && weston_view_is_opaque(ev, &output->base.region))
+			return ev;
+
+		return NULL;
+	}
+
+	return NULL;
+}
+
+/* Asynchronous flips are only used when the client asked for them and its
+ * buffer is the only content of the output, scanned out from the primary
+ * plane: that is all the kernel accepts for an async atomic commit. Video
+ * is paced to the display anyway, tearing it would only show. */
+static bool
+drm_output_can_async_flip(struct drm_output *output,
+			  struct drm_output_state *state,
+			  struct drm_plane_state *scanout_state)
+{
+	struct drm_backend *b = to_drm_backend(output->base.compositor);
+	struct drm_plane_state *ps;
+	struct weston_view *ev;
+
+	if (output->async_flip_refused || !b->async_page_flip)
+		return false;
+
+	if (scanout_state->fb->type != BUFFER_CLIENT &&
+	    scanout_state->fb->type != BUFFER_DMABUF)
+		return false;
+
+	ev = drm_output_get_fullscreen_view(output);
+	if (!ev || !ev->surface->async_present ||
+	    ev->surface->content_type == WESTON_SURFACE_CONTENT_TYPE_VIDEO)
+		return false;
+
+	wl_list_for_each(ps, &state->plane_list, link) {
+		if (ps != scanout_state && ps->fb)
+			return false;
+	}
+
+	return true;
+}
+
 static int
 drm_output_repaint(struct weston_output *output_base,
 		   pixman_region32_t *damage,
@@ -462,6 +1143,7 @@ drm_output_repaint(struct weston_output *output_base,
 	struct drm_output *output = to_drm_output(output_base);
 	struct drm_output_state *state = NULL;
 	struct drm_plane_state *scanout_state;
+	struct weston_view *fullscreen_view;
 
 	assert(!output->virtual);
 
@@ -485,12 +1167,33 @@ drm_output_repaint(struct weston_output *output_base,
 	else
 		state->protection = WESTON_HDCP_DISABLE;
 
-	drm_output_render(state, damage);
+	/* Photo content has no frame rate for the display to follow. */
+	fullscreen_view = drm_output_get_fullscreen_view(output);
+	state->vrr_enabled = (drm_output_vrr_possible(output) &&
+			      fullscreen_view != NULL &&
+			      fullscreen_view->surface->content_type !=
+			      WESTON_SURFACE_CONTENT_TYPE_PHOTO) ||
+			     (output->idle_refresh.active &&
+			      !output->idle_refresh.mode_switched);
+
+	if (output->idle_refresh.timer)
+		wl_event_source_timer_update(output->idle_refresh.timer,
+					     output->idle_refresh.timeout_msec);
+
+	if (output_base->mirror) {
+		drm_output_render_mirror(state);
+	} else {
+		drm_output_render(state, damage);
+		drm_output_schedule_mirrors(state);
+	}
 	scanout_state = drm_output_state_get_plane(state,
 						   output->scanout_plane);
 	if (!scanout_state || !scanout_state->fb)
 		goto err;
 
+	state->async_flip = drm_output_can_async_flip(output, state,
+						      scanout_state);
+
 	return 0;
 
 err:
@@ -523,6 +1226,56 @@ drm_waitvblank_pipe(struct drm_crtc *crtc)
 		return 0;
 }
 
+static void
+drm_backend_first_frames(void *data)
+{
+	struct drm_backend *b = data;
+	struct weston_output *base;
+	struct drm_output *output;
+
+	b->first_frame_idle = NULL;
+
+	wl_list_for_each(base, &b->compositor->output_list, link) {
+		output = to_drm_output(base);
+		if (!output->first_frame_deferred)
+			continue;
+
+		output->first_frame_deferred = false;
+		weston_output_finish_frame(base, NULL,
+					   WP_PRESENTATION_FEEDBACK_INVALID);
+	}
+}
+
+/**
+ * Hold back the first frame of an output until the event loop goes idle
+ *
+ * Outputs enabled together, at startup or from one hotplug burst, then
+ * become due for repaint in the same cycle, and their first modesets
+ * go into a single atomic commit instead of one commit each.
+ */
+static bool
+drm_output_defer_first_frame(struct drm_output *output)
+{
+	struct drm_backend *b = output->backend;
+	struct wl_event_loop *loop;
+
+	if (!b->atomic_modeset)
+		return false;
+
+	if (!b->first_frame_idle) {
+		loop = wl_display_get_event_loop(b->compositor->wl_display);
+		b->first_frame_idle =
+			wl_event_loop_add_idle(loop, drm_backend_first_frames,
+					       b);
+		if (!b->first_frame_idle)
+			return false;
+	}
+
+	output->first_frame_deferred = true;
+
+	return true;
+}
+
 static int
 drm_output_start_repaint_loop(struct weston_output *output_base)
 {
@@ -544,8 +1297,16 @@ drm_output_start_repaint_loop(struct weston_output *output_base)
 	if (output->disable_pending || output->destroy_pending)
 		return 0;
 
+	/* Anything but the repaint turning the idle refresh on ends it. */
+	if (output->idle_refresh.entering)
+		output->idle_refresh.entering = false;
+	else if (output->idle_refresh.active)
+		drm_output_idle_refresh_leave(output);
+
 	if (!scanout_plane->state_cur->fb) {
 		/* We can't page flip if there's no mode set */
+		if (drm_output_defer_first_frame(output))
+			return 0;
 		goto finish_frame;
 	}
 
@@ -628,7 +1389,8 @@ drm_repaint_begin(struct weston_compositor *compositor)
 	ret = drm_pending_state_alloc(b);
 	b->repaint_data = ret;
 
-	if (weston_log_scope_is_enabled(b->debug)) {
+	weston_log_scope_next_sample(b->debug);
+	if (weston_log_scope_is_sampled(b->debug)) {
 		char *dbg = weston_compositor_print_scene_graph(compositor);
 		drm_debug(b, "[repaint] Beginning repaint; pending_state %p\n",
 			  ret);
@@ -648,14 +1410,72 @@ drm_repaint_begin(struct weston_compositor *compositor)
  * the update completes (see drm_output_update_complete), the output
  * state will be freed.
  */
+static bool
+drm_output_state_is_first_modeset(struct drm_output_state *state)
+{
+	struct drm_output *output = state->output;
+
+	return !output->virtual && state->dpms == WESTON_DPMS_ON &&
+	       !output->scanout_plane->state_cur->fb;
+}
+
+/**
+ * Check that the outputs brought up by this commit work together
+ *
+ * The CRTCs picked for each output on its own may still exceed what the
+ * display controller can drive at once, e.g. in memory bandwidth. Until
+ * a TEST_ONLY commit passes, the output latest in the list is taken out
+ * and left to try again alone on its next repaint.
+ */
+static void
+drm_pending_state_test_first_modesets(struct drm_pending_state *pending_state)
+{
+	struct drm_output_state *state, *last;
+	struct drm_output *output;
+	int count = 0;
+
+	wl_list_for_each(state, &pending_state->output_list, link) {
+		if (drm_output_state_is_first_modeset(state))
+			count++;
+	}
+
+	while (count > 1 && drm_pending_state_test(pending_state) != 0) {
+		last = NULL;
+		wl_list_for_each_reverse(state, &pending_state->output_list,
+					 link) {
+			if (drm_output_state_is_first_modeset(state)) {
+				last = state;
+				break;
+			}
+		}
+		assert(last);
+
+		output = last->output;
+		weston_log("Output %s cannot be enabled together with the "
+			   "others, retrying it on its own\n",
+			   output->base.name);
+
+		drm_output_state_free(last);
+		weston_output_repaint_failed(&output->base);
+		weston_output_schedule_repaint(&output->base);
+		count--;
+	}
+}
+
 static int
 drm_repaint_flush(struct weston_compositor *compositor, void *repaint_data)
 {
 	struct drm_backend *b = to_drm_backend(compositor);
 	struct drm_pending_state *pending_state = repaint_data;
+	const char *phase;
 	int ret;
 
+	phase = weston_watchdog_phase_enter("drm_pending_state_apply");
+	if (b->atomic_modeset)
+		drm_pending_state_test_first_modesets(pending_state);
+
 	ret = drm_pending_state_apply(pending_state);
+	weston_watchdog_phase_leave(phase);
 	if (ret != 0)
 		weston_log("repaint-flush failed: %s\n", strerror(errno));
 
@@ -693,6 +1513,7 @@ drm_output_switch_mode(struct weston_output *output_base, struct weston_mode *mo
 	struct drm_output *output = to_drm_output(output_base);
 	struct drm_backend *b = to_drm_backend(output_base->compositor);
 	struct drm_mode *drm_mode = drm_output_choose_mode(output, mode);
+	struct weston_mode *old_mode = output->base.current_mode;
 
 	if (!drm_mode) {
 		weston_log("%s: invalid resolution %dx%d\n",
@@ -717,6 +1538,13 @@ drm_output_switch_mode(struct weston_output *output_base, struct weston_mode *mo
 	 */
 	b->state_invalid = true;
 
+	/* Only the timings change, the buffers fit the new mode as well. */
+	if (drm_mode->base.width == old_mode->width &&
+	    drm_mode->base.height == old_mode->height)
+		return 0;
+
+	drm_output_release_mirrors(output);
+
 	if (b->use_pixman) {
 		drm_output_fini_pixman(output);
 		if (drm_output_init_pixman(output, b) < 0) {
@@ -724,7 +1552,7 @@ drm_output_switch_mode(struct weston_output *output_base, struct weston_mode *mo
 				   "new mode\n");
 			return -1;
 		}
-	} else {
+	} else if (drm_output_resize_egl(output, b) < 0) {
 		drm_output_fini_egl(output);
 		if (drm_output_init_egl(output, b) < 0) {
 			weston_log("failed to init output egl state with "
@@ -776,6 +1604,8 @@ drm_plane_create(struct drm_backend *b, const drmModePlane *kplane)
 	plane->state_cur->complete = true;
 	plane->possible_crtcs = kplane->possible_crtcs;
 	plane->plane_id = kplane->plane_id;
+	plane->scaling.max_ok[0] = plane->scaling.max_ok[1] = 1 << 16;
+	plane->scaling.min_fail[0] = plane->scaling.min_fail[1] = UINT32_MAX;
 
 	weston_drm_format_array_init(&plane->formats);
 
@@ -887,6 +1717,7 @@ drm_plane_destroy(struct drm_plane *plane)
 	if (plane->type == WDRM_PLANE_TYPE_OVERLAY)
 		drmModeSetPlane(plane->backend->drm.fd, plane->plane_id,
 				0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+	drm_plane_set_damage_view(plane, NULL);
 	drm_plane_state_free(plane->state_cur, true);
 	drm_property_info_free(plane->props, WDRM_PLANE__COUNT);
 	weston_plane_release(&plane->base);
@@ -1147,6 +1978,7 @@ drm_output_init_pixman(struct drm_output *output, struct drm_backend *b)
 	unsigned int i;
 	const struct pixman_renderer_output_options options = {
 		.use_shadow = b->use_pixman_shadow,
+		.repaint_threads = b->pixman_repaint_threads,
 	};
 
 	switch (format) {
@@ -1181,8 +2013,11 @@ drm_output_init_pixman(struct drm_output *output, struct drm_backend *b)
 	weston_log("DRM: output %s %s shadow framebuffer.\n", output->base.name,
 		   b->use_pixman_shadow ? "uses" : "does not use");
 
-	pixman_region32_init_rect(&output->previous_damage,
-				  output->base.x, output->base.y, output->base.width, output->base.height);
+	for (i = 0; i < ARRAY_LENGTH(output->image_damage); i++)
+		pixman_region32_init_rect(&output->image_damage[i],
+					  output->base.x, output->base.y,
+					  output->base.width,
+					  output->base.height);
 
 	return 0;
 
@@ -1215,7 +2050,8 @@ drm_output_fini_pixman(struct drm_output *output)
 	}
 
 	pixman_renderer_output_destroy(&output->base);
-	pixman_region32_fini(&output->previous_damage);
+	for (i = 0; i < ARRAY_LENGTH(output->image_damage); i++)
+		pixman_region32_fini(&output->image_damage[i]);
 
 	for (i = 0; i < ARRAY_LENGTH(output->dumb); i++) {
 		pixman_image_unref(output->image[i]);
@@ -1366,6 +2202,31 @@ drm_output_set_seat(struct weston_output *base,
 				     seat ? seat : "");
 }
 
+static void
+drm_output_set_vrr(struct weston_output *base, bool enable)
+{
+	struct drm_output *output = to_drm_output(base);
+
+	output->vrr_allowed = enable;
+}
+
+static void
+drm_output_set_idle_refresh(struct weston_output *base, uint32_t timeout_msec)
+{
+	struct drm_output *output = to_drm_output(base);
+
+	output->idle_refresh.timeout_msec = timeout_msec;
+}
+
+static void
+drm_output_set_mirror_of(struct weston_output *base, const char *name)
+{
+	struct drm_output *output = to_drm_output(base);
+
+	free(output->mirror_of);
+	output->mirror_of = name ? strdup(name) : NULL;
+}
+
 static int
 drm_output_init_gamma_size(struct drm_output *output)
 {
@@ -1539,6 +2400,12 @@ drm_crtc_create(struct drm_backend *b, uint32_t crtc_id, uint32_t pipe)
 
 	drm_property_info_populate(b, crtc_props, crtc->props_crtc,
 				   WDRM_CRTC__COUNT, props);
+	crtc->degamma_lut_size =
+		drm_property_get_value(&crtc->props_crtc[WDRM_CRTC_DEGAMMA_LUT_SIZE],
+				       props, 0);
+	crtc->gamma_lut_size =
+		drm_property_get_value(&crtc->props_crtc[WDRM_CRTC_GAMMA_LUT_SIZE],
+				       props, 0);
 	crtc->backend = b;
 	crtc->crtc_id = crtc_id;
 	crtc->pipe = pipe;
@@ -1779,6 +2646,50 @@ drm_output_detach_crtc(struct drm_output *output)
 	b->state_invalid = true;
 }
 
+static bool
+drm_mode_info_timings_equal(const drmModeModeInfo *a, const drmModeModeInfo *b)
+{
+	return a->clock == b->clock &&
+	       a->hdisplay == b->hdisplay &&
+	       a->hsync_start == b->hsync_start &&
+	       a->hsync_end == b->hsync_end &&
+	       a->htotal == b->htotal &&
+	       a->hskew == b->hskew &&
+	       a->vdisplay == b->vdisplay &&
+	       a->vsync_start == b->vsync_start &&
+	       a->vsync_end == b->vsync_end &&
+	       a->vtotal == b->vtotal &&
+	       a->vscan == b->vscan &&
+	       a->flags == b->flags;
+}
+
+/** Whether the output can take over the CRTC as the firmware or boot
+ * splash left it
+ *
+ * True when every head is still driven by the CRTC we picked and that
+ * CRTC runs the mode we are about to set.
+ */
+static bool
+drm_output_can_handoff(struct drm_output *output)
+{
+	struct drm_mode *mode = to_drm_mode(output->base.current_mode);
+	struct weston_head *base;
+	struct drm_head *head;
+
+	if (!output->backend->atomic_modeset)
+		return false;
+
+	wl_list_for_each(base, &output->base.head_list, output_link) {
+		head = to_drm_head(base);
+		if (head->inherited_crtc_id != output->crtc->crtc_id ||
+		    !drm_mode_info_timings_equal(&head->inherited_mode,
+						 &mode->mode_info))
+			return false;
+	}
+
+	return true;
+}
+
 static int
 drm_output_enable(struct weston_output *base)
 {
@@ -1799,9 +2710,14 @@ drm_output_enable(struct weston_output *base)
 	if (drm_output_init_gamma_size(output) < 0)
 		goto err_planes;
 
+	drm_output_offload_color_transform(output);
+
 	if (b->pageflip_timeout)
 		drm_output_pageflip_timer_create(output);
 
+	if (output->idle_refresh.timeout_msec)
+		drm_output_idle_refresh_init(output);
+
 	if (b->use_pixman) {
 		if (drm_output_init_pixman(output, b) < 0) {
 			weston_log("Failed to init output pixman state\n");
@@ -1814,6 +2730,11 @@ drm_output_enable(struct weston_output *base)
 
 	drm_output_init_backlight(output);
 
+	output->seamless_handoff = drm_output_can_handoff(output);
+	if (output->seamless_handoff)
+		weston_log("Output %s: taking over the current mode without "
+			   "a modeset\n", output->base.name);
+
 	output->base.start_repaint_loop = drm_output_start_repaint_loop;
 	output->base.repaint = drm_output_repaint;
 	output->base.assign_planes = drm_assign_planes;
@@ -1821,6 +2742,16 @@ drm_output_enable(struct weston_output *base)
 	output->base.switch_mode = drm_output_switch_mode;
 	output->base.set_gamma = drm_output_set_gamma;
 
+	/* Atomic commits can scale the scanout plane, and a test commit
+	 * tells whether this one does. */
+	output->base.zoom.scanout_capable = b->atomic_modeset;
+
+	if (output->mirror_of && strcmp(output->mirror_of, base->name) != 0) {
+		output->base.mirror = true;
+		weston_log("Output %s will mirror output %s\n",
+			   base->name, output->mirror_of);
+	}
+
 	weston_log("Output %s (crtc %d) video modes:\n",
 		   output->base.name, output->crtc->crtc_id);
 	drm_output_print_modes(output);
@@ -1828,6 +2759,7 @@ drm_output_enable(struct weston_output *base)
 	return 0;
 
 err_planes:
+	drm_output_fini_color_transform(output);
 	drm_output_deinit_planes(output);
 err_crtc:
 	drm_output_detach_crtc(output);
@@ -1840,11 +2772,18 @@ drm_output_deinit(struct weston_output *base)
 	struct drm_output *output = to_drm_output(base);
 	struct drm_backend *b = to_drm_backend(base->compositor);
 
+	drm_output_release_mirrors(output);
+	output->mirror_source = NULL;
+	output->first_frame_deferred = false;
+
 	if (b->use_pixman)
 		drm_output_fini_pixman(output);
 	else
 		drm_output_fini_egl(output);
 
+	drm_output_writeback_fini(output);
+	drm_output_idle_refresh_fini(output);
+	drm_output_fini_color_transform(output);
 	drm_output_deinit_planes(output);
 	drm_output_detach_crtc(output);
 }
@@ -1881,6 +2820,7 @@ drm_output_destroy(struct weston_output *base)
 	assert(!output->state_last);
 	drm_output_state_free(output->state_cur);
 
+	free(output->mirror_of);
 	free(output);
 }
 
@@ -2109,6 +3049,8 @@ drm_writeback_update_info(struct drm_writeback *writeback, drmModeConnector *con
 	int ret;
 
 	ret = drm_connector_assign_connector_info(&writeback->connector, conn);
+	if (ret == 0)
+		drm_writeback_update_caps(writeback, conn);
 
 	return ret;
 }
@@ -2280,6 +3222,10 @@ err:
 static void
 drm_writeback_destroy(struct drm_writeback *writeback)
 {
+	if (writeback->output)
+		drm_output_writeback_fini(writeback->output);
+
+	drm_writeback_fini_caps(writeback);
 	drm_connector_fini(&writeback->connector);
 	wl_list_remove(&writeback->link);
 
@@ -2440,6 +3386,66 @@ drm_backend_update_connectors(struct drm_backend *b, struct udev_device *drm_dev
 	drmModeFreeResources(resources);
 }
 
+/** Re-probe a single known connector
+ *
+ * @return false if the connector is not one we know, or is gone, in which
+ * case only drm_backend_update_connectors() can sort it out.
+ */
+static bool
+drm_backend_update_connector(struct drm_backend *b, uint32_t connector_id)
+{
+	drmModeConnector *conn;
+	struct drm_head *head;
+	struct drm_writeback *writeback;
+	int ret;
+
+	head = drm_head_find_by_connector(b, connector_id);
+	writeback = drm_writeback_find_by_connector(b, connector_id);
+	if (!head && !writeback)
+		return false;
+
+	conn = drmModeGetConnector(b->drm.fd, connector_id);
+	if (!conn)
+		return false;
+
+	if (head)
+		ret = drm_head_update_info(head, conn);
+	else
+		ret = drm_writeback_update_info(writeback, conn);
+
+	if (ret < 0)
+		drmModeFreeConnector(conn);
+
+	return true;
+}
+
+static int
+drm_backend_hotplug_timeout(void *data)
+{
+	struct drm_backend *b = data;
+	bool all = b->hotplug.all_connectors;
+	uint32_t *connector_id;
+
+	if (!all) {
+		wl_array_for_each(connector_id, &b->hotplug.connectors) {
+			if (!drm_backend_update_connector(b, *connector_id)) {
+				all = true;
+				break;
+			}
+		}
+	}
+
+	if (all)
+		drm_backend_update_connectors(b, b->hotplug.device);
+
+	b->hotplug.all_connectors = false;
+	b->hotplug.connectors.size = 0;
+	udev_device_unref(b->hotplug.device);
+	b->hotplug.device = NULL;
+
+	return 0;
+}
+
 static enum wdrm_connector_property
 drm_connector_find_property_by_id(struct drm_connector *connector,
 				  uint32_t property_id)
@@ -2503,6 +3509,23 @@ udev_event_is_hotplug(struct drm_backend *b, struct udev_device *device)
 	return strcmp(val, "1") == 0;
 }
 
+static int
+udev_event_get_connector(struct drm_backend *b,
+			 struct udev_device *device,
+			 uint32_t *connector_id)
+{
+	const char *val;
+	int id;
+
+	val = udev_device_get_property_value(device, "CONNECTOR");
+	if (!val || !safe_strtoint(val, &id))
+		return 0;
+
+	*connector_id = id;
+
+	return 1;
+}
+
 static int
 udev_event_is_conn_prop_change(struct drm_backend *b,
 			       struct udev_device *device,
@@ -2513,11 +3536,8 @@ udev_event_is_conn_prop_change(struct drm_backend *b,
 	const char *val;
 	int id;
 
-	val = udev_device_get_property_value(device, "CONNECTOR");
-	if (!val || !safe_strtoint(val, &id))
+	if (!udev_event_get_connector(b, device, connector_id))
 		return 0;
-	else
-		*connector_id = id;
 
 	val = udev_device_get_property_value(device, "PROPERTY");
 	if (!val || !safe_strtoint(val, &id))
@@ -2528,6 +3548,60 @@ udev_event_is_conn_prop_change(struct drm_backend *b,
 	return 1;
 }
 
+/** Queue a hotplug uevent for drm_backend_hotplug_timeout()
+ *
+ * Events naming a connector re-probe just that one; anything else, or a
+ * connector we do not know yet, re-probes them all. The window starts at
+ * the first event of a burst, so a steady stream of events cannot hold
+ * hotplug handling off indefinitely.
+ */
+static void
+drm_backend_queue_hotplug(struct drm_backend *b, struct udev_device *event)
+{
+	struct wl_event_loop *loop;
+	uint32_t connector_id, *id;
+	bool pending = b->hotplug.device != NULL;
+	bool found = false;
+
+	if (!b->hotplug.timer) {
+		loop = wl_display_get_event_loop(b->compositor->wl_display);
+		b->hotplug.timer =
+			wl_event_loop_add_timer(loop,
+						drm_backend_hotplug_timeout, b);
+		if (!b->hotplug.timer) {
+			drm_backend_update_connectors(b, event);
+			return;
+		}
+	}
+
+	if (b->hotplug.all_connectors) {
+		/* nothing to add */
+	} else if (udev_event_get_connector(b, event, &connector_id)) {
+		wl_array_for_each(id, &b->hotplug.connectors) {
+			if (*id == connector_id)
+				found = true;
+		}
+
+		id = found ? NULL : wl_array_add(&b->hotplug.connectors,
+						 sizeof *id);
+		if (id)
+			*id = connector_id;
+		else if (!found)
+			b->hotplug.all_connectors = true;
+	} else {
+		b->hotplug.all_connectors = true;
+	}
+
+	udev_device_ref(event);
+	if (b->hotplug.device)
+		udev_device_unref(b->hotplug.device);
+	b->hotplug.device = event;
+
+	if (!pending)
+		wl_event_source_timer_update(b->hotplug.timer,
+					     DRM_HOTPLUG_DEBOUNCE_MSEC);
+}
+
 static int
 udev_drm_event(int fd, uint32_t mask, void *data)
 {
@@ -2541,7 +3615,7 @@ udev_drm_event(int fd, uint32_t mask, void *data)
 		if (udev_event_is_conn_prop_change(b, event, &conn_id, &prop_id))
 			drm_backend_update_conn_props(b, conn_id, prop_id);
 		else
-			drm_backend_update_connectors(b, event);
+			drm_backend_queue_hotplug(b, event);
 	}
 
 	udev_device_unref(event);
@@ -2549,6 +3623,81 @@ udev_drm_event(int fd, uint32_t mask, void *data)
 	return 1;
 }
 
+/*
+ * Open the device the GL renderer should run on, when it is not the KMS
+ * device. Render nodes need no DRM master, so this bypasses the launcher.
+ */
+static int
+drm_backend_open_render_device(struct drm_backend *b, const char *name)
+{
+	struct stat st;
+	char *filename;
+	int fd;
+
+	if (name[0] == '/')
+		filename = strdup(name);
+	else
+		str_printf(&filename, "/dev/dri/%s", name);
+	if (!filename)
+		return -1;
+
+	fd = open(filename, O_RDWR | O_CLOEXEC);
+	if (fd < 0) {
+		weston_log("couldn't open render device %s: %s\n",
+			   filename, strerror(errno));
+		free(filename);
+		return -1;
+	}
+
+	if (fstat(fd, &st) < 0 || !S_ISCHR(st.st_mode)) {
+		weston_log("render device %s is not a DRM device\n", filename);
+		close(fd);
+		free(filename);
+		return -1;
+	}
+
+	if (st.st_rdev == b->drm.devnum) {
+		weston_log("render device %s is the KMS device, "
+			   "not offloading rendering\n", filename);
+		close(fd);
+		free(filename);
+		return 0;
+	}
+
+	b->render.fd = fd;
+	b->render.filename = filename;
+	b->render.devnum = st.st_rdev;
+	weston_log("rendering on %s, scanning out on %s\n",
+		   b->render.filename, b->drm.filename);
+
+	return 0;
+}
+
+static void
+drm_backend_close_render_device(struct drm_backend *b)
+{
+	if (b->render.fd >= 0)
+		close(b->render.fd);
+	b->render.fd = -1;
+
+	free(b->render.filename);
+	b->render.filename = NULL;
+}
+
+/* Cached framebuffers and blobs are only kept in case they are asked for
+ * again, the ones in use hold references of their own. */
+static void
+drm_trim_memory(struct weston_compositor *ec, struct weston_memory_trim *trim)
+{
+	struct drm_backend *b = to_drm_backend(ec);
+
+	trim->dmabuf_imports += b->dmabuf_fb_cache_len;
+	trim->kms_objects += b->mode_blob_cache_len + b->edid_cache_len;
+
+	drm_fb_cache_flush(b);
+	drm_mode_cache_flush(b);
+}
+
 static void
 drm_destroy(struct weston_compositor *ec)
 {
@@ -2558,14 +3707,30 @@ drm_destroy(struct weston_compositor *ec)
 	struct drm_writeback *writeback, *writeback_tmp;
 
 	udev_input_destroy(&b->input);
+	drm_backend_fini_cursor_latch(b);
 
 	wl_event_source_remove(b->udev_drm_source);
 	wl_event_source_remove(b->drm_source);
+	if (b->hotplug.timer)
+		wl_event_source_remove(b->hotplug.timer);
+	if (b->hotplug.device)
+		udev_device_unref(b->hotplug.device);
+	wl_array_release(&b->hotplug.connectors);
+	if (b->first_frame_idle)
+		wl_event_source_remove(b->first_frame_idle);
 
 	b->shutting_down = true;
 
+	if (b->commit_thread)
+		drm_commit_thread_destroy(b->commit_thread);
+
 	destroy_sprites(b);
 
+	wl_list_remove(&b->metrics_listener.link);
+	weston_log_scope_destroy(b->flip_stats_scope);
+	b->flip_stats_scope = NULL;
+	weston_log_scope_destroy(b->plane_stats_scope);
+	b->plane_stats_scope = NULL;
 	weston_log_scope_destroy(b->debug);
 	b->debug = NULL;
 	weston_compositor_shutdown(ec);
@@ -2580,10 +3745,10 @@ drm_destroy(struct weston_compositor *ec)
 			      &b->writeback_connector_list, link)
 		drm_writeback_destroy(writeback);
 
-#ifdef BUILD_DRM_GBM
-	if (b->gbm)
-		gbm_device_destroy(b->gbm);
-#endif
+	drm_fb_cache_flush(b);
+	drm_mode_cache_flush(b);
+	fini_egl(b);
+	drm_backend_close_render_device(b);
 
 	udev_monitor_unref(b->udev_monitor);
 	udev_unref(b->udev);
@@ -2592,6 +3757,7 @@ drm_destroy(struct weston_compositor *ec)
 	weston_launcher_destroy(ec->launcher);
 
 	free(b->drm.filename);
+	free(b->recorder_output);
 	free(b);
 }
 
@@ -2607,13 +3773,28 @@ session_notify(struct wl_listener *listener, void *data)
 	if (compositor->session_active) {
 		weston_log("activating session\n");
 		weston_compositor_wake(compositor);
-		weston_compositor_damage_all(compositor);
-		b->state_invalid = true;
+
+		/* Our fbs, textures and plane assignments all survive the
+		 * switch; repainting from scratch is only needed when the
+		 * other session left the CRTCs in a state we cannot take
+		 * back without a modeset. */
+		if (drm_backend_try_restore_state(b)) {
+			weston_log("restoring previous KMS state\n");
+			wl_list_for_each(output, &compositor->output_list,
+					 base.link)
+				weston_output_schedule_repaint(&output->base);
+		} else {
+			weston_compositor_damage_all(compositor);
+			b->state_invalid = true;
+		}
 		udev_input_enable(&b->input);
 	} else {
 		weston_log("deactivating session\n");
 		udev_input_disable(&b->input);
 
+		if (b->commit_thread)
+			drm_commit_thread_flush(b->commit_thread);
+
 		weston_compositor_offscreen(compositor);
 
 		/* If we have a repaint scheduled (either from a
@@ -2865,12 +4046,36 @@ recorder_destroy(struct drm_output *output)
 	vaapi_recorder_destroy(output->recorder);
 	output->recorder = NULL;
 
-	weston_output_disable_planes_decr(&output->base);
+	if (!output->recorder_writeback)
+		weston_output_disable_planes_decr(&output->base);
 
 	wl_list_remove(&output->recorder_frame_listener.link);
 	weston_log("[libva recorder] done\n");
 }
 
+static void
+recorder_writeback_done(struct weston_output *output_base, int fd,
+			uint32_t format, int width, int height, int stride,
+			void *data)
+{
+	struct drm_output *output = to_drm_output(output_base);
+	int ret;
+
+	if (fd < 0)
+		return;
+
+	if (!output->recorder || format != DRM_FORMAT_XRGB8888) {
+		close(fd);
+		return;
+	}
+
+	ret = vaapi_recorder_frame(output->recorder, fd, stride);
+	if (ret < 0) {
+		weston_log("[libva recorder] aborted: %s\n", strerror(errno));
+		recorder_destroy(output);
+	}
+}
+
 static void
 recorder_frame_notify(struct wl_listener *listener, void *data)
 {
@@ -2885,6 +4090,16 @@ recorder_frame_notify(struct wl_listener *listener, void *data)
 	if (!output->recorder)
 		return;
 
+	/* The composed frame, planes included, arrives asynchronously. */
+	if (output->recorder_writeback) {
+		if (!output->capture &&
+		    drm_output_capture_writeback(&output->base,
+						 recorder_writeback_done,
+						 NULL) < 0)
+			weston_log("[libva recorder] writeback capture failed\n");
+		return;
+	}
+
 	ret = drmPrimeHandleToFD(b->drm.fd,
 				 output->scanout_plane->state_cur->fb->handles[0],
 				 DRM_CLOEXEC, &fd);
@@ -2916,7 +4131,8 @@ create_recorder(struct drm_backend *b, int width, int height,
 	drmGetMagic(fd, &magic);
 	drmAuthMagic(b->drm.fd, magic);
 
-	return vaapi_recorder_create(fd, width, height, filename);
+	return vaapi_recorder_create(fd, width, height, filename,
+				     b->recorder_queue_depth);
 }
 
 static void
@@ -2941,13 +4157,18 @@ recorder_binding(struct weston_keyboard *keyboard, const struct timespec *time,
 		height = output->base.current_mode->height;
 
 		output->recorder =
-			create_recorder(b, width, height, "capture.h264");
+			create_recorder(b, width, height,
+					b->recorder_output ?: "capture.h264");
 		if (!output->recorder) {
 			weston_log("failed to create vaapi recorder\n");
 			return;
 		}
 
-		weston_output_disable_planes_incr(&output->base);
+		/* Writeback sees the planes, the front buffer does not. */
+		output->recorder_writeback =
+			drm_output_writeback_supported(output);
+		if (!output->recorder_writeback)
+			weston_output_disable_planes_incr(&output->base);
 
 		output->recorder_frame_listener.notify = recorder_frame_notify;
 		wl_signal_add(&output->base.frame_signal,
@@ -2974,6 +4195,9 @@ static const struct weston_drm_output_api api = {
 	drm_output_set_mode,
 	drm_output_set_gbm_format,
 	drm_output_set_seat,
+	drm_output_set_vrr,
+	drm_output_set_idle_refresh,
+	drm_output_set_mirror_of,
 };
 
 static struct drm_backend *
@@ -3004,15 +4228,35 @@ drm_backend_create(struct weston_compositor *compositor,
 
 	b->state_invalid = true;
 	b->drm.fd = -1;
+	b->render.fd = -1;
 
 	b->compositor = compositor;
 	b->use_pixman = config->use_pixman;
 	b->pageflip_timeout = config->pageflip_timeout;
+	b->pageflip_timeout_recovery = config->pageflip_timeout_recovery;
+	b->cursor_late_latch = config->cursor_late_latch;
 	b->use_pixman_shadow = config->use_pixman_shadow;
+	b->pixman_repaint_threads = config->pixman_repaint_threads;
+	if (config->recorder_output)
+		b->recorder_output = strdup(config->recorder_output);
+	b->recorder_queue_depth = config->recorder_queue_depth ?
+				  config->recorder_queue_depth : 4;
 
 	b->debug = weston_compositor_add_log_scope(compositor, "drm-backend",
 						   "Debug messages from DRM/KMS backend\n",
 						   NULL, NULL, NULL);
+	b->plane_stats_scope =
+		weston_compositor_add_log_scope(compositor, "drm-plane-stats",
+						"DRM/KMS plane assignment counters\n",
+						drm_plane_stats_print_cb,
+						NULL, b);
+	b->flip_stats_scope =
+		weston_compositor_add_log_scope(compositor, "drm-flip-stats",
+						"DRM/KMS page flip timing\n",
+						drm_flip_stats_print_cb,
+						NULL, b);
+	b->metrics_listener.notify = drm_backend_write_metrics;
+	wl_signal_add(&compositor->metrics_signal, &b->metrics_listener);
 
 	compositor->backend = &b->base;
 
@@ -3052,6 +4296,14 @@ drm_backend_create(struct weston_compositor *compositor,
 		goto err_udev_dev;
 	}
 
+	if (config->render_device && b->use_pixman) {
+		weston_log("ignoring render device %s with the pixman "
+			   "renderer\n", config->render_device);
+	} else if (config->render_device) {
+		if (drm_backend_open_render_device(b, config->render_device) < 0)
+			goto err_udev_dev;
+	}
+
 	if (b->use_pixman) {
 		if (init_pixman(b) < 0) {
 			weston_log("failed to initialize pixman renderer\n");
@@ -3071,6 +4323,7 @@ drm_backend_create(struct weston_compositor *compositor,
 	b->base.create_output = drm_output_create;
 	b->base.device_changed = drm_device_changed;
 	b->base.can_scanout_dmabuf = drm_can_scanout_dmabuf;
+	b->base.trim_memory = drm_trim_memory;
 
 	weston_setup_vt_switch_bindings(compositor);
 
@@ -3087,7 +4340,12 @@ drm_backend_create(struct weston_compositor *compositor,
 	}
 
 	wl_list_init(&b->plane_list);
+	wl_list_init(&b->dmabuf_fb_cache);
+	wl_list_init(&b->mode_blob_cache);
+	wl_list_init(&b->edid_cache);
+	wl_array_init(&b->hotplug.connectors);
 	create_sprites(b);
+	drm_backend_init_cursor_latch(b);
 
 	if (udev_input_init(&b->input,
 			    compositor, b->udev, seat_id,
@@ -3112,10 +4370,19 @@ drm_backend_create(struct weston_compositor *compositor,
 	if (!b->cursors_are_broken)
 		compositor->capabilities |= WESTON_CAP_CURSOR_PLANE;
 
-	loop = wl_display_get_event_loop(compositor->wl_display);
+	/* Page flips are handled ahead of client requests. */
 	b->drm_source =
-		wl_event_loop_add_fd(loop, b->drm.fd,
-				     WL_EVENT_READABLE, on_drm_input, b);
+		wl_event_loop_add_fd(weston_compositor_get_priority_loop(compositor,
+						WESTON_EVENT_PRIORITY_FLIP),
+				     b->drm.fd, WL_EVENT_READABLE,
+				     on_drm_input, b);
+
+	if (config->commit_thread && b->atomic_modeset) {
+		b->commit_thread = drm_commit_thread_create(b);
+		if (!b->commit_thread)
+			weston_log("failed to create the commit thread, "
+				   "committing from the main loop\n");
+	}
 
 	b->udev_monitor = udev_monitor_new_from_netlink(b->udev, "udev");
 	if (b->udev_monitor == NULL) {
@@ -3124,6 +4391,7 @@ drm_backend_create(struct weston_compositor *compositor,
 	}
 	udev_monitor_filter_add_match_subsystem_devtype(b->udev_monitor,
 							"drm", NULL);
+	loop = wl_display_get_event_loop(compositor->wl_display);
 	b->udev_drm_source =
 		wl_event_loop_add_fd(loop,
 				     udev_monitor_get_fd(b->udev_monitor),
@@ -3166,6 +4434,16 @@ drm_backend_create(struct weston_compositor *compositor,
 			free(scanout_formats);
 			if (ret < 0)
 				goto err_udev_monitor;
+
+			/* With render offload, steer clients towards buffers
+			 * the KMS device can reach as well, so that they can
+			 * be composited or scanned out without copies. */
+			if (b->render.gbm &&
+			    !weston_dmabuf_feedback_tranche_create(compositor->default_dmabuf_feedback,
+								   compositor->dmabuf_feedback_format_table,
+								   b->drm.devnum, 0,
+								   CROSS_DEVICE_PREF))
+				goto err_udev_monitor;
 		}
 		if (weston_direct_display_setup(compositor) < 0)
 			weston_log("Error: initializing direct-display "
@@ -3191,6 +4469,12 @@ drm_backend_create(struct weston_compositor *compositor,
 		goto err_udev_monitor;
 	}
 
+	ret = drm_backend_init_writeback_capture_api(compositor);
+	if (ret < 0) {
+		weston_log("Failed to register writeback capture API.\n");
+		goto err_udev_monitor;
+	}
+
 	ret = drm_backend_init_virtual_output_api(compositor);
 	if (ret < 0) {
 		weston_log("Failed to register virtual output API.\n");
@@ -3203,10 +4487,13 @@ err_udev_monitor:
 	wl_event_source_remove(b->udev_drm_source);
 	udev_monitor_unref(b->udev_monitor);
 err_drm_source:
+	if (b->commit_thread)
+		drm_commit_thread_destroy(b->commit_thread);
 	wl_event_source_remove(b->drm_source);
 err_udev_input:
 	udev_input_destroy(&b->input);
 err_sprite:
+	drm_backend_fini_cursor_latch(b);
 	destroy_sprites(b);
 err_create_crtc_list:
 	drmModeFreeResources(res);
@@ -3217,11 +4504,11 @@ err_udev:
 err_launcher:
 	weston_launcher_destroy(compositor->launcher);
 err_compositor:
+	wl_list_remove(&b->metrics_listener.link);
 	weston_compositor_shutdown(compositor);
-#ifdef BUILD_DRM_GBM
-	if (b->gbm)
-		gbm_device_destroy(b->gbm);
-#endif
+	fini_egl(b);
+	drm_backend_close_render_device(b);
+	free(b->recorder_output);
 	free(b);
 	return NULL;
 }
@@ -202,7 +202,7 @@ drm_fb_destroy_gbm(struct gbm_bo *bo, void *data)
 	struct drm_fb *fb = data;
 
 	assert(fb->type == BUFFER_GBM_SURFACE || fb->type == BUFFER_CLIENT ||
-	       fb->type == BUFFER_CURSOR);
+	       fb->type == BUFFER_CURSOR || fb->type == BUFFER_VIRTUAL);
 	drm_fb_destroy(fb);
 }
 
@@ -216,6 +216,34 @@ drm_fb_destroy_dmabuf(struct drm_fb *fb)
 	drm_fb_destroy(fb);
 }
 
+static enum wdrm_plane_color_encoding
+drm_color_encoding_from_dmabuf(enum linux_dmabuf_yuv_encoding encoding)
+{
+	switch (encoding) {
+	case LINUX_DMABUF_YUV_ENCODING_BT601:
+		return WDRM_PLANE_COLOR_ENCODING_BT601;
+	case LINUX_DMABUF_YUV_ENCODING_BT709:
+		return WDRM_PLANE_COLOR_ENCODING_BT709;
+	case LINUX_DMABUF_YUV_ENCODING_BT2020:
+		return WDRM_PLANE_COLOR_ENCODING_BT2020;
+	}
+
+	return WDRM_PLANE_COLOR_ENCODING_BT601;
+}
+
+static enum wdrm_plane_color_range
+drm_color_range_from_dmabuf(enum linux_dmabuf_yuv_range range)
+{
+	switch (range) {
+	case LINUX_DMABUF_YUV_RANGE_LIMITED:
+		return WDRM_PLANE_COLOR_RANGE_LIMITED;
+	case LINUX_DMABUF_YUV_RANGE_FULL:
+		return WDRM_PLANE_COLOR_RANGE_FULL;
+	}
+
+	return WDRM_PLANE_COLOR_RANGE_LIMITED;
+}
+
 static struct drm_fb *
 drm_fb_get_from_dmabuf(struct linux_dmabuf_buffer *dmabuf,
 		       struct drm_backend *backend, bool is_opaque,
@@ -298,11 +326,17 @@ drm_fb_get_from_dmabuf(struct linux_dmabuf_buffer *dmabuf,
 	if (is_opaque)
 		fb->format = pixel_format_get_opaque_substitute(fb->format);
 
+	fb->color_encoding = drm_color_encoding_from_dmabuf(dmabuf->yuv_encoding);
+	fb->color_range = drm_color_range_from_dmabuf(dmabuf->yuv_range);
+
 	if (backend->min_width > fb->width ||
 	    fb->width > backend->max_width ||
 	    backend->min_height > fb->height ||
 	    fb->height > backend->max_height) {
 		weston_log("bo geometry out of bounds\n");
+		if (try_view_on_plane_failure_reasons)
+			*try_view_on_plane_failure_reasons |=
+				FAILURE_REASONS_FB_SIZE_INCOMPATIBLE;
 		goto err_free;
 	}
 
@@ -408,6 +442,100 @@ err_free:
 	free(fb);
 	return NULL;
 }
+
+static void
+drm_fb_destroy_render_bo(struct gbm_bo *render_bo, void *data)
+{
+	struct gbm_bo *bo = data;
+
+	/* The drm_fb is attached to the imported bo and goes with it. */
+	gbm_bo_destroy(bo);
+}
+
+static struct gbm_bo *
+drm_import_render_bo(struct gbm_bo *render_bo, struct drm_backend *backend)
+{
+	struct gbm_bo *bo;
+	int fd;
+
+	fd = gbm_bo_get_fd(render_bo);
+	if (fd < 0) {
+		weston_log("failed to export render buffer: %s\n",
+			   strerror(errno));
+		return NULL;
+	}
+
+#ifdef HAVE_GBM_FD_IMPORT
+	struct gbm_import_fd_modifier_data import_mod = {
+		.width = gbm_bo_get_width(render_bo),
+		.height = gbm_bo_get_height(render_bo),
+		.format = gbm_bo_get_format(render_bo),
+		.num_fds = gbm_bo_get_plane_count(render_bo),
+		.modifier = gbm_bo_get_modifier(render_bo),
+	};
+	unsigned int i;
+
+	/* All planes of a renderer-allocated bo live in the same dmabuf. */
+	for (i = 0; i < import_mod.num_fds; i++) {
+		import_mod.fds[i] = fd;
+		import_mod.strides[i] = gbm_bo_get_stride_for_plane(render_bo, i);
+		import_mod.offsets[i] = gbm_bo_get_offset(render_bo, i);
+	}
+
+	bo = gbm_bo_import(backend->gbm, GBM_BO_IMPORT_FD_MODIFIER,
+			   &import_mod, GBM_BO_USE_SCANOUT);
+#else
+	struct gbm_import_fd_data import_legacy = {
+		.fd = fd,
+		.width = gbm_bo_get_width(render_bo),
+		.height = gbm_bo_get_height(render_bo),
+		.stride = gbm_bo_get_stride(render_bo),
+		.format = gbm_bo_get_format(render_bo),
+	};
+
+	bo = gbm_bo_import(backend->gbm, GBM_BO_IMPORT_FD,
+			   &import_legacy, GBM_BO_USE_SCANOUT);
+#endif
+	close(fd);
+
+	if (!bo)
+		weston_log("failed to import render buffer on KMS device: %s\n",
+			   strerror(errno));
+
+	return bo;
+}
+
+/* Render offload: wrap a bo rendered on backend->render.gbm in a KMS fb.
+ *
+ * The bo is imported into the KMS device once; the import is cached on the
+ * render bo, so that it lives exactly as long as the render bo's slot in its
+ * gbm_surface. */
+struct drm_fb *
+drm_fb_get_from_render_bo(struct gbm_bo *render_bo,
+			  struct drm_backend *backend)
+{
+	struct gbm_bo *bo = gbm_bo_get_user_data(render_bo);
+	struct drm_fb *fb;
+
+	if (bo)
+		return drm_fb_get_from_bo(bo, backend, true, BUFFER_GBM_SURFACE);
+
+	bo = drm_import_render_bo(render_bo, backend);
+	if (!bo)
+		return NULL;
+
+	/* The renderer always produces an opaque image. */
+	fb = drm_fb_get_from_bo(bo, backend, true, BUFFER_GBM_SURFACE);
+	if (!fb) {
+		gbm_bo_destroy(bo);
+		return NULL;
+	}
+	fb->render_bo = render_bo;
+
+	gbm_bo_set_user_data(render_bo, bo, drm_fb_destroy_render_bo);
+
+	return fb;
+}
 #endif
 
 void
@@ -427,10 +555,12 @@ drm_fb_unref(struct drm_fb *fb)
 #ifdef BUILD_DRM_GBM
 	case BUFFER_CURSOR:
 	case BUFFER_CLIENT:
+	case BUFFER_VIRTUAL:
 		gbm_bo_destroy(fb->bo);
 		break;
 	case BUFFER_GBM_SURFACE:
-		gbm_surface_release_buffer(fb->gbm_surface, fb->bo);
+		gbm_surface_release_buffer(fb->gbm_surface,
+					   fb->render_bo ? fb->render_bo : fb->bo);
 		break;
 	case BUFFER_DMABUF:
 		drm_fb_destroy_dmabuf(fb);
@@ -442,6 +572,59 @@ drm_fb_unref(struct drm_fb *fb)
 	}
 }
 
+/**
+ * Rank a format modifier by the memory bandwidth its layout saves
+ *
+ * Compression is vendor specific, so only the schemes described by the
+ * kernel headers Weston is built against are recognised; any other
+ * explicit layout counts as tiled.
+ */
+enum drm_modifier_rank
+drm_modifier_rank(uint64_t modifier)
+{
+	uint64_t vendor = modifier >> 56;
+
+	if (modifier == DRM_FORMAT_MOD_LINEAR ||
+	    modifier == DRM_FORMAT_MOD_INVALID)
+		return DRM_MODIFIER_RANK_LINEAR;
+
+	switch (vendor) {
+	case DRM_FORMAT_MOD_VENDOR_INTEL:
+#ifdef I915_FORMAT_MOD_Y_TILED_CCS
+		if (modifier == I915_FORMAT_MOD_Y_TILED_CCS ||
+		    modifier == I915_FORMAT_MOD_Yf_TILED_CCS)
+			return DRM_MODIFIER_RANK_COMPRESSED;
+#endif
+#ifdef I915_FORMAT_MOD_Y_TILED_GEN12_RC_CCS
+		if (modifier == I915_FORMAT_MOD_Y_TILED_GEN12_RC_CCS ||
+		    modifier == I915_FORMAT_MOD_Y_TILED_GEN12_MC_CCS)
+			return DRM_MODIFIER_RANK_COMPRESSED;
+#endif
+		break;
+	case DRM_FORMAT_MOD_VENDOR_AMD:
+#ifdef AMD_FMT_MOD_GET
+		if (AMD_FMT_MOD_GET(DCC, modifier))
+			return DRM_MODIFIER_RANK_COMPRESSED;
+#endif
+		break;
+	case DRM_FORMAT_MOD_VENDOR_ARM:
+#ifdef DRM_FORMAT_MOD_ARM_TYPE_AFBC
+		if (((modifier >> 52) & DRM_FORMAT_MOD_ARM_TYPE_MASK) ==
+		    DRM_FORMAT_MOD_ARM_TYPE_AFBC)
+			return DRM_MODIFIER_RANK_COMPRESSED;
+#endif
+		break;
+	case DRM_FORMAT_MOD_VENDOR_VIVANTE:
+#ifdef VIVANTE_MOD_TS_MASK
+		if (modifier & (VIVANTE_MOD_TS_MASK | VIVANTE_MOD_COMP_MASK))
+			return DRM_MODIFIER_RANK_COMPRESSED;
+#endif
+		break;
+	}
+
+	return DRM_MODIFIER_RANK_TILED;
+}
+
 #ifdef BUILD_DRM_GBM
 bool
 drm_can_scanout_dmabuf(struct weston_compositor *ec,
@@ -461,6 +644,48 @@ drm_can_scanout_dmabuf(struct weston_compositor *ec,
 	return ret;
 }
 
+/* Planes without COLOR_ENCODING/COLOR_RANGE convert YUV as BT.601 limited
+ * range, the kernel default for both properties, so anything else needs the
+ * property along with the matching enum value. */
+static bool
+drm_fb_colorimetry_supported(struct drm_fb *fb, struct drm_plane *plane)
+{
+	struct drm_backend *b = plane->backend;
+	struct drm_property_info *encoding =
+		&plane->props[WDRM_PLANE_COLOR_ENCODING];
+	struct drm_property_info *range = &plane->props[WDRM_PLANE_COLOR_RANGE];
+
+	if (!pixel_format_is_yuv(fb->format))
+		return true;
+
+	/* Legacy drmModeSetPlane() cannot carry the properties. */
+	if (encoding->prop_id == 0 || !b->atomic_modeset) {
+		if (fb->color_encoding != WDRM_PLANE_COLOR_ENCODING_BT601)
+			goto unsupported;
+	} else if (!encoding->enum_values[fb->color_encoding].valid) {
+		goto unsupported;
+	}
+
+	if (range->prop_id == 0 || !b->atomic_modeset) {
+		if (fb->color_range != WDRM_PLANE_COLOR_RANGE_LIMITED)
+			goto unsupported;
+	} else if (!range->enum_values[fb->color_range].valid) {
+		goto unsupported;
+	}
+
+	return true;
+
+unsupported:
+	drm_debug(b, "\t\t\t\t[%s] not placing view on %s: "
+		  "plane cannot convert %s as %s, %s\n",
+		  drm_output_get_plane_type_name(plane),
+		  drm_output_get_plane_type_name(plane),
+		  fb->format->drm_format_name,
+		  plane_color_encoding_enums[fb->color_encoding].name,
+		  plane_color_range_enums[fb->color_range].name);
+	return false;
+}
+
 static bool
 drm_fb_compatible_with_plane(struct drm_fb *fb, struct drm_plane *plane)
 {
@@ -479,10 +704,10 @@ drm_fb_compatible_with_plane(struct drm_fb *fb, struct drm_plane *plane)
 		 * care in this case (even though recent versions are also using
 		 * dmabufs), and it should know better what works or not. */
 		if (fb->modifier == DRM_FORMAT_MOD_INVALID)
-			return true;
+			return drm_fb_colorimetry_supported(fb, plane);
 
 		if (weston_drm_format_has_modifier(fmt, fb->modifier))
-			return true;
+			return drm_fb_colorimetry_supported(fb, plane);
 	}
 
 	drm_debug(b, "\t\t\t\t[%s] not placing view on %s: "
@@ -498,6 +723,141 @@ drm_fb_compatible_with_plane(struct drm_fb *fb, struct drm_plane *plane)
 	return false;
 }
 
+/* Tell a format mismatch, which needs a client to pick another format, from a
+ * modifier mismatch, which only needs it to allocate differently, and from
+ * planes refusing the content itself, e.g. its YUV colorimetry, which no
+ * reallocation fixes. With a NULL plane, look at every plane. */
+uint32_t
+drm_fb_plane_failure_reason(struct drm_backend *b, struct drm_fb *fb,
+			    struct drm_plane *plane)
+{
+	uint32_t reason = FAILURE_REASONS_FB_FORMAT_INCOMPATIBLE;
+	struct weston_drm_format *fmt;
+	struct drm_plane *p;
+
+	wl_list_for_each(p, &b->plane_list, link) {
+		if (plane && p != plane)
+			continue;
+
+		fmt = weston_drm_format_array_find_format(&p->formats,
+							  fb->format->format);
+		if (!fmt)
+			continue;
+
+		if (fb->modifier != DRM_FORMAT_MOD_INVALID &&
+		    !weston_drm_format_has_modifier(fmt, fb->modifier))
+			reason = FAILURE_REASONS_FB_MODIFIER_INCOMPATIBLE;
+		else
+			return FAILURE_REASONS_PLANES_REJECTED;
+	}
+
+	return reason;
+}
+
+#define DRM_DMABUF_FB_CACHE_MAX 16
+
+struct drm_fb_cache_entry {
+	struct dmabuf_key key;
+	struct linux_dmabuf_client *client;
+	struct drm_fb *fb;
+	struct wl_list link; /* drm_backend::dmabuf_fb_cache */
+};
+
+static void
+drm_fb_cache_entry_destroy(struct drm_backend *b,
+			   struct drm_fb_cache_entry *entry)
+{
+	drm_fb_unref(entry->fb);
+	linux_dmabuf_client_unref(entry->client);
+	wl_list_remove(&entry->link);
+	b->dmabuf_fb_cache_len--;
+	free(entry);
+}
+
+void
+drm_fb_cache_flush(struct drm_backend *b)
+{
+	struct drm_fb_cache_entry *entry, *tmp;
+
+	wl_list_for_each_safe(entry, tmp, &b->dmabuf_fb_cache, link)
+		drm_fb_cache_entry_destroy(b, entry);
+}
+
+/* Takes over the reference to fb. Only called while the dmabuf's client is
+ * connected, which also means the backend is still around. */
+static void
+drm_fb_cache_put(struct drm_backend *b, struct linux_dmabuf_buffer *dmabuf,
+		 struct drm_fb *fb)
+{
+	struct drm_fb_cache_entry *entry, *tmp;
+
+	if (!dmabuf->has_key) {
+		drm_fb_unref(fb);
+		return;
+	}
+
+	entry = zalloc(sizeof *entry);
+	if (!entry) {
+		drm_fb_unref(fb);
+		return;
+	}
+
+	entry->key = dmabuf->key;
+	entry->client = linux_dmabuf_client_ref(dmabuf->client);
+	entry->fb = fb;
+	wl_list_insert(&b->dmabuf_fb_cache, &entry->link);
+	b->dmabuf_fb_cache_len++;
+
+	/* Don't keep the memory of disconnected clients alive, nor more
+	 * than a handful of buffers. */
+	wl_list_for_each_safe(entry, tmp, &b->dmabuf_fb_cache, link)
+		if (!linux_dmabuf_client_is_alive(entry->client))
+			drm_fb_cache_entry_destroy(b, entry);
+
+	while (b->dmabuf_fb_cache_len > DRM_DMABUF_FB_CACHE_MAX) {
+		entry = container_of(b->dmabuf_fb_cache.prev,
+				     struct drm_fb_cache_entry, link);
+		drm_fb_cache_entry_destroy(b, entry);
+	}
+}
+
+/* Returns a drm_fb for an earlier wl_buffer wrapping the same memory, as
+ * drm_fb_get_from_dmabuf() would have created it. */
+static struct drm_fb *
+drm_fb_cache_take(struct drm_backend *b, struct linux_dmabuf_buffer *dmabuf,
+		  bool is_opaque)
+{
+	const struct pixel_format_info *format;
+	struct drm_fb_cache_entry *entry;
+	struct drm_fb *fb;
+
+	if (!dmabuf->has_key)
+		return NULL;
+
+	format = pixel_format_get_info(dmabuf->attributes.format);
+	if (!format)
+		return NULL;
+	if (is_opaque)
+		format = pixel_format_get_opaque_substitute(format);
+
+	wl_list_for_each(entry, &b->dmabuf_fb_cache, link) {
+		fb = entry->fb;
+		if (!dmabuf_key_equal(&entry->key, &dmabuf->key) ||
+		    fb->format != format ||
+		    fb->color_encoding !=
+			drm_color_encoding_from_dmabuf(dmabuf->yuv_encoding) ||
+		    fb->color_range !=
+			drm_color_range_from_dmabuf(dmabuf->yuv_range))
+			continue;
+
+		entry->fb = NULL;
+		drm_fb_cache_entry_destroy(b, entry);
+		return fb;
+	}
+
+	return NULL;
+}
+
 static void
 drm_fb_handle_buffer_destroy(struct wl_listener *listener, void *data)
 {
@@ -507,7 +867,12 @@ drm_fb_handle_buffer_destroy(struct wl_listener *listener, void *data)
 	if (buf_fb->fb) {
 		assert(buf_fb->fb->type == BUFFER_CLIENT ||
 		       buf_fb->fb->type == BUFFER_DMABUF);
-		drm_fb_unref(buf_fb->fb);
+		if (buf_fb->dmabuf &&
+		    linux_dmabuf_client_is_alive(buf_fb->dmabuf->client))
+			drm_fb_cache_put(buf_fb->backend, buf_fb->dmabuf,
+					 buf_fb->fb);
+		else
+			drm_fb_unref(buf_fb->fb);
 	}
 
 	free(buf_fb);
@@ -526,9 +891,6 @@ drm_fb_get_from_view(struct drm_output_state *state, struct weston_view *ev,
 	struct drm_fb *fb;
 	struct drm_plane *plane;
 
-	if (ev->alpha != 1.0f)
-		return NULL;
-
 	if (!drm_view_transform_supported(ev, &output->base))
 		return NULL;
 
@@ -546,23 +908,30 @@ drm_fb_get_from_view(struct drm_output_state *state, struct weston_view *ev,
 	}
 
 	buf_fb = zalloc(sizeof(*buf_fb));
+	buf_fb->backend = b;
 	buffer->backend_private = buf_fb;
 	buf_fb->buffer_destroy_listener.notify = drm_fb_handle_buffer_destroy;
 	wl_signal_add(&buffer->destroy_signal, &buf_fb->buffer_destroy_listener);
 
-	if (wl_shm_buffer_get(buffer->resource))
+	/* wl_shm buffers can only be scanned out through their udmabuf */
+	if (wl_shm_buffer_get(buffer->resource) && !buffer->udmabuf)
 		goto unsuitable;
 
 	/* GBM is used for dmabuf import as well as from client wl_buffer. */
 	if (!b->gbm)
 		goto unsuitable;
 
-	dmabuf = linux_dmabuf_buffer_get(buffer->resource);
+	dmabuf = buffer->udmabuf;
+	if (!dmabuf)
+		dmabuf = linux_dmabuf_buffer_get(buffer->resource);
 	if (dmabuf) {
-		fb = drm_fb_get_from_dmabuf(dmabuf, b, is_opaque,
-					    &buf_fb->failure_reasons);
+		fb = drm_fb_cache_take(b, dmabuf, is_opaque);
+		if (!fb)
+			fb = drm_fb_get_from_dmabuf(dmabuf, b, is_opaque,
+						    &buf_fb->failure_reasons);
 		if (!fb)
 			goto unsuitable;
+		buf_fb->dmabuf = dmabuf;
 	} else {
 		struct gbm_bo *bo;
 
@@ -585,8 +954,8 @@ drm_fb_get_from_view(struct drm_output_state *state, struct weston_view *ev,
 			fb->plane_mask |= (1 << plane->plane_idx);
 	}
 	if (fb->plane_mask == 0) {
+		buf_fb->failure_reasons |= drm_fb_plane_failure_reason(b, fb, NULL);
 		drm_fb_unref(fb);
-		buf_fb->failure_reasons |= FAILURE_REASONS_FB_FORMAT_INCOMPATIBLE;
 		goto unsuitable;
 	}
 
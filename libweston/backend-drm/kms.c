@@ -29,7 +29,9 @@
 
 #include "config.h"
 
+#include <fcntl.h>
 #include <stdint.h>
+#include <unistd.h>
 
 #include <xf86drm.h>
 #include <xf86drmMode.h>
@@ -39,7 +41,11 @@
 #include "shared/helpers.h"
 #include "shared/weston-drm-fourcc.h"
 #include "drm-internal.h"
+#include "color.h"
 #include "pixel-formats.h"
+#include "linux-sync-file.h"
+#include "weston-probe.h"
+#include "shared/fd-util.h"
 #include "presentation-time-server-protocol.h"
 
 struct drm_property_enum_info plane_type_enums[] = {
@@ -54,6 +60,60 @@ struct drm_property_enum_info plane_type_enums[] = {
 	},
 };
 
+struct drm_property_enum_info plane_color_encoding_enums[] = {
+	[WDRM_PLANE_COLOR_ENCODING_BT601] = {
+		.name = "ITU-R BT.601 YCbCr",
+	},
+	[WDRM_PLANE_COLOR_ENCODING_BT709] = {
+		.name = "ITU-R BT.709 YCbCr",
+	},
+	[WDRM_PLANE_COLOR_ENCODING_BT2020] = {
+		.name = "ITU-R BT.2020 YCbCr",
+	},
+};
+
+struct drm_property_enum_info plane_color_range_enums[] = {
+	[WDRM_PLANE_COLOR_RANGE_LIMITED] = {
+		.name = "YCbCr limited range",
+	},
+	[WDRM_PLANE_COLOR_RANGE_FULL] = {
+		.name = "YCbCr full range",
+	},
+};
+
+struct drm_property_enum_info plane_blend_mode_enums[] = {
+	[WDRM_PLANE_BLEND_MODE_NONE] = {
+		.name = "None",
+	},
+	[WDRM_PLANE_BLEND_MODE_PREMULTI] = {
+		.name = "Pre-multiplied",
+	},
+	[WDRM_PLANE_BLEND_MODE_COVERAGE] = {
+		.name = "Coverage",
+	},
+};
+
+struct drm_property_enum_info plane_rotation_enums[] = {
+	[WDRM_PLANE_ROTATION_0] = {
+		.name = "rotate-0",
+	},
+	[WDRM_PLANE_ROTATION_90] = {
+		.name = "rotate-90",
+	},
+	[WDRM_PLANE_ROTATION_180] = {
+		.name = "rotate-180",
+	},
+	[WDRM_PLANE_ROTATION_270] = {
+		.name = "rotate-270",
+	},
+	[WDRM_PLANE_ROTATION_REFLECT_X] = {
+		.name = "reflect-x",
+	},
+	[WDRM_PLANE_ROTATION_REFLECT_Y] = {
+		.name = "reflect-y",
+	},
+};
+
 const struct drm_property_info plane_props[] = {
 	[WDRM_PLANE_TYPE] = {
 		.name = "type",
@@ -74,6 +134,27 @@ const struct drm_property_info plane_props[] = {
 	[WDRM_PLANE_IN_FENCE_FD] = { .name = "IN_FENCE_FD" },
 	[WDRM_PLANE_FB_DAMAGE_CLIPS] = { .name = "FB_DAMAGE_CLIPS" },
 	[WDRM_PLANE_ZPOS] = { .name = "zpos" },
+	[WDRM_PLANE_COLOR_ENCODING] = {
+		.name = "COLOR_ENCODING",
+		.enum_values = plane_color_encoding_enums,
+		.num_enum_values = WDRM_PLANE_COLOR_ENCODING__COUNT,
+	},
+	[WDRM_PLANE_COLOR_RANGE] = {
+		.name = "COLOR_RANGE",
+		.enum_values = plane_color_range_enums,
+		.num_enum_values = WDRM_PLANE_COLOR_RANGE__COUNT,
+	},
+	[WDRM_PLANE_ROTATION] = {
+		.name = "rotation",
+		.enum_values = plane_rotation_enums,
+		.num_enum_values = WDRM_PLANE_ROTATION__COUNT,
+	},
+	[WDRM_PLANE_ALPHA] = { .name = "alpha" },
+	[WDRM_PLANE_BLEND_MODE] = {
+		.name = "pixel blend mode",
+		.enum_values = plane_blend_mode_enums,
+		.num_enum_values = WDRM_PLANE_BLEND_MODE__COUNT,
+	},
 };
 
 struct drm_property_enum_info dpms_state_enums[] = {
@@ -143,11 +224,26 @@ const struct drm_property_info connector_props[] = {
 		.enum_values = panel_orientation_enums,
 		.num_enum_values = WDRM_PANEL_ORIENTATION__COUNT,
 	},
+	[WDRM_CONNECTOR_VRR_CAPABLE] = { .name = "vrr_capable", },
+	[WDRM_CONNECTOR_WRITEBACK_PIXEL_FORMATS] = {
+		.name = "WRITEBACK_PIXEL_FORMATS",
+	},
+	[WDRM_CONNECTOR_WRITEBACK_FB_ID] = { .name = "WRITEBACK_FB_ID", },
+	[WDRM_CONNECTOR_WRITEBACK_OUT_FENCE_PTR] = {
+		.name = "WRITEBACK_OUT_FENCE_PTR",
+	},
 };
 
 const struct drm_property_info crtc_props[] = {
 	[WDRM_CRTC_MODE_ID] = { .name = "MODE_ID", },
 	[WDRM_CRTC_ACTIVE] = { .name = "ACTIVE", },
+	[WDRM_CRTC_OUT_FENCE_PTR] = { .name = "OUT_FENCE_PTR", },
+	[WDRM_CRTC_DEGAMMA_LUT] = { .name = "DEGAMMA_LUT", },
+	[WDRM_CRTC_DEGAMMA_LUT_SIZE] = { .name = "DEGAMMA_LUT_SIZE", },
+	[WDRM_CRTC_CTM] = { .name = "CTM", },
+	[WDRM_CRTC_GAMMA_LUT] = { .name = "GAMMA_LUT", },
+	[WDRM_CRTC_GAMMA_LUT_SIZE] = { .name = "GAMMA_LUT_SIZE", },
+	[WDRM_CRTC_VRR_ENABLED] = { .name = "VRR_ENABLED", },
 };
 
 
@@ -354,7 +450,8 @@ drm_property_info_populate(struct drm_backend *b,
 			continue;
 		}
 
-		if (!(prop->flags & DRM_MODE_PROP_ENUM)) {
+		if (!(prop->flags & (DRM_MODE_PROP_ENUM |
+				     DRM_MODE_PROP_BITMASK))) {
 			weston_log("DRM: expected property %s to be an enum,"
 				   " but it is not; ignoring\n", prop->name);
 			drmModeFreeProperty(prop);
@@ -524,6 +621,189 @@ drm_output_set_gamma(struct weston_output *output_base,
 		weston_log("set gamma failed: %s\n", strerror(errno));
 }
 
+static uint16_t
+color_lut_value(float v)
+{
+	if (!(v > 0.0f))
+		return 0;
+	if (v >= 1.0f)
+		return 0xffff;
+	return v * 0xffff + 0.5f;
+}
+
+/* S31.32 sign-magnitude, as in struct drm_color_ctm */
+static uint64_t
+color_ctm_value(float v)
+{
+	bool neg = v < 0.0f;
+	uint64_t mag = (neg ? -v : v) * (double)(1ull << 32) + 0.5;
+
+	return neg ? mag | (1ull << 63) : mag;
+}
+
+static bool
+drm_color_curve_supported(struct drm_crtc *crtc,
+			  const struct weston_color_curve *curve,
+			  enum wdrm_crtc_property prop, uint32_t lut_size)
+{
+	switch (curve->type) {
+	case WESTON_COLOR_CURVE_TYPE_IDENTITY:
+		return true;
+	case WESTON_COLOR_CURVE_TYPE_LUT_3x1D:
+		return crtc->props_crtc[prop].prop_id != 0 && lut_size > 1;
+	}
+
+	return false;
+}
+
+static int
+drm_color_curve_create_blob(struct drm_backend *b,
+			    struct weston_color_transform *xform,
+			    const struct weston_color_curve *curve,
+			    uint32_t lut_size, uint32_t *blob_id)
+{
+	struct drm_color_lut *lut;
+	float *values;
+	uint32_t i;
+	int ret = -1;
+
+	*blob_id = 0;
+	if (curve->type == WESTON_COLOR_CURVE_TYPE_IDENTITY)
+		return 0;
+
+	values = calloc(lut_size * 3, sizeof *values);
+	lut = calloc(lut_size, sizeof *lut);
+	if (!values || !lut)
+		goto out;
+
+	curve->u.lut_3x1d.fill_in(xform, values, lut_size);
+	for (i = 0; i < lut_size; i++) {
+		lut[i].red = color_lut_value(values[i]);
+		lut[i].green = color_lut_value(values[lut_size + i]);
+		lut[i].blue = color_lut_value(values[2 * lut_size + i]);
+	}
+
+	ret = drmModeCreatePropertyBlob(b->drm.fd, lut,
+					lut_size * sizeof *lut, blob_id);
+
+out:
+	free(values);
+	free(lut);
+	return ret;
+}
+
+static int
+drm_color_mapping_create_blob(struct drm_backend *b,
+			      const struct weston_color_mapping *mapping,
+			      uint32_t *blob_id)
+{
+	struct drm_color_ctm ctm;
+	const float *m = mapping->u.mat.matrix;
+	unsigned row, col;
+
+	*blob_id = 0;
+	if (mapping->type == WESTON_COLOR_MAPPING_TYPE_IDENTITY)
+		return 0;
+
+	assert(mapping->type == WESTON_COLOR_MAPPING_TYPE_MATRIX);
+
+	/* The CTM is row-major, weston's matrix column-major. */
+	for (row = 0; row < 3; row++)
+		for (col = 0; col < 3; col++)
+			ctm.matrix[row * 3 + col] =
+				color_ctm_value(m[col * 3 + row]);
+
+	return drmModeCreatePropertyBlob(b->drm.fd, &ctm, sizeof ctm, blob_id);
+}
+
+/**
+ * Apply the output color transformation on the CRTC instead of the renderer
+ *
+ * The CRTC color pipeline DEGAMMA_LUT, CTM and GAMMA_LUT maps onto a
+ * pre-curve, matrix and post-curve transformation. If the whole sRGB to
+ * output transformation fits, the renderer composites in sRGB without any
+ * shadow framebuffer, and views need no color transformation to be put on
+ * planes, since the CRTC converts everything it scans out.
+ *
+ * Must be called while enabling the output, before the renderer state is
+ * created.
+ */
+void
+drm_output_offload_color_transform(struct drm_output *output)
+{
+	struct drm_backend *b = to_drm_backend(output->base.compositor);
+	struct weston_color_transform *xform = output->base.from_sRGB_to_output;
+	struct drm_crtc *crtc = output->crtc;
+
+	if (!b->atomic_modeset)
+		return;
+
+	/* The interim steps would stay on the CRTC for good. */
+	if (xform && xform->pending)
+		return;
+
+	if (xform) {
+		if (!drm_color_curve_supported(crtc, &xform->pre_curve,
+					       WDRM_CRTC_DEGAMMA_LUT,
+					       crtc->degamma_lut_size) ||
+		    !drm_color_curve_supported(crtc, &xform->post_curve,
+					       WDRM_CRTC_GAMMA_LUT,
+					       crtc->gamma_lut_size))
+			return;
+
+		switch (xform->mapping.type) {
+		case WESTON_COLOR_MAPPING_TYPE_IDENTITY:
+			break;
+		case WESTON_COLOR_MAPPING_TYPE_MATRIX:
+			if (crtc->props_crtc[WDRM_CRTC_CTM].prop_id == 0)
+				return;
+			break;
+		case WESTON_COLOR_MAPPING_TYPE_3D_LUT:
+			return;
+		}
+
+		if (drm_color_curve_create_blob(b, xform, &xform->pre_curve,
+						crtc->degamma_lut_size,
+						&output->degamma_lut_blob_id) < 0 ||
+		    drm_color_mapping_create_blob(b, &xform->mapping,
+						  &output->ctm_blob_id) < 0 ||
+		    drm_color_curve_create_blob(b, xform, &xform->post_curve,
+						crtc->gamma_lut_size,
+						&output->gamma_lut_blob_id) < 0) {
+			weston_log("Output %s: failed to create color blobs: %s\n",
+				   output->base.name, strerror(errno));
+			drm_output_fini_color_transform(output);
+			return;
+		}
+
+		/* GAMMA_LUT now belongs to the color transformation. */
+		output->base.gamma_size = 0;
+
+		weston_log("Output %s: color transformation done by the CRTC\n",
+			   output->base.name);
+	}
+
+	weston_output_set_color_transform_by_backend(&output->base);
+}
+
+void
+drm_output_fini_color_transform(struct drm_output *output)
+{
+	struct drm_backend *b = to_drm_backend(output->base.compositor);
+	uint32_t *blobs[] = {
+		&output->degamma_lut_blob_id,
+		&output->ctm_blob_id,
+		&output->gamma_lut_blob_id,
+	};
+	unsigned i;
+
+	for (i = 0; i < ARRAY_LENGTH(blobs); i++) {
+		if (*blobs[i] != 0)
+			drmModeDestroyPropertyBlob(b->drm.fd, *blobs[i]);
+		*blobs[i] = 0;
+	}
+}
+
 /**
  * Mark an output state as current on the output, i.e. it has been
  * submitted to the kernel. The mode argument determines whether this
@@ -551,6 +831,10 @@ drm_output_assign_state(struct drm_output_state *state,
 	state->pending_state = NULL;
 
 	output->state_cur = state;
+	output->base.vrr_enabled = state->vrr_enabled;
+
+	if (mode == DRM_STATE_APPLY_ASYNC)
+		drm_output_flip_submitted(output);
 
 	if (b->atomic_modeset && mode == DRM_STATE_APPLY_ASYNC) {
 		drm_debug(b, "\t[CRTC:%u] setting pending flip\n",
@@ -642,6 +926,232 @@ err:
 	drmModeSetCursor(b->drm.fd, crtc->crtc_id, 0, 0, 0);
 }
 
+/**
+ * Per-seat pointer tracking for cursor late-latching
+ *
+ * A repaint only picks up pointer motion at the start of the next frame, so
+ * motion arriving while a flip is outstanding is displayed a full frame
+ * later than it could be. An atomic commit cannot be amended once queued,
+ * but the legacy cursor ioctl can move the cursor plane independently of
+ * the pending flip on drivers supporting asynchronous cursor updates.
+ */
+struct drm_cursor_latch {
+	struct drm_backend *backend;
+	struct weston_seat *seat;
+	struct weston_pointer *pointer;
+
+	struct wl_list link; /* drm_backend::cursor_latch_list */
+
+	struct wl_listener seat_destroy_listener;
+	struct wl_listener caps_listener;
+	struct wl_listener motion_listener;
+	struct wl_listener pointer_destroy_listener;
+};
+
+static void
+drm_output_late_latch_cursor(struct drm_output *output, struct weston_view *ev)
+{
+	struct drm_backend *b = to_drm_backend(output->base.compositor);
+	struct drm_plane *plane = output->cursor_plane;
+	struct drm_plane_state tmp;
+
+	if (!plane || !plane->state_cur->fb ||
+	    plane->state_cur->output != output)
+		return;
+
+	/* Once the flip has completed, the next repaint is going to place
+	 * the cursor anyway; only a frame still in flight is worth amending. */
+	if (output->base.repaint_status != REPAINT_AWAITING_COMPLETION)
+		return;
+
+	/* Work on a copy: the coordinates are only committed to the current
+	 * state if the cursor can be moved without cropping, which would need
+	 * a new cursor BO and thus a full repaint. */
+	tmp = *plane->state_cur;
+	if (!drm_plane_state_coords_for_view(&tmp, ev, tmp.zpos))
+		return;
+
+	if (tmp.src_x != 0 || tmp.src_y != 0 ||
+	    tmp.src_w != tmp.dest_w << 16 || tmp.src_h != tmp.dest_h << 16)
+		return;
+
+	if (tmp.dest_x == plane->state_cur->dest_x &&
+	    tmp.dest_y == plane->state_cur->dest_y)
+		return;
+
+	if (drmModeMoveCursor(b->drm.fd, output->crtc->crtc_id,
+			      tmp.dest_x, tmp.dest_y)) {
+		weston_log("failed to move cursor: %s\n", strerror(errno));
+		return;
+	}
+
+	drm_debug(b, "\t[repaint] late-latched cursor on output %s to %d,%d\n",
+		  output->base.name, tmp.dest_x, tmp.dest_y);
+
+	/* The next commit must start from where the cursor actually is. */
+	plane->state_cur->dest_x = tmp.dest_x;
+	plane->state_cur->dest_y = tmp.dest_y;
+}
+
+static void
+drm_cursor_latch_handle_motion(struct wl_listener *listener, void *data)
+{
+	struct drm_cursor_latch *latch =
+		container_of(listener, struct drm_cursor_latch,
+			     motion_listener);
+	struct drm_backend *b = latch->backend;
+	struct weston_pointer *pointer = data;
+	struct weston_view *ev = pointer->sprite;
+	struct drm_output *output;
+
+	if (!b->cursor_late_latch || b->cursors_are_broken ||
+	    b->shutting_down || !ev)
+		return;
+
+	weston_view_update_transform(ev);
+
+	/* The cursor plane can only be moved for a view lying entirely
+	 * within a single output. */
+	if (!ev->output || ev->output_mask != (1u << ev->output->id))
+		return;
+
+	output = to_drm_output(ev->output);
+	if (output->virtual || output->cursor_view != ev)
+		return;
+
+	drm_output_late_latch_cursor(output, ev);
+}
+
+static void
+drm_cursor_latch_unwatch_pointer(struct drm_cursor_latch *latch)
+{
+	if (!latch->pointer)
+		return;
+
+	wl_list_remove(&latch->motion_listener.link);
+	wl_list_remove(&latch->pointer_destroy_listener.link);
+	latch->pointer = NULL;
+}
+
+static void
+drm_cursor_latch_handle_pointer_destroy(struct wl_listener *listener,
+					void *data)
+{
+	struct drm_cursor_latch *latch =
+		container_of(listener, struct drm_cursor_latch,
+			     pointer_destroy_listener);
+
+	drm_cursor_latch_unwatch_pointer(latch);
+}
+
+static void
+drm_cursor_latch_handle_caps(struct wl_listener *listener, void *data)
+{
+	struct drm_cursor_latch *latch =
+		container_of(listener, struct drm_cursor_latch, caps_listener);
+	struct weston_pointer *pointer = weston_seat_get_pointer(latch->seat);
+
+	if (pointer == latch->pointer)
+		return;
+
+	drm_cursor_latch_unwatch_pointer(latch);
+	if (!pointer)
+		return;
+
+	latch->pointer = pointer;
+	latch->motion_listener.notify = drm_cursor_latch_handle_motion;
+	wl_signal_add(&pointer->motion_signal, &latch->motion_listener);
+	latch->pointer_destroy_listener.notify =
+		drm_cursor_latch_handle_pointer_destroy;
+	wl_signal_add(&pointer->destroy_signal,
+		      &latch->pointer_destroy_listener);
+}
+
+static void
+drm_cursor_latch_destroy(struct drm_cursor_latch *latch)
+{
+	drm_cursor_latch_unwatch_pointer(latch);
+	wl_list_remove(&latch->caps_listener.link);
+	wl_list_remove(&latch->seat_destroy_listener.link);
+	wl_list_remove(&latch->link);
+	free(latch);
+}
+
+static void
+drm_cursor_latch_handle_seat_destroy(struct wl_listener *listener, void *data)
+{
+	struct drm_cursor_latch *latch =
+		container_of(listener, struct drm_cursor_latch,
+			     seat_destroy_listener);
+
+	drm_cursor_latch_destroy(latch);
+}
+
+static void
+drm_cursor_latch_create(struct drm_backend *b, struct weston_seat *seat)
+{
+	struct drm_cursor_latch *latch;
+
+	latch = zalloc(sizeof *latch);
+	if (!latch) {
+		weston_log("%s: out of memory\n", __func__);
+		return;
+	}
+
+	latch->backend = b;
+	latch->seat = seat;
+	wl_list_insert(&b->cursor_latch_list, &latch->link);
+
+	latch->seat_destroy_listener.notify =
+		drm_cursor_latch_handle_seat_destroy;
+	wl_signal_add(&seat->destroy_signal, &latch->seat_destroy_listener);
+	latch->caps_listener.notify = drm_cursor_latch_handle_caps;
+	wl_signal_add(&seat->updated_caps_signal, &latch->caps_listener);
+
+	drm_cursor_latch_handle_caps(&latch->caps_listener, seat);
+}
+
+static void
+drm_backend_handle_seat_created(struct wl_listener *listener, void *data)
+{
+	struct drm_backend *b =
+		container_of(listener, struct drm_backend,
+			     seat_created_listener);
+
+	drm_cursor_latch_create(b, data);
+}
+
+void
+drm_backend_init_cursor_latch(struct drm_backend *b)
+{
+	struct weston_compositor *ec = b->compositor;
+	struct weston_seat *seat;
+
+	wl_list_init(&b->cursor_latch_list);
+	wl_list_init(&b->seat_created_listener.link);
+
+	if (!b->cursor_late_latch)
+		return;
+
+	b->seat_created_listener.notify = drm_backend_handle_seat_created;
+	wl_signal_add(&ec->seat_created_signal, &b->seat_created_listener);
+
+	wl_list_for_each(seat, &ec->seat_list, link)
+		drm_cursor_latch_create(b, seat);
+}
+
+void
+drm_backend_fini_cursor_latch(struct drm_backend *b)
+{
+	struct drm_cursor_latch *latch, *tmp;
+
+	wl_list_remove(&b->seat_created_listener.link);
+	wl_list_init(&b->seat_created_listener.link);
+
+	wl_list_for_each_safe(latch, tmp, &b->cursor_latch_list, link)
+		drm_cursor_latch_destroy(latch);
+}
+
 static int
 drm_output_apply_state_legacy(struct drm_output_state *state)
 {
@@ -740,7 +1250,19 @@ drm_output_apply_state_legacy(struct drm_output_state *state)
 			   crtc->crtc_id, scanout_state->plane->plane_id,
 			   pinfo ? pinfo->drm_format_name : "UNKNOWN");
 
-	if (drmModePageFlip(backend->drm.fd, crtc->crtc_id,
+	if (state->async_flip &&
+	    drmModePageFlip(backend->drm.fd, crtc->crtc_id,
+			    scanout_state->fb->fb_id,
+			    DRM_MODE_PAGE_FLIP_EVENT | DRM_MODE_PAGE_FLIP_ASYNC,
+			    output) < 0) {
+		weston_log("async pageflip refused: %s, falling back to "
+			   "vsync\n", strerror(errno));
+		output->async_flip_refused = true;
+		state->async_flip = false;
+	}
+
+	if (!state->async_flip &&
+	    drmModePageFlip(backend->drm.fd, crtc->crtc_id,
 			    scanout_state->fb->fb_id,
 			    DRM_MODE_PAGE_FLIP_EVENT, output) < 0) {
 		weston_log("queueing pageflip failed: %s\n", strerror(errno));
@@ -749,10 +1271,6 @@ drm_output_apply_state_legacy(struct drm_output_state *state)
 
 	assert(!output->page_flip_pending);
 
-	if (output->pageflip_timer)
-		wl_event_source_timer_update(output->pageflip_timer,
-		                             backend->pageflip_timeout);
-
 	drm_output_set_cursor(state);
 
 	if (state->dpms != output->state_cur->dpms) {
@@ -921,6 +1439,217 @@ drm_connector_set_hdcp_property(struct drm_connector *connector,
 	assert(ret == 0);
 }
 
+/* The explicit-sync release of the client buffer a plane currently scans
+ * out, if this state replaces it. */
+static struct weston_buffer_release *
+drm_plane_state_replaced_release(struct drm_plane_state *plane_state)
+{
+	struct drm_plane_state *cur = plane_state->plane->state_cur;
+	struct weston_buffer_release *release;
+
+	if (!cur || cur == plane_state)
+		return NULL;
+
+	release = cur->fb_ref.release.buffer_release;
+	if (!release || release == plane_state->fb_ref.release.buffer_release)
+		return NULL;
+
+	return release;
+}
+
+static bool
+drm_output_state_replaces_releases(struct drm_output_state *state)
+{
+	struct drm_plane_state *plane_state;
+
+	wl_list_for_each(plane_state, &state->plane_list, link)
+		if (drm_plane_state_replaced_release(plane_state))
+			return true;
+
+	return false;
+}
+
+static bool
+drm_buffer_release_add_fence(struct weston_buffer_release *release,
+			     int fence_fd)
+{
+	int fd;
+
+	/* The GL renderer may already have fenced the buffer for an
+	 * output it composited it on; the client must wait for both. */
+	if (release->fence_fd >= 0)
+		fd = weston_linux_sync_file_merge(release->fence_fd, fence_fd);
+	else
+		fd = fcntl(fence_fd, F_DUPFD_CLOEXEC, 0);
+
+	if (fd < 0)
+		return false;
+
+	fd_update(&release->fence_fd, fd);
+	return true;
+}
+
+/* Once a commit requesting an out-fence went through, client buffers it
+ * takes off the planes can go back to their explicit-sync clients right
+ * away, with the fence telling them when the hardware stopped reading.
+ * The wl_buffer itself is still released on the next flip event. */
+static void
+drm_output_state_send_fenced_releases(struct drm_output_state *state)
+{
+	struct drm_backend *b = to_drm_backend(state->output->base.compositor);
+	struct weston_buffer_release *release;
+	struct drm_plane_state *plane_state;
+
+	if (state->out_fence_fd < 0)
+		return;
+
+	wl_list_for_each(plane_state, &state->plane_list, link) {
+		release = drm_plane_state_replaced_release(plane_state);
+		if (!release)
+			continue;
+
+		/* Without a fence, keep the release until the flip event. */
+		if (!drm_buffer_release_add_fence(release, state->out_fence_fd))
+			continue;
+
+		drm_debug(b, "			[atomic] plane %lu: fenced release\n",
+			  (unsigned long) plane_state->plane->plane_id);
+		weston_buffer_release_reference(&plane_state->plane->state_cur->fb_ref.release,
+						NULL);
+	}
+
+	fd_clear(&state->out_fence_fd);
+}
+
+static int
+drm_output_add_color_props(struct drm_output *output, drmModeAtomicReq *req)
+{
+	struct drm_crtc *crtc = output->crtc;
+	int ret = 0;
+
+	/* Identity stages are reset, too: whatever was there before is not
+	 * part of the transformation. */
+	if (crtc->props_crtc[WDRM_CRTC_DEGAMMA_LUT].prop_id != 0)
+		ret |= crtc_add_prop(req, crtc, WDRM_CRTC_DEGAMMA_LUT,
+				     output->degamma_lut_blob_id);
+	if (crtc->props_crtc[WDRM_CRTC_CTM].prop_id != 0)
+		ret |= crtc_add_prop(req, crtc, WDRM_CRTC_CTM,
+				     output->ctm_blob_id);
+	if (crtc->props_crtc[WDRM_CRTC_GAMMA_LUT].prop_id != 0)
+		ret |= crtc_add_prop(req, crtc, WDRM_CRTC_GAMMA_LUT,
+				     output->gamma_lut_blob_id);
+
+	return ret;
+}
+
+/* The kernel clears WRITEBACK_FB_ID after every commit, so routing the
+ * connector away is all a detach needs. */
+static int
+drm_output_add_writeback_props(struct drm_output *output,
+			       drmModeAtomicReq *req, uint32_t flags)
+{
+	struct drm_writeback_capture *capture = output->capture;
+	struct drm_connector *connector;
+	int ret = 0;
+
+	if (capture && !capture->committed) {
+		connector = &capture->writeback->connector;
+		ret |= connector_add_prop(req, connector,
+					  WDRM_CONNECTOR_CRTC_ID,
+					  output->crtc->crtc_id);
+		ret |= connector_add_prop(req, connector,
+					  WDRM_CONNECTOR_WRITEBACK_FB_ID,
+					  capture->fb->fb_id);
+		fd_clear(&capture->out_fence_fd);
+		if (!(flags & DRM_MODE_ATOMIC_TEST_ONLY))
+			ret |= connector_add_prop(req, connector,
+						  WDRM_CONNECTOR_WRITEBACK_OUT_FENCE_PTR,
+						  (uintptr_t) &capture->out_fence_fd);
+	} else if (output->writeback_routed && !capture) {
+		connector = &output->writeback_routed->connector;
+		ret |= connector_add_prop(req, connector,
+					  WDRM_CONNECTOR_CRTC_ID, 0);
+	}
+
+	return ret;
+}
+
+/**
+ * Get the rotation property value showing a buffer with a transform
+ *
+ * \param plane The plane to show the buffer on.
+ * \param transform How the buffer contents must be turned to appear
+ * upright on the CRTC, in wl_output terms: counter-clockwise rotation,
+ * flipped around the vertical axis first.
+ * \param rotation Set to the bitmask for the rotation property, which
+ * is 0 when the plane has none.
+ * \return 0 on success, -1 if the plane cannot apply the transform.
+ */
+int
+drm_plane_get_rotation(struct drm_plane *plane,
+			enum wl_output_transform transform,
+			uint64_t *rotation)
+{
+	static const enum wdrm_plane_rotation rotations[] = {
+		[WL_OUTPUT_TRANSFORM_NORMAL] = WDRM_PLANE_ROTATION_0,
+		[WL_OUTPUT_TRANSFORM_90] = WDRM_PLANE_ROTATION_90,
+		[WL_OUTPUT_TRANSFORM_180] = WDRM_PLANE_ROTATION_180,
+		[WL_OUTPUT_TRANSFORM_270] = WDRM_PLANE_ROTATION_270,
+		[WL_OUTPUT_TRANSFORM_FLIPPED] = WDRM_PLANE_ROTATION_0,
+		[WL_OUTPUT_TRANSFORM_FLIPPED_90] = WDRM_PLANE_ROTATION_90,
+		[WL_OUTPUT_TRANSFORM_FLIPPED_180] = WDRM_PLANE_ROTATION_180,
+		[WL_OUTPUT_TRANSFORM_FLIPPED_270] = WDRM_PLANE_ROTATION_270,
+	};
+	struct drm_property_info *info = &plane->props[WDRM_PLANE_ROTATION];
+	struct drm_property_enum_info *rot, *reflect;
+
+	*rotation = 0;
+
+	if (info->prop_id == 0)
+		return transform == WL_OUTPUT_TRANSFORM_NORMAL ? 0 : -1;
+
+	assert((unsigned) transform < ARRAY_LENGTH(rotations));
+	rot = &info->enum_values[rotations[transform]];
+	if (!rot->valid)
+		return -1;
+	*rotation = 1ull << rot->value;
+
+	if (transform >= WL_OUTPUT_TRANSFORM_FLIPPED) {
+		reflect = &info->enum_values[WDRM_PLANE_ROTATION_REFLECT_X];
+		if (!reflect->valid)
+			return -1;
+		*rotation |= 1ull << reflect->value;
+	}
+
+	return 0;
+}
+
+/**
+ * Check whether a plane can be left out of an atomic commit
+ *
+ * When the renderer kept the previous fb because nothing on the primary
+ * plane changed, the kernel already has the exact same plane state, and
+ * only the other planes of the CRTC need reprogramming. A modeset always
+ * carries every plane.
+ */
+static bool
+drm_plane_state_can_skip(struct drm_plane_state *state, uint32_t flags)
+{
+	struct drm_plane_state *cur = state->plane->state_cur;
+
+	if (!state->fb_reused || (flags & DRM_MODE_ATOMIC_ALLOW_MODESET))
+		return false;
+
+	return cur->fb == state->fb && cur->output == state->output &&
+	       cur->src_x == state->src_x && cur->src_y == state->src_y &&
+	       cur->src_w == state->src_w && cur->src_h == state->src_h &&
+	       cur->dest_x == state->dest_x && cur->dest_y == state->dest_y &&
+	       cur->dest_w == state->dest_w && cur->dest_h == state->dest_h &&
+	       cur->zpos == state->zpos && cur->rotation == state->rotation &&
+	       cur->alpha == state->alpha &&
+	       cur->blend_mode == state->blend_mode && state->in_fence_fd < 0;
+}
+
 static int
 drm_output_apply_state_atomic(struct drm_output_state *state,
 			      drmModeAtomicReq *req,
@@ -938,7 +1667,8 @@ drm_output_apply_state_atomic(struct drm_output_state *state,
 		  (*flags & DRM_MODE_ATOMIC_TEST_ONLY) ? "testing" : "applying",
 		  (unsigned long) output->base.id, output->base.name);
 
-	if (state->dpms != output->state_cur->dpms) {
+	if (state->dpms != output->state_cur->dpms &&
+	    !(output->seamless_handoff && state->dpms == WESTON_DPMS_ON)) {
 		drm_debug(b, "\t\t\t[atomic] DPMS state differs, modeset OK\n");
 		*flags |= DRM_MODE_ATOMIC_ALLOW_MODESET;
 	}
@@ -952,6 +1682,22 @@ drm_output_apply_state_atomic(struct drm_output_state *state,
 				     current_mode->blob_id);
 		ret |= crtc_add_prop(req, crtc, WDRM_CRTC_ACTIVE, 1);
 
+		if (crtc->props_crtc[WDRM_CRTC_VRR_ENABLED].prop_id != 0)
+			ret |= crtc_add_prop(req, crtc, WDRM_CRTC_VRR_ENABLED,
+					     state->vrr_enabled);
+
+		if (output->base.from_blend_to_output_by_backend &&
+		    output->base.from_blend_to_output)
+			ret |= drm_output_add_color_props(output, req);
+
+		/* Test commits would hand out a fence for nothing. */
+		fd_clear(&state->out_fence_fd);
+		if (!(*flags & DRM_MODE_ATOMIC_TEST_ONLY) &&
+		    crtc->props_crtc[WDRM_CRTC_OUT_FENCE_PTR].prop_id != 0 &&
+		    drm_output_state_replaces_releases(state))
+			ret |= crtc_add_prop(req, crtc, WDRM_CRTC_OUT_FENCE_PTR,
+					     (uintptr_t) &state->out_fence_fd);
+
 		/* No need for the DPMS property, since it is implicit in
 		 * routing and CRTC activity. */
 		wl_list_for_each(head, &output->base.head_list, base.output_link) {
@@ -959,6 +1705,8 @@ drm_output_apply_state_atomic(struct drm_output_state *state,
 						  WDRM_CONNECTOR_CRTC_ID,
 						  crtc->crtc_id);
 		}
+
+		ret |= drm_output_add_writeback_props(output, req, *flags);
 	} else {
 		ret |= crtc_add_prop(req, crtc, WDRM_CRTC_MODE_ID, 0);
 		ret |= crtc_add_prop(req, crtc, WDRM_CRTC_ACTIVE, 0);
@@ -968,6 +1716,12 @@ drm_output_apply_state_atomic(struct drm_output_state *state,
 		wl_list_for_each(head, &output->base.head_list, base.output_link)
 			ret |= connector_add_prop(req, &head->connector,
 						  WDRM_CONNECTOR_CRTC_ID, 0);
+
+		/* A capture waits for the CRTC to come back on. */
+		if (output->writeback_routed && !output->capture)
+			ret |= connector_add_prop(req,
+						  &output->writeback_routed->connector,
+						  WDRM_CONNECTOR_CRTC_ID, 0);
 	}
 
 	wl_list_for_each(head, &output->base.head_list, base.output_link)
@@ -983,6 +1737,13 @@ drm_output_apply_state_atomic(struct drm_output_state *state,
 		struct drm_plane *plane = plane_state->plane;
 		const struct pixel_format_info *pinfo = NULL;
 
+		if (drm_plane_state_can_skip(plane_state, *flags)) {
+			drm_debug(plane->backend, "\t\t\t[PLANE:%lu] unchanged, "
+				  "left out of the commit\n",
+				  (unsigned long) plane->plane_id);
+			continue;
+		}
+
 		ret |= plane_add_prop(req, plane, WDRM_PLANE_FB_ID,
 				      plane_state->fb ? plane_state->fb->fb_id : 0);
 		ret |= plane_add_prop(req, plane, WDRM_PLANE_CRTC_ID,
@@ -1020,6 +1781,63 @@ drm_output_apply_state_atomic(struct drm_output_state *state,
 					      plane_state->in_fence_fd);
 		}
 
+		/* drm_fb_compatible_with_plane() only lets YUV buffers onto
+		 * planes which support their encoding and range */
+		if (pinfo && pixel_format_is_yuv(pinfo)) {
+			struct drm_fb *fb = plane_state->fb;
+			struct drm_property_info *info;
+			uint64_t val;
+
+			info = &plane->props[WDRM_PLANE_COLOR_ENCODING];
+			if (info->prop_id != 0) {
+				val = info->enum_values[fb->color_encoding].value;
+				ret |= plane_add_prop(req, plane,
+						      WDRM_PLANE_COLOR_ENCODING,
+						      val);
+			}
+
+			info = &plane->props[WDRM_PLANE_COLOR_RANGE];
+			if (info->prop_id != 0) {
+				val = info->enum_values[fb->color_range].value;
+				ret |= plane_add_prop(req, plane,
+						      WDRM_PLANE_COLOR_RANGE,
+						      val);
+			}
+		}
+
+		/* A plane rotated before must be turned back explicitly. */
+		if (plane_state->fb &&
+		    plane->props[WDRM_PLANE_ROTATION].prop_id != 0) {
+			uint64_t rotation = plane_state->rotation;
+
+			if (rotation == 0)
+				drm_plane_get_rotation(plane,
+						       WL_OUTPUT_TRANSFORM_NORMAL,
+						       &rotation);
+			if (rotation != 0)
+				ret |= plane_add_prop(req, plane,
+						      WDRM_PLANE_ROTATION,
+						      rotation);
+		}
+
+		/* Set on every commit, so a plane left translucent by a fade
+		 * becomes opaque again. */
+		if (plane_state->fb &&
+		    plane->props[WDRM_PLANE_ALPHA].prop_id != 0)
+			ret |= plane_add_prop(req, plane, WDRM_PLANE_ALPHA,
+					      plane_state->alpha);
+
+		if (plane_state->fb &&
+		    plane->props[WDRM_PLANE_BLEND_MODE].prop_id != 0) {
+			struct drm_property_info *info =
+				&plane->props[WDRM_PLANE_BLEND_MODE];
+
+			if (info->enum_values[plane_state->blend_mode].valid)
+				ret |= plane_add_prop(req, plane,
+						      WDRM_PLANE_BLEND_MODE,
+						      info->enum_values[plane_state->blend_mode].value);
+		}
+
 		/* do note, that 'invented' zpos values are set as immutable */
 		if (plane_state->zpos != DRM_PLANE_ZPOS_INVALID_PLANE &&
 		    plane_state->plane->zpos_min != plane_state->plane->zpos_max)
@@ -1040,6 +1858,47 @@ drm_output_apply_state_atomic(struct drm_output_state *state,
  * Helper function used only by drm_pending_state_apply, with the same
  * guarantees and constraints as that function.
  */
+/* Only a commit for a single output can be asynchronous. */
+static bool
+drm_pending_state_wants_async_flip(struct drm_pending_state *pending_state)
+{
+	struct drm_output_state *output_state;
+	int n = 0;
+	bool async = false;
+
+	wl_list_for_each(output_state, &pending_state->output_list, link) {
+		async = output_state->async_flip;
+		n++;
+	}
+
+	return n == 1 && async;
+}
+
+/* Commits are only handed to the commit thread when nothing on the main
+ * loop depends on their outcome: no modeset or takeover with fallbacks to
+ * try, and no out-fence or writeback fence to pick up afterwards. */
+static bool
+drm_pending_state_can_defer(struct drm_pending_state *pending_state,
+			    enum drm_state_apply_mode mode, uint32_t flags)
+{
+	struct drm_backend *b = pending_state->backend;
+	struct drm_output_state *output_state;
+
+	if (!b->commit_thread || mode != DRM_STATE_APPLY_ASYNC ||
+	    b->state_invalid || b->planes_invalid ||
+	    (flags & (DRM_MODE_ATOMIC_ALLOW_MODESET | DRM_MODE_PAGE_FLIP_ASYNC)))
+		return false;
+
+	wl_list_for_each(output_state, &pending_state->output_list, link) {
+		if (output_state->output->capture ||
+		    output_state->output->seamless_handoff ||
+		    drm_output_state_replaces_releases(output_state))
+			return false;
+	}
+
+	return true;
+}
+
 static int
 drm_pending_state_apply_atomic(struct drm_pending_state *pending_state,
 			       enum drm_state_apply_mode mode)
@@ -1048,6 +1907,7 @@ drm_pending_state_apply_atomic(struct drm_pending_state *pending_state,
 	struct drm_output_state *output_state, *tmp;
 	struct drm_plane *plane;
 	drmModeAtomicReq *req = drmModeAtomicAlloc();
+	bool handoff = false;
 	uint32_t flags;
 	int ret = 0;
 
@@ -1068,6 +1928,7 @@ drm_pending_state_apply_atomic(struct drm_pending_state *pending_state,
 
 	if (b->state_invalid) {
 		struct weston_head *head_base;
+		struct drm_writeback *writeback;
 		struct drm_head *head;
 		struct drm_crtc *crtc;
 		uint32_t connector_id;
@@ -1076,6 +1937,17 @@ drm_pending_state_apply_atomic(struct drm_pending_state *pending_state,
 		drm_debug(b, "\t\t[atomic] previous state invalid; "
 			     "starting with fresh state\n");
 
+		/* Taking over CRTCs that already run our modes does not
+		 * need a modeset, unless something else has to be shut
+		 * down on the way; see below. */
+		handoff = mode == DRM_STATE_APPLY_ASYNC &&
+			  !wl_list_empty(&pending_state->output_list);
+		wl_list_for_each(output_state, &pending_state->output_list,
+				 link) {
+			if (!output_state->output->seamless_handoff)
+				handoff = false;
+		}
+
 		/* If we need to reset all our state (e.g. because we've
 		 * just started, or just been VT-switched in), explicitly
 		 * disable all the CRTCs and connectors we aren't using. */
@@ -1103,6 +1975,15 @@ drm_pending_state_apply_atomic(struct drm_pending_state *pending_state,
 				ret = -1;
 		}
 
+		/* Writeback connectors left routed by an earlier capture */
+		wl_list_for_each(writeback, &b->writeback_connector_list, link) {
+			if (writeback->output)
+				continue;
+
+			ret |= connector_add_prop(req, &writeback->connector,
+						  WDRM_CONNECTOR_CRTC_ID, 0);
+		}
+
 		wl_list_for_each(crtc, &b->crtc_list, link) {
 			struct drm_property_info *info;
 			drmModeObjectProperties *props;
@@ -1132,6 +2013,7 @@ drm_pending_state_apply_atomic(struct drm_pending_state *pending_state,
 
 			drm_debug(b, "\t\t[atomic] disabling unused CRTC %lu\n",
 				  (unsigned long) crtc->crtc_id);
+			handoff = false;
 
 			ret |= crtc_add_prop(req, crtc, WDRM_CRTC_ACTIVE, 0);
 			ret |= crtc_add_prop(req, crtc, WDRM_CRTC_MODE_ID, 0);
@@ -1146,7 +2028,16 @@ drm_pending_state_apply_atomic(struct drm_pending_state *pending_state,
 			plane_add_prop(req, plane, WDRM_PLANE_FB_ID, 0);
 		}
 
-		flags |= DRM_MODE_ATOMIC_ALLOW_MODESET;
+		if (!handoff)
+			flags |= DRM_MODE_ATOMIC_ALLOW_MODESET;
+	} else if (b->planes_invalid) {
+		drm_debug(b, "\t\t[atomic] restoring state; starting with "
+			     "all planes disabled\n");
+
+		wl_list_for_each(plane, &b->plane_list, link) {
+			plane_add_prop(req, plane, WDRM_PLANE_CRTC_ID, 0);
+			plane_add_prop(req, plane, WDRM_PLANE_FB_ID, 0);
+		}
 	}
 
 	wl_list_for_each(output_state, &pending_state->output_list, link) {
@@ -1162,9 +2053,51 @@ drm_pending_state_apply_atomic(struct drm_pending_state *pending_state,
 		goto out;
 	}
 
+	if (mode == DRM_STATE_APPLY_ASYNC &&
+	    !(flags & DRM_MODE_ATOMIC_ALLOW_MODESET) &&
+	    drm_pending_state_wants_async_flip(pending_state))
+		flags |= DRM_MODE_PAGE_FLIP_ASYNC;
+
+	if (drm_pending_state_can_defer(pending_state, mode, flags) &&
+	    drm_commit_thread_queue(b->commit_thread, req, flags,
+				    pending_state) == 0) {
+		drm_debug(b, "[atomic] commit handed to the commit thread\n");
+		req = NULL;
+		goto committed;
+	}
+
+	/* Keep the kernel seeing commits in the order they were made. */
+	if (b->commit_thread && mode != DRM_STATE_TEST_ONLY)
+		drm_commit_thread_flush(b->commit_thread);
+
 	ret = drmModeAtomicCommit(b->drm.fd, req, flags, b);
 	drm_debug(b, "[atomic] drmModeAtomicCommit\n");
 
+	/* The driver may still refuse an async flip for this particular
+	 * state, e.g. because of a property it cannot change without a
+	 * vblank. Fall back to a regular flip and stop trying. */
+	if (ret != 0 && (flags & DRM_MODE_PAGE_FLIP_ASYNC)) {
+		weston_log("atomic: async page flip refused: %s, "
+			   "falling back to vsync\n", strerror(errno));
+		wl_list_for_each(output_state, &pending_state->output_list,
+				 link) {
+			output_state->output->async_flip_refused = true;
+			output_state->async_flip = false;
+		}
+		flags &= ~DRM_MODE_PAGE_FLIP_ASYNC;
+		ret = drmModeAtomicCommit(b->drm.fd, req, flags, b);
+	}
+
+	/* The kernel knows better whether the inherited state really
+	 * matches, e.g. a connector property we set differently. */
+	if (ret != 0 && handoff && !(flags & DRM_MODE_ATOMIC_ALLOW_MODESET)) {
+		weston_log("atomic: seamless takeover refused: %s, "
+			   "doing a full modeset\n", strerror(errno));
+		flags |= DRM_MODE_ATOMIC_ALLOW_MODESET;
+		ret = drmModeAtomicCommit(b->drm.fd, req, flags, b);
+	}
+
+committed:
 	/* Test commits do not take ownership of the state; return
 	 * without freeing here. */
 	if (mode == DRM_STATE_TEST_ONLY) {
@@ -1172,17 +2105,34 @@ drm_pending_state_apply_atomic(struct drm_pending_state *pending_state,
 		return ret;
 	}
 
+	/* Only the first commit can take over the inherited state. */
+	wl_list_for_each(output_state, &pending_state->output_list, link)
+		output_state->output->seamless_handoff = false;
+
 	if (ret != 0) {
 		weston_log("atomic: couldn't commit new state: %s\n",
 			   strerror(errno));
+		/* A restore raced with a change we did not see; go through
+		 * a full modeset instead. */
+		if (b->planes_invalid)
+			b->state_invalid = true;
+		/* The plane assignments may have been reused without a
+		 * test commit; rebuild them from scratch next time. */
+		wl_list_for_each(output_state, &pending_state->output_list,
+				 link)
+			output_state->output->plane_cache.valid = false;
 		goto out;
 	}
 
 	wl_list_for_each_safe(output_state, tmp, &pending_state->output_list,
-			      link)
+			      link) {
+		drm_output_state_send_fenced_releases(output_state);
+		drm_output_writeback_committed(output_state);
 		drm_output_assign_state(output_state, mode);
+	}
 
 	b->state_invalid = false;
+	b->planes_invalid = false;
 
 	assert(wl_list_empty(&pending_state->output_list));
 
@@ -1224,6 +2174,123 @@ drm_pending_state_test(struct drm_pending_state *pending_state)
 	return 0;
 }
 
+/**
+ * Checks whether the state we last committed can be put back without a
+ * modeset, e.g. when the session becomes active again after another DRM
+ * master had the device.
+ *
+ * The kernel keeps our CRTC timings unless someone changed them, and our
+ * framebuffers are still alive, so if no CRTC or connector outside our
+ * configuration is lit and a test commit of the current state without
+ * ALLOW_MODESET succeeds, the next repaint can simply re-commit it. On
+ * success planes_invalid is set so that commit also turns off planes the
+ * other master left behind; otherwise the caller falls back to
+ * state_invalid and a full modeset.
+ *
+ * Only available with atomic modesetting.
+ */
+bool
+drm_backend_try_restore_state(struct drm_backend *b)
+{
+	struct drm_pending_state *pending_state;
+	struct weston_head *head_base;
+	struct drm_output *output;
+	struct drm_crtc *crtc;
+	bool ok = true;
+	int ret;
+
+	if (!b->atomic_modeset || b->state_invalid)
+		return false;
+
+	wl_list_for_each(crtc, &b->crtc_list, link) {
+		drmModeObjectProperties *props;
+
+		if (crtc->output)
+			continue;
+
+		props = drmModeObjectGetProperties(b->drm.fd, crtc->crtc_id,
+						   DRM_MODE_OBJECT_CRTC);
+		if (!props)
+			return false;
+
+		if (drm_property_get_value(&crtc->props_crtc[WDRM_CRTC_ACTIVE],
+					   props, 0) != 0)
+			ok = false;
+		drmModeFreeObjectProperties(props);
+
+		if (!ok) {
+			drm_debug(b, "[atomic] unused CRTC %lu left active, "
+				     "restore needs a modeset\n",
+				  (unsigned long) crtc->crtc_id);
+			return false;
+		}
+	}
+
+	wl_list_for_each(head_base, &b->compositor->head_list,
+			 compositor_link) {
+		struct drm_head *head = to_drm_head(head_base);
+		drmModeObjectProperties *props;
+
+		if (weston_head_is_enabled(head_base))
+			continue;
+
+		props = drmModeObjectGetProperties(b->drm.fd,
+						   head->connector.connector_id,
+						   DRM_MODE_OBJECT_CONNECTOR);
+		if (!props)
+			return false;
+
+		if (drm_property_get_value(&head->connector.props[WDRM_CONNECTOR_CRTC_ID],
+					   props, 0) != 0)
+			ok = false;
+		drmModeFreeObjectProperties(props);
+
+		if (!ok) {
+			drm_debug(b, "[atomic] inactive head %s left routed, "
+				     "restore needs a modeset\n",
+				  head_base->name);
+			return false;
+		}
+	}
+
+	pending_state = drm_pending_state_alloc(b);
+	if (!pending_state)
+		return false;
+
+	wl_list_for_each(output, &b->compositor->output_list, base.link) {
+		struct drm_plane *scanout_plane;
+
+		if (output->virtual)
+			continue;
+
+		scanout_plane = output->scanout_plane;
+		if (!output->state_cur ||
+		    output->state_cur->dpms != WESTON_DPMS_ON ||
+		    !scanout_plane->state_cur->fb) {
+			ok = false;
+			break;
+		}
+
+		drm_output_state_duplicate(output->state_cur, pending_state,
+					   DRM_OUTPUT_STATE_PRESERVE_PLANES);
+	}
+
+	if (ok) {
+		b->planes_invalid = true;
+		ret = drm_pending_state_test(pending_state);
+		if (ret != 0) {
+			drm_debug(b, "[atomic] restore test commit failed: %s\n",
+				  strerror(errno));
+			b->planes_invalid = false;
+			ok = false;
+		}
+	}
+
+	drm_pending_state_free(pending_state);
+
+	return ok;
+}
+
 /**
  * Applies all of a pending_state asynchronously: the primary entry point for
  * applying KMS state to a device. Updates the state for all outputs in the
@@ -1237,10 +2304,17 @@ drm_pending_state_apply(struct drm_pending_state *pending_state)
 	struct drm_backend *b = pending_state->backend;
 	struct drm_output_state *output_state, *tmp;
 	struct drm_crtc *crtc;
+	int ret;
 
-	if (b->atomic_modeset)
-		return drm_pending_state_apply_atomic(pending_state,
-						      DRM_STATE_APPLY_ASYNC);
+	WESTON_PROBE(drm_pending_state_apply, pending_state,
+		     b->atomic_modeset, b->state_invalid);
+
+	if (b->atomic_modeset) {
+		ret = drm_pending_state_apply_atomic(pending_state,
+						     DRM_STATE_APPLY_ASYNC);
+		WESTON_PROBE(drm_pending_state_applied, pending_state, ret);
+		return ret;
+	}
 
 	if (b->state_invalid) {
 		/* If we need to reset all our state (e.g. because we've
@@ -1259,7 +2333,6 @@ drm_pending_state_apply(struct drm_pending_state *pending_state)
 	wl_list_for_each_safe(output_state, tmp, &pending_state->output_list,
 			      link) {
 		struct drm_output *output = output_state->output;
-		int ret;
 
 		if (output->virtual) {
 			drm_output_assign_state(output_state,
@@ -1367,10 +2440,17 @@ page_flip_handler(int fd, unsigned int frame,
 
 	drm_output_update_msc(output, frame);
 
+	if (!drm_output_flip_completed(output, output->page_flip_pending,
+				       sec, usec))
+		return;
+
 	assert(!b->atomic_modeset);
 	assert(output->page_flip_pending);
 	output->page_flip_pending = false;
 
+	if (output->state_cur->async_flip)
+		flags &= ~WP_PRESENTATION_FEEDBACK_KIND_VSYNC;
+
 	drm_output_update_complete(output, flags, sec, usec);
 }
 
@@ -1385,6 +2465,8 @@ atomic_flip_handler(int fd, unsigned int frame, unsigned int sec,
 			 WP_PRESENTATION_FEEDBACK_KIND_HW_COMPLETION |
 			 WP_PRESENTATION_FEEDBACK_KIND_HW_CLOCK;
 
+	WESTON_PROBE(drm_atomic_flip, crtc_id, frame, sec, usec);
+
 	crtc = drm_crtc_find(b, crtc_id);
 	assert(crtc);
 
@@ -1398,11 +2480,18 @@ atomic_flip_handler(int fd, unsigned int frame, unsigned int sec,
 
 	drm_output_update_msc(output, frame);
 
+	if (!drm_output_flip_completed(output, output->atomic_complete_pending,
+				       sec, usec))
+		return;
+
 	drm_debug(b, "[atomic][CRTC:%u] flip processing started\n", crtc_id);
 	assert(b->atomic_modeset);
 	assert(output->atomic_complete_pending);
 	output->atomic_complete_pending = false;
 
+	if (output->state_cur->async_flip)
+		flags &= ~WP_PRESENTATION_FEEDBACK_KIND_VSYNC;
+
 	drm_output_update_complete(output, flags, sec, usec);
 	drm_debug(b, "[atomic][CRTC:%u] flip processing completed\n", crtc_id);
 }
@@ -1497,5 +2586,12 @@ init_kms_caps(struct drm_backend *b)
 	weston_log("DRM: %s picture aspect ratio\n",
 		   b->aspect_ratio_supported ? "supports" : "does not support");
 
+	ret = drmGetCap(b->drm.fd, b->atomic_modeset ?
+				   DRM_CAP_ATOMIC_ASYNC_PAGE_FLIP :
+				   DRM_CAP_ASYNC_PAGE_FLIP, &cap);
+	b->async_page_flip = (ret == 0 && cap == 1);
+	weston_log("DRM: %s async page flip\n",
+		   b->async_page_flip ? "supports" : "does not support");
+
 	return 0;
 }
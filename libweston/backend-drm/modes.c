@@ -97,6 +97,108 @@ drm_subpixel_to_wayland(int drm_value)
 	}
 }
 
+#define DRM_MODE_BLOB_CACHE_MAX 32
+#define DRM_EDID_CACHE_MAX 8
+
+struct drm_mode_blob_cache_entry {
+	drmModeModeInfo mode_info;
+	uint32_t blob_id;
+	struct wl_list link; /* drm_backend::mode_blob_cache */
+};
+
+struct drm_edid_cache_entry {
+	uint64_t hash;
+	size_t length;
+	uint8_t *data;
+	int parse_result;
+	struct drm_edid edid;
+	struct wl_list link; /* drm_backend::edid_cache */
+};
+
+static void
+drm_mode_blob_cache_entry_destroy(struct drm_backend *backend,
+				  struct drm_mode_blob_cache_entry *entry)
+{
+	drmModeDestroyPropertyBlob(backend->drm.fd, entry->blob_id);
+	wl_list_remove(&entry->link);
+	backend->mode_blob_cache_len--;
+	free(entry);
+}
+
+/* Takes over the blob. */
+static void
+drm_mode_blob_cache_put(struct drm_backend *backend,
+			const drmModeModeInfo *info, uint32_t blob_id)
+{
+	struct drm_mode_blob_cache_entry *entry;
+
+	entry = zalloc(sizeof *entry);
+	if (!entry) {
+		drmModeDestroyPropertyBlob(backend->drm.fd, blob_id);
+		return;
+	}
+
+	entry->mode_info = *info;
+	entry->blob_id = blob_id;
+	wl_list_insert(&backend->mode_blob_cache, &entry->link);
+	backend->mode_blob_cache_len++;
+
+	while (backend->mode_blob_cache_len > DRM_MODE_BLOB_CACHE_MAX) {
+		entry = container_of(backend->mode_blob_cache.prev,
+				     struct drm_mode_blob_cache_entry, link);
+		drm_mode_blob_cache_entry_destroy(backend, entry);
+	}
+}
+
+static uint32_t
+drm_mode_blob_cache_take(struct drm_backend *backend,
+			 const drmModeModeInfo *info)
+{
+	struct drm_mode_blob_cache_entry *entry;
+	uint32_t blob_id;
+
+	wl_list_for_each(entry, &backend->mode_blob_cache, link) {
+		if (memcmp(&entry->mode_info, info, sizeof *info) != 0)
+			continue;
+
+		blob_id = entry->blob_id;
+		wl_list_remove(&entry->link);
+		backend->mode_blob_cache_len--;
+		free(entry);
+
+		return blob_id;
+	}
+
+	return 0;
+}
+
+static void
+drm_edid_cache_entry_destroy(struct drm_backend *backend,
+			     struct drm_edid_cache_entry *entry)
+{
+	wl_list_remove(&entry->link);
+	backend->edid_cache_len--;
+	free(entry->data);
+	free(entry);
+}
+
+/** Release every cached mode blob and EDID
+ *
+ * \param backend The backend owning the caches.
+ */
+void
+drm_mode_cache_flush(struct drm_backend *backend)
+{
+	struct drm_mode_blob_cache_entry *blob, *blob_tmp;
+	struct drm_edid_cache_entry *edid, *edid_tmp;
+
+	wl_list_for_each_safe(blob, blob_tmp, &backend->mode_blob_cache, link)
+		drm_mode_blob_cache_entry_destroy(backend, blob);
+
+	wl_list_for_each_safe(edid, edid_tmp, &backend->edid_cache, link)
+		drm_edid_cache_entry_destroy(backend, edid);
+}
+
 int
 drm_mode_ensure_blob(struct drm_backend *backend, struct drm_mode *mode)
 {
@@ -105,6 +207,14 @@ drm_mode_ensure_blob(struct drm_backend *backend, struct drm_mode *mode)
 	if (mode->blob_id)
 		return 0;
 
+	mode->blob_id = drm_mode_blob_cache_take(backend, &mode->mode_info);
+	if (mode->blob_id) {
+		drm_debug(backend, "\t\t\t[atomic] reusing mode blob %lu "
+			  "for %s\n", (unsigned long) mode->blob_id,
+			  mode->mode_info.name);
+		return 0;
+	}
+
 	ret = drmModeCreatePropertyBlob(backend->drm.fd,
 					&mode->mode_info,
 					sizeof(mode->mode_info),
@@ -310,6 +420,74 @@ edid_parse(struct drm_edid *edid, const uint8_t *data, size_t length)
  * be free()'d explicitly, instead they get implicitly freed when the
  * \c drm_head is destroyed.
  */
+static uint64_t
+edid_hash(const uint8_t *data, size_t length)
+{
+	uint64_t hash = 0xcbf29ce484222325ull;	/* FNV-1a */
+	size_t i;
+
+	for (i = 0; i < length; i++) {
+		hash ^= data[i];
+		hash *= 0x100000001b3ull;
+	}
+
+	return hash;
+}
+
+/** Parse an EDID blob, or copy the result of parsing the same bytes before
+ *
+ * Connectors re-read their EDID on every hotplug and property change;
+ * a monitor that comes back with the same EDID does not get parsed again.
+ */
+static int
+edid_parse_cached(struct drm_backend *backend, struct drm_edid *edid,
+		  const uint8_t *data, size_t length)
+{
+	struct drm_edid_cache_entry *entry;
+	uint64_t hash = edid_hash(data, length);
+	int rc;
+
+	wl_list_for_each(entry, &backend->edid_cache, link) {
+		if (entry->hash != hash || entry->length != length ||
+		    memcmp(entry->data, data, length) != 0)
+			continue;
+
+		wl_list_remove(&entry->link);
+		wl_list_insert(&backend->edid_cache, &entry->link);
+		*edid = entry->edid;
+
+		return entry->parse_result;
+	}
+
+	memset(edid, 0, sizeof *edid);
+
+	entry = zalloc(sizeof *entry);
+	if (entry)
+		entry->data = malloc(length);
+	if (!entry || !entry->data) {
+		free(entry);
+		return edid_parse(edid, data, length);
+	}
+
+	rc = edid_parse(edid, data, length);
+
+	memcpy(entry->data, data, length);
+	entry->hash = hash;
+	entry->length = length;
+	entry->parse_result = rc;
+	entry->edid = *edid;
+	wl_list_insert(&backend->edid_cache, &entry->link);
+	backend->edid_cache_len++;
+
+	while (backend->edid_cache_len > DRM_EDID_CACHE_MAX) {
+		entry = container_of(backend->edid_cache.prev,
+				     struct drm_edid_cache_entry, link);
+		drm_edid_cache_entry_destroy(backend, entry);
+	}
+
+	return rc;
+}
+
 static void
 find_and_parse_output_edid(struct drm_head *head,
 			   drmModeObjectPropertiesPtr props,
@@ -332,9 +510,8 @@ find_and_parse_output_edid(struct drm_head *head,
 	if (!edid_blob)
 		return;
 
-	rc = edid_parse(&head->edid,
-			edid_blob->data,
-			edid_blob->length);
+	rc = edid_parse_cached(head->backend, &head->edid,
+			       edid_blob->data, edid_blob->length);
 	if (!rc) {
 		if (head->edid.pnp_id[0] != '\0')
 			*make = head->edid.pnp_id;
@@ -409,7 +586,8 @@ static void
 drm_output_destroy_mode(struct drm_backend *backend, struct drm_mode *mode)
 {
 	if (mode->blob_id)
-		drmModeDestroyPropertyBlob(backend->drm.fd, mode->blob_id);
+		drm_mode_blob_cache_put(backend, &mode->mode_info,
+					mode->blob_id);
 	wl_list_remove(&mode->base.link);
 	free(mode);
 }
@@ -528,6 +706,9 @@ update_head_from_connector(struct drm_head *head)
 	weston_head_set_transform(&head->base,
 				  get_panel_orientation(connector, props));
 
+	head->vrr_capable = drm_property_get_value(
+		&connector->props[WDRM_CONNECTOR_VRR_CAPABLE], props, 0);
+
 	/* Unknown connection status is assumed disconnected. */
 	weston_head_set_connection_status(&head->base,
 				conn->connection == DRM_MODE_CONNECTED);
@@ -33,8 +33,54 @@
 #include <xf86drmMode.h>
 
 #include "drm-internal.h"
+#include "shared/fd-util.h"
 #include "shared/weston-drm-fourcc.h"
 
+/* Signed permutation matrices for each wl_output_transform, mapping
+ * (x, y) to (m[0] * x + m[1] * y, m[2] * x + m[3] * y). */
+static const int transform_matrices[][4] = {
+	[WL_OUTPUT_TRANSFORM_NORMAL] = { 1, 0, 0, 1 },
+	[WL_OUTPUT_TRANSFORM_90] = { 0, 1, -1, 0 },
+	[WL_OUTPUT_TRANSFORM_180] = { -1, 0, 0, -1 },
+	[WL_OUTPUT_TRANSFORM_270] = { 0, -1, 1, 0 },
+	[WL_OUTPUT_TRANSFORM_FLIPPED] = { -1, 0, 0, 1 },
+	[WL_OUTPUT_TRANSFORM_FLIPPED_90] = { 0, 1, 1, 0 },
+	[WL_OUTPUT_TRANSFORM_FLIPPED_180] = { 1, 0, 0, -1 },
+	[WL_OUTPUT_TRANSFORM_FLIPPED_270] = { 0, -1, -1, 0 },
+};
+
+/**
+ * Work out the transform a plane applies to show a buffer on an output
+ *
+ * Buffer contents are turned by the buffer transform relative to the
+ * surface, and the output framebuffer by the output transform relative
+ * to the compositor space, so the plane has to undo the former and apply
+ * the latter. The common case of matching transforms gives NORMAL.
+ */
+static enum wl_output_transform
+drm_plane_transform_for_view(uint32_t buffer_transform,
+			     uint32_t output_transform)
+{
+	const int *b = transform_matrices[buffer_transform];
+	const int *o = transform_matrices[output_transform];
+	int p[4];
+	unsigned int i;
+
+	/* The matrices are orthogonal: the inverse is the transpose. */
+	p[0] = o[0] * b[0] + o[1] * b[1];
+	p[1] = o[0] * b[2] + o[1] * b[3];
+	p[2] = o[2] * b[0] + o[3] * b[1];
+	p[3] = o[2] * b[2] + o[3] * b[3];
+
+	for (i = 0; i < ARRAY_LENGTH(transform_matrices); i++) {
+		if (memcmp(transform_matrices[i], p, sizeof p) == 0)
+			return i;
+	}
+
+	assert(!"not a wl_output_transform");
+	return WL_OUTPUT_TRANSFORM_NORMAL;
+}
+
 /**
  * Allocate a new, empty, plane state.
  */
@@ -49,6 +95,8 @@ drm_plane_state_alloc(struct drm_output_state *state_output,
 	state->plane = plane;
 	state->in_fence_fd = -1;
 	state->zpos = DRM_PLANE_ZPOS_INVALID_PLANE;
+	state->alpha = DRM_PLANE_ALPHA_OPAQUE;
+	state->blend_mode = WDRM_PLANE_BLEND_MODE_PREMULTI;
 
 	/* Here we only add the plane state to the desired link, and not
 	 * set the member. Having an output pointer set means that the
@@ -81,6 +129,8 @@ drm_plane_state_free(struct drm_plane_state *state, bool force)
 	state->output_state = NULL;
 	state->in_fence_fd = -1;
 	state->zpos = DRM_PLANE_ZPOS_INVALID_PLANE;
+	state->alpha = DRM_PLANE_ALPHA_OPAQUE;
+	state->blend_mode = WDRM_PLANE_BLEND_MODE_PREMULTI;
 
 	/* Once the damage blob has been submitted, it is refcounted internally
 	 * by the kernel, which means we can safely discard it.
@@ -118,6 +168,7 @@ drm_plane_state_duplicate(struct drm_output_state *state_output,
 	 * lasts for the duration of a single repaint.
 	 */
 	dst->damage_blob_id = 0;
+	dst->fb_reused = false;
 	wl_list_init(&dst->link);
 
 	wl_list_for_each_safe(old, tmp, &state_output->plane_list, link) {
@@ -184,6 +235,45 @@ drm_plane_state_put_back(struct drm_plane_state *state)
 	(void) drm_plane_state_alloc(state_output, plane);
 }
 
+static bool
+drm_view_content_is_opaque(struct weston_view *ev)
+{
+	struct weston_surface *surface = ev->surface;
+	pixman_box32_t box = { 0, 0, surface->width, surface->height };
+
+	return surface->is_opaque ||
+	       pixman_region32_contains_rectangle(&surface->opaque, &box) ==
+	       PIXMAN_REGION_IN;
+}
+
+/*
+ * Client buffers are premultiplied, which is also what planes without the
+ * blend mode property do. Opaque content needs no per-pixel blending at
+ * all, which lets e.g. the plane alpha of a fading XRGB buffer apply
+ * without reading the alpha channel. Planes which only offer coverage
+ * blending cannot show translucent content correctly.
+ */
+static bool
+drm_plane_state_set_blend_mode(struct drm_plane_state *state,
+			       struct weston_view *ev)
+{
+	struct drm_property_info *info =
+		&state->plane->props[WDRM_PLANE_BLEND_MODE];
+	bool opaque = drm_view_content_is_opaque(ev);
+
+	state->blend_mode = WDRM_PLANE_BLEND_MODE_PREMULTI;
+	if (info->prop_id == 0)
+		return true;
+
+	if (opaque && info->enum_values[WDRM_PLANE_BLEND_MODE_NONE].valid)
+		state->blend_mode = WDRM_PLANE_BLEND_MODE_NONE;
+	else if (!info->enum_values[WDRM_PLANE_BLEND_MODE_PREMULTI].valid &&
+		 !opaque)
+		return false;
+
+	return true;
+}
+
 /**
  * Given a weston_view, fill the drm_plane_state's co-ordinates to display on
  * a given plane.
@@ -194,6 +284,8 @@ drm_plane_state_coords_for_view(struct drm_plane_state *state,
 {
 	struct drm_output *output = state->output;
 	struct weston_buffer *buffer = ev->surface->buffer_ref.buffer;
+	struct weston_buffer_viewport *viewport = &ev->surface->buffer_viewport;
+	enum wl_output_transform transform;
 	pixman_region32_t dest_rect, src_rect;
 	pixman_box32_t *box, tbox;
 	float sxf1, syf1, sxf2, syf2;
@@ -201,6 +293,33 @@ drm_plane_state_coords_for_view(struct drm_plane_state *state,
 	if (!drm_view_transform_supported(ev, &output->base))
 		return false;
 
+	/* Buffers not matching the output transform need the plane to
+	 * rotate them, which only atomic commits can ask for. The source
+	 * rectangle below is in buffer space either way, and the
+	 * destination in CRTC space. */
+	transform = drm_plane_transform_for_view(viewport->buffer.transform,
+						 output->base.transform);
+	state->rotation = 0;
+	if (transform != WL_OUTPUT_TRANSFORM_NORMAL &&
+	    (!output->backend->atomic_modeset ||
+	     drm_plane_get_rotation(state->plane, transform,
+				    &state->rotation) < 0))
+		return false;
+
+	/* Translucent views, e.g. fading ones, stay on a plane which can
+	 * blend them by itself, instead of going back to the renderer. */
+	state->alpha = DRM_PLANE_ALPHA_OPAQUE;
+	if (ev->alpha < 1.0f) {
+		if (!output->backend->atomic_modeset ||
+		    state->plane->props[WDRM_PLANE_ALPHA].prop_id == 0)
+			return false;
+		state->alpha = (uint16_t) (MAX(ev->alpha, 0.0f) *
+					   DRM_PLANE_ALPHA_OPAQUE + 0.5f);
+	}
+
+	if (!drm_plane_state_set_blend_mode(state, ev))
+		return false;
+
 	/* Update the base weston_plane co-ordinates. */
 	box = pixman_region32_extents(&ev->transform.boundingbox);
 	state->plane->base.x = box->x1;
@@ -339,6 +458,7 @@ drm_output_state_alloc(struct drm_output *output,
 	state->output = output;
 	state->dpms = WESTON_DPMS_OFF;
 	state->protection = WESTON_HDCP_DISABLE;
+	state->out_fence_fd = -1;
 	state->pending_state = pending_state;
 	if (pending_state)
 		wl_list_insert(&pending_state->output_list, &state->link);
@@ -373,6 +493,7 @@ drm_output_state_duplicate(struct drm_output_state *src,
 	 * state. */
 	*dst = *src;
 
+	dst->out_fence_fd = -1;
 	dst->pending_state = pending_state;
 	if (pending_state)
 		wl_list_insert(&pending_state->output_list, &dst->link);
@@ -410,6 +531,7 @@ drm_output_state_free(struct drm_output_state *state)
 	wl_list_for_each_safe(ps, next, &state->plane_list, link)
 		drm_plane_state_free(ps, false);
 
+	fd_clear(&state->out_fence_fd);
 	wl_list_remove(&state->link);
 
 	free(state);
@@ -39,7 +39,9 @@
 #include "drm-internal.h"
 
 #include "color.h"
+#include "content-hash.h"
 #include "linux-dmabuf.h"
+#include "weston-probe.h"
 #include "presentation-time-server-protocol.h"
 
 enum drm_output_propose_state_mode {
@@ -124,12 +126,140 @@ drm_output_check_plane_has_view_assigned(struct drm_plane *plane,
 	return false;
 }
 
+enum drm_plane_scaling_dir {
+	DRM_PLANE_SCALING_UP = 0,
+	DRM_PLANE_SCALING_DOWN,
+};
+
+/* Ratio of the larger to the smaller of a source length in 16.16 fixed
+ * point and a destination length in pixels, also in 16.16 fixed point. */
+static uint32_t
+drm_plane_scaling_ratio(uint32_t src, uint32_t dest,
+			enum drm_plane_scaling_dir *dir)
+{
+	uint64_t d = (uint64_t) dest << 16;
+	uint64_t ratio;
+
+	if (src == 0 || dest == 0) {
+		*dir = DRM_PLANE_SCALING_UP;
+		return 1 << 16;
+	}
+
+	if (d >= src) {
+		*dir = DRM_PLANE_SCALING_UP;
+		ratio = (d << 16) / src;
+	} else {
+		*dir = DRM_PLANE_SCALING_DOWN;
+		ratio = ((uint64_t) src << 16) / d;
+	}
+
+	return ratio > UINT32_MAX ? UINT32_MAX : ratio;
+}
+
+/* Largest up- and downscaling ratio over both axes of a plane state. */
+static void
+drm_plane_state_scaling(struct drm_plane_state *state, uint32_t ratios[2])
+{
+	enum drm_plane_scaling_dir dir;
+	uint32_t ratio;
+
+	ratios[DRM_PLANE_SCALING_UP] = 1 << 16;
+	ratios[DRM_PLANE_SCALING_DOWN] = 1 << 16;
+
+	ratio = drm_plane_scaling_ratio(state->src_w, state->dest_w, &dir);
+	ratios[dir] = MAX(ratios[dir], ratio);
+	ratio = drm_plane_scaling_ratio(state->src_h, state->dest_h, &dir);
+	ratios[dir] = MAX(ratios[dir], ratio);
+}
+
+/**
+ * Check whether a plane state scales beyond what the plane is known to do
+ *
+ * Scaler limits are not exposed by KMS, so they are learnt from the
+ * TEST_ONLY commits made while placing views, see
+ * drm_plane_scaling_record(). This lets scaled views skip planes whose
+ * scaler already refused the same or an even larger ratio.
+ */
+static bool
+drm_plane_scaling_known_bad(struct drm_plane_state *state)
+{
+	struct drm_plane *plane = state->plane;
+	uint32_t ratios[2];
+	int i;
+
+	drm_plane_state_scaling(state, ratios);
+	for (i = 0; i < 2; i++) {
+		if (ratios[i] > plane->scaling.max_ok[i] &&
+		    ratios[i] >= plane->scaling.min_fail[i])
+			return true;
+	}
+
+	return false;
+}
+
+/**
+ * Remember the outcome of a TEST_ONLY commit for a plane's scaler
+ *
+ * A refused state is only blamed on scaling when it scales beyond every
+ * ratio the plane accepted before, so unrelated failures of unscaled
+ * states never restrict the plane.
+ */
+static void
+drm_plane_scaling_record(struct drm_plane_state *state, bool passed)
+{
+	struct drm_plane *plane = state->plane;
+	uint32_t ratios[2];
+	int i;
+
+	drm_plane_state_scaling(state, ratios);
+	for (i = 0; i < 2; i++) {
+		if (passed) {
+			plane->scaling.max_ok[i] = MAX(plane->scaling.max_ok[i],
+						       ratios[i]);
+		} else if (ratios[i] > plane->scaling.max_ok[i]) {
+			plane->scaling.min_fail[i] = MIN(plane->scaling.min_fail[i],
+							 ratios[i]);
+		}
+	}
+}
+
+/**
+ * Learn scaler limits from the final test of a proposed state
+ *
+ * Every plane of a passing state takes its ratios as known good. A
+ * failure is only attributed to scaling when a single plane shows a
+ * client buffer, as in a fullscreen view scaled onto the scanout plane.
+ */
+static void
+drm_output_state_scaling_record(struct drm_output_state *state, bool passed)
+{
+	struct drm_plane_state *ps, *client_ps = NULL;
+	int count = 0;
+
+	wl_list_for_each(ps, &state->plane_list, link) {
+		if (!ps->fb)
+			continue;
+		if (passed) {
+			drm_plane_scaling_record(ps, true);
+			continue;
+		}
+		if (ps->ev) {
+			client_ps = ps;
+			count++;
+		}
+	}
+
+	if (!passed && count == 1)
+		drm_plane_scaling_record(client_ps, false);
+}
+
 static struct drm_plane_state *
 drm_output_prepare_overlay_view(struct drm_plane *plane,
 				struct drm_output_state *output_state,
 				struct weston_view *ev,
 				enum drm_output_propose_state_mode mode,
-				struct drm_fb *fb, uint64_t zpos)
+				struct drm_fb *fb, uint64_t zpos,
+				uint32_t *try_view_on_plane_failure_reasons)
 {
 	struct drm_output *output = output_state->output;
 	struct weston_compositor *ec = output->base.compositor;
@@ -154,6 +284,8 @@ drm_output_prepare_overlay_view(struct drm_plane *plane,
 	state->output = output;
 
 	if (!drm_plane_state_coords_for_view(state, ev, zpos)) {
+		*try_view_on_plane_failure_reasons |=
+			FAILURE_REASONS_TRANSFORM_INCOMPATIBLE;
 		drm_debug(b, "\t\t\t\t[overlay] not placing view %p on overlay: "
 			     "unsuitable transform\n", ev);
 		drm_plane_state_put_back(state);
@@ -161,11 +293,23 @@ drm_output_prepare_overlay_view(struct drm_plane *plane,
 		goto out;
 	}
 
+	if (drm_plane_scaling_known_bad(state)) {
+		*try_view_on_plane_failure_reasons |=
+			FAILURE_REASONS_SCALING_INCOMPATIBLE;
+		drm_debug(b, "\t\t\t\t[overlay] not placing view %p on overlay: "
+			     "scaling beyond plane limits\n", ev);
+		drm_plane_state_put_back(state);
+		state = NULL;
+		goto out;
+	}
+
 	/* If the surface buffer has an in-fence fd, but the plane
 	 * doesn't support fences, we can't place the buffer on this
 	 * plane. */
 	if (ev->surface->acquire_fence_fd >= 0 &&
 	     plane->props[WDRM_PLANE_IN_FENCE_FD].prop_id == 0) {
+		*try_view_on_plane_failure_reasons |=
+			FAILURE_REASONS_FENCE_INCOMPATIBLE;
 		drm_debug(b, "\t\t\t\t[overlay] not placing view %p on overlay: "
 			     "no in-fence support\n", ev);
 		drm_plane_state_put_back(state);
@@ -190,6 +334,8 @@ drm_output_prepare_overlay_view(struct drm_plane *plane,
 	}
 
 	ret = drm_pending_state_test(output_state->pending_state);
+	output->plane_stats.test_commits++;
+	drm_plane_scaling_record(state, ret == 0);
 	if (ret == 0) {
 		drm_debug(b, "\t\t\t[overlay] provisionally placing "
 			     "view %p on overlay %d in mixed mode\n",
@@ -197,6 +343,7 @@ drm_output_prepare_overlay_view(struct drm_plane *plane,
 		goto out;
 	}
 
+	*try_view_on_plane_failure_reasons |= FAILURE_REASONS_TEST_FAILED;
 	drm_debug(b, "\t\t\t[overlay] not placing view %p on overlay %lu "
 		     "in mixed mode: kernel test failed\n",
 		  ev, (unsigned long) plane->plane_id);
@@ -246,9 +393,114 @@ cursor_bo_update(struct drm_plane_state *plane_state, struct weston_view *ev)
 		weston_log("failed update cursor: %s\n", strerror(errno));
 }
 
+/* Identifies the image cursor_bo_update() would write for the buffer */
+static uint64_t
+cursor_image_hash(struct weston_buffer *buffer)
+{
+	int32_t stride = wl_shm_buffer_get_stride(buffer->shm_buffer);
+	uint8_t *s = wl_shm_buffer_get_data(buffer->shm_buffer);
+	uint64_t hash = ((uint64_t) buffer->width << 32) | buffer->height;
+	int i;
+
+	wl_shm_buffer_begin_access(buffer->shm_buffer);
+	for (i = 0; i < buffer->height; i++)
+		hash = weston_content_hash_bytes(hash, s + i * stride,
+						 buffer->width * 4);
+	wl_shm_buffer_end_access(buffer->shm_buffer);
+
+	return hash;
+}
+
+/**
+ * Pick the cursor BO to show an image with
+ *
+ * Animated cursors cycle through a few images, so a BO still holding the
+ * image is just switched to. Otherwise the image goes to a BO never used,
+ * a new one while the cache has room, or the least recently used one;
+ * never to the BO on screen.
+ *
+ * @param output Output owning the cursor BOs
+ * @param hash Image hash from cursor_image_hash()
+ * @param needs_update Set to whether the image must be written
+ * @return Index into gbm_cursor_fb, or -1 if there is no BO to use
+ */
+static int
+drm_output_find_cursor_bo(struct drm_output *output, uint64_t hash,
+			  bool *needs_update)
+{
+	struct drm_fb *on_screen = output->cursor_plane->state_cur->fb;
+	int victim = -1;
+	int empty = -1;
+	int i;
+
+	*needs_update = false;
+	for (i = 0; i < DRM_CURSOR_CACHE_SIZE; i++) {
+		if (output->gbm_cursor_fb[i] &&
+		    output->gbm_cursor_last_use[i] != 0 &&
+		    output->gbm_cursor_hash[i] == hash)
+			return i;
+	}
+
+	*needs_update = true;
+	for (i = 0; i < DRM_CURSOR_CACHE_SIZE; i++) {
+		if (!output->gbm_cursor_fb[i]) {
+			if (empty < 0)
+				empty = i;
+			continue;
+		}
+		if (output->gbm_cursor_fb[i] == on_screen)
+			continue;
+		if (victim < 0 || output->gbm_cursor_last_use[i] <
+				  output->gbm_cursor_last_use[victim])
+			victim = i;
+	}
+
+	if (victim >= 0 && output->gbm_cursor_last_use[victim] == 0)
+		return victim;
+	if (empty >= 0 && drm_output_create_cursor_bo(output, empty) == 0)
+		return empty;
+
+	return victim;
+}
+
+/* An atomic cursor plane takes any fb it supports, so a client dmabuf of
+ * the cursor size is scanned out as it is, like on an overlay. */
+static struct drm_plane_state *
+drm_output_prepare_cursor_fb(struct drm_plane_state *plane_state,
+			     struct weston_view *ev, struct drm_fb *fb,
+			     uint32_t *try_view_on_plane_failure_reasons)
+{
+	struct drm_plane *plane = plane_state->plane;
+	struct drm_backend *b = plane->backend;
+
+	if (ev->surface->acquire_fence_fd >= 0 &&
+	    plane->props[WDRM_PLANE_IN_FENCE_FD].prop_id == 0) {
+		*try_view_on_plane_failure_reasons |=
+			FAILURE_REASONS_FENCE_INCOMPATIBLE;
+		drm_debug(b, "\t\t\t\t[cursor] not assigning view %p to cursor "
+			     "plane (no in-fence support)\n", ev);
+		drm_plane_state_put_back(plane_state);
+		return NULL;
+	}
+
+	/* Whatever the next wl_shm cursor is, it is looked up by hash. */
+	drm_output_set_cursor_view(plane_state->output, NULL);
+
+	plane_state->fb = drm_fb_ref(fb);
+	plane_state->ev = ev;
+	plane_state->in_fence_fd = ev->surface->acquire_fence_fd;
+
+	drm_debug(b, "\t\t\t\t[cursor] provisionally assigned view %p to "
+		     "cursor, scanning out its buffer\n", ev);
+
+	return plane_state;
+}
+
 static struct drm_plane_state *
 drm_output_prepare_cursor_view(struct drm_output_state *output_state,
-			       struct weston_view *ev, uint64_t zpos)
+			       struct weston_view *ev, struct drm_fb *fb,
+			       uint64_t zpos,
+			       uint32_t *try_view_on_plane_failure_reasons)
 {
 	struct drm_output *output = output_state->output;
 	struct drm_backend *b = to_drm_backend(output->base.compositor);
@@ -257,6 +509,9 @@ drm_output_prepare_cursor_view(struct drm_output_state *output_state,
 	bool needs_update = false;
 	struct weston_buffer *buffer = ev->surface->buffer_ref.buffer;
 	const char *p_name = drm_output_get_plane_type_name(plane);
+	bool is_shm = wl_shm_buffer_get(buffer->resource) != NULL;
+	uint64_t hash = 0;
+	int slot;
 
 	assert(!b->cursors_are_broken);
 
@@ -282,6 +537,8 @@ drm_output_prepare_cursor_view(struct drm_output_state *output_state,
 	 * simple cropping/translation in cursor_bo_update. */
 	plane_state->output = output;
 	if (!drm_plane_state_coords_for_view(plane_state, ev, zpos)) {
+		*try_view_on_plane_failure_reasons |=
+			FAILURE_REASONS_TRANSFORM_INCOMPATIBLE;
 		drm_debug(b, "\t\t\t\t[%s] not placing view %p on %s: "
 			     "unsuitable transform\n", p_name, ev, p_name);
 		goto err;
@@ -289,6 +546,8 @@ drm_output_prepare_cursor_view(struct drm_output_state *output_state,
 
 	if (buffer->width > b->cursor_width ||
 	    buffer->height > b->cursor_height) {
+		*try_view_on_plane_failure_reasons |=
+			FAILURE_REASONS_FB_SIZE_INCOMPATIBLE;
 		drm_debug(b, "\t\t\t\t[%s] not assigning view %p to %s plane "
 			     "(surface buffer (%dx%d) larger than permitted"
 			     " (%dx%d))\n", p_name, ev, p_name,
@@ -297,30 +556,59 @@ drm_output_prepare_cursor_view(struct drm_output_state *output_state,
 		goto err;
 	}
 
+	/* The cursor buffer is uploaded as-is, keep it simple. */
+	if (plane_state->rotation != 0 ||
+	    plane_state->alpha != DRM_PLANE_ALPHA_OPAQUE) {
+		*try_view_on_plane_failure_reasons |=
+			FAILURE_REASONS_TRANSFORM_INCOMPATIBLE;
+		drm_debug(b, "\t\t\t\t[%s] not assigning view %p to %s plane "
+			     "(cursor cannot be rotated or blended)\n",
+			     p_name, ev, p_name);
+		goto err;
+	}
+
 	if (plane_state->src_x != 0 || plane_state->src_y != 0 ||
 	    plane_state->src_w > (unsigned) b->cursor_width << 16 ||
 	    plane_state->src_h > (unsigned) b->cursor_height << 16 ||
 	    plane_state->src_w != plane_state->dest_w << 16 ||
 	    plane_state->src_h != plane_state->dest_h << 16) {
+		*try_view_on_plane_failure_reasons |=
+			FAILURE_REASONS_SCALING_INCOMPATIBLE;
 		drm_debug(b, "\t\t\t\t[%s] not assigning view %p to %s plane "
 			     "(positioning requires cropping or scaling)\n",
 			     p_name, ev, p_name);
 		goto err;
 	}
 
+	if (!is_shm)
+		return drm_output_prepare_cursor_fb(plane_state, ev, fb,
+					try_view_on_plane_failure_reasons);
+
 	/* Since we're setting plane state up front, we need to work out
 	 * whether or not we need to upload a new cursor. We can't use the
 	 * plane damage, since the planes haven't actually been calculated
 	 * yet: instead try to figure it out directly. KMS cursor planes are
 	 * pretty unique here, in that they lie partway between a Weston plane
 	 * (direct scanout) and a renderer. */
+	if (ev != output->cursor_view &&
+	    ev->surface->buffer_ref.released_early) {
+		/* The client may already be drawing into it again. */
+		drm_debug(b, "\t\t\t\t[%s] not assigning view %p to %s plane "
+			     "(buffer already released)\n", p_name, ev, p_name);
+		goto err;
+	}
+
 	if (ev != output->cursor_view ||
 	    pixman_region32_not_empty(&ev->surface->damage)) {
-		output->current_cursor++;
-		output->current_cursor =
-			output->current_cursor %
-				ARRAY_LENGTH(output->gbm_cursor_fb);
-		needs_update = true;
+		hash = cursor_image_hash(buffer);
+		slot = drm_output_find_cursor_bo(output, hash, &needs_update);
+		if (slot < 0) {
+			drm_debug(b, "\t\t\t\t[%s] not assigning view %p to "
+				     "%s plane (no free cursor BO)\n",
+				  p_name, ev, p_name);
+			goto err;
+		}
+		output->current_cursor = slot;
 	}
 
 	drm_output_set_cursor_view(output, ev);
@@ -328,10 +616,16 @@ drm_output_prepare_cursor_view(struct drm_output_state *output_state,
 
 	plane_state->fb =
 		drm_fb_ref(output->gbm_cursor_fb[output->current_cursor]);
+	output->gbm_cursor_last_use[output->current_cursor] =
+		++output->gbm_cursor_use_count;
 
 	if (needs_update) {
 		drm_debug(b, "\t\t\t\t[%s] copying new content to cursor BO\n", p_name);
 		cursor_bo_update(plane_state, ev);
+		output->gbm_cursor_hash[output->current_cursor] = hash;
+	} else if (hash != 0) {
+		drm_debug(b, "\t\t\t\t[%s] reusing cursor BO %d\n",
+			  p_name, output->current_cursor);
 	}
 
 	/* The cursor API is somewhat special: in cursor_bo_update(), we upload
@@ -355,7 +649,9 @@ err:
 #else
 static struct drm_plane_state *
 drm_output_prepare_cursor_view(struct drm_output_state *output_state,
-			       struct weston_view *ev, uint64_t zpos)
+			       struct weston_view *ev, struct drm_fb *fb,
+			       uint64_t zpos,
+			       uint32_t *try_view_on_plane_failure_reasons)
 {
 	return NULL;
 }
@@ -365,7 +661,8 @@ static struct drm_plane_state *
 drm_output_prepare_scanout_view(struct drm_output_state *output_state,
 				struct weston_view *ev,
 				enum drm_output_propose_state_mode mode,
-				struct drm_fb *fb, uint64_t zpos)
+				struct drm_fb *fb, uint64_t zpos,
+				uint32_t *try_view_on_plane_failure_reasons)
 {
 	struct drm_output *output = output_state->output;
 	struct drm_backend *b = to_drm_backend(output->base.compositor);
@@ -390,6 +687,8 @@ drm_output_prepare_scanout_view(struct drm_output_state *output_state,
 	 * support fences, we can't place the buffer on this plane. */
 	if (ev->surface->acquire_fence_fd >= 0 &&
 	    scanout_plane->props[WDRM_PLANE_IN_FENCE_FD].prop_id == 0) {
+		*try_view_on_plane_failure_reasons |=
+			FAILURE_REASONS_FENCE_INCOMPATIBLE;
 		drm_debug(b, "\t\t\t\t[%s] not placing view %p on %s: "
 			     "no in-fence support\n", p_name, ev, p_name);
 		return NULL;
@@ -415,6 +714,8 @@ drm_output_prepare_scanout_view(struct drm_output_state *output_state,
 	state->ev = ev;
 	state->output = output;
 	if (!drm_plane_state_coords_for_view(state, ev, zpos)) {
+		*try_view_on_plane_failure_reasons |=
+			FAILURE_REASONS_TRANSFORM_INCOMPATIBLE;
 		drm_debug(b, "\t\t\t\t[%s] not placing view %p on %s: "
 			     "unsuitable transform\n", p_name, ev, p_name);
 		goto err;
@@ -428,6 +729,14 @@ drm_output_prepare_scanout_view(struct drm_output_state *output_state,
 		goto err;
 	}
 
+	if (drm_plane_scaling_known_bad(state)) {
+		*try_view_on_plane_failure_reasons |=
+			FAILURE_REASONS_SCALING_INCOMPATIBLE;
+		drm_debug(b, "\t\t\t\t[%s] not placing view %p on %s: "
+			     "scaling beyond plane limits\n", p_name, ev, p_name);
+		goto err;
+	}
+
 	state->in_fence_fd = ev->surface->acquire_fence_fd;
 
 	/* In plane-only mode, we don't need to test the state now, as we
@@ -444,7 +753,8 @@ drm_output_try_view_on_plane(struct drm_plane *plane,
 			     struct drm_output_state *state,
 			     struct weston_view *ev,
 			     enum drm_output_propose_state_mode mode,
-			     struct drm_fb *fb, uint64_t zpos)
+			     struct drm_fb *fb, uint64_t zpos,
+			     uint32_t *try_view_on_plane_failure_reasons)
 {
 	struct drm_backend *b = state->pending_state->backend;
 	struct weston_output *wet_output = &state->output->base;
@@ -471,7 +781,8 @@ drm_output_try_view_on_plane(struct drm_plane *plane,
 			goto out;
 		}
 
-		ps = drm_output_prepare_cursor_view(state, ev, zpos);
+		ps = drm_output_prepare_cursor_view(state, ev, fb, zpos,
+						    try_view_on_plane_failure_reasons);
 		if (ps)
 			availability = PLACED_ON_PLANE;
 		break;
@@ -491,7 +802,8 @@ drm_output_try_view_on_plane(struct drm_plane *plane,
 		}
 
 		ps = drm_output_prepare_overlay_view(plane, state, ev, mode,
-						     fb, zpos);
+						     fb, zpos,
+						     try_view_on_plane_failure_reasons);
 		if (ps)
 			availability = PLACED_ON_PLANE;
 		break;
@@ -502,7 +814,8 @@ drm_output_try_view_on_plane(struct drm_plane *plane,
 		}
 
 		ps = drm_output_prepare_scanout_view(state, ev, mode,
-						     fb, zpos);
+						     fb, zpos,
+						     try_view_on_plane_failure_reasons);
 		if (ps)
 			availability = PLACED_ON_PLANE;
 		break;
@@ -584,29 +897,175 @@ drm_output_check_zpos_plane_states(struct drm_output_state *state)
 	}
 }
 
+/* Non-cursor planes which could ever show a view of this output; the scanout
+ * tranche only offers what these planes support. */
+static uint32_t
+drm_output_scanout_plane_mask(struct drm_output *output)
+{
+	struct drm_backend *b = output->backend;
+	struct drm_plane *plane;
+	uint32_t mask = 0;
+
+	if (output->virtual)
+		return 0;
+
+	wl_list_for_each(plane, &b->plane_list, link) {
+		if (plane->type == WDRM_PLANE_TYPE_CURSOR)
+			continue;
+		if (plane->possible_crtcs & (1 << output->crtc->pipe))
+			mask |= 1 << plane->plane_idx;
+	}
+
+	return mask;
+}
+
+/* Keep only the best ranked modifiers of each format, so clients
+ * reallocating for scanout pick bandwidth-friendly layouts; buffers in
+ * other layouts are still listed by the renderer tranche. */
+static int
+drm_format_array_keep_best_modifiers(struct weston_drm_format_array *formats)
+{
+	struct weston_drm_format_array best;
+	struct weston_drm_format *fmt, *best_fmt;
+	const uint64_t *modifiers;
+	unsigned int num_modifiers, i;
+	enum drm_modifier_rank rank, top;
+	int ret = 0;
+
+	weston_drm_format_array_init(&best);
+
+	wl_array_for_each(fmt, &formats->arr) {
+		modifiers = weston_drm_format_get_modifiers(fmt, &num_modifiers);
+
+		top = DRM_MODIFIER_RANK_LINEAR;
+		if (!weston_drm_format_has_modifier(fmt, DRM_FORMAT_MOD_INVALID)) {
+			for (i = 0; i < num_modifiers; i++) {
+				rank = drm_modifier_rank(modifiers[i]);
+				top = MAX(top, rank);
+			}
+		}
+
+		best_fmt = weston_drm_format_array_add_format(&best, fmt->format);
+		if (!best_fmt) {
+			ret = -1;
+			goto out;
+		}
+
+		for (i = 0; i < num_modifiers; i++) {
+			if (top != DRM_MODIFIER_RANK_LINEAR &&
+			    drm_modifier_rank(modifiers[i]) != top)
+				continue;
+
+			ret = weston_drm_format_add_modifier(best_fmt,
+							     modifiers[i]);
+			if (ret < 0)
+				goto out;
+		}
+	}
+
+	ret = weston_drm_format_array_replace(formats, &best);
+
+out:
+	weston_drm_format_array_fini(&best);
+	return ret;
+}
+
+static int
+dmabuf_feedback_narrow_scanout_tranche(struct drm_backend *b,
+				       struct weston_dmabuf_feedback *dmabuf_feedback,
+				       struct weston_dmabuf_feedback_tranche *tranche,
+				       uint32_t plane_mask)
+{
+	struct weston_compositor *ec = b->compositor;
+	struct weston_drm_format_array formats;
+	struct drm_plane *plane;
+	int ret;
+
+	weston_drm_format_array_init(&formats);
+
+	wl_list_for_each(plane, &b->plane_list, link) {
+		if (!(plane_mask & (1 << plane->plane_idx)))
+			continue;
+
+		ret = weston_drm_format_array_join(&formats, &plane->formats);
+		if (ret < 0)
+			goto out;
+	}
+
+	ret = weston_drm_format_array_intersect(&formats,
+						ec->renderer->get_supported_formats(ec));
+	if (ret < 0)
+		goto out;
+
+	ret = drm_format_array_keep_best_modifiers(&formats);
+	if (ret < 0)
+		goto out;
+
+	ret = weston_dmabuf_feedback_tranche_set_formats(dmabuf_feedback, tranche,
+							 ec->dmabuf_feedback_format_table,
+							 &formats);
+
+out:
+	weston_drm_format_array_fini(&formats);
+	return ret;
+}
+
+static uint32_t
+dmabuf_feedback_vote(struct weston_dmabuf_feedback *dmabuf_feedback)
+{
+	/* A clear majority of the window has to agree. */
+	const unsigned int threshold = WESTON_DMABUF_FEEDBACK_WINDOW * 3 / 4;
+	unsigned int add_votes = 0, remove_votes = 0;
+	unsigned int i;
+
+	if (dmabuf_feedback->placement_window_len < WESTON_DMABUF_FEEDBACK_WINDOW)
+		return ACTION_NEEDED_NONE;
+
+	for (i = 0; i < WESTON_DMABUF_FEEDBACK_WINDOW; i++) {
+		uint32_t reasons = dmabuf_feedback->placement_window[i];
+
+		/* Reallocating makes no difference if the renderer is forced
+		 * on the view anyway, or if the planes would turn it down for
+		 * its size or stacking. */
+		if (reasons & FAILURE_REASONS_FORCE_RENDERER)
+			remove_votes++;
+		else if (reasons & FAILURE_REASONS_SCANOUT_FIXABLE)
+			add_votes++;
+		else if (reasons & (FAILURE_REASONS_FB_SIZE_INCOMPATIBLE |
+				    FAILURE_REASONS_ZPOS_INCOMPATIBLE |
+				    FAILURE_REASONS_PLANES_REJECTED))
+			remove_votes++;
+	}
+
+	if (add_votes >= threshold)
+		return ACTION_NEEDED_ADD_SCANOUT_TRANCHE;
+	if (remove_votes >= threshold)
+		return ACTION_NEEDED_REMOVE_SCANOUT_TRANCHE;
+
+	return ACTION_NEEDED_NONE;
+}
+
+/* Decide, from the reasons the view failed placement over the last
+ * WESTON_DMABUF_FEEDBACK_WINDOW repaints, whether the client should be told
+ * to reallocate from a scanout tranche, or to go back to renderer formats.
+ * The scanout tranche only lists what the planes of the view's output
+ * support, and is rebuilt when those planes change. */
 static bool
-dmabuf_feedback_maybe_update(struct drm_backend *b, struct weston_view *ev,
+dmabuf_feedback_maybe_update(struct drm_output *output, struct weston_view *ev,
 			     uint32_t try_view_on_plane_failure_reasons)
 {
+	struct drm_backend *b = output->backend;
 	struct weston_dmabuf_feedback *dmabuf_feedback = ev->surface->dmabuf_feedback;
 	struct weston_dmabuf_feedback_tranche *scanout_tranche;
 	dev_t scanout_dev = b->drm.devnum;
 	uint32_t scanout_flags = ZWP_LINUX_DMABUF_FEEDBACK_V1_TRANCHE_FLAGS_SCANOUT;
-	uint32_t action_needed = ACTION_NEEDED_NONE;
-	struct timespec current_time, delta_time;
-	const time_t MAX_TIME_SECONDS = 2;
-
-	/* Find out what we need to do with the dma-buf feedback */
-	if (try_view_on_plane_failure_reasons & FAILURE_REASONS_FORCE_RENDERER)
-		action_needed |= ACTION_NEEDED_REMOVE_SCANOUT_TRANCHE;
-	if (try_view_on_plane_failure_reasons &
-		(FAILURE_REASONS_ADD_FB_FAILED |
-		 FAILURE_REASONS_FB_FORMAT_INCOMPATIBLE |
-		 FAILURE_REASONS_DMABUF_MODIFIER_INVALID))
-		action_needed |= ACTION_NEEDED_ADD_SCANOUT_TRANCHE;
-
-	assert(action_needed != (ACTION_NEEDED_REMOVE_SCANOUT_TRANCHE |
-				 ACTION_NEEDED_ADD_SCANOUT_TRANCHE));
+	uint32_t action_needed;
+	uint32_t plane_mask;
+	struct timespec current_time;
+	const time_t MIN_RESEND_SECONDS = 1;
+
+	weston_dmabuf_feedback_record_placement(dmabuf_feedback,
+						try_view_on_plane_failure_reasons);
 
 	/* Look for scanout tranche. If not found, add it but in disabled mode
 	 * (we still don't know if we'll have to send it to clients). This
@@ -620,71 +1079,101 @@ dmabuf_feedback_maybe_update(struct drm_backend *b, struct weston_view *ev,
 					b->compositor->dmabuf_feedback_format_table,
 					scanout_dev, scanout_flags,
 					SCANOUT_PREF);
-		scanout_tranche->active = false;
+		if (!scanout_tranche)
+			return false;
+		weston_dmabuf_feedback_tranche_set_active(dmabuf_feedback,
+							  scanout_tranche, false);
 	}
 
-	/* No actions needed, so disarm timer and return */
-	if (action_needed == ACTION_NEEDED_NONE ||
-	    (action_needed == ACTION_NEEDED_ADD_SCANOUT_TRANCHE &&
-	     scanout_tranche->active) ||
-	    (action_needed == ACTION_NEEDED_REMOVE_SCANOUT_TRANCHE &&
-	     !scanout_tranche->active)) {
-		dmabuf_feedback->action_needed = ACTION_NEEDED_NONE;
-		return false;
-	}
+	plane_mask = drm_output_scanout_plane_mask(output);
+	action_needed = dmabuf_feedback_vote(dmabuf_feedback);
+
+	/* The tranche was narrowed for planes the view can no longer reach,
+	 * e.g. it moved to another output: roll it back right away, without
+	 * waiting for the window, since the client may be allocating from
+	 * formats that now never work. Views spanning several outputs are
+	 * left to the window, where they vote for the renderer. */
+	if (scanout_tranche->active &&
+	    ev->output_mask == (1u << output->base.id) &&
+	    plane_mask != dmabuf_feedback->scanout_plane_mask) {
+		action_needed = plane_mask ? ACTION_NEEDED_ADD_SCANOUT_TRANCHE :
+					     ACTION_NEEDED_REMOVE_SCANOUT_TRANCHE;
+	} else {
+		if ((action_needed == ACTION_NEEDED_ADD_SCANOUT_TRANCHE &&
+		     scanout_tranche->active) ||
+		    (action_needed == ACTION_NEEDED_REMOVE_SCANOUT_TRANCHE &&
+		     !scanout_tranche->active))
+			action_needed = ACTION_NEEDED_NONE;
 
-	/* We hit this if:
-	 *
-	 * 1. timer is still off, or
-	 * 2. the action needed when it was set to on does not match the most
-	 *    recent needed action we've detected.
-	 *
-	 * So we reset the timestamp, set the timer to on it with the most
-	 * recent needed action, return and leave the timer running. */
-	if (dmabuf_feedback->action_needed == ACTION_NEEDED_NONE ||
-	    dmabuf_feedback->action_needed != action_needed) {
-		clock_gettime(CLOCK_MONOTONIC, &dmabuf_feedback->timer);
 		dmabuf_feedback->action_needed = action_needed;
-		return false;
-	/* Timer is already on and the action needed when it was set to on does
-	 * not conflict with the most recent needed action we've detected. If
-	 * more than MAX_TIME_SECONDS has passed, we need to resend the dma-buf
-	 * feedback. Otherwise, return and leave the timer running. */
-	} else {
+		if (action_needed == ACTION_NEEDED_NONE)
+			return false;
+
+		/* Give clients time to reallocate before changing our
+		 * mind again. */
 		clock_gettime(CLOCK_MONOTONIC, &current_time);
-		delta_time.tv_sec = current_time.tv_sec -
-				    dmabuf_feedback->timer.tv_sec;
-		if (delta_time.tv_sec < MAX_TIME_SECONDS)
+		if (dmabuf_feedback->timer.tv_sec != 0 &&
+		    current_time.tv_sec - dmabuf_feedback->timer.tv_sec <
+		    MIN_RESEND_SECONDS)
 			return false;
 	}
 
-	/* If we got here it means that the timer has triggered, so we have
-	 * pending actions with the dma-buf feedback. So we update and resend
-	 * them. */
-	if (action_needed == ACTION_NEEDED_ADD_SCANOUT_TRANCHE)
-		scanout_tranche->active = true;
-	else if (action_needed == ACTION_NEEDED_REMOVE_SCANOUT_TRANCHE)
-		scanout_tranche->active = false;
-	else
-		assert(0);
+	if (action_needed == ACTION_NEEDED_ADD_SCANOUT_TRANCHE) {
+		if (plane_mask == 0 ||
+		    dmabuf_feedback_narrow_scanout_tranche(b, dmabuf_feedback,
+							   scanout_tranche,
+							   plane_mask) < 0)
+			return false;
+		weston_dmabuf_feedback_tranche_set_active(dmabuf_feedback,
+							  scanout_tranche, true);
+		dmabuf_feedback->scanout_plane_mask = plane_mask;
+	} else {
+		weston_dmabuf_feedback_tranche_set_active(dmabuf_feedback,
+							  scanout_tranche, false);
+		dmabuf_feedback->scanout_plane_mask = 0;
+	}
 
 	drm_debug(b, "\t[repaint] Need to update and resend the "
-		     "dma-buf feedback for surface of view %p\n", ev);
+		     "dma-buf feedback for surface of view %p (%s scanout "
+		     "tranche)\n", ev,
+		     scanout_tranche->active ? "with" : "without");
 	weston_dmabuf_feedback_send_all(dmabuf_feedback,
 					b->compositor->dmabuf_feedback_format_table);
 
-	/* Set the timer to off */
+	/* Start over, so that the next decision only looks at how the
+	 * client did with the feedback it just got. */
+	clock_gettime(CLOCK_MONOTONIC, &dmabuf_feedback->timer);
 	dmabuf_feedback->action_needed = ACTION_NEEDED_NONE;
+	dmabuf_feedback->placement_window_len = 0;
+	dmabuf_feedback->placement_window_pos = 0;
 
 	return true;
 }
 
+/* wl_shm cursors are copied into a cursor BO; atomic drivers can also scan
+ * out a client buffer which has the size of those BOs. */
+static bool
+drm_cursor_plane_takes_buffer(struct drm_plane *plane,
+			      struct wl_shm_buffer *shmbuf, struct drm_fb *fb)
+{
+	struct drm_backend *b = plane->backend;
+
+	if (shmbuf)
+		return wl_shm_buffer_get_format(shmbuf) == WL_SHM_FORMAT_ARGB8888;
+
+	return b->atomic_modeset && fb &&
+	       (fb->plane_mask & (1 << plane->plane_idx)) &&
+	       fb->width == b->cursor_width && fb->height == b->cursor_height;
+}
+
 static struct drm_plane_state *
 drm_output_prepare_plane_view(struct drm_output_state *state,
 			      struct weston_view *ev,
 			      enum drm_output_propose_state_mode mode,
 			      struct drm_plane_state *scanout_state,
 			      uint64_t current_lowest_zpos,
+			      bool cursor_only,
+			      bool underlay,
 			      uint32_t *try_view_on_plane_failure_reasons)
 {
 	struct drm_output *output = state->output;
@@ -723,7 +1212,24 @@ drm_output_prepare_plane_view(struct drm_output_state *state,
 			continue;
 		}
 
+		if (ev->plane_hint.fixed_zpos &&
+		    (ev->plane_hint.zpos < plane->zpos_min ||
+		     ev->plane_hint.zpos > plane->zpos_max ||
+		     ev->plane_hint.zpos >= current_lowest_zpos ||
+		     (scanout_state &&
+		      ev->plane_hint.zpos <= scanout_state->zpos))) {
+			*try_view_on_plane_failure_reasons |=
+				FAILURE_REASONS_ZPOS_INCOMPATIBLE;
+			drm_debug(b, "\t\t\t\t[plane] not adding plane %d to "
+				     "candidate list: cannot stack at the "
+				     "view's fixed zpos (%"PRIu64")\n",
+				     plane->plane_id, ev->plane_hint.zpos);
+			continue;
+		}
+
 		if (plane->zpos_min >= current_lowest_zpos) {
+			*try_view_on_plane_failure_reasons |=
+				FAILURE_REASONS_ZPOS_INCOMPATIBLE;
 			drm_debug(b, "\t\t\t\t[plane] not adding plane %d to "
 				     "candidate list: minimum zpos (%"PRIu64") "
 				     "plane's above current lowest zpos "
@@ -732,9 +1238,32 @@ drm_output_prepare_plane_view(struct drm_output_state *state,
 			continue;
 		}
 
-		if (mode == DRM_OUTPUT_PROPOSE_STATE_MIXED) {
+		if (underlay &&
+		    (plane->type != WDRM_PLANE_TYPE_OVERLAY ||
+		     plane->zpos_min >= scanout_state->zpos)) {
+			*try_view_on_plane_failure_reasons |=
+				FAILURE_REASONS_ZPOS_INCOMPATIBLE;
+			drm_debug(b, "\t\t\t\t[plane] not adding plane %d to "
+				     "candidate list: cannot go below the "
+				     "primary's zpos (%"PRIu64")\n",
+				     plane->plane_id, scanout_state->zpos);
+			continue;
+		}
+
+		if (mode == DRM_OUTPUT_PROPOSE_STATE_MIXED && !underlay) {
 			assert(scanout_state != NULL);
+			if (current_lowest_zpos <= scanout_state->zpos + 1) {
+				*try_view_on_plane_failure_reasons |=
+					FAILURE_REASONS_ZPOS_INCOMPATIBLE;
+				drm_debug(b, "\t\t\t\t[plane] not adding plane %d to "
+					     "candidate list: no zpos left "
+					     "above the primary, underlay in "
+					     "use\n", plane->plane_id);
+				continue;
+			}
 			if (scanout_state->zpos >= plane->zpos_max) {
+				*try_view_on_plane_failure_reasons |=
+					FAILURE_REASONS_ZPOS_INCOMPATIBLE;
 				drm_debug(b, "\t\t\t\t[plane] not adding plane %d to "
 					     "candidate list: primary's zpos "
 					     "value (%"PRIu64") higher than "
@@ -745,6 +1274,22 @@ drm_output_prepare_plane_view(struct drm_output_state *state,
 			}
 		}
 
+		if (ev->plane_hint.preference ==
+		    WESTON_VIEW_PLANE_PREFER_PRIMARY &&
+		    plane->type != WDRM_PLANE_TYPE_PRIMARY) {
+			drm_debug(b, "\t\t\t\t[plane] not adding plane %d to "
+				     "candidate list: view only wants the "
+				     "primary plane\n", plane->plane_id);
+			continue;
+		}
+
+		if (cursor_only && plane->type != WDRM_PLANE_TYPE_CURSOR) {
+			drm_debug(b, "\t\t\t\t[plane] not adding plane %d to "
+				     "candidate list: kept for views that save "
+				     "more composition\n", plane->plane_id);
+			continue;
+		}
+
 		if (mode == DRM_OUTPUT_PROPOSE_STATE_RENDERER_ONLY &&
 		    (plane->type == WDRM_PLANE_TYPE_OVERLAY ||
 		     plane->type == WDRM_PLANE_TYPE_PRIMARY)) {
@@ -755,7 +1300,15 @@ drm_output_prepare_plane_view(struct drm_output_state *state,
 		}
 
 		if (plane->type == WDRM_PLANE_TYPE_CURSOR &&
-		    (!shmbuf || wl_shm_buffer_get_format(shmbuf) != WL_SHM_FORMAT_ARGB8888)) {
+		    drm_output_is_mirrored(output)) {
+			drm_debug(b, "\t\t\t\t[plane] not adding plane %d to "
+				     "candidate list: mirrors only show the "
+				     "primary plane\n", plane->plane_id);
+			continue;
+		}
+
+		if (plane->type == WDRM_PLANE_TYPE_CURSOR &&
+		    !drm_cursor_plane_takes_buffer(plane, shmbuf, fb)) {
 			drm_debug(b, "\t\t\t\t[plane] not adding plane %d, type cursor to "
 				     "candidate list: cursor planes only support ARGB8888"
 				     "wl_shm buffers and the view buffer is of another type\n",
@@ -765,7 +1318,8 @@ drm_output_prepare_plane_view(struct drm_output_state *state,
 
 		if (plane->type != WDRM_PLANE_TYPE_CURSOR &&
 		    (!fb || !(fb->plane_mask & (1 << plane->plane_idx)))) {
-			*try_view_on_plane_failure_reasons |=
+			*try_view_on_plane_failure_reasons |= fb ?
+				drm_fb_plane_failure_reason(b, fb, plane) :
 				FAILURE_REASONS_FB_FORMAT_INCOMPATIBLE;
 			drm_debug(b, "\t\t\t\t[plane] not adding plane %d to "
 				     "candidate list: invalid pixel format\n",
@@ -780,6 +1334,10 @@ drm_output_prepare_plane_view(struct drm_output_state *state,
 	 * plane suitable for \c ev; start with the highest zpos value of a
 	 * plane to maximize our chances, but do note we pass the zpos value
 	 * based on current tracked value by \c current_lowest_zpos_in_use */
+	if (!wl_list_empty(&zpos_candidate_list))
+		*try_view_on_plane_failure_reasons |=
+			FAILURE_REASONS_PLANES_REJECTED;
+
 	while (!wl_list_empty(&zpos_candidate_list)) {
 		struct drm_plane_zpos *head_p_zpos =
 			wl_container_of(zpos_candidate_list.next,
@@ -788,7 +1346,13 @@ drm_output_prepare_plane_view(struct drm_output_state *state,
 		const char *p_name = drm_output_get_plane_type_name(plane);
 		uint64_t zpos;
 
-		if (current_lowest_zpos == DRM_PLANE_ZPOS_INVALID_PLANE)
+		if (ev->plane_hint.fixed_zpos)
+			zpos = ev->plane_hint.zpos;
+		else if (underlay)
+			zpos = MIN(MIN(current_lowest_zpos,
+				       scanout_state->zpos) - 1,
+				   plane->zpos_max);
+		else if (current_lowest_zpos == DRM_PLANE_ZPOS_INVALID_PLANE)
 			zpos = plane->zpos_max;
 		else
 			zpos = MIN(current_lowest_zpos - 1, plane->zpos_max);
@@ -798,7 +1362,8 @@ drm_output_prepare_plane_view(struct drm_output_state *state,
 			     plane->plane_id, p_name);
 
 		ps = drm_output_try_view_on_plane(plane, state, ev,
-						  mode, fb, zpos);
+						  mode, fb, zpos,
+						  try_view_on_plane_failure_reasons);
 		drm_output_destroy_zpos_plane(head_p_zpos);
 		if (ps) {
 			drm_debug(b, "\t\t\t\t[view] view %p has been placed to "
@@ -815,10 +1380,148 @@ drm_output_prepare_plane_view(struct drm_output_state *state,
 	return ps;
 }
 
+/* A view underneath renderer content can still go on a plane below the
+ * primary one, with the renderer punching a transparent hole for it, as
+ * long as the renderer framebuffer carries alpha and the view fully covers
+ * whatever is below it.
+ */
+static bool
+drm_view_can_underlay(struct weston_view *ev, pixman_region32_t *clipped_view)
+{
+	if (ev->plane_hint.fixed_zpos ||
+	    ev->plane_hint.preference == WESTON_VIEW_PLANE_PREFER_PRIMARY)
+		return false;
+
+	return ev->alpha == 1.0f && weston_view_is_opaque(ev, clipped_view);
+}
+
+/* Estimate how much renderer work putting a view on a plane saves: the
+ * area it covers on the output, weighted up when the renderer would have
+ * to convert YUV or blend.
+ */
+static uint64_t
+drm_view_plane_value(struct weston_view *ev, struct drm_output *output)
+{
+	struct weston_buffer *buffer = ev->surface->buffer_ref.buffer;
+	struct linux_dmabuf_buffer *dmabuf;
+	const struct pixel_format_info *info;
+	pixman_region32_t visible;
+	const pixman_box32_t *box;
+	uint64_t value;
+
+	/* Outranks every heuristic estimate. */
+	if (ev->plane_hint.preference == WESTON_VIEW_PLANE_PREFER_OVERLAY)
+		return UINT64_MAX;
+
+	pixman_region32_init(&visible);
+	pixman_region32_intersect(&visible, &ev->transform.boundingbox,
+				  &output->base.region);
+	box = pixman_region32_extents(&visible);
+	value = (uint64_t) (box->x2 - box->x1) * (box->y2 - box->y1);
+	pixman_region32_fini(&visible);
+
+	dmabuf = buffer ? linux_dmabuf_buffer_get(buffer->resource) : NULL;
+	if (dmabuf) {
+		info = pixel_format_get_info(dmabuf->attributes.format);
+		if (info && (info->sampler_type != 0 ||
+			     info->num_planes > 1 || info->hsub > 1))
+			value *= 2;
+	}
+
+	if (!weston_view_is_opaque(ev, &ev->transform.boundingbox))
+		value += value / 2;
+
+	/* The renderer would redo these every frame. */
+	if (ev->surface->content_type == WESTON_SURFACE_CONTENT_TYPE_VIDEO ||
+	    ev->surface->content_type == WESTON_SURFACE_CONTENT_TYPE_GAME)
+		value *= 2;
+
+	return value;
+}
+
+static int
+compare_plane_value_desc(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a;
+	uint64_t y = *(const uint64_t *)b;
+
+	return (x < y) - (x > y);
+}
+
+/* When more views could go on overlay planes than there are planes to
+ * offer, the top-to-bottom walk hands planes out first come, first served,
+ * e.g. to a small surface above a full-screen video. Return the value a
+ * view needs to be offered an overlay in mixed mode so that only the most
+ * valuable candidates compete for them, or 0 if every candidate fits.
+ */
+static uint64_t
+drm_output_min_plane_value(struct drm_output *output)
+{
+	struct drm_backend *b = output->backend;
+	struct weston_paint_node *pnode;
+	struct drm_plane *plane;
+	struct wl_array values;
+	uint64_t *value;
+	uint64_t threshold = 0;
+	unsigned int n_planes = 0;
+	unsigned int n_views;
+
+	wl_list_for_each(plane, &b->plane_list, link) {
+		if (plane->type == WDRM_PLANE_TYPE_OVERLAY &&
+		    drm_plane_is_available(plane, output))
+			n_planes++;
+	}
+	if (n_planes == 0)
+		return 0;
+
+	wl_array_init(&values);
+	wl_list_for_each(pnode, &output->base.paint_node_z_order_list,
+			 z_order_link) {
+		struct weston_view *ev = pnode->view;
+		struct weston_buffer *buffer;
+
+		if (ev->output_mask != (1u << output->base.id) ||
+		    !weston_view_has_valid_buffer(ev) ||
+		    ev->plane_hint.preference ==
+		    WESTON_VIEW_PLANE_PREFER_RENDERER ||
+		    ev->plane_hint.preference ==
+		    WESTON_VIEW_PLANE_PREFER_PRIMARY)
+			continue;
+
+		/* wl_shm buffers can only go on the cursor plane, unless
+		 * they were imported through udmabuf */
+		buffer = ev->surface->buffer_ref.buffer;
+		if (wl_shm_buffer_get(buffer->resource) && !buffer->udmabuf)
+			continue;
+
+		value = wl_array_add(&values, sizeof *value);
+		if (!value) {
+			wl_array_release(&values);
+			return 0;
+		}
+		*value = drm_view_plane_value(ev, output);
+	}
+
+	n_views = values.size / sizeof *value;
+	if (n_views > n_planes) {
+		qsort(values.data, n_views, sizeof *value,
+		      compare_plane_value_desc);
+		threshold = ((uint64_t *) values.data)[n_planes - 1];
+		/* Ties cannot be told apart; let the walk decide. */
+		if (threshold == ((uint64_t *) values.data)[n_planes])
+			threshold = 0;
+	}
+
+	wl_array_release(&values);
+	return threshold;
+}
+
 static struct drm_output_state *
 drm_output_propose_state(struct weston_output *output_base,
 			 struct drm_pending_state *pending_state,
-			 enum drm_output_propose_state_mode mode)
+			 enum drm_output_propose_state_mode mode,
+			 uint64_t min_plane_value,
+			 bool skip_test)
 {
 	struct drm_output *output = to_drm_output(output_base);
 	struct drm_backend *b = to_drm_backend(output->base.compositor);
@@ -830,6 +1533,8 @@ drm_output_propose_state(struct weston_output *output_base,
 	pixman_region32_t occluded_region;
 
 	bool renderer_ok = (mode != DRM_OUTPUT_PROPOSE_STATE_PLANES_ONLY);
+	bool underlay_ok = false;
+	bool past_fullscreen = false;
 	int ret;
 	uint64_t current_lowest_zpos = DRM_PLANE_ZPOS_INVALID_PLANE;
 
@@ -883,6 +1588,9 @@ drm_output_propose_state(struct weston_output *output_base,
 			  (unsigned long) output->base.id);
 		drm_debug(b, "\t\t[state] scanout will use for zpos %"PRIu64"\n",
 				scanout_state->zpos);
+
+		/* Underlays show through holes in the renderer output. */
+		underlay_ok = !pixel_format_is_opaque(scanout_fb->format);
 	}
 
 	/* - renderer_region contains the total region which which will be
@@ -902,10 +1610,16 @@ drm_output_propose_state(struct weston_output *output_base,
 		struct weston_view *ev = pnode->view;
 		struct drm_plane_state *ps = NULL;
 		bool force_renderer = false;
+		bool underlay = false;
 		pixman_region32_t clipped_view;
 		pixman_region32_t surface_overlap;
 		bool totally_occluded = false;
 
+		/* Everything below the fullscreen view is occluded. */
+		if (past_fullscreen)
+			break;
+		past_fullscreen = ev == output->base.fullscreen_view;
+
 		drm_debug(b, "\t\t\t[view] evaluating view %p for "
 		             "output %s (%lu)\n",
 		          ev, output->base.name,
@@ -971,13 +1685,22 @@ drm_output_propose_state(struct weston_output *output_base,
 
 		/* Since we process views from top to bottom, we know that if
 		 * the view intersects the calculated renderer region, it must
-		 * be part of, or occluded by, it, and cannot go on a plane. */
+		 * be part of, or occluded by, it, and can only go on a plane
+		 * below the primary one. */
 		pixman_region32_intersect(&surface_overlap, &renderer_region,
 					  &clipped_view);
 		if (pixman_region32_not_empty(&surface_overlap)) {
-			drm_debug(b, "\t\t\t\t[view] not assigning view %p to plane "
-			             "(occluded by renderer views)\n", ev);
-			force_renderer = true;
+			if (underlay_ok &&
+			    drm_view_can_underlay(ev, &clipped_view)) {
+				drm_debug(b, "\t\t\t\t[view] view %p is under "
+					     "renderer views, trying an "
+					     "underlay\n", ev);
+				underlay = true;
+			} else {
+				drm_debug(b, "\t\t\t\t[view] not assigning view %p to plane "
+					     "(occluded by renderer views)\n", ev);
+				force_renderer = true;
+			}
 		}
 		pixman_region32_fini(&surface_overlap);
 
@@ -991,13 +1714,26 @@ drm_output_propose_state(struct weston_output *output_base,
 			force_renderer = true;
 		}
 
+		if (ev->plane_hint.preference ==
+		    WESTON_VIEW_PLANE_PREFER_RENDERER) {
+			drm_debug(b, "\t\t\t\t[view] not assigning view %p to plane "
+				     "(shell asked for the renderer)\n", ev);
+			force_renderer = true;
+		}
+
 		/* Now try to place it on a plane if we can. */
 		if (!force_renderer) {
+			bool cursor_only = min_plane_value != 0 &&
+				ev->plane_hint.preference !=
+				WESTON_VIEW_PLANE_PREFER_PRIMARY &&
+				drm_view_plane_value(ev, output) < min_plane_value;
+
 			drm_debug(b, "\t\t\t[plane] started with zpos %"PRIu64"\n",
 				      current_lowest_zpos);
 			ps = drm_output_prepare_plane_view(state, ev, mode,
 							   scanout_state,
 							   current_lowest_zpos,
+							   cursor_only, underlay,
 							   &pnode->try_view_on_plane_failure_reasons);
 			/* If we were able to place the view in a plane, set
 			 * failure reasons to none. */
@@ -1060,11 +1796,18 @@ drm_output_propose_state(struct weston_output *output_base,
 	drm_output_check_zpos_plane_states(state);
 
 	/* Check to see if this state will actually work. */
-	ret = drm_pending_state_test(state->pending_state);
-	if (ret != 0) {
-		drm_debug(b, "\t\t[view] failing state generation: "
-			     "atomic test not OK\n");
-		goto err;
+	if (skip_test) {
+		drm_debug(b, "\t\t[state] skipping atomic test, identical "
+			     "scene passed it before\n");
+	} else {
+		ret = drm_pending_state_test(state->pending_state);
+		output->plane_stats.test_commits++;
+		drm_output_state_scaling_record(state, ret == 0);
+		if (ret != 0) {
+			drm_debug(b, "\t\t[view] failing state generation: "
+				     "atomic test not OK\n");
+			goto err;
+		}
 	}
 
 	/* Counterpart to duplicating scanout state at the top of this
@@ -1086,6 +1829,417 @@ err:
 	return NULL;
 }
 
+static uint64_t
+hash_u64(uint64_t hash, uint64_t value)
+{
+	int i;
+
+	/* FNV-1a, one byte at a time */
+	for (i = 0; i < 8; i++) {
+		hash ^= (value >> (i * 8)) & 0xff;
+		hash *= 0x100000001b3ull;
+	}
+
+	return hash;
+}
+
+static uint64_t
+hash_box(uint64_t hash, const pixman_box32_t *box)
+{
+	hash = hash_u64(hash, (uint32_t) box->x1);
+	hash = hash_u64(hash, (uint32_t) box->y1);
+	hash = hash_u64(hash, (uint32_t) box->x2);
+	return hash_u64(hash, (uint32_t) box->y2);
+}
+
+static uint64_t
+hash_view_buffer(uint64_t hash, struct weston_view *ev)
+{
+	struct weston_buffer *buffer = ev->surface->buffer_ref.buffer;
+	struct linux_dmabuf_buffer *dmabuf;
+	struct wl_shm_buffer *shm;
+
+	if (!buffer)
+		return hash_u64(hash, 0);
+
+	hash = hash_u64(hash, (uint32_t) buffer->width);
+	hash = hash_u64(hash, (uint32_t) buffer->height);
+
+	shm = wl_shm_buffer_get(buffer->resource);
+	if (shm)
+		return hash_u64(hash, wl_shm_buffer_get_format(shm));
+
+	dmabuf = linux_dmabuf_buffer_get(buffer->resource);
+	if (dmabuf) {
+		hash = hash_u64(hash, dmabuf->attributes.format);
+		hash = hash_u64(hash, dmabuf->attributes.modifier[0]);
+		return hash_u64(hash, dmabuf->attributes.n_planes);
+	}
+
+	/* wl_drm and other legacy buffers; the format is not known
+	 * without importing, so key on the buffer object itself. */
+	return hash_u64(hash, (uintptr_t) buffer);
+}
+
+/* Compute a key over everything drm_output_propose_state() looks at
+ * besides the framebuffer contents: the views on the output in z-order,
+ * their geometry, alpha, opaque regions, buffer formats/modifiers and plane
+ * hints, the output mode and protection, and which planes other outputs
+ * hold.
+ */
+static uint64_t
+drm_output_plane_cache_key(struct drm_output *output)
+{
+	struct drm_backend *b = output->backend;
+	struct weston_paint_node *pnode;
+	struct drm_plane *plane;
+	uint64_t hash = 0xcbf29ce484222325ull;
+	uint32_t alpha_bits;
+
+	hash = hash_u64(hash, (uintptr_t) output->base.current_mode);
+	hash = hash_u64(hash, output->base.current_protection);
+
+	/* Planes held by other outputs are not available to us. */
+	wl_list_for_each(plane, &b->plane_list, link) {
+		if (plane->state_cur->output == output)
+			continue;
+
+		hash = hash_u64(hash, plane->plane_id);
+		hash = hash_u64(hash, (uintptr_t) plane->state_cur->output);
+	}
+
+	wl_list_for_each(pnode, &output->base.paint_node_z_order_list,
+			 z_order_link) {
+		struct weston_view *ev = pnode->view;
+		struct weston_surface *es = ev->surface;
+		struct weston_buffer_viewport *vp = &es->buffer_viewport;
+
+		if (!(ev->output_mask & (1u << output->base.id)))
+			continue;
+
+		memcpy(&alpha_bits, &ev->alpha, sizeof alpha_bits);
+
+		hash = hash_u64(hash, (uintptr_t) ev);
+		hash = hash_u64(hash, ev->output_mask);
+		hash = hash_u64(hash, alpha_bits);
+		hash = hash_u64(hash, ev->transform.enabled ?
+				      ev->transform.matrix.type : 0);
+		hash = hash_box(hash, pixman_region32_extents(&ev->transform.boundingbox));
+		hash = hash_box(hash, pixman_region32_extents(&ev->transform.opaque));
+		hash = hash_u64(hash, weston_view_is_opaque(ev, &ev->transform.boundingbox));
+		hash = hash_u64(hash, vp->buffer.transform);
+		hash = hash_u64(hash, (uint32_t) vp->buffer.scale);
+		hash = hash_u64(hash, (uint32_t) vp->buffer.src_x);
+		hash = hash_u64(hash, (uint32_t) vp->buffer.src_y);
+		hash = hash_u64(hash, (uint32_t) vp->buffer.src_width);
+		hash = hash_u64(hash, (uint32_t) vp->buffer.src_height);
+		hash = hash_u64(hash, (uint32_t) vp->surface.width);
+		hash = hash_u64(hash, (uint32_t) vp->surface.height);
+		hash = hash_u64(hash, es->protection_mode);
+		hash = hash_u64(hash, es->desired_protection);
+		hash = hash_u64(hash, pnode->surf_xform_valid);
+		hash = hash_u64(hash, (uintptr_t) pnode->surf_xform.transform);
+		hash = hash_u64(hash, pnode->surf_xform.identity_pipeline);
+		hash = hash_u64(hash, ev->plane_hint.preference);
+		hash = hash_u64(hash, ev->plane_hint.fixed_zpos);
+		hash = hash_u64(hash, ev->plane_hint.zpos);
+		hash = hash_u64(hash, es->content_type);
+		hash = hash_view_buffer(hash, ev);
+
+		/* Nothing below a fullscreen view can reach a plane. */
+		if (ev == output->base.fullscreen_view)
+			break;
+	}
+
+	return hash;
+}
+
+/** Pass client surface damage of a directly scanned-out view to KMS
+ *
+ * FB_DAMAGE_CLIPS describe what changed relative to the framebuffer the
+ * plane showed before, so they are only valid when the same view was on
+ * the plane last frame and the surface damage has not been consumed by
+ * the repaint of another output.
+ */
+static void
+drm_plane_state_add_view_damage(struct drm_plane_state *state,
+				struct drm_output *output)
+{
+	struct drm_backend *b = output->backend;
+	struct drm_plane *plane = state->plane;
+	struct weston_view *ev = state->ev;
+	pixman_region32_t damage;
+	pixman_box32_t src;
+	pixman_box32_t *rects;
+	int n_rects;
+
+	if (plane->props[WDRM_PLANE_FB_DAMAGE_CLIPS].prop_id == 0 ||
+	    plane->type == WDRM_PLANE_TYPE_CURSOR ||
+	    plane->damage_view != ev ||
+	    plane->state_cur->output != output ||
+	    ev->output_mask != (1u << output->base.id) ||
+	    b->state_invalid)
+		return;
+
+	assert(state->damage_blob_id == 0);
+
+	pixman_region32_init(&damage);
+	weston_surface_to_buffer_region(ev->surface, &ev->surface->damage,
+					&damage);
+
+	src.x1 = state->src_x >> 16;
+	src.y1 = state->src_y >> 16;
+	src.x2 = (state->src_x + state->src_w + 0xffff) >> 16;
+	src.y2 = (state->src_y + state->src_h + 0xffff) >> 16;
+	pixman_region32_intersect_rect(&damage, &damage, src.x1, src.y1,
+				       src.x2 - src.x1, src.y2 - src.y1);
+
+	/* No clips at all means the whole plane is damaged, and an empty
+	 * blob cannot be created, so leave an undamaged plane at that. */
+	rects = pixman_region32_rectangles(&damage, &n_rects);
+	if (n_rects > 0)
+		drmModeCreatePropertyBlob(b->drm.fd, rects,
+					  sizeof(*rects) * n_rects,
+					  &state->damage_blob_id);
+
+	pixman_region32_fini(&damage);
+}
+
+/** Attach damage clips to the client planes of a final output state
+ *
+ * Also records which view each plane of the output shows, so that the
+ * next frame knows whether its surface damage applies.
+ */
+static void
+drm_output_state_add_view_damage(struct drm_output *output,
+				 struct drm_output_state *state)
+{
+	struct drm_backend *b = output->backend;
+	struct drm_plane_state *plane_state;
+	struct drm_plane *plane;
+
+	wl_list_for_each(plane_state, &state->plane_list, link) {
+		if (plane_state->ev && plane_state->fb &&
+		    plane_state->fb->type != BUFFER_CURSOR)
+			drm_plane_state_add_view_damage(plane_state, output);
+	}
+
+	wl_list_for_each(plane, &b->plane_list, link) {
+		plane_state = drm_output_state_get_existing_plane(state, plane);
+		if (plane_state)
+			drm_plane_set_damage_view(plane, plane_state->fb ?
+						  plane_state->ev : NULL);
+		else if (plane->state_cur->output == output)
+			drm_plane_set_damage_view(plane, NULL);
+	}
+}
+
+static const char *const failure_reasons_as_string[FAILURE_REASONS__COUNT] = {
+	"force-renderer",
+	"format",
+	"dmabuf-modifier",
+	"add-fb",
+	"modifier",
+	"size",
+	"zpos",
+	"planes-rejected",
+	"transform",
+	"scaling",
+	"fence",
+	"test-failed",
+};
+
+static void
+drm_output_plane_stats_count_failures(struct drm_output *output,
+				      uint32_t reasons)
+{
+	unsigned int i;
+
+	output->plane_stats.views_on_renderer++;
+
+	for (i = 0; i < FAILURE_REASONS__COUNT; i++) {
+		if (reasons & (1u << i))
+			output->plane_stats.failures[i]++;
+	}
+}
+
+static void
+drm_plane_stats_print_reasons(struct weston_log_subscription *sub,
+			      uint32_t reasons)
+{
+	unsigned int i;
+
+	for (i = 0; i < FAILURE_REASONS__COUNT; i++) {
+		if (reasons & (1u << i))
+			weston_log_subscription_printf(sub, " %s",
+						       failure_reasons_as_string[i]);
+	}
+}
+
+static void
+drm_output_plane_stats_print(struct weston_log_subscription *sub,
+			     struct drm_output *output)
+{
+	struct weston_paint_node *pnode;
+	uint64_t frames = output->plane_stats.frames;
+	unsigned int i;
+
+	weston_log_subscription_printf(sub, "output %s:\n"
+		"\tframes: %" PRIu64 "\n", output->base.name, frames);
+
+	for (i = 0; i < ARRAY_LENGTH(output->plane_stats.modes); i++) {
+		uint64_t n = output->plane_stats.modes[i];
+
+		weston_log_subscription_printf(sub,
+			"\t%s: %" PRIu64 " (%.1f%%)\n",
+			drm_propose_state_mode_to_string(i), n,
+			frames ? 100.0 * n / frames : 0.0);
+	}
+
+	weston_log_subscription_printf(sub,
+		"\tTEST_ONLY commits: %" PRIu64 " (%.2f per frame)\n"
+		"\tviews on planes: %" PRIu64 ", on the renderer: %" PRIu64 "\n"
+		"\trenderer views by failure reason:\n",
+		output->plane_stats.test_commits,
+		frames ? (double) output->plane_stats.test_commits / frames : 0.0,
+		output->plane_stats.views_on_planes,
+		output->plane_stats.views_on_renderer);
+
+	for (i = 0; i < FAILURE_REASONS__COUNT; i++) {
+		if (output->plane_stats.failures[i] == 0)
+			continue;
+		weston_log_subscription_printf(sub, "\t\t%s: %" PRIu64 "\n",
+					       failure_reasons_as_string[i],
+					       output->plane_stats.failures[i]);
+	}
+
+	weston_log_subscription_printf(sub, "\tlast frame:\n");
+	wl_list_for_each(pnode, &output->base.paint_node_z_order_list,
+			 z_order_link) {
+		struct weston_view *ev = pnode->view;
+		struct drm_plane *plane = NULL, *iter;
+		char desc[512] = "[no description available]";
+
+		if (!(ev->output_mask & (1u << output->base.id)))
+			continue;
+
+		wl_list_for_each(iter, &output->backend->plane_list, link) {
+			if (ev->plane == &iter->base) {
+				plane = iter;
+				break;
+			}
+		}
+
+		if (ev->surface->get_label)
+			ev->surface->get_label(ev->surface, desc, sizeof desc);
+
+		if (plane) {
+			weston_log_subscription_printf(sub,
+				"\t\tview %p (%s): %s plane %lu\n", ev, desc,
+				plane_type_enums[plane->type].name,
+				(unsigned long) plane->plane_id);
+		} else {
+			weston_log_subscription_printf(sub,
+				"\t\tview %p (%s): renderer,", ev, desc);
+			drm_plane_stats_print_reasons(sub,
+				pnode->try_view_on_plane_failure_reasons);
+			weston_log_subscription_printf(sub, "\n");
+		}
+	}
+}
+
+/** Print the plane assignment counters of every output
+ *
+ * Failure reasons are counted once per frame for each view which ends up
+ * on the renderer; a view rejected by several planes for different
+ * reasons counts towards each of them.
+ */
+void
+drm_plane_stats_print_cb(struct weston_log_subscription *sub, void *data)
+{
+	struct drm_backend *b = data;
+	struct weston_output *output_base;
+
+	wl_list_for_each(output_base, &b->compositor->output_list, link)
+		drm_output_plane_stats_print(sub, to_drm_output(output_base));
+
+	weston_log_subscription_complete(sub);
+}
+
+/** The plane assignment counters in OpenMetrics families */
+void
+drm_plane_stats_write_metrics(struct weston_metrics *m, struct drm_backend *b)
+{
+	static const char *const mode_labels[] = {
+		[DRM_OUTPUT_PROPOSE_STATE_MIXED] = "mixed",
+		[DRM_OUTPUT_PROPOSE_STATE_RENDERER_ONLY] = "renderer-only",
+		[DRM_OUTPUT_PROPOSE_STATE_PLANES_ONLY] = "planes-only",
+	};
+	struct weston_output *base;
+	struct drm_output *output;
+	unsigned int i;
+
+	weston_metrics_family(m, "weston_drm_plane_assignments", "counter",
+			      NULL, "Repaints by the plane assignment mode used");
+	wl_list_for_each(base, &b->compositor->output_list, link) {
+		output = to_drm_output(base);
+		for (i = 0; i < ARRAY_LENGTH(mode_labels); i++)
+			weston_metrics_sample(m,
+				"weston_drm_plane_assignments_total",
+				output->plane_stats.modes[i],
+				"output", base->name,
+				"mode", mode_labels[i], NULL);
+	}
+
+	weston_metrics_family(m, "weston_drm_test_commits", "counter", NULL,
+			      "TEST_ONLY atomic commits");
+	wl_list_for_each(base, &b->compositor->output_list, link) {
+		output = to_drm_output(base);
+		weston_metrics_sample(m, "weston_drm_test_commits_total",
+				      output->plane_stats.test_commits,
+				      "output", base->name, NULL);
+	}
+
+	weston_metrics_family(m, "weston_drm_views", "counter", NULL,
+			      "Views per repaint, by where they were shown");
+	wl_list_for_each(base, &b->compositor->output_list, link) {
+		output = to_drm_output(base);
+		weston_metrics_sample(m, "weston_drm_views_total",
+				      output->plane_stats.views_on_planes,
+				      "output", base->name,
+				      "placement", "plane", NULL);
+		weston_metrics_sample(m, "weston_drm_views_total",
+				      output->plane_stats.views_on_renderer,
+				      "output", base->name,
+				      "placement", "renderer", NULL);
+	}
+
+	weston_metrics_family(m, "weston_drm_renderer_views", "counter", NULL,
+			      "Views left to the renderer, by failure reason");
+	wl_list_for_each(base, &b->compositor->output_list, link) {
+		output = to_drm_output(base);
+		for (i = 0; i < FAILURE_REASONS__COUNT; i++) {
+			if (output->plane_stats.failures[i] == 0)
+				continue;
+			weston_metrics_sample(m,
+				"weston_drm_renderer_views_total",
+				output->plane_stats.failures[i],
+				"output", base->name,
+				"reason", failure_reasons_as_string[i], NULL);
+		}
+	}
+}
+
+/* An overlay showing a buffer without alpha at full plane alpha hides
+ * everything under it, whatever the client says about opaque regions. */
+static bool
+drm_plane_state_is_opaque(struct drm_plane_state *state)
+{
+	return state->plane->type == WDRM_PLANE_TYPE_OVERLAY &&
+	       state->fb && pixel_format_is_opaque(state->fb->format) &&
+	       state->alpha == DRM_PLANE_ALPHA_OPAQUE;
+}
+
 void
 drm_assign_planes(struct weston_output *output_base, void *repaint_data)
 {
@@ -1097,20 +2251,76 @@ drm_assign_planes(struct weston_output *output_base, void *repaint_data)
 	struct weston_paint_node *pnode;
 	struct weston_plane *primary = &output_base->compositor->primary_plane;
 	enum drm_output_propose_state_mode mode = DRM_OUTPUT_PROPOSE_STATE_PLANES_ONLY;
+	uint64_t min_plane_value = 0;
+	uint64_t cache_key;
+	bool cache_hit;
 
 	drm_debug(b, "\t[repaint] preparing state for output %s (%lu)\n",
 		  output_base->name, (unsigned long) output_base->id);
 
-	if (!b->sprites_are_broken && !output->virtual) {
+	/* The failure reasons accumulate over the propose attempts below,
+	 * and are left in place afterwards for the drm-plane-stats scope. */
+	wl_list_for_each(pnode, &output->base.paint_node_z_order_list,
+			 z_order_link)
+		pnode->try_view_on_plane_failure_reasons = FAILURE_REASONS_NONE;
+
+	/* An unchanged scene gets the same answer from the kernel, so reuse
+	 * the mode that worked last time without test commits, or go
+	 * straight to renderer-only if nothing else did. */
+	cache_key = drm_output_plane_cache_key(output);
+	cache_hit = output->plane_cache.valid &&
+		    output->plane_cache.key == cache_key &&
+		    !b->state_invalid && !drm_output_is_mirrored(output);
+
+	if (cache_hit &&
+	    output->plane_cache.mode != DRM_OUTPUT_PROPOSE_STATE_RENDERER_ONLY) {
+		mode = output->plane_cache.mode;
+		min_plane_value = output->plane_cache.min_plane_value;
+		drm_debug(b, "\t[repaint] scene unchanged, reusing %s\n",
+			  drm_propose_state_mode_to_string(mode));
+		state = drm_output_propose_state(output_base, pending_state,
+						 mode, min_plane_value, true);
+		if (!state) {
+			mode = DRM_OUTPUT_PROPOSE_STATE_PLANES_ONLY;
+			min_plane_value = 0;
+			cache_hit = false;
+		}
+	} else if (cache_hit) {
+		drm_debug(b, "\t[repaint] scene unchanged, planes did not "
+			     "work last time\n");
+	}
+
+	if (state || cache_hit) {
+		/* reusing the cached outcome */
+	} else if (drm_output_is_mirrored(output)) {
+		/* Mirrors take the renderer's framebuffer, which has to
+		 * hold the whole scene. */
+		drm_debug(b, "\t[state] output is mirrored, not using planes\n");
+	} else if (!b->sprites_are_broken && !output->virtual) {
 		drm_debug(b, "\t[repaint] trying planes-only build state\n");
-		state = drm_output_propose_state(output_base, pending_state, mode);
+		state = drm_output_propose_state(output_base, pending_state,
+						 mode, 0, false);
+		if (!state) {
+			mode = DRM_OUTPUT_PROPOSE_STATE_MIXED;
+			min_plane_value = drm_output_min_plane_value(output);
+		}
+		if (!state && min_plane_value) {
+			drm_debug(b, "\t[repaint] could not build planes-only "
+				     "state, trying mixed with overlays for the "
+				     "most valuable views\n");
+			state = drm_output_propose_state(output_base,
+							 pending_state, mode,
+							 min_plane_value,
+							 false);
+			if (!state)
+				min_plane_value = 0;
+		}
 		if (!state) {
 			drm_debug(b, "\t[repaint] could not build planes-only "
 				     "state, trying mixed\n");
-			mode = DRM_OUTPUT_PROPOSE_STATE_MIXED;
 			state = drm_output_propose_state(output_base,
 							 pending_state,
-							 mode);
+							 mode, 0, false);
 		}
 		if (!state) {
 			drm_debug(b, "\t[repaint] could not build mixed-mode "
@@ -1122,18 +2332,37 @@ drm_assign_planes(struct weston_output *output_base, void *repaint_data)
 
 	if (!state) {
 		mode = DRM_OUTPUT_PROPOSE_STATE_RENDERER_ONLY;
+		min_plane_value = 0;
 		state = drm_output_propose_state(output_base, pending_state,
-						 mode);
+						 mode, 0, false);
 	}
 
 	assert(state);
+	output->plane_cache.valid = true;
+	output->plane_cache.key = cache_key;
+	output->plane_cache.mode = mode;
+	output->plane_cache.min_plane_value = min_plane_value;
+
 	drm_debug(b, "\t[repaint] Using %s composition\n",
 		  drm_propose_state_mode_to_string(mode));
 
+	output->plane_stats.frames++;
+	output->plane_stats.modes[mode]++;
+
+	WESTON_PROBE(drm_assign_planes, output_base->id, mode, cache_hit,
+		     min_plane_value);
+
+	drm_output_state_add_view_damage(output, state);
+
 	wl_list_for_each(pnode, &output->base.paint_node_z_order_list,
 			 z_order_link) {
 		struct weston_view *ev = pnode->view;
+		struct drm_plane_state *target_state = NULL;
 		struct drm_plane *target_plane = NULL;
+		uint64_t target_zpos = DRM_PLANE_ZPOS_INVALID_PLANE;
+
+		pnode->need_hole = false;
+		pnode->plane_opaque = false;
 
 		/* If this view doesn't touch our output at all, there's no
 		 * reason to do anything with it. */
@@ -1143,9 +2372,8 @@ drm_assign_planes(struct weston_output *output_base, void *repaint_data)
 
 		/* Update dmabuf-feedback if needed */
 		if (ev->surface->dmabuf_feedback)
-			dmabuf_feedback_maybe_update(b, ev,
+			dmabuf_feedback_maybe_update(output, ev,
 						     pnode->try_view_on_plane_failure_reasons);
-		pnode->try_view_on_plane_failure_reasons = FAILURE_REASONS_NONE;
 
 		/* Test whether this buffer can ever go into a plane:
 		 * non-shm, or small enough to be a cursor.
@@ -1158,6 +2386,7 @@ drm_assign_planes(struct weston_output *output_base, void *repaint_data)
 		if (b->use_pixman ||
 		    (weston_view_has_valid_buffer(ev) &&
 		    (!wl_shm_buffer_get(ev->surface->buffer_ref.buffer->resource) ||
+		     ev->surface->buffer_ref.buffer->udmabuf ||
 		     (ev->surface->width <= b->cursor_width &&
 		      ev->surface->height <= b->cursor_height))))
 			ev->surface->keep_buffer = true;
@@ -1172,7 +2401,9 @@ drm_assign_planes(struct weston_output *output_base, void *repaint_data)
 		wl_list_for_each(plane_state, &state->plane_list, link) {
 			if (plane_state->ev == ev) {
 				plane_state->ev = NULL;
+				target_state = plane_state;
 				target_plane = plane_state->plane;
+				target_zpos = plane_state->zpos;
 				break;
 			}
 		}
@@ -1182,15 +2413,31 @@ drm_assign_planes(struct weston_output *output_base, void *repaint_data)
 				  ev, plane_type_enums[target_plane->type].name,
 				  (unsigned long) target_plane->plane_id);
 			weston_view_move_to_plane(ev, &target_plane->base);
+			output->plane_stats.views_on_planes++;
+
+			/* Only mixed mode places views below the primary. */
+			if (mode == DRM_OUTPUT_PROPOSE_STATE_MIXED &&
+			    target_zpos < output->scanout_plane->zpos_min) {
+				drm_debug(b, "\t[repaint] view %p is an "
+					     "underlay, renderer punches a "
+					     "hole\n", ev);
+				pnode->need_hole = true;
+			} else {
+				pnode->plane_opaque =
+					drm_plane_state_is_opaque(target_state);
+			}
 		} else {
 			drm_debug(b, "\t[repaint] view %p using renderer "
 				     "composition\n", ev);
 			weston_view_move_to_plane(ev, primary);
+			drm_output_plane_stats_count_failures(output,
+					pnode->try_view_on_plane_failure_reasons);
 		}
 
 		if (!target_plane ||
-		    target_plane->type == WDRM_PLANE_TYPE_CURSOR) {
-			/* cursor plane & renderer involve a copy */
+		    (target_plane->type == WDRM_PLANE_TYPE_CURSOR &&
+		     wl_shm_buffer_get(ev->surface->buffer_ref.buffer->resource))) {
+			/* wl_shm cursors & renderer involve a copy */
 			ev->psf_flags = 0;
 		} else {
 			/* All other planes are a direct scanout of a
@@ -1214,6 +2461,41 @@ drm_assign_planes(struct weston_output *output_base, void *repaint_data)
 	}
 }
 
+static void
+drm_plane_handle_damage_view_destroy(struct wl_listener *listener,
+				     void *data)
+{
+	struct drm_plane *plane =
+		container_of(listener, struct drm_plane,
+			     damage_view_destroy_listener);
+
+	drm_plane_set_damage_view(plane, NULL);
+}
+
+/** Set the client view last put on a plane
+ *
+ * Cleared when the view is destroyed, so a new view allocated at the same
+ * address never inherits damage tracking.
+ */
+void
+drm_plane_set_damage_view(struct drm_plane *plane, struct weston_view *ev)
+{
+	if (plane->damage_view == ev)
+		return;
+
+	if (plane->damage_view)
+		wl_list_remove(&plane->damage_view_destroy_listener.link);
+
+	plane->damage_view = ev;
+
+	if (ev) {
+		plane->damage_view_destroy_listener.notify =
+			drm_plane_handle_damage_view_destroy;
+		wl_signal_add(&ev->destroy_signal,
+			      &plane->damage_view_destroy_listener);
+	}
+}
+
 static void
 drm_output_handle_cursor_view_destroy(struct wl_listener *listener, void *data)
 {
@@ -35,6 +35,8 @@
 
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include <fcntl.h>
 
 #include <pthread.h>
@@ -70,8 +72,15 @@
 #define PROFILE_IDC_MAIN        77
 #define PROFILE_IDC_HIGH        100
 
+#define RECORDER_SOCKET_PREFIX "unix:"
+
+struct vaapi_recorder_input {
+	int prime_fd, stride;
+};
+
 struct vaapi_recorder {
 	int drm_fd, output_fd;
+	int output_is_socket;
 	int width, height;
 	int frame_count;
 
@@ -81,9 +90,13 @@ struct vaapi_recorder {
 	pthread_mutex_t mutex;
 	pthread_cond_t input_cond;
 
+	/* Ring of frames waiting for the worker, protected by mutex. The
+	 * worker only holds the mutex to pop a frame, so queueing never
+	 * waits for an encode. */
 	struct {
-		int valid;
-		int prime_fd, stride;
+		struct vaapi_recorder_input *frames;
+		unsigned int depth, head, count;
+		unsigned int dropped;
 	} input;
 
 	VADisplay va_dpy;
@@ -750,6 +763,33 @@ enum output_write_status {
 	OUTPUT_WRITE_FATAL
 };
 
+/* A stream socket may take the coded frame in several pieces, and the
+ * reader going away must not raise SIGPIPE in the compositor. */
+static ssize_t
+output_write_all(struct vaapi_recorder *r, const void *data, size_t size)
+{
+	const char *p = data;
+	size_t done = 0;
+	ssize_t count;
+
+	while (done < size) {
+		if (r->output_is_socket)
+			count = send(r->output_fd, p + done, size - done,
+				     MSG_NOSIGNAL);
+		else
+			count = write(r->output_fd, p + done, size - done);
+
+		if (count < 0 && errno == EINTR)
+			continue;
+		if (count < 0)
+			return -1;
+
+		done += count;
+	}
+
+	return done;
+}
+
 static enum output_write_status
 encoder_write_output(struct vaapi_recorder *r, VABufferID output_buf)
 {
@@ -767,7 +807,7 @@ encoder_write_output(struct vaapi_recorder *r, VABufferID output_buf)
 		return OUTPUT_WRITE_OVERFLOW;
 	}
 
-	count = write(r->output_fd, segment->buf, segment->size);
+	count = output_write_all(r, segment->buf, segment->size);
 
 	vaUnmapBuffer(r->va_dpy, output_buf);
 
@@ -822,8 +862,13 @@ encoder_encode(struct vaapi_recorder *r, VASurfaceID input)
 		vaDestroyBuffer(r->va_dpy, buffers[--count]);
 	} while (ret == OUTPUT_WRITE_OVERFLOW);
 
-	if (ret == OUTPUT_WRITE_FATAL)
-		r->error = errno;
+	if (ret == OUTPUT_WRITE_FATAL) {
+		int err = errno;
+
+		pthread_mutex_lock(&r->mutex);
+		r->error = err;
+		pthread_mutex_unlock(&r->mutex);
+	}
 
 	for (i = 0; i < count; i++)
 		vaDestroyBuffer(r->va_dpy, buffers[i]);
@@ -907,6 +952,44 @@ setup_worker_thread(struct vaapi_recorder *r)
 	return 1;
 }
 
+static int
+open_output(struct vaapi_recorder *r, const char *filename)
+{
+	const size_t prefix_len = strlen(RECORDER_SOCKET_PREFIX);
+	struct sockaddr_un addr;
+	int flags, fd;
+
+	if (strncmp(filename, RECORDER_SOCKET_PREFIX, prefix_len) != 0) {
+		flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+		return open(filename, flags, 0644);
+	}
+
+	filename += prefix_len;
+	if (strlen(filename) >= sizeof addr.sun_path) {
+		weston_log("vaapi: socket path too long: %s\n", filename);
+		return -1;
+	}
+
+	memset(&addr, 0, sizeof addr);
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, filename);
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -1;
+
+	if (connect(fd, (struct sockaddr *) &addr, sizeof addr) < 0) {
+		weston_log("vaapi: failed to connect to %s: %s\n",
+			   filename, strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	r->output_is_socket = 1;
+
+	return fd;
+}
+
 static void
 destroy_worker_thread(struct vaapi_recorder *r)
 {
@@ -922,15 +1005,29 @@ destroy_worker_thread(struct vaapi_recorder *r)
 
 	pthread_mutex_destroy(&r->mutex);
 	pthread_cond_destroy(&r->input_cond);
+
+	/* Frames the worker did not get to */
+	while (r->input.count > 0) {
+		close(r->input.frames[r->input.head].prime_fd);
+		r->input.head = (r->input.head + 1) % r->input.depth;
+		r->input.count--;
+	}
 }
 
+/**
+ * Create a recorder encoding H.264 to filename
+ *
+ * A filename of the form "unix:/path" connects to a listening stream
+ * socket instead. Up to queue_depth frames wait for the encoder before
+ * vaapi_recorder_frame() starts dropping them.
+ */
 struct vaapi_recorder *
-vaapi_recorder_create(int drm_fd, int width, int height, const char *filename)
+vaapi_recorder_create(int drm_fd, int width, int height, const char *filename,
+		      unsigned int queue_depth)
 {
 	struct vaapi_recorder *r;
 	VAStatus status;
 	int major, minor;
-	int flags;
 
 	r = zalloc(sizeof *r);
 	if (r == NULL)
@@ -940,11 +1037,15 @@ vaapi_recorder_create(int drm_fd, int width, int height, const char *filename)
 	r->height = height;
 	r->drm_fd = drm_fd;
 
+	r->input.depth = queue_depth > 0 ? queue_depth : 1;
+	r->input.frames = zalloc(r->input.depth * sizeof *r->input.frames);
+	if (r->input.frames == NULL)
+		goto err_free;
+
 	if (setup_worker_thread(r) < 0)
 		goto err_free;
 
-	flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
-	r->output_fd = open(filename, flags, 0644);
+	r->output_fd = open_output(r, filename);
 	if (r->output_fd < 0)
 		goto err_thread;
 
@@ -980,6 +1081,7 @@ err_fd:
 err_thread:
 	destroy_worker_thread(r);
 err_free:
+	free(r->input.frames);
 	free(r);
 
 	return NULL;
@@ -990,6 +1092,10 @@ vaapi_recorder_destroy(struct vaapi_recorder *r)
 {
 	destroy_worker_thread(r);
 
+	if (r->input.dropped > 0)
+		weston_log("[libva recorder] dropped %u frames, "
+			   "encoder queue full\n", r->input.dropped);
+
 	encoder_destroy(r);
 	vpp_destroy(r);
 
@@ -998,6 +1104,7 @@ vaapi_recorder_destroy(struct vaapi_recorder *r)
 	close(r->output_fd);
 	close(r->drm_fd);
 
+	free(r->input.frames);
 	free(r);
 }
 
@@ -1079,22 +1186,23 @@ convert_rgb_to_yuv(struct vaapi_recorder *r, VASurfaceID rgb_surface)
 	return status;
 }
 
+/* The dmabuf is imported as the VPP input surface as is; the only pass
+ * over the pixels is the colour conversion on the GPU. */
 static void
-recorder_frame(struct vaapi_recorder *r)
+recorder_frame(struct vaapi_recorder *r, struct vaapi_recorder_input *input)
 {
 	VASurfaceID rgb_surface;
 	VAStatus status;
 
-	status = create_surface_from_fd(r, r->input.prime_fd,
-					r->input.stride, &rgb_surface);
+	status = create_surface_from_fd(r, input->prime_fd,
+					input->stride, &rgb_surface);
+	close(input->prime_fd);
 	if (status != VA_STATUS_SUCCESS) {
 		weston_log("[libva recorder] "
 			   "failed to create surface from bo\n");
 		return;
 	}
 
-	close(r->input.prime_fd);
-
 	status = convert_rgb_to_yuv(r, rgb_surface);
 	if (status != VA_STATUS_SUCCESS) {
 		weston_log("[libva recorder] "
@@ -1111,20 +1219,26 @@ static void *
 worker_thread_function(void *data)
 {
 	struct vaapi_recorder *r = data;
+	struct vaapi_recorder_input input;
 
 	pthread_mutex_lock(&r->mutex);
 
 	while (!r->destroying) {
-		if (!r->input.valid)
+		if (r->input.count == 0)
 			pthread_cond_wait(&r->input_cond, &r->mutex);
 
 		/* If the thread is awaken by destroy_worker_thread(),
 		 * there might not be valid input */
-		if (!r->input.valid)
+		if (r->input.count == 0)
 			continue;
 
-		recorder_frame(r);
-		r->input.valid = 0;
+		input = r->input.frames[r->input.head];
+		r->input.head = (r->input.head + 1) % r->input.depth;
+		r->input.count--;
+
+		pthread_mutex_unlock(&r->mutex);
+		recorder_frame(r, &input);
+		pthread_mutex_lock(&r->mutex);
 	}
 
 	pthread_mutex_unlock(&r->mutex);
@@ -1132,26 +1246,40 @@ worker_thread_function(void *data)
 	return NULL;
 }
 
+/**
+ * Queue a frame for encoding, taking ownership of prime_fd
+ *
+ * When the encoder has fallen queue_depth frames behind, the frame is
+ * dropped instead of waiting. Returns -1 with errno set once the encoder
+ * has failed for good.
+ */
 int
 vaapi_recorder_frame(struct vaapi_recorder *r, int prime_fd, int stride)
 {
+	struct vaapi_recorder_input *input;
+	unsigned int tail;
 	int ret = 0;
 
 	pthread_mutex_lock(&r->mutex);
 
 	if (r->error) {
+		close(prime_fd);
 		errno = r->error;
 		ret = -1;
 		goto unlock;
 	}
 
-	/* The mutex is never released while encoding, so this point should
-	 * never be reached if input.valid is true. */
-	assert(!r->input.valid);
+	if (r->input.count == r->input.depth) {
+		close(prime_fd);
+		r->input.dropped++;
+		goto unlock;
+	}
 
-	r->input.prime_fd = prime_fd;
-	r->input.stride = stride;
-	r->input.valid = 1;
+	tail = (r->input.head + r->input.count) % r->input.depth;
+	input = &r->input.frames[tail];
+	input->prime_fd = prime_fd;
+	input->stride = stride;
+	r->input.count++;
 	pthread_cond_signal(&r->input_cond);
 
 unlock:
@@ -29,7 +29,8 @@
 struct vaapi_recorder;
 
 struct vaapi_recorder *
-vaapi_recorder_create(int drm_fd, int width, int height, const char *filename);
+vaapi_recorder_create(int drm_fd, int width, int height, const char *filename,
+		      unsigned int queue_depth);
 void
 vaapi_recorder_destroy(struct vaapi_recorder *r);
 int
@@ -179,6 +179,8 @@ finish_frame_handler(void *data)
 	weston_compositor_read_presentation_clock(output->base.compositor, &ts);
 	weston_output_finish_frame(&output->base, &ts, 0);
 
+	udev_input_enumerate_deferred(&output->backend->input);
+
 	return 1;
 }
 
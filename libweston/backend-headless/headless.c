@@ -32,10 +32,13 @@
 #include <string.h>
 #include <sys/time.h>
 #include <stdbool.h>
+#include <time.h>
 
 #include <libweston/libweston.h>
 #include <libweston/backend-headless.h>
 #include "shared/helpers.h"
+#include "shared/timespec-util.h"
+#include "frame-stats.h"
 #include "linux-explicit-synchronization.h"
 #include "pixman-renderer.h"
 #include "renderer-gl/gl-renderer.h"
@@ -58,6 +61,9 @@ struct headless_backend {
 	struct weston_seat fake_seat;
 	enum headless_renderer_type renderer_type;
 
+	uint32_t refresh; /* mHz, 0 to finish frames right away */
+	bool benchmark;
+
 	struct gl_renderer_interface *glri;
 };
 
@@ -70,10 +76,20 @@ struct headless_output {
 
 	struct weston_mode mode;
 	struct wl_event_source *finish_frame_timer;
+	struct wl_event_source *finish_frame_idle;
 	uint32_t *image_buf;
 	pixman_image_t *image;
+
+	/* benchmark mode, CLOCK_MONOTONIC */
+	struct weston_frame_histogram repaint_time;
+	struct weston_frame_histogram frame_interval;
+	struct timespec first_frame;
+	struct timespec last_frame;
 };
 
+/* Advertised refresh of flat out outputs, only bounds the repaint window */
+#define HEADLESS_FLAT_OUT_REFRESH 1000000
+
 static const uint32_t headless_formats[] = {
 	DRM_FORMAT_XRGB8888,
 	DRM_FORMAT_ARGB8888,
@@ -108,18 +124,49 @@ headless_output_start_repaint_loop(struct weston_output *output)
 	return 0;
 }
 
+static void
+headless_output_finish_frame(struct headless_output *output)
+{
+	struct headless_backend *b = to_headless_backend(output->base.compositor);
+	struct timespec ts, now;
+
+	if (b->benchmark) {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if (output->last_frame.tv_sec || output->last_frame.tv_nsec)
+			weston_frame_histogram_add(&output->frame_interval,
+						   timespec_sub_to_nsec(&now,
+							&output->last_frame));
+		else
+			output->first_frame = now;
+		output->last_frame = now;
+
+		/* Keep the next frame busy whether clients draw or not. */
+		weston_output_damage(&output->base);
+	}
+
+	weston_compositor_read_presentation_clock(output->base.compositor, &ts);
+	weston_output_finish_frame(&output->base, &ts, 0);
+}
+
 static int
 finish_frame_handler(void *data)
 {
 	struct headless_output *output = data;
-	struct timespec ts;
 
-	weston_compositor_read_presentation_clock(output->base.compositor, &ts);
-	weston_output_finish_frame(&output->base, &ts, 0);
+	headless_output_finish_frame(output);
 
 	return 1;
 }
 
+static void
+finish_frame_idle_handler(void *data)
+{
+	struct headless_output *output = data;
+
+	output->finish_frame_idle = NULL;
+	headless_output_finish_frame(output);
+}
+
 static int
 headless_output_repaint(struct weston_output *output_base,
 		       pixman_region32_t *damage,
@@ -127,17 +174,76 @@ headless_output_repaint(struct weston_output *output_base,
 {
 	struct headless_output *output = to_headless_output(output_base);
 	struct weston_compositor *ec = output->base.compositor;
+	struct headless_backend *b = to_headless_backend(ec);
+	struct wl_event_loop *loop;
+	struct timespec start, end;
+
+	if (b->benchmark)
+		clock_gettime(CLOCK_MONOTONIC, &start);
 
 	ec->renderer->repaint_output(&output->base, damage);
 
+	if (b->benchmark) {
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		weston_frame_histogram_add(&output->repaint_time,
+					   timespec_sub_to_nsec(&end, &start));
+	}
+
 	pixman_region32_subtract(&ec->primary_plane.damage,
 				 &ec->primary_plane.damage, damage);
 
-	wl_event_source_timer_update(output->finish_frame_timer, 16);
+	if (b->refresh == 0) {
+		loop = wl_display_get_event_loop(ec->wl_display);
+		output->finish_frame_idle =
+			wl_event_loop_add_idle(loop, finish_frame_idle_handler,
+					       output);
+	} else {
+		wl_event_source_timer_update(output->finish_frame_timer,
+					     MAX(1000000 / b->refresh, 1u));
+	}
 
 	return 0;
 }
 
+static void
+headless_output_print_stats(struct headless_output *output)
+{
+	const struct weston_frame_histogram *rt = &output->repaint_time;
+	const struct weston_frame_histogram *fi = &output->frame_interval;
+	double secs;
+
+	if (rt->count == 0)
+		return;
+
+	secs = timespec_sub_to_nsec(&output->last_frame,
+				    &output->first_frame) / 1e9;
+
+	weston_log("headless: output %s benchmark, %llu frames",
+		   output->base.name, (unsigned long long) rt->count);
+	if (fi->count > 0 && secs > 0.0)
+		weston_log_continue(" in %.3f s, %.1f fps", secs,
+				    fi->count / secs);
+	weston_log_continue("\n");
+	weston_log_continue(STAMP_SPACE "repaint: mean %llu us, "
+			    "p50 %llu us, p99 %llu us, max %llu us\n",
+			    (unsigned long long) (rt->sum_usec / rt->count),
+			    (unsigned long long)
+				weston_frame_histogram_percentile(rt, 50),
+			    (unsigned long long)
+				weston_frame_histogram_percentile(rt, 99),
+			    (unsigned long long) rt->max_usec);
+	if (fi->count > 0)
+		weston_log_continue(STAMP_SPACE "frame interval: mean %llu us, "
+				    "p50 %llu us, p99 %llu us, max %llu us\n",
+				    (unsigned long long)
+					(fi->sum_usec / fi->count),
+				    (unsigned long long)
+					weston_frame_histogram_percentile(fi, 50),
+				    (unsigned long long)
+					weston_frame_histogram_percentile(fi, 99),
+				    (unsigned long long) fi->max_usec);
+}
+
 static void
 headless_output_disable_gl(struct headless_output *output)
 {
@@ -165,6 +271,13 @@ headless_output_disable(struct weston_output *base)
 		return 0;
 
 	wl_event_source_remove(output->finish_frame_timer);
+	if (output->finish_frame_idle) {
+		wl_event_source_remove(output->finish_frame_idle);
+		output->finish_frame_idle = NULL;
+	}
+
+	if (b->benchmark)
+		headless_output_print_stats(output);
 
 	switch (b->renderer_type) {
 	case HEADLESS_GL:
@@ -284,6 +397,7 @@ headless_output_set_size(struct weston_output *base,
 			 int width, int height)
 {
 	struct headless_output *output = to_headless_output(base);
+	struct headless_backend *b = to_headless_backend(base->compositor);
 	struct weston_head *head;
 	int output_width, output_height;
 
@@ -308,7 +422,8 @@ headless_output_set_size(struct weston_output *base,
 		WL_OUTPUT_MODE_CURRENT | WL_OUTPUT_MODE_PREFERRED;
 	output->mode.width = output_width;
 	output->mode.height = output_height;
-	output->mode.refresh = 60000;
+	output->mode.refresh = b->refresh ? b->refresh :
+					    HEADLESS_FLAT_OUT_REFRESH;
 	wl_list_insert(&output->base.mode_list, &output->mode.link);
 
 	output->base.current_mode = &output->mode;
@@ -442,6 +557,11 @@ headless_backend_create(struct weston_compositor *compositor,
 		goto err_free;
 	}
 
+	b->benchmark = config->benchmark;
+	b->refresh = config->refresh;
+	if (b->refresh == 0 && !b->benchmark)
+		b->refresh = 60000;
+
 	if (config->use_gl)
 		b->renderer_type = HEADLESS_GL;
 	else if (config->use_pixman)
@@ -30,6 +30,9 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
 #include <linux/input.h>
 
 #include <freerdp/version.h>
@@ -40,22 +43,96 @@
 #include <freerdp/codec/color.h>
 #include <freerdp/codec/rfx.h>
 #include <freerdp/codec/nsc.h>
+#include <freerdp/codec/h264.h>
+#include <freerdp/channels/wtsvc.h>
+#include <freerdp/server/rdpgfx.h>
 #include <freerdp/locale/keyboard.h>
 #include <winpr/input.h>
 #include <winpr/ssl.h>
+#include <winpr/synch.h>
+#include <winpr/sysinfo.h>
 
 #include "shared/helpers.h"
 #include "shared/timespec-util.h"
 #include <libweston/libweston.h>
 #include <libweston/backend-rdp.h>
 #include "pixman-renderer.h"
+#include "renderer-gl/gl-renderer.h"
+#include "shared/weston-drm-fourcc.h"
+#include "shared/weston-egl-ext.h"
 
 #define MAX_FREERDP_FDS 32
 #define DEFAULT_AXIS_STEP_DISTANCE 10
 #define RDP_MODE_FREQ 60 * 1000
 #define DEFAULT_PIXEL_FORMAT PIXEL_FORMAT_BGRA32
+#define RDP_TILE_SIZE 64
+#define RDP_MAX_ENCODER_THREADS 4
+#define RDP_MAX_READBACK_RECTS 16
+/* frames sent on the graphics pipeline but not acknowledged yet */
+#define RDP_GFX_MAX_FRAMES_IN_FLIGHT 2
+/* MS-RDPEGFX 2.2.2.3, the client stopped sending acknowledgements */
+#define RDP_GFX_SUSPEND_FRAME_ACK 0xffffffff
+#define RDP_GFX_SURFACE_ID 1
+#define RDP_GFX_H264_BITRATE (10 * 1000 * 1000)
+#define RDP_GFX_H264_QP 22
+
+static const uint32_t rdp_formats[] = {
+	DRM_FORMAT_XRGB8888,
+	DRM_FORMAT_ARGB8888,
+};
 
 struct rdp_output;
+struct rdp_peer_context;
+
+enum rdp_encode_job_state {
+	RDP_ENCODE_JOB_QUEUED,
+	RDP_ENCODE_JOB_RUNNING,
+	RDP_ENCODE_JOB_DONE,
+};
+
+struct rdp_encode_job {
+	struct rdp_peer_context *context;
+	pixman_region32_t region;
+	pixman_image_t *image;
+	SURFACE_BITS_COMMAND cmd;
+
+	/* AVC420 frame for the graphics pipeline, instead of cmd */
+	bool gfx;
+	bool gfx_encoded;
+	RDPGFX_SURFACE_COMMAND gfx_cmd;
+	RDPGFX_AVC420_BITMAP_STREAM avc420;
+
+	enum rdp_encode_job_state state;
+	struct wl_list link;
+};
+
+/* Worker threads shared by all peers, running the RemoteFX, NSCodec and
+ * H.264 encoders. Peers send the encoded frames from the main thread. */
+struct rdp_encoder {
+	pthread_t threads[RDP_MAX_ENCODER_THREADS];
+	int n_threads;
+	pthread_mutex_t mutex;
+	pthread_cond_t job_cond;
+	pthread_cond_t done_cond;
+	bool quit;
+	/* struct rdp_encode_job::link */
+	struct wl_list queue;
+	struct wl_list done;
+
+	int done_fd;
+	struct wl_event_source *done_source;
+	/* jobs submitted but not sent yet, only touched by the main thread */
+	int n_pending;
+};
+
+/* Hashes of the output content in RDP_TILE_SIZE tiles, so that damage
+ * which did not change any pixels is not encoded again. */
+struct rdp_tile_cache {
+	int width;
+	int height;
+	uint64_t *hashes;
+	bool *valid;
+};
 
 struct rdp_backend {
 	struct weston_backend base;
@@ -71,6 +148,10 @@ struct rdp_backend {
 	int tls_enabled;
 	int no_clients_resize;
 	int force_no_compression;
+	bool use_gl;
+
+	struct gl_renderer_interface *glri;
+	struct rdp_encoder encoder;
 };
 
 enum peer_item_flags {
@@ -93,11 +174,23 @@ struct rdp_head {
 struct rdp_output {
 	struct weston_output base;
 	struct wl_event_source *finish_frame_timer;
+	bool finish_frame_pending;
 	pixman_image_t *shadow_surface;
+	struct rdp_tile_cache tiles;
+
+	/* With the GL renderer the shadow surface is filled by reading
+	 * back the damage, which the peers get once all reads are done. */
+	pixman_region32_t readback_damage;
+	int readback_pending;
 
 	struct wl_list peers;
 };
 
+struct rdp_readback {
+	struct rdp_output *output;
+	pixman_box32_t box;
+};
+
 struct rdp_peer_context {
 	rdpContext _p;
 
@@ -108,6 +201,28 @@ struct rdp_peer_context {
 	RFX_RECT *rfx_rects;
 	NSC_CONTEXT *nsc_context;
 
+	HANDLE vcm;
+	struct wl_event_source *vcm_event;
+
+	/* Graphics pipeline (RDPGFX) channel, used instead of surface bits
+	 * once the client confirmed it can decode AVC420. Frames are paced
+	 * by the client's acknowledgements. */
+	struct {
+		bool checked;
+		bool ready;
+		RdpgfxServerContext *context;
+		struct wl_event_source *event;
+		H264_CONTEXT *h264;
+		UINT32 frame_id;
+		UINT32 frames_in_flight;
+		bool acks_suspended;
+	} gfx;
+
+	/* the peer has at most one frame in the encoder at a time, and
+	 * collects damage meanwhile */
+	struct rdp_encode_job *job;
+	pixman_region32_t deferred_damage;
+
 	struct rdp_peers_item item;
 };
 typedef struct rdp_peer_context RdpPeerContext;
@@ -131,14 +246,13 @@ to_rdp_backend(struct weston_compositor *base)
 }
 
 static void
-rdp_peer_refresh_rfx(pixman_region32_t *damage, pixman_image_t *image, freerdp_peer *peer)
+rdp_peer_encode_rfx(pixman_region32_t *damage, pixman_image_t *image,
+		    freerdp_peer *peer, SURFACE_BITS_COMMAND *cmd)
 {
 	int width, height, nrects, i;
 	pixman_box32_t *region, *rects;
 	uint32_t *ptr;
 	RFX_RECT *rfxRect;
-	rdpUpdate *update = peer->update;
-	SURFACE_BITS_COMMAND cmd = { 0 };
 	RdpPeerContext *context = (RdpPeerContext *)peer->context;
 
 	Stream_Clear(context->encode_stream);
@@ -147,16 +261,16 @@ rdp_peer_refresh_rfx(pixman_region32_t *damage, pixman_image_t *image, freerdp_p
 	width = (damage->extents.x2 - damage->extents.x1);
 	height = (damage->extents.y2 - damage->extents.y1);
 
-	cmd.skipCompression = TRUE;
-	cmd.cmdType = CMDTYPE_STREAM_SURFACE_BITS;
-	cmd.destLeft = damage->extents.x1;
-	cmd.destTop = damage->extents.y1;
-	cmd.destRight = damage->extents.x2;
-	cmd.destBottom = damage->extents.y2;
-	cmd.bmp.bpp = 32;
-	cmd.bmp.codecID = peer->settings->RemoteFxCodecId;
-	cmd.bmp.width = width;
-	cmd.bmp.height = height;
+	cmd->skipCompression = TRUE;
+	cmd->cmdType = CMDTYPE_STREAM_SURFACE_BITS;
+	cmd->destLeft = damage->extents.x1;
+	cmd->destTop = damage->extents.y1;
+	cmd->destRight = damage->extents.x2;
+	cmd->destBottom = damage->extents.y2;
+	cmd->bmp.bpp = 32;
+	cmd->bmp.codecID = peer->settings->RemoteFxCodecId;
+	cmd->bmp.width = width;
+	cmd->bmp.height = height;
 
 	ptr = pixman_image_get_data(image) + damage->extents.x1 +
 				damage->extents.y1 * (pixman_image_get_stride(image) / sizeof(uint32_t));
@@ -179,20 +293,17 @@ rdp_peer_refresh_rfx(pixman_region32_t *damage, pixman_image_t *image, freerdp_p
 			pixman_image_get_stride(image)
 	);
 
-	cmd.bmp.bitmapDataLength = Stream_GetPosition(context->encode_stream);
-	cmd.bmp.bitmapData = Stream_Buffer(context->encode_stream);
-
-	update->SurfaceBits(update->context, &cmd);
+	cmd->bmp.bitmapDataLength = Stream_GetPosition(context->encode_stream);
+	cmd->bmp.bitmapData = Stream_Buffer(context->encode_stream);
 }
 
 
 static void
-rdp_peer_refresh_nsc(pixman_region32_t *damage, pixman_image_t *image, freerdp_peer *peer)
+rdp_peer_encode_nsc(pixman_region32_t *damage, pixman_image_t *image,
+		    freerdp_peer *peer, SURFACE_BITS_COMMAND *cmd)
 {
 	int width, height;
 	uint32_t *ptr;
-	rdpUpdate *update = peer->update;
-	SURFACE_BITS_COMMAND cmd = { 0 };
 	RdpPeerContext *context = (RdpPeerContext *)peer->context;
 
 	Stream_Clear(context->encode_stream);
@@ -201,16 +312,16 @@ rdp_peer_refresh_nsc(pixman_region32_t *damage, pixman_image_t *image, freerdp_p
 	width = (damage->extents.x2 - damage->extents.x1);
 	height = (damage->extents.y2 - damage->extents.y1);
 
-	cmd.cmdType = CMDTYPE_SET_SURFACE_BITS;
-	cmd.skipCompression = TRUE;
-	cmd.destLeft = damage->extents.x1;
-	cmd.destTop = damage->extents.y1;
-	cmd.destRight = damage->extents.x2;
-	cmd.destBottom = damage->extents.y2;
-	cmd.bmp.bpp = 32;
-	cmd.bmp.codecID = peer->settings->NSCodecId;
-	cmd.bmp.width = width;
-	cmd.bmp.height = height;
+	cmd->cmdType = CMDTYPE_SET_SURFACE_BITS;
+	cmd->skipCompression = TRUE;
+	cmd->destLeft = damage->extents.x1;
+	cmd->destTop = damage->extents.y1;
+	cmd->destRight = damage->extents.x2;
+	cmd->destBottom = damage->extents.y2;
+	cmd->bmp.bpp = 32;
+	cmd->bmp.codecID = peer->settings->NSCodecId;
+	cmd->bmp.width = width;
+	cmd->bmp.height = height;
 
 	ptr = pixman_image_get_data(image) + damage->extents.x1 +
 				damage->extents.y1 * (pixman_image_get_stride(image) / sizeof(uint32_t));
@@ -219,10 +330,67 @@ rdp_peer_refresh_nsc(pixman_region32_t *damage, pixman_image_t *image, freerdp_p
 			width, height,
 			pixman_image_get_stride(image));
 
-	cmd.bmp.bitmapDataLength = Stream_GetPosition(context->encode_stream);
-	cmd.bmp.bitmapData = Stream_Buffer(context->encode_stream);
+	cmd->bmp.bitmapDataLength = Stream_GetPosition(context->encode_stream);
+	cmd->bmp.bitmapData = Stream_Buffer(context->encode_stream);
+}
+
+/* The encoder always takes the whole output, the damage rectangles only
+ * tell the client which parts of the decoded frame to update. */
+static void
+rdp_peer_encode_avc420(struct rdp_encode_job *job)
+{
+	RdpPeerContext *context = job->context;
+	pixman_image_t *image = job->image;
+	RDPGFX_SURFACE_COMMAND *cmd = &job->gfx_cmd;
+	RDPGFX_H264_METABLOCK *meta = &job->avc420.meta;
+	int width = pixman_image_get_width(image);
+	int height = pixman_image_get_height(image);
+	pixman_box32_t *rects;
+	BYTE *data = NULL;
+	UINT32 size = 0;
+	int nrects, i;
+
+	if (avc420_compress(context->gfx.h264,
+			    (const BYTE *)pixman_image_get_data(image),
+			    DEFAULT_PIXEL_FORMAT,
+			    pixman_image_get_stride(image),
+			    width, height, &data, &size) < 0 || !data)
+		return;
+
+	rects = pixman_region32_rectangles(&job->region, &nrects);
+	meta->regionRects = calloc(nrects, sizeof *meta->regionRects);
+	meta->quantQualityVals = calloc(nrects, sizeof *meta->quantQualityVals);
+	if (!meta->regionRects || !meta->quantQualityVals)
+		return;
+
+	meta->numRegionRects = nrects;
+	for (i = 0; i < nrects; i++) {
+		meta->regionRects[i].left = rects[i].x1;
+		meta->regionRects[i].top = rects[i].y1;
+		meta->regionRects[i].right = rects[i].x2;
+		meta->regionRects[i].bottom = rects[i].y2;
+		meta->quantQualityVals[i].qp = RDP_GFX_H264_QP;
+		meta->quantQualityVals[i].qpVal = RDP_GFX_H264_QP;
+		meta->quantQualityVals[i].qualityVal = 100;
+	}
 
-	update->SurfaceBits(update->context, &cmd);
+	job->avc420.data = data;
+	job->avc420.length = size;
+
+	cmd->surfaceId = RDP_GFX_SURFACE_ID;
+	cmd->codecId = RDPGFX_CODECID_AVC420;
+	cmd->format = PIXEL_FORMAT_BGRX32;
+	cmd->left = 0;
+	cmd->top = 0;
+	cmd->right = width;
+	cmd->bottom = height;
+	cmd->width = width;
+	cmd->height = height;
+	cmd->data = data;
+	cmd->length = size;
+	cmd->extra = &job->avc420;
+
+	job->gfx_encoded = true;
 }
 
 static void
@@ -299,21 +467,435 @@ rdp_peer_refresh_raw(pixman_region32_t *region, pixman_image_t *image, freerdp_p
 	update->SurfaceFrameMarker(peer->context, &marker);
 }
 
+static void
+rdp_peer_refresh_region(pixman_region32_t *region, freerdp_peer *peer);
+
+static void
+rdp_output_maybe_finish_frame(struct rdp_output *output);
+
+/* Called from the encoder threads */
+static void
+rdp_encode_job_run(struct rdp_encode_job *job)
+{
+	freerdp_peer *peer = job->context->item.peer;
+
+	if (job->gfx)
+		rdp_peer_encode_avc420(job);
+	else if (peer->settings->RemoteFxCodec)
+		rdp_peer_encode_rfx(&job->region, job->image, peer, &job->cmd);
+	else
+		rdp_peer_encode_nsc(&job->region, job->image, peer, &job->cmd);
+}
+
+static bool
+rdp_peer_gfx_throttled(RdpPeerContext *context)
+{
+	return context->gfx.ready && !context->gfx.acks_suspended &&
+	       context->gfx.frames_in_flight >= RDP_GFX_MAX_FRAMES_IN_FLIGHT;
+}
+
+static void
+rdp_peer_flush_deferred_damage(RdpPeerContext *context)
+{
+	pixman_region32_t deferred;
+
+	if (context->job || rdp_peer_gfx_throttled(context) ||
+	    !pixman_region32_not_empty(&context->deferred_damage))
+		return;
+
+	pixman_region32_init(&deferred);
+	pixman_region32_copy(&deferred, &context->deferred_damage);
+	pixman_region32_clear(&context->deferred_damage);
+	rdp_peer_refresh_region(&deferred, context->item.peer);
+	pixman_region32_fini(&deferred);
+}
+
+static UINT32
+rdp_gfx_timestamp(void)
+{
+	SYSTEMTIME st;
+
+	/* MS-RDPEGFX 2.2.2.11 */
+	GetLocalTime(&st);
+	return (st.wHour << 22) | (st.wMinute << 16) |
+	       (st.wSecond << 10) | st.wMilliseconds;
+}
+
+static void
+rdp_peer_gfx_send_frame(RdpPeerContext *context, struct rdp_encode_job *job)
+{
+	RdpgfxServerContext *gfx = context->gfx.context;
+	RDPGFX_START_FRAME_PDU start = { 0 };
+	RDPGFX_END_FRAME_PDU end = { 0 };
+
+	/* the channel went away while the frame was being encoded */
+	if (!context->gfx.ready)
+		return;
+
+	if (!job->gfx_encoded) {
+		weston_log("failed to encode an AVC420 frame\n");
+		return;
+	}
+
+	start.frameId = ++context->gfx.frame_id;
+	start.timestamp = rdp_gfx_timestamp();
+	end.frameId = start.frameId;
+
+	gfx->StartFrame(gfx, &start);
+	gfx->SurfaceCommand(gfx, &job->gfx_cmd);
+	gfx->EndFrame(gfx, &end);
+
+	context->gfx.frames_in_flight++;
+}
+
+static void
+rdp_encode_job_finish(struct rdp_backend *b, struct rdp_encode_job *job,
+		      bool send)
+{
+	RdpPeerContext *context = job->context;
+	freerdp_peer *peer = context->item.peer;
+	struct rdp_output *output = b->output;
+
+	wl_list_remove(&job->link);
+	context->job = NULL;
+	b->encoder.n_pending--;
+
+	if (send && job->gfx)
+		rdp_peer_gfx_send_frame(context, job);
+	else if (send)
+		peer->update->SurfaceBits(peer->context, &job->cmd);
+
+	pixman_region32_fini(&job->region);
+	pixman_image_unref(job->image);
+	free(job->avc420.meta.regionRects);
+	free(job->avc420.meta.quantQualityVals);
+	free(job);
+
+	if (send)
+		rdp_peer_flush_deferred_damage(context);
+
+	if (output)
+		rdp_output_maybe_finish_frame(output);
+}
+
+static void
+rdp_encoder_submit(struct rdp_backend *b, RdpPeerContext *context,
+		   pixman_region32_t *region, pixman_image_t *image)
+{
+	struct rdp_encoder *encoder = &b->encoder;
+	struct rdp_encode_job *job;
+
+	if (context->job || rdp_peer_gfx_throttled(context)) {
+		pixman_region32_union(&context->deferred_damage,
+				      &context->deferred_damage, region);
+		return;
+	}
+
+	job = zalloc(sizeof *job);
+	if (!job) {
+		weston_log("failed to allocate an RDP encoder job\n");
+		return;
+	}
+
+	job->context = context;
+	job->gfx = context->gfx.ready;
+	pixman_region32_init(&job->region);
+	pixman_region32_copy(&job->region, region);
+	job->image = pixman_image_ref(image);
+
+	context->job = job;
+	encoder->n_pending++;
+
+	if (encoder->n_threads == 0) {
+		rdp_encode_job_run(job);
+		wl_list_init(&job->link);
+		rdp_encode_job_finish(b, job, true);
+		return;
+	}
+
+	pthread_mutex_lock(&encoder->mutex);
+	job->state = RDP_ENCODE_JOB_QUEUED;
+	wl_list_insert(encoder->queue.prev, &job->link);
+	pthread_cond_signal(&encoder->job_cond);
+	pthread_mutex_unlock(&encoder->mutex);
+}
+
+/* Drops the peer's job, waiting for it if a worker is encoding it. */
+static void
+rdp_encoder_cancel(struct rdp_backend *b, RdpPeerContext *context)
+{
+	struct rdp_encoder *encoder = &b->encoder;
+	struct rdp_encode_job *job = context->job;
+
+	if (!job)
+		return;
+
+	if (encoder->n_threads > 0) {
+		pthread_mutex_lock(&encoder->mutex);
+		while (job->state == RDP_ENCODE_JOB_RUNNING)
+			pthread_cond_wait(&encoder->done_cond, &encoder->mutex);
+		/* unlinked from either the queue or the done list */
+		wl_list_remove(&job->link);
+		wl_list_init(&job->link);
+		pthread_mutex_unlock(&encoder->mutex);
+	}
+
+	rdp_encode_job_finish(b, job, false);
+}
+
+static void *
+rdp_encoder_thread_function(void *data)
+{
+	struct rdp_encoder *encoder = data;
+	struct rdp_encode_job *job;
+	uint64_t one = 1;
+
+	pthread_mutex_lock(&encoder->mutex);
+	while (!encoder->quit) {
+		if (wl_list_empty(&encoder->queue)) {
+			pthread_cond_wait(&encoder->job_cond, &encoder->mutex);
+			continue;
+		}
+
+		job = container_of(encoder->queue.next,
+				   struct rdp_encode_job, link);
+		wl_list_remove(&job->link);
+		job->state = RDP_ENCODE_JOB_RUNNING;
+		pthread_mutex_unlock(&encoder->mutex);
+
+		rdp_encode_job_run(job);
+
+		pthread_mutex_lock(&encoder->mutex);
+		job->state = RDP_ENCODE_JOB_DONE;
+		wl_list_insert(encoder->done.prev, &job->link);
+		pthread_cond_broadcast(&encoder->done_cond);
+
+		if (write(encoder->done_fd, &one, sizeof one) != sizeof one)
+			weston_log("failed to signal RDP encoder completion\n");
+	}
+	pthread_mutex_unlock(&encoder->mutex);
+
+	return NULL;
+}
+
+static int
+rdp_encoder_done_handler(int fd, uint32_t mask, void *data)
+{
+	struct rdp_backend *b = data;
+	struct rdp_encoder *encoder = &b->encoder;
+	struct rdp_encode_job *job;
+	uint64_t count;
+
+	if (read(fd, &count, sizeof count) != sizeof count)
+		return 0;
+
+	pthread_mutex_lock(&encoder->mutex);
+	while (!wl_list_empty(&encoder->done)) {
+		job = container_of(encoder->done.next,
+				   struct rdp_encode_job, link);
+		wl_list_remove(&job->link);
+		wl_list_init(&job->link);
+
+		/* Sending may queue the deferred damage of the peer. */
+		pthread_mutex_unlock(&encoder->mutex);
+		rdp_encode_job_finish(b, job, true);
+		pthread_mutex_lock(&encoder->mutex);
+	}
+	pthread_mutex_unlock(&encoder->mutex);
+
+	return 0;
+}
+
+static int
+rdp_encoder_init(struct rdp_backend *b)
+{
+	struct rdp_encoder *encoder = &b->encoder;
+	struct wl_event_loop *loop;
+	long n_cpus;
+	int i;
+
+	wl_list_init(&encoder->queue);
+	wl_list_init(&encoder->done);
+
+	encoder->done_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (encoder->done_fd < 0)
+		return -1;
+
+	loop = wl_display_get_event_loop(b->compositor->wl_display);
+	encoder->done_source = wl_event_loop_add_fd(loop, encoder->done_fd,
+						    WL_EVENT_READABLE,
+						    rdp_encoder_done_handler,
+						    b);
+	if (!encoder->done_source) {
+		close(encoder->done_fd);
+		return -1;
+	}
+
+	pthread_mutex_init(&encoder->mutex, NULL);
+	pthread_cond_init(&encoder->job_cond, NULL);
+	pthread_cond_init(&encoder->done_cond, NULL);
+
+	/* Without threads, frames are encoded on the main thread. */
+	n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	for (i = 0; i < MIN(n_cpus, RDP_MAX_ENCODER_THREADS); i++) {
+		if (pthread_create(&encoder->threads[i], NULL,
+				   rdp_encoder_thread_function, encoder) != 0)
+			break;
+		encoder->n_threads++;
+	}
+
+	weston_log("RDP encoder using %d threads\n", encoder->n_threads);
+
+	return 0;
+}
+
+static void
+rdp_encoder_destroy(struct rdp_backend *b)
+{
+	struct rdp_encoder *encoder = &b->encoder;
+	int i;
+
+	pthread_mutex_lock(&encoder->mutex);
+	encoder->quit = true;
+	pthread_cond_broadcast(&encoder->job_cond);
+	pthread_mutex_unlock(&encoder->mutex);
+
+	for (i = 0; i < encoder->n_threads; i++)
+		pthread_join(encoder->threads[i], NULL);
+
+	pthread_mutex_destroy(&encoder->mutex);
+	pthread_cond_destroy(&encoder->job_cond);
+	pthread_cond_destroy(&encoder->done_cond);
+
+	wl_event_source_remove(encoder->done_source);
+	close(encoder->done_fd);
+}
+
 static void
 rdp_peer_refresh_region(pixman_region32_t *region, freerdp_peer *peer)
 {
 	RdpPeerContext *context = (RdpPeerContext *)peer->context;
-	struct rdp_output *output = context->rdpBackend->output;
+	struct rdp_backend *b = context->rdpBackend;
+	struct rdp_output *output = b->output;
 	rdpSettings *settings = peer->settings;
 
-	if (settings->RemoteFxCodec)
-		rdp_peer_refresh_rfx(region, output->shadow_surface, peer);
-	else if (settings->NSCodec)
-		rdp_peer_refresh_nsc(region, output->shadow_surface, peer);
+	if (!output)
+		return;
+
+	if (context->gfx.ready || settings->RemoteFxCodec || settings->NSCodec)
+		rdp_encoder_submit(b, context, region, output->shadow_surface);
 	else
 		rdp_peer_refresh_raw(region, output->shadow_surface, peer);
 }
 
+static void
+rdp_tile_cache_fini(struct rdp_tile_cache *cache)
+{
+	free(cache->hashes);
+	free(cache->valid);
+	cache->hashes = NULL;
+	cache->valid = NULL;
+	cache->width = 0;
+	cache->height = 0;
+}
+
+static int
+rdp_tile_cache_init(struct rdp_tile_cache *cache, int width, int height)
+{
+	int n_tiles;
+
+	rdp_tile_cache_fini(cache);
+
+	cache->width = (width + RDP_TILE_SIZE - 1) / RDP_TILE_SIZE;
+	cache->height = (height + RDP_TILE_SIZE - 1) / RDP_TILE_SIZE;
+	n_tiles = cache->width * cache->height;
+
+	cache->hashes = calloc(n_tiles, sizeof *cache->hashes);
+	cache->valid = calloc(n_tiles, sizeof *cache->valid);
+	if (!cache->hashes || !cache->valid) {
+		rdp_tile_cache_fini(cache);
+		return -1;
+	}
+
+	return 0;
+}
+
+static uint64_t
+rdp_tile_hash(pixman_image_t *image, const pixman_box32_t *box)
+{
+	const uint32_t *data = pixman_image_get_data(image);
+	int stride = pixman_image_get_stride(image) / sizeof(uint32_t);
+	const uint32_t *row;
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	int x, y;
+
+	/* FNV-1a over the pixels of the tile */
+	for (y = box->y1; y < box->y2; y++) {
+		row = data + y * stride;
+		for (x = box->x1; x < box->x2; x++)
+			hash = (hash ^ row[x]) * 0x100000001b3ULL;
+	}
+
+	return hash;
+}
+
+/* Re-hashes the tiles touched by damage, and puts the part of damage
+ * covering tiles whose content changed into changed. A cache that
+ * could not be allocated lets all damage through. */
+static void
+rdp_tile_cache_update(struct rdp_tile_cache *cache, pixman_image_t *image,
+		      pixman_region32_t *damage, pixman_region32_t *changed)
+{
+	pixman_box32_t *extents = pixman_region32_extents(damage);
+	int image_width = pixman_image_get_width(image);
+	int image_height = pixman_image_get_height(image);
+	int tx, ty, tx1, ty1, tx2, ty2;
+	pixman_box32_t tile;
+	uint64_t hash;
+	int i;
+
+	if (!cache->hashes) {
+		pixman_region32_copy(changed, damage);
+		return;
+	}
+
+	tx1 = MAX(extents->x1, 0) / RDP_TILE_SIZE;
+	ty1 = MAX(extents->y1, 0) / RDP_TILE_SIZE;
+	tx2 = MIN((extents->x2 + RDP_TILE_SIZE - 1) / RDP_TILE_SIZE,
+		  cache->width);
+	ty2 = MIN((extents->y2 + RDP_TILE_SIZE - 1) / RDP_TILE_SIZE,
+		  cache->height);
+
+	pixman_region32_clear(changed);
+
+	for (ty = ty1; ty < ty2; ty++) {
+		for (tx = tx1; tx < tx2; tx++) {
+			tile.x1 = tx * RDP_TILE_SIZE;
+			tile.y1 = ty * RDP_TILE_SIZE;
+			tile.x2 = MIN(tile.x1 + RDP_TILE_SIZE, image_width);
+			tile.y2 = MIN(tile.y1 + RDP_TILE_SIZE, image_height);
+
+			if (pixman_region32_contains_rectangle(damage, &tile) ==
+			    PIXMAN_REGION_OUT)
+				continue;
+
+			i = ty * cache->width + tx;
+			hash = rdp_tile_hash(image, &tile);
+			if (cache->valid[i] && cache->hashes[i] == hash)
+				continue;
+
+			cache->hashes[i] = hash;
+			cache->valid[i] = true;
+			pixman_region32_union_rect(changed, changed,
+						   tile.x1, tile.y1,
+						   tile.x2 - tile.x1,
+						   tile.y2 - tile.y1);
+		}
+	}
+
+	pixman_region32_intersect(changed, changed, damage);
+}
+
 static int
 rdp_output_start_repaint_loop(struct weston_output *output)
 {
@@ -325,26 +907,170 @@ rdp_output_start_repaint_loop(struct weston_output *output)
 	return 0;
 }
 
-static int
-rdp_output_repaint(struct weston_output *output_base, pixman_region32_t *damage,
-		   void *repaint_data)
+static void
+rdp_output_send_damage(struct rdp_output *output, pixman_region32_t *damage)
 {
-	struct rdp_output *output = container_of(output_base, struct rdp_output, base);
-	struct weston_compositor *ec = output->base.compositor;
 	struct rdp_peers_item *outputPeer;
+	pixman_region32_t changed;
 
-	pixman_renderer_output_set_buffer(output_base, output->shadow_surface);
-	ec->renderer->repaint_output(&output->base, damage);
+	pixman_region32_init(&changed);
+	if (pixman_region32_not_empty(damage))
+		rdp_tile_cache_update(&output->tiles, output->shadow_surface,
+				      damage, &changed);
 
-	if (pixman_region32_not_empty(damage)) {
+	if (pixman_region32_not_empty(&changed)) {
 		wl_list_for_each(outputPeer, &output->peers, link) {
 			if ((outputPeer->flags & RDP_PEER_ACTIVATED) &&
 					(outputPeer->flags & RDP_PEER_OUTPUT_ENABLED))
 			{
-				rdp_peer_refresh_region(damage, outputPeer->peer);
+				rdp_peer_refresh_region(&changed, outputPeer->peer);
 			}
 		}
 	}
+	pixman_region32_fini(&changed);
+}
+
+/* GL rows come bottom-up, and in RGBA order if the renderer cannot read
+ * BGRA; the shadow surface is top-down x8r8g8b8. */
+static void
+rdp_output_copy_readback(struct rdp_output *output, const pixman_box32_t *box,
+			 pixman_format_code_t format, const void *pixels)
+{
+	int width = box->x2 - box->x1;
+	int height = box->y2 - box->y1;
+	int stride = pixman_image_get_stride(output->shadow_surface);
+	uint8_t *dst = (uint8_t *)pixman_image_get_data(output->shadow_surface);
+	const uint32_t *src;
+	uint32_t *row, p;
+	int i, j;
+
+	dst += box->y1 * stride + box->x1 * 4;
+	for (i = 0; i < height; i++) {
+		src = (const uint32_t *)pixels + (height - 1 - i) * width;
+		row = (uint32_t *)(dst + i * stride);
+
+		if (format == PIXMAN_a8r8g8b8) {
+			memcpy(row, src, width * 4);
+			continue;
+		}
+
+		for (j = 0; j < width; j++) {
+			p = src[j];
+			row[j] = (p & 0xff00ff00) |
+				 ((p & 0x00ff0000) >> 16) |
+				 ((p & 0x000000ff) << 16);
+		}
+	}
+}
+
+static void
+rdp_output_readback_complete(struct rdp_output *output)
+{
+	rdp_output_send_damage(output, &output->readback_damage);
+	pixman_region32_clear(&output->readback_damage);
+
+	rdp_output_maybe_finish_frame(output);
+}
+
+static void
+rdp_readback_done(void *data, const void *pixels)
+{
+	struct rdp_readback *rb = data;
+	struct rdp_output *output = rb->output;
+	struct weston_compositor *ec = output->base.compositor;
+
+	if (pixels)
+		rdp_output_copy_readback(output, &rb->box, ec->read_format,
+					 pixels);
+	free(rb);
+
+	/* Cancelled reads come from the renderer output going away, there
+	 * is nothing to send then. */
+	if (--output->readback_pending == 0 && pixels)
+		rdp_output_readback_complete(output);
+}
+
+static void
+rdp_output_readback_box(struct rdp_output *output, const pixman_box32_t *box)
+{
+	struct weston_compositor *ec = output->base.compositor;
+	struct weston_renderer *renderer = ec->renderer;
+	int width = box->x2 - box->x1;
+	int height = box->y2 - box->y1;
+	/* glReadPixels counts rows from the bottom */
+	int y = output->base.current_mode->height - box->y2;
+	struct rdp_readback *rb;
+	void *pixels;
+
+	rb = zalloc(sizeof *rb);
+	if (rb) {
+		rb->output = output;
+		rb->box = *box;
+		if (renderer->read_pixels_async &&
+		    renderer->read_pixels_async(&output->base, ec->read_format,
+						box->x1, y, width, height,
+						rdp_readback_done, rb) == 0) {
+			output->readback_pending++;
+			return;
+		}
+		free(rb);
+	}
+
+	pixels = malloc(width * height * 4);
+	if (!pixels) {
+		weston_log("failed to allocate the RDP readback buffer\n");
+		return;
+	}
+
+	if (renderer->read_pixels(&output->base, ec->read_format, pixels,
+				  box->x1, y, width, height) == 0)
+		rdp_output_copy_readback(output, box, ec->read_format, pixels);
+	free(pixels);
+}
+
+static void
+rdp_output_readback(struct rdp_output *output, pixman_region32_t *damage)
+{
+	struct weston_mode *mode = output->base.current_mode;
+	pixman_box32_t *rects, extents;
+	int nrects, i;
+
+	pixman_region32_intersect_rect(&output->readback_damage, damage,
+				       0, 0, mode->width, mode->height);
+
+	/* Reading the few pixels in between is cheaper than many small
+	 * reads, and the pbuffer holds the whole frame anyway. */
+	rects = pixman_region32_rectangles(&output->readback_damage, &nrects);
+	if (nrects > RDP_MAX_READBACK_RECTS) {
+		extents = *pixman_region32_extents(&output->readback_damage);
+		pixman_region32_reset(&output->readback_damage, &extents);
+		rects = pixman_region32_rectangles(&output->readback_damage,
+						   &nrects);
+	}
+
+	for (i = 0; i < nrects; i++)
+		rdp_output_readback_box(output, &rects[i]);
+
+	if (output->readback_pending == 0)
+		rdp_output_readback_complete(output);
+}
+
+static int
+rdp_output_repaint(struct weston_output *output_base, pixman_region32_t *damage,
+		   void *repaint_data)
+{
+	struct rdp_output *output = container_of(output_base, struct rdp_output, base);
+	struct weston_compositor *ec = output->base.compositor;
+	struct rdp_backend *b = to_rdp_backend(ec);
+
+	if (!b->use_gl)
+		pixman_renderer_output_set_buffer(output_base, output->shadow_surface);
+	ec->renderer->repaint_output(&output->base, damage);
+
+	if (b->use_gl)
+		rdp_output_readback(output, damage);
+	else
+		rdp_output_send_damage(output, damage);
 
 	pixman_region32_subtract(&ec->primary_plane.damage,
 				 &ec->primary_plane.damage, damage);
@@ -353,14 +1079,42 @@ rdp_output_repaint(struct weston_output *output_base, pixman_region32_t *damage,
 	return 0;
 }
 
-static int
-finish_frame_handler(void *data)
+static void
+rdp_output_finish_frame(struct rdp_output *output)
 {
-	struct rdp_output *output = data;
 	struct timespec ts;
 
 	weston_compositor_read_presentation_clock(output->base.compositor, &ts);
 	weston_output_finish_frame(&output->base, &ts, 0);
+}
+
+static void
+rdp_output_maybe_finish_frame(struct rdp_output *output)
+{
+	struct rdp_backend *b = to_rdp_backend(output->base.compositor);
+
+	if (!output->finish_frame_pending || b->encoder.n_pending > 0 ||
+	    output->readback_pending > 0)
+		return;
+
+	output->finish_frame_pending = false;
+	rdp_output_finish_frame(output);
+}
+
+static int
+finish_frame_handler(void *data)
+{
+	struct rdp_output *output = data;
+	struct rdp_backend *b = to_rdp_backend(output->base.compositor);
+
+	/* The next frame would overwrite what the encoder still reads, or
+	 * what the GPU has not handed back yet. */
+	if (b->encoder.n_pending > 0 || output->readback_pending > 0) {
+		output->finish_frame_pending = true;
+		return 1;
+	}
+
+	rdp_output_finish_frame(output);
 
 	return 1;
 }
@@ -392,6 +1146,46 @@ ensure_matching_mode(struct weston_output *output, struct weston_mode *target)
 	return rdp_insert_new_mode(output, target->width, target->height, RDP_MODE_FREQ);
 }
 
+static int
+rdp_output_renderer_create(struct rdp_output *output)
+{
+	struct rdp_backend *b = to_rdp_backend(output->base.compositor);
+	const struct pixman_renderer_output_options pixman_options = {
+		.use_shadow = true,
+	};
+	const struct gl_renderer_pbuffer_options gl_options = {
+		.width = output->base.current_mode->width,
+		.height = output->base.current_mode->height,
+		.drm_formats = rdp_formats,
+		.drm_formats_count = ARRAY_LENGTH(rdp_formats),
+	};
+
+	if (!b->use_gl)
+		return pixman_renderer_output_create(&output->base,
+						     &pixman_options);
+
+	if (b->glri->output_pbuffer_create(&output->base, &gl_options) < 0) {
+		weston_log("failed to create gl renderer output state\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+static void
+rdp_output_renderer_destroy(struct rdp_output *output)
+{
+	struct rdp_backend *b = to_rdp_backend(output->base.compositor);
+
+	/* cancels the pending reads */
+	if (b->use_gl)
+		b->glri->output_destroy(&output->base);
+	else
+		pixman_renderer_output_destroy(&output->base);
+
+	pixman_region32_clear(&output->readback_damage);
+}
+
 static int
 rdp_switch_mode(struct weston_output *output, struct weston_mode *target_mode)
 {
@@ -400,7 +1194,6 @@ rdp_switch_mode(struct weston_output *output, struct weston_mode *target_mode)
 	rdpSettings *settings;
 	pixman_image_t *new_shadow_buffer;
 	struct weston_mode *local_mode;
-	const struct pixman_renderer_output_options options = { .use_shadow = true, };
 
 	local_mode = ensure_matching_mode(output, target_mode);
 	if (!local_mode) {
@@ -416,8 +1209,11 @@ rdp_switch_mode(struct weston_output *output, struct weston_mode *target_mode)
 	output->current_mode = local_mode;
 	output->current_mode->flags |= WL_OUTPUT_MODE_CURRENT;
 
-	pixman_renderer_output_destroy(output);
-	pixman_renderer_output_create(output, &options);
+	rdp_output_renderer_destroy(rdpOutput);
+	if (rdp_output_renderer_create(rdpOutput) < 0)
+		weston_log("failed to recreate the renderer output\n");
+	/* a frame waiting on cancelled reads can go now */
+	rdp_output_maybe_finish_frame(rdpOutput);
 
 	new_shadow_buffer = pixman_image_create_bits(PIXMAN_x8r8g8b8, target_mode->width,
 			target_mode->height, 0, target_mode->width * 4);
@@ -426,6 +1222,10 @@ rdp_switch_mode(struct weston_output *output, struct weston_mode *target_mode)
 	pixman_image_unref(rdpOutput->shadow_surface);
 	rdpOutput->shadow_surface = new_shadow_buffer;
 
+	if (rdp_tile_cache_init(&rdpOutput->tiles, target_mode->width,
+				target_mode->height) < 0)
+		weston_log("failed to allocate the RDP tile cache\n");
+
 	wl_list_for_each(rdpPeer, &rdpOutput->peers, link) {
 		settings = rdpPeer->peer->settings;
 		if (settings->DesktopWidth == (UINT32)target_mode->width &&
@@ -493,9 +1293,6 @@ rdp_output_enable(struct weston_output *base)
 	struct rdp_output *output = to_rdp_output(base);
 	struct rdp_backend *b = to_rdp_backend(base->compositor);
 	struct wl_event_loop *loop;
-	const struct pixman_renderer_output_options options = {
-		.use_shadow = true,
-	};
 
 	output->shadow_surface = pixman_image_create_bits(PIXMAN_x8r8g8b8,
 							  output->base.current_mode->width,
@@ -507,11 +1304,20 @@ rdp_output_enable(struct weston_output *base)
 		return -1;
 	}
 
-	if (pixman_renderer_output_create(&output->base, &options) < 0) {
+	pixman_region32_init(&output->readback_damage);
+	output->readback_pending = 0;
+
+	if (rdp_output_renderer_create(output) < 0) {
+		pixman_region32_fini(&output->readback_damage);
 		pixman_image_unref(output->shadow_surface);
 		return -1;
 	}
 
+	if (rdp_tile_cache_init(&output->tiles,
+				output->base.current_mode->width,
+				output->base.current_mode->height) < 0)
+		weston_log("failed to allocate the RDP tile cache\n");
+
 	loop = wl_display_get_event_loop(b->compositor->wl_display);
 	output->finish_frame_timer = wl_event_loop_add_timer(loop, finish_frame_handler, output);
 
@@ -529,10 +1335,13 @@ rdp_output_disable(struct weston_output *base)
 	if (!output->base.enabled)
 		return 0;
 
+	rdp_output_renderer_destroy(output);
+	pixman_region32_fini(&output->readback_damage);
 	pixman_image_unref(output->shadow_surface);
-	pixman_renderer_output_destroy(&output->base);
+	rdp_tile_cache_fini(&output->tiles);
 
 	wl_event_source_remove(output->finish_frame_timer);
+	output->finish_frame_pending = false;
 	b->output = NULL;
 
 	return 0;
@@ -613,6 +1422,8 @@ rdp_destroy(struct weston_compositor *ec)
 		if (b->listener_events[i])
 			wl_event_source_remove(b->listener_events[i]);
 
+	rdp_encoder_destroy(b);
+
 	weston_compositor_shutdown(ec);
 
 	wl_list_for_each_safe(base, next, &ec->head_list, compositor_link)
@@ -665,6 +1476,253 @@ int rdp_implant_listener(struct rdp_backend *b, freerdp_listener* instance)
 	return 0;
 }
 
+static void
+rdp_peer_refresh_full(freerdp_peer *peer)
+{
+	RdpPeerContext *context = (RdpPeerContext *)peer->context;
+	struct rdp_output *output = context->rdpBackend->output;
+	pixman_region32_t damage;
+
+	if (!output)
+		return;
+
+	pixman_region32_init_rect(&damage, 0, 0,
+				  output->base.width, output->base.height);
+	rdp_peer_refresh_region(&damage, peer);
+	pixman_region32_fini(&damage);
+}
+
+static void
+rdp_peer_gfx_close(RdpPeerContext *context)
+{
+	/* a worker may still be using the H.264 encoder */
+	rdp_encoder_cancel(context->rdpBackend, context);
+
+	if (context->gfx.event) {
+		wl_event_source_remove(context->gfx.event);
+		context->gfx.event = NULL;
+	}
+
+	if (context->gfx.context) {
+		context->gfx.context->Close(context->gfx.context);
+		rdpgfx_server_context_free(context->gfx.context);
+		context->gfx.context = NULL;
+	}
+
+	if (context->gfx.h264) {
+		h264_context_free(context->gfx.h264);
+		context->gfx.h264 = NULL;
+	}
+
+	context->gfx.ready = false;
+	context->gfx.frames_in_flight = 0;
+}
+
+/* (Re)creates the surface covering the output. The encoder must be
+ * idle, as its context is reset to the new size. */
+static bool
+rdp_peer_gfx_create_surface(RdpPeerContext *context, bool delete_old)
+{
+	RdpgfxServerContext *gfx = context->gfx.context;
+	struct weston_mode *mode = context->rdpBackend->output->base.current_mode;
+	RDPGFX_DELETE_SURFACE_PDU delete_surface = { 0 };
+	RDPGFX_RESET_GRAPHICS_PDU reset = { 0 };
+	RDPGFX_CREATE_SURFACE_PDU create = { 0 };
+	RDPGFX_MAP_SURFACE_TO_OUTPUT_PDU map = { 0 };
+	MONITOR_DEF monitor = { 0 };
+
+	if (!h264_context_reset(context->gfx.h264, mode->width, mode->height))
+		return false;
+
+	if (delete_old) {
+		delete_surface.surfaceId = RDP_GFX_SURFACE_ID;
+		if (gfx->DeleteSurface(gfx, &delete_surface) != CHANNEL_RC_OK)
+			return false;
+	}
+
+	monitor.right = mode->width - 1;
+	monitor.bottom = mode->height - 1;
+	monitor.flags = MONITOR_PRIMARY;
+
+	reset.width = mode->width;
+	reset.height = mode->height;
+	reset.monitorCount = 1;
+	reset.monitorDefArray = &monitor;
+
+	create.surfaceId = RDP_GFX_SURFACE_ID;
+	create.width = mode->width;
+	create.height = mode->height;
+	create.pixelFormat = GFX_PIXEL_FORMAT_XRGB_8888;
+
+	map.surfaceId = RDP_GFX_SURFACE_ID;
+
+	return gfx->ResetGraphics(gfx, &reset) == CHANNEL_RC_OK &&
+	       gfx->CreateSurface(gfx, &create) == CHANNEL_RC_OK &&
+	       gfx->MapSurfaceToOutput(gfx, &map) == CHANNEL_RC_OK;
+}
+
+static bool
+rdp_gfx_capset_has_avc420(const RDPGFX_CAPSET *capset)
+{
+	if (capset->version == RDPGFX_CAPVERSION_81)
+		return capset->flags & RDPGFX_CAPS_FLAG_AVC420_ENABLED;
+	if (capset->version >= RDPGFX_CAPVERSION_10)
+		return !(capset->flags & RDPGFX_CAPS_FLAG_AVC_DISABLED);
+
+	return false;
+}
+
+static UINT
+rdp_gfx_caps_advertise(RdpgfxServerContext *gfx,
+		       const RDPGFX_CAPS_ADVERTISE_PDU *advertise)
+{
+	RdpPeerContext *context = gfx->custom;
+	RDPGFX_CAPS_CONFIRM_PDU confirm = { 0 };
+	RDPGFX_CAPSET capset = { 0 };
+	const RDPGFX_CAPSET *best = NULL;
+	UINT16 i;
+
+	for (i = 0; i < advertise->capsSetCount; i++) {
+		if (!rdp_gfx_capset_has_avc420(&advertise->capsSets[i]))
+			continue;
+		if (!best || advertise->capsSets[i].version > best->version)
+			best = &advertise->capsSets[i];
+	}
+
+	/* Without AVC420 the pipeline has nothing over surface bits. */
+	if (!best) {
+		weston_log("RDP client cannot decode AVC420, not using the "
+			   "graphics pipeline\n");
+		return CHANNEL_RC_UNSUPPORTED_VERSION;
+	}
+
+	capset = *best;
+	confirm.capsSet = &capset;
+	if (gfx->CapsConfirm(gfx, &confirm) != CHANNEL_RC_OK ||
+	    !rdp_peer_gfx_create_surface(context, false)) {
+		weston_log("failed to set up the RDP graphics pipeline\n");
+		return ERROR_INTERNAL_ERROR;
+	}
+
+	weston_log("RDP graphics pipeline 0x%x using AVC420\n", capset.version);
+	context->gfx.ready = true;
+	rdp_peer_refresh_full(context->item.peer);
+
+	return CHANNEL_RC_OK;
+}
+
+static UINT
+rdp_gfx_frame_acknowledge(RdpgfxServerContext *gfx,
+			  const RDPGFX_FRAME_ACKNOWLEDGE_PDU *ack)
+{
+	RdpPeerContext *context = gfx->custom;
+	UINT32 in_flight = context->gfx.frame_id - ack->frameId;
+
+	context->gfx.acks_suspended =
+		ack->queueDepth == RDP_GFX_SUSPEND_FRAME_ACK;
+	context->gfx.frames_in_flight = MIN(context->gfx.frames_in_flight,
+					    in_flight);
+
+	rdp_peer_flush_deferred_damage(context);
+
+	return CHANNEL_RC_OK;
+}
+
+static int
+rdp_gfx_activity(int fd, uint32_t mask, void *data)
+{
+	RdpPeerContext *context = data;
+	bool was_ready;
+
+	if (rdpgfx_server_handle_messages(context->gfx.context) ==
+	    CHANNEL_RC_OK)
+		return 0;
+
+	/* back to surface bits, which need the whole output again */
+	was_ready = context->gfx.ready;
+	rdp_peer_gfx_close(context);
+	if (was_ready)
+		rdp_peer_refresh_full(context->item.peer);
+
+	return 0;
+}
+
+/* The graphics pipeline is a dynamic channel, so it can only be opened
+ * once the client has set up drdynvc, after the activation. */
+static void
+rdp_peer_gfx_maybe_open(RdpPeerContext *context)
+{
+	freerdp_peer *client = context->item.peer;
+	struct wl_event_loop *loop;
+	RdpgfxServerContext *gfx;
+	HANDLE handle;
+	int fd;
+
+	if (context->gfx.checked ||
+	    !(context->item.flags & RDP_PEER_ACTIVATED) ||
+	    !WTSVirtualChannelManagerIsChannelJoined(context->vcm, "drdynvc") ||
+	    WTSVirtualChannelManagerGetDrdynvcState(context->vcm) !=
+	    DRDYNVC_STATE_READY)
+		return;
+
+	context->gfx.checked = true;
+	if (!client->settings->SupportGraphicsPipeline ||
+	    !context->rdpBackend->output)
+		return;
+
+	context->gfx.h264 = h264_context_new(TRUE);
+	if (!context->gfx.h264) {
+		weston_log("no H.264 encoder, not using the RDP graphics "
+			   "pipeline\n");
+		return;
+	}
+
+	h264_context_set_option(context->gfx.h264,
+				H264_CONTEXT_OPTION_RATECONTROL,
+				H264_RATECONTROL_VBR);
+	h264_context_set_option(context->gfx.h264,
+				H264_CONTEXT_OPTION_BITRATE,
+				RDP_GFX_H264_BITRATE);
+	h264_context_set_option(context->gfx.h264,
+				H264_CONTEXT_OPTION_FRAMERATE,
+				RDP_MODE_FREQ / 1000);
+	h264_context_set_option(context->gfx.h264,
+				H264_CONTEXT_OPTION_QP, RDP_GFX_H264_QP);
+
+	gfx = rdpgfx_server_context_new(context->vcm);
+	if (!gfx) {
+		rdp_peer_gfx_close(context);
+		return;
+	}
+
+	gfx->custom = context;
+	gfx->rdpcontext = &context->_p;
+	gfx->CapsAdvertise = rdp_gfx_caps_advertise;
+	gfx->FrameAcknowledge = rdp_gfx_frame_acknowledge;
+
+	/* The messages are handled from the event loop, so the callbacks
+	 * run on the main thread like everything else of the peer. */
+	if (!rdpgfx_server_set_own_thread(gfx, FALSE) || !gfx->Open(gfx)) {
+		weston_log("failed to open the RDP graphics pipeline\n");
+		rdpgfx_server_context_free(gfx);
+		rdp_peer_gfx_close(context);
+		return;
+	}
+	context->gfx.context = gfx;
+
+	handle = rdpgfx_server_get_event_handle(gfx);
+	fd = handle ? GetEventFileDescriptor(handle) : -1;
+	if (fd < 0) {
+		rdp_peer_gfx_close(context);
+		return;
+	}
+
+	loop = wl_display_get_event_loop(context->rdpBackend->compositor->wl_display);
+	context->gfx.event = wl_event_loop_add_fd(loop, fd, WL_EVENT_READABLE,
+						  rdp_gfx_activity, context);
+	if (!context->gfx.event)
+		rdp_peer_gfx_close(context);
+}
 
 static BOOL
 rdp_peer_context_new(freerdp_peer* client, RdpPeerContext* context)
@@ -690,6 +1748,8 @@ rdp_peer_context_new(freerdp_peer* client, RdpPeerContext* context)
 	if (!context->encode_stream)
 		goto out_error_stream;
 
+	pixman_region32_init(&context->deferred_damage);
+
 	return TRUE;
 
 out_error_nsc:
@@ -712,6 +1772,16 @@ rdp_peer_context_free(freerdp_peer* client, RdpPeerContext* context)
 			wl_event_source_remove(context->events[i]);
 	}
 
+	/* A worker may still be using the codec contexts. */
+	rdp_encoder_cancel(context->rdpBackend, context);
+	pixman_region32_fini(&context->deferred_damage);
+
+	rdp_peer_gfx_close(context);
+	if (context->vcm_event)
+		wl_event_source_remove(context->vcm_event);
+	if (context->vcm)
+		WTSCloseServer(context->vcm);
+
 	if (context->item.flags & RDP_PEER_ACTIVATED) {
 		weston_seat_release_keyboard(context->item.seat);
 		weston_seat_release_pointer(context->item.seat);
@@ -730,11 +1800,21 @@ static int
 rdp_client_activity(int fd, uint32_t mask, void *data)
 {
 	freerdp_peer* client = (freerdp_peer *)data;
+	RdpPeerContext *peerCtx = (RdpPeerContext *)client->context;
 
 	if (!client->CheckFileDescriptor(client)) {
 		weston_log("unable to checkDescriptor for %p\n", client);
 		goto out_clean;
 	}
+
+	if (peerCtx->vcm) {
+		if (!WTSVirtualChannelManagerCheckFileDescriptor(peerCtx->vcm)) {
+			weston_log("unable to check the virtual channels of %p\n",
+				   client);
+			goto out_clean;
+		}
+		rdp_peer_gfx_maybe_open(peerCtx);
+	}
 	return 0;
 
 out_clean:
@@ -896,8 +1976,6 @@ xf_peer_activate(freerdp_peer* client)
 	struct xkb_keymap *keymap;
 	struct weston_output *weston_output;
 	int i;
-	pixman_box32_t box;
-	pixman_region32_t damage;
 	char seat_name[50];
 	POINTER_SYSTEM_UPDATE pointer_system;
 
@@ -952,6 +2030,16 @@ xf_peer_activate(freerdp_peer* client)
 	rfx_context_reset(peerCtx->rfx_context, weston_output->width, weston_output->height);
 	nsc_context_reset(peerCtx->nsc_context, weston_output->width, weston_output->height);
 
+	if (peerCtx->gfx.ready) {
+		rdp_encoder_cancel(b, peerCtx);
+		if (rdp_peer_gfx_create_surface(peerCtx, true)) {
+			rdp_peer_refresh_full(client);
+		} else {
+			weston_log("failed to resize the RDP graphics pipeline\n");
+			rdp_peer_gfx_close(peerCtx);
+		}
+	}
+
 	if (peersItem->flags & RDP_PEER_ACTIVATED)
 		return TRUE;
 
@@ -975,8 +2063,8 @@ xf_peer_activate(freerdp_peer* client)
 
 	keymap = NULL;
 	if (xkbRuleNames.layout) {
-		keymap = xkb_keymap_new_from_names(b->compositor->xkb_context,
-						   &xkbRuleNames, 0);
+		keymap = weston_compositor_get_xkb_keymap(b->compositor,
+							  &xkbRuleNames);
 	}
 
 	if (settings->ClientHostname)
@@ -1004,15 +2092,7 @@ xf_peer_activate(freerdp_peer* client)
 	pointer->PointerSystem(client->context, &pointer_system);
 
 	/* sends a full refresh */
-	box.x1 = 0;
-	box.y1 = 0;
-	box.x2 = output->base.width;
-	box.y2 = output->base.height;
-	pixman_region32_init_with_extents(&damage, &box);
-
-	rdp_peer_refresh_region(&damage, client);
-
-	pixman_region32_fini(&damage);
+	rdp_peer_refresh_full(client);
 
 	return TRUE;
 }
@@ -1200,6 +2280,7 @@ rdp_peer_init(freerdp_peer *client, struct rdp_backend *b)
 	rdpSettings	*settings;
 	rdpInput *input;
 	RdpPeerContext *peerCtx;
+	HANDLE handle;
 
 	client->ContextSize = sizeof(RdpPeerContext);
 	client->ContextNew = (psPeerContextNew)rdp_peer_context_new;
@@ -1234,6 +2315,7 @@ rdp_peer_init(freerdp_peer *client, struct rdp_backend *b)
 	settings->NSCodec = TRUE;
 	settings->FrameMarkerCommandEnabled = TRUE;
 	settings->SurfaceFrameMarkerEnabled = TRUE;
+	settings->SupportGraphicsPipeline = TRUE;
 
 	client->Capabilities = xf_peer_capabilities;
 	client->PostConnect = xf_peer_post_connect;
@@ -1263,6 +2345,17 @@ rdp_peer_init(freerdp_peer *client, struct rdp_backend *b)
 	for ( ; i < MAX_FREERDP_FDS; i++)
 		peerCtx->events[i] = 0;
 
+	/* Without the virtual channels, the peer just gets surface bits. */
+	peerCtx->vcm = WTSOpenServerA((LPSTR)peerCtx);
+	handle = peerCtx->vcm ?
+		 WTSVirtualChannelManagerGetEventHandle(peerCtx->vcm) : NULL;
+	fd = handle ? GetEventFileDescriptor(handle) : -1;
+	if (fd >= 0)
+		peerCtx->vcm_event = wl_event_loop_add_fd(loop, fd,
+							  WL_EVENT_READABLE,
+							  rdp_client_activity,
+							  client);
+
 	wl_list_insert(&b->output->peers, &peerCtx->item.link);
 	return 0;
 
@@ -1288,6 +2381,24 @@ static const struct weston_rdp_output_api api = {
 	rdp_output_set_size,
 };
 
+static int
+rdp_gl_renderer_init(struct rdp_backend *b)
+{
+	const struct gl_renderer_display_options options = {
+		.egl_platform = EGL_PLATFORM_SURFACELESS_MESA,
+		.egl_native_display = NULL,
+		.egl_surface_type = EGL_PBUFFER_BIT,
+		.drm_formats = rdp_formats,
+		.drm_formats_count = ARRAY_LENGTH(rdp_formats),
+	};
+
+	b->glri = weston_load_module("gl-renderer.so", "gl_renderer_interface");
+	if (!b->glri)
+		return -1;
+
+	return b->glri->display_create(b->compositor, &options);
+}
+
 static struct rdp_backend *
 rdp_backend_create(struct weston_compositor *compositor,
 		   struct weston_rdp_backend_config *config)
@@ -1309,6 +2420,7 @@ rdp_backend_create(struct weston_compositor *compositor,
 	b->rdp_key = config->rdp_key ? strdup(config->rdp_key) : NULL;
 	b->no_clients_resize = config->no_clients_resize;
 	b->force_no_compression = config->force_no_compression;
+	b->use_gl = config->use_gl;
 
 	compositor->backend = &b->base;
 
@@ -1325,8 +2437,19 @@ rdp_backend_create(struct weston_compositor *compositor,
 	if (weston_compositor_set_presentation_clock_software(compositor) < 0)
 		goto err_compositor;
 
-	if (pixman_renderer_init(compositor) < 0)
+	if (b->use_gl) {
+		if (rdp_gl_renderer_init(b) < 0) {
+			weston_log("Failed to initialize the GL renderer\n");
+			goto err_compositor;
+		}
+	} else if (pixman_renderer_init(compositor) < 0) {
+		goto err_compositor;
+	}
+
+	if (rdp_encoder_init(b) < 0) {
+		weston_log("Failed to initialize the RDP encoder\n");
 		goto err_compositor;
+	}
 
 	if (rdp_head_create(compositor, "rdp") < 0)
 		goto err_compositor;
@@ -1374,6 +2497,9 @@ err_output:
 	if (b->output)
 		weston_output_release(&b->output->base);
 err_compositor:
+	if (b->encoder.done_source)
+		rdp_encoder_destroy(b);
+
 	wl_list_for_each_safe(base, next, &compositor->head_list, compositor_link)
 		rdp_head_destroy(to_rdp_head(base));
 
@@ -1397,6 +2523,7 @@ config_init_to_defaults(struct weston_rdp_backend_config *config)
 	config->env_socket = 0;
 	config->no_clients_resize = 0;
 	config->force_no_compression = 0;
+	config->use_gl = false;
 }
 
 WL_EXPORT int
@@ -58,8 +58,11 @@
 #include "shared/timespec-util.h"
 #include "fullscreen-shell-unstable-v1-client-protocol.h"
 #include "xdg-shell-client-protocol.h"
+#include "linux-dmabuf-unstable-v1-client-protocol.h"
+#include "presentation-time-client-protocol.h"
 #include "presentation-time-server-protocol.h"
 #include "linux-dmabuf.h"
+#include "libweston-internal.h"
 #include <libweston/windowed-output-api.h>
 
 #define WINDOW_TITLE "Weston Compositor"
@@ -80,6 +83,10 @@ struct wayland_backend {
 		struct xdg_wm_base *xdg_wm_base;
 		struct zwp_fullscreen_shell_v1 *fshell;
 		struct wl_shm *shm;
+		struct wl_subcompositor *subcompositor;
+		struct zwp_linux_dmabuf_v1 *dmabuf;
+		struct wl_array dmabuf_formats; /**< struct wayland_dmabuf_format */
+		struct wp_presentation *presentation;
 
 		struct wl_list output_list;
 
@@ -91,6 +98,10 @@ struct wayland_backend {
 	bool sprawl_across_outputs;
 	bool fullscreen;
 
+	/* Forward fullscreen client dmabufs to the parent compositor */
+	bool passthrough;
+	struct wl_list passthrough_buffer_list;
+
 	struct theme *theme;
 	cairo_device_t *frame_device;
 	struct wl_cursor_theme *cursor_theme;
@@ -142,6 +153,18 @@ struct wayland_output {
 	struct weston_mode mode;
 
 	struct wl_callback *frame_cb;
+	struct wp_presentation_feedback *presentation_feedback;
+
+	struct {
+		struct wl_surface *surface;
+		struct wl_subsurface *subsurface;
+		struct weston_plane plane;
+
+		/* chosen by assign_planes for the frame being repainted */
+		struct wayland_passthrough_buffer *pending;
+		/* attached to the parent subsurface */
+		struct wayland_passthrough_buffer *current;
+	} passthrough;
 };
 
 struct wayland_parent_output {
@@ -192,6 +215,37 @@ struct wayland_shm_buffer {
 	cairo_surface_t *c_surface;
 };
 
+struct wayland_dmabuf_format {
+	uint32_t format;
+	uint64_t modifier;
+};
+
+/** A client dmabuf re-imported into the parent compositor
+ *
+ * One exists per local weston_buffer that was ever a passthrough
+ * candidate. The parent wl_buffer is created asynchronously, so a buffer
+ * the parent rejects only costs one failed request and is composited
+ * locally from then on.
+ */
+struct wayland_passthrough_buffer {
+	struct wayland_backend *backend;
+	struct wl_list link;		/**< wayland_backend::passthrough_buffer_list */
+
+	struct weston_buffer *buffer;
+	struct wl_listener buffer_destroy_listener;
+
+	/* output to repaint once the import completes */
+	struct wayland_output *output;
+
+	struct zwp_linux_buffer_params_v1 *params;
+	struct wl_buffer *parent_buffer;
+	bool failed;
+
+	/* Keeps the client from reusing the buffer while the parent
+	 * still scans it out; dropped on the parent's release. */
+	struct weston_buffer_reference parent_ref;
+};
+
 struct wayland_input {
 	struct weston_seat base;
 	struct wayland_backend *backend;
@@ -391,14 +445,12 @@ frame_done(void *data, struct wl_callback *callback, uint32_t time)
 	wl_callback_destroy(callback);
 	output->frame_cb = NULL;
 
-	/* XXX: use the presentation extension for proper timings */
-
 	/*
 	 * This is the fallback case, where Presentation extension is not
-	 * available from the parent compositor. We do not know the base for
-	 * 'time', so we cannot feed it to finish_frame(). Do the only thing
-	 * we can, and pretend finish_frame time is when we process this
-	 * event.
+	 * available from the parent compositor, and the start of the
+	 * repaint loop. We do not know the base for 'time', so we cannot
+	 * feed it to finish_frame(). Do the only thing we can, and pretend
+	 * finish_frame time is when we process this event.
 	 */
 	weston_compositor_read_presentation_clock(output->base.compositor, &ts);
 	weston_output_finish_frame(&output->base, &ts, 0);
@@ -408,6 +460,106 @@ static const struct wl_callback_listener frame_listener = {
 	frame_done
 };
 
+static void
+wayland_output_clear_presentation_feedback(struct wayland_output *output)
+{
+	if (output->presentation_feedback) {
+		wp_presentation_feedback_destroy(output->presentation_feedback);
+		output->presentation_feedback = NULL;
+	}
+}
+
+static void
+presentation_feedback_sync_output(void *data,
+				  struct wp_presentation_feedback *feedback,
+				  struct wl_output *output)
+{
+}
+
+static void
+presentation_feedback_presented(void *data,
+				struct wp_presentation_feedback *feedback,
+				uint32_t tv_sec_hi, uint32_t tv_sec_lo,
+				uint32_t tv_nsec, uint32_t refresh,
+				uint32_t seq_hi, uint32_t seq_lo,
+				uint32_t flags)
+{
+	struct wayland_output *output = data;
+	struct weston_mode *mode = output->base.current_mode;
+	uint64_t seq = ((uint64_t)seq_hi << 32) | seq_lo;
+	struct timespec ts;
+
+	assert(feedback == output->presentation_feedback);
+	wayland_output_clear_presentation_feedback(output);
+
+	/* The parent's clock is our presentation clock, see
+	 * presentation_clock_id(), so the timestamp can be used as is. */
+	timespec_from_proto(&ts, tv_sec_hi, tv_sec_lo, tv_nsec);
+	if (timespec_sub_to_nsec(&ts, &output->base.frame_time) < 0)
+		ts = output->base.frame_time;
+
+	/* Follow the refresh rate the parent actually runs the surface at,
+	 * so the repaint window is placed against its vblank, not ours. */
+	if (refresh > 0 && mode)
+		mode->refresh = (int32_t)(1000000000000LL / refresh);
+
+	if (seq > 0)
+		output->base.msc = seq;
+
+	/* A zero-copy parent frame says nothing about our clients; those
+	 * views carry their own flag. */
+	flags &= ~WP_PRESENTATION_FEEDBACK_KIND_ZERO_COPY;
+
+	weston_output_finish_frame(&output->base, &ts, flags);
+}
+
+static void
+presentation_feedback_discarded(void *data,
+				struct wp_presentation_feedback *feedback)
+{
+	struct wayland_output *output = data;
+	struct timespec ts;
+
+	assert(feedback == output->presentation_feedback);
+	wayland_output_clear_presentation_feedback(output);
+
+	weston_compositor_read_presentation_clock(output->base.compositor, &ts);
+	weston_output_finish_frame(&output->base, &ts,
+				   WP_PRESENTATION_FEEDBACK_INVALID);
+}
+
+static const struct wp_presentation_feedback_listener presentation_feedback_listener = {
+	presentation_feedback_sync_output,
+	presentation_feedback_presented,
+	presentation_feedback_discarded
+};
+
+/** Ask the parent to tell us when the next commit is on screen
+ *
+ * Must be called before the output surface is committed. With
+ * wp_presentation from the parent the frame completes with the parent's
+ * vblank timestamp; otherwise a frame callback marks the completion.
+ */
+static void
+wayland_output_request_frame_completion(struct wayland_output *output)
+{
+	struct wayland_backend *b = to_wayland_backend(output->base.compositor);
+
+	if (b->parent.presentation) {
+		wayland_output_clear_presentation_feedback(output);
+		output->presentation_feedback =
+			wp_presentation_feedback(b->parent.presentation,
+						 output->parent.surface);
+		wp_presentation_feedback_add_listener(output->presentation_feedback,
+						      &presentation_feedback_listener,
+						      output);
+		return;
+	}
+
+	output->frame_cb = wl_surface_frame(output->parent.surface);
+	wl_callback_add_listener(output->frame_cb, &frame_listener, output);
+}
+
 static void
 draw_initial_frame(struct wayland_output *output)
 {
@@ -497,6 +649,336 @@ wayland_output_update_gl_border(struct wayland_output *output)
 }
 #endif
 
+static void
+wayland_passthrough_buffer_destroy(struct wayland_passthrough_buffer *pb)
+{
+	struct wayland_output *output;
+
+	/* The local buffer may be going away while the parent still holds
+	 * it, in which case the reference listener is ours to unhook. */
+	if (pb->parent_ref.buffer)
+		wl_list_remove(&pb->parent_ref.destroy_listener.link);
+
+	if (pb->params)
+		zwp_linux_buffer_params_v1_destroy(pb->params);
+	if (pb->parent_buffer)
+		wl_buffer_destroy(pb->parent_buffer);
+
+	wl_list_for_each(output, &pb->backend->compositor->output_list,
+			 base.link) {
+		if (output->passthrough.pending == pb)
+			output->passthrough.pending = NULL;
+		if (output->passthrough.current == pb)
+			output->passthrough.current = NULL;
+	}
+
+	wl_list_remove(&pb->buffer_destroy_listener.link);
+	wl_list_remove(&pb->link);
+	free(pb);
+}
+
+static void
+passthrough_buffer_handle_destroy(struct wl_listener *listener, void *data)
+{
+	struct wayland_passthrough_buffer *pb =
+		container_of(listener, struct wayland_passthrough_buffer,
+			     buffer_destroy_listener);
+
+	wayland_passthrough_buffer_destroy(pb);
+}
+
+static void
+passthrough_buffer_release(void *data, struct wl_buffer *buffer)
+{
+	struct wayland_passthrough_buffer *pb = data;
+
+	weston_buffer_reference(&pb->parent_ref, NULL);
+}
+
+static const struct wl_buffer_listener passthrough_buffer_listener = {
+	passthrough_buffer_release
+};
+
+static void
+passthrough_params_created(void *data,
+			   struct zwp_linux_buffer_params_v1 *params,
+			   struct wl_buffer *buffer)
+{
+	struct wayland_passthrough_buffer *pb = data;
+
+	zwp_linux_buffer_params_v1_destroy(pb->params);
+	pb->params = NULL;
+
+	pb->parent_buffer = buffer;
+	wl_buffer_add_listener(pb->parent_buffer,
+			       &passthrough_buffer_listener, pb);
+
+	if (pb->output)
+		weston_output_schedule_repaint(&pb->output->base);
+}
+
+static void
+passthrough_params_failed(void *data,
+			  struct zwp_linux_buffer_params_v1 *params)
+{
+	struct wayland_passthrough_buffer *pb = data;
+
+	zwp_linux_buffer_params_v1_destroy(pb->params);
+	pb->params = NULL;
+	pb->failed = true;
+}
+
+static const struct zwp_linux_buffer_params_v1_listener passthrough_params_listener = {
+	passthrough_params_created,
+	passthrough_params_failed
+};
+
+static bool
+wayland_backend_parent_supports_dmabuf(struct wayland_backend *b,
+				       const struct dmabuf_attributes *attr)
+{
+	struct wayland_dmabuf_format *fmt;
+
+	wl_array_for_each(fmt, &b->parent.dmabuf_formats) {
+		if (fmt->format == attr->format &&
+		    fmt->modifier == attr->modifier[0])
+			return true;
+	}
+
+	return false;
+}
+
+static struct wayland_passthrough_buffer *
+wayland_passthrough_buffer_get(struct wayland_output *output,
+			       struct weston_buffer *buffer,
+			       struct linux_dmabuf_buffer *dmabuf)
+{
+	struct wayland_backend *b = to_wayland_backend(output->base.compositor);
+	const struct dmabuf_attributes *attr = &dmabuf->attributes;
+	struct wayland_passthrough_buffer *pb;
+	int i;
+
+	wl_list_for_each(pb, &b->passthrough_buffer_list, link) {
+		if (pb->buffer == buffer)
+			return pb;
+	}
+
+	if (!wayland_backend_parent_supports_dmabuf(b, attr))
+		return NULL;
+
+	pb = zalloc(sizeof *pb);
+	if (!pb)
+		return NULL;
+
+	pb->backend = b;
+	pb->buffer = buffer;
+	pb->output = output;
+	pb->buffer_destroy_listener.notify = passthrough_buffer_handle_destroy;
+	wl_signal_add(&buffer->destroy_signal, &pb->buffer_destroy_listener);
+	wl_list_insert(&b->passthrough_buffer_list, &pb->link);
+
+	pb->params = zwp_linux_dmabuf_v1_create_params(b->parent.dmabuf);
+	for (i = 0; i < attr->n_planes; i++)
+		zwp_linux_buffer_params_v1_add(pb->params, attr->fd[i], i,
+					       attr->offset[i],
+					       attr->stride[i],
+					       attr->modifier[i] >> 32,
+					       attr->modifier[i] & 0xffffffff);
+	zwp_linux_buffer_params_v1_add_listener(pb->params,
+						&passthrough_params_listener,
+						pb);
+	zwp_linux_buffer_params_v1_create(pb->params, attr->width,
+					  attr->height, attr->format,
+					  attr->flags);
+	wl_display_flush(b->parent.wl_display);
+
+	return pb;
+}
+
+static void
+wayland_output_destroy_passthrough(struct wayland_output *output)
+{
+	struct wayland_backend *b = to_wayland_backend(output->base.compositor);
+	struct wayland_passthrough_buffer *pb;
+
+	wl_list_for_each(pb, &b->passthrough_buffer_list, link) {
+		if (pb->output == output)
+			pb->output = NULL;
+	}
+
+	output->passthrough.pending = NULL;
+	output->passthrough.current = NULL;
+
+	if (output->passthrough.subsurface) {
+		wl_subsurface_destroy(output->passthrough.subsurface);
+		output->passthrough.subsurface = NULL;
+	}
+
+	if (output->passthrough.surface) {
+		wl_surface_destroy(output->passthrough.surface);
+		output->passthrough.surface = NULL;
+	}
+}
+
+static int
+wayland_output_create_passthrough(struct wayland_output *output)
+{
+	struct wayland_backend *b = to_wayland_backend(output->base.compositor);
+	struct wl_region *region;
+
+	output->passthrough.surface =
+		wl_compositor_create_surface(b->parent.compositor);
+	if (!output->passthrough.surface)
+		return -1;
+
+	/* Input keeps going to the output surface underneath. */
+	region = wl_compositor_create_region(b->parent.compositor);
+	wl_surface_set_input_region(output->passthrough.surface, region);
+	wl_region_destroy(region);
+
+	output->passthrough.subsurface =
+		wl_subcompositor_get_subsurface(b->parent.subcompositor,
+						output->passthrough.surface,
+						output->parent.surface);
+	if (!output->passthrough.subsurface) {
+		wl_surface_destroy(output->passthrough.surface);
+		output->passthrough.surface = NULL;
+		return -1;
+	}
+
+	return 0;
+}
+
+/** Pick a view whose buffer the parent compositor can show directly
+ *
+ * Only the topmost view qualifies, and only if its dmabuf covers the
+ * whole output one-to-one, so that nothing local has to be drawn on top
+ * of it. Anything below it is still composited into the output surface,
+ * which the parent blends under the subsurface.
+ */
+static struct wayland_passthrough_buffer *
+wayland_output_passthrough_candidate(struct wayland_output *output,
+				     struct weston_view *ev)
+{
+	struct weston_surface *surface = ev->surface;
+	struct weston_buffer_viewport *vp = &surface->buffer_viewport;
+	struct weston_buffer *buffer = surface->buffer_ref.buffer;
+	struct linux_dmabuf_buffer *dmabuf;
+	struct wayland_passthrough_buffer *pb;
+
+	if (!buffer || !buffer->resource)
+		return NULL;
+
+	if (ev->output_mask != (1u << output->base.id))
+		return NULL;
+
+	if (ev->alpha != 1.0f ||
+	    !weston_view_matches_output_entirely(ev, &output->base))
+		return NULL;
+
+	if (output->base.transform != WL_OUTPUT_TRANSFORM_NORMAL ||
+	    vp->buffer.transform != WL_OUTPUT_TRANSFORM_NORMAL ||
+	    vp->buffer.src_width != wl_fixed_from_int(-1) ||
+	    vp->surface.width != -1)
+		return NULL;
+
+	/* The parent cannot wait on our fences or signal our releases. */
+	if (surface->acquire_fence_fd >= 0 ||
+	    surface->buffer_release_ref.buffer_release)
+		return NULL;
+
+	dmabuf = linux_dmabuf_buffer_get(buffer->resource);
+	if (!dmabuf)
+		return NULL;
+
+	if (dmabuf->attributes.width != output->base.current_mode->width ||
+	    dmabuf->attributes.height != output->base.current_mode->height)
+		return NULL;
+
+	pb = wayland_passthrough_buffer_get(output, buffer, dmabuf);
+	if (!pb || pb->failed || !pb->parent_buffer)
+		return NULL;
+
+	return pb;
+}
+
+static void
+wayland_output_assign_planes(struct weston_output *output_base,
+			     void *repaint_data)
+{
+	struct wayland_output *output = to_wayland_output(output_base);
+	struct weston_compositor *ec = output_base->compositor;
+	struct weston_paint_node *pnode;
+	struct wayland_passthrough_buffer *pb = NULL;
+	bool topmost = true;
+
+	wl_list_for_each(pnode, &output_base->paint_node_z_order_list,
+			 z_order_link) {
+		struct weston_view *ev = pnode->view;
+
+		if (topmost) {
+			topmost = false;
+			pb = wayland_output_passthrough_candidate(output, ev);
+			if (pb) {
+				weston_view_move_to_plane(ev,
+							  &output->passthrough.plane);
+				ev->psf_flags =
+					WP_PRESENTATION_FEEDBACK_KIND_ZERO_COPY;
+				continue;
+			}
+		}
+
+		weston_view_move_to_plane(ev, &ec->primary_plane);
+		ev->psf_flags = 0;
+	}
+
+	output->passthrough.pending = pb;
+}
+
+/** Update the passthrough subsurface for the frame being repainted
+ *
+ * Must run before the output surface is committed: the subsurface is in
+ * synchronized mode, so its new state lands on the same parent commit as
+ * the locally composited frame.
+ */
+static void
+wayland_output_update_passthrough(struct wayland_output *output)
+{
+	struct wayland_passthrough_buffer *pb = output->passthrough.pending;
+	int32_t x = 0, y = 0;
+
+	output->passthrough.pending = NULL;
+
+	if (!pb && !output->passthrough.current)
+		return;
+
+	if (pb && !output->passthrough.surface &&
+	    wayland_output_create_passthrough(output) < 0)
+		return;
+
+	if (!output->passthrough.surface) {
+		output->passthrough.current = NULL;
+		return;
+	}
+
+	if (pb) {
+		if (output->frame)
+			frame_interior(output->frame, &x, &y, NULL, NULL);
+		wl_subsurface_set_position(output->passthrough.subsurface,
+					   x, y);
+		wl_surface_attach(output->passthrough.surface,
+				  pb->parent_buffer, 0, 0);
+		wl_surface_damage(output->passthrough.surface, 0, 0,
+				  INT32_MAX, INT32_MAX);
+		weston_buffer_reference(&pb->parent_ref, pb->buffer);
+	} else {
+		wl_surface_attach(output->passthrough.surface, NULL, 0, 0);
+	}
+
+	wl_surface_commit(output->passthrough.surface);
+	output->passthrough.current = pb;
+}
+
 static int
 wayland_output_start_repaint_loop(struct weston_output *output_base)
 {
@@ -532,10 +1014,10 @@ wayland_output_repaint_gl(struct weston_output *output_base,
 	struct wayland_output *output = to_wayland_output(output_base);
 	struct weston_compositor *ec = output->base.compositor;
 
-	output->frame_cb = wl_surface_frame(output->parent.surface);
-	wl_callback_add_listener(output->frame_cb, &frame_listener, output);
+	wayland_output_request_frame_completion(output);
 
 	wayland_output_update_gl_border(output);
+	wayland_output_update_passthrough(output);
 
 	ec->renderer->repaint_output(&output->base, damage);
 
@@ -662,9 +1144,9 @@ wayland_output_repaint_pixman(struct weston_output *output_base,
 	b->compositor->renderer->repaint_output(output_base, &sb->damage);
 
 	wayland_shm_buffer_attach(sb);
+	wayland_output_update_passthrough(output);
 
-	output->frame_cb = wl_surface_frame(output->parent.surface);
-	wl_callback_add_listener(output->frame_cb, &frame_listener, output);
+	wayland_output_request_frame_completion(output);
 	wl_surface_commit(output->parent.surface);
 	wl_display_flush(b->parent.wl_display);
 
@@ -682,6 +1164,8 @@ wayland_backend_destroy_output_surface(struct wayland_output *output)
 {
 	assert(output->parent.surface);
 
+	wayland_output_destroy_passthrough(output);
+
 	if (output->parent.xdg_toplevel) {
 		xdg_toplevel_destroy(output->parent.xdg_toplevel);
 		output->parent.xdg_toplevel = NULL;
@@ -723,6 +1207,8 @@ wayland_output_disable(struct weston_output *base)
 	if (!output->base.enabled)
 		return 0;
 
+	wayland_output_clear_presentation_feedback(output);
+
 	if (b->use_pixman) {
 		pixman_renderer_output_destroy(&output->base);
 #ifdef ENABLE_EGL
@@ -736,6 +1222,9 @@ wayland_output_disable(struct weston_output *base)
 
 	wayland_backend_destroy_output_surface(output);
 
+	if (b->passthrough)
+		weston_plane_release(&output->passthrough.plane);
+
 	if (output->frame)
 		frame_destroy(output->frame);
 
@@ -758,6 +1247,7 @@ wayland_output_destroy(struct weston_output *base)
 
 	if (output->frame_cb)
 		wl_callback_destroy(output->frame_cb);
+	wayland_output_clear_presentation_feedback(output);
 
 	free(output->title);
 	free(output);
@@ -1090,6 +1580,9 @@ wayland_output_switch_mode(struct weston_output *output_base,
 	if (output->base.current_mode == mode)
 		return 0;
 
+	/* The passthrough subsurface belongs to the old surface. */
+	wayland_output_destroy_passthrough(output);
+
 	old_mode = output->base.current_mode;
 	old_surface = output->parent.surface;
 	output->base.current_mode = mode;
@@ -1277,6 +1770,14 @@ wayland_output_enable(struct weston_output *base)
 
 	output->base.start_repaint_loop = wayland_output_start_repaint_loop;
 	output->base.assign_planes = NULL;
+	if (b->passthrough) {
+		weston_plane_init(&output->passthrough.plane,
+				  b->compositor, 0, 0);
+		weston_compositor_stack_plane(b->compositor,
+					      &output->passthrough.plane,
+					      &b->compositor->primary_plane);
+		output->base.assign_planes = wayland_output_assign_planes;
+	}
 	output->base.set_backlight = NULL;
 	output->base.set_dpms = NULL;
 	output->base.switch_mode = wayland_output_switch_mode;
@@ -1946,10 +2447,8 @@ input_handle_keymap(void *data, struct wl_keyboard *keyboard, uint32_t format,
 			goto error;
 		}
 
-		keymap = xkb_keymap_new_from_string(input->backend->compositor->xkb_context,
-						    map_str,
-						    XKB_KEYMAP_FORMAT_TEXT_V1,
-						    0);
+		keymap = weston_compositor_get_xkb_keymap_from_string(
+				input->backend->compositor, map_str);
 		munmap(map_str, size);
 
 		if (!keymap) {
@@ -2654,6 +3153,54 @@ static const struct xdg_wm_base_listener wm_base_listener = {
 	xdg_wm_base_ping,
 };
 
+static void
+parent_dmabuf_format(void *data, struct zwp_linux_dmabuf_v1 *dmabuf,
+		     uint32_t format)
+{
+	/* Superseded by the modifier event from version 3 on. */
+}
+
+static void
+parent_dmabuf_modifier(void *data, struct zwp_linux_dmabuf_v1 *dmabuf,
+		       uint32_t format, uint32_t modifier_hi,
+		       uint32_t modifier_lo)
+{
+	struct wayland_backend *b = data;
+	struct wayland_dmabuf_format *fmt;
+
+	fmt = wl_array_add(&b->parent.dmabuf_formats, sizeof *fmt);
+	if (!fmt)
+		return;
+
+	fmt->format = format;
+	fmt->modifier = ((uint64_t)modifier_hi << 32) | modifier_lo;
+}
+
+static const struct zwp_linux_dmabuf_v1_listener parent_dmabuf_listener = {
+	parent_dmabuf_format,
+	parent_dmabuf_modifier
+};
+
+static void
+presentation_clock_id(void *data, struct wp_presentation *presentation,
+		      uint32_t clk_id)
+{
+	struct wayland_backend *b = data;
+
+	/* Parent timestamps are only usable in our own clock domain. */
+	if (weston_compositor_set_presentation_clock(b->compositor,
+						     clk_id) < 0) {
+		weston_log("Parent presentation clock %u is not usable, "
+			   "falling back to frame callbacks.\n", clk_id);
+		wp_presentation_destroy(b->parent.presentation);
+		b->parent.presentation = NULL;
+	}
+}
+
+static const struct wp_presentation_listener presentation_listener = {
+	presentation_clock_id
+};
+
 static void
 registry_handle_global(void *data, struct wl_registry *registry, uint32_t name,
 		       const char *interface, uint32_t version)
@@ -2686,6 +3233,23 @@ registry_handle_global(void *data, struct wl_registry *registry, uint32_t name,
 	} else if (strcmp(interface, "wl_shm") == 0) {
 		b->parent.shm =
 			wl_registry_bind(registry, name, &wl_shm_interface, 1);
+	} else if (strcmp(interface, "wl_subcompositor") == 0) {
+		b->parent.subcompositor =
+			wl_registry_bind(registry, name,
+					 &wl_subcompositor_interface, 1);
+	} else if (strcmp(interface, "zwp_linux_dmabuf_v1") == 0 &&
+		   version >= 3) {
+		b->parent.dmabuf =
+			wl_registry_bind(registry, name,
+					 &zwp_linux_dmabuf_v1_interface, 3);
+		zwp_linux_dmabuf_v1_add_listener(b->parent.dmabuf,
+						 &parent_dmabuf_listener, b);
+	} else if (strcmp(interface, "wp_presentation") == 0) {
+		b->parent.presentation =
+			wl_registry_bind(registry, name,
+					 &wp_presentation_interface, 1);
+		wp_presentation_add_listener(b->parent.presentation,
+					     &presentation_listener, b);
 	}
 }
 
@@ -2757,6 +3321,24 @@ wayland_destroy(struct weston_compositor *ec)
 	wl_list_for_each_safe(input, next_input, &b->pending_input_list, link)
 		wayland_input_destroy(input);
 
+	while (!wl_list_empty(&b->passthrough_buffer_list)) {
+		struct wayland_passthrough_buffer *pb =
+			container_of(b->passthrough_buffer_list.next,
+				     struct wayland_passthrough_buffer, link);
+
+		wayland_passthrough_buffer_destroy(pb);
+	}
+
+	if (b->parent.dmabuf)
+		zwp_linux_dmabuf_v1_destroy(b->parent.dmabuf);
+	wl_array_release(&b->parent.dmabuf_formats);
+
+	if (b->parent.subcompositor)
+		wl_subcompositor_destroy(b->parent.subcompositor);
+
+	if (b->parent.presentation)
+		wp_presentation_destroy(b->parent.presentation);
+
 	if (b->parent.shm)
 		wl_shm_destroy(b->parent.shm);
 
@@ -2871,6 +3453,8 @@ wayland_backend_create(struct weston_compositor *compositor,
 	wl_list_init(&b->parent.output_list);
 	wl_list_init(&b->input_list);
 	wl_list_init(&b->pending_input_list);
+	wl_list_init(&b->passthrough_buffer_list);
+	wl_array_init(&b->parent.dmabuf_formats);
 	b->parent.registry = wl_display_get_registry(b->parent.wl_display);
 	wl_registry_add_listener(b->parent.registry, &registry_listener, b);
 	wl_display_roundtrip(b->parent.wl_display);
@@ -2889,6 +3473,16 @@ wayland_backend_create(struct weston_compositor *compositor,
 #endif
 	b->fullscreen = new_config->fullscreen;
 
+	if (new_config->passthrough) {
+		if (b->parent.subcompositor && b->parent.dmabuf) {
+			b->passthrough = true;
+		} else {
+			weston_log("Parent compositor lacks wl_subcompositor "
+				   "or zwp_linux_dmabuf_v1 v3; dmabuf "
+				   "passthrough disabled.\n");
+		}
+	}
+
 	if (!b->use_pixman) {
 		gl_renderer = weston_load_module("gl-renderer.so",
 						 "gl_renderer_interface");
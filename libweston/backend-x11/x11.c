@@ -90,6 +90,7 @@ struct x11_backend {
 	struct xkb_keymap	*xkb_keymap;
 	unsigned int		 has_xkb;
 	uint8_t			 xkb_event_base;
+	uint8_t			 shm_event_base;
 	int			 fullscreen;
 	int			 no_input;
 	int			 use_pixman;
@@ -135,6 +136,7 @@ struct x11_output {
 
 	xcb_gc_t		gc;
 	xcb_shm_seg_t		segment;
+	bool			shm_completion_pending;
 	pixman_image_t	       *hw_surface;
 	int			shm_id;
 	void		       *buf;
@@ -219,7 +221,7 @@ x11_backend_get_keymap(struct x11_backend *b)
 	copy_prop_value(options);
 #undef copy_prop_value
 
-	ret = xkb_keymap_new_from_names(b->compositor->xkb_context, &names, 0);
+	ret = weston_compositor_get_xkb_keymap(b->compositor, &names);
 
 	free(reply);
 	return ret;
@@ -432,18 +434,27 @@ x11_output_repaint_gl(struct weston_output *output_base,
 	return 0;
 }
 
-static void
-set_clip_for_output(struct weston_output *output_base, pixman_region32_t *region)
+/* Past this many damage rectangles one upload of their extents is
+ * cheaper than a request per rectangle. */
+#define X11_SHM_MAX_DAMAGE_RECTS 16
+
+/** Copy the damaged part of the SHM image to the output window
+ *
+ * Requests are not checked, so no round-trip is made per frame; X errors
+ * come back through the event loop. The last request asks for a
+ * ShmCompletion event, which finishes the frame once the server is done
+ * reading the segment. Returns false if nothing was posted.
+ */
+static bool
+x11_output_put_shm_damage(struct x11_output *output, pixman_region32_t *region)
 {
-	struct x11_output *output = to_x11_output(output_base);
-	struct weston_compositor *ec = output->base.compositor;
-	struct x11_backend *b = to_x11_backend(ec);
+	struct weston_output *output_base = &output->base;
+	struct x11_backend *b = to_x11_backend(output_base->compositor);
+	int width = pixman_image_get_width(output->hw_surface);
+	int height = pixman_image_get_height(output->hw_surface);
 	pixman_region32_t transformed_region;
 	pixman_box32_t *rects;
-	xcb_rectangle_t *output_rects;
-	xcb_void_cookie_t cookie;
 	int nrects, i;
-	xcb_generic_error_t *err;
 
 	pixman_region32_init(&transformed_region);
 	pixman_region32_copy(&transformed_region, region);
@@ -453,36 +464,35 @@ set_clip_for_output(struct weston_output *output_base, pixman_region32_t *region
 				  output_base->transform,
 				  output_base->current_scale,
 				  &transformed_region, &transformed_region);
+	pixman_region32_intersect_rect(&transformed_region,
+				       &transformed_region,
+				       0, 0, width, height);
 
 	rects = pixman_region32_rectangles(&transformed_region, &nrects);
-	output_rects = calloc(nrects, sizeof(xcb_rectangle_t));
-
-	if (output_rects == NULL) {
-		pixman_region32_fini(&transformed_region);
-		return;
+	if (nrects > X11_SHM_MAX_DAMAGE_RECTS) {
+		rects = pixman_region32_extents(&transformed_region);
+		nrects = 1;
 	}
 
 	for (i = 0; i < nrects; i++) {
-		output_rects[i].x = rects[i].x1;
-		output_rects[i].y = rects[i].y1;
-		output_rects[i].width = rects[i].x2 - rects[i].x1;
-		output_rects[i].height = rects[i].y2 - rects[i].y1;
+		xcb_shm_put_image(b->conn, output->window, output->gc,
+				  width, height,
+				  rects[i].x1, rects[i].y1,
+				  rects[i].x2 - rects[i].x1,
+				  rects[i].y2 - rects[i].y1,
+				  rects[i].x1, rects[i].y1,
+				  output->depth, XCB_IMAGE_FORMAT_Z_PIXMAP,
+				  i == nrects - 1, output->segment, 0);
 	}
 
 	pixman_region32_fini(&transformed_region);
 
-	cookie = xcb_set_clip_rectangles_checked(b->conn, XCB_CLIP_ORDERING_UNSORTED,
-					output->gc,
-					0, 0, nrects,
-					output_rects);
-	err = xcb_request_check(b->conn, cookie);
-	if (err != NULL) {
-		weston_log("Failed to set clip rects, err: %d\n", err->error_code);
-		free(err);
-	}
-	free(output_rects);
-}
+	if (nrects == 0)
+		return false;
 
+	xcb_flush(b->conn);
+	return true;
+}
 
 static int
 x11_output_repaint_shm(struct weston_output *output_base,
@@ -491,31 +501,18 @@ x11_output_repaint_shm(struct weston_output *output_base,
 {
 	struct x11_output *output = to_x11_output(output_base);
 	struct weston_compositor *ec = output->base.compositor;
-	struct x11_backend *b = to_x11_backend(ec);
-	xcb_void_cookie_t cookie;
-	xcb_generic_error_t *err;
 
 	pixman_renderer_output_set_buffer(output_base, output->hw_surface);
 	ec->renderer->repaint_output(output_base, damage);
 
 	pixman_region32_subtract(&ec->primary_plane.damage,
 				 &ec->primary_plane.damage, damage);
-	set_clip_for_output(output_base, damage);
-	cookie = xcb_shm_put_image_checked(b->conn, output->window, output->gc,
-					pixman_image_get_width(output->hw_surface),
-					pixman_image_get_height(output->hw_surface),
-					0, 0,
-					pixman_image_get_width(output->hw_surface),
-					pixman_image_get_height(output->hw_surface),
-					0, 0, output->depth, XCB_IMAGE_FORMAT_Z_PIXMAP,
-					0, output->segment, 0);
-	err = xcb_request_check(b->conn, cookie);
-	if (err != NULL) {
-		weston_log("Failed to put shm image, err: %d\n", err->error_code);
-		free(err);
-	}
 
-	wl_event_source_timer_update(output->finish_frame_timer, 10);
+	if (x11_output_put_shm_damage(output, damage))
+		output->shm_completion_pending = true;
+	else
+		wl_event_source_timer_update(output->finish_frame_timer, 10);
+
 	return 0;
 }
 
@@ -720,6 +717,7 @@ x11_output_init_shm(struct x11_backend *b, struct x11_output *output,
 		errno = ENOENT;
 		return -1;
 	}
+	b->shm_event_base = ext->first_event;
 
 	screen = x11_compositor_get_default_screen(b);
 	visual_type = find_visual_by_id(screen, screen->root_visual);
@@ -1445,6 +1443,29 @@ x11_backend_next_event(struct x11_backend *b,
 	return *event != NULL;
 }
 
+static void
+x11_backend_deliver_shm_completion(struct x11_backend *b,
+				   xcb_shm_completion_event_t *completion)
+{
+	struct weston_output *base;
+	struct x11_output *output;
+	struct timespec ts;
+
+	wl_list_for_each(base, &b->compositor->output_list, link) {
+		output = to_x11_output(base);
+		if (output->window != completion->drawable)
+			continue;
+
+		if (!output->shm_completion_pending)
+			return;
+
+		output->shm_completion_pending = false;
+		weston_compositor_read_presentation_clock(b->compositor, &ts);
+		weston_output_finish_frame(&output->base, &ts, 0);
+		return;
+	}
+}
+
 static int
 x11_backend_handle_event(int fd, uint32_t mask, void *data)
 {
@@ -1658,6 +1679,11 @@ x11_backend_handle_event(int fd, uint32_t mask, void *data)
 			break;
 		}
 
+		if (b->shm_event_base &&
+		    response_type == b->shm_event_base + XCB_SHM_COMPLETION)
+			x11_backend_deliver_shm_completion(b,
+				(xcb_shm_completion_event_t *) event);
+
 #ifdef HAVE_XCB_XKB
 		if (b->has_xkb) {
 			if (response_type == b->xkb_event_base) {
@@ -107,6 +107,16 @@ struct weston_backend {
 	 */
 	bool (*can_scanout_dmabuf)(struct weston_compositor *compositor,
 				   struct linux_dmabuf_buffer *buffer);
+
+	/** Release caches under memory pressure. Optional.
+	 *
+	 * @param compositor The compositor.
+	 * @param trim Where to add what was released.
+	 *
+	 * See weston_compositor_trim_memory().
+	 */
+	void (*trim_memory)(struct weston_compositor *compositor,
+			    struct weston_memory_trim *trim);
 };
 
 /* weston_head */
@@ -178,6 +188,9 @@ void
 weston_output_region_from_global(struct weston_output *output,
 				 pixman_region32_t *region);
 
+void
+weston_output_set_color_transform_by_backend(struct weston_output *output);
+
 /* weston_seat */
 
 void
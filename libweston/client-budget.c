@@ -0,0 +1,325 @@
+/*
+ * Copyright © 2022 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <sys/types.h>
+
+#include <libweston/libweston.h>
+#include <libweston/weston-log.h>
+#include <libweston/zalloc.h>
+#include "libweston-internal.h"
+#include "client-budget.h"
+#include "shared/timespec-util.h"
+
+/*
+ * libwayland dispatches everything it read from a client in one go and
+ * has no way to pause a client, so a request flood cannot be cut short.
+ * What the budget bounds instead is the work the flood makes for the
+ * compositor: once a client has sent more requests than its budget in
+ * one event loop iteration, its commits without a target are folded
+ * into a single held back commit, applied when its output repaints, as
+ * for a synchronized subsurface. The requests are counted by a protocol
+ * logger; an idle callback marks the end of the iteration.
+ */
+struct weston_client_budget {
+	struct weston_compositor *compositor;
+	uint32_t budget;
+	struct wl_protocol_logger *logger;
+	struct wl_event_source *idle;
+	struct wl_list clients;		/* weston_client_requests::link */
+	struct weston_client_requests *last;
+	struct weston_log_scope *scope;
+};
+
+struct weston_client_requests {
+	struct weston_client_budget *cb;
+	struct wl_client *client;
+	struct wl_listener destroy_listener;
+	struct wl_list link;
+
+	struct timespec first_seen;
+	uint32_t iteration_requests;
+	uint32_t max_iteration_requests;
+	uint64_t requests;
+	uint64_t over_budget_iterations;
+	uint64_t deferred_commits;
+};
+
+static void
+client_requests_destroy(struct weston_client_requests *cr)
+{
+	if (cr->cb->last == cr)
+		cr->cb->last = NULL;
+	wl_list_remove(&cr->destroy_listener.link);
+	wl_list_remove(&cr->link);
+	free(cr);
+}
+
+static void
+client_requests_handle_destroy(struct wl_listener *listener, void *data)
+{
+	struct weston_client_requests *cr =
+		container_of(listener, struct weston_client_requests,
+			     destroy_listener);
+
+	client_requests_destroy(cr);
+}
+
+static struct weston_client_requests *
+client_requests_get(struct weston_client_budget *cb, struct wl_client *client)
+{
+	struct wl_listener *listener;
+
+	/* Requests mostly come in runs from the same client */
+	if (cb->last && cb->last->client == client)
+		return cb->last;
+
+	listener = wl_client_get_destroy_listener(client,
+						  client_requests_handle_destroy);
+	if (!listener)
+		return NULL;
+
+	cb->last = container_of(listener, struct weston_client_requests,
+				destroy_listener);
+	return cb->last;
+}
+
+static struct weston_client_requests *
+client_requests_ensure(struct weston_client_budget *cb,
+		       struct wl_client *client)
+{
+	struct weston_client_requests *cr;
+
+	cr = client_requests_get(cb, client);
+	if (cr)
+		return cr;
+
+	cr = zalloc(sizeof *cr);
+	if (!cr)
+		return NULL;
+
+	cr->cb = cb;
+	cr->client = client;
+	weston_compositor_get_time(&cr->first_seen);
+	cr->destroy_listener.notify = client_requests_handle_destroy;
+	wl_client_add_destroy_listener(client, &cr->destroy_listener);
+	wl_list_insert(&cb->clients, &cr->link);
+	cb->last = cr;
+
+	return cr;
+}
+
+static void
+client_budget_iteration_done(void *data)
+{
+	struct weston_client_budget *cb = data;
+	struct weston_client_requests *cr;
+
+	cb->idle = NULL;
+
+	wl_list_for_each(cr, &cb->clients, link) {
+		if (cr->iteration_requests == 0)
+			continue;
+
+		cr->requests += cr->iteration_requests;
+		if (cr->iteration_requests > cr->max_iteration_requests)
+			cr->max_iteration_requests = cr->iteration_requests;
+		if (cb->budget && cr->iteration_requests > cb->budget)
+			cr->over_budget_iterations++;
+		cr->iteration_requests = 0;
+	}
+}
+
+static void
+client_budget_logger(void *data, enum wl_protocol_logger_type direction,
+		     const struct wl_protocol_logger_message *message)
+{
+	struct weston_client_budget *cb = data;
+	struct weston_client_requests *cr;
+	struct wl_event_loop *loop;
+
+	if (direction != WL_PROTOCOL_LOGGER_REQUEST)
+		return;
+
+	cr = client_requests_ensure(cb, wl_resource_get_client(message->resource));
+	if (!cr)
+		return;
+
+	cr->iteration_requests++;
+
+	if (!cb->idle) {
+		loop = wl_display_get_event_loop(cb->compositor->wl_display);
+		cb->idle = wl_event_loop_add_idle(loop,
+						  client_budget_iteration_done,
+						  cb);
+	}
+}
+
+static void
+client_budget_start(struct weston_client_budget *cb)
+{
+	if (cb->logger)
+		return;
+
+	cb->logger = wl_display_add_protocol_logger(cb->compositor->wl_display,
+						    client_budget_logger, cb);
+}
+
+static void
+client_budget_print_cb(struct weston_log_subscription *sub, void *data)
+{
+	struct weston_client_budget *cb = data;
+	struct weston_client_requests *cr;
+	struct timespec now;
+	int64_t msec;
+	pid_t pid;
+
+	if (!cb->logger) {
+		/* Counting costs a callback per request, so it only starts
+		 * once somebody asks. */
+		client_budget_start(cb);
+		weston_log_subscription_printf(sub,
+			"request counting started, subscribe again for "
+			"counts\n");
+		weston_log_subscription_complete(sub);
+		return;
+	}
+
+	weston_compositor_get_time(&now);
+	weston_log_subscription_printf(sub, "budget: %u requests per "
+				       "iteration%s\n", cb->budget,
+				       cb->budget ? "" : " (off)");
+
+	wl_list_for_each(cr, &cb->clients, link) {
+		wl_client_get_credentials(cr->client, &pid, NULL, NULL);
+		msec = timespec_sub_to_msec(&now, &cr->first_seen);
+		weston_log_subscription_printf(sub,
+			"pid %d: %" PRIu64 " requests (%.1f/s), "
+			"max %u in one iteration, "
+			"%" PRIu64 " iterations over budget, "
+			"%" PRIu64 " deferred commits\n",
+			(int) pid, cr->requests,
+			msec > 0 ? cr->requests * 1000.0 / msec : 0.0,
+			cr->max_iteration_requests,
+			cr->over_budget_iterations, cr->deferred_commits);
+	}
+
+	weston_log_subscription_complete(sub);
+}
+
+int
+weston_compositor_init_client_budget(struct weston_compositor *ec)
+{
+	struct weston_client_budget *cb;
+
+	cb = zalloc(sizeof *cb);
+	if (!cb)
+		return -1;
+
+	cb->compositor = ec;
+	wl_list_init(&cb->clients);
+	cb->scope = weston_compositor_add_log_scope(ec, "client-requests",
+						    "Requests per client and "
+						    "event loop iteration\n",
+						    client_budget_print_cb,
+						    NULL, cb);
+	ec->client_budget = cb;
+
+	return 0;
+}
+
+void
+weston_compositor_fini_client_budget(struct weston_compositor *ec)
+{
+	struct weston_client_budget *cb = ec->client_budget;
+	struct weston_client_requests *cr, *tmp;
+
+	if (!cb)
+		return;
+
+	/* The clients outlive the compositor */
+	wl_list_for_each_safe(cr, tmp, &cb->clients, link)
+		client_requests_destroy(cr);
+
+	if (cb->idle)
+		wl_event_source_remove(cb->idle);
+	if (cb->logger)
+		wl_protocol_logger_destroy(cb->logger);
+	weston_log_scope_destroy(cb->scope);
+	free(cb);
+	ec->client_budget = NULL;
+}
+
+/** Whether a client has used up its budget in this iteration */
+bool
+weston_client_budget_exceeded(struct weston_compositor *ec,
+			      struct wl_client *client)
+{
+	struct weston_client_budget *cb = ec->client_budget;
+	struct weston_client_requests *cr;
+
+	if (!cb->budget)
+		return false;
+
+	cr = client_requests_get(cb, client);
+
+	return cr && cr->iteration_requests > cb->budget;
+}
+
+void
+weston_client_budget_note_deferred(struct weston_compositor *ec,
+				   struct wl_client *client)
+{
+	struct weston_client_requests *cr;
+
+	cr = client_requests_get(ec->client_budget, client);
+	if (cr)
+		cr->deferred_commits++;
+}
+
+/** Limit how many requests a client may send per event loop iteration
+ *
+ * \param ec The compositor.
+ * \param budget Requests per client and iteration, 0 for no limit.
+ *
+ * Past its budget, a client's commits without a presentation target are
+ * merged and held back until the repaint of its output, so that a flood
+ * of requests costs little more than parsing them. The "client-requests"
+ * debug scope prints the counters.
+ *
+ * \ingroup compositor
+ */
+WL_EXPORT void
+weston_compositor_set_client_request_budget(struct weston_compositor *ec,
+					    uint32_t budget)
+{
+	ec->client_budget->budget = budget;
+	if (budget)
+		client_budget_start(ec->client_budget);
+}
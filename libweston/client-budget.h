@@ -0,0 +1,47 @@
+/*
+ * Copyright © 2022 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef WESTON_CLIENT_BUDGET_H
+#define WESTON_CLIENT_BUDGET_H
+
+#include <stdbool.h>
+
+#include <libweston/libweston.h>
+
+int
+weston_compositor_init_client_budget(struct weston_compositor *ec);
+
+void
+weston_compositor_fini_client_budget(struct weston_compositor *ec);
+
+bool
+weston_client_budget_exceeded(struct weston_compositor *ec,
+			      struct wl_client *client);
+
+void
+weston_client_budget_note_deferred(struct weston_compositor *ec,
+				   struct wl_client *client);
+
+#endif /* WESTON_CLIENT_BUDGET_H */
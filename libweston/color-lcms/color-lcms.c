@@ -36,9 +36,10 @@
 static void
 cmlcms_destroy_color_transform(struct weston_color_transform *xform_base)
 {
+	struct weston_color_manager_lcms *cm = get_cmlcms(xform_base->cm);
 	struct cmlcms_color_transform *xform = get_xform(xform_base);
 
-	cmlcms_color_transform_destroy(xform);
+	cmlcms_color_transform_release(cm, xform);
 }
 
 static bool
@@ -50,23 +51,31 @@ cmlcms_get_surface_color_transform(struct weston_color_manager *cm_base,
 	struct weston_color_manager_lcms *cm = get_cmlcms(cm_base);
 	struct cmlcms_color_transform_search_param param = {
 		/*
-		 * Assumes both content and output color spaces are sRGB SDR.
-		 * This defines the blending space as optical sRGB SDR.
+		 * Assumes content color space is sRGB SDR. This defines the
+		 * blending space as optical sRGB SDR, whatever the output
+		 * color profile is.
 		 */
 		.type = CMLCMS_TYPE_EOTF_sRGB,
 	};
 	struct cmlcms_color_transform *xform;
 
-	/* TODO: use output color profile */
-	if (output->color_profile)
-		return false;
+	/*
+	 * The backend converts sRGB to the output color space on its own,
+	 * so the renderer blends electrical sRGB as is.
+	 */
+	if (output->from_blend_to_output_by_backend) {
+		surf_xform->transform = NULL;
+		surf_xform->identity_pipeline = true;
+		return true;
+	}
 
 	xform = cmlcms_color_transform_get(cm, &param);
 	if (!xform)
 		return false;
 
 	surf_xform->transform = &xform->base;
-	surf_xform->identity_pipeline = true;
+	/* Without an output profile, the output is assumed sRGB too. */
+	surf_xform->identity_pipeline = (output->color_profile == NULL);
 
 	return true;
 }
@@ -86,9 +95,10 @@ cmlcms_get_output_color_transform(struct weston_color_manager *cm_base,
 	};
 	struct cmlcms_color_transform *xform;
 
-	/* TODO: use output color profile */
-	if (output->color_profile)
-		return false;
+	if (output->color_profile) {
+		param.type = CMLCMS_TYPE_BLEND_TO_OUTPUT;
+		param.output_profile = get_cprof(output->color_profile);
+	}
 
 	xform = cmlcms_color_transform_get(cm, &param);
 	if (!xform)
@@ -103,15 +113,25 @@ cmlcms_get_sRGB_to_output_color_transform(struct weston_color_manager *cm_base,
 					  struct weston_output *output,
 					  struct weston_color_transform **xform_out)
 {
-	/* Assumes output color space is sRGB SDR */
+	struct weston_color_manager_lcms *cm = get_cmlcms(cm_base);
+	struct cmlcms_color_transform_search_param param = {
+		.type = CMLCMS_TYPE_sRGB_TO_OUTPUT,
+	};
+	struct cmlcms_color_transform *xform;
 
-	/* TODO: use output color profile */
-	if (output->color_profile)
-		return false;
+	/* Without a profile, the output color space is assumed sRGB SDR */
+	if (!output->color_profile) {
+		/* Identity transform */
+		*xform_out = NULL;
+		return true;
+	}
 
-	/* Identity transform */
-	*xform_out = NULL;
+	param.output_profile = get_cprof(output->color_profile);
+	xform = cmlcms_color_transform_get(cm, &param);
+	if (!xform)
+		return false;
 
+	*xform_out = &xform->base;
 	return true;
 }
 
@@ -127,10 +147,6 @@ cmlcms_get_sRGB_to_blend_color_transform(struct weston_color_manager *cm_base,
 	};
 	struct cmlcms_color_transform *xform;
 
-	/* TODO: use output color profile */
-	if (output->color_profile)
-		return false;
-
 	xform = cmlcms_color_transform_get(cm, &param);
 	if (!xform)
 		return false;
@@ -165,6 +181,14 @@ cmlcms_init(struct weston_color_manager *cm_base)
 
 	cmsSetLogErrorHandlerTHR(cm->lcms_ctx, lcms_error_logger);
 
+	cm->sRGB_profile = cmsCreate_sRGBProfileTHR(cm->lcms_ctx);
+	if (!cm->sRGB_profile) {
+		weston_log("color-lcms error: creating the sRGB profile failed.\n");
+		cmsDeleteContext(cm->lcms_ctx);
+		cm->lcms_ctx = NULL;
+		return false;
+	}
+
 	weston_log("LittleCMS %d initialized.\n", cmsGetEncodedCMMversion());
 
 	return true;
@@ -174,11 +198,22 @@ static void
 cmlcms_destroy(struct weston_color_manager *cm_base)
 {
 	struct weston_color_manager_lcms *cm = get_cmlcms(cm_base);
+	unsigned i;
 
-	assert(wl_list_empty(&cm->color_transform_list));
-	assert(wl_list_empty(&cm->color_profile_list));
+	/* Jobs and parked transforms hold the last references to output
+	 * profiles. */
+	cmlcms_worker_fini(cm);
+	cmlcms_color_transform_lru_flush(cm);
 
-	cmsDeleteContext(cm->lcms_ctx);
+	for (i = 0; i < CMLCMS_HASH_BUCKETS; i++) {
+		assert(wl_list_empty(&cm->color_transform_hash[i]));
+		assert(wl_list_empty(&cm->color_profile_hash[i]));
+	}
+
+	if (cm->sRGB_profile)
+		cmsCloseProfile(cm->sRGB_profile);
+	if (cm->lcms_ctx)
+		cmsDeleteContext(cm->lcms_ctx);
 	free(cm);
 }
 
@@ -186,6 +221,7 @@ WL_EXPORT struct weston_color_manager *
 weston_color_manager_create(struct weston_compositor *compositor)
 {
 	struct weston_color_manager_lcms *cm;
+	unsigned i;
 
 	cm = zalloc(sizeof *cm);
 	if (!cm)
@@ -207,8 +243,14 @@ weston_color_manager_create(struct weston_compositor *compositor)
 	cm->base.get_sRGB_to_blend_color_transform =
 	      cmlcms_get_sRGB_to_blend_color_transform;
 
-	wl_list_init(&cm->color_transform_list);
-	wl_list_init(&cm->color_profile_list);
+	for (i = 0; i < CMLCMS_HASH_BUCKETS; i++) {
+		wl_list_init(&cm->color_transform_hash[i]);
+		wl_list_init(&cm->color_profile_hash[i]);
+	}
+	wl_list_init(&cm->color_transform_lru);
+	wl_list_init(&cm->worker.queue);
+	wl_list_init(&cm->worker.done);
+	cm->worker.done_fd = -1;
 
 	return &cm->base;
 }
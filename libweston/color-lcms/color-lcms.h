@@ -28,17 +28,47 @@
 #define WESTON_COLOR_LCMS_H
 
 #include <lcms2.h>
+#include <pthread.h>
 #include <libweston/libweston.h>
 
 #include "color.h"
 #include "shared/helpers.h"
 
+/* Buckets in the transform and profile hash tables, a power of two */
+#define CMLCMS_HASH_BUCKETS 64
+
+/* Unreferenced transforms kept around for reuse */
+#define CMLCMS_TRANSFORM_LRU_MAX 16
+
 struct weston_color_manager_lcms {
 	struct weston_color_manager base;
 	cmsContext lcms_ctx;
 
-	struct wl_list color_transform_list; /* cmlcms_color_transform::link */
-	struct wl_list color_profile_list; /* cmlcms_color_profile::link */
+	/* source profile for content and blending, until clients can tag */
+	cmsHPROFILE sRGB_profile;
+
+	/* cmlcms_color_transform::link, by search parameters */
+	struct wl_list color_transform_hash[CMLCMS_HASH_BUCKETS];
+	/* cmlcms_color_transform::lru_link, most recently released first */
+	struct wl_list color_transform_lru;
+	unsigned color_transform_lru_len;
+
+	/* cmlcms_color_profile::link, by MD5 */
+	struct wl_list color_profile_hash[CMLCMS_HASH_BUCKETS];
+
+	/* Builds 3D LUT mappings off the main loop, see cmlcms_mapping_job */
+	struct {
+		bool running;
+		bool quit;
+		pthread_t thread;
+		pthread_mutex_t lock;
+		pthread_cond_t cond;
+		/* cmlcms_mapping_job::link, protected by lock */
+		struct wl_list queue;
+		struct wl_list done;
+		int done_fd;
+		struct wl_event_source *done_source;
+	} worker;
 };
 
 static inline struct weston_color_manager_lcms *
@@ -54,7 +84,7 @@ struct cmlcms_md5_sum {
 struct cmlcms_color_profile {
 	struct weston_color_profile base;
 
-	/* struct weston_color_manager_lcms::color_profile_list */
+	/* struct weston_color_manager_lcms::color_profile_hash */
 	struct wl_list link;
 
 	cmsHPROFILE profile;
@@ -85,23 +115,49 @@ cmlcms_destroy_color_profile(struct weston_color_profile *cprof_base);
 enum cmlcms_color_transform_type {
 	CMLCMS_TYPE_EOTF_sRGB = 0,
 	CMLCMS_TYPE_EOTF_sRGB_INV,
+	/* optical sRGB to output_profile */
+	CMLCMS_TYPE_BLEND_TO_OUTPUT,
+	/* electrical sRGB to output_profile */
+	CMLCMS_TYPE_sRGB_TO_OUTPUT,
 	CMLCMS_TYPE__END,
 };
 
 struct cmlcms_color_transform_search_param {
 	enum cmlcms_color_transform_type type;
+
+	/* destination for the types mapping to an output, NULL otherwise */
+	struct cmlcms_color_profile *output_profile;
 };
 
 struct cmlcms_color_transform {
 	struct weston_color_transform base;
 
-	/* weston_color_manager_lcms::color_transform_list */
+	/* weston_color_manager_lcms::color_transform_hash */
 	struct wl_list link;
 
+	/* weston_color_manager_lcms::color_transform_lru, while
+	 * base.ref_count is zero */
+	struct wl_list lru_link;
+
 	struct cmlcms_color_transform_search_param search_key;
 
-	/* for EOTF types */
+	/* for EOTF types, and the pre-curve of the types mapping to an output */
 	cmsToneCurve *curve;
+
+	/*
+	 * For the types mapping to an output: matrix-shaper output profiles
+	 * get a matrix and per-channel inverse TRCs, everything else goes
+	 * through a transform sampled into a 3D LUT.
+	 */
+	cmsToneCurve *post_curve[3];
+	cmsHTRANSFORM cmap_3dlut;
+
+	/* cmap_3dlut sampled by the last fill_in, to skip LCMS next time */
+	float *lut3d;
+	unsigned lut3d_len;
+
+	/* building cmap_3dlut on the worker, while base.pending */
+	struct cmlcms_mapping_job *job;
 };
 
 static inline struct cmlcms_color_transform *
@@ -114,7 +170,17 @@ struct cmlcms_color_transform *
 cmlcms_color_transform_get(struct weston_color_manager_lcms *cm,
 			   const struct cmlcms_color_transform_search_param *param);
 
+void
+cmlcms_color_transform_release(struct weston_color_manager_lcms *cm,
+			       struct cmlcms_color_transform *xform);
+
+void
+cmlcms_color_transform_lru_flush(struct weston_color_manager_lcms *cm);
+
 void
 cmlcms_color_transform_destroy(struct cmlcms_color_transform *xform);
 
+void
+cmlcms_worker_fini(struct weston_color_manager_lcms *cm);
+
 #endif /* WESTON_COLOR_LCMS_H */
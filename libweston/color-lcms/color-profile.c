@@ -66,13 +66,23 @@ validate_icc_profile(cmsHPROFILE profile, char **errmsg)
 	return true;
 }
 
+/* The MD5 is uniformly distributed already. */
+static struct wl_list *
+color_profile_bucket(struct weston_color_manager_lcms *cm,
+		     const struct cmlcms_md5_sum *md5sum)
+{
+	unsigned h = md5sum->bytes[0] | md5sum->bytes[1] << 8;
+
+	return &cm->color_profile_hash[h & (CMLCMS_HASH_BUCKETS - 1)];
+}
+
 static struct cmlcms_color_profile *
-cmlcms_find_color_profile_by_md5(const struct weston_color_manager_lcms *cm,
+cmlcms_find_color_profile_by_md5(struct weston_color_manager_lcms *cm,
 				 const struct cmlcms_md5_sum *md5sum)
 {
 	struct cmlcms_color_profile *cprof;
 
-	wl_list_for_each(cprof, &cm->color_profile_list, link) {
+	wl_list_for_each(cprof, color_profile_bucket(cm, md5sum), link) {
 		if (memcmp(cprof->md5sum.bytes,
 			   md5sum->bytes, sizeof(md5sum->bytes)) == 0)
 			return cprof;
@@ -97,7 +107,7 @@ cmlcms_color_profile_create(struct weston_color_manager_lcms *cm,
 	cprof->base.description = desc;
 	cprof->profile = profile;
 	cmsGetHeaderProfileID(profile, cprof->md5sum.bytes);
-	wl_list_insert(&cm->color_profile_list, &cprof->link);
+	wl_list_insert(color_profile_bucket(cm, &cprof->md5sum), &cprof->link);
 
 	return cprof;
 }
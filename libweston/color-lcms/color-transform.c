@@ -27,6 +27,12 @@
 #include "config.h"
 
 #include <assert.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
 #include <libweston/libweston.h>
 
 #include "color.h"
@@ -78,52 +84,575 @@ cmlcms_fill_in_tone_curve(struct weston_color_transform *xform_base,
 	}
 }
 
+static void
+cmlcms_fill_in_post_curve(struct weston_color_transform *xform_base,
+			  float *values, unsigned len)
+{
+	struct cmlcms_color_transform *xform = get_xform(xform_base);
+	unsigned ch, i;
+	cmsFloat32Number x;
+
+	assert(len > 1);
+
+	for (ch = 0; ch < 3; ch++) {
+		assert(xform->post_curve[ch] != NULL);
+		for (i = 0; i < len; i++) {
+			x = (double)i / (len - 1);
+			values[ch * len + i] =
+				cmsEvalToneCurveFloat(xform->post_curve[ch], x);
+		}
+	}
+}
+
+/* Also runs on the worker thread, so no logging here. */
+static void
+sample_3dlut(cmsHTRANSFORM cmap, float *lut, unsigned len)
+{
+	float divider = len - 1;
+	unsigned r, g, b;
+	float *rgb = lut;
+
+	for (b = 0; b < len; b++) {
+		for (g = 0; g < len; g++) {
+			for (r = 0; r < len; r++) {
+				rgb[0] = r / divider;
+				rgb[1] = g / divider;
+				rgb[2] = b / divider;
+				rgb += 3;
+			}
+		}
+	}
+
+	/* Input and output formats are identical, so LCMS can transform
+	 * the grid in place. */
+	cmsDoTransform(cmap, lut, lut, len * len * len);
+}
+
+static void
+cmlcms_fill_in_3dlut(struct weston_color_transform *xform_base,
+		     float *lut, unsigned len)
+{
+	struct cmlcms_color_transform *xform = get_xform(xform_base);
+
+	assert(xform->cmap_3dlut != NULL);
+	assert(len > 1);
+
+	if (xform->lut3d && xform->lut3d_len == len) {
+		memcpy(lut, xform->lut3d, len * len * len * 3 * sizeof *lut);
+		return;
+	}
+
+	sample_3dlut(xform->cmap_3dlut, lut, len);
+
+	/* Renderers drop their copy with the transform object, which can go
+	 * through the LRU and be revived; keep the samples around. */
+	free(xform->lut3d);
+	xform->lut3d = malloc(len * len * len * 3 * sizeof *lut);
+	xform->lut3d_len = xform->lut3d ? len : 0;
+	if (xform->lut3d)
+		memcpy(xform->lut3d, lut, len * len * len * 3 * sizeof *lut);
+}
+
+static cmsToneCurve *
+build_tone_curve(struct weston_color_manager_lcms *cm,
+		 enum cmlcms_color_transform_type type)
+{
+	const struct tone_curve_def *tonedef = &predefined_eotf_curves[type];
+	cmsToneCurve *curve;
+
+	curve = cmsBuildParametricToneCurve(cm->lcms_ctx,
+					    tonedef->cmstype,
+					    tonedef->params);
+	if (curve == NULL)
+		weston_log("color-lcms error: failed to build parametric tone curve.\n");
+
+	return curve;
+}
+
+static cmsHTRANSFORM
+build_output_mapping(struct weston_color_manager_lcms *cm,
+		     struct cmlcms_color_profile *output_profile)
+{
+	cmsHTRANSFORM cmap;
+
+	cmap = cmsCreateTransformTHR(cm->lcms_ctx,
+				     cm->sRGB_profile, TYPE_RGB_FLT,
+				     output_profile->profile, TYPE_RGB_FLT,
+				     INTENT_PERCEPTUAL, 0);
+	if (cmap == NULL)
+		weston_log("color-lcms error: failed to create a color mapping to '%s'.\n",
+			   output_profile->base.description);
+
+	return cmap;
+}
+
+/** A 3D LUT mapping built on the worker thread
+ *
+ * Creating the LCMS transform and sampling it into the 3D LUT is by far
+ * the most expensive part of a color transformation, easily longer than a
+ * frame. Until the job finishes, its transformation is pending: the
+ * mapping is left as identity, so a blend-to-output transformation
+ * re-encodes to sRGB and the output shows sRGB content unmapped for a
+ * frame or two.
+ *
+ * The worker only touches cmap and lut; all other fields belong to the
+ * main thread.
+ */
+struct cmlcms_mapping_job {
+	struct wl_list link;	/* worker.queue or worker.done */
+
+	/* NULL once the transformation has gone away */
+	struct cmlcms_color_transform *xform;
+	/* reference held for the worker */
+	struct cmlcms_color_profile *output_profile;
+
+	cmsHTRANSFORM cmap;
+	float *lut;
+	unsigned len;
+};
+
+/* 3D LUT size along each axis for the renderers */
+#define CMLCMS_3DLUT_LEN 33
+
+static void
+cmlcms_mapping_job_destroy(struct cmlcms_mapping_job *job)
+{
+	if (job->xform)
+		job->xform->job = NULL;
+	if (job->cmap)
+		cmsDeleteTransform(job->cmap);
+	free(job->lut);
+	weston_color_profile_unref(&job->output_profile->base);
+	free(job);
+}
+
+static void *
+cmlcms_worker_func(void *data)
+{
+	struct weston_color_manager_lcms *cm = data;
+	struct cmlcms_mapping_job *job;
+	uint64_t one = 1;
+	ssize_t ret;
+
+	pthread_mutex_lock(&cm->worker.lock);
+	while (!cm->worker.quit) {
+		if (wl_list_empty(&cm->worker.queue)) {
+			pthread_cond_wait(&cm->worker.cond, &cm->worker.lock);
+			continue;
+		}
+
+		job = wl_container_of(cm->worker.queue.next, job, link);
+		wl_list_remove(&job->link);
+		pthread_mutex_unlock(&cm->worker.lock);
+
+		/* Profiles are locked by LCMS itself, the main thread may
+		 * read them meanwhile. */
+		job->cmap = cmsCreateTransformTHR(cm->lcms_ctx,
+						  cm->sRGB_profile, TYPE_RGB_FLT,
+						  job->output_profile->profile,
+						  TYPE_RGB_FLT,
+						  INTENT_PERCEPTUAL, 0);
+		if (job->cmap) {
+			job->len = CMLCMS_3DLUT_LEN;
+			job->lut = malloc(job->len * job->len * job->len * 3 *
+					  sizeof *job->lut);
+			if (job->lut)
+				sample_3dlut(job->cmap, job->lut, job->len);
+		}
+
+		pthread_mutex_lock(&cm->worker.lock);
+		wl_list_insert(cm->worker.done.prev, &job->link);
+
+		do {
+			ret = write(cm->worker.done_fd, &one, sizeof one);
+		} while (ret < 0 && errno == EINTR);
+	}
+	pthread_mutex_unlock(&cm->worker.lock);
+
+	return NULL;
+}
+
+static void
+cmlcms_mapping_job_finish(struct cmlcms_mapping_job *job)
+{
+	struct cmlcms_color_transform *xform = job->xform;
+
+	if (!xform)
+		return;
+
+	xform->base.pending = false;
+
+	if (!job->cmap) {
+		weston_log("color-lcms error: failed to create a color mapping to '%s', "
+			   "keeping sRGB.\n", job->output_profile->base.description);
+		return;
+	}
+
+	xform->cmap_3dlut = job->cmap;
+	job->cmap = NULL;
+	xform->lut3d = job->lut;
+	xform->lut3d_len = job->lut ? job->len : 0;
+	job->lut = NULL;
+
+	xform->base.mapping.type = WESTON_COLOR_MAPPING_TYPE_3D_LUT;
+	xform->base.mapping.u.lut3d.fill_in = cmlcms_fill_in_3dlut;
+	xform->base.mapping.u.lut3d.optimal_len = CMLCMS_3DLUT_LEN;
+
+	weston_color_transform_changed(&xform->base);
+}
+
+static int
+cmlcms_worker_done(int fd, uint32_t mask, void *data)
+{
+	struct weston_color_manager_lcms *cm = data;
+	struct cmlcms_mapping_job *job, *tmp;
+	struct wl_list done;
+	uint64_t count;
+
+	if (read(fd, &count, sizeof count) < 0 && errno != EAGAIN)
+		weston_log("color-lcms: failed to read worker eventfd: %s\n",
+			   strerror(errno));
+
+	wl_list_init(&done);
+	pthread_mutex_lock(&cm->worker.lock);
+	wl_list_insert_list(&done, &cm->worker.done);
+	wl_list_init(&cm->worker.done);
+	pthread_mutex_unlock(&cm->worker.lock);
+
+	wl_list_for_each_safe(job, tmp, &done, link) {
+		wl_list_remove(&job->link);
+		cmlcms_mapping_job_finish(job);
+		cmlcms_mapping_job_destroy(job);
+	}
+
+	return 0;
+}
+
+static bool
+cmlcms_worker_start(struct weston_color_manager_lcms *cm)
+{
+	struct wl_event_loop *loop;
+
+	if (cm->worker.running)
+		return true;
+
+	cm->worker.done_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (cm->worker.done_fd < 0)
+		return false;
+
+	loop = wl_display_get_event_loop(cm->base.compositor->wl_display);
+	cm->worker.done_source = wl_event_loop_add_fd(loop, cm->worker.done_fd,
+						      WL_EVENT_READABLE,
+						      cmlcms_worker_done, cm);
+	if (!cm->worker.done_source)
+		goto err_fd;
+
+	pthread_mutex_init(&cm->worker.lock, NULL);
+	pthread_cond_init(&cm->worker.cond, NULL);
+	cm->worker.quit = false;
+	if (pthread_create(&cm->worker.thread, NULL,
+			   cmlcms_worker_func, cm) != 0) {
+		pthread_cond_destroy(&cm->worker.cond);
+		pthread_mutex_destroy(&cm->worker.lock);
+		wl_event_source_remove(cm->worker.done_source);
+		cm->worker.done_source = NULL;
+		goto err_fd;
+	}
+
+	cm->worker.running = true;
+	return true;
+
+err_fd:
+	close(cm->worker.done_fd);
+	cm->worker.done_fd = -1;
+	weston_log("color-lcms: no worker thread, building color mappings "
+		   "synchronously.\n");
+	return false;
+}
+
+/** Stop the worker and drop all its jobs, finished or not */
 void
-cmlcms_color_transform_destroy(struct cmlcms_color_transform *xform)
+cmlcms_worker_fini(struct weston_color_manager_lcms *cm)
 {
-	wl_list_remove(&xform->link);
+	struct cmlcms_mapping_job *job, *tmp;
+
+	if (!cm->worker.running)
+		return;
+
+	pthread_mutex_lock(&cm->worker.lock);
+	cm->worker.quit = true;
+	pthread_cond_signal(&cm->worker.cond);
+	pthread_mutex_unlock(&cm->worker.lock);
+	pthread_join(cm->worker.thread, NULL);
+
+	wl_list_insert_list(&cm->worker.done, &cm->worker.queue);
+	wl_list_init(&cm->worker.queue);
+	wl_list_for_each_safe(job, tmp, &cm->worker.done, link) {
+		wl_list_remove(&job->link);
+		cmlcms_mapping_job_destroy(job);
+	}
+
+	wl_event_source_remove(cm->worker.done_source);
+	cm->worker.done_source = NULL;
+	close(cm->worker.done_fd);
+	cm->worker.done_fd = -1;
+	pthread_cond_destroy(&cm->worker.cond);
+	pthread_mutex_destroy(&cm->worker.lock);
+	cm->worker.running = false;
+}
+
+/* Returns false when the mapping has to be built synchronously. */
+static bool
+cmlcms_mapping_job_queue(struct weston_color_manager_lcms *cm,
+			 struct cmlcms_color_transform *xform,
+			 struct cmlcms_color_profile *output_profile)
+{
+	struct cmlcms_mapping_job *job;
+
+	if (!cmlcms_worker_start(cm))
+		return false;
+
+	job = zalloc(sizeof *job);
+	if (!job)
+		return false;
+
+	job->xform = xform;
+	weston_color_profile_ref(&output_profile->base);
+	job->output_profile = output_profile;
+	xform->job = job;
+	xform->base.pending = true;
+
+	pthread_mutex_lock(&cm->worker.lock);
+	wl_list_insert(cm->worker.queue.prev, &job->link);
+	pthread_cond_signal(&cm->worker.cond);
+	pthread_mutex_unlock(&cm->worker.lock);
+
+	return true;
+}
+
+/* Columns are the XYZ (D50) of the red, green and blue primaries. */
+static bool
+get_colorant_matrix(cmsHPROFILE profile, struct weston_matrix *mat)
+{
+	static const cmsTagSignature tags[] = {
+		cmsSigRedColorantTag,
+		cmsSigGreenColorantTag,
+		cmsSigBlueColorantTag,
+	};
+	const cmsCIEXYZ *xyz;
+	unsigned i;
+
+	weston_matrix_init(mat);
+	mat->type = WESTON_MATRIX_TRANSFORM_OTHER;
+	for (i = 0; i < ARRAY_LENGTH(tags); i++) {
+		xyz = cmsReadTag(profile, tags[i]);
+		if (!xyz)
+			return false;
+
+		mat->d[i * 4 + 0] = xyz->X;
+		mat->d[i * 4 + 1] = xyz->Y;
+		mat->d[i * 4 + 2] = xyz->Z;
+	}
+
+	return true;
+}
+
+/*
+ * An RGB matrix-shaper output profile is exactly "linear sRGB to linear
+ * output RGB by a 3x3 matrix, then the inverse TRC per channel". This is
+ * cheaper for the renderer than a 3D LUT, and display hardware can often
+ * do it, too.
+ */
+static bool
+build_output_matrix_shaper(struct weston_color_manager_lcms *cm,
+			   struct cmlcms_color_transform *xform,
+			   struct cmlcms_color_profile *output_profile)
+{
+	static const cmsTagSignature trc_tags[] = {
+		cmsSigRedTRCTag,
+		cmsSigGreenTRCTag,
+		cmsSigBlueTRCTag,
+	};
+	cmsHPROFILE profile = output_profile->profile;
+	struct weston_matrix sRGB_mat, out_mat, out_inv;
+	struct weston_color_mapping_matrix *mapping;
+	const cmsToneCurve *trc;
+	unsigned i, j;
+
+	if (cmsGetColorSpace(profile) != cmsSigRgbData ||
+	    !cmsIsMatrixShaper(profile))
+		return false;
+
+	if (!get_colorant_matrix(cm->sRGB_profile, &sRGB_mat) ||
+	    !get_colorant_matrix(profile, &out_mat) ||
+	    weston_matrix_invert(&out_inv, &out_mat) < 0)
+		return false;
+
+	/* sRGB to XYZ, then XYZ to output */
+	weston_matrix_multiply(&sRGB_mat, &out_inv);
+
+	for (i = 0; i < ARRAY_LENGTH(trc_tags); i++) {
+		trc = cmsReadTag(profile, trc_tags[i]);
+		if (!trc)
+			return false;
+
+		xform->post_curve[i] = cmsReverseToneCurve(trc);
+		if (!xform->post_curve[i])
+			return false;
+	}
+
+	mapping = &xform->base.mapping.u.mat;
+	for (i = 0; i < 3; i++)
+		for (j = 0; j < 3; j++)
+			mapping->matrix[i * 3 + j] = sRGB_mat.d[i * 4 + j];
+
+	xform->base.mapping.type = WESTON_COLOR_MAPPING_TYPE_MATRIX;
+
+	xform->base.post_curve.type = WESTON_COLOR_CURVE_TYPE_LUT_3x1D;
+	xform->base.post_curve.u.lut_3x1d.fill_in = cmlcms_fill_in_post_curve;
+	xform->base.post_curve.u.lut_3x1d.optimal_len = 256;
+
+	return true;
+}
+
+static void
+cmlcms_color_transform_free(struct cmlcms_color_transform *xform)
+{
+	unsigned i;
+
+	for (i = 0; i < ARRAY_LENGTH(xform->post_curve); i++) {
+		if (xform->post_curve[i])
+			cmsFreeToneCurve(xform->post_curve[i]);
+	}
+	if (xform->cmap_3dlut)
+		cmsDeleteTransform(xform->cmap_3dlut);
 	if (xform->curve)
 		cmsFreeToneCurve(xform->curve);
+	free(xform->lut3d);
+	/* A running job finishes on its own and is then thrown away. */
+	if (xform->job)
+		xform->job->xform = NULL;
 	free(xform);
 }
 
+static unsigned
+search_param_hash(const struct cmlcms_color_transform_search_param *param)
+{
+	uint64_t h = (uintptr_t) param->output_profile;
+
+	h ^= (uint64_t) param->type << 56;
+	h *= 0x9e3779b97f4a7c15ull;
+
+	return (h >> 32) & (CMLCMS_HASH_BUCKETS - 1);
+}
+
+void
+cmlcms_color_transform_destroy(struct cmlcms_color_transform *xform)
+{
+	wl_list_remove(&xform->lru_link);
+	wl_list_remove(&xform->link);
+	if (xform->search_key.output_profile)
+		weston_color_profile_unref(&xform->search_key.output_profile->base);
+	cmlcms_color_transform_free(xform);
+}
+
 static struct cmlcms_color_transform *
 cmlcms_color_transform_create(struct weston_color_manager_lcms *cm,
 			const struct cmlcms_color_transform_search_param *param)
 {
 	struct cmlcms_color_transform *xform;
-	const struct tone_curve_def *tonedef;
 
 	if (param->type < 0 || param->type >= CMLCMS_TYPE__END) {
 		weston_log("color-lcms error: bad color transform type in %s.\n",
 			   __func__);
 		return NULL;
 	}
-	tonedef = &predefined_eotf_curves[param->type];
 
 	xform = zalloc(sizeof *xform);
 	if (!xform)
 		return NULL;
 
-	xform->curve = cmsBuildParametricToneCurve(cm->lcms_ctx,
-						   tonedef->cmstype,
-						   tonedef->params);
-	if (xform->curve == NULL) {
-		weston_log("color-lcms error: failed to build parametric tone curve.\n");
-		free(xform);
-		return NULL;
+	switch (param->type) {
+	case CMLCMS_TYPE_EOTF_sRGB:
+	case CMLCMS_TYPE_EOTF_sRGB_INV:
+		xform->curve = build_tone_curve(cm, param->type);
+		if (!xform->curve)
+			goto err;
+		break;
+	case CMLCMS_TYPE_BLEND_TO_OUTPUT:
+		if (!param->output_profile)
+			goto err;
+
+		/* Optical sRGB is already the matrix input. */
+		if (build_output_matrix_shaper(cm, xform,
+					       param->output_profile))
+			break;
+
+		/*
+		 * Re-encode the optical blending space as sRGB before the
+		 * 3D LUT, so that the LUT grid is spaced perceptually instead
+		 * of wasting most of its points on highlights.
+		 */
+		xform->curve = build_tone_curve(cm, CMLCMS_TYPE_EOTF_sRGB_INV);
+		if (!xform->curve)
+			goto err;
+		if (cmlcms_mapping_job_queue(cm, xform, param->output_profile))
+			break;
+		xform->cmap_3dlut = build_output_mapping(cm,
+							 param->output_profile);
+		if (!xform->cmap_3dlut)
+			goto err;
+		break;
+	case CMLCMS_TYPE_sRGB_TO_OUTPUT:
+		if (!param->output_profile)
+			goto err;
+
+		if (build_output_matrix_shaper(cm, xform,
+					       param->output_profile)) {
+			xform->curve = build_tone_curve(cm,
+							CMLCMS_TYPE_EOTF_sRGB);
+			if (!xform->curve)
+				goto err;
+			break;
+		}
+
+		if (cmlcms_mapping_job_queue(cm, xform, param->output_profile))
+			break;
+		xform->cmap_3dlut = build_output_mapping(cm,
+							 param->output_profile);
+		if (!xform->cmap_3dlut)
+			goto err;
+		break;
+	case CMLCMS_TYPE__END:
+		assert(0);
 	}
 
 	weston_color_transform_init(&xform->base, &cm->base);
 	xform->search_key = *param;
+	if (param->output_profile)
+		weston_color_profile_ref(&param->output_profile->base);
+
+	if (xform->curve) {
+		xform->base.pre_curve.type = WESTON_COLOR_CURVE_TYPE_LUT_3x1D;
+		xform->base.pre_curve.u.lut_3x1d.fill_in = cmlcms_fill_in_tone_curve;
+		xform->base.pre_curve.u.lut_3x1d.optimal_len = 256;
+	}
 
-	xform->base.pre_curve.type = WESTON_COLOR_CURVE_TYPE_LUT_3x1D;
-	xform->base.pre_curve.u.lut_3x1d.fill_in = cmlcms_fill_in_tone_curve;
-	xform->base.pre_curve.u.lut_3x1d.optimal_len = 256;
+	if (xform->cmap_3dlut) {
+		xform->base.mapping.type = WESTON_COLOR_MAPPING_TYPE_3D_LUT;
+		xform->base.mapping.u.lut3d.fill_in = cmlcms_fill_in_3dlut;
+		xform->base.mapping.u.lut3d.optimal_len = 33;
+	}
 
-	wl_list_insert(&cm->color_transform_list, &xform->link);
+	wl_list_insert(&cm->color_transform_hash[search_param_hash(param)],
+		       &xform->link);
+	wl_list_init(&xform->lru_link);
 
 	return xform;
+
+err:
+	cmlcms_color_transform_free(xform);
+	return NULL;
 }
 
 static bool
@@ -133,20 +662,71 @@ transform_matches_params(const struct cmlcms_color_transform *xform,
 	if (xform->search_key.type != param->type)
 		return false;
 
+	if (xform->search_key.output_profile != param->output_profile)
+		return false;
+
 	return true;
 }
 
+/** Keep an unreferenced transform for reuse
+ *
+ * Called when the last reference is gone. The destroy signal has already
+ * been emitted, so renderers and backends have dropped their state. The
+ * LCMS objects, which are the expensive part, stay until the transform
+ * falls off the end of the LRU, or is picked up again by
+ * cmlcms_color_transform_get(), e.g. when a monitor comes back.
+ */
+void
+cmlcms_color_transform_release(struct weston_color_manager_lcms *cm,
+			       struct cmlcms_color_transform *xform)
+{
+	struct cmlcms_color_transform *oldest;
+
+	assert(xform->base.ref_count == 0);
+
+	wl_list_insert(&cm->color_transform_lru, &xform->lru_link);
+	cm->color_transform_lru_len++;
+
+	if (cm->color_transform_lru_len > CMLCMS_TRANSFORM_LRU_MAX) {
+		oldest = wl_container_of(cm->color_transform_lru.prev,
+					 oldest, lru_link);
+		cm->color_transform_lru_len--;
+		cmlcms_color_transform_destroy(oldest);
+	}
+}
+
+void
+cmlcms_color_transform_lru_flush(struct weston_color_manager_lcms *cm)
+{
+	struct cmlcms_color_transform *xform, *tmp;
+
+	wl_list_for_each_safe(xform, tmp, &cm->color_transform_lru, lru_link)
+		cmlcms_color_transform_destroy(xform);
+	cm->color_transform_lru_len = 0;
+}
+
 struct cmlcms_color_transform *
 cmlcms_color_transform_get(struct weston_color_manager_lcms *cm,
 			   const struct cmlcms_color_transform_search_param *param)
 {
+	struct wl_list *bucket = &cm->color_transform_hash[search_param_hash(param)];
 	struct cmlcms_color_transform *xform;
 
-	wl_list_for_each(xform, &cm->color_transform_list, link) {
-		if (transform_matches_params(xform, param)) {
+	wl_list_for_each(xform, bucket, link) {
+		if (!transform_matches_params(xform, param))
+			continue;
+
+		if (xform->base.ref_count == 0) {
+			/* Revive from the LRU, with a fresh destroy signal. */
+			wl_list_remove(&xform->lru_link);
+			wl_list_init(&xform->lru_link);
+			cm->color_transform_lru_len--;
+			weston_color_transform_init(&xform->base, &cm->base);
+		} else {
 			weston_color_transform_ref(&xform->base);
-			return xform;
 		}
+
+		return xform;
 	}
 
 	xform = cmlcms_color_transform_create(cm, param);
@@ -165,6 +165,23 @@ weston_color_transform_init(struct weston_color_transform *xform,
 	wl_signal_init(&xform->destroy_signal);
 }
 
+/**
+ * Announce that the steps of a color transform have been replaced
+ *
+ * This is used only by color managers, when a pending transform got its
+ * precise steps. Renderers and backends drop their cached objects through
+ * the destroy signal, as if the transform had gone away, and build new
+ * ones the next time they use it. Every output is repainted.
+ */
+WL_EXPORT void
+weston_color_transform_changed(struct weston_color_transform *xform)
+{
+	wl_signal_emit(&xform->destroy_signal, xform);
+	wl_signal_init(&xform->destroy_signal);
+
+	weston_compositor_damage_all(xform->cm->compositor);
+}
+
 /** Deep copy */
 void
 weston_surface_color_transform_copy(struct weston_surface_color_transform *dst,
@@ -98,6 +98,71 @@ struct weston_color_curve {
 	} u;
 };
 
+enum weston_color_mapping_type {
+	/** Identity function, no-op */
+	WESTON_COLOR_MAPPING_TYPE_IDENTITY = 0,
+
+	/** Three-dimensional look-up table */
+	WESTON_COLOR_MAPPING_TYPE_3D_LUT,
+
+	/** Linear 3x3 matrix */
+	WESTON_COLOR_MAPPING_TYPE_MATRIX,
+};
+
+struct weston_color_mapping_3dlut {
+	/**
+	 * Approximate a color mapping with a 3D LUT
+	 *
+	 * A 3D LUT samples the mapping from the unit cube [0.0, 1.0]^3 to RGB
+	 * on a regular grid of len x len x len points. The first and last
+	 * grid points on each axis correspond to input values 0.0 and 1.0.
+	 * Between grid points, trilinear interpolation should be used.
+	 *
+	 * This function fills in the given array with the LUT values.
+	 *
+	 * \param xform This color transformation object.
+	 * \param lut Array of 3 x len x len x len elements. The RGB triplet
+	 * for input (r, g, b) grid indices is at 3 * (r + len * (g + len * b)),
+	 * that is, R index varies fastest.
+	 * \param len The number of grid points along each axis.
+	 */
+	void
+	(*fill_in)(struct weston_color_transform *xform,
+		   float *lut, unsigned len);
+
+	/** Optimal 3D LUT size along each axis for storage vs. precision */
+	unsigned optimal_len;
+};
+
+struct weston_color_mapping_matrix {
+	/**
+	 * 3x3 matrix, column-major like weston_matrix
+	 *
+	 * Output channel i is the sum over j of matrix[j * 3 + i] times
+	 * input channel j.
+	 */
+	float matrix[9];
+};
+
+/**
+ * A three-channel color space mapping
+ *
+ * This object represents a mapping from one RGB space to another, where
+ * the output channels may depend on all input channels, e.g. a gamut
+ * mapping between an input and an output ICC profile.
+ */
+struct weston_color_mapping {
+	/** Which member of 'u' defines the mapping. */
+	enum weston_color_mapping_type type;
+
+	/** Parameters for the mapping. */
+	union {
+		/* identity: no parameters */
+		struct weston_color_mapping_3dlut lut3d;
+		struct weston_color_mapping_matrix mat;
+	} u;
+};
+
 /**
  * Describes a color transformation formula
  *
@@ -115,6 +180,14 @@ struct weston_color_transform {
 	/* for renderer or backend to attach their own cached objects */
 	struct wl_signal destroy_signal;
 
+	/*
+	 * The color manager is still computing the precise steps; the ones
+	 * below are an interim approximation. They are replaced once, then
+	 * weston_color_transform_changed() drops all cached objects.
+	 * Backends should not commit to hardware state for such a transform.
+	 */
+	bool pending;
+
 	/* Color transform is the series of steps: */
 
 	/** Step 1: color model change */
@@ -124,10 +197,10 @@ struct weston_color_transform {
 	struct weston_color_curve pre_curve;
 
 	/** Step 3: color mapping */
-	/* TBD: e.g. a 3D LUT or a matrix */
+	struct weston_color_mapping mapping;
 
 	/** Step 4: color curve after color mapping */
-	/* struct weston_color_curve post_curve; */
+	struct weston_color_curve post_curve;
 };
 
 /**
@@ -286,6 +359,9 @@ void
 weston_color_transform_init(struct weston_color_transform *xform,
 			    struct weston_color_manager *cm);
 
+void
+weston_color_transform_changed(struct weston_color_transform *xform);
+
 void
 weston_surface_color_transform_copy(struct weston_surface_color_transform *dst,
 				    const struct weston_surface_color_transform *src);
@@ -54,12 +54,23 @@
 #include <inttypes.h>
 
 #include "timeline.h"
+#include "weston-probe.h"
+#include "content-hash.h"
+#include "frame-arena.h"
+#include "client-budget.h"
+#include "event-loop.h"
+#include "memory-pressure.h"
+#include "object-pool.h"
+#include "watchdog.h"
+#include "shm-udmabuf.h"
+#include "frame-stats.h"
 
 #include <libweston/libweston.h>
 #include <libweston/weston-log.h>
 #include "linux-dmabuf.h"
 #include "viewporter-server-protocol.h"
 #include "presentation-time-server-protocol.h"
+#include "weston-commit-timing-server-protocol.h"
 #include "xdg-output-unstable-v1-server-protocol.h"
 #include "linux-explicit-synchronization-unstable-v1-server-protocol.h"
 #include "linux-explicit-synchronization.h"
@@ -86,6 +97,9 @@
  */
 
 #define DEFAULT_REPAINT_WINDOW 7 /* milliseconds */
+#define DEFAULT_REPAINT_WINDOW_PERCENTILE 95
+/* Adaptive repaint window needs this many samples before it kicks in */
+#define REPAINT_TIME_MIN_SAMPLES 8
 
 static void
 weston_output_update_matrix(struct weston_output *output);
@@ -98,6 +112,12 @@ static void
 weston_compositor_build_view_list(struct weston_compositor *compositor,
 				  struct weston_output *output);
 
+static void
+weston_compositor_view_list_dirty(struct weston_compositor *compositor);
+
+static void
+weston_compositor_pick_grid_dirty(struct weston_compositor *compositor);
+
 static char *
 weston_output_create_heads_string(struct weston_output *output);
 
@@ -111,7 +131,7 @@ weston_paint_node_create(struct weston_surface *surface,
 
 	assert(view->surface == surface);
 
-	pnode = zalloc(sizeof *pnode);
+	pnode = weston_object_pool_alloc(surface->compositor->paint_node_pool);
 	if (!pnode)
 		return NULL;
 
@@ -154,7 +174,27 @@ weston_paint_node_destroy(struct weston_paint_node *pnode)
 	wl_list_remove(&pnode->z_order_link);
 	assert(pnode->surf_xform_valid || !pnode->surf_xform.transform);
 	weston_surface_color_transform_fini(&pnode->surf_xform);
-	free(pnode);
+	if (pnode->renderer_cache)
+		pnode->renderer_cache_destroy(pnode->renderer_cache);
+	weston_object_pool_free(pnode);
+}
+
+static void
+weston_view_dirty_paint_nodes(struct weston_view *view)
+{
+	struct weston_paint_node *pnode;
+
+	wl_list_for_each(pnode, &view->paint_node_list, view_link)
+		pnode->renderer_cache_dirty = true;
+}
+
+static void
+weston_surface_dirty_paint_nodes(struct weston_surface *surface)
+{
+	struct weston_paint_node *pnode;
+
+	wl_list_for_each(pnode, &surface->paint_node_list, surface_link)
+		pnode->renderer_cache_dirty = true;
 }
 
 /** Send wl_output events for mode and scale changes
@@ -377,12 +417,47 @@ region_init_infinite(pixman_region32_t *region)
 static struct weston_subsurface *
 weston_surface_to_subsurface(struct weston_surface *surface);
 
+/* Remember a dirty view for weston_compositor_update_transforms() */
+static void
+weston_view_queue_transform_update(struct weston_view *view)
+{
+	struct weston_compositor *compositor = view->surface->compositor;
+	struct weston_view **slot;
+
+	if (view->transform.dirty_slot)
+		return;
+
+	slot = wl_array_add(&compositor->transform_dirty_views, sizeof *slot);
+	if (!slot) {
+		/* The next full update pass will find it anyway */
+		compositor->view_list_needs_rebuild = true;
+		return;
+	}
+
+	*slot = view;
+	view->transform.dirty_slot =
+		compositor->transform_dirty_views.size / sizeof *slot;
+}
+
+static void
+weston_view_unqueue_transform_update(struct weston_view *view)
+{
+	struct weston_compositor *compositor = view->surface->compositor;
+	struct weston_view **views = compositor->transform_dirty_views.data;
+
+	if (!view->transform.dirty_slot)
+		return;
+
+	views[view->transform.dirty_slot - 1] = NULL;
+	view->transform.dirty_slot = 0;
+}
+
 WL_EXPORT struct weston_view *
 weston_view_create(struct weston_surface *surface)
 {
 	struct weston_view *view;
 
-	view = zalloc(sizeof *view);
+	view = weston_object_pool_alloc(surface->compositor->view_pool);
 	if (view == NULL)
 		return NULL;
 
@@ -410,6 +485,7 @@ weston_view_create(struct weston_surface *surface)
 	pixman_region32_init(&view->geometry.scissor);
 	pixman_region32_init(&view->transform.boundingbox);
 	view->transform.dirty = 1;
+	weston_view_queue_transform_update(view);
 
 	return view;
 }
@@ -526,6 +602,8 @@ weston_surface_state_init(struct weston_surface_state *state)
 	pixman_region32_init(&state->damage_buffer);
 	pixman_region32_init(&state->opaque);
 	region_init_infinite(&state->input);
+	state->opaque_serial = 0;
+	state->input_serial = 0;
 
 	wl_list_init(&state->frame_callback_list);
 	wl_list_init(&state->feedback_list);
@@ -540,6 +618,10 @@ weston_surface_state_init(struct weston_surface_state *state)
 
 	state->desired_protection = WESTON_HDCP_DISABLE;
 	state->protection_mode = WESTON_SURFACE_PROTECTION_MODE_RELAXED;
+
+	state->async_present = false;
+	state->content_type = WESTON_SURFACE_CONTENT_TYPE_NONE;
+	state->has_target = false;
 }
 
 static void
@@ -580,12 +662,29 @@ weston_surface_state_set_buffer(struct weston_surface_state *state,
 			      &state->buffer_destroy_listener);
 }
 
+/** A wl_surface.commit held back by weston_commit_timer_v1 */
+struct weston_commit_queue_entry {
+	struct wl_list link; /* weston_surface::commit_queue */
+	struct weston_surface_state state;
+	/* Keeps the buffer from being released while queued */
+	struct weston_buffer_reference buffer_ref;
+};
+
+static void
+weston_commit_queue_entry_destroy(struct weston_commit_queue_entry *entry)
+{
+	wl_list_remove(&entry->link);
+	weston_buffer_reference(&entry->buffer_ref, NULL);
+	weston_surface_state_fini(&entry->state);
+	free(entry);
+}
+
 WL_EXPORT struct weston_surface *
 weston_surface_create(struct weston_compositor *compositor)
 {
 	struct weston_surface *surface;
 
-	surface = zalloc(sizeof *surface);
+	surface = weston_object_pool_alloc(compositor->surface_pool);
 	if (surface == NULL)
 		return NULL;
 
@@ -605,12 +704,18 @@ weston_surface_create(struct weston_compositor *compositor)
 	pixman_region32_init(&surface->damage);
 	pixman_region32_init(&surface->opaque);
 	region_init_infinite(&surface->input);
+	/* The first commit clips the regions, whatever the size. */
+	surface->region_width = -1;
+	surface->region_height = -1;
 
 	wl_list_init(&surface->views);
 	wl_list_init(&surface->paint_node_list);
 
 	wl_list_init(&surface->frame_callback_list);
 	wl_list_init(&surface->feedback_list);
+	wl_list_init(&surface->frame_throttle_link);
+	wl_list_init(&surface->commit_queue);
+	wl_list_init(&surface->commit_queue_link);
 
 	wl_list_init(&surface->subsurface_list);
 	wl_list_init(&surface->subsurface_list_pending);
@@ -778,6 +883,62 @@ weston_transformed_rect(int width, int height,
 	return ret;
 }
 
+/* Regions with at most this many boxes are transformed without going
+ * through the heap. */
+#define REGION_TRANSFORM_STACK_BOXES 32
+
+/* An axis-aligned map of box corners, x' = xx * x + xy * y + x0 and
+ * y' = yx * x + yy * y + y0. */
+struct box_affine {
+	float xx, xy, x0;
+	float yx, yy, y0;
+};
+
+struct box_affine_int {
+	int32_t xx, xy, x0;
+	int32_t yx, yy, y0;
+};
+
+static void
+transform_boxes(pixman_box32_t *dest, const pixman_box32_t *src, int nrects,
+		const struct box_affine *a)
+{
+	float ax, ay, bx, by;
+	int i;
+
+	for (i = 0; i < nrects; i++) {
+		ax = a->xx * src[i].x1 + a->xy * src[i].y1 + a->x0;
+		ay = a->yx * src[i].x1 + a->yy * src[i].y1 + a->y0;
+		bx = a->xx * src[i].x2 + a->xy * src[i].y2 + a->x0;
+		by = a->yx * src[i].x2 + a->yy * src[i].y2 + a->y0;
+
+		dest[i].x1 = floor(MIN(ax, bx));
+		dest[i].x2 = ceil(MAX(ax, bx));
+		dest[i].y1 = floor(MIN(ay, by));
+		dest[i].y2 = ceil(MAX(ay, by));
+	}
+}
+
+static void
+transform_boxes_int(pixman_box32_t *dest, const pixman_box32_t *src,
+		    int nrects, const struct box_affine_int *a)
+{
+	int32_t ax, ay, bx, by;
+	int i;
+
+	for (i = 0; i < nrects; i++) {
+		ax = a->xx * src[i].x1 + a->xy * src[i].y1 + a->x0;
+		ay = a->yx * src[i].x1 + a->yy * src[i].y1 + a->y0;
+		bx = a->xx * src[i].x2 + a->xy * src[i].y2 + a->x0;
+		by = a->yx * src[i].x2 + a->yy * src[i].y2 + a->y0;
+
+		dest[i].x1 = MIN(ax, bx);
+		dest[i].x2 = MAX(ax, bx);
+		dest[i].y1 = MIN(ay, by);
+		dest[i].y2 = MAX(ay, by);
+	}
+}
+
 /** Transform a region by a matrix, restricted to axis-aligned transformations
  *
  * Warning: This function does not work for projective, affine, or matrices
@@ -789,13 +950,40 @@ weston_matrix_transform_region(pixman_region32_t *dest,
 			       struct weston_matrix *matrix,
 			       pixman_region32_t *src)
 {
+	pixman_box32_t stack_rects[REGION_TRANSFORM_STACK_BOXES];
 	pixman_box32_t *src_rects, *dest_rects;
 	int nrects, i;
 
-	src_rects = pixman_region32_rectangles(src, &nrects);
-	dest_rects = malloc(nrects * sizeof(*dest_rects));
-	if (!dest_rects)
+	/* Views mostly sit at integer positions, which pixman can apply
+	 * without rebuilding the region. */
+	if ((matrix->type & ~WESTON_MATRIX_TRANSFORM_TRANSLATE) == 0 &&
+	    matrix->d[12] == floorf(matrix->d[12]) &&
+	    matrix->d[13] == floorf(matrix->d[13])) {
+		pixman_region32_copy(dest, src);
+		pixman_region32_translate(dest, matrix->d[12], matrix->d[13]);
 		return;
+	}
+
+	src_rects = pixman_region32_rectangles(src, &nrects);
+	if (nrects <= REGION_TRANSFORM_STACK_BOXES) {
+		dest_rects = stack_rects;
+	} else {
+		dest_rects = malloc(nrects * sizeof(*dest_rects));
+		if (!dest_rects)
+			return;
+	}
+
+	if (!(matrix->type & WESTON_MATRIX_TRANSFORM_OTHER)) {
+		/* Without projection w stays 1, and the corners map
+		 * through the top two rows of the matrix. */
+		struct box_affine a = {
+			.xx = matrix->d[0], .xy = matrix->d[4], .x0 = matrix->d[12],
+			.yx = matrix->d[1], .yy = matrix->d[5], .y0 = matrix->d[13],
+		};
+
+		transform_boxes(dest_rects, src_rects, nrects, &a);
+		goto out;
+	}
 
 	for (i = 0; i < nrects; i++) {
 		struct weston_vector vec1 = {{
@@ -829,9 +1017,11 @@ weston_matrix_transform_region(pixman_region32_t *dest,
 		}
 	}
 
+out:
 	pixman_region32_clear(dest);
 	pixman_region32_init_rects(dest, dest_rects, nrects);
-	free(dest_rects);
+	if (dest_rects != stack_rects)
+		free(dest_rects);
 }
 
 /** Transform a region to buffer coordinates
@@ -858,8 +1048,10 @@ weston_transformed_region(int width, int height,
 			  int32_t scale,
 			  pixman_region32_t *src, pixman_region32_t *dest)
 {
+	pixman_box32_t stack_rects[REGION_TRANSFORM_STACK_BOXES];
 	pixman_box32_t *src_rects, *dest_rects;
-	int nrects, i;
+	struct box_affine_int a;
+	int nrects;
 
 	if (transform == WL_OUTPUT_TRANSFORM_NORMAL && scale == 1) {
 		if (src != dest)
@@ -867,81 +1059,56 @@ weston_transformed_region(int width, int height,
 		return;
 	}
 
-	src_rects = pixman_region32_rectangles(src, &nrects);
-	dest_rects = malloc(nrects * sizeof(*dest_rects));
-	if (!dest_rects)
-		return;
+	switch (transform) {
+	default:
+	case WL_OUTPUT_TRANSFORM_NORMAL:
+		a = (struct box_affine_int) { 1, 0, 0,  0, 1, 0 };
+		break;
+	case WL_OUTPUT_TRANSFORM_90:
+		a = (struct box_affine_int) { 0, 1, 0,  -1, 0, width };
+		break;
+	case WL_OUTPUT_TRANSFORM_180:
+		a = (struct box_affine_int) { -1, 0, width,  0, -1, height };
+		break;
+	case WL_OUTPUT_TRANSFORM_270:
+		a = (struct box_affine_int) { 0, -1, height,  1, 0, 0 };
+		break;
+	case WL_OUTPUT_TRANSFORM_FLIPPED:
+		a = (struct box_affine_int) { -1, 0, width,  0, 1, 0 };
+		break;
+	case WL_OUTPUT_TRANSFORM_FLIPPED_90:
+		a = (struct box_affine_int) { 0, 1, 0,  1, 0, 0 };
+		break;
+	case WL_OUTPUT_TRANSFORM_FLIPPED_180:
+		a = (struct box_affine_int) { 1, 0, 0,  0, -1, height };
+		break;
+	case WL_OUTPUT_TRANSFORM_FLIPPED_270:
+		a = (struct box_affine_int) { 0, -1, height,  -1, 0, width };
+		break;
+	}
+
+	a.xx *= scale;
+	a.xy *= scale;
+	a.x0 *= scale;
+	a.yx *= scale;
+	a.yy *= scale;
+	a.y0 *= scale;
 
-	if (transform == WL_OUTPUT_TRANSFORM_NORMAL) {
-		memcpy(dest_rects, src_rects, nrects * sizeof(*dest_rects));
+	src_rects = pixman_region32_rectangles(src, &nrects);
+	if (nrects <= REGION_TRANSFORM_STACK_BOXES) {
+		dest_rects = stack_rects;
 	} else {
-		for (i = 0; i < nrects; i++) {
-			switch (transform) {
-			default:
-			case WL_OUTPUT_TRANSFORM_NORMAL:
-				dest_rects[i].x1 = src_rects[i].x1;
-				dest_rects[i].y1 = src_rects[i].y1;
-				dest_rects[i].x2 = src_rects[i].x2;
-				dest_rects[i].y2 = src_rects[i].y2;
-				break;
-			case WL_OUTPUT_TRANSFORM_90:
-				dest_rects[i].x1 = src_rects[i].y1;
-				dest_rects[i].y1 = width - src_rects[i].x2;
-				dest_rects[i].x2 = src_rects[i].y2;
-				dest_rects[i].y2 = width - src_rects[i].x1;
-				break;
-			case WL_OUTPUT_TRANSFORM_180:
-				dest_rects[i].x1 = width - src_rects[i].x2;
-				dest_rects[i].y1 = height - src_rects[i].y2;
-				dest_rects[i].x2 = width - src_rects[i].x1;
-				dest_rects[i].y2 = height - src_rects[i].y1;
-				break;
-			case WL_OUTPUT_TRANSFORM_270:
-				dest_rects[i].x1 = height - src_rects[i].y2;
-				dest_rects[i].y1 = src_rects[i].x1;
-				dest_rects[i].x2 = height - src_rects[i].y1;
-				dest_rects[i].y2 = src_rects[i].x2;
-				break;
-			case WL_OUTPUT_TRANSFORM_FLIPPED:
-				dest_rects[i].x1 = width - src_rects[i].x2;
-				dest_rects[i].y1 = src_rects[i].y1;
-				dest_rects[i].x2 = width - src_rects[i].x1;
-				dest_rects[i].y2 = src_rects[i].y2;
-				break;
-			case WL_OUTPUT_TRANSFORM_FLIPPED_90:
-				dest_rects[i].x1 = src_rects[i].y1;
-				dest_rects[i].y1 = src_rects[i].x1;
-				dest_rects[i].x2 = src_rects[i].y2;
-				dest_rects[i].y2 = src_rects[i].x2;
-				break;
-			case WL_OUTPUT_TRANSFORM_FLIPPED_180:
-				dest_rects[i].x1 = src_rects[i].x1;
-				dest_rects[i].y1 = height - src_rects[i].y2;
-				dest_rects[i].x2 = src_rects[i].x2;
-				dest_rects[i].y2 = height - src_rects[i].y1;
-				break;
-			case WL_OUTPUT_TRANSFORM_FLIPPED_270:
-				dest_rects[i].x1 = height - src_rects[i].y2;
-				dest_rects[i].y1 = width - src_rects[i].x2;
-				dest_rects[i].x2 = height - src_rects[i].y1;
-				dest_rects[i].y2 = width - src_rects[i].x1;
-				break;
-			}
-		}
+		dest_rects = malloc(nrects * sizeof(*dest_rects));
+		if (!dest_rects)
+			return;
 	}
 
-	if (scale != 1) {
-		for (i = 0; i < nrects; i++) {
-			dest_rects[i].x1 *= scale;
-			dest_rects[i].x2 *= scale;
-			dest_rects[i].y1 *= scale;
-			dest_rects[i].y2 *= scale;
-		}
-	}
+	transform_boxes_int(dest_rects, src_rects, nrects, &a);
 
 	pixman_region32_clear(dest);
 	pixman_region32_init_rects(dest, dest_rects, nrects);
-	free(dest_rects);
+	if (dest_rects != stack_rects)
+		free(dest_rects);
 }
 
 static void
@@ -1377,7 +1544,7 @@ weston_view_assign_output(struct weston_view *ev)
 	mask = 0;
 	pixman_region32_init(&region);
 	wl_list_for_each(output, &ec->output_list, link) {
-		if (output->destroying)
+		if (output->destroying || output->mirror)
 			continue;
 
 		pixman_region32_intersect(&region, &ev->transform.boundingbox,
@@ -1532,6 +1699,18 @@ weston_view_update_transform_disable(struct weston_view *view)
 	}
 }
 
+static bool
+layer_has_offset(const struct weston_layer *layer)
+{
+	return layer && (layer->offset.x != 0.0f || layer->offset.y != 0.0f);
+}
+
+static bool
+view_has_layer_offset(struct weston_view *view)
+{
+	return layer_has_offset(view->layer_link.layer);
+}
+
 static int
 weston_view_update_transform_enable(struct weston_view *view)
 {
@@ -1553,8 +1732,12 @@ weston_view_update_transform_enable(struct weston_view *view)
 	wl_list_for_each(tform, &view->geometry.transformation_list, link)
 		weston_matrix_multiply(matrix, &tform->matrix);
 
+	/* Children inherit the offset through the parent's matrix. */
 	if (parent)
 		weston_matrix_multiply(matrix, &parent->transform.matrix);
+	else if (view_has_layer_offset(view))
+		weston_matrix_translate(matrix, view->layer_link.layer->offset.x,
+					view->layer_link.layer->offset.y, 0);
 
 	if (weston_matrix_invert(inverse, matrix) < 0) {
 		/* Oops, bad total transformation, not invertible */
@@ -1611,6 +1794,8 @@ weston_view_update_transform(struct weston_view *view)
 		weston_view_update_transform(parent);
 
 	view->transform.dirty = 0;
+	weston_compositor_pick_grid_dirty(view->surface->compositor);
+	weston_view_dirty_paint_nodes(view);
 
 	weston_view_damage_below(view);
 
@@ -1623,7 +1808,7 @@ weston_view_update_transform(struct weston_view *view)
 	    &view->transform.position.link &&
 	    view->geometry.transformation_list.prev ==
 	    &view->transform.position.link &&
-	    !parent) {
+	    !parent && !view_has_layer_offset(view)) {
 		weston_view_update_transform_disable(view);
 	} else {
 		if (weston_view_update_transform_enable(view) < 0)
@@ -1664,12 +1849,48 @@ weston_view_geometry_dirty(struct weston_view *view)
 		return;
 
 	view->transform.dirty = 1;
+	weston_view_queue_transform_update(view);
 
 	wl_list_for_each(child, &view->geometry.child_list,
 			 geometry.parent_link)
 		weston_view_geometry_dirty(child);
 }
 
+/** Bring the transforms of all dirty views up to date
+ *
+ * One pass over the views dirtied since the previous pass, instead of
+ * a walk over every view in the scene graph per repaint. Each view gets
+ * its matrices and bounding box computed once: parents are updated
+ * before their children by weston_view_update_transform(), and views
+ * already updated on demand are clean and skipped.
+ *
+ * Updates can dirty more views through the transform signal, those are
+ * queued behind and handled in the same pass. The views updated are the
+ * ones of view_list, the same as the walk this replaces.
+ */
+static void
+weston_compositor_update_transforms(struct weston_compositor *compositor)
+{
+	struct wl_array *queue = &compositor->transform_dirty_views;
+	struct weston_view *view;
+	size_t i;
+
+	for (i = 0; i < queue->size / sizeof view; i++) {
+		view = ((struct weston_view **) queue->data)[i];
+		if (!view)
+			continue;
+
+		view->transform.dirty_slot = 0;
+
+		/* Views outside view_list are updated by view_list_add()
+		 * once they get mapped. */
+		if (!wl_list_empty(&view->link))
+			weston_view_update_transform(view);
+	}
+
+	queue->size = 0;
+}
+
 WL_EXPORT void
 weston_view_to_global_fixed(struct weston_view *view,
 			    wl_fixed_t vx, wl_fixed_t vy,
@@ -1823,6 +2044,9 @@ weston_view_set_transform_parent(struct weston_view *view,
 			view->geometry.scissor_enabled = false;
 	}
 
+	if (view->geometry.parent != parent)
+		weston_compositor_view_list_dirty(view->surface->compositor);
+
 	view->geometry.parent = parent;
 
 	view->geometry.parent_destroy_listener.notify =
@@ -1907,6 +2131,41 @@ weston_view_set_mask(struct weston_view *view,
 	weston_view_schedule_repaint(view);
 }
 
+/** Tell the backend how a view would like to be composited
+ *
+ * \param view The view to hint.
+ * \param hint The placement hint, or NULL to drop any previous one.
+ *
+ * The hint is advisory: a view still goes to the renderer if no plane can
+ * show it. With a fixed zpos, only a plane that can stack the view at
+ * exactly that position is considered, which keeps the placement the same
+ * from frame to frame.
+ *
+ * This function schedules a repaint for the view if the hint changed.
+ */
+WL_EXPORT void
+weston_view_set_plane_hint(struct weston_view *view,
+			   const struct weston_view_plane_hint *hint)
+{
+	struct weston_view_plane_hint none = {
+		.preference = WESTON_VIEW_PLANE_PREFER_NONE,
+	};
+
+	if (!hint)
+		hint = &none;
+
+	if (view->plane_hint.preference == hint->preference &&
+	    view->plane_hint.fixed_zpos == hint->fixed_zpos &&
+	    (!hint->fixed_zpos || view->plane_hint.zpos == hint->zpos))
+		return;
+
+	view->plane_hint = *hint;
+	if (!view->plane_hint.fixed_zpos)
+		view->plane_hint.zpos = 0;
+
+	weston_view_schedule_repaint(view);
+}
+
 /** Remove the clip mask from a view
  *
  * \param view The view to remove the clip mask from.
@@ -2155,39 +2414,213 @@ weston_compositor_get_time(struct timespec *time)
 /** weston_compositor_pick_view
  * \ingroup compositor
  */
-WL_EXPORT struct weston_view *
-weston_compositor_pick_view(struct weston_compositor *compositor,
-			    wl_fixed_t x, wl_fixed_t y,
-			    wl_fixed_t *vx, wl_fixed_t *vy)
+#define PICK_GRID_CELL_SHIFT 7 /* 128x128 pixel cells */
+#define PICK_GRID_MAX_CELLS (1 << 16)
+
+static void
+weston_compositor_pick_grid_dirty(struct weston_compositor *compositor)
+{
+	compositor->pick_grid.dirty = true;
+}
+
+static void
+pick_grid_release(struct weston_compositor *compositor)
+{
+	free(compositor->pick_grid.cell_start);
+	free(compositor->pick_grid.views);
+	compositor->pick_grid.cell_start = NULL;
+	compositor->pick_grid.views = NULL;
+	compositor->pick_grid.cols = 0;
+	compositor->pick_grid.rows = 0;
+}
+
+/* Clip a view's bounding box to the grid, returning false if it does not
+ * touch the grid at all. The resulting cell range is inclusive.
+ */
+static bool
+pick_grid_view_cells(struct weston_compositor *compositor,
+		     struct weston_view *view,
+		     int *col1, int *row1, int *col2, int *row2)
+{
+	const pixman_box32_t *grid = &compositor->pick_grid.extents;
+	const pixman_box32_t *box;
+	int x1, y1, x2, y2;
+
+	if (!pixman_region32_not_empty(&view->transform.boundingbox))
+		return false;
+
+	box = pixman_region32_extents(&view->transform.boundingbox);
+	x1 = MAX(box->x1, grid->x1);
+	y1 = MAX(box->y1, grid->y1);
+	x2 = MIN(box->x2, grid->x2);
+	y2 = MIN(box->y2, grid->y2);
+	if (x1 >= x2 || y1 >= y2)
+		return false;
+
+	*col1 = (x1 - grid->x1) >> PICK_GRID_CELL_SHIFT;
+	*row1 = (y1 - grid->y1) >> PICK_GRID_CELL_SHIFT;
+	*col2 = (x2 - 1 - grid->x1) >> PICK_GRID_CELL_SHIFT;
+	*row2 = (y2 - 1 - grid->y1) >> PICK_GRID_CELL_SHIFT;
+
+	return true;
+}
+
+/* Bucket every view of view_list into the grid cells its bounding box
+ * overlaps. The buckets are stored back to back in one array, and since
+ * view_list is walked top to bottom, each bucket stays in z-order.
+ */
+static void
+pick_grid_rebuild(struct weston_compositor *compositor)
 {
+	struct weston_output *output;
 	struct weston_view *view;
-	wl_fixed_t view_x, view_y;
-	int view_ix, view_iy;
-	int ix = wl_fixed_to_int(x);
-	int iy = wl_fixed_to_int(y);
+	pixman_region32_t area;
+	uint32_t *cell_start;
+	uint32_t *fill;
+	struct weston_view **views;
+	uint32_t total = 0;
+	int cols, rows, ncells;
+	int col1, row1, col2, row2;
+	int c, r, i;
+
+	compositor->pick_grid.dirty = false;
+	pick_grid_release(compositor);
+
+	pixman_region32_init(&area);
+	wl_list_for_each(output, &compositor->output_list, link)
+		pixman_region32_union(&area, &area, &output->region);
+	compositor->pick_grid.extents = *pixman_region32_extents(&area);
+	pixman_region32_fini(&area);
+
+	cols = (compositor->pick_grid.extents.x2 -
+		compositor->pick_grid.extents.x1 +
+		(1 << PICK_GRID_CELL_SHIFT) - 1) >> PICK_GRID_CELL_SHIFT;
+	rows = (compositor->pick_grid.extents.y2 -
+		compositor->pick_grid.extents.y1 +
+		(1 << PICK_GRID_CELL_SHIFT) - 1) >> PICK_GRID_CELL_SHIFT;
+	/* Sparse output layouts would need a huge grid. */
+	if (cols <= 0 || rows <= 0 || cols * rows > PICK_GRID_MAX_CELLS)
+		return;
+
+	ncells = cols * rows;
+	cell_start = zalloc((ncells + 1) * sizeof *cell_start);
+	fill = zalloc(ncells * sizeof *fill);
+	if (!cell_start || !fill)
+		goto err;
+
+	/* The bucket extents are only valid once cols/rows are known. */
+	compositor->pick_grid.cols = cols;
+	compositor->pick_grid.rows = rows;
 
-	/* Can't use paint node list: occlusion by input regions, not opaque. */
 	wl_list_for_each(view, &compositor->view_list, link) {
-		if (!pixman_region32_contains_point(
-				&view->transform.boundingbox, ix, iy, NULL))
+		if (!pick_grid_view_cells(compositor, view,
+					  &col1, &row1, &col2, &row2))
 			continue;
 
-		weston_view_from_global_fixed(view, x, y, &view_x, &view_y);
-		view_ix = wl_fixed_to_int(view_x);
-		view_iy = wl_fixed_to_int(view_y);
+		for (r = row1; r <= row2; r++)
+			for (c = col1; c <= col2; c++)
+				cell_start[r * cols + c + 1]++;
+	}
 
-		if (!pixman_region32_contains_point(&view->surface->input,
-						    view_ix, view_iy, NULL))
-			continue;
+	for (i = 0; i < ncells; i++)
+		cell_start[i + 1] += cell_start[i];
+	total = cell_start[ncells];
 
-		if (view->geometry.scissor_enabled &&
-		    !pixman_region32_contains_point(&view->geometry.scissor,
-						    view_ix, view_iy, NULL))
+	views = malloc(MAX(total, 1u) * sizeof *views);
+	if (!views)
+		goto err;
+
+	wl_list_for_each(view, &compositor->view_list, link) {
+		if (!pick_grid_view_cells(compositor, view,
+					  &col1, &row1, &col2, &row2))
 			continue;
 
-		*vx = view_x;
-		*vy = view_y;
-		return view;
+		for (r = row1; r <= row2; r++) {
+			for (c = col1; c <= col2; c++) {
+				i = r * cols + c;
+				views[cell_start[i] + fill[i]++] = view;
+			}
+		}
+	}
+
+	free(fill);
+	compositor->pick_grid.cell_start = cell_start;
+	compositor->pick_grid.views = views;
+	return;
+
+err:
+	/* Picking falls back to walking view_list. */
+	free(cell_start);
+	free(fill);
+	compositor->pick_grid.cols = 0;
+	compositor->pick_grid.rows = 0;
+}
+
+static bool
+view_accepts_input_at(struct weston_view *view,
+		      wl_fixed_t x, wl_fixed_t y,
+		      wl_fixed_t *vx, wl_fixed_t *vy)
+{
+	wl_fixed_t view_x, view_y;
+	int view_ix, view_iy;
+
+	if (!pixman_region32_contains_point(&view->transform.boundingbox,
+					    wl_fixed_to_int(x),
+					    wl_fixed_to_int(y), NULL))
+		return false;
+
+	weston_view_from_global_fixed(view, x, y, &view_x, &view_y);
+	view_ix = wl_fixed_to_int(view_x);
+	view_iy = wl_fixed_to_int(view_y);
+
+	if (!pixman_region32_contains_point(&view->surface->input,
+					    view_ix, view_iy, NULL))
+		return false;
+
+	if (view->geometry.scissor_enabled &&
+	    !pixman_region32_contains_point(&view->geometry.scissor,
+					    view_ix, view_iy, NULL))
+		return false;
+
+	*vx = view_x;
+	*vy = view_y;
+	return true;
+}
+
+WL_EXPORT struct weston_view *
+weston_compositor_pick_view(struct weston_compositor *compositor,
+			    wl_fixed_t x, wl_fixed_t y,
+			    wl_fixed_t *vx, wl_fixed_t *vy)
+{
+	const pixman_box32_t *grid = &compositor->pick_grid.extents;
+	struct weston_view *view;
+	int ix = wl_fixed_to_int(x);
+	int iy = wl_fixed_to_int(y);
+	uint32_t i, end;
+	int cell;
+
+	if (compositor->pick_grid.dirty)
+		pick_grid_rebuild(compositor);
+
+	/* Can't use paint node list: occlusion by input regions, not opaque. */
+	if (compositor->pick_grid.cell_start &&
+	    ix >= grid->x1 && ix < grid->x2 &&
+	    iy >= grid->y1 && iy < grid->y2) {
+		cell = ((iy - grid->y1) >> PICK_GRID_CELL_SHIFT) *
+		       compositor->pick_grid.cols +
+		       ((ix - grid->x1) >> PICK_GRID_CELL_SHIFT);
+		end = compositor->pick_grid.cell_start[cell + 1];
+
+		for (i = compositor->pick_grid.cell_start[cell]; i < end; i++) {
+			view = compositor->pick_grid.views[i];
+			if (view_accepts_input_at(view, x, y, vx, vy))
+				return view;
+		}
+	} else {
+		wl_list_for_each(view, &compositor->view_list, link) {
+			if (view_accepts_input_at(view, x, y, vx, vy))
+				return view;
+		}
 	}
 
 	*vx = wl_fixed_from_int(-1000000);
@@ -2222,6 +2655,7 @@ weston_view_unmap(struct weston_view *view)
 	weston_layer_entry_remove(&view->layer_link);
 	wl_list_remove(&view->link);
 	wl_list_init(&view->link);
+	weston_compositor_view_list_dirty(view->surface->compositor);
 	view->output_mask = 0;
 	weston_surface_assign_output(view->surface);
 
@@ -2252,6 +2686,7 @@ weston_surface_unmap(struct weston_surface *surface)
 	wl_list_for_each(view, &surface->views, surface_link)
 		weston_view_unmap(view);
 	surface->output = NULL;
+	weston_compositor_view_list_dirty(surface->compositor);
 }
 
 static void
@@ -2283,6 +2718,7 @@ weston_view_destroy(struct weston_view *view)
 		weston_paint_node_destroy(pnode);
 
 	wl_list_remove(&view->link);
+	weston_compositor_pick_grid_dirty(view->surface->compositor);
 	weston_layer_entry_remove(&view->layer_link);
 
 	pixman_region32_fini(&view->clip);
@@ -2292,10 +2728,11 @@ weston_view_destroy(struct weston_view *view)
 
 	weston_view_set_transform_parent(view, NULL);
 	weston_view_set_output(view, NULL);
+	weston_view_unqueue_transform_update(view);
 
 	wl_list_remove(&view->surface_link);
 
-	free(view);
+	weston_object_pool_free(view);
 }
 
 WL_EXPORT void
@@ -2305,6 +2742,7 @@ weston_surface_destroy(struct weston_surface *surface)
 	struct weston_view *ev, *nv;
 	struct weston_pointer_constraint *constraint, *next_constraint;
 	struct weston_paint_node *pnode, *pntmp;
+	struct weston_commit_queue_entry *entry, *next_entry;
 
 	if (--surface->ref_count > 0)
 		return;
@@ -2327,6 +2765,17 @@ weston_surface_destroy(struct weston_surface *surface)
 		weston_paint_node_destroy(pnode);
 	}
 
+	wl_list_for_each_safe(entry, next_entry, &surface->commit_queue, link)
+		weston_commit_queue_entry_destroy(entry);
+	wl_list_remove(&surface->commit_queue_link);
+	if (surface->commit_timer_resource)
+		wl_resource_set_user_data(surface->commit_timer_resource, NULL);
+	if (surface->tearing_control_resource)
+		wl_resource_set_user_data(surface->tearing_control_resource,
+					  NULL);
+	if (surface->content_type_resource)
+		wl_resource_set_user_data(surface->content_type_resource, NULL);
+
 	weston_surface_state_fini(&surface->pending);
 
 	weston_buffer_reference(&surface->buffer_ref, NULL);
@@ -2338,6 +2787,7 @@ weston_surface_destroy(struct weston_surface *surface)
 
 	wl_resource_for_each_safe(cb, next, &surface->frame_callback_list)
 		wl_resource_destroy(cb);
+	wl_list_remove(&surface->frame_throttle_link);
 
 	weston_presentation_feedback_discard_list(&surface->feedback_list);
 
@@ -2348,7 +2798,10 @@ weston_surface_destroy(struct weston_surface *surface)
 
 	fd_clear(&surface->acquire_fence_fd);
 
-	free(surface);
+	weston_frame_stats_surface_destroy(surface);
+	weston_surface_content_hash_destroy(surface);
+
+	weston_object_pool_free(surface);
 }
 
 static void
@@ -2381,11 +2834,13 @@ weston_buffer_destroy_handler(struct wl_listener *listener, void *data)
 		container_of(listener, struct weston_buffer, destroy_listener);
 
 	weston_signal_emit_mutable(&buffer->destroy_signal, buffer);
-	free(buffer);
+	weston_buffer_udmabuf_destroy(buffer);
+	weston_object_pool_free(buffer);
 }
 
 WL_EXPORT struct weston_buffer *
-weston_buffer_from_resource(struct wl_resource *resource)
+weston_buffer_from_resource(struct weston_compositor *compositor,
+			    struct wl_resource *resource)
 {
 	struct weston_buffer *buffer;
 	struct wl_listener *listener;
@@ -2397,7 +2852,7 @@ weston_buffer_from_resource(struct wl_resource *resource)
 		return container_of(listener, struct weston_buffer,
 				    destroy_listener);
 
-	buffer = zalloc(sizeof *buffer);
+	buffer = weston_object_pool_alloc(compositor->buffer_pool);
 	if (buffer == NULL)
 		return NULL;
 
@@ -2420,32 +2875,65 @@ weston_buffer_reference_handle_destroy(struct wl_listener *listener,
 
 	assert((struct weston_buffer *)data == ref->buffer);
 	ref->buffer = NULL;
+	ref->released_early = false;
+}
+
+static void
+weston_buffer_unbusy(struct weston_buffer *buffer)
+{
+	buffer->busy_count--;
+	if (buffer->busy_count == 0) {
+		assert(wl_resource_get_client(buffer->resource));
+		wl_buffer_send_release(buffer->resource);
+	}
 }
 
+/** Reference a buffer, sending wl_buffer.release for the old one
+ *
+ * Referencing the same buffer again after weston_buffer_reference_release()
+ * makes it busy again: the client attached it once more.
+ */
 WL_EXPORT void
 weston_buffer_reference(struct weston_buffer_reference *ref,
 			struct weston_buffer *buffer)
 {
+	WESTON_PROBE(buffer_reference, ref, ref->buffer, buffer);
+
 	if (ref->buffer && buffer != ref->buffer) {
-		ref->buffer->busy_count--;
-		if (ref->buffer->busy_count == 0) {
-			assert(wl_resource_get_client(ref->buffer->resource));
-			wl_buffer_send_release(ref->buffer->resource);
-		}
+		if (!ref->released_early)
+			weston_buffer_unbusy(ref->buffer);
 		wl_list_remove(&ref->destroy_listener.link);
 	}
 
-	if (buffer && buffer != ref->buffer) {
+	if (buffer && (buffer != ref->buffer || ref->released_early))
 		buffer->busy_count++;
+
+	if (buffer && buffer != ref->buffer)
 		wl_signal_add(&buffer->destroy_signal,
 			      &ref->destroy_listener);
-	}
 
 	ref->buffer = buffer;
+	ref->released_early = false;
 	ref->destroy_listener.notify = weston_buffer_reference_handle_destroy;
 }
 
-static void
+/** Give a referenced buffer back to the client while keeping the pointer
+ *
+ * For when the contents have been copied and nothing will read the buffer
+ * again until it is attached anew. The client gets wl_buffer.release once
+ * no other reference keeps the buffer busy.
+ */
+static void
+weston_buffer_reference_release(struct weston_buffer_reference *ref)
+{
+	if (!ref->buffer || ref->released_early)
+		return;
+
+	ref->released_early = true;
+	weston_buffer_unbusy(ref->buffer);
+}
+
+static void
 weston_buffer_release_reference_handle_destroy(struct wl_listener *listener,
 					       void *data)
 {
@@ -2518,6 +3006,9 @@ weston_surface_attach(struct weston_surface *surface,
 			weston_surface_unmap(surface);
 	}
 
+	if (buffer && weston_buffer_ensure_udmabuf(surface->compositor, buffer))
+		weston_buffer_udmabuf_sync(buffer);
+
 	surface->compositor->renderer->attach(surface, buffer);
 
 	weston_surface_calculate_size_from_buffer(surface);
@@ -2550,12 +3041,37 @@ weston_output_damage(struct weston_output *output)
 	weston_output_schedule_repaint(output);
 }
 
+static bool
+surface_views_on_primary_plane(struct weston_surface *surface)
+{
+	struct weston_view *view;
+
+	wl_list_for_each(view, &surface->views, surface_link) {
+		if (view->plane != &surface->compositor->primary_plane)
+			return false;
+	}
+
+	return true;
+}
+
 static void
 surface_flush_damage(struct weston_surface *surface)
 {
+	struct weston_renderer *renderer = surface->compositor->renderer;
+
+	/* Once the renderer has its own copy of a SHM buffer, the client
+	 * can have it back right away instead of after the next attach,
+	 * which lets it get by with two buffers. Views on other planes,
+	 * such as a KMS cursor, may still read from it. */
 	if (surface->buffer_ref.buffer &&
-	    wl_shm_buffer_get(surface->buffer_ref.buffer->resource))
-		surface->compositor->renderer->flush_damage(surface);
+	    !surface->buffer_ref.buffer->udmabuf &&
+	    wl_shm_buffer_get(surface->buffer_ref.buffer->resource) &&
+	    renderer->flush_damage(surface) &&
+	    surface_views_on_primary_plane(surface)) {
+		weston_buffer_reference_release(&surface->buffer_ref);
+		weston_buffer_release_reference(&surface->buffer_release_ref,
+						NULL);
+	}
 
 	if (pixman_region32_not_empty(&surface->damage))
 		TL_POINT(surface->compositor, "core_flush_damage", TLP_SURFACE(surface),
@@ -2566,30 +3082,103 @@ surface_flush_damage(struct weston_surface *surface)
 
 static void
 view_accumulate_damage(struct weston_view *view,
-		       pixman_region32_t *opaque)
+		       pixman_region32_t *opaque,
+		       struct wl_array *damage_boxes)
 {
 	pixman_region32_t damage;
+	pixman_box32_t *rects, *boxes;
+	int n;
+
+	/* Most views of a busy scene, sub-surfaces in particular, have
+	 * nothing new to show. */
+	if (pixman_region32_not_empty(&view->surface->damage)) {
+		pixman_region32_init(&damage);
+		if (view->transform.enabled) {
+			pixman_box32_t *extents;
+
+			extents = pixman_region32_extents(&view->surface->damage);
+			view_compute_bbox(view, extents, &damage);
+		} else {
+			pixman_region32_copy(&damage, &view->surface->damage);
+			pixman_region32_translate(&damage,
+						  view->geometry.x,
+						  view->geometry.y);
+		}
 
-	pixman_region32_init(&damage);
-	if (view->transform.enabled) {
-		pixman_box32_t *extents;
+		pixman_region32_intersect(&damage, &damage,
+					  &view->transform.boundingbox);
+		pixman_region32_subtract(&damage, &damage, opaque);
 
-		extents = pixman_region32_extents(&view->surface->damage);
-		view_compute_bbox(view, extents, &damage);
-	} else {
-		pixman_region32_copy(&damage, &view->surface->damage);
-		pixman_region32_translate(&damage,
-					  view->geometry.x, view->geometry.y);
+		rects = pixman_region32_rectangles(&damage, &n);
+		boxes = n > 0 ? wl_array_add(damage_boxes, n * sizeof *rects) :
+				NULL;
+		if (boxes)
+			memcpy(boxes, rects, n * sizeof *rects);
+		else if (n > 0)
+			pixman_region32_union(&view->plane->damage,
+					      &view->plane->damage, &damage);
+		pixman_region32_fini(&damage);
 	}
 
-	pixman_region32_intersect(&damage, &damage,
-				  &view->transform.boundingbox);
-	pixman_region32_subtract(&damage, &damage, opaque);
-	pixman_region32_union(&view->plane->damage,
-			      &view->plane->damage, &damage);
-	pixman_region32_fini(&damage);
 	pixman_region32_copy(&view->clip, opaque);
-	pixman_region32_union(opaque, opaque, &view->transform.opaque);
+	if (pixman_region32_not_empty(&view->transform.opaque))
+		pixman_region32_union(opaque, opaque, &view->transform.opaque);
+}
+
+/** Merge the damage boxes collected from the views of a plane
+ *
+ * Building one region out of all of them at once sorts the boxes a
+ * single time, where a union per view would walk the ever growing
+ * plane damage again for every view.
+ */
+static void
+plane_merge_damage_boxes(struct weston_plane *plane,
+			 struct wl_array *damage_boxes)
+{
+	pixman_region32_t damage;
+
+	if (damage_boxes->size == 0)
+		return;
+
+	pixman_region32_init_rects(&damage, damage_boxes->data,
+				   damage_boxes->size / sizeof(pixman_box32_t));
+	pixman_region32_union(&plane->damage, &plane->damage, &damage);
+	pixman_region32_fini(&damage);
+
+	damage_boxes->size = 0;
+}
+
+static struct weston_view *
+output_find_fullscreen_view(struct weston_output *output)
+{
+	pixman_box32_t *extents = pixman_region32_extents(&output->region);
+	struct weston_paint_node *pnode;
+	struct weston_view *view;
+
+	wl_list_for_each(pnode, &output->paint_node_z_order_list,
+			 z_order_link) {
+		view = pnode->view;
+		if (!(view->output_mask & (1u << output->id)))
+			continue;
+
+		/* Only the topmost view of the output can hide all others. */
+		if (view->alpha < 1.0 || view->transform.dirty ||
+		    !pnode->surf_xform_valid)
+			return NULL;
+
+		if (pixman_region32_contains_rectangle(&view->transform.opaque,
+						       extents) == PIXMAN_REGION_IN)
+			return view;
+
+		if (view->surface->is_opaque && !view->transform.enabled &&
+		    pixman_region32_contains_rectangle(&view->transform.boundingbox,
+						       extents) == PIXMAN_REGION_IN)
+			return view;
+
+		return NULL;
+	}
+
+	return NULL;
 }
 
 static void
@@ -2599,26 +3188,51 @@ output_accumulate_damage(struct weston_output *output)
 	struct weston_plane *plane;
 	struct weston_paint_node *pnode;
 	pixman_region32_t opaque, clip;
+	struct wl_array damage_boxes;
+	bool covered;
 
 	pixman_region32_init(&clip);
+	wl_array_init(&damage_boxes);
 
 	wl_list_for_each(plane, &ec->plane_list, link) {
 		pixman_region32_copy(&plane->clip, &clip);
 
 		pixman_region32_init(&opaque);
+		covered = false;
 
 		wl_list_for_each(pnode, &output->paint_node_z_order_list,
 				 z_order_link) {
 			if (pnode->view->plane != plane)
 				continue;
 
-			view_accumulate_damage(pnode->view, &opaque);
+			/* Views only on this output and under the fullscreen
+			 * view have all their damage subtracted anyway. */
+			if (covered &&
+			    pnode->view->output_mask == (1u << output->id)) {
+				pixman_region32_copy(&pnode->view->clip, &opaque);
+				continue;
+			}
+
+			view_accumulate_damage(pnode->view, &opaque,
+					       &damage_boxes);
+
+			/* Lets the renderer skip what the plane hides. */
+			if (pnode->plane_opaque &&
+			    plane != &ec->primary_plane)
+				pixman_region32_union(&opaque, &opaque,
+						      &pnode->view->transform.boundingbox);
+
+			if (pnode->view == output->fullscreen_view)
+				covered = true;
 		}
 
+		plane_merge_damage_boxes(plane, &damage_boxes);
+
 		pixman_region32_union(&clip, &clip, &opaque);
 		pixman_region32_fini(&opaque);
 	}
 
+	wl_array_release(&damage_boxes);
 	pixman_region32_fini(&clip);
 
 	wl_list_for_each(pnode, &output->paint_node_z_order_list,
@@ -2808,12 +3422,58 @@ view_list_add(struct weston_compositor *compositor,
 	}
 }
 
+static void
+weston_compositor_view_list_dirty(struct weston_compositor *compositor)
+{
+	compositor->view_list_needs_rebuild = true;
+	weston_compositor_pick_grid_dirty(compositor);
+}
+
+/* Rebuild an output's z-order list from an up-to-date
+ * weston_compositor::view_list. The view list is already in z-order with
+ * sub-surfaces expanded, so no layer walk is needed.
+ */
+static void
+weston_output_build_z_order_list(struct weston_output *output)
+{
+	struct weston_compositor *compositor = output->compositor;
+	struct weston_view *view;
+
+	wl_list_remove(&output->paint_node_z_order_list);
+	wl_list_init(&output->paint_node_z_order_list);
+
+	wl_list_for_each(view, &compositor->view_list, link)
+		add_to_z_order_list(output, view_ensure_paint_node(view, output));
+
+	output->paint_node_z_order_dirty = false;
+}
+
 static void
 weston_compositor_build_view_list(struct weston_compositor *compositor,
 				  struct weston_output *output)
 {
 	struct weston_view *view, *tmp;
 	struct weston_layer *layer;
+	struct weston_output *other;
+	struct weston_paint_node *pnode;
+
+	weston_compositor_update_transforms(compositor);
+
+	if (!compositor->view_list_needs_rebuild) {
+		/* The stacking is unchanged */
+		if (!output)
+			return;
+
+		if (output->paint_node_z_order_dirty) {
+			weston_output_build_z_order_list(output);
+			return;
+		}
+
+		wl_list_for_each(pnode, &output->paint_node_z_order_list,
+				 z_order_link)
+			weston_paint_node_ensure_color_transform(pnode);
+		return;
+	}
 
 	if (output) {
 		wl_list_remove(&output->paint_node_z_order_list);
@@ -2837,6 +3497,16 @@ weston_compositor_build_view_list(struct weston_compositor *compositor,
 	wl_list_for_each(layer, &compositor->layer_list, link)
 		wl_list_for_each(view, &layer->view_list.link, layer_link.link)
 			surface_free_unused_subsurface_views(view->surface);
+
+	/* Creating and destroying sub-surface views above marks the list
+	 * dirty again, but the result already accounts for them. */
+	compositor->view_list_needs_rebuild = false;
+
+	wl_list_for_each(other, &compositor->output_list, link)
+		if (other != output)
+			other->paint_node_z_order_dirty = true;
+	if (output)
+		output->paint_node_z_order_dirty = false;
 }
 
 static void
@@ -2864,6 +3534,346 @@ weston_output_take_feedback_list(struct weston_output *output,
 	wl_list_init(&surface->feedback_list);
 }
 
+static void
+weston_output_repaint_time_add(struct weston_output *output, int64_t nsec)
+{
+	unsigned int i = output->repaint_time.next;
+
+	output->repaint_time.nsec[i] = nsec;
+	output->repaint_time.next = (i + 1) % WESTON_REPAINT_TIME_SAMPLES;
+	if (output->repaint_time.count < WESTON_REPAINT_TIME_SAMPLES)
+		output->repaint_time.count++;
+	output->repaint_time.last_pending = true;
+}
+
+/** Extend the latest repaint time sample by GPU rendering time
+ *
+ * \param output The output that was repainted.
+ * \param gpu_end CLOCK_MONOTONIC time when the GPU finished rendering it.
+ *
+ * Renderers call this when they learn when rendering of the latest
+ * output repaint completed. Reports arriving after the next repaint began
+ * are ignored.
+ */
+WL_EXPORT void
+weston_output_repaint_time_gpu_done(struct weston_output *output,
+				    const struct timespec *gpu_end)
+{
+	unsigned int i;
+	int64_t nsec;
+
+	if (!output->repaint_time.last_pending)
+		return;
+
+	output->repaint_time.last_pending = false;
+
+	i = (output->repaint_time.next + WESTON_REPAINT_TIME_SAMPLES - 1) %
+	    WESTON_REPAINT_TIME_SAMPLES;
+	nsec = timespec_sub_to_nsec(gpu_end, &output->repaint_time.start);
+	if (nsec > output->repaint_time.nsec[i])
+		output->repaint_time.nsec[i] = nsec;
+}
+
+static int
+compare_int64(const void *a, const void *b)
+{
+	int64_t x = *(const int64_t *)a;
+	int64_t y = *(const int64_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+static int32_t
+weston_output_compute_repaint_window(struct weston_output *output)
+{
+	struct weston_compositor *compositor = output->compositor;
+	int64_t sorted[WESTON_REPAINT_TIME_SAMPLES];
+	unsigned int count = output->repaint_time.count;
+	unsigned int idx;
+	int64_t msec;
+
+	if (!compositor->repaint_window_adaptive ||
+	    count < REPAINT_TIME_MIN_SAMPLES)
+		return compositor->repaint_msec;
+
+	memcpy(sorted, output->repaint_time.nsec, count * sizeof sorted[0]);
+	qsort(sorted, count, sizeof sorted[0], compare_int64);
+
+	idx = (count * compositor->repaint_window_percentile + 99) / 100;
+	idx = MIN(MAX(idx, 1u), count) - 1;
+
+	/* Round up, and leave 1 ms for the commit and scheduling jitter. */
+	msec = (sorted[idx] + 999999) / 1000000 + 1;
+
+	return MIN(msec, compositor->repaint_msec);
+}
+
+static bool
+view_is_occluded_on_output(struct weston_view *view,
+			   struct weston_output *output)
+{
+	pixman_region32_t visible;
+	bool occluded;
+
+	pixman_region32_init(&visible);
+	pixman_region32_intersect(&visible, &view->transform.boundingbox,
+				  &output->region);
+	pixman_region32_subtract(&visible, &visible, &view->clip);
+	pixman_region32_subtract(&visible, &visible, &view->plane->clip);
+	occluded = !pixman_region32_not_empty(&visible);
+	pixman_region32_fini(&visible);
+
+	return occluded;
+}
+
+static int
+frame_throttle_timer_handler(void *data)
+{
+	struct weston_compositor *ec = data;
+	struct weston_surface *surface, *next;
+	struct wl_resource *cb, *cnext;
+	struct timespec now;
+	uint32_t now_msec;
+
+	weston_compositor_read_presentation_clock(ec, &now);
+	now_msec = timespec_to_msec(&now);
+
+	wl_list_for_each_safe(surface, next, &ec->frame_throttle_list,
+			      frame_throttle_link) {
+		wl_resource_for_each_safe(cb, cnext,
+					  &surface->frame_callback_list) {
+			wl_callback_send_done(cb, now_msec);
+			wl_resource_destroy(cb);
+		}
+		wl_list_remove(&surface->frame_throttle_link);
+		wl_list_init(&surface->frame_throttle_link);
+	}
+
+	return 0;
+}
+
+/** Decide whether to hold back the frame callbacks of a surface
+ *
+ * A surface whose views on the output are all fully covered by opaque
+ * content gets its frame callbacks at the rate set by
+ * weston_compositor::occluded_frame_interval_msec. Surfaces outside every
+ * output or on hidden layers are not in any paint node list, so they
+ * never get frame callbacks in the first place. Output enter and leave
+ * events are unaffected, they only depend on the view geometry.
+ *
+ * Photo content does not change on its own, so a hidden photo surface
+ * gets no frame callbacks at all until it becomes visible again.
+ */
+static bool
+surface_throttle_frame_callbacks(struct weston_surface *surface,
+				 struct weston_output *output)
+{
+	struct weston_compositor *ec = surface->compositor;
+	struct weston_view *view;
+	bool occluded = true;
+
+	if (ec->occluded_frame_interval_msec == 0)
+		return false;
+
+	wl_list_for_each(view, &surface->views, surface_link) {
+		if (!(view->output_mask & (1u << output->id)))
+			continue;
+		if (!view_is_occluded_on_output(view, output)) {
+			occluded = false;
+			break;
+		}
+	}
+
+	if (!occluded) {
+		wl_list_remove(&surface->frame_throttle_link);
+		wl_list_init(&surface->frame_throttle_link);
+		return false;
+	}
+
+	if (wl_list_empty(&surface->frame_callback_list) ||
+	    !wl_list_empty(&surface->frame_throttle_link))
+		return true;
+
+	if (surface->content_type == WESTON_SURFACE_CONTENT_TYPE_PHOTO)
+		return true;
+
+	if (wl_list_empty(&ec->frame_throttle_list) &&
+	    ec->occluded_frame_interval_msec > 0)
+		wl_event_source_timer_update(ec->frame_throttle_timer,
+					     ec->occluded_frame_interval_msec);
+	wl_list_insert(&ec->frame_throttle_list, &surface->frame_throttle_link);
+
+	return true;
+}
+
+/* Flush a client unless it was already flushed in this cycle */
+static void
+flush_focused_client(struct weston_compositor *ec, struct wl_client *client,
+		     struct wl_client **flushed, unsigned int *n_flushed,
+		     unsigned int max_flushed)
+{
+	unsigned int i;
+
+	if (!client)
+		return;
+
+	for (i = 0; i < *n_flushed; i++) {
+		if (flushed[i] == client)
+			return;
+	}
+
+	wl_client_flush(client);
+	ec->flush_stats.focused_flushes++;
+
+	if (*n_flushed < max_flushed)
+		flushed[(*n_flushed)++] = client;
+}
+
+static struct wl_client *
+surface_get_client(struct weston_surface *surface)
+{
+	if (!surface || !surface->resource)
+		return NULL;
+
+	return wl_resource_get_client(surface->resource);
+}
+
+/* Idle callbacks run after all event sources of a dispatch cycle, right
+ * before wl_display_run() flushes every client. Flushing the clients with
+ * input focus first gets their events onto the wire ahead of a burst of
+ * frame callbacks for everyone else. */
+static void
+flush_idle_handler(void *data)
+{
+	struct weston_compositor *ec = data;
+	struct wl_client *flushed[16];
+	unsigned int n_flushed = 0;
+	struct weston_seat *seat;
+
+	ec->flush_idle_source = NULL;
+	ec->flush_stats.cycles++;
+
+	wl_list_for_each(seat, &ec->seat_list, link) {
+		struct weston_keyboard *keyboard = weston_seat_get_keyboard(seat);
+		struct weston_pointer *pointer = weston_seat_get_pointer(seat);
+		struct weston_touch *touch = weston_seat_get_touch(seat);
+
+		if (keyboard)
+			flush_focused_client(ec, surface_get_client(keyboard->focus),
+					     flushed, &n_flushed,
+					     ARRAY_LENGTH(flushed));
+		if (pointer && pointer->focus_client)
+			flush_focused_client(ec, pointer->focus_client->client,
+					     flushed, &n_flushed,
+					     ARRAY_LENGTH(flushed));
+		if (touch && touch->focus)
+			flush_focused_client(ec,
+					     surface_get_client(touch->focus->surface),
+					     flushed, &n_flushed,
+					     ARRAY_LENGTH(flushed));
+	}
+}
+
+/** Request focused clients to be flushed first in this dispatch cycle
+ *
+ * Event sources that emit protocol events to many clients at once, such as
+ * input and frame callbacks, call this so that the clients with input focus
+ * are written to before the compositor flushes all clients. Each client
+ * still gets at most one flush per cycle from the regular path, as the
+ * already flushed ones have nothing left to write.
+ */
+void
+weston_compositor_schedule_flush(struct weston_compositor *compositor)
+{
+	struct wl_event_loop *loop;
+
+	if (compositor->flush_idle_source)
+		return;
+
+	loop = wl_display_get_event_loop(compositor->wl_display);
+	compositor->flush_idle_source =
+		wl_event_loop_add_idle(loop, flush_idle_handler, compositor);
+}
+
+static void
+client_flush_stats_print_cb(struct weston_log_subscription *sub, void *data)
+{
+	struct weston_compositor *ec = data;
+
+	weston_log_subscription_printf(sub,
+		"flush cycles: %" PRIu64 "\n"
+		"focused client flushes: %" PRIu64 "\n"
+		"frame callbacks: %" PRIu64 " (max %u in one repaint)\n",
+		ec->flush_stats.cycles, ec->flush_stats.focused_flushes,
+		ec->flush_stats.frame_callbacks,
+		ec->flush_stats.max_frame_callbacks);
+	weston_log_subscription_complete(sub);
+}
+
+static void
+object_pool_print(struct weston_log_subscription *sub,
+		  const struct weston_object_pool *pool)
+{
+	weston_log_subscription_printf(sub,
+		"%s: %u live (peak %u), %u free, %" PRIu64 " allocations, "
+		"%" PRIu64 " recycled, %" PRIu64 " returned to the heap\n",
+		pool->name, pool->live, pool->peak_live, pool->n_free,
+		pool->allocs, pool->reuses, pool->heap_frees);
+}
+
+static void
+object_pool_stats_print_cb(struct weston_log_subscription *sub, void *data)
+{
+	struct weston_compositor *ec = data;
+
+	object_pool_print(sub, ec->surface_pool);
+	object_pool_print(sub, ec->view_pool);
+	object_pool_print(sub, ec->paint_node_pool);
+	object_pool_print(sub, ec->buffer_pool);
+	weston_log_subscription_complete(sub);
+}
+
+/* Enough for a burst of menus and tooltips; beyond that, freed objects
+ * go back to the heap. */
+#define OBJECT_POOL_MAX_FREE 256
+
+static int
+weston_compositor_create_object_pools(struct weston_compositor *ec)
+{
+	ec->surface_pool =
+		weston_object_pool_create("surfaces",
+					  sizeof(struct weston_surface),
+					  OBJECT_POOL_MAX_FREE);
+	ec->view_pool =
+		weston_object_pool_create("views", sizeof(struct weston_view),
+					  OBJECT_POOL_MAX_FREE);
+	ec->paint_node_pool =
+		weston_object_pool_create("paint nodes",
+					  sizeof(struct weston_paint_node),
+					  OBJECT_POOL_MAX_FREE);
+	ec->buffer_pool =
+		weston_object_pool_create("buffers",
+					  sizeof(struct weston_buffer),
+					  OBJECT_POOL_MAX_FREE);
+
+	if (!ec->surface_pool || !ec->view_pool ||
+	    !ec->paint_node_pool || !ec->buffer_pool)
+		return -1;
+
+	return 0;
+}
+
+/* Objects outliving the compositor, like the buffers of clients still
+ * connected, keep their pool until they go. */
+static void
+weston_compositor_destroy_object_pools(struct weston_compositor *ec)
+{
+	weston_object_pool_destroy(ec->surface_pool);
+	weston_object_pool_destroy(ec->view_pool);
+	weston_object_pool_destroy(ec->paint_node_pool);
+	weston_object_pool_destroy(ec->buffer_pool);
+}
+
 static int
 weston_output_repaint(struct weston_output *output, void *repaint_data)
 {
@@ -2875,15 +3885,36 @@ weston_output_repaint(struct weston_output *output, void *repaint_data)
 	pixman_region32_t output_damage;
 	int r;
 	uint32_t frame_time_msec;
+	uint32_t n_callbacks;
 	enum weston_hdcp_protection highest_requested = WESTON_HDCP_DISABLE;
 
 	if (output->destroying)
 		return 0;
 
 	TL_POINT(ec, "core_repaint_begin", TLP_OUTPUT(output), TLP_END);
+	WESTON_PROBE(output_repaint_begin, output->id);
+
+	clock_gettime(CLOCK_MONOTONIC, &output->repaint_time.start);
+	output->repaint_time.last_pending = false;
+
+	/* A mirror has no views of its own, the backend reuses what its
+	 * source output has already rendered. */
+	if (output->mirror) {
+		pixman_region32_init(&output_damage);
+		r = output->repaint(output, &output_damage, repaint_data);
+		pixman_region32_fini(&output_damage);
+
+		output->repaint_needed = false;
+		if (r == 0)
+			output->repaint_status = REPAINT_AWAITING_COMPLETION;
+
+		WESTON_PROBE(output_repaint_end, output->id, r);
+		return r;
+	}
 
 	/* Rebuild the surface list and update surface transforms up front. */
 	weston_compositor_build_view_list(ec, output);
+	output->fullscreen_view = output_find_fullscreen_view(output);
 
 	/* Find the highest protection desired for an output */
 	wl_list_for_each(pnode, &output->paint_node_z_order_list,
@@ -2914,6 +3945,10 @@ weston_output_repaint(struct weston_output *output, void *repaint_data)
 		}
 	}
 
+	output_accumulate_damage(output);
+
+	/* After output_accumulate_damage(), as the occlusion test needs the
+	 * view clip regions. */
 	wl_list_init(&frame_callback_list);
 	wl_list_for_each(pnode, &output->paint_node_z_order_list,
 			 z_order_link) {
@@ -2921,16 +3956,18 @@ weston_output_repaint(struct weston_output *output, void *repaint_data)
 		 * same surface.
 		 */
 		if (pnode->surface->output == output) {
+			weston_output_take_feedback_list(output, pnode->surface);
+
+			if (surface_throttle_frame_callbacks(pnode->surface,
+							     output))
+				continue;
+
 			wl_list_insert_list(&frame_callback_list,
 					    &pnode->surface->frame_callback_list);
 			wl_list_init(&pnode->surface->frame_callback_list);
-
-			weston_output_take_feedback_list(output, pnode->surface);
 		}
 	}
 
-	output_accumulate_damage(output);
-
 	pixman_region32_init(&output_damage);
 	pixman_region32_intersect(&output_damage,
 				  &ec->primary_plane.damage, &output->region);
@@ -2943,6 +3980,17 @@ weston_output_repaint(struct weston_output *output, void *repaint_data)
 	r = output->repaint(output, &output_damage, repaint_data);
 
 	pixman_region32_fini(&output_damage);
+	weston_output_frame_arena_reset(output);
+
+	if (r == 0) {
+		struct timespec cpu_end;
+
+		clock_gettime(CLOCK_MONOTONIC, &cpu_end);
+		weston_output_repaint_time_add(output,
+			timespec_sub_to_nsec(&cpu_end,
+					     &output->repaint_time.start));
+		weston_frame_stats_repaint(output);
+	}
 
 	output->repaint_needed = false;
 	if (r == 0)
@@ -2952,9 +4000,18 @@ weston_output_repaint(struct weston_output *output, void *repaint_data)
 
 	frame_time_msec = timespec_to_msec(&output->frame_time);
 
+	n_callbacks = 0;
 	wl_resource_for_each_safe(cb, cnext, &frame_callback_list) {
 		wl_callback_send_done(cb, frame_time_msec);
 		wl_resource_destroy(cb);
+		n_callbacks++;
+	}
+
+	if (n_callbacks > 0) {
+		ec->flush_stats.frame_callbacks += n_callbacks;
+		if (n_callbacks > ec->flush_stats.max_frame_callbacks)
+			ec->flush_stats.max_frame_callbacks = n_callbacks;
+		weston_compositor_schedule_flush(ec);
 	}
 
 	wl_list_for_each_safe(animation, next, &output->animation_list, link) {
@@ -2963,10 +4020,14 @@ weston_output_repaint(struct weston_output *output, void *repaint_data)
 	}
 
 	TL_POINT(ec, "core_repaint_posted", TLP_OUTPUT(output), TLP_END);
+	WESTON_PROBE(output_repaint_end, output->id, r);
 
 	return r;
 }
 
+static void
+weston_output_apply_commit_queue(struct weston_output *output);
+
 static void
 weston_output_schedule_repaint_reset(struct weston_output *output)
 {
@@ -2991,6 +4052,9 @@ weston_output_maybe_repaint(struct weston_output *output, struct timespec *now,
 	if (msec_to_repaint > 1)
 		return ret;
 
+	/* Commits held back for this repaint make it needed. */
+	weston_output_apply_commit_queue(output);
+
 	/* If we're sleeping, drop the repaint machinery entirely; we will
 	 * explicitly repaint all outputs when we come back. */
 	if (compositor->state == WESTON_COMPOSITOR_SLEEPING ||
@@ -3056,26 +4120,55 @@ output_repaint_timer_arm(struct weston_compositor *compositor)
 	if (msec_to_next < 1)
 		msec_to_next = 1;
 
-	wl_event_source_timer_update(compositor->repaint_timer, msec_to_next);
+	wl_event_source_timer_update(compositor->repaint_timer, msec_to_next);
+}
+
+/* Find the scheduled output with the earliest repaint deadline that has not
+ * been visited yet in this repaint cycle.
+ */
+static struct weston_output *
+output_repaint_next_due(struct weston_compositor *compositor,
+			uint32_t visited_mask)
+{
+	struct weston_output *output;
+	struct weston_output *earliest = NULL;
+
+	wl_list_for_each(output, &compositor->output_list, link) {
+		if (visited_mask & (1u << output->id))
+			continue;
+
+		if (output->repaint_status != REPAINT_SCHEDULED)
+			continue;
+
+		if (!earliest ||
+		    timespec_sub_to_nsec(&output->next_repaint,
+					 &earliest->next_repaint) < 0)
+			earliest = output;
+	}
+
+	return earliest;
 }
 
-static int
-output_repaint_timer_handler(void *data)
+/* Repaint the due outputs not in skip_mask in one backend repaint cycle */
+static void
+output_repaint_cycle(struct weston_compositor *compositor,
+		     const struct timespec *now, uint32_t skip_mask)
 {
-	struct weston_compositor *compositor = data;
 	struct weston_output *output;
-	struct timespec now;
 	void *repaint_data = NULL;
+	uint32_t visited_mask = skip_mask;
 	int ret = 0;
 
-	weston_compositor_read_presentation_clock(compositor, &now);
-	compositor->last_repaint_start = now;
-
 	if (compositor->backend->repaint_begin)
 		repaint_data = compositor->backend->repaint_begin(compositor);
 
-	wl_list_for_each(output, &compositor->output_list, link) {
-		ret = weston_output_maybe_repaint(output, &now, repaint_data);
+	/* Outputs are repainted one after another, so serve the closest
+	 * deadline first. Otherwise, with several heavy outputs due in the
+	 * same cycle, an output late in output_list may miss its vblank
+	 * while outputs with more slack are being repainted. */
+	while ((output = output_repaint_next_due(compositor, visited_mask))) {
+		visited_mask |= 1u << output->id;
+		ret = weston_output_maybe_repaint(output, now, repaint_data);
 		if (ret)
 			break;
 	}
@@ -3099,7 +4192,80 @@ output_repaint_timer_handler(void *data)
 
 	wl_list_for_each(output, &compositor->output_list, link)
 		output->repainted = false;
+}
+
+/* The background outputs to leave out of a cycle, when other outputs are
+ * due in it as well */
+static uint32_t
+output_repaint_background_mask(struct weston_compositor *compositor,
+			       const struct timespec *now)
+{
+	struct weston_output *output;
+	uint32_t mask = 0;
+	bool foreground_due = false;
+
+	wl_list_for_each(output, &compositor->output_list, link) {
+		if (output->repaint_status != REPAINT_SCHEDULED)
+			continue;
+
+		if (output->repaint_background)
+			mask |= 1u << output->id;
+		else if (timespec_sub_to_msec(&output->next_repaint, now) <= 1)
+			foreground_due = true;
+	}
+
+	return foreground_due ? mask : 0;
+}
+
+/* Runs once the event loop has dispatched everything else that was ready,
+ * so the page flips of the other outputs are long queued by then. */
+static void
+output_repaint_background_idle(void *data)
+{
+	struct weston_compositor *compositor = data;
+	struct weston_output *output;
+	struct timespec now;
+	uint32_t skip_mask = 0;
+
+	compositor->repaint_background_idle = NULL;
+
+	wl_list_for_each(output, &compositor->output_list, link) {
+		if (!output->repaint_background)
+			skip_mask |= 1u << output->id;
+	}
+
+	weston_compositor_read_presentation_clock(compositor, &now);
+	output_repaint_cycle(compositor, &now, skip_mask);
+
+	output_repaint_timer_arm(compositor);
+}
+
+static int
+output_repaint_timer_handler(void *data)
+{
+	struct weston_compositor *compositor = data;
+	struct wl_event_loop *loop;
+	struct timespec now;
+	uint32_t background_mask;
+
+	weston_compositor_read_presentation_clock(compositor, &now);
+	compositor->last_repaint_start = now;
+
+	background_mask = output_repaint_background_mask(compositor, &now);
+	output_repaint_cycle(compositor, &now, background_mask);
 
+	if (background_mask && !compositor->repaint_background_idle) {
+		loop = wl_display_get_event_loop(compositor->wl_display);
+		compositor->repaint_background_idle =
+			wl_event_loop_add_idle(loop,
+					       output_repaint_background_idle,
+					       compositor);
+		if (!compositor->repaint_background_idle)
+			output_repaint_background_idle(compositor);
+	}
+
+	/* Left out outputs are still scheduled, but the idle callback runs
+	 * before the timer can fire again. */
 	output_repaint_timer_arm(compositor);
 
 	return 0;
@@ -3152,6 +4318,10 @@ weston_output_finish_frame(struct weston_output *output,
 	struct timespec vblank_monotonic;
 	int64_t msec_rel;
 
+	WESTON_PROBE(output_finish_frame, output->id,
+		     stamp ? (int64_t)stamp->tv_sec : 0,
+		     stamp ? stamp->tv_nsec : 0, presented_flags);
+
 	assert(output->repaint_status == REPAINT_AWAITING_COMPLETION);
 
 	/*
@@ -3169,6 +4339,7 @@ weston_output_finish_frame(struct weston_output *output,
 	 * timebase to work against, so any delay just wastes time. Push a
 	 * repaint as soon as possible so we can get on with it. */
 	if (!stamp) {
+		weston_frame_stats_finish_frame(output, NULL, presented_flags);
 		output->next_repaint = now;
 		goto out;
 	}
@@ -3184,12 +4355,17 @@ weston_output_finish_frame(struct weston_output *output,
 						  output, refresh_nsec, stamp,
 						  output->msc,
 						  presented_flags);
+	weston_frame_stats_finish_frame(output, &vblank_monotonic,
+					presented_flags);
 
 	output->frame_time = *stamp;
 
+	output->repaint_time.window_msec =
+		weston_output_compute_repaint_window(output);
+
 	timespec_add_nsec(&output->next_repaint, stamp, refresh_nsec);
 	timespec_add_msec(&output->next_repaint, &output->next_repaint,
-			  -compositor->repaint_msec);
+			  -output->repaint_time.window_msec);
 	msec_rel = timespec_sub_to_msec(&output->next_repaint, &now);
 
 	if (msec_rel < -1000 || msec_rel > 1000) {
@@ -3206,9 +4382,13 @@ weston_output_finish_frame(struct weston_output *output,
 	/* Called from restart_repaint_loop and restart happens already after
 	 * the deadline given by repaint_msec? In that case we delay until
 	 * the deadline of the next frame, to give clients a more predictable
-	 * timing of the repaint cycle to lock on. */
+	 * timing of the repaint cycle to lock on. With variable refresh the
+	 * display waits for us instead, so repaint right away. */
 	if (presented_flags == WP_PRESENTATION_FEEDBACK_INVALID &&
-	    msec_rel < 0) {
+	    msec_rel < 0 && output->vrr_enabled) {
+		output->next_repaint = now;
+	} else if (presented_flags == WP_PRESENTATION_FEEDBACK_INVALID &&
+		   msec_rel < 0) {
 		while (timespec_sub_to_nsec(&output->next_repaint, &now) < 0) {
 			timespec_add_nsec(&output->next_repaint,
 					  &output->next_repaint,
@@ -3250,11 +4430,23 @@ weston_layer_entry_insert(struct weston_layer_entry *list,
 {
 	wl_list_insert(&list->link, &entry->link);
 	entry->layer = list->layer;
+	weston_compositor_view_list_dirty(entry->layer->compositor);
+
+	if (layer_has_offset(entry->layer))
+		weston_view_geometry_dirty(container_of(entry, struct weston_view,
+							layer_link));
 }
 
 WL_EXPORT void
 weston_layer_entry_remove(struct weston_layer_entry *entry)
 {
+	if (entry->layer)
+		weston_compositor_view_list_dirty(entry->layer->compositor);
+
+	if (layer_has_offset(entry->layer))
+		weston_view_geometry_dirty(container_of(entry, struct weston_view,
+							layer_link));
+
 	wl_list_remove(&entry->link);
 	wl_list_init(&entry->link);
 	entry->layer = NULL;
@@ -3274,6 +4466,8 @@ weston_layer_init(struct weston_layer *layer,
 	wl_list_init(&layer->link);
 	wl_list_init(&layer->view_list.link);
 	layer->view_list.layer = layer;
+	layer->offset.x = 0.0f;
+	layer->offset.y = 0.0f;
 	weston_layer_set_mask_infinite(layer);
 }
 
@@ -3285,6 +4479,7 @@ WL_EXPORT void
 weston_layer_fini(struct weston_layer *layer)
 {
 	wl_list_remove(&layer->link);
+	weston_compositor_view_list_dirty(layer->compositor);
 
 	if (!wl_list_empty(&layer->view_list.link))
 		weston_log("BUG: finalizing a layer with views still on it.\n");
@@ -3307,6 +4502,7 @@ weston_layer_set_position(struct weston_layer *layer,
 	struct weston_layer *below;
 
 	wl_list_remove(&layer->link);
+	weston_compositor_view_list_dirty(layer->compositor);
 
 	/* layer_list is ordered from top to bottom, the last layer being the
 	 * background with the smallest position value */
@@ -3331,6 +4527,7 @@ weston_layer_unset_position(struct weston_layer *layer)
 {
 	wl_list_remove(&layer->link);
 	wl_list_init(&layer->link);
+	weston_compositor_view_list_dirty(layer->compositor);
 }
 
 WL_EXPORT void
@@ -3364,6 +4561,32 @@ weston_layer_set_mask_infinite(struct weston_layer *layer)
 	}
 }
 
+/** Move a whole layer by an offset
+ *
+ * \param layer The layer to move
+ * \param x Horizontal offset, in global coordinates
+ * \param y Vertical offset, in global coordinates
+ *
+ * The offset is composed after the transform of each view in the layer,
+ * so sub-surfaces and transform children follow their parent. Shells
+ * can slide a layer in or out without touching the views'
+ * transformation lists; the mask is not moved.
+ */
+WL_EXPORT void
+weston_layer_set_offset(struct weston_layer *layer, float x, float y)
+{
+	struct weston_view *view;
+
+	if (layer->offset.x == x && layer->offset.y == y)
+		return;
+
+	layer->offset.x = x;
+	layer->offset.y = y;
+
+	wl_list_for_each(view, &layer->view_list.link, layer_link.link)
+		weston_view_geometry_dirty(view);
+}
+
 WL_EXPORT bool
 weston_layer_mask_is_infinite(struct weston_layer *layer)
 {
@@ -3433,7 +4656,8 @@ surface_attach(struct wl_client *client,
 	struct weston_buffer *buffer = NULL;
 
 	if (buffer_resource) {
-		buffer = weston_buffer_from_resource(buffer_resource);
+		buffer = weston_buffer_from_resource(surface->compositor,
+						     buffer_resource);
 		if (buffer == NULL) {
 			wl_client_post_no_memory(client);
 			return;
@@ -3505,6 +4729,14 @@ surface_frame(struct wl_client *client,
 		       wl_resource_get_link(cb));
 }
 
+static void
+region_serial_bump(uint32_t *serial)
+{
+	/* 0 is what every new state starts with. */
+	if (++*serial == 0)
+		*serial = 1;
+}
+
 static void
 surface_set_opaque_region(struct wl_client *client,
 			  struct wl_resource *resource,
@@ -3520,6 +4752,7 @@ surface_set_opaque_region(struct wl_client *client,
 	} else {
 		pixman_region32_clear(&surface->pending.opaque);
 	}
+	region_serial_bump(&surface->pending.opaque_serial);
 }
 
 static void
@@ -3538,6 +4771,7 @@ surface_set_input_region(struct wl_client *client,
 		pixman_region32_fini(&surface->pending.input);
 		region_init_infinite(&surface->pending.input);
 	}
+	region_serial_bump(&surface->pending.input_serial);
 }
 
 /* Cause damage to this sub-surface and all its children.
@@ -3568,8 +4802,10 @@ weston_surface_commit_subsurface_order(struct weston_surface *surface)
 		wl_list_remove(&sub->parent_link);
 		wl_list_insert(&surface->subsurface_list, &sub->parent_link);
 
-		if (sub->reordered)
+		if (sub->reordered) {
 			weston_surface_damage_subsurfaces(sub);
+			weston_compositor_view_list_dirty(surface->compositor);
+		}
 	}
 }
 
@@ -3736,6 +4972,79 @@ weston_surface_is_pending_viewport_dst_size_int(
 	       fixed_is_integer(vp->buffer.src_height);
 }
 
+static void
+weston_surface_content_hash_destroy(struct weston_surface *surface)
+{
+	if (!surface->content_hash)
+		return;
+
+	weston_content_hash_fini(surface->content_hash);
+	free(surface->content_hash);
+	surface->content_hash = NULL;
+}
+
+/** Drop the damage of a commit which attached the same pixels again
+ *
+ * Some clients redraw and commit identical wl_shm buffers every frame.
+ * Hashing the damaged tiles is much cheaper than uploading them and
+ * repainting the output, so with the shm-content-hash option a commit
+ * whose damaged pixels all hash as before carries no damage at all.
+ * Must be called after the buffer is attached.
+ */
+static void
+weston_surface_drop_unchanged_damage(struct weston_surface *surface,
+				     struct weston_surface_state *state)
+{
+	struct weston_buffer *buffer = surface->buffer_ref.buffer;
+	const struct pixel_format_info *pinfo = NULL;
+	struct wl_shm_buffer *shm = NULL;
+	pixman_region32_t damage;
+	uint32_t format = 0;
+	bool changed;
+
+	if (buffer)
+		shm = wl_shm_buffer_get(buffer->resource);
+	if (shm) {
+		format = wl_shm_buffer_get_format(shm);
+		pinfo = pixel_format_get_info_shm(format);
+	}
+
+	/* Single plane formats only, and the next wl_shm buffer after any
+	 * other kind of content starts from scratch. */
+	if (!pinfo || pinfo->bpp == 0 || pinfo->bpp % 8 != 0) {
+		weston_surface_content_hash_destroy(surface);
+		return;
+	}
+
+	if (!surface->content_hash) {
+		surface->content_hash = zalloc(sizeof *surface->content_hash);
+		if (!surface->content_hash)
+			return;
+	}
+
+	pixman_region32_init(&damage);
+	weston_matrix_transform_region(&damage,
+				       &surface->surface_to_buffer_matrix,
+				       &state->damage_surface);
+	pixman_region32_union(&damage, &damage, &state->damage_buffer);
+
+	wl_shm_buffer_begin_access(shm);
+	changed = weston_content_hash_update(surface->content_hash,
+					     wl_shm_buffer_get_data(shm),
+					     wl_shm_buffer_get_width(shm),
+					     wl_shm_buffer_get_height(shm),
+					     wl_shm_buffer_get_stride(shm),
+					     format, pinfo->bpp / 8, &damage);
+	wl_shm_buffer_end_access(shm);
+
+	pixman_region32_fini(&damage);
+
+	if (!changed) {
+		pixman_region32_clear(&state->damage_surface);
+		pixman_region32_clear(&state->damage_buffer);
+	}
+}
+
 /* Translate pending damage in buffer co-ordinates to surface
  * co-ordinates and union it with a pixman_region32_t.
  * This should only be called after the buffer is attached.
@@ -3802,6 +5111,10 @@ weston_surface_commit_state(struct weston_surface *surface,
 {
 	struct weston_view *view;
 	pixman_region32_t opaque;
+	bool attached = state->newly_attached;
+	bool resized;
+
+	weston_surface_dirty_paint_nodes(surface);
 
 	/* wl_surface.set_buffer_transform */
 	/* wl_surface.set_buffer_scale */
@@ -3818,6 +5131,8 @@ weston_surface_commit_state(struct weston_surface *surface,
 		weston_buffer_release_move(&surface->buffer_release_ref,
 					   &state->buffer_release_ref);
 		weston_surface_attach(surface, state->buffer);
+		if (state->buffer)
+			weston_frame_stats_commit(surface);
 	}
 	weston_surface_state_set_buffer(state, NULL);
 	assert(state->acquire_fence_fd == -1);
@@ -3839,6 +5154,9 @@ weston_surface_commit_state(struct weston_surface *surface,
 	state->newly_attached = 0;
 	state->buffer_viewport.changed = 0;
 
+	if (attached && surface->compositor->shm_content_hash)
+		weston_surface_drop_unchanged_damage(surface, state);
+
 	/* wl_surface.damage and wl_surface.damage_buffer */
 	if (pixman_region32_not_empty(&state->damage_surface) ||
 	     pixman_region32_not_empty(&state->damage_buffer))
@@ -3853,22 +5171,35 @@ weston_surface_commit_state(struct weston_surface *surface,
 				       0, 0, surface->width, surface->height);
 	pixman_region32_clear(&state->damage_surface);
 
+	/* Regions only need clipping again if they or the size changed. */
+	resized = surface->region_width != surface->width ||
+		  surface->region_height != surface->height;
+	surface->region_width = surface->width;
+	surface->region_height = surface->height;
+
 	/* wl_surface.set_opaque_region */
-	pixman_region32_init(&opaque);
-	pixman_region32_intersect_rect(&opaque, &state->opaque,
-				       0, 0, surface->width, surface->height);
+	if (resized || surface->opaque_serial != state->opaque_serial) {
+		pixman_region32_init(&opaque);
+		pixman_region32_intersect_rect(&opaque, &state->opaque, 0, 0,
+					       surface->width, surface->height);
 
-	if (!pixman_region32_equal(&opaque, &surface->opaque)) {
-		pixman_region32_copy(&surface->opaque, &opaque);
-		wl_list_for_each(view, &surface->views, surface_link)
-			weston_view_geometry_dirty(view);
-	}
+		if (!pixman_region32_equal(&opaque, &surface->opaque)) {
+			pixman_region32_copy(&surface->opaque, &opaque);
+			wl_list_for_each(view, &surface->views, surface_link)
+				weston_view_geometry_dirty(view);
+		}
 
-	pixman_region32_fini(&opaque);
+		pixman_region32_fini(&opaque);
+		surface->opaque_serial = state->opaque_serial;
+	}
 
 	/* wl_surface.set_input_region */
-	pixman_region32_intersect_rect(&surface->input, &state->input,
-				       0, 0, surface->width, surface->height);
+	if (resized || surface->input_serial != state->input_serial) {
+		pixman_region32_intersect_rect(&surface->input, &state->input,
+					       0, 0, surface->width,
+					       surface->height);
+		surface->input_serial = state->input_serial;
+	}
 
 	/* wl_surface.frame */
 	wl_list_insert_list(&surface->frame_callback_list,
@@ -3893,12 +5224,20 @@ weston_surface_commit_state(struct weston_surface *surface,
 	/* weston_protected_surface.set_type */
 	weston_surface_set_desired_protection(surface, state->desired_protection);
 
+	/* weston_tearing_control_v1.set_presentation_hint */
+	surface->async_present = state->async_present;
+
+	/* weston_content_type_v1.set_content_type */
+	surface->content_type = state->content_type;
+
 	wl_signal_emit(&surface->commit_signal, surface);
 }
 
 static void
 weston_surface_commit(struct weston_surface *surface)
 {
+	WESTON_PROBE(surface_commit, surface, surface->pending.buffer);
+
 	weston_surface_commit_state(surface, &surface->pending);
 
 	weston_surface_commit_subsurface_order(surface);
@@ -3913,6 +5252,253 @@ static void
 weston_subsurface_parent_commit(struct weston_subsurface *sub,
 				int parent_is_synchronized);
 
+static void
+weston_surface_state_merge_pending(struct weston_surface *surface,
+				   struct weston_surface_state *dst);
+
+static void
+weston_commit_queue_entry_apply(struct weston_commit_queue_entry *entry,
+				struct weston_surface *surface)
+{
+	struct weston_subsurface *sub;
+
+	weston_surface_commit_state(surface, &entry->state);
+	weston_commit_queue_entry_destroy(entry);
+
+	weston_surface_commit_subsurface_order(surface);
+
+	weston_surface_schedule_repaint(surface);
+
+	wl_list_for_each(sub, &surface->subsurface_list, parent_link) {
+		if (sub->surface != surface)
+			weston_subsurface_parent_commit(sub, 0);
+	}
+}
+
+static void
+weston_surface_flush_commit_queue(struct weston_surface *surface)
+{
+	struct weston_commit_queue_entry *entry;
+
+	while (!wl_list_empty(&surface->commit_queue)) {
+		entry = container_of(surface->commit_queue.next,
+				     struct weston_commit_queue_entry, link);
+		weston_commit_queue_entry_apply(entry, surface);
+	}
+
+	wl_list_remove(&surface->commit_queue_link);
+	wl_list_init(&surface->commit_queue_link);
+}
+
+/* Whether the repaint about to start on the output is the one closest to
+ * the target of the commit. */
+static bool
+weston_commit_queue_entry_is_due(struct weston_commit_queue_entry *entry,
+				 struct weston_output *output)
+{
+	struct weston_surface_state *state = &entry->state;
+	struct timespec presentation;
+	int32_t refresh_nsec;
+
+	if (!state->has_target)
+		return true;
+
+	/* Outputs that do not count refreshes cannot honour MSC targets. */
+	if (state->target_is_msc)
+		return output->msc == 0 || state->target_msc <= output->msc + 1;
+
+	refresh_nsec = millihz_to_nsec(output->current_mode->refresh);
+	timespec_add_msec(&presentation, &output->next_repaint,
+			  output->repaint_time.window_msec);
+
+	return timespec_sub_to_nsec(&state->target_time,
+				    &presentation) < refresh_nsec / 2;
+}
+
+/* When to make sure the output is repainting, so that the repaint for the
+ * target is not missed: one and a half refresh periods ahead of it. */
+static int64_t
+weston_commit_queue_entry_msec_to_wake(struct weston_commit_queue_entry *entry,
+				       struct weston_output *output,
+				       const struct timespec *now)
+{
+	struct weston_surface_state *state = &entry->state;
+	struct timespec wake;
+	int32_t refresh_nsec;
+
+	if (!state->has_target)
+		return 0;
+
+	refresh_nsec = millihz_to_nsec(output->current_mode->refresh);
+
+	if (state->target_is_msc) {
+		if (output->msc == 0 || state->target_msc <= output->msc + 1)
+			return 0;
+		timespec_add_nsec(&wake, &output->frame_time,
+				  (int64_t)(state->target_msc - output->msc - 1) *
+				  refresh_nsec);
+	} else {
+		timespec_add_nsec(&wake, &state->target_time,
+				  -(int64_t)refresh_nsec * 3 / 2);
+	}
+
+	return timespec_sub_to_msec(&wake, now);
+}
+
+/** Keep the repaint loop of outputs with held back commits running
+ *
+ * Outputs whose next held back commit is close to its target get a repaint
+ * scheduled, the timer is armed for the earliest of the others. Commits of
+ * surfaces that are no longer on any output are applied right away.
+ */
+static void
+weston_compositor_update_commit_timing(struct weston_compositor *ec)
+{
+	struct weston_surface *surface, *next;
+	struct weston_commit_queue_entry *entry;
+	struct timespec now;
+	int64_t msec, msec_to_next = INT64_MAX;
+
+	weston_compositor_read_presentation_clock(ec, &now);
+
+	wl_list_for_each_safe(surface, next, &ec->commit_queue_list,
+			      commit_queue_link) {
+		if (!surface->output) {
+			weston_surface_flush_commit_queue(surface);
+			continue;
+		}
+
+		entry = container_of(surface->commit_queue.next,
+				     struct weston_commit_queue_entry, link);
+		msec = weston_commit_queue_entry_msec_to_wake(entry,
+							      surface->output,
+							      &now);
+		if (msec <= 0)
+			weston_output_schedule_repaint(surface->output);
+		else if (msec < msec_to_next)
+			msec_to_next = msec;
+	}
+
+	wl_event_source_timer_update(ec->commit_timing_timer,
+				     msec_to_next == INT64_MAX ? 0 : msec_to_next);
+}
+
+static int
+commit_timing_timer_handler(void *data)
+{
+	struct weston_compositor *ec = data;
+
+	weston_compositor_update_commit_timing(ec);
+
+	return 0;
+}
+
+/* Called right before an output repaints. */
+static void
+weston_output_apply_commit_queue(struct weston_output *output)
+{
+	struct weston_compositor *ec = output->compositor;
+	struct weston_surface *surface, *next;
+	struct weston_commit_queue_entry *entry;
+
+	if (wl_list_empty(&ec->commit_queue_list))
+		return;
+
+	wl_list_for_each_safe(surface, next, &ec->commit_queue_list,
+			      commit_queue_link) {
+		if (surface->output != output)
+			continue;
+
+		while (!wl_list_empty(&surface->commit_queue)) {
+			entry = container_of(surface->commit_queue.next,
+					     struct weston_commit_queue_entry,
+					     link);
+			if (!weston_commit_queue_entry_is_due(entry, output))
+				break;
+
+			weston_commit_queue_entry_apply(entry, surface);
+		}
+
+		if (wl_list_empty(&surface->commit_queue)) {
+			wl_list_remove(&surface->commit_queue_link);
+			wl_list_init(&surface->commit_queue_link);
+		}
+	}
+
+	weston_compositor_update_commit_timing(ec);
+}
+
+/* Hold the pending state back if it has a target, or if earlier commits are
+ * still held back. Returns false if the commit should be applied now. */
+static bool
+weston_surface_queue_commit(struct weston_surface *surface)
+{
+	struct weston_compositor *ec = surface->compositor;
+	struct wl_client *client = wl_resource_get_client(surface->resource);
+	struct weston_commit_queue_entry *entry;
+	bool defer;
+
+	/* See client-budget.c */
+	defer = !surface->pending.has_target &&
+		weston_client_budget_exceeded(ec, client);
+
+	if (!surface->pending.has_target && !defer &&
+	    wl_list_empty(&surface->commit_queue))
+		return false;
+
+	if (!surface->output) {
+		weston_surface_flush_commit_queue(surface);
+		surface->pending.has_target = false;
+		return false;
+	}
+
+	if (defer)
+		weston_client_budget_note_deferred(ec, client);
+
+	/* Commits without a target behind one that has none either apply
+	 * in the same repaint, so they fold into it. */
+	if (!surface->pending.has_target &&
+	    !wl_list_empty(&surface->commit_queue)) {
+		entry = container_of(surface->commit_queue.prev,
+				     struct weston_commit_queue_entry, link);
+		if (!entry->state.has_target) {
+			if (surface->pending.newly_attached)
+				weston_buffer_reference(&entry->buffer_ref,
+							surface->pending.buffer);
+			weston_surface_state_merge_pending(surface,
+							   &entry->state);
+			return true;
+		}
+	}
+
+	entry = zalloc(sizeof *entry);
+	if (!entry) {
+		wl_client_post_no_memory(client);
+		return true;
+	}
+
+	weston_surface_state_init(&entry->state);
+	if (surface->pending.newly_attached)
+		weston_buffer_reference(&entry->buffer_ref,
+					surface->pending.buffer);
+	weston_surface_state_merge_pending(surface, &entry->state);
+
+	entry->state.has_target = surface->pending.has_target;
+	entry->state.target_is_msc = surface->pending.target_is_msc;
+	entry->state.target_time = surface->pending.target_time;
+	entry->state.target_msc = surface->pending.target_msc;
+	surface->pending.has_target = false;
+
+	if (wl_list_empty(&surface->commit_queue))
+		wl_list_insert(&ec->commit_queue_list,
+			       &surface->commit_queue_link);
+	wl_list_insert(surface->commit_queue.prev, &entry->link);
+
+	weston_compositor_update_commit_timing(ec);
+
+	return true;
+}
+
 static void
 surface_commit(struct wl_client *client, struct wl_resource *resource)
 {
@@ -3980,10 +5566,14 @@ surface_commit(struct wl_client *client, struct wl_resource *resource)
 	}
 
 	if (sub) {
+		surface->pending.has_target = false;
 		weston_subsurface_commit(sub);
 		return;
 	}
 
+	if (weston_surface_queue_commit(surface))
+		return;
+
 	weston_surface_commit(surface);
 
 	wl_list_for_each(sub, &surface->subsurface_list, parent_link) {
@@ -4042,32 +5632,7 @@ static const struct wl_surface_interface surface_interface = {
 	surface_set_buffer_transform,
 	surface_set_buffer_scale,
 	surface_damage_buffer
-};
-
-static int
-create_surface_dmabuf_feedback(struct weston_compositor *ec,
-			       struct weston_surface *surface)
-{
-	struct weston_dmabuf_feedback_tranche *tranche;
-	dev_t main_device = ec->default_dmabuf_feedback->main_device;
-	uint32_t flags = 0;
-
-	surface->dmabuf_feedback = weston_dmabuf_feedback_create(main_device);
-	if (!surface->dmabuf_feedback)
-		return -1;
-
-	tranche = weston_dmabuf_feedback_tranche_create(surface->dmabuf_feedback,
-							ec->dmabuf_feedback_format_table,
-							main_device, flags,
-							RENDERER_PREF);
-	if (!tranche) {
-		weston_dmabuf_feedback_destroy(surface->dmabuf_feedback);
-		surface->dmabuf_feedback = NULL;
-		return -1;
-	}
-
-	return 0;
-}
+};
 
 static void
 compositor_create_surface(struct wl_client *client,
@@ -4075,23 +5640,16 @@ compositor_create_surface(struct wl_client *client,
 {
 	struct weston_compositor *ec = wl_resource_get_user_data(resource);
 	struct weston_surface *surface;
-	int ret;
 
 	surface = weston_surface_create(ec);
 	if (surface == NULL)
 		goto err;
 
-	if (ec->default_dmabuf_feedback) {
-		ret = create_surface_dmabuf_feedback(ec, surface);
-		if (ret < 0)
-			goto err_dmabuf_feedback;
-	}
-
 	surface->resource =
 		wl_resource_create(client, &wl_surface_interface,
 				   wl_resource_get_version(resource), id);
 	if (surface->resource == NULL)
-		goto err_dmabuf_feedback;
+		goto err_surface;
 	wl_resource_set_implementation(surface->resource, &surface_interface,
 				       surface, destroy_surface);
 
@@ -4099,7 +5657,7 @@ compositor_create_surface(struct wl_client *client,
 
 	return;
 
-err_dmabuf_feedback:
+err_surface:
 	weston_surface_destroy(surface);
 err:
 	wl_resource_post_no_memory(resource);
@@ -4193,68 +5751,95 @@ weston_subsurface_commit_from_cache(struct weston_subsurface *sub)
 	sub->has_cached_data = 0;
 }
 
+/** Move the pending state of a surface on top of a state not yet applied
+ *
+ * Used for the sub-surface cache and for commits held back by
+ * weston_commit_timer_v1. The buffer itself is only weakly referenced by
+ * \c dst, the caller must keep a weston_buffer_reference to it.
+ */
 static void
-weston_subsurface_commit_to_cache(struct weston_subsurface *sub)
+weston_surface_state_merge_pending(struct weston_surface *surface,
+				   struct weston_surface_state *dst)
 {
-	struct weston_surface *surface = sub->surface;
-
 	/*
 	 * If this commit would cause the surface to move by the
 	 * attach(dx, dy) parameters, the old damage region must be
 	 * translated to correspond to the new surface coordinate system
 	 * origin.
 	 */
-	pixman_region32_translate(&sub->cached.damage_surface,
-				  -surface->pending.sx, -surface->pending.sy);
-	pixman_region32_union(&sub->cached.damage_surface,
-			      &sub->cached.damage_surface,
-			      &surface->pending.damage_surface);
-	pixman_region32_clear(&surface->pending.damage_surface);
+	if (surface->pending.sx != 0 || surface->pending.sy != 0)
+		pixman_region32_translate(&dst->damage_surface,
+					  -surface->pending.sx,
+					  -surface->pending.sy);
+	if (pixman_region32_not_empty(&surface->pending.damage_surface)) {
+		pixman_region32_union(&dst->damage_surface,
+				      &dst->damage_surface,
+				      &surface->pending.damage_surface);
+		pixman_region32_clear(&surface->pending.damage_surface);
+	}
 
 	if (surface->pending.newly_attached) {
-		sub->cached.newly_attached = 1;
-		weston_surface_state_set_buffer(&sub->cached,
-						surface->pending.buffer);
-		weston_buffer_reference(&sub->cached_buffer_ref,
-					surface->pending.buffer);
-		weston_presentation_feedback_discard_list(
-					&sub->cached.feedback_list);
+		dst->newly_attached = 1;
+		weston_surface_state_set_buffer(dst, surface->pending.buffer);
+		weston_presentation_feedback_discard_list(&dst->feedback_list);
 		/* zwp_surface_synchronization_v1.set_acquire_fence */
-		fd_move(&sub->cached.acquire_fence_fd,
+		fd_move(&dst->acquire_fence_fd,
 			&surface->pending.acquire_fence_fd);
 		/* zwp_surface_synchronization_v1.get_release */
-		weston_buffer_release_move(&sub->cached.buffer_release_ref,
+		weston_buffer_release_move(&dst->buffer_release_ref,
 					   &surface->pending.buffer_release_ref);
 	}
-	sub->cached.desired_protection = surface->pending.desired_protection;
-	sub->cached.protection_mode = surface->pending.protection_mode;
+	dst->desired_protection = surface->pending.desired_protection;
+	dst->protection_mode = surface->pending.protection_mode;
+	dst->async_present = surface->pending.async_present;
+	dst->content_type = surface->pending.content_type;
 	assert(surface->pending.acquire_fence_fd == -1);
 	assert(surface->pending.buffer_release_ref.buffer_release == NULL);
-	sub->cached.sx += surface->pending.sx;
-	sub->cached.sy += surface->pending.sy;
+	dst->sx += surface->pending.sx;
+	dst->sy += surface->pending.sy;
 
-	apply_damage_buffer(&sub->cached.damage_surface, surface, &surface->pending);
+	apply_damage_buffer(&dst->damage_surface, surface, &surface->pending);
 
-	sub->cached.buffer_viewport.changed |=
+	dst->buffer_viewport.changed |=
 		surface->pending.buffer_viewport.changed;
-	sub->cached.buffer_viewport.buffer =
+	dst->buffer_viewport.buffer =
 		surface->pending.buffer_viewport.buffer;
-	sub->cached.buffer_viewport.surface =
+	dst->buffer_viewport.surface =
 		surface->pending.buffer_viewport.surface;
 
 	weston_surface_reset_pending_buffer(surface);
 
-	pixman_region32_copy(&sub->cached.opaque, &surface->pending.opaque);
+	/* The pending regions persist from commit to commit, and clients
+	 * rarely set them again, so only copy what was set since. */
+	if (dst->opaque_serial != surface->pending.opaque_serial) {
+		pixman_region32_copy(&dst->opaque, &surface->pending.opaque);
+		dst->opaque_serial = surface->pending.opaque_serial;
+	}
 
-	pixman_region32_copy(&sub->cached.input, &surface->pending.input);
+	if (dst->input_serial != surface->pending.input_serial) {
+		pixman_region32_copy(&dst->input, &surface->pending.input);
+		dst->input_serial = surface->pending.input_serial;
+	}
 
-	wl_list_insert_list(&sub->cached.frame_callback_list,
+	wl_list_insert_list(&dst->frame_callback_list,
 			    &surface->pending.frame_callback_list);
 	wl_list_init(&surface->pending.frame_callback_list);
 
-	wl_list_insert_list(&sub->cached.feedback_list,
+	wl_list_insert_list(&dst->feedback_list,
 			    &surface->pending.feedback_list);
 	wl_list_init(&surface->pending.feedback_list);
+}
+
+static void
+weston_subsurface_commit_to_cache(struct weston_subsurface *sub)
+{
+	struct weston_surface *surface = sub->surface;
+
+	if (surface->pending.newly_attached)
+		weston_buffer_reference(&sub->cached_buffer_ref,
+					surface->pending.buffer);
+
+	weston_surface_state_merge_pending(surface, &sub->cached);
 
 	sub->has_cached_data = 1;
 }
@@ -4362,6 +5947,7 @@ subsurface_committed(struct weston_surface *surface, int32_t dx, int32_t dy)
 
 	if (!weston_surface_is_mapped(surface)) {
 		surface->is_mapped = true;
+		weston_compositor_view_list_dirty(surface->compositor);
 
 		/* Cannot call weston_view_update_transform(),
 		 * because that would call it also for the parent surface,
@@ -4504,6 +6090,23 @@ weston_surface_get_bounding_box(struct weston_surface *surface)
 	return geometry;
 }
 
+static bool
+surface_copy_rect_is_valid(struct weston_surface *surface,
+			   int src_x, int src_y, int width, int height)
+{
+	int cw, ch;
+
+	weston_surface_get_content_size(surface, &cw, &ch);
+
+	if (src_x < 0 || src_y < 0)
+		return false;
+
+	if (width <= 0 || height <= 0)
+		return false;
+
+	return src_x + width <= cw && src_y + height <= ch;
+}
+
 /** Copy surface contents to system memory.
  *
  * \param surface The surface to copy from.
@@ -4552,28 +6155,135 @@ weston_surface_copy_content(struct weston_surface *surface,
 			    int width, int height)
 {
 	struct weston_renderer *rer = surface->compositor->renderer;
-	int cw, ch;
 	const size_t bytespp = 4; /* PIXMAN_a8b8g8r8 */
 
 	if (!rer->surface_copy_content)
 		return -1;
 
-	weston_surface_get_content_size(surface, &cw, &ch);
-
-	if (src_x < 0 || src_y < 0)
+	if (!surface_copy_rect_is_valid(surface, src_x, src_y, width, height))
 		return -1;
 
-	if (width <= 0 || height <= 0)
+	if (width * bytespp * height > size)
 		return -1;
 
-	if (src_x + width > cw || src_y + height > ch)
+	return rer->surface_copy_content(surface, target, size,
+					 src_x, src_y, width, height);
+}
+
+struct weston_surface_copy {
+	weston_surface_copy_content_done_func_t done;
+	void *data;
+	void *pixels;
+	struct wl_event_source *idle;
+	struct wl_listener surface_destroy_listener;
+};
+
+static void
+weston_surface_copy_finish(struct weston_surface_copy *copy,
+			   const void *pixels)
+{
+	wl_list_remove(&copy->surface_destroy_listener.link);
+	wl_event_source_remove(copy->idle);
+
+	copy->done(copy->data, pixels);
+
+	free(copy->pixels);
+	free(copy);
+}
+
+static void
+weston_surface_copy_idle(void *data)
+{
+	struct weston_surface_copy *copy = data;
+
+	weston_surface_copy_finish(copy, copy->pixels);
+}
+
+static void
+weston_surface_copy_handle_surface_destroy(struct wl_listener *listener,
+					   void *data)
+{
+	struct weston_surface_copy *copy =
+		container_of(listener, struct weston_surface_copy,
+			     surface_destroy_listener);
+
+	weston_surface_copy_finish(copy, NULL);
+}
+
+/** Copy surface contents without waiting for the GPU
+ *
+ * \param surface The surface to copy from.
+ * \param src_x X location on contents to copy from.
+ * \param src_y Y location on contents to copy from.
+ * \param width Width in pixels of the area to copy.
+ * \param height Height in pixels of the area to copy.
+ * \param done Called with the pixels once the copy has finished.
+ * \param data User data for done.
+ * \return 0 if the copy was started, -1 for failure.
+ *
+ * Like weston_surface_copy_content(), but the pixels are handed to done
+ * from the event loop instead of being read back before returning, which
+ * keeps periodic captures such as thumbnails from stalling the compositor
+ * on the GPU. The rectangle rules and pixel layout are the same.
+ *
+ * On success done is called exactly once and never from within this
+ * call, with NULL pixels if the copy failed or the surface was destroyed
+ * first. On failure done is never called.
+ *
+ * Renderers without an asynchronous read-back copy synchronously into a
+ * temporary buffer and deliver it from an idle callback.
+ */
+WL_EXPORT int
+weston_surface_copy_content_async(struct weston_surface *surface,
+				  int src_x, int src_y,
+				  int width, int height,
+				  weston_surface_copy_content_done_func_t done,
+				  void *data)
+{
+	struct weston_renderer *rer = surface->compositor->renderer;
+	const size_t bytespp = 4; /* PIXMAN_a8b8g8r8 */
+	struct weston_surface_copy *copy;
+	struct wl_event_loop *loop;
+	size_t size;
+
+	if (!surface_copy_rect_is_valid(surface, src_x, src_y, width, height))
 		return -1;
 
-	if (width * bytespp * height > size)
+	if (rer->surface_copy_content_async &&
+	    rer->surface_copy_content_async(surface, src_x, src_y,
+					    width, height, done, data) == 0)
+		return 0;
+
+	copy = zalloc(sizeof *copy);
+	if (!copy)
 		return -1;
 
-	return rer->surface_copy_content(surface, target, size,
-					 src_x, src_y, width, height);
+	size = width * bytespp * height;
+	copy->pixels = malloc(size);
+	if (!copy->pixels ||
+	    weston_surface_copy_content(surface, copy->pixels, size,
+					src_x, src_y, width, height) < 0)
+		goto err;
+
+	loop = wl_display_get_event_loop(surface->compositor->wl_display);
+	copy->idle = wl_event_loop_add_idle(loop, weston_surface_copy_idle,
+					    copy);
+	if (!copy->idle)
+		goto err;
+
+	copy->done = done;
+	copy->data = data;
+	copy->surface_destroy_listener.notify =
+		weston_surface_copy_handle_surface_destroy;
+	wl_signal_add(&surface->destroy_signal,
+		      &copy->surface_destroy_listener);
+
+	return 0;
+
+err:
+	free(copy->pixels);
+	free(copy);
+	return -1;
 }
 
 static void
@@ -4700,6 +6410,7 @@ subsurface_set_desync(struct wl_client *client, struct wl_resource *resource)
 static void
 weston_subsurface_unlink_parent(struct weston_subsurface *sub)
 {
+	weston_compositor_view_list_dirty(sub->parent->compositor);
 	wl_list_remove(&sub->parent_link);
 	wl_list_remove(&sub->parent_link_pending);
 	wl_list_remove(&sub->parent_destroy_listener.link);
@@ -4766,6 +6477,7 @@ weston_subsurface_link_parent(struct weston_subsurface *sub,
 	wl_list_insert(&parent->subsurface_list, &sub->parent_link);
 	wl_list_insert(&parent->subsurface_list_pending,
 		       &sub->parent_link_pending);
+	weston_compositor_view_list_dirty(parent->compositor);
 }
 
 static void
@@ -6048,7 +7760,7 @@ weston_compositor_reflow_outputs(struct weston_compositor *compositor,
 			continue;
 		}
 
-		if (start_resizing) {
+		if (start_resizing && !output->mirror) {
 			weston_output_move(output, output->x + delta_width, output->y);
 			output->dirty = 1;
 		}
@@ -6074,7 +7786,7 @@ WL_EXPORT void
 weston_output_region_from_global(struct weston_output *output,
 				 pixman_region32_t *region)
 {
-	if (output->zoom.active) {
+	if (output->zoom.active && !output->zoom.scanout) {
 		weston_matrix_transform_region(region, &output->matrix, region);
 	} else {
 		pixman_region32_translate(region, -output->x, -output->y);
@@ -6088,14 +7800,24 @@ weston_output_region_from_global(struct weston_output *output,
 static void
 weston_output_update_matrix(struct weston_output *output)
 {
-	float magnification;
+	float magnification = 1.0f;
 
 	weston_matrix_init(&output->matrix);
 	weston_matrix_translate(&output->matrix, -output->x, -output->y, 0);
 
+	output->zoom.scanout = false;
 	if (output->zoom.active) {
 		magnification = 1 / (1 - output->zoom.spring_z.current);
 		weston_output_update_zoom(output);
+		output->zoom.scanout = output->zoom.scanout_capable;
+	}
+
+	if (output->zoom.scanout) {
+		output->zoom.area.x = output->zoom.trans_x;
+		output->zoom.area.y = output->zoom.trans_y;
+		output->zoom.area.width = output->width / magnification;
+		output->zoom.area.height = output->height / magnification;
+	} else if (output->zoom.active) {
 		weston_matrix_translate(&output->matrix, -output->zoom.trans_x,
 					-output->zoom.trans_y, 0);
 		weston_matrix_scale(&output->matrix, magnification,
@@ -6168,6 +7890,8 @@ weston_output_init_geometry(struct weston_output *output, int x, int y)
 	pixman_region32_init_rect(&output->region, x, y,
 				  output->width,
 				  output->height);
+
+	weston_compositor_pick_grid_dirty(output->compositor);
 }
 
 /**
@@ -6257,10 +7981,14 @@ weston_compositor_add_output(struct weston_compositor *compositor,
 	wl_list_insert(compositor->output_list.prev, &output->link);
 	output->enabled = true;
 
-	wl_list_for_each(head, &output->head_list, output_link)
-		weston_head_add_global(head);
+	/* Shells and clients only get to see outputs with their own
+	 * content. */
+	if (!output->mirror) {
+		wl_list_for_each(head, &output->head_list, output_link)
+			weston_head_add_global(head);
 
-	wl_signal_emit(&compositor->output_created_signal, output);
+		wl_signal_emit(&compositor->output_created_signal, output);
+	}
 
 	/*
 	 * Use view_list, as paint nodes have not been created for this
@@ -6349,6 +8077,35 @@ weston_output_set_color_transforms(struct weston_output *output)
 	return true;
 }
 
+/** Let the backend apply the output color transformation
+ *
+ * \param output The output being enabled.
+ *
+ * A backend calls this from its enable hook, before creating the renderer
+ * state, when the display hardware can apply the sRGB to output color
+ * transformation to everything it shows. The renderer then blends
+ * electrical sRGB without any color transformation, and
+ * from_blend_to_output becomes that sRGB to output transformation, for the
+ * backend to apply.
+ *
+ * This is reset whenever the color transformations are recomputed.
+ *
+ * \ingroup output
+ * \internal
+ */
+WL_EXPORT void
+weston_output_set_color_transform_by_backend(struct weston_output *output)
+{
+	assert(!output->enabled);
+
+	weston_color_transform_unref(output->from_blend_to_output);
+	output->from_blend_to_output = output->from_sRGB_to_output;
+	output->from_blend_to_output_by_backend = true;
+	output->from_sRGB_to_output = NULL;
+	weston_color_transform_unref(output->from_sRGB_to_blend);
+	output->from_sRGB_to_blend = NULL;
+}
+
 /** Removes output from compositor's list of enabled outputs
  *
  * \param output The weston_output object that is being removed.
@@ -6397,6 +8154,8 @@ weston_compositor_remove_output(struct weston_output *output)
 	}
 	assert(wl_list_empty(&output->paint_node_z_order_list));
 
+	weston_compositor_pick_grid_dirty(compositor);
+
 	/*
 	 * Use view_list in case the output did not go through repaint
 	 * after a view came on it, lacking a paint node. Just to be sure.
@@ -6410,17 +8169,24 @@ weston_compositor_remove_output(struct weston_output *output)
 
 	weston_presentation_feedback_discard_list(&output->feedback_list);
 
-	weston_compositor_reflow_outputs(compositor, output, -output->width);
+	weston_output_release_view_timeline(output);
+
+	if (!output->mirror)
+		weston_compositor_reflow_outputs(compositor, output,
+						 -output->width);
 
 	wl_list_remove(&output->link);
 	wl_list_insert(compositor->pending_output_list.prev, &output->link);
 	output->enabled = false;
 
-	weston_signal_emit_mutable(&compositor->output_destroyed_signal, output);
+	if (!output->mirror)
+		weston_signal_emit_mutable(&compositor->output_destroyed_signal,
+					   output);
 	weston_signal_emit_mutable(&output->destroy_signal, output);
 
 	wl_list_for_each(head, &output->head_list, output_link)
 		weston_head_remove_global(head);
+	output->mirror = false;
 
 	compositor->output_id_pool &= ~(1u << output->id);
 	output->id = 0xffffffff; /* invalid */
@@ -6738,11 +8504,13 @@ weston_output_enable(struct weston_output *output)
 		assert(head->model);
 	}
 
-	iterator = container_of(c->output_list.prev,
-				struct weston_output, link);
+	wl_list_for_each_reverse(iterator, &c->output_list, link) {
+		if (iterator->mirror)
+			continue;
 
-	if (!wl_list_empty(&c->output_list))
 		x = iterator->x + iterator->width;
+		break;
+	}
 
 	/* Make sure the scale is set up */
 	assert(output->scale);
@@ -6765,9 +8533,12 @@ weston_output_enable(struct weston_output *output)
 	weston_output_damage(output);
 
 	wl_list_init(&output->animation_list);
+	weston_output_init_view_timeline(output);
 	wl_list_init(&output->feedback_list);
 	wl_list_init(&output->paint_node_list);
 	wl_list_init(&output->paint_node_z_order_list);
+	output->paint_node_z_order_dirty = true;
+	output->repaint_time.window_msec = output->compositor->repaint_msec;
 
 	if (!weston_output_set_color_transforms(output))
 		return -1;
@@ -6938,6 +8709,8 @@ weston_output_release(struct weston_output *output)
 		weston_compositor_remove_output(output);
 
 	weston_color_profile_unref(output->color_profile);
+	weston_frame_stats_output_destroy(output);
+	weston_output_frame_arena_destroy(output);
 
 	pixman_region32_fini(&output->region);
 	wl_list_remove(&output->link);
@@ -7422,6 +9195,149 @@ bind_presentation(struct wl_client *client,
 	wp_presentation_send_clock_id(resource, compositor->presentation_clock);
 }
 
+static void
+commit_timer_destroy(struct wl_client *client, struct wl_resource *resource)
+{
+	wl_resource_destroy(resource);
+}
+
+static bool
+commit_timer_check_target(struct wl_resource *resource)
+{
+	struct weston_surface *surface = wl_resource_get_user_data(resource);
+
+	if (!surface) {
+		wl_resource_post_error(resource,
+				       WESTON_COMMIT_TIMER_V1_ERROR_SURFACE_DESTROYED,
+				       "the wl_surface was destroyed");
+		return false;
+	}
+
+	if (surface->pending.has_target) {
+		wl_resource_post_error(resource,
+				       WESTON_COMMIT_TIMER_V1_ERROR_TIMESTAMP_EXISTS,
+				       "wl_surface@%"PRIu32" already has a target "
+				       "for this commit",
+				       wl_resource_get_id(surface->resource));
+		return false;
+	}
+
+	return true;
+}
+
+static void
+commit_timer_set_timestamp(struct wl_client *client,
+			   struct wl_resource *resource,
+			   uint32_t tv_sec_hi, uint32_t tv_sec_lo,
+			   uint32_t tv_nsec)
+{
+	struct weston_surface *surface = wl_resource_get_user_data(resource);
+
+	if (tv_nsec >= 1000000000) {
+		wl_resource_post_error(resource,
+				       WESTON_COMMIT_TIMER_V1_ERROR_INVALID_TIMESTAMP,
+				       "tv_nsec %"PRIu32" out of range", tv_nsec);
+		return;
+	}
+
+	if (!commit_timer_check_target(resource))
+		return;
+
+	surface->pending.has_target = true;
+	surface->pending.target_is_msc = false;
+	timespec_from_proto(&surface->pending.target_time,
+			    tv_sec_hi, tv_sec_lo, tv_nsec);
+}
+
+static void
+commit_timer_set_target_msc(struct wl_client *client,
+			    struct wl_resource *resource,
+			    uint32_t msc_hi, uint32_t msc_lo)
+{
+	struct weston_surface *surface = wl_resource_get_user_data(resource);
+
+	if (!commit_timer_check_target(resource))
+		return;
+
+	surface->pending.has_target = true;
+	surface->pending.target_is_msc = true;
+	surface->pending.target_msc = ((uint64_t)msc_hi << 32) + msc_lo;
+}
+
+static const struct weston_commit_timer_v1_interface commit_timer_implementation = {
+	commit_timer_destroy,
+	commit_timer_set_timestamp,
+	commit_timer_set_target_msc,
+};
+
+static void
+destroy_commit_timer(struct wl_resource *resource)
+{
+	struct weston_surface *surface = wl_resource_get_user_data(resource);
+
+	if (surface)
+		surface->commit_timer_resource = NULL;
+}
+
+static void
+commit_timing_destroy(struct wl_client *client, struct wl_resource *resource)
+{
+	wl_resource_destroy(resource);
+}
+
+static void
+commit_timing_get_timer(struct wl_client *client,
+			struct wl_resource *timing_resource,
+			uint32_t id,
+			struct wl_resource *surface_resource)
+{
+	struct weston_surface *surface =
+		wl_resource_get_user_data(surface_resource);
+	struct wl_resource *resource;
+
+	if (surface->commit_timer_resource) {
+		wl_resource_post_error(timing_resource,
+				       WESTON_COMMIT_TIMING_V1_ERROR_TIMER_EXISTS,
+				       "wl_surface@%"PRIu32" already has a timer",
+				       wl_resource_get_id(surface_resource));
+		return;
+	}
+
+	resource = wl_resource_create(client, &weston_commit_timer_v1_interface,
+				      1, id);
+	if (resource == NULL) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+
+	wl_resource_set_implementation(resource, &commit_timer_implementation,
+				       surface, destroy_commit_timer);
+	surface->commit_timer_resource = resource;
+}
+
+static const struct weston_commit_timing_v1_interface commit_timing_implementation = {
+	commit_timing_destroy,
+	commit_timing_get_timer,
+};
+
+static void
+bind_commit_timing(struct wl_client *client,
+		   void *data, uint32_t version, uint32_t id)
+{
+	struct weston_compositor *compositor = data;
+	struct wl_resource *resource;
+
+	resource = wl_resource_create(client, &weston_commit_timing_v1_interface,
+				      version, id);
+	if (resource == NULL) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+
+	wl_resource_set_implementation(resource, &commit_timing_implementation,
+				       compositor, NULL);
+}
+
 static void
 compositor_bind(struct wl_client *client,
 		void *data, uint32_t version, uint32_t id)
@@ -7637,6 +9553,9 @@ weston_compositor_print_scene_graph(struct weston_compositor *ec)
 
 		fprintf(fp, "\trepaint status: %s\n",
 			output_repaint_status_text(output));
+		fprintf(fp, "\trepaint window: %d ms%s\n",
+			output->repaint_time.window_msec,
+			ec->repaint_window_adaptive ? " (adaptive)" : "");
 		if (output->repaint_status == REPAINT_SCHEDULED)
 			fprintf(fp, "\tnext repaint: %ld.%09ld\n",
 				output->next_repaint.tv_sec,
@@ -7749,7 +9668,10 @@ weston_compositor_create(struct wl_display *display,
 
 	ec->weston_log_ctx = log_ctx;
 	ec->wl_display = display;
+	weston_log_ctx_set_event_loop(log_ctx,
+				      wl_display_get_event_loop(display));
 	ec->user_data = user_data;
+	ec->udmabuf_fd = -1;
 	wl_signal_init(&ec->destroy_signal);
 	wl_signal_init(&ec->create_surface_signal);
 	wl_signal_init(&ec->activate_signal);
@@ -7768,10 +9690,13 @@ weston_compositor_create(struct wl_display *display,
 	wl_signal_init(&ec->heads_changed_signal);
 	wl_signal_init(&ec->output_heads_changed_signal);
 	wl_signal_init(&ec->session_signal);
+	wl_signal_init(&ec->memory_pressure_signal);
+	wl_signal_init(&ec->metrics_signal);
 	ec->session_active = true;
 
 	ec->output_id_pool = 0;
 	ec->repaint_msec = DEFAULT_REPAINT_WINDOW;
+	ec->repaint_window_percentile = DEFAULT_REPAINT_WINDOW_PERCENTILE;
 
 	ec->activate_serial = 1;
 
@@ -7779,6 +9704,15 @@ weston_compositor_create(struct wl_display *display,
 
 	ec->content_protection = NULL;
 
+	if (weston_compositor_create_object_pools(ec) < 0)
+		goto fail;
+
+	if (weston_compositor_init_priority_loops(ec) < 0)
+		goto fail;
+
+	if (weston_compositor_init_client_budget(ec) < 0)
+		goto fail;
+
 	if (!wl_global_create(ec->wl_display, &wl_compositor_interface, 4,
 			      ec, compositor_bind))
 		goto fail;
@@ -7799,10 +9733,22 @@ weston_compositor_create(struct wl_display *display,
 			      ec, bind_presentation))
 		goto fail;
 
+	if (!wl_global_create(ec->wl_display,
+			      &weston_commit_timing_v1_interface, 1,
+			      ec, bind_commit_timing))
+		goto fail;
+
+	if (weston_tearing_control_setup(ec) < 0)
+		goto fail;
+
+	if (weston_content_type_setup(ec) < 0)
+		goto fail;
+
 	if (weston_input_init(ec) != 0)
 		goto fail;
 
 	wl_list_init(&ec->view_list);
+	wl_array_init(&ec->transform_dirty_views);
 	wl_list_init(&ec->plane_list);
 	wl_list_init(&ec->layer_list);
 	wl_list_init(&ec->seat_list);
@@ -7816,6 +9762,9 @@ weston_compositor_create(struct wl_display *display,
 	wl_list_init(&ec->axis_binding_list);
 	wl_list_init(&ec->debug_binding_list);
 
+	wl_list_init(&ec->xkb_info_list);
+	wl_list_init(&ec->xkb_keymap_cache);
+
 	wl_list_init(&ec->plugin_api_list);
 
 	weston_plane_init(&ec->primary_plane, ec, 0, 0);
@@ -7830,6 +9779,14 @@ weston_compositor_create(struct wl_display *display,
 	ec->repaint_timer =
 		wl_event_loop_add_timer(loop, output_repaint_timer_handler,
 					ec);
+	wl_list_init(&ec->frame_throttle_list);
+	ec->frame_throttle_timer =
+		wl_event_loop_add_timer(loop, frame_throttle_timer_handler,
+					ec);
+	wl_list_init(&ec->commit_queue_list);
+	ec->commit_timing_timer =
+		wl_event_loop_add_timer(loop, commit_timing_timer_handler,
+					ec);
 
 	weston_layer_init(&ec->fade_layer, ec);
 	weston_layer_init(&ec->cursor_layer, ec);
@@ -7850,9 +9807,38 @@ weston_compositor_create(struct wl_display *display,
 						weston_timeline_create_subscription,
 						weston_timeline_destroy_subscription,
 						ec);
+
+	ec->timeline_binary =
+		weston_compositor_add_log_scope(ec, "timeline-binary",
+						"Timeline event points, compact binary\n",
+						weston_timeline_binary_create_subscription,
+						weston_timeline_binary_destroy_subscription,
+						ec);
+
+	wl_list_init(&ec->frame_stats_client_list);
+	ec->frame_stats =
+		weston_compositor_add_log_scope(ec, "frame-stats",
+						"Frame timing histograms\n",
+						weston_frame_stats_print_cb,
+						NULL, ec);
+
+	ec->client_flush_scope =
+		weston_compositor_add_log_scope(ec, "client-flush",
+						"Client flush scheduling counters\n",
+						client_flush_stats_print_cb,
+						NULL, ec);
+
+	ec->object_pool_scope =
+		weston_compositor_add_log_scope(ec, "object-pools",
+						"Recycled object counters\n",
+						object_pool_stats_print_cb,
+						NULL, ec);
 	return ec;
 
 fail:
+	weston_compositor_fini_client_budget(ec);
+	weston_compositor_fini_priority_loops(ec);
+	weston_compositor_destroy_object_pools(ec);
 	free(ec);
 	return NULL;
 }
@@ -7867,6 +9853,16 @@ weston_compositor_shutdown(struct weston_compositor *ec)
 
 	wl_event_source_remove(ec->idle_source);
 	wl_event_source_remove(ec->repaint_timer);
+	if (ec->repaint_background_idle)
+		wl_event_source_remove(ec->repaint_background_idle);
+	wl_event_source_remove(ec->frame_throttle_timer);
+	wl_event_source_remove(ec->commit_timing_timer);
+	weston_compositor_memory_pressure_fini(ec);
+	weston_compositor_watchdog_fini(ec);
+	if (ec->flush_idle_source) {
+		wl_event_source_remove(ec->flush_idle_source);
+		ec->flush_idle_source = NULL;
+	}
 
 	/* Destroy all outputs associated with this compositor */
 	wl_list_for_each_safe(output, next, &ec->output_list, link)
@@ -8042,6 +10038,35 @@ weston_compositor_import_dmabuf(struct weston_compositor *compositor,
 	return renderer->import_dmabuf(compositor, buffer);
 }
 
+/** Start importing dmabuf buffer into the current renderer
+ *
+ * \param compositor The compositor.
+ * \param buffer The dmabuf buffer to import.
+ * \param done Called once the import finished, from the main loop.
+ * \param data User data for done.
+ * \return False if the renderer cannot import asynchronously, in which
+ * case done is not called and weston_compositor_import_dmabuf() should
+ * be used.
+ *
+ * Unlike weston_compositor_import_dmabuf(), this does not keep the
+ * compositor waiting for the driver while it creates the import.
+ *
+ * \ingroup compositor
+ */
+WL_EXPORT bool
+weston_compositor_import_dmabuf_async(struct weston_compositor *compositor,
+				      struct linux_dmabuf_buffer *buffer,
+				      weston_renderer_import_dmabuf_done_func_t done,
+				      void *data)
+{
+	struct weston_renderer *renderer = compositor->renderer;
+
+	if (renderer->import_dmabuf_async == NULL)
+		return false;
+
+	return renderer->import_dmabuf_async(compositor, buffer, done, data);
+}
+
 WL_EXPORT bool
 weston_compositor_dmabuf_can_scanout(struct weston_compositor *compositor,
 		struct linux_dmabuf_buffer *buffer)
@@ -8220,6 +10245,8 @@ weston_compositor_destroy(struct weston_compositor *compositor)
 	/* The backend is responsible for destroying the heads. */
 	assert(wl_list_empty(&compositor->head_list));
 
+	weston_compositor_fini_priority_loops(compositor);
+
 	weston_plugin_api_destroy_list(compositor);
 
 	if (compositor->heads_changed_source)
@@ -8228,14 +10255,36 @@ weston_compositor_destroy(struct weston_compositor *compositor)
 	weston_log_scope_destroy(compositor->debug_scene);
 	compositor->debug_scene = NULL;
 
+	pick_grid_release(compositor);
+	wl_array_release(&compositor->transform_dirty_views);
+
 	weston_log_scope_destroy(compositor->timeline);
 	compositor->timeline = NULL;
 
+	weston_log_scope_destroy(compositor->timeline_binary);
+	compositor->timeline_binary = NULL;
+
+	weston_log_scope_destroy(compositor->frame_stats);
+	compositor->frame_stats = NULL;
+
+	weston_log_scope_destroy(compositor->client_flush_scope);
+	compositor->client_flush_scope = NULL;
+	weston_compositor_fini_client_budget(compositor);
+	weston_frame_stats_compositor_destroy(compositor);
+
+	weston_log_scope_destroy(compositor->object_pool_scope);
+	compositor->object_pool_scope = NULL;
+
 	if (compositor->default_dmabuf_feedback) {
 		weston_dmabuf_feedback_destroy(compositor->default_dmabuf_feedback);
 		weston_dmabuf_feedback_format_table_destroy(compositor->dmabuf_feedback_format_table);
 	}
 
+	/* the event loop goes away with the display */
+	weston_log_ctx_set_event_loop(compositor->weston_log_ctx, NULL);
+
+	weston_compositor_destroy_object_pools(compositor);
+	weston_compositor_shm_udmabuf_fini(compositor);
 	free(compositor);
 }
 
@@ -0,0 +1,193 @@
+/*
+ * Copyright © 2022 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "content-hash.h"
+#include "shared/helpers.h"
+
+#define LANES 8
+#define PRIME1 0x9e3779b1u
+#define PRIME2 0x85ebca77u
+
+static inline uint32_t
+rotl32(uint32_t x, int r)
+{
+	return (x << r) | (x >> (32 - r));
+}
+
+/** Hash a run of bytes
+ *
+ * Eight independent 32-bit lanes consume 32 bytes per step, which the
+ * compiler turns into SSE4.1/AVX2 or NEON vector multiplies. This is
+ * not a cryptographic hash; it only has to tell changed pixels apart.
+ */
+uint64_t
+weston_content_hash_bytes(uint64_t seed, const void *data, size_t len)
+{
+	const uint8_t *p = data;
+	uint32_t lane[LANES];
+	uint32_t word[LANES];
+	uint64_t h;
+	int i;
+
+	for (i = 0; i < LANES; i++)
+		lane[i] = (uint32_t) seed + PRIME2 * (i + 1);
+
+	for (; len >= sizeof word; len -= sizeof word, p += sizeof word) {
+		memcpy(word, p, sizeof word);
+		for (i = 0; i < LANES; i++)
+			lane[i] = rotl32(lane[i] + word[i] * PRIME2, 13) * PRIME1;
+	}
+
+	if (len > 0) {
+		memset(word, 0, sizeof word);
+		memcpy(word, p, len);
+		for (i = 0; i < LANES; i++)
+			lane[i] = rotl32(lane[i] + word[i] * PRIME2, 13) * PRIME1;
+	}
+
+	h = seed ^ len;
+	for (i = 0; i < LANES; i++) {
+		h ^= lane[i];
+		h *= 0x100000001b3ull;
+		h ^= h >> 29;
+	}
+
+	return h;
+}
+
+void
+weston_content_hash_fini(struct weston_content_hash *hash)
+{
+	free(hash->tiles);
+	*hash = (struct weston_content_hash) { 0 };
+}
+
+static uint64_t
+hash_tile(const uint8_t *data, int32_t width, int32_t height,
+	  int32_t stride, int bytes_pp, int tx, int ty)
+{
+	int x = tx * WESTON_CONTENT_HASH_TILE;
+	int y = ty * WESTON_CONTENT_HASH_TILE;
+	int w = MIN(WESTON_CONTENT_HASH_TILE, width - x);
+	int h = MIN(WESTON_CONTENT_HASH_TILE, height - y);
+	uint64_t hash = 0;
+	int row;
+
+	for (row = 0; row < h; row++)
+		hash = weston_content_hash_bytes(hash,
+						 data + (size_t) (y + row) * stride +
+						 (size_t) x * bytes_pp,
+						 (size_t) w * bytes_pp);
+
+	return hash;
+}
+
+/** Hash the damaged tiles of a new buffer
+ *
+ * \param hash What the surface showed until now.
+ * \param data The pixels of the new buffer.
+ * \param damage The damage of the commit, in buffer coordinates.
+ * \return True if any pixel under the damage may differ from before.
+ *
+ * A buffer of another size or format starts over and counts as changed.
+ */
+bool
+weston_content_hash_update(struct weston_content_hash *hash,
+			   const void *data, int32_t width, int32_t height,
+			   int32_t stride, uint32_t format, int bytes_pp,
+			   pixman_region32_t *damage)
+{
+	const int tile = WESTON_CONTENT_HASH_TILE;
+	pixman_region32_t tiles;
+	pixman_box32_t *rects;
+	pixman_box32_t *boxes;
+	bool changed = false;
+	uint64_t value;
+	int n, i, tx, ty;
+
+	if (!hash->tiles || hash->width != width || hash->height != height ||
+	    hash->format != format) {
+		weston_content_hash_fini(hash);
+		hash->tiles_x = (width + tile - 1) / tile;
+		hash->tiles_y = (height + tile - 1) / tile;
+		hash->tiles = calloc((size_t) hash->tiles_x * hash->tiles_y,
+				     sizeof *hash->tiles);
+		if (!hash->tiles)
+			return true;
+
+		hash->width = width;
+		hash->height = height;
+		hash->format = format;
+
+		for (ty = 0; ty < hash->tiles_y; ty++)
+			for (tx = 0; tx < hash->tiles_x; tx++)
+				hash->tiles[ty * hash->tiles_x + tx] =
+					hash_tile(data, width, height, stride,
+						  bytes_pp, tx, ty);
+
+		return true;
+	}
+
+	/* Snap the damage to tiles first, so that a tile touched by several
+	 * damage rectangles is only hashed once. */
+	rects = pixman_region32_rectangles(damage, &n);
+	if (n == 0)
+		return false;
+
+	boxes = malloc(n * sizeof *boxes);
+	if (!boxes)
+		return true;
+
+	for (i = 0; i < n; i++) {
+		boxes[i].x1 = MAX(rects[i].x1, 0) / tile;
+		boxes[i].y1 = MAX(rects[i].y1, 0) / tile;
+		boxes[i].x2 = (MIN(rects[i].x2, width) + tile - 1) / tile;
+		boxes[i].y2 = (MIN(rects[i].y2, height) + tile - 1) / tile;
+	}
+	pixman_region32_init_rects(&tiles, boxes, n);
+	free(boxes);
+
+	rects = pixman_region32_rectangles(&tiles, &n);
+	for (i = 0; i < n; i++) {
+		for (ty = rects[i].y1; ty < rects[i].y2; ty++) {
+			for (tx = rects[i].x1; tx < rects[i].x2; tx++) {
+				value = hash_tile(data, width, height, stride,
+						  bytes_pp, tx, ty);
+				if (hash->tiles[ty * hash->tiles_x + tx] != value) {
+					hash->tiles[ty * hash->tiles_x + tx] = value;
+					changed = true;
+				}
+			}
+		}
+	}
+	pixman_region32_fini(&tiles);
+
+	return changed;
+}
@@ -0,0 +1,62 @@
+/*
+ * Copyright © 2022 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef WESTON_CONTENT_HASH_H
+#define WESTON_CONTENT_HASH_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <pixman.h>
+
+/** Edge length of the square tiles content is hashed in, in pixels */
+#define WESTON_CONTENT_HASH_TILE 64
+
+/** Fingerprint of what a surface last showed, tile by tile
+ *
+ * Used to notice clients which commit a new wl_shm buffer with the same
+ * pixels as before. Only the tiles touched by the damage of a commit
+ * are hashed again.
+ */
+struct weston_content_hash {
+	int32_t width, height;
+	uint32_t format;
+	int tiles_x, tiles_y;
+	uint64_t *tiles;
+};
+
+void
+weston_content_hash_fini(struct weston_content_hash *hash);
+
+uint64_t
+weston_content_hash_bytes(uint64_t seed, const void *data, size_t len);
+
+bool
+weston_content_hash_update(struct weston_content_hash *hash,
+			   const void *data, int32_t width, int32_t height,
+			   int32_t stride, uint32_t format, int bytes_pp,
+			   pixman_region32_t *damage);
+
+#endif /* WESTON_CONTENT_HASH_H */
@@ -0,0 +1,165 @@
+/*
+ * Copyright © 2022 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdint.h>
+
+#include <libweston/libweston.h>
+#include "libweston-internal.h"
+#include "weston-content-type-server-protocol.h"
+
+static void
+content_type_set_content_type(struct wl_client *client,
+			      struct wl_resource *resource,
+			      uint32_t content_type)
+{
+	struct weston_surface *surface = wl_resource_get_user_data(resource);
+
+	if (!surface)
+		return;
+
+	switch (content_type) {
+	case WESTON_CONTENT_TYPE_V1_TYPE_PHOTO:
+		surface->pending.content_type = WESTON_SURFACE_CONTENT_TYPE_PHOTO;
+		break;
+	case WESTON_CONTENT_TYPE_V1_TYPE_VIDEO:
+		surface->pending.content_type = WESTON_SURFACE_CONTENT_TYPE_VIDEO;
+		break;
+	case WESTON_CONTENT_TYPE_V1_TYPE_GAME:
+		surface->pending.content_type = WESTON_SURFACE_CONTENT_TYPE_GAME;
+		break;
+	default:
+		surface->pending.content_type = WESTON_SURFACE_CONTENT_TYPE_NONE;
+		break;
+	}
+}
+
+static void
+content_type_destroy(struct wl_client *client, struct wl_resource *resource)
+{
+	wl_resource_destroy(resource);
+}
+
+static const struct weston_content_type_v1_interface
+	content_type_implementation = {
+		content_type_set_content_type,
+		content_type_destroy,
+};
+
+static void
+destroy_content_type(struct wl_resource *resource)
+{
+	struct weston_surface *surface = wl_resource_get_user_data(resource);
+
+	if (!surface)
+		return;
+
+	surface->pending.content_type = WESTON_SURFACE_CONTENT_TYPE_NONE;
+	surface->content_type_resource = NULL;
+}
+
+static void
+content_type_manager_destroy(struct wl_client *client,
+			     struct wl_resource *resource)
+{
+	wl_resource_destroy(resource);
+}
+
+static void
+content_type_manager_get_surface_content_type(struct wl_client *client,
+					      struct wl_resource *manager_resource,
+					      uint32_t id,
+					      struct wl_resource *surface_resource)
+{
+	struct weston_surface *surface =
+		wl_resource_get_user_data(surface_resource);
+	struct wl_resource *resource;
+
+	if (surface->content_type_resource) {
+		wl_resource_post_error(manager_resource,
+				       WESTON_CONTENT_TYPE_MANAGER_V1_ERROR_ALREADY_CONSTRUCTED,
+				       "wl_surface@%u already has a content "
+				       "type object",
+				       wl_resource_get_id(surface_resource));
+		return;
+	}
+
+	resource = wl_resource_create(client,
+				      &weston_content_type_v1_interface,
+				      1, id);
+	if (!resource) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+
+	wl_resource_set_implementation(resource,
+				       &content_type_implementation,
+				       surface, destroy_content_type);
+	surface->content_type_resource = resource;
+}
+
+static const struct weston_content_type_manager_v1_interface
+	content_type_manager_implementation = {
+		content_type_manager_destroy,
+		content_type_manager_get_surface_content_type,
+};
+
+static void
+bind_content_type_manager(struct wl_client *client, void *data,
+			  uint32_t version, uint32_t id)
+{
+	struct weston_compositor *ec = data;
+	struct wl_resource *resource;
+
+	resource = wl_resource_create(client,
+				      &weston_content_type_manager_v1_interface,
+				      version, id);
+	if (!resource) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+
+	wl_resource_set_implementation(resource,
+				       &content_type_manager_implementation,
+				       ec, NULL);
+}
+
+/** Advertise weston_content_type_manager_v1
+ *
+ * The hint ends up in weston_surface::content_type. The DRM backend uses
+ * it when ranking views for planes and deciding on VRR and asynchronous
+ * flips; the core uses it to pace frame callbacks of hidden surfaces.
+ */
+int
+weston_content_type_setup(struct weston_compositor *ec)
+{
+	if (!wl_global_create(ec->wl_display,
+			      &weston_content_type_manager_v1_interface, 1,
+			      ec, bind_content_type_manager))
+		return -1;
+
+	return 0;
+}
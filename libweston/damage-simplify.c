@@ -0,0 +1,144 @@
+/*
+ * Copyright © 2022 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "damage-simplify.h"
+#include "shared/helpers.h"
+
+/* How far back the merge looks for a partner box. Region boxes come
+ * sorted top to bottom, so close neighbours are among the last ones. */
+#define MERGE_WINDOW 32
+
+static int64_t
+box_area(const pixman_box32_t *box)
+{
+	return (int64_t) (box->x2 - box->x1) * (box->y2 - box->y1);
+}
+
+static pixman_box32_t
+box_union(const pixman_box32_t *a, const pixman_box32_t *b)
+{
+	return (pixman_box32_t) {
+		.x1 = MIN(a->x1, b->x1),
+		.y1 = MIN(a->y1, b->y1),
+		.x2 = MAX(a->x2, b->x2),
+		.y2 = MAX(a->y2, b->y2),
+	};
+}
+
+static int64_t
+box_overlap(const pixman_box32_t *a, const pixman_box32_t *b)
+{
+	int32_t w = MIN(a->x2, b->x2) - MAX(a->x1, b->x1);
+	int32_t h = MIN(a->y2, b->y2) - MAX(a->y1, b->y1);
+
+	if (w <= 0 || h <= 0)
+		return 0;
+
+	return (int64_t) w * h;
+}
+
+/* Pixels painted in addition if a and b were drawn as their bounding
+ * box instead. */
+static int64_t
+merge_cost(const pixman_box32_t *a, const pixman_box32_t *b)
+{
+	pixman_box32_t u = box_union(a, b);
+
+	return box_area(&u) - box_area(a) - box_area(b) + box_overlap(a, b);
+}
+
+static int
+merge_pass(pixman_box32_t *boxes, int n, int64_t pixels_per_box)
+{
+	int64_t cost, best_cost;
+	int i, j, best, nout = 0;
+
+	for (i = 0; i < n; i++) {
+		best = -1;
+		best_cost = pixels_per_box + 1;
+
+		for (j = nout - 1; j >= 0 && j >= nout - MERGE_WINDOW; j--) {
+			cost = merge_cost(&boxes[j], &boxes[i]);
+			if (cost < best_cost) {
+				best = j;
+				best_cost = cost;
+			}
+		}
+
+		if (best >= 0)
+			boxes[best] = box_union(&boxes[best], &boxes[i]);
+		else
+			boxes[nout++] = boxes[i];
+	}
+
+	return nout;
+}
+
+/** Merge the boxes of a region into fewer, bigger ones
+ *
+ * \param region The region to simplify, turned into a superset of itself.
+ * \param pixels_per_box How many pixels more may be covered for every
+ * box saved; 0 leaves the region alone.
+ *
+ * Each box of a damage region costs the GL renderer a clip pass and a
+ * draw call per view, while covering a few more pixels only costs fill
+ * rate, so two boxes are drawn as their bounding box whenever that adds
+ * at most \c pixels_per_box pixels.
+ */
+void
+weston_region_simplify(pixman_region32_t *region, uint32_t pixels_per_box)
+{
+	pixman_box32_t *rects, *boxes;
+	int n, nout, prev;
+
+	rects = pixman_region32_rectangles(region, &n);
+	if (pixels_per_box == 0 || n < 2)
+		return;
+
+	boxes = malloc(n * sizeof *boxes);
+	if (!boxes)
+		return;
+	memcpy(boxes, rects, n * sizeof *boxes);
+
+	/* Grown boxes may now be worth merging with each other. */
+	nout = n;
+	do {
+		prev = nout;
+		nout = merge_pass(boxes, nout, pixels_per_box);
+	} while (nout > 1 && nout < prev);
+
+	if (nout < n) {
+		pixman_region32_fini(region);
+		pixman_region32_init_rects(region, boxes, nout);
+	}
+
+	free(boxes);
+}
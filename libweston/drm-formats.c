@@ -26,11 +26,131 @@
 #include "config.h"
 
 #include <assert.h>
+#include <stdlib.h>
 
 #include <libweston/libweston.h>
 #include "libweston-internal.h"
 #include "shared/weston-drm-fourcc.h"
 
+/* Below this many entries a linear scan over the wl_array is cheaper than
+ * hashing, so sets that small are not indexed at all. */
+#define DRM_INDEX_MIN_ENTRIES 8
+
+typedef uint64_t (*drm_index_key_func)(const struct wl_array *arr,
+				       uint32_t pos);
+
+static uint64_t
+format_key_at(const struct wl_array *arr, uint32_t pos)
+{
+	const struct weston_drm_format *formats = arr->data;
+
+	return formats[pos].format;
+}
+
+static uint64_t
+modifier_key_at(const struct wl_array *arr, uint32_t pos)
+{
+	const uint64_t *modifiers = arr->data;
+
+	return modifiers[pos];
+}
+
+static uint32_t
+drm_index_hash(uint64_t key)
+{
+	/* 64-bit finalizer from MurmurHash3, modifiers only differ in a few
+	 * high bits so they have to be mixed down. */
+	key ^= key >> 33;
+	key *= 0xff51afd7ed558ccdULL;
+	key ^= key >> 33;
+	key *= 0xc4ceb9fe1a85ec53ULL;
+	key ^= key >> 33;
+
+	return (uint32_t) key;
+}
+
+static void
+drm_index_fini(struct weston_drm_index *index)
+{
+	free(index->slots);
+	index->slots = NULL;
+	index->mask = 0;
+}
+
+static void
+drm_index_insert(struct weston_drm_index *index, uint64_t key, uint32_t pos)
+{
+	uint32_t i = drm_index_hash(key) & index->mask;
+
+	while (index->slots[i] != 0)
+		i = (i + 1) & index->mask;
+
+	index->slots[i] = pos + 1;
+}
+
+static void
+drm_index_rebuild(struct weston_drm_index *index, const struct wl_array *arr,
+		  size_t elem_size, drm_index_key_func key_at)
+{
+	uint32_t count = arr->size / elem_size;
+	uint32_t capacity = 32;
+	uint32_t pos;
+
+	drm_index_fini(index);
+
+	if (count < DRM_INDEX_MIN_ENTRIES)
+		return;
+
+	/* Keep the load factor at or below 1/4 right after a rebuild, so
+	 * that it takes a few insertions before the next one. */
+	while (capacity < count * 4)
+		capacity *= 2;
+
+	index->slots = calloc(capacity, sizeof(*index->slots));
+	if (!index->slots)
+		return; /* Lookups fall back to a linear scan. */
+	index->mask = capacity - 1;
+
+	for (pos = 0; pos < count; pos++)
+		drm_index_insert(index, key_at(arr, pos), pos);
+}
+
+/* Must be called right after appending one entry to arr. */
+static void
+drm_index_append(struct weston_drm_index *index, const struct wl_array *arr,
+		 size_t elem_size, drm_index_key_func key_at)
+{
+	uint32_t count = arr->size / elem_size;
+
+	if (count < DRM_INDEX_MIN_ENTRIES)
+		return;
+
+	if (!index->slots || count * 2 > index->mask + 1) {
+		drm_index_rebuild(index, arr, elem_size, key_at);
+		return;
+	}
+
+	drm_index_insert(index, key_at(arr, count - 1), count - 1);
+}
+
+/* Returns the position of key in arr, or -1. Only valid if index->slots. */
+static int64_t
+drm_index_find(const struct weston_drm_index *index, const struct wl_array *arr,
+	       drm_index_key_func key_at, uint64_t key)
+{
+	uint32_t i = drm_index_hash(key) & index->mask;
+	uint32_t pos;
+
+	while (index->slots[i] != 0) {
+		pos = index->slots[i] - 1;
+		if (key_at(arr, pos) == key)
+			return pos;
+		i = (i + 1) & index->mask;
+	}
+
+	return -1;
+}
+
 /**
  * Initialize a weston_drm_format_array
  *
@@ -40,6 +160,8 @@ WL_EXPORT void
 weston_drm_format_array_init(struct weston_drm_format_array *formats)
 {
 	wl_array_init(&formats->arr);
+	formats->index.slots = NULL;
+	formats->index.mask = 0;
 }
 
 /**
@@ -55,10 +177,13 @@ weston_drm_format_array_fini(struct weston_drm_format_array *formats)
 {
 	struct weston_drm_format *fmt;
 
-	wl_array_for_each(fmt, &formats->arr)
+	wl_array_for_each(fmt, &formats->arr) {
 		wl_array_release(&fmt->modifiers);
+		drm_index_fini(&fmt->modifier_index);
+	}
 
 	wl_array_release(&formats->arr);
+	drm_index_fini(&formats->index);
 }
 
 static int
@@ -78,6 +203,9 @@ add_format_and_modifiers(struct weston_drm_format_array *formats,
 		return -1;
 	}
 
+	drm_index_rebuild(&fmt->modifier_index, &fmt->modifiers,
+			  sizeof(uint64_t), modifier_key_at);
+
 	return 0;
 }
 
@@ -138,6 +266,11 @@ weston_drm_format_array_add_format(struct weston_drm_format_array *formats,
 
 	fmt->format = format;
 	wl_array_init(&fmt->modifiers);
+	fmt->modifier_index.slots = NULL;
+	fmt->modifier_index.mask = 0;
+
+	drm_index_append(&formats->index, &formats->arr, sizeof(*fmt),
+			 format_key_at);
 
 	return fmt;
 }
@@ -162,6 +295,13 @@ weston_drm_format_array_remove_latest_format(struct weston_drm_format_array *for
 
 	fmt = array->data + array->size;
 	wl_array_release(&fmt->modifiers);
+	drm_index_fini(&fmt->modifier_index);
+
+	/* Removal is rare enough (only while building arrays) that a rebuild
+	 * is cheaper to maintain than tombstones. */
+	if (formats->index.slots)
+		drm_index_rebuild(&formats->index, array, sizeof(*fmt),
+				  format_key_at);
 }
 
 /**
@@ -176,6 +316,16 @@ weston_drm_format_array_find_format(const struct weston_drm_format_array *format
 				    uint32_t format)
 {
 	struct weston_drm_format *fmt;
+	int64_t pos;
+
+	if (formats->index.slots) {
+		pos = drm_index_find(&formats->index, &formats->arr,
+				     format_key_at, format);
+		if (pos < 0)
+			return NULL;
+		fmt = formats->arr.data;
+		return &fmt[pos];
+	}
 
 	wl_array_for_each(fmt, &formats->arr)
 		if (fmt->format == format)
@@ -282,23 +432,20 @@ weston_drm_format_array_join(struct weston_drm_format_array *formats_A,
 static int
 modifiers_intersect(const struct weston_drm_format *fmt_A,
 		    const struct weston_drm_format *fmt_B,
-		    struct wl_array *modifiers_result)
+		    struct weston_drm_format *fmt_result)
 {
 	const uint64_t *modifiers;
 	unsigned int num_modifiers;
-	uint64_t *mod;
 	unsigned int i;
+	int ret;
 
 	modifiers = weston_drm_format_get_modifiers(fmt_A, &num_modifiers);
 	for (i = 0; i < num_modifiers; i++) {
 		if (!weston_drm_format_has_modifier(fmt_B, modifiers[i]))
 			continue;
-		mod = wl_array_add(modifiers_result, sizeof(modifiers[i]));
-		if (!mod) {
-			weston_log("%s: out of memory\n", __func__);
+		ret = weston_drm_format_add_modifier(fmt_result, modifiers[i]);
+		if (ret < 0)
 			return -1;
-		}
-		*mod = modifiers[i];
 	}
 
 	return 0;
@@ -332,7 +479,7 @@ weston_drm_format_array_intersect(struct weston_drm_format_array *formats_A,
 		if (!fmt_result)
 			goto err;
 
-		ret = modifiers_intersect(fmt_A, fmt_B, &fmt_result->modifiers);
+		ret = modifiers_intersect(fmt_A, fmt_B, fmt_result);
 		if (ret < 0)
 			goto err;
 
@@ -355,23 +502,20 @@ err:
 static int
 modifiers_subtract(const struct weston_drm_format *fmt_A,
 		   const struct weston_drm_format *fmt_B,
-		   struct wl_array *modifiers_result)
+		   struct weston_drm_format *fmt_result)
 {
 	const uint64_t *modifiers;
 	unsigned int num_modifiers;
-	uint64_t *mod;
 	unsigned int i;
+	int ret;
 
 	modifiers = weston_drm_format_get_modifiers(fmt_A, &num_modifiers);
 	for (i = 0; i < num_modifiers; i++) {
 		if (weston_drm_format_has_modifier(fmt_B, modifiers[i]))
 			continue;
-		mod = wl_array_add(modifiers_result, sizeof(modifiers[i]));
-		if (!mod) {
-			weston_log("%s: out of memory\n", __func__);
+		ret = weston_drm_format_add_modifier(fmt_result, modifiers[i]);
+		if (ret < 0)
 			return -1;
-		}
-		*mod = modifiers[i];
 	}
 
 	return 0;
@@ -411,7 +555,7 @@ weston_drm_format_array_subtract(struct weston_drm_format_array *formats_A,
 		if (!fmt_result)
 			goto err;
 
-		ret = modifiers_subtract(fmt_A, fmt_B, &fmt_result->modifiers);
+		ret = modifiers_subtract(fmt_A, fmt_B, fmt_result);
 		if (ret < 0)
 			goto err;
 
@@ -457,6 +601,9 @@ weston_drm_format_add_modifier(struct weston_drm_format *format,
 	}
 	*mod = modifier;
 
+	drm_index_append(&format->modifier_index, &format->modifiers,
+			 sizeof(*mod), modifier_key_at);
+
 	return 0;
 }
 
@@ -476,6 +623,11 @@ weston_drm_format_has_modifier(const struct weston_drm_format *format,
 	unsigned int num_modifiers;
 	unsigned int i;
 
+	if (format->modifier_index.slots)
+		return drm_index_find(&format->modifier_index,
+				      &format->modifiers, modifier_key_at,
+				      modifier) >= 0;
+
 	modifiers = weston_drm_format_get_modifiers(format, &num_modifiers);
 	for (i = 0; i < num_modifiers; i++)
 		if (modifiers[i] == modifier)
@@ -0,0 +1,194 @@
+/*
+ * Copyright © 2022 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include <libweston/libweston.h>
+#include <libweston/zalloc.h>
+#include "libweston-internal.h"
+#include "event-loop.h"
+#include "watchdog.h"
+
+/*
+ * wl_event_loop dispatches its ready sources in the order epoll returns
+ * them, so a burst of client requests can hold up a page flip or an
+ * input event. Sources that must not wait live in event loops of their
+ * own, one per priority class. Each of those is a single fd in the
+ * display's loop, which dispatches all classes in order when any of them
+ * is ready, and weston_compositor_run() drains them before every pass
+ * over the rest.
+ */
+struct weston_priority_loops {
+	struct wl_event_loop *loops[WESTON_EVENT_PRIORITY_COUNT];
+	struct wl_event_source *sources[WESTON_EVENT_PRIORITY_COUNT];
+};
+
+static void
+weston_compositor_dispatch_priority(struct weston_compositor *ec)
+{
+	int i;
+
+	for (i = 0; i < WESTON_EVENT_PRIORITY_COUNT; i++)
+		wl_event_loop_dispatch(ec->priority_loops->loops[i], 0);
+}
+
+static int
+priority_loop_dispatch(int fd, uint32_t mask, void *data)
+{
+	struct weston_compositor *ec = data;
+
+	weston_compositor_dispatch_priority(ec);
+
+	return 0;
+}
+
+int
+weston_compositor_init_priority_loops(struct weston_compositor *ec)
+{
+	struct weston_priority_loops *pl;
+	struct wl_event_loop *loop;
+	int i;
+
+	pl = zalloc(sizeof *pl);
+	if (!pl)
+		return -1;
+	ec->priority_loops = pl;
+
+	loop = wl_display_get_event_loop(ec->wl_display);
+	for (i = 0; i < WESTON_EVENT_PRIORITY_COUNT; i++) {
+		pl->loops[i] = wl_event_loop_create();
+		if (!pl->loops[i])
+			goto err;
+
+		pl->sources[i] =
+			wl_event_loop_add_fd(loop,
+					     wl_event_loop_get_fd(pl->loops[i]),
+					     WL_EVENT_READABLE,
+					     priority_loop_dispatch, ec);
+		if (!pl->sources[i])
+			goto err;
+	}
+
+	return 0;
+
+err:
+	weston_compositor_fini_priority_loops(ec);
+	return -1;
+}
+
+/* Called once the backend has removed its sources */
+void
+weston_compositor_fini_priority_loops(struct weston_compositor *ec)
+{
+	struct weston_priority_loops *pl = ec->priority_loops;
+	int i;
+
+	if (!pl)
+		return;
+
+	for (i = 0; i < WESTON_EVENT_PRIORITY_COUNT; i++) {
+		if (pl->sources[i])
+			wl_event_source_remove(pl->sources[i]);
+		if (pl->loops[i])
+			wl_event_loop_destroy(pl->loops[i]);
+	}
+
+	free(pl);
+	ec->priority_loops = NULL;
+}
+
+/** Get the event loop for sources of a priority class
+ *
+ * Sources added to it are dispatched ahead of those on the display's
+ * event loop, and classes of higher priority ahead of lower ones.
+ */
+WL_EXPORT struct wl_event_loop *
+weston_compositor_get_priority_loop(struct weston_compositor *ec,
+				    enum weston_event_priority priority)
+{
+	return ec->priority_loops->loops[priority];
+}
+
+/** Run the compositor until weston_compositor_terminate()
+ *
+ * \param ec The compositor.
+ *
+ * This replaces wl_display_run(). Each pass flushes the clients, waits
+ * for an event, dispatches page flips and input first and then the
+ * clients, timers and everything else that is ready. Priority sources
+ * that become ready in the middle of a pass wait for the next one at
+ * most.
+ *
+ * \ingroup compositor
+ */
+WL_EXPORT void
+weston_compositor_run(struct weston_compositor *ec)
+{
+	struct wl_event_loop *loop = wl_display_get_event_loop(ec->wl_display);
+	struct pollfd pfd = {
+		.fd = wl_event_loop_get_fd(loop),
+		.events = POLLIN,
+	};
+
+	ec->running = true;
+	weston_watchdog_iteration_begin(ec);
+	while (ec->running) {
+		/* What wl_event_loop_dispatch() would run before waiting */
+		weston_watchdog_phase_enter("idle callbacks");
+		wl_event_loop_dispatch_idle(loop);
+		weston_watchdog_phase_enter("wl_display_flush_clients");
+		wl_display_flush_clients(ec->wl_display);
+		weston_watchdog_iteration_end(ec);
+
+		if (poll(&pfd, 1, -1) < 0 && errno != EINTR)
+			break;
+
+		weston_watchdog_iteration_begin(ec);
+		weston_compositor_dispatch_priority(ec);
+		wl_event_loop_dispatch(loop, 0);
+	}
+	weston_watchdog_iteration_end(ec);
+}
+
+/** Make weston_compositor_run() return
+ *
+ * \param ec The compositor.
+ *
+ * Also terminates wl_display_run() for compositors which run the display
+ * themselves.
+ *
+ * \ingroup compositor
+ */
+WL_EXPORT void
+weston_compositor_terminate(struct weston_compositor *ec)
+{
+	ec->running = false;
+	wl_display_terminate(ec->wl_display);
+}
@@ -0,0 +1,172 @@
+/*
+ * Copyright © 2022 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stddef.h>
+#include <stdlib.h>
+
+#include <libweston/libweston.h>
+#include "frame-arena.h"
+#include "shared/helpers.h"
+
+#define FRAME_ARENA_MIN_SIZE 4096
+
+struct frame_arena_chunk {
+	struct frame_arena_chunk *next;
+	union weston_max_align data[];
+};
+
+static size_t
+frame_arena_align(size_t size)
+{
+	return (size + WESTON_MAX_ALIGN - 1) & ~(WESTON_MAX_ALIGN - 1);
+}
+
+void
+weston_frame_arena_init(struct weston_frame_arena *arena)
+{
+	*arena = (struct weston_frame_arena) { 0 };
+}
+
+static void
+frame_arena_free_chunks(struct weston_frame_arena *arena)
+{
+	struct frame_arena_chunk *chunk, *next;
+
+	for (chunk = arena->chunks; chunk; chunk = next) {
+		next = chunk->next;
+		free(chunk);
+	}
+	arena->chunks = NULL;
+}
+
+void
+weston_frame_arena_fini(struct weston_frame_arena *arena)
+{
+	frame_arena_free_chunks(arena);
+	free(arena->data);
+	weston_frame_arena_init(arena);
+}
+
+/** Allocate scratch memory valid until the next reset
+ *
+ * The memory is suitably aligned for any type and is not cleared.
+ * Returns NULL if the heap is exhausted.
+ */
+void *
+weston_frame_arena_alloc(struct weston_frame_arena *arena, size_t size)
+{
+	struct frame_arena_chunk *chunk;
+	void *ptr;
+
+	size = frame_arena_align(MAX(size, (size_t) 1));
+	arena->allocs++;
+
+	if (size <= arena->size - arena->used) {
+		ptr = arena->data + arena->used;
+		arena->used += size;
+		return ptr;
+	}
+
+	chunk = malloc(sizeof *chunk + size);
+	if (!chunk)
+		return NULL;
+
+	arena->heap_allocs++;
+	arena->overflow += size;
+	chunk->next = arena->chunks;
+	arena->chunks = chunk;
+
+	return chunk->data;
+}
+
+/** Release everything allocated since the last reset */
+void
+weston_frame_arena_reset(struct weston_frame_arena *arena)
+{
+	size_t needed = arena->used + arena->overflow;
+	size_t size;
+	char *data;
+
+	frame_arena_free_chunks(arena);
+	arena->peak = MAX(arena->peak, needed);
+	arena->frames++;
+	arena->used = 0;
+
+	if (arena->overflow == 0)
+		return;
+	arena->overflow = 0;
+
+	size = MAX(arena->size, (size_t) FRAME_ARENA_MIN_SIZE);
+	while (size < needed)
+		size *= 2;
+
+	/* Nothing in it is live any more, no need to copy. */
+	data = malloc(size);
+	if (!data)
+		return;
+
+	arena->heap_allocs++;
+	free(arena->data);
+	arena->data = data;
+	arena->size = size;
+}
+
+/** Allocate memory for the output's current repaint
+ *
+ * For temporary buffers of the renderers and the core, which are released
+ * all together after weston_output_repaint(). Returns NULL on failure.
+ */
+WL_EXPORT void *
+weston_output_frame_alloc(struct weston_output *output, size_t size)
+{
+	if (!output->frame_arena) {
+		output->frame_arena = malloc(sizeof *output->frame_arena);
+		if (!output->frame_arena)
+			return NULL;
+		weston_frame_arena_init(output->frame_arena);
+	}
+
+	return weston_frame_arena_alloc(output->frame_arena, size);
+}
+
+void
+weston_output_frame_arena_reset(struct weston_output *output)
+{
+	if (output->frame_arena)
+		weston_frame_arena_reset(output->frame_arena);
+}
+
+void
+weston_output_frame_arena_destroy(struct weston_output *output)
+{
+	if (!output->frame_arena)
+		return;
+
+	weston_frame_arena_fini(output->frame_arena);
+	free(output->frame_arena);
+	output->frame_arena = NULL;
+}
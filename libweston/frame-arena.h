@@ -0,0 +1,80 @@
+/*
+ * Copyright © 2022 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef WESTON_FRAME_ARENA_H
+#define WESTON_FRAME_ARENA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <libweston/libweston.h>
+
+struct frame_arena_chunk;
+
+/** Scratch memory that lives until the end of a repaint
+ *
+ * Allocations are carved out of one block and never freed one by one,
+ * everything goes at once when the arena is reset. Whatever does not fit
+ * gets a block of its own for the current frame, and the next reset
+ * grows the main block to fit, so that a steady scene stops touching the
+ * heap after its first frame.
+ */
+struct weston_frame_arena {
+	char *data;
+	size_t size;
+	size_t used;
+	/** Bytes handed out from overflow chunks since the last reset */
+	size_t overflow;
+	struct frame_arena_chunk *chunks;
+
+	/* counters for the 'frame-stats' scope */
+	uint64_t frames;
+	uint64_t allocs;
+	uint64_t heap_allocs;
+	size_t peak;
+};
+
+void
+weston_frame_arena_init(struct weston_frame_arena *arena);
+
+void
+weston_frame_arena_fini(struct weston_frame_arena *arena);
+
+void *
+weston_frame_arena_alloc(struct weston_frame_arena *arena, size_t size);
+
+void
+weston_frame_arena_reset(struct weston_frame_arena *arena);
+
+void *
+weston_output_frame_alloc(struct weston_output *output, size_t size);
+
+void
+weston_output_frame_arena_reset(struct weston_output *output);
+
+void
+weston_output_frame_arena_destroy(struct weston_output *output);
+
+#endif /* WESTON_FRAME_ARENA_H */
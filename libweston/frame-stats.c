@@ -0,0 +1,541 @@
+/*
+ * Copyright © 2022 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <time.h>
+#include <wayland-server.h>
+
+#include <libweston/libweston.h>
+#include <libweston/weston-log.h>
+#include "frame-arena.h"
+#include "frame-stats.h"
+#include "libweston-internal.h"
+#include "presentation-time-server-protocol.h"
+#include "shared/helpers.h"
+#include "shared/timespec-util.h"
+
+/**
+ * Frame statistics are collected all the time, unlike timeline points, and
+ * kept in fixed-size histograms. Binding the one-shot 'frame-stats' scope
+ * prints them:
+ *
+ *	weston-debug frame-stats
+ *
+ * Per output there are the time from the start of a repaint to the vblank
+ * the frame was shown at, the time from that vblank until the compositor
+ * handled the completion, and how many vblanks each frame missed.
+ *
+ * Per client and per surface there is the time from a commit with a new
+ * buffer being applied to the vblank it was first shown at, and the number
+ * of commits dropped because a newer one replaced them before any repaint
+ * picked them up.
+ */
+
+struct weston_frame_stats_client {
+	struct wl_client *client;
+	pid_t pid;
+	struct wl_listener destroy_listener;
+	struct wl_list link; /**< weston_compositor::frame_stats_client_list */
+	struct wl_list surface_list; /**< weston_surface_frame_stats::link */
+
+	struct weston_frame_histogram commit_to_present;
+	uint64_t commits;
+	uint64_t dropped;
+};
+
+struct weston_surface_frame_stats {
+	struct weston_surface *surface;
+	/** NULL once the client is gone */
+	struct weston_frame_stats_client *client;
+	struct wl_list link; /**< weston_frame_stats_client::surface_list */
+
+	/* the latest commit not repainted yet, zero if none */
+	struct timespec commit;		/* CLOCK_MONOTONIC */
+	/* the commit repainted on in_flight_output, waiting for its vblank */
+	struct timespec in_flight;
+	struct weston_output *in_flight_output;
+
+	struct weston_frame_histogram commit_to_present;
+	uint64_t dropped;
+};
+
+static unsigned int
+histogram_bucket(uint64_t usec)
+{
+	unsigned int i = 0;
+
+	while (usec > 1 && i < WESTON_FRAME_HISTOGRAM_BUCKETS - 1) {
+		usec >>= 1;
+		i++;
+	}
+
+	return i;
+}
+
+WL_EXPORT void
+weston_frame_histogram_add(struct weston_frame_histogram *hist, int64_t nsec)
+{
+	uint64_t usec = nsec > 0 ? nsec / 1000 : 0;
+
+	hist->count++;
+	hist->sum_usec += usec;
+	hist->max_usec = MAX(hist->max_usec, usec);
+	hist->buckets[histogram_bucket(usec)]++;
+}
+
+/** Upper bound of the bucket holding the given percentile, in usec */
+WL_EXPORT uint64_t
+weston_frame_histogram_percentile(const struct weston_frame_histogram *hist,
+				  unsigned int percentile)
+{
+	uint64_t target, seen = 0;
+	unsigned int i;
+
+	if (hist->count == 0)
+		return 0;
+
+	target = (hist->count * MIN(percentile, 100u) + 99) / 100;
+	target = MAX(target, 1u);
+
+	for (i = 0; i < WESTON_FRAME_HISTOGRAM_BUCKETS - 1; i++) {
+		seen += hist->buckets[i];
+		if (seen >= target)
+			return MIN(2ull << i, hist->max_usec);
+	}
+
+	return hist->max_usec;
+}
+
+static struct weston_output_frame_stats *
+output_frame_stats(struct weston_output *output)
+{
+	if (!output->frame_stats)
+		output->frame_stats = zalloc(sizeof *output->frame_stats);
+
+	return output->frame_stats;
+}
+
+/* The paint node list stays as built for the repaint until the next one,
+ * so at finish_frame it still holds the surfaces of the presented frame. */
+static void
+frame_stats_take_commits(struct weston_output *output)
+{
+	struct weston_surface_frame_stats *ss;
+	struct weston_paint_node *pnode;
+
+	wl_list_for_each(pnode, &output->paint_node_z_order_list,
+			 z_order_link) {
+		ss = pnode->surface->frame_stats;
+		if (!ss || pnode->surface->output != output ||
+		    timespec_is_zero(&ss->commit))
+			continue;
+
+		ss->in_flight = ss->commit;
+		ss->in_flight_output = output;
+		ss->commit = (struct timespec) { 0 };
+	}
+}
+
+static void
+frame_stats_present_commits(struct weston_output *output,
+			    const struct timespec *vblank)
+{
+	struct weston_surface_frame_stats *ss;
+	struct weston_paint_node *pnode;
+	int64_t nsec;
+
+	wl_list_for_each(pnode, &output->paint_node_z_order_list,
+			 z_order_link) {
+		ss = pnode->surface->frame_stats;
+		if (!ss || ss->in_flight_output != output)
+			continue;
+
+		if (vblank) {
+			nsec = timespec_sub_to_nsec(vblank, &ss->in_flight);
+			weston_frame_histogram_add(&ss->commit_to_present,
+						   nsec);
+			if (ss->client)
+				weston_frame_histogram_add(
+					&ss->client->commit_to_present, nsec);
+		}
+
+		ss->in_flight_output = NULL;
+	}
+}
+
+/** Called when a repaint was submitted to the backend */
+void
+weston_frame_stats_repaint(struct weston_output *output)
+{
+	struct weston_output_frame_stats *stats = output_frame_stats(output);
+	int32_t refresh_mhz = output->current_mode->refresh;
+	int64_t refresh_nsec;
+
+	if (!stats)
+		return;
+
+	frame_stats_take_commits(output);
+
+	stats->repainted = true;
+	if (!stats->target_valid || refresh_mhz <= 0)
+		return;
+
+	/* The repaint aims at the first vblank after the last one that
+	 * has not passed already when it started. */
+	refresh_nsec = 1000000000000LL / refresh_mhz;
+	do {
+		timespec_add_nsec(&stats->target, &stats->target,
+				  refresh_nsec);
+	} while (timespec_sub_to_nsec(&stats->target,
+				      &output->repaint_time.start) < 0);
+}
+
+/** Called from weston_output_finish_frame()
+ *
+ * \param vblank The vblank in CLOCK_MONOTONIC, or NULL if unknown.
+ */
+void
+weston_frame_stats_finish_frame(struct weston_output *output,
+				const struct timespec *vblank,
+				uint32_t presented_flags)
+{
+	struct weston_output_frame_stats *stats = output->frame_stats;
+	int32_t refresh_mhz = output->current_mode->refresh;
+	struct timespec now;
+	int64_t late_nsec, refresh_nsec;
+	unsigned int missed;
+	bool repainted;
+
+	if (!stats)
+		return;
+
+	repainted = stats->repainted;
+	stats->repainted = false;
+	if (repainted)
+		frame_stats_present_commits(output,
+			presented_flags & WP_PRESENTATION_FEEDBACK_INVALID ?
+			NULL : vblank);
+
+	if (!vblank) {
+		stats->target_valid = false;
+		return;
+	}
+
+	if (repainted && !(presented_flags & WP_PRESENTATION_FEEDBACK_INVALID)) {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+
+		stats->frames++;
+		weston_frame_histogram_add(&stats->repaint_to_flip,
+			timespec_sub_to_nsec(vblank,
+					     &output->repaint_time.start));
+		weston_frame_histogram_add(&stats->presentation_delay,
+			timespec_sub_to_nsec(&now, vblank));
+
+		if (stats->target_valid && refresh_mhz > 0) {
+			refresh_nsec = 1000000000000LL / refresh_mhz;
+			late_nsec = timespec_sub_to_nsec(vblank,
+							 &stats->target);
+			missed = late_nsec > refresh_nsec / 2 ?
+				 (late_nsec + refresh_nsec / 2) / refresh_nsec :
+				 0;
+			stats->missed[MIN(missed,
+					  WESTON_FRAME_MISSED_BUCKETS - 1u)]++;
+		}
+	}
+
+	stats->target = *vblank;
+	stats->target_valid = true;
+}
+
+void
+weston_frame_stats_output_destroy(struct weston_output *output)
+{
+	free(output->frame_stats);
+	output->frame_stats = NULL;
+}
+
+static void
+frame_stats_client_destroy(struct weston_frame_stats_client *fsc)
+{
+	struct weston_surface_frame_stats *ss, *tmp;
+
+	/* the client goes before its surfaces */
+	wl_list_for_each_safe(ss, tmp, &fsc->surface_list, link) {
+		ss->client = NULL;
+		wl_list_remove(&ss->link);
+		wl_list_init(&ss->link);
+	}
+
+	wl_list_remove(&fsc->destroy_listener.link);
+	wl_list_remove(&fsc->link);
+	free(fsc);
+}
+
+static void
+frame_stats_client_handle_destroy(struct wl_listener *listener, void *data)
+{
+	struct weston_frame_stats_client *fsc =
+		container_of(listener, struct weston_frame_stats_client,
+			     destroy_listener);
+
+	frame_stats_client_destroy(fsc);
+}
+
+static struct weston_frame_stats_client *
+frame_stats_client_get(struct weston_compositor *compositor,
+		       struct wl_client *client)
+{
+	struct weston_frame_stats_client *fsc;
+
+	wl_list_for_each(fsc, &compositor->frame_stats_client_list, link) {
+		if (fsc->client == client)
+			return fsc;
+	}
+
+	fsc = zalloc(sizeof *fsc);
+	if (!fsc)
+		return NULL;
+
+	fsc->client = client;
+	wl_list_init(&fsc->surface_list);
+	wl_client_get_credentials(client, &fsc->pid, NULL, NULL);
+	fsc->destroy_listener.notify = frame_stats_client_handle_destroy;
+	wl_client_add_destroy_listener(client, &fsc->destroy_listener);
+	wl_list_insert(&compositor->frame_stats_client_list, &fsc->link);
+
+	return fsc;
+}
+
+/** Called when a commit attaching a new buffer was applied */
+void
+weston_frame_stats_commit(struct weston_surface *surface)
+{
+	struct weston_surface_frame_stats *ss = surface->frame_stats;
+	struct weston_frame_stats_client *fsc;
+
+	/* compositor-internal surfaces have no client to blame */
+	if (!surface->resource)
+		return;
+
+	if (!ss) {
+		fsc = frame_stats_client_get(surface->compositor,
+				wl_resource_get_client(surface->resource));
+		if (!fsc)
+			return;
+
+		ss = zalloc(sizeof *ss);
+		if (!ss)
+			return;
+
+		ss->surface = surface;
+		ss->client = fsc;
+		wl_list_insert(&fsc->surface_list, &ss->link);
+		surface->frame_stats = ss;
+	}
+
+	if (ss->client)
+		ss->client->commits++;
+
+	/* replaced before any repaint took it */
+	if (!timespec_is_zero(&ss->commit)) {
+		ss->dropped++;
+		if (ss->client)
+			ss->client->dropped++;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &ss->commit);
+}
+
+void
+weston_frame_stats_surface_destroy(struct weston_surface *surface)
+{
+	struct weston_surface_frame_stats *ss = surface->frame_stats;
+
+	if (!ss)
+		return;
+
+	wl_list_remove(&ss->link);
+	free(ss);
+	surface->frame_stats = NULL;
+}
+
+void
+weston_frame_stats_compositor_destroy(struct weston_compositor *compositor)
+{
+	struct weston_frame_stats_client *fsc, *tmp;
+
+	wl_list_for_each_safe(fsc, tmp, &compositor->frame_stats_client_list,
+			      link)
+		frame_stats_client_destroy(fsc);
+}
+
+static void
+print_histogram(struct weston_log_subscription *sub, const char *name,
+		const struct weston_frame_histogram *hist)
+{
+	unsigned int i;
+
+	weston_log_subscription_printf(sub, "\t%s: %" PRIu64 " samples",
+				       name, hist->count);
+	if (hist->count == 0) {
+		weston_log_subscription_printf(sub, "\n");
+		return;
+	}
+
+	weston_log_subscription_printf(sub,
+		", mean %" PRIu64 " us, p50 <= %" PRIu64 " us, "
+		"p99 <= %" PRIu64 " us, max %" PRIu64 " us\n",
+		hist->sum_usec / hist->count,
+		weston_frame_histogram_percentile(hist, 50),
+		weston_frame_histogram_percentile(hist, 99),
+		hist->max_usec);
+
+	for (i = 0; i < WESTON_FRAME_HISTOGRAM_BUCKETS; i++) {
+		if (hist->buckets[i] == 0)
+			continue;
+
+		if (i == WESTON_FRAME_HISTOGRAM_BUCKETS - 1)
+			weston_log_subscription_printf(sub,
+				"\t\t>= %u us: %u\n", 1u << i,
+				hist->buckets[i]);
+		else
+			weston_log_subscription_printf(sub,
+				"\t\t< %u us: %u\n", 2u << i,
+				hist->buckets[i]);
+	}
+}
+
+/** Per-client families of weston_compositor_write_metrics() */
+void
+weston_frame_stats_write_client_metrics(struct weston_metrics *m,
+					struct weston_compositor *compositor)
+{
+	struct weston_frame_stats_client *fsc;
+	char pid[16];
+
+	/* Told apart by pid, like the frame-stats scope prints them */
+	weston_metrics_family(m, "weston_client_commits", "counter", NULL,
+			      "Commits applying a new buffer");
+	wl_list_for_each(fsc, &compositor->frame_stats_client_list, link) {
+		snprintf(pid, sizeof pid, "%d", (int) fsc->pid);
+		weston_metrics_sample(m, "weston_client_commits_total",
+				      fsc->commits, "pid", pid, NULL);
+	}
+
+	weston_metrics_family(m, "weston_client_dropped_commits", "counter",
+			      NULL,
+			      "Commits replaced before any repaint showed them");
+	wl_list_for_each(fsc, &compositor->frame_stats_client_list, link) {
+		snprintf(pid, sizeof pid, "%d", (int) fsc->pid);
+		weston_metrics_sample(m, "weston_client_dropped_commits_total",
+				      fsc->dropped, "pid", pid, NULL);
+	}
+
+	weston_metrics_family(m, "weston_client_commit_to_present_seconds",
+			      "histogram", "seconds",
+			      "Commit to the vblank it was first shown at");
+	wl_list_for_each(fsc, &compositor->frame_stats_client_list, link) {
+		snprintf(pid, sizeof pid, "%d", (int) fsc->pid);
+		weston_metrics_histogram(m,
+			"weston_client_commit_to_present_seconds",
+			&fsc->commit_to_present, "pid", pid, NULL);
+	}
+}
+
+/** The 'frame-stats' one-shot scope */
+void
+weston_frame_stats_print_cb(struct weston_log_subscription *sub, void *data)
+{
+	struct weston_compositor *compositor = data;
+	struct weston_frame_stats_client *fsc;
+	struct weston_surface_frame_stats *ss;
+	struct weston_output_frame_stats *stats;
+	struct weston_frame_arena *arena;
+	struct weston_output *output;
+	unsigned int i;
+	char desc[128];
+
+	wl_list_for_each(output, &compositor->output_list, link) {
+		stats = output->frame_stats;
+		arena = output->frame_arena;
+
+		weston_log_subscription_printf(sub,
+			"output %d (%s): %" PRIu64 " frames\n",
+			output->id, output->name, stats ? stats->frames : 0);
+		if (!stats)
+			continue;
+
+		print_histogram(sub, "repaint to flip",
+				&stats->repaint_to_flip);
+		print_histogram(sub, "presentation delay",
+				&stats->presentation_delay);
+
+		weston_log_subscription_printf(sub, "\tmissed vblanks:");
+		for (i = 0; i < WESTON_FRAME_MISSED_BUCKETS; i++)
+			weston_log_subscription_printf(sub, " %u%s: %u", i,
+				i == WESTON_FRAME_MISSED_BUCKETS - 1 ? "+" : "",
+				stats->missed[i]);
+		weston_log_subscription_printf(sub, "\n");
+
+		if (arena && arena->frames > 0)
+			weston_log_subscription_printf(sub,
+				"\tframe arena: %zu bytes, peak %zu, "
+				"%.1f allocations per frame, "
+				"%" PRIu64 " from the heap\n",
+				arena->size, arena->peak,
+				(double) arena->allocs / arena->frames,
+				arena->heap_allocs);
+	}
+
+	wl_list_for_each(fsc, &compositor->frame_stats_client_list, link) {
+		weston_log_subscription_printf(sub,
+			"client pid %d: %" PRIu64 " dropped commits\n",
+			(int) fsc->pid, fsc->dropped);
+		print_histogram(sub, "commit to present",
+				&fsc->commit_to_present);
+
+		wl_list_for_each(ss, &fsc->surface_list, link) {
+			if (!ss->surface->get_label ||
+			    ss->surface->get_label(ss->surface, desc,
+						   sizeof desc) < 0)
+				desc[0] = '\0';
+
+			weston_log_subscription_printf(sub,
+				"    surface %s: %" PRIu64 " dropped commits\n",
+				desc[0] ? desc : "(unlabelled)", ss->dropped);
+			print_histogram(sub, "commit to present",
+					&ss->commit_to_present);
+		}
+	}
+
+	weston_log_subscription_complete(sub);
+}
@@ -0,0 +1,113 @@
+/*
+ * Copyright © 2022 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef WESTON_FRAME_STATS_H
+#define WESTON_FRAME_STATS_H
+
+#include <stdint.h>
+#include <time.h>
+
+#include <libweston/libweston.h>
+#include <libweston/weston-log.h>
+
+/** Power-of-two buckets: bucket i counts values of [2^i, 2^(i+1)) usec,
+ * bucket 0 also counts smaller ones and the last one everything longer. */
+#define WESTON_FRAME_HISTOGRAM_BUCKETS 24
+
+/** Linear buckets of missed vblanks per frame, the last one is open. */
+#define WESTON_FRAME_MISSED_BUCKETS 5
+
+/** A histogram of durations
+ *
+ * Fixed size and only ever written from the compositor main loop, so
+ * recording a sample costs a handful of additions and no allocation.
+ *
+ * @ingroup internal-log
+ */
+struct weston_frame_histogram {
+	uint64_t count;
+	uint64_t sum_usec;
+	uint64_t max_usec;
+	uint32_t buckets[WESTON_FRAME_HISTOGRAM_BUCKETS];
+};
+
+/** Frame timing of one output, see the 'frame-stats' scope
+ *
+ * @ingroup internal-log
+ */
+struct weston_output_frame_stats {
+	/** weston_output_repaint() start to the vblank it was shown at */
+	struct weston_frame_histogram repaint_to_flip;
+	/** vblank to weston_output_finish_frame() handling it */
+	struct weston_frame_histogram presentation_delay;
+	uint32_t missed[WESTON_FRAME_MISSED_BUCKETS];
+
+	/* the vblank the frame in flight was repainted for */
+	struct timespec target;		/* CLOCK_MONOTONIC */
+	bool target_valid;
+	bool repainted;
+	uint64_t frames;
+};
+
+void
+weston_frame_histogram_add(struct weston_frame_histogram *hist,
+			   int64_t nsec);
+
+uint64_t
+weston_frame_histogram_percentile(const struct weston_frame_histogram *hist,
+				  unsigned int percentile);
+
+void
+weston_frame_stats_repaint(struct weston_output *output);
+
+void
+weston_frame_stats_finish_frame(struct weston_output *output,
+				const struct timespec *vblank,
+				uint32_t presented_flags);
+
+void
+weston_frame_stats_commit(struct weston_surface *surface);
+
+void
+weston_frame_stats_surface_destroy(struct weston_surface *surface);
+
+void
+weston_frame_stats_output_destroy(struct weston_output *output);
+
+void
+weston_frame_stats_compositor_destroy(struct weston_compositor *compositor);
+
+void
+weston_frame_stats_print_cb(struct weston_log_subscription *sub, void *data);
+
+void
+weston_metrics_histogram(struct weston_metrics *m, const char *name,
+			 const struct weston_frame_histogram *hist, ...);
+
+void
+weston_frame_stats_write_client_metrics(struct weston_metrics *m,
+					struct weston_compositor *compositor);
+
+#endif /* WESTON_FRAME_STATS_H */
@@ -45,6 +45,7 @@
 #include <libweston/libweston.h>
 #include "backend.h"
 #include "libweston-internal.h"
+#include "weston-probe.h"
 #include "relative-pointer-unstable-v1-server-protocol.h"
 #include "pointer-constraints-unstable-v1-server-protocol.h"
 #include "input-timestamps-unstable-v1-server-protocol.h"
@@ -428,28 +429,126 @@ touch_focus_resource_destroyed(struct wl_listener *listener, void *data)
 	weston_touch_set_focus(touch, NULL);
 }
 
+/** The wl_keyboard or wl_touch resources of one client
+ *
+ * Keyboard and touch devices keep their unfocused resources per client, so
+ * that focus changes only touch the resources of the clients involved
+ * instead of walking every binding of every client. The entry lives as long
+ * as the client has any resource for the device; while the client has focus
+ * its resources are on the device's focus_resource_list instead.
+ */
+struct weston_input_resource_client {
+	struct wl_list link;
+	struct wl_client *client;
+	struct wl_list resources;
+	unsigned int n_resources;
+};
+
+static struct weston_input_resource_client *
+input_resource_client_find(struct wl_list *clients, struct wl_client *client)
+{
+	struct weston_input_resource_client *rc;
+
+	wl_list_for_each(rc, clients, link) {
+		if (rc->client == client)
+			return rc;
+	}
+
+	return NULL;
+}
+
+static struct weston_input_resource_client *
+input_resource_client_ensure(struct wl_list *clients, struct wl_client *client)
+{
+	struct weston_input_resource_client *rc;
+
+	rc = input_resource_client_find(clients, client);
+	if (rc)
+		return rc;
+
+	rc = zalloc(sizeof *rc);
+	if (!rc)
+		return NULL;
+
+	rc->client = client;
+	wl_list_init(&rc->resources);
+	wl_list_insert(clients, &rc->link);
+
+	return rc;
+}
+
 static void
-move_resources(struct wl_list *destination, struct wl_list *source)
+input_resource_client_destroy(struct weston_input_resource_client *rc)
 {
-	wl_list_insert_list(destination, source);
-	wl_list_init(source);
+	wl_list_remove(&rc->resources);
+	wl_list_remove(&rc->link);
+	free(rc);
 }
 
+/* Forget a destroyed resource, its link has already been removed. */
 static void
-move_resources_for_client(struct wl_list *destination,
-			  struct wl_list *source,
-			  struct wl_client *client)
+input_resource_client_unref(struct wl_list *clients, struct wl_client *client)
 {
-	struct wl_resource *resource, *tmp;
-	wl_resource_for_each_safe(resource, tmp, source) {
-		if (wl_resource_get_client(resource) == client) {
-			wl_list_remove(wl_resource_get_link(resource));
-			wl_list_insert(destination,
-				       wl_resource_get_link(resource));
-		}
+	struct weston_input_resource_client *rc;
+
+	rc = input_resource_client_find(clients, client);
+	if (rc && --rc->n_resources == 0)
+		input_resource_client_destroy(rc);
+}
+
+/* Detach all resources from a device that is going away. */
+static void
+input_resource_clients_release(struct wl_list *clients)
+{
+	struct weston_input_resource_client *rc, *tmp;
+	struct wl_resource *resource;
+
+	wl_list_for_each_safe(rc, tmp, clients, link) {
+		wl_resource_for_each(resource, &rc->resources)
+			wl_resource_set_user_data(resource, NULL);
+		input_resource_client_destroy(rc);
 	}
 }
 
+/* Return the focused resources, all belonging to one client, to that
+ * client's entry. */
+static void
+input_resource_clients_unfocus(struct wl_list *clients,
+			       struct wl_list *focus_resource_list)
+{
+	struct weston_input_resource_client *rc;
+	struct wl_resource *first;
+
+	if (wl_list_empty(focus_resource_list))
+		return;
+
+	first = wl_resource_from_link(focus_resource_list->next);
+	rc = input_resource_client_find(clients, wl_resource_get_client(first));
+	assert(rc);
+
+	wl_list_insert_list(&rc->resources, focus_resource_list);
+	wl_list_init(focus_resource_list);
+}
+
+/* Move all resources of the client to the focus list, returns whether
+ * there were any. */
+static bool
+input_resource_clients_focus(struct wl_list *clients,
+			     struct wl_list *focus_resource_list,
+			     struct wl_client *client)
+{
+	struct weston_input_resource_client *rc;
+
+	rc = input_resource_client_find(clients, client);
+	if (!rc || wl_list_empty(&rc->resources))
+		return false;
+
+	wl_list_insert_list(focus_resource_list, &rc->resources);
+	wl_list_init(&rc->resources);
+
+	return true;
+}
+
 static void
 default_grab_pointer_focus(struct weston_pointer_grab *grab)
 {
@@ -1049,20 +1148,21 @@ send_modifiers_to_resource(struct weston_keyboard *keyboard,
 				   keyboard->modifiers.group);
 }
 
+/* Send modifiers to the unfocused wl_keyboard resources of a client */
 static void
-send_modifiers_to_client_in_list(struct wl_client *client,
-				 struct wl_list *list,
-				 uint32_t serial,
-				 struct weston_keyboard *keyboard)
+send_modifiers_to_client(struct wl_client *client,
+			 uint32_t serial,
+			 struct weston_keyboard *keyboard)
 {
+	struct weston_input_resource_client *rc;
 	struct wl_resource *resource;
 
-	wl_resource_for_each(resource, list) {
-		if (wl_resource_get_client(resource) == client)
-			send_modifiers_to_resource(keyboard,
-						   resource,
-						   serial);
-	}
+	rc = input_resource_client_find(&keyboard->resource_clients, client);
+	if (!rc)
+		return;
+
+	wl_resource_for_each(resource, &rc->resources)
+		send_modifiers_to_resource(keyboard, resource, serial);
 }
 
 static struct weston_pointer_client *
@@ -1090,18 +1190,6 @@ find_pointer_client_for_view(struct weston_pointer *pointer, struct weston_view
 	return find_pointer_client_for_surface(pointer, view->surface);
 }
 
-static struct wl_resource *
-find_resource_for_surface(struct wl_list *list, struct weston_surface *surface)
-{
-	if (!surface)
-		return NULL;
-
-	if (!surface->resource)
-		return NULL;
-
-	return wl_resource_find_for_client(list, wl_resource_get_client(surface->resource));
-}
-
 /** Send wl_keyboard.modifiers events to focused resources and pointer
  *  focused resources.
  *
@@ -1144,10 +1232,7 @@ weston_keyboard_send_modifiers(struct weston_keyboard *keyboard,
 		struct wl_client *pointer_client =
 			wl_resource_get_client(pointer->focus->surface->resource);
 
-		send_modifiers_to_client_in_list(pointer_client,
-						 &keyboard->resource_list,
-						 serial,
-						 keyboard);
+		send_modifiers_to_client(pointer_client, serial, keyboard);
 	}
 }
 
@@ -1290,7 +1375,7 @@ weston_keyboard_create(void)
 	if (keyboard == NULL)
 	    return NULL;
 
-	wl_list_init(&keyboard->resource_list);
+	wl_list_init(&keyboard->resource_clients);
 	wl_list_init(&keyboard->focus_resource_list);
 	wl_list_init(&keyboard->focus_resource_listener.link);
 	keyboard->focus_resource_listener.notify = keyboard_focus_resource_destroyed;
@@ -1312,15 +1397,11 @@ weston_keyboard_destroy(struct weston_keyboard *keyboard)
 {
 	struct wl_resource *resource;
 
-	wl_resource_for_each(resource, &keyboard->resource_list) {
-		wl_resource_set_user_data(resource, NULL);
-	}
-
 	wl_resource_for_each(resource, &keyboard->focus_resource_list) {
 		wl_resource_set_user_data(resource, NULL);
 	}
 
-	wl_list_remove(&keyboard->resource_list);
+	input_resource_clients_release(&keyboard->resource_clients);
 	wl_list_remove(&keyboard->focus_resource_list);
 
 	xkb_state_unref(keyboard->xkb_state.state);
@@ -1350,7 +1431,7 @@ weston_touch_create(void)
 		return NULL;
 
 	wl_list_init(&touch->device_list);
-	wl_list_init(&touch->resource_list);
+	wl_list_init(&touch->resource_clients);
 	wl_list_init(&touch->focus_resource_list);
 	wl_list_init(&touch->focus_view_listener.link);
 	touch->focus_view_listener.notify = touch_focus_view_destroyed;
@@ -1372,15 +1453,11 @@ weston_touch_destroy(struct weston_touch *touch)
 
 	assert(wl_list_empty(&touch->device_list));
 
-	wl_resource_for_each(resource, &touch->resource_list) {
-		wl_resource_set_user_data(resource, NULL);
-	}
-
 	wl_resource_for_each(resource, &touch->focus_resource_list) {
 		wl_resource_set_user_data(resource, NULL);
 	}
 
-	wl_list_remove(&touch->resource_list);
+	input_resource_clients_release(&touch->resource_clients);
 	wl_list_remove(&touch->focus_resource_list);
 	wl_list_remove(&touch->focus_view_listener.link);
 	wl_list_remove(&touch->focus_resource_listener.link);
@@ -1469,10 +1546,7 @@ weston_pointer_set_focus(struct weston_pointer *pointer,
 		serial = wl_display_next_serial(display);
 
 		if (kbd && kbd->focus != view->surface)
-			send_modifiers_to_client_in_list(surface_client,
-							 &kbd->resource_list,
-							 serial,
-							 kbd);
+			send_modifiers_to_client(surface_client, serial, kbd);
 
 		pointer->focus_client = pointer_client;
 
@@ -1551,19 +1625,16 @@ weston_keyboard_set_focus(struct weston_keyboard *keyboard,
 			wl_keyboard_send_leave(resource, serial,
 					keyboard->focus->resource);
 		}
-		move_resources(&keyboard->resource_list, focus_resource_list);
+		input_resource_clients_unfocus(&keyboard->resource_clients,
+					       focus_resource_list);
 	}
 
-	if (find_resource_for_surface(&keyboard->resource_list, surface) &&
-	    keyboard->focus != surface) {
-		struct wl_client *surface_client =
-			wl_resource_get_client(surface->resource);
-
+	if (surface && keyboard->focus != surface &&
+	    input_resource_clients_focus(&keyboard->resource_clients,
+					 focus_resource_list,
+					 wl_resource_get_client(surface->resource))) {
 		serial = wl_display_next_serial(display);
 
-		move_resources_for_client(focus_resource_list,
-					  &keyboard->resource_list,
-					  surface_client);
 		send_enter_to_resource_list(focus_resource_list,
 					    keyboard,
 					    surface,
@@ -1686,6 +1757,8 @@ weston_pointer_clamp(struct weston_pointer *pointer, wl_fixed_t *fx, wl_fixed_t
 	old_y = wl_fixed_to_int(pointer->y);
 
 	wl_list_for_each(output, &ec->output_list, link) {
+		if (output->mirror)
+			continue;
 		if (pointer->seat->output && pointer->seat->output != output)
 			continue;
 		if (pixman_region32_contains_point(&output->region,
@@ -1757,6 +1830,8 @@ weston_pointer_handle_output_destroy(struct wl_listener *listener, void *data)
 	y = wl_fixed_to_int(pointer->y);
 
 	wl_list_for_each(output, &ec->output_list, link) {
+		if (output->mirror)
+			continue;
 		if (pixman_region32_contains_point(&output->region,
 						   x, y, NULL))
 			return;
@@ -1790,6 +1865,8 @@ notify_motion(struct weston_seat *seat,
 	struct weston_compositor *ec = seat->compositor;
 	struct weston_pointer *pointer = weston_seat_get_pointer(seat);
 
+	WESTON_PROBE(notify_motion, seat, event->mask);
+
 	weston_compositor_wake(ec);
 	pointer->grab->interface->motion(pointer->grab, time, event);
 }
@@ -1838,6 +1915,8 @@ notify_motion_absolute(struct weston_seat *seat, const struct timespec *time,
 	struct weston_pointer *pointer = weston_seat_get_pointer(seat);
 	struct weston_pointer_motion_event event = { 0 };
 
+	WESTON_PROBE(notify_motion_absolute, seat);
+
 	weston_compositor_wake(ec);
 
 	event = (struct weston_pointer_motion_event) {
@@ -1885,6 +1964,8 @@ notify_button(struct weston_seat *seat, const struct timespec *time,
 	struct weston_compositor *compositor = seat->compositor;
 	struct weston_pointer *pointer = weston_seat_get_pointer(seat);
 
+	WESTON_PROBE(notify_button, seat, button, state);
+
 	if (state == WL_POINTER_BUTTON_STATE_PRESSED) {
 		weston_compositor_idle_inhibit(compositor);
 		if (pointer->button_count == 0) {
@@ -1916,6 +1997,8 @@ notify_axis(struct weston_seat *seat, const struct timespec *time,
 	struct weston_compositor *compositor = seat->compositor;
 	struct weston_pointer *pointer = weston_seat_get_pointer(seat);
 
+	WESTON_PROBE(notify_axis, seat, event->axis);
+
 	weston_compositor_wake(compositor);
 
 	if (weston_compositor_run_axis_binding(compositor, pointer,
@@ -1945,6 +2028,7 @@ notify_pointer_frame(struct weston_seat *seat)
 	weston_compositor_wake(compositor);
 
 	pointer->grab->interface->frame(pointer->grab);
+	weston_compositor_schedule_flush(compositor);
 }
 
 WL_EXPORT int
@@ -2126,19 +2210,22 @@ send_modifiers(struct wl_resource *resource, uint32_t serial, struct weston_keyb
 }
 
 static struct weston_xkb_info *
-weston_xkb_info_create(struct xkb_keymap *keymap);
+weston_xkb_info_create(struct weston_compositor *ec,
+		       struct xkb_keymap *keymap);
 
 static void
 update_keymap(struct weston_seat *seat)
 {
 	struct weston_keyboard *keyboard = weston_seat_get_keyboard(seat);
+	struct weston_input_resource_client *rc;
 	struct wl_resource *resource;
 	struct weston_xkb_info *xkb_info;
 	struct xkb_state *state;
 	xkb_mod_mask_t latched_mods;
 	xkb_mod_mask_t locked_mods;
 
-	xkb_info = weston_xkb_info_create(keyboard->pending_keymap);
+	xkb_info = weston_xkb_info_create(seat->compositor,
+					  keyboard->pending_keymap);
 
 	xkb_keymap_unref(keyboard->pending_keymap);
 	keyboard->pending_keymap = NULL;
@@ -2171,8 +2258,10 @@ update_keymap(struct weston_seat *seat)
 	xkb_state_unref(keyboard->xkb_state.state);
 	keyboard->xkb_state.state = state;
 
-	wl_resource_for_each(resource, &keyboard->resource_list)
-		weston_keyboard_send_keymap(keyboard, resource);
+	wl_list_for_each(rc, &keyboard->resource_clients, link) {
+		wl_resource_for_each(resource, &rc->resources)
+			weston_keyboard_send_keymap(keyboard, resource);
+	}
 	wl_resource_for_each(resource, &keyboard->focus_resource_list)
 		weston_keyboard_send_keymap(keyboard, resource);
 
@@ -2181,8 +2270,10 @@ update_keymap(struct weston_seat *seat)
 	if (!latched_mods && !locked_mods)
 		return;
 
-	wl_resource_for_each(resource, &keyboard->resource_list)
-		send_modifiers(resource, wl_display_get_serial(seat->compositor->wl_display), keyboard);
+	wl_list_for_each(rc, &keyboard->resource_clients, link) {
+		wl_resource_for_each(resource, &rc->resources)
+			send_modifiers(resource, wl_display_get_serial(seat->compositor->wl_display), keyboard);
+	}
 	wl_resource_for_each(resource, &keyboard->focus_resource_list)
 		send_modifiers(resource, wl_display_get_serial(seat->compositor->wl_display), keyboard);
 }
@@ -2197,6 +2288,10 @@ notify_key(struct weston_seat *seat, const struct timespec *time, uint32_t key,
 	struct weston_keyboard_grab *grab = keyboard->grab;
 	uint32_t *k, *end;
 
+	WESTON_PROBE(notify_key, seat, key, state);
+
+	weston_compositor_schedule_flush(compositor);
+
 	if (state == WL_KEYBOARD_KEY_STATE_PRESSED) {
 		weston_compositor_idle_inhibit(compositor);
 	} else {
@@ -2354,10 +2449,8 @@ weston_touch_set_focus(struct weston_touch *touch, struct weston_view *view)
 	wl_list_remove(&touch->focus_view_listener.link);
 	wl_list_init(&touch->focus_view_listener.link);
 
-	if (!wl_list_empty(focus_resource_list)) {
-		move_resources(&touch->resource_list,
-			       focus_resource_list);
-	}
+	input_resource_clients_unfocus(&touch->resource_clients,
+				       focus_resource_list);
 
 	if (view) {
 		struct wl_client *surface_client;
@@ -2368,9 +2461,9 @@ weston_touch_set_focus(struct weston_touch *touch, struct weston_view *view)
 		}
 
 		surface_client = wl_resource_get_client(view->surface->resource);
-		move_resources_for_client(focus_resource_list,
-					  &touch->resource_list,
-					  surface_client);
+		input_resource_clients_focus(&touch->resource_clients,
+					     focus_resource_list,
+					     surface_client);
 		wl_resource_add_destroy_listener(view->surface->resource,
 						 &touch->focus_resource_listener);
 		wl_signal_add(&view->destroy_signal, &touch->focus_view_listener);
@@ -2577,6 +2670,8 @@ notify_touch_normalized(struct weston_touch_device *device,
 	struct weston_seat *seat = device->aggregate->seat;
 	struct weston_touch *touch = device->aggregate;
 
+	WESTON_PROBE(notify_touch, seat, touch_id, touch_type);
+
 	if (touch_type != WL_TOUCH_UP) {
 		if (weston_touch_device_can_calibrate(device))
 			assert(norm != NULL);
@@ -2641,6 +2736,7 @@ notify_touch_frame(struct weston_touch_device *device)
 	}
 
 	weston_compositor_update_touch_mode(device->aggregate->seat->compositor);
+	weston_compositor_schedule_flush(device->aggregate->seat->compositor);
 }
 
 WL_EXPORT void
@@ -2846,6 +2942,8 @@ destroy_keyboard_resource(struct wl_resource *resource)
 	if (keyboard) {
 		remove_input_resource_from_timestamps(resource,
 						      &keyboard->timestamps_list);
+		input_resource_client_unref(&keyboard->resource_clients,
+					    wl_resource_get_client(resource));
 	}
 }
 
@@ -2873,6 +2971,7 @@ seat_get_keyboard(struct wl_client *client, struct wl_resource *resource,
 	 * capabilities and the client trying to use the old ones.
 	 */
 	struct weston_keyboard *keyboard = seat ? seat->keyboard_state : NULL;
+	struct weston_input_resource_client *rc;
 	struct wl_resource *cr;
 
 	cr = wl_resource_create(client, &wl_keyboard_interface,
@@ -2891,10 +2990,18 @@ seat_get_keyboard(struct wl_client *client, struct wl_resource *resource,
 	if (!keyboard)
 		return;
 
+	rc = input_resource_client_ensure(&keyboard->resource_clients, client);
+	if (!rc) {
+		wl_resource_set_user_data(cr, NULL);
+		wl_client_post_no_memory(client);
+		return;
+	}
+	rc->n_resources++;
+
 	/* May be moved to focused list later by either
 	 * weston_keyboard_set_focus or directly if this client is already
 	 * focused */
-	wl_list_insert(&keyboard->resource_list, wl_resource_get_link(cr));
+	wl_list_insert(&rc->resources, wl_resource_get_link(cr));
 
 	if (wl_resource_get_version(cr) >= WL_KEYBOARD_REPEAT_INFO_SINCE_VERSION) {
 		wl_keyboard_send_repeat_info(cr,
@@ -2939,6 +3046,8 @@ destroy_touch_resource(struct wl_resource *resource)
 	if (touch) {
 		remove_input_resource_from_timestamps(resource,
 						      &touch->timestamps_list);
+		input_resource_client_unref(&touch->resource_clients,
+					    wl_resource_get_client(resource));
 	}
 }
 
@@ -2966,6 +3075,7 @@ seat_get_touch(struct wl_client *client, struct wl_resource *resource,
 	 * capabilities and the client trying to use the old ones.
 	 */
 	struct weston_touch *touch = seat ? seat->touch_state : NULL;
+	struct weston_input_resource_client *rc;
 	struct wl_resource *cr;
 
 	cr = wl_resource_create(client, &wl_touch_interface,
@@ -2984,13 +3094,20 @@ seat_get_touch(struct wl_client *client, struct wl_resource *resource,
 	if (!touch)
 		return;
 
+	rc = input_resource_client_ensure(&touch->resource_clients, client);
+	if (!rc) {
+		wl_resource_set_user_data(cr, NULL);
+		wl_client_post_no_memory(client);
+		return;
+	}
+	rc->n_resources++;
+
 	if (touch->focus &&
 	    wl_resource_get_client(touch->focus->surface->resource) == client) {
 		wl_list_insert(&touch->focus_resource_list,
 			       wl_resource_get_link(cr));
 	} else {
-		wl_list_insert(&touch->resource_list,
-			       wl_resource_get_link(cr));
+		wl_list_insert(&rc->resources, wl_resource_get_link(cr));
 	}
 }
 
@@ -3132,12 +3249,146 @@ weston_xkb_info_destroy(struct weston_xkb_info *xkb_info)
 	if (--xkb_info->ref_count > 0)
 		return;
 
+	wl_list_remove(&xkb_info->link);
 	xkb_keymap_unref(xkb_info->keymap);
 
 	os_ro_anonymous_file_destroy(xkb_info->keymap_rofile);
 	free(xkb_info);
 }
 
+/** A compiled keymap, shared by all seats asking for the same one
+ *
+ * Compiling a keymap takes tens of milliseconds on slow cores, and seats
+ * of a multi-seat setup or layout toggles keep asking for the same few.
+ * The key is either the RMLVO names or the keymap text.
+ */
+struct weston_xkb_keymap_entry {
+	struct wl_list link; /* weston_compositor::xkb_keymap_cache */
+	char *key;
+	struct xkb_keymap *keymap;
+};
+
+static struct xkb_keymap *
+xkb_keymap_cache_lookup(struct weston_compositor *ec, const char *key)
+{
+	struct weston_xkb_keymap_entry *entry;
+
+	wl_list_for_each(entry, &ec->xkb_keymap_cache, link) {
+		if (strcmp(entry->key, key) == 0) {
+			/* Keep the most recently used ones in front. */
+			wl_list_remove(&entry->link);
+			wl_list_insert(&ec->xkb_keymap_cache, &entry->link);
+			return xkb_keymap_ref(entry->keymap);
+		}
+	}
+
+	return NULL;
+}
+
+static void
+xkb_keymap_cache_add(struct weston_compositor *ec, char *key,
+		     struct xkb_keymap *keymap)
+{
+	struct weston_xkb_keymap_entry *entry;
+
+	entry = zalloc(sizeof *entry);
+	if (!entry) {
+		free(key);
+		return;
+	}
+
+	entry->key = key;
+	entry->keymap = xkb_keymap_ref(keymap);
+	wl_list_insert(&ec->xkb_keymap_cache, &entry->link);
+}
+
+static void
+xkb_keymap_cache_release(struct weston_compositor *ec)
+{
+	struct weston_xkb_keymap_entry *entry, *tmp;
+
+	wl_list_for_each_safe(entry, tmp, &ec->xkb_keymap_cache, link) {
+		wl_list_remove(&entry->link);
+		xkb_keymap_unref(entry->keymap);
+		free(entry->key);
+		free(entry);
+	}
+}
+
+/** Get a compiled keymap for the given RMLVO names
+ *
+ * \param ec The compositor, whose XKB context is used.
+ * \param names The rule names, NULL fields are left to libxkbcommon
+ * defaults.
+ * \return A new reference to the keymap, or NULL if it failed to compile.
+ *
+ * Returns the same keymap object for the same names, so that seats using
+ * it also share one weston_xkb_info and one keymap file.
+ */
+WL_EXPORT struct xkb_keymap *
+weston_compositor_get_xkb_keymap(struct weston_compositor *ec,
+				 const struct xkb_rule_names *names)
+{
+	struct xkb_keymap *keymap;
+	char *key;
+
+	if (asprintf(&key, "rmlvo:%s:%s:%s:%s:%s",
+		     names->rules ?: "", names->model ?: "",
+		     names->layout ?: "", names->variant ?: "",
+		     names->options ?: "") < 0)
+		return xkb_keymap_new_from_names(ec->xkb_context, names, 0);
+
+	keymap = xkb_keymap_cache_lookup(ec, key);
+	if (keymap) {
+		free(key);
+		return keymap;
+	}
+
+	keymap = xkb_keymap_new_from_names(ec->xkb_context, names, 0);
+	if (keymap)
+		xkb_keymap_cache_add(ec, key, keymap);
+	else
+		free(key);
+
+	return keymap;
+}
+
+/** Get a compiled keymap for the given keymap text
+ *
+ * \param ec The compositor, whose XKB context is used.
+ * \param string The keymap in XKB_KEYMAP_FORMAT_TEXT_V1.
+ * \return A new reference to the keymap, or NULL if it failed to compile.
+ *
+ * Like weston_compositor_get_xkb_keymap(), for keymaps received from a
+ * parent compositor or another remote source.
+ */
+WL_EXPORT struct xkb_keymap *
+weston_compositor_get_xkb_keymap_from_string(struct weston_compositor *ec,
+					     const char *string)
+{
+	struct xkb_keymap *keymap;
+	char *key;
+
+	if (asprintf(&key, "text:%s", string) < 0)
+		return xkb_keymap_new_from_string(ec->xkb_context, string,
+						  XKB_KEYMAP_FORMAT_TEXT_V1, 0);
+
+	keymap = xkb_keymap_cache_lookup(ec, key);
+	if (keymap) {
+		free(key);
+		return keymap;
+	}
+
+	keymap = xkb_keymap_new_from_string(ec->xkb_context, string,
+					    XKB_KEYMAP_FORMAT_TEXT_V1, 0);
+	if (keymap)
+		xkb_keymap_cache_add(ec, key, keymap);
+	else
+		free(key);
+
+	return keymap;
+}
+
 void
 weston_compositor_xkb_destroy(struct weston_compositor *ec)
 {
@@ -3149,15 +3400,28 @@ weston_compositor_xkb_destroy(struct weston_compositor *ec)
 
 	if (ec->xkb_info)
 		weston_xkb_info_destroy(ec->xkb_info);
+	xkb_keymap_cache_release(ec);
 	xkb_context_unref(ec->xkb_context);
 }
 
+/* Keymaps from weston_compositor_get_xkb_keymap() are shared objects, so
+ * all keyboards using one get the same info and keymap file as well. */
 static struct weston_xkb_info *
-weston_xkb_info_create(struct xkb_keymap *keymap)
+weston_xkb_info_create(struct weston_compositor *ec,
+		       struct xkb_keymap *keymap)
 {
 	char *keymap_string;
 	size_t keymap_size;
-	struct weston_xkb_info *xkb_info = zalloc(sizeof *xkb_info);
+	struct weston_xkb_info *xkb_info;
+
+	wl_list_for_each(xkb_info, &ec->xkb_info_list, link) {
+		if (xkb_info->keymap == keymap) {
+			xkb_info->ref_count++;
+			return xkb_info;
+		}
+	}
+
+	xkb_info = zalloc(sizeof *xkb_info);
 	if (xkb_info == NULL)
 		return NULL;
 
@@ -3205,6 +3469,8 @@ weston_xkb_info_create(struct xkb_keymap *keymap)
 		goto err_keymap;
 	}
 
+	wl_list_insert(&ec->xkb_info_list, &xkb_info->link);
+
 	return xkb_info;
 
 err_keymap:
@@ -3221,9 +3487,7 @@ weston_compositor_build_global_keymap(struct weston_compositor *ec)
 	if (ec->xkb_info != NULL)
 		return 0;
 
-	keymap = xkb_keymap_new_from_names(ec->xkb_context,
-					   &ec->xkb_names,
-					   0);
+	keymap = weston_compositor_get_xkb_keymap(ec, &ec->xkb_names);
 	if (keymap == NULL) {
 		weston_log("failed to compile global XKB keymap\n");
 		weston_log("  tried rules %s, model %s, layout %s, variant %s, "
@@ -3234,7 +3498,7 @@ weston_compositor_build_global_keymap(struct weston_compositor *ec)
 		return -1;
 	}
 
-	ec->xkb_info = weston_xkb_info_create(keymap);
+	ec->xkb_info = weston_xkb_info_create(ec, keymap);
 	xkb_keymap_unref(keymap);
 	if (ec->xkb_info == NULL)
 		return -1;
@@ -3276,7 +3540,8 @@ weston_seat_init_keyboard(struct weston_seat *seat, struct xkb_keymap *keymap)
 	}
 
 	if (keymap != NULL) {
-		keyboard->xkb_info = weston_xkb_info_create(keymap);
+		keyboard->xkb_info = weston_xkb_info_create(seat->compositor,
+							    keymap);
 		if (keyboard->xkb_info == NULL)
 			goto err;
 	} else {
@@ -39,6 +39,10 @@ struct launcher_interface {
 	int (* activate_vt) (struct weston_launcher *launcher, int vt);
 	/* Get the number of the VT weston is running in */
 	int (* get_vt) (struct weston_launcher *launcher);
+	/* Optional: start acquiring a device that will be opened shortly */
+	void (* prefetch) (struct weston_launcher *launcher, const char *path);
+	/* Optional: drop the prefetched devices that were not opened */
+	void (* prefetch_finish) (struct weston_launcher *launcher);
 };
 
 struct weston_launcher {
@@ -42,6 +42,7 @@
 #include "backend.h"
 #include "dbus.h"
 #include "launcher-impl.h"
+#include "watchdog.h"
 
 #define DRM_MAJOR 226
 
@@ -67,39 +68,102 @@ struct launcher_logind {
 	struct wl_event_source *dbus_ctx;
 	char *spath;
 	DBusPendingCall *pending_active;
+
+	/* TakeDevice calls sent ahead of the matching open() */
+	struct wl_list prefetch_list;
+};
+
+struct launcher_logind_prefetch {
+	struct wl_list link;	/* launcher_logind::prefetch_list */
+	dev_t devnum;
+	DBusPendingCall *pending;
 };
 
+static void
+launcher_logind_release_device(struct launcher_logind *wl, uint32_t major,
+			     uint32_t minor);
+
+static DBusMessage *
+launcher_logind_take_device_msg(struct launcher_logind *wl, uint32_t major,
+				uint32_t minor)
+{
+	DBusMessage *m;
+
+	m = dbus_message_new_method_call("org.freedesktop.login1",
+					 wl->spath,
+					 "org.freedesktop.login1.Session",
+					 "TakeDevice");
+	if (!m)
+		return NULL;
+
+	if (!dbus_message_append_args(m,
+				      DBUS_TYPE_UINT32, &major,
+				      DBUS_TYPE_UINT32, &minor,
+				      DBUS_TYPE_INVALID)) {
+		dbus_message_unref(m);
+		return NULL;
+	}
+
+	return m;
+}
+
+static struct launcher_logind_prefetch *
+launcher_logind_find_prefetch(struct launcher_logind *wl, dev_t devnum)
+{
+	struct launcher_logind_prefetch *prefetch;
+
+	wl_list_for_each(prefetch, &wl->prefetch_list, link) {
+		if (prefetch->devnum == devnum)
+			return prefetch;
+	}
+
+	return NULL;
+}
+
+static void
+launcher_logind_prefetch_destroy(struct launcher_logind_prefetch *prefetch)
+{
+	wl_list_remove(&prefetch->link);
+	dbus_pending_call_unref(prefetch->pending);
+	free(prefetch);
+}
+
 static int
 launcher_logind_take_device(struct launcher_logind *wl, uint32_t major,
 			  uint32_t minor, bool *paused_out)
 {
+	struct launcher_logind_prefetch *prefetch;
 	DBusMessage *m, *reply;
+	const char *phase;
 	bool b;
 	int r, fd;
 	dbus_bool_t paused;
 
-	m = dbus_message_new_method_call("org.freedesktop.login1",
-					 wl->spath,
-					 "org.freedesktop.login1.Session",
-					 "TakeDevice");
-	if (!m)
-		return -ENOMEM;
-
-	b = dbus_message_append_args(m,
-				     DBUS_TYPE_UINT32, &major,
-				     DBUS_TYPE_UINT32, &minor,
-				     DBUS_TYPE_INVALID);
-	if (!b) {
-		r = -ENOMEM;
-		goto err_unref;
+	/* A prefetched call has been in flight since the prefetch, waiting
+	 * for it overlaps with the round-trips of the other devices. */
+	prefetch = launcher_logind_find_prefetch(wl, makedev(major, minor));
+	if (prefetch) {
+		phase = weston_watchdog_phase_enter("logind TakeDevice");
+		dbus_pending_call_block(prefetch->pending);
+		weston_watchdog_phase_leave(phase);
+		reply = dbus_pending_call_steal_reply(prefetch->pending);
+		launcher_logind_prefetch_destroy(prefetch);
+	} else {
+		m = launcher_logind_take_device_msg(wl, major, minor);
+		if (!m)
+			return -ENOMEM;
+
+		phase = weston_watchdog_phase_enter("logind TakeDevice");
+		reply = dbus_connection_send_with_reply_and_block(wl->dbus, m,
+								  -1, NULL);
+		weston_watchdog_phase_leave(phase);
+		dbus_message_unref(m);
 	}
 
-	reply = dbus_connection_send_with_reply_and_block(wl->dbus, m,
-							  -1, NULL);
-	if (!reply) {
+	if (!reply || dbus_message_get_type(reply) == DBUS_MESSAGE_TYPE_ERROR) {
 		weston_log("logind: TakeDevice on %d:%d failed.\n", major, minor);
 		r = -ENODEV;
-		goto err_unref;
+		goto err_reply;
 	}
 
 	b = dbus_message_get_args(reply, NULL,
@@ -117,12 +181,75 @@ launcher_logind_take_device(struct launcher_logind *wl, uint32_t major,
 		*paused_out = paused;
 
 err_reply:
-	dbus_message_unref(reply);
-err_unref:
-	dbus_message_unref(m);
+	if (reply)
+		dbus_message_unref(reply);
 	return r;
 }
 
+/** Send TakeDevice for a device that is going to be opened soon
+ *
+ * logind answers the requests in order, so a caller about to open many
+ * devices pays for one round-trip instead of one per device. The reply
+ * is only collected by launcher_logind_open().
+ */
+static void
+launcher_logind_prefetch(struct weston_launcher *launcher, const char *path)
+{
+	struct launcher_logind *wl = wl_container_of(launcher, wl, base);
+	struct launcher_logind_prefetch *prefetch;
+	DBusPendingCall *pending;
+	DBusMessage *m;
+	struct stat st;
+	bool b;
+
+	if (stat(path, &st) < 0 || !S_ISCHR(st.st_mode))
+		return;
+
+	if (launcher_logind_find_prefetch(wl, st.st_rdev))
+		return;
+
+	prefetch = zalloc(sizeof *prefetch);
+	if (!prefetch)
+		return;
+
+	m = launcher_logind_take_device_msg(wl, major(st.st_rdev),
+					    minor(st.st_rdev));
+	if (!m) {
+		free(prefetch);
+		return;
+	}
+
+	b = dbus_connection_send_with_reply(wl->dbus, m, &pending, -1);
+	dbus_message_unref(m);
+	if (!b || !pending) {
+		free(prefetch);
+		return;
+	}
+
+	prefetch->devnum = st.st_rdev;
+	prefetch->pending = pending;
+	wl_list_insert(&wl->prefetch_list, &prefetch->link);
+}
+
+/** Give back the prefetched devices nobody opened
+ *
+ * logind handles the ReleaseDevice after the TakeDevice it follows, so
+ * the pending calls can simply be dropped without waiting for them.
+ */
+static void
+launcher_logind_prefetch_finish(struct weston_launcher *launcher)
+{
+	struct launcher_logind *wl = wl_container_of(launcher, wl, base);
+	struct launcher_logind_prefetch *prefetch, *tmp;
+
+	wl_list_for_each_safe(prefetch, tmp, &wl->prefetch_list, link) {
+		dbus_pending_call_cancel(prefetch->pending);
+		launcher_logind_release_device(wl, major(prefetch->devnum),
+					       minor(prefetch->devnum));
+		launcher_logind_prefetch_destroy(prefetch);
+	}
+}
+
 static void
 launcher_logind_release_device(struct launcher_logind *wl, uint32_t major,
 			     uint32_t minor)
@@ -636,6 +763,7 @@ launcher_logind_take_control(struct launcher_logind *wl)
 {
 	DBusError err;
 	DBusMessage *m, *reply;
+	const char *phase;
 	dbus_bool_t force;
 	bool b;
 	int r;
@@ -658,8 +786,10 @@ launcher_logind_take_control(struct launcher_logind *wl)
 		goto err_unref;
 	}
 
+	phase = weston_watchdog_phase_enter("logind TakeControl");
 	reply = dbus_connection_send_with_reply_and_block(wl->dbus,
 							  m, -1, &err);
+	weston_watchdog_phase_leave(phase);
 	if (!reply) {
 		if (dbus_error_has_name(&err, DBUS_ERROR_UNKNOWN_METHOD))
 			weston_log("logind: old systemd version detected\n");
@@ -775,6 +905,7 @@ launcher_logind_connect(struct weston_launcher **out, struct weston_compositor *
 	wl->base.iface = &launcher_logind_iface;
 	wl->compositor = compositor;
 	wl->sync_drm = sync_drm;
+	wl_list_init(&wl->prefetch_list);
 
 	wl->seat = strdup(seat_id);
 	if (!wl->seat) {
@@ -869,6 +1000,7 @@ launcher_logind_destroy(struct weston_launcher *launcher)
 		dbus_pending_call_unref(wl->pending_active);
 	}
 
+	launcher_logind_prefetch_finish(launcher);
 	launcher_logind_release_control(wl);
 	launcher_logind_destroy_dbus(wl);
 	weston_dbus_close(wl->dbus, wl->dbus_ctx);
@@ -895,4 +1027,6 @@ const struct launcher_interface launcher_logind_iface = {
 	.close = launcher_logind_close,
 	.activate_vt = launcher_logind_activate_vt,
 	.get_vt = launcher_logind_get_vt,
+	.prefetch = launcher_logind_prefetch,
+	.prefetch_finish = launcher_logind_prefetch_finish,
 };
@@ -85,6 +85,26 @@ weston_launcher_close(struct weston_launcher *launcher, int fd)
 	launcher->iface->close(launcher, fd);
 }
 
+/** Announce a device that is about to be opened
+ *
+ * Launchers which acquire devices through IPC can start doing so now,
+ * so that acquiring a batch of devices costs one round-trip. Each batch
+ * must end with weston_launcher_prefetch_finish().
+ */
+void
+weston_launcher_prefetch(struct weston_launcher *launcher, const char *path)
+{
+	if (launcher->iface->prefetch)
+		launcher->iface->prefetch(launcher, path);
+}
+
+void
+weston_launcher_prefetch_finish(struct weston_launcher *launcher)
+{
+	if (launcher->iface->prefetch_finish)
+		launcher->iface->prefetch_finish(launcher);
+}
+
 WL_EXPORT int
 weston_launcher_activate_vt(struct weston_launcher *launcher, int vt)
 {
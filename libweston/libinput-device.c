@@ -42,6 +42,7 @@
 #include "backend.h"
 #include "libweston-internal.h"
 #include "libinput-device.h"
+#include "libinput-seat.h"
 #include "shared/helpers.h"
 #include "shared/timespec-util.h"
 
@@ -129,6 +130,21 @@ handle_pointer_motion(struct libinput_device *libinput_device,
 		.dy_unaccel = dy_unaccel,
 	};
 
+	if (device->seat->compositor->input_coalesce) {
+		if (device->motion_pending) {
+			device->motion.time = event.time;
+			device->motion.dx += event.dx;
+			device->motion.dy += event.dy;
+			device->motion.dx_unaccel += event.dx_unaccel;
+			device->motion.dy_unaccel += event.dy_unaccel;
+		} else {
+			device->motion = event;
+			device->motion_pending = true;
+		}
+
+		return false;
+	}
+
 	notify_motion(device->seat, &time, &event);
 
 	return true;
@@ -323,6 +339,14 @@ handle_pointer_axis(struct libinput_device *libinput_device,
 	return true;
 }
 
+static struct udev_input *
+evdev_device_get_udev_input(struct evdev_device *device)
+{
+	struct libinput *libinput = libinput_device_get_context(device->device);
+
+	return libinput_get_user_data(libinput);
+}
+
 static struct weston_output *
 touch_get_output(struct weston_touch_device *device)
 {
@@ -360,9 +384,12 @@ touch_get_calibration(struct weston_touch_device *device,
 		      struct weston_touch_device_matrix *cal)
 {
 	struct evdev_device *evdev_device = device->backend_data;
+	struct udev_input *input = evdev_device_get_udev_input(evdev_device);
 
+	udev_input_lock(input);
 	libinput_device_config_calibration_get_matrix(evdev_device->device,
 						      cal->m);
+	udev_input_unlock(input);
 }
 
 static void
@@ -389,13 +416,16 @@ touch_set_calibration(struct weston_touch_device *device,
 		      const struct weston_touch_device_matrix *cal)
 {
 	struct evdev_device *evdev_device = device->backend_data;
+	struct udev_input *input = evdev_device_get_udev_input(evdev_device);
 
 	/* Stop output hotplug from reloading the WL_CALIBRATION values.
 	 * libinput will maintain the latest calibration for us.
 	 */
 	evdev_device->override_wl_calibration = true;
 
+	udev_input_lock(input);
 	do_set_calibration(evdev_device, cal);
+	udev_input_unlock(input);
 }
 
 static const struct weston_touch_device_ops touch_calibration_ops = {
@@ -435,6 +465,25 @@ create_touch_device(struct evdev_device *device)
 	return touch_device;
 }
 
+static void
+coalesce_touch_motion(struct evdev_device *device,
+		      const struct evdev_touch_motion *motion)
+{
+	unsigned int i;
+
+	for (i = 0; i < device->n_touch_pending; i++) {
+		if (device->touch_pending[i].slot == motion->slot) {
+			device->touch_pending[i] = *motion;
+			return;
+		}
+	}
+
+	if (device->n_touch_pending == ARRAY_LENGTH(device->touch_pending))
+		evdev_device_flush_coalesced(device);
+
+	device->touch_pending[device->n_touch_pending++] = *motion;
+}
+
 static void
 handle_touch_with_coords(struct libinput_device *libinput_device,
 			 struct libinput_event_touch *touch_event,
@@ -464,6 +513,27 @@ handle_touch_with_coords(struct libinput_device *libinput_device,
 	weston_output_transform_coordinate(device->output,
 					   x, y, &x, &y);
 
+	if (touch_type == WL_TOUCH_MOTION &&
+	    device->seat->compositor->input_coalesce) {
+		struct evdev_touch_motion motion = {
+			.slot = slot,
+			.time = time,
+			.x = x,
+			.y = y,
+			.normalized = weston_touch_device_can_calibrate(
+						device->touch_device),
+		};
+
+		if (motion.normalized) {
+			motion.norm.x =
+				libinput_event_touch_get_x_transformed(touch_event, 1);
+			motion.norm.y =
+				libinput_event_touch_get_y_transformed(touch_event, 1);
+		}
+		coalesce_touch_motion(device, &motion);
+		return;
+	}
+
 	if (weston_touch_device_can_calibrate(device->touch_device)) {
 		norm.x = libinput_event_touch_get_x_transformed(touch_event, 1);
 		norm.y = libinput_event_touch_get_y_transformed(touch_event, 1);
@@ -510,9 +580,60 @@ handle_touch_frame(struct libinput_device *libinput_device,
 	struct evdev_device *device =
 		libinput_device_get_user_data(libinput_device);
 
+	/* The frame belongs to motion still held back, so send it along. */
+	if (device->n_touch_pending > 0) {
+		device->touch_frame_pending = true;
+		return;
+	}
+
 	notify_touch_frame(device->touch_device);
 }
 
+bool
+evdev_device_has_coalesced(struct evdev_device *device)
+{
+	return device->motion_pending || device->n_touch_pending > 0 ||
+	       device->touch_frame_pending;
+}
+
+/** Deliver the input held back by motion coalescing
+ *
+ * Must be called before any other event of the seat is delivered, so
+ * that clients see the events in their original order.
+ */
+void
+evdev_device_flush_coalesced(struct evdev_device *device)
+{
+	struct evdev_touch_motion *motion;
+	unsigned int i;
+
+	if (device->motion_pending) {
+		device->motion_pending = false;
+		notify_motion(device->seat, &device->motion.time,
+			      &device->motion);
+		notify_pointer_frame(device->seat);
+	}
+
+	for (i = 0; i < device->n_touch_pending; i++) {
+		motion = &device->touch_pending[i];
+		if (motion->normalized)
+			notify_touch_normalized(device->touch_device,
+						&motion->time, motion->slot,
+						motion->x, motion->y,
+						&motion->norm, WL_TOUCH_MOTION);
+		else
+			notify_touch(device->touch_device, &motion->time,
+				     motion->slot, motion->x, motion->y,
+				     WL_TOUCH_MOTION);
+	}
+	device->n_touch_pending = 0;
+
+	if (device->touch_frame_pending) {
+		device->touch_frame_pending = false;
+		notify_touch_frame(device->touch_device);
+	}
+}
+
 int
 evdev_device_process_event(struct libinput_event *event)
 {
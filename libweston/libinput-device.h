@@ -41,6 +41,18 @@ enum evdev_device_seat_capability {
 	EVDEV_SEAT_TOUCH = (1 << 2)
 };
 
+/* Touch slots whose motion can be held back at once per device */
+#define EVDEV_COALESCED_TOUCH_SLOTS 10
+
+struct evdev_touch_motion {
+	int32_t slot;
+	struct timespec time;
+	double x;
+	double y;
+	bool normalized;
+	struct weston_point2d_device_normalized norm;
+};
+
 struct evdev_device {
 	struct weston_seat *seat;
 	enum evdev_device_seat_capability seat_caps;
@@ -52,6 +64,13 @@ struct evdev_device {
 	char *output_name;
 	int fd;
 	bool override_wl_calibration;
+
+	/* Input held back while weston_compositor::input_coalesce is set */
+	bool motion_pending;
+	struct weston_pointer_motion_event motion;
+	unsigned int n_touch_pending;
+	struct evdev_touch_motion touch_pending[EVDEV_COALESCED_TOUCH_SLOTS];
+	bool touch_frame_pending;
 };
 
 void
@@ -76,6 +95,12 @@ evdev_notify_keyboard_focus(struct weston_seat *seat,
 void
 evdev_device_set_calibration(struct evdev_device *device);
 
+bool
+evdev_device_has_coalesced(struct evdev_device *device);
+
+void
+evdev_device_flush_coalesced(struct evdev_device *device);
+
 int
 dispatch_libinput(struct libinput *libinput);
 
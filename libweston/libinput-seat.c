@@ -26,11 +26,16 @@
 
 #include "config.h"
 
+#include <errno.h>
+#include <poll.h>
+#include <sched.h>
+#include <signal.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <sys/eventfd.h>
 #include <libinput.h>
 #include <libudev.h>
 
@@ -49,6 +54,13 @@ static struct udev_seat *
 udev_seat_create(struct udev_input *input, const char *seat_name);
 static void
 udev_seat_destroy(struct udev_seat *seat);
+static void
+udev_input_flush_coalesced(struct udev_input *input);
+static void
+udev_input_stop_thread(struct udev_input *input);
+
+/* Upper bound on how long device enumeration waits for the first frame */
+#define DEFERRED_ENUMERATION_TIMEOUT_MS 1000
 
 static struct udev_seat *
 get_udev_seat(struct udev_input *input, struct libinput_device *device)
@@ -183,11 +195,108 @@ udev_input_disable(struct udev_input *input)
 
 	wl_event_source_remove(input->libinput_source);
 	input->libinput_source = NULL;
+	udev_input_stop_thread(input);
+
+	udev_input_lock(input);
 	libinput_suspend(input->libinput);
 	process_events(input);
+	udev_input_unlock(input);
+	udev_input_flush_coalesced(input);
+	if (input->coalesce_timer_armed) {
+		wl_event_source_timer_update(input->coalesce_timer, 0);
+		input->coalesce_timer_armed = false;
+	}
 	input->suspended = 1;
 }
 
+static bool
+event_is_coalescable(struct libinput_event *event)
+{
+	switch (libinput_event_get_type(event)) {
+	case LIBINPUT_EVENT_POINTER_MOTION:
+	case LIBINPUT_EVENT_TOUCH_MOTION:
+	case LIBINPUT_EVENT_TOUCH_FRAME:
+		return true;
+	default:
+		return false;
+	}
+}
+
+static void
+udev_input_flush_coalesced(struct udev_input *input)
+{
+	struct udev_seat *seat;
+	struct evdev_device *device;
+
+	wl_list_for_each(seat, &input->compositor->seat_list, base.link) {
+		wl_list_for_each(device, &seat->devices_list, link)
+			evdev_device_flush_coalesced(device);
+	}
+}
+
+static bool
+udev_input_has_coalesced(struct udev_input *input)
+{
+	struct udev_seat *seat;
+	struct evdev_device *device;
+
+	wl_list_for_each(seat, &input->compositor->seat_list, base.link) {
+		wl_list_for_each(device, &seat->devices_list, link) {
+			if (evdev_device_has_coalesced(device))
+				return true;
+		}
+	}
+
+	return false;
+}
+
+static int
+coalesce_timer_handler(void *data)
+{
+	struct udev_input *input = data;
+
+	input->coalesce_timer_armed = false;
+	udev_input_flush_coalesced(input);
+
+	return 0;
+}
+
+/* Called after a batch of libinput events has been processed. Without a
+ * deadline the merged motion goes out right away, otherwise a timer
+ * started by the first held back event bounds the added latency. */
+static void
+udev_input_schedule_coalesced(struct udev_input *input)
+{
+	struct weston_compositor *c = input->compositor;
+	struct wl_event_loop *loop;
+
+	if (!c->input_coalesce)
+		return;
+
+	if (c->input_coalesce_msec == 0) {
+		udev_input_flush_coalesced(input);
+		return;
+	}
+
+	if (input->coalesce_timer_armed || !udev_input_has_coalesced(input))
+		return;
+
+	if (!input->coalesce_timer) {
+		loop = wl_display_get_event_loop(c->wl_display);
+		input->coalesce_timer =
+			wl_event_loop_add_timer(loop, coalesce_timer_handler,
+						input);
+		if (!input->coalesce_timer) {
+			udev_input_flush_coalesced(input);
+			return;
+		}
+	}
+
+	wl_event_source_timer_update(input->coalesce_timer,
+				     c->input_coalesce_msec);
+	input->coalesce_timer_armed = true;
+}
+
 static int
 udev_input_process_event(struct libinput_event *event)
 {
@@ -197,6 +306,10 @@ udev_input_process_event(struct libinput_event *event)
 	struct udev_input *input = libinput_get_user_data(libinput);
 	int ret = 0;
 
+	/* Keep the order of events: everything held back goes first. */
+	if (input->compositor->input_coalesce && !event_is_coalescable(event))
+		udev_input_flush_coalesced(input);
+
 	switch (libinput_event_get_type(event)) {
 	case LIBINPUT_EVENT_DEVICE_ADDED:
 		ret = device_added(input, libinput_device);
@@ -224,10 +337,12 @@ process_events(struct udev_input *input)
 {
 	struct libinput_event *event;
 
+	udev_input_lock(input);
 	while ((event = libinput_get_event(input->libinput))) {
 		process_event(event);
 		libinput_event_destroy(event);
 	}
+	udev_input_unlock(input);
 }
 
 static int
@@ -237,6 +352,7 @@ udev_input_dispatch(struct udev_input *input)
 		weston_log("libinput: Failed to dispatch libinput\n");
 
 	process_events(input);
+	udev_input_schedule_coalesced(input);
 
 	return 0;
 }
@@ -249,12 +365,261 @@ libinput_source_dispatch(int fd, uint32_t mask, void *data)
 	return udev_input_dispatch(input) != 0;
 }
 
+/* Run the launcher call posted by the input thread, if any. Main thread
+ * only. */
+static void
+udev_input_run_launcher_call(struct udev_input *input)
+{
+	struct weston_launcher *launcher = input->compositor->launcher;
+	const char *path;
+	int flags, fd;
+
+	pthread_mutex_lock(&input->launcher_mutex);
+	if (!input->launcher_call.pending) {
+		pthread_mutex_unlock(&input->launcher_mutex);
+		return;
+	}
+	path = input->launcher_call.path;
+	flags = input->launcher_call.flags;
+	fd = input->launcher_call.fd;
+	input->launcher_call.pending = false;
+	pthread_mutex_unlock(&input->launcher_mutex);
+
+	if (path) {
+		fd = weston_launcher_open(launcher, path, flags);
+	} else {
+		weston_launcher_close(launcher, fd);
+		fd = 0;
+	}
+
+	pthread_mutex_lock(&input->launcher_mutex);
+	input->launcher_call.fd = fd;
+	input->launcher_call.done = true;
+	pthread_cond_broadcast(&input->launcher_cond);
+	pthread_mutex_unlock(&input->launcher_mutex);
+}
+
+/* Input thread: hand a launcher open (path set) or close to the main
+ * thread and wait for it. */
+static int
+input_thread_launcher_call(struct udev_input *input, const char *path,
+			   int flags, int fd)
+{
+	uint64_t one = 1;
+
+	pthread_mutex_lock(&input->launcher_mutex);
+	input->launcher_call.pending = true;
+	input->launcher_call.done = false;
+	input->launcher_call.path = path;
+	input->launcher_call.flags = flags;
+	input->launcher_call.fd = fd;
+	pthread_cond_broadcast(&input->launcher_cond);
+	pthread_mutex_unlock(&input->launcher_mutex);
+
+	/* Wakes the main loop if it is idle rather than waiting for
+	 * the lock. */
+	if (write(input->thread_wake_fd, &one, sizeof one) < 0 &&
+	    errno != EAGAIN)
+		weston_log("libinput: failed to wake the main loop: %s\n",
+			   strerror(errno));
+
+	pthread_mutex_lock(&input->launcher_mutex);
+	while (!input->launcher_call.done)
+		pthread_cond_wait(&input->launcher_cond,
+				  &input->launcher_mutex);
+	fd = input->launcher_call.fd;
+	pthread_mutex_unlock(&input->launcher_mutex);
+
+	return fd;
+}
+
+/** Take the libinput lock
+ *
+ * The input thread holds the lock while libinput dispatches, and device
+ * hotplug makes it wait there for the main thread to open or close the
+ * device through the launcher. So instead of blocking, the main thread
+ * runs those launcher calls until the lock is free.
+ */
+void
+udev_input_lock(struct udev_input *input)
+{
+	unsigned int serial;
+
+	if (!input->thread_running ||
+	    !pthread_equal(pthread_self(), input->main_thread)) {
+		pthread_mutex_lock(&input->lock);
+		return;
+	}
+
+	for (;;) {
+		pthread_mutex_lock(&input->launcher_mutex);
+		serial = input->unlock_serial;
+		pthread_mutex_unlock(&input->launcher_mutex);
+
+		if (pthread_mutex_trylock(&input->lock) == 0)
+			return;
+
+		pthread_mutex_lock(&input->launcher_mutex);
+		while (!input->launcher_call.pending &&
+		       input->unlock_serial == serial)
+			pthread_cond_wait(&input->launcher_cond,
+					  &input->launcher_mutex);
+		pthread_mutex_unlock(&input->launcher_mutex);
+
+		udev_input_run_launcher_call(input);
+	}
+}
+
+/* Input thread: drop the lock and let a waiting main thread retry. */
+static void
+input_thread_unlock(struct udev_input *input)
+{
+	pthread_mutex_unlock(&input->lock);
+
+	pthread_mutex_lock(&input->launcher_mutex);
+	input->unlock_serial++;
+	pthread_cond_broadcast(&input->launcher_cond);
+	pthread_mutex_unlock(&input->launcher_mutex);
+}
+
+/* Main loop side of the input thread: the events are already queued
+ * inside libinput, with their kernel timestamps, and only need to be
+ * delivered. */
+static int
+input_thread_wake_dispatch(int fd, uint32_t mask, void *data)
+{
+	struct udev_input *input = data;
+	uint64_t count;
+
+	if (read(fd, &count, sizeof count) < 0 && errno != EAGAIN)
+		weston_log("libinput: failed to read input thread wakeup: %s\n",
+			   strerror(errno));
+
+	udev_input_run_launcher_call(input);
+	process_events(input);
+	udev_input_schedule_coalesced(input);
+
+	return 0;
+}
+
+static void *
+input_thread_func(void *data)
+{
+	struct udev_input *input = data;
+	struct pollfd fds[2] = {
+		{ .fd = libinput_get_fd(input->libinput), .events = POLLIN },
+		{ .fd = input->thread_quit_fd, .events = POLLIN },
+	};
+	uint64_t one = 1;
+
+	for (;;) {
+		if (poll(fds, ARRAY_LENGTH(fds), -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+
+		if (fds[1].revents)
+			break;
+
+		if (!(fds[0].revents & POLLIN))
+			continue;
+
+		/* Reading the devices here also runs pointer acceleration
+		 * and touch calibration inside libinput. */
+		pthread_mutex_lock(&input->lock);
+		libinput_dispatch(input->libinput);
+		input_thread_unlock(input);
+
+		if (write(input->thread_wake_fd, &one, sizeof one) < 0 &&
+		    errno != EAGAIN)
+			break;
+	}
+
+	pthread_mutex_lock(&input->launcher_mutex);
+	input->thread_exited = true;
+	pthread_cond_broadcast(&input->launcher_cond);
+	pthread_mutex_unlock(&input->launcher_mutex);
+
+	return NULL;
+}
+
+static void
+udev_input_start_thread(struct udev_input *input)
+{
+	struct sched_param param = { .sched_priority = 1 };
+	sigset_t set, oldset;
+	int ret;
+
+	if (!input->use_thread || input->thread_running)
+		return;
+
+	input->thread_exited = false;
+
+	/* Signals are handled by the main loop only. */
+	sigfillset(&set);
+	pthread_sigmask(SIG_SETMASK, &set, &oldset);
+	ret = pthread_create(&input->thread, NULL, input_thread_func, input);
+	pthread_sigmask(SIG_SETMASK, &oldset, NULL);
+
+	if (ret != 0) {
+		weston_log("libinput: failed to start input thread: %s\n",
+			   strerror(ret));
+		return;
+	}
+	input->thread_running = true;
+
+	ret = pthread_setschedparam(input->thread, SCHED_FIFO, &param);
+	if (ret != 0)
+		weston_log("libinput: could not raise input thread "
+			   "priority: %s\n", strerror(ret));
+}
+
+static void
+udev_input_stop_thread(struct udev_input *input)
+{
+	uint64_t value = 1;
+	bool exited;
+
+	if (!input->thread_running)
+		return;
+
+	if (write(input->thread_quit_fd, &value, sizeof value) < 0)
+		weston_log("libinput: failed to stop input thread: %s\n",
+			   strerror(errno));
+
+	/* The thread may be waiting for a launcher call before it can
+	 * see the request to quit. */
+	for (;;) {
+		pthread_mutex_lock(&input->launcher_mutex);
+		while (!input->launcher_call.pending && !input->thread_exited)
+			pthread_cond_wait(&input->launcher_cond,
+					  &input->launcher_mutex);
+		exited = input->thread_exited;
+		pthread_mutex_unlock(&input->launcher_mutex);
+
+		if (exited)
+			break;
+		udev_input_run_launcher_call(input);
+	}
+	pthread_join(input->thread, NULL);
+	input->thread_running = false;
+
+	/* Reset the eventfd for the next start. */
+	if (read(input->thread_quit_fd, &value, sizeof value) < 0)
+		weston_log("libinput: failed to reset input thread: %s\n",
+			   strerror(errno));
+}
+
 static int
 open_restricted(const char *path, int flags, void *user_data)
 {
 	struct udev_input *input = user_data;
 	struct weston_launcher *launcher = input->compositor->launcher;
 
+	if (!pthread_equal(pthread_self(), input->main_thread))
+		return input_thread_launcher_call(input, path, flags, -1);
+
 	return weston_launcher_open(launcher, path, flags);
 }
 
@@ -264,6 +629,11 @@ close_restricted(int fd, void *user_data)
 	struct udev_input *input = user_data;
 	struct weston_launcher *launcher = input->compositor->launcher;
 
+	if (!pthread_equal(pthread_self(), input->main_thread)) {
+		input_thread_launcher_call(input, NULL, 0, fd);
+		return;
+	}
+
 	weston_launcher_close(launcher, fd);
 }
 
@@ -272,34 +642,13 @@ const struct libinput_interface libinput_interface = {
 	close_restricted,
 };
 
-int
-udev_input_enable(struct udev_input *input)
+static int
+udev_input_check_devices(struct udev_input *input)
 {
-	struct wl_event_loop *loop;
 	struct weston_compositor *c = input->compositor;
-	int fd;
 	struct udev_seat *seat;
 	int devices_found = 0;
 
-	loop = wl_display_get_event_loop(c->wl_display);
-	fd = libinput_get_fd(input->libinput);
-	input->libinput_source =
-		wl_event_loop_add_fd(loop, fd, WL_EVENT_READABLE,
-				     libinput_source_dispatch, input);
-	if (!input->libinput_source) {
-		return -1;
-	}
-
-	if (input->suspended) {
-		if (libinput_resume(input->libinput) != 0) {
-			wl_event_source_remove(input->libinput_source);
-			input->libinput_source = NULL;
-			return -1;
-		}
-		input->suspended = 0;
-		process_events(input);
-	}
-
 	wl_list_for_each(seat, &input->compositor->seat_list, base.link) {
 		evdev_notify_keyboard_focus(&seat->base, &seat->devices_list);
 
@@ -327,6 +676,151 @@ udev_input_enable(struct udev_input *input)
 	return 0;
 }
 
+/* libinput opens the devices of the seat one after the other; let the
+ * launcher start acquiring all of them at once. */
+static void
+udev_input_prefetch_devices(struct udev_input *input)
+{
+	struct weston_launcher *launcher = input->compositor->launcher;
+	struct udev_enumerate *e;
+	struct udev_list_entry *entry;
+	struct udev_device *device;
+	const char *devnode, *seat;
+
+	e = udev_enumerate_new(input->udev);
+	if (!e)
+		return;
+
+	udev_enumerate_add_match_subsystem(e, "input");
+	udev_enumerate_add_match_sysname(e, "event[0-9]*");
+	udev_enumerate_add_match_property(e, "ID_INPUT", "1");
+	udev_enumerate_scan_devices(e);
+
+	udev_list_entry_foreach(entry, udev_enumerate_get_list_entry(e)) {
+		device = udev_device_new_from_syspath(input->udev,
+						      udev_list_entry_get_name(entry));
+		if (!device)
+			continue;
+
+		seat = udev_device_get_property_value(device, "ID_SEAT");
+		devnode = udev_device_get_devnode(device);
+		if (devnode && strcmp(seat ? seat : "seat0", input->seat_id) == 0)
+			weston_launcher_prefetch(launcher, devnode);
+
+		udev_device_unref(device);
+	}
+
+	udev_enumerate_unref(e);
+}
+
+int
+udev_input_enable(struct udev_input *input)
+{
+	struct wl_event_loop *loop;
+	struct weston_compositor *c = input->compositor;
+	int fd;
+	int ret;
+
+	loop = weston_compositor_get_priority_loop(c, WESTON_EVENT_PRIORITY_INPUT);
+	if (input->use_thread) {
+		input->libinput_source =
+			wl_event_loop_add_fd(loop, input->thread_wake_fd,
+					     WL_EVENT_READABLE,
+					     input_thread_wake_dispatch, input);
+	} else {
+		fd = libinput_get_fd(input->libinput);
+		input->libinput_source =
+			wl_event_loop_add_fd(loop, fd, WL_EVENT_READABLE,
+					     libinput_source_dispatch, input);
+	}
+	if (!input->libinput_source) {
+		return -1;
+	}
+
+	if (input->suspended) {
+		if (!input->enumeration_deferred)
+			udev_input_prefetch_devices(input);
+		udev_input_lock(input);
+		ret = libinput_resume(input->libinput);
+		udev_input_unlock(input);
+		weston_launcher_prefetch_finish(c->launcher);
+		if (ret != 0) {
+			wl_event_source_remove(input->libinput_source);
+			input->libinput_source = NULL;
+			return -1;
+		}
+		input->suspended = 0;
+		process_events(input);
+	}
+
+	udev_input_start_thread(input);
+
+	/* The devices are not known yet, they are checked once the
+	 * deferred enumeration has run. */
+	if (input->enumeration_deferred) {
+		if (input->deferred_on_resume)
+			udev_input_enumerate_deferred(input);
+		return 0;
+	}
+
+	return udev_input_check_devices(input);
+}
+
+/** Assign the seat whose enumeration was deferred at init
+ *
+ * Opening and probing every input device, and compiling the keymap for
+ * the first keyboard, can take a while on boards with many devices. When
+ * [libinput] defer-enumeration is set this runs once the backend has
+ * shown its first frame instead of before the first repaint. Does nothing
+ * when no enumeration is pending, so backends may call it on every frame.
+ */
+void
+udev_input_enumerate_deferred(struct udev_input *input)
+{
+	struct weston_compositor *c = input->compositor;
+	int ret;
+
+	if (!input->enumeration_deferred)
+		return;
+
+	if (input->deferred_timer) {
+		wl_event_source_remove(input->deferred_timer);
+		input->deferred_timer = NULL;
+	}
+
+	/* Devices cannot be opened without the session, wait for it. */
+	if (input->suspended) {
+		input->deferred_on_resume = true;
+		return;
+	}
+
+	udev_input_prefetch_devices(input);
+	udev_input_lock(input);
+	ret = libinput_udev_assign_seat(input->libinput, input->seat_id);
+	if (ret == 0)
+		process_events(input);
+	udev_input_unlock(input);
+	weston_launcher_prefetch_finish(c->launcher);
+
+	input->enumeration_deferred = false;
+	input->deferred_on_resume = false;
+
+	if (ret != 0 || udev_input_check_devices(input) < 0) {
+		weston_log("fatal: failed to create input devices\n");
+		weston_compositor_exit_with_code(c, EXIT_FAILURE);
+	}
+}
+
+static int
+deferred_enumeration_timeout(void *data)
+{
+	struct udev_input *input = data;
+
+	udev_input_enumerate_deferred(input);
+
+	return 0;
+}
+
 static void
 libinput_log_func(struct libinput *libinput,
 		  enum libinput_log_priority priority,
@@ -342,17 +836,52 @@ udev_input_init(struct udev_input *input, struct weston_compositor *c,
 {
 	enum libinput_log_priority priority = LIBINPUT_LOG_PRIORITY_INFO;
 	const char *log_priority = NULL;
+	pthread_mutexattr_t attr;
+	int ret;
 
 	memset(input, 0, sizeof *input);
 
 	input->compositor = c;
 	input->configure_device = configure_device;
+	input->udev = udev;
+	input->thread_quit_fd = -1;
+	input->thread_wake_fd = -1;
+	input->main_thread = pthread_self();
+
+	input->seat_id = strdup(seat_id);
+	if (!input->seat_id)
+		return -1;
+
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(&input->lock, &attr);
+	pthread_mutexattr_destroy(&attr);
+	pthread_mutex_init(&input->launcher_mutex, NULL);
+	pthread_cond_init(&input->launcher_cond, NULL);
+
+	if (c->input_thread) {
+		input->thread_quit_fd = eventfd(0, EFD_CLOEXEC);
+		input->thread_wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+		if (input->thread_quit_fd >= 0 && input->thread_wake_fd >= 0) {
+			input->use_thread = true;
+		} else {
+			weston_log("libinput: failed to create eventfds, "
+				   "not using an input thread.\n");
+			if (input->thread_quit_fd >= 0)
+				close(input->thread_quit_fd);
+			if (input->thread_wake_fd >= 0)
+				close(input->thread_wake_fd);
+			input->thread_quit_fd = -1;
+			input->thread_wake_fd = -1;
+		}
+	}
 
 	log_priority = getenv("WESTON_LIBINPUT_LOG_PRIORITY");
 
 	input->libinput = libinput_udev_create_context(&libinput_interface,
 						       input, udev);
 	if (!input->libinput) {
+		free(input->seat_id);
 		return -1;
 	}
 
@@ -370,8 +899,25 @@ udev_input_init(struct udev_input *input, struct weston_compositor *c,
 
 	libinput_log_set_priority(input->libinput, priority);
 
-	if (libinput_udev_assign_seat(input->libinput, seat_id) != 0) {
+	if (c->input_deferred_enumeration) {
+		input->deferred_timer =
+			wl_event_loop_add_timer(wl_display_get_event_loop(c->wl_display),
+						deferred_enumeration_timeout,
+						input);
+		if (input->deferred_timer) {
+			wl_event_source_timer_update(input->deferred_timer,
+						     DEFERRED_ENUMERATION_TIMEOUT_MS);
+			input->enumeration_deferred = true;
+			return udev_input_enable(input);
+		}
+	}
+
+	udev_input_prefetch_devices(input);
+	ret = libinput_udev_assign_seat(input->libinput, seat_id);
+	weston_launcher_prefetch_finish(c->launcher);
+	if (ret != 0) {
 		libinput_unref(input->libinput);
+		free(input->seat_id);
 		return -1;
 	}
 
@@ -387,9 +933,22 @@ udev_input_destroy(struct udev_input *input)
 
 	if (input->libinput_source)
 		wl_event_source_remove(input->libinput_source);
+	if (input->coalesce_timer)
+		wl_event_source_remove(input->coalesce_timer);
+	if (input->deferred_timer)
+		wl_event_source_remove(input->deferred_timer);
+	free(input->seat_id);
+	udev_input_stop_thread(input);
 	wl_list_for_each_safe(seat, next, &input->compositor->seat_list, base.link)
 		udev_seat_destroy(seat);
 	libinput_unref(input->libinput);
+	if (input->thread_quit_fd >= 0)
+		close(input->thread_quit_fd);
+	if (input->thread_wake_fd >= 0)
+		close(input->thread_wake_fd);
+	pthread_mutex_destroy(&input->lock);
+	pthread_mutex_destroy(&input->launcher_mutex);
+	pthread_cond_destroy(&input->launcher_cond);
 }
 
 static void
@@ -398,8 +957,10 @@ udev_seat_led_update(struct weston_seat *seat_base, enum weston_led leds)
 	struct udev_seat *seat = (struct udev_seat *) seat_base;
 	struct evdev_device *device;
 
+	udev_input_lock(seat->input);
 	wl_list_for_each(device, &seat->devices_list, link)
 		evdev_led_update(device, leds);
+	udev_input_unlock(seat->input);
 }
 
 static void
@@ -408,6 +969,7 @@ udev_seat_output_changed(struct udev_seat *seat, struct weston_output *output)
 	struct evdev_device *device;
 	struct weston_output *found;
 
+	udev_input_lock(seat->input);
 	wl_list_for_each(device, &seat->devices_list, link) {
 		/* If we find any input device without an associated output
 		 * or an output name to associate with, just tie it with the
@@ -427,6 +989,7 @@ udev_seat_output_changed(struct udev_seat *seat, struct weston_output *output)
 						 device->output_name);
 		evdev_device_set_output(device, found);
 	}
+	udev_input_unlock(seat->input);
 }
 
 static void
@@ -461,6 +1024,7 @@ udev_seat_create(struct udev_input *input, const char *seat_name)
 
 	weston_seat_init(&seat->base, c, seat_name);
 	seat->base.led_update = udev_seat_led_update;
+	seat->input = input;
 
 	seat->output_create_listener.notify = notify_output_create;
 	wl_signal_add(&c->output_created_signal,
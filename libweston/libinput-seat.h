@@ -30,13 +30,17 @@
 #include "config.h"
 
 #include <libudev.h>
+#include <pthread.h>
 
 #include <libweston/libweston.h>
 
 struct libinput_device;
 
+struct udev_input;
+
 struct udev_seat {
 	struct weston_seat base;
+	struct udev_input *input;
 	struct wl_list devices_list;
 	struct wl_listener output_create_listener;
 	struct wl_listener output_heads_listener;
@@ -51,6 +55,43 @@ struct udev_input {
 	struct weston_compositor *compositor;
 	int suspended;
 	udev_configure_device_t configure_device;
+	struct wl_event_source *coalesce_timer;
+	bool coalesce_timer_armed;
+
+	/* libinput is not thread-safe, every call into it holds this lock
+	 * once the input thread may be running. Recursive, because event
+	 * processing can call back into libinput, e.g. for LED updates. */
+	pthread_mutex_t lock;
+	bool use_thread;
+	bool thread_running;
+	pthread_t thread;
+	int thread_quit_fd;
+	int thread_wake_fd;
+	bool thread_exited;
+
+	/* The launcher may only be used from the main thread. Devices
+	 * hotplugged while the input thread dispatches are opened and
+	 * closed there through launcher_call, see udev_input_lock(). */
+	pthread_t main_thread;
+	pthread_mutex_t launcher_mutex;
+	pthread_cond_t launcher_cond;
+	struct {
+		bool pending;
+		bool done;
+		const char *path; /* NULL for a close */
+		int flags;
+		int fd;
+	} launcher_call;
+	unsigned int unlock_serial;
+
+	struct udev *udev;
+	char *seat_id;
+
+	/* Deferred device enumeration: the seat is only assigned once the
+	 * backend reports its first frame, or after a timeout. */
+	bool enumeration_deferred;
+	struct wl_event_source *deferred_timer;
+	bool deferred_on_resume;
 };
 
 int
@@ -65,6 +106,17 @@ udev_input_init(struct udev_input *input,
 		udev_configure_device_t configure_device);
 void
 udev_input_destroy(struct udev_input *input);
+void
+udev_input_enumerate_deferred(struct udev_input *input);
+
+void
+udev_input_lock(struct udev_input *input);
+
+static inline void
+udev_input_unlock(struct udev_input *input)
+{
+	pthread_mutex_unlock(&input->lock);
+}
 
 struct udev_seat *
 udev_seat_get_named(struct udev_input *u,
@@ -66,6 +66,19 @@ weston_binding_list_destroy_all(struct wl_list *list);
 
 /* weston_compositor */
 
+/** Priority classes of event sources, see event-loop.c */
+enum weston_event_priority {
+	/** Page flips and commit completions, for the vblank deadline */
+	WESTON_EVENT_PRIORITY_FLIP = 0,
+	/** Input devices */
+	WESTON_EVENT_PRIORITY_INPUT,
+	WESTON_EVENT_PRIORITY_COUNT,
+};
+
+struct wl_event_loop *
+weston_compositor_get_priority_loop(struct weston_compositor *ec,
+				    enum weston_event_priority priority);
+
 void
 touch_calibrator_mode_changed(struct weston_compositor *compositor);
 
@@ -82,6 +95,11 @@ bool
 weston_compositor_import_dmabuf(struct weston_compositor *compositor,
 				struct linux_dmabuf_buffer *buffer);
 bool
+weston_compositor_import_dmabuf_async(struct weston_compositor *compositor,
+				      struct linux_dmabuf_buffer *buffer,
+				      weston_renderer_import_dmabuf_done_func_t done,
+				      void *data);
+bool
 weston_compositor_dmabuf_can_scanout(struct weston_compositor *compositor,
 					struct linux_dmabuf_buffer *buffer);
 void
@@ -90,6 +108,9 @@ weston_compositor_offscreen(struct weston_compositor *compositor);
 char *
 weston_compositor_print_scene_graph(struct weston_compositor *ec);
 
+void
+weston_compositor_schedule_flush(struct weston_compositor *compositor);
+
 void
 weston_compositor_read_presentation_clock(
 			const struct weston_compositor *compositor,
@@ -150,6 +171,12 @@ weston_compositor_shutdown(struct weston_compositor *ec);
 void
 weston_compositor_xkb_destroy(struct weston_compositor *ec);
 
+int
+weston_tearing_control_setup(struct weston_compositor *ec);
+
+int
+weston_content_type_setup(struct weston_compositor *ec);
+
 int
 weston_input_init(struct weston_compositor *compositor);
 
@@ -161,6 +188,10 @@ weston_output_disable_planes_incr(struct weston_output *output);
 void
 weston_output_disable_planes_decr(struct weston_output *output);
 
+void
+weston_output_repaint_time_gpu_done(struct weston_output *output,
+				    const struct timespec *gpu_end);
+
 /* weston_plane */
 
 void
@@ -209,6 +240,14 @@ weston_seat_release_touch(struct weston_seat *seat);
 void
 weston_seat_update_keymap(struct weston_seat *seat, struct xkb_keymap *keymap);
 
+struct xkb_keymap *
+weston_compositor_get_xkb_keymap(struct weston_compositor *ec,
+				 const struct xkb_rule_names *names);
+
+struct xkb_keymap *
+weston_compositor_get_xkb_keymap_from_string(struct weston_compositor *ec,
+					     const char *string);
+
 void
 wl_data_device_set_keyboard_focus(struct weston_seat *seat);
 
@@ -268,6 +307,14 @@ weston_surface_to_buffer_region(struct weston_surface *surface,
 void
 weston_surface_schedule_repaint(struct weston_surface *surface);
 
+/* weston_animation_timeline */
+
+void
+weston_output_init_view_timeline(struct weston_output *output);
+
+void
+weston_output_release_view_timeline(struct weston_output *output);
+
 /* weston_spring */
 
 void
@@ -328,13 +375,23 @@ weston_protected_surface_send_event(struct protected_surface *psurface,
 
 /* weston_drm_format */
 
+/* Open-addressing hash index over the entries of a wl_array, mapping a key
+ * to its position in the array. It is only built once a set grows large
+ * enough for hashing to beat a linear scan; slots is NULL until then. */
+struct weston_drm_index {
+	uint32_t *slots; /* position + 1, or 0 for an empty slot */
+	uint32_t mask; /* capacity - 1, capacity is a power of two */
+};
+
 struct weston_drm_format {
 	uint32_t format;
 	struct wl_array modifiers;
+	struct weston_drm_index modifier_index;
 };
 
 struct weston_drm_format_array {
 	struct wl_array arr;
+	struct weston_drm_index index;
 };
 
 void
@@ -418,6 +475,24 @@ struct weston_paint_node {
 	bool surf_xform_valid;
 
 	uint32_t try_view_on_plane_failure_reasons;
+
+	/* Set by the backend when the view sits on a plane below the
+	 * primary one: the renderer clears the view's area to transparent
+	 * instead of drawing it, so that the plane shows through. */
+	bool need_hole;
+
+	/* Set by the backend when the view sits on a plane above the
+	 * primary one which scans it out fully opaque, e.g. a video buffer
+	 * without alpha: its whole area then hides the primary plane even
+	 * without an opaque region from the client. */
+	bool plane_opaque;
+
+	/* Renderer data derived from the view geometry and the committed
+	 * surface state, kept across repaints. renderer_cache_dirty is set
+	 * whenever either changes; the renderer rebuilds its cache then. */
+	void *renderer_cache;
+	void (*renderer_cache_destroy)(void *cache);
+	bool renderer_cache_dirty;
 };
 
 struct weston_paint_node *
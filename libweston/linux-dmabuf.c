@@ -31,14 +31,150 @@
 #include <unistd.h>
 #include <string.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 
 #include <libweston/libweston.h>
 #include "linux-dmabuf.h"
+#include "shared/helpers.h"
 #include "shared/os-compatibility.h"
 #include "libweston-internal.h"
 #include "shared/weston-drm-fourcc.h"
 
+/* Tracks whether the client behind some dmabufs is still connected. The
+ * client holds a reference until it is destroyed, and so does every
+ * linux_dmabuf_buffer and import cache entry that refers to it. */
+struct linux_dmabuf_client {
+	struct wl_listener destroy_listener;
+	bool alive;
+	int refcount;
+};
+
+static void
+linux_dmabuf_client_destroyed(struct wl_listener *listener, void *data)
+{
+	struct linux_dmabuf_client *client =
+		container_of(listener, struct linux_dmabuf_client,
+			     destroy_listener);
+
+	client->alive = false;
+	linux_dmabuf_client_unref(client);
+}
+
+static struct linux_dmabuf_client *
+linux_dmabuf_client_get(struct wl_client *wl_client)
+{
+	struct linux_dmabuf_client *client;
+	struct wl_listener *listener;
+
+	listener = wl_client_get_destroy_listener(wl_client,
+						  linux_dmabuf_client_destroyed);
+	if (listener) {
+		client = container_of(listener, struct linux_dmabuf_client,
+				      destroy_listener);
+		return linux_dmabuf_client_ref(client);
+	}
+
+	client = zalloc(sizeof *client);
+	if (!client)
+		return NULL;
+
+	client->alive = true;
+	client->refcount = 2; /* one for the wl_client, one for the caller */
+	client->destroy_listener.notify = linux_dmabuf_client_destroyed;
+	wl_client_add_destroy_listener(wl_client, &client->destroy_listener);
+
+	return client;
+}
+
+/** Take a reference on the client of a linux_dmabuf_buffer
+ *
+ * \param client The client, see linux_dmabuf_buffer::client.
+ * \return The client.
+ */
+WL_EXPORT struct linux_dmabuf_client *
+linux_dmabuf_client_ref(struct linux_dmabuf_client *client)
+{
+	client->refcount++;
+
+	return client;
+}
+
+/** Drop a reference taken with linux_dmabuf_client_ref()
+ *
+ * \param client The client, may be NULL.
+ */
+WL_EXPORT void
+linux_dmabuf_client_unref(struct linux_dmabuf_client *client)
+{
+	if (!client)
+		return;
+
+	assert(client->refcount > 0);
+	if (--client->refcount > 0)
+		return;
+
+	free(client);
+}
+
+/** Check whether the client of a linux_dmabuf_buffer is still connected
+ *
+ * Buffers are destroyed after their client when it disconnects, so import
+ * caches must check this before keeping anything for a released buffer.
+ *
+ * \param client The client, may be NULL.
+ * \return True if the client is still connected.
+ */
+WL_EXPORT bool
+linux_dmabuf_client_is_alive(const struct linux_dmabuf_client *client)
+{
+	return client && client->alive;
+}
+
+/** Compare two dmabuf keys
+ *
+ * \param a One key.
+ * \param b The other key.
+ * \return True if both refer to the same memory with the same layout.
+ */
+WL_EXPORT bool
+dmabuf_key_equal(const struct dmabuf_key *a, const struct dmabuf_key *b)
+{
+	/* Keys are zero-initialised, padding and unused planes included. */
+	return memcmp(a, b, sizeof(*a)) == 0;
+}
+
+static void
+linux_dmabuf_buffer_init_key(struct linux_dmabuf_buffer *buffer)
+{
+	struct dmabuf_attributes *attributes = &buffer->attributes;
+	struct dmabuf_key *key = &buffer->key;
+	struct stat st;
+	int i;
+
+	memset(key, 0, sizeof(*key));
+	buffer->has_key = false;
+
+	key->width = attributes->width;
+	key->height = attributes->height;
+	key->format = attributes->format;
+	key->flags = attributes->flags;
+	key->n_planes = attributes->n_planes;
+
+	for (i = 0; i < attributes->n_planes; i++) {
+		if (fstat(attributes->fd[i], &st) < 0)
+			return;
+
+		key->dev[i] = st.st_dev;
+		key->ino[i] = st.st_ino;
+		key->offset[i] = attributes->offset[i];
+		key->stride[i] = attributes->stride[i];
+		key->modifier[i] = attributes->modifier[i];
+	}
+
+	buffer->has_key = true;
+}
+
 static void
 linux_dmabuf_buffer_destroy(struct linux_dmabuf_buffer *buffer)
 {
@@ -50,6 +186,7 @@ linux_dmabuf_buffer_destroy(struct linux_dmabuf_buffer *buffer)
 	}
 
 	buffer->attributes.n_planes = 0;
+	linux_dmabuf_client_unref(buffer->client);
 	free(buffer);
 }
 
@@ -152,6 +289,94 @@ destroy_linux_dmabuf_wl_buffer(struct wl_resource *resource)
 	linux_dmabuf_buffer_destroy(buffer);
 }
 
+/** A create request waiting for the renderer to finish the import */
+struct linux_dmabuf_pending_import {
+	struct linux_dmabuf_buffer *buffer;
+	/* NULL once the client destroyed the params object */
+	struct wl_resource *params_resource;
+	struct wl_listener params_destroy_listener;
+};
+
+static void
+pending_import_params_destroyed(struct wl_listener *listener, void *data)
+{
+	struct linux_dmabuf_pending_import *pending =
+		container_of(listener, struct linux_dmabuf_pending_import,
+			     params_destroy_listener);
+
+	wl_list_remove(&pending->params_destroy_listener.link);
+	pending->params_resource = NULL;
+}
+
+static void
+pending_import_done(struct linux_dmabuf_buffer *buffer, bool success,
+		    void *data)
+{
+	struct linux_dmabuf_pending_import *pending = data;
+	struct wl_resource *params_resource = pending->params_resource;
+
+	if (params_resource)
+		wl_list_remove(&pending->params_destroy_listener.link);
+	free(pending);
+
+	if (!success) {
+		if (params_resource)
+			zwp_linux_buffer_params_v1_send_failed(params_resource);
+		linux_dmabuf_buffer_destroy(buffer);
+		return;
+	}
+
+	if (params_resource)
+		buffer->buffer_resource =
+			wl_resource_create(wl_resource_get_client(params_resource),
+					   &wl_buffer_interface, 1, 0);
+
+	if (!buffer->buffer_resource) {
+		if (params_resource)
+			wl_resource_post_no_memory(params_resource);
+		if (buffer->user_data_destroy_func)
+			buffer->user_data_destroy_func(buffer);
+		linux_dmabuf_buffer_destroy(buffer);
+		return;
+	}
+
+	wl_resource_set_implementation(buffer->buffer_resource,
+				       &linux_dmabuf_buffer_implementation,
+				       buffer, destroy_linux_dmabuf_wl_buffer);
+	zwp_linux_buffer_params_v1_send_created(params_resource,
+						buffer->buffer_resource);
+}
+
+/* Only the create request can wait for the import: create_immed has
+ * to hand out a usable wl_buffer straight away. */
+static bool
+params_import_async(struct wl_resource *params_resource,
+		    struct linux_dmabuf_buffer *buffer)
+{
+	struct linux_dmabuf_pending_import *pending;
+
+	pending = zalloc(sizeof *pending);
+	if (!pending)
+		return false;
+
+	pending->buffer = buffer;
+	pending->params_resource = params_resource;
+	pending->params_destroy_listener.notify =
+		pending_import_params_destroyed;
+	wl_resource_add_destroy_listener(params_resource,
+					 &pending->params_destroy_listener);
+
+	if (!weston_compositor_import_dmabuf_async(buffer->compositor, buffer,
+						   pending_import_done,
+						   pending)) {
+		wl_list_remove(&pending->params_destroy_listener.link);
+		free(pending);
+		return false;
+	}
+
+	return true;
+}
+
 static void
 params_create_common(struct wl_client *client,
 		     struct wl_resource *params_resource,
@@ -263,6 +488,9 @@ params_create_common(struct wl_client *client,
 		}
 	}
 
+	linux_dmabuf_buffer_init_key(buffer);
+	buffer->client = linux_dmabuf_client_get(client);
+
 	if (buffer->direct_display) {
 		if (!weston_compositor_dmabuf_can_scanout(buffer->compositor,
 							  buffer))
@@ -271,6 +499,9 @@ params_create_common(struct wl_client *client,
 		goto avoid_gpu_import;
 	}
 
+	if (buffer_id == 0 && params_import_async(params_resource, buffer))
+		return;
+
 	if (!weston_compositor_import_dmabuf(buffer->compositor, buffer))
 		goto err_failed;
 
@@ -382,6 +613,8 @@ linux_dmabuf_create_params(struct wl_client *client,
 				   &zwp_linux_buffer_params_v1_interface,
 				   version, params_id);
 	buffer->direct_display = false;
+	buffer->yuv_encoding = LINUX_DMABUF_YUV_ENCODING_BT601;
+	buffer->yuv_range = LINUX_DMABUF_YUV_RANGE_LIMITED;
 	if (!buffer->params_resource)
 		goto err_dealloc;
 
@@ -429,22 +662,26 @@ weston_dmabuf_feedback_tranche_create(struct weston_dmabuf_feedback *dmabuf_feed
 	tranche->flags = flags;
 	tranche->preference = preference;
 
-	/* Get the formats indices array */
-	if (flags == 0) {
+	/* Get the formats indices array. Scanout formats are already limited
+	 * to those the renderer can import, which is also what a cross-device
+	 * tranche needs. */
+	if (flags == 0 && preference != CROSS_DEVICE_PREF) {
 		if (wl_array_copy(&tranche->formats_indices,
 				  &format_table->renderer_formats_indices) < 0) {
 			weston_log("%s: out of memory\n", __func__);
 			goto err;
 		}
-	} else if (flags & ZWP_LINUX_DMABUF_FEEDBACK_V1_TRANCHE_FLAGS_SCANOUT) {
+	} else if (flags & ZWP_LINUX_DMABUF_FEEDBACK_V1_TRANCHE_FLAGS_SCANOUT ||
+		   preference == CROSS_DEVICE_PREF) {
 		if (wl_array_copy(&tranche->formats_indices,
 				  &format_table->scanout_formats_indices) < 0) {
 			weston_log("%s: out of memory\n", __func__);
 			goto err;
 		}
 	} else {
-		weston_log("error: for now we just have renderer and scanout "
-			   "tranches, can't create other type of tranche\n");
+		weston_log("error: for now we just have renderer, cross-device "
+			   "and scanout tranches, can't create other type of "
+			   "tranche\n");
 		goto err;
 	}
 
@@ -457,6 +694,7 @@ weston_dmabuf_feedback_tranche_create(struct weston_dmabuf_feedback *dmabuf_feed
 			break;
 	}
 	wl_list_insert(pos->prev, &tranche->link);
+	dmabuf_feedback->serial++;
 
 	return tranche;
 
@@ -583,7 +821,8 @@ format_table_get_format_index(struct weston_dmabuf_feedback_format_table *format
 			      uint32_t format, uint64_t modifier, uint16_t *index_out)
 {
 	uint16_t index;
-	unsigned int num_elements = format_table->size / sizeof(index);
+	unsigned int num_elements = format_table->size /
+				    sizeof(*format_table->data);
 
 	for (index = 0; index < num_elements; index++) {
 		if (format_table->data[index].format == format &&
@@ -645,6 +884,100 @@ err:
 	return -1;
 }
 
+/** Replace the formats advertised by a dma-buf feedback tranche
+ *
+ * Used to narrow a tranche down to what would actually work for a given
+ * surface, e.g. the formats of the planes of the output it is on instead of
+ * those of every plane. Pairs missing from the format table are skipped, as
+ * the table holds every pair a client may ever be offered.
+ *
+ * @param dmabuf_feedback The dma-buf feedback object owning the tranche
+ * @param tranche The tranche to update
+ * @param format_table The dma-buf feedback format table
+ * @param formats The new formats of the tranche
+ * @return 0 on success, -1 on failure, leaving the tranche unchanged
+ */
+WL_EXPORT int
+weston_dmabuf_feedback_tranche_set_formats(struct weston_dmabuf_feedback *dmabuf_feedback,
+					   struct weston_dmabuf_feedback_tranche *tranche,
+					   struct weston_dmabuf_feedback_format_table *format_table,
+					   const struct weston_drm_format_array *formats)
+{
+	struct weston_drm_format *fmt;
+	struct wl_array indices;
+	unsigned int num_modifiers;
+	const uint64_t *modifiers;
+	uint16_t index, *index_ptr;
+	unsigned int i;
+
+	wl_array_init(&indices);
+
+	wl_array_for_each(fmt, &formats->arr) {
+		modifiers = weston_drm_format_get_modifiers(fmt, &num_modifiers);
+		for (i = 0; i < num_modifiers; i++) {
+			if (format_table_get_format_index(format_table, fmt->format,
+							  modifiers[i], &index) < 0)
+				continue;
+
+			index_ptr = wl_array_add(&indices, sizeof(index));
+			if (!index_ptr) {
+				wl_array_release(&indices);
+				return -1;
+			}
+			*index_ptr = index;
+		}
+	}
+
+	if (indices.size == tranche->formats_indices.size &&
+	    memcmp(indices.data, tranche->formats_indices.data,
+		   indices.size) == 0) {
+		wl_array_release(&indices);
+		return 0;
+	}
+
+	wl_array_release(&tranche->formats_indices);
+	tranche->formats_indices = indices;
+	dmabuf_feedback->serial++;
+
+	return 0;
+}
+
+/** Set whether a dma-buf feedback tranche is advertised
+ *
+ * @param dmabuf_feedback The dma-buf feedback object owning the tranche
+ * @param tranche The tranche to update
+ * @param active Whether clients should be sent the tranche
+ */
+WL_EXPORT void
+weston_dmabuf_feedback_tranche_set_active(struct weston_dmabuf_feedback *dmabuf_feedback,
+					  struct weston_dmabuf_feedback_tranche *tranche,
+					  bool active)
+{
+	if (tranche->active == active)
+		return;
+
+	tranche->active = active;
+	dmabuf_feedback->serial++;
+}
+
+/** Record one repaint's placement outcome for a surface
+ *
+ * @param dmabuf_feedback The surface dma-buf feedback
+ * @param reasons Backend-specific reasons why placement failed, or 0
+ */
+WL_EXPORT void
+weston_dmabuf_feedback_record_placement(struct weston_dmabuf_feedback *dmabuf_feedback,
+					uint32_t reasons)
+{
+	dmabuf_feedback->placement_window[dmabuf_feedback->placement_window_pos] =
+		reasons;
+	dmabuf_feedback->placement_window_pos =
+		(dmabuf_feedback->placement_window_pos + 1) %
+		WESTON_DMABUF_FEEDBACK_WINDOW;
+	if (dmabuf_feedback->placement_window_len < WESTON_DMABUF_FEEDBACK_WINDOW)
+		dmabuf_feedback->placement_window_len++;
+}
+
 /** Creates dma-buf feedback object
  *
  * @param main_device The main device of the dma-buf feedback
@@ -719,18 +1052,15 @@ weston_dmabuf_feedback_send(struct weston_dmabuf_feedback *dmabuf_feedback,
 {
 	struct weston_dmabuf_feedback_tranche *tranche;
 	struct wl_array device;
-	dev_t *dev;
 
 	/* main_device and target_device events need a dev_t as parameter,
 	 * but we can't use this directly to communicate with the Wayland
 	 * client. The solution is to use a wl_array, which is supported by
-	 * Wayland, and add the dev_t as an element of the array. */
-	wl_array_init(&device);
-	dev = wl_array_add(&device, sizeof(*dev));
-	if (!dev) {
-		wl_resource_post_no_memory(res);
-		return;
-	}
+	 * Wayland, with the dev_t as its only element. The array only borrows
+	 * the dev_t being sent, so no allocation happens here and everything
+	 * the events carry is what the feedback already holds. */
+	device.size = sizeof(dev_t);
+	device.alloc = 0;
 
 	/* format_table event - In Weston, we never modify the dma-buf feedback
 	 * format table. So we have this flag in order to advertise the format
@@ -742,7 +1072,7 @@ weston_dmabuf_feedback_send(struct weston_dmabuf_feedback *dmabuf_feedback,
 							       format_table->size);
 
 	/* main_device event */
-	*dev = dmabuf_feedback->main_device;
+	device.data = &dmabuf_feedback->main_device;
 	zwp_linux_dmabuf_feedback_v1_send_main_device(res, &device);
 
 	/* send events for each tranche */
@@ -751,7 +1081,7 @@ weston_dmabuf_feedback_send(struct weston_dmabuf_feedback *dmabuf_feedback,
 			continue;
 
 		/* tranche_target_device event */
-		*dev = tranche->target_device;
+		device.data = &tranche->target_device;
 		zwp_linux_dmabuf_feedback_v1_send_tranche_target_device(res, &device);
 
 		/* tranche_flags event */
@@ -766,8 +1096,6 @@ weston_dmabuf_feedback_send(struct weston_dmabuf_feedback *dmabuf_feedback,
 
 	/* compositor_done_event */
 	zwp_linux_dmabuf_feedback_v1_send_done(res);
-
-	wl_array_release(&device);
 }
 
 /** Sends the feedback events for a dma-buf feedback object
@@ -775,7 +1103,8 @@ weston_dmabuf_feedback_send(struct weston_dmabuf_feedback *dmabuf_feedback,
  * Given a dma-buf feedback object, this will send events to clients that are
  * subscribed to it. This is useful for the per-surface dma-buf feedback, which
  * is dynamic and can change throughout compositor's life. These changes results
- * in the need to resend the feedback events to clients.
+ * in the need to resend the feedback events to clients. Nothing is sent if
+ * the feedback did not change since the last time it was sent.
  *
  * @param dmabuf_feedback The weston_dmabuf_feedback object
  * @param format_table The dma-buf feedback formats table
@@ -786,9 +1115,14 @@ weston_dmabuf_feedback_send_all(struct weston_dmabuf_feedback *dmabuf_feedback,
 {
 	struct wl_resource *res;
 
+	if (dmabuf_feedback->sent_serial == dmabuf_feedback->serial)
+		return;
+
 	wl_resource_for_each(res, &dmabuf_feedback->resource_list)
 		weston_dmabuf_feedback_send(dmabuf_feedback,
 					    format_table, res, false);
+
+	dmabuf_feedback->sent_serial = dmabuf_feedback->serial;
 }
 
 static void
@@ -853,6 +1187,44 @@ linux_dmabuf_get_default_feedback(struct wl_client *client,
 				    dmabuf_feedback_resource, true);
 }
 
+/* Surface dma-buf feedback starts as a copy of the default one, and is only
+ * created once a client asks for it: most surfaces never do, and this keeps
+ * wl_surface creation cheap and spares the backend from tracking placement
+ * for surfaces nobody listens to. */
+static struct weston_dmabuf_feedback *
+surface_dmabuf_feedback_create(struct weston_compositor *ec)
+{
+	struct weston_dmabuf_feedback *default_feedback =
+		ec->default_dmabuf_feedback;
+	struct weston_dmabuf_feedback *dmabuf_feedback;
+	struct weston_dmabuf_feedback_tranche *tranche, *src;
+
+	dmabuf_feedback =
+		weston_dmabuf_feedback_create(default_feedback->main_device);
+	if (!dmabuf_feedback)
+		return NULL;
+
+	/* Start from the default tranches: the renderer's, plus the
+	 * cross-device one when rendering is offloaded. The backend adds
+	 * scanout tranches later, as the scene demands. */
+	wl_list_for_each_reverse(src, &default_feedback->tranche_list, link) {
+		tranche = weston_dmabuf_feedback_tranche_create(dmabuf_feedback,
+								ec->dmabuf_feedback_format_table,
+								src->target_device,
+								src->flags,
+								src->preference);
+		if (!tranche) {
+			weston_dmabuf_feedback_destroy(dmabuf_feedback);
+			return NULL;
+		}
+	}
+
+	/* Nobody has been sent anything yet, so nobody is out of date. */
+	dmabuf_feedback->sent_serial = dmabuf_feedback->serial;
+
+	return dmabuf_feedback;
+}
+
 static void
 linux_dmabuf_get_per_surface_feedback(struct wl_client *client,
 				      struct wl_resource *dmabuf_resource,
@@ -863,6 +1235,15 @@ linux_dmabuf_get_per_surface_feedback(struct wl_client *client,
 		wl_resource_get_user_data(surface_resource);
 	struct wl_resource *dmabuf_feedback_resource;
 
+	if (!surface->dmabuf_feedback) {
+		surface->dmabuf_feedback =
+			surface_dmabuf_feedback_create(surface->compositor);
+		if (!surface->dmabuf_feedback) {
+			wl_resource_post_no_memory(dmabuf_resource);
+			return;
+		}
+	}
+
 	dmabuf_feedback_resource =
 		dmabuf_feedback_resource_create(dmabuf_resource,
 						client, dmabuf_feedback_id);
@@ -27,14 +27,29 @@
 #define WESTON_LINUX_DMABUF_H
 
 #include <stdint.h>
+#include <sys/types.h>
 #include "linux-dmabuf-unstable-v1-server-protocol.h"
 
 #define MAX_DMABUF_PLANES 4
 
 struct linux_dmabuf_buffer;
+struct linux_dmabuf_client;
 typedef void (*dmabuf_user_data_destroy_func)(
 			struct linux_dmabuf_buffer *buffer);
 
+/** YUV to RGB conversion matrix of a dmabuf */
+enum linux_dmabuf_yuv_encoding {
+	LINUX_DMABUF_YUV_ENCODING_BT601 = 0,
+	LINUX_DMABUF_YUV_ENCODING_BT709,
+	LINUX_DMABUF_YUV_ENCODING_BT2020,
+};
+
+/** Quantisation range of the YUV samples of a dmabuf */
+enum linux_dmabuf_yuv_range {
+	LINUX_DMABUF_YUV_RANGE_LIMITED = 0,
+	LINUX_DMABUF_YUV_RANGE_FULL,
+};
+
 struct dmabuf_attributes {
 	int32_t width;
 	int32_t height;
@@ -47,6 +62,27 @@ struct dmabuf_attributes {
 	uint64_t modifier[MAX_DMABUF_PLANES];
 };
 
+/** Identity of the memory a dmabuf refers to
+ *
+ * Two wl_buffers with equal keys wrap the very same dma-buf objects with the
+ * same layout, e.g. a client re-creating a wl_buffer for fds it already
+ * used, so whatever was imported for one is valid for the other. The inode
+ * of a dma-buf is unique for as long as the dma-buf exists, which holding an
+ * import guarantees. Compare with dmabuf_key_equal().
+ */
+struct dmabuf_key {
+	int32_t width;
+	int32_t height;
+	uint32_t format;
+	uint32_t flags;
+	int n_planes;
+	dev_t dev[MAX_DMABUF_PLANES];
+	ino_t ino[MAX_DMABUF_PLANES];
+	uint32_t offset[MAX_DMABUF_PLANES];
+	uint32_t stride[MAX_DMABUF_PLANES];
+	uint64_t modifier[MAX_DMABUF_PLANES];
+};
+
 struct linux_dmabuf_buffer {
 	struct wl_resource *buffer_resource;
 	struct wl_resource *params_resource;
@@ -73,11 +109,29 @@ struct linux_dmabuf_buffer {
 
 	/**< marked as scan-out capable, avoids any composition */
 	bool direct_display;
+
+	/**< colorimetry of YUV content, ignored for RGB formats; the
+	 * defaults match what the GL renderer's YUV shaders assume */
+	enum linux_dmabuf_yuv_encoding yuv_encoding;
+	enum linux_dmabuf_yuv_range yuv_range;
+
+	/**< identity of the underlying memory, for import caches; only
+	 * valid if has_key is set */
+	struct dmabuf_key key;
+	bool has_key;
+
+	/**< the client that created the buffer, which import caches use
+	 * to drop what they kept for it once it disconnects */
+	struct linux_dmabuf_client *client;
 };
 
+#define WESTON_DMABUF_FEEDBACK_WINDOW 16
+
 enum weston_dmabuf_feedback_tranche_preference {
 	RENDERER_PREF = 0,
-	SCANOUT_PREF = 1
+	/* Formats the renderer and a separate KMS device can both import */
+	CROSS_DEVICE_PREF = 1,
+	SCANOUT_PREF = 2
 };
 
 struct weston_dmabuf_feedback_format_table {
@@ -118,12 +172,31 @@ struct weston_dmabuf_feedback {
 	/* weston_dmabuf_feedback_tranche::link */
 	struct wl_list tranche_list;
 
-	/* We use this timer to know if the scene has stabilized and that would
-	 * be useful to resend dma-buf feedback events to clients. Consider the
-	 * timer off when action_needed == ACTION_NEEDED_NONE. See enum
-	 * actions_needed_dmabuf_feedback. */
+	/* When the feedback was last resent, so that backends can rate-limit
+	 * how often clients are asked to reallocate. */
 	struct timespec timer;
+	/* The action the placement window last voted for. See enum
+	 * actions_needed_dmabuf_feedback. */
 	uint32_t action_needed;
+
+	/* Moving window of backend-specific reasons why the surface's views
+	 * failed to get a plane, one entry per repaint. Cleared whenever the
+	 * feedback is resent, so every decision is based on what happened
+	 * after the client last had a chance to react. */
+	uint32_t placement_window[WESTON_DMABUF_FEEDBACK_WINDOW];
+	unsigned int placement_window_len;
+	unsigned int placement_window_pos;
+
+	/* Backend-specific set of planes the scanout tranche was narrowed
+	 * to, to notice when it has to be rebuilt. */
+	uint32_t scanout_plane_mask;
+
+	/* Bumped whenever what the feedback advertises changes, and the value
+	 * it had when the subscribed clients were last brought up to date.
+	 * Lets weston_dmabuf_feedback_send_all() skip resends that would not
+	 * tell clients anything new. */
+	uint32_t serial;
+	uint32_t sent_serial;
 };
 
 struct weston_dmabuf_feedback_tranche {
@@ -165,6 +238,18 @@ void
 linux_dmabuf_buffer_send_server_error(struct linux_dmabuf_buffer *buffer,
 				      const char *msg);
 
+bool
+dmabuf_key_equal(const struct dmabuf_key *a, const struct dmabuf_key *b);
+
+struct linux_dmabuf_client *
+linux_dmabuf_client_ref(struct linux_dmabuf_client *client);
+
+void
+linux_dmabuf_client_unref(struct linux_dmabuf_client *client);
+
+bool
+linux_dmabuf_client_is_alive(const struct linux_dmabuf_client *client);
+
 struct weston_dmabuf_feedback *
 weston_dmabuf_feedback_create(dev_t main_device);
 
@@ -190,6 +275,21 @@ int
 weston_dmabuf_feedback_format_table_set_scanout_indices(struct weston_dmabuf_feedback_format_table *format_table,
 							const struct weston_drm_format_array *scanout_formats);
 
+int
+weston_dmabuf_feedback_tranche_set_formats(struct weston_dmabuf_feedback *dmabuf_feedback,
+					   struct weston_dmabuf_feedback_tranche *tranche,
+					   struct weston_dmabuf_feedback_format_table *format_table,
+					   const struct weston_drm_format_array *formats);
+
+void
+weston_dmabuf_feedback_tranche_set_active(struct weston_dmabuf_feedback *dmabuf_feedback,
+					  struct weston_dmabuf_feedback_tranche *tranche,
+					  bool active);
+
+void
+weston_dmabuf_feedback_record_placement(struct weston_dmabuf_feedback *dmabuf_feedback,
+					uint32_t reasons);
+
 struct weston_dmabuf_feedback_tranche *
 weston_dmabuf_feedback_tranche_create(struct weston_dmabuf_feedback *dmabuf_feedback,
 				      struct weston_dmabuf_feedback_format_table *format_table,
@@ -29,6 +29,7 @@
 #include <errno.h>
 #include <poll.h>
 #include <stddef.h>
+#include <string.h>
 #include <sys/ioctl.h>
 #include <wayland-server-core.h>
 
@@ -81,3 +82,27 @@ weston_linux_sync_file_read_timestamp(int fd, struct timespec *ts)
 
 	return 0;
 }
+
+/* Merge two sync files into a new one
+ *
+ * The new sync file signals once both fences have signalled. Fences from the
+ * same timeline are collapsed into the later one, so repeatedly merging
+ * fences of a single device does not grow the result.
+ *
+ * \param fd1[in] a file descriptor for a sync file
+ * \param fd2[in] a file descriptor for another sync file
+ * \return the file descriptor of the new sync file, or -1 on error
+ */
+WL_EXPORT int
+weston_linux_sync_file_merge(int fd1, int fd2)
+{
+	struct sync_merge_data data = { { 0 } };
+
+	strncpy(data.name, "weston", sizeof(data.name) - 1);
+	data.fd2 = fd2;
+
+	if (ioctl(fd1, SYNC_IOC_MERGE, &data) < 0)
+		return -1;
+
+	return data.fence;
+}
@@ -0,0 +1,227 @@
+/*
+ * Copyright © 2022 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+
+#include <libweston/libweston.h>
+#include <libweston/zalloc.h>
+#include "backend.h"
+#include "libweston-internal.h"
+#include "memory-pressure.h"
+#include "object-pool.h"
+#include "shared/fd-util.h"
+#include "shared/timespec-util.h"
+
+/*
+ * Memory pressure from the kernel's pressure stall information. A PSI
+ * trigger on /proc/pressure/memory signals POLLPRI once tasks have been
+ * stalled on memory for longer than the threshold within a one second
+ * window. The trigger fd always polls readable, so it waits for EPOLLPRI
+ * in an epoll set of its own, which in turn is readable for the
+ * wl_event_loop.
+ *
+ * Trimming drops caches that are refilled on demand, so it is worth
+ * doing before the OOM killer picks the compositor, but not on every
+ * window of a longer stall.
+ */
+
+#define PSI_WINDOW_USEC 1000000
+#define MEMORY_TRIM_INTERVAL_MSEC 10000
+
+struct weston_memory_pressure {
+	struct weston_compositor *compositor;
+	int psi_fd;
+	int epoll_fd;
+	struct wl_event_source *source;
+	struct timespec last_trim;
+	bool trimmed;
+};
+
+static void
+memory_pressure_destroy(struct weston_memory_pressure *mp)
+{
+	if (mp->source)
+		wl_event_source_remove(mp->source);
+	fd_clear(&mp->epoll_fd);
+	fd_clear(&mp->psi_fd);
+	free(mp);
+}
+
+static int
+memory_pressure_handler(int fd, uint32_t mask, void *data)
+{
+	struct weston_memory_pressure *mp = data;
+	struct weston_compositor *ec = mp->compositor;
+	struct epoll_event ev;
+	struct timespec now;
+
+	/* Polling the trigger consumes the event. */
+	if (epoll_wait(mp->epoll_fd, &ev, 1, 0) <= 0)
+		return 0;
+
+	if (ev.events & EPOLLERR) {
+		weston_log("Memory pressure: PSI trigger failed, no longer "
+			   "monitored.\n");
+		ec->memory_pressure = NULL;
+		memory_pressure_destroy(mp);
+		return 0;
+	}
+
+	weston_compositor_read_presentation_clock(ec, &now);
+	if (mp->trimmed &&
+	    timespec_sub_to_msec(&now, &mp->last_trim) <
+	    MEMORY_TRIM_INTERVAL_MSEC)
+		return 0;
+
+	mp->last_trim = now;
+	mp->trimmed = true;
+	weston_compositor_trim_memory(ec);
+
+	return 0;
+}
+
+/** Trim caches whenever the system runs short of memory
+ *
+ * \param ec The compositor.
+ * \param stall_msec How long tasks may be stalled on memory within one
+ * second before weston_compositor_trim_memory() runs, 1 to 999.
+ * \return 0 on success, -1 if the kernel does not report memory pressure.
+ */
+WL_EXPORT int
+weston_compositor_enable_memory_pressure(struct weston_compositor *ec,
+					 uint32_t stall_msec)
+{
+	struct weston_memory_pressure *mp;
+	struct epoll_event ev = { .events = EPOLLPRI };
+	struct wl_event_loop *loop;
+	char trigger[64];
+	int len;
+
+	if (ec->memory_pressure)
+		return 0;
+
+	if (stall_msec == 0 || stall_msec * 1000 >= PSI_WINDOW_USEC) {
+		weston_log("Memory pressure: invalid stall threshold %u ms.\n",
+			   stall_msec);
+		return -1;
+	}
+
+	mp = zalloc(sizeof *mp);
+	if (!mp)
+		return -1;
+
+	mp->compositor = ec;
+	mp->epoll_fd = -1;
+
+	mp->psi_fd = open("/proc/pressure/memory",
+			  O_RDWR | O_NONBLOCK | O_CLOEXEC);
+	if (mp->psi_fd < 0) {
+		weston_log("Memory pressure: cannot open "
+			   "/proc/pressure/memory: %s\n", strerror(errno));
+		goto fail;
+	}
+
+	/* The kernel wants the terminating NUL as well. */
+	len = snprintf(trigger, sizeof trigger, "some %u %u",
+		       stall_msec * 1000, PSI_WINDOW_USEC);
+	if (write(mp->psi_fd, trigger, len + 1) < 0) {
+		weston_log("Memory pressure: cannot set PSI trigger: %s\n",
+			   strerror(errno));
+		goto fail;
+	}
+
+	mp->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (mp->epoll_fd < 0 ||
+	    epoll_ctl(mp->epoll_fd, EPOLL_CTL_ADD, mp->psi_fd, &ev) < 0) {
+		weston_log("Memory pressure: epoll failed: %s\n",
+			   strerror(errno));
+		goto fail;
+	}
+
+	loop = wl_display_get_event_loop(ec->wl_display);
+	mp->source = wl_event_loop_add_fd(loop, mp->epoll_fd,
+					  WL_EVENT_READABLE,
+					  memory_pressure_handler, mp);
+	if (!mp->source)
+		goto fail;
+
+	ec->memory_pressure = mp;
+
+	return 0;
+
+fail:
+	memory_pressure_destroy(mp);
+	return -1;
+}
+
+void
+weston_compositor_memory_pressure_fini(struct weston_compositor *ec)
+{
+	if (!ec->memory_pressure)
+		return;
+
+	memory_pressure_destroy(ec->memory_pressure);
+	ec->memory_pressure = NULL;
+}
+
+/** Release caches the compositor can do without
+ *
+ * Asks the renderer and the backend to drop what they can recreate on
+ * demand, empties the object pools, then emits memory_pressure_signal for
+ * the frontend and plugins before logging the total. Runs on memory
+ * pressure, see weston_compositor_enable_memory_pressure(), and may be
+ * called at any other time outside of a repaint.
+ */
+WL_EXPORT void
+weston_compositor_trim_memory(struct weston_compositor *ec)
+{
+	struct weston_memory_trim trim = { 0 };
+
+	if (ec->renderer && ec->renderer->trim_memory)
+		ec->renderer->trim_memory(ec, &trim);
+	if (ec->backend && ec->backend->trim_memory)
+		ec->backend->trim_memory(ec, &trim);
+
+	trim.heap_bytes += weston_object_pool_trim(ec->surface_pool);
+	trim.heap_bytes += weston_object_pool_trim(ec->view_pool);
+	trim.heap_bytes += weston_object_pool_trim(ec->paint_node_pool);
+	trim.heap_bytes += weston_object_pool_trim(ec->buffer_pool);
+
+	wl_signal_emit(&ec->memory_pressure_signal, &trim);
+
+	weston_log("Memory pressure: released %zu KiB of textures, %zu KiB "
+		   "of heap, %u shader programs, %u dmabuf imports and %u "
+		   "mode blobs and EDIDs.\n",
+		   trim.texture_bytes >> 10, trim.heap_bytes >> 10,
+		   trim.programs, trim.dmabuf_imports, trim.kms_objects);
+}
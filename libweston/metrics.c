@@ -0,0 +1,261 @@
+/*
+ * Copyright © 2022 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <wayland-server.h>
+
+#include <libweston/libweston.h>
+#include "frame-arena.h"
+#include "frame-stats.h"
+#include "libweston-internal.h"
+#include "shared/helpers.h"
+
+/**
+ * The counters behind the 'frame-stats' scope, and whatever backends and
+ * renderers add through metrics_signal, in the OpenMetrics text format.
+ * Nothing here runs unless a scraper asks: the counters are updated as
+ * part of the normal repaint and commit bookkeeping either way.
+ */
+struct weston_metrics {
+	FILE *fp;
+};
+
+static void
+metrics_write_label_value(FILE *fp, const char *value)
+{
+	for (; *value; value++) {
+		switch (*value) {
+		case '\\':
+			fputs("\\\\", fp);
+			break;
+		case '"':
+			fputs("\\\"", fp);
+			break;
+		case '\n':
+			fputs("\\n", fp);
+			break;
+		default:
+			fputc(*value, fp);
+		}
+	}
+}
+
+/* The label pairs end with a NULL key, le is the histogram bucket. */
+static void
+metrics_write_labels(FILE *fp, va_list labels, const char *le)
+{
+	const char *key, *value;
+	bool first = true;
+
+	while ((key = va_arg(labels, const char *))) {
+		value = va_arg(labels, const char *);
+		fprintf(fp, "%s%s=\"", first ? "{" : ",", key);
+		metrics_write_label_value(fp, value);
+		fputc('"', fp);
+		first = false;
+	}
+
+	if (le) {
+		fprintf(fp, "%sle=\"%s\"", first ? "{" : ",", le);
+		first = false;
+	}
+
+	if (!first)
+		fputc('}', fp);
+}
+
+/** Start a metric family
+ *
+ * \param m The exposition being written.
+ * \param name Family name, e.g. "weston_output_frames".
+ * \param type "counter", "gauge" or "histogram".
+ * \param unit The unit suffix of the name, or NULL.
+ * \param help One line describing the family.
+ *
+ * All samples of the family must follow before the next family starts.
+ */
+WL_EXPORT void
+weston_metrics_family(struct weston_metrics *m, const char *name,
+		      const char *type, const char *unit, const char *help)
+{
+	fprintf(m->fp, "# TYPE %s %s\n", name, type);
+	if (unit)
+		fprintf(m->fp, "# UNIT %s %s\n", name, unit);
+	fprintf(m->fp, "# HELP %s %s\n", name, help);
+}
+
+/** Write one sample
+ *
+ * \param m The exposition being written.
+ * \param name Sample name: the family name, with "_total" for counters.
+ * \param value The value.
+ * \param ... Label name and value string pairs, terminated by NULL.
+ */
+WL_EXPORT void
+weston_metrics_sample(struct weston_metrics *m, const char *name,
+		      double value, ...)
+{
+	va_list labels;
+
+	fputs(name, m->fp);
+	va_start(labels, value);
+	metrics_write_labels(m->fp, labels, NULL);
+	va_end(labels);
+	fprintf(m->fp, " %.17g\n", value);
+}
+
+static void
+metrics_histogram_sample(struct weston_metrics *m, const char *name,
+			 const char *suffix, const char *le, double value,
+			 va_list labels)
+{
+	va_list copy;
+
+	va_copy(copy, labels);
+	fprintf(m->fp, "%s%s", name, suffix);
+	metrics_write_labels(m->fp, copy, le);
+	fprintf(m->fp, " %.17g\n", value);
+	va_end(copy);
+}
+
+/** Write the samples of a histogram of durations, in seconds
+ *
+ * \param m The exposition being written.
+ * \param name The family name, started with type "histogram".
+ * \param hist The histogram.
+ * \param ... Label name and value string pairs, terminated by NULL.
+ */
+WL_EXPORT void
+weston_metrics_histogram(struct weston_metrics *m, const char *name,
+			 const struct weston_frame_histogram *hist, ...)
+{
+	va_list labels;
+	uint64_t seen = 0;
+	unsigned int i;
+	char le[32];
+
+	va_start(labels, hist);
+	for (i = 0; i < WESTON_FRAME_HISTOGRAM_BUCKETS - 1; i++) {
+		seen += hist->buckets[i];
+		snprintf(le, sizeof le, "%g", (2u << i) / 1e6);
+		metrics_histogram_sample(m, name, "_bucket", le, seen, labels);
+	}
+	metrics_histogram_sample(m, name, "_bucket", "+Inf", hist->count,
+				 labels);
+	metrics_histogram_sample(m, name, "_count", NULL, hist->count, labels);
+	metrics_histogram_sample(m, name, "_sum", NULL, hist->sum_usec / 1e6,
+				 labels);
+	va_end(labels);
+}
+
+static void
+metrics_write_outputs(struct weston_metrics *m,
+		      struct weston_compositor *compositor)
+{
+	struct weston_output_frame_stats *stats;
+	struct weston_output *output;
+	uint64_t missed;
+	unsigned int i;
+
+	weston_metrics_family(m, "weston_output_frames", "counter", NULL,
+			      "Frames repainted and presented");
+	wl_list_for_each(output, &compositor->output_list, link) {
+		stats = output->frame_stats;
+		weston_metrics_sample(m, "weston_output_frames_total",
+				      stats ? stats->frames : 0,
+				      "output", output->name, NULL);
+	}
+
+	weston_metrics_family(m, "weston_output_missed_frames", "counter",
+			      NULL,
+			      "Frames presented one or more vblanks late");
+	wl_list_for_each(output, &compositor->output_list, link) {
+		stats = output->frame_stats;
+		missed = 0;
+		for (i = 1; stats && i < WESTON_FRAME_MISSED_BUCKETS; i++)
+			missed += stats->missed[i];
+		weston_metrics_sample(m, "weston_output_missed_frames_total",
+				      missed, "output", output->name, NULL);
+	}
+
+	weston_metrics_family(m, "weston_output_repaint_to_flip_seconds",
+			      "histogram", "seconds",
+			      "Start of the repaint to the vblank it was shown at");
+	wl_list_for_each(output, &compositor->output_list, link) {
+		if (output->frame_stats)
+			weston_metrics_histogram(m,
+				"weston_output_repaint_to_flip_seconds",
+				&output->frame_stats->repaint_to_flip,
+				"output", output->name, NULL);
+	}
+
+	weston_metrics_family(m, "weston_output_presentation_delay_seconds",
+			      "histogram", "seconds",
+			      "Vblank to the compositor handling its completion");
+	wl_list_for_each(output, &compositor->output_list, link) {
+		if (output->frame_stats)
+			weston_metrics_histogram(m,
+				"weston_output_presentation_delay_seconds",
+				&output->frame_stats->presentation_delay,
+				"output", output->name, NULL);
+	}
+
+	weston_metrics_family(m, "weston_output_frame_arena_bytes", "gauge",
+			      "bytes", "Per-frame scratch memory of the output");
+	wl_list_for_each(output, &compositor->output_list, link) {
+		if (output->frame_arena)
+			weston_metrics_sample(m,
+				"weston_output_frame_arena_bytes",
+				output->frame_arena->size,
+				"output", output->name, NULL);
+	}
+}
+
+/** Write all performance counters in the OpenMetrics text format
+ *
+ * \param compositor The compositor.
+ * \param fp Where to write the exposition, including the final "# EOF".
+ *
+ * Backends and renderers add their families from metrics_signal, which
+ * is emitted with the struct weston_metrics being written.
+ *
+ * \ingroup compositor
+ */
+WL_EXPORT void
+weston_compositor_write_metrics(struct weston_compositor *compositor,
+				FILE *fp)
+{
+	struct weston_metrics m = { .fp = fp };
+
+	metrics_write_outputs(&m, compositor);
+	weston_frame_stats_write_client_metrics(&m, compositor);
+	wl_signal_emit(&compositor->metrics_signal, &m);
+
+	fputs("# EOF\n", fp);
+}
@@ -46,9 +46,10 @@ noop_renderer_repaint_output(struct weston_output *output,
 {
 }
 
-static void
+static bool
 noop_renderer_flush_damage(struct weston_surface *surface)
 {
+	return false;
 }
 
 static void
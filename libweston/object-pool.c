@@ -0,0 +1,177 @@
+/*
+ * Copyright © 2022 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libweston/zalloc.h>
+#include "object-pool.h"
+#include "shared/helpers.h"
+
+/* In front of every object, keeping the object aligned for any type. */
+union object_pool_header {
+	struct weston_object_pool *pool;
+	/* next on the free list */
+	union object_pool_header *next;
+	union weston_max_align align;
+};
+
+static union object_pool_header *
+object_header(void *object)
+{
+	return (union object_pool_header *)object - 1;
+}
+
+struct weston_object_pool *
+weston_object_pool_create(const char *name, size_t size,
+			  unsigned int max_free)
+{
+	struct weston_object_pool *pool;
+
+	pool = zalloc(sizeof *pool);
+	if (!pool)
+		return NULL;
+
+	pool->name = name;
+	pool->size = size;
+	pool->max_free = max_free;
+
+	return pool;
+}
+
+static void
+object_pool_drain(struct weston_object_pool *pool)
+{
+	union object_pool_header *header, *next;
+
+	for (header = pool->free_list; header; header = next) {
+		next = header->next;
+		free(header);
+		pool->heap_frees++;
+	}
+	pool->free_list = NULL;
+	pool->n_free = 0;
+}
+
+/** Destroy the pool with its free list
+ *
+ * Objects still alive keep the pool until they are freed.
+ */
+void
+weston_object_pool_destroy(struct weston_object_pool *pool)
+{
+	if (!pool)
+		return;
+
+	object_pool_drain(pool);
+	pool->destroyed = true;
+
+	if (pool->live == 0)
+		free(pool);
+}
+
+/** Give the free list back to the heap
+ *
+ * \return The number of bytes released.
+ */
+size_t
+weston_object_pool_trim(struct weston_object_pool *pool)
+{
+	size_t bytes = pool->n_free *
+		       (sizeof(union object_pool_header) + pool->size);
+
+	object_pool_drain(pool);
+
+	return bytes;
+}
+
+/** Allocate a zeroed object, recycling a freed one if there is any
+ *
+ * Returns NULL if the heap is exhausted.
+ */
+void *
+weston_object_pool_alloc(struct weston_object_pool *pool)
+{
+	union object_pool_header *header;
+
+	assert(!pool->destroyed);
+
+	header = pool->free_list;
+	if (header) {
+		pool->free_list = header->next;
+		pool->n_free--;
+		pool->reuses++;
+		memset(header + 1, 0, pool->size);
+	} else {
+		header = calloc(1, sizeof *header + pool->size);
+		if (!header)
+			return NULL;
+	}
+
+	header->pool = pool;
+	pool->allocs++;
+	pool->live++;
+	pool->peak_live = MAX(pool->peak_live, pool->live);
+
+	return header + 1;
+}
+
+/** Give an object back to its pool, NULL is ignored */
+void
+weston_object_pool_free(void *object)
+{
+	union object_pool_header *header;
+	struct weston_object_pool *pool;
+
+	if (!object)
+		return;
+
+	header = object_header(object);
+	pool = header->pool;
+	assert(pool->live > 0);
+	pool->live--;
+
+	if (pool->destroyed) {
+		free(header);
+		if (pool->live == 0)
+			free(pool);
+		return;
+	}
+
+	if (pool->n_free >= pool->max_free) {
+		free(header);
+		pool->heap_frees++;
+		return;
+	}
+
+	header->next = pool->free_list;
+	pool->free_list = header;
+	pool->n_free++;
+}
@@ -0,0 +1,74 @@
+/*
+ * Copyright © 2022 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef WESTON_OBJECT_POOL_H
+#define WESTON_OBJECT_POOL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/** Recycler for one type of often created object
+ *
+ * Freed objects are kept on a free list, up to a limit, and handed out
+ * zeroed again by the next allocation, so that short-lived objects such
+ * as popup surfaces and their views do not churn the heap. Every object
+ * knows its pool, which stays around until the last object is freed even
+ * when the pool itself was destroyed first.
+ */
+struct weston_object_pool {
+	const char *name;
+	size_t size;
+	unsigned int max_free;
+	bool destroyed;
+
+	void *free_list;
+	unsigned int n_free;
+
+	/* counters for the 'object-pools' scope */
+	uint64_t allocs;
+	uint64_t reuses;
+	uint64_t heap_frees;
+	unsigned int live;
+	unsigned int peak_live;
+};
+
+struct weston_object_pool *
+weston_object_pool_create(const char *name, size_t size,
+			  unsigned int max_free);
+
+void
+weston_object_pool_destroy(struct weston_object_pool *pool);
+
+size_t
+weston_object_pool_trim(struct weston_object_pool *pool);
+
+void *
+weston_object_pool_alloc(struct weston_object_pool *pool);
+
+void
+weston_object_pool_free(void *object);
+
+#endif /* WESTON_OBJECT_POOL_H */
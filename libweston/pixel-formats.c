@@ -26,6 +26,7 @@
 
 #include "config.h"
 
+#include <assert.h>
 #include <endian.h>
 #include <inttypes.h>
 #include <stdbool.h>
@@ -401,6 +402,13 @@ static const struct pixel_format_info pixel_format_table[] = {
 		.num_planes = 2,
 		.chroma_order = ORDER_VU,
 	},
+	{
+		DRM_FORMAT(P010),
+		SAMPLER_TYPE(EGL_TEXTURE_Y_UV_WL),
+		.num_planes = 2,
+		.hsub = 2,
+		.vsub = 2,
+	},
 	{
 		DRM_FORMAT(YUV410),
 		SAMPLER_TYPE(EGL_TEXTURE_Y_U_V_WL),
@@ -474,6 +482,92 @@ static const struct pixel_format_info pixel_format_table[] = {
 	},
 };
 
+/*
+ * Open-addressed indices into pixel_format_table, keyed by fourcc and by
+ * opaque substitute. Formats are looked up on every attach, import and
+ * plane check, so these are filled in once when the library is loaded
+ * rather than scanning the table each time. A slot holds the table
+ * position plus one, 0 marks it empty.
+ */
+#define PIXEL_FORMAT_INDEX_SIZE 256
+
+static uint8_t format_index[PIXEL_FORMAT_INDEX_SIZE];
+static uint8_t opaque_substitute_index[PIXEL_FORMAT_INDEX_SIZE];
+
+static uint32_t
+pixel_format_hash(uint32_t format)
+{
+	/* Fibonacci hashing, fourccs are ASCII and differ mostly in the
+	 * low bits of each byte. */
+	return (format * 0x9e3779b1u) >> 24;
+}
+
+typedef uint32_t (*pixel_format_key_func)(const struct pixel_format_info *info);
+
+static uint32_t
+format_key(const struct pixel_format_info *info)
+{
+	return info->format;
+}
+
+static uint32_t
+opaque_substitute_key(const struct pixel_format_info *info)
+{
+	return info->opaque_substitute;
+}
+
+static const struct pixel_format_info *
+pixel_format_index_find(const uint8_t *index, pixel_format_key_func key_of,
+			uint32_t key)
+{
+	const struct pixel_format_info *info;
+	uint32_t i = pixel_format_hash(key);
+
+	while (index[i] != 0) {
+		info = &pixel_format_table[index[i] - 1];
+		if (key_of(info) == key)
+			return info;
+		i = (i + 1) % PIXEL_FORMAT_INDEX_SIZE;
+	}
+
+	return NULL;
+}
+
+static void
+pixel_format_index_insert(uint8_t *index, pixel_format_key_func key_of,
+			  unsigned int pos)
+{
+	uint32_t key = key_of(&pixel_format_table[pos]);
+	uint32_t i = pixel_format_hash(key);
+
+	/* Keep the first entry for a key, as the linear scan used to. */
+	if (pixel_format_index_find(index, key_of, key))
+		return;
+
+	while (index[i] != 0)
+		i = (i + 1) % PIXEL_FORMAT_INDEX_SIZE;
+
+	index[i] = pos + 1;
+}
+
+static void __attribute__((constructor))
+pixel_format_index_init(void)
+{
+	unsigned int i;
+
+	/* Keep the load factor low enough for short probe sequences. */
+	static_assert(ARRAY_LENGTH(pixel_format_table) * 4 <=
+		      PIXEL_FORMAT_INDEX_SIZE,
+		      "pixel format index too small");
+
+	for (i = 0; i < ARRAY_LENGTH(pixel_format_table); i++) {
+		pixel_format_index_insert(format_index, format_key, i);
+		if (pixel_format_table[i].opaque_substitute)
+			pixel_format_index_insert(opaque_substitute_index,
+						  opaque_substitute_key, i);
+	}
+}
+
 WL_EXPORT const struct pixel_format_info *
 pixel_format_get_info_shm(uint32_t format)
 {
@@ -488,14 +582,7 @@ pixel_format_get_info_shm(uint32_t format)
 WL_EXPORT const struct pixel_format_info *
 pixel_format_get_info(uint32_t format)
 {
-	unsigned int i;
-
-	for (i = 0; i < ARRAY_LENGTH(pixel_format_table); i++) {
-		if (pixel_format_table[i].format == format)
-			return &pixel_format_table[i];
-	}
-
-	return NULL;
+	return pixel_format_index_find(format_index, format_key, format);
 }
 
 WL_EXPORT const struct pixel_format_info *
@@ -541,6 +628,13 @@ pixel_format_is_opaque(const struct pixel_format_info *info)
 	return !info->opaque_substitute;
 }
 
+WL_EXPORT bool
+pixel_format_is_yuv(const struct pixel_format_info *info)
+{
+	/* Only the YUV entries in the table leave the RGB bits unset. */
+	return info->bits.r == 0 && info->bits.g == 0 && info->bits.b == 0;
+}
+
 WL_EXPORT const struct pixel_format_info *
 pixel_format_get_opaque_substitute(const struct pixel_format_info *info)
 {
@@ -553,14 +647,12 @@ pixel_format_get_opaque_substitute(const struct pixel_format_info *info)
 WL_EXPORT const struct pixel_format_info *
 pixel_format_get_info_by_opaque_substitute(uint32_t format)
 {
-	unsigned int i;
-
-	for (i = 0; i < ARRAY_LENGTH(pixel_format_table); i++) {
-		if (pixel_format_table[i].opaque_substitute == format)
-			return &pixel_format_table[i];
-	}
+	/* Opaque formats have no substitute, they are not indexed. */
+	if (format == 0)
+		return NULL;
 
-	return NULL;
+	return pixel_format_index_find(opaque_substitute_index,
+				       opaque_substitute_key, format);
 }
 
 WL_EXPORT unsigned int
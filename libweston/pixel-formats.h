@@ -214,6 +214,18 @@ pixel_format_get_plane_count(const struct pixel_format_info *format);
 bool
 pixel_format_is_opaque(const struct pixel_format_info *format);
 
+/**
+ * Determine if a pixel format stores YUV rather than RGB data
+ *
+ * YUV formats need a colour encoding and quantisation range to be converted
+ * to RGB, whether by a shader or by a display controller plane.
+ *
+ * @param format Pixel format info structure
+ * @returns True if the format is a YUV format
+ */
+bool
+pixel_format_is_yuv(const struct pixel_format_info *format);
+
 /**
  * Get compatible opaque equivalent for a format
  *
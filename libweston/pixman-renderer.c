@@ -30,26 +30,96 @@
 #include <errno.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
+#include <math.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
 
 #include "pixman-renderer.h"
 #include "color.h"
+#include "linux-dmabuf.h"
 #include "pixel-formats.h"
+#include "pixman-rotate.h"
 #include "shared/helpers.h"
+#include "shared/weston-drm-fourcc.h"
 
+#include <linux/dma-buf.h>
 #include <linux/input.h>
 
+/* Rows below which a damage band is not worth handing to a worker */
+#define PIXMAN_REPAINT_BAND_MIN_HEIGHT 32
+#define PIXMAN_REPAINT_THREADS_MAX 16
+
+/** One horizontal slice of an output repaint
+ *
+ * Every band composites into its own pixman image wrapping the output
+ * pixels, so that clip regions set by concurrent bands do not collide.
+ */
+struct pixman_repaint_band {
+	pixman_image_t *target;
+	/* rows of target to paint, in output coordinates */
+	pixman_box32_t box;
+	pixman_image_t *debug_color;
+};
+
+struct pixman_output_state;
+
+struct pixman_repaint_worker {
+	struct pixman_output_state *po;
+	pthread_t thread;
+	unsigned int index;
+};
+
 struct pixman_output_state {
 	void *shadow_buffer;
 	pixman_image_t *shadow_image;
+	/* Rotation left for copy_to_hw_buffer(). For 90, 180 and 270 the
+	 * shadow is kept unrotated, so that views composite through
+	 * pixman's untransformed fast paths, and the damage is rotated into
+	 * the hardware buffer by the pixman-rotate.c kernels. */
+	uint32_t shadow_transform;
+	/* global to shadow coordinates, valid for a rotated shadow */
+	struct weston_matrix shadow_matrix;
+	struct weston_matrix shadow_inverse_matrix;
 	pixman_image_t *hw_buffer;
 	pixman_region32_t *hw_extra_damage;
+
+	/* Repaint thread pool, the compositor thread paints band 0 */
+	struct pixman_repaint_worker *workers;
+	unsigned int n_workers;
+	pthread_mutex_t work_mutex;
+	pthread_cond_t work_cond;
+	pthread_cond_t done_cond;
+	uint32_t work_seq;
+	unsigned int work_pending;
+	bool work_quit;
+
+	/* Current job, valid while work_pending is non-zero */
+	struct weston_output *work_output;
+	pixman_region32_t *work_node_damage;
+	struct pixman_repaint_band *work_bands;
+	unsigned int work_n_bands;
+};
+
+/** A linear dmabuf mapped for reading, kept for the buffer's lifetime */
+struct pixman_dmabuf {
+	void *map;
+	size_t map_size;
+	pixman_format_code_t pixman_format;
 };
 
 struct pixman_surface_state {
 	struct weston_surface *surface;
 
 	pixman_image_t *image;
+	/* Set while image wraps a mapped dmabuf, to bracket CPU access */
+	struct linux_dmabuf_buffer *dmabuf;
+	/* Color of image if it was created by surface_set_color */
+	pixman_color_t solid_color;
 	struct weston_buffer_reference buffer_ref;
 	struct weston_buffer_release_reference buffer_release_ref;
 
@@ -65,6 +135,9 @@ struct pixman_renderer {
 	pixman_image_t *debug_color;
 	struct weston_binding *debug_binding;
 
+	/* Formats with DRM_FORMAT_MOD_LINEAR, the only dmabufs we map */
+	struct weston_drm_format_array supported_formats;
+
 	struct wl_signal destroy_signal;
 };
 
@@ -129,6 +202,31 @@ pixman_renderer_read_pixels(struct weston_output *output,
 
 #define D2F(v) pixman_double_to_fixed((double)v)
 
+/** Transform a region from global to render target coordinates
+ *
+ * The same as weston_output_region_from_global(), except that a rotated
+ * shadow leaves the output rotation out.
+ */
+static void
+pixman_output_region_from_global(struct weston_output *output,
+				 pixman_region32_t *region)
+{
+	struct pixman_output_state *po = get_output_state(output);
+
+	if (po->shadow_transform == WL_OUTPUT_TRANSFORM_NORMAL) {
+		weston_output_region_from_global(output, region);
+	} else if (output->zoom.active && !output->zoom.scanout) {
+		weston_matrix_transform_region(region, &po->shadow_matrix,
+					       region);
+	} else {
+		pixman_region32_translate(region, -output->x, -output->y);
+		weston_transformed_region(output->width, output->height,
+					  WL_OUTPUT_TRANSFORM_NORMAL,
+					  output->current_scale,
+					  region, region);
+	}
+}
+
 static void
 weston_matrix_to_pixman_transform(pixman_transform_t *pt,
 				  const struct weston_matrix *wm)
@@ -151,12 +249,16 @@ pixman_renderer_compute_transform(pixman_transform_t *transform_out,
 				  struct weston_view *ev,
 				  struct weston_output *output)
 {
+	struct pixman_output_state *po = get_output_state(output);
 	struct weston_matrix matrix;
 
 	/* Set up the source transformation based on the surface
 	   position, the output position/transform/scale and the client
 	   specified buffer transform/scale */
-	matrix = output->inverse_matrix;
+	if (po->shadow_transform != WL_OUTPUT_TRANSFORM_NORMAL)
+		matrix = po->shadow_inverse_matrix;
+	else
+		matrix = output->inverse_matrix;
 
 	if (ev->transform.enabled) {
 		weston_matrix_multiply(&matrix, &ev->transform.inverse);
@@ -309,10 +411,35 @@ composite_clipped(pixman_image_t *src,
 	}
 }
 
+/** Create a private reference to a surface image
+ *
+ * Source transform, filter and repeat are image state in Pixman. Wrapping
+ * the surface pixels in a fresh image per composite keeps that state local
+ * to the band being painted.
+ */
+static pixman_image_t *
+pixman_surface_state_get_source(struct pixman_surface_state *ps)
+{
+	pixman_format_code_t format;
+	void *data;
+
+	data = pixman_image_get_data(ps->image);
+	if (!data)
+		return pixman_image_create_solid_fill(&ps->solid_color);
+
+	format = pixman_image_get_format(ps->image);
+	return pixman_image_create_bits_no_clear(format,
+					pixman_image_get_width(ps->image),
+					pixman_image_get_height(ps->image),
+					data,
+					pixman_image_get_stride(ps->image));
+}
+
 /** Paint an intersected region
  *
  * \param ev The view to be painted.
  * \param output The output being painted.
+ * \param band The band of the output to paint into.
  * \param repaint_output The region to be painted in output coordinates.
  * \param source_clip The region of the source image to use, in source image
  *                    coordinates. If NULL, use the whole source image.
@@ -320,28 +447,31 @@ composite_clipped(pixman_image_t *src,
  */
 static void
 repaint_region(struct weston_view *ev, struct weston_output *output,
+	       struct pixman_repaint_band *band,
 	       pixman_region32_t *repaint_output,
 	       pixman_region32_t *source_clip,
 	       pixman_op_t pixman_op)
 {
-	struct pixman_renderer *pr =
-		(struct pixman_renderer *) output->compositor->renderer;
 	struct pixman_surface_state *ps = get_surface_state(ev->surface);
-	struct pixman_output_state *po = get_output_state(output);
 	struct weston_buffer_viewport *vp = &ev->surface->buffer_viewport;
-	pixman_image_t *target_image;
+	pixman_image_t *target_image = band->target;
+	pixman_image_t *src_image;
+	pixman_region32_t band_clip;
 	pixman_transform_t transform;
 	pixman_filter_t filter;
 	pixman_image_t *mask_image;
 	pixman_color_t mask = { 0, };
 
-	if (po->shadow_image)
-		target_image = po->shadow_image;
-	else
-		target_image = po->hw_buffer;
+	pixman_region32_init_with_extents(&band_clip, &band->box);
+	pixman_region32_intersect(&band_clip, &band_clip, repaint_output);
+	if (!pixman_region32_not_empty(&band_clip)) {
+		pixman_region32_fini(&band_clip);
+		return;
+	}
 
  	/* Clip rendering to the damaged output region */
-	pixman_image_set_clip_region32(target_image, repaint_output);
+	pixman_image_set_clip_region32(target_image, &band_clip);
+	pixman_region32_fini(&band_clip);
 
 	pixman_renderer_compute_transform(&transform, ev, output);
 
@@ -360,12 +490,15 @@ repaint_region(struct weston_view *ev, struct weston_output *output,
 		mask_image = NULL;
 	}
 
-	if (source_clip)
+	if (source_clip) {
 		composite_clipped(ps->image, mask_image, target_image,
 				  &transform, filter, source_clip);
-	else
-		composite_whole(pixman_op, ps->image, mask_image,
+	} else {
+		src_image = pixman_surface_state_get_source(ps);
+		composite_whole(pixman_op, src_image, mask_image,
 				target_image, &transform, filter);
+		pixman_image_unref(src_image);
+	}
 
 	if (mask_image)
 		pixman_image_unref(mask_image);
@@ -373,9 +506,9 @@ repaint_region(struct weston_view *ev, struct weston_output *output,
 	if (ps->buffer_ref.buffer)
 		wl_shm_buffer_end_access(ps->buffer_ref.buffer->shm_buffer);
 
-	if (pr->repaint_debug)
+	if (band->debug_color)
 		pixman_image_composite32(PIXMAN_OP_OVER,
-					 pr->debug_color, /* src */
+					 band->debug_color, /* src */
 					 NULL /* mask */,
 					 target_image, /* dest */
 					 0, 0, /* src_x, src_y */
@@ -389,6 +522,7 @@ repaint_region(struct weston_view *ev, struct weston_output *output,
 
 static void
 draw_view_translated(struct weston_view *view, struct weston_output *output,
+		     struct pixman_repaint_band *band,
 		     pixman_region32_t *repaint_global)
 {
 	struct weston_surface *surface = view->surface;
@@ -414,11 +548,11 @@ draw_view_translated(struct weston_view *view, struct weston_output *output,
 							  repaint_global,
 							  &surface->opaque,
 							  view);
-			weston_output_region_from_global(output,
+			pixman_output_region_from_global(output,
 							 &repaint_output);
 
-			repaint_region(view, output, &repaint_output, NULL,
-				       PIXMAN_OP_SRC);
+			repaint_region(view, output, band, &repaint_output,
+				       NULL, PIXMAN_OP_SRC);
 		}
 	}
 
@@ -426,9 +560,9 @@ draw_view_translated(struct weston_view *view, struct weston_output *output,
 		region_intersect_only_translation(&repaint_output,
 						  repaint_global,
 						  &surface_blend, view);
-		weston_output_region_from_global(output, &repaint_output);
+		pixman_output_region_from_global(output, &repaint_output);
 
-		repaint_region(view, output, &repaint_output, NULL,
+		repaint_region(view, output, band, &repaint_output, NULL,
 			       PIXMAN_OP_OVER);
 	}
 
@@ -439,6 +573,7 @@ draw_view_translated(struct weston_view *view, struct weston_output *output,
 static void
 draw_view_source_clipped(struct weston_view *view,
 			 struct weston_output *output,
+			 struct pixman_repaint_band *band,
 			 pixman_region32_t *repaint_global)
 {
 	struct weston_surface *surface = view->surface;
@@ -462,9 +597,9 @@ draw_view_source_clipped(struct weston_view *view,
 
 	pixman_region32_init(&repaint_output);
 	pixman_region32_copy(&repaint_output, repaint_global);
-	weston_output_region_from_global(output, &repaint_output);
+	pixman_output_region_from_global(output, &repaint_output);
 
-	repaint_region(view, output, &repaint_output, &buffer_region,
+	repaint_region(view, output, band, &repaint_output, &buffer_region,
 		       PIXMAN_OP_OVER);
 
 	pixman_region32_fini(&repaint_output);
@@ -474,6 +609,7 @@ draw_view_source_clipped(struct weston_view *view,
 
 static void
 draw_paint_node(struct weston_paint_node *pnode,
+		struct pixman_repaint_band *band,
 		pixman_region32_t *damage /* in global coordinates */)
 {
 	struct pixman_surface_state *ps = get_surface_state(pnode->surface);
@@ -505,7 +641,8 @@ draw_paint_node(struct weston_paint_node *pnode,
 		 * Also the boundingbox is accurate rather than an
 		 * approximation.
 		 */
-		draw_view_translated(pnode->view, pnode->output, &repaint);
+		draw_view_translated(pnode->view, pnode->output, band,
+				     &repaint);
 	} else {
 		/* The complex case: the view transformation does not allow
 		 * converting opaque etc. regions into global coordinate space.
@@ -514,22 +651,536 @@ draw_paint_node(struct weston_paint_node *pnode,
 		 * to be used whole. Source clipping does not work with
 		 * PIXMAN_OP_SRC.
 		 */
-		draw_view_source_clipped(pnode->view, pnode->output, &repaint);
+		draw_view_source_clipped(pnode->view, pnode->output, band,
+					 &repaint);
 	}
 
 out:
 	pixman_region32_fini(&repaint);
 }
+
+/* Bisection steps when shrinking a box into a transformed view */
+#define PIXMAN_OCCLUSION_FIT_STEPS 6
+
+static bool
+view_covers_global_box(struct weston_view *view, const pixman_box32_t *src,
+		       float x1, float y1, float x2, float y2)
+{
+	const float corners[4][2] = {
+		{ x1, y1 }, { x2, y1 }, { x1, y2 }, { x2, y2 },
+	};
+	float sx, sy;
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_LENGTH(corners); i++) {
+		weston_view_from_global_float(view, corners[i][0],
+					      corners[i][1], &sx, &sy);
+		if (sx < src->x1 || sx > src->x2 ||
+		    sy < src->y1 || sy > src->y2)
+			return false;
+	}
+
+	return true;
+}
+
+/** Find an axis-aligned box inside a transformed surface rectangle
+ *
+ * \param view The view, with an affine non-translation transformation.
+ * \param src A rectangle in surface coordinates.
+ * \param occluder Returns the box in global coordinates, possibly empty.
+ *
+ * The global bounding box of \c src is shrunk towards its center until all
+ * of its corners map back into \c src. The preimage of the box is then a
+ * parallelogram spanned by points inside a rectangle, so the whole box is
+ * covered. This is exact for 90 degree rotations and conservative otherwise.
+ */
 static void
-repaint_surfaces(struct weston_output *output, pixman_region32_t *damage)
+view_inscribed_box(struct weston_view *view, const pixman_box32_t *src,
+		   pixman_region32_t *occluder)
+{
+	const float src_corners[4][2] = {
+		{ src->x1, src->y1 }, { src->x2, src->y1 },
+		{ src->x1, src->y2 }, { src->x2, src->y2 },
+	};
+	float x1 = 0, y1 = 0, x2 = 0, y2 = 0;
+	float cx, cy, hw, hh;
+	float lo = 0.0f, hi = 1.0f, scale;
+	float gx, gy;
+	pixman_box32_t box;
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_LENGTH(src_corners); i++) {
+		weston_view_to_global_float(view, src_corners[i][0],
+					    src_corners[i][1], &gx, &gy);
+		if (i == 0 || gx < x1)
+			x1 = gx;
+		if (i == 0 || gx > x2)
+			x2 = gx;
+		if (i == 0 || gy < y1)
+			y1 = gy;
+		if (i == 0 || gy > y2)
+			y2 = gy;
+	}
+
+	cx = (x1 + x2) / 2.0f;
+	cy = (y1 + y2) / 2.0f;
+	hw = (x2 - x1) / 2.0f;
+	hh = (y2 - y1) / 2.0f;
+
+	if (view_covers_global_box(view, src, x1, y1, x2, y2)) {
+		lo = 1.0f;
+	} else {
+		for (i = 0; i < PIXMAN_OCCLUSION_FIT_STEPS; i++) {
+			scale = (lo + hi) / 2.0f;
+			if (view_covers_global_box(view, src,
+						   cx - hw * scale,
+						   cy - hh * scale,
+						   cx + hw * scale,
+						   cy + hh * scale))
+				lo = scale;
+			else
+				hi = scale;
+		}
+	}
+
+	/* Round inwards, a partially covered pixel does not occlude */
+	box.x1 = ceilf(cx - hw * lo);
+	box.y1 = ceilf(cy - hh * lo);
+	box.x2 = floorf(cx + hw * lo);
+	box.y2 = floorf(cy + hh * lo);
+
+	if (box.x1 < box.x2 && box.y1 < box.y2)
+		pixman_region32_init_with_extents(occluder, &box);
+	else
+		pixman_region32_init(occluder);
+}
+
+/** Compute the global region a view paints fully opaque
+ *
+ * For translated views this is the opaque region of the surface, or the
+ * whole bounding box when the buffer format has no alpha. Transformed views
+ * are covered by an inscribed box of their opaque rectangle, which lets
+ * rotated opaque windows occlude what lies beneath them.
+ */
+static void
+view_occluder_region(struct weston_view *view, pixman_region32_t *occluder)
+{
+	struct weston_surface *surface = view->surface;
+	pixman_region32_t src;
+	pixman_box32_t src_box;
+
+	if (view->alpha < 1.0 || view->transform.dirty) {
+		pixman_region32_init(occluder);
+		return;
+	}
+
+	if (weston_view_is_opaque(view, &view->transform.boundingbox) &&
+	    view_transformation_is_translation(view)) {
+		pixman_region32_init(occluder);
+		pixman_region32_copy(occluder, &view->transform.boundingbox);
+		return;
+	}
+
+	if (view_transformation_is_translation(view)) {
+		pixman_region32_init(occluder);
+		pixman_region32_copy(occluder, &view->transform.opaque);
+		return;
+	}
+
+	if (view->transform.matrix.type & WESTON_MATRIX_TRANSFORM_OTHER) {
+		pixman_region32_init(occluder);
+		return;
+	}
+
+	/* Only a single rectangle maps to a convex preimage test */
+	if (surface->is_opaque)
+		pixman_region32_init_rect(&src, 0, 0,
+					  surface->width, surface->height);
+	else
+		pixman_region32_init_rect(&src, 0, 0, 0, 0);
+
+	if (!surface->is_opaque &&
+	    pixman_region32_n_rects(&surface->opaque) == 1)
+		pixman_region32_copy(&src, &surface->opaque);
+
+	if (view->geometry.scissor_enabled)
+		pixman_region32_intersect(&src, &src, &view->geometry.scissor);
+
+	if (pixman_region32_n_rects(&src) != 1) {
+		pixman_region32_fini(&src);
+		pixman_region32_init(occluder);
+		return;
+	}
+
+	src_box = *pixman_region32_extents(&src);
+	pixman_region32_fini(&src);
+
+	view_inscribed_box(view, &src_box, occluder);
+}
+
+/** Split the output damage per paint node, minus what is covered above
+ *
+ * \param output The output being painted.
+ * \param damage The damage in global coordinates.
+ * \param n_nodes Returns the number of paint nodes on the output.
+ * \return Regions in bottom-to-top paint order, or NULL on failure.
+ *
+ * The compositor's view clip only accounts for regions clients declared
+ * opaque and translated views. Walking top to bottom, each view on the
+ * primary plane here also occludes with alpha-less buffers and under
+ * rotation, so covered pixels are never composited.
+ */
+static pixman_region32_t *
+compute_node_damage(struct weston_output *output, pixman_region32_t *damage,
+		    unsigned int *n_nodes)
 {
 	struct weston_compositor *compositor = output->compositor;
 	struct weston_paint_node *pnode;
+	struct pixman_surface_state *ps;
+	pixman_region32_t *node_damage;
+	pixman_region32_t occluded;
+	pixman_region32_t occluder;
+	unsigned int n, i;
+
+	n = wl_list_length(&output->paint_node_z_order_list);
+	*n_nodes = n;
+	if (n == 0)
+		return NULL;
+
+	node_damage = calloc(n, sizeof *node_damage);
+	if (!node_damage)
+		return NULL;
+
+	pixman_region32_init(&occluded);
+	i = n;
+	wl_list_for_each(pnode, &output->paint_node_z_order_list,
+			 z_order_link) {
+		pixman_region32_t *region = &node_damage[--i];
+
+		pixman_region32_init(region);
+		if (pnode->view->plane != &compositor->primary_plane &&
+		    !pnode->need_hole)
+			continue;
+
+		pixman_region32_subtract(region, damage, &occluded);
+
+		/* the hole replaces everything below it */
+		if (pnode->need_hole) {
+			pixman_region32_union(&occluded, &occluded,
+					      &pnode->view->transform.boundingbox);
+			continue;
+		}
+
+		ps = get_surface_state(pnode->surface);
+		if (!pnode->surf_xform_valid || !ps->image)
+			continue;
+
+		view_occluder_region(pnode->view, &occluder);
+		pixman_region32_union(&occluded, &occluded, &occluder);
+		pixman_region32_fini(&occluder);
+	}
+	pixman_region32_fini(&occluded);
+
+	return node_damage;
+}
+
+static void
+free_node_damage(pixman_region32_t *node_damage, unsigned int n_nodes)
+{
+	unsigned int i;
+
+	if (!node_damage)
+		return;
+
+	for (i = 0; i < n_nodes; i++)
+		pixman_region32_fini(&node_damage[i]);
+	free(node_damage);
+}
+
+/** Clear the area of a view on an underlay plane to transparent
+ *
+ * The plane sits below the primary one and shows through the hole.
+ */
+static void
+draw_paint_node_hole(struct weston_paint_node *pnode,
+		     struct pixman_repaint_band *band,
+		     pixman_region32_t *damage /* in global coordinates */)
+{
+	static const pixman_color_t transparent = { 0, 0, 0, 0 };
+	pixman_region32_t repaint;
+	pixman_box32_t *rects;
+	int nrects;
+
+	pixman_region32_init(&repaint);
+	pixman_region32_intersect(&repaint,
+				  &pnode->view->transform.boundingbox, damage);
+	pixman_output_region_from_global(pnode->output, &repaint);
+	pixman_region32_intersect_rect(&repaint, &repaint,
+				       band->box.x1, band->box.y1,
+				       band->box.x2 - band->box.x1,
+				       band->box.y2 - band->box.y1);
+
+	rects = pixman_region32_rectangles(&repaint, &nrects);
+	if (nrects > 0)
+		pixman_image_fill_boxes(PIXMAN_OP_SRC, band->target,
+					&transparent, nrects, rects);
+
+	pixman_region32_fini(&repaint);
+}
+
+static void
+repaint_band(struct weston_output *output, struct pixman_repaint_band *band,
+	     pixman_region32_t *node_damage)
+{
+	struct weston_compositor *compositor = output->compositor;
+	struct weston_paint_node *pnode;
+	unsigned int i = 0;
 
 	wl_list_for_each_reverse(pnode, &output->paint_node_z_order_list,
 				 z_order_link) {
+		if (!pixman_region32_not_empty(&node_damage[i])) {
+			i++;
+			continue;
+		}
+
 		if (pnode->view->plane == &compositor->primary_plane)
-			draw_paint_node(pnode, damage);
+			draw_paint_node(pnode, band, &node_damage[i]);
+		else if (pnode->need_hole)
+			draw_paint_node_hole(pnode, band, &node_damage[i]);
+		i++;
+	}
+}
+
+static void *
+repaint_worker_thread(void *data)
+{
+	struct pixman_repaint_worker *worker = data;
+	struct pixman_output_state *po = worker->po;
+	uint32_t seq = 0;
+
+	pthread_mutex_lock(&po->work_mutex);
+	for (;;) {
+		while (!po->work_quit && po->work_seq == seq)
+			pthread_cond_wait(&po->work_cond, &po->work_mutex);
+
+		if (po->work_quit)
+			break;
+
+		seq = po->work_seq;
+		if (worker->index >= po->work_n_bands)
+			continue;
+
+		pthread_mutex_unlock(&po->work_mutex);
+		repaint_band(po->work_output, &po->work_bands[worker->index],
+			     po->work_node_damage);
+		pthread_mutex_lock(&po->work_mutex);
+
+		if (--po->work_pending == 0)
+			pthread_cond_signal(&po->done_cond);
+	}
+	pthread_mutex_unlock(&po->work_mutex);
+
+	return NULL;
+}
+
+static unsigned int
+repaint_band_count(struct weston_output *output,
+		   struct pixman_output_state *po,
+		   pixman_region32_t *damage,
+		   pixman_box32_t *extents)
+{
+	pixman_region32_t damage_output;
+	unsigned int n_bands;
+	int32_t height;
+
+	pixman_region32_init(&damage_output);
+	pixman_region32_copy(&damage_output, damage);
+	pixman_output_region_from_global(output, &damage_output);
+	*extents = *pixman_region32_extents(&damage_output);
+	pixman_region32_fini(&damage_output);
+
+	height = extents->y2 - extents->y1;
+	if (height <= 0)
+		return 1;
+
+	n_bands = height / PIXMAN_REPAINT_BAND_MIN_HEIGHT;
+	if (n_bands > po->n_workers + 1)
+		n_bands = po->n_workers + 1;
+
+	return n_bands > 0 ? n_bands : 1;
+}
+
+static void
+repaint_surfaces(struct weston_output *output, pixman_region32_t *damage)
+{
+	struct pixman_renderer *pr = get_renderer(output->compositor);
+	struct pixman_output_state *po = get_output_state(output);
+	struct pixman_repaint_band bands[PIXMAN_REPAINT_THREADS_MAX];
+	static const pixman_color_t debug_red = {
+		0x3fff, 0x0000, 0x0000, 0x3fff
+	};
+	pixman_region32_t *node_damage;
+	pixman_image_t *target_image;
+	pixman_box32_t extents;
+	unsigned int n_nodes;
+	unsigned int n_bands;
+	unsigned int i;
+	int32_t y, height;
+
+	node_damage = compute_node_damage(output, damage, &n_nodes);
+	if (!node_damage)
+		return;
+
+	if (po->shadow_image)
+		target_image = po->shadow_image;
+	else
+		target_image = po->hw_buffer;
+
+	if (po->n_workers == 0 ||
+	    (n_bands = repaint_band_count(output, po, damage, &extents)) < 2) {
+		bands[0].target = target_image;
+		bands[0].box.x1 = 0;
+		bands[0].box.y1 = 0;
+		bands[0].box.x2 = pixman_image_get_width(target_image);
+		bands[0].box.y2 = pixman_image_get_height(target_image);
+		bands[0].debug_color = pr->repaint_debug ?
+				       pr->debug_color : NULL;
+		repaint_band(output, &bands[0], node_damage);
+		free_node_damage(node_damage, n_nodes);
+		return;
+	}
+
+	height = extents.y2 - extents.y1;
+	for (i = 0; i < n_bands; i++) {
+		y = extents.y1 + height * i / n_bands;
+		bands[i].box.x1 = extents.x1;
+		bands[i].box.y1 = y;
+		bands[i].box.x2 = extents.x2;
+		bands[i].box.y2 = extents.y1 + height * (i + 1) / n_bands;
+		bands[i].target = pixman_image_create_bits_no_clear(
+					pixman_image_get_format(target_image),
+					pixman_image_get_width(target_image),
+					pixman_image_get_height(target_image),
+					pixman_image_get_data(target_image),
+					pixman_image_get_stride(target_image));
+		bands[i].debug_color = pr->repaint_debug ?
+			pixman_image_create_solid_fill(&debug_red) : NULL;
+	}
+
+	pthread_mutex_lock(&po->work_mutex);
+	po->work_output = output;
+	po->work_node_damage = node_damage;
+	po->work_bands = bands;
+	po->work_n_bands = n_bands;
+	po->work_pending = n_bands - 1;
+	po->work_seq++;
+	pthread_cond_broadcast(&po->work_cond);
+	pthread_mutex_unlock(&po->work_mutex);
+
+	repaint_band(output, &bands[0], node_damage);
+
+	pthread_mutex_lock(&po->work_mutex);
+	while (po->work_pending > 0)
+		pthread_cond_wait(&po->done_cond, &po->work_mutex);
+	po->work_bands = NULL;
+	po->work_n_bands = 0;
+	pthread_mutex_unlock(&po->work_mutex);
+
+	for (i = 0; i < n_bands; i++) {
+		pixman_image_unref(bands[i].target);
+		if (bands[i].debug_color)
+			pixman_image_unref(bands[i].debug_color);
+	}
+
+	free_node_damage(node_damage, n_nodes);
+}
+
+/** Rotate the damage of an unrotated shadow into the hardware buffer
+ *
+ * \param region The damage in shadow coordinates, clipped to the shadow
+ * in place.
+ */
+static void
+rotate_to_hw_buffer(struct pixman_output_state *po, pixman_region32_t *region)
+{
+	const uint32_t *src_bits = pixman_image_get_data(po->shadow_image);
+	uint32_t *dst_bits = pixman_image_get_data(po->hw_buffer);
+	int src_stride = pixman_image_get_stride(po->shadow_image) / 4;
+	int dst_stride = pixman_image_get_stride(po->hw_buffer) / 4;
+	int sw = pixman_image_get_width(po->shadow_image);
+	int sh = pixman_image_get_height(po->shadow_image);
+	pixman_box32_t *rects;
+	int nrects, i, w, h;
+
+	pixman_region32_intersect_rect(region, region, 0, 0, sw, sh);
+	rects = pixman_region32_rectangles(region, &nrects);
+	for (i = 0; i < nrects; i++) {
+		const uint32_t *src = &src_bits[rects[i].y1 * src_stride +
+						rects[i].x1];
+
+		w = rects[i].x2 - rects[i].x1;
+		h = rects[i].y2 - rects[i].y1;
+
+		switch (po->shadow_transform) {
+		case WL_OUTPUT_TRANSFORM_90:
+			pixman_rotate_90(&dst_bits[(sw - rects[i].x2) *
+						   dst_stride + rects[i].y1],
+					 dst_stride, src, src_stride, w, h);
+			break;
+		case WL_OUTPUT_TRANSFORM_180:
+			pixman_rotate_180(&dst_bits[(sh - rects[i].y2) *
+						    dst_stride +
+						    sw - rects[i].x2],
+					  dst_stride, src, src_stride, w, h);
+			break;
+		case WL_OUTPUT_TRANSFORM_270:
+			pixman_rotate_270(&dst_bits[rects[i].x1 * dst_stride +
+						    sh - rects[i].y2],
+					  dst_stride, src, src_stride, w, h);
+			break;
+		default:
+			assert(0);
+		}
+	}
+}
+
+/* Map hardware buffer pixels back to the unrotated shadow, for buffers
+ * the rotation kernels cannot write to */
+static void
+shadow_rotation_to_pixman_transform(pixman_transform_t *transform,
+				    struct pixman_output_state *po)
+{
+	pixman_fixed_t sw = pixman_int_to_fixed(
+				pixman_image_get_width(po->shadow_image));
+	pixman_fixed_t sh = pixman_int_to_fixed(
+				pixman_image_get_height(po->shadow_image));
+	pixman_fixed_t one = pixman_fixed_1;
+
+	switch (po->shadow_transform) {
+	case WL_OUTPUT_TRANSFORM_90:
+		pixman_transform_init_identity(transform);
+		transform->matrix[0][0] = 0;
+		transform->matrix[0][1] = -one;
+		transform->matrix[0][2] = sw;
+		transform->matrix[1][0] = one;
+		transform->matrix[1][1] = 0;
+		break;
+	case WL_OUTPUT_TRANSFORM_180:
+		pixman_transform_init_scale(transform, -one, -one);
+		transform->matrix[0][2] = sw;
+		transform->matrix[1][2] = sh;
+		break;
+	case WL_OUTPUT_TRANSFORM_270:
+		pixman_transform_init_identity(transform);
+		transform->matrix[0][0] = 0;
+		transform->matrix[0][1] = one;
+		transform->matrix[1][0] = -one;
+		transform->matrix[1][1] = 0;
+		transform->matrix[1][2] = sh;
+		break;
+	default:
+		pixman_transform_init_identity(transform);
+		break;
 	}
 }
 
@@ -538,10 +1189,24 @@ copy_to_hw_buffer(struct weston_output *output, pixman_region32_t *region)
 {
 	struct pixman_output_state *po = get_output_state(output);
 	pixman_region32_t output_region;
+	pixman_transform_t transform;
 
 	pixman_region32_init(&output_region);
 	pixman_region32_copy(&output_region, region);
 
+	if (po->shadow_transform != WL_OUTPUT_TRANSFORM_NORMAL &&
+	    pixman_image_get_format(po->hw_buffer) == PIXMAN_x8r8g8b8) {
+		pixman_output_region_from_global(output, &output_region);
+		rotate_to_hw_buffer(po, &output_region);
+		pixman_region32_fini(&output_region);
+		return;
+	}
+
+	/* Other formats convert through pixman's transformed fetch */
+	shadow_rotation_to_pixman_transform(&transform, po);
+	if (po->shadow_transform != WL_OUTPUT_TRANSFORM_NORMAL)
+		pixman_image_set_transform(po->shadow_image, &transform);
+
 	weston_output_region_from_global(output, &output_region);
 
 	pixman_image_set_clip_region32 (po->hw_buffer, &output_region);
@@ -558,6 +1223,100 @@ copy_to_hw_buffer(struct weston_output *output, pixman_region32_t *region)
 				 pixman_image_get_height (po->hw_buffer) /* height */);
 
 	pixman_image_set_clip_region32 (po->hw_buffer, NULL);
+	pixman_image_set_transform(po->shadow_image, NULL);
+}
+
+static uint32_t
+shadow_transform_for_output(struct weston_output *output)
+{
+	switch (output->transform) {
+	case WL_OUTPUT_TRANSFORM_90:
+	case WL_OUTPUT_TRANSFORM_180:
+	case WL_OUTPUT_TRANSFORM_270:
+		return output->transform;
+	default:
+		/* Flips stay in the view transformations */
+		return WL_OUTPUT_TRANSFORM_NORMAL;
+	}
+}
+
+static int
+pixman_output_state_create_shadow(struct pixman_output_state *po,
+				  struct weston_output *output)
+{
+	uint32_t transform = shadow_transform_for_output(output);
+	void *buffer;
+	pixman_image_t *image;
+	int w, h;
+
+	w = output->current_mode->width;
+	h = output->current_mode->height;
+	if (transform == WL_OUTPUT_TRANSFORM_90 ||
+	    transform == WL_OUTPUT_TRANSFORM_270) {
+		w = output->current_mode->height;
+		h = output->current_mode->width;
+	}
+
+	buffer = malloc(w * h * 4);
+	if (!buffer)
+		return -1;
+
+	image = pixman_image_create_bits(PIXMAN_x8r8g8b8, w, h, buffer, w * 4);
+	if (!image) {
+		free(buffer);
+		return -1;
+	}
+
+	if (po->shadow_image)
+		pixman_image_unref(po->shadow_image);
+	free(po->shadow_buffer);
+
+	po->shadow_buffer = buffer;
+	po->shadow_image = image;
+	po->shadow_transform = transform;
+
+	return 0;
+}
+
+/** Follow the output transform with the shadow
+ *
+ * The shadow matrix is the output matrix with the rotation undone, so
+ * that views land unrotated in the shadow.
+ */
+static int
+pixman_output_state_update_shadow(struct pixman_output_state *po,
+				  struct weston_output *output)
+{
+	int sw, sh;
+
+	if (po->shadow_transform != shadow_transform_for_output(output) &&
+	    pixman_output_state_create_shadow(po, output) < 0)
+		return -1;
+
+	if (po->shadow_transform == WL_OUTPUT_TRANSFORM_NORMAL)
+		return 0;
+
+	sw = pixman_image_get_width(po->shadow_image);
+	sh = pixman_image_get_height(po->shadow_image);
+
+	po->shadow_matrix = output->matrix;
+	switch (po->shadow_transform) {
+	case WL_OUTPUT_TRANSFORM_90:
+		weston_matrix_rotate_xy(&po->shadow_matrix, 0, 1);
+		weston_matrix_translate(&po->shadow_matrix, sw, 0, 0);
+		break;
+	case WL_OUTPUT_TRANSFORM_180:
+		weston_matrix_rotate_xy(&po->shadow_matrix, -1, 0);
+		weston_matrix_translate(&po->shadow_matrix, sw, sh, 0);
+		break;
+	case WL_OUTPUT_TRANSFORM_270:
+		weston_matrix_rotate_xy(&po->shadow_matrix, 0, -1);
+		weston_matrix_translate(&po->shadow_matrix, 0, sh, 0);
+		break;
+	}
+	weston_matrix_invert(&po->shadow_inverse_matrix, &po->shadow_matrix);
+
+	return 0;
 }
 
 static void
@@ -565,6 +1324,7 @@ pixman_renderer_repaint_output(struct weston_output *output,
 			       pixman_region32_t *output_damage)
 {
 	struct pixman_output_state *po = get_output_state(output);
+	struct weston_plane *primary = &output->compositor->primary_plane;
 	pixman_region32_t hw_damage;
 
 	assert(output->from_blend_to_output_by_backend ||
@@ -575,6 +1335,14 @@ pixman_renderer_repaint_output(struct weston_output *output,
  		return;
 	}
 
+	if (po->shadow_image &&
+	    pixman_output_state_update_shadow(po, output) < 0) {
+		weston_log("Pixman renderer: failed to reallocate the shadow "
+			   "of %s\n", output->name);
+		po->hw_extra_damage = NULL;
+		return;
+	}
+
 	pixman_region32_init(&hw_damage);
 	if (po->hw_extra_damage) {
 		pixman_region32_union(&hw_damage,
@@ -584,12 +1352,26 @@ pixman_renderer_repaint_output(struct weston_output *output,
 		pixman_region32_copy(&hw_damage, output_damage);
 	}
 
+	/* What opaque overlays hide now is drawn once they move away. */
+	if (pixman_region32_not_empty(&primary->clip)) {
+		pixman_region32_t hidden;
+
+		pixman_region32_init(&hidden);
+		pixman_region32_intersect(&hidden, &hw_damage, &primary->clip);
+		pixman_region32_union(&primary->damage, &primary->damage,
+				      &hidden);
+		pixman_region32_subtract(&hw_damage, &hw_damage, &hidden);
+		pixman_region32_fini(&hidden);
+	}
+
+	output_dmabufs_sync(output, DMA_BUF_SYNC_START);
 	if (po->shadow_image) {
 		repaint_surfaces(output, output_damage);
 		copy_to_hw_buffer(output, &hw_damage);
 	} else {
 		repaint_surfaces(output, &hw_damage);
 	}
+	output_dmabufs_sync(output, DMA_BUF_SYNC_END);
 	pixman_region32_fini(&hw_damage);
 
 	wl_signal_emit(&output->frame_signal, output_damage);
@@ -597,10 +1379,11 @@ pixman_renderer_repaint_output(struct weston_output *output,
 	/* Actual flip should be done by caller */
 }
 
-static void
+static bool
 pixman_renderer_flush_damage(struct weston_surface *surface)
 {
-	/* No-op for pixman renderer */
+	/* Pixman composites straight from the buffer every time */
+	return false;
 }
 
 static void
@@ -615,15 +1398,177 @@ buffer_state_handle_buffer_destroy(struct wl_listener *listener, void *data)
 		pixman_image_unref(ps->image);
 		ps->image = NULL;
 	}
+	ps->dmabuf = NULL;
 
 	ps->buffer_destroy_listener.notify = NULL;
 }
 
+static void
+pixman_renderer_destroy_dmabuf(struct linux_dmabuf_buffer *dmabuf)
+{
+	struct pixman_dmabuf *data = linux_dmabuf_buffer_get_user_data(dmabuf);
+
+	munmap(data->map, data->map_size);
+	free(data);
+	linux_dmabuf_buffer_set_user_data(dmabuf, NULL, NULL);
+}
+
+/** Map a linear single-plane dmabuf pixman can read from directly
+ *
+ * The mapping lives as long as the buffer; contents are read through it
+ * on every repaint, bracketed by DMA_BUF_IOCTL_SYNC.
+ */
+static bool
+pixman_renderer_import_dmabuf(struct weston_compositor *ec,
+			      struct linux_dmabuf_buffer *dmabuf)
+{
+	struct dmabuf_attributes *attributes = &dmabuf->attributes;
+	const struct pixel_format_info *pixel_info;
+	struct pixman_dmabuf *data;
+	size_t size;
+	void *map;
+
+	if (attributes->n_planes != 1 ||
+	    attributes->modifier[0] != DRM_FORMAT_MOD_LINEAR ||
+	    attributes->flags != 0)
+		return false;
+
+	pixel_info = pixel_format_get_info(attributes->format);
+	if (!pixel_info ||
+	    !pixman_format_supported_source(pixel_info->pixman_format))
+		return false;
+
+	/* pixman addresses rows in whole 32-bit words */
+	if (attributes->stride[0] % sizeof(uint32_t) != 0)
+		return false;
+
+	size = (size_t) attributes->offset[0] +
+	       (size_t) attributes->stride[0] * attributes->height;
+	map = mmap(NULL, size, PROT_READ, MAP_SHARED, attributes->fd[0], 0);
+	if (map == MAP_FAILED) {
+		weston_log("pixman: failed to map dmabuf: %s\n",
+			   strerror(errno));
+		return false;
+	}
+
+	data = zalloc(sizeof *data);
+	if (!data) {
+		munmap(map, size);
+		return false;
+	}
+
+	data->map = map;
+	data->map_size = size;
+	data->pixman_format = pixel_info->pixman_format;
+	linux_dmabuf_buffer_set_user_data(dmabuf, data,
+					  pixman_renderer_destroy_dmabuf);
+
+	return true;
+}
+
+static const struct weston_drm_format_array *
+pixman_renderer_get_supported_formats(struct weston_compositor *ec)
+{
+	struct pixman_renderer *pr = get_renderer(ec);
+
+	return &pr->supported_formats;
+}
+
+static int
+populate_supported_formats(struct pixman_renderer *pr)
+{
+	const struct pixel_format_info *pixel_info;
+	struct weston_drm_format *fmt;
+	unsigned int i, num_formats;
+
+	num_formats = pixel_format_get_info_count();
+	for (i = 0; i < num_formats; i++) {
+		pixel_info = pixel_format_get_info_by_index(i);
+		if (!pixman_format_supported_source(pixel_info->pixman_format))
+			continue;
+
+		fmt = weston_drm_format_array_add_format(&pr->supported_formats,
+							 pixel_info->format);
+		if (!fmt ||
+		    weston_drm_format_add_modifier(fmt, DRM_FORMAT_MOD_LINEAR) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+static void
+dmabuf_sync(struct linux_dmabuf_buffer *dmabuf, uint64_t flags)
+{
+	struct dma_buf_sync sync = { .flags = flags };
+	int ret;
+
+	do {
+		ret = ioctl(dmabuf->attributes.fd[0], DMA_BUF_IOCTL_SYNC, &sync);
+	} while (ret < 0 && (errno == EINTR || errno == EAGAIN));
+}
+
+/* Make the CPU view of the dmabufs shown on output coherent while the
+ * renderer reads them. */
+static void
+output_dmabufs_sync(struct weston_output *output, uint64_t flags)
+{
+	struct weston_paint_node *pnode;
+	struct pixman_surface_state *ps;
+
+	wl_list_for_each(pnode, &output->paint_node_z_order_list, z_order_link) {
+		ps = pnode->surface->renderer_state;
+		if (ps && ps->dmabuf)
+			dmabuf_sync(ps->dmabuf, DMA_BUF_SYNC_READ | flags);
+	}
+}
+
+static void
+pixman_renderer_attach_dmabuf(struct weston_surface *es,
+			      struct weston_buffer *buffer,
+			      struct linux_dmabuf_buffer *dmabuf)
+{
+	struct pixman_surface_state *ps = get_surface_state(es);
+	struct dmabuf_attributes *attributes = &dmabuf->attributes;
+	struct pixman_dmabuf *data;
+
+	buffer->width = attributes->width;
+	buffer->height = attributes->height;
+
+	/* Scanned out by the backend, there is nothing to composite. */
+	if (dmabuf->direct_display)
+		return;
+
+	data = linux_dmabuf_buffer_get_user_data(dmabuf);
+	if (!data) {
+		weston_buffer_reference(&ps->buffer_ref, NULL);
+		weston_buffer_release_reference(&ps->buffer_release_ref, NULL);
+		linux_dmabuf_buffer_send_server_error(dmabuf,
+			"dmabuf was not imported by the pixman renderer");
+		return;
+	}
+
+	es->is_opaque = pixel_format_is_opaque(
+				pixel_format_get_info(attributes->format));
+
+	ps->image = pixman_image_create_bits(data->pixman_format,
+		buffer->width, buffer->height,
+		(uint32_t *) ((uint8_t *) data->map + attributes->offset[0]),
+		attributes->stride[0]);
+	ps->dmabuf = dmabuf;
+
+	ps->buffer_destroy_listener.notify =
+		buffer_state_handle_buffer_destroy;
+	wl_signal_add(&buffer->destroy_signal,
+		      &ps->buffer_destroy_listener);
+}
+
 static void
 pixman_renderer_attach(struct weston_surface *es, struct weston_buffer *buffer)
 {
 	struct pixman_surface_state *ps = get_surface_state(es);
 	struct wl_shm_buffer *shm_buffer;
+	struct linux_dmabuf_buffer *dmabuf;
 	const struct pixel_format_info *pixel_info;
 
 	weston_buffer_reference(&ps->buffer_ref, buffer);
@@ -639,12 +1584,18 @@ pixman_renderer_attach(struct weston_surface *es, struct weston_buffer *buffer)
 		pixman_image_unref(ps->image);
 		ps->image = NULL;
 	}
+	ps->dmabuf = NULL;
 
 	if (!buffer)
 		return;
 
 	shm_buffer = wl_shm_buffer_get(buffer->resource);
 
+	if (!shm_buffer && (dmabuf = linux_dmabuf_buffer_get(buffer->resource))) {
+		pixman_renderer_attach_dmabuf(es, buffer, dmabuf);
+		return;
+	}
+
 	if (! shm_buffer) {
 		weston_log("Pixman renderer supports only SHM buffers\n");
 		weston_buffer_reference(&ps->buffer_ref, NULL);
@@ -767,6 +1718,7 @@ pixman_renderer_surface_set_color(struct weston_surface *es,
 		ps->image = NULL;
 	}
 
+	ps->solid_color = color;
 	ps->image = pixman_image_create_solid_fill(&color);
 }
 
@@ -777,6 +1729,7 @@ pixman_renderer_destroy(struct weston_compositor *ec)
 
 	wl_signal_emit(&pr->destroy_signal, pr);
 	weston_binding_destroy(pr->debug_binding);
+	weston_drm_format_array_fini(&pr->supported_formats);
 	free(pr);
 
 	ec->renderer = NULL;
@@ -814,6 +1767,8 @@ pixman_renderer_surface_copy_content(struct weston_surface *surface,
 	out_buf = pixman_image_create_bits(format, width, height,
 					   target, width * bytespp);
 
+	if (ps->dmabuf)
+		dmabuf_sync(ps->dmabuf, DMA_BUF_SYNC_START | DMA_BUF_SYNC_READ);
 	pixman_image_set_transform(ps->image, NULL);
 	pixman_image_composite32(PIXMAN_OP_SRC,
 				 ps->image,    /* src */
@@ -823,6 +1778,8 @@ pixman_renderer_surface_copy_content(struct weston_surface *surface,
 				 0, 0,         /* mask_x, mask_y */
 				 0, 0,         /* dest_x, dest_y */
 				 width, height);
+	if (ps->dmabuf)
+		dmabuf_sync(ps->dmabuf, DMA_BUF_SYNC_END | DMA_BUF_SYNC_READ);
 
 	pixman_image_unref(out_buf);
 
@@ -873,6 +1830,15 @@ pixman_renderer_init(struct weston_compositor *ec)
 		pixman_renderer_surface_get_content_size;
 	renderer->base.surface_copy_content =
 		pixman_renderer_surface_copy_content;
+	renderer->base.import_dmabuf = pixman_renderer_import_dmabuf;
+	renderer->base.get_supported_formats =
+		pixman_renderer_get_supported_formats;
+	weston_drm_format_array_init(&renderer->supported_formats);
+	if (populate_supported_formats(renderer) < 0) {
+		weston_drm_format_array_fini(&renderer->supported_formats);
+		free(renderer);
+		return -1;
+	}
 	ec->renderer = &renderer->base;
 	ec->capabilities |= WESTON_CAP_ROTATION_ANY;
 	ec->capabilities |= WESTON_CAP_VIEW_CLIP_MASK;
@@ -927,40 +1893,96 @@ pixman_renderer_output_set_hw_extra_damage(struct weston_output *output,
 	po->hw_extra_damage = extra_damage;
 }
 
+static void
+pixman_renderer_output_stop_workers(struct pixman_output_state *po)
+{
+	unsigned int i;
+
+	if (!po->workers)
+		return;
+
+	pthread_mutex_lock(&po->work_mutex);
+	po->work_quit = true;
+	pthread_cond_broadcast(&po->work_cond);
+	pthread_mutex_unlock(&po->work_mutex);
+
+	for (i = 0; i < po->n_workers; i++)
+		pthread_join(po->workers[i].thread, NULL);
+
+	pthread_cond_destroy(&po->done_cond);
+	pthread_cond_destroy(&po->work_cond);
+	pthread_mutex_destroy(&po->work_mutex);
+
+	free(po->workers);
+	po->workers = NULL;
+	po->n_workers = 0;
+}
+
+static int
+pixman_renderer_output_start_workers(struct pixman_output_state *po,
+				     unsigned int n_workers)
+{
+	sigset_t all, saved;
+	unsigned int i;
+	int ret = 0;
+
+	po->workers = zalloc(n_workers * sizeof *po->workers);
+	if (!po->workers)
+		return -1;
+
+	pthread_mutex_init(&po->work_mutex, NULL);
+	pthread_cond_init(&po->work_cond, NULL);
+	pthread_cond_init(&po->done_cond, NULL);
+
+	/* Signals are for the compositor thread only */
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, &saved);
+
+	/* Worker i paints band i + 1 */
+	for (i = 0; i < n_workers; i++) {
+		po->workers[i].po = po;
+		po->workers[i].index = i + 1;
+		if (pthread_create(&po->workers[i].thread, NULL,
+				   repaint_worker_thread,
+				   &po->workers[i]) != 0) {
+			ret = -1;
+			break;
+		}
+		po->n_workers++;
+	}
+
+	pthread_sigmask(SIG_SETMASK, &saved, NULL);
+
+	if (ret < 0)
+		pixman_renderer_output_stop_workers(po);
+
+	return ret;
+}
+
 WL_EXPORT int
 pixman_renderer_output_create(struct weston_output *output,
 			      const struct pixman_renderer_output_options *options)
 {
 	struct pixman_output_state *po;
-	int w, h;
+	unsigned int n_threads;
 
 	po = zalloc(sizeof *po);
 	if (po == NULL)
 		return -1;
 
-	if (options->use_shadow) {
-		/* set shadow image transformation */
-		w = output->current_mode->width;
-		h = output->current_mode->height;
-
-		po->shadow_buffer = malloc(w * h * 4);
-
-		if (!po->shadow_buffer) {
-			free(po);
-			return -1;
-		}
-
-		po->shadow_image =
-			pixman_image_create_bits(PIXMAN_x8r8g8b8, w, h,
-						 po->shadow_buffer, w * 4);
-
-		if (!po->shadow_image) {
-			free(po->shadow_buffer);
-			free(po);
-			return -1;
-		}
+	if (options->use_shadow &&
+	    pixman_output_state_create_shadow(po, output) < 0) {
+		free(po);
+		return -1;
 	}
 
+	n_threads = MIN(options->repaint_threads, PIXMAN_REPAINT_THREADS_MAX);
+	if (n_threads > 1 &&
+	    pixman_renderer_output_start_workers(po, n_threads - 1) < 0)
+		weston_log("Pixman renderer: failed to start repaint "
+			   "threads, painting %s single-threaded\n",
+			   output->name);
+
 	output->renderer_state = po;
 
 	return 0;
@@ -971,6 +1993,8 @@ pixman_renderer_output_destroy(struct weston_output *output)
 {
 	struct pixman_output_state *po = get_output_state(output);
 
+	pixman_renderer_output_stop_workers(po);
+
 	if (po->shadow_image)
 		pixman_image_unref(po->shadow_image);
 
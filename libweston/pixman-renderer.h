@@ -33,8 +33,13 @@ int
 pixman_renderer_init(struct weston_compositor *ec);
 
 struct pixman_renderer_output_options {
-	/** Composite into a shadow buffer, copying to the hardware buffer */
+	/** Composite into a shadow buffer, copying to the hardware buffer;
+	 * with a 90, 180 or 270 degree output transform the shadow stays
+	 * unrotated and the copy rotates */
 	bool use_shadow;
+	/** Threads compositing horizontal bands of the damage in parallel,
+	 * including the compositor thread; 0 or 1 paints single-threaded */
+	unsigned int repaint_threads;
 };
 
 int
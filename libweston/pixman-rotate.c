@@ -0,0 +1,239 @@
+/*
+ * Copyright © 2022 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#define PIXMAN_ROTATE_NEON 1
+#endif
+
+#include "pixman-rotate.h"
+#include "shared/helpers.h"
+
+/* Side of the square tiles a block is walked in. A tile of source and
+ * its rotated destination, 4 KiB each, stay in L1 while the tile is
+ * transposed, instead of every destination row being evicted between
+ * two consecutive source rows. */
+#define PIXMAN_ROTATE_TILE 32
+
+#if defined(PIXMAN_ROTATE_NEON)
+static bool use_simd = true;
+#else
+static bool use_simd = false;
+#endif
+
+bool
+pixman_rotate_simd_enable(bool enable)
+{
+#if defined(PIXMAN_ROTATE_NEON)
+	use_simd = enable;
+#endif
+	return use_simd;
+}
+
+#if defined(PIXMAN_ROTATE_NEON)
+/* Load the 4x4 block of src at (x, y) and store its columns in c[] */
+static inline void
+load_transposed_4x4(uint32x4_t c[4], const uint32_t *src, int src_stride,
+		    int x, int y)
+{
+	uint32x4x2_t t01, t23;
+
+	t01 = vtrnq_u32(vld1q_u32(&src[(y + 0) * src_stride + x]),
+			vld1q_u32(&src[(y + 1) * src_stride + x]));
+	t23 = vtrnq_u32(vld1q_u32(&src[(y + 2) * src_stride + x]),
+			vld1q_u32(&src[(y + 3) * src_stride + x]));
+
+	c[0] = vcombine_u32(vget_low_u32(t01.val[0]), vget_low_u32(t23.val[0]));
+	c[1] = vcombine_u32(vget_low_u32(t01.val[1]), vget_low_u32(t23.val[1]));
+	c[2] = vcombine_u32(vget_high_u32(t01.val[0]), vget_high_u32(t23.val[0]));
+	c[3] = vcombine_u32(vget_high_u32(t01.val[1]), vget_high_u32(t23.val[1]));
+}
+
+static inline uint32x4_t
+reverse_4(uint32x4_t v)
+{
+	v = vrev64q_u32(v);
+
+	return vcombine_u32(vget_high_u32(v), vget_low_u32(v));
+}
+#endif
+
+/* Rotate the [x0, x1) x [y0, y1) part of the block pixel by pixel */
+static void
+rotate_90_scalar(uint32_t *dst, int dst_stride,
+		 const uint32_t *src, int src_stride, int width,
+		 int x0, int x1, int y0, int y1)
+{
+	int x, y;
+
+	for (x = x0; x < x1; x++) {
+		uint32_t *d = &dst[(width - 1 - x) * dst_stride];
+
+		for (y = y0; y < y1; y++)
+			d[y] = src[y * src_stride + x];
+	}
+}
+
+static void
+rotate_270_scalar(uint32_t *dst, int dst_stride,
+		  const uint32_t *src, int src_stride, int height,
+		  int x0, int x1, int y0, int y1)
+{
+	int x, y;
+
+	for (x = x0; x < x1; x++) {
+		uint32_t *d = &dst[x * dst_stride + height - 1];
+
+		for (y = y0; y < y1; y++)
+			d[-y] = src[y * src_stride + x];
+	}
+}
+
+static void
+rotate_90_tile(uint32_t *dst, int dst_stride,
+	       const uint32_t *src, int src_stride, int width,
+	       int x0, int x1, int y0, int y1)
+{
+	int x = x0, y = y0;
+
+#if defined(PIXMAN_ROTATE_NEON)
+	if (use_simd) {
+		int x4 = x0 + ((x1 - x0) & ~3);
+		int y4 = y0 + ((y1 - y0) & ~3);
+		uint32x4_t c[4];
+		int i;
+
+		for (y = y0; y < y4; y += 4) {
+			for (x = x0; x < x4; x += 4) {
+				load_transposed_4x4(c, src, src_stride, x, y);
+				for (i = 0; i < 4; i++)
+					vst1q_u32(&dst[(width - 1 - x - i) *
+						       dst_stride + y], c[i]);
+			}
+		}
+
+		/* right and bottom edges of the tile */
+		rotate_90_scalar(dst, dst_stride, src, src_stride, width,
+				 x4, x1, y0, y1);
+		x = x0;
+		y = y4;
+		x1 = x4;
+	}
+#endif
+
+	rotate_90_scalar(dst, dst_stride, src, src_stride, width,
+			 x, x1, y, y1);
+}
+
+static void
+rotate_270_tile(uint32_t *dst, int dst_stride,
+		const uint32_t *src, int src_stride, int height,
+		int x0, int x1, int y0, int y1)
+{
+	int x = x0, y = y0;
+
+#if defined(PIXMAN_ROTATE_NEON)
+	if (use_simd) {
+		int x4 = x0 + ((x1 - x0) & ~3);
+		int y4 = y0 + ((y1 - y0) & ~3);
+		uint32x4_t c[4];
+		int i;
+
+		for (y = y0; y < y4; y += 4) {
+			for (x = x0; x < x4; x += 4) {
+				load_transposed_4x4(c, src, src_stride, x, y);
+				for (i = 0; i < 4; i++)
+					vst1q_u32(&dst[(x + i) * dst_stride +
+						       height - 4 - y],
+						  reverse_4(c[i]));
+			}
+		}
+
+		rotate_270_scalar(dst, dst_stride, src, src_stride, height,
+				  x4, x1, y0, y1);
+		x = x0;
+		y = y4;
+		x1 = x4;
+	}
+#endif
+
+	rotate_270_scalar(dst, dst_stride, src, src_stride, height,
+			  x, x1, y, y1);
+}
+
+void
+pixman_rotate_90(uint32_t *dst, int dst_stride,
+		 const uint32_t *src, int src_stride, int width, int height)
+{
+	int tx, ty;
+
+	for (ty = 0; ty < height; ty += PIXMAN_ROTATE_TILE)
+		for (tx = 0; tx < width; tx += PIXMAN_ROTATE_TILE)
+			rotate_90_tile(dst, dst_stride, src, src_stride, width,
+				       tx, MIN(tx + PIXMAN_ROTATE_TILE, width),
+				       ty, MIN(ty + PIXMAN_ROTATE_TILE, height));
+}
+
+void
+pixman_rotate_270(uint32_t *dst, int dst_stride,
+		  const uint32_t *src, int src_stride, int width, int height)
+{
+	int tx, ty;
+
+	for (ty = 0; ty < height; ty += PIXMAN_ROTATE_TILE)
+		for (tx = 0; tx < width; tx += PIXMAN_ROTATE_TILE)
+			rotate_270_tile(dst, dst_stride, src, src_stride, height,
+					tx, MIN(tx + PIXMAN_ROTATE_TILE, width),
+					ty, MIN(ty + PIXMAN_ROTATE_TILE, height));
+}
+
+void
+pixman_rotate_180(uint32_t *dst, int dst_stride,
+		  const uint32_t *src, int src_stride, int width, int height)
+{
+	int x, y;
+
+	/* Both sides are walked row by row, so there is nothing to gain
+	 * from tiling. */
+	for (y = 0; y < height; y++) {
+		const uint32_t *s = &src[y * src_stride];
+		uint32_t *d = &dst[(height - 1 - y) * dst_stride + width - 1];
+
+		x = 0;
+#if defined(PIXMAN_ROTATE_NEON)
+		if (use_simd) {
+			for (; x + 4 <= width; x += 4)
+				vst1q_u32(&d[-x - 3], reverse_4(vld1q_u32(&s[x])));
+		}
+#endif
+		for (; x < width; x++)
+			d[-x] = s[x];
+	}
+}
@@ -0,0 +1,69 @@
+/*
+ * Copyright © 2022 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef _WESTON_PIXMAN_ROTATE_H
+#define _WESTON_PIXMAN_ROTATE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/** Select the NEON or the scalar implementation
+ *
+ * NEON is used by default when the build target has it. Both paths
+ * produce identical results.
+ *
+ * \return True if the NEON implementation is now in use.
+ */
+bool
+pixman_rotate_simd_enable(bool enable);
+
+/** Rotate a block of 32-bit pixels by 90 degrees counter-clockwise
+ *
+ * The width x height block at src is stored as a height x width block
+ * at dst, with dst[(width - 1 - x) * dst_stride + y] = src[y * src_stride
+ * + x]. This is what WL_OUTPUT_TRANSFORM_90 does to the output contents.
+ * Strides are in pixels.
+ */
+void
+pixman_rotate_90(uint32_t *dst, int dst_stride,
+		 const uint32_t *src, int src_stride, int width, int height);
+
+/** Rotate a block of 32-bit pixels by 180 degrees
+ *
+ * dst[(height - 1 - y) * dst_stride + width - 1 - x] =
+ * src[y * src_stride + x]
+ */
+void
+pixman_rotate_180(uint32_t *dst, int dst_stride,
+		  const uint32_t *src, int src_stride, int width, int height);
+
+/** Rotate a block of 32-bit pixels by 270 degrees counter-clockwise
+ *
+ * dst[x * dst_stride + height - 1 - y] = src[y * src_stride + x]
+ */
+void
+pixman_rotate_270(uint32_t *dst, int dst_stride,
+		  const uint32_t *src, int src_stride, int width, int height);
+
+#endif
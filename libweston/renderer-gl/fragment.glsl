@@ -46,10 +46,19 @@
 #define SHADER_COLOR_CURVE_IDENTITY 0
 #define SHADER_COLOR_CURVE_LUT_3x1D 1
 
+/* enum gl_shader_color_mapping */
+#define SHADER_COLOR_MAPPING_IDENTITY 0
+#define SHADER_COLOR_MAPPING_3DLUT 1
+#define SHADER_COLOR_MAPPING_MATRIX 2
+
 #if DEF_VARIANT == SHADER_VARIANT_EXTERNAL
 #extension GL_OES_EGL_image_external : require
 #endif
 
+#if DEF_COLOR_MAPPING == SHADER_COLOR_MAPPING_3DLUT
+#extension GL_OES_texture_3D : require
+#endif
+
 #ifdef GL_FRAGMENT_PRECISION_HIGH
 #define HIGHPRECISION highp
 #else
@@ -66,6 +75,8 @@ compile_const int c_variant = DEF_VARIANT;
 compile_const bool c_input_is_premult = DEF_INPUT_IS_PREMULT;
 compile_const bool c_green_tint = DEF_GREEN_TINT;
 compile_const int c_color_pre_curve = DEF_COLOR_PRE_CURVE;
+compile_const int c_color_mapping = DEF_COLOR_MAPPING;
+compile_const int c_color_post_curve = DEF_COLOR_POST_CURVE;
 
 vec4
 yuva2rgba(vec4 yuva)
@@ -109,6 +120,13 @@ uniform float alpha;
 uniform vec4 unicolor;
 uniform HIGHPRECISION sampler2D color_pre_curve_lut_2d;
 uniform HIGHPRECISION vec2 color_pre_curve_lut_scale_offset;
+#if DEF_COLOR_MAPPING == SHADER_COLOR_MAPPING_3DLUT
+uniform HIGHPRECISION sampler3D color_mapping_lut_3d;
+#endif
+uniform HIGHPRECISION vec2 color_mapping_lut_scale_offset;
+uniform HIGHPRECISION mat3 color_mapping_matrix;
+uniform HIGHPRECISION sampler2D color_post_curve_lut_2d;
+uniform HIGHPRECISION vec2 color_post_curve_lut_scale_offset;
 
 vec4
 sample_input_texture()
@@ -199,6 +217,62 @@ color_pre_curve(vec3 color)
 	}
 }
 
+vec3
+sample_color_mapping_lut_3d(vec3 color)
+{
+#if DEF_COLOR_MAPPING == SHADER_COLOR_MAPPING_3DLUT
+	vec3 pos = color * color_mapping_lut_scale_offset.s +
+		   color_mapping_lut_scale_offset.t;
+
+	return texture3D(color_mapping_lut_3d, pos).rgb;
+#else
+	/* Never reached, the LUT is not declared. */
+	return vec3(1.0, 0.3, 1.0);
+#endif
+}
+
+vec3
+color_mapping(vec3 color)
+{
+	if (c_color_mapping == SHADER_COLOR_MAPPING_IDENTITY)
+		return color;
+	else if (c_color_mapping == SHADER_COLOR_MAPPING_3DLUT)
+		return sample_color_mapping_lut_3d(color);
+	else if (c_color_mapping == SHADER_COLOR_MAPPING_MATRIX)
+		return color_mapping_matrix * color;
+	else
+		/* Never reached, bad c_color_mapping. */
+		return vec3(1.0, 0.3, 1.0);
+}
+
+/* Same layout as the pre-curve LUT, see sample_color_pre_curve_lut_2d(). */
+float
+sample_color_post_curve_lut_2d(float x, compile_const int row)
+{
+	float tx = lut_texcoord(x, color_post_curve_lut_scale_offset);
+
+	return texture2D(color_post_curve_lut_2d,
+			 vec2(tx, (float(row) + 0.5) / 4.0)).x;
+}
+
+vec3
+color_post_curve(vec3 color)
+{
+	vec3 ret;
+
+	if (c_color_post_curve == SHADER_COLOR_CURVE_IDENTITY) {
+		return color;
+	} else if (c_color_post_curve == SHADER_COLOR_CURVE_LUT_3x1D) {
+		ret.r = sample_color_post_curve_lut_2d(color.r, 0);
+		ret.g = sample_color_post_curve_lut_2d(color.g, 1);
+		ret.b = sample_color_post_curve_lut_2d(color.b, 2);
+		return ret;
+	} else {
+		/* Never reached, bad c_color_post_curve. */
+		return vec3(1.0, 0.3, 1.0);
+	}
+}
+
 vec4
 color_pipeline(vec4 color)
 {
@@ -206,6 +280,8 @@ color_pipeline(vec4 color)
 	color.a *= alpha;
 
 	color.rgb = color_pre_curve(color.rgb);
+	color.rgb = color_mapping(color.rgb);
+	color.rgb = color_post_curve(color.rgb);
 
 	return color;
 }
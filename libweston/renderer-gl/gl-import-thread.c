@@ -0,0 +1,211 @@
+/*
+ * Copyright © 2022 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include <libweston/libweston.h>
+#include <libweston/weston-log.h>
+#include "gl-renderer.h"
+#include "gl-renderer-internal.h"
+
+/**
+ * A thread running slow EGL imports on behalf of the main loop
+ *
+ * EGLImages of dmabufs are created without a context, so the worker needs
+ * no EGL state of its own. Jobs are run in order; their completion is
+ * handed back to the main loop through an eventfd.
+ */
+struct gl_import_thread {
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+
+	/* Protected by lock */
+	struct wl_list queue;
+	struct wl_list done;
+	bool quit;
+
+	int done_fd;
+	struct wl_event_source *done_source;
+};
+
+static void *
+gl_import_thread_func(void *data)
+{
+	struct gl_import_thread *it = data;
+	struct gl_import_job *job;
+	uint64_t value = 1;
+
+	pthread_mutex_lock(&it->lock);
+	for (;;) {
+		while (wl_list_empty(&it->queue) && !it->quit)
+			pthread_cond_wait(&it->cond, &it->lock);
+		if (it->quit)
+			break;
+
+		job = container_of(it->queue.next, struct gl_import_job, link);
+		wl_list_remove(&job->link);
+		pthread_mutex_unlock(&it->lock);
+
+		job->run(job);
+
+		pthread_mutex_lock(&it->lock);
+		wl_list_insert(it->done.prev, &job->link);
+
+		/* Only fails if the counter overflowed, which wakes the
+		 * main loop just as well. */
+		if (write(it->done_fd, &value, sizeof value) < 0)
+			continue;
+	}
+	pthread_mutex_unlock(&it->lock);
+
+	return NULL;
+}
+
+static void
+gl_import_thread_reap(struct gl_import_thread *it)
+{
+	struct gl_import_job *job, *tmp;
+	struct wl_list done;
+	uint64_t value;
+
+	wl_list_init(&done);
+
+	pthread_mutex_lock(&it->lock);
+	wl_list_insert_list(&done, &it->done);
+	wl_list_init(&it->done);
+	if (read(it->done_fd, &value, sizeof value) < 0 && errno != EAGAIN)
+		weston_log("failed to read import thread events: %s\n",
+			   strerror(errno));
+	pthread_mutex_unlock(&it->lock);
+
+	wl_list_for_each_safe(job, tmp, &done, link) {
+		wl_list_remove(&job->link);
+		job->complete(job, false);
+	}
+}
+
+static int
+gl_import_thread_done(int fd, uint32_t mask, void *data)
+{
+	gl_import_thread_reap(data);
+
+	return 0;
+}
+
+/** Queue a job, whose complete() is then called exactly once */
+void
+gl_import_thread_queue(struct gl_import_thread *it, struct gl_import_job *job)
+{
+	pthread_mutex_lock(&it->lock);
+	wl_list_insert(it->queue.prev, &job->link);
+	pthread_cond_broadcast(&it->cond);
+	pthread_mutex_unlock(&it->lock);
+}
+
+struct gl_import_thread *
+gl_import_thread_create(struct wl_event_loop *loop)
+{
+	struct gl_import_thread *it;
+	sigset_t set, oldset;
+	int ret;
+
+	it = zalloc(sizeof *it);
+	if (!it)
+		return NULL;
+
+	wl_list_init(&it->queue);
+	wl_list_init(&it->done);
+
+	it->done_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (it->done_fd < 0)
+		goto err_free;
+
+	it->done_source = wl_event_loop_add_fd(loop, it->done_fd,
+					       WL_EVENT_READABLE,
+					       gl_import_thread_done, it);
+	if (!it->done_source)
+		goto err_fd;
+
+	pthread_mutex_init(&it->lock, NULL);
+	pthread_cond_init(&it->cond, NULL);
+
+	/* Signals are handled by the main loop only. */
+	sigfillset(&set);
+	pthread_sigmask(SIG_SETMASK, &set, &oldset);
+	ret = pthread_create(&it->thread, NULL, gl_import_thread_func, it);
+	pthread_sigmask(SIG_SETMASK, &oldset, NULL);
+	if (ret != 0) {
+		weston_log("failed to start import thread: %s\n",
+			   strerror(ret));
+		goto err_source;
+	}
+
+	return it;
+
+err_source:
+	pthread_cond_destroy(&it->cond);
+	pthread_mutex_destroy(&it->lock);
+	wl_event_source_remove(it->done_source);
+err_fd:
+	close(it->done_fd);
+err_free:
+	free(it);
+	return NULL;
+}
+
+/** Stop the thread; finished jobs complete, the others are cancelled */
+void
+gl_import_thread_destroy(struct gl_import_thread *it)
+{
+	struct gl_import_job *job, *tmp;
+
+	pthread_mutex_lock(&it->lock);
+	it->quit = true;
+	pthread_cond_broadcast(&it->cond);
+	pthread_mutex_unlock(&it->lock);
+	pthread_join(it->thread, NULL);
+
+	gl_import_thread_reap(it);
+	wl_list_for_each_safe(job, tmp, &it->queue, link) {
+		wl_list_remove(&job->link);
+		job->complete(job, true);
+	}
+
+	pthread_cond_destroy(&it->cond);
+	pthread_mutex_destroy(&it->lock);
+	wl_event_source_remove(it->done_source);
+	close(it->done_fd);
+	free(it);
+}
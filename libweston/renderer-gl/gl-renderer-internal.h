@@ -37,6 +37,10 @@
 #include "shared/weston-egl-ext.h"  /* for PFN* stuff */
 #include "shared/helpers.h"
 
+#ifndef GL_EXT_texture_storage
+typedef void (GL_APIENTRYP PFNGLTEXSTORAGE2DEXTPROC) (GLenum target, GLsizei levels, GLenum internalformat, GLsizei width, GLsizei height);
+#endif
+
 enum gl_shader_texture_variant {
 	SHADER_VARIANT_NONE = 0,
 /* Keep the following in sync with fragment.glsl. */
@@ -56,6 +60,13 @@ enum gl_shader_color_curve {
 	SHADER_COLOR_CURVE_LUT_3x1D,
 };
 
+/* Keep the following in sync with fragment.glsl. */
+enum gl_shader_color_mapping {
+	SHADER_COLOR_MAPPING_IDENTITY = 0,
+	SHADER_COLOR_MAPPING_3DLUT,
+	SHADER_COLOR_MAPPING_MATRIX,
+};
+
 /** GL shader requirements key
  *
  * This structure is used as a binary blob key for building and searching
@@ -71,12 +82,14 @@ struct gl_shader_requirements
 	bool input_is_premult:1;
 	bool green_tint:1;
 	unsigned color_pre_curve:1; /* enum gl_shader_color_curve */
+	unsigned color_mapping:2; /* enum gl_shader_color_mapping */
+	unsigned color_post_curve:1; /* enum gl_shader_color_curve */
 
 	/*
 	 * The total size of all bitfields plus pad_bits_ must fill up exactly
 	 * how many bytes the compiler allocates for them together.
 	 */
-	unsigned pad_bits_:25;
+	unsigned pad_bits_:22;
 };
 static_assert(sizeof(struct gl_shader_requirements) ==
 	      4 /* total bitfield size in bytes */,
@@ -96,6 +109,11 @@ struct gl_shader_config {
 	GLuint input_tex[GL_SHADER_INPUT_TEX_MAX];
 	GLuint color_pre_curve_lut_tex;
 	GLfloat color_pre_curve_lut_scale_offset[2];
+	GLuint color_mapping_lut_tex;
+	GLfloat color_mapping_lut_scale_offset[2];
+	GLfloat color_mapping_matrix[9];
+	GLuint color_post_curve_lut_tex;
+	GLfloat color_post_curve_lut_scale_offset[2];
 };
 
 struct gl_renderer {
@@ -118,6 +136,18 @@ struct gl_renderer {
 
 	struct wl_array vertices;
 	struct wl_array vtxcnt;
+	struct wl_array indices;
+
+	/** Geometry of consecutive repaint regions sharing a shader config
+	 * and blend state, drawn with a single call on flush.
+	 */
+	struct {
+		bool active;
+		bool blend;
+		struct gl_shader_config sconf;
+		struct weston_view *view;
+		struct weston_output *output;
+	} batch;
 
 	EGLDeviceEXT egl_device;
 	const char *drm_device;
@@ -153,10 +183,56 @@ struct gl_renderer {
 	bool has_dmabuf_import;
 	struct wl_list dmabuf_images;
 	struct wl_list dmabuf_formats;
+	/** EGLImages of released dmabufs, most recently released first */
+	struct wl_list dmabuf_cache;
+	unsigned int dmabuf_cache_len;
 
 	bool has_texture_type_2_10_10_10_rev;
 	bool has_gl_texture_rg;
 
+	/** Ring of pixel unpack buffers for streaming wl_shm uploads */
+	bool has_pbo_upload;
+	GLuint upload_pbo[3];
+	unsigned int upload_pbo_next;
+
+	/** glTexStorage2D or glTexStorage2DEXT, immutable wl_shm textures */
+	PFNGLTEXSTORAGE2DEXTPROC tex_storage_2d;
+	/** GL_BGRA8_EXT is only a storage format with GL_EXT_texture_storage */
+	bool has_bgra8_storage;
+	GLint max_texture_size;
+	/** Released wl_shm textures, most recently released first */
+	struct wl_list texture_pool; /* gl_pooled_texture::link */
+	size_t texture_pool_bytes;
+	uint64_t texture_pool_reuses;
+	uint64_t texture_pool_allocs;
+
+	/** All gl_surface_states, for texture eviction */
+	struct wl_list surface_state_list;
+	/** Count of gl_renderer_repaint_output calls */
+	uint64_t frame_counter;
+	/** Resident wl_shm texture memory, in bytes */
+	size_t texture_bytes;
+	size_t texture_bytes_peak;
+	/** Estimated size of imported client buffers, in bytes */
+	size_t import_bytes;
+	size_t import_bytes_peak;
+	/** Output shadow framebuffers, in bytes */
+	size_t fbo_bytes;
+	size_t fbo_bytes_peak;
+	struct wl_list client_memory_list; /* gl_client_memory::link */
+	struct weston_log_scope *memory_scope;
+	struct wl_listener metrics_listener;
+
+	/** GL_EXT_disjoint_timer_query, for the GPU time of each view */
+	bool has_disjoint_timer_query;
+	PFNGLGENQUERIESEXTPROC gen_queries;
+	PFNGLDELETEQUERIESEXTPROC delete_queries;
+	PFNGLQUERYCOUNTEREXTPROC query_counter;
+	PFNGLGETQUERYOBJECTUIVEXTPROC get_query_objectuiv;
+	PFNGLGETQUERYOBJECTUI64VEXTPROC get_query_objectui64v;
+	PFNGLGETINTEGER64VEXTPROC get_integer64v;
+	struct weston_log_scope *gpu_time_scope;
+
 	struct gl_shader *current_shader;
 	struct gl_shader *fallback_shader;
 
@@ -186,6 +262,19 @@ struct gl_renderer {
 	 */
 	struct wl_list shader_list;
 	struct weston_log_scope *shader_scope;
+
+	/** On-disk program binary cache, NULL directory if disabled */
+	char *shader_cache_dir;
+	uint64_t shader_cache_key;
+	PFNGLGETPROGRAMBINARYOESPROC get_program_binary;
+	PFNGLPROGRAMBINARYOESPROC program_binary;
+
+	/** Idle source compiling the commonly needed programs at start-up */
+	struct wl_event_source *shader_warmup_source;
+	unsigned int shader_warmup_next;
+
+	/** Creates dmabuf EGLImages off the main loop, started on demand */
+	struct gl_import_thread *import_thread;
 };
 
 static inline struct gl_renderer *
@@ -224,6 +313,9 @@ gl_shader_texture_variant_get_target(enum gl_shader_texture_variant v);
 bool
 gl_shader_texture_variant_can_be_premult(enum gl_shader_texture_variant v);
 
+bool
+gl_shader_texture_variant_is_yuv(enum gl_shader_texture_variant v);
+
 void
 gl_shader_destroy(struct gl_renderer *gr, struct gl_shader *shader);
 
@@ -236,6 +328,9 @@ gl_renderer_create_fallback_shader(struct gl_renderer *gr);
 void
 gl_renderer_garbage_collect_programs(struct gl_renderer *gr);
 
+unsigned int
+gl_renderer_trim_programs(struct gl_renderer *gr);
+
 bool
 gl_renderer_use_program(struct gl_renderer *gr,
 			const struct gl_shader_config *sconf);
@@ -243,8 +338,36 @@ gl_renderer_use_program(struct gl_renderer *gr,
 struct weston_log_scope *
 gl_shader_scope_create(struct gl_renderer *gr);
 
+void
+gl_shader_cache_init(struct gl_renderer *gr, const char *extensions);
+
+void
+gl_shader_cache_fini(struct gl_renderer *gr);
+
 bool
 gl_shader_config_set_color_transform(struct gl_shader_config *sconf,
 				     struct weston_color_transform *xform);
 
+struct gl_import_thread;
+
+/** Work for the import thread */
+struct gl_import_job {
+	struct wl_list link; /* gl_import_thread queue or done list */
+
+	/** Runs on the import thread */
+	void (*run)(struct gl_import_job *job);
+	/** Runs on the main loop after run(), or with cancelled set instead
+	 * of it if the thread is destroyed first */
+	void (*complete)(struct gl_import_job *job, bool cancelled);
+};
+
+struct gl_import_thread *
+gl_import_thread_create(struct wl_event_loop *loop);
+
+void
+gl_import_thread_destroy(struct gl_import_thread *it);
+
+void
+gl_import_thread_queue(struct gl_import_thread *it, struct gl_import_job *job);
+
 #endif /* GL_RENDERER_INTERNAL_H */
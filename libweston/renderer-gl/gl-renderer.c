@@ -31,6 +31,7 @@
 #include <GLES2/gl2ext.h>
 #include <GLES3/gl3.h>
 
+#include <inttypes.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
@@ -46,9 +47,12 @@
 #include "timeline.h"
 
 #include "color.h"
+#include "damage-simplify.h"
+#include "frame-arena.h"
 #include "gl-renderer.h"
 #include "gl-renderer-internal.h"
 #include "vertex-clipping.h"
+#include "watchdog.h"
 #include "linux-dmabuf.h"
 #include "linux-dmabuf-unstable-v1-server-protocol.h"
 #include "linux-explicit-synchronization.h"
@@ -85,6 +89,7 @@ struct gl_fbo_texture {
 	GLuint tex;
 	int32_t width;
 	int32_t height;
+	size_t bytes;
 };
 
 struct gl_output_state {
@@ -103,9 +108,31 @@ struct gl_output_state {
 	/* struct timeline_render_point::link */
 	struct wl_list timeline_render_point_list;
 
+	/* struct gl_gpu_time_frame::link, oldest first */
+	struct wl_list gpu_time_frame_list;
+	/* frame being recorded, NULL while GPU timing is off */
+	struct gl_gpu_time_frame *gpu_time_frame;
+
+	/* struct gl_readback::link */
+	struct wl_list readback_list;
+
+	/* struct gl_renderer_dmabuf_target::link */
+	struct wl_list dmabuf_target_list;
+	struct gl_renderer_dmabuf_target *dmabuf_target;
+
 	struct gl_fbo_texture shadow;
 };
 
+struct gl_renderer_dmabuf_target {
+	struct weston_output *output;
+	struct egl_image *image;
+	GLuint fbo;
+	GLuint tex;
+	/* areas repainted into other targets since this one was used */
+	pixman_region32_t damage;
+	struct wl_list link;
+};
+
 enum buffer_type {
 	BUFFER_TYPE_NULL,
 	BUFFER_TYPE_SOLID, /* internal solid color surfaces without a buffer */
@@ -137,6 +164,36 @@ struct dmabuf_image {
 	enum gl_shader_texture_variant shader_variant;
 };
 
+/* Imports of released dmabufs, kept in case the client wraps the same
+ * memory into a new wl_buffer, as some video players do every frame. */
+struct dmabuf_cache_entry {
+	struct dmabuf_key key;
+	struct linux_dmabuf_client *client;
+	int num_images;
+	struct egl_image *images[3];
+	enum import_type import_type;
+	enum gl_shader_texture_variant shader_variant;
+	struct wl_list link; /* gl_renderer::dmabuf_cache */
+};
+
+#define GL_DMABUF_CACHE_MAX 16
+
+/** A wl_shm texture waiting to be reused, see gl_texture_pool_get() */
+struct gl_pooled_texture {
+	struct wl_list link; /* gl_renderer::texture_pool */
+	GLuint tex;
+	GLenum gl_format;
+	GLenum gl_pixel_type;
+	int width;
+	int height;
+	size_t bytes;
+};
+
+/* wl_shm textures are allocated in multiples of this many texels, so
+ * that a resize only reallocates when it changes the size class. */
+#define GL_TEXTURE_SIZE_CLASS 64
+#define GL_TEXTURE_POOL_MAX_BYTES (32 << 20)
+
 struct dmabuf_format {
 	uint32_t format;
 	struct wl_list link;
@@ -194,6 +251,12 @@ struct gl_surface_state {
 	bool y_inverted;
 	bool direct_display;
 
+	/* SHM textures come from gl_renderer::texture_pool and may be
+	 * larger than pitch x height, to the next size class */
+	bool textures_pooled;
+	int tex_width[3];
+	int tex_height[3];
+
 	/* Extension needed for SHM YUV texture */
 	int offset[3]; /* offset per plane */
 	int hsub[3];  /* horizontal subsampling per plane */
@@ -205,10 +268,43 @@ struct gl_surface_state {
 	   Used only in the context of a gl_renderer_repaint_output call. */
 	bool used_in_output_repaint;
 
+	/* Texture eviction of hidden SHM surfaces */
+	struct wl_list link; /* gl_renderer::surface_state_list */
+	uint64_t last_visible_frame; /* gl_renderer::frame_counter */
+	size_t texture_bytes;
+	bool textures_evicted;
+	int evicted_num_textures;
+
+	/* Estimated size of client buffers imported as EGLImages */
+	size_t import_bytes;
+	struct gl_client_memory *client_memory; /* NULL for internal surfaces */
+
+	/* weston_surface_copy_content_async() in flight */
+	struct wl_list readback_list; /* gl_readback::link */
+
+	/* YUV content converted to RGB once per commit, for surfaces shown
+	 * on several outputs; laid out like textures[0]. */
+	struct gl_fbo_texture rgb_cache;
+	bool rgb_cache_valid;
+
 	struct wl_listener surface_destroy_listener;
 	struct wl_listener renderer_destroy_listener;
 };
 
+/** GPU memory attributed to one client, see the "gl-memory" scope */
+struct gl_client_memory {
+	struct wl_list link; /* gl_renderer::client_memory_list */
+	struct gl_renderer *gr;
+	struct wl_client *client;
+	struct wl_listener destroy_listener;
+
+	size_t texture_bytes;
+	size_t texture_bytes_peak;
+	size_t import_bytes;
+	size_t import_bytes_peak;
+	bool over_budget;
+};
+
 enum timeline_render_point_type {
 	TIMELINE_RENDER_POINT_TYPE_BEGIN,
 	TIMELINE_RENDER_POINT_TYPE_END
@@ -223,6 +319,41 @@ struct timeline_render_point {
 	struct wl_event_source *event_source;
 };
 
+struct gl_readback {
+	/* gl_output_state::readback_list, or gl_surface_state::readback_list
+	 * when output is NULL */
+	struct wl_list link;
+
+	struct gl_renderer *gr;
+	struct weston_output *output;
+	GLuint pbo;
+	GLsizeiptr size;
+	int fd;
+	struct wl_event_source *event_source;
+
+	weston_renderer_read_pixels_done_func_t done;
+	void *data;
+};
+
+/** GPU timestamps taken before and after drawing one paint node */
+struct gl_gpu_time_query {
+	struct weston_surface *surface; /* NULL once destroyed */
+	GLuint queries[2];
+};
+
+/** The paint node timestamps of one output repaint
+ *
+ * Results are read back on a later repaint of the output, once the GPU
+ * has got that far, so recording never stalls the pipeline.
+ */
+struct gl_gpu_time_frame {
+	struct wl_list link; /* gl_output_state::gpu_time_frame_list */
+
+	/* GL_TIMESTAMP_EXT minus CLOCK_MONOTONIC when recording started */
+	int64_t clock_offset_ns;
+	struct wl_array queries; /* struct gl_gpu_time_query */
+};
+
 static uint32_t
 gr_gl_version(uint16_t major, uint16_t minor)
 {
@@ -260,6 +391,20 @@ get_output_state(struct weston_output *output)
 static int
 gl_renderer_create_surface(struct weston_surface *surface);
 
+static void
+gl_surface_state_restore(struct gl_surface_state *gs);
+
+static void
+gl_renderer_evict_textures(struct gl_renderer *gr);
+
+static void
+gl_renderer_account_bytes(size_t *bytes, size_t *peak, ssize_t delta)
+{
+	*bytes += delta;
+	if (*bytes > *peak)
+		*peak = *bytes;
+}
+
 static inline struct gl_surface_state *
 get_surface_state(struct weston_surface *surface)
 {
@@ -298,6 +443,10 @@ timeline_render_point_handler(int fd, uint32_t mask, void *data)
 							  &tspec) == 0) {
 			TL_POINT(trp->output->compositor, tp_name, TLP_GPU(&tspec),
 				 TLP_OUTPUT(trp->output), TLP_END);
+
+			if (trp->type == TIMELINE_RENDER_POINT_TYPE_END)
+				weston_output_repaint_time_gpu_done(trp->output,
+								    &tspec);
 		}
 	}
 
@@ -328,8 +477,14 @@ timeline_submit_render_sync(struct gl_renderer *gr,
 	struct wl_event_loop *loop;
 	int fd;
 	struct timeline_render_point *trp;
+	bool want_end_time;
+
+	/* The adaptive repaint window needs to know when rendering ended. */
+	want_end_time = type == TIMELINE_RENDER_POINT_TYPE_END &&
+			gr->compositor->repaint_window_adaptive;
 
-	if (!weston_log_scope_is_enabled(gr->compositor->timeline) ||
+	if (!(weston_log_scope_is_enabled(gr->compositor->timeline) ||
+	      want_end_time) ||
 	    !gr->has_native_fence_sync ||
 	    sync == EGL_NO_SYNC_KHR)
 		return;
@@ -358,6 +513,185 @@ timeline_submit_render_sync(struct gl_renderer *gr,
 	wl_list_insert(&go->timeline_render_point_list, &trp->link);
 }
 
+static bool
+gl_gpu_time_is_enabled(struct gl_renderer *gr)
+{
+	return gr->has_disjoint_timer_query &&
+	       (weston_log_scope_is_enabled(gr->compositor->timeline) ||
+		weston_log_scope_is_enabled(gr->compositor->timeline_binary) ||
+		weston_log_scope_is_enabled(gr->gpu_time_scope));
+}
+
+static void
+gl_gpu_time_frame_destroy(struct gl_renderer *gr,
+			  struct gl_gpu_time_frame *frame)
+{
+	struct gl_gpu_time_query *q;
+
+	wl_array_for_each(q, &frame->queries)
+		gr->delete_queries(ARRAY_LENGTH(q->queries), q->queries);
+	wl_array_release(&frame->queries);
+	wl_list_remove(&frame->link);
+	free(frame);
+}
+
+/** Start timing the paint nodes of an output repaint
+ *
+ * The clock offset maps the GPU timestamps to CLOCK_MONOTONIC, so that
+ * they line up with the other timeline points.
+ */
+static void
+gl_gpu_time_frame_begin(struct gl_renderer *gr, struct weston_output *output)
+{
+	struct gl_output_state *go = get_output_state(output);
+	struct gl_gpu_time_frame *frame;
+	struct timespec now;
+	GLint64 gpu_now;
+
+	if (!gl_gpu_time_is_enabled(gr))
+		return;
+
+	frame = zalloc(sizeof *frame);
+	if (!frame)
+		return;
+
+	gr->get_integer64v(GL_TIMESTAMP_EXT, &gpu_now);
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	frame->clock_offset_ns = gpu_now - timespec_to_nsec(&now);
+	wl_array_init(&frame->queries);
+
+	wl_list_insert(go->gpu_time_frame_list.prev, &frame->link);
+	go->gpu_time_frame = frame;
+}
+
+static void
+gl_gpu_time_print_surface(struct gl_renderer *gr, struct weston_output *output,
+			  struct weston_surface *surface, int64_t gpu_ns)
+{
+	char desc[512];
+
+	if (!surface->get_label ||
+	    surface->get_label(surface, desc, sizeof(desc)) < 0)
+		strcpy(desc, "[no description available]");
+
+	weston_log_scope_printf(gr->gpu_time_scope,
+				"\t%s: surface %u (%s): %" PRId64 " us\n",
+				output->name,
+				surface->resource ?
+				wl_resource_get_id(surface->resource) : 0,
+				desc, gpu_ns / 1000);
+}
+
+static void
+gl_gpu_time_frame_report(struct gl_renderer *gr, struct weston_output *output,
+			 struct gl_gpu_time_frame *frame)
+{
+	struct gl_gpu_time_query *q;
+	struct timespec ts[2];
+	GLuint64 t[2];
+	int64_t total_ns = 0;
+	int i;
+
+	wl_array_for_each(q, &frame->queries) {
+		for (i = 0; i < 2; i++) {
+			gr->get_query_objectui64v(q->queries[i],
+						  GL_QUERY_RESULT_EXT, &t[i]);
+			timespec_from_nsec(&ts[i], (int64_t)t[i] -
+					   frame->clock_offset_ns);
+		}
+
+		if (!q->surface || t[1] < t[0])
+			continue;
+
+		total_ns += t[1] - t[0];
+
+		TL_POINT(gr->compositor, "renderer_gpu_view_begin",
+			 TLP_GPU(&ts[0]), TLP_OUTPUT(output),
+			 TLP_SURFACE(q->surface), TLP_END);
+		TL_POINT(gr->compositor, "renderer_gpu_view_end",
+			 TLP_GPU(&ts[1]), TLP_OUTPUT(output),
+			 TLP_SURFACE(q->surface), TLP_END);
+
+		if (weston_log_scope_is_enabled(gr->gpu_time_scope))
+			gl_gpu_time_print_surface(gr, output, q->surface,
+						  t[1] - t[0]);
+	}
+
+	if (weston_log_scope_is_enabled(gr->gpu_time_scope))
+		weston_log_scope_printf(gr->gpu_time_scope,
+					"%s: %zu views, %" PRId64 " us\n",
+					output->name,
+					frame->queries.size / sizeof *q,
+					total_ns / 1000);
+}
+
+/** Report the recorded frames of an output which the GPU has finished
+ *
+ * Frames are finished in order, so the first one still pending stops the
+ * walk. When the GPU reports a disjoint event, e.g. a frequency change or
+ * a reset, the timestamps read so far cannot be trusted and are dropped.
+ */
+static void
+gl_gpu_time_collect(struct gl_renderer *gr, struct weston_output *output)
+{
+	struct gl_output_state *go = get_output_state(output);
+	struct gl_gpu_time_frame *frame, *tmp;
+	struct gl_gpu_time_query *last;
+	GLuint available;
+	GLint disjoint = 0;
+
+	if (wl_list_empty(&go->gpu_time_frame_list))
+		return;
+
+	glGetIntegerv(GL_GPU_DISJOINT_EXT, &disjoint);
+
+	wl_list_for_each_safe(frame, tmp, &go->gpu_time_frame_list, link) {
+		if (frame->queries.size > 0) {
+			last = (struct gl_gpu_time_query *)
+				((char *)frame->queries.data +
+				 frame->queries.size - sizeof *last);
+			available = GL_FALSE;
+			gr->get_query_objectuiv(last->queries[1],
+						GL_QUERY_RESULT_AVAILABLE_EXT,
+						&available);
+			if (!available && !disjoint)
+				break;
+
+			if (!disjoint)
+				gl_gpu_time_frame_report(gr, output, frame);
+		}
+
+		gl_gpu_time_frame_destroy(gr, frame);
+	}
+}
+
+/** Forget a destroyed surface in the frames still waiting for the GPU */
+static void
+gl_gpu_time_surface_destroyed(struct gl_renderer *gr,
+			      struct weston_surface *surface)
+{
+	struct weston_output *output;
+	struct gl_output_state *go;
+	struct gl_gpu_time_frame *frame;
+	struct gl_gpu_time_query *q;
+
+	if (!gr->has_disjoint_timer_query)
+		return;
+
+	wl_list_for_each(output, &gr->compositor->output_list, link) {
+		go = get_output_state(output);
+		if (!go)
+			continue;
+
+		wl_list_for_each(frame, &go->gpu_time_frame_list, link) {
+			wl_array_for_each(q, &frame->queries) {
+				if (q->surface == surface)
+					q->surface = NULL;
+			}
+		}
+	}
+}
+
 static struct egl_image*
 egl_image_create(struct gl_renderer *gr, EGLenum target,
 		 EGLClientBuffer buffer, const EGLint *attribs)
@@ -439,6 +773,118 @@ dmabuf_image_destroy(struct dmabuf_image *image)
 	free(image);
 }
 
+static void
+dmabuf_cache_entry_destroy(struct gl_renderer *gr,
+			   struct dmabuf_cache_entry *entry)
+{
+	int i;
+
+	for (i = 0; i < entry->num_images; ++i)
+		egl_image_unref(entry->images[i]);
+
+	linux_dmabuf_client_unref(entry->client);
+	wl_list_remove(&entry->link);
+	gr->dmabuf_cache_len--;
+	free(entry);
+}
+
+/* Drop what disconnected clients left behind, then the least recently
+ * released entries beyond the cache size. */
+static void
+dmabuf_cache_prune(struct gl_renderer *gr)
+{
+	struct dmabuf_cache_entry *entry, *tmp;
+
+	wl_list_for_each_safe(entry, tmp, &gr->dmabuf_cache, link)
+		if (!linux_dmabuf_client_is_alive(entry->client))
+			dmabuf_cache_entry_destroy(gr, entry);
+
+	while (gr->dmabuf_cache_len > GL_DMABUF_CACHE_MAX) {
+		entry = container_of(gr->dmabuf_cache.prev,
+				     struct dmabuf_cache_entry, link);
+		dmabuf_cache_entry_destroy(gr, entry);
+	}
+}
+
+static void
+dmabuf_cache_flush(struct gl_renderer *gr)
+{
+	struct dmabuf_cache_entry *entry, *tmp;
+
+	wl_list_for_each_safe(entry, tmp, &gr->dmabuf_cache, link)
+		dmabuf_cache_entry_destroy(gr, entry);
+}
+
+/* Hand the EGLImages of a released dmabuf over to the cache, leaving image
+ * with nothing to release. */
+static void
+dmabuf_cache_put(struct gl_renderer *gr, struct dmabuf_image *image)
+{
+	struct linux_dmabuf_buffer *dmabuf = image->dmabuf;
+	struct dmabuf_cache_entry *entry;
+	int i;
+
+	if (!dmabuf->has_key || image->num_images == 0 ||
+	    !linux_dmabuf_client_is_alive(dmabuf->client))
+		return;
+
+	entry = zalloc(sizeof *entry);
+	if (!entry)
+		return;
+
+	entry->key = dmabuf->key;
+	entry->client = linux_dmabuf_client_ref(dmabuf->client);
+	entry->import_type = image->import_type;
+	entry->shader_variant = image->shader_variant;
+	entry->num_images = image->num_images;
+	for (i = 0; i < image->num_images; ++i)
+		entry->images[i] = image->images[i];
+	image->num_images = 0;
+
+	wl_list_insert(&gr->dmabuf_cache, &entry->link);
+	gr->dmabuf_cache_len++;
+
+	dmabuf_cache_prune(gr);
+}
+
+static struct dmabuf_cache_entry *
+dmabuf_cache_find(struct gl_renderer *gr, struct linux_dmabuf_buffer *dmabuf)
+{
+	struct dmabuf_cache_entry *entry;
+
+	if (!dmabuf->has_key)
+		return NULL;
+
+	wl_list_for_each(entry, &gr->dmabuf_cache, link) {
+		if (dmabuf_key_equal(&entry->key, &dmabuf->key))
+			return entry;
+	}
+
+	return NULL;
+}
+
+/* Reuse the EGLImages of an earlier wl_buffer wrapping the same memory. */
+static bool
+dmabuf_cache_take(struct gl_renderer *gr, struct dmabuf_image *image)
+{
+	struct dmabuf_cache_entry *entry;
+	int i;
+
+	entry = dmabuf_cache_find(gr, image->dmabuf);
+	if (!entry)
+		return false;
+
+	image->import_type = entry->import_type;
+	image->shader_variant = entry->shader_variant;
+	image->num_images = entry->num_images;
+	for (i = 0; i < entry->num_images; ++i)
+		image->images[i] = entry->images[i];
+	entry->num_images = 0;
+
+	dmabuf_cache_entry_destroy(gr, entry);
+	return true;
+}
+
 #define max(a, b) (((a) > (b)) ? (a) : (b))
 #define min(a, b) (((a) > (b)) ? (b) : (a))
 
@@ -476,15 +922,7 @@ calculate_edges(struct weston_view *ev, pixman_box32_t *rect,
 					    &surf.x[i], &surf.y[i]);
 
 	/* find bounding box: */
-	min_x = max_x = surf.x[0];
-	min_y = max_y = surf.y[0];
-
-	for (i = 1; i < surf.n; i++) {
-		min_x = min(min_x, surf.x[i]);
-		max_x = max(max_x, surf.x[i]);
-		min_y = min(min_y, surf.y[i]);
-		max_y = max(max_y, surf.y[i]);
-	}
+	polygon8_bounding_box(&surf, &min_x, &min_y, &max_x, &max_y);
 
 	/* First, simple bounding box check to discard early transformed
 	 * surface rects that do not intersect with the clip region:
@@ -528,7 +966,8 @@ merge_down(pixman_box32_t *a, pixman_box32_t *b, pixman_box32_t *merge)
 }
 
 static int
-compress_bands(pixman_box32_t *inrects, int nrects, pixman_box32_t **outrects)
+compress_bands(struct weston_output *output, pixman_box32_t *inrects,
+	       int nrects, pixman_box32_t **outrects)
 {
 	bool merged = false;
 	pixman_box32_t *out, merge_rect;
@@ -542,7 +981,12 @@ compress_bands(pixman_box32_t *inrects, int nrects, pixman_box32_t **outrects)
 	/* nrects is an upper bound - we're not too worried about
 	 * allocating a little extra
 	 */
-	out = malloc(sizeof(pixman_box32_t) * nrects);
+	out = weston_output_frame_alloc(output, sizeof(pixman_box32_t) * nrects);
+	if (!out) {
+		*outrects = inrects;
+		return nrects;
+	}
+
 	out[0] = inrects[0];
 	nout = 1;
 	for (i = 1; i < nrects; i++) {
@@ -562,10 +1006,84 @@ compress_bands(pixman_box32_t *inrects, int nrects, pixman_box32_t **outrects)
 	return nout;
 }
 
+/* Vertices one draw pass of a paint node produced, along with the
+ * per-fan vertex counts, as they were appended to the batch. */
+struct gl_vertex_cache {
+	struct wl_array vertices;
+	struct wl_array vtxcnt;
+	bool valid;
+};
+
+/* Per paint node state which only depends on the view geometry and the
+ * committed surface state; see weston_paint_node::renderer_cache. */
+struct gl_paint_node_cache {
+	struct gl_renderer *gr;
+
+	/* opaque region in surface coordinates: */
+	pixman_region32_t surface_opaque;
+	/* non-opaque region in surface coordinates: */
+	pixman_region32_t surface_blend;
+
+	/* repaint region the cached vertices were computed for,
+	 * in global coordinates: */
+	pixman_region32_t repaint;
+	struct gl_vertex_cache opaque_vtx;
+	struct gl_vertex_cache blend_vtx;
+};
+
+static void
+gl_vertex_cache_store(struct gl_vertex_cache *vc,
+		      const struct wl_array *vertices, size_t vertices_start,
+		      const struct wl_array *vtxcnt, size_t vtxcnt_start)
+{
+	size_t vsize = vertices->size - vertices_start;
+	size_t csize = vtxcnt->size - vtxcnt_start;
+	void *v, *c;
+
+	vc->vertices.size = 0;
+	vc->vtxcnt.size = 0;
+	vc->valid = false;
+
+	v = wl_array_add(&vc->vertices, vsize);
+	c = wl_array_add(&vc->vtxcnt, csize);
+	if (!v || !c)
+		return;
+
+	memcpy(v, (const char *) vertices->data + vertices_start, vsize);
+	memcpy(c, (const char *) vtxcnt->data + vtxcnt_start, csize);
+	vc->valid = true;
+}
+
+static int
+gl_vertex_cache_replay(struct gl_vertex_cache *vc,
+		       struct wl_array *vertices, struct wl_array *vtxcnt)
+{
+	void *v, *c;
+
+	v = wl_array_add(vertices, vc->vertices.size);
+	c = wl_array_add(vtxcnt, vc->vtxcnt.size);
+	if (!v || !c)
+		return 0;
+
+	memcpy(v, vc->vertices.data, vc->vertices.size);
+	memcpy(c, vc->vtxcnt.data, vc->vtxcnt.size);
+
+	return vc->vtxcnt.size / sizeof(unsigned int);
+}
+
+/** Append the triangle fans of a region to the current batch
+ *
+ * With a vertex cache, 'reuse' replays the vertices it holds instead of
+ * clipping the region again; otherwise the cache is refilled with what
+ * gets computed.
+ */
 static int
 texture_region(struct weston_view *ev,
+	       struct weston_output *output,
 	       pixman_region32_t *region,
-	       pixman_region32_t *surf_region)
+	       pixman_region32_t *surf_region,
+	       struct gl_vertex_cache *vc,
+	       bool reuse)
 {
 	struct gl_surface_state *gs = get_surface_state(ev->surface);
 	struct weston_compositor *ec = ev->surface->compositor;
@@ -575,17 +1093,22 @@ texture_region(struct weston_view *ev,
 	pixman_box32_t *rects, *surf_rects;
 	pixman_box32_t *raw_rects;
 	int i, j, k, nrects, nsurf, raw_nrects;
-	bool used_band_compression;
+	size_t vertices_start, vtxcnt_start;
+
+	if (vc && reuse && vc->valid)
+		return gl_vertex_cache_replay(vc, &gr->vertices, &gr->vtxcnt);
+
+	vertices_start = gr->vertices.size;
+	vtxcnt_start = gr->vtxcnt.size;
+
 	raw_rects = pixman_region32_rectangles(region, &raw_nrects);
 	surf_rects = pixman_region32_rectangles(surf_region, &nsurf);
 
 	if (raw_nrects < 4) {
-		used_band_compression = false;
 		nrects = raw_nrects;
 		rects = raw_rects;
 	} else {
-		nrects = compress_bands(raw_rects, raw_nrects, &rects);
-		used_band_compression = true;
+		nrects = compress_bands(output, raw_rects, raw_nrects, &rects);
 	}
 	/* worst case we can have 8 vertices per rect (ie. clipped into
 	 * an octagon):
@@ -593,8 +1116,13 @@ texture_region(struct weston_view *ev,
 	v = wl_array_add(&gr->vertices, nrects * nsurf * 8 * 4 * sizeof *v);
 	vtxcnt = wl_array_add(&gr->vtxcnt, nrects * nsurf * sizeof *vtxcnt);
 
-	inv_width = 1.0 / gs->pitch;
-	inv_height = 1.0 / gs->height;
+	if (gs->textures_pooled) {
+		inv_width = 1.0 / gs->tex_width[0];
+		inv_height = 1.0 / gs->tex_height[0];
+	} else {
+		inv_width = 1.0 / gs->pitch;
+		inv_height = 1.0 / gs->height;
+	}
 
 	for (i = 0; i < nrects; i++) {
 		pixman_box32_t *rect = &rects[i];
@@ -645,11 +1173,42 @@ texture_region(struct weston_view *ev,
 		}
 	}
 
-	if (used_band_compression)
-		free(rects);
+	/* Drop the unused worst-case slack, so that the next region can be
+	 * appended contiguously to the same batch. */
+	gr->vertices.size = (char *) v - (char *) gr->vertices.data;
+	gr->vtxcnt.size = (char *) &vtxcnt[nvtx] - (char *) gr->vtxcnt.data;
+
+	if (vc)
+		gl_vertex_cache_store(vc, &gr->vertices, vertices_start,
+				      &gr->vtxcnt, vtxcnt_start);
+
 	return nvtx;
 }
 
+static int
+texel_size(GLenum gl_format, GLenum gl_pixel_type)
+{
+	switch (gl_pixel_type) {
+	case GL_UNSIGNED_SHORT_5_6_5:
+		return 2;
+	case GL_HALF_FLOAT:
+		return 8;
+	default:
+		break;
+	}
+
+	switch (gl_format) {
+	case GL_R8_EXT:
+	case GL_LUMINANCE:
+		return 1;
+	case GL_RG8_EXT:
+	case GL_LUMINANCE_ALPHA:
+		return 2;
+	default:
+		return 4;
+	}
+}
+
 /** Create a texture and a framebuffer object
  *
  * \param fbotex To be initialized.
@@ -700,6 +1259,7 @@ gl_fbo_texture_init(struct gl_fbo_texture *fbotex,
 	fbotex->tex = shadow_tex;
 	fbotex->width = width;
 	fbotex->height = height;
+	fbotex->bytes = (size_t)width * height * texel_size(format, type);
 
 	return true;
 }
@@ -711,6 +1271,7 @@ gl_fbo_texture_fini(struct gl_fbo_texture *fbotex)
 	fbotex->fbo = 0;
 	glDeleteTextures(1, &fbotex->tex);
 	fbotex->tex = 0;
+	fbotex->bytes = 0;
 }
 
 static void
@@ -787,30 +1348,74 @@ triangle_fan_debug(struct gl_renderer *gr,
 	gl_renderer_use_program(gr, sconf);
 }
 
+static bool
+gl_shader_config_equal(const struct gl_shader_config *a,
+		       const struct gl_shader_config *b)
+{
+	int i;
+
+	if (memcmp(&a->req, &b->req, sizeof a->req) != 0 ||
+	    a->view_alpha != b->view_alpha ||
+	    a->input_tex_filter != b->input_tex_filter ||
+	    a->color_pre_curve_lut_tex != b->color_pre_curve_lut_tex ||
+	    a->color_pre_curve_lut_scale_offset[0] !=
+	    b->color_pre_curve_lut_scale_offset[0] ||
+	    a->color_pre_curve_lut_scale_offset[1] !=
+	    b->color_pre_curve_lut_scale_offset[1] ||
+	    a->color_mapping_lut_tex != b->color_mapping_lut_tex ||
+	    a->color_mapping_lut_scale_offset[0] !=
+	    b->color_mapping_lut_scale_offset[0] ||
+	    a->color_mapping_lut_scale_offset[1] !=
+	    b->color_mapping_lut_scale_offset[1] ||
+	    memcmp(a->color_mapping_matrix, b->color_mapping_matrix,
+		   sizeof a->color_mapping_matrix) != 0 ||
+	    a->color_post_curve_lut_tex != b->color_post_curve_lut_tex ||
+	    a->color_post_curve_lut_scale_offset[0] !=
+	    b->color_post_curve_lut_scale_offset[0] ||
+	    a->color_post_curve_lut_scale_offset[1] !=
+	    b->color_post_curve_lut_scale_offset[1])
+		return false;
+
+	for (i = 0; i < 4; i++) {
+		if (a->unicolor[i] != b->unicolor[i])
+			return false;
+	}
+
+	for (i = 0; i < GL_SHADER_INPUT_TEX_MAX; i++) {
+		if (a->input_tex[i] != b->input_tex[i])
+			return false;
+	}
+
+	return memcmp(a->projection.d, b->projection.d,
+		      sizeof a->projection.d) == 0;
+}
+
+/* Draw everything accumulated in the current batch. */
 static void
-repaint_region(struct gl_renderer *gr,
-	       struct weston_view *ev,
-	       struct weston_output *output,
-	       pixman_region32_t *region,
-	       pixman_region32_t *surf_region,
-	       const struct gl_shader_config *sconf)
+repaint_batch_flush(struct gl_renderer *gr)
 {
 	GLfloat *v;
 	unsigned int *vtxcnt;
-	int i, first, nfans;
+	unsigned int nvtx, ntris = 0;
+	GLushort *index = NULL;
+	int i, k, first, nfans;
 
-	/* The final region to be painted is the intersection of
-	 * 'region' and 'surf_region'. However, 'region' is in the global
-	 * coordinates, and 'surf_region' is in the surface-local
-	 * coordinates. texture_region() will iterate over all pairs of
-	 * rectangles from both regions, compute the intersection
-	 * polygon for each pair, and store it as a triangle fan if
-	 * it has a non-zero area (at least 3 vertices, actually).
-	 */
-	nfans = texture_region(ev, region, surf_region);
+	if (!gr->batch.active)
+		return;
+
+	gr->batch.active = false;
 
 	v = gr->vertices.data;
 	vtxcnt = gr->vtxcnt.data;
+	nfans = gr->vtxcnt.size / sizeof *vtxcnt;
+	nvtx = gr->vertices.size / (4 * sizeof *v);
+	if (nfans == 0)
+		goto out;
+
+	if (gr->batch.blend)
+		glEnable(GL_BLEND);
+	else
+		glDisable(GL_BLEND);
 
 	/* position: */
 	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 4 * sizeof *v, &v[0]);
@@ -820,25 +1425,98 @@ repaint_region(struct gl_renderer *gr,
 	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 4 * sizeof *v, &v[2]);
 	glEnableVertexAttribArray(1);
 
-	if (!gl_renderer_use_program(gr, sconf)) {
-		gl_renderer_send_shader_error(ev);
+	if (!gl_renderer_use_program(gr, &gr->batch.sconf)) {
+		gl_renderer_send_shader_error(gr->batch.view);
 		/* continue drawing with the fallback shader */
 	}
 
-	for (i = 0, first = 0; i < nfans; i++) {
-		glDrawArrays(GL_TRIANGLE_FAN, first, vtxcnt[i]);
-		if (gr->fan_debug)
-			triangle_fan_debug(gr, sconf, output, first, vtxcnt[i]);
-		first += vtxcnt[i];
+	/* The fans are convex, so each one splits into triangles sharing
+	 * its first vertex, and all of them go out in one indexed draw.
+	 * Indices are 16 bits in GLES2; larger batches draw fan by fan.
+	 */
+	if (nfans > 1 && nvtx <= 0x10000) {
+		for (i = 0; i < nfans; i++)
+			ntris += vtxcnt[i] - 2;
+
+		gr->indices.size = 0;
+		index = wl_array_add(&gr->indices, ntris * 3 * sizeof *index);
+	}
+
+	if (index) {
+		for (i = 0, first = 0; i < nfans; i++) {
+			for (k = 2; k < (int) vtxcnt[i]; k++) {
+				*index++ = first;
+				*index++ = first + k - 1;
+				*index++ = first + k;
+			}
+			first += vtxcnt[i];
+		}
+
+		glDrawElements(GL_TRIANGLES, ntris * 3, GL_UNSIGNED_SHORT,
+			       gr->indices.data);
+	} else {
+		for (i = 0, first = 0; i < nfans; i++) {
+			glDrawArrays(GL_TRIANGLE_FAN, first, vtxcnt[i]);
+			first += vtxcnt[i];
+		}
+	}
+
+	if (gr->fan_debug) {
+		for (i = 0, first = 0; i < nfans; i++) {
+			triangle_fan_debug(gr, &gr->batch.sconf,
+					   gr->batch.output, first, vtxcnt[i]);
+			first += vtxcnt[i];
+		}
 	}
 
 	glDisableVertexAttribArray(1);
 	glDisableVertexAttribArray(0);
 
+out:
 	gr->vertices.size = 0;
 	gr->vtxcnt.size = 0;
 }
 
+static void
+repaint_region(struct gl_renderer *gr,
+	       struct weston_view *ev,
+	       struct weston_output *output,
+	       pixman_region32_t *region,
+	       pixman_region32_t *surf_region,
+	       const struct gl_shader_config *sconf,
+	       bool blend,
+	       struct gl_vertex_cache *vc,
+	       bool reuse)
+{
+	/* Consecutive regions that would be drawn with the exact same
+	 * program, uniforms, textures and blend state are only accumulated
+	 * here; the draw happens when the state changes or the views are
+	 * done.
+	 */
+	if (gr->batch.active &&
+	    (gr->batch.blend != blend || gr->batch.output != output ||
+	     !gl_shader_config_equal(&gr->batch.sconf, sconf)))
+		repaint_batch_flush(gr);
+
+	if (!gr->batch.active) {
+		gr->batch.active = true;
+		gr->batch.blend = blend;
+		gr->batch.sconf = *sconf;
+		gr->batch.view = ev;
+		gr->batch.output = output;
+	}
+
+	/* The final region to be painted is the intersection of
+	 * 'region' and 'surf_region'. However, 'region' is in the global
+	 * coordinates, and 'surf_region' is in the surface-local
+	 * coordinates. texture_region() will iterate over all pairs of
+	 * rectangles from both regions, compute the intersection
+	 * polygon for each pair, and store it as a triangle fan if
+	 * it has a non-zero area (at least 3 vertices, actually).
+	 */
+	texture_region(ev, output, region, surf_region, vc, reuse);
+}
+
 static int
 use_output(struct weston_output *output)
 {
@@ -1014,6 +1692,7 @@ gl_shader_config_init_for_paint_node(struct gl_shader_config *sconf,
 {
 	struct gl_surface_state *gs = get_surface_state(pnode->surface);
 	struct gl_output_state *go = get_output_state(pnode->output);
+	int i;
 
 	if (!pnode->surf_xform_valid)
 		return false;
@@ -1026,6 +1705,14 @@ gl_shader_config_init_for_paint_node(struct gl_shader_config *sconf,
 
 	gl_shader_config_set_input_textures(sconf, gs);
 
+	if (gs->rgb_cache_valid) {
+		sconf->req.variant = SHADER_VARIANT_RGBX;
+		sconf->req.input_is_premult = false;
+		sconf->input_tex[0] = gs->rgb_cache.tex;
+		for (i = 1; i < GL_SHADER_INPUT_TEX_MAX; i++)
+			sconf->input_tex[i] = 0;
+	}
+
 	if (!gl_shader_config_set_color_transform(sconf, pnode->surf_xform.transform)) {
 		weston_log("GL-renderer: failed to generate a color transformation.\n");
 		return false;
@@ -1034,6 +1721,100 @@ gl_shader_config_init_for_paint_node(struct gl_shader_config *sconf,
 	return true;
 }
 
+static void
+gl_paint_node_cache_destroy(void *data)
+{
+	struct gl_paint_node_cache *cache = data;
+
+	pixman_region32_fini(&cache->surface_opaque);
+	pixman_region32_fini(&cache->surface_blend);
+	pixman_region32_fini(&cache->repaint);
+	wl_array_release(&cache->opaque_vtx.vertices);
+	wl_array_release(&cache->opaque_vtx.vtxcnt);
+	wl_array_release(&cache->blend_vtx.vertices);
+	wl_array_release(&cache->blend_vtx.vtxcnt);
+	free(cache);
+}
+
+static void
+gl_paint_node_cache_update(struct gl_paint_node_cache *cache,
+			   struct weston_paint_node *pnode)
+{
+	struct weston_surface *surface = pnode->surface;
+	struct weston_view *view = pnode->view;
+
+	/* blended region is whole surface minus opaque region: */
+	pixman_region32_fini(&cache->surface_blend);
+	pixman_region32_init_rect(&cache->surface_blend, 0, 0,
+				  surface->width, surface->height);
+	if (view->geometry.scissor_enabled)
+		pixman_region32_intersect(&cache->surface_blend,
+					  &cache->surface_blend,
+					  &view->geometry.scissor);
+	pixman_region32_subtract(&cache->surface_blend, &cache->surface_blend,
+				 &surface->opaque);
+
+	/* XXX: Should we be using ev->transform.opaque here? */
+	if (view->geometry.scissor_enabled)
+		pixman_region32_intersect(&cache->surface_opaque,
+					  &surface->opaque,
+					  &view->geometry.scissor);
+	else
+		pixman_region32_copy(&cache->surface_opaque, &surface->opaque);
+
+	pixman_region32_clear(&cache->repaint);
+	cache->opaque_vtx.valid = false;
+	cache->blend_vtx.valid = false;
+}
+
+/** Get the cached surface regions and vertices of a paint node
+ *
+ * They only change with the view geometry or a surface commit, both of
+ * which mark the paint node dirty, so a static view repainted every
+ * frame does not redo the region arithmetic. A renderer switch leaves
+ * another renderer's cache behind, which is replaced here.
+ */
+static struct gl_paint_node_cache *
+gl_paint_node_get_cache(struct gl_renderer *gr,
+			struct weston_paint_node *pnode)
+{
+	struct gl_paint_node_cache *cache = pnode->renderer_cache;
+
+	if (cache &&
+	    pnode->renderer_cache_destroy == gl_paint_node_cache_destroy &&
+	    cache->gr == gr) {
+		if (pnode->renderer_cache_dirty)
+			gl_paint_node_cache_update(cache, pnode);
+		pnode->renderer_cache_dirty = false;
+		return cache;
+	}
+
+	if (pnode->renderer_cache) {
+		pnode->renderer_cache_destroy(pnode->renderer_cache);
+		pnode->renderer_cache = NULL;
+	}
+
+	cache = zalloc(sizeof *cache);
+	if (!cache)
+		return NULL;
+
+	cache->gr = gr;
+	pixman_region32_init(&cache->surface_opaque);
+	pixman_region32_init(&cache->surface_blend);
+	pixman_region32_init(&cache->repaint);
+	wl_array_init(&cache->opaque_vtx.vertices);
+	wl_array_init(&cache->opaque_vtx.vtxcnt);
+	wl_array_init(&cache->blend_vtx.vertices);
+	wl_array_init(&cache->blend_vtx.vtxcnt);
+	gl_paint_node_cache_update(cache, pnode);
+
+	pnode->renderer_cache = cache;
+	pnode->renderer_cache_destroy = gl_paint_node_cache_destroy;
+	pnode->renderer_cache_dirty = false;
+
+	return cache;
+}
+
 static void
 draw_paint_node(struct weston_paint_node *pnode,
 		pixman_region32_t *damage /* in global coordinates */)
@@ -1042,12 +1823,10 @@ draw_paint_node(struct weston_paint_node *pnode,
 	struct gl_surface_state *gs = get_surface_state(pnode->surface);
 	/* repaint bounding region in global coordinates: */
 	pixman_region32_t repaint;
-	/* opaque region in surface coordinates: */
-	pixman_region32_t surface_opaque;
-	/* non-opaque region in surface coordinates: */
-	pixman_region32_t surface_blend;
+	struct gl_paint_node_cache *cache;
 	GLint filter;
 	struct gl_shader_config sconf;
+	bool reuse;
 
 	/* In case of a runtime switch of renderers, we may not have received
 	 * an attach for this surface since the switch. In that case we don't
@@ -1055,6 +1834,8 @@ draw_paint_node(struct weston_paint_node *pnode,
 	if (gs->shader_variant == SHADER_VARIANT_NONE && !gs->direct_display)
 		return;
 
+	gl_surface_state_restore(gs);
+
 	pixman_region32_init(&repaint);
 	pixman_region32_intersect(&repaint,
 				  &pnode->view->transform.boundingbox, damage);
@@ -1068,7 +1849,8 @@ draw_paint_node(struct weston_paint_node *pnode,
 
 	glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
 
-	if (pnode->view->transform.enabled || pnode->output->zoom.active ||
+	if (pnode->view->transform.enabled ||
+	    (pnode->output->zoom.active && !pnode->output->zoom.scanout) ||
 	    pnode->output->current_scale != pnode->surface->buffer_viewport.buffer.scale)
 		filter = GL_LINEAR;
 	else
@@ -1077,27 +1859,19 @@ draw_paint_node(struct weston_paint_node *pnode,
 	if (!gl_shader_config_init_for_paint_node(&sconf, pnode, filter))
 		goto out;
 
-	/* blended region is whole surface minus opaque region: */
-	pixman_region32_init_rect(&surface_blend, 0, 0,
-				  pnode->surface->width, pnode->surface->height);
-	if (pnode->view->geometry.scissor_enabled)
-		pixman_region32_intersect(&surface_blend, &surface_blend,
-					  &pnode->view->geometry.scissor);
-	pixman_region32_subtract(&surface_blend, &surface_blend,
-				 &pnode->surface->opaque);
+	cache = gl_paint_node_get_cache(gr, pnode);
+	if (!cache)
+		goto out;
 
-	/* XXX: Should we be using ev->transform.opaque here? */
-	pixman_region32_init(&surface_opaque);
-	if (pnode->view->geometry.scissor_enabled)
-		pixman_region32_intersect(&surface_opaque,
-					  &pnode->surface->opaque,
-					  &pnode->view->geometry.scissor);
-	else
-		pixman_region32_copy(&surface_opaque, &pnode->surface->opaque);
+	/* Views over content that is damaged every frame tend to get the
+	 * same repaint region over and over, and so the same vertices. */
+	reuse = pixman_region32_equal(&cache->repaint, &repaint);
+	if (!reuse && !pixman_region32_copy(&cache->repaint, &repaint))
+		pixman_region32_clear(&cache->repaint);
 
 	maybe_censor_override(&sconf, pnode->output, pnode->view);
 
-	if (pixman_region32_not_empty(&surface_opaque)) {
+	if (pixman_region32_not_empty(&cache->surface_opaque)) {
 		struct gl_shader_config alt = sconf;
 
 		if (alt.req.variant == SHADER_VARIANT_RGBA) {
@@ -1109,25 +1883,63 @@ draw_paint_node(struct weston_paint_node *pnode,
 			alt.req.variant = SHADER_VARIANT_RGBX;
 		}
 
-		if (pnode->view->alpha < 1.0)
-			glEnable(GL_BLEND);
-		else
-			glDisable(GL_BLEND);
-
 		repaint_region(gr, pnode->view, pnode->output,
-			       &repaint, &surface_opaque, &alt);
+			       &repaint, &cache->surface_opaque, &alt,
+			       pnode->view->alpha < 1.0,
+			       &cache->opaque_vtx, reuse);
 		gs->used_in_output_repaint = true;
 	}
 
-	if (pixman_region32_not_empty(&surface_blend)) {
-		glEnable(GL_BLEND);
+	if (pixman_region32_not_empty(&cache->surface_blend)) {
 		repaint_region(gr, pnode->view, pnode->output,
-			       &repaint, &surface_blend, &sconf);
+			       &repaint, &cache->surface_blend, &sconf, true,
+			       &cache->blend_vtx, reuse);
 		gs->used_in_output_repaint = true;
 	}
 
-	pixman_region32_fini(&surface_blend);
-	pixman_region32_fini(&surface_opaque);
+out:
+	pixman_region32_fini(&repaint);
+}
+
+/** Clear the area of a view on an underlay plane to transparent
+ *
+ * The plane sits below the primary one, so whatever is drawn over the
+ * hole by views higher up blends onto the plane's content.
+ */
+static void
+draw_paint_node_hole(struct weston_paint_node *pnode,
+		     pixman_region32_t *damage /* in global coordinates */)
+{
+	struct gl_renderer *gr = get_renderer(pnode->surface->compositor);
+	struct gl_output_state *go = get_output_state(pnode->output);
+	struct weston_surface *surface = pnode->surface;
+	pixman_region32_t repaint;
+	pixman_region32_t surf_region;
+	struct gl_shader_config sconf = {
+		.req = {
+			.variant = SHADER_VARIANT_SOLID,
+			.input_is_premult = true,
+		},
+		.projection = go->output_matrix,
+		.view_alpha = 1.0f,
+		.unicolor = { 0.0f, 0.0f, 0.0f, 0.0f },
+	};
+
+	pixman_region32_init(&repaint);
+	pixman_region32_intersect(&repaint,
+				  &pnode->view->transform.boundingbox, damage);
+	if (!pixman_region32_not_empty(&repaint))
+		goto out;
+
+	/* no color transform: transparent black has to stay that */
+	if (!gl_shader_config_set_color_transform(&sconf, NULL))
+		goto out;
+
+	pixman_region32_init_rect(&surf_region, 0, 0,
+				  surface->width, surface->height);
+	repaint_region(gr, pnode->view, pnode->output, &repaint,
+		       &surf_region, &sconf, false, NULL, false);
+	pixman_region32_fini(&surf_region);
 
 out:
 	pixman_region32_fini(&repaint);
@@ -1137,13 +1949,44 @@ static void
 repaint_views(struct weston_output *output, pixman_region32_t *damage)
 {
 	struct weston_compositor *compositor = output->compositor;
+	struct gl_renderer *gr = get_renderer(compositor);
 	struct weston_paint_node *pnode;
 
+	struct gl_output_state *go = get_output_state(output);
+	struct gl_gpu_time_query *q;
+
 	wl_list_for_each_reverse(pnode, &output->paint_node_z_order_list,
 				 z_order_link) {
-		if (pnode->view->plane == &compositor->primary_plane)
+		if (pnode->view->plane != &compositor->primary_plane) {
+			if (pnode->need_hole)
+				draw_paint_node_hole(pnode, damage);
+			continue;
+		}
+
+		if (!go->gpu_time_frame) {
+			draw_paint_node(pnode, damage);
+			continue;
+		}
+
+		/* Timing a node needs its draws to be issued between the
+		 * timestamps, so batching across nodes is given up. */
+		q = wl_array_add(&go->gpu_time_frame->queries, sizeof *q);
+		if (!q) {
 			draw_paint_node(pnode, damage);
+			continue;
+		}
+
+		q->surface = pnode->surface;
+		gr->gen_queries(ARRAY_LENGTH(q->queries), q->queries);
+
+		repaint_batch_flush(gr);
+		gr->query_counter(q->queries[0], GL_TIMESTAMP_EXT);
+		draw_paint_node(pnode, damage);
+		repaint_batch_flush(gr);
+		gr->query_counter(q->queries[1], GL_TIMESTAMP_EXT);
 	}
+
+	repaint_batch_flush(gr);
 }
 
 static int
@@ -1190,27 +2033,25 @@ update_buffer_release_fences(struct weston_compositor *compositor,
 			continue;
 		}
 
-		/* At the moment it is safe to just replace the fence_fd,
-		 * discarding the previous one:
-		 *
-		 * 1. If the previous fence fd represents a sync fence from
-		 *    a previous repaint cycle, that fence fd is now not
-		 *    sufficient to provide the release guarantee and should
-		 *    be replaced.
-		 *
-		 * 2. If the fence fd represents a sync fence from another
-		 *    output in the same repaint cycle, it's fine to replace
-		 *    it since we are rendering to all outputs using the same
-		 *    EGL context, so a fence issued for a later output rendering
-		 *    is guaranteed to signal after fences for previous output
-		 *    renderings.
-		 *
-		 * Note that the above is only valid if the buffer_release
-		 * fences only originate from the GL renderer, which guarantees
-		 * a total order of operations and fences.  If we introduce
-		 * fences from other sources (e.g., plane out-fences), we will
-		 * need to merge fences instead.
+		/* buffer_release may already hold a fence from a previous repaint
+		 * cycle, from another output in this cycle, or a plane
+		 * out-fence from the DRM backend when the buffer was also
+		 * scanned out. Merge rather than replace: fences from our
+		 * own EGL context collapse into the latest one, and the
+		 * client has to wait for the plane to let go too. If merging
+		 * fails, our fence still covers every earlier render.
 		 */
+		if (buffer_release->fence_fd >= 0) {
+			int merged_fd;
+
+			merged_fd = weston_linux_sync_file_merge(buffer_release->fence_fd,
+								 fence_fd);
+			if (merged_fd >= 0) {
+				close(fence_fd);
+				fence_fd = merged_fd;
+			}
+		}
+
 		fd_update(&buffer_release->fence_fd, fence_fd);
 	}
 }
@@ -1467,7 +2308,8 @@ output_rotate_damage(struct weston_output *output,
  *
  * @param output The output whose co-ordinate space we are after
  * @param global_region The affected region in global co-ordinate space
- * @param[out] rects Y-inverted quads in {x,y,w,h} order; caller must free
+ * @param[out] rects Y-inverted quads in {x,y,w,h} order, allocated for the
+ *             current repaint of the output; NULL on failure
  * @param[out] nrects Number of quads (4x number of co-ordinates)
  */
 static void
@@ -1506,7 +2348,12 @@ pixman_region_to_egl_y_invert(struct weston_output *output,
 	/* Convert from a Pixman region into {x,y,w,h} quads, flipping in the
 	 * Y axis to account for GL's lower-left-origin co-ordinate space. */
 	box = pixman_region32_rectangles(&transformed, nrects);
-	*rects = malloc(*nrects * 4 * sizeof(EGLint));
+	*rects = weston_output_frame_alloc(output, *nrects * 4 * sizeof(EGLint));
+	if (!*rects) {
+		*nrects = 0;
+		pixman_region32_fini(&transformed);
+		return;
+	}
 
 	buffer_height = go->borders[GL_RENDERER_BORDER_TOP].height +
 			output->current_mode->height +
@@ -1599,6 +2446,106 @@ blit_shadow_to_output(struct weston_output *output,
 	pixman_region32_fini(&translated_damage);
 }
 
+static void
+gl_surface_state_drop_rgb_cache(struct gl_renderer *gr,
+				struct gl_surface_state *gs)
+{
+	gs->rgb_cache_valid = false;
+
+	if (!gs->rgb_cache.fbo)
+		return;
+
+	gl_renderer_account_bytes(&gr->fbo_bytes, &gr->fbo_bytes_peak,
+				  -(ssize_t)gs->rgb_cache.bytes);
+	gl_fbo_texture_fini(&gs->rgb_cache);
+}
+
+/** Convert the YUV content of a surface on several outputs to RGB once
+ *
+ * Each output would otherwise run the conversion shader over the same
+ * unchanged buffer in every repaint. The cache texture has the layout
+ * of textures[0], so the texture coordinates of the views stay valid.
+ * Must be called while no output framebuffer is bound for drawing.
+ */
+static void
+gl_surface_state_update_rgb_cache(struct gl_renderer *gr,
+				  struct weston_surface *surface)
+{
+	static const GLfloat verts[4 * 2] = {
+		0.0f, 0.0f,
+		1.0f, 0.0f,
+		1.0f, 1.0f,
+		0.0f, 1.0f
+	};
+	static const GLfloat projmat[16] = { /* transpose */
+		 2.0f,  0.0f, 0.0f, 0.0f,
+		 0.0f,  2.0f, 0.0f, 0.0f,
+		 0.0f,  0.0f, 1.0f, 0.0f,
+		-1.0f, -1.0f, 0.0f, 1.0f
+	};
+	struct gl_surface_state *gs = get_surface_state(surface);
+	struct gl_shader_config sconf = {
+		.view_alpha = 1.0f,
+		.input_tex_filter = GL_LINEAR,
+	};
+	uint32_t mask = surface->output_mask;
+	int32_t width, height;
+
+	if (!gl_shader_texture_variant_is_yuv(gs->shader_variant) ||
+	    gs->direct_display || (mask & (mask - 1)) == 0) {
+		gl_surface_state_drop_rgb_cache(gr, gs);
+		return;
+	}
+
+	if (gs->rgb_cache_valid)
+		return;
+
+	gl_surface_state_restore(gs);
+
+	width = gs->textures_pooled ? gs->tex_width[0] : gs->pitch;
+	height = gs->textures_pooled ? gs->tex_height[0] : gs->height;
+
+	if (gs->rgb_cache.fbo &&
+	    (gs->rgb_cache.width != width || gs->rgb_cache.height != height))
+		gl_surface_state_drop_rgb_cache(gr, gs);
+
+	if (!gs->rgb_cache.fbo) {
+		if (!gl_fbo_texture_init(&gs->rgb_cache, width, height,
+					 GL_RGBA, GL_RGBA, GL_UNSIGNED_BYTE))
+			return;
+		gl_renderer_account_bytes(&gr->fbo_bytes, &gr->fbo_bytes_peak,
+					  gs->rgb_cache.bytes);
+	}
+
+	if (ensure_surface_buffer_is_ready(gr, gs) < 0)
+		return;
+
+	gl_shader_config_set_input_textures(&sconf, gs);
+	ARRAY_COPY(sconf.projection.d, projmat);
+	sconf.projection.type = WESTON_MATRIX_TRANSFORM_SCALE |
+				WESTON_MATRIX_TRANSFORM_TRANSLATE;
+
+	glBindFramebuffer(GL_FRAMEBUFFER, gs->rgb_cache.fbo);
+	glViewport(0, 0, width, height);
+	glDisable(GL_BLEND);
+
+	if (!gl_renderer_use_program(gr, &sconf))
+		return;
+
+	/* position and texcoord map the texture one to one */
+	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, verts);
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 0, verts);
+	glEnableVertexAttribArray(1);
+
+	glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+
+	glDisableVertexAttribArray(1);
+	glDisableVertexAttribArray(0);
+
+	gs->rgb_cache_valid = true;
+}
+
 /* NOTE: We now allow falling back to ARGB gl visuals when XRGB is
  * unavailable, so we're assuming the background has no transparency
  * and that everything with a blend, like drop shadows, will have something
@@ -1614,6 +2561,7 @@ gl_renderer_repaint_output(struct weston_output *output,
 	struct gl_output_state *go = get_output_state(output);
 	struct weston_compositor *compositor = output->compositor;
 	struct gl_renderer *gr = get_renderer(compositor);
+	struct gl_renderer_dmabuf_target *target = go->dmabuf_target;
 	EGLBoolean ret;
 	static int errored;
 	/* areas we've damaged since we last used this buffer */
@@ -1622,12 +2570,16 @@ gl_renderer_repaint_output(struct weston_output *output,
 	pixman_region32_t total_damage;
 	enum gl_border_status border_status = BORDER_STATUS_CLEAN;
 	struct weston_paint_node *pnode;
+	const char *phase;
 
 	assert(output->from_blend_to_output_by_backend ||
 	       output->from_blend_to_output == NULL || shadow_exists(go));
 
-	if (use_output(output) < 0)
+	phase = weston_watchdog_phase_enter("gl_renderer_repaint_output");
+	if (use_output(output) < 0) {
+		weston_watchdog_phase_leave(phase);
 		return;
+	}
 
 	/* Clear the used_in_output_repaint flag, so that we can properly track
 	 * which surfaces were used in this output repaint. */
@@ -1637,6 +2589,8 @@ gl_renderer_repaint_output(struct weston_output *output,
 			struct gl_surface_state *gs =
 				get_surface_state(pnode->view->surface);
 			gs->used_in_output_repaint = false;
+			gs->last_visible_frame = gr->frame_counter;
+			gl_surface_state_update_rgb_cache(gr, pnode->surface);
 		}
 	}
 
@@ -1647,17 +2601,26 @@ gl_renderer_repaint_output(struct weston_output *output,
 
 	go->begin_render_sync = create_render_sync(gr);
 
+	gl_gpu_time_collect(gr, output);
+	gl_gpu_time_frame_begin(gr, output);
+
 	/* Calculate the global GL matrix */
 	go->output_matrix = output->matrix;
 	weston_matrix_translate(&go->output_matrix,
 				-(output->current_mode->width / 2.0),
 				-(output->current_mode->height / 2.0), 0);
+	/* A dmabuf target is read top row first, so it needs no flip. */
 	weston_matrix_scale(&go->output_matrix,
 			    2.0 / output->current_mode->width,
-			    -2.0 / output->current_mode->height, 1);
+			    (target ? 2.0 : -2.0) / output->current_mode->height,
+			    1);
 
 	/* If using shadow, redirect all drawing to it first. */
-	if (shadow_exists(go)) {
+	if (target) {
+		glBindFramebuffer(GL_FRAMEBUFFER, target->fbo);
+		glViewport(0, 0, output->current_mode->width,
+			   output->current_mode->height);
+	} else if (shadow_exists(go)) {
 		/* XXX: Shadow code does not support resizing. */
 		assert(output->current_mode->width == go->shadow.width);
 		assert(output->current_mode->height == go->shadow.height);
@@ -1692,10 +2655,25 @@ gl_renderer_repaint_output(struct weston_output *output,
 	pixman_region32_init(&previous_damage);
 	pixman_region32_init(&total_damage); /* total area to redraw */
 
-	/* Update previous_damage using buffer_age (if available), and store
-	 * current damaged region for future use. */
-	output_get_damage(output, &previous_damage, &border_status);
-	output_rotate_damage(output, output_damage, go->border_status);
+	if (target) {
+		struct gl_renderer_dmabuf_target *other;
+
+		/* The target's own damage tracking takes the place of
+		 * buffer_age. */
+		pixman_region32_copy(&previous_damage, &target->damage);
+		pixman_region32_clear(&target->damage);
+		wl_list_for_each(other, &go->dmabuf_target_list, link) {
+			if (other != target)
+				pixman_region32_union(&other->damage,
+						      &other->damage,
+						      output_damage);
+		}
+	} else {
+		/* Update previous_damage using buffer_age (if available), and
+		 * store current damaged region for future use. */
+		output_get_damage(output, &previous_damage, &border_status);
+		output_rotate_damage(output, output_damage, go->border_status);
+	}
 
 	/* Redraw both areas which have changed since we last used this buffer,
 	 * as well as the areas we now want to repaint, to make sure the
@@ -1703,7 +2681,30 @@ gl_renderer_repaint_output(struct weston_output *output,
 	pixman_region32_union(&total_damage, &previous_damage, output_damage);
 	border_status |= go->border_status;
 
-	if (gr->has_egl_partial_update && !gr->fan_debug) {
+	/* Drawing more than the damage is always fine, as long as the
+	 * partial update region below covers it. */
+	if (!gr->fan_debug)
+		weston_region_simplify(&total_damage,
+				       compositor->damage_merge_pixels);
+
+	/* The damage of previous frames may lie under opaque overlays now.
+	 * Nothing there is seen, so it is left on the primary plane to be
+	 * drawn once the overlay moves away. */
+	if (pixman_region32_not_empty(&compositor->primary_plane.clip)) {
+		pixman_region32_t hidden;
+
+		pixman_region32_init(&hidden);
+		pixman_region32_intersect(&hidden, &total_damage,
+					  &compositor->primary_plane.clip);
+		pixman_region32_union(&compositor->primary_plane.damage,
+				      &compositor->primary_plane.damage,
+				      &hidden);
+		pixman_region32_subtract(&total_damage, &total_damage,
+					 &hidden);
+		pixman_region32_fini(&hidden);
+	}
+
+	if (gr->has_egl_partial_update && !gr->fan_debug && !target) {
 		int n_egl_rects;
 		EGLint *egl_rects;
 
@@ -1714,7 +2715,6 @@ gl_renderer_repaint_output(struct weston_output *output,
 					      &egl_rects, &n_egl_rects);
 		gr->set_damage_region(gr->egl_display, go->egl_surface,
 				      egl_rects, n_egl_rects);
-		free(egl_rects);
 	}
 
 	if (shadow_exists(go)) {
@@ -1737,13 +2737,21 @@ gl_renderer_repaint_output(struct weston_output *output,
 	pixman_region32_fini(&total_damage);
 	pixman_region32_fini(&previous_damage);
 
+	go->gpu_time_frame = NULL;
+
 	draw_output_borders(output, border_status);
 
 	wl_signal_emit(&output->frame_signal, output_damage);
 
 	go->end_render_sync = create_render_sync(gr);
 
-	if (gr->swap_buffers_with_damage && !gr->fan_debug) {
+	if (target) {
+		/* Nothing to swap, but the render sync objects only get
+		 * their fence fd after a flush. */
+		glFlush();
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		ret = EGL_TRUE;
+	} else if (gr->swap_buffers_with_damage && !gr->fan_debug) {
 		int n_egl_rects;
 		EGLint *egl_rects;
 
@@ -1755,7 +2763,6 @@ gl_renderer_repaint_output(struct weston_output *output,
 		ret = gr->swap_buffers_with_damage(gr->egl_display,
 						   go->egl_surface,
 						   egl_rects, n_egl_rects);
-		free(egl_rects);
 	} else {
 		ret = eglSwapBuffers(gr->egl_display, go->egl_surface);
 	}
@@ -1779,6 +2786,10 @@ gl_renderer_repaint_output(struct weston_output *output,
 	update_buffer_release_fences(compositor, output);
 
 	gl_renderer_garbage_collect_programs(gr);
+	gl_renderer_evict_textures(gr);
+	gr->frame_counter++;
+
+	weston_watchdog_phase_leave(phase);
 }
 
 static int
@@ -1814,142 +2825,1028 @@ gl_renderer_read_pixels(struct weston_output *output,
 	return 0;
 }
 
-static GLenum
-gl_format_from_internal(GLenum internal_format)
+static void
+gl_readback_destroy(struct gl_readback *rb)
 {
-	switch (internal_format) {
-	case GL_R8_EXT:
-		return GL_RED_EXT;
-	case GL_RG8_EXT:
-		return GL_RG_EXT;
-	case GL_RGBA16F:
-	case GL_RGB10_A2:
-		return GL_RGBA;
-	default:
-		return internal_format;
+	wl_list_remove(&rb->link);
+	wl_event_source_remove(rb->event_source);
+	close(rb->fd);
+	glDeleteBuffers(1, &rb->pbo);
+	free(rb);
+}
+
+static bool
+gl_readback_make_current(struct gl_readback *rb)
+{
+	struct gl_renderer *gr = rb->gr;
+
+	if (rb->output)
+		return use_output(rb->output) == 0;
+
+	return eglMakeCurrent(gr->egl_display, gr->dummy_surface,
+			      gr->dummy_surface, gr->egl_context) == EGL_TRUE;
+}
+
+static int
+gl_readback_handler(int fd, uint32_t mask, void *data)
+{
+	struct gl_readback *rb = data;
+	const void *pixels = NULL;
+
+	/* The fence signalled, so mapping does not wait for the GPU. */
+	if (gl_readback_make_current(rb)) {
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, rb->pbo);
+		pixels = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, rb->size,
+					  GL_MAP_READ_BIT);
 	}
+
+	rb->done(rb->data, pixels);
+
+	if (pixels)
+		glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+	gl_readback_destroy(rb);
+
+	return 0;
 }
 
-static void
-gl_renderer_flush_damage(struct weston_surface *surface)
+/* Queue a read of the current framebuffer into a new pack buffer, with
+ * completion signalled through a native fence polled from the event
+ * loop. On failure nothing is left of the read-back but rb itself. */
+static int
+gl_readback_start(struct gl_readback *rb, struct weston_compositor *ec,
+		  int x, int y, int width, int height, GLenum gl_format)
 {
-	const struct weston_testsuite_quirks *quirks =
-		&surface->compositor->test_data.test_quirks;
-	struct gl_surface_state *gs = get_surface_state(surface);
-	struct weston_buffer *buffer = gs->buffer_ref.buffer;
-	struct weston_view *view;
-	bool texture_used;
-	pixman_box32_t *rectangles;
-	uint8_t *data;
-	int i, j, n;
+	struct gl_renderer *gr = rb->gr;
+	struct wl_event_loop *loop;
+	EGLSyncKHR sync;
+
+	rb->size = (GLsizeiptr) width * height * 4;
+	rb->fd = -1;
+
+	glGenBuffers(1, &rb->pbo);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, rb->pbo);
+	glBufferData(GL_PIXEL_PACK_BUFFER, rb->size, NULL, GL_STREAM_READ);
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	glReadPixels(x, y, width, height, gl_format, GL_UNSIGNED_BYTE, NULL);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+	sync = create_render_sync(gr);
+	if (sync != EGL_NO_SYNC_KHR) {
+		glFlush();
+		rb->fd = gr->dup_native_fence_fd(gr->egl_display, sync);
+		gr->destroy_sync(gr->egl_display, sync);
+	}
+
+	if (rb->fd == EGL_NO_NATIVE_FENCE_FD_ANDROID) {
+		glDeleteBuffers(1, &rb->pbo);
+		return -1;
+	}
+
+	loop = wl_display_get_event_loop(ec->wl_display);
+	rb->event_source = wl_event_loop_add_fd(loop, rb->fd,
+						WL_EVENT_READABLE,
+						gl_readback_handler, rb);
+	if (!rb->event_source) {
+		close(rb->fd);
+		glDeleteBuffers(1, &rb->pbo);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int
+gl_renderer_read_pixels_async(struct weston_output *output,
+			      pixman_format_code_t format,
+			      uint32_t x, uint32_t y,
+			      uint32_t width, uint32_t height,
+			      weston_renderer_read_pixels_done_func_t done,
+			      void *data)
+{
+	struct gl_renderer *gr = get_renderer(output->compositor);
+	struct gl_output_state *go = get_output_state(output);
+	struct gl_readback *rb;
+	GLenum gl_format;
+
+	if (gr->gl_version < gr_gl_version(3, 0) || !gr->has_native_fence_sync)
+		return -1;
+
+	x += go->borders[GL_RENDERER_BORDER_LEFT].width;
+	y += go->borders[GL_RENDERER_BORDER_BOTTOM].height;
+
+	switch (format) {
+	case PIXMAN_a8r8g8b8:
+		gl_format = GL_BGRA_EXT;
+		break;
+	case PIXMAN_a8b8g8r8:
+		gl_format = GL_RGBA;
+		break;
+	default:
+		return -1;
+	}
+
+	if (use_output(output) < 0)
+		return -1;
+
+	rb = zalloc(sizeof *rb);
+	if (!rb)
+		return -1;
+
+	rb->gr = gr;
+	rb->output = output;
+	rb->done = done;
+	rb->data = data;
+
+	if (gl_readback_start(rb, output->compositor, x, y, width, height,
+			      gl_format) < 0) {
+		free(rb);
+		return -1;
+	}
+
+	wl_list_insert(&go->readback_list, &rb->link);
+
+	return 0;
+}
+
+static GLenum
+gl_format_from_internal(GLenum internal_format)
+{
+	switch (internal_format) {
+	case GL_R8_EXT:
+		return GL_RED_EXT;
+	case GL_RG8_EXT:
+		return GL_RG_EXT;
+	case GL_RGBA16F:
+	case GL_RGB10_A2:
+		return GL_RGBA;
+	default:
+		return internal_format;
+	}
+}
+
+/* Uploading a few unchanged pixels is cheaper than issuing many small
+ * uploads, so collapse fragmented damage into its bounding box.
+ */
+static bool
+texture_damage_should_merge(pixman_region32_t *damage)
+{
+	const pixman_box32_t *extents = pixman_region32_extents(damage);
+	pixman_box32_t *rects;
+	int64_t area = 0;
+	int64_t extents_area;
+	int i, n;
+
+	rects = pixman_region32_rectangles(damage, &n);
+	if (n <= 1)
+		return false;
+	if (n > 32)
+		return true;
+
+	for (i = 0; i < n; i++)
+		area += (int64_t) (rects[i].x2 - rects[i].x1) *
+			(rects[i].y2 - rects[i].y1);
+
+	extents_area = (int64_t) (extents->x2 - extents->x1) *
+		       (extents->y2 - extents->y1);
+
+	return extents_area <= 2 * area;
+}
+
+/* Row pitch in the staging buffer, matching GL_UNPACK_ALIGNMENT 4 */
+static inline size_t
+upload_row_pitch(int width, int bpp)
+{
+	return ((size_t) width * bpp + 3) & ~(size_t) 3;
+}
+
+/* Stage the damaged rectangles of a single-plane wl_shm buffer in a
+ * pixel unpack buffer, and upload them from there. The client memory is
+ * only read by one memcpy per row, and the texture uploads themselves do
+ * not have to complete before the draw is queued.
+ */
+static bool
+gl_renderer_upload_damage_pbo(struct gl_renderer *gr,
+			      struct gl_surface_state *gs,
+			      struct weston_surface *surface,
+			      const uint8_t *data,
+			      const pixman_box32_t *rects, int n)
+{
+	struct weston_buffer *buffer = gs->buffer_ref.buffer;
+	int stride = wl_shm_buffer_get_stride(buffer->shm_buffer);
+	int bpp = stride / gs->pitch;
+	pixman_box32_t *boxes;
+	size_t size = 0;
+	size_t offset;
+	uint8_t *map;
+	int i, y;
+
+	boxes = malloc(n * sizeof *boxes);
+	if (!boxes)
+		return false;
+
+	for (i = 0; i < n; i++) {
+		pixman_box32_t r = weston_surface_to_buffer_rect(surface,
+								 rects[i]);
+
+		r.x1 = MAX(r.x1, 0);
+		r.y1 = MAX(r.y1, 0);
+		r.x2 = MIN(r.x2, buffer->width);
+		r.y2 = MIN(r.y2, buffer->height);
+		if (r.x1 >= r.x2 || r.y1 >= r.y2)
+			r.x2 = r.x1;
+
+		boxes[i] = r;
+		size += upload_row_pitch(r.x2 - r.x1, bpp) * (r.y2 - r.y1);
+	}
+
+	if (size == 0) {
+		free(boxes);
+		return true;
+	}
+
+	if (gr->upload_pbo[0] == 0)
+		glGenBuffers(ARRAY_LENGTH(gr->upload_pbo), gr->upload_pbo);
+
+	/* Re-specifying the store lets the driver hand us fresh memory
+	 * instead of waiting for uploads still reading the old one. */
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, gr->upload_pbo[gr->upload_pbo_next]);
+	gr->upload_pbo_next = (gr->upload_pbo_next + 1) %
+			      ARRAY_LENGTH(gr->upload_pbo);
+	glBufferData(GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW);
+	map = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size,
+			       GL_MAP_WRITE_BIT |
+			       GL_MAP_INVALIDATE_BUFFER_BIT);
+	if (!map) {
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		free(boxes);
+		return false;
+	}
+
+	offset = 0;
+	for (i = 0; i < n; i++) {
+		const pixman_box32_t *r = &boxes[i];
+		size_t row = (r->x2 - r->x1) * bpp;
+
+		for (y = r->y1; y < r->y2; y++) {
+			memcpy(map + offset,
+			       data + gs->offset[0] + y * stride + r->x1 * bpp,
+			       row);
+			offset += upload_row_pitch(r->x2 - r->x1, bpp);
+		}
+	}
+	glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glPixelStorei(GL_UNPACK_ROW_LENGTH_EXT, 0);
+	glPixelStorei(GL_UNPACK_SKIP_PIXELS_EXT, 0);
+	glPixelStorei(GL_UNPACK_SKIP_ROWS_EXT, 0);
+	glBindTexture(GL_TEXTURE_2D, gs->textures[0]);
+
+	offset = 0;
+	for (i = 0; i < n; i++) {
+		const pixman_box32_t *r = &boxes[i];
+
+		if (r->x1 == r->x2)
+			continue;
+
+		glTexSubImage2D(GL_TEXTURE_2D, 0,
+				r->x1, r->y1,
+				r->x2 - r->x1, r->y2 - r->y1,
+				gl_format_from_internal(gs->gl_format[0]),
+				gs->gl_pixel_type,
+				(const void *) (uintptr_t) offset);
+		offset += upload_row_pitch(r->x2 - r->x1, bpp) *
+			  (r->y2 - r->y1);
+	}
+
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	free(boxes);
+
+	return true;
+}
+
+/* A pooled texture larger than the buffer has stale texels past its last
+ * column and row. Repeat the edge into them, as clamping would, so that
+ * linear filtering does not blend them in. */
+static void
+pad_pooled_textures(struct gl_surface_state *gs, const uint8_t *data,
+		    bool right, bool bottom)
+{
+	int w, h, j;
+
+	for (j = 0; j < gs->num_textures; j++) {
+		w = gs->pitch / gs->hsub[j];
+		h = gs->height / gs->vsub[j];
+
+		glBindTexture(GL_TEXTURE_2D, gs->textures[j]);
+		glPixelStorei(GL_UNPACK_ROW_LENGTH_EXT, w);
+		if (right && gs->tex_width[j] > w) {
+			glPixelStorei(GL_UNPACK_SKIP_PIXELS_EXT, w - 1);
+			glPixelStorei(GL_UNPACK_SKIP_ROWS_EXT, 0);
+			glTexSubImage2D(GL_TEXTURE_2D, 0, w, 0, 1, h,
+					gl_format_from_internal(gs->gl_format[j]),
+					gs->gl_pixel_type,
+					data + gs->offset[j]);
+		}
+		if (bottom && gs->tex_height[j] > h) {
+			glPixelStorei(GL_UNPACK_SKIP_PIXELS_EXT, 0);
+			glPixelStorei(GL_UNPACK_SKIP_ROWS_EXT, h - 1);
+			glTexSubImage2D(GL_TEXTURE_2D, 0, 0, h, w, 1,
+					gl_format_from_internal(gs->gl_format[j]),
+					gs->gl_pixel_type,
+					data + gs->offset[j]);
+		}
+	}
+}
+
+static void
+upload_full_shm(struct gl_surface_state *gs, struct weston_buffer *buffer)
+{
+	uint8_t *data = wl_shm_buffer_get_data(buffer->shm_buffer);
+	int j;
+
+	glActiveTexture(GL_TEXTURE0);
+	glPixelStorei(GL_UNPACK_SKIP_PIXELS_EXT, 0);
+	glPixelStorei(GL_UNPACK_SKIP_ROWS_EXT, 0);
+	wl_shm_buffer_begin_access(buffer->shm_buffer);
+	for (j = 0; j < gs->num_textures; j++) {
+		glBindTexture(GL_TEXTURE_2D, gs->textures[j]);
+		glPixelStorei(GL_UNPACK_ROW_LENGTH_EXT,
+			      gs->pitch / gs->hsub[j]);
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0,
+				gs->pitch / gs->hsub[j],
+				buffer->height / gs->vsub[j],
+				gl_format_from_internal(gs->gl_format[j]),
+				gs->gl_pixel_type,
+				data + gs->offset[j]);
+	}
+	pad_pooled_textures(gs, data, true, true);
+	wl_shm_buffer_end_access(buffer->shm_buffer);
+}
+
+static bool
+gl_renderer_flush_damage(struct weston_surface *surface)
+{
+	const struct weston_testsuite_quirks *quirks =
+		&surface->compositor->test_data.test_quirks;
+	struct gl_renderer *gr = get_renderer(surface->compositor);
+	struct gl_surface_state *gs = get_surface_state(surface);
+	struct weston_buffer *buffer = gs->buffer_ref.buffer;
+	struct weston_view *view;
+	bool texture_used;
+	pixman_box32_t *rectangles;
+	pixman_box32_t merged;
+	pixman_box32_t edges;
+	uint8_t *data;
+	int i, j, n;
+
+	pixman_region32_union(&gs->texture_damage,
+			      &gs->texture_damage, &surface->damage);
+
+	if (pixman_region32_not_empty(&surface->damage))
+		gs->rgb_cache_valid = false;
+
+	/* Already uploaded, see below */
+	if (!buffer)
+		return true;
+
+	/* Avoid upload, if the texture won't be used this time.
+	 * We still accumulate the damage in texture_damage, and
+	 * hold the reference to the buffer, in case the surface
+	 * migrates back to the primary plane.
+	 */
+	texture_used = false;
+	wl_list_for_each(view, &surface->views, surface_link) {
+		if (view->plane == &surface->compositor->primary_plane) {
+			texture_used = true;
+			break;
+		}
+	}
+	if (!texture_used)
+		return false;
+
+	if (!pixman_region32_not_empty(&gs->texture_damage) &&
+	    !gs->needs_full_upload)
+		goto done;
+
+	data = wl_shm_buffer_get_data(buffer->shm_buffer);
+
+	glActiveTexture(GL_TEXTURE0);
+
+	if (gs->needs_full_upload || quirks->gl_force_full_upload) {
+		upload_full_shm(gs, buffer);
+		goto done;
+	}
+
+	if (texture_damage_should_merge(&gs->texture_damage)) {
+		merged = *pixman_region32_extents(&gs->texture_damage);
+		rectangles = &merged;
+		n = 1;
+	} else {
+		rectangles = pixman_region32_rectangles(&gs->texture_damage,
+							&n);
+	}
+	edges = weston_surface_to_buffer_rect(surface,
+			*pixman_region32_extents(&gs->texture_damage));
+
+	wl_shm_buffer_begin_access(buffer->shm_buffer);
+	if (gr->has_pbo_upload && gs->num_textures == 1 &&
+	    gl_renderer_upload_damage_pbo(gr, gs, surface, data,
+					  rectangles, n)) {
+		pad_pooled_textures(gs, data, edges.x2 >= buffer->width,
+				    edges.y2 >= buffer->height);
+		wl_shm_buffer_end_access(buffer->shm_buffer);
+		goto done;
+	}
+
+	for (i = 0; i < n; i++) {
+		pixman_box32_t r;
+
+		r = weston_surface_to_buffer_rect(surface, rectangles[i]);
+
+		for (j = 0; j < gs->num_textures; j++) {
+			glBindTexture(GL_TEXTURE_2D, gs->textures[j]);
+			glPixelStorei(GL_UNPACK_ROW_LENGTH_EXT,
+				      gs->pitch / gs->hsub[j]);
+			glPixelStorei(GL_UNPACK_SKIP_PIXELS_EXT,
+				      r.x1 / gs->hsub[j]);
+			glPixelStorei(GL_UNPACK_SKIP_ROWS_EXT,
+				      r.y1 / gs->hsub[j]);
+			glTexSubImage2D(GL_TEXTURE_2D, 0,
+					r.x1 / gs->hsub[j],
+					r.y1 / gs->vsub[j],
+					(r.x2 - r.x1) / gs->hsub[j],
+					(r.y2 - r.y1) / gs->vsub[j],
+					gl_format_from_internal(gs->gl_format[j]),
+					gs->gl_pixel_type,
+					data + gs->offset[j]);
+		}
+	}
+	pad_pooled_textures(gs, data, edges.x2 >= buffer->width,
+			    edges.y2 >= buffer->height);
+	wl_shm_buffer_end_access(buffer->shm_buffer);
+
+done:
+	pixman_region32_fini(&gs->texture_damage);
+	pixman_region32_init(&gs->texture_damage);
+	gs->needs_full_upload = false;
+
+	/* The textures may get evicted while hidden, and are then uploaded
+	 * again from this buffer. */
+	if (surface->compositor->texture_evict_frames > 0)
+		return false;
+
+	weston_buffer_reference(&gs->buffer_ref, NULL);
+	weston_buffer_release_reference(&gs->buffer_release_ref, NULL);
+
+	return true;
+}
+
+/* Sized internal formats for immutable storage, 0 where there is none */
+static GLenum
+gl_sized_format(struct gl_renderer *gr, GLenum gl_format,
+		GLenum gl_pixel_type)
+{
+	switch (gl_format) {
+	case GL_BGRA_EXT:
+		return gr->has_bgra8_storage ? GL_BGRA8_EXT : 0;
+	case GL_RGBA:
+		return gl_pixel_type == GL_UNSIGNED_BYTE ? GL_RGBA8 : 0;
+	case GL_RGB:
+		return gl_pixel_type == GL_UNSIGNED_SHORT_5_6_5 ? GL_RGB565 : 0;
+	case GL_R8_EXT:
+	case GL_RG8_EXT:
+	case GL_RGB10_A2:
+	case GL_RGBA16F:
+		return gl_format;
+	default:
+		return 0;
+	}
+}
+
+static int
+gl_texture_size_class(struct gl_renderer *gr, int size)
+{
+	int rounded = (size + GL_TEXTURE_SIZE_CLASS - 1) /
+		      GL_TEXTURE_SIZE_CLASS * GL_TEXTURE_SIZE_CLASS;
+
+	return MAX(MIN(rounded, gr->max_texture_size), size);
+}
+
+static void
+gl_texture_pool_trim(struct gl_renderer *gr, size_t max_bytes)
+{
+	struct gl_pooled_texture *pt;
+
+	while (!wl_list_empty(&gr->texture_pool) &&
+	       (max_bytes == 0 || gr->texture_pool_bytes > max_bytes)) {
+		pt = wl_container_of(gr->texture_pool.prev, pt, link);
+		glDeleteTextures(1, &pt->tex);
+		gr->texture_pool_bytes -= pt->bytes;
+		wl_list_remove(&pt->link);
+		free(pt);
+	}
+}
+
+/** Get a wl_shm texture of the given size class
+ *
+ * Reuses a texture some surface released with the same format and size,
+ * or allocates one, with immutable storage where the driver offers it.
+ * The contents are undefined.
+ */
+static GLuint
+gl_texture_pool_get(struct gl_renderer *gr, GLenum gl_format,
+		    GLenum gl_pixel_type, int width, int height)
+{
+	struct gl_pooled_texture *pt;
+	GLenum sized_format = 0;
+	GLuint tex;
+
+	wl_list_for_each(pt, &gr->texture_pool, link) {
+		if (pt->gl_format != gl_format ||
+		    pt->gl_pixel_type != gl_pixel_type ||
+		    pt->width != width || pt->height != height)
+			continue;
+
+		tex = pt->tex;
+		gr->texture_pool_bytes -= pt->bytes;
+		gr->texture_pool_reuses++;
+		wl_list_remove(&pt->link);
+		free(pt);
+		return tex;
+	}
+
+	gr->texture_pool_allocs++;
+	glActiveTexture(GL_TEXTURE0);
+	glGenTextures(1, &tex);
+	glBindTexture(GL_TEXTURE_2D, tex);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+	if (gr->tex_storage_2d)
+		sized_format = gl_sized_format(gr, gl_format, gl_pixel_type);
+	if (sized_format)
+		gr->tex_storage_2d(GL_TEXTURE_2D, 1, sized_format,
+				   width, height);
+	else
+		glTexImage2D(GL_TEXTURE_2D, 0, gl_format, width, height, 0,
+			     gl_format_from_internal(gl_format),
+			     gl_pixel_type, NULL);
+
+	return tex;
+}
+
+static void
+gl_texture_pool_put(struct gl_renderer *gr, GLuint tex, GLenum gl_format,
+		    GLenum gl_pixel_type, int width, int height)
+{
+	struct gl_pooled_texture *pt;
+	size_t bytes = (size_t)width * height *
+		       texel_size(gl_format, gl_pixel_type);
+
+	pt = bytes <= GL_TEXTURE_POOL_MAX_BYTES ? zalloc(sizeof *pt) : NULL;
+	if (!pt) {
+		glDeleteTextures(1, &tex);
+		return;
+	}
+
+	pt->tex = tex;
+	pt->gl_format = gl_format;
+	pt->gl_pixel_type = gl_pixel_type;
+	pt->width = width;
+	pt->height = height;
+	pt->bytes = bytes;
+	wl_list_insert(&gr->texture_pool, &pt->link);
+	gr->texture_pool_bytes += bytes;
+
+	gl_texture_pool_trim(gr, GL_TEXTURE_POOL_MAX_BYTES);
+}
+
+/** Drop the textures of a surface, recycling pooled ones if asked to */
+static void
+gl_surface_state_release_textures(struct gl_renderer *gr,
+				  struct gl_surface_state *gs, bool recycle)
+{
+	int j;
+
+	if (gs->textures_pooled && recycle) {
+		for (j = 0; j < gs->num_textures; j++)
+			gl_texture_pool_put(gr, gs->textures[j],
+					    gs->gl_format[j],
+					    gs->gl_pixel_type,
+					    gs->tex_width[j],
+					    gs->tex_height[j]);
+	} else {
+		glDeleteTextures(gs->num_textures, gs->textures);
+	}
+
+	gs->num_textures = 0;
+	gs->textures_pooled = false;
+}
+
+/* Textures for gs->gl_format at gs->tex_width x gs->tex_height */
+static void
+gl_surface_state_get_pooled_textures(struct gl_renderer *gr,
+				     struct gl_surface_state *gs,
+				     int num_textures)
+{
+	int j;
+
+	for (j = 0; j < num_textures; j++)
+		gs->textures[j] = gl_texture_pool_get(gr, gs->gl_format[j],
+						      gs->gl_pixel_type,
+						      gs->tex_width[j],
+						      gs->tex_height[j]);
+	gs->num_textures = num_textures;
+	gs->textures_pooled = true;
+	glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+static void
+ensure_textures(struct gl_surface_state *gs, GLenum target, int num_textures)
+{
+	int i;
+
+	/* Immutable SHM textures cannot take an EGLImage. */
+	if (gs->textures_pooled)
+		gl_surface_state_release_textures(
+			get_renderer(gs->surface->compositor), gs, true);
+
+	if (num_textures <= gs->num_textures) {
+		glDeleteTextures(gs->num_textures - num_textures, &gs->textures[num_textures]);
+		gs->num_textures = num_textures;
+		return;
+	}
+
+	glActiveTexture(GL_TEXTURE0);
+
+	for (i = gs->num_textures; i < num_textures; i++) {
+		glGenTextures(1, &gs->textures[i]);
+		glBindTexture(target, gs->textures[i]);
+		glTexParameteri(target, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(target, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	}
+	gs->num_textures = num_textures;
+	glBindTexture(target, 0);
+}
+
+static void
+client_memory_destroy(struct gl_client_memory *cm)
+{
+	wl_list_remove(&cm->link);
+	wl_list_remove(&cm->destroy_listener.link);
+	free(cm);
+}
+
+static void
+client_memory_handle_client_destroy(struct wl_listener *listener, void *data)
+{
+	struct gl_client_memory *cm =
+		container_of(listener, struct gl_client_memory,
+			     destroy_listener);
+	struct gl_surface_state *gs;
+
+	/* The client's surfaces are destroyed after this. */
+	wl_list_for_each(gs, &cm->gr->surface_state_list, link) {
+		if (gs->client_memory == cm)
+			gs->client_memory = NULL;
+	}
+
+	client_memory_destroy(cm);
+}
+
+static void
+gl_surface_state_bind_client(struct gl_renderer *gr,
+			     struct gl_surface_state *gs)
+{
+	struct gl_client_memory *cm;
+	struct wl_client *client;
+
+	if (gs->client_memory || !gs->surface->resource)
+		return;
+
+	client = wl_resource_get_client(gs->surface->resource);
+	wl_list_for_each(cm, &gr->client_memory_list, link) {
+		if (cm->client == client) {
+			gs->client_memory = cm;
+			break;
+		}
+	}
+
+	if (!gs->client_memory) {
+		cm = zalloc(sizeof *cm);
+		if (!cm)
+			return;
+
+		cm->gr = gr;
+		cm->client = client;
+		cm->destroy_listener.notify =
+			client_memory_handle_client_destroy;
+		wl_client_add_destroy_listener(client, &cm->destroy_listener);
+		wl_list_insert(&gr->client_memory_list, &cm->link);
+		gs->client_memory = cm;
+	}
+
+	/* Charge what the surface already holds to its client. */
+	cm = gs->client_memory;
+	if (!gs->textures_evicted)
+		gl_renderer_account_bytes(&cm->texture_bytes,
+					  &cm->texture_bytes_peak,
+					  gs->texture_bytes);
+	gl_renderer_account_bytes(&cm->import_bytes, &cm->import_bytes_peak,
+				  gs->import_bytes);
+}
+
+static void
+account_texture_bytes(struct gl_renderer *gr, struct gl_surface_state *gs,
+		      ssize_t delta)
+{
+	struct gl_client_memory *cm = gs->client_memory;
+
+	gl_renderer_account_bytes(&gr->texture_bytes, &gr->texture_bytes_peak,
+				  delta);
+	if (cm)
+		gl_renderer_account_bytes(&cm->texture_bytes,
+					  &cm->texture_bytes_peak, delta);
+}
+
+static void
+gl_surface_state_set_texture_bytes(struct gl_surface_state *gs, size_t bytes)
+{
+	struct gl_renderer *gr = get_renderer(gs->surface->compositor);
+
+	if (!gs->textures_evicted)
+		account_texture_bytes(gr, gs, -(ssize_t)gs->texture_bytes);
+	gs->texture_bytes = bytes;
+	gs->textures_evicted = false;
+	account_texture_bytes(gr, gs, bytes);
+}
+
+static void
+gl_surface_state_set_import_bytes(struct gl_surface_state *gs, size_t bytes)
+{
+	struct gl_renderer *gr = get_renderer(gs->surface->compositor);
+	struct gl_client_memory *cm = gs->client_memory;
+	ssize_t delta = (ssize_t)bytes - (ssize_t)gs->import_bytes;
+
+	gs->import_bytes = bytes;
+	gl_renderer_account_bytes(&gr->import_bytes, &gr->import_bytes_peak,
+				  delta);
+	if (cm)
+		gl_renderer_account_bytes(&cm->import_bytes,
+					  &cm->import_bytes_peak, delta);
+}
+
+/** Enforce [core] client-memory-budget
+ *
+ * A client whose textures and imported buffers exceed the budget is
+ * disconnected with a no_memory error.
+ */
+static void
+gl_surface_state_check_client_budget(struct gl_renderer *gr,
+				     struct gl_surface_state *gs)
+{
+	struct gl_client_memory *cm = gs->client_memory;
+	size_t budget = (size_t)gr->compositor->client_memory_budget_mib << 20;
+	pid_t pid;
+
+	if (!cm || budget == 0 || cm->over_budget ||
+	    cm->texture_bytes + cm->import_bytes <= budget)
+		return;
+
+	wl_client_get_credentials(cm->client, &pid, NULL, NULL);
+	weston_log("Client %d uses %zu KiB of GPU memory, more than its "
+		   "budget of %u MiB, disconnecting.\n", pid,
+		   (cm->texture_bytes + cm->import_bytes) >> 10,
+		   gr->compositor->client_memory_budget_mib);
+	cm->over_budget = true;
+	wl_client_post_no_memory(cm->client);
+}
+
+static bool
+surface_is_in_scene(struct weston_surface *surface)
+{
+	struct weston_paint_node *pnode, *pn;
+
+	wl_list_for_each(pnode, &surface->paint_node_list, surface_link) {
+		wl_list_for_each(pn, &pnode->output->paint_node_z_order_list,
+				 z_order_link) {
+			if (pn == pnode)
+				return true;
+		}
+	}
+
+	return false;
+}
+
+static bool
+gl_surface_state_can_evict(struct gl_renderer *gr,
+			   struct gl_surface_state *gs, uint32_t frames)
+{
+	/* Only SHM textures are copies the renderer owns; the buffer must
+	 * still be around to upload them again. */
+	if (gs->buffer_type != BUFFER_TYPE_SHM || gs->textures_evicted ||
+	    gs->texture_bytes == 0 || !gs->buffer_ref.buffer)
+		return false;
+
+	if (gr->frame_counter - gs->last_visible_frame < frames)
+		return false;
+
+	return !surface_is_in_scene(gs->surface);
+}
 
-	pixman_region32_union(&gs->texture_damage,
-			      &gs->texture_damage, &surface->damage);
+static void
+gl_surface_state_evict(struct gl_renderer *gr, struct gl_surface_state *gs)
+{
+	gs->evicted_num_textures = gs->num_textures;
+	gl_surface_state_release_textures(gr, gs, false);
+	gl_surface_state_drop_rgb_cache(gr, gs);
+	gs->textures_evicted = true;
+	account_texture_bytes(gr, gs, -(ssize_t)gs->texture_bytes);
+}
 
-	if (!buffer)
+/** Release textures of surfaces that have not been drawn for a while
+ *
+ * Runs after each output repaint while texture-evict-frames is set, and
+ * releases least recently drawn SHM textures until the resident total
+ * fits in texture-budget again.
+ */
+static void
+gl_renderer_evict_textures(struct gl_renderer *gr)
+{
+	struct weston_compositor *ec = gr->compositor;
+	size_t budget = (size_t)ec->texture_budget_mib << 20;
+	struct gl_surface_state *gs, *oldest;
+
+	if (ec->texture_evict_frames == 0)
 		return;
 
-	/* Avoid upload, if the texture won't be used this time.
-	 * We still accumulate the damage in texture_damage, and
-	 * hold the reference to the buffer, in case the surface
-	 * migrates back to the primary plane.
-	 */
-	texture_used = false;
-	wl_list_for_each(view, &surface->views, surface_link) {
-		if (view->plane == &surface->compositor->primary_plane) {
-			texture_used = true;
-			break;
+	if (gr->texture_bytes + gr->texture_pool_bytes > budget)
+		gl_texture_pool_trim(gr, 0);
+
+	while (gr->texture_bytes > budget) {
+		oldest = NULL;
+		wl_list_for_each(gs, &gr->surface_state_list, link) {
+			if (!gl_surface_state_can_evict(gr, gs,
+							ec->texture_evict_frames))
+				continue;
+			if (!oldest ||
+			    gs->last_visible_frame < oldest->last_visible_frame)
+				oldest = gs;
 		}
+		if (!oldest)
+			break;
+
+		gl_surface_state_evict(gr, oldest);
 	}
-	if (!texture_used)
-		return;
+}
 
-	if (!pixman_region32_not_empty(&gs->texture_damage) &&
-	    !gs->needs_full_upload)
-		goto done;
+/** Release everything that is recreated on demand
+ *
+ * Hidden surfaces lose their SHM textures as far as the buffer is kept
+ * to upload them again, and all shader programs but the one in use go.
+ */
+static void
+gl_renderer_trim_memory(struct weston_compositor *ec,
+			struct weston_memory_trim *trim)
+{
+	struct gl_renderer *gr = get_renderer(ec);
+	size_t texture_bytes = gr->texture_bytes + gr->texture_pool_bytes;
+	struct gl_surface_state *gs;
 
-	data = wl_shm_buffer_get_data(buffer->shm_buffer);
+	if (eglMakeCurrent(gr->egl_display, gr->dummy_surface,
+			   gr->dummy_surface, gr->egl_context) == EGL_FALSE)
+		return;
 
-	glActiveTexture(GL_TEXTURE0);
+	trim->programs += gl_renderer_trim_programs(gr);
 
-	if (gs->needs_full_upload || quirks->gl_force_full_upload) {
-		glPixelStorei(GL_UNPACK_SKIP_PIXELS_EXT, 0);
-		glPixelStorei(GL_UNPACK_SKIP_ROWS_EXT, 0);
-		wl_shm_buffer_begin_access(buffer->shm_buffer);
-		for (j = 0; j < gs->num_textures; j++) {
-			glBindTexture(GL_TEXTURE_2D, gs->textures[j]);
-			glPixelStorei(GL_UNPACK_ROW_LENGTH_EXT,
-				      gs->pitch / gs->hsub[j]);
-			glTexImage2D(GL_TEXTURE_2D, 0,
-				     gs->gl_format[j],
-				     gs->pitch / gs->hsub[j],
-				     buffer->height / gs->vsub[j],
-				     0,
-				     gl_format_from_internal(gs->gl_format[j]),
-				     gs->gl_pixel_type,
-				     data + gs->offset[j]);
-		}
-		wl_shm_buffer_end_access(buffer->shm_buffer);
-		goto done;
+	wl_list_for_each(gs, &gr->surface_state_list, link) {
+		if (gl_surface_state_can_evict(gr, gs, 0))
+			gl_surface_state_evict(gr, gs);
 	}
+	gl_texture_pool_trim(gr, 0);
+	trim->texture_bytes += texture_bytes - gr->texture_bytes;
 
-	rectangles = pixman_region32_rectangles(&gs->texture_damage, &n);
-	wl_shm_buffer_begin_access(buffer->shm_buffer);
-	for (i = 0; i < n; i++) {
-		pixman_box32_t r;
+	trim->dmabuf_imports += gr->dmabuf_cache_len;
+	dmabuf_cache_flush(gr);
+}
 
-		r = weston_surface_to_buffer_rect(surface, rectangles[i]);
+/** Recreate evicted textures from the still referenced SHM buffer */
+static void
+gl_surface_state_restore(struct gl_surface_state *gs)
+{
+	struct gl_renderer *gr = get_renderer(gs->surface->compositor);
 
-		for (j = 0; j < gs->num_textures; j++) {
-			glBindTexture(GL_TEXTURE_2D, gs->textures[j]);
-			glPixelStorei(GL_UNPACK_ROW_LENGTH_EXT,
-				      gs->pitch / gs->hsub[j]);
-			glPixelStorei(GL_UNPACK_SKIP_PIXELS_EXT,
-				      r.x1 / gs->hsub[j]);
-			glPixelStorei(GL_UNPACK_SKIP_ROWS_EXT,
-				      r.y1 / gs->hsub[j]);
-			glTexSubImage2D(GL_TEXTURE_2D, 0,
-					r.x1 / gs->hsub[j],
-					r.y1 / gs->vsub[j],
-					(r.x2 - r.x1) / gs->hsub[j],
-					(r.y2 - r.y1) / gs->vsub[j],
-					gl_format_from_internal(gs->gl_format[j]),
-					gs->gl_pixel_type,
-					data + gs->offset[j]);
-		}
-	}
-	wl_shm_buffer_end_access(buffer->shm_buffer);
+	if (!gs->textures_evicted)
+		return;
 
-done:
-	pixman_region32_fini(&gs->texture_damage);
-	pixman_region32_init(&gs->texture_damage);
-	gs->needs_full_upload = false;
+	gl_surface_state_get_pooled_textures(gr, gs, gs->evicted_num_textures);
+	gl_surface_state_set_texture_bytes(gs, gs->texture_bytes);
+	upload_full_shm(gs, gs->buffer_ref.buffer);
 
-	weston_buffer_reference(&gs->buffer_ref, NULL);
-	weston_buffer_release_reference(&gs->buffer_release_ref, NULL);
+	pixman_region32_clear(&gs->texture_damage);
+	gs->needs_full_upload = false;
 }
 
 static void
-ensure_textures(struct gl_surface_state *gs, GLenum target, int num_textures)
+memory_scope_print_surface(struct weston_log_subscription *subs,
+			   struct gl_surface_state *gs)
 {
-	int i;
+	struct weston_surface *surface = gs->surface;
+	char desc[512];
 
-	if (num_textures <= gs->num_textures) {
-		glDeleteTextures(gs->num_textures - num_textures, &gs->textures[num_textures]);
-		gs->num_textures = num_textures;
+	if (gs->texture_bytes == 0 && gs->import_bytes == 0)
 		return;
-	}
 
-	glActiveTexture(GL_TEXTURE0);
+	if (!surface->get_label ||
+	    surface->get_label(surface, desc, sizeof(desc)) < 0)
+		strcpy(desc, "[no description available]");
+
+	weston_log_subscription_printf(subs,
+		"\t\tsurface %u (%s), %dx%d: textures %zu%s, imported %zu\n",
+		surface->resource ? wl_resource_get_id(surface->resource) : 0,
+		desc, surface->width, surface->height,
+		gs->texture_bytes >> 10,
+		gs->textures_evicted ? " (evicted)" : "",
+		gs->import_bytes >> 10);
+}
 
-	for (i = gs->num_textures; i < num_textures; i++) {
-		glGenTextures(1, &gs->textures[i]);
-		glBindTexture(target, gs->textures[i]);
-		glTexParameteri(target, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-		glTexParameteri(target, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+/** Print the memory held per client and surface
+ *
+ * One-shot "gl-memory" debug scope: textures are copies the renderer
+ * owns, imported buffers are client allocations the renderer wraps in
+ * EGLImages, framebuffers are the renderer's own render targets.
+ */
+static void
+gl_memory_scope_new_subscription(struct weston_log_subscription *subs,
+				 void *data)
+{
+	struct gl_renderer *gr = data;
+	struct gl_client_memory *cm;
+	struct gl_surface_state *gs;
+	pid_t pid;
+
+	weston_log_subscription_printf(subs,
+		"GL renderer memory in KiB, current (peak):\n"
+		"\ttextures: %zu (%zu)\n"
+		"\timported buffers: %zu (%zu)\n"
+		"\tframebuffers: %zu (%zu)\n"
+		"\ttexture pool: %zu, %" PRIu64 " reused, %" PRIu64
+		" allocated\n",
+		gr->texture_bytes >> 10, gr->texture_bytes_peak >> 10,
+		gr->import_bytes >> 10, gr->import_bytes_peak >> 10,
+		gr->fbo_bytes >> 10, gr->fbo_bytes_peak >> 10,
+		gr->texture_pool_bytes >> 10, gr->texture_pool_reuses,
+		gr->texture_pool_allocs);
+
+	wl_list_for_each(cm, &gr->client_memory_list, link) {
+		wl_client_get_credentials(cm->client, &pid, NULL, NULL);
+		weston_log_subscription_printf(subs,
+			"\tclient pid %d: textures %zu (%zu), "
+			"imported %zu (%zu)\n", pid,
+			cm->texture_bytes >> 10, cm->texture_bytes_peak >> 10,
+			cm->import_bytes >> 10, cm->import_bytes_peak >> 10);
+
+		wl_list_for_each(gs, &gr->surface_state_list, link) {
+			if (gs->client_memory == cm)
+				memory_scope_print_surface(subs, gs);
+		}
 	}
-	gs->num_textures = num_textures;
-	glBindTexture(target, 0);
+
+	weston_log_subscription_printf(subs, "\tcompositor:\n");
+	wl_list_for_each(gs, &gr->surface_state_list, link) {
+		if (!gs->client_memory)
+			memory_scope_print_surface(subs, gs);
+	}
+
+	weston_log_subscription_complete(subs);
+}
+
+static void
+gl_renderer_write_metrics(struct wl_listener *listener, void *data)
+{
+	struct gl_renderer *gr =
+		container_of(listener, struct gl_renderer, metrics_listener);
+	struct weston_metrics *m = data;
+	const struct {
+		const char *kind;
+		size_t bytes;
+	} usage[] = {
+		{ "textures", gr->texture_bytes },
+		{ "imported", gr->import_bytes },
+		{ "framebuffers", gr->fbo_bytes },
+		{ "texture-pool", gr->texture_pool_bytes },
+	};
+	unsigned int i;
+
+	weston_metrics_family(m, "weston_gl_memory_bytes", "gauge", "bytes",
+			      "GPU memory held by the GL renderer, see gl-memory");
+	for (i = 0; i < ARRAY_LENGTH(usage); i++)
+		weston_metrics_sample(m, "weston_gl_memory_bytes",
+				      usage[i].bytes, "kind", usage[i].kind,
+				      NULL);
 }
 
 static void
@@ -1963,6 +3860,7 @@ gl_renderer_attach_shm(struct weston_surface *es, struct weston_buffer *buffer,
 	GLenum gl_pixel_type;
 	int pitch;
 	int num_planes;
+	int tex_width, tex_height;
 	bool using_glesv2 = gr->gl_version < gr_gl_version(3, 0);
 
 	buffer->shm_buffer = shm_buffer;
@@ -2112,16 +4010,28 @@ unsupported:
 		return;
 	}
 
+	tex_width = gl_texture_size_class(gr, pitch);
+	tex_height = gl_texture_size_class(gr, buffer->height);
+
 	/* Only allocate a texture if it doesn't match existing one.
 	 * If a switch from DRM allocated buffer to a SHM buffer is
-	 * happening, we need to allocate a new texture buffer. */
-	if (pitch != gs->pitch ||
-	    buffer->height != gs->height ||
+	 * happening, we need to allocate a new texture buffer. Sizes
+	 * within the same size class keep the textures. */
+	if (tex_width != gs->tex_width[0] ||
+	    tex_height != gs->tex_height[0] ||
+	    num_planes != gs->num_textures ||
+	    !gs->textures_pooled ||
 	    gl_format[0] != gs->gl_format[0] ||
 	    gl_format[1] != gs->gl_format[1] ||
 	    gl_format[2] != gs->gl_format[2] ||
 	    gl_pixel_type != gs->gl_pixel_type ||
-	    gs->buffer_type != BUFFER_TYPE_SHM) {
+	    gs->buffer_type != BUFFER_TYPE_SHM ||
+	    gs->textures_evicted) {
+		size_t bytes = 0;
+		int j;
+
+		gl_surface_state_release_textures(gr, gs, true);
+
 		gs->pitch = pitch;
 		gs->height = buffer->height;
 		gs->gl_format[0] = gl_format[0];
@@ -2135,7 +4045,18 @@ unsupported:
 
 		gs->surface = es;
 
-		ensure_textures(gs, GL_TEXTURE_2D, num_planes);
+		for (j = 0; j < num_planes; j++) {
+			gs->tex_width[j] = tex_width / gs->hsub[j];
+			gs->tex_height[j] = tex_height / gs->vsub[j];
+			bytes += (size_t)gs->tex_width[j] * gs->tex_height[j] *
+				 texel_size(gl_format[j], gl_pixel_type);
+		}
+		gl_surface_state_get_pooled_textures(gr, gs, num_planes);
+		gl_surface_state_set_texture_bytes(gs, bytes);
+	} else if (pitch != gs->pitch || buffer->height != gs->height) {
+		gs->pitch = pitch;
+		gs->height = buffer->height;
+		gs->needs_full_upload = true;
 	}
 }
 
@@ -2227,7 +4148,9 @@ static void
 gl_renderer_destroy_dmabuf(struct linux_dmabuf_buffer *dmabuf)
 {
 	struct dmabuf_image *image = linux_dmabuf_buffer_get_user_data(dmabuf);
+	struct gl_renderer *gr = get_renderer(dmabuf->compositor);
 
+	dmabuf_cache_put(gr, image);
 	dmabuf_image_destroy(image);
 }
 
@@ -2604,17 +4527,15 @@ choose_texture_target(struct gl_renderer *gr,
 	}
 }
 
-static struct dmabuf_image *
-import_dmabuf(struct gl_renderer *gr,
-	      struct linux_dmabuf_buffer *dmabuf)
+/* Create the EGLImages of a dmabuf_image; also safe from the import
+ * thread, since it only uses EGL without a context. */
+static bool
+import_dmabuf_images(struct gl_renderer *gr, struct dmabuf_image *image)
 {
+	struct linux_dmabuf_buffer *dmabuf = image->dmabuf;
 	struct egl_image *egl_image;
-	struct dmabuf_image *image;
 	GLenum target;
 
-	image = dmabuf_image_create();
-	image->dmabuf = dmabuf;
-
 	egl_image = import_simple_dmabuf(gr, &dmabuf->attributes);
 	if (egl_image) {
 		image->num_images = 1;
@@ -2630,13 +4551,31 @@ import_dmabuf(struct gl_renderer *gr,
 			image->shader_variant = SHADER_VARIANT_EXTERNAL;
 		}
 	} else {
-		if (!import_yuv_dmabuf(gr, image)) {
-			dmabuf_image_destroy(image);
-			return NULL;
-		}
+		if (!import_yuv_dmabuf(gr, image))
+			return false;
 		image->import_type = IMPORT_TYPE_GL_CONVERSION;
 	}
 
+	return true;
+}
+
+static struct dmabuf_image *
+import_dmabuf(struct gl_renderer *gr,
+	      struct linux_dmabuf_buffer *dmabuf)
+{
+	struct dmabuf_image *image;
+
+	image = dmabuf_image_create();
+	image->dmabuf = dmabuf;
+
+	if (dmabuf_cache_take(gr, image))
+		return image;
+
+	if (!import_dmabuf_images(gr, image)) {
+		dmabuf_image_destroy(image);
+		return NULL;
+	}
+
 	return image;
 }
 
@@ -2742,15 +4681,11 @@ gl_renderer_query_dmabuf_modifiers(struct weston_compositor *wc, int format,
 }
 
 static bool
-gl_renderer_import_dmabuf(struct weston_compositor *ec,
-			  struct linux_dmabuf_buffer *dmabuf)
+gl_renderer_dmabuf_is_importable(struct gl_renderer *gr,
+				 struct linux_dmabuf_buffer *dmabuf)
 {
-	struct gl_renderer *gr = get_renderer(ec);
-	struct dmabuf_image *image;
 	int i;
 
-	assert(gr->has_dmabuf_import);
-
 	for (i = 0; i < dmabuf->attributes.n_planes; i++) {
 		/* return if EGL doesn't support import modifiers */
 		if (dmabuf->attributes.modifier[i] != DRM_FORMAT_MOD_INVALID)
@@ -2767,6 +4702,21 @@ gl_renderer_import_dmabuf(struct weston_compositor *ec,
 	if (dmabuf->attributes.flags & ~ZWP_LINUX_BUFFER_PARAMS_V1_FLAGS_Y_INVERT)
 		return false;
 
+	return true;
+}
+
+static bool
+gl_renderer_import_dmabuf(struct weston_compositor *ec,
+			  struct linux_dmabuf_buffer *dmabuf)
+{
+	struct gl_renderer *gr = get_renderer(ec);
+	struct dmabuf_image *image;
+
+	assert(gr->has_dmabuf_import);
+
+	if (!gl_renderer_dmabuf_is_importable(gr, dmabuf))
+		return false;
+
 	image = import_dmabuf(gr, dmabuf);
 	if (!image)
 		return false;
@@ -2778,6 +4728,166 @@ gl_renderer_import_dmabuf(struct weston_compositor *ec,
 	return true;
 }
 
+struct dmabuf_import_job {
+	struct gl_import_job base;
+	struct gl_renderer *gr;
+	struct dmabuf_image *image;
+	bool success;
+
+	weston_renderer_import_dmabuf_done_func_t done;
+	void *data;
+};
+
+static void
+dmabuf_import_job_run(struct gl_import_job *base)
+{
+	struct dmabuf_import_job *job =
+		container_of(base, struct dmabuf_import_job, base);
+
+	job->success = import_dmabuf_images(job->gr, job->image);
+}
+
+static void
+dmabuf_import_job_complete(struct gl_import_job *base, bool cancelled)
+{
+	struct dmabuf_import_job *job =
+		container_of(base, struct dmabuf_import_job, base);
+	struct dmabuf_image *image = job->image;
+	struct linux_dmabuf_buffer *dmabuf = image->dmabuf;
+	/* a cancelled job never ran */
+	bool success = !cancelled && job->success;
+
+	if (success) {
+		wl_list_insert(&job->gr->dmabuf_images, &image->link);
+		linux_dmabuf_buffer_set_user_data(dmabuf, image,
+			gl_renderer_destroy_dmabuf);
+	} else {
+		dmabuf_image_destroy(image);
+	}
+
+	job->done(dmabuf, success, job->data);
+	free(job);
+}
+
+/* Multi-planar and YUV imports can take milliseconds in some drivers;
+ * the dmabuf cache is still looked up right away. */
+static bool
+gl_renderer_import_dmabuf_async(struct weston_compositor *ec,
+				struct linux_dmabuf_buffer *dmabuf,
+				weston_renderer_import_dmabuf_done_func_t done,
+				void *data)
+{
+	struct gl_renderer *gr = get_renderer(ec);
+	struct dmabuf_import_job *job;
+
+	assert(gr->has_dmabuf_import);
+
+	if (!gl_renderer_dmabuf_is_importable(gr, dmabuf) ||
+	    dmabuf_cache_find(gr, dmabuf))
+		return false;
+
+	if (!gr->import_thread) {
+		gr->import_thread =
+			gl_import_thread_create(wl_display_get_event_loop(ec->wl_display));
+		if (!gr->import_thread)
+			return false;
+	}
+
+	job = zalloc(sizeof *job);
+	if (!job)
+		return false;
+
+	job->base.run = dmabuf_import_job_run;
+	job->base.complete = dmabuf_import_job_complete;
+	job->gr = gr;
+	job->image = dmabuf_image_create();
+	job->image->dmabuf = dmabuf;
+	job->done = done;
+	job->data = data;
+
+	gl_import_thread_queue(gr->import_thread, &job->base);
+
+	return true;
+}
+
+/** Copy the output contents into a client dmabuf
+ *
+ * Used by the screenshooter from the output frame signal, while the
+ * just rendered frame is still in the back buffer. The dmabuf must have
+ * been imported as a single RGB EGLImage so it can be a render target.
+ * Completion is left to implicit synchronization of the dmabuf.
+ */
+static int
+gl_renderer_blit_to_dmabuf(struct weston_output *output,
+			   struct linux_dmabuf_buffer *dmabuf)
+{
+	struct gl_renderer *gr = get_renderer(output->compositor);
+	struct gl_output_state *go = get_output_state(output);
+	struct dmabuf_image *image;
+	int32_t x, y, width, height;
+	GLuint tex, fbo;
+	GLenum status;
+	int ret = -1;
+
+	if (gr->gl_version < gr_gl_version(3, 0) || dmabuf->direct_display)
+		return -1;
+
+	image = linux_dmabuf_buffer_get_user_data(dmabuf);
+	if (!image || image->import_type != IMPORT_TYPE_DIRECT ||
+	    image->shader_variant != SHADER_VARIANT_RGBA)
+		return -1;
+
+	width = output->current_mode->width;
+	height = output->current_mode->height;
+	if (dmabuf->attributes.width < width ||
+	    dmabuf->attributes.height < height)
+		return -1;
+
+	if (use_output(output) < 0)
+		return -1;
+
+	x = go->borders[GL_RENDERER_BORDER_LEFT].width;
+	y = go->borders[GL_RENDERER_BORDER_BOTTOM].height;
+
+	glGenTextures(1, &tex);
+	glBindTexture(GL_TEXTURE_2D, tex);
+	gr->image_target_texture_2d(GL_TEXTURE_2D, image->images[0]->image);
+
+	glGenFramebuffers(1, &fbo);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, fbo);
+	glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+			       GL_TEXTURE_2D, tex, 0);
+
+	status = glCheckFramebufferStatus(GL_DRAW_FRAMEBUFFER);
+	if (status == GL_FRAMEBUFFER_COMPLETE) {
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+
+		/* GL's origin is bottom-left, while the first row of the
+		 * dmabuf is the top row unless the client asked for y-invert.
+		 */
+		if (dmabuf->attributes.flags &
+		    ZWP_LINUX_BUFFER_PARAMS_V1_FLAGS_Y_INVERT)
+			glBlitFramebuffer(x, y, x + width, y + height,
+					  0, 0, width, height,
+					  GL_COLOR_BUFFER_BIT, GL_NEAREST);
+		else
+			glBlitFramebuffer(x, y, x + width, y + height,
+					  0, height, width, 0,
+					  GL_COLOR_BUFFER_BIT, GL_NEAREST);
+		glFlush();
+		ret = 0;
+	} else {
+		weston_log("dmabuf screenshot target incomplete: 0x%x\n",
+			   status);
+	}
+
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glDeleteFramebuffers(1, &fbo);
+	glDeleteTextures(1, &tex);
+
+	return ret;
+}
+
 static bool
 dmabuf_is_opaque(struct linux_dmabuf_buffer *dmabuf)
 {
@@ -2918,9 +5028,27 @@ populate_supported_formats(struct weston_compositor *ec,
 		free(modifiers);
 	}
 
-out:
-	free(formats);
-	return ret;
+out:
+	free(formats);
+	return ret;
+}
+
+/** Estimate the memory behind an imported client buffer */
+static size_t
+buffer_import_size(struct weston_buffer *buffer,
+		   struct linux_dmabuf_buffer *dmabuf)
+{
+	size_t size = 0;
+	int i;
+
+	if (!dmabuf)
+		return (size_t)buffer->width * buffer->height * 4;
+
+	for (i = 0; i < dmabuf->attributes.n_planes; i++)
+		size += (size_t)dmabuf->attributes.stride[i] *
+			dmabuf->attributes.height;
+
+	return size;
 }
 
 static void
@@ -2930,10 +5058,15 @@ gl_renderer_attach(struct weston_surface *es, struct weston_buffer *buffer)
 	struct gl_renderer *gr = get_renderer(ec);
 	struct gl_surface_state *gs = get_surface_state(es);
 	struct wl_shm_buffer *shm_buffer;
-	struct linux_dmabuf_buffer *dmabuf;
+	struct linux_dmabuf_buffer *dmabuf = NULL;
 	EGLint format;
 	int i;
 
+	if (buffer)
+		gl_surface_state_bind_client(gr, gs);
+
+	gs->rgb_cache_valid = false;
+
 	weston_buffer_reference(&gs->buffer_ref, buffer);
 	weston_buffer_release_reference(&gs->buffer_release_ref,
 					es->buffer_release_ref.buffer_release);
@@ -2944,8 +5077,9 @@ gl_renderer_attach(struct weston_surface *es, struct weston_buffer *buffer)
 			gs->images[i] = NULL;
 		}
 		gs->num_images = 0;
-		glDeleteTextures(gs->num_textures, gs->textures);
-		gs->num_textures = 0;
+		gl_surface_state_release_textures(gr, gs, true);
+		gl_surface_state_set_texture_bytes(gs, 0);
+		gl_surface_state_set_import_bytes(gs, 0);
 		gs->buffer_type = BUFFER_TYPE_NULL;
 		gs->y_inverted = true;
 		gs->direct_display = false;
@@ -2955,8 +5089,21 @@ gl_renderer_attach(struct weston_surface *es, struct weston_buffer *buffer)
 
 	shm_buffer = wl_shm_buffer_get(buffer->resource);
 
+	/* Sampled from the client's pages, like a client dmabuf */
+	if (shm_buffer && buffer->udmabuf) {
+		buffer->shm_buffer = shm_buffer;
+		dmabuf = buffer->udmabuf;
+		shm_buffer = NULL;
+	}
+
+	/* Client allocated buffers do not count against the budget. */
+	if (!shm_buffer)
+		gl_surface_state_set_texture_bytes(gs, 0);
+
 	if (shm_buffer)
 		gl_renderer_attach_shm(es, buffer, shm_buffer);
+	else if (dmabuf)
+		gl_renderer_attach_dmabuf(es, buffer, dmabuf);
 	else if (gr->has_bind_display &&
 		 gr->query_buffer(gr->egl_display, (void *)buffer->resource,
 				  EGL_TEXTURE_FORMAT, &format))
@@ -2976,7 +5123,16 @@ gl_renderer_attach(struct weston_surface *es, struct weston_buffer *buffer)
 		es->is_opaque = false;
 		weston_buffer_send_server_error(buffer,
 			"disconnecting due to unhandled buffer type");
+		return;
 	}
+
+	if (shm_buffer)
+		gl_surface_state_set_import_bytes(gs, 0);
+	else
+		gl_surface_state_set_import_bytes(gs,
+			buffer_import_size(buffer, dmabuf));
+
+	gl_surface_state_check_client_budget(gr, gs);
 }
 
 static void
@@ -3028,11 +5184,11 @@ pack_color(pixman_format_code_t format, float *c)
 	}
 }
 
+/* Draw the surface content into a new texture-backed framebuffer, left
+ * bound on return. The caller deletes *fbo and *tex whatever the result. */
 static int
-gl_renderer_surface_copy_content(struct weston_surface *surface,
-				 void *target, size_t size,
-				 int src_x, int src_y,
-				 int width, int height)
+gl_renderer_surface_draw_content(struct weston_surface *surface,
+				 GLuint *fbo, GLuint *tex)
 {
 	static const GLfloat verts[4 * 2] = {
 		0.0f, 0.0f,
@@ -3056,50 +5212,33 @@ gl_renderer_surface_copy_content(struct weston_surface *surface,
 		.view_alpha = 1.0f,
 		.input_tex_filter = GL_NEAREST,
 	};
-	const pixman_format_code_t format = PIXMAN_a8b8g8r8;
-	const size_t bytespp = 4; /* PIXMAN_a8b8g8r8 */
-	const GLenum gl_format = GL_RGBA; /* PIXMAN_a8b8g8r8 little-endian */
 	struct gl_renderer *gr = get_renderer(surface->compositor);
 	struct gl_surface_state *gs = get_surface_state(surface);
+	GLfloat texcoords[4 * 2];
 	int cw, ch;
-	GLuint fbo;
-	GLuint tex;
 	GLenum status;
-	int ret = -1;
+	int i;
 
 	gl_renderer_surface_get_content_size(surface, &cw, &ch);
 
-	switch (gs->buffer_type) {
-	case BUFFER_TYPE_NULL:
-		return -1;
-	case BUFFER_TYPE_SOLID:
-		*(uint32_t *)target = pack_color(format, gs->color);
-		return 0;
-	case BUFFER_TYPE_SHM:
-		gl_renderer_flush_damage(surface);
-		/* fall through */
-	case BUFFER_TYPE_EGL:
-		break;
-	}
-
 	gl_shader_config_set_input_textures(&sconf, gs);
 
 	glActiveTexture(GL_TEXTURE0);
-	glGenTextures(1, &tex);
-	glBindTexture(GL_TEXTURE_2D, tex);
+	glGenTextures(1, tex);
+	glBindTexture(GL_TEXTURE_2D, *tex);
 	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, cw, ch,
 		     0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
 	glBindTexture(GL_TEXTURE_2D, 0);
 
-	glGenFramebuffers(1, &fbo);
-	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+	glGenFramebuffers(1, fbo);
+	glBindFramebuffer(GL_FRAMEBUFFER, *fbo);
 	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
-			       GL_TEXTURE_2D, tex, 0);
+			       GL_TEXTURE_2D, *tex, 0);
 
 	status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
 	if (status != GL_FRAMEBUFFER_COMPLETE) {
 		weston_log("%s: fbo error: %#x\n", __func__, status);
-		goto out;
+		return -1;
 	}
 
 	glViewport(0, 0, cw, ch);
@@ -3112,14 +5251,22 @@ gl_renderer_surface_copy_content(struct weston_surface *surface,
 				WESTON_MATRIX_TRANSFORM_TRANSLATE;
 
 	if (!gl_renderer_use_program(gr, &sconf))
-		goto out;
+		return -1;
 
 	/* position: */
 	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, verts);
 	glEnableVertexAttribArray(0);
 
-	/* texcoord: */
-	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 0, verts);
+	/* texcoord: pooled textures extend past the content */
+	for (i = 0; i < 4; i++) {
+		texcoords[i * 2] = verts[i * 2];
+		texcoords[i * 2 + 1] = verts[i * 2 + 1];
+		if (gs->textures_pooled) {
+			texcoords[i * 2] *= (GLfloat)cw / gs->tex_width[0];
+			texcoords[i * 2 + 1] *= (GLfloat)ch / gs->tex_height[0];
+		}
+	}
+	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 0, texcoords);
 	glEnableVertexAttribArray(1);
 
 	glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
@@ -3127,12 +5274,102 @@ gl_renderer_surface_copy_content(struct weston_surface *surface,
 	glDisableVertexAttribArray(1);
 	glDisableVertexAttribArray(0);
 
-	glPixelStorei(GL_PACK_ALIGNMENT, bytespp);
-	glReadPixels(src_x, src_y, width, height, gl_format,
-		     GL_UNSIGNED_BYTE, target);
-	ret = 0;
+	return 0;
+}
+
+static int
+gl_renderer_surface_copy_content(struct weston_surface *surface,
+				 void *target, size_t size,
+				 int src_x, int src_y,
+				 int width, int height)
+{
+	const pixman_format_code_t format = PIXMAN_a8b8g8r8;
+	const size_t bytespp = 4; /* PIXMAN_a8b8g8r8 */
+	const GLenum gl_format = GL_RGBA; /* PIXMAN_a8b8g8r8 little-endian */
+	struct gl_surface_state *gs = get_surface_state(surface);
+	GLuint fbo;
+	GLuint tex;
+	int ret = -1;
+
+	switch (gs->buffer_type) {
+	case BUFFER_TYPE_NULL:
+		return -1;
+	case BUFFER_TYPE_SOLID:
+		*(uint32_t *)target = pack_color(format, gs->color);
+		return 0;
+	case BUFFER_TYPE_SHM:
+		gl_surface_state_restore(gs);
+		gl_renderer_flush_damage(surface);
+		/* fall through */
+	case BUFFER_TYPE_EGL:
+		break;
+	}
+
+	if (gl_renderer_surface_draw_content(surface, &fbo, &tex) == 0) {
+		glPixelStorei(GL_PACK_ALIGNMENT, bytespp);
+		glReadPixels(src_x, src_y, width, height, gl_format,
+			     GL_UNSIGNED_BYTE, target);
+		ret = 0;
+	}
+
+	glDeleteFramebuffers(1, &fbo);
+	glDeleteTextures(1, &tex);
+
+	return ret;
+}
+
+/* Same draw as gl_renderer_surface_copy_content(), but the read lands in
+ * a pack buffer and is delivered once its fence signals, so the
+ * compositor does not stall on the GPU. Solid and null surfaces have
+ * nothing to wait for and are left to the synchronous path. */
+static int
+gl_renderer_surface_copy_content_async(struct weston_surface *surface,
+				       int src_x, int src_y,
+				       int width, int height,
+				       weston_surface_copy_content_done_func_t done,
+				       void *data)
+{
+	const GLenum gl_format = GL_RGBA; /* PIXMAN_a8b8g8r8 little-endian */
+	struct gl_renderer *gr = get_renderer(surface->compositor);
+	struct gl_surface_state *gs = get_surface_state(surface);
+	struct gl_readback *rb;
+	GLuint fbo;
+	GLuint tex;
+	int ret = -1;
+
+	if (gr->gl_version < gr_gl_version(3, 0) ||
+	    !gr->has_native_fence_sync)
+		return -1;
+
+	switch (gs->buffer_type) {
+	case BUFFER_TYPE_NULL:
+	case BUFFER_TYPE_SOLID:
+		return -1;
+	case BUFFER_TYPE_SHM:
+		gl_surface_state_restore(gs);
+		gl_renderer_flush_damage(surface);
+		/* fall through */
+	case BUFFER_TYPE_EGL:
+		break;
+	}
+
+	rb = zalloc(sizeof *rb);
+	if (!rb)
+		return -1;
+
+	rb->gr = gr;
+	rb->done = done;
+	rb->data = data;
+
+	if (gl_renderer_surface_draw_content(surface, &fbo, &tex) == 0 &&
+	    gl_readback_start(rb, surface->compositor, src_x, src_y,
+			      width, height, gl_format) == 0) {
+		wl_list_insert(&gs->readback_list, &rb->link);
+		ret = 0;
+	} else {
+		free(rb);
+	}
 
-out:
 	glDeleteFramebuffers(1, &fbo);
 	glDeleteTextures(1, &tex);
 
@@ -3142,14 +5379,27 @@ out:
 static void
 surface_state_destroy(struct gl_surface_state *gs, struct gl_renderer *gr)
 {
+	struct gl_readback *rb, *rb_tmp;
 	int i;
 
+	wl_list_for_each_safe(rb, rb_tmp, &gs->readback_list, link) {
+		rb->done(rb->data, NULL);
+		gl_readback_destroy(rb);
+	}
+
+	gl_surface_state_drop_rgb_cache(gr, gs);
+
 	wl_list_remove(&gs->surface_destroy_listener.link);
 	wl_list_remove(&gs->renderer_destroy_listener.link);
 
 	gs->surface->renderer_state = NULL;
+	gl_gpu_time_surface_destroyed(gr, gs->surface);
 
-	glDeleteTextures(gs->num_textures, gs->textures);
+	wl_list_remove(&gs->link);
+	if (!gs->textures_evicted)
+		account_texture_bytes(gr, gs, -(ssize_t)gs->texture_bytes);
+	gl_surface_state_set_import_bytes(gs, 0);
+	gl_surface_state_release_textures(gr, gs, true);
 
 	for (i = 0; i < gs->num_images; i++)
 		egl_image_unref(gs->images[i]);
@@ -3207,6 +5457,9 @@ gl_renderer_create_surface(struct weston_surface *surface)
 	gs->direct_display = false;
 
 	gs->surface = surface;
+	gs->last_visible_frame = gr->frame_counter;
+	wl_list_insert(&gr->surface_state_list, &gs->link);
+	wl_list_init(&gs->readback_list);
 
 	pixman_region32_init(&gs->texture_damage);
 	surface->renderer_state = gs;
@@ -3372,6 +5625,9 @@ gl_renderer_output_create(struct weston_output *output,
 		pixman_region32_init(&go->buffer_damage[i]);
 
 	wl_list_init(&go->timeline_render_point_list);
+	wl_list_init(&go->gpu_time_frame_list);
+	wl_list_init(&go->readback_list);
+	wl_list_init(&go->dmabuf_target_list);
 
 	go->begin_render_sync = EGL_NO_SYNC_KHR;
 	go->end_render_sync = EGL_NO_SYNC_KHR;
@@ -3386,6 +5642,9 @@ gl_renderer_output_create(struct weston_output *output,
 					  output->current_mode->height,
 					  GL_RGBA16F, GL_RGBA, GL_HALF_FLOAT);
 		if (ret) {
+			gl_renderer_account_bytes(&gr->fbo_bytes,
+						  &gr->fbo_bytes_peak,
+						  go->shadow.bytes);
 			weston_log("Output %s uses 16F shadow.\n",
 				   output->name);
 		} else {
@@ -3427,6 +5686,60 @@ gl_renderer_output_window_create(struct weston_output *output,
 	return ret;
 }
 
+static int
+gl_renderer_output_window_resize(struct weston_output *output,
+				 const struct gl_renderer_output_options *options)
+{
+	struct gl_renderer *gr = get_renderer(output->compositor);
+	struct gl_output_state *go = get_output_state(output);
+	int32_t width = output->current_mode->width;
+	int32_t height = output->current_mode->height;
+	struct gl_fbo_texture shadow;
+	EGLSurface egl_surface;
+	int i;
+
+	egl_surface = gl_renderer_create_window_surface(gr,
+							options->window_for_legacy,
+							options->window_for_platform,
+							options->drm_formats,
+							options->drm_formats_count);
+	if (egl_surface == EGL_NO_SURFACE) {
+		weston_log("failed to create egl surface\n");
+		return -1;
+	}
+
+	eglMakeCurrent(gr->egl_display,
+		       gr->dummy_surface, gr->dummy_surface, gr->egl_context);
+
+	if (shadow_exists(go) &&
+	    (go->shadow.width != width || go->shadow.height != height)) {
+		if (!gl_fbo_texture_init(&shadow, width, height,
+					 GL_RGBA16F, GL_RGBA, GL_HALF_FLOAT)) {
+			weston_log("Output %s failed to resize 16F shadow.\n",
+				   output->name);
+			weston_platform_destroy_egl_surface(gr->egl_display,
+							    egl_surface);
+			return -1;
+		}
+
+		gl_renderer_account_bytes(&gr->fbo_bytes, &gr->fbo_bytes_peak,
+					  -(ssize_t)go->shadow.bytes);
+		gl_fbo_texture_fini(&go->shadow);
+		go->shadow = shadow;
+		gl_renderer_account_bytes(&gr->fbo_bytes, &gr->fbo_bytes_peak,
+					  go->shadow.bytes);
+	}
+
+	weston_platform_destroy_egl_surface(gr->egl_display, go->egl_surface);
+	go->egl_surface = egl_surface;
+
+	/* Nothing of the old buffers carries over. */
+	for (i = 0; i < BUFFER_DAMAGE_COUNT; i++)
+		pixman_region32_clear(&go->buffer_damage[i]);
+
+	return 0;
+}
+
 static int
 gl_renderer_output_pbuffer_create(struct weston_output *output,
 				  const struct gl_renderer_pbuffer_options *options)
@@ -3481,23 +5794,189 @@ gl_renderer_output_pbuffer_create(struct weston_output *output,
 	return ret;
 }
 
+static struct gl_renderer_dmabuf_target *
+gl_renderer_output_dmabuf_target_create(struct weston_output *output,
+					 struct dmabuf_attributes *attributes)
+{
+	struct gl_renderer *gr = get_renderer(output->compositor);
+	struct gl_output_state *go = get_output_state(output);
+	struct gl_renderer_dmabuf_target *target;
+	GLenum status;
+
+	if (!gr->has_dmabuf_import)
+		return NULL;
+
+	if (attributes->width != output->current_mode->width ||
+	    attributes->height != output->current_mode->height)
+		return NULL;
+
+	if (use_output(output) < 0)
+		return NULL;
+
+	target = zalloc(sizeof *target);
+	if (!target)
+		return NULL;
+
+	target->image = import_simple_dmabuf(gr, attributes);
+	if (!target->image) {
+		weston_log("failed to import dmabuf render target\n");
+		free(target);
+		return NULL;
+	}
+
+	glActiveTexture(GL_TEXTURE0);
+	glGenTextures(1, &target->tex);
+	glBindTexture(GL_TEXTURE_2D, target->tex);
+	gr->image_target_texture_2d(GL_TEXTURE_2D, target->image->image);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	glGenFramebuffers(1, &target->fbo);
+	glBindFramebuffer(GL_FRAMEBUFFER, target->fbo);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+			       GL_TEXTURE_2D, target->tex, 0);
+	status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	if (status != GL_FRAMEBUFFER_COMPLETE) {
+		weston_log("dmabuf render target incomplete: 0x%x\n", status);
+		glDeleteFramebuffers(1, &target->fbo);
+		glDeleteTextures(1, &target->tex);
+		egl_image_unref(target->image);
+		free(target);
+		return NULL;
+	}
+
+	target->output = output;
+	pixman_region32_init_rect(&target->damage, output->x, output->y,
+				  output->width, output->height);
+	wl_list_insert(&go->dmabuf_target_list, &target->link);
+
+	return target;
+}
+
+static void
+gl_renderer_output_dmabuf_target_destroy(struct gl_renderer_dmabuf_target *target)
+{
+	struct gl_renderer *gr = get_renderer(target->output->compositor);
+	struct gl_output_state *go = get_output_state(target->output);
+
+	if (go->dmabuf_target == target)
+		go->dmabuf_target = NULL;
+
+	eglMakeCurrent(gr->egl_display,
+		       gr->dummy_surface, gr->dummy_surface, gr->egl_context);
+
+	glDeleteFramebuffers(1, &target->fbo);
+	glDeleteTextures(1, &target->tex);
+	egl_image_unref(target->image);
+
+	pixman_region32_fini(&target->damage);
+	wl_list_remove(&target->link);
+	free(target);
+}
+
+static int
+gl_renderer_output_set_dmabuf_target(struct weston_output *output,
+				     struct gl_renderer_dmabuf_target *target)
+{
+	struct gl_output_state *go = get_output_state(output);
+	int i;
+
+	if (target && shadow_exists(go))
+		return -1;
+
+	/* The EGLSurface missed the frames drawn into dmabuf targets,
+	 * so its buffer age can no longer be trusted. */
+	if (go->dmabuf_target && !target) {
+		for (i = 0; i < BUFFER_DAMAGE_COUNT; i++)
+			pixman_region32_copy(&go->buffer_damage[i],
+					     &output->region);
+	}
+
+	go->dmabuf_target = target;
+
+	return 0;
+}
+
+/** Copy the contents of one dmabuf target into another
+ *
+ * The targets may belong to different outputs of different sizes; the
+ * copy is then scaled with linear filtering. Both are read top row
+ * first, so no flip is needed. The render sync of the destination's
+ * output is replaced, so that its fence fd covers the copy.
+ */
+static int
+gl_renderer_dmabuf_target_blit(struct gl_renderer_dmabuf_target *src,
+			       struct gl_renderer_dmabuf_target *dst)
+{
+	struct gl_renderer *gr = get_renderer(dst->output->compositor);
+	struct gl_output_state *go = get_output_state(dst->output);
+	int32_t src_width = src->output->current_mode->width;
+	int32_t src_height = src->output->current_mode->height;
+	int32_t dst_width = dst->output->current_mode->width;
+	int32_t dst_height = dst->output->current_mode->height;
+
+	if (gr->gl_version < gr_gl_version(3, 0))
+		return -1;
+
+	if (eglMakeCurrent(gr->egl_display, gr->dummy_surface,
+			   gr->dummy_surface, gr->egl_context) == EGL_FALSE)
+		return -1;
+
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, src->fbo);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, dst->fbo);
+	glBlitFramebuffer(0, 0, src_width, src_height,
+			  0, 0, dst_width, dst_height, GL_COLOR_BUFFER_BIT,
+			  src_width == dst_width && src_height == dst_height ?
+			  GL_NEAREST : GL_LINEAR);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	if (go->end_render_sync != EGL_NO_SYNC_KHR)
+		gr->destroy_sync(gr->egl_display, go->end_render_sync);
+	go->end_render_sync = create_render_sync(gr);
+	glFlush();
+
+	/* The whole of dst is new, other targets of its output missed it. */
+	pixman_region32_clear(&dst->damage);
+
+	return 0;
+}
+
 static void
 gl_renderer_output_destroy(struct weston_output *output)
 {
 	struct gl_renderer *gr = get_renderer(output->compositor);
 	struct gl_output_state *go = get_output_state(output);
 	struct timeline_render_point *trp, *tmp;
+	struct gl_gpu_time_frame *frame, *frame_tmp;
+	struct gl_readback *rb, *rb_tmp;
+	struct gl_renderer_dmabuf_target *target, *target_tmp;
 	int i;
 
 	for (i = 0; i < 2; i++)
 		pixman_region32_fini(&go->buffer_damage[i]);
 
-	if (shadow_exists(go))
+	if (shadow_exists(go)) {
+		gl_renderer_account_bytes(&gr->fbo_bytes, &gr->fbo_bytes_peak,
+					  -(ssize_t)go->shadow.bytes);
 		gl_fbo_texture_fini(&go->shadow);
+	}
 
 	eglMakeCurrent(gr->egl_display,
 		       gr->dummy_surface, gr->dummy_surface, gr->egl_context);
 
+	wl_list_for_each_safe(rb, rb_tmp, &go->readback_list, link) {
+		rb->done(rb->data, NULL);
+		gl_readback_destroy(rb);
+	}
+
+	wl_list_for_each_safe(target, target_tmp, &go->dmabuf_target_list,
+			      link)
+		gl_renderer_output_dmabuf_target_destroy(target);
+
+	wl_list_for_each_safe(frame, frame_tmp, &go->gpu_time_frame_list, link)
+		gl_gpu_time_frame_destroy(gr, frame);
+
 	weston_platform_destroy_egl_surface(gr->egl_display, go->egl_surface);
 
 	if (!wl_list_empty(&go->timeline_render_point_list))
@@ -3512,6 +5991,7 @@ gl_renderer_output_destroy(struct weston_output *output)
 	if (go->end_render_sync != EGL_NO_SYNC_KHR)
 		gr->destroy_sync(gr->egl_display, go->end_render_sync);
 
+	output->renderer_state = NULL;
 	free(go);
 }
 
@@ -3538,23 +6018,33 @@ gl_renderer_destroy(struct weston_compositor *ec)
 	struct gl_renderer *gr = get_renderer(ec);
 	struct dmabuf_image *image, *next;
 	struct dmabuf_format *format, *next_format;
+	struct gl_client_memory *cm, *cm_tmp;
 
 	wl_signal_emit(&gr->destroy_signal, gr);
 
 	if (gr->has_bind_display)
 		gr->unbind_display(gr->egl_display, ec->wl_display);
 
+	gl_shader_cache_fini(gr);
 	gl_renderer_shader_list_destroy(gr);
 	if (gr->fallback_shader)
 		gl_shader_destroy(gr, gr->fallback_shader);
 
+	if (gr->upload_pbo[0] != 0)
+		glDeleteBuffers(ARRAY_LENGTH(gr->upload_pbo), gr->upload_pbo);
+	gl_texture_pool_trim(gr, 0);
+
 	/* Work around crash in egl_dri2.c's dri2_make_current() - when does this apply? */
 	eglMakeCurrent(gr->egl_display,
 		       EGL_NO_SURFACE, EGL_NO_SURFACE,
 		       EGL_NO_CONTEXT);
 
+	if (gr->import_thread)
+		gl_import_thread_destroy(gr->import_thread);
+
 	wl_list_for_each_safe(image, next, &gr->dmabuf_images, link)
 		dmabuf_image_destroy(image);
+	dmabuf_cache_flush(gr);
 
 	wl_list_for_each_safe(format, next_format, &gr->dmabuf_formats, link)
 		dmabuf_format_destroy(format);
@@ -3570,12 +6060,19 @@ gl_renderer_destroy(struct weston_compositor *ec)
 
 	wl_array_release(&gr->vertices);
 	wl_array_release(&gr->vtxcnt);
+	wl_array_release(&gr->indices);
 
 	if (gr->fragment_binding)
 		weston_binding_destroy(gr->fragment_binding);
 	if (gr->fan_binding)
 		weston_binding_destroy(gr->fan_binding);
 
+	wl_list_for_each_safe(cm, cm_tmp, &gr->client_memory_list, link)
+		client_memory_destroy(cm);
+
+	wl_list_remove(&gr->metrics_listener.link);
+	weston_log_scope_destroy(gr->gpu_time_scope);
+	weston_log_scope_destroy(gr->memory_scope);
 	weston_log_scope_destroy(gr->shader_scope);
 	free(gr);
 }
@@ -3663,10 +6160,25 @@ gl_renderer_display_create(struct weston_compositor *ec,
 	if (!gr->shader_scope)
 		goto fail;
 
+	gr->memory_scope =
+		weston_compositor_add_log_scope(ec, "gl-memory",
+			"GL renderer memory per client and surface\n",
+			gl_memory_scope_new_subscription, NULL, gr);
+	if (!gr->memory_scope)
+		goto fail;
+
+	gr->gpu_time_scope =
+		weston_compositor_add_log_scope(ec, "gl-gpu-time",
+			"GPU time spent drawing each view, per output repaint\n",
+			NULL, NULL, gr);
+	if (!gr->gpu_time_scope)
+		goto fail;
+
 	if (gl_renderer_setup_egl_client_extensions(gr) < 0)
 		goto fail;
 
 	gr->base.read_pixels = gl_renderer_read_pixels;
+	gr->base.read_pixels_async = gl_renderer_read_pixels_async;
 	gr->base.repaint_output = gl_renderer_repaint_output;
 	gr->base.flush_damage = gl_renderer_flush_damage;
 	gr->base.attach = gl_renderer_attach;
@@ -3675,6 +6187,9 @@ gl_renderer_display_create(struct weston_compositor *ec,
 	gr->base.surface_get_content_size =
 		gl_renderer_surface_get_content_size;
 	gr->base.surface_copy_content = gl_renderer_surface_copy_content;
+	gr->base.surface_copy_content_async =
+		gl_renderer_surface_copy_content_async;
+	gr->base.trim_memory = gl_renderer_trim_memory;
 
 	if (gl_renderer_setup_egl_display(gr, options->egl_native_display) < 0)
 		goto fail;
@@ -3712,9 +6227,15 @@ gl_renderer_display_create(struct weston_compositor *ec,
 		ec->capabilities |= WESTON_CAP_EXPLICIT_SYNC;
 
 	wl_list_init(&gr->dmabuf_images);
+	wl_list_init(&gr->surface_state_list);
+	wl_list_init(&gr->client_memory_list);
+	wl_list_init(&gr->texture_pool);
+	wl_list_init(&gr->dmabuf_cache);
 	if (gr->has_dmabuf_import) {
 		gr->base.import_dmabuf = gl_renderer_import_dmabuf;
 		gr->base.get_supported_formats = gl_renderer_get_supported_formats;
+		gr->base.blit_to_dmabuf = gl_renderer_blit_to_dmabuf;
+		gr->base.import_dmabuf_async = gl_renderer_import_dmabuf_async;
 		ret = populate_supported_formats(ec, &gr->supported_formats);
 		if (ret < 0)
 			goto fail_terminate;
@@ -3771,6 +6292,9 @@ gl_renderer_display_create(struct weston_compositor *ec,
 	if (gr->gl_supports_color_transforms)
 		ec->capabilities |= WESTON_CAP_COLOR_OPS;
 
+	gr->metrics_listener.notify = gl_renderer_write_metrics;
+	wl_signal_add(&ec->metrics_signal, &gr->metrics_listener);
+
 	return 0;
 
 fail_with_error:
@@ -3788,6 +6312,8 @@ fail_terminate:
 	weston_drm_format_array_fini(&gr->supported_formats);
 	eglTerminate(gr->egl_display);
 fail:
+	weston_log_scope_destroy(gr->gpu_time_scope);
+	weston_log_scope_destroy(gr->memory_scope);
 	weston_log_scope_destroy(gr->shader_scope);
 	free(gr);
 	ec->renderer = NULL;
@@ -3839,6 +6365,33 @@ get_gl_version(void)
 	return gr_gl_version(2, 0);
 }
 
+/* GL_EXT_disjoint_timer_query allows an implementation without timestamp
+ * support, which is no use for timing individual views. */
+static void
+gl_renderer_setup_timer_query(struct gl_renderer *gr)
+{
+	PFNGLGETQUERYIVEXTPROC get_queryiv;
+	GLint bits = 0;
+
+	get_queryiv = (void *) eglGetProcAddress("glGetQueryivEXT");
+	gr->gen_queries = (void *) eglGetProcAddress("glGenQueriesEXT");
+	gr->delete_queries = (void *) eglGetProcAddress("glDeleteQueriesEXT");
+	gr->query_counter = (void *) eglGetProcAddress("glQueryCounterEXT");
+	gr->get_query_objectuiv =
+		(void *) eglGetProcAddress("glGetQueryObjectuivEXT");
+	gr->get_query_objectui64v =
+		(void *) eglGetProcAddress("glGetQueryObjectui64vEXT");
+	gr->get_integer64v = (void *) eglGetProcAddress("glGetInteger64vEXT");
+
+	if (!get_queryiv || !gr->gen_queries || !gr->delete_queries ||
+	    !gr->query_counter || !gr->get_query_objectuiv ||
+	    !gr->get_query_objectui64v || !gr->get_integer64v)
+		return;
+
+	get_queryiv(GL_TIMESTAMP_EXT, GL_QUERY_COUNTER_BITS_EXT, &bits);
+	gr->has_disjoint_timer_query = bits > 0;
+}
+
 static int
 gl_renderer_setup(struct weston_compositor *ec, EGLSurface egl_surface)
 {
@@ -3949,14 +6502,34 @@ gl_renderer_setup(struct weston_compositor *ec, EGLSurface egl_surface)
 	if (weston_check_egl_extension(extensions, "GL_OES_EGL_image_external"))
 		gr->has_egl_image_external = true;
 
+	if (gr->gl_version >= gr_gl_version(3, 0))
+		gr->has_pbo_upload = true;
+
+	if (weston_check_egl_extension(extensions, "GL_EXT_texture_storage")) {
+		gr->tex_storage_2d =
+			(void *) eglGetProcAddress("glTexStorage2DEXT");
+		gr->has_bgra8_storage = gr->tex_storage_2d != NULL;
+	} else if (gr->gl_version >= gr_gl_version(3, 0)) {
+		gr->tex_storage_2d =
+			(void *) eglGetProcAddress("glTexStorage2D");
+	}
+	glGetIntegerv(GL_MAX_TEXTURE_SIZE, &gr->max_texture_size);
+
+	if (weston_check_egl_extension(extensions,
+				       "GL_EXT_disjoint_timer_query"))
+		gl_renderer_setup_timer_query(gr);
+
 	if (gr->gl_version >= gr_gl_version(3, 0) &&
 	    weston_check_egl_extension(extensions, "GL_OES_texture_float_linear") &&
-	    weston_check_egl_extension(extensions, "GL_EXT_color_buffer_half_float")) {
+	    weston_check_egl_extension(extensions, "GL_EXT_color_buffer_half_float") &&
+	    weston_check_egl_extension(extensions, "GL_OES_texture_3D")) {
 		gr->gl_supports_color_transforms = true;
 	}
 
 	glActiveTexture(GL_TEXTURE0);
 
+	gl_shader_cache_init(gr, extensions);
+
 	gr->fallback_shader = gl_renderer_create_fallback_shader(gr);
 	if (!gr->fallback_shader) {
 		weston_log("Error: compiling fallback shader failed.\n");
@@ -3979,6 +6552,14 @@ gl_renderer_setup(struct weston_compositor *ec, EGLSurface egl_surface)
 		ec->read_format == PIXMAN_a8r8g8b8 ? "BGRA" : "RGBA");
 	weston_log_continue(STAMP_SPACE "EGL Wayland extension: %s\n",
 			    gr->has_bind_display ? "yes" : "no");
+	weston_log_continue(STAMP_SPACE "wl_shm upload via PBO: %s\n",
+			    gr->has_pbo_upload ? "yes" : "no");
+	weston_log_continue(STAMP_SPACE "immutable texture storage: %s\n",
+			    gr->tex_storage_2d ? "yes" : "no");
+	weston_log_continue(STAMP_SPACE "GPU timer queries: %s\n",
+			    gr->has_disjoint_timer_query ? "yes" : "no");
+	weston_log_continue(STAMP_SPACE "shader binary cache: %s\n",
+			    gr->shader_cache_dir ? gr->shader_cache_dir : "no");
 
 	return 0;
 }
@@ -3986,8 +6567,13 @@ gl_renderer_setup(struct weston_compositor *ec, EGLSurface egl_surface)
 WL_EXPORT struct gl_renderer_interface gl_renderer_interface = {
 	.display_create = gl_renderer_display_create,
 	.output_window_create = gl_renderer_output_window_create,
+	.output_window_resize = gl_renderer_output_window_resize,
 	.output_pbuffer_create = gl_renderer_output_pbuffer_create,
 	.output_destroy = gl_renderer_output_destroy,
+	.output_dmabuf_target_create = gl_renderer_output_dmabuf_target_create,
+	.output_dmabuf_target_destroy = gl_renderer_output_dmabuf_target_destroy,
+	.output_set_dmabuf_target = gl_renderer_output_set_dmabuf_target,
+	.dmabuf_target_blit = gl_renderer_dmabuf_target_blit,
 	.output_set_border = gl_renderer_output_set_border,
 	.create_fence_fd = gl_renderer_create_fence_fd,
 };
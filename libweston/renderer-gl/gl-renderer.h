@@ -51,6 +51,9 @@ typedef intptr_t EGLNativeWindowType;
 
 #endif /* ENABLE_EGL */
 
+struct dmabuf_attributes;
+struct gl_renderer_dmabuf_target;
+
 enum gl_renderer_border_side {
 	GL_RENDERER_BORDER_TOP = 0,
 	GL_RENDERER_BORDER_LEFT = 1,
@@ -157,6 +160,22 @@ struct gl_renderer_interface {
 	int (*output_window_create)(struct weston_output *output,
 				    const struct gl_renderer_output_options *options);
 
+	/**
+	 * Move the output over to a new native window of the current mode size
+	 *
+	 * \param output The output, created with \c output_window_create.
+	 * \param options The new window, and the formats as for
+	 * \c output_window_create.
+	 * \return 0 on success, -1 on failure, in which case the output keeps
+	 * drawing to its old window.
+	 *
+	 * Only the EGL surface is replaced, and the shadow framebuffer
+	 * resized; everything else of the output state stays. The old window
+	 * may be destroyed afterwards.
+	 */
+	int (*output_window_resize)(struct weston_output *output,
+				    const struct gl_renderer_output_options *options);
+
 	/**
 	 * Attach GL-renderer to the output with internal pixel storage
 	 *
@@ -180,6 +199,51 @@ struct gl_renderer_interface {
 
 	void (*output_destroy)(struct weston_output *output);
 
+	/**
+	 * Create a render target from a dmabuf
+	 *
+	 * \param output The output the target will be rendered for.
+	 * \param attributes The dmabuf, which must match the output mode size.
+	 * \return The target, or NULL on failure.
+	 *
+	 * The target stays valid until destroyed with
+	 * \c output_dmabuf_target_destroy or until the output is destroyed.
+	 */
+	struct gl_renderer_dmabuf_target *
+	(*output_dmabuf_target_create)(struct weston_output *output,
+				       struct dmabuf_attributes *attributes);
+
+	void (*output_dmabuf_target_destroy)(struct gl_renderer_dmabuf_target *target);
+
+	/**
+	 * Select where the next repaints of the output are drawn
+	 *
+	 * \param output The output.
+	 * \param target A target of this output, or NULL for the EGLSurface.
+	 * \return 0 on success, -1 if the output cannot render into targets.
+	 *
+	 * Repainting into a target does not swap the EGLSurface. The damage
+	 * each target missed is tracked separately, so only changed areas are
+	 * redrawn into it.
+	 */
+	int (*output_set_dmabuf_target)(struct weston_output *output,
+					struct gl_renderer_dmabuf_target *target);
+
+	/**
+	 * Copy the contents of a target into another
+	 *
+	 * \param src The target to read, e.g. one wrapping a framebuffer
+	 * scanned out for its output.
+	 * \param dst The target to write, possibly of another output and
+	 * size, in which case the copy is scaled.
+	 * \return 0 on success, -1 if the GPU cannot blit (GLES 2).
+	 *
+	 * The fence fd of the destination's output signals when the copy
+	 * is done.
+	 */
+	int (*dmabuf_target_blit)(struct gl_renderer_dmabuf_target *src,
+				  struct gl_renderer_dmabuf_target *dst);
+
 	/* Sets the output border.
 	 *
 	 * The side specifies the side for which we are setting the border.
@@ -29,6 +29,7 @@
 #include <GLES2/gl2ext.h>
 
 #include <assert.h>
+#include <string.h>
 
 #include <libweston/libweston.h>
 #include "color.h"
@@ -44,11 +45,21 @@ struct gl_renderer_color_curve {
 	float offset;
 };
 
+struct gl_renderer_color_mapping {
+	enum gl_shader_color_mapping type;
+	GLuint tex;
+	float scale;
+	float offset;
+	float matrix[9];
+};
+
 struct gl_renderer_color_transform {
 	struct weston_color_transform *owner;
 	struct wl_listener destroy_listener;
 
 	struct gl_renderer_color_curve pre_curve;
+	struct gl_renderer_color_mapping mapping;
+	struct gl_renderer_color_curve post_curve;
 };
 
 static void
@@ -58,10 +69,19 @@ gl_renderer_color_curve_fini(struct gl_renderer_color_curve *gl_curve)
 		glDeleteTextures(1, &gl_curve->tex);
 }
 
+static void
+gl_renderer_color_mapping_fini(struct gl_renderer_color_mapping *gl_mapping)
+{
+	if (gl_mapping->tex)
+		glDeleteTextures(1, &gl_mapping->tex);
+}
+
 static void
 gl_renderer_color_transform_destroy(struct gl_renderer_color_transform *gl_xform)
 {
 	gl_renderer_color_curve_fini(&gl_xform->pre_curve);
+	gl_renderer_color_mapping_fini(&gl_xform->mapping);
+	gl_renderer_color_curve_fini(&gl_xform->post_curve);
 	wl_list_remove(&gl_xform->destroy_listener.link);
 	free(gl_xform);
 }
@@ -152,6 +172,48 @@ gl_color_curve_lut_3x1d(struct gl_renderer_color_curve *gl_curve,
 	return true;
 }
 
+static bool
+gl_color_mapping_lut_3d(struct gl_renderer_color_mapping *gl_mapping,
+			const struct weston_color_mapping *mapping,
+			struct weston_color_transform *xform)
+{
+	const unsigned dim_size = mapping->u.lut3d.optimal_len;
+	GLuint tex;
+	float *lut;
+
+	lut = calloc(dim_size * dim_size * dim_size, 3 * sizeof *lut);
+	if (!lut)
+		return false;
+
+	/* Baked once here, the texture lives as long as the transform. */
+	mapping->u.lut3d.fill_in(xform, lut, dim_size);
+
+	glActiveTexture(GL_TEXTURE0);
+	glGenTextures(1, &tex);
+	glBindTexture(GL_TEXTURE_3D, tex);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, sizeof (float));
+	glPixelStorei(GL_UNPACK_ROW_LENGTH_EXT, 0);
+	glPixelStorei(GL_UNPACK_SKIP_PIXELS_EXT, 0);
+	glPixelStorei(GL_UNPACK_SKIP_ROWS_EXT, 0);
+	glTexImage3D(GL_TEXTURE_3D, 0, GL_RGB32F, dim_size, dim_size, dim_size,
+		     0, GL_RGB, GL_FLOAT, lut);
+
+	glBindTexture(GL_TEXTURE_3D, 0);
+	free(lut);
+
+	gl_mapping->type = SHADER_COLOR_MAPPING_3DLUT;
+	gl_mapping->tex = tex;
+	gl_mapping->scale = (float)(dim_size - 1) / dim_size;
+	gl_mapping->offset = 0.5f / dim_size;
+
+	return true;
+}
+
 static const struct gl_renderer_color_transform *
 gl_renderer_color_transform_from(struct weston_color_transform *xform)
 {
@@ -160,6 +222,14 @@ gl_renderer_color_transform_from(struct weston_color_transform *xform)
 		.pre_curve.tex = 0,
 		.pre_curve.scale = 0.0f,
 		.pre_curve.offset = 0.0f,
+		.mapping.type = SHADER_COLOR_MAPPING_IDENTITY,
+		.mapping.tex = 0,
+		.mapping.scale = 0.0f,
+		.mapping.offset = 0.0f,
+		.post_curve.type = SHADER_COLOR_CURVE_IDENTITY,
+		.post_curve.tex = 0,
+		.post_curve.scale = 0.0f,
+		.post_curve.offset = 0.0f,
 	};
 	struct gl_renderer_color_transform *gl_xform;
 	bool ok = false;
@@ -195,6 +265,45 @@ gl_renderer_color_transform_from(struct weston_color_transform *xform)
 		return NULL;
 	}
 
+	switch (xform->mapping.type) {
+	case WESTON_COLOR_MAPPING_TYPE_IDENTITY:
+		gl_xform->mapping = no_op_gl_xform.mapping;
+		ok = true;
+		break;
+	case WESTON_COLOR_MAPPING_TYPE_3D_LUT:
+		ok = gl_color_mapping_lut_3d(&gl_xform->mapping,
+					     &xform->mapping, xform);
+		break;
+	case WESTON_COLOR_MAPPING_TYPE_MATRIX:
+		gl_xform->mapping = no_op_gl_xform.mapping;
+		gl_xform->mapping.type = SHADER_COLOR_MAPPING_MATRIX;
+		memcpy(gl_xform->mapping.matrix, xform->mapping.u.mat.matrix,
+		       sizeof gl_xform->mapping.matrix);
+		ok = true;
+		break;
+	}
+
+	if (!ok) {
+		gl_renderer_color_transform_destroy(gl_xform);
+		return NULL;
+	}
+
+	switch (xform->post_curve.type) {
+	case WESTON_COLOR_CURVE_TYPE_IDENTITY:
+		gl_xform->post_curve = no_op_gl_xform.post_curve;
+		ok = true;
+		break;
+	case WESTON_COLOR_CURVE_TYPE_LUT_3x1D:
+		ok = gl_color_curve_lut_3x1d(&gl_xform->post_curve,
+					     &xform->post_curve, xform);
+		break;
+	}
+
+	if (!ok) {
+		gl_renderer_color_transform_destroy(gl_xform);
+		return NULL;
+	}
+
 	return gl_xform;
 }
 
@@ -213,5 +322,17 @@ gl_shader_config_set_color_transform(struct gl_shader_config *sconf,
 	sconf->color_pre_curve_lut_scale_offset[0] = gl_xform->pre_curve.scale;
 	sconf->color_pre_curve_lut_scale_offset[1] = gl_xform->pre_curve.offset;
 
+	sconf->req.color_mapping = gl_xform->mapping.type;
+	sconf->color_mapping_lut_tex = gl_xform->mapping.tex;
+	sconf->color_mapping_lut_scale_offset[0] = gl_xform->mapping.scale;
+	sconf->color_mapping_lut_scale_offset[1] = gl_xform->mapping.offset;
+	memcpy(sconf->color_mapping_matrix, gl_xform->mapping.matrix,
+	       sizeof sconf->color_mapping_matrix);
+
+	sconf->req.color_post_curve = gl_xform->post_curve.type;
+	sconf->color_post_curve_lut_tex = gl_xform->post_curve.tex;
+	sconf->color_post_curve_lut_scale_offset[0] = gl_xform->post_curve.scale;
+	sconf->color_post_curve_lut_scale_offset[1] = gl_xform->post_curve.offset;
+
 	return true;
 }
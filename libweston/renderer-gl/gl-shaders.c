@@ -32,6 +32,12 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include <libweston/libweston.h>
 #include <libweston/weston-log.h>
@@ -42,6 +48,7 @@
 #include "gl-renderer.h"
 #include "gl-renderer-internal.h"
 #include "shared/helpers.h"
+#include "shared/platform.h"
 #include "shared/timespec-util.h"
 
 /* static const char vertex_shader[]; vertex.glsl */
@@ -60,6 +67,11 @@ struct gl_shader {
 	GLint color_uniform;
 	GLint color_pre_curve_lut_2d_uniform;
 	GLint color_pre_curve_lut_scale_offset_uniform;
+	GLint color_mapping_lut_3d_uniform;
+	GLint color_mapping_lut_scale_offset_uniform;
+	GLint color_mapping_matrix_uniform;
+	GLint color_post_curve_lut_2d_uniform;
+	GLint color_post_curve_lut_scale_offset_uniform;
 	struct wl_list link; /* gl_renderer::shader_list */
 	struct timespec last_used;
 };
@@ -97,6 +109,20 @@ gl_shader_color_curve_to_string(enum gl_shader_color_curve kind)
 	return "!?!?"; /* never reached */
 }
 
+static const char *
+gl_shader_color_mapping_to_string(enum gl_shader_color_mapping kind)
+{
+	switch (kind) {
+#define CASERET(x) case x: return #x;
+	CASERET(SHADER_COLOR_MAPPING_IDENTITY)
+	CASERET(SHADER_COLOR_MAPPING_3DLUT)
+	CASERET(SHADER_COLOR_MAPPING_MATRIX)
+#undef CASERET
+	}
+
+	return "!?!?"; /* never reached */
+}
+
 static void
 dump_program_with_line_numbers(int count, const char **sources)
 {
@@ -162,9 +188,11 @@ create_shader_description_string(const struct gl_shader_requirements *req)
 	int size;
 	char *str;
 
-	size = asprintf(&str, "%s %s %cinput_is_premult %cgreen",
+	size = asprintf(&str, "%s %s %s %s %cinput_is_premult %cgreen",
 			gl_shader_texture_variant_to_string(req->variant),
 			gl_shader_color_curve_to_string(req->color_pre_curve),
+			gl_shader_color_mapping_to_string(req->color_mapping),
+			gl_shader_color_curve_to_string(req->color_post_curve),
 			req->input_is_premult ? '+' : '-',
 			req->green_tint ? '+' : '-');
 	if (size < 0)
@@ -182,16 +210,204 @@ create_shader_config_string(const struct gl_shader_requirements *req)
 			"#define DEF_GREEN_TINT %s\n"
 			"#define DEF_INPUT_IS_PREMULT %s\n"
 			"#define DEF_COLOR_PRE_CURVE %s\n"
+			"#define DEF_COLOR_MAPPING %s\n"
+			"#define DEF_COLOR_POST_CURVE %s\n"
 			"#define DEF_VARIANT %s\n",
 			req->green_tint ? "true" : "false",
 			req->input_is_premult ? "true" : "false",
 			gl_shader_color_curve_to_string(req->color_pre_curve),
+			gl_shader_color_mapping_to_string(req->color_mapping),
+			gl_shader_color_curve_to_string(req->color_post_curve),
 			gl_shader_texture_variant_to_string(req->variant));
 	if (size < 0)
 		return NULL;
 	return str;
 }
 
+#define SHADER_CACHE_MAGIC 0x57475342 /* "WGSB" */
+
+struct shader_cache_header {
+	uint32_t magic;
+	uint32_t requirements;
+	uint32_t binary_format;
+	uint32_t length;
+};
+
+static uint64_t
+shader_cache_hash_string(uint64_t hash, const char *str)
+{
+	/* FNV-1a */
+	for (; str && *str; str++) {
+		hash ^= (uint8_t) *str;
+		hash *= 0x100000001b3ull;
+	}
+
+	return hash;
+}
+
+static uint32_t
+shader_requirements_to_u32(const struct gl_shader_requirements *req)
+{
+	uint32_t val;
+
+	memcpy(&val, req, sizeof val);
+	return val;
+}
+
+static char *
+shader_cache_path(struct gl_renderer *gr,
+		  const struct gl_shader_requirements *req)
+{
+	char *path;
+
+	if (asprintf(&path, "%s/%016" PRIx64 "-%08" PRIx32 ".bin",
+		     gr->shader_cache_dir, gr->shader_cache_key,
+		     shader_requirements_to_u32(req)) < 0)
+		return NULL;
+
+	return path;
+}
+
+/* Try to create the program from a cached binary. Returns true if the
+ * program linked successfully from it.
+ */
+static bool
+shader_cache_load(struct gl_renderer *gr, struct gl_shader *shader)
+{
+	struct shader_cache_header hdr;
+	char *path;
+	void *binary = NULL;
+	GLint status = 0;
+	int fd;
+
+	if (!gr->shader_cache_dir)
+		return false;
+
+	path = shader_cache_path(gr, &shader->key);
+	if (!path)
+		return false;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	free(path);
+	if (fd < 0)
+		return false;
+
+	if (read(fd, &hdr, sizeof hdr) != sizeof hdr ||
+	    hdr.magic != SHADER_CACHE_MAGIC ||
+	    hdr.requirements != shader_requirements_to_u32(&shader->key) ||
+	    hdr.length == 0)
+		goto out;
+
+	binary = malloc(hdr.length);
+	if (!binary ||
+	    read(fd, binary, hdr.length) != (ssize_t) hdr.length)
+		goto out;
+
+	shader->program = glCreateProgram();
+	gr->program_binary(shader->program, hdr.binary_format,
+			   binary, hdr.length);
+	glGetProgramiv(shader->program, GL_LINK_STATUS, &status);
+	if (!status) {
+		/* Typically a driver update; rebuild and overwrite. */
+		glDeleteProgram(shader->program);
+		shader->program = 0;
+	}
+
+out:
+	free(binary);
+	close(fd);
+	return status != 0;
+}
+
+static void
+shader_cache_store(struct gl_renderer *gr, struct gl_shader *shader)
+{
+	struct shader_cache_header hdr = {
+		.magic = SHADER_CACHE_MAGIC,
+		.requirements = shader_requirements_to_u32(&shader->key),
+	};
+	GLint length = 0;
+	GLenum format;
+	void *binary;
+	char *path = NULL;
+	char *tmp = NULL;
+	int fd = -1;
+	bool ok = false;
+
+	if (!gr->shader_cache_dir)
+		return;
+
+	glGetProgramiv(shader->program, GL_PROGRAM_BINARY_LENGTH_OES, &length);
+	if (length <= 0)
+		return;
+
+	binary = malloc(length);
+	if (!binary)
+		return;
+
+	gr->get_program_binary(shader->program, length, &length,
+			       &format, binary);
+	hdr.binary_format = format;
+	hdr.length = length;
+
+	path = shader_cache_path(gr, &shader->key);
+	if (!path || asprintf(&tmp, "%s.tmp", path) < 0) {
+		tmp = NULL;
+		goto out;
+	}
+
+	/* Write to a temporary file and rename, so that a concurrent or
+	 * interrupted writer never leaves a truncated binary behind. */
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+	if (fd < 0)
+		goto out;
+
+	if (write(fd, &hdr, sizeof hdr) == sizeof hdr &&
+	    write(fd, binary, hdr.length) == (ssize_t) hdr.length)
+		ok = true;
+
+	close(fd);
+	if (ok && rename(tmp, path) == 0)
+		tmp[0] = '\0';
+	else
+		unlink(tmp);
+
+out:
+	if (!ok)
+		weston_log_scope_printf(gr->shader_scope,
+					"Failed to store shader binary: %s\n",
+					strerror(errno));
+	free(tmp);
+	free(path);
+	free(binary);
+}
+
+static void
+gl_shader_get_uniforms(struct gl_shader *shader)
+{
+	shader->proj_uniform = glGetUniformLocation(shader->program, "proj");
+	shader->tex_uniforms[0] = glGetUniformLocation(shader->program, "tex");
+	shader->tex_uniforms[1] = glGetUniformLocation(shader->program, "tex1");
+	shader->tex_uniforms[2] = glGetUniformLocation(shader->program, "tex2");
+	shader->alpha_uniform = glGetUniformLocation(shader->program, "alpha");
+	shader->color_uniform = glGetUniformLocation(shader->program,
+						     "unicolor");
+	shader->color_pre_curve_lut_2d_uniform =
+		glGetUniformLocation(shader->program, "color_pre_curve_lut_2d");
+	shader->color_pre_curve_lut_scale_offset_uniform =
+		glGetUniformLocation(shader->program, "color_pre_curve_lut_scale_offset");
+	shader->color_mapping_lut_3d_uniform =
+		glGetUniformLocation(shader->program, "color_mapping_lut_3d");
+	shader->color_mapping_lut_scale_offset_uniform =
+		glGetUniformLocation(shader->program, "color_mapping_lut_scale_offset");
+	shader->color_mapping_matrix_uniform =
+		glGetUniformLocation(shader->program, "color_mapping_matrix");
+	shader->color_post_curve_lut_2d_uniform =
+		glGetUniformLocation(shader->program, "color_post_curve_lut_2d");
+	shader->color_post_curve_lut_scale_offset_uniform =
+		glGetUniformLocation(shader->program, "color_post_curve_lut_scale_offset");
+}
+
 static struct gl_shader *
 gl_shader_create(struct gl_renderer *gr,
 		 const struct gl_shader_requirements *requirements)
@@ -212,6 +428,23 @@ gl_shader_create(struct gl_renderer *gr,
 	wl_list_init(&shader->link);
 	shader->key = *requirements;
 
+	if (shader_cache_load(gr, shader)) {
+		if (verbose) {
+			char *desc;
+
+			desc = create_shader_description_string(requirements);
+			weston_log_scope_printf(gr->shader_scope,
+						"Loaded cached shader program for: %s\n",
+						desc);
+			free(desc);
+		}
+
+		gl_shader_get_uniforms(shader);
+		wl_list_insert(&gr->shader_list, &shader->link);
+
+		return shader;
+	}
+
 	if (verbose) {
 		char *desc;
 
@@ -256,17 +489,8 @@ gl_shader_create(struct gl_renderer *gr,
 	glDeleteShader(shader->vertex_shader);
 	glDeleteShader(shader->fragment_shader);
 
-	shader->proj_uniform = glGetUniformLocation(shader->program, "proj");
-	shader->tex_uniforms[0] = glGetUniformLocation(shader->program, "tex");
-	shader->tex_uniforms[1] = glGetUniformLocation(shader->program, "tex1");
-	shader->tex_uniforms[2] = glGetUniformLocation(shader->program, "tex2");
-	shader->alpha_uniform = glGetUniformLocation(shader->program, "alpha");
-	shader->color_uniform = glGetUniformLocation(shader->program,
-						     "unicolor");
-	shader->color_pre_curve_lut_2d_uniform =
-		glGetUniformLocation(shader->program, "color_pre_curve_lut_2d");
-	shader->color_pre_curve_lut_scale_offset_uniform =
-		glGetUniformLocation(shader->program, "color_pre_curve_lut_scale_offset");
+	gl_shader_get_uniforms(shader);
+	shader_cache_store(gr, shader);
 
 	free(conf);
 
@@ -376,6 +600,8 @@ gl_renderer_create_fallback_shader(struct gl_renderer *gr)
 		.variant = SHADER_VARIANT_SOLID,
 		.input_is_premult = true,
 		.color_pre_curve = SHADER_COLOR_CURVE_IDENTITY,
+		.color_mapping = SHADER_COLOR_MAPPING_IDENTITY,
+		.color_post_curve = SHADER_COLOR_CURVE_IDENTITY,
 	};
 	struct gl_shader *shader;
 
@@ -442,6 +668,27 @@ gl_renderer_garbage_collect_programs(struct gl_renderer *gr)
 	}
 }
 
+/** Delete every shader program but the one in use
+ *
+ * \return The number of programs deleted.
+ */
+unsigned int
+gl_renderer_trim_programs(struct gl_renderer *gr)
+{
+	struct gl_shader *shader, *tmp;
+	unsigned int count = 0;
+
+	wl_list_for_each_safe(shader, tmp, &gr->shader_list, link) {
+		if (shader == gr->current_shader)
+			continue;
+
+		gl_shader_destroy(gr, shader);
+		count++;
+	}
+
+	return count;
+}
+
 bool
 gl_shader_texture_variant_can_be_premult(enum gl_shader_texture_variant v)
 {
@@ -461,6 +708,25 @@ gl_shader_texture_variant_can_be_premult(enum gl_shader_texture_variant v)
 	return true;
 }
 
+bool
+gl_shader_texture_variant_is_yuv(enum gl_shader_texture_variant v)
+{
+	switch (v) {
+	case SHADER_VARIANT_Y_U_V:
+	case SHADER_VARIANT_Y_UV:
+	case SHADER_VARIANT_Y_XUXV:
+	case SHADER_VARIANT_XYUV:
+		return true;
+	case SHADER_VARIANT_NONE:
+	case SHADER_VARIANT_RGBX:
+	case SHADER_VARIANT_RGBA:
+	case SHADER_VARIANT_SOLID:
+	case SHADER_VARIANT_EXTERNAL:
+		return false;
+	}
+	return false;
+}
+
 GLenum
 gl_shader_texture_variant_get_target(enum gl_shader_texture_variant v)
 {
@@ -515,6 +781,51 @@ gl_shader_load_config(struct gl_shader *shader,
 			     1, sconf->color_pre_curve_lut_scale_offset);
 		break;
 	}
+
+	/* Fixed texture unit for color_mapping LUT */
+	i++;
+	glActiveTexture(GL_TEXTURE0 + i);
+	switch (sconf->req.color_mapping) {
+	case SHADER_COLOR_MAPPING_IDENTITY:
+		assert(sconf->color_mapping_lut_tex == 0);
+		break;
+	case SHADER_COLOR_MAPPING_3DLUT:
+		assert(sconf->color_mapping_lut_tex != 0);
+		assert(shader->color_mapping_lut_3d_uniform != -1);
+		assert(shader->color_mapping_lut_scale_offset_uniform != -1);
+
+		glBindTexture(GL_TEXTURE_3D_OES, sconf->color_mapping_lut_tex);
+		glUniform1i(shader->color_mapping_lut_3d_uniform, i);
+		glUniform2fv(shader->color_mapping_lut_scale_offset_uniform,
+			     1, sconf->color_mapping_lut_scale_offset);
+		break;
+	case SHADER_COLOR_MAPPING_MATRIX:
+		assert(sconf->color_mapping_lut_tex == 0);
+		assert(shader->color_mapping_matrix_uniform != -1);
+
+		glUniformMatrix3fv(shader->color_mapping_matrix_uniform,
+				   1, GL_FALSE, sconf->color_mapping_matrix);
+		break;
+	}
+
+	/* Fixed texture unit for color_post_curve LUT */
+	i++;
+	glActiveTexture(GL_TEXTURE0 + i);
+	switch (sconf->req.color_post_curve) {
+	case SHADER_COLOR_CURVE_IDENTITY:
+		assert(sconf->color_post_curve_lut_tex == 0);
+		break;
+	case SHADER_COLOR_CURVE_LUT_3x1D:
+		assert(sconf->color_post_curve_lut_tex != 0);
+		assert(shader->color_post_curve_lut_2d_uniform != -1);
+		assert(shader->color_post_curve_lut_scale_offset_uniform != -1);
+
+		glBindTexture(GL_TEXTURE_2D, sconf->color_post_curve_lut_tex);
+		glUniform1i(shader->color_post_curve_lut_2d_uniform, i);
+		glUniform2fv(shader->color_post_curve_lut_scale_offset_uniform,
+			     1, sconf->color_post_curve_lut_scale_offset);
+		break;
+	}
 }
 
 bool
@@ -560,3 +871,141 @@ gl_renderer_use_program(struct gl_renderer *gr,
 
 	return true;
 }
+
+static const struct gl_shader_requirements shader_warmup_list[] = {
+	{ .variant = SHADER_VARIANT_RGBA, .input_is_premult = true },
+	{ .variant = SHADER_VARIANT_RGBX },
+	{ .variant = SHADER_VARIANT_SOLID, .input_is_premult = true },
+	{ .variant = SHADER_VARIANT_Y_UV },
+	{ .variant = SHADER_VARIANT_Y_U_V },
+	{ .variant = SHADER_VARIANT_Y_XUXV },
+	{ .variant = SHADER_VARIANT_XYUV },
+	{ .variant = SHADER_VARIANT_EXTERNAL, .input_is_premult = true },
+};
+
+static void
+shader_warmup_idle(void *data)
+{
+	struct gl_renderer *gr = data;
+	struct wl_event_loop *loop;
+	const struct gl_shader_requirements *reqs;
+
+	gr->shader_warmup_source = NULL;
+
+	if (gr->shader_warmup_next >= ARRAY_LENGTH(shader_warmup_list))
+		return;
+
+	reqs = &shader_warmup_list[gr->shader_warmup_next++];
+
+	/* One program per idle iteration, so that clients get serviced
+	 * between compilations. */
+	if (reqs->variant != SHADER_VARIANT_EXTERNAL ||
+	    gr->has_egl_image_external) {
+		eglMakeCurrent(gr->egl_display, gr->dummy_surface,
+			       gr->dummy_surface, gr->egl_context);
+		gl_renderer_get_program(gr, reqs);
+	}
+
+	loop = wl_display_get_event_loop(gr->compositor->wl_display);
+	gr->shader_warmup_source =
+		wl_event_loop_add_idle(loop, shader_warmup_idle, gr);
+}
+
+static char *
+shader_cache_dir_create(void)
+{
+	const char *env;
+	char *base = NULL;
+	char *dir = NULL;
+
+	env = getenv("WESTON_GL_SHADER_CACHE_DIR");
+	if (env) {
+		/* An empty value disables the cache. */
+		if (env[0] == '\0')
+			return NULL;
+		dir = strdup(env);
+	} else {
+		env = getenv("XDG_CACHE_HOME");
+		if (env && env[0] == '/') {
+			base = strdup(env);
+		} else {
+			env = getenv("HOME");
+			if (!env || env[0] != '/' ||
+			    asprintf(&base, "%s/.cache", env) < 0)
+				return NULL;
+		}
+		if (!base)
+			return NULL;
+
+		if (mkdir(base, 0700) < 0 && errno != EEXIST)
+			goto out;
+		if (asprintf(&dir, "%s/weston", base) < 0)
+			dir = NULL;
+	}
+
+	if (dir && mkdir(dir, 0700) < 0 && errno != EEXIST) {
+		free(dir);
+		dir = NULL;
+	}
+
+out:
+	free(base);
+	return dir;
+}
+
+void
+gl_shader_cache_init(struct gl_renderer *gr, const char *extensions)
+{
+	struct wl_event_loop *loop;
+	uint64_t key = 0xcbf29ce484222325ull;
+	GLint num_formats = 0;
+
+	loop = wl_display_get_event_loop(gr->compositor->wl_display);
+	gr->shader_warmup_next = 0;
+	gr->shader_warmup_source =
+		wl_event_loop_add_idle(loop, shader_warmup_idle, gr);
+
+	if (!weston_check_egl_extension(extensions,
+					"GL_OES_get_program_binary"))
+		return;
+
+	glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS_OES, &num_formats);
+	if (num_formats <= 0)
+		return;
+
+	gr->get_program_binary =
+		(void *) eglGetProcAddress("glGetProgramBinaryOES");
+	gr->program_binary =
+		(void *) eglGetProcAddress("glProgramBinaryOES");
+	if (!gr->get_program_binary || !gr->program_binary)
+		return;
+
+	/* Binaries are only valid for the driver that produced them and the
+	 * sources they were compiled from. */
+	key = shader_cache_hash_string(key,
+				       (const char *) glGetString(GL_VENDOR));
+	key = shader_cache_hash_string(key,
+				       (const char *) glGetString(GL_RENDERER));
+	key = shader_cache_hash_string(key,
+				       (const char *) glGetString(GL_VERSION));
+	key = shader_cache_hash_string(key, vertex_shader);
+	key = shader_cache_hash_string(key, fragment_shader);
+	gr->shader_cache_key = key;
+
+	gr->shader_cache_dir = shader_cache_dir_create();
+	if (gr->shader_cache_dir)
+		weston_log_scope_printf(gr->shader_scope,
+					"Shader binary cache: %s\n",
+					gr->shader_cache_dir);
+}
+
+void
+gl_shader_cache_fini(struct gl_renderer *gr)
+{
+	if (gr->shader_warmup_source)
+		wl_event_source_remove(gr->shader_warmup_source);
+	gr->shader_warmup_source = NULL;
+
+	free(gr->shader_cache_dir);
+	gr->shader_cache_dir = NULL;
+}
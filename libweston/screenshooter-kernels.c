@@ -0,0 +1,199 @@
+/*
+ * Copyright © 2008-2011 Kristian Høgsberg
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define SCREENSHOOTER_SSE2 1
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define SCREENSHOOTER_NEON 1
+#endif
+
+#include "screenshooter-kernels.h"
+
+#if defined(SCREENSHOOTER_SSE2) || defined(SCREENSHOOTER_NEON)
+static bool use_simd = true;
+#else
+static bool use_simd = false;
+#endif
+
+bool
+screenshooter_kernels_simd_enable(bool enable)
+{
+#if defined(SCREENSHOOTER_SSE2) || defined(SCREENSHOOTER_NEON)
+	use_simd = enable;
+#endif
+	return use_simd;
+}
+
+static inline uint32_t
+swap_RB(uint32_t v)
+{
+	/*                    A R G B */
+	uint32_t tmp = v & 0xff00ff00;
+	tmp |= (v >> 16) & 0x000000ff;
+	tmp |= (v << 16) & 0x00ff0000;
+	return tmp;
+}
+
+static inline uint32_t
+component_delta(uint32_t next, uint32_t prev)
+{
+	unsigned char dr, dg, db;
+
+	dr = (next >> 16) - (prev >> 16);
+	dg = (next >>  8) - (prev >>  8);
+	db = (next >>  0) - (prev >>  0);
+
+	return (dr << 16) | (dg << 8) | (db << 0);
+}
+
+void
+screenshooter_copy_row_swap_RB(uint32_t *dst, const uint32_t *src, int n)
+{
+	int i = 0;
+
+#if defined(SCREENSHOOTER_SSE2)
+	if (use_simd) {
+		const __m128i ag = _mm_set1_epi32(0xff00ff00);
+		const __m128i b = _mm_set1_epi32(0x000000ff);
+		const __m128i r = _mm_set1_epi32(0x00ff0000);
+
+		for (; i + 4 <= n; i += 4) {
+			__m128i v = _mm_loadu_si128((const __m128i *) &src[i]);
+			__m128i t = _mm_and_si128(v, ag);
+
+			t = _mm_or_si128(t, _mm_and_si128(_mm_srli_epi32(v, 16), b));
+			t = _mm_or_si128(t, _mm_and_si128(_mm_slli_epi32(v, 16), r));
+			_mm_storeu_si128((__m128i *) &dst[i], t);
+		}
+	}
+#elif defined(SCREENSHOOTER_NEON)
+	if (use_simd) {
+		for (; i + 16 <= n; i += 16) {
+			/* de-interleave bytes: B G R A in memory */
+			uint8x16x4_t v = vld4q_u8((const uint8_t *) &src[i]);
+			uint8x16_t t = v.val[0];
+
+			v.val[0] = v.val[2];
+			v.val[2] = t;
+			vst4q_u8((uint8_t *) &dst[i], v);
+		}
+	}
+#endif
+
+	for (; i < n; i++)
+		dst[i] = swap_RB(src[i]);
+}
+
+void
+screenshooter_delta_row(uint32_t *delta, uint32_t *prev,
+			const uint32_t *next, int n)
+{
+	int i = 0;
+
+#if defined(SCREENSHOOTER_SSE2)
+	if (use_simd) {
+		const __m128i rgb = _mm_set1_epi32(0x00ffffff);
+
+		/* Per byte subtraction wraps exactly like the unsigned char
+		 * arithmetic of component_delta(). */
+		for (; i + 4 <= n; i += 4) {
+			__m128i nv = _mm_loadu_si128((const __m128i *) &next[i]);
+			__m128i pv = _mm_loadu_si128((const __m128i *) &prev[i]);
+			__m128i d = _mm_and_si128(_mm_sub_epi8(nv, pv), rgb);
+
+			_mm_storeu_si128((__m128i *) &delta[i], d);
+			_mm_storeu_si128((__m128i *) &prev[i], nv);
+		}
+	}
+#elif defined(SCREENSHOOTER_NEON)
+	if (use_simd) {
+		const uint32x4_t rgb = vdupq_n_u32(0x00ffffff);
+
+		for (; i + 4 <= n; i += 4) {
+			uint32x4_t nv = vld1q_u32(&next[i]);
+			uint32x4_t pv = vld1q_u32(&prev[i]);
+			uint8x16_t d = vsubq_u8(vreinterpretq_u8_u32(nv),
+						vreinterpretq_u8_u32(pv));
+
+			vst1q_u32(&delta[i],
+				  vandq_u32(vreinterpretq_u32_u8(d), rgb));
+			vst1q_u32(&prev[i], nv);
+		}
+	}
+#endif
+
+	for (; i < n; i++) {
+		delta[i] = component_delta(next[i], prev[i]);
+		prev[i] = next[i];
+	}
+}
+
+int
+screenshooter_run_end(const uint32_t *delta, int start, int n,
+		      uint32_t value)
+{
+	int i = start;
+
+#if defined(SCREENSHOOTER_SSE2)
+	if (use_simd) {
+		const __m128i v = _mm_set1_epi32(value);
+
+		for (; i + 4 <= n; i += 4) {
+			__m128i d = _mm_loadu_si128((const __m128i *) &delta[i]);
+
+			if (_mm_movemask_epi8(_mm_cmpeq_epi32(d, v)) != 0xffff)
+				break;
+		}
+	}
+#elif defined(SCREENSHOOTER_NEON)
+	if (use_simd) {
+		const uint32x4_t v = vdupq_n_u32(value);
+
+		for (; i + 4 <= n; i += 4) {
+			uint32x4_t eq = vceqq_u32(vld1q_u32(&delta[i]), v);
+			uint32x2_t m = vand_u32(vget_low_u32(eq),
+						vget_high_u32(eq));
+
+			if ((vget_lane_u32(m, 0) & vget_lane_u32(m, 1)) !=
+			    0xffffffff)
+				break;
+		}
+	}
+#endif
+
+	for (; i < n; i++) {
+		if (delta[i] != value)
+			break;
+	}
+
+	return i;
+}
@@ -0,0 +1,62 @@
+/*
+ * Copyright © 2008-2011 Kristian Høgsberg
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef _WESTON_SCREENSHOOTER_KERNELS_H
+#define _WESTON_SCREENSHOOTER_KERNELS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/** Select the SIMD or the scalar implementation
+ *
+ * SIMD is used by default when the build target has SSE2 or NEON.
+ * Both paths produce identical results.
+ *
+ * \return True if the SIMD implementation is now in use.
+ */
+bool
+screenshooter_kernels_simd_enable(bool enable);
+
+/** Copy n 32-bit pixels swapping the R and B channels */
+void
+screenshooter_copy_row_swap_RB(uint32_t *dst, const uint32_t *src, int n);
+
+/** Compute wcap per-channel deltas of a row
+ *
+ * Stores next[i] - prev[i] for the R, G and B channels (alpha zero) into
+ * delta[i], and copies next[i] into prev[i].
+ */
+void
+screenshooter_delta_row(uint32_t *delta, uint32_t *prev,
+			const uint32_t *next, int n);
+
+/** Find the end of a run
+ *
+ * \return The first index i in [start, n) with delta[i] != value, or n.
+ */
+int
+screenshooter_run_end(const uint32_t *delta, int start, int n,
+		      uint32_t value);
+
+#endif
@@ -33,26 +33,34 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <errno.h>
+#include <pthread.h>
 #include <sys/uio.h>
 
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
 #include <libweston/libweston.h>
 #include "shared/helpers.h"
 #include "shared/timespec-util.h"
 #include "backend.h"
 #include "libweston-internal.h"
+#include "linux-dmabuf.h"
+#include "screenshooter-kernels.h"
 
 #include "wcap/wcap-decode.h"
 
 struct screenshooter_frame_listener {
 	struct wl_listener listener;
 	struct weston_buffer *buffer;
+	struct linux_dmabuf_buffer *dmabuf;
 	struct weston_output *output;
 	weston_screenshooter_done_func_t done;
 	void *data;
 };
 
 static void
-copy_bgra_yflip(uint8_t *dst, uint8_t *src, int height, int stride)
+copy_bgra_yflip(uint8_t *dst, const uint8_t *src, int height, int stride)
 {
 	uint8_t *end;
 
@@ -65,31 +73,20 @@ copy_bgra_yflip(uint8_t *dst, uint8_t *src, int height, int stride)
 }
 
 static void
-copy_bgra(uint8_t *dst, uint8_t *src, int height, int stride)
+copy_bgra(uint8_t *dst, const uint8_t *src, int height, int stride)
 {
 	/* TODO: optimize this out */
 	memcpy(dst, src, height * stride);
 }
 
 static void
-copy_row_swap_RB(void *vdst, void *vsrc, int bytes)
+copy_row_swap_RB(void *vdst, const void *vsrc, int bytes)
 {
-	uint32_t *dst = vdst;
-	uint32_t *src = vsrc;
-	uint32_t *end = dst + bytes / 4;
-
-	while (dst < end) {
-		uint32_t v = *src++;
-		/*                    A R G B */
-		uint32_t tmp = v & 0xff00ff00;
-		tmp |= (v >> 16) & 0x000000ff;
-		tmp |= (v << 16) & 0x00ff0000;
-		*dst++ = tmp;
-	}
+	screenshooter_copy_row_swap_RB(vdst, vsrc, bytes / 4);
 }
 
 static void
-copy_rgba_yflip(uint8_t *dst, uint8_t *src, int height, int stride)
+copy_rgba_yflip(uint8_t *dst, const uint8_t *src, int height, int stride)
 {
 	uint8_t *end;
 
@@ -102,7 +99,7 @@ copy_rgba_yflip(uint8_t *dst, uint8_t *src, int height, int stride)
 }
 
 static void
-copy_rgba(uint8_t *dst, uint8_t *src, int height, int stride)
+copy_rgba(uint8_t *dst, const uint8_t *src, int height, int stride)
 {
 	uint8_t *end;
 
@@ -114,32 +111,16 @@ copy_rgba(uint8_t *dst, uint8_t *src, int height, int stride)
 	}
 }
 
+/* Copy the read back pixels into the client buffer and complete. */
 static void
-screenshooter_frame_notify(struct wl_listener *listener, void *data)
+screenshooter_finish(struct screenshooter_frame_listener *l,
+		     const uint8_t *pixels)
 {
-	struct screenshooter_frame_listener *l =
-		container_of(listener,
-			     struct screenshooter_frame_listener, listener);
 	struct weston_output *output = l->output;
 	struct weston_compositor *compositor = output->compositor;
 	int32_t stride;
-	uint8_t *pixels, *d, *s;
-
-	weston_output_disable_planes_decr(output);
-	wl_list_remove(&listener->link);
-	stride = l->buffer->width * (PIXMAN_FORMAT_BPP(compositor->read_format) / 8);
-	pixels = malloc(stride * l->buffer->height);
-
-	if (pixels == NULL) {
-		l->done(l->data, WESTON_SCREENSHOOTER_NO_MEMORY);
-		free(l);
-		return;
-	}
-
-	compositor->renderer->read_pixels(output,
-			     compositor->read_format, pixels,
-			     0, 0, output->current_mode->width,
-			     output->current_mode->height);
+	uint8_t *d;
+	const uint8_t *s;
 
 	stride = wl_shm_buffer_get_stride(l->buffer->shm_buffer);
 
@@ -170,26 +151,101 @@ screenshooter_frame_notify(struct wl_listener *listener, void *data)
 	wl_shm_buffer_end_access(l->buffer->shm_buffer);
 
 	l->done(l->data, WESTON_SCREENSHOOTER_SUCCESS);
-	free(pixels);
 	free(l);
 }
 
+static void
+screenshooter_read_pixels_done(void *data, const void *pixels)
+{
+	struct screenshooter_frame_listener *l = data;
+
+	if (!pixels) {
+		l->done(l->data, WESTON_SCREENSHOOTER_BAD_BUFFER);
+		free(l);
+		return;
+	}
+
+	screenshooter_finish(l, pixels);
+}
+
+static void
+screenshooter_frame_notify(struct wl_listener *listener, void *data)
+{
+	struct screenshooter_frame_listener *l =
+		container_of(listener,
+			     struct screenshooter_frame_listener, listener);
+	struct weston_output *output = l->output;
+	struct weston_compositor *compositor = output->compositor;
+	struct weston_renderer *renderer = compositor->renderer;
+	int32_t stride;
+	uint8_t *pixels;
+
+	weston_output_disable_planes_decr(output);
+	wl_list_remove(&listener->link);
+
+	if (l->dmabuf) {
+		if (renderer->blit_to_dmabuf(output, l->dmabuf) < 0)
+			l->done(l->data, WESTON_SCREENSHOOTER_BAD_BUFFER);
+		else
+			l->done(l->data, WESTON_SCREENSHOOTER_SUCCESS);
+		free(l);
+		return;
+	}
+
+	stride = l->buffer->width * (PIXMAN_FORMAT_BPP(compositor->read_format) / 8);
+
+	/* The asynchronous read-back delivers exactly the output size, so
+	 * it is only used when that is what the copy below expects. */
+	if (renderer->read_pixels_async &&
+	    wl_shm_buffer_get_stride(l->buffer->shm_buffer) == stride &&
+	    l->buffer->width == output->current_mode->width &&
+	    l->buffer->height == output->current_mode->height &&
+	    renderer->read_pixels_async(output, compositor->read_format,
+					0, 0, output->current_mode->width,
+					output->current_mode->height,
+					screenshooter_read_pixels_done, l) == 0)
+		return;
+
+	pixels = malloc(stride * l->buffer->height);
+
+	if (pixels == NULL) {
+		l->done(l->data, WESTON_SCREENSHOOTER_NO_MEMORY);
+		free(l);
+		return;
+	}
+
+	renderer->read_pixels(output,
+			     compositor->read_format, pixels,
+			     0, 0, output->current_mode->width,
+			     output->current_mode->height);
+
+	screenshooter_finish(l, pixels);
+	free(pixels);
+}
+
 WL_EXPORT int
 weston_screenshooter_shoot(struct weston_output *output,
 			   struct weston_buffer *buffer,
 			   weston_screenshooter_done_func_t done, void *data)
 {
+	struct weston_renderer *renderer = output->compositor->renderer;
 	struct screenshooter_frame_listener *l;
-
-	if (!wl_shm_buffer_get(buffer->resource)) {
+	struct linux_dmabuf_buffer *dmabuf = NULL;
+
+	if (wl_shm_buffer_get(buffer->resource)) {
+		buffer->shm_buffer = wl_shm_buffer_get(buffer->resource);
+		buffer->width = wl_shm_buffer_get_width(buffer->shm_buffer);
+		buffer->height = wl_shm_buffer_get_height(buffer->shm_buffer);
+	} else if (renderer->blit_to_dmabuf &&
+		   (dmabuf = linux_dmabuf_buffer_get(buffer->resource))) {
+		/* Copied on the GPU, with no CPU read-back. */
+		buffer->width = dmabuf->attributes.width;
+		buffer->height = dmabuf->attributes.height;
+	} else {
 		done(data, WESTON_SCREENSHOOTER_BAD_BUFFER);
 		return -1;
 	}
 
-	buffer->shm_buffer = wl_shm_buffer_get(buffer->resource);
-	buffer->width = wl_shm_buffer_get_width(buffer->shm_buffer);
-	buffer->height = wl_shm_buffer_get_height(buffer->shm_buffer);
-
 	if (buffer->width < output->current_mode->width ||
 	    buffer->height < output->current_mode->height) {
 		done(data, WESTON_SCREENSHOOTER_BAD_BUFFER);
@@ -203,6 +259,7 @@ weston_screenshooter_shoot(struct weston_output *output,
 	}
 
 	l->buffer = buffer;
+	l->dmabuf = dmabuf;
 	l->output = output;
 	l->done = done;
 	l->data = data;
@@ -214,14 +271,52 @@ weston_screenshooter_shoot(struct weston_output *output,
 	return 0;
 }
 
+/* Frames the v2 writer thread may fall behind by before the recorder
+ * waits for it, as v1 always waits for its writes. */
+#define RECORDER_QUEUE_DEPTH 4
+/* Keyframes are split into bands that can be decoded in parallel */
+#define RECORDER_KEYFRAME_BAND 64
+#define RECORDER_ZSTD_LEVEL 1
+
+struct weston_recorder_job {
+	struct wl_list link;	/* weston_recorder::writer.jobs */
+	struct wcap_frame_header_v2 header;
+	void *data;
+};
+
 struct weston_recorder {
 	struct weston_output *output;
 	uint32_t *frame, *rect;
 	uint32_t *tmpbuf;
+	uint32_t *delta;
 	uint32_t total;
 	int fd;
 	struct wl_listener frame_listener;
 	int count, destroying;
+
+	/* Non-zero for the v2 format */
+	uint32_t keyframe_interval;
+	uint32_t since_keyframe;
+	pixman_box32_t *keyframe_rects;
+	int n_keyframe_rects;
+
+	/* v2 frames are compressed and written on their own thread */
+	struct {
+		pthread_t thread;
+		pthread_mutex_t mutex;
+		pthread_cond_t job_cond;
+		pthread_cond_t space_cond;
+		struct wl_list jobs;
+		int n_jobs;
+		bool quit;
+
+		/* Owned by the thread until it is joined */
+		uint32_t compression;
+		uint64_t offset;
+		uint32_t n_frames;
+		struct wl_array index;
+		bool failed;
+	} writer;
 };
 
 static uint32_t *
@@ -243,16 +338,194 @@ output_run(uint32_t *p, uint32_t delta, int run)
 	return p;
 }
 
-static uint32_t
-component_delta(uint32_t next, uint32_t prev)
+static bool
+weston_recorder_write(struct weston_recorder *recorder,
+		      const void *data, size_t size)
+{
+	const char *p = data;
+	ssize_t ret;
+
+	while (size > 0) {
+		ret = write(recorder->fd, p, size);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			return false;
+		p += ret;
+		size -= ret;
+	}
+
+	return true;
+}
+
+struct weston_recorder_scratch {
+	void *buf;
+	size_t size;
+#ifdef HAVE_ZSTD
+	ZSTD_CCtx *cctx;
+#endif
+};
+
+/* Compress a frame if that makes it smaller, and return its payload */
+static const void *
+weston_recorder_compress(struct weston_recorder *recorder,
+			 struct weston_recorder_job *job,
+			 struct weston_recorder_scratch *scratch)
 {
-	unsigned char dr, dg, db;
+#ifdef HAVE_ZSTD
+	size_t bound, ret;
+	void *buf;
+
+	if (recorder->writer.compression != WCAP_COMPRESSION_ZSTD ||
+	    !scratch->cctx)
+		return job->data;
+
+	bound = ZSTD_compressBound(job->header.raw_size);
+	if (bound > scratch->size) {
+		buf = realloc(scratch->buf, bound);
+		if (!buf)
+			return job->data;
+		scratch->buf = buf;
+		scratch->size = bound;
+	}
+
+	ret = ZSTD_compressCCtx(scratch->cctx, scratch->buf, bound,
+				job->data, job->header.raw_size,
+				RECORDER_ZSTD_LEVEL);
+	if (ZSTD_isError(ret) || ret >= job->header.raw_size)
+		return job->data;
 
-	dr = (next >> 16) - (prev >> 16);
-	dg = (next >>  8) - (prev >>  8);
-	db = (next >>  0) - (prev >>  0);
+	job->header.flags |= WCAP_FRAME_COMPRESSED;
+	job->header.size = ret;
 
-	return (dr << 16) | (dg << 8) | (db << 0);
+	return scratch->buf;
+#else
+	return job->data;
+#endif
+}
+
+static void
+weston_recorder_write_job(struct weston_recorder *recorder,
+			  struct weston_recorder_job *job,
+			  struct weston_recorder_scratch *scratch)
+{
+	static const uint8_t pad[3];
+	struct wcap_index_entry *entry;
+	const void *payload;
+	size_t stored;
+
+	if (recorder->writer.failed)
+		return;
+
+	job->header.size = job->header.raw_size;
+	payload = weston_recorder_compress(recorder, job, scratch);
+	stored = (job->header.size + 3) & ~3u;
+
+	if (!weston_recorder_write(recorder, &job->header, sizeof job->header) ||
+	    !weston_recorder_write(recorder, payload, job->header.size) ||
+	    !weston_recorder_write(recorder, pad, stored - job->header.size)) {
+		recorder->writer.failed = true;
+		return;
+	}
+
+	if (job->header.flags & WCAP_FRAME_KEYFRAME) {
+		entry = wl_array_add(&recorder->writer.index, sizeof *entry);
+		if (entry) {
+			entry->offset = recorder->writer.offset;
+			entry->frame = recorder->writer.n_frames;
+			entry->msecs = job->header.msecs;
+		}
+	}
+
+	stored += sizeof job->header;
+	recorder->writer.offset += stored;
+	recorder->writer.n_frames++;
+	__atomic_fetch_add(&recorder->total, stored, __ATOMIC_RELAXED);
+}
+
+static void *
+weston_recorder_writer_thread(void *data)
+{
+	struct weston_recorder *recorder = data;
+	struct weston_recorder_scratch scratch = { NULL, 0 };
+	struct weston_recorder_job *job;
+
+#ifdef HAVE_ZSTD
+	scratch.cctx = ZSTD_createCCtx();
+#endif
+
+	pthread_mutex_lock(&recorder->writer.mutex);
+	for (;;) {
+		while (wl_list_empty(&recorder->writer.jobs) &&
+		       !recorder->writer.quit)
+			pthread_cond_wait(&recorder->writer.job_cond,
+					  &recorder->writer.mutex);
+
+		/* Everything queued before the recorder stopped is written */
+		if (wl_list_empty(&recorder->writer.jobs))
+			break;
+
+		job = container_of(recorder->writer.jobs.next,
+				   struct weston_recorder_job, link);
+		wl_list_remove(&job->link);
+		recorder->writer.n_jobs--;
+		pthread_cond_signal(&recorder->writer.space_cond);
+		pthread_mutex_unlock(&recorder->writer.mutex);
+
+		weston_recorder_write_job(recorder, job, &scratch);
+		free(job);
+
+		pthread_mutex_lock(&recorder->writer.mutex);
+	}
+	pthread_mutex_unlock(&recorder->writer.mutex);
+
+#ifdef HAVE_ZSTD
+	ZSTD_freeCCtx(scratch.cctx);
+#endif
+	free(scratch.buf);
+
+	return NULL;
+}
+
+static struct weston_recorder_job *
+weston_recorder_job_create(struct weston_recorder *recorder, uint32_t msecs,
+			   pixman_box32_t *r, int n, bool keyframe)
+{
+	struct weston_recorder_job *job;
+	size_t size = n * sizeof *r;
+	int i;
+
+	/* A run covers at least one pixel, so a rectangle never takes more
+	 * words than it has pixels. */
+	for (i = 0; i < n; i++)
+		size += (size_t) (r[i].x2 - r[i].x1) * (r[i].y2 - r[i].y1) * 4;
+
+	job = malloc(sizeof *job + size);
+	if (!job)
+		return NULL;
+
+	job->data = job + 1;
+	job->header.msecs = msecs;
+	job->header.nrects = n;
+	job->header.flags = keyframe ? WCAP_FRAME_KEYFRAME : 0;
+	memcpy(job->data, r, n * sizeof *r);
+
+	return job;
+}
+
+/* Blocks while the writer thread is RECORDER_QUEUE_DEPTH frames behind */
+static void
+weston_recorder_queue_job(struct weston_recorder *recorder,
+			  struct weston_recorder_job *job)
+{
+	pthread_mutex_lock(&recorder->writer.mutex);
+	while (recorder->writer.n_jobs >= RECORDER_QUEUE_DEPTH)
+		pthread_cond_wait(&recorder->writer.space_cond,
+				  &recorder->writer.mutex);
+	wl_list_insert(recorder->writer.jobs.prev, &job->link);
+	recorder->writer.n_jobs++;
+	pthread_cond_signal(&recorder->writer.job_cond);
+	pthread_mutex_unlock(&recorder->writer.mutex);
 }
 
 static void
@@ -268,8 +541,8 @@ weston_recorder_frame_notify(struct wl_listener *listener, void *data)
 	uint32_t msecs = timespec_to_msec(&output->frame_time);
 	pixman_box32_t *r;
 	pixman_region32_t damage, transformed_damage;
-	int i, j, k, n, width, height, run, stride;
-	uint32_t delta, prev, *d, *s, *p, next;
+	int i, j, k, end, n, width, height, run, stride;
+	uint32_t prev, *d, *s, *p;
 	struct {
 		uint32_t msecs;
 		uint32_t nrects;
@@ -278,6 +551,9 @@ weston_recorder_frame_notify(struct wl_listener *listener, void *data)
 	int do_yflip;
 	int y_orig;
 	uint32_t *outbuf;
+	struct weston_recorder_job *job = NULL;
+	uint32_t *job_p = NULL;
+	bool keyframe;
 
 	do_yflip = !!(compositor->capabilities & WESTON_CAP_CAPTURE_YFLIP);
 	if (do_yflip)
@@ -295,20 +571,46 @@ weston_recorder_frame_notify(struct wl_listener *listener, void *data)
 	pixman_region32_fini(&damage);
 
 	r = pixman_region32_rectangles(&transformed_damage, &n);
+
+	keyframe = recorder->keyframe_interval > 0 &&
+		   (recorder->count == 0 ||
+		    recorder->since_keyframe >= recorder->keyframe_interval);
+	if (keyframe) {
+		r = recorder->keyframe_rects;
+		n = recorder->n_keyframe_rects;
+	}
+
 	if (n == 0) {
 		pixman_region32_fini(&transformed_damage);
 		return;
 	}
 
-	header.msecs = msecs;
-	header.nrects = n;
-	v[0].iov_base = &header;
-	v[0].iov_len = sizeof header;
-	v[1].iov_base = r;
-	v[1].iov_len = n * sizeof *r;
-	recorder->total += writev(recorder->fd, v, 2);
 	stride = output->current_mode->width;
 
+	if (recorder->keyframe_interval > 0) {
+		job = weston_recorder_job_create(recorder, msecs, r, n,
+						 keyframe);
+		if (!job) {
+			weston_log("%s: out of memory\n", __func__);
+			pixman_region32_fini(&transformed_damage);
+			return;
+		}
+		job_p = (uint32_t *) ((pixman_box32_t *) job->data + n);
+
+		/* Encoded against a blank frame */
+		if (keyframe)
+			memset(recorder->frame, 0, stride * 4 *
+			       output->current_mode->height);
+	} else {
+		header.msecs = msecs;
+		header.nrects = n;
+		v[0].iov_base = &header;
+		v[0].iov_len = sizeof header;
+		v[1].iov_base = r;
+		v[1].iov_len = n * sizeof *r;
+		recorder->total += writev(recorder->fd, v, 2);
+	}
+
 	for (i = 0; i < n; i++) {
 		width = r[i].x2 - r[i].x1;
 		height = r[i].y2 - r[i].y1;
@@ -322,7 +624,7 @@ weston_recorder_frame_notify(struct wl_listener *listener, void *data)
 				compositor->read_format, recorder->rect,
 				r[i].x1, y_orig, width, height);
 
-		p = outbuf;
+		p = job ? job_p : outbuf;
 		run = prev = 0; /* quiet gcc */
 		for (j = 0; j < height; j++) {
 			if (do_yflip)
@@ -332,24 +634,29 @@ weston_recorder_frame_notify(struct wl_listener *listener, void *data)
 			y_orig = r[i].y2 - j - 1;
 			d = recorder->frame + stride * y_orig + r[i].x1;
 
-			for (k = 0; k < width; k++) {
-				next = *s++;
-				delta = component_delta(next, *d);
-				*d++ = next;
-				if (run == 0 || delta == prev) {
-					run++;
-				} else {
+			screenshooter_delta_row(recorder->delta, d, s, width);
+
+			for (k = 0; k < width; k = end) {
+				if (run == 0) {
+					prev = recorder->delta[k];
+				} else if (recorder->delta[k] != prev) {
 					p = output_run(p, prev, run);
-					run = 1;
+					prev = recorder->delta[k];
+					run = 0;
 				}
-				prev = delta;
+				end = screenshooter_run_end(recorder->delta,
+							    k, width, prev);
+				run += end - k;
 			}
 		}
 
 		p = output_run(p, prev, run);
 
-		recorder->total += write(recorder->fd,
-					 outbuf, (p - outbuf) * 4);
+		if (job)
+			job_p = p;
+		else
+			recorder->total += write(recorder->fd,
+						 outbuf, (p - outbuf) * 4);
 
 #if 0
 		fprintf(stderr,
@@ -362,6 +669,14 @@ weston_recorder_frame_notify(struct wl_listener *listener, void *data)
 	}
 
 	pixman_region32_fini(&transformed_damage);
+
+	if (job) {
+		job->header.raw_size = (char *) job_p - (char *) job->data;
+		weston_recorder_queue_job(recorder, job);
+		recorder->since_keyframe = keyframe ?
+					   1 : recorder->since_keyframe + 1;
+	}
+
 	recorder->count++;
 
 	if (recorder->destroying)
@@ -374,19 +689,107 @@ weston_recorder_free(struct weston_recorder *recorder)
 	if (recorder == NULL)
 		return;
 
+	free(recorder->keyframe_rects);
+	free(recorder->delta);
 	free(recorder->tmpbuf);
 	free(recorder->rect);
 	free(recorder->frame);
 	free(recorder);
 }
 
+static int
+weston_recorder_init_v2(struct weston_recorder *recorder,
+			uint32_t keyframe_interval)
+{
+	struct weston_mode *mode = recorder->output->current_mode;
+	int i;
+
+	recorder->n_keyframe_rects = (mode->height + RECORDER_KEYFRAME_BAND - 1) /
+				     RECORDER_KEYFRAME_BAND;
+	recorder->keyframe_rects = calloc(recorder->n_keyframe_rects,
+					  sizeof *recorder->keyframe_rects);
+	if (!recorder->keyframe_rects)
+		return -1;
+
+	for (i = 0; i < recorder->n_keyframe_rects; i++) {
+		recorder->keyframe_rects[i].x1 = 0;
+		recorder->keyframe_rects[i].y1 = i * RECORDER_KEYFRAME_BAND;
+		recorder->keyframe_rects[i].x2 = mode->width;
+		recorder->keyframe_rects[i].y2 =
+			MIN((i + 1) * RECORDER_KEYFRAME_BAND, mode->height);
+	}
+
+	recorder->keyframe_interval = keyframe_interval;
+#ifdef HAVE_ZSTD
+	recorder->writer.compression = WCAP_COMPRESSION_ZSTD;
+#else
+	recorder->writer.compression = WCAP_COMPRESSION_NONE;
+#endif
+	recorder->writer.offset = sizeof(struct wcap_header_v2);
+	wl_list_init(&recorder->writer.jobs);
+	wl_array_init(&recorder->writer.index);
+
+	return 0;
+}
+
+static int
+weston_recorder_start_writer(struct weston_recorder *recorder)
+{
+	pthread_mutex_init(&recorder->writer.mutex, NULL);
+	pthread_cond_init(&recorder->writer.job_cond, NULL);
+	pthread_cond_init(&recorder->writer.space_cond, NULL);
+
+	if (pthread_create(&recorder->writer.thread, NULL,
+			   weston_recorder_writer_thread, recorder) != 0) {
+		pthread_cond_destroy(&recorder->writer.space_cond);
+		pthread_cond_destroy(&recorder->writer.job_cond);
+		pthread_mutex_destroy(&recorder->writer.mutex);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Waits for the queued frames, then closes the file with the index */
+static void
+weston_recorder_finish_v2(struct weston_recorder *recorder)
+{
+	struct wcap_index_trailer trailer = { 0 };
+
+	pthread_mutex_lock(&recorder->writer.mutex);
+	recorder->writer.quit = true;
+	pthread_cond_signal(&recorder->writer.job_cond);
+	pthread_mutex_unlock(&recorder->writer.mutex);
+	pthread_join(recorder->writer.thread, NULL);
+
+	pthread_cond_destroy(&recorder->writer.space_cond);
+	pthread_cond_destroy(&recorder->writer.job_cond);
+	pthread_mutex_destroy(&recorder->writer.mutex);
+
+	trailer.index_offset = recorder->writer.offset;
+	trailer.n_entries = recorder->writer.index.size /
+			    sizeof(struct wcap_index_entry);
+	trailer.n_frames = recorder->writer.n_frames;
+	trailer.magic = WCAP_INDEX_MAGIC;
+
+	if (recorder->writer.failed ||
+	    !weston_recorder_write(recorder, recorder->writer.index.data,
+				   recorder->writer.index.size) ||
+	    !weston_recorder_write(recorder, &trailer, sizeof trailer))
+		weston_log("recorder: writing the capture failed, "
+			   "the file is incomplete\n");
+
+	wl_array_release(&recorder->writer.index);
+}
+
 static struct weston_recorder *
-weston_recorder_create(struct weston_output *output, const char *filename)
+weston_recorder_create(struct weston_output *output, const char *filename,
+		       uint32_t keyframe_interval)
 {
 	struct weston_compositor *compositor = output->compositor;
 	struct weston_recorder *recorder;
 	int stride, size;
-	struct { uint32_t magic, format, width, height; } header;
+	struct wcap_header_v2 header;
 	int do_yflip;
 
 	do_yflip = !!(compositor->capabilities & WESTON_CAP_CAPTURE_YFLIP);
@@ -401,9 +804,11 @@ weston_recorder_create(struct weston_output *output, const char *filename)
 	size = stride * 4 * output->current_mode->height;
 	recorder->frame = zalloc(size);
 	recorder->rect = malloc(size);
+	recorder->delta = malloc(stride * 4);
 	recorder->output = output;
 
-	if ((recorder->frame == NULL) || (recorder->rect == NULL)) {
+	if ((recorder->frame == NULL) || (recorder->rect == NULL) ||
+	    (recorder->delta == NULL)) {
 		weston_log("%s: out of memory\n", __func__);
 		goto err_recorder;
 	}
@@ -416,7 +821,14 @@ weston_recorder_create(struct weston_output *output, const char *filename)
 		}
 	}
 
-	header.magic = WCAP_HEADER_MAGIC;
+	if (keyframe_interval > 0 &&
+	    weston_recorder_init_v2(recorder, keyframe_interval) < 0) {
+		weston_log("%s: out of memory\n", __func__);
+		goto err_recorder;
+	}
+
+	header.magic = keyframe_interval > 0 ?
+		       WCAP_HEADER_MAGIC_V2 : WCAP_HEADER_MAGIC;
 
 	switch (compositor->read_format) {
 	case PIXMAN_x8r8g8b8:
@@ -442,7 +854,21 @@ weston_recorder_create(struct weston_output *output, const char *filename)
 
 	header.width = output->current_mode->width;
 	header.height = output->current_mode->height;
-	recorder->total += write(recorder->fd, &header, sizeof header);
+	if (keyframe_interval > 0) {
+		header.compression = recorder->writer.compression;
+		header.keyframe_interval = keyframe_interval;
+		recorder->total += write(recorder->fd, &header, sizeof header);
+
+		if (weston_recorder_start_writer(recorder) < 0) {
+			weston_log("%s: failed to start the writer thread\n",
+				   __func__);
+			close(recorder->fd);
+			goto err_recorder;
+		}
+	} else {
+		recorder->total += write(recorder->fd, &header,
+					 sizeof(struct wcap_header));
+	}
 
 	recorder->frame_listener.notify = weston_recorder_frame_notify;
 	wl_signal_add(&output->frame_signal, &recorder->frame_listener);
@@ -460,13 +886,16 @@ static void
 weston_recorder_destroy(struct weston_recorder *recorder)
 {
 	wl_list_remove(&recorder->frame_listener.link);
+	if (recorder->keyframe_interval > 0)
+		weston_recorder_finish_v2(recorder);
 	close(recorder->fd);
 	weston_output_disable_planes_decr(recorder->output);
 	weston_recorder_free(recorder);
 }
 
-WL_EXPORT struct weston_recorder *
-weston_recorder_start(struct weston_output *output, const char *filename)
+static struct weston_recorder *
+recorder_start(struct weston_output *output, const char *filename,
+	       uint32_t keyframe_interval)
 {
 	struct wl_listener *listener;
 
@@ -480,14 +909,40 @@ weston_recorder_start(struct weston_output *output, const char *filename)
 
 	weston_log("starting recorder for output %s, file %s\n",
 		   output->name, filename);
-	return weston_recorder_create(output, filename);
+	return weston_recorder_create(output, filename, keyframe_interval);
+}
+
+WL_EXPORT struct weston_recorder *
+weston_recorder_start(struct weston_output *output, const char *filename)
+{
+	return recorder_start(output, filename, 0);
+}
+
+/** Start recording an output in the wcap v2 format
+ *
+ * \param output The output to record.
+ * \param filename The file to write, truncated if it exists.
+ * \param keyframe_interval Frames from one keyframe to the next, at least 1.
+ *
+ * Unlike the v1 format of weston_recorder_start(), every
+ * keyframe_interval-th frame is stored whole, frames are compressed with
+ * zstd when libweston is built with it, and the file ends with an index
+ * of the keyframes, so wcap-decode can seek without replaying it.
+ * Compression and writing happen on a thread of their own.
+ */
+WL_EXPORT struct weston_recorder *
+weston_recorder_start_v2(struct weston_output *output, const char *filename,
+			 uint32_t keyframe_interval)
+{
+	return recorder_start(output, filename, MAX(keyframe_interval, 1u));
 }
 
 WL_EXPORT void
 weston_recorder_stop(struct weston_recorder *recorder)
 {
 	weston_log("stopping recorder, total file size %dM, %d frames\n",
-		   recorder->total / (1024 * 1024), recorder->count);
+		   __atomic_load_n(&recorder->total, __ATOMIC_RELAXED) /
+		   (1024 * 1024), recorder->count);
 
 	recorder->destroying = 1;
 	weston_output_schedule_repaint(recorder->output);
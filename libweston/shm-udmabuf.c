@@ -0,0 +1,275 @@
+/*
+ * Copyright © 2022 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/dma-buf.h>
+#ifdef HAVE_LINUX_UDMABUF_H
+#include <linux/udmabuf.h>
+#endif
+
+#include <libweston/libweston.h>
+#include <libweston/zalloc.h>
+#include "libweston-internal.h"
+#include "linux-dmabuf.h"
+#include "pixel-formats.h"
+#include "shm-udmabuf.h"
+#include "shared/fd-util.h"
+#include "shared/helpers.h"
+#include "shared/weston-drm-fourcc.h"
+
+/*
+ * wl_shm buffers wrapped into dmabufs with /dev/udmabuf, so that the
+ * renderer imports them like a client dmabuf instead of uploading the
+ * pixels, and the DRM backend can put them on a plane.
+ *
+ * libwayland keeps the fd of a wl_shm pool to itself, so the memfd is
+ * found again through the compositor's own mapping of the pool in
+ * /proc/self/map_files. Opening those needs CAP_CHECKPOINT_RESTORE or
+ * CAP_SYS_ADMIN; without either, the first attempt turns the path off.
+ * udmabuf also wants a memfd sealed against shrinking and a page aligned
+ * buffer, anything else keeps being uploaded.
+ */
+
+#ifdef HAVE_LINUX_UDMABUF_H
+
+/* Find the mapping of the pool containing data. */
+static int
+shm_open_pool_memfd(const void *data, uint64_t *file_offset)
+{
+	uintptr_t addr = (uintptr_t)data;
+	unsigned long start, end, offset;
+	char perms[5];
+	char line[512];
+	char path[64];
+	FILE *maps;
+	int fd = -1;
+	int err = ENOENT;
+
+	maps = fopen("/proc/self/maps", "re");
+	if (!maps)
+		return -1;
+
+	while (fgets(line, sizeof line, maps)) {
+		if (sscanf(line, "%lx-%lx %4s %lx", &start, &end, perms,
+			   &offset) != 4)
+			continue;
+		if (addr < start || addr >= end)
+			continue;
+
+		/* libwayland maps pools shared, from memfds or files */
+		if (perms[3] != 's' || !strstr(line, "/memfd:"))
+			break;
+
+		snprintf(path, sizeof path, "/proc/self/map_files/%lx-%lx",
+			 start, end);
+		fd = open(path, O_RDWR | O_CLOEXEC);
+		err = errno;
+		*file_offset = offset + (addr - start);
+		break;
+	}
+
+	fclose(maps);
+	errno = err;
+	return fd;
+}
+
+static struct linux_dmabuf_buffer *
+shm_create_udmabuf(struct weston_compositor *ec, struct wl_shm_buffer *shm)
+{
+	const struct pixel_format_info *info;
+	struct linux_dmabuf_buffer *dmabuf;
+	struct udmabuf_create create = { 0 };
+	long page_size = sysconf(_SC_PAGESIZE);
+	int32_t stride = wl_shm_buffer_get_stride(shm);
+	int32_t height = wl_shm_buffer_get_height(shm);
+	uint64_t offset = 0;
+	int memfd, fd;
+
+	info = pixel_format_get_info_shm(wl_shm_buffer_get_format(shm));
+	if (!info || info->num_planes != 1 || page_size <= 0)
+		return NULL;
+
+	memfd = shm_open_pool_memfd(wl_shm_buffer_get_data(shm), &offset);
+	if (memfd < 0) {
+		if (errno == EPERM || errno == EACCES) {
+			weston_log("udmabuf: cannot open the wl_shm pools of "
+				   "clients (%s), uploading them instead\n",
+				   strerror(errno));
+			fd_clear(&ec->udmabuf_fd);
+		}
+		return NULL;
+	}
+
+	if (offset % page_size != 0) {
+		close(memfd);
+		return NULL;
+	}
+
+	create.memfd = memfd;
+	create.flags = UDMABUF_FLAGS_CLOEXEC;
+	create.offset = offset;
+	create.size = ((uint64_t)stride * height + page_size - 1) &
+		      ~((uint64_t)page_size - 1);
+	fd = ioctl(ec->udmabuf_fd, UDMABUF_CREATE, &create);
+	close(memfd);
+	if (fd < 0)
+		return NULL;
+
+	dmabuf = zalloc(sizeof *dmabuf);
+	if (!dmabuf) {
+		close(fd);
+		return NULL;
+	}
+
+	dmabuf->compositor = ec;
+	dmabuf->attributes.width = wl_shm_buffer_get_width(shm);
+	dmabuf->attributes.height = height;
+	dmabuf->attributes.format = info->format;
+	dmabuf->attributes.n_planes = 1;
+	dmabuf->attributes.fd[0] = fd;
+	dmabuf->attributes.offset[0] = 0;
+	dmabuf->attributes.stride[0] = stride;
+	dmabuf->attributes.modifier[0] = DRM_FORMAT_MOD_LINEAR;
+
+	/* The renderer decides whether the layout suits it. */
+	if (!weston_compositor_import_dmabuf(ec, dmabuf)) {
+		linux_dmabuf_buffer_destroy(dmabuf);
+		return NULL;
+	}
+
+	return dmabuf;
+}
+
+/** Open /dev/udmabuf to import wl_shm buffers as dmabufs
+ *
+ * \return 0 on success, -1 if the kernel does not offer udmabuf.
+ */
+WL_EXPORT int
+weston_compositor_enable_shm_udmabuf(struct weston_compositor *ec)
+{
+	if (ec->udmabuf_fd >= 0)
+		return 0;
+
+	ec->udmabuf_fd = open("/dev/udmabuf", O_RDWR | O_CLOEXEC);
+	if (ec->udmabuf_fd < 0) {
+		weston_log("udmabuf: cannot open /dev/udmabuf: %s\n",
+			   strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+#else /* HAVE_LINUX_UDMABUF_H */
+
+static struct linux_dmabuf_buffer *
+shm_create_udmabuf(struct weston_compositor *ec, struct wl_shm_buffer *shm)
+{
+	return NULL;
+}
+
+WL_EXPORT int
+weston_compositor_enable_shm_udmabuf(struct weston_compositor *ec)
+{
+	weston_log("udmabuf: not supported by this build\n");
+	return -1;
+}
+
+#endif /* HAVE_LINUX_UDMABUF_H */
+
+/** Wrap a wl_shm buffer into a dmabuf, once per buffer
+ *
+ * \return The dmabuf, already imported into the renderer, or NULL if the
+ * buffer has to be uploaded.
+ */
+struct linux_dmabuf_buffer *
+weston_buffer_ensure_udmabuf(struct weston_compositor *ec,
+			     struct weston_buffer *buffer)
+{
+	struct wl_shm_buffer *shm;
+
+	if (buffer->udmabuf || buffer->udmabuf_failed || ec->udmabuf_fd < 0)
+		return buffer->udmabuf;
+
+	shm = wl_shm_buffer_get(buffer->resource);
+	if (!shm)
+		return NULL;
+
+	buffer->udmabuf = shm_create_udmabuf(ec, shm);
+	buffer->udmabuf_failed = !buffer->udmabuf;
+
+	return buffer->udmabuf;
+}
+
+/** Make what the client drew before the commit visible to devices
+ *
+ * udmabuf memory is cached, the cache maintenance of a CPU access
+ * finishing writes it back for the GPU and the display controller.
+ */
+void
+weston_buffer_udmabuf_sync(struct weston_buffer *buffer)
+{
+	struct dma_buf_sync sync = { 0 };
+	int fd;
+
+	if (!buffer->udmabuf)
+		return;
+
+	fd = buffer->udmabuf->attributes.fd[0];
+	sync.flags = DMA_BUF_SYNC_START | DMA_BUF_SYNC_WRITE;
+	if (ioctl(fd, DMA_BUF_IOCTL_SYNC, &sync) < 0)
+		return;
+	sync.flags = DMA_BUF_SYNC_END | DMA_BUF_SYNC_WRITE;
+	ioctl(fd, DMA_BUF_IOCTL_SYNC, &sync);
+}
+
+void
+weston_buffer_udmabuf_destroy(struct weston_buffer *buffer)
+{
+	struct linux_dmabuf_buffer *dmabuf = buffer->udmabuf;
+
+	if (!dmabuf)
+		return;
+
+	if (dmabuf->user_data_destroy_func)
+		dmabuf->user_data_destroy_func(dmabuf);
+	linux_dmabuf_buffer_destroy(dmabuf);
+	buffer->udmabuf = NULL;
+}
+
+void
+weston_compositor_shm_udmabuf_fini(struct weston_compositor *ec)
+{
+	fd_clear(&ec->udmabuf_fd);
+}
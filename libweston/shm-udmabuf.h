@@ -0,0 +1,46 @@
+/*
+ * Copyright © 2022 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef WESTON_SHM_UDMABUF_H
+#define WESTON_SHM_UDMABUF_H
+
+#include <libweston/libweston.h>
+
+struct linux_dmabuf_buffer;
+
+struct linux_dmabuf_buffer *
+weston_buffer_ensure_udmabuf(struct weston_compositor *ec,
+			     struct weston_buffer *buffer);
+
+void
+weston_buffer_udmabuf_sync(struct weston_buffer *buffer);
+
+void
+weston_buffer_udmabuf_destroy(struct weston_buffer *buffer);
+
+void
+weston_compositor_shm_udmabuf_fini(struct weston_compositor *ec);
+
+#endif /* WESTON_SHM_UDMABUF_H */
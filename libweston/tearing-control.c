@@ -0,0 +1,152 @@
+/*
+ * Copyright © 2022 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdint.h>
+
+#include <libweston/libweston.h>
+#include "libweston-internal.h"
+#include "weston-tearing-control-server-protocol.h"
+
+static void
+tearing_control_set_presentation_hint(struct wl_client *client,
+				      struct wl_resource *resource,
+				      uint32_t hint)
+{
+	struct weston_surface *surface = wl_resource_get_user_data(resource);
+
+	if (!surface)
+		return;
+
+	surface->pending.async_present =
+		hint == WESTON_TEARING_CONTROL_V1_PRESENTATION_HINT_ASYNC;
+}
+
+static void
+tearing_control_destroy(struct wl_client *client, struct wl_resource *resource)
+{
+	wl_resource_destroy(resource);
+}
+
+static const struct weston_tearing_control_v1_interface
+	tearing_control_implementation = {
+		tearing_control_set_presentation_hint,
+		tearing_control_destroy,
+};
+
+static void
+destroy_tearing_control(struct wl_resource *resource)
+{
+	struct weston_surface *surface = wl_resource_get_user_data(resource);
+
+	if (!surface)
+		return;
+
+	surface->pending.async_present = false;
+	surface->tearing_control_resource = NULL;
+}
+
+static void
+tearing_control_manager_destroy(struct wl_client *client,
+				struct wl_resource *resource)
+{
+	wl_resource_destroy(resource);
+}
+
+static void
+tearing_control_manager_get_tearing_control(struct wl_client *client,
+					    struct wl_resource *manager_resource,
+					    uint32_t id,
+					    struct wl_resource *surface_resource)
+{
+	struct weston_surface *surface =
+		wl_resource_get_user_data(surface_resource);
+	struct wl_resource *resource;
+
+	if (surface->tearing_control_resource) {
+		wl_resource_post_error(manager_resource,
+				       WESTON_TEARING_CONTROL_MANAGER_V1_ERROR_TEARING_CONTROL_EXISTS,
+				       "wl_surface@%u already has a tearing "
+				       "control object",
+				       wl_resource_get_id(surface_resource));
+		return;
+	}
+
+	resource = wl_resource_create(client,
+				      &weston_tearing_control_v1_interface,
+				      1, id);
+	if (!resource) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+
+	wl_resource_set_implementation(resource,
+				       &tearing_control_implementation,
+				       surface, destroy_tearing_control);
+	surface->tearing_control_resource = resource;
+}
+
+static const struct weston_tearing_control_manager_v1_interface
+	tearing_control_manager_implementation = {
+		tearing_control_manager_destroy,
+		tearing_control_manager_get_tearing_control,
+};
+
+static void
+bind_tearing_control_manager(struct wl_client *client, void *data,
+			     uint32_t version, uint32_t id)
+{
+	struct weston_compositor *ec = data;
+	struct wl_resource *resource;
+
+	resource = wl_resource_create(client,
+				      &weston_tearing_control_manager_v1_interface,
+				      version, id);
+	if (!resource) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+
+	wl_resource_set_implementation(resource,
+				       &tearing_control_manager_implementation,
+				       ec, NULL);
+}
+
+/** Advertise weston_tearing_control_manager_v1
+ *
+ * The hint ends up in weston_surface::async_present. Acting on it is up to
+ * the backend.
+ */
+int
+weston_tearing_control_setup(struct weston_compositor *ec)
+{
+	if (!wl_global_create(ec->wl_display,
+			      &weston_tearing_control_manager_v1_interface, 1,
+			      ec, bind_tearing_control_manager))
+		return -1;
+
+	return 0;
+}
@@ -31,6 +31,7 @@
 #include <string.h>
 #include <time.h>
 #include <assert.h>
+#include <stdlib.h>
 
 #include <libweston/libweston.h>
 #include <libweston/weston-log.h>
@@ -379,6 +380,15 @@ weston_timeline_refresh_subscription_objects(struct weston_compositor *wc,
 		if (sub_obj)
 			sub_obj->force_refresh = true;
 	}
+
+	while ((sub = weston_log_subscription_iterate(wc->timeline_binary,
+						      sub))) {
+		struct weston_timeline_subscription_object *sub_obj;
+
+		sub_obj = weston_timeline_get_subscription_object(sub, object);
+		if (sub_obj)
+			sub_obj->force_refresh = true;
+	}
 }
 
 typedef int (*type_func)(struct timeline_emit_context *ctx, void *obj);
@@ -459,3 +469,317 @@ weston_timeline_point(struct weston_log_scope *timeline_scope,
 
 	}
 }
+
+/* Big enough for a couple of idle flushes per frame on a busy compositor,
+ * small enough to not matter when left subscribed. */
+#define TLB_BUFFER_SIZE (16 * 1024)
+#define TLB_RECORD_MAX 512
+
+struct tlb_record {
+	uint8_t data[TLB_RECORD_MAX];
+	size_t len;
+	bool overflow;
+};
+
+static void
+tlb_put(struct tlb_record *rec, const void *data, size_t len)
+{
+	if (rec->len + len > sizeof(rec->data)) {
+		rec->overflow = true;
+		return;
+	}
+
+	memcpy(&rec->data[rec->len], data, len);
+	rec->len += len;
+}
+
+static void
+tlb_put_u8(struct tlb_record *rec, uint8_t v)
+{
+	tlb_put(rec, &v, sizeof v);
+}
+
+static void
+tlb_put_u32(struct tlb_record *rec, uint32_t v)
+{
+	tlb_put(rec, &v, sizeof v);
+}
+
+static void
+tlb_put_u64(struct tlb_record *rec, uint64_t v)
+{
+	tlb_put(rec, &v, sizeof v);
+}
+
+static void
+tlb_put_ts(struct tlb_record *rec, const struct timespec *ts)
+{
+	tlb_put_u64(rec, (uint64_t)ts->tv_sec * 1000000000ull + ts->tv_nsec);
+}
+
+static void
+tlb_begin(struct tlb_record *rec, enum timeline_binary_record type)
+{
+	uint16_t header[2] = { type, 0 };
+
+	rec->len = 0;
+	rec->overflow = false;
+	tlb_put(rec, header, sizeof header);
+}
+
+static void
+tlb_flush(struct weston_timeline_subscription *tl_sub)
+{
+	if (tl_sub->len > 0)
+		weston_log_subscription_write(tl_sub->sub,
+					      (const char *)tl_sub->buf,
+					      tl_sub->len);
+	tl_sub->len = 0;
+}
+
+static void
+tlb_flush_idle(void *data)
+{
+	struct weston_timeline_subscription *tl_sub = data;
+
+	tl_sub->flush_source = NULL;
+	tlb_flush(tl_sub);
+}
+
+/** Queue a finished record; the stream is written once per idle so that a
+ * point costs a memcpy rather than a write to the subscriber. */
+static void
+tlb_end(struct weston_timeline_subscription *tl_sub, struct tlb_record *rec)
+{
+	uint16_t len = rec->len;
+
+	/* a truncated description is useless, drop it */
+	if (rec->overflow)
+		return;
+
+	memcpy(&rec->data[2], &len, sizeof len);
+
+	if (tl_sub->len + rec->len > TLB_BUFFER_SIZE)
+		tlb_flush(tl_sub);
+	memcpy(&tl_sub->buf[tl_sub->len], rec->data, rec->len);
+	tl_sub->len += rec->len;
+
+	if (!tl_sub->flush_source)
+		tl_sub->flush_source =
+			wl_event_loop_add_idle(tl_sub->loop, tlb_flush_idle,
+					       tl_sub);
+	if (!tl_sub->flush_source)
+		tlb_flush(tl_sub);
+}
+
+static uint32_t
+tlb_name_id(struct weston_timeline_subscription *tl_sub, const char *name)
+{
+	struct tlb_record rec;
+	const char **names;
+	unsigned int i;
+
+	/* point names are string literals, compare the pointers */
+	for (i = 0; i < tl_sub->names_count; i++)
+		if (tl_sub->names[i] == name)
+			return i + 1;
+
+	names = realloc(tl_sub->names,
+			(tl_sub->names_count + 1) * sizeof *names);
+	if (!names)
+		return 0;
+
+	tl_sub->names = names;
+	tl_sub->names[tl_sub->names_count++] = name;
+
+	tlb_begin(&rec, TLB_NAME);
+	tlb_put_u32(&rec, tl_sub->names_count);
+	tlb_put(&rec, name, strlen(name));
+	tlb_end(tl_sub, &rec);
+
+	return tl_sub->names_count;
+}
+
+static uint32_t
+tlb_output_id(struct weston_timeline_subscription *tl_sub,
+	      struct weston_output *output)
+{
+	struct weston_timeline_subscription_object *sub_obj;
+	struct tlb_record rec;
+
+	sub_obj = weston_timeline_subscription_output_ensure(tl_sub, output);
+	if (weston_timeline_check_object_refresh(sub_obj)) {
+		tlb_begin(&rec, TLB_OUTPUT);
+		tlb_put_u32(&rec, sub_obj->id);
+		if (output->name)
+			tlb_put(&rec, output->name, strlen(output->name));
+		tlb_end(tl_sub, &rec);
+	}
+
+	return sub_obj->id;
+}
+
+static uint32_t
+tlb_surface_id(struct weston_timeline_subscription *tl_sub,
+	       struct weston_surface *surface)
+{
+	struct weston_timeline_subscription_object *sub_obj;
+	struct weston_surface *mains;
+	struct tlb_record rec;
+	uint32_t main_id = 0;
+	char desc[256];
+
+	sub_obj = weston_timeline_subscription_surface_ensure(tl_sub, surface);
+	if (!weston_timeline_check_object_refresh(sub_obj))
+		return sub_obj->id;
+
+	mains = weston_surface_get_main_surface(surface);
+	if (mains != surface)
+		main_id = tlb_surface_id(tl_sub, mains);
+
+	if (!surface->get_label ||
+	    surface->get_label(surface, desc, sizeof(desc)) < 0)
+		desc[0] = '\0';
+
+	tlb_begin(&rec, TLB_SURFACE);
+	tlb_put_u32(&rec, sub_obj->id);
+	tlb_put_u32(&rec, main_id);
+	tlb_put(&rec, desc, strlen(desc));
+	tlb_end(tl_sub, &rec);
+
+	return sub_obj->id;
+}
+
+/** Create a binary timeline subscription and write the stream header
+ *
+ * @ingroup internal-log
+ */
+void
+weston_timeline_binary_create_subscription(struct weston_log_subscription *sub,
+					   void *user_data)
+{
+	struct weston_compositor *compositor = user_data;
+	struct weston_timeline_subscription *tl_sub;
+	uint32_t version = WESTON_TIMELINE_BINARY_VERSION;
+
+	tl_sub = zalloc(sizeof(*tl_sub));
+	if (!tl_sub)
+		return;
+
+	tl_sub->buf = malloc(TLB_BUFFER_SIZE);
+	if (!tl_sub->buf) {
+		free(tl_sub);
+		return;
+	}
+
+	wl_list_init(&tl_sub->objects);
+	tl_sub->sub = sub;
+	tl_sub->loop = wl_display_get_event_loop(compositor->wl_display);
+	weston_log_subscription_set_data(sub, tl_sub);
+
+	weston_log_subscription_write(sub, WESTON_TIMELINE_BINARY_MAGIC, 4);
+	weston_log_subscription_write(sub, (const char *)&version,
+				      sizeof version);
+}
+
+/** Destroy a binary timeline subscription
+ *
+ * Records not flushed yet are dropped, the stream is already going away.
+ *
+ * @ingroup internal-log
+ */
+void
+weston_timeline_binary_destroy_subscription(struct weston_log_subscription *sub,
+					    void *user_data)
+{
+	struct weston_timeline_subscription *tl_sub =
+		weston_log_subscription_get_data(sub);
+
+	if (!tl_sub)
+		return;
+
+	if (tl_sub->flush_source)
+		wl_event_source_remove(tl_sub->flush_source);
+	free(tl_sub->names);
+	free(tl_sub->buf);
+
+	weston_timeline_destroy_subscription(sub, user_data);
+}
+
+/** Like weston_timeline_point(), but for the 'timeline-binary' scope
+ *
+ * No formatting happens here: the point is copied into the batch buffer
+ * of each subscription.
+ *
+ * @ingroup log
+ */
+WL_EXPORT void
+weston_timeline_point_binary(struct weston_log_scope *timeline_scope,
+			     const char *name, ...)
+{
+	struct weston_timeline_subscription *tl_sub;
+	struct weston_log_subscription *sub = NULL;
+	struct tlb_record rec;
+	enum timeline_type otype;
+	struct timespec ts;
+	uint32_t name_id, id;
+	va_list argp;
+	void *obj;
+
+	if (!weston_log_scope_is_enabled(timeline_scope))
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	while ((sub = weston_log_subscription_iterate(timeline_scope, sub))) {
+		tl_sub = weston_log_subscription_get_data(sub);
+		if (!tl_sub)
+			continue;
+
+		name_id = tlb_name_id(tl_sub, name);
+		if (name_id == 0)
+			continue;
+
+		/* object descriptions go out before the point itself */
+		va_start(argp, name);
+		while ((otype = va_arg(argp, enum timeline_type)) != TLT_END) {
+			obj = va_arg(argp, void *);
+			if (otype == TLT_OUTPUT)
+				tlb_output_id(tl_sub, obj);
+			else if (otype == TLT_SURFACE)
+				tlb_surface_id(tl_sub, obj);
+		}
+		va_end(argp);
+
+		tlb_begin(&rec, TLB_POINT);
+		tlb_put_ts(&rec, &ts);
+		tlb_put_u32(&rec, name_id);
+
+		va_start(argp, name);
+		while ((otype = va_arg(argp, enum timeline_type)) != TLT_END) {
+			obj = va_arg(argp, void *);
+			switch (otype) {
+			case TLT_OUTPUT:
+				id = tlb_output_id(tl_sub, obj);
+				tlb_put_u8(&rec, otype);
+				tlb_put_u32(&rec, id);
+				break;
+			case TLT_SURFACE:
+				id = tlb_surface_id(tl_sub, obj);
+				tlb_put_u8(&rec, otype);
+				tlb_put_u32(&rec, id);
+				break;
+			case TLT_VBLANK:
+			case TLT_GPU:
+				tlb_put_u8(&rec, otype);
+				tlb_put_ts(&rec, obj);
+				break;
+			default:
+				break;
+			}
+		}
+		va_end(argp);
+
+		tlb_end(tl_sub, &rec);
+	}
+}
@@ -29,6 +29,7 @@
 
 #include <wayland-util.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 #include <libweston/weston-log.h>
 #include <wayland-server-core.h>
@@ -53,6 +54,48 @@ enum timeline_type {
 struct weston_timeline_subscription {
 	unsigned int next_id;
 	struct wl_list objects; /**< weston_timeline_subscription_object::subscription_link */
+
+	/* Only for the 'timeline-binary' scope: */
+	struct weston_log_subscription *sub;
+	/** point names sent so far, the id of a name is its index + 1 */
+	const char **names;
+	unsigned int names_count;
+	/** records batched until the next idle flush */
+	uint8_t *buf;
+	size_t len;
+	struct wl_event_loop *loop;
+	struct wl_event_source *flush_source;
+};
+
+/** The binary timeline stream
+ *
+ * Written to subscriptions of the 'timeline-binary' scope in host byte
+ * order, see tools/timeline-to-trace.py for a reader. The stream starts
+ * with the magic "WTLB" and a uint32_t version, followed by records. Each
+ * record starts with a uint16_t type and a uint16_t total length:
+ *
+ * - TLB_NAME: uint32_t id, then the point name, not terminated.
+ * - TLB_OUTPUT: uint32_t id, then the output name.
+ * - TLB_SURFACE: uint32_t id, uint32_t main surface id or 0, then the
+ *   surface description.
+ * - TLB_POINT: uint64_t CLOCK_MONOTONIC nsec, uint32_t name id, then
+ *   arguments until the end of the record: a uint8_t enum timeline_type
+ *   followed by a uint32_t object id for TLT_OUTPUT and TLT_SURFACE, or a
+ *   uint64_t nsec for TLT_VBLANK and TLT_GPU.
+ *
+ * Names and objects are described once per subscription, before the first
+ * point referring to them, and again when the object is refreshed.
+ *
+ * @ingroup internal-log
+ */
+#define WESTON_TIMELINE_BINARY_MAGIC "WTLB"
+#define WESTON_TIMELINE_BINARY_VERSION 1
+
+enum timeline_binary_record {
+	TLB_NAME = 1,
+	TLB_OUTPUT,
+	TLB_SURFACE,
+	TLB_POINT,
 };
 
 /**
@@ -91,10 +134,15 @@ struct weston_timeline_subscription_object {
  */
 #define TL_POINT(ec, ...) do { \
 	weston_timeline_point(ec->timeline, __VA_ARGS__); \
+	weston_timeline_point_binary(ec->timeline_binary, __VA_ARGS__); \
 } while (0)
 
 void
 weston_timeline_point(struct weston_log_scope *timeline_scope,
 		      const char *name, ...);
 
+void
+weston_timeline_point_binary(struct weston_log_scope *timeline_scope,
+			     const char *name, ...);
+
 #endif /* WESTON_TIMELINE_H */
@@ -25,9 +25,34 @@
 #include <assert.h>
 #include <float.h>
 #include <math.h>
+#include <stdbool.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define VERTEX_CLIP_SSE2 1
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define VERTEX_CLIP_NEON 1
+#endif
 
 #include "vertex-clipping.h"
 
+#if defined(VERTEX_CLIP_SSE2) || defined(VERTEX_CLIP_NEON)
+static bool use_simd = true;
+#else
+static bool use_simd = false;
+#endif
+
+bool
+clip_simd_enable(bool enable)
+{
+#if defined(VERTEX_CLIP_SSE2) || defined(VERTEX_CLIP_NEON)
+	use_simd = enable;
+#endif
+	return use_simd;
+}
+
 float
 float_difference(float a, float b)
 {
@@ -106,28 +131,87 @@ clip_append_vertex(struct clip_context *ctx, float x, float y)
 	*ctx->vertices.y++ = y;
 }
 
-static enum path_transition
-path_transition_left_edge(struct clip_context *ctx, float x, float y)
+enum clip_side {
+	CLIP_SIDE_GE, /* inside is coordinate >= clip value */
+	CLIP_SIDE_LT, /* inside is coordinate < clip value */
+};
+
+/* Returns a bit mask with bit i set if vertex i is on the inside of the
+ * clip edge.
+ */
+static unsigned int
+clip_inside_mask_scalar(const float *v, int n, float c, enum clip_side side)
 {
-	return ((ctx->prev.x >= ctx->clip.x1) << 1) | (x >= ctx->clip.x1);
+	unsigned int mask = 0;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		if (side == CLIP_SIDE_GE ? v[i] >= c : v[i] < c)
+			mask |= 1u << i;
+	}
+
+	return mask;
 }
 
-static enum path_transition
-path_transition_right_edge(struct clip_context *ctx, float x, float y)
+#if defined(VERTEX_CLIP_SSE2)
+static unsigned int
+clip_inside_mask_simd(const float *v, int n, float c, enum clip_side side)
 {
-	return ((ctx->prev.x < ctx->clip.x2) << 1) | (x < ctx->clip.x2);
+	__m128 vc = _mm_set1_ps(c);
+	__m128 lo = _mm_loadu_ps(&v[0]);
+	__m128 hi = _mm_loadu_ps(&v[4]);
+	unsigned int mask;
+
+	if (side == CLIP_SIDE_GE)
+		mask = _mm_movemask_ps(_mm_cmpge_ps(lo, vc)) |
+		       _mm_movemask_ps(_mm_cmpge_ps(hi, vc)) << 4;
+	else
+		mask = _mm_movemask_ps(_mm_cmplt_ps(lo, vc)) |
+		       _mm_movemask_ps(_mm_cmplt_ps(hi, vc)) << 4;
+
+	return mask & ((1u << n) - 1);
 }
+#elif defined(VERTEX_CLIP_NEON)
+static unsigned int
+neon_movemask(uint32x4_t cmp)
+{
+	static const uint32_t bit_values[4] = { 1, 2, 4, 8 };
+	uint32x4_t bits = vandq_u32(cmp, vld1q_u32(bit_values));
+	uint32x2_t sum = vadd_u32(vget_low_u32(bits), vget_high_u32(bits));
 
-static enum path_transition
-path_transition_top_edge(struct clip_context *ctx, float x, float y)
+	sum = vpadd_u32(sum, sum);
+	return vget_lane_u32(sum, 0);
+}
+
+static unsigned int
+clip_inside_mask_simd(const float *v, int n, float c, enum clip_side side)
 {
-	return ((ctx->prev.y >= ctx->clip.y1) << 1) | (y >= ctx->clip.y1);
+	float32x4_t vc = vdupq_n_f32(c);
+	float32x4_t lo = vld1q_f32(&v[0]);
+	float32x4_t hi = vld1q_f32(&v[4]);
+	unsigned int mask;
+
+	if (side == CLIP_SIDE_GE)
+		mask = neon_movemask(vcgeq_f32(lo, vc)) |
+		       neon_movemask(vcgeq_f32(hi, vc)) << 4;
+	else
+		mask = neon_movemask(vcltq_f32(lo, vc)) |
+		       neon_movemask(vcltq_f32(hi, vc)) << 4;
+
+	return mask & ((1u << n) - 1);
 }
+#endif
 
-static enum path_transition
-path_transition_bottom_edge(struct clip_context *ctx, float x, float y)
+static unsigned int
+clip_inside_mask(const float *v, int n, float c, enum clip_side side)
 {
-	return ((ctx->prev.y < ctx->clip.y2) << 1) | (y < ctx->clip.y2);
+#if defined(VERTEX_CLIP_SSE2) || defined(VERTEX_CLIP_NEON)
+	/* Polygon coordinate arrays always have room for 8 vertices; the
+	 * lanes beyond n are masked out. */
+	if (use_simd)
+		return clip_inside_mask_simd(v, n, c, side);
+#endif
+	return clip_inside_mask_scalar(v, n, c, side);
 }
 
 static void
@@ -202,94 +286,183 @@ clip_context_prepare(struct clip_context *ctx, const struct polygon8 *src,
 	ctx->vertices.y = dst_y;
 }
 
+/* Clip the polygon against one edge.
+ *
+ * Vertex classification is done for all vertices at once; a polygon
+ * entirely inside is copied through unchanged, which is what the
+ * transition walk would produce as well.
+ */
 static int
-clip_polygon_left(struct clip_context *ctx, const struct polygon8 *src,
-		  float *dst_x, float *dst_y)
+clip_polygon_edge(struct clip_context *ctx, const struct polygon8 *src,
+		  float *dst_x, float *dst_y, bool leftright,
+		  float clip_value, enum clip_side side)
 {
+	const float *coord = leftright ? src->x : src->y;
+	unsigned int inside, all;
 	enum path_transition trans;
+	unsigned int prev_in, cur_in;
 	int i;
 
 	if (src->n < 2)
 		return 0;
 
+	all = (1u << src->n) - 1;
+	inside = clip_inside_mask(coord, src->n, clip_value, side);
+	if (inside == all) {
+		memcpy(dst_x, src->x, src->n * sizeof *dst_x);
+		memcpy(dst_y, src->y, src->n * sizeof *dst_y);
+		return src->n;
+	}
+	if (inside == 0)
+		return 0;
+
 	clip_context_prepare(ctx, src, dst_x, dst_y);
+	prev_in = (inside >> (src->n - 1)) & 1;
 	for (i = 0; i < src->n; i++) {
-		trans = path_transition_left_edge(ctx, src->x[i], src->y[i]);
-		clip_polygon_leftright(ctx, trans, src->x[i], src->y[i],
-				       ctx->clip.x1);
+		cur_in = (inside >> i) & 1;
+		trans = (prev_in << 1) | cur_in;
+		if (leftright)
+			clip_polygon_leftright(ctx, trans, src->x[i], src->y[i],
+					       clip_value);
+		else
+			clip_polygon_topbottom(ctx, trans, src->x[i], src->y[i],
+					       clip_value);
+		prev_in = cur_in;
 	}
 	return ctx->vertices.x - dst_x;
 }
 
+static int
+clip_polygon_left(struct clip_context *ctx, const struct polygon8 *src,
+		  float *dst_x, float *dst_y)
+{
+	return clip_polygon_edge(ctx, src, dst_x, dst_y, true,
+				 ctx->clip.x1, CLIP_SIDE_GE);
+}
+
 static int
 clip_polygon_right(struct clip_context *ctx, const struct polygon8 *src,
 		   float *dst_x, float *dst_y)
 {
-	enum path_transition trans;
-	int i;
-
-	if (src->n < 2)
-		return 0;
-
-	clip_context_prepare(ctx, src, dst_x, dst_y);
-	for (i = 0; i < src->n; i++) {
-		trans = path_transition_right_edge(ctx, src->x[i], src->y[i]);
-		clip_polygon_leftright(ctx, trans, src->x[i], src->y[i],
-				       ctx->clip.x2);
-	}
-	return ctx->vertices.x - dst_x;
+	return clip_polygon_edge(ctx, src, dst_x, dst_y, true,
+				 ctx->clip.x2, CLIP_SIDE_LT);
 }
 
 static int
 clip_polygon_top(struct clip_context *ctx, const struct polygon8 *src,
 		 float *dst_x, float *dst_y)
 {
-	enum path_transition trans;
-	int i;
-
-	if (src->n < 2)
-		return 0;
-
-	clip_context_prepare(ctx, src, dst_x, dst_y);
-	for (i = 0; i < src->n; i++) {
-		trans = path_transition_top_edge(ctx, src->x[i], src->y[i]);
-		clip_polygon_topbottom(ctx, trans, src->x[i], src->y[i],
-				       ctx->clip.y1);
-	}
-	return ctx->vertices.x - dst_x;
+	return clip_polygon_edge(ctx, src, dst_x, dst_y, false,
+				 ctx->clip.y1, CLIP_SIDE_GE);
 }
 
 static int
 clip_polygon_bottom(struct clip_context *ctx, const struct polygon8 *src,
 		    float *dst_x, float *dst_y)
 {
-	enum path_transition trans;
-	int i;
-
-	if (src->n < 2)
-		return 0;
-
-	clip_context_prepare(ctx, src, dst_x, dst_y);
-	for (i = 0; i < src->n; i++) {
-		trans = path_transition_bottom_edge(ctx, src->x[i], src->y[i]);
-		clip_polygon_topbottom(ctx, trans, src->x[i], src->y[i],
-				       ctx->clip.y2);
-	}
-	return ctx->vertices.x - dst_x;
+	return clip_polygon_edge(ctx, src, dst_x, dst_y, false,
+				 ctx->clip.y2, CLIP_SIDE_LT);
 }
 
 #define max(a, b) (((a) > (b)) ? (a) : (b))
 #define min(a, b) (((a) > (b)) ? (b) : (a))
 #define clip(x, a, b)  min(max(x, a), b)
 
+void
+polygon8_bounding_box(const struct polygon8 *p,
+		      float *min_x, float *min_y,
+		      float *max_x, float *max_y)
+{
+	int i;
+
+	assert(p->n > 0);
+
+#if defined(VERTEX_CLIP_SSE2)
+	if (use_simd && p->n == 4) {
+		__m128 x = _mm_loadu_ps(p->x);
+		__m128 y = _mm_loadu_ps(p->y);
+		__m128 lo = _mm_unpacklo_ps(x, y); /* x0 y0 x1 y1 */
+		__m128 hi = _mm_unpackhi_ps(x, y); /* x2 y2 x3 y3 */
+		__m128 mn = _mm_min_ps(lo, hi);
+		__m128 mx = _mm_max_ps(lo, hi);
+
+		mn = _mm_min_ps(mn, _mm_movehl_ps(mn, mn));
+		mx = _mm_max_ps(mx, _mm_movehl_ps(mx, mx));
+		*min_x = _mm_cvtss_f32(mn);
+		*max_x = _mm_cvtss_f32(mx);
+		*min_y = _mm_cvtss_f32(_mm_shuffle_ps(mn, mn, 1));
+		*max_y = _mm_cvtss_f32(_mm_shuffle_ps(mx, mx, 1));
+		return;
+	}
+#elif defined(VERTEX_CLIP_NEON)
+	if (use_simd && p->n == 4) {
+		float32x4_t x = vld1q_f32(p->x);
+		float32x4_t y = vld1q_f32(p->y);
+		float32x2_t mnx = vpmin_f32(vget_low_f32(x), vget_high_f32(x));
+		float32x2_t mny = vpmin_f32(vget_low_f32(y), vget_high_f32(y));
+		float32x2_t mxx = vpmax_f32(vget_low_f32(x), vget_high_f32(x));
+		float32x2_t mxy = vpmax_f32(vget_low_f32(y), vget_high_f32(y));
+
+		*min_x = vget_lane_f32(vpmin_f32(mnx, mnx), 0);
+		*min_y = vget_lane_f32(vpmin_f32(mny, mny), 0);
+		*max_x = vget_lane_f32(vpmax_f32(mxx, mxx), 0);
+		*max_y = vget_lane_f32(vpmax_f32(mxy, mxy), 0);
+		return;
+	}
+#endif
+
+	*min_x = *max_x = p->x[0];
+	*min_y = *max_y = p->y[0];
+
+	for (i = 1; i < p->n; i++) {
+		*min_x = min(*min_x, p->x[i]);
+		*max_x = max(*max_x, p->x[i]);
+		*min_y = min(*min_y, p->y[i]);
+		*max_y = max(*max_y, p->y[i]);
+	}
+}
+
 int
 clip_simple(struct clip_context *ctx,
 	    struct polygon8 *surf,
 	    float *ex,
 	    float *ey)
 {
-	int i;
-	for (i = 0; i < surf->n; i++) {
+	int i = 0;
+
+#if defined(VERTEX_CLIP_SSE2)
+	if (use_simd) {
+		__m128 x1 = _mm_set1_ps(ctx->clip.x1);
+		__m128 x2 = _mm_set1_ps(ctx->clip.x2);
+		__m128 y1 = _mm_set1_ps(ctx->clip.y1);
+		__m128 y2 = _mm_set1_ps(ctx->clip.y2);
+
+		for (; i + 4 <= surf->n; i += 4) {
+			__m128 x = _mm_loadu_ps(&surf->x[i]);
+			__m128 y = _mm_loadu_ps(&surf->y[i]);
+
+			_mm_storeu_ps(&ex[i], _mm_min_ps(_mm_max_ps(x, x1), x2));
+			_mm_storeu_ps(&ey[i], _mm_min_ps(_mm_max_ps(y, y1), y2));
+		}
+	}
+#elif defined(VERTEX_CLIP_NEON)
+	if (use_simd) {
+		float32x4_t x1 = vdupq_n_f32(ctx->clip.x1);
+		float32x4_t x2 = vdupq_n_f32(ctx->clip.x2);
+		float32x4_t y1 = vdupq_n_f32(ctx->clip.y1);
+		float32x4_t y2 = vdupq_n_f32(ctx->clip.y2);
+
+		for (; i + 4 <= surf->n; i += 4) {
+			float32x4_t x = vld1q_f32(&surf->x[i]);
+			float32x4_t y = vld1q_f32(&surf->y[i]);
+
+			vst1q_f32(&ex[i], vminq_f32(vmaxq_f32(x, x1), x2));
+			vst1q_f32(&ey[i], vminq_f32(vmaxq_f32(y, y1), y2));
+		}
+	}
+#endif
+
+	for (; i < surf->n; i++) {
 		ex[i] = clip(surf->x[i], ctx->clip.x1, ctx->clip.x2);
 		ey[i] = clip(surf->y[i], ctx->clip.y1, ctx->clip.y2);
 	}
@@ -25,6 +25,8 @@
 #ifndef _WESTON_VERTEX_CLIPPING_H
 #define _WESTON_VERTEX_CLIPPING_H
 
+#include <stdbool.h>
+
 struct polygon8 {
 	float x[8];
 	float y[8];
@@ -51,6 +53,22 @@ struct clip_context {
 float
 float_difference(float a, float b);
 
+/** Select the SIMD or the scalar implementation
+ *
+ * SIMD is used by default when the build target has SSE2 or NEON.
+ * Both paths produce identical results; this exists so that they can be
+ * tested against each other.
+ *
+ * \return True if the SIMD implementation is now in use.
+ */
+bool
+clip_simd_enable(bool enable);
+
+void
+polygon8_bounding_box(const struct polygon8 *p,
+		      float *min_x, float *min_y,
+		      float *max_x, float *max_y);
+
 int
 clip_simple(struct clip_context *ctx,
 	    struct polygon8 *surf,
@@ -61,6 +79,6 @@ int
 clip_transformed(struct clip_context *ctx,
 		 struct polygon8 *surf,
 		 float *ex,
-		 float *ey);\
+		 float *ey);
 
 #endif
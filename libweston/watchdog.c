@@ -0,0 +1,408 @@
+/*
+ * Copyright © 2022 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include <libweston/libweston.h>
+#include <libweston/weston-log.h>
+#include <libweston/zalloc.h>
+#include "libweston-internal.h"
+#include "watchdog.h"
+#include "shared/helpers.h"
+#include "shared/timespec-util.h"
+
+/*
+ * A thread that notices when the main loop has been busy with one
+ * iteration for longer than a threshold. The main thread only stores
+ * what it is doing: the iteration counter and its start around the
+ * poll() of weston_compositor_run(), and phase names from markers put
+ * around calls that can block. The thread samples the phases while the
+ * stall lasts; the main thread writes them to the "watchdog" log scope,
+ * which the flight recorder keeps by default, once it gets going again.
+ *
+ * Writing from the thread would race with whatever log write the main
+ * thread may be stuck in, so a stall which never ends leaves no record.
+ */
+
+/* Different phases kept per stall */
+#define WATCHDOG_MAX_SAMPLES 8
+
+static const char watchdog_phase_client[] = "client request";
+
+struct watchdog_phase {
+	const char *phase;
+	/* for watchdog_phase_client: the last request dispatched */
+	const char *interface;
+	const char *message;
+	int32_t pid;
+};
+
+/* Written by the main thread only, with relaxed atomics: while it is
+ * stalled, nothing changes under the watchdog thread. */
+static struct watchdog_phase main_phase;
+
+struct weston_watchdog {
+	struct weston_compositor *compositor;
+	struct weston_log_scope *scope;
+	struct wl_protocol_logger *logger;
+	int64_t threshold_nsec;
+	uint32_t threshold_msec;
+
+	pthread_t thread;
+	bool thread_running;
+	int quit_fd;
+
+	/* Written by the main thread: odd while an iteration runs */
+	uint32_t iteration;
+	int64_t iteration_start; /* CLOCK_MONOTONIC, nsec */
+
+	/* Written by the watchdog thread */
+	pthread_mutex_t lock;
+	uint32_t stalled_iteration;
+	struct watchdog_phase samples[WATCHDOG_MAX_SAMPLES];
+	unsigned int n_samples;
+	unsigned int dropped_samples;
+};
+
+static int64_t
+watchdog_now(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return timespec_to_nsec(&now);
+}
+
+WL_EXPORT const char *
+weston_watchdog_phase_enter(const char *phase)
+{
+	const char *previous;
+
+	previous = __atomic_load_n(&main_phase.phase, __ATOMIC_RELAXED);
+	__atomic_store_n(&main_phase.phase, phase, __ATOMIC_RELAXED);
+
+	return previous;
+}
+
+WL_EXPORT void
+weston_watchdog_phase_leave(const char *previous)
+{
+	__atomic_store_n(&main_phase.phase, previous, __ATOMIC_RELAXED);
+}
+
+static void
+watchdog_protocol_logger(void *user_data,
+			 enum wl_protocol_logger_type direction,
+			 const struct wl_protocol_logger_message *message)
+{
+	pid_t pid;
+
+	if (direction != WL_PROTOCOL_LOGGER_REQUEST)
+		return;
+
+	wl_client_get_credentials(wl_resource_get_client(message->resource),
+				  &pid, NULL, NULL);
+
+	/* Interface and message names are static protocol data. */
+	__atomic_store_n(&main_phase.interface,
+			 wl_resource_get_class(message->resource),
+			 __ATOMIC_RELAXED);
+	__atomic_store_n(&main_phase.message, message->message->name,
+			 __ATOMIC_RELAXED);
+	__atomic_store_n(&main_phase.pid, pid, __ATOMIC_RELAXED);
+	__atomic_store_n(&main_phase.phase, watchdog_phase_client,
+			 __ATOMIC_RELAXED);
+}
+
+static void
+watchdog_phase_read(struct watchdog_phase *phase)
+{
+	phase->phase = __atomic_load_n(&main_phase.phase, __ATOMIC_RELAXED);
+	if (phase->phase != watchdog_phase_client) {
+		phase->interface = NULL;
+		phase->message = NULL;
+		phase->pid = 0;
+		return;
+	}
+
+	phase->interface = __atomic_load_n(&main_phase.interface,
+					   __ATOMIC_RELAXED);
+	phase->message = __atomic_load_n(&main_phase.message,
+					 __ATOMIC_RELAXED);
+	phase->pid = __atomic_load_n(&main_phase.pid, __ATOMIC_RELAXED);
+}
+
+static bool
+watchdog_phase_equal(const struct watchdog_phase *a,
+		     const struct watchdog_phase *b)
+{
+	return a->phase == b->phase && a->interface == b->interface &&
+	       a->message == b->message && a->pid == b->pid;
+}
+
+static void
+watchdog_sample(struct weston_watchdog *wd, uint32_t iteration)
+{
+	struct watchdog_phase phase, *last;
+
+	watchdog_phase_read(&phase);
+
+	pthread_mutex_lock(&wd->lock);
+
+	if (wd->stalled_iteration != iteration) {
+		wd->n_samples = 0;
+		wd->dropped_samples = 0;
+	}
+
+	last = wd->n_samples ? &wd->samples[wd->n_samples - 1] : NULL;
+	if (!last || !watchdog_phase_equal(last, &phase)) {
+		if (wd->n_samples < ARRAY_LENGTH(wd->samples))
+			wd->samples[wd->n_samples++] = phase;
+		else
+			wd->dropped_samples++;
+	}
+
+	__atomic_store_n(&wd->stalled_iteration, iteration, __ATOMIC_RELEASE);
+
+	pthread_mutex_unlock(&wd->lock);
+}
+
+static void *
+watchdog_thread_func(void *data)
+{
+	struct weston_watchdog *wd = data;
+	struct pollfd pfd = { .fd = wd->quit_fd, .events = POLLIN };
+	int timeout = MAX(wd->threshold_msec / 4, 1u);
+	uint32_t iteration;
+	int64_t start;
+	int ret;
+
+	for (;;) {
+		ret = poll(&pfd, 1, timeout);
+		if (ret > 0 || (ret < 0 && errno != EINTR))
+			break;
+
+		iteration = __atomic_load_n(&wd->iteration, __ATOMIC_ACQUIRE);
+		if (!(iteration & 1))
+			continue;
+
+		/* The start belongs to the iteration if that is still the
+		 * same after reading it. */
+		start = __atomic_load_n(&wd->iteration_start, __ATOMIC_RELAXED);
+		if (__atomic_load_n(&wd->iteration, __ATOMIC_ACQUIRE) != iteration)
+			continue;
+
+		if (watchdog_now() - start >= wd->threshold_nsec)
+			watchdog_sample(wd, iteration);
+	}
+
+	return NULL;
+}
+
+static void
+watchdog_report(struct weston_watchdog *wd)
+{
+	struct watchdog_phase samples[WATCHDOG_MAX_SAMPLES];
+	unsigned int n_samples, dropped_samples, i;
+	char timestr[128];
+	int64_t msec;
+
+	pthread_mutex_lock(&wd->lock);
+	n_samples = wd->n_samples;
+	dropped_samples = wd->dropped_samples;
+	memcpy(samples, wd->samples, n_samples * sizeof samples[0]);
+	pthread_mutex_unlock(&wd->lock);
+
+	if (!weston_log_scope_is_enabled(wd->scope))
+		return;
+
+	msec = (watchdog_now() - wd->iteration_start) / 1000000;
+	weston_log_scope_printf(wd->scope,
+				"%s main loop stalled for %" PRId64 " ms in",
+				weston_log_scope_timestamp(wd->scope, timestr,
+							   sizeof timestr),
+				msec);
+
+	for (i = 0; i < n_samples; i++) {
+		weston_log_scope_printf(wd->scope, "%s %s", i ? "," : ":",
+					samples[i].phase ?: "event dispatch");
+		if (samples[i].phase == watchdog_phase_client)
+			weston_log_scope_printf(wd->scope,
+						" (last: pid %d %s.%s)",
+						samples[i].pid,
+						samples[i].interface,
+						samples[i].message);
+	}
+	if (dropped_samples)
+		weston_log_scope_printf(wd->scope, ", %u more",
+					dropped_samples);
+	weston_log_scope_printf(wd->scope, "\n");
+}
+
+void
+weston_watchdog_iteration_begin(struct weston_compositor *ec)
+{
+	struct weston_watchdog *wd = ec->watchdog;
+
+	weston_watchdog_phase_enter(NULL);
+
+	if (!wd)
+		return;
+
+	__atomic_store_n(&wd->iteration_start, watchdog_now(),
+			 __ATOMIC_RELAXED);
+	__atomic_store_n(&wd->iteration, wd->iteration + 1, __ATOMIC_RELEASE);
+}
+
+void
+weston_watchdog_iteration_end(struct weston_compositor *ec)
+{
+	struct weston_watchdog *wd = ec->watchdog;
+
+	if (!wd || !(wd->iteration & 1))
+		return;
+
+	if (__atomic_load_n(&wd->stalled_iteration, __ATOMIC_ACQUIRE) ==
+	    wd->iteration)
+		watchdog_report(wd);
+
+	__atomic_store_n(&wd->iteration, wd->iteration + 1, __ATOMIC_RELEASE);
+}
+
+static void
+watchdog_destroy(struct weston_watchdog *wd)
+{
+	uint64_t value = 1;
+
+	if (wd->thread_running) {
+		if (write(wd->quit_fd, &value, sizeof value) < 0)
+			weston_log("Watchdog: failed to stop thread: %s\n",
+				   strerror(errno));
+		pthread_join(wd->thread, NULL);
+	}
+
+	if (wd->quit_fd >= 0)
+		close(wd->quit_fd);
+	if (wd->logger)
+		wl_protocol_logger_destroy(wd->logger);
+	weston_log_scope_destroy(wd->scope);
+	pthread_mutex_destroy(&wd->lock);
+	free(wd);
+}
+
+/** Log main loop stalls longer than a threshold
+ *
+ * \param ec The compositor.
+ * \param threshold_msec How long one event loop iteration may take before
+ * it is reported to the "watchdog" log scope.
+ * \return 0 on success, -1 on failure.
+ *
+ * Only covers compositors run by weston_compositor_run(). Each stall is
+ * written as one line with the phases the main thread went through while
+ * the watchdog was looking, see weston_watchdog_phase_enter(). For
+ * dispatching clients, that is the last request they sent. The watchdog
+ * looks four times per threshold, so the phases of stalls just over the
+ * threshold may be missed.
+ */
+WL_EXPORT int
+weston_compositor_enable_watchdog(struct weston_compositor *ec,
+				  uint32_t threshold_msec)
+{
+	struct weston_watchdog *wd;
+	sigset_t set, oldset;
+	int ret;
+
+	if (ec->watchdog)
+		return 0;
+
+	if (threshold_msec == 0)
+		return -1;
+
+	wd = zalloc(sizeof *wd);
+	if (!wd)
+		return -1;
+
+	wd->compositor = ec;
+	wd->threshold_msec = threshold_msec;
+	wd->threshold_nsec = (int64_t) threshold_msec * 1000000;
+	pthread_mutex_init(&wd->lock, NULL);
+
+	wd->scope = weston_compositor_add_log_scope(ec, "watchdog",
+						    "Main loop stalls\n",
+						    NULL, NULL, NULL);
+
+	wd->quit_fd = eventfd(0, EFD_CLOEXEC);
+	if (wd->quit_fd < 0)
+		goto fail;
+
+	wd->logger = wl_display_add_protocol_logger(ec->wl_display,
+						    watchdog_protocol_logger,
+						    wd);
+	if (!wd->logger)
+		goto fail;
+
+	/* Signals are handled by the main loop only. */
+	sigfillset(&set);
+	pthread_sigmask(SIG_SETMASK, &set, &oldset);
+	ret = pthread_create(&wd->thread, NULL, watchdog_thread_func, wd);
+	pthread_sigmask(SIG_SETMASK, &oldset, NULL);
+
+	if (ret != 0) {
+		weston_log("Watchdog: failed to start thread: %s\n",
+			   strerror(ret));
+		goto fail;
+	}
+	wd->thread_running = true;
+
+	ec->watchdog = wd;
+
+	return 0;
+
+fail:
+	watchdog_destroy(wd);
+	return -1;
+}
+
+void
+weston_compositor_watchdog_fini(struct weston_compositor *ec)
+{
+	if (!ec->watchdog)
+		return;
+
+	watchdog_destroy(ec->watchdog);
+	ec->watchdog = NULL;
+}
@@ -0,0 +1,54 @@
+/*
+ * Copyright © 2022 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef WESTON_WATCHDOG_H
+#define WESTON_WATCHDOG_H
+
+#include <libweston/libweston.h>
+
+/** Tell the watchdog what the main thread is busy with
+ *
+ * \param phase A string literal naming the work, e.g. the function.
+ * \return The phase to restore with weston_watchdog_phase_leave().
+ *
+ * Costs a store, whether the watchdog runs or not, so it may wrap any
+ * call that can block: ioctls, D-Bus round trips, file I/O.
+ */
+const char *
+weston_watchdog_phase_enter(const char *phase);
+
+void
+weston_watchdog_phase_leave(const char *previous);
+
+void
+weston_watchdog_iteration_begin(struct weston_compositor *ec);
+
+void
+weston_watchdog_iteration_end(struct weston_compositor *ec);
+
+void
+weston_compositor_watchdog_fini(struct weston_compositor *ec);
+
+#endif /* WESTON_WATCHDOG_H */
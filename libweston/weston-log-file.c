@@ -30,8 +30,19 @@
 #include <libweston/libweston.h>
 
 #include "weston-log-internal.h"
+#include "watchdog.h"
+#include "shared/timespec-util.h"
 
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
 
 /** File type of stream
  */
@@ -51,7 +62,11 @@ weston_log_file_write(struct weston_log_subscriber *sub,
 		      const char *data, size_t len)
 {
 	struct weston_debug_log_file *stream = to_weston_debug_log_file(sub);
+	const char *phase;
+
+	phase = weston_watchdog_phase_enter("log write");
 	fwrite(data, len, 1, stream->file);
+	weston_watchdog_phase_leave(phase);
 }
 
 static void
@@ -96,3 +111,259 @@ weston_log_subscriber_create_log(FILE *dump_to)
 
 	return &file->base;
 }
+
+/** File type of stream, written by a thread of its own
+ *
+ * The subscriber copies every message into a single-producer,
+ * single-consumer byte ring; the log context hands messages of other
+ * threads to the main thread first, so the main thread is the only
+ * producer. The writer thread empties the ring in batches and sleeps on
+ * an eventfd, which the producer only signals while the writer sleeps.
+ */
+struct weston_debug_log_file_async {
+	struct weston_log_subscriber base;
+	FILE *file;
+	int fsync_msec;
+
+	char *ring;
+	size_t size;
+	/* Byte counts: head written by the producer, tail by the writer */
+	uint64_t head;
+	uint64_t tail;
+
+	/* Producer only: messages that did not fit, not yet reported */
+	uint32_t dropped;
+
+	int wake_fd;
+	bool sleeping;
+	bool quit;
+	pthread_t thread;
+};
+
+static struct weston_debug_log_file_async *
+to_weston_debug_log_file_async(struct weston_log_subscriber *sub)
+{
+	return container_of(sub, struct weston_debug_log_file_async, base);
+}
+
+static void
+log_async_ring_put(struct weston_debug_log_file_async *stream,
+		   uint64_t head, const char *data, size_t len)
+{
+	size_t offset = head % stream->size;
+	size_t first = MIN(len, stream->size - offset);
+
+	memcpy(stream->ring + offset, data, first);
+	memcpy(stream->ring, data + first, len - first);
+}
+
+static void
+weston_log_file_async_write(struct weston_log_subscriber *sub,
+			    const char *data, size_t len)
+{
+	struct weston_debug_log_file_async *stream =
+		to_weston_debug_log_file_async(sub);
+	uint64_t head = stream->head;
+	uint64_t tail;
+	char dropped[64];
+	int dropped_len = 0;
+	size_t room;
+
+	tail = __atomic_load_n(&stream->tail, __ATOMIC_ACQUIRE);
+	room = stream->size - (head - tail);
+
+	if (stream->dropped > 0)
+		dropped_len = snprintf(dropped, sizeof dropped,
+				       "[dropped %u log messages]\n",
+				       stream->dropped);
+
+	/* Never wait for the disk: what does not fit is counted instead. */
+	if (dropped_len + len > room) {
+		stream->dropped++;
+		return;
+	}
+
+	if (dropped_len > 0) {
+		log_async_ring_put(stream, head, dropped, dropped_len);
+		head += dropped_len;
+		stream->dropped = 0;
+	}
+	log_async_ring_put(stream, head, data, len);
+	head += len;
+
+	/* Pairs with the writer going to sleep in log_async_wait(). */
+	__atomic_store_n(&stream->head, head, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&stream->sleeping, __ATOMIC_SEQ_CST))
+		eventfd_write(stream->wake_fd, 1);
+}
+
+static void
+log_async_wait(struct weston_debug_log_file_async *stream, int timeout)
+{
+	struct pollfd pfd = { .fd = stream->wake_fd, .events = POLLIN };
+	eventfd_t value;
+
+	/* Checked again after announcing the sleep, so that a message
+	 * published in between is not left waiting for the next one. */
+	__atomic_store_n(&stream->sleeping, true, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&stream->head, __ATOMIC_SEQ_CST) == stream->tail &&
+	    !__atomic_load_n(&stream->quit, __ATOMIC_SEQ_CST) &&
+	    poll(&pfd, 1, timeout) > 0)
+		eventfd_read(stream->wake_fd, &value);
+	__atomic_store_n(&stream->sleeping, false, __ATOMIC_SEQ_CST);
+}
+
+static int64_t
+log_async_now_msec(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return timespec_to_msec(&now);
+}
+
+static void *
+log_async_thread_func(void *data)
+{
+	struct weston_debug_log_file_async *stream = data;
+	int64_t last_sync = log_async_now_msec();
+	bool unsynced = false;
+	uint64_t head, tail;
+	size_t offset, len;
+	int timeout;
+
+	for (;;) {
+		head = __atomic_load_n(&stream->head, __ATOMIC_ACQUIRE);
+		tail = stream->tail;
+
+		if (head == tail) {
+			if (unsynced && stream->fsync_msec > 0 &&
+			    log_async_now_msec() - last_sync >= stream->fsync_msec) {
+				fsync(fileno(stream->file));
+				last_sync = log_async_now_msec();
+				unsynced = false;
+			}
+
+			if (__atomic_load_n(&stream->quit, __ATOMIC_SEQ_CST))
+				break;
+
+			timeout = -1;
+			if (unsynced && stream->fsync_msec > 0)
+				timeout = MAX(stream->fsync_msec -
+					      (log_async_now_msec() - last_sync),
+					      0);
+			log_async_wait(stream, timeout);
+			continue;
+		}
+
+		while (tail != head) {
+			offset = tail % stream->size;
+			len = MIN(head - tail, stream->size - offset);
+			fwrite(stream->ring + offset, len, 1, stream->file);
+			tail += len;
+		}
+		fflush(stream->file);
+
+		/* Only now may the producer reuse the space. */
+		__atomic_store_n(&stream->tail, tail, __ATOMIC_RELEASE);
+
+		if (stream->fsync_msec == 0) {
+			fsync(fileno(stream->file));
+			last_sync = log_async_now_msec();
+		} else {
+			unsynced = true;
+		}
+	}
+
+	return NULL;
+}
+
+static void
+weston_log_subscriber_destroy_log_async(struct weston_log_subscriber *subscriber)
+{
+	struct weston_debug_log_file_async *stream =
+		to_weston_debug_log_file_async(subscriber);
+
+	weston_log_subscriber_release(subscriber);
+
+	/* The writer drains the ring before it stops. */
+	__atomic_store_n(&stream->quit, true, __ATOMIC_SEQ_CST);
+	eventfd_write(stream->wake_fd, 1);
+	pthread_join(stream->thread, NULL);
+
+	if (stream->dropped > 0)
+		fprintf(stream->file, "[dropped %u log messages]\n",
+			stream->dropped);
+	fflush(stream->file);
+
+	close(stream->wake_fd);
+	free(stream->ring);
+	free(stream);
+}
+
+/** Creates a file type of subscriber which writes from a thread
+ *
+ * Writing to the subscriber only copies the message into a buffer, so a
+ * slow or stalled disk does not hold up the compositor. Messages which do
+ * not fit in the buffer are dropped, and their number is written once
+ * there is room again. Should be destroyed using
+ * weston_log_subscriber_destroy(), which writes out what is buffered.
+ *
+ * @param dump_to if specified, used for writing data to, stderr otherwise
+ * @param size the size of the buffer in bytes
+ * @param fsync_msec fsync the file after every batch of messages with 0,
+ * at least every fsync_msec milliseconds while there is unsynced data
+ * when positive, never when negative
+ * @returns a weston_log_subscriber object or NULL in case of failure
+ *
+ * @sa weston_log_subscriber_create_log
+ */
+WL_EXPORT struct weston_log_subscriber *
+weston_log_subscriber_create_log_async(FILE *dump_to, size_t size,
+				       int fsync_msec)
+{
+	struct weston_debug_log_file_async *stream;
+	sigset_t set, oldset;
+	int ret;
+
+	if (size == 0)
+		return NULL;
+
+	stream = zalloc(sizeof *stream);
+	if (!stream)
+		return NULL;
+
+	stream->file = dump_to ? dump_to : stderr;
+	stream->fsync_msec = fsync_msec;
+	stream->size = size;
+	stream->ring = malloc(size);
+	stream->wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (!stream->ring || stream->wake_fd < 0)
+		goto fail;
+
+	/* Signals are handled by the main loop only. */
+	sigfillset(&set);
+	pthread_sigmask(SIG_SETMASK, &set, &oldset);
+	ret = pthread_create(&stream->thread, NULL, log_async_thread_func,
+			     stream);
+	pthread_sigmask(SIG_SETMASK, &oldset, NULL);
+	if (ret != 0)
+		goto fail;
+
+	stream->base.write = weston_log_file_async_write;
+	stream->base.destroy = weston_log_subscriber_destroy_log_async;
+	stream->base.destroy_subscription = NULL;
+	stream->base.complete = NULL;
+
+	wl_list_init(&stream->base.subscription_list);
+
+	return &stream->base;
+
+fail:
+	if (stream->wake_fd >= 0)
+		close(stream->wake_fd);
+	free(stream->ring);
+	free(stream);
+	return NULL;
+}
@@ -78,9 +78,11 @@ static void
 weston_log_flight_recorder_adjust_end(struct weston_ring_buffer *rb,
 				      size_t bytes_to_advance)
 {
-	if (rb->append_pos == rb->size - bytes_to_advance)
+	if (rb->append_pos == rb->size - bytes_to_advance) {
+		/* filled up exactly, the oldest data now starts at 0 */
 		rb->append_pos = 0;
-	else
+		rb->overlap = true;
+	} else
 		rb->append_pos += bytes_to_advance;
 }
 
@@ -218,6 +220,77 @@ weston_log_subscriber_display_flight_rec(struct weston_log_subscriber *sub)
 	weston_log_subscriber_display_flight_rec_data(rb, rb->file);
 }
 
+/** Write the contents of a flight recorder, oldest first, to a file
+ *
+ * @param sub a flight recorder created by either
+ * weston_log_subscriber_create_flight_rec() or
+ * weston_log_subscriber_create_binary_flight_rec()
+ * @param file an already opened file
+ */
+WL_EXPORT void
+weston_log_subscriber_dump_flight_rec(struct weston_log_subscriber *sub,
+				      FILE *file)
+{
+	struct weston_debug_log_flight_recorder *flight_rec =
+		to_flight_recorder(sub);
+	struct weston_ring_buffer *rb = &flight_rec->rb;
+
+	/* Nothing written yet, don't dump the untouched buffer. */
+	if (!rb->overlap && rb->append_pos == 0)
+		return;
+
+	weston_log_subscriber_display_flight_rec_data(rb, file);
+}
+
+/** Move the newest contents of a flight recorder into a smaller buffer
+ *
+ * Meant for giving memory back under memory pressure. Only for
+ * recorders created by weston_log_subscriber_create_flight_rec(), the
+ * records of a binary one would no longer line up with the ring.
+ *
+ * @param sub the flight recorder
+ * @param size the new size of the backing storage, in bytes
+ * @returns the number of bytes released, 0 if the recorder is already
+ * no larger than \a size
+ */
+WL_EXPORT size_t
+weston_log_subscriber_shrink_flight_rec(struct weston_log_subscriber *sub,
+					size_t size)
+{
+	struct weston_debug_log_flight_recorder *flight_rec =
+		to_flight_recorder(sub);
+	struct weston_ring_buffer *rb = &flight_rec->rb;
+	size_t old_size = rb->size + 1;
+	size_t keep = size - 1;
+	size_t len, head;
+	char *buf;
+
+	if (size < 2 || size >= old_size)
+		return 0;
+
+	buf = zalloc(size);
+	if (!buf)
+		return 0;
+
+	/* oldest first, as weston_log_subscriber_display_flight_rec_data()
+	 * would print it */
+	if (!rb->overlap) {
+		len = MIN(rb->append_pos, keep);
+		memcpy(buf, &rb->buf[rb->append_pos - len], len);
+	} else {
+		len = MIN(rb->size, keep);
+		head = MIN(rb->append_pos, len);
+		memcpy(buf, &rb->buf[rb->size - (len - head)], len - head);
+		memcpy(&buf[len - head], &rb->buf[rb->append_pos - head], head);
+	}
+
+	free(rb->buf);
+	weston_ring_buffer_init(rb, size, buf);
+	weston_log_flight_recorder_adjust_end(rb, len);
+
+	return old_size - size;
+}
+
 static void
 weston_log_subscriber_destroy_flight_rec(struct weston_log_subscriber *sub)
 {
@@ -276,6 +349,46 @@ weston_log_subscriber_create_flight_rec(size_t size)
 	return &flight_rec->base;
 }
 
+/** Create a flight recorder for fixed-size binary records
+ *
+ * Unlike weston_log_subscriber_create_flight_rec(), the ring holds
+ * exactly \a size bytes and starts out zeroed. When every write is the
+ * same length and \a size is a multiple of it, records never straddle
+ * the boundary between the newest and the oldest data. Any number of
+ * these can exist next to the primary flight recorder, and they are not
+ * reachable through weston_log_flight_recorder_display_buffer().
+ *
+ * @param size the size of the ring, in bytes
+ * @returns a weston_log_subscriber object or NULL in case of failure
+ */
+WL_EXPORT struct weston_log_subscriber *
+weston_log_subscriber_create_binary_flight_rec(size_t size)
+{
+	struct weston_debug_log_flight_recorder *flight_rec;
+	char *weston_rb;
+
+	flight_rec = zalloc(sizeof(*flight_rec));
+	if (!flight_rec)
+		return NULL;
+
+	flight_rec->base.write = weston_log_flight_recorder_write;
+	flight_rec->base.destroy = weston_log_subscriber_destroy_flight_rec;
+	flight_rec->base.destroy_subscription = NULL;
+	flight_rec->base.complete = NULL;
+	wl_list_init(&flight_rec->base.subscription_list);
+
+	/* weston_ring_buffer_init() keeps the last byte as a terminator */
+	weston_rb = zalloc(size + 1);
+	if (!weston_rb) {
+		free(flight_rec);
+		return NULL;
+	}
+
+	weston_ring_buffer_init(&flight_rec->rb, size + 1, weston_rb);
+
+	return &flight_rec->base;
+}
+
 /** Retrieve flight recorder ring buffer contents, could be useful when
  * implementing an assert()-like wrapper.
  *
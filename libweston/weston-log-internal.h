@@ -114,4 +114,20 @@ void
 weston_timeline_destroy_subscription(struct weston_log_subscription *sub,
 				     void *user_data);
 
+void
+weston_timeline_binary_create_subscription(struct weston_log_subscription *sub,
+					   void *user_data);
+
+void
+weston_timeline_binary_destroy_subscription(struct weston_log_subscription *sub,
+					    void *user_data);
+
+void
+weston_log_subscription_write(struct weston_log_subscription *sub,
+			      const char *data, size_t len);
+
+void
+weston_log_ctx_set_event_loop(struct weston_log_context *log_ctx,
+			      struct wl_event_loop *loop);
+
 #endif /* WESTON_LOG_INTERNAL_H */
@@ -36,8 +36,11 @@
 #include <assert.h>
 #include <unistd.h>
 #include <stdarg.h>
+#include <stdint.h>
 #include <string.h>
 #include <errno.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
 #include <sys/time.h>
 
 /**
@@ -46,6 +49,38 @@
  * @defgroup debug-protocol weston-debug protocol specific
  */
 
+/* Must be a power of two. */
+#define WESTON_LOG_RING_SLOTS 256
+#define WESTON_LOG_RING_MSG_SIZE 512
+
+struct weston_log_ring_slot {
+	/** slot index when free, index + 1 when holding a message */
+	size_t seq;
+	struct weston_log_scope *scope;
+	size_t len;
+	char data[WESTON_LOG_RING_MSG_SIZE];
+};
+
+/** Messages from threads other than the main one
+ *
+ * A bounded multi-producer queue: producers claim a slot by advancing head
+ * with a compare-and-swap and format straight into it, so they never block
+ * on each other or on the main loop. Only the main loop consumes, writing
+ * the messages to their scopes in claim order. A full ring drops messages
+ * and counts them.
+ *
+ * @ingroup internal-log
+ */
+struct weston_log_ring {
+	struct weston_log_ring_slot slots[WESTON_LOG_RING_SLOTS];
+	size_t head;		/**< producers, atomic */
+	size_t tail;		/**< main loop only */
+	uint32_t dropped;	/**< atomic */
+	bool wake_pending;	/**< atomic */
+	int fd;			/**< eventfd waking the main loop */
+	struct wl_event_source *source;
+};
+
 /** Main weston-log context
  *
  * One per weston_compositor. Stores list of scopes created and a list pending
@@ -69,6 +104,12 @@ struct weston_log_context {
 	struct wl_listener compositor_destroy_listener;
 	struct wl_list scope_list; /**< weston_log_scope::compositor_link */
 	struct wl_list pending_subscription_list; /**< weston_log_subscription::source_link */
+	struct wl_list sample_list; /**< weston_log_sample::link */
+
+	/** the thread that created the context and runs the main loop */
+	pthread_t main_thread;
+	/** NULL if it could not be set up, other threads then race */
+	struct weston_log_ring *ring;
 };
 
 /** weston-log message scope
@@ -85,8 +126,22 @@ struct weston_log_scope {
 	weston_log_scope_cb new_subscription;
 	weston_log_scope_cb destroy_subscription;
 	void *user_data;
+	struct weston_log_context *log_ctx;
 	struct wl_list compositor_link;
 	struct wl_list subscription_list;  /**< weston_log_subscription::source_link */
+
+	unsigned int sample_interval;	/**< 0 or 1 keeps every period */
+	unsigned int sample_count;	/**< periods since the last kept one */
+};
+
+/** Sampling requested for a scope by name, possibly before it exists
+ *
+ * @ingroup internal-log
+ */
+struct weston_log_sample {
+	char *scope_name;
+	unsigned int interval;
+	struct wl_list link;	/**< weston_log_context::sample_list */
 };
 
 /** Ties a subscriber to a scope
@@ -179,7 +234,7 @@ weston_log_subscription_destroy_pending(struct weston_log_subscription *sub)
  *
  * @memberof weston_log_subscription
  */
-static void
+void
 weston_log_subscription_write(struct weston_log_subscription *sub,
 			      const char *data, size_t len)
 {
@@ -394,6 +449,219 @@ weston_log_ctx_disable_debug_protocol(struct weston_log_context *log_ctx)
 	log_ctx->global = NULL;
 }
 
+static struct weston_log_ring *
+weston_log_ring_create(void)
+{
+	struct weston_log_ring *ring;
+	size_t i;
+
+	ring = zalloc(sizeof *ring);
+	if (!ring)
+		return NULL;
+
+	ring->fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (ring->fd < 0) {
+		free(ring);
+		return NULL;
+	}
+
+	for (i = 0; i < WESTON_LOG_RING_SLOTS; i++)
+		ring->slots[i].seq = i;
+
+	return ring;
+}
+
+/** Write out everything published so far, on the main thread */
+static void
+weston_log_ring_drain(struct weston_log_ring *ring)
+{
+	struct weston_log_ring_slot *slot;
+	uint32_t dropped;
+
+	/* Cleared before looking, so a message published after this point
+	 * wakes us up again. */
+	__atomic_store_n(&ring->wake_pending, false, __ATOMIC_SEQ_CST);
+
+	for (;;) {
+		slot = &ring->slots[ring->tail & (WESTON_LOG_RING_SLOTS - 1)];
+		if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) !=
+		    ring->tail + 1)
+			break;
+
+		weston_log_scope_write(slot->scope, slot->data, slot->len);
+
+		__atomic_store_n(&slot->seq, ring->tail + WESTON_LOG_RING_SLOTS,
+				 __ATOMIC_RELEASE);
+		ring->tail++;
+	}
+
+	dropped = __atomic_exchange_n(&ring->dropped, 0, __ATOMIC_RELAXED);
+	if (dropped)
+		fprintf(stderr, "weston-log: dropped %u messages from other "
+			"threads, the log ring was full\n", dropped);
+}
+
+static int
+weston_log_ring_handle_event(int fd, uint32_t mask, void *data)
+{
+	struct weston_log_ring *ring = data;
+	uint64_t count;
+
+	if (read(fd, &count, sizeof count) < 0 && errno != EAGAIN)
+		return 0;
+
+	weston_log_ring_drain(ring);
+
+	return 0;
+}
+
+static void
+weston_log_ring_destroy(struct weston_log_ring *ring)
+{
+	weston_log_ring_drain(ring);
+
+	if (ring->source)
+		wl_event_source_remove(ring->source);
+	close(ring->fd);
+	free(ring);
+}
+
+/** Claim a slot, NULL when the ring is full */
+static struct weston_log_ring_slot *
+weston_log_ring_claim(struct weston_log_ring *ring, size_t *pos_out)
+{
+	struct weston_log_ring_slot *slot;
+	size_t pos, seq;
+	intptr_t diff;
+
+	pos = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+	for (;;) {
+		slot = &ring->slots[pos & (WESTON_LOG_RING_SLOTS - 1)];
+		seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+		diff = (intptr_t)seq - (intptr_t)pos;
+
+		if (diff == 0) {
+			/* on failure pos is reloaded with the current head */
+			if (__atomic_compare_exchange_n(&ring->head, &pos,
+							pos + 1, true,
+							__ATOMIC_RELAXED,
+							__ATOMIC_RELAXED))
+				break;
+		} else if (diff < 0) {
+			__atomic_fetch_add(&ring->dropped, 1,
+					   __ATOMIC_RELAXED);
+			return NULL;
+		} else {
+			pos = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+		}
+	}
+
+	*pos_out = pos;
+	return slot;
+}
+
+static void
+weston_log_ring_publish(struct weston_log_ring *ring,
+			struct weston_log_ring_slot *slot, size_t pos)
+{
+	uint64_t one = 1;
+
+	__atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+
+	if (!__atomic_exchange_n(&ring->wake_pending, true, __ATOMIC_SEQ_CST) &&
+	    write(ring->fd, &one, sizeof one) < 0) {
+		/* the counter cannot overflow in practice, and the main
+		 * loop drains on its next wake-up anyway */
+	}
+}
+
+static bool
+weston_log_scope_is_off_main_thread(struct weston_log_scope *scope)
+{
+	struct weston_log_context *log_ctx = scope->log_ctx;
+
+	return log_ctx->ring &&
+	       !pthread_equal(pthread_self(), log_ctx->main_thread);
+}
+
+/* Messages longer than a slot are cut. */
+static int
+weston_log_ring_vprintf(struct weston_log_ring *ring,
+			struct weston_log_scope *scope,
+			const char *fmt, va_list ap)
+{
+	struct weston_log_ring_slot *slot;
+	size_t pos;
+	int len;
+
+	slot = weston_log_ring_claim(ring, &pos);
+	if (!slot)
+		return 0;
+
+	len = vsnprintf(slot->data, sizeof slot->data, fmt, ap);
+	slot->scope = scope;
+	slot->len = len < 0 ? 0 : MIN((size_t)len, sizeof slot->data - 1);
+
+	weston_log_ring_publish(ring, slot, pos);
+
+	return len;
+}
+
+static void
+weston_log_ring_write(struct weston_log_ring *ring,
+		      struct weston_log_scope *scope,
+		      const char *data, size_t len)
+{
+	struct weston_log_ring_slot *slot;
+	size_t pos, chunk;
+
+	while (len > 0) {
+		slot = weston_log_ring_claim(ring, &pos);
+		if (!slot)
+			return;
+
+		chunk = MIN(len, sizeof slot->data);
+		memcpy(slot->data, data, chunk);
+		slot->scope = scope;
+		slot->len = chunk;
+
+		weston_log_ring_publish(ring, slot, pos);
+
+		data += chunk;
+		len -= chunk;
+	}
+}
+
+/** Deliver messages from other threads from the given event loop
+ *
+ * Until this is called, or after it is called with NULL, they wait in the
+ * ring until a scope is destroyed or the context goes away.
+ *
+ * @ingroup internal-log
+ */
+void
+weston_log_ctx_set_event_loop(struct weston_log_context *log_ctx,
+			      struct wl_event_loop *loop)
+{
+	struct weston_log_ring *ring = log_ctx->ring;
+
+	if (!ring)
+		return;
+
+	if (ring->source) {
+		wl_event_source_remove(ring->source);
+		ring->source = NULL;
+	}
+
+	weston_log_ring_drain(ring);
+
+	if (loop)
+		ring->source = wl_event_loop_add_fd(loop, ring->fd,
+						    WL_EVENT_READABLE,
+						    weston_log_ring_handle_event,
+						    ring);
+}
+
 /** Creates  weston_log_context structure
  *
  * \return NULL in case of failure, or a weston_log_context object in case of
@@ -414,8 +682,12 @@ weston_log_ctx_create(void)
 
 	wl_list_init(&log_ctx->scope_list);
 	wl_list_init(&log_ctx->pending_subscription_list);
+	wl_list_init(&log_ctx->sample_list);
 	wl_list_init(&log_ctx->compositor_destroy_listener.link);
 
+	log_ctx->main_thread = pthread_self();
+	log_ctx->ring = weston_log_ring_create();
+
 	return log_ctx;
 }
 
@@ -431,6 +703,7 @@ weston_log_ctx_destroy(struct weston_log_context *log_ctx)
 {
 	struct weston_log_scope *scope;
 	struct weston_log_subscription *pending_sub, *pending_sub_tmp;
+	struct weston_log_sample *sample, *sample_tmp;
 
 	/* We can't destroy the log context if there's still a compositor
 	 * that depends on it. This is an user error */
@@ -438,6 +711,9 @@ weston_log_ctx_destroy(struct weston_log_context *log_ctx)
 
 	weston_log_ctx_disable_debug_protocol(log_ctx);
 
+	if (log_ctx->ring)
+		weston_log_ring_destroy(log_ctx->ring);
+
 	wl_list_for_each(scope, &log_ctx->scope_list, compositor_link)
 		fprintf(stderr, "Internal warning: debug scope '%s' has not been destroyed.\n",
 			   scope->name);
@@ -453,6 +729,12 @@ weston_log_ctx_destroy(struct weston_log_context *log_ctx)
 
 	/* pending_subscription_list should be empty at this point */
 
+	wl_list_for_each_safe(sample, sample_tmp, &log_ctx->sample_list, link) {
+		wl_list_remove(&sample->link);
+		free(sample->scope_name);
+		free(sample);
+	}
+
 	free(log_ctx);
 }
 
@@ -581,6 +863,7 @@ weston_log_ctx_add_log_scope(struct weston_log_context *log_ctx,
 {
 	struct weston_log_scope *scope;
 	struct weston_log_subscription *pending_sub = NULL;
+	struct weston_log_sample *sample;
 
 	if (!name || !description) {
 		fprintf(stderr, "Error: cannot add a debug scope without name or description.\n");
@@ -611,6 +894,7 @@ weston_log_ctx_add_log_scope(struct weston_log_context *log_ctx,
 	scope->new_subscription = new_subscription;
 	scope->destroy_subscription = destroy_subscription;
 	scope->user_data = user_data;
+	scope->log_ctx = log_ctx;
 	wl_list_init(&scope->subscription_list);
 
 	if (!scope->name || !scope->desc) {
@@ -624,6 +908,11 @@ weston_log_ctx_add_log_scope(struct weston_log_context *log_ctx,
 
 	wl_list_insert(log_ctx->scope_list.prev, &scope->compositor_link);
 
+	wl_list_for_each(sample, &log_ctx->sample_list, link) {
+		if (strcmp(sample->scope_name, scope->name) == 0)
+			scope->sample_interval = sample->interval;
+	}
+
 	/* check if there are any pending subscriptions to this scope */
 	while ((pending_sub = find_pending_subscription(log_ctx, scope->name)) != NULL) {
 		weston_log_subscription_create(pending_sub->owner, scope);
@@ -689,6 +978,11 @@ weston_log_scope_destroy(struct weston_log_scope *scope)
 	if (!scope)
 		return;
 
+	/* Threads must have stopped logging to the scope by now, flush out
+	 * what they left in the ring. */
+	if (scope->log_ctx->ring)
+		weston_log_ring_drain(scope->log_ctx->ring);
+
 	wl_list_for_each_safe(sub, sub_tmp, &scope->subscription_list, source_link)
 		weston_log_subscription_destroy(sub);
 
@@ -728,6 +1022,89 @@ weston_log_scope_is_enabled(struct weston_log_scope *scope)
 	return !wl_list_empty(&scope->subscription_list);
 }
 
+/** Is the scope enabled, and in a period its sampling keeps?
+ *
+ * \param scope The log scope to check; may be NULL.
+ * \return True if messages printed now should be gathered at all.
+ *
+ * Like weston_log_scope_is_enabled(), but with sampling set through
+ * weston_log_ctx_set_sample_interval() it is only true during one out of
+ * every N periods, as counted by weston_log_scope_next_sample(). Use
+ * weston_log_scope_lazy_printf() to skip evaluating the arguments too.
+ *
+ * \memberof weston_log_scope
+ */
+WL_EXPORT bool
+weston_log_scope_is_sampled(struct weston_log_scope *scope)
+{
+	if (!weston_log_scope_is_enabled(scope))
+		return false;
+
+	return scope->sample_interval <= 1 || scope->sample_count == 0;
+}
+
+/** Start a new sampling period for the scope
+ *
+ * \param scope The log scope; may be NULL.
+ *
+ * Called by the scope owner at the granularity sampling should have,
+ * typically once per repaint cycle.
+ *
+ * \memberof weston_log_scope
+ */
+WL_EXPORT void
+weston_log_scope_next_sample(struct weston_log_scope *scope)
+{
+	if (!scope || scope->sample_interval <= 1)
+		return;
+
+	scope->sample_count = (scope->sample_count + 1) % scope->sample_interval;
+}
+
+/** Keep only one out of every interval periods of a scope
+ *
+ * \param log_ctx The log context.
+ * \param scope_name The scope to sample; it need not exist yet.
+ * \param interval Periods per sampled one; 0 or 1 keeps all of them.
+ *
+ * Lets noisy scopes stay subscribed in production: messages printed
+ * outside of the sampled periods are dropped without being formatted.
+ *
+ * \ingroup log
+ */
+WL_EXPORT void
+weston_log_ctx_set_sample_interval(struct weston_log_context *log_ctx,
+				   const char *scope_name,
+				   unsigned int interval)
+{
+	struct weston_log_scope *scope;
+	struct weston_log_sample *sample;
+
+	wl_list_for_each(sample, &log_ctx->sample_list, link) {
+		if (strcmp(sample->scope_name, scope_name) == 0)
+			break;
+	}
+
+	if (&sample->link == &log_ctx->sample_list) {
+		sample = zalloc(sizeof *sample);
+		if (!sample)
+			return;
+		sample->scope_name = strdup(scope_name);
+		if (!sample->scope_name) {
+			free(sample);
+			return;
+		}
+		wl_list_insert(&log_ctx->sample_list, &sample->link);
+	}
+	sample->interval = interval;
+
+	scope = weston_log_get_scope(log_ctx, scope_name);
+	if (scope) {
+		scope->sample_interval = interval;
+		scope->sample_count = 0;
+	}
+}
+
 /** Close the stream's complete callback if one was installed/created.
  *
  * @ingroup log
@@ -784,6 +1161,11 @@ weston_log_scope_write(struct weston_log_scope *scope,
 	if (!scope)
 		return;
 
+	if (weston_log_scope_is_off_main_thread(scope)) {
+		weston_log_ring_write(scope->log_ctx->ring, scope, data, len);
+		return;
+	}
+
 	wl_list_for_each(sub, &scope->subscription_list, source_link)
 		weston_log_subscription_write(sub, data, len);
 }
@@ -813,6 +1195,10 @@ weston_log_scope_vprintf(struct weston_log_scope *scope,
 	if (!weston_log_scope_is_enabled(scope))
 		return len;
 
+	if (weston_log_scope_is_off_main_thread(scope))
+		return weston_log_ring_vprintf(scope->log_ctx->ring, scope,
+					       fmt, ap);
+
 	len = vasprintf(&str, fmt, ap);
 	if (len >= 0) {
 		weston_log_scope_write(scope, str, len);
@@ -0,0 +1,46 @@
+/*
+ * Copyright © 2022 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef WESTON_PROBE_H
+#define WESTON_PROBE_H
+
+/** Static tracepoints for perf, bpftrace and SystemTap
+ *
+ * When built with -Dusdt=true, every WESTON_PROBE() is a USDT probe of
+ * the "weston" provider: a single nop in the code and an ELF note telling
+ * tracers where it is, so a probe costs nothing while nobody is attached.
+ * Probes survive inlining, unlike function entry points.
+ *
+ * Arguments should be integers or pointers. In builds without probes they
+ * are not evaluated at all, so they must not have side effects.
+ */
+#ifdef HAVE_USDT
+#include <sys/sdt.h>
+#define WESTON_PROBE(name, ...) STAP_PROBEV(weston, name, ##__VA_ARGS__)
+#else
+#define WESTON_PROBE(name, ...) do { } while (0)
+#endif
+
+#endif /* WESTON_PROBE_H */
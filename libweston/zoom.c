@@ -36,6 +36,19 @@
 #include "text-cursor-position-server-protocol.h"
 #include "shared/helpers.h"
 
+/* The frame only needs rendering again if the zoom is in output->matrix;
+ * the scanout plane just takes the new area on the next repaint. */
+static void
+weston_zoom_update_output(struct weston_output *output)
+{
+	output->dirty = 1;
+
+	if (output->zoom.scanout)
+		weston_output_schedule_repaint(output);
+	else
+		weston_output_damage(output);
+}
+
 static void
 weston_zoom_frame_z(struct weston_animation *animation,
 		    struct weston_output *output,
@@ -54,6 +67,7 @@ weston_zoom_frame_z(struct weston_animation *animation,
 	if (weston_spring_done(&output->zoom.spring_z)) {
 		if (output->zoom.active && output->zoom.level <= 0.0) {
 			output->zoom.active = false;
+			output->zoom.scanout = false;
 			output->zoom.seat = NULL;
 			weston_output_disable_planes_decr(output);
 			wl_list_remove(&output->zoom.motion_listener.link);
@@ -63,8 +77,7 @@ weston_zoom_frame_z(struct weston_animation *animation,
 		wl_list_init(&animation->link);
 	}
 
-	output->dirty = 1;
-	weston_output_damage(output);
+	weston_zoom_update_output(output);
 }
 
 static void
@@ -117,8 +130,7 @@ weston_zoom_transition(struct weston_output *output)
 		}
 	}
 
-	output->dirty = 1;
-	weston_output_damage(output);
+	weston_zoom_update_output(output);
 }
 
 WL_EXPORT void
@@ -176,6 +188,8 @@ weston_output_init_zoom(struct weston_output *output)
 	output->zoom.level = 0.0;
 	output->zoom.trans_x = 0.0;
 	output->zoom.trans_y = 0.0;
+	output->zoom.scanout_capable = false;
+	output->zoom.scanout = false;
 	weston_spring_init(&output->zoom.spring_z, 250.0, 0.0, 0.0);
 	output->zoom.spring_z.friction = 1000;
 	output->zoom.animation_z.frame = weston_zoom_frame_z;
@@ -36,6 +36,9 @@
 #include <errno.h>
 #include <unistd.h>
 
+#include "shared/os-compatibility.h"
+#include "shared/weston-drm-fourcc.h"
+
 #include <pipewire/pipewire.h>
 
 #include <spa/param/format-utils.h>
@@ -47,6 +50,10 @@
 
 #define PROP_RANGE(min, max) 2, (min), (max)
 
+/* Damage rectangles attached to each buffer; larger damage is sent as its
+ * bounding box. */
+#define MAX_DAMAGE_RECTS 16
+
 struct weston_pipewire {
 	struct weston_compositor *compositor;
 	struct wl_list output_list;
@@ -70,6 +77,9 @@ struct pipewire_output {
 	int (*saved_enable)(struct weston_output *output);
 	int (*saved_disable)(struct weston_output *output);
 	int (*saved_start_repaint_loop)(struct weston_output *output);
+	int (*saved_repaint)(struct weston_output *output,
+			     pixman_region32_t *damage,
+			     void *repaint_data);
 
 	struct weston_head *head;
 
@@ -85,6 +95,27 @@ struct pipewire_output {
 	struct wl_list link;
 	bool submitted_frame;
 	enum dpms_enum dpms;
+
+	bool damage_tracking;
+	/* Damage in buffer coordinates since the last queued buffer */
+	pixman_region32_t damage;
+
+	/* The stream negotiated dmabufs, which the output renders into */
+	bool dmabuf;
+	struct pw_buffer *render_buffer;
+	bool render_buffer_bound;
+
+	/* Frames are copied from another output instead of composited */
+	bool mirror;
+};
+
+struct pipewire_buffer {
+	struct weston_drm_virtual_buffer *virtual_buffer;
+	int fd;
+	void *data;
+	uint32_t size;
+	uint32_t stride;
+	uint32_t offset;
 };
 
 struct pipewire_frame_data {
@@ -156,6 +187,54 @@ lookup_pipewire_output(struct weston_output *base_output)
 	return NULL;
 }
 
+static void
+pipewire_output_damage_all(struct pipewire_output *output)
+{
+	struct weston_mode *mode = output->output->current_mode;
+
+	pixman_region32_fini(&output->damage);
+	pixman_region32_init_rect(&output->damage, 0, 0,
+				  mode->width, mode->height);
+}
+
+static void
+pipewire_output_set_buffer_damage(struct pipewire_output *output,
+				  struct spa_buffer *spa_buffer)
+{
+	struct spa_meta *meta;
+	struct spa_meta_region *r;
+	pixman_box32_t *rects;
+	int n_rects, max_rects, i;
+
+	meta = spa_buffer_find_meta(spa_buffer, SPA_META_VideoDamage);
+	if (!meta)
+		return;
+
+	r = spa_meta_first(meta);
+	max_rects = meta->size / sizeof(*r);
+	if (max_rects == 0)
+		return;
+
+	rects = pixman_region32_rectangles(&output->damage, &n_rects);
+	if (n_rects > max_rects) {
+		rects = pixman_region32_extents(&output->damage);
+		n_rects = 1;
+	}
+
+	for (i = 0; i < n_rects; i++) {
+		r[i].region.position.x = rects[i].x1;
+		r[i].region.position.y = rects[i].y1;
+		r[i].region.size.width = rects[i].x2 - rects[i].x1;
+		r[i].region.size.height = rects[i].y2 - rects[i].y1;
+	}
+
+	/* A zero-sized region terminates the list */
+	if (i < max_rects) {
+		r[i].region.size.width = 0;
+		r[i].region.size.height = 0;
+	}
+}
+
 static void
 pipewire_output_handle_frame(struct pipewire_output *output, int fd,
 			     int stride, struct drm_fb *drm_buffer)
@@ -164,6 +243,7 @@ pipewire_output_handle_frame(struct pipewire_output *output, int fd,
 		output->pipewire->virtual_output_api;
 	size_t size = output->output->height * stride;
 	struct pw_buffer *buffer;
+	struct pipewire_buffer *pb;
 	struct spa_buffer *spa_buffer;
 	struct spa_meta_header *h;
 	void *ptr;
@@ -172,13 +252,36 @@ pipewire_output_handle_frame(struct pipewire_output *output, int fd,
 	    PW_STREAM_STATE_STREAMING)
 		goto out;
 
-	buffer = pw_stream_dequeue_buffer(output->stream);
-	if (!buffer) {
-		weston_log("Failed to dequeue a pipewire buffer\n");
+	if (output->damage_tracking &&
+	    !pixman_region32_not_empty(&output->damage)) {
+		pipewire_output_debug(output, "skip frame, no damage");
+		goto out;
+	}
+
+	if (output->render_buffer_bound) {
+		buffer = output->render_buffer;
+		output->render_buffer = NULL;
+		output->render_buffer_bound = false;
+	} else if (output->dmabuf) {
+		/* The frame went to the GBM surface, which consumers of
+		 * dmabufs do not see. */
 		goto out;
+	} else {
+		buffer = pw_stream_dequeue_buffer(output->stream);
+		if (!buffer) {
+			weston_log("Failed to dequeue a pipewire buffer\n");
+			goto out;
+		}
 	}
 
 	spa_buffer = buffer->buffer;
+	pb = buffer->user_data;
+	if (!pb) {
+		spa_buffer->datas[0].chunk->size = 0;
+		spa_buffer->datas[0].chunk->flags = SPA_CHUNK_FLAG_CORRUPTED;
+		pw_stream_queue_buffer(output->stream, buffer);
+		goto out;
+	}
 
 	if ((h = spa_buffer_find_meta_data(spa_buffer, SPA_META_Header,
 				     sizeof(struct spa_meta_header)))) {
@@ -188,13 +291,25 @@ pipewire_output_handle_frame(struct pipewire_output *output, int fd,
 		h->dts_offset = 0;
 	}
 
-	ptr = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
-	memcpy(spa_buffer->datas[0].data, ptr, size);
-	munmap(ptr, size);
-
-	spa_buffer->datas[0].chunk->offset = 0;
-	spa_buffer->datas[0].chunk->stride = stride;
+	if (pb->virtual_buffer) {
+		/* Rendered in place */
+		spa_buffer->datas[0].chunk->offset = pb->offset;
+		spa_buffer->datas[0].chunk->stride = pb->stride;
+	} else {
+		ptr = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+		memcpy(pb->data, ptr, SPA_MIN(size, pb->size));
+		munmap(ptr, size);
+
+		spa_buffer->datas[0].chunk->offset = 0;
+		spa_buffer->datas[0].chunk->stride = stride;
+	}
 	spa_buffer->datas[0].chunk->size = spa_buffer->datas[0].maxsize;
+	spa_buffer->datas[0].chunk->flags = 0;
+
+	if (output->damage_tracking) {
+		pipewire_output_set_buffer_damage(output, spa_buffer);
+		pixman_region32_clear(&output->damage);
+	}
 
 	pipewire_output_debug(output, "push frame");
 	pw_stream_queue_buffer(output->stream, buffer);
@@ -315,9 +430,13 @@ pipewire_output_destroy(struct weston_output *base_output)
 		free(mode);
 	}
 
+	/* Release the stream buffers while the virtual output still
+	 * exists. */
+	pw_stream_destroy(output->stream);
+
 	output->saved_destroy(base_output);
 
-	pw_stream_destroy(output->stream);
+	pixman_region32_fini(&output->damage);
 
 	wl_list_remove(&output->link);
 	weston_head_release(output->head);
@@ -338,6 +457,79 @@ pipewire_output_start_repaint_loop(struct weston_output *base_output)
 	return 0;
 }
 
+static void
+pipewire_output_add_damage(struct pipewire_output *output,
+			   pixman_region32_t *damage)
+{
+	struct weston_output *base_output = output->output;
+	pixman_region32_t buffer_damage;
+
+	pixman_region32_init(&buffer_damage);
+	if (base_output->zoom.active) {
+		weston_matrix_transform_region(&buffer_damage,
+					       &base_output->matrix, damage);
+	} else {
+		pixman_region32_copy(&buffer_damage, damage);
+		pixman_region32_translate(&buffer_damage,
+					  -base_output->x, -base_output->y);
+		weston_transformed_region(base_output->width,
+					  base_output->height,
+					  base_output->transform,
+					  base_output->current_scale,
+					  &buffer_damage, &buffer_damage);
+	}
+	pixman_region32_intersect_rect(&buffer_damage, &buffer_damage, 0, 0,
+				       base_output->current_mode->width,
+				       base_output->current_mode->height);
+	pixman_region32_union(&output->damage, &output->damage,
+			      &buffer_damage);
+	pixman_region32_fini(&buffer_damage);
+}
+
+static void
+pipewire_output_bind_render_buffer(struct pipewire_output *output)
+{
+	const struct weston_drm_virtual_output_api *api =
+		output->pipewire->virtual_output_api;
+	struct pipewire_buffer *pb = NULL;
+
+	/* A buffer stays dequeued until a frame drawn into it is queued */
+	if (!output->render_buffer &&
+	    pw_stream_get_state(output->stream, NULL) ==
+	    PW_STREAM_STATE_STREAMING)
+		output->render_buffer = pw_stream_dequeue_buffer(output->stream);
+
+	if (output->render_buffer)
+		pb = output->render_buffer->user_data;
+
+	output->render_buffer_bound = pb && pb->virtual_buffer &&
+		api->set_render_buffer(output->output,
+				       pb->virtual_buffer) == 0;
+	if (!output->render_buffer_bound) {
+		pipewire_output_debug(output, "no buffer to render into");
+		api->set_render_buffer(output->output, NULL);
+	}
+}
+
+static int
+pipewire_output_repaint(struct weston_output *base_output,
+			pixman_region32_t *damage,
+			void *repaint_data)
+{
+	struct pipewire_output *output = lookup_pipewire_output(base_output);
+
+	if (output->dmabuf)
+		pipewire_output_bind_render_buffer(output);
+
+	/* A mirror frame is copied whole, the core passes no damage. */
+	if (output->damage_tracking && base_output->mirror)
+		pipewire_output_damage_all(output);
+	else if (output->damage_tracking)
+		pipewire_output_add_damage(output, damage);
+
+	return output->saved_repaint(base_output, damage, repaint_data);
+}
+
 static void
 pipewire_set_dpms(struct weston_output *base_output, enum dpms_enum level)
 {
@@ -350,20 +542,19 @@ pipewire_set_dpms(struct weston_output *base_output, enum dpms_enum level)
 	pipewire_output_finish_frame_handler(output);
 }
 
-static int
-pipewire_output_connect(struct pipewire_output *output)
+static const struct spa_pod *
+pipewire_output_build_format(struct pipewire_output *output,
+			     struct spa_pod_builder *builder, bool dmabuf)
 {
-	uint8_t buffer[1024];
-	struct spa_pod_builder builder =
-		SPA_POD_BUILDER_INIT(buffer, sizeof(buffer));
-	const struct spa_pod *params[1];
 	int frame_rate = output->output->current_mode->refresh / 1000;
 	int width = output->output->width;
 	int height = output->output->height;
-	int ret;
+	struct spa_pod_frame frame;
 
-	params[0] = spa_pod_builder_add_object(&builder,
-		SPA_TYPE_OBJECT_Format, SPA_PARAM_EnumFormat,
+	spa_pod_builder_push_object(builder, &frame,
+				    SPA_TYPE_OBJECT_Format,
+				    SPA_PARAM_EnumFormat);
+	spa_pod_builder_add(builder,
 		SPA_FORMAT_mediaType, SPA_POD_Id(SPA_MEDIA_TYPE_video),
 		SPA_FORMAT_mediaSubtype, SPA_POD_Id(SPA_MEDIA_SUBTYPE_raw),
 		SPA_FORMAT_VIDEO_format, SPA_POD_Id(SPA_VIDEO_FORMAT_BGRx),
@@ -372,12 +563,36 @@ pipewire_output_connect(struct pipewire_output *output)
 		SPA_FORMAT_VIDEO_maxFramerate,
 		SPA_POD_CHOICE_RANGE_Fraction(&SPA_FRACTION(frame_rate, 1),
 			&SPA_FRACTION(1, 1),
-			&SPA_FRACTION(frame_rate, 1)));
+			&SPA_FRACTION(frame_rate, 1)),
+		0);
+
+	/* Consumers that can import dmabufs pick the format with a
+	 * modifier; the others fall back to shared memory. */
+	if (dmabuf) {
+		spa_pod_builder_prop(builder, SPA_FORMAT_VIDEO_modifier,
+				     SPA_POD_PROP_FLAG_MANDATORY);
+		spa_pod_builder_long(builder, DRM_FORMAT_MOD_LINEAR);
+	}
+
+	return spa_pod_builder_pop(builder, &frame);
+}
+
+static int
+pipewire_output_connect(struct pipewire_output *output)
+{
+	uint8_t buffer[1024];
+	struct spa_pod_builder builder =
+		SPA_POD_BUILDER_INIT(buffer, sizeof(buffer));
+	const struct spa_pod *params[2];
+	int ret;
+
+	params[0] = pipewire_output_build_format(output, &builder, true);
+	params[1] = pipewire_output_build_format(output, &builder, false);
 
 	ret = pw_stream_connect(output->stream, PW_DIRECTION_OUTPUT, SPA_ID_INVALID,
 				(PW_STREAM_FLAG_DRIVER |
-				 PW_STREAM_FLAG_MAP_BUFFERS),
-				params, 1);
+				 PW_STREAM_FLAG_ALLOC_BUFFERS),
+				params, 2);
 	if (ret != 0) {
 		weston_log("Failed to connect pipewire stream: %s",
 			   spa_strerror(ret));
@@ -409,6 +624,8 @@ pipewire_output_enable(struct weston_output *base_output)
 
 	output->saved_start_repaint_loop = base_output->start_repaint_loop;
 	base_output->start_repaint_loop = pipewire_output_start_repaint_loop;
+	output->saved_repaint = base_output->repaint;
+	base_output->repaint = pipewire_output_repaint;
 	base_output->set_dpms = pipewire_set_dpms;
 
 	loop = wl_display_get_event_loop(c->wl_display);
@@ -446,6 +663,8 @@ pipewire_output_stream_state_changed(void *data, enum pw_stream_state old,
 
 	switch (state) {
 	case PW_STREAM_STATE_STREAMING:
+		/* New consumers need a complete first frame */
+		pipewire_output_damage_all(output);
 		weston_output_schedule_repaint(output->output);
 		break;
 	default:
@@ -460,7 +679,8 @@ pipewire_output_stream_param_changed(void *data, uint32_t id, const struct spa_p
 	uint8_t buffer[1024];
 	struct spa_pod_builder builder =
 		SPA_POD_BUILDER_INIT(buffer, sizeof(buffer));
-	const struct spa_pod *params[2];
+	const struct spa_pod *params[3];
+	int n_params = 2;
 	int32_t width, height, stride, size;
 	const int bpp = 4;
 
@@ -471,33 +691,144 @@ pipewire_output_stream_param_changed(void *data, uint32_t id, const struct spa_p
 	}
 
 	spa_format_video_raw_parse(format, &output->video_format);
+	output->dmabuf = spa_pod_find_prop(format, NULL,
+					   SPA_FORMAT_VIDEO_modifier) != NULL;
 
 	width = output->video_format.size.width;
 	height = output->video_format.size.height;
 	stride = SPA_ROUND_UP_N(width * bpp, 4);
 	size = height * stride;
 
-	pipewire_output_debug(output, "format = %dx%d", width, height);
+	pipewire_output_debug(output, "format = %dx%d%s", width, height,
+			      output->dmabuf ? " dmabuf" : "");
+
+	/* A mirror copies into the negotiated dmabufs, or else into
+	 * backend buffers that are read back like the GBM surface. */
+	if (output->mirror)
+		output->pipewire->virtual_output_api->set_buffer_queue_depth(
+			output->output, output->dmabuf ? 0 : 2);
 
 	params[0] = spa_pod_builder_add_object(&builder,
 		SPA_TYPE_OBJECT_ParamBuffers, SPA_PARAM_Buffers,
 		SPA_PARAM_BUFFERS_size, SPA_POD_Int(size),
 		SPA_PARAM_BUFFERS_stride, SPA_POD_Int(stride),
 		SPA_PARAM_BUFFERS_buffers, SPA_POD_CHOICE_RANGE_Int(4, 2, 8),
-		SPA_PARAM_BUFFERS_align, SPA_POD_Int(16));
+		SPA_PARAM_BUFFERS_align, SPA_POD_Int(16),
+		SPA_PARAM_BUFFERS_dataType,
+		SPA_POD_Int(output->dmabuf ? 1 << SPA_DATA_DmaBuf :
+					     1 << SPA_DATA_MemFd));
 
 	params[1] = spa_pod_builder_add_object(&builder,
 		SPA_TYPE_OBJECT_ParamMeta, SPA_PARAM_Meta,
 		SPA_PARAM_META_type, SPA_POD_Id(SPA_META_Header),
 		SPA_PARAM_META_size, SPA_POD_Int(sizeof(struct spa_meta_header)));
 
-	pw_stream_update_params(output->stream, params, 2);
+	if (output->damage_tracking) {
+		params[n_params++] = spa_pod_builder_add_object(&builder,
+			SPA_TYPE_OBJECT_ParamMeta, SPA_PARAM_Meta,
+			SPA_PARAM_META_type, SPA_POD_Id(SPA_META_VideoDamage),
+			SPA_PARAM_META_size,
+			SPA_POD_Int(sizeof(struct spa_meta_region) *
+				    MAX_DAMAGE_RECTS));
+	}
+
+	pw_stream_update_params(output->stream, params, n_params);
+}
+
+static void
+pipewire_output_stream_add_buffer(void *data, struct pw_buffer *buffer)
+{
+	struct pipewire_output *output = data;
+	const struct weston_drm_virtual_output_api *api =
+		output->pipewire->virtual_output_api;
+	struct spa_data *d = buffer->buffer->datas;
+	struct pipewire_buffer *pb;
+	uint64_t modifier;
+	int32_t height = output->video_format.size.height;
+
+	pb = zalloc(sizeof *pb);
+	if (!pb)
+		return;
+
+	if (output->dmabuf) {
+		pb->virtual_buffer = api->create_buffer(output->output,
+							&pb->fd, &pb->stride,
+							&pb->offset, &modifier);
+		if (!pb->virtual_buffer) {
+			weston_log("Failed to create a pipewire dmabuf\n");
+			free(pb);
+			return;
+		}
+		pb->size = pb->offset + pb->stride * height;
+
+		d[0].type = SPA_DATA_DmaBuf;
+		d[0].data = NULL;
+	} else {
+		pb->stride = SPA_ROUND_UP_N(output->video_format.size.width * 4,
+					    4);
+		pb->size = pb->stride * height;
+		pb->fd = os_create_anonymous_file(pb->size);
+		if (pb->fd < 0) {
+			weston_log("Failed to create a pipewire buffer\n");
+			free(pb);
+			return;
+		}
+
+		pb->data = mmap(NULL, pb->size, PROT_READ | PROT_WRITE,
+				MAP_SHARED, pb->fd, 0);
+		if (pb->data == MAP_FAILED) {
+			weston_log("Failed to map a pipewire buffer\n");
+			close(pb->fd);
+			free(pb);
+			return;
+		}
+
+		d[0].type = SPA_DATA_MemFd;
+		d[0].data = pb->data;
+	}
+
+	d[0].flags = SPA_DATA_FLAG_READWRITE;
+	d[0].fd = pb->fd;
+	d[0].mapoffset = 0;
+	d[0].maxsize = pb->size;
+
+	buffer->user_data = pb;
+	pipewire_output_debug(output, "add buffer fd = %d", pb->fd);
+}
+
+static void
+pipewire_output_stream_remove_buffer(void *data, struct pw_buffer *buffer)
+{
+	struct pipewire_output *output = data;
+	const struct weston_drm_virtual_output_api *api =
+		output->pipewire->virtual_output_api;
+	struct pipewire_buffer *pb = buffer->user_data;
+
+	if (output->render_buffer == buffer) {
+		output->render_buffer = NULL;
+		output->render_buffer_bound = false;
+	}
+
+	if (!pb)
+		return;
+
+	pipewire_output_debug(output, "remove buffer fd = %d", pb->fd);
+
+	if (pb->virtual_buffer)
+		api->destroy_buffer(pb->virtual_buffer);
+	else
+		munmap(pb->data, pb->size);
+	close(pb->fd);
+	free(pb);
+	buffer->user_data = NULL;
 }
 
 static const struct pw_stream_events stream_events = {
 	PW_VERSION_STREAM_EVENTS,
 	.state_changed = pipewire_output_stream_state_changed,
 	.param_changed = pipewire_output_stream_param_changed,
+	.add_buffer = pipewire_output_stream_add_buffer,
+	.remove_buffer = pipewire_output_stream_remove_buffer,
 };
 
 static struct weston_output *
@@ -548,6 +879,7 @@ pipewire_output_create(struct weston_compositor *c, char *name)
 	output->saved_disable = output->output->disable;
 	output->output->disable = pipewire_output_disable;
 	output->pipewire = pipewire;
+	pixman_region32_init(&output->damage);
 	wl_list_insert(pipewire->output_list.prev, &output->link);
 
 	asprintf(&remoting_name, "%s-%s", connector_name, name);
@@ -629,6 +961,35 @@ pipewire_output_set_seat(struct weston_output *output, const char *seat)
 {
 }
 
+static void
+pipewire_output_set_damage_tracking(struct weston_output *base_output,
+				    bool enable)
+{
+	struct pipewire_output *output = lookup_pipewire_output(base_output);
+
+	if (output == NULL) {
+		weston_log("Output is not pipewire.\n");
+		return;
+	}
+
+	output->damage_tracking = enable;
+}
+
+static void
+pipewire_output_set_mirror_of(struct weston_output *base_output,
+			      const char *name)
+{
+	struct pipewire_output *output = lookup_pipewire_output(base_output);
+
+	if (output == NULL) {
+		weston_log("Output is not pipewire.\n");
+		return;
+	}
+
+	output->mirror = name != NULL;
+	output->pipewire->virtual_output_api->set_mirror_of(base_output, name);
+}
+
 static void
 weston_pipewire_destroy(struct wl_listener *l, void *data)
 {
@@ -719,6 +1080,8 @@ static const struct weston_pipewire_api pipewire_api = {
 	pipewire_output_is_pipewire,
 	pipewire_output_set_mode,
 	pipewire_output_set_seat,
+	pipewire_output_set_damage_tracking,
+	pipewire_output_set_mirror_of,
 };
 
 WL_EXPORT int
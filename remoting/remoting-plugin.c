@@ -52,6 +52,13 @@
 
 #define MAX_RETRY_COUNT	3
 
+/* At most one frame in (MAX_FRAME_SKIP + 1) is sent when over budget */
+#define MAX_FRAME_SKIP	4
+#define RATE_CONTROL_PERIOD_MSEC	1000
+
+/* Buffers a mirror copies into when no queue depth is configured */
+#define REMOTING_MIRROR_QUEUE_DEPTH	2
+
 struct weston_remoting {
 	struct weston_compositor *compositor;
 	struct wl_list output_list;
@@ -67,6 +74,43 @@ struct remoted_gstpipe {
 	struct wl_event_source *source;
 };
 
+#define RTP_PAYLOAD_H264 "h264parse ! rtph264pay config-interval=1"
+#define RTP_PAYLOAD_H265 "h265parse ! rtph265pay config-interval=1"
+#define RTP_PAYLOAD_VP8 "rtpvp8pay"
+#define RTP_PAYLOAD_VP9 "rtpvp9pay"
+#define RTP_PAYLOAD_JPEG "rtpjpegpay"
+
+/* encoder elements a default pipeline can be built for, by element name */
+struct remoted_output_encoder_payloader {
+	const char *element;
+	const char *payloader;
+};
+
+static const struct remoted_output_encoder_payloader encoder_payloaders[] = {
+	{ "x264enc", RTP_PAYLOAD_H264 },
+	{ "openh264enc", RTP_PAYLOAD_H264 },
+	{ "v4l2h264enc", RTP_PAYLOAD_H264 },
+	{ "vpuenc_h264", RTP_PAYLOAD_H264 },
+	{ "vaapih264enc", RTP_PAYLOAD_H264 },
+	{ "vah264enc", RTP_PAYLOAD_H264 },
+	{ "x265enc", RTP_PAYLOAD_H265 },
+	{ "v4l2h265enc", RTP_PAYLOAD_H265 },
+	{ "vpuenc_hevc", RTP_PAYLOAD_H265 },
+	{ "vaapih265enc", RTP_PAYLOAD_H265 },
+	{ "vah265enc", RTP_PAYLOAD_H265 },
+	{ "vp8enc", RTP_PAYLOAD_VP8 },
+	{ "v4l2vp8enc", RTP_PAYLOAD_VP8 },
+	{ "vpuenc_vp8", RTP_PAYLOAD_VP8 },
+	{ "vaapivp8enc", RTP_PAYLOAD_VP8 },
+	{ "vp9enc", RTP_PAYLOAD_VP9 },
+	{ "v4l2vp9enc", RTP_PAYLOAD_VP9 },
+	{ "vaapivp9enc", RTP_PAYLOAD_VP9 },
+	{ "jpegenc", RTP_PAYLOAD_JPEG },
+	{ "v4l2jpegenc", RTP_PAYLOAD_JPEG },
+	{ "vpuenc_jpeg", RTP_PAYLOAD_JPEG },
+	{ "vaapijpegenc", RTP_PAYLOAD_JPEG },
+};
+
 /* supported gbm format list */
 struct remoted_output_support_gbm_format {
 	/* GBM_FORMAT_* tokens are strictly aliased with DRM_FORMAT_*, so we
@@ -103,6 +147,10 @@ struct remoted_output {
 	int port;
 	char *gst_pipeline;
 	const struct remoted_output_support_gbm_format *format;
+	char *encoder;
+	bool encoder_pipeline; /* gst_pipeline was built for encoder */
+	int bitrate; /* kbit/s, 0 for encoder default */
+	unsigned int buffer_queue_depth;
 
 	struct weston_head *head;
 
@@ -115,11 +163,18 @@ struct remoted_output {
 
 	GstElement *pipeline;
 	GstAppSrc *appsrc;
+	GstElement *encoder_element;
 	GstBus *bus;
 	struct remoted_gstpipe gstpipe;
 	GstClockTime start_time;
 	int retry_count;
 	enum dpms_enum dpms;
+
+	/* Rate control; encoded_bytes is updated from the streaming thread */
+	uint64_t encoded_bytes;
+	struct timespec rate_start;
+	unsigned int frame_skip;
+	unsigned int frame_count;
 };
 
 struct mem_free_cb_data {
@@ -183,6 +238,96 @@ remoting_gst_bus_sync_handler(GstBus *bus, GstMessage *message,
 	return GST_BUS_PASS;
 }
 
+static GstPadProbeReturn
+remoting_gst_encoder_probe(GstPad *pad, GstPadProbeInfo *info,
+			   gpointer user_data)
+{
+	struct remoted_output *output = user_data;
+	GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+
+	if (buffer)
+		__atomic_fetch_add(&output->encoded_bytes,
+				   gst_buffer_get_size(buffer),
+				   __ATOMIC_RELAXED);
+
+	return GST_PAD_PROBE_OK;
+}
+
+static void
+remoting_gst_encoder_set_bitrate(struct remoted_output *output)
+{
+	GObjectClass *klass;
+	GstStructure *controls;
+
+	if (!output->encoder_element || output->bitrate <= 0)
+		return;
+
+	klass = G_OBJECT_GET_CLASS(output->encoder_element);
+
+	/* Most software and vendor encoders take kbit/s, V4L2 M2M
+	 * encoders a control in bit/s. */
+	if (g_object_class_find_property(klass, "bitrate")) {
+		g_object_set(G_OBJECT(output->encoder_element),
+			     "bitrate", (guint) output->bitrate, NULL);
+	} else if (g_object_class_find_property(klass, "extra-controls")) {
+		controls = gst_structure_new("controls",
+					     "video_bitrate", G_TYPE_INT,
+					     output->bitrate * 1000, NULL);
+		g_object_set(G_OBJECT(output->encoder_element),
+			     "extra-controls", controls, NULL);
+		gst_structure_free(controls);
+	} else {
+		weston_log("remoting: encoder has no bitrate control, "
+			   "relying on frame skipping\n");
+	}
+}
+
+static void
+remoting_gst_encoder_init(struct remoted_output *output)
+{
+	GstPad *pad;
+
+	output->encoder_element =
+		gst_bin_get_by_name(GST_BIN(output->pipeline), "encoder");
+	if (!output->encoder_element)
+		return;
+
+	remoting_gst_encoder_set_bitrate(output);
+
+	pad = gst_element_get_static_pad(output->encoder_element, "src");
+	if (pad) {
+		gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER,
+				  remoting_gst_encoder_probe, output, NULL);
+		gst_object_unref(pad);
+	}
+
+	__atomic_store_n(&output->encoded_bytes, 0, __ATOMIC_RELAXED);
+	output->rate_start.tv_sec = 0;
+	output->rate_start.tv_nsec = 0;
+	output->frame_skip = 0;
+	output->frame_count = 0;
+}
+
+/* The encoder option is an element description, "name prop=value ...";
+ * only its element name selects the payloader. */
+static const char *
+remoting_encoder_payloader(const char *encoder)
+{
+	unsigned int i;
+	size_t len;
+
+	encoder += strspn(encoder, " \t");
+	len = strcspn(encoder, " \t");
+
+	for (i = 0; i < ARRAY_LENGTH(encoder_payloaders); i++) {
+		if (strlen(encoder_payloaders[i].element) == len &&
+		    strncmp(encoder, encoder_payloaders[i].element, len) == 0)
+			return encoder_payloaders[i].payloader;
+	}
+
+	return NULL;
+}
+
 static int
 remoting_gst_pipeline_init(struct remoted_output *output)
 {
@@ -190,8 +335,41 @@ remoting_gst_pipeline_init(struct remoted_output *output)
 	GError *err = NULL;
 	GstStateChangeReturn ret;
 	struct weston_mode *mode = output->output->current_mode;
+	bool dmabuf_caps = false;
 
-	if (!output->gst_pipeline) {
+	if (!output->gst_pipeline && output->encoder) {
+		char pipeline_str[1024];
+		const char *payloader;
+		bool v4l2;
+
+		payloader = remoting_encoder_payloader(output->encoder);
+		if (!payloader) {
+			weston_log("remoting: no RTP payloader known for "
+				   "encoder %s\n", output->encoder);
+			return -1;
+		}
+
+		/* V4L2 M2M encoders import the output dmabufs directly,
+		 * without a CPU copy or colour conversion in between. */
+		v4l2 = strncmp(output->encoder + strspn(output->encoder, " \t"),
+			       "v4l2", 4) == 0;
+		snprintf(pipeline_str, sizeof(pipeline_str),
+			 "rtpbin name=rtpbin "
+			 "appsrc name=src ! queue ! %s name=encoder%s ! %s ! "
+			 "rtpbin.send_rtp_sink_0 "
+			 "rtpbin.send_rtp_src_0 ! "
+			 "udpsink name=sink host=%s port=%d "
+			 "rtpbin.send_rtcp_src_0 ! "
+			 "udpsink host=%s port=%d sync=false async=false "
+			 "udpsrc port=%d ! rtpbin.recv_rtcp_sink_0",
+			 output->encoder,
+			 v4l2 ? " output-io-mode=dmabuf-import" : "",
+			 payloader,
+			 output->host, output->port, output->host,
+			 output->port + 1, output->port + 2);
+		output->gst_pipeline = strdup(pipeline_str);
+		output->encoder_pipeline = true;
+	} else if (!output->gst_pipeline) {
 		char pipeline_str[1024];
 		/* TODO: use encodebin instead of jpegenc */
 		snprintf(pipeline_str, sizeof(pipeline_str),
@@ -210,6 +388,9 @@ remoting_gst_pipeline_init(struct remoted_output *output)
 	}
 	weston_log("GST pipeline: %s\n", output->gst_pipeline);
 
+	dmabuf_caps = output->encoder_pipeline &&
+		      strncmp(output->encoder, "v4l2", 4) == 0;
+
 	output->pipeline = gst_parse_launch(output->gst_pipeline, &err);
 	if (!output->pipeline) {
 		weston_log("Could not create gstreamer pipeline. Error: %s\n",
@@ -243,6 +424,10 @@ remoting_gst_pipeline_init(struct remoted_output *output)
 		weston_log("Could not create gstreamer caps.\n");
 		goto err;
 	}
+	if (dmabuf_caps)
+		gst_caps_set_features(caps, 0,
+				      gst_caps_features_new("memory:DMABuf",
+							    NULL));
 	g_object_set(G_OBJECT(output->appsrc),
 		     "caps", caps,
 		     "stream-type", 0,
@@ -259,6 +444,8 @@ remoting_gst_pipeline_init(struct remoted_output *output)
 	gst_bus_set_sync_handler(output->bus, remoting_gst_bus_sync_handler,
 				 &output->gstpipe, NULL);
 
+	remoting_gst_encoder_init(output);
+
 	output->start_time = 0;
 	ret = gst_element_set_state(output->pipeline, GST_STATE_PLAYING);
 	if (ret == GST_STATE_CHANGE_FAILURE) {
@@ -281,6 +468,10 @@ remoting_gst_pipeline_deinit(struct remoted_output *output)
 		return;
 
 	gst_element_set_state(output->pipeline, GST_STATE_NULL);
+	if (output->encoder_element) {
+		gst_object_unref(GST_OBJECT(output->encoder_element));
+		output->encoder_element = NULL;
+	}
 	if (output->bus)
 		gst_object_unref(GST_OBJECT(output->bus));
 	gst_object_unref(GST_OBJECT(output->pipeline));
@@ -545,6 +736,43 @@ remoting_output_gst_push_buffer(struct remoted_output *output,
 	output->submitted_frame = true;
 }
 
+/* Adjust how many frames are dropped so that the measured encoder
+ * output stays within the configured bitrate.
+ */
+static void
+remoting_output_rate_control(struct remoted_output *output)
+{
+	struct timespec now;
+	int64_t elapsed_msec;
+	uint64_t bytes, kbps;
+
+	if (!output->encoder_element || output->bitrate <= 0)
+		return;
+
+	weston_compositor_read_presentation_clock(output->remoting->compositor,
+						  &now);
+	if (!timespec_is_zero(&output->rate_start)) {
+		elapsed_msec = timespec_sub_to_msec(&now, &output->rate_start);
+		if (elapsed_msec < RATE_CONTROL_PERIOD_MSEC)
+			return;
+
+		bytes = __atomic_exchange_n(&output->encoded_bytes, 0,
+					    __ATOMIC_RELAXED);
+		kbps = bytes * 8 / elapsed_msec;
+
+		if (kbps > (uint64_t) output->bitrate * 11 / 10 &&
+		    output->frame_skip < MAX_FRAME_SKIP)
+			output->frame_skip++;
+		else if (kbps < (uint64_t) output->bitrate * 8 / 10 &&
+			 output->frame_skip > 0)
+			output->frame_skip--;
+	} else {
+		__atomic_store_n(&output->encoded_bytes, 0, __ATOMIC_RELAXED);
+	}
+
+	output->rate_start = now;
+}
+
 static int
 remoting_output_fence_sync_handler(int fd, uint32_t mask, void *data)
 {
@@ -580,6 +808,17 @@ remoting_output_frame(struct weston_output *output_base, int fd, int stride,
 	if (!output)
 		return -1;
 
+	/* Frames are only submitted on damage; beyond that, drop frames
+	 * while the encoder is over its bitrate budget. */
+	remoting_output_rate_control(output);
+	if (output->frame_skip > 0 &&
+	    output->frame_count++ % (output->frame_skip + 1) != 0) {
+		close(fd);
+		api->buffer_released(output_buffer);
+		output->submitted_frame = true;
+		return 0;
+	}
+
 	cb_data = zalloc(sizeof *cb_data);
 	if (!cb_data)
 		return -1;
@@ -650,6 +889,7 @@ remoting_output_destroy(struct weston_output *output)
 		free(remoted_output->host);
 	if (remoted_output->gst_pipeline)
 		free(remoted_output->gst_pipeline);
+	free(remoted_output->encoder);
 
 	wl_list_remove(&remoted_output->link);
 	weston_head_release(remoted_output->head);
@@ -692,6 +932,7 @@ remoting_output_enable(struct weston_output *output)
 	const struct weston_drm_virtual_output_api *api
 		= remoted_output->remoting->virtual_output_api;
 	struct wl_event_loop *loop;
+	unsigned int depth;
 	int ret;
 
 	api->set_submit_frame_cb(output, remoting_output_frame);
@@ -700,6 +941,15 @@ remoting_output_enable(struct weston_output *output)
 	if (ret < 0)
 		return ret;
 
+	/* A mirror has no GBM surface frames, it copies into the queue. */
+	depth = remoted_output->buffer_queue_depth;
+	if (output->mirror && depth == 0)
+		depth = REMOTING_MIRROR_QUEUE_DEPTH;
+
+	if (depth > 0 && api->set_buffer_queue_depth(output, depth) < 0)
+		weston_log("Cannot allocate %u buffers for remoted output %s\n",
+			   depth, output->name);
+
 	remoted_output->saved_start_repaint_loop = output->start_repaint_loop;
 	output->start_repaint_loop = remoting_output_start_repaint_loop;
 	output->set_dpms = remoting_output_set_dpms;
@@ -910,6 +1160,48 @@ remoting_output_set_gst_pipeline(struct weston_output *output,
 	remoted_output->gst_pipeline = strdup(gst_pipeline);
 }
 
+static void
+remoting_output_set_encoder(struct weston_output *output,
+			    const char *encoder)
+{
+	struct remoted_output *remoted_output = lookup_remoted_output(output);
+
+	if (!remoted_output)
+		return;
+
+	free(remoted_output->encoder);
+	remoted_output->encoder = encoder ? strdup(encoder) : NULL;
+}
+
+static void
+remoting_output_set_bitrate(struct weston_output *output, int kbps)
+{
+	struct remoted_output *remoted_output = lookup_remoted_output(output);
+
+	if (remoted_output)
+		remoted_output->bitrate = kbps > 0 ? kbps : 0;
+}
+
+static void
+remoting_output_set_buffer_queue_depth(struct weston_output *output,
+				       unsigned int depth)
+{
+	struct remoted_output *remoted_output = lookup_remoted_output(output);
+
+	if (remoted_output)
+		remoted_output->buffer_queue_depth = depth;
+}
+
+static void
+remoting_output_set_mirror_of(struct weston_output *output, const char *name)
+{
+	struct remoted_output *remoted_output = lookup_remoted_output(output);
+
+	if (remoted_output)
+		remoted_output->remoting->virtual_output_api->set_mirror_of(output,
+									    name);
+}
+
 static const struct weston_remoting_api remoting_api = {
 	remoting_output_create,
 	remoting_output_is_remoted,
@@ -919,6 +1211,10 @@ static const struct weston_remoting_api remoting_api = {
 	remoting_output_set_host,
 	remoting_output_set_port,
 	remoting_output_set_gst_pipeline,
+	remoting_output_set_encoder,
+	remoting_output_set_bitrate,
+	remoting_output_set_buffer_queue_depth,
+	remoting_output_set_mirror_of,
 };
 
 WL_EXPORT int
@@ -516,15 +516,18 @@ create_layout(cairo_t *cr, const char *title)
 	cairo_show_text(cr, title)
 #endif
 
+/** Render the shadow and border of a frame, without the title
+ *
+ * THEME_FRAME_NO_TITLE selects the thin top border instead of a title
+ * bar. The result depends only on the size and flags, so callers may
+ * keep it around and reuse it.
+ */
 void
-theme_render_frame(struct theme *t,
-		   cairo_t *cr, int width, int height,
-		   const char *title, cairo_rectangle_int_t *title_rect,
-		   struct wl_list *buttons, uint32_t flags)
+theme_render_frame_border(struct theme *t, cairo_t *cr,
+			  int width, int height, uint32_t flags)
 {
 	cairo_surface_t *source;
-	int x, y, margin, top_margin;
-	int text_width, text_height;
+	int margin, top_margin;
 
 	cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
 	cairo_set_source_rgba(cr, 0, 0, 0, 0);
@@ -544,71 +547,99 @@ theme_render_frame(struct theme *t,
 	else
 		source = t->inactive_frame;
 
-	if (title || !wl_list_empty(buttons))
-		top_margin = t->titlebar_height;
-	else
+	if (flags & THEME_FRAME_NO_TITLE)
 		top_margin = t->width;
+	else
+		top_margin = t->titlebar_height;
 
 	tile_source(cr, source,
 		    margin, margin,
 		    width - margin * 2, height - margin * 2,
 		    t->width, top_margin);
+}
 
-	if (title || !wl_list_empty(buttons)) {
+/** Render the title text of a frame over its border */
+void
+theme_render_frame_title(struct theme *t, cairo_t *cr, int width,
+			 const char *title, cairo_rectangle_int_t *title_rect,
+			 uint32_t flags)
+{
+	int x, y, margin;
+	int text_width, text_height;
+
+	if (flags & THEME_FRAME_MAXIMIZED)
+		margin = 0;
+	else
+		margin = t->margin;
 
-		cairo_rectangle (cr, title_rect->x, title_rect->y,
-				 title_rect->width, title_rect->height);
-		cairo_clip(cr);
-		cairo_set_operator(cr, CAIRO_OPERATOR_OVER);
+	cairo_rectangle (cr, title_rect->x, title_rect->y,
+			 title_rect->width, title_rect->height);
+	cairo_clip(cr);
+	cairo_set_operator(cr, CAIRO_OPERATOR_OVER);
 
 #ifdef HAVE_PANGO
-		PangoLayout *title_layout;
-		PangoRectangle logical;
+	PangoLayout *title_layout;
+	PangoRectangle logical;
 
-		title_layout = create_layout(cr, title);
+	title_layout = create_layout(cr, title);
 
-		pango_layout_get_pixel_extents (title_layout, NULL, &logical);
-		text_width = MIN(title_rect->width, logical.width);
-		text_height = logical.height;
-		if (text_width < logical.width)
-		  pango_layout_set_width (title_layout, text_width * PANGO_SCALE);
+	pango_layout_get_pixel_extents (title_layout, NULL, &logical);
+	text_width = MIN(title_rect->width, logical.width);
+	text_height = logical.height;
+	if (text_width < logical.width)
+	  pango_layout_set_width (title_layout, text_width * PANGO_SCALE);
 
 #else
-		cairo_text_extents_t extents;
-		cairo_font_extents_t font_extents;
-
-		cairo_select_font_face(cr, "sans-serif",
-				       CAIRO_FONT_SLANT_NORMAL,
-				       CAIRO_FONT_WEIGHT_BOLD);
-		cairo_set_font_size(cr, 14);
-		cairo_text_extents(cr, title, &extents);
-		cairo_font_extents (cr, &font_extents);
-		text_width = extents.width;
-		text_height = font_extents.descent - font_extents.ascent;
+	cairo_text_extents_t extents;
+	cairo_font_extents_t font_extents;
+
+	cairo_select_font_face(cr, "sans-serif",
+			       CAIRO_FONT_SLANT_NORMAL,
+			       CAIRO_FONT_WEIGHT_BOLD);
+	cairo_set_font_size(cr, 14);
+	cairo_text_extents(cr, title, &extents);
+	cairo_font_extents (cr, &font_extents);
+	text_width = extents.width;
+	text_height = font_extents.descent - font_extents.ascent;
 #endif
 
-		x = (width - text_width) / 2;
-		y = margin + (t->titlebar_height - text_height) / 2;
-		if (x < title_rect->x)
-			x = title_rect->x;
-		else if (x + text_width > (title_rect->x + title_rect->width))
-			x = (title_rect->x + title_rect->width) - text_width;
-
-		if (flags & THEME_FRAME_ACTIVE) {
-			cairo_move_to(cr, x + 1, y  + 1);
-			cairo_set_source_rgb(cr, 1, 1, 1);
-			SHOW_TEXT(cr);
-			cairo_move_to(cr, x, y);
-			cairo_set_source_rgb(cr, 0, 0, 0);
-			SHOW_TEXT(cr);
-		} else {
-			cairo_move_to(cr, x, y);
-			cairo_set_source_rgb(cr, 0.4, 0.4, 0.4);
-			SHOW_TEXT(cr);
-		}
+	x = (width - text_width) / 2;
+	y = margin + (t->titlebar_height - text_height) / 2;
+	if (x < title_rect->x)
+		x = title_rect->x;
+	else if (x + text_width > (title_rect->x + title_rect->width))
+		x = (title_rect->x + title_rect->width) - text_width;
+
+	if (flags & THEME_FRAME_ACTIVE) {
+		cairo_move_to(cr, x + 1, y  + 1);
+		cairo_set_source_rgb(cr, 1, 1, 1);
+		SHOW_TEXT(cr);
+		cairo_move_to(cr, x, y);
+		cairo_set_source_rgb(cr, 0, 0, 0);
+		SHOW_TEXT(cr);
+	} else {
+		cairo_move_to(cr, x, y);
+		cairo_set_source_rgb(cr, 0.4, 0.4, 0.4);
+		SHOW_TEXT(cr);
 	}
 }
 
+void
+theme_render_frame(struct theme *t,
+		   cairo_t *cr, int width, int height,
+		   const char *title, cairo_rectangle_int_t *title_rect,
+		   struct wl_list *buttons, uint32_t flags)
+{
+	if (!title && wl_list_empty(buttons))
+		flags |= THEME_FRAME_NO_TITLE;
+
+	theme_render_frame_border(t, cr, width, height, flags);
+
+	if (!(flags & THEME_FRAME_NO_TITLE))
+		theme_render_frame_title(t, cr, width, title, title_rect,
+					 flags);
+}
+
 enum theme_location
 theme_get_location(struct theme *t, int x, int y,
 				int width, int height, int flags)
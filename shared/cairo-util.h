@@ -77,6 +77,13 @@ theme_render_frame(struct theme *t,
 		   cairo_t *cr, int width, int height,
 		   const char *title, cairo_rectangle_int_t *title_rect,
 		   struct wl_list *buttons, uint32_t flags);
+void
+theme_render_frame_border(struct theme *t, cairo_t *cr,
+			  int width, int height, uint32_t flags);
+void
+theme_render_frame_title(struct theme *t, cairo_t *cr, int width,
+			 const char *title, cairo_rectangle_int_t *title_rect,
+			 uint32_t flags);
 
 enum theme_location {
 	THEME_LOCATION_INTERIOR = 0,
@@ -230,4 +237,15 @@ frame_double_touch_up(struct frame *frame, void *data, int32_t id);
 void
 frame_repaint(struct frame *frame, cairo_t *cr);
 
+/* Repaints only the title bar area between the buttons */
+void
+frame_repaint_title(struct frame *frame, cairo_t *cr);
+
+uint32_t
+frame_get_flags(struct frame *frame);
+
+/* Hover and press state of all buttons, for telling apart renderings */
+uint32_t
+frame_button_state(struct frame *frame);
+
 #endif
@@ -48,19 +48,72 @@ struct weston_config_entry {
 	char *key;
 	char *value;
 	struct wl_list link;
+
+	uint32_t key_hash;
+	struct weston_config_entry *hash_next;
 };
 
 struct weston_config_section {
 	char *name;
 	struct wl_list entry_list;
 	struct wl_list link;
+
+	uint32_t name_hash;
+	struct weston_config_section *hash_next;
+
+	/* Entries by key, chained in file order; NULL falls back to a scan */
+	struct weston_config_entry **entry_index;
+	uint32_t entry_index_mask;
+	uint64_t content_hash;
 };
 
 struct weston_config {
 	struct wl_list section_list;
+
+	/* Sections by name, chained in file order; NULL falls back to a scan */
+	struct weston_config_section **section_index;
+	uint32_t section_index_mask;
+	uint64_t content_hash;
+
 	char path[PATH_MAX];
 };
 
+#define FNV1A_64_INIT 0xcbf29ce484222325ull
+#define FNV1A_64_PRIME 0x100000001b3ull
+
+static uint64_t
+fnv1a_64(uint64_t hash, const void *data, size_t len)
+{
+	const unsigned char *p = data;
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		hash ^= p[i];
+		hash *= FNV1A_64_PRIME;
+	}
+
+	return hash;
+}
+
+static uint32_t
+config_string_hash(const char *s)
+{
+	uint64_t hash = fnv1a_64(FNV1A_64_INIT, s, strlen(s));
+
+	return hash ^ (hash >> 32);
+}
+
+static uint32_t
+config_index_size(unsigned count)
+{
+	uint32_t size = 4;
+
+	while (size < count)
+		size *= 2;
+
+	return size;
+}
+
 static int
 open_config_file(struct weston_config *c, const char *name)
 {
@@ -119,33 +172,66 @@ config_section_get_entry(struct weston_config_section *section,
 			 const char *key)
 {
 	struct weston_config_entry *e;
+	uint32_t hash;
 
 	if (section == NULL)
 		return NULL;
-	wl_list_for_each(e, &section->entry_list, link)
-		if (strcmp(e->key, key) == 0)
+
+	if (!section->entry_index) {
+		wl_list_for_each(e, &section->entry_list, link)
+			if (strcmp(e->key, key) == 0)
+				return e;
+		return NULL;
+	}
+
+	hash = config_string_hash(key);
+	for (e = section->entry_index[hash & section->entry_index_mask];
+	     e; e = e->hash_next) {
+		if (e->key_hash == hash && strcmp(e->key, key) == 0)
 			return e;
+	}
 
 	return NULL;
 }
 
+static bool
+config_section_matches(struct weston_config_section *s,
+		       const char *key, const char *value)
+{
+	struct weston_config_entry *e;
+
+	if (key == NULL)
+		return true;
+
+	e = config_section_get_entry(s, key);
+	return e && strcmp(e->value, value) == 0;
+}
+
 WL_EXPORT
 struct weston_config_section *
 weston_config_get_section(struct weston_config *config, const char *section,
 			  const char *key, const char *value)
 {
 	struct weston_config_section *s;
-	struct weston_config_entry *e;
+	uint32_t hash;
 
 	if (config == NULL)
 		return NULL;
-	wl_list_for_each(s, &config->section_list, link) {
-		if (strcmp(s->name, section) != 0)
-			continue;
-		if (key == NULL)
-			return s;
-		e = config_section_get_entry(s, key);
-		if (e && strcmp(e->value, value) == 0)
+
+	if (!config->section_index) {
+		wl_list_for_each(s, &config->section_list, link) {
+			if (strcmp(s->name, section) == 0 &&
+			    config_section_matches(s, key, value))
+				return s;
+		}
+		return NULL;
+	}
+
+	hash = config_string_hash(section);
+	for (s = config->section_index[hash & config->section_index_mask];
+	     s; s = s->hash_next) {
+		if (s->name_hash == hash && strcmp(s->name, section) == 0 &&
+		    config_section_matches(s, key, value))
 			return s;
 	}
 
@@ -389,16 +475,190 @@ section_add_entry(struct weston_config_section *section,
 	return entry;
 }
 
+/* Index the sections and their entries by name, keeping the file order
+ * within each chain so that lookups still return the first match. Without
+ * memory for an index the lookups simply scan the lists. */
+static void
+config_build_index(struct weston_config *config)
+{
+	struct weston_config_section *s, **slot;
+	struct weston_config_entry *e, **eslot;
+	unsigned count = 0, entries;
+
+	wl_list_for_each(s, &config->section_list, link) {
+		entries = wl_list_length(&s->entry_list);
+		s->entry_index_mask = config_index_size(entries) - 1;
+		s->entry_index = calloc(s->entry_index_mask + 1,
+					sizeof *s->entry_index);
+		s->content_hash = FNV1A_64_INIT;
+
+		wl_list_for_each(e, &s->entry_list, link) {
+			e->key_hash = config_string_hash(e->key);
+			s->content_hash = fnv1a_64(s->content_hash, e->key,
+						   strlen(e->key) + 1);
+			s->content_hash = fnv1a_64(s->content_hash, e->value,
+						   strlen(e->value) + 1);
+			if (!s->entry_index)
+				continue;
+
+			eslot = &s->entry_index[e->key_hash &
+						s->entry_index_mask];
+			while (*eslot)
+				eslot = &(*eslot)->hash_next;
+			*eslot = e;
+		}
+
+		s->name_hash = config_string_hash(s->name);
+		count++;
+	}
+
+	config->section_index_mask = config_index_size(count) - 1;
+	config->section_index = calloc(config->section_index_mask + 1,
+				       sizeof *config->section_index);
+	if (!config->section_index)
+		return;
+
+	wl_list_for_each(s, &config->section_list, link) {
+		slot = &config->section_index[s->name_hash &
+					      config->section_index_mask];
+		while (*slot)
+			slot = &(*slot)->hash_next;
+		*slot = s;
+	}
+}
+
+static int
+config_parse_line(struct weston_config *config,
+		  struct weston_config_section **section, char *line)
+{
+	char *p;
+	int i;
+
+	switch (line[0]) {
+	case '#':
+	case '\0':
+		return 0;
+	case '[':
+		p = strchr(&line[1], ']');
+		if (!p || p[1] != '\0') {
+			fprintf(stderr, "malformed "
+				"section header: %s\n", line);
+			return -1;
+		}
+		p[0] = '\0';
+		*section = config_add_section(config, &line[1]);
+		return 0;
+	default:
+		p = strchr(line, '=');
+		if (!p || p == line || !*section) {
+			fprintf(stderr, "malformed "
+				"config line: %s\n", line);
+			return -1;
+		}
+
+		p[0] = '\0';
+		p++;
+		while (isspace(*p))
+			p++;
+		i = strlen(p);
+		while (i > 0 && isspace(p[i - 1])) {
+			p[i - 1] = '\0';
+			i--;
+		}
+		section_add_entry(*section, line, p);
+		return 0;
+	}
+}
+
+/* Parses the buffer in place, which must be NUL-terminated. */
+static int
+config_parse_buffer(struct weston_config *config, char *buf)
+{
+	struct weston_config_section *section = NULL;
+	char *line = buf, *nl;
+
+	while (*line) {
+		nl = strchrnul(line, '\n');
+		if (*nl)
+			*nl++ = '\0';
+
+		if (config_parse_line(config, &section, line) < 0)
+			return -1;
+		line = nl;
+	}
+
+	return 0;
+}
+
+/* Reads the whole file in one go instead of a stdio line at a time. The
+ * file is not mapped: it may be truncated by an editor while a reload
+ * reads it, which would fault on a mapping. */
+static int
+config_parse_fd(struct weston_config *config, int fd)
+{
+	struct stat filestat;
+	size_t size, len = 0;
+	ssize_t ret;
+	char *buf;
+	int r;
+
+	if (fstat(fd, &filestat) < 0 ||
+	    !S_ISREG(filestat.st_mode))
+		return -1;
+
+	size = filestat.st_size;
+	buf = malloc(size + 1);
+	if (!buf)
+		return -1;
+
+	while (len < size) {
+		ret = read(fd, buf + len, size - len);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret < 0) {
+			free(buf);
+			return -1;
+		}
+		if (ret == 0)
+			break;
+		len += ret;
+	}
+	buf[len] = '\0';
+
+	config->content_hash = fnv1a_64(FNV1A_64_INIT, buf, len);
+	r = config_parse_buffer(config, buf);
+	free(buf);
+
+	if (r == 0)
+		config_build_index(config);
+
+	return r;
+}
+
+static void
+config_release_sections(struct wl_list *section_list)
+{
+	struct weston_config_section *s, *next_s;
+	struct weston_config_entry *e, *next_e;
+
+	wl_list_for_each_safe(s, next_s, section_list, link) {
+		wl_list_for_each_safe(e, next_e, &s->entry_list, link) {
+			free(e->key);
+			free(e->value);
+			free(e);
+		}
+		free(s->entry_index);
+		free(s->name);
+		free(s);
+	}
+}
+
 WL_EXPORT
 struct weston_config *
 weston_config_parse(const char *name)
 {
-	FILE *fp;
-	char line[512], *p;
-	struct stat filestat;
 	struct weston_config *config;
-	struct weston_config_section *section = NULL;
-	int i, fd;
+	int fd, ret;
 
 	config = zalloc(sizeof *config);
 	if (config == NULL)
@@ -412,63 +672,159 @@ weston_config_parse(const char *name)
 		return NULL;
 	}
 
-	if (fstat(fd, &filestat) < 0 ||
-	    !S_ISREG(filestat.st_mode)) {
-		close(fd);
-		free(config);
+	ret = config_parse_fd(config, fd);
+	close(fd);
+	if (ret < 0) {
+		weston_config_destroy(config);
 		return NULL;
 	}
 
-	fp = fdopen(fd, "r");
-	if (fp == NULL) {
-		free(config);
-		return NULL;
+	return config;
+}
+
+/* The n-th section called name, counting from 0 in file order */
+static struct weston_config_section *
+config_find_nth_section(struct weston_config *config, const char *name,
+			unsigned n)
+{
+	struct weston_config_section *s;
+
+	wl_list_for_each(s, &config->section_list, link) {
+		if (strcmp(s->name, name) == 0 && n-- == 0)
+			return s;
 	}
 
-	while (fgets(line, sizeof line, fp)) {
-		switch (line[0]) {
-		case '#':
-		case '\n':
-			continue;
-		case '[':
-			p = strchr(&line[1], ']');
-			if (!p || p[1] != '\n') {
-				fprintf(stderr, "malformed "
-					"section header: %s\n", line);
-				fclose(fp);
-				weston_config_destroy(config);
-				return NULL;
-			}
-			p[0] = '\0';
-			section = config_add_section(config, &line[1]);
+	return NULL;
+}
+
+static unsigned
+config_section_ordinal(struct weston_config *config,
+		       struct weston_config_section *section)
+{
+	struct weston_config_section *s;
+	unsigned n = 0;
+
+	wl_list_for_each(s, &config->section_list, link) {
+		if (s == section)
+			break;
+		if (strcmp(s->name, section->name) == 0)
+			n++;
+	}
+
+	return n;
+}
+
+static bool
+config_section_equal(struct weston_config_section *a,
+		     struct weston_config_section *b)
+{
+	struct weston_config_entry *ea, *eb;
+
+	if (a->content_hash != b->content_hash)
+		return false;
+
+	eb = container_of(b->entry_list.next, struct weston_config_entry, link);
+	wl_list_for_each(ea, &a->entry_list, link) {
+		if (&eb->link == &b->entry_list ||
+		    strcmp(ea->key, eb->key) != 0 ||
+		    strcmp(ea->value, eb->value) != 0)
+			return false;
+		eb = container_of(eb->link.next,
+				  struct weston_config_entry, link);
+	}
+
+	return &eb->link == &b->entry_list;
+}
+
+/** Read the config file again and report what changed
+ *
+ * The file the config was parsed from is read again. If its contents
+ * differ, the config takes over the new contents, and \a changed is
+ * called for every section that was added, removed or modified. Sections
+ * are matched up by their name and their position among the sections of
+ * the same name. The old section is NULL for an added section and the new
+ * one is NULL for a removed section.
+ *
+ * Section pointers obtained before the reload stay valid until the
+ * callbacks have returned, and are freed afterwards. On failure the
+ * config keeps its previous contents.
+ *
+ * \return the number of sections reported, or -1 on failure.
+ */
+WL_EXPORT
+int
+weston_config_reload(struct weston_config *config,
+		     weston_config_section_changed_func_t changed,
+		     void *data)
+{
+	struct weston_config *next;
+	struct weston_config_section *s, *old;
+	struct weston_config_section **index;
+	struct wl_list old_sections;
+	unsigned n;
+	int fd, count = 0;
+
+	if (config == NULL)
+		return -1;
+
+	next = zalloc(sizeof *next);
+	if (next == NULL)
+		return -1;
+	wl_list_init(&next->section_list);
+
+	fd = open(config->path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0 || config_parse_fd(next, fd) < 0) {
+		if (fd >= 0)
+			close(fd);
+		weston_config_destroy(next);
+		return -1;
+	}
+	close(fd);
+
+	if (next->content_hash == config->content_hash) {
+		weston_config_destroy(next);
+		return 0;
+	}
+
+	/* Swap the contents, keeping the old sections for the callbacks.
+	 * Afterwards next holds the old contents. */
+	wl_list_init(&old_sections);
+	wl_list_insert_list(&old_sections, &config->section_list);
+	wl_list_init(&config->section_list);
+	wl_list_insert_list(&config->section_list, &next->section_list);
+	wl_list_init(&next->section_list);
+	wl_list_insert_list(&next->section_list, &old_sections);
+
+	index = config->section_index;
+	config->section_index = next->section_index;
+	next->section_index = index;
+	n = config->section_index_mask;
+	config->section_index_mask = next->section_index_mask;
+	next->section_index_mask = n;
+	config->content_hash = next->content_hash;
+
+	wl_list_for_each(s, &config->section_list, link) {
+		n = config_section_ordinal(config, s);
+		old = config_find_nth_section(next, s->name, n);
+		if (old && config_section_equal(old, s))
 			continue;
-		default:
-			p = strchr(line, '=');
-			if (!p || p == line || !section) {
-				fprintf(stderr, "malformed "
-					"config line: %s\n", line);
-				fclose(fp);
-				weston_config_destroy(config);
-				return NULL;
-			}
-
-			p[0] = '\0';
-			p++;
-			while (isspace(*p))
-				p++;
-			i = strlen(p);
-			while (i > 0 && isspace(p[i - 1])) {
-				p[i - 1] = '\0';
-				i--;
-			}
-			section_add_entry(section, line, p);
+		if (changed)
+			changed(s->name, old, s, data);
+		count++;
+	}
+
+	wl_list_for_each(old, &next->section_list, link) {
+		n = config_section_ordinal(next, old);
+		if (config_find_nth_section(config, old->name, n))
 			continue;
-		}
+		if (changed)
+			changed(old->name, old, NULL, data);
+		count++;
 	}
 
-	fclose(fp);
+	weston_config_destroy(next);
 
-	return config;
+	return count;
 }
 
 WL_EXPORT
@@ -506,21 +862,10 @@ WL_EXPORT
 void
 weston_config_destroy(struct weston_config *config)
 {
-	struct weston_config_section *s, *next_s;
-	struct weston_config_entry *e, *next_e;
-
 	if (config == NULL)
 		return;
 
-	wl_list_for_each_safe(s, next_s, &config->section_list, link) {
-		wl_list_for_each_safe(e, next_e, &s->entry_list, link) {
-			free(e->key);
-			free(e->value);
-			free(e);
-		}
-		free(s->name);
-		free(s);
-	}
-
+	config_release_sections(&config->section_list);
+	free(config->section_index);
 	free(config);
 }
@@ -27,6 +27,8 @@
 
 #include "config.h"
 
+#include <math.h>
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
@@ -106,6 +108,15 @@ struct frame {
 	struct wl_list buttons;
 	struct wl_list pointers;
 	struct wl_list touches;
+
+	/* Shadow and border as last rendered, painted again as long as the
+	 * size, scale and state are unchanged */
+	struct {
+		cairo_surface_t *surface;
+		int32_t width, height;
+		int scale;
+		uint32_t flags;
+	} border_cache;
 };
 
 static struct frame_button *
@@ -319,6 +330,9 @@ frame_destroy(struct frame *frame)
 	wl_list_for_each_safe(pointer, next_pointer, &frame->pointers, link)
 		frame_pointer_destroy(pointer);
 
+	if (frame->border_cache.surface)
+		cairo_surface_destroy(frame->border_cache.surface);
+
 	free(frame->title);
 	free(frame);
 }
@@ -994,6 +1008,64 @@ frame_double_touch_up(struct frame *frame, void *data, int32_t id)
 	}
 }
 
+/* Paint the shadow and border from the cache, rendering it first if
+ * needed. Only done when cr maps the frame onto whole device pixels at
+ * an integer scale, so that the cached pixels match a direct render. */
+static bool
+frame_paint_cached_border(struct frame *frame, cairo_t *cr, uint32_t flags)
+{
+	cairo_surface_t *surface = frame->border_cache.surface;
+	cairo_matrix_t m;
+	cairo_t *cache_cr;
+	int scale;
+
+	cairo_get_matrix(cr, &m);
+	scale = m.xx;
+	if (scale < 1 || m.xx != scale || m.yy != scale ||
+	    m.xy != 0 || m.yx != 0 ||
+	    m.x0 != floor(m.x0) || m.y0 != floor(m.y0))
+		return false;
+
+	if (!surface ||
+	    frame->border_cache.width != frame->width ||
+	    frame->border_cache.height != frame->height ||
+	    frame->border_cache.scale != scale ||
+	    frame->border_cache.flags != flags) {
+		if (surface)
+			cairo_surface_destroy(surface);
+		frame->border_cache.surface = NULL;
+
+		surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32,
+						     frame->width * scale,
+						     frame->height * scale);
+		cache_cr = cairo_create(surface);
+		cairo_scale(cache_cr, scale, scale);
+		theme_render_frame_border(frame->theme, cache_cr,
+					  frame->width, frame->height, flags);
+		cairo_destroy(cache_cr);
+
+		if (cairo_surface_status(surface) != CAIRO_STATUS_SUCCESS) {
+			cairo_surface_destroy(surface);
+			return false;
+		}
+
+		frame->border_cache.surface = surface;
+		frame->border_cache.width = frame->width;
+		frame->border_cache.height = frame->height;
+		frame->border_cache.scale = scale;
+		frame->border_cache.flags = flags;
+	}
+
+	cairo_save(cr);
+	cairo_scale(cr, 1.0 / scale, 1.0 / scale);
+	cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
+	cairo_set_source_surface(cr, surface, 0, 0);
+	cairo_paint(cr);
+	cairo_restore(cr);
+
+	return true;
+}
+
 void
 frame_repaint(struct frame *frame, cairo_t *cr)
 {
@@ -1008,10 +1080,19 @@ frame_repaint(struct frame *frame, cairo_t *cr)
 	if (frame->flags & FRAME_FLAG_ACTIVE)
 		flags |= THEME_FRAME_ACTIVE;
 
+	if (!frame->title && wl_list_empty(&frame->buttons))
+		flags |= THEME_FRAME_NO_TITLE;
+
+	/* Button hover, title changes and the Wayland backend painting its
+	 * border in four strips all reuse the same shadow and border. */
 	cairo_save(cr);
-	theme_render_frame(frame->theme, cr, frame->width, frame->height,
-			   frame->title, &frame->title_rect,
-			   &frame->buttons, flags);
+	if (!frame_paint_cached_border(frame, cr, flags))
+		theme_render_frame_border(frame->theme, cr,
+					  frame->width, frame->height, flags);
+	if (!(flags & THEME_FRAME_NO_TITLE))
+		theme_render_frame_title(frame->theme, cr, frame->width,
+					 frame->title, &frame->title_rect,
+					 flags);
 	cairo_restore(cr);
 
 	wl_list_for_each(button, &frame->buttons, link)
@@ -1019,3 +1100,40 @@ frame_repaint(struct frame *frame, cairo_t *cr)
 
 	frame_status_clear(frame, FRAME_STATUS_REPAINT);
 }
+
+void
+frame_repaint_title(struct frame *frame, cairo_t *cr)
+{
+	frame_refresh_geometry(frame);
+
+	cairo_save(cr);
+	cairo_rectangle(cr, frame->title_rect.x, frame->title_rect.y,
+			frame->title_rect.width, frame->title_rect.height);
+	cairo_clip(cr);
+	frame_repaint(frame, cr);
+	cairo_restore(cr);
+}
+
+uint32_t
+frame_get_flags(struct frame *frame)
+{
+	return frame->flags;
+}
+
+uint32_t
+frame_button_state(struct frame *frame)
+{
+	struct frame_button *button;
+	uint32_t state = 0;
+	int i = 0;
+
+	wl_list_for_each(button, &frame->buttons, link) {
+		if (button->hover_count)
+			state |= 1u << i;
+		if (button->press_count)
+			state |= 2u << i;
+		i = (i + 2) % 32;
+	}
+
+	return state;
+}
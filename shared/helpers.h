@@ -117,6 +117,21 @@ do { \
 	(type *)( (char *)__mptr - offsetof(type,member) );})
 #endif
 
+/**
+ * The most strictly aligned basic types, as a union.
+ *
+ * Stands in for C11's max_align_t, which the gnu99 build does not have:
+ * memory aligned for this union can hold any of them.
+ */
+union weston_max_align {
+	long long ll;
+	long double ld;
+	void *p;
+};
+
+/** Alignment of union weston_max_align, a power of two. */
+#define WESTON_MAX_ALIGN __alignof__(union weston_max_align)
+
 /**
  * Build-time static assertion support
  *
@@ -27,6 +27,7 @@
 #include "config.h"
 
 #include <float.h>
+#include <stdbool.h>
 #include <string.h>
 #include <stdlib.h>
 #include <math.h>
@@ -39,6 +40,10 @@
 
 #include <libweston/matrix.h>
 
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
 
 /*
  * Matrices are stored in column-major order, that is the array indices are:
@@ -46,8 +51,23 @@
  *  1  5  9 13
  *  2  6 10 14
  *  3  7 11 15
+ *
+ * The type tracks which kinds of transformation have been multiplied in,
+ * 0 being the identity. Matrices built only from translations and scales
+ * have nothing but the diagonal and the last column set, which the
+ * functions below take advantage of; the type must therefore be accurate,
+ * set it to WESTON_MATRIX_TRANSFORM_OTHER after filling in d by hand.
  */
 
+#define MATRIX_TYPE_SCALE_TRANSLATE \
+	(WESTON_MATRIX_TRANSFORM_SCALE | WESTON_MATRIX_TRANSFORM_TRANSLATE)
+
+static inline bool
+matrix_is_scale_translate(const struct weston_matrix *matrix)
+{
+	return (matrix->type & ~MATRIX_TYPE_SCALE_TRANSLATE) == 0;
+}
+
 WL_EXPORT void
 weston_matrix_init(struct weston_matrix *matrix)
 {
@@ -59,23 +79,67 @@ weston_matrix_init(struct weston_matrix *matrix)
 	memcpy(matrix, &identity, sizeof identity);
 }
 
-/* m <- n * m, that is, m is multiplied on the LEFT. */
-WL_EXPORT void
-weston_matrix_multiply(struct weston_matrix *m, const struct weston_matrix *n)
+#if defined(__ARM_NEON)
+static void
+matrix_multiply_full(struct weston_matrix *tmp, const struct weston_matrix *m,
+		     const struct weston_matrix *n)
+{
+	float32x4_t n0 = vld1q_f32(&n->d[0]);
+	float32x4_t n1 = vld1q_f32(&n->d[4]);
+	float32x4_t n2 = vld1q_f32(&n->d[8]);
+	float32x4_t n3 = vld1q_f32(&n->d[12]);
+	float32x4_t col;
+	int i;
+
+	/* Column i of the result is n applied to column i of m. */
+	for (i = 0; i < 16; i += 4) {
+		col = vmulq_n_f32(n0, m->d[i + 0]);
+		col = vmlaq_n_f32(col, n1, m->d[i + 1]);
+		col = vmlaq_n_f32(col, n2, m->d[i + 2]);
+		col = vmlaq_n_f32(col, n3, m->d[i + 3]);
+		vst1q_f32(&tmp->d[i], col);
+	}
+}
+#else
+static void
+matrix_multiply_full(struct weston_matrix *tmp, const struct weston_matrix *m,
+		     const struct weston_matrix *n)
 {
-	struct weston_matrix tmp;
 	const float *row, *column;
 	div_t d;
 	int i, j;
 
 	for (i = 0; i < 16; i++) {
-		tmp.d[i] = 0;
+		tmp->d[i] = 0;
 		d = div(i, 4);
 		row = m->d + d.quot * 4;
 		column = n->d + d.rem;
 		for (j = 0; j < 4; j++)
-			tmp.d[i] += row[j] * column[j * 4];
+			tmp->d[i] += row[j] * column[j * 4];
+	}
+}
+#endif
+
+/* m <- n * m, that is, m is multiplied on the LEFT. */
+WL_EXPORT void
+weston_matrix_multiply(struct weston_matrix *m, const struct weston_matrix *n)
+{
+	struct weston_matrix tmp;
+
+	if (matrix_is_scale_translate(m) && matrix_is_scale_translate(n)) {
+		/* Scales multiply, and n scales m's translation before
+		 * adding its own. */
+		m->d[12] = n->d[0] * m->d[12] + n->d[12];
+		m->d[13] = n->d[5] * m->d[13] + n->d[13];
+		m->d[14] = n->d[10] * m->d[14] + n->d[14];
+		m->d[0] *= n->d[0];
+		m->d[5] *= n->d[5];
+		m->d[10] *= n->d[10];
+		m->type |= n->type;
+		return;
 	}
+
+	matrix_multiply_full(&tmp, m, n);
 	tmp.type = m->type | n->type;
 	memcpy(m, &tmp, sizeof tmp);
 }
@@ -117,16 +181,46 @@ weston_matrix_rotate_xy(struct weston_matrix *matrix, float cos, float sin)
 WL_EXPORT void
 weston_matrix_transform(struct weston_matrix *matrix, struct weston_vector *v)
 {
-	int i, j;
+	const float *d = matrix->d;
+	float w = v->f[3];
+#if defined(__ARM_NEON)
+	float32x4_t t;
+#else
 	struct weston_vector t;
+	int i, j;
+#endif
 
+	switch (matrix->type) {
+	case 0:
+		return;
+	case WESTON_MATRIX_TRANSFORM_TRANSLATE:
+		v->f[0] += d[12] * w;
+		v->f[1] += d[13] * w;
+		v->f[2] += d[14] * w;
+		return;
+	case WESTON_MATRIX_TRANSFORM_SCALE:
+	case MATRIX_TYPE_SCALE_TRANSLATE:
+		v->f[0] = v->f[0] * d[0] + d[12] * w;
+		v->f[1] = v->f[1] * d[5] + d[13] * w;
+		v->f[2] = v->f[2] * d[10] + d[14] * w;
+		return;
+	}
+
+#if defined(__ARM_NEON)
+	t = vmulq_n_f32(vld1q_f32(&d[0]), v->f[0]);
+	t = vmlaq_n_f32(t, vld1q_f32(&d[4]), v->f[1]);
+	t = vmlaq_n_f32(t, vld1q_f32(&d[8]), v->f[2]);
+	t = vmlaq_n_f32(t, vld1q_f32(&d[12]), w);
+	vst1q_f32(v->f, t);
+#else
 	for (i = 0; i < 4; i++) {
 		t.f[i] = 0;
 		for (j = 0; j < 4; j++)
-			t.f[i] += v->f[j] * matrix->d[i + j * 4];
+			t.f[i] += v->f[j] * d[i + j * 4];
 	}
 
 	*v = t;
+#endif
 }
 
 static inline void
@@ -256,6 +350,29 @@ inverse_transform(const double *LU, const unsigned *p, float *v)
 		v[j] = b[j];
 }
 
+/* The inverse of a scale s followed by a translation t scales by 1/s and
+ * translates by -t/s, computed in double like the general path. */
+static int
+matrix_invert_scale_translate(struct weston_matrix *inverse,
+			      const struct weston_matrix *matrix)
+{
+	double scale[3];
+	unsigned i;
+
+	for (i = 0; i < 3; i++) {
+		scale[i] = matrix->d[i * 5];
+		if (fabs(scale[i]) < 1e-9)
+			return -1; /* zero pivot, not invertible */
+	}
+
+	for (i = 0; i < 3; i++) {
+		inverse->d[i * 5] = 1.0 / scale[i];
+		inverse->d[12 + i] = -matrix->d[12 + i] / scale[i];
+	}
+
+	return 0;
+}
+
 WL_EXPORT int
 weston_matrix_invert(struct weston_matrix *inverse,
 		     const struct weston_matrix *matrix)
@@ -264,6 +381,18 @@ weston_matrix_invert(struct weston_matrix *inverse,
 	unsigned perm[4];	/* permutation */
 	unsigned c;
 
+	if (matrix_is_scale_translate(matrix)) {
+		struct weston_matrix tmp;
+
+		weston_matrix_init(&tmp);
+		if (matrix_invert_scale_translate(&tmp, matrix) < 0)
+			return -1;
+		tmp.type = matrix->type;
+		memcpy(inverse, &tmp, sizeof tmp);
+
+		return 0;
+	}
+
 	if (matrix_invert(LU, perm, matrix) < 0)
 		return -1;
 
@@ -0,0 +1,181 @@
+/*
+ * Copyright © 2022 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+
+#include "shared/helpers.h"
+#include "shared/timespec-util.h"
+#include "weston-test-client-helper.h"
+#include "presentation-time-client-protocol.h"
+#include "weston-commit-timing-client-protocol.h"
+#include "weston-test-fixture-compositor.h"
+
+static enum test_result_code
+fixture_setup(struct weston_test_harness *harness)
+{
+	struct compositor_setup setup;
+
+	compositor_setup_defaults(&setup);
+
+	return weston_test_harness_execute_as_client(harness, &setup);
+}
+DECLARE_FIXTURE_SETUP(fixture_setup);
+
+struct presented {
+	bool done;
+	struct timespec time;
+	uint32_t refresh_nsec;
+};
+
+static void
+feedback_sync_output(void *data,
+		     struct wp_presentation_feedback *feedback,
+		     struct wl_output *output)
+{
+}
+
+static void
+feedback_presented(void *data,
+		   struct wp_presentation_feedback *feedback,
+		   uint32_t tv_sec_hi, uint32_t tv_sec_lo, uint32_t tv_nsec,
+		   uint32_t refresh_nsec, uint32_t seq_hi, uint32_t seq_lo,
+		   uint32_t flags)
+{
+	struct presented *p = data;
+
+	timespec_from_proto(&p->time, tv_sec_hi, tv_sec_lo, tv_nsec);
+	p->refresh_nsec = refresh_nsec;
+	p->done = true;
+}
+
+static void
+feedback_discarded(void *data, struct wp_presentation_feedback *feedback)
+{
+	assert(0 && "feedback discarded");
+}
+
+static const struct wp_presentation_feedback_listener feedback_listener = {
+	feedback_sync_output,
+	feedback_presented,
+	feedback_discarded
+};
+
+static void
+presentation_clock_id(void *data, struct wp_presentation *pres,
+		      uint32_t clk_id)
+{
+	clockid_t *clock = data;
+
+	*clock = clk_id;
+}
+
+static const struct wp_presentation_listener presentation_listener = {
+	presentation_clock_id
+};
+
+TEST(commit_with_timestamp_is_held_until_target)
+{
+	struct client *client;
+	struct wp_presentation *pres;
+	struct wp_presentation_feedback *feedback;
+	struct weston_commit_timing_v1 *timing;
+	struct weston_commit_timer_v1 *timer;
+	struct wl_surface *surface;
+	struct presented presented = {};
+	clockid_t clock = -1;
+	struct timespec target;
+	int64_t early_nsec;
+
+	client = create_client_and_test_surface(100, 50, 100, 100);
+	assert(client);
+	surface = client->surface->wl_surface;
+
+	pres = bind_to_singleton_global(client, &wp_presentation_interface, 1);
+	wp_presentation_add_listener(pres, &presentation_listener, &clock);
+	timing = bind_to_singleton_global(client,
+					  &weston_commit_timing_v1_interface, 1);
+	timer = weston_commit_timing_v1_get_timer(timing, surface);
+	client_roundtrip(client);
+	assert(clock != (clockid_t)-1);
+
+	clock_gettime(clock, &target);
+	timespec_add_msec(&target, &target, 100);
+
+	wl_surface_attach(surface, client->surface->buffer->proxy, 0, 0);
+	wl_surface_damage(surface, 0, 0, 100, 100);
+	feedback = wp_presentation_feedback(pres, surface);
+	wp_presentation_feedback_add_listener(feedback, &feedback_listener,
+					      &presented);
+	weston_commit_timer_v1_set_timestamp(timer,
+					     (uint64_t)target.tv_sec >> 32,
+					     target.tv_sec & 0xffffffff,
+					     target.tv_nsec);
+	wl_surface_commit(surface);
+
+	while (!presented.done)
+		assert(wl_display_dispatch(client->wl_display) >= 0);
+
+	/* Presented in the refresh closest to the target, not before. */
+	early_nsec = timespec_sub_to_nsec(&target, &presented.time);
+	testlog("presented %" PRId64 " ns before the target, refresh %u ns\n",
+		early_nsec, presented.refresh_nsec);
+	assert(early_nsec <= (int64_t)presented.refresh_nsec);
+
+	wp_presentation_feedback_destroy(feedback);
+	weston_commit_timer_v1_destroy(timer);
+	weston_commit_timing_v1_destroy(timing);
+	wp_presentation_destroy(pres);
+	client_destroy(client);
+}
+
+TEST(second_target_for_a_commit_is_an_error)
+{
+	struct client *client;
+	struct weston_commit_timing_v1 *timing;
+	struct weston_commit_timer_v1 *timer;
+
+	client = create_client_and_test_surface(100, 50, 100, 100);
+	assert(client);
+
+	timing = bind_to_singleton_global(client,
+					  &weston_commit_timing_v1_interface, 1);
+	timer = weston_commit_timing_v1_get_timer(timing,
+						  client->surface->wl_surface);
+	weston_commit_timer_v1_set_target_msc(timer, 0, 1);
+	weston_commit_timer_v1_set_target_msc(timer, 0, 2);
+
+	expect_protocol_error(client, &weston_commit_timer_v1_interface,
+			      WESTON_COMMIT_TIMER_V1_ERROR_TIMESTAMP_EXISTS);
+
+	client_destroy(client);
+}
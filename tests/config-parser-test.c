@@ -31,6 +31,7 @@
 #include <string.h>
 #include <assert.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <unistd.h>
 
 #include <libweston/config-parser.h>
@@ -630,3 +631,110 @@ ZUC_TEST(config_test, section_from_null)
 	section = weston_config_get_section(NULL, "bucket", NULL, NULL);
 	ZUC_ASSERT_NULL(section);
 }
+
+struct reload_changes {
+	int count;
+	char names[8][32];
+	bool added[8];
+	bool removed[8];
+};
+
+static void
+record_change(const char *name, struct weston_config_section *old_section,
+	      struct weston_config_section *new_section, void *data)
+{
+	struct reload_changes *changes = data;
+
+	if (changes->count >= (int)ARRAY_LENGTH(changes->names))
+		return;
+
+	snprintf(changes->names[changes->count],
+		 sizeof changes->names[changes->count], "%s", name);
+	changes->added[changes->count] = old_section == NULL;
+	changes->removed[changes->count] = new_section == NULL;
+	changes->count++;
+}
+
+static int
+write_config(const char *file, const char *text)
+{
+	int len;
+	int fd;
+
+	fd = open(file, O_WRONLY | O_TRUNC | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+
+	len = write(fd, text, strlen(text));
+	close(fd);
+
+	return len == (int)strlen(text) ? 0 : -1;
+}
+
+ZUC_TEST(config_test, reload_reports_changed_sections)
+{
+	struct weston_config *config = NULL;
+	struct weston_config_section *section;
+	struct reload_changes changes = { 0 };
+	char file[] = "/tmp/weston-config-parser-test-XXXXXX";
+	char *s = NULL;
+	int fd;
+	int r;
+
+	fd = mkstemp(file);
+	ZUC_ASSERT_NE(-1, fd);
+	close(fd);
+
+	ZUC_ASSERTG_EQ(0, write_config(file,
+				       "[foo]\n"
+				       "a=b\n"
+				       "[bucket]\n"
+				       "color=blue\n"
+				       "[bucket]\n"
+				       "color=red\n"
+				       "[gone]\n"
+				       "soon=true\n"), out);
+	config = weston_config_parse(file);
+	ZUC_ASSERTG_NOT_NULL(config, out);
+
+	/* Nothing changed on disk */
+	r = weston_config_reload(config, record_change, &changes);
+	ZUC_ASSERTG_EQ(0, r, out);
+	ZUC_ASSERTG_EQ(0, changes.count, out);
+
+	ZUC_ASSERTG_EQ(0, write_config(file,
+				       "[foo]\n"
+				       "a=b\n"
+				       "[bucket]\n"
+				       "color=blue\n"
+				       "[bucket]\n"
+				       "color=green\n"
+				       "[new]\n"
+				       "x=y"), out);
+	r = weston_config_reload(config, record_change, &changes);
+	ZUC_ASSERTG_EQ(3, r, out);
+	ZUC_ASSERTG_EQ(3, changes.count, out);
+
+	ZUC_ASSERTG_STREQ("bucket", changes.names[0], out);
+	ZUC_ASSERTG_FALSE(changes.added[0], out);
+	ZUC_ASSERTG_FALSE(changes.removed[0], out);
+	ZUC_ASSERTG_STREQ("new", changes.names[1], out);
+	ZUC_ASSERTG_TRUE(changes.added[1], out);
+	ZUC_ASSERTG_STREQ("gone", changes.names[2], out);
+	ZUC_ASSERTG_TRUE(changes.removed[2], out);
+
+	/* Lookups see the new contents */
+	section = weston_config_get_section(config, "bucket", "color", "green");
+	ZUC_ASSERTG_NOT_NULL(section, out);
+	section = weston_config_get_section(config, "gone", NULL, NULL);
+	ZUC_ASSERTG_NULL(section, out);
+	section = weston_config_get_section(config, "new", NULL, NULL);
+	r = weston_config_section_get_string(section, "x", &s, NULL);
+	ZUC_ASSERTG_EQ(0, r, out);
+	ZUC_ASSERTG_STREQ("y", s, out);
+
+out:
+	free(s);
+	weston_config_destroy(config);
+	unlink(file);
+}
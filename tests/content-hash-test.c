@@ -0,0 +1,143 @@
+/*
+ * Copyright © 2022 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "weston-test-runner.h"
+
+#include "content-hash.h"
+
+#define WIDTH 200
+#define HEIGHT 130
+#define STRIDE (WIDTH * 4 + 16)
+#define FORMAT 1
+
+static uint8_t *
+create_pixels(void)
+{
+	uint8_t *pixels = malloc(STRIDE * HEIGHT);
+	int i;
+
+	assert(pixels);
+	for (i = 0; i < STRIDE * HEIGHT; i++)
+		pixels[i] = i * 7;
+
+	return pixels;
+}
+
+static bool
+update(struct weston_content_hash *hash, const uint8_t *pixels,
+       int x, int y, int w, int h)
+{
+	pixman_region32_t damage;
+	bool changed;
+
+	pixman_region32_init_rect(&damage, x, y, w, h);
+	changed = weston_content_hash_update(hash, pixels, WIDTH, HEIGHT,
+					     STRIDE, FORMAT, 4, &damage);
+	pixman_region32_fini(&damage);
+
+	return changed;
+}
+
+TEST(content_hash_sees_changes_under_damage_only)
+{
+	struct weston_content_hash hash = { 0 };
+	uint8_t *pixels = create_pixels();
+
+	/* The first buffer always counts as new. */
+	assert(update(&hash, pixels, 0, 0, WIDTH, HEIGHT));
+	assert(!update(&hash, pixels, 0, 0, WIDTH, HEIGHT));
+	assert(!update(&hash, pixels, 10, 10, 5, 5));
+
+	/* A changed pixel under the damage is found... */
+	pixels[150 * 4 + 100 * STRIDE] ^= 0x01;
+	assert(update(&hash, pixels, 140, 90, 20, 20));
+	assert(!update(&hash, pixels, 140, 90, 20, 20));
+
+	/* ...also in the last partial tile... */
+	pixels[(WIDTH - 1) * 4 + 3 + (HEIGHT - 1) * STRIDE] ^= 0x80;
+	assert(update(&hash, pixels, WIDTH - 1, HEIGHT - 1, 1, 1));
+
+	/* ...but the stride padding is not content. */
+	pixels[WIDTH * 4 + 5 * STRIDE] ^= 0xff;
+	assert(!update(&hash, pixels, 0, 0, WIDTH, HEIGHT));
+
+	/* An uncovered tile is not looked at. */
+	pixels[4 + 4 * STRIDE] ^= 0x10;
+	assert(!update(&hash, pixels, 100, 100, 10, 10));
+
+	/* Damage outside of the buffer is ignored. */
+	assert(!update(&hash, pixels, WIDTH + 10, 0, 10, 10));
+
+	weston_content_hash_fini(&hash);
+	free(pixels);
+}
+
+TEST(content_hash_restarts_for_another_buffer_layout)
+{
+	struct weston_content_hash hash = { 0 };
+	uint8_t *pixels = create_pixels();
+	pixman_region32_t damage;
+
+	assert(update(&hash, pixels, 0, 0, WIDTH, HEIGHT));
+
+	pixman_region32_init_rect(&damage, 0, 0, 10, 10);
+	assert(weston_content_hash_update(&hash, pixels, WIDTH - 1, HEIGHT,
+					  STRIDE, FORMAT, 4, &damage));
+	assert(weston_content_hash_update(&hash, pixels, WIDTH - 1, HEIGHT,
+					  STRIDE, FORMAT + 1, 4, &damage));
+	assert(!weston_content_hash_update(&hash, pixels, WIDTH - 1, HEIGHT,
+					   STRIDE, FORMAT + 1, 4, &damage));
+	pixman_region32_fini(&damage);
+
+	weston_content_hash_fini(&hash);
+	free(pixels);
+}
+
+TEST(content_hash_bytes_depends_on_every_byte)
+{
+	uint8_t data[77];
+	uint64_t ref;
+	unsigned int i;
+
+	for (i = 0; i < sizeof data; i++)
+		data[i] = i;
+	ref = weston_content_hash_bytes(0, data, sizeof data);
+
+	for (i = 0; i < sizeof data; i++) {
+		data[i] ^= 0x04;
+		assert(weston_content_hash_bytes(0, data, sizeof data) != ref);
+		data[i] ^= 0x04;
+	}
+
+	assert(weston_content_hash_bytes(0, data, sizeof data) == ref);
+	assert(weston_content_hash_bytes(0, data, sizeof data - 1) != ref);
+}
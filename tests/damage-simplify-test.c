@@ -0,0 +1,135 @@
+/*
+ * Copyright © 2022 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "weston-test-runner.h"
+
+#include "damage-simplify.h"
+
+static bool
+region_contains(pixman_region32_t *outer, pixman_region32_t *inner)
+{
+	pixman_region32_t rest;
+	bool contained;
+
+	pixman_region32_init(&rest);
+	pixman_region32_subtract(&rest, inner, outer);
+	contained = !pixman_region32_not_empty(&rest);
+	pixman_region32_fini(&rest);
+
+	return contained;
+}
+
+static int64_t
+region_area(pixman_region32_t *region)
+{
+	pixman_box32_t *rects;
+	int64_t area = 0;
+	int i, n;
+
+	rects = pixman_region32_rectangles(region, &n);
+	for (i = 0; i < n; i++)
+		area += (int64_t) (rects[i].x2 - rects[i].x1) *
+			(rects[i].y2 - rects[i].y1);
+
+	return area;
+}
+
+/* A 10x10 grid of 4x4 boxes, 8 pixels apart. */
+static void
+init_grid(pixman_region32_t *region)
+{
+	int x, y;
+
+	pixman_region32_init(region);
+	for (y = 0; y < 10; y++)
+		for (x = 0; x < 10; x++)
+			pixman_region32_union_rect(region, region,
+						   x * 8, y * 8, 4, 4);
+}
+
+TEST(region_simplify_zero_keeps_the_region)
+{
+	pixman_region32_t region, orig;
+
+	init_grid(&region);
+	init_grid(&orig);
+
+	weston_region_simplify(&region, 0);
+	assert(pixman_region32_equal(&region, &orig));
+
+	pixman_region32_fini(&region);
+	pixman_region32_fini(&orig);
+}
+
+TEST(region_simplify_merges_within_budget)
+{
+	pixman_region32_t region, orig;
+	int n_before, n_after;
+
+	init_grid(&region);
+	init_grid(&orig);
+	pixman_region32_rectangles(&orig, &n_before);
+
+	/* Joining two neighbours costs 16 pixels, so a budget of 15
+	 * changes nothing and a huge one gives the bounding box. */
+	weston_region_simplify(&region, 15);
+	assert(pixman_region32_equal(&region, &orig));
+
+	weston_region_simplify(&region, 100);
+	pixman_region32_rectangles(&region, &n_after);
+	assert(n_after < n_before);
+	assert(region_contains(&region, &orig));
+	assert(region_area(&region) < 76 * 76);
+
+	weston_region_simplify(&region, 1 << 20);
+	pixman_region32_rectangles(&region, &n_after);
+	assert(n_after == 1);
+	assert(region_area(&region) == 76 * 76);
+
+	pixman_region32_fini(&region);
+	pixman_region32_fini(&orig);
+}
+
+TEST(region_simplify_keeps_distant_boxes_apart)
+{
+	pixman_region32_t region, orig;
+
+	pixman_region32_init_rect(&region, 0, 0, 10, 10);
+	pixman_region32_union_rect(&region, &region, 1000, 1000, 10, 10);
+	pixman_region32_init(&orig);
+	pixman_region32_copy(&orig, &region);
+
+	weston_region_simplify(&region, 4096);
+	assert(pixman_region32_equal(&region, &orig));
+
+	pixman_region32_fini(&region);
+	pixman_region32_fini(&orig);
+}
@@ -26,10 +26,13 @@
 #include "config.h"
 
 #include <assert.h>
+#include <inttypes.h>
+#include <time.h>
 
 #include <libweston/libweston.h>
 #include <libweston-internal.h>
 #include "shared/weston-drm-fourcc.h"
+#include "shared/timespec-util.h"
 
 #include "weston-test-client-helper.h"
 #include "weston-test-fixture-compositor.h"
@@ -570,3 +573,162 @@ TEST(subtract_arrays_modifier_invalid)
         weston_drm_format_array_fini(&format_array_A);
         weston_drm_format_array_fini(&format_array_B);
 }
+
+/* Big enough for both the formats and the modifier sets to be hash indexed. */
+#define LARGE_NUM_FORMATS 64
+#define LARGE_NUM_MODIFIERS 32
+
+static void
+add_large_set(struct weston_drm_format_array *formats, uint32_t format_base,
+              uint64_t modifier_base)
+{
+        struct weston_drm_format *fmt;
+        unsigned int i, j;
+        int ret;
+
+        for (i = 0; i < LARGE_NUM_FORMATS; i++) {
+                fmt = weston_drm_format_array_add_format(formats,
+                                                         format_base + i);
+                assert(fmt);
+                /* Spread the modifiers over the vendor bits, as real
+                 * modifiers mostly differ in their upper byte. */
+                for (j = 0; j < LARGE_NUM_MODIFIERS; j++) {
+                        ret = weston_drm_format_add_modifier(fmt,
+                                        modifier_base + ((uint64_t)j << 56) + j);
+                        assert(ret == 0);
+                }
+        }
+}
+
+TEST(large_array_operations)
+{
+        struct weston_drm_format_array format_array_A, format_array_B;
+        struct weston_drm_format *fmt;
+        unsigned int i, j;
+        int ret;
+
+        weston_drm_format_array_init(&format_array_A);
+        weston_drm_format_array_init(&format_array_B);
+
+        add_large_set(&format_array_A, 100, 0);
+
+        for (i = 0; i < LARGE_NUM_FORMATS; i++) {
+                fmt = weston_drm_format_array_find_format(&format_array_A, 100 + i);
+                assert(fmt && fmt->format == 100 + i);
+                for (j = 0; j < LARGE_NUM_MODIFIERS; j++)
+                        assert(weston_drm_format_has_modifier(fmt,
+                                        ((uint64_t)j << 56) + j));
+                assert(!weston_drm_format_has_modifier(fmt, 1ULL << 55));
+        }
+        assert(!weston_drm_format_array_find_format(&format_array_A, 99));
+        assert(!weston_drm_format_array_find_format(&format_array_A,
+                                                    100 + LARGE_NUM_FORMATS));
+
+        /* Removing the latest formats must drop them from the lookup. */
+        weston_drm_format_array_remove_latest_format(&format_array_A);
+        weston_drm_format_array_remove_latest_format(&format_array_A);
+        assert(!weston_drm_format_array_find_format(&format_array_A,
+                                                    100 + LARGE_NUM_FORMATS - 1));
+        assert(!weston_drm_format_array_find_format(&format_array_A,
+                                                    100 + LARGE_NUM_FORMATS - 2));
+        assert(weston_drm_format_array_find_format(&format_array_A,
+                                                   100 + LARGE_NUM_FORMATS - 3));
+
+        /* Replace, join and subtract keep the lookups consistent. */
+        ret = weston_drm_format_array_replace(&format_array_B, &format_array_A);
+        assert(ret == 0);
+        assert(weston_drm_format_array_equal(&format_array_A, &format_array_B));
+
+        ret = weston_drm_format_array_join(&format_array_B, &format_array_A);
+        assert(ret == 0);
+        assert(weston_drm_format_array_equal(&format_array_A, &format_array_B));
+
+        ret = weston_drm_format_array_subtract(&format_array_B, &format_array_A);
+        assert(ret == 0);
+        assert(format_array_B.arr.size == 0);
+
+        weston_drm_format_array_fini(&format_array_A);
+        weston_drm_format_array_fini(&format_array_B);
+}
+
+TEST(large_array_intersect)
+{
+        struct weston_drm_format_array format_array_A, format_array_B;
+        int ret;
+
+        weston_drm_format_array_init(&format_array_A);
+        weston_drm_format_array_init(&format_array_B);
+
+        /* Half of the formats overlap, and all of their modifiers do. */
+        add_large_set(&format_array_A, 0, 0);
+        add_large_set(&format_array_B, LARGE_NUM_FORMATS / 2, 0);
+
+        ret = weston_drm_format_array_intersect(&format_array_A, &format_array_B);
+        assert(ret == 0);
+        assert(weston_drm_format_array_count_pairs(&format_array_A) ==
+               (LARGE_NUM_FORMATS / 2) * LARGE_NUM_MODIFIERS);
+        assert(!weston_drm_format_array_find_format(&format_array_A, 0));
+        assert(weston_drm_format_array_find_format(&format_array_A,
+                                                   LARGE_NUM_FORMATS - 1));
+
+        weston_drm_format_array_fini(&format_array_A);
+        weston_drm_format_array_fini(&format_array_B);
+}
+
+/* Not a pass/fail test: logs how long the lookups take, so that regressions
+ * in the per-plane, per-view checks are visible in the test log. */
+TEST(lookup_throughput)
+{
+        struct weston_drm_format_array format_array;
+        struct weston_drm_format *fmt;
+        struct timespec begin, end;
+        const unsigned int rounds = 1000;
+        unsigned int found = 0;
+        unsigned int i, j, r;
+        int64_t nsec;
+
+        weston_drm_format_array_init(&format_array);
+        add_large_set(&format_array, 0, 0);
+
+        clock_gettime(CLOCK_MONOTONIC, &begin);
+        for (r = 0; r < rounds; r++) {
+                for (i = 0; i < LARGE_NUM_FORMATS * 2; i++) {
+                        fmt = weston_drm_format_array_find_format(&format_array, i);
+                        if (!fmt)
+                                continue;
+                        for (j = 0; j < LARGE_NUM_MODIFIERS * 2; j++)
+                                found += weston_drm_format_has_modifier(fmt,
+                                                ((uint64_t)j << 56) + j);
+                }
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        assert(found == rounds * LARGE_NUM_FORMATS * LARGE_NUM_MODIFIERS);
+
+        nsec = timespec_sub_to_nsec(&end, &begin);
+        testlog("%u format lookups and %u modifier lookups in %" PRId64 " us\n",
+                rounds * LARGE_NUM_FORMATS * 2,
+                rounds * LARGE_NUM_FORMATS * LARGE_NUM_MODIFIERS * 2,
+                nsec / 1000);
+
+        clock_gettime(CLOCK_MONOTONIC, &begin);
+        for (r = 0; r < rounds / 10; r++) {
+                struct weston_drm_format_array copy;
+                int ret;
+
+                weston_drm_format_array_init(&copy);
+                ret = weston_drm_format_array_replace(&copy, &format_array);
+                assert(ret == 0);
+                ret = weston_drm_format_array_intersect(&copy, &format_array);
+                assert(ret == 0);
+                weston_drm_format_array_fini(&copy);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        nsec = timespec_sub_to_nsec(&end, &begin);
+        testlog("%u replace+intersect of %u pairs in %" PRId64 " us\n",
+                rounds / 10, LARGE_NUM_FORMATS * LARGE_NUM_MODIFIERS,
+                nsec / 1000);
+
+        weston_drm_format_array_fini(&format_array);
+}
@@ -0,0 +1,117 @@
+/*
+ * Copyright © 2022 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "weston-test-runner.h"
+
+#include "shared/helpers.h"
+#include "frame-arena.h"
+
+static const size_t sizes[] = { 1, 7, 16, 100, 333, 4096, 5000, 24 };
+
+static void
+fill_frame(struct weston_frame_arena *arena, unsigned char **ptrs)
+{
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_LENGTH(sizes); i++) {
+		ptrs[i] = weston_frame_arena_alloc(arena, sizes[i]);
+		assert(ptrs[i]);
+		assert((uintptr_t) ptrs[i] % WESTON_MAX_ALIGN == 0);
+		memset(ptrs[i], i + 1, sizes[i]);
+	}
+
+	/* Nothing handed out overlaps. */
+	for (i = 0; i < ARRAY_LENGTH(sizes); i++) {
+		assert(ptrs[i][0] == i + 1);
+		assert(ptrs[i][sizes[i] - 1] == i + 1);
+	}
+}
+
+TEST(frame_arena_steady_frames_stay_off_the_heap)
+{
+	struct weston_frame_arena arena;
+	unsigned char *ptrs[ARRAY_LENGTH(sizes)];
+	uint64_t heap_allocs;
+	int frame;
+
+	weston_frame_arena_init(&arena);
+
+	/* The first frame has nothing to carve from. */
+	fill_frame(&arena, ptrs);
+	assert(arena.heap_allocs == ARRAY_LENGTH(sizes));
+	weston_frame_arena_reset(&arena);
+	assert(arena.size >= arena.peak);
+
+	heap_allocs = arena.heap_allocs;
+	for (frame = 0; frame < 10; frame++) {
+		fill_frame(&arena, ptrs);
+		weston_frame_arena_reset(&arena);
+	}
+
+	assert(arena.heap_allocs == heap_allocs);
+	assert(arena.frames == 11);
+	assert(arena.allocs == 11 * ARRAY_LENGTH(sizes));
+
+	weston_frame_arena_fini(&arena);
+}
+
+TEST(frame_arena_grows_for_a_bigger_frame)
+{
+	struct weston_frame_arena arena;
+	unsigned char *ptrs[ARRAY_LENGTH(sizes)];
+	uint64_t heap_allocs;
+	void *big;
+
+	weston_frame_arena_init(&arena);
+
+	fill_frame(&arena, ptrs);
+	weston_frame_arena_reset(&arena);
+
+	/* Overflows into a chunk of its own, then fits after the reset. */
+	heap_allocs = arena.heap_allocs;
+	fill_frame(&arena, ptrs);
+	big = weston_frame_arena_alloc(&arena, 1 << 20);
+	assert(big);
+	memset(big, 0xaa, 1 << 20);
+	assert(arena.heap_allocs == heap_allocs + 1);
+	weston_frame_arena_reset(&arena);
+	assert(arena.size >= (1 << 20));
+
+	heap_allocs = arena.heap_allocs;
+	fill_frame(&arena, ptrs);
+	big = weston_frame_arena_alloc(&arena, 1 << 20);
+	assert(big);
+	assert(arena.heap_allocs == heap_allocs);
+	weston_frame_arena_reset(&arena);
+
+	weston_frame_arena_fini(&arena);
+}
@@ -0,0 +1,128 @@
+/*
+ * Copyright © 2022 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "weston-test-runner.h"
+
+#include <libweston/libweston.h>
+#include <libweston/weston-log.h>
+
+#define LINE_COUNT 1000
+
+static struct weston_log_scope *
+create_scope(struct weston_log_context *ctx, FILE **fp,
+	     size_t size, struct weston_log_subscriber **sub)
+{
+	struct weston_log_scope *scope;
+
+	scope = weston_log_ctx_add_log_scope(ctx, "test", "log-async test\n",
+					     NULL, NULL, NULL);
+	assert(scope);
+
+	*fp = tmpfile();
+	assert(*fp);
+
+	*sub = weston_log_subscriber_create_log_async(*fp, size, -1);
+	assert(*sub);
+	weston_log_subscribe(ctx, *sub, "test");
+
+	return scope;
+}
+
+TEST(log_async_keeps_order)
+{
+	struct weston_log_context *ctx;
+	struct weston_log_subscriber *sub;
+	struct weston_log_scope *scope;
+	char line[128];
+	int expected = 0;
+	int lines = 0;
+	int dropped = 0;
+	int value;
+	FILE *fp;
+	int i;
+
+	ctx = weston_log_ctx_create();
+	assert(ctx);
+	scope = create_scope(ctx, &fp, 4096, &sub);
+
+	for (i = 0; i < LINE_COUNT; i++)
+		weston_log_scope_printf(scope, "line %d\n", i);
+
+	weston_log_subscriber_destroy(sub);
+
+	rewind(fp);
+	while (fgets(line, sizeof line, fp)) {
+		if (sscanf(line, "line %d", &value) == 1) {
+			assert(value >= expected);
+			expected = value + 1;
+			lines++;
+		} else {
+			assert(sscanf(line, "[dropped %d log messages]",
+				      &value) == 1);
+			dropped += value;
+		}
+	}
+	assert(lines + dropped == LINE_COUNT);
+
+	fclose(fp);
+	weston_log_scope_destroy(scope);
+	weston_log_ctx_destroy(ctx);
+}
+
+TEST(log_async_reports_drops)
+{
+	struct weston_log_context *ctx;
+	struct weston_log_subscriber *sub;
+	struct weston_log_scope *scope;
+	char buf[128];
+	size_t len;
+	FILE *fp;
+
+	ctx = weston_log_ctx_create();
+	assert(ctx);
+	scope = create_scope(ctx, &fp, 32, &sub);
+
+	/* Larger than the whole ring, so it can never fit. */
+	weston_log_scope_printf(scope, "%s\n",
+				"0123456789012345678901234567890123456789");
+	weston_log_scope_printf(scope, "ok\n");
+
+	weston_log_subscriber_destroy(sub);
+
+	rewind(fp);
+	len = fread(buf, 1, sizeof buf - 1, fp);
+	buf[len] = '\0';
+	assert(strcmp(buf, "[dropped 1 log messages]\nok\n") == 0);
+
+	fclose(fp);
+	weston_log_scope_destroy(scope);
+	weston_log_ctx_destroy(ctx);
+}
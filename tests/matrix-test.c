@@ -182,6 +182,95 @@ randomize_matrix(struct weston_matrix *m)
 #else
 		m->d[i] = frand();
 #endif
+	m->type = WESTON_MATRIX_TRANSFORM_OTHER;
+}
+
+static void
+randomize_scale_translate(struct weston_matrix *m, unsigned int type)
+{
+	weston_matrix_init(m);
+	if (type & WESTON_MATRIX_TRANSFORM_SCALE)
+		weston_matrix_scale(m, frand() * 8.0, frand() * 8.0,
+				    frand() * 8.0);
+	if (type & WESTON_MATRIX_TRANSFORM_TRANSLATE)
+		weston_matrix_translate(m, frand() * 4096.0, frand() * 4096.0,
+					frand() * 16.0);
+}
+
+static double
+matrix_max_diff(const struct weston_matrix *a, const struct weston_matrix *b)
+{
+	double diff, errsup = 0.0;
+	unsigned i;
+
+	for (i = 0; i < 16; ++i) {
+		diff = fabs(a->d[i] - b->d[i]) / fmax(1.0, fabs(b->d[i]));
+		if (diff > errsup)
+			errsup = diff;
+	}
+
+	return errsup;
+}
+
+/* Run the type-specialized paths against the general ones, which are
+ * taken when the type claims an arbitrary matrix. */
+static int
+test_fast_paths(void)
+{
+	static const unsigned int types[] = {
+		0,
+		WESTON_MATRIX_TRANSFORM_TRANSLATE,
+		WESTON_MATRIX_TRANSFORM_SCALE,
+		WESTON_MATRIX_TRANSFORM_SCALE |
+			WESTON_MATRIX_TRANSFORM_TRANSLATE,
+	};
+	struct weston_matrix a, b, fast, full, n_full;
+	struct weston_vector v_fast, v_full;
+	unsigned i, j, k;
+	int ret_fast, ret_full;
+	double errsup = 0.0;
+	int fails = 0;
+
+	for (k = 0; k < 100000; ++k) {
+		i = random() % 4;
+		j = random() % 4;
+		randomize_scale_translate(&a, types[i]);
+		randomize_scale_translate(&b, types[j]);
+
+		fast = a;
+		weston_matrix_multiply(&fast, &b);
+		full = a;
+		full.type = WESTON_MATRIX_TRANSFORM_OTHER;
+		n_full = b;
+		n_full.type = WESTON_MATRIX_TRANSFORM_OTHER;
+		weston_matrix_multiply(&full, &n_full);
+		errsup = fmax(errsup, matrix_max_diff(&fast, &full));
+		if (fast.type != (a.type | b.type))
+			fails++;
+
+		v_fast = (struct weston_vector){ { frand() * 4096.0,
+						   frand() * 4096.0,
+						   frand(), 1.0f } };
+		v_full = v_fast;
+		weston_matrix_transform(&fast, &v_fast);
+		weston_matrix_transform(&full, &v_full);
+		for (i = 0; i < 4; ++i)
+			errsup = fmax(errsup, fabs(v_fast.f[i] - v_full.f[i]) /
+					      fmax(1.0, fabs(v_full.f[i])));
+
+		n_full = full;
+		ret_fast = weston_matrix_invert(&fast, &fast);
+		ret_full = weston_matrix_invert(&full, &n_full);
+		if (ret_fast != ret_full)
+			fails++;
+		else if (ret_fast == 0)
+			errsup = fmax(errsup, matrix_max_diff(&fast, &full));
+	}
+
+	printf("type-specialized paths: %d mismatches, max rel. error %g\n",
+	       fails, errsup);
+
+	return fails == 0 && errsup < 1e-5 ? 0 : -1;
 }
 
 /* Take a matrix, compute inverse, multiply together
@@ -414,6 +503,9 @@ int main(void)
 	print_matrix(&M);
 	printf("max abs error: %g, original determinant %g\n", errsup, det);
 
+	if (test_fast_paths() < 0)
+		return 1;
+
 	test_loop_precision();
 	test_loop_speed_matrixvector();
 	test_loop_speed_inversetransform();
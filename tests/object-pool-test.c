@@ -0,0 +1,144 @@
+/*
+ * Copyright © 2022 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "weston-test-runner.h"
+
+#include "shared/helpers.h"
+#include "object-pool.h"
+
+struct thing {
+	int a;
+	double b;
+	char name[40];
+};
+
+TEST(object_pool_recycles_zeroed_objects)
+{
+	struct weston_object_pool *pool;
+	struct thing *t, *again;
+
+	pool = weston_object_pool_create("things", sizeof *t, 4);
+	assert(pool);
+
+	t = weston_object_pool_alloc(pool);
+	assert(t);
+	assert((uintptr_t) t % WESTON_MAX_ALIGN == 0);
+	assert(t->a == 0 && t->name[0] == 0);
+	memset(t, 0xaa, sizeof *t);
+	assert(pool->live == 1);
+
+	weston_object_pool_free(t);
+	assert(pool->live == 0);
+	assert(pool->n_free == 1);
+
+	again = weston_object_pool_alloc(pool);
+	assert(again == t);
+	assert(again->a == 0 && again->b == 0.0 && again->name[39] == 0);
+	assert(pool->reuses == 1);
+	assert(pool->allocs == 2);
+
+	weston_object_pool_free(again);
+	weston_object_pool_free(NULL);
+	weston_object_pool_destroy(pool);
+}
+
+TEST(object_pool_keeps_at_most_max_free)
+{
+	struct weston_object_pool *pool;
+	struct thing *things[10];
+	unsigned int i;
+
+	pool = weston_object_pool_create("things", sizeof(struct thing), 4);
+	assert(pool);
+
+	for (i = 0; i < ARRAY_LENGTH(things); i++) {
+		things[i] = weston_object_pool_alloc(pool);
+		assert(things[i]);
+	}
+	assert(pool->peak_live == ARRAY_LENGTH(things));
+
+	for (i = 0; i < ARRAY_LENGTH(things); i++)
+		weston_object_pool_free(things[i]);
+
+	assert(pool->live == 0);
+	assert(pool->n_free == 4);
+	assert(pool->heap_frees == ARRAY_LENGTH(things) - 4);
+
+	weston_object_pool_destroy(pool);
+}
+
+TEST(object_pool_outlives_its_destruction)
+{
+	struct weston_object_pool *pool;
+	struct thing *t, *spare;
+
+	pool = weston_object_pool_create("things", sizeof *t, 4);
+	assert(pool);
+
+	spare = weston_object_pool_alloc(pool);
+	t = weston_object_pool_alloc(pool);
+	assert(spare && t);
+	weston_object_pool_free(spare);
+
+	/* Frees the free list, t keeps the pool until it goes. */
+	weston_object_pool_destroy(pool);
+	assert(pool->destroyed);
+	assert(pool->n_free == 0);
+	assert(pool->live == 1);
+
+	t->a = 1;
+	weston_object_pool_free(t);
+}
+
+TEST(object_pool_trim_empties_free_list)
+{
+	struct weston_object_pool *pool;
+	struct thing *a, *b, *c;
+
+	pool = weston_object_pool_create("things", sizeof(struct thing), 4);
+	assert(pool);
+
+	a = weston_object_pool_alloc(pool);
+	b = weston_object_pool_alloc(pool);
+	c = weston_object_pool_alloc(pool);
+	assert(a && b && c);
+	weston_object_pool_free(a);
+	weston_object_pool_free(b);
+
+	assert(weston_object_pool_trim(pool) >= 2 * sizeof(struct thing));
+	assert(pool->n_free == 0);
+	assert(pool->live == 1);
+	assert(weston_object_pool_trim(pool) == 0);
+
+	weston_object_pool_free(c);
+	assert(pool->n_free == 1);
+	weston_object_pool_destroy(pool);
+}
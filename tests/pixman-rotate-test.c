@@ -0,0 +1,179 @@
+/*
+ * Copyright © 2022 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "weston-test-runner.h"
+
+#include "shared/helpers.h"
+#include "shared/timespec-util.h"
+#include "shared/xalloc.h"
+#include "pixman-rotate.h"
+
+struct rotate_size {
+	int width;
+	int height;
+};
+
+static const struct rotate_size sizes[] = {
+	{ 1, 1 }, { 3, 5 }, { 4, 4 }, { 7, 33 }, { 32, 32 }, { 33, 31 },
+	{ 64, 3 }, { 67, 129 }, { 1080, 64 },
+};
+
+typedef void (*rotate_func_t)(uint32_t *dst, int dst_stride,
+			      const uint32_t *src, int src_stride,
+			      int width, int height);
+
+static void
+fill_random(uint32_t *buf, int n, unsigned int seed)
+{
+	int i;
+
+	srand(seed);
+	for (i = 0; i < n; i++)
+		buf[i] = (uint32_t) rand() << 16 ^ (uint32_t) rand();
+}
+
+/* Destination offset of source pixel (x, y) in a block of the given size */
+static int
+rotated_offset(int degrees, int x, int y, int width, int height,
+	       int dst_stride)
+{
+	switch (degrees) {
+	case 90:
+		return (width - 1 - x) * dst_stride + y;
+	case 180:
+		return (height - 1 - y) * dst_stride + width - 1 - x;
+	case 270:
+		return x * dst_stride + height - 1 - y;
+	}
+
+	assert(0);
+	return 0;
+}
+
+/*
+ * Rotate a block with both strides padded, and check every pixel of the
+ * result, plus that the padding is left alone, for the scalar and then
+ * for the SIMD implementation.
+ */
+static void
+check_rotate(rotate_func_t func, int degrees, const struct rotate_size *size)
+{
+	int w = size->width, h = size->height;
+	int dst_w = degrees == 180 ? w : h;
+	int dst_h = degrees == 180 ? h : w;
+	int src_stride = w + 3, dst_stride = dst_w + 5;
+	uint32_t *src = xzalloc(src_stride * h * sizeof *src);
+	uint32_t *dst = xzalloc(dst_stride * dst_h * sizeof *dst);
+	int pass, x, y;
+
+	fill_random(src, src_stride * h, w * h);
+
+	for (pass = 0; pass < 2; pass++) {
+		if (pixman_rotate_simd_enable(pass == 1) != (pass == 1))
+			break;
+
+		memset(dst, 0xa5, dst_stride * dst_h * sizeof *dst);
+		func(dst, dst_stride, src, src_stride, w, h);
+
+		for (y = 0; y < h; y++) {
+			for (x = 0; x < w; x++) {
+				int o = rotated_offset(degrees, x, y, w, h,
+						       dst_stride);
+
+				assert(dst[o] == src[y * src_stride + x]);
+			}
+		}
+
+		for (y = 0; y < dst_h; y++)
+			for (x = dst_w; x < dst_stride; x++)
+				assert(dst[y * dst_stride + x] == 0xa5a5a5a5);
+	}
+
+	free(src);
+	free(dst);
+}
+
+TEST_P(rotate_90, sizes)
+{
+	check_rotate(pixman_rotate_90, 90, data);
+}
+
+TEST_P(rotate_180, sizes)
+{
+	check_rotate(pixman_rotate_180, 180, data);
+}
+
+TEST_P(rotate_270, sizes)
+{
+	check_rotate(pixman_rotate_270, 270, data);
+}
+
+static int64_t
+bench_rotate(rotate_func_t func, uint32_t *dst, const uint32_t *src,
+	     int width, int height, int iterations)
+{
+	struct timespec begin, end;
+	int it;
+
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	for (it = 0; it < iterations; it++)
+		func(dst, height, src, width, width, height);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	return timespec_sub_to_nsec(&end, &begin);
+}
+
+TEST(benchmark_rotate_90)
+{
+	const int width = 1920, height = 1080, iterations = 4;
+	uint32_t *src = xzalloc(width * height * sizeof *src);
+	uint32_t *dst = xzalloc(width * height * sizeof *dst);
+	int64_t scalar_ns, simd_ns;
+
+	fill_random(src, width * height, 1);
+
+	pixman_rotate_simd_enable(false);
+	scalar_ns = bench_rotate(pixman_rotate_90, dst, src, width, height,
+				 iterations);
+	testlog("scalar: %.2f ms per %dx%d frame\n",
+		scalar_ns / 1e6 / iterations, width, height);
+
+	if (pixman_rotate_simd_enable(true)) {
+		simd_ns = bench_rotate(pixman_rotate_90, dst, src, width,
+				       height, iterations);
+		testlog("simd:   %.2f ms per %dx%d frame\n",
+			simd_ns / 1e6 / iterations, width, height);
+	}
+
+	free(src);
+	free(dst);
+}
@@ -0,0 +1,186 @@
+/*
+ * Copyright © 2008-2011 Kristian Høgsberg
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "weston-test-runner.h"
+
+#include "shared/helpers.h"
+#include "shared/timespec-util.h"
+#include "shared/xalloc.h"
+#include "screenshooter-kernels.h"
+
+static const int widths[] = { 1, 3, 4, 7, 16, 17, 31, 64, 67, 1920 };
+
+static void
+fill_random(uint32_t *buf, int n, unsigned int seed, uint32_t mask)
+{
+	int i;
+
+	srand(seed);
+	for (i = 0; i < n; i++)
+		buf[i] = ((uint32_t) rand() << 16 ^ (uint32_t) rand()) & mask;
+}
+
+TEST_P(swap_RB_matches_scalar, widths)
+{
+	int n = *(const int *) data;
+	uint32_t *src = xzalloc(n * sizeof *src);
+	uint32_t *ref = xzalloc(n * sizeof *ref);
+	uint32_t *out = xzalloc(n * sizeof *out);
+	int i;
+
+	fill_random(src, n, n, 0xffffffff);
+
+	screenshooter_kernels_simd_enable(false);
+	screenshooter_copy_row_swap_RB(ref, src, n);
+	for (i = 0; i < n; i++) {
+		assert((ref[i] & 0xff00ff00) == (src[i] & 0xff00ff00));
+		assert(((ref[i] >> 16) & 0xff) == (src[i] & 0xff));
+		assert((ref[i] & 0xff) == ((src[i] >> 16) & 0xff));
+	}
+
+	if (screenshooter_kernels_simd_enable(true)) {
+		screenshooter_copy_row_swap_RB(out, src, n);
+		assert(memcmp(ref, out, n * sizeof *out) == 0);
+	}
+
+	free(src);
+	free(ref);
+	free(out);
+}
+
+TEST_P(delta_row_matches_scalar, widths)
+{
+	int n = *(const int *) data;
+	uint32_t *next = xzalloc(n * sizeof *next);
+	uint32_t *prev_ref = xzalloc(n * sizeof *prev_ref);
+	uint32_t *prev_simd = xzalloc(n * sizeof *prev_simd);
+	uint32_t *delta_ref = xzalloc(n * sizeof *delta_ref);
+	uint32_t *delta_simd = xzalloc(n * sizeof *delta_simd);
+
+	fill_random(next, n, n, 0xffffffff);
+	fill_random(prev_ref, n, n + 1, 0xffffffff);
+	memcpy(prev_simd, prev_ref, n * sizeof *prev_simd);
+
+	screenshooter_kernels_simd_enable(false);
+	screenshooter_delta_row(delta_ref, prev_ref, next, n);
+	assert(memcmp(prev_ref, next, n * sizeof *next) == 0);
+
+	if (screenshooter_kernels_simd_enable(true)) {
+		screenshooter_delta_row(delta_simd, prev_simd, next, n);
+		assert(memcmp(prev_simd, next, n * sizeof *next) == 0);
+		assert(memcmp(delta_ref, delta_simd, n * sizeof *next) == 0);
+	}
+
+	free(next);
+	free(prev_ref);
+	free(prev_simd);
+	free(delta_ref);
+	free(delta_simd);
+}
+
+TEST_P(run_end_matches_scalar, widths)
+{
+	int n = *(const int *) data;
+	uint32_t *delta = xzalloc(n * sizeof *delta);
+	int start, ref;
+
+	/* Mostly equal values, so that runs of all lengths show up. */
+	fill_random(delta, n, n, 0x1);
+
+	for (start = 0; start < n; start++) {
+		screenshooter_kernels_simd_enable(false);
+		ref = screenshooter_run_end(delta, start, n, delta[start]);
+		assert(ref > start && ref <= n);
+
+		if (screenshooter_kernels_simd_enable(true))
+			assert(screenshooter_run_end(delta, start, n,
+						     delta[start]) == ref);
+	}
+
+	free(delta);
+}
+
+static int64_t
+bench_row_kernels(uint32_t *src, uint32_t *dst, uint32_t *prev,
+		  int width, int height, int iterations)
+{
+	struct timespec begin, end;
+	int it, y, x;
+
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	for (it = 0; it < iterations; it++) {
+		for (y = 0; y < height; y++) {
+			uint32_t *row = src + y * width;
+
+			screenshooter_copy_row_swap_RB(dst + y * width,
+						       row, width);
+			screenshooter_delta_row(dst + y * width,
+						prev + y * width, row, width);
+			for (x = 0; x < width;
+			     x = screenshooter_run_end(dst + y * width, x,
+						       width, dst[y * width + x]))
+				;
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	return timespec_sub_to_nsec(&end, &begin);
+}
+
+TEST(benchmark_row_kernels)
+{
+	const int width = 1920, height = 1080, iterations = 4;
+	uint32_t *src = xzalloc(width * height * sizeof *src);
+	uint32_t *dst = xzalloc(width * height * sizeof *dst);
+	uint32_t *prev = xzalloc(width * height * sizeof *prev);
+	int64_t scalar_ns, simd_ns;
+
+	/* Low entropy content, like a typical desktop. */
+	fill_random(src, width * height, 1, 0x01010101);
+
+	screenshooter_kernels_simd_enable(false);
+	scalar_ns = bench_row_kernels(src, dst, prev, width, height,
+				      iterations);
+	testlog("scalar: %.2f ms per %dx%d frame\n",
+		scalar_ns / 1e6 / iterations, width, height);
+
+	if (screenshooter_kernels_simd_enable(true)) {
+		simd_ns = bench_row_kernels(src, dst, prev, width, height,
+					    iterations);
+		testlog("simd:   %.2f ms per %dx%d frame\n",
+			simd_ns / 1e6 / iterations, width, height);
+	}
+
+	free(src);
+	free(dst);
+	free(prev);
+}
@@ -133,58 +133,37 @@ unpremultiply_and_swap_a8b8g8r8_to_PAMrgba(void *pixels, size_t size)
 	}
 }
 
+struct surface_shot {
+	struct weston_surface *surface;
+	int width, height;
+	size_t sz;
+	char desc[512];
+};
+
 static void
-trigger_binding(struct weston_keyboard *keyboard, const struct timespec *time,
-		uint32_t key, void *data)
+surface_shot_done(void *data, const void *content)
 {
+	struct surface_shot *shot = data;
 	const char *prefix = "surfaceshot-";
 	const char *suffix = ".pam";
 	char fname[1024];
-	struct weston_surface *surface;
-	struct weston_seat *seat = keyboard->seat;
-	struct weston_pointer *pointer = weston_seat_get_pointer(seat);
-	int width, height;
-	char desc[512];
 	void *pixels;
-	const size_t bytespp = 4; /* PIXMAN_a8b8g8r8 */
-	size_t sz;
 	int ret;
 	FILE *fp;
 
-	if (!pointer || !pointer->focus)
-		return;
-
-	surface = pointer->focus->surface;
-
-	weston_surface_get_content_size(surface, &width, &height);
-
-	if (!surface->get_label ||
-	    surface->get_label(surface, desc, sizeof(desc)) < 0)
-		snprintf(desc, sizeof(desc), "(unknown)");
-
-	weston_log("surface screenshot of %p: '%s', %dx%d\n",
-		   surface, desc, width, height);
-
-	sz = width * bytespp * height;
-	if (sz == 0) {
-		weston_log("no content for %p\n", surface);
-		return;
+	if (!content) {
+		weston_log("shooting surface %p failed\n", shot->surface);
+		goto out;
 	}
 
-	pixels = malloc(sz);
+	pixels = malloc(shot->sz);
 	if (!pixels) {
-		weston_log("%s: failed to malloc %zu B\n", __func__, sz);
-		return;
-	}
-
-	ret = weston_surface_copy_content(surface, pixels, sz,
-					  0, 0, width, height);
-	if (ret < 0) {
-		weston_log("shooting surface %p failed\n", surface);
+		weston_log("%s: failed to malloc %zu B\n", __func__, shot->sz);
 		goto out;
 	}
 
-	unpremultiply_and_swap_a8b8g8r8_to_PAMrgba(pixels, sz);
+	memcpy(pixels, content, shot->sz);
+	unpremultiply_and_swap_a8b8g8r8_to_PAMrgba(pixels, shot->sz);
 
 	fp = file_create_dated(NULL, prefix, suffix, fname, sizeof(fname));
 	if (!fp) {
@@ -200,18 +179,72 @@ trigger_binding(struct weston_keyboard *keyboard, const struct timespec *time,
 
 		weston_log("Cannot open '%s*%s' for writing: %s\n",
 			   prefix, suffix, msg);
+		free(pixels);
 		goto out;
 	}
 
-	ret = write_PAM_image_rgba(fp, width, height, pixels, sz, desc);
+	ret = write_PAM_image_rgba(fp, shot->width, shot->height,
+				   pixels, shot->sz, shot->desc);
 	if (fclose(fp) != 0 || ret < 0)
-		weston_log("writing surface %p screenshot failed.\n", surface);
+		weston_log("writing surface %p screenshot failed.\n",
+			   shot->surface);
 	else
 		weston_log("successfully shot surface %p into '%s'\n",
-			   surface, fname);
+			   shot->surface, fname);
 
-out:
 	free(pixels);
+out:
+	free(shot);
+}
+
+static void
+trigger_binding(struct weston_keyboard *keyboard, const struct timespec *time,
+		uint32_t key, void *data)
+{
+	struct weston_surface *surface;
+	struct weston_seat *seat = keyboard->seat;
+	struct weston_pointer *pointer = weston_seat_get_pointer(seat);
+	const size_t bytespp = 4; /* PIXMAN_a8b8g8r8 */
+	struct surface_shot *shot;
+	int ret;
+
+	if (!pointer || !pointer->focus)
+		return;
+
+	surface = pointer->focus->surface;
+
+	shot = zalloc(sizeof *shot);
+	if (!shot) {
+		weston_log("%s: out of memory\n", __func__);
+		return;
+	}
+
+	/* Only the address is logged once the copy is done; the surface
+	 * may be gone by then. */
+	shot->surface = surface;
+	weston_surface_get_content_size(surface, &shot->width, &shot->height);
+
+	if (!surface->get_label ||
+	    surface->get_label(surface, shot->desc, sizeof(shot->desc)) < 0)
+		snprintf(shot->desc, sizeof(shot->desc), "(unknown)");
+
+	weston_log("surface screenshot of %p: '%s', %dx%d\n",
+		   surface, shot->desc, shot->width, shot->height);
+
+	shot->sz = shot->width * bytespp * shot->height;
+	if (shot->sz == 0) {
+		weston_log("no content for %p\n", surface);
+		free(shot);
+		return;
+	}
+
+	ret = weston_surface_copy_content_async(surface, 0, 0,
+						shot->width, shot->height,
+						surface_shot_done, shot);
+	if (ret < 0) {
+		weston_log("shooting surface %p failed\n", surface);
+		free(shot);
+	}
 }
 
 WL_EXPORT int
@@ -180,9 +180,9 @@ deep_copy_polygon8(const struct polygon8 *src, struct polygon8 *dst)
 	ARRAY_COPY(dst->y, src->y);
 }
 
-TEST_P(clip_polygon_n_vertices_emitted, test_data)
+static void
+check_polygon_n_vertices_emitted(const struct vertex_clip_test_data *tdata)
 {
-	struct vertex_clip_test_data *tdata = data;
 	struct clip_context ctx;
 	struct polygon8 polygon;
 	float vertices_x[8];
@@ -193,9 +193,9 @@ TEST_P(clip_polygon_n_vertices_emitted, test_data)
 	assert(emitted == tdata->expected.n);
 }
 
-TEST_P(clip_polygon_expected_vertices, test_data)
+static void
+check_polygon_expected_vertices(const struct vertex_clip_test_data *tdata)
 {
-	struct vertex_clip_test_data *tdata = data;
 	struct clip_context ctx;
 	struct polygon8 polygon;
 	float vertices_x[8];
@@ -211,6 +211,85 @@ TEST_P(clip_polygon_expected_vertices, test_data)
 	}
 }
 
+TEST_P(clip_polygon_n_vertices_emitted, test_data)
+{
+	clip_simd_enable(false);
+	check_polygon_n_vertices_emitted(data);
+
+	if (clip_simd_enable(true))
+		check_polygon_n_vertices_emitted(data);
+}
+
+TEST_P(clip_polygon_expected_vertices, test_data)
+{
+	clip_simd_enable(false);
+	check_polygon_expected_vertices(data);
+
+	if (clip_simd_enable(true))
+		check_polygon_expected_vertices(data);
+}
+
+static void
+check_clip_simple(const struct vertex_clip_test_data *tdata)
+{
+	struct clip_context ctx;
+	struct polygon8 polygon;
+	float vertices_x[8];
+	float vertices_y[8];
+	int emitted;
+	int i;
+
+	populate_clip_context(&ctx);
+	deep_copy_polygon8(&tdata->surface, &polygon);
+	emitted = clip_simple(&ctx, &polygon, vertices_x, vertices_y);
+	assert(emitted == tdata->surface.n);
+
+	for (i = 0; i < emitted; i++) {
+		assert(vertices_x[i] >= BOUNDING_BOX_LEFT_X);
+		assert(vertices_x[i] <= BOUNDING_BOX_RIGHT_X);
+		assert(vertices_y[i] >= BOUNDING_BOX_BOTTOM_Y);
+		assert(vertices_y[i] <= BOUNDING_BOX_TOP_Y);
+		if (tdata->surface.x[i] >= BOUNDING_BOX_LEFT_X &&
+		    tdata->surface.x[i] <= BOUNDING_BOX_RIGHT_X)
+			assert(vertices_x[i] == tdata->surface.x[i]);
+		if (tdata->surface.y[i] >= BOUNDING_BOX_BOTTOM_Y &&
+		    tdata->surface.y[i] <= BOUNDING_BOX_TOP_Y)
+			assert(vertices_y[i] == tdata->surface.y[i]);
+	}
+}
+
+TEST_P(clip_simple_clamps_to_box, test_data)
+{
+	clip_simd_enable(false);
+	check_clip_simple(data);
+
+	if (clip_simd_enable(true))
+		check_clip_simple(data);
+}
+
+TEST_P(polygon_bounding_box, test_data)
+{
+	const struct vertex_clip_test_data *tdata = data;
+	const struct polygon8 *p = &tdata->surface;
+	float ref[4], simd[4];
+	int i;
+
+	clip_simd_enable(false);
+	polygon8_bounding_box(p, &ref[0], &ref[1], &ref[2], &ref[3]);
+
+	for (i = 0; i < p->n; i++) {
+		assert(p->x[i] >= ref[0] && p->x[i] <= ref[2]);
+		assert(p->y[i] >= ref[1] && p->y[i] <= ref[3]);
+	}
+
+	if (clip_simd_enable(true)) {
+		polygon8_bounding_box(p, &simd[0], &simd[1],
+				      &simd[2], &simd[3]);
+		for (i = 0; i < 4; i++)
+			assert(simd[i] == ref[i]);
+	}
+}
+
 TEST(float_difference_different)
 {
 	assert(float_difference(1.0f, 0.0f) == 1.0f);
@@ -0,0 +1,115 @@
+/*
+ * Copyright © 2022 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "weston-test-runner.h"
+
+#include "shared/helpers.h"
+#include "shared/xalloc.h"
+#include "wcap-decode.h"
+#include "wcap-convert.h"
+
+struct convert_case {
+	uint32_t format;
+	int width, height;
+};
+
+static const struct convert_case cases[] = {
+	{ WCAP_FORMAT_XRGB8888, 2, 2 },
+	{ WCAP_FORMAT_XRGB8888, 6, 4 },
+	{ WCAP_FORMAT_XRGB8888, 18, 2 },
+	{ WCAP_FORMAT_XRGB8888, 1920, 4 },
+	{ WCAP_FORMAT_XBGR8888, 2, 2 },
+	{ WCAP_FORMAT_XBGR8888, 6, 4 },
+	{ WCAP_FORMAT_XBGR8888, 18, 2 },
+	{ WCAP_FORMAT_XBGR8888, 1920, 4 },
+};
+
+static uint32_t *
+random_frame(int width, int height)
+{
+	uint32_t *frame = xzalloc(width * height * sizeof *frame);
+	int i;
+
+	srand(width * height);
+	for (i = 0; i < width * height; i++)
+		frame[i] = (uint32_t) rand() << 16 ^ (uint32_t) rand();
+
+	/* The extremes of every chroma sum */
+	frame[0] = 0xffffff;
+	frame[1] = 0x000000;
+	frame[width] = 0xff0000;
+	frame[width + 1] = 0x0000ff;
+
+	return frame;
+}
+
+TEST_P(yv12_matches_scalar, cases)
+{
+	const struct convert_case *c = data;
+	size_t size = c->width * c->height * 3 / 2;
+	uint32_t *frame = random_frame(c->width, c->height);
+	unsigned char *ref = xzalloc(size);
+	unsigned char *out = xzalloc(size);
+
+	wcap_convert_simd_enable(false);
+	wcap_convert_to_yv12(c->format, frame, c->width, c->height, ref);
+
+	if (wcap_convert_simd_enable(true)) {
+		wcap_convert_to_yv12(c->format, frame, c->width, c->height, out);
+		assert(memcmp(ref, out, size) == 0);
+	}
+
+	free(frame);
+	free(ref);
+	free(out);
+}
+
+TEST_P(yuv444_matches_scalar, cases)
+{
+	const struct convert_case *c = data;
+	size_t size = c->width * c->height * 3;
+	uint32_t *frame = random_frame(c->width, c->height);
+	unsigned char *ref = xzalloc(size);
+	unsigned char *out = xzalloc(size);
+
+	wcap_convert_simd_enable(false);
+	wcap_convert_to_yuv444(c->format, frame, c->width, c->height, ref);
+
+	if (wcap_convert_simd_enable(true)) {
+		wcap_convert_to_yuv444(c->format, frame, c->width, c->height,
+				       out);
+		assert(memcmp(ref, out, size) == 0);
+	}
+
+	free(frame);
+	free(ref);
+	free(out);
+}
@@ -0,0 +1,194 @@
+/*
+ * Copyright © 2022 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "weston-test-runner.h"
+
+#include "shared/helpers.h"
+#include "shared/xalloc.h"
+#include "wcap-decode.h"
+
+#define WIDTH 16
+#define HEIGHT 8
+#define N_FRAMES 12
+#define KEYFRAME_INTERVAL 4
+#define FRAME_MSECS 10
+
+/* Random runs covering count pixels, returns the end of the data */
+static uint32_t *
+fill_rle(uint32_t *p, int count)
+{
+	int j;
+
+	while (count > 0) {
+		j = rand() % 5 + 1;
+		if (j > count)
+			j = count;
+		*p++ = (uint32_t) (j - 1) << 24 | (rand() & 0x00ffffff);
+		count -= j;
+	}
+
+	return p;
+}
+
+static void
+write_frame(FILE *fp, int f, struct wcap_index_entry *entry, long *offset)
+{
+	struct wcap_frame_header_v2 header = { 0 };
+	struct wcap_rectangle rect;
+	uint32_t *data, *p;
+	bool keyframe = f % KEYFRAME_INTERVAL == 0;
+
+	if (keyframe) {
+		rect = (struct wcap_rectangle) { 0, 0, WIDTH, HEIGHT };
+	} else {
+		rect.x1 = rand() % (WIDTH - 1);
+		rect.y1 = rand() % (HEIGHT - 1);
+		rect.x2 = rect.x1 + 1 + rand() % (WIDTH - rect.x1);
+		rect.y2 = rect.y1 + 1 + rand() % (HEIGHT - rect.y1);
+	}
+
+	data = xzalloc(sizeof rect + WIDTH * HEIGHT * sizeof *data);
+	memcpy(data, &rect, sizeof rect);
+	p = fill_rle((uint32_t *) ((char *) data + sizeof rect),
+		     (rect.x2 - rect.x1) * (rect.y2 - rect.y1));
+
+	header.msecs = f * FRAME_MSECS;
+	header.nrects = 1;
+	header.flags = keyframe ? WCAP_FRAME_KEYFRAME : 0;
+	header.raw_size = (char *) p - (char *) data;
+	header.size = header.raw_size;
+
+	if (keyframe) {
+		entry->offset = *offset;
+		entry->frame = f;
+		entry->msecs = header.msecs;
+	}
+
+	assert(fwrite(&header, sizeof header, 1, fp) == 1);
+	assert(fwrite(data, header.size, 1, fp) == 1);
+	*offset += sizeof header + header.size;
+	free(data);
+}
+
+/* An uncompressed v2 recording, with or without its index */
+static char *
+write_recording(bool with_index)
+{
+	struct wcap_header_v2 header = {
+		.magic = WCAP_HEADER_MAGIC_V2,
+		.format = WCAP_FORMAT_XRGB8888,
+		.width = WIDTH,
+		.height = HEIGHT,
+		.compression = WCAP_COMPRESSION_NONE,
+		.keyframe_interval = KEYFRAME_INTERVAL,
+	};
+	struct wcap_index_entry index[N_FRAMES / KEYFRAME_INTERVAL];
+	struct wcap_index_trailer trailer = { 0 };
+	char *path = xstrdup("/tmp/weston-wcap-XXXXXX.wcap");
+	long offset = sizeof header;
+	FILE *fp;
+	int fd, f;
+
+	fd = mkstemps(path, strlen(".wcap"));
+	assert(fd >= 0);
+	fp = fdopen(fd, "w");
+	assert(fp);
+
+	srand(N_FRAMES);
+	assert(fwrite(&header, sizeof header, 1, fp) == 1);
+	for (f = 0; f < N_FRAMES; f++)
+		write_frame(fp, f, &index[f / KEYFRAME_INTERVAL], &offset);
+
+	if (with_index) {
+		trailer.index_offset = offset;
+		trailer.n_entries = ARRAY_LENGTH(index);
+		trailer.n_frames = N_FRAMES;
+		trailer.magic = WCAP_INDEX_MAGIC;
+		assert(fwrite(index, sizeof index, 1, fp) == 1);
+		assert(fwrite(&trailer, sizeof trailer, 1, fp) == 1);
+	}
+	fclose(fp);
+
+	return path;
+}
+
+static void
+check_seek(bool with_index)
+{
+	static const int order[] = { 7, 2, 11, 0, 5, 6, 3, 9, 8, 1, 10, 4 };
+	size_t frame_size = WIDTH * HEIGHT * sizeof(uint32_t);
+	char *path = write_recording(with_index);
+	struct wcap_decoder *decoder;
+	uint32_t *frames[N_FRAMES];
+	unsigned int i;
+	int f;
+
+	decoder = wcap_decoder_create(path);
+	assert(decoder);
+	assert(decoder->version == 2);
+	assert(decoder->n_frames == N_FRAMES);
+	assert(decoder->n_index == N_FRAMES / KEYFRAME_INTERVAL);
+
+	for (f = 0; f < N_FRAMES; f++) {
+		assert(wcap_decoder_get_frame(decoder) == 1);
+		assert(decoder->msecs == (uint32_t) f * FRAME_MSECS);
+		frames[f] = xzalloc(frame_size);
+		memcpy(frames[f], decoder->frame, frame_size);
+	}
+	assert(wcap_decoder_get_frame(decoder) == 0);
+
+	for (i = 0; i < ARRAY_LENGTH(order); i++) {
+		f = order[i];
+		assert(wcap_decoder_seek(decoder, f * FRAME_MSECS) == 1);
+		assert(decoder->count == (uint32_t) f + 1);
+		assert(memcmp(decoder->frame, frames[f], frame_size) == 0);
+	}
+	assert(wcap_decoder_seek(decoder, N_FRAMES * FRAME_MSECS) == 0);
+
+	wcap_decoder_destroy(decoder);
+	for (f = 0; f < N_FRAMES; f++)
+		free(frames[f]);
+	unlink(path);
+	free(path);
+}
+
+TEST(seek_matches_replay)
+{
+	check_seek(true);
+}
+
+TEST(seek_without_index)
+{
+	check_seek(false);
+}
@@ -1324,6 +1324,55 @@ fuzzy_match_pixels(uint32_t pix_a, uint32_t pix_b,
 	return ret;
 }
 
+/*
+ * The fuzz check of check_images_match() works on all four channels of a
+ * pixel at once: each channel is spread into a 16-bit lane of a 64-bit
+ * word, so that the signed difference and both bounds can be tested
+ * without carries crossing into the neighbouring channel.
+ */
+#define LANES(v) ((uint64_t)(v) * 0x0001000100010001ull)
+
+struct pixel_fuzz {
+	uint64_t bias;	/* per lane 0x8000 - fuzz.a */
+	uint64_t upper;	/* per lane 0x3fff - (fuzz.b - fuzz.a) */
+	bool zero_ok;	/* identical pixels match */
+};
+
+static void
+pixel_fuzz_init(struct pixel_fuzz *pf, const struct range *fuzz)
+{
+	/* Differences are within [-255, 255], wider bounds change nothing. */
+	int a = max(fuzz->a, -256);
+	int b = min(fuzz->b, 256);
+
+	pf->bias = LANES(0x8000 - a);
+	pf->upper = LANES(0x3fff - max(b - a, -1));
+	pf->zero_ok = fuzz->a <= 0 && fuzz->b >= 0;
+}
+
+static inline uint64_t
+pixel_spread(uint32_t pix)
+{
+	uint64_t v = pix;
+
+	return (v & 0xff) | ((v & 0xff00) << 8) |
+	       ((v & 0xff0000) << 16) | ((v & 0xff000000) << 24);
+}
+
+static inline bool
+pixel_fuzz_match(const struct pixel_fuzz *pf, uint32_t pix_a, uint32_t pix_b)
+{
+	/* per lane 0x8000 + (b - a) - fuzz.a, always positive */
+	uint64_t u = pixel_spread(pix_b) + pf->bias - pixel_spread(pix_a);
+
+	/* b - a >= fuzz.a */
+	if ((u & LANES(0x8000)) != LANES(0x8000))
+		return false;
+
+	/* b - a - fuzz.a <= fuzz.b - fuzz.a */
+	return (((u & LANES(0x7fff)) + pf->upper) & LANES(0x4000)) == 0;
+}
+
 /**
  * Test if a given region within two images are pixel-identical
  *
@@ -1350,15 +1399,18 @@ check_images_match(pixman_image_t *img_a, pixman_image_t *img_b,
 		   const struct rectangle *clip_rect, const struct range *prec)
 {
 	struct range fuzz = range_get(prec);
-	struct pixel_diff_stat diffstat = {};
+	struct pixel_fuzz pf;
 	struct image_iterator it_a;
 	struct image_iterator it_b;
 	pixman_box32_t box;
+	size_t row_bytes;
 	int x, y;
 	uint32_t *pix_a;
 	uint32_t *pix_b;
 
 	box = image_check_get_roi(img_a, img_b, clip_rect);
+	row_bytes = (box.x2 - box.x1) * sizeof(uint32_t);
+	pixel_fuzz_init(&pf, &fuzz);
 
 	image_iter_init(&it_a, img_a);
 	image_iter_init(&it_b, img_b);
@@ -1367,9 +1419,13 @@ check_images_match(pixman_image_t *img_a, pixman_image_t *img_b,
 		pix_a = image_iter_get_row(&it_a, y) + box.x1;
 		pix_b = image_iter_get_row(&it_b, y) + box.x1;
 
+		/* Most rows of a passing test are identical. */
+		if (pf.zero_ok && memcmp(pix_a, pix_b, row_bytes) == 0)
+			continue;
+
 		for (x = box.x1; x < box.x2; x++) {
-			if (!fuzzy_match_pixels(*pix_a, *pix_b,
-						&fuzz, &diffstat))
+			if (!(pf.zero_ok && *pix_a == *pix_b) &&
+			    !pixel_fuzz_match(&pf, *pix_a, *pix_b))
 				return false;
 
 			pix_a++;
@@ -1619,6 +1675,42 @@ load_image_from_png(const char *fname)
 	return converted;
 }
 
+struct reference_image {
+	struct wl_list link; /* reference_image_cache */
+	char *fname;
+	pixman_image_t *image;
+};
+
+/* Reference images are only ever read, so fixtures of a test program
+ * comparing against the same file load and convert it just once. */
+static struct wl_list reference_image_cache = {
+	&reference_image_cache, &reference_image_cache
+};
+
+static pixman_image_t *
+load_reference_image(const char *fname)
+{
+	struct reference_image *ref;
+	pixman_image_t *image;
+
+	wl_list_for_each(ref, &reference_image_cache, link) {
+		if (strcmp(ref->fname, fname) == 0)
+			return pixman_image_ref(ref->image);
+	}
+
+	/* Missing files are not cached, they may get written meanwhile. */
+	image = load_image_from_png(fname);
+	if (!image)
+		return NULL;
+
+	ref = xzalloc(sizeof *ref);
+	ref->fname = xstrdup(fname);
+	ref->image = pixman_image_ref(image);
+	wl_list_insert(&reference_image_cache, &ref->link);
+
+	return image;
+}
+
 /**
  * Take screenshot of a single output
  *
@@ -1729,7 +1821,7 @@ verify_image(struct buffer *shot,
 
 	if (ref_image) {
 		ref_fname = screenshot_reference_filename(ref_image, ref_seq_no);
-		ref = load_image_from_png(ref_fname);
+		ref = load_reference_image(ref_fname);
 	}
 
 	if (ref) {
@@ -109,7 +109,10 @@ get_lock_path(void)
 	char *lock_path;
 
 	suffix = "weston-test-suite-drm-lock";
-	env_path = getenv("XDG_RUNTIME_DIR");
+	/* Fixtures running in parallel have private runtime directories. */
+	env_path = getenv("WESTON_TEST_SUITE_LOCK_DIR");
+	if (!env_path)
+		env_path = getenv("XDG_RUNTIME_DIR");
 	if (!env_path) {
 		fprintf(stderr, "Failed to compute lock file path. " \
 			"XDG_RUNTIME_DIR is not set.\n");
@@ -192,6 +195,7 @@ compositor_setup_defaults_(struct compositor_setup *setup,
 		.extra_module = NULL,
 		.logging_scopes = NULL,
 		.testset_name = testset_name,
+		.benchmark = false,
 	};
 }
 
@@ -430,6 +434,9 @@ execute_compositor(const struct compositor_setup *setup,
 	if (setup->xwayland)
 		prog_args_take(&args, strdup("--xwayland"));
 
+	if (setup->benchmark && setup->backend == WESTON_BACKEND_HEADLESS)
+		prog_args_take(&args, strdup("--benchmark"));
+
 	test_data.test_quirks = setup->test_quirks;
 	test_data.test_private_data = data;
 	prog_args_save(&args);
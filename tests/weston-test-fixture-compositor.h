@@ -100,6 +100,9 @@ struct compositor_setup {
 	const char *logging_scopes;
 	/** The name of this test program, used as a unique identifier. */
 	const char *testset_name;
+	/** Headless backend only: repaint continuously as fast as possible
+	 * instead of at a synthetic 60 Hz, see \c --benchmark . */
+	bool benchmark;
 };
 
 void
@@ -123,6 +126,7 @@ compositor_setup_defaults_(struct compositor_setup *setup,
  * - extra_module: none
  * - logging_scopes: compositor defaults
  * - testset_name: the test name from meson.build
+ * - benchmark: no
  *
  * \ingroup testharness
  */
@@ -26,6 +26,7 @@
 #include "config.h"
 
 #include <unistd.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/wait.h>
@@ -34,6 +35,8 @@
 #include <errno.h>
 #include <signal.h>
 #include <getopt.h>
+#include <dirent.h>
+#include <fcntl.h>
 
 #include "test-config.h"
 #include "weston-test-runner.h"
@@ -201,6 +204,8 @@ struct weston_test_harness {
 	int32_t fixt_ind;
 	char *chosen_testname;
 	int32_t case_ind;
+	/** fixtures run at the same time, each in its own process */
+	int32_t jobs;
 
 	struct wet_testsuite_data data;
 };
@@ -364,6 +369,8 @@ help(const char *exe)
 		"Options:\n"
 		"  -f, --fixture N  Run only fixture number N. 0 runs all (default).\n"
 		"  -h, --help       Print this help and exit with success.\n"
+		"  -j, --jobs N     Run up to N fixtures in parallel, default from\n"
+		"                   WESTON_TEST_JOBS or 1.\n"
 		"  -l, --list       List all tests in this executable and exit with success.\n"
 		"testname:          Optional; name of the test to execute instead of all tests.\n"
 		"number:            Optional; for a multi-case test, run the given case only.\n"
@@ -378,11 +385,21 @@ parse_command_line(struct weston_test_harness *harness, int argc, char **argv)
 	static const struct option opts[] = {
 		{ "fixture", required_argument, NULL,      'f' },
 		{ "help",    no_argument,       NULL,      'h' },
+		{ "jobs",    required_argument, NULL,      'j' },
 		{ "list",    no_argument,       NULL,      'l' },
 		{ 0,         0,                 NULL,      0  }
 	};
+	const char *jobs_env;
 
-	while ((c = getopt_long(argc, argv, "f:hl", opts, NULL)) != -1) {
+	jobs_env = getenv("WESTON_TEST_JOBS");
+	if (jobs_env && !safe_strtoint(jobs_env, &harness->jobs)) {
+		fprintf(stderr,
+			"Error: WESTON_TEST_JOBS='%s' does not look like a number.\n",
+			jobs_env);
+		exit(RESULT_HARD_ERROR);
+	}
+
+	while ((c = getopt_long(argc, argv, "f:hj:l", opts, NULL)) != -1) {
 		switch (c) {
 		case 'f':
 			if (!safe_strtoint(optarg, &harness->fixt_ind)) {
@@ -396,6 +413,14 @@ parse_command_line(struct weston_test_harness *harness, int argc, char **argv)
 		case 'h':
 			help(argv[0]);
 			exit(RESULT_OK);
+		case 'j':
+			if (!safe_strtoint(optarg, &harness->jobs)) {
+				fprintf(stderr,
+					"Error: '%s' does not look like a number (command line).\n",
+					optarg);
+				exit(RESULT_HARD_ERROR);
+			}
+			break;
 		case 'l':
 			list_tests();
 			exit(RESULT_OK);
@@ -438,8 +463,14 @@ weston_test_harness_create(int argc, char **argv)
 
 	harness->fixt_ind = -1;
 	harness->case_ind = -1;
+	harness->jobs = 1;
 	parse_command_line(harness, argc, argv);
 
+	if (harness->jobs < 1) {
+		fprintf(stderr, "Error: at least one job is needed.\n");
+		exit(RESULT_HARD_ERROR);
+	}
+
 	fsa = fixture_setup_array_get_();
 	if (harness->fixt_ind < -1 || harness->fixt_ind >= fsa->n_elements) {
 		fprintf(stderr,
@@ -620,11 +651,259 @@ fixture_report(const struct wet_testsuite_data *d, enum test_result_code ret)
 		d->passed, d->skipped, d->failed, d->total);
 }
 
+/** Run one fixture and report its tests
+ *
+ * \return RESULT_OK if the fixture was skipped or all of its tests passed
+ * or skipped, RESULT_FAIL or RESULT_HARD_ERROR otherwise.
+ */
+static enum test_result_code
+run_fixture(struct weston_test_harness *harness,
+	    const struct fixture_setup_array *fsa, int fi)
+{
+	const void *arg = fixture_setup_array_get_arg(fsa, fi);
+	enum test_result_code ret;
+
+	harness->data.fixture_iteration = fi;
+	harness->data.fixture_name = fixture_setup_array_get_name(fsa, fi);
+	harness->data.passed = 0;
+	harness->data.skipped = 0;
+	harness->data.failed = 0;
+
+	testlog("--- Fixture %d (%s)...\n", fi + 1, harness->data.fixture_name);
+
+	ret = fixture_setup_run_(harness, arg);
+	fixture_report(&harness->data, ret);
+
+	if (ret == RESULT_SKIP) {
+		tap_skip_fixture(&harness->data);
+#if WESTON_TEST_SKIP_IS_FAILURE
+		return RESULT_FAIL;
+#else
+		return RESULT_OK;
+#endif
+	}
+
+	if (ret != RESULT_OK)
+		return ret;
+
+	return counts_to_result(&harness->data);
+}
+
+static void
+merge_result(enum test_result_code *result, enum test_result_code ret)
+{
+	if (ret != RESULT_OK && *result != RESULT_HARD_ERROR)
+		*result = ret;
+}
+
+/** A fixture running in a child process */
+struct fixture_job {
+	pid_t pid;
+	int fi;
+	/** TAP output and log of the child, copied out in fixture order */
+	FILE *out;
+	FILE *err;
+	/** Private XDG_RUNTIME_DIR, so that sockets never collide */
+	char *runtime_dir;
+	enum test_result_code result;
+	bool done;
+};
+
+static void
+remove_runtime_dir(const char *path)
+{
+	struct dirent *de;
+	DIR *dir;
+
+	dir = opendir(path);
+	if (dir) {
+		/* a crashed compositor leaves its socket behind */
+		while ((de = readdir(dir))) {
+			if (strcmp(de->d_name, ".") != 0 &&
+			    strcmp(de->d_name, "..") != 0)
+				unlinkat(dirfd(dir), de->d_name, 0);
+		}
+		closedir(dir);
+	}
+
+	rmdir(path);
+}
+
+static bool
+fixture_job_start(struct weston_test_harness *harness,
+		  const struct fixture_setup_array *fsa,
+		  struct fixture_job *job, int counter)
+{
+	const char *runtime_dir = getenv("XDG_RUNTIME_DIR");
+	enum test_result_code ret;
+
+	if (!runtime_dir) {
+		fprintf(stderr, "Error: XDG_RUNTIME_DIR is not set.\n");
+		return false;
+	}
+
+	if (asprintf(&job->runtime_dir, "%s/weston-test-XXXXXX",
+		     runtime_dir) < 0) {
+		job->runtime_dir = NULL;
+		return false;
+	}
+
+	job->out = tmpfile();
+	job->err = tmpfile();
+	if (!job->out || !job->err || !mkdtemp(job->runtime_dir)) {
+		fprintf(stderr, "Error: setting up fixture job failed: %s\n",
+			strerror(errno));
+		return false;
+	}
+
+	fflush(stdout);
+	fflush(stderr);
+
+	job->pid = fork();
+	if (job->pid == -1) {
+		fprintf(stderr, "Error: fork failed: %s\n", strerror(errno));
+		return false;
+	}
+
+	if (job->pid > 0)
+		return true;
+
+	dup2(fileno(job->out), STDOUT_FILENO);
+	dup2(fileno(job->err), STDERR_FILENO);
+	setenv("XDG_RUNTIME_DIR", job->runtime_dir, 1);
+
+	/* Number the TAP lines as if the fixtures ran one after another. */
+	harness->data.counter = counter;
+	ret = run_fixture(harness, fsa, job->fi);
+
+	fflush(stdout);
+	fflush(stderr);
+	_exit(ret);
+}
+
+static void
+copy_stream(FILE *from, FILE *to)
+{
+	char buf[4096];
+	size_t len;
+
+	rewind(from);
+	while ((len = fread(buf, 1, sizeof buf, from)) > 0)
+		fwrite(buf, 1, len, to);
+	fflush(to);
+}
+
+static void
+fixture_job_finish(struct fixture_job *job)
+{
+	if (job->out) {
+		copy_stream(job->out, stdout);
+		fclose(job->out);
+	}
+	if (job->err) {
+		copy_stream(job->err, stderr);
+		fclose(job->err);
+	}
+	if (job->runtime_dir) {
+		remove_runtime_dir(job->runtime_dir);
+		free(job->runtime_dir);
+	}
+}
+
+static enum test_result_code
+status_to_result(int fi, int status)
+{
+	if (WIFEXITED(status))
+		return WEXITSTATUS(status);
+
+	testlog("--- Fixture %d killed by signal %d\n", fi + 1,
+		WTERMSIG(status));
+	return RESULT_HARD_ERROR;
+}
+
+/** Run fixtures in parallel child processes
+ *
+ * Every child gets its own XDG_RUNTIME_DIR, so the compositor sockets of
+ * fixtures running at the same time cannot collide. The output of the
+ * children is held back and printed in fixture order, so the TAP stream
+ * looks the same as a serial run.
+ */
+static enum test_result_code
+run_fixtures_parallel(struct weston_test_harness *harness,
+		      const struct fixture_setup_array *fsa,
+		      int fi, int fi_end)
+{
+	enum test_result_code result = RESULT_OK;
+	int n = fi_end - fi;
+	struct fixture_job *jobs;
+	int started = 0;
+	int reported = 0;
+	int active = 0;
+	int status;
+	pid_t pid;
+	int i;
+
+	/* The DRM-backend lock must stay shared between the children. */
+	if (getenv("XDG_RUNTIME_DIR"))
+		setenv("WESTON_TEST_SUITE_LOCK_DIR",
+		       getenv("XDG_RUNTIME_DIR"), 0);
+
+	jobs = calloc(n, sizeof *jobs);
+	assert(jobs);
+
+	while (reported < n) {
+		while (active < harness->jobs && started < n) {
+			struct fixture_job *job = &jobs[started];
+
+			job->fi = fi + started;
+			if (!fixture_job_start(harness, fsa, job,
+					       started * harness->data.total)) {
+				job->result = RESULT_HARD_ERROR;
+				job->done = true;
+			} else {
+				active++;
+			}
+			started++;
+		}
+
+		while (reported < n && jobs[reported].done) {
+			fixture_job_finish(&jobs[reported]);
+			merge_result(&result, jobs[reported].result);
+			reported++;
+		}
+
+		if (active == 0)
+			continue;
+
+		pid = waitpid(-1, &status, 0);
+		if (pid == -1) {
+			if (errno == EINTR)
+				continue;
+			fprintf(stderr, "Error: waitpid failed: %s\n",
+				strerror(errno));
+			abort();
+		}
+
+		for (i = 0; i < started; i++) {
+			if (jobs[i].pid != pid || jobs[i].done)
+				continue;
+
+			jobs[i].result = status_to_result(jobs[i].fi, status);
+			jobs[i].done = true;
+			active--;
+			break;
+		}
+	}
+
+	free(jobs);
+
+	return result;
+}
+
 int
 main(int argc, char *argv[])
 {
 	struct weston_test_harness *harness;
-	enum test_result_code ret;
 	enum test_result_code result = RESULT_OK;
 	const struct fixture_setup_array *fsa;
 	int fi;
@@ -645,35 +924,11 @@ main(int argc, char *argv[])
 	tap_plan(&harness->data, fi_end - fi);
 	testlog("Iterating through %d fixtures.\n", fi_end - fi);
 
-	for (; fi < fi_end; fi++) {
-		const void *arg = fixture_setup_array_get_arg(fsa, fi);
-
-		harness->data.fixture_iteration = fi;
-		harness->data.fixture_name = fixture_setup_array_get_name(fsa,
-									  fi);
-		harness->data.passed = 0;
-		harness->data.skipped = 0;
-		harness->data.failed = 0;
-
-		testlog("--- Fixture %d (%s)...\n",
-			fi + 1, harness->data.fixture_name);
-
-		ret = fixture_setup_run_(harness, arg);
-		fixture_report(&harness->data, ret);
-
-		if (ret == RESULT_SKIP) {
-			tap_skip_fixture(&harness->data);
-#if WESTON_TEST_SKIP_IS_FAILURE
-			ret = RESULT_FAIL;
-#else
-			continue;
-#endif
-		}
-
-		if (ret != RESULT_OK && result != RESULT_HARD_ERROR)
-			result = ret;
-		else if (counts_to_result(&harness->data) != RESULT_OK)
-			result = RESULT_FAIL;
+	if (harness->jobs > 1 && fi_end - fi > 1) {
+		result = run_fixtures_parallel(harness, fsa, fi, fi_end);
+	} else {
+		for (; fi < fi_end; fi++)
+			merge_result(&result, run_fixture(harness, fsa, fi));
 	}
 
 	weston_test_harness_destroy(harness);
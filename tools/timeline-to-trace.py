@@ -0,0 +1,153 @@
+# encoding=utf-8
+# Copyright © 2022 Collabora, Ltd.
+#
+# Permission is hereby granted, free of charge, to any person obtaining a
+# copy of this software and associated documentation files (the "Software"),
+# to deal in the Software without restriction, including without limitation
+# the rights to use, copy, modify, merge, publish, distribute, sublicense,
+# and/or sell copies of the Software, and to permit persons to whom the
+# Software is furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice (including the next
+# paragraph) shall be included in all copies or substantial portions of the
+# Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+# THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+# FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+# IN THE SOFTWARE.
+
+# Converts the 'timeline-binary' debug scope stream to the Chrome trace
+# event format, which Perfetto and chrome://tracing load:
+#
+#   weston-debug -o trace.bin timeline-binary
+#   timeline-to-trace.py trace.bin > trace.json
+#
+# See libweston/timeline.h for the stream layout. Points are drawn as
+# instant events on one track per output (track 0 when no output is
+# given), vblank and GPU timestamps as extra instants on the same track.
+
+import argparse
+import json
+import struct
+import sys
+
+MAGIC = b'WTLB'
+VERSION = 1
+
+TLB_NAME = 1
+TLB_OUTPUT = 2
+TLB_SURFACE = 3
+TLB_POINT = 4
+
+TLT_OUTPUT = 1
+TLT_SURFACE = 2
+TLT_VBLANK = 3
+TLT_GPU = 4
+
+
+def parse(data, endian):
+    names = {}
+    outputs = {}
+    surfaces = {}
+    events = []
+
+    pos = 8
+    while pos + 4 <= len(data):
+        rtype, rlen = struct.unpack_from(endian + 'HH', data, pos)
+        if rlen < 4 or pos + rlen > len(data):
+            sys.stderr.write('truncated record at offset %d\n' % pos)
+            break
+        body = data[pos + 4:pos + rlen]
+        pos += rlen
+
+        if rtype == TLB_NAME:
+            (nid,) = struct.unpack_from(endian + 'I', body)
+            names[nid] = body[4:].decode('utf-8', 'replace')
+        elif rtype == TLB_OUTPUT:
+            (oid,) = struct.unpack_from(endian + 'I', body)
+            outputs[oid] = body[4:].decode('utf-8', 'replace')
+            events.append({'ph': 'M', 'name': 'thread_name', 'pid': 1,
+                           'tid': oid,
+                           'args': {'name': 'output ' + outputs[oid]}})
+        elif rtype == TLB_SURFACE:
+            sid, main = struct.unpack_from(endian + 'II', body)
+            surfaces[sid] = {'desc': body[8:].decode('utf-8', 'replace'),
+                             'main_surface': main}
+        elif rtype == TLB_POINT:
+            events.extend(point(body, endian, names, surfaces))
+
+    return events
+
+
+def point(body, endian, names, surfaces):
+    nsec, nid = struct.unpack_from(endian + 'QI', body)
+    name = names.get(nid, 'point %d' % nid)
+    tid = 0
+    args = {}
+    extra = []
+
+    pos = 12
+    while pos < len(body):
+        otype = body[pos]
+        pos += 1
+        if otype in (TLT_OUTPUT, TLT_SURFACE):
+            (oid,) = struct.unpack_from(endian + 'I', body, pos)
+            pos += 4
+            if otype == TLT_OUTPUT:
+                tid = oid
+            else:
+                args['surface'] = oid
+                if oid in surfaces:
+                    args['surface_desc'] = surfaces[oid]['desc']
+        elif otype in (TLT_VBLANK, TLT_GPU):
+            (ts,) = struct.unpack_from(endian + 'Q', body, pos)
+            pos += 8
+            label = 'vblank' if otype == TLT_VBLANK else 'gpu'
+            args[label] = ts / 1000.0
+            extra.append((label, ts))
+        else:
+            break
+
+    events = [{'ph': 'i', 's': 't', 'name': name, 'ts': nsec / 1000.0,
+               'pid': 1, 'tid': tid, 'args': args}]
+    for label, ts in extra:
+        events.append({'ph': 'i', 's': 't', 'name': label,
+                       'ts': ts / 1000.0, 'pid': 1, 'tid': tid,
+                       'args': {'point': name}})
+    return events
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description='Convert a binary Weston timeline to Chrome trace JSON')
+    parser.add_argument('input', help='timeline-binary stream')
+    parser.add_argument('-o', '--output', help='output file, default stdout')
+    args = parser.parse_args()
+
+    with open(args.input, 'rb') as f:
+        data = f.read()
+
+    if data[:4] != MAGIC:
+        sys.exit('%s: not a binary Weston timeline' % args.input)
+
+    # The stream is in the byte order of the compositor host.
+    endian = '<'
+    if struct.unpack_from('<I', data, 4)[0] != VERSION:
+        endian = '>'
+        if struct.unpack_from('>I', data, 4)[0] != VERSION:
+            sys.exit('%s: unsupported timeline version' % args.input)
+
+    trace = {'traceEvents': parse(data, endian),
+             'displayTimeUnit': 'ms'}
+
+    out = open(args.output, 'w') if args.output else sys.stdout
+    json.dump(trace, out)
+    out.write('\n')
+
+
+if __name__ == '__main__':
+    main()
@@ -258,6 +258,16 @@ zuc_set_spawn(bool spawn);
 void
 zuc_set_output_junit(bool enable);
 
+/**
+ * Sets the number of timed samples each benchmark takes.
+ * Defaults to 100, which is the least for a meaningful 99th percentile.
+ *
+ * @param samples number of samples, or 0 for the default.
+ * @see ZUC_BENCH()
+ */
+void
+zuc_set_bench_samples(int samples);
+
 /**
  * Defines a test case that can be registered to run.
  *
@@ -307,6 +317,58 @@ zuc_set_output_junit(bool enable);
 	\
 	static void zuctest_##tcase##_##test(void *param)
 
+/**
+ * Defines a benchmark that is registered and run like a test.
+ *
+ * The body is to run the measured operation the given number of times.
+ * The framework first calls it with growing iteration counts until one
+ * call takes long enough to time reliably, keeps doing so for a warmup
+ * period, then times a number of calls with that count. The minimum, mean,
+ * median and 99th percentile time per iteration are reported alongside the
+ * test results.
+ *
+ * Assertions can be used in the body, a failure ends the measurement.
+ *
+ * @code
+ * ZUC_BENCH(matrix, multiply, iterations)
+ * {
+ *     struct weston_matrix a, b;
+ *     uint64_t i;
+ *
+ *     weston_matrix_init(&a);
+ *     weston_matrix_init(&b);
+ *     for (i = 0; i < iterations; i++) {
+ *         weston_matrix_multiply(&a, &b);
+ *         ZUC_BENCH_KEEP(&a);
+ *     }
+ * }
+ * @endcode
+ *
+ * @param tcase name to use as the containing test case.
+ * @param test name used for the benchmark under a given test case.
+ * @param iterations name for the uint64_t iteration count parameter.
+ * @see zuc_set_bench_samples()
+ * @see ZUC_BENCH_KEEP()
+ */
+#define ZUC_BENCH(tcase, test, iterations) \
+	static void zucbench_##tcase##_##test(uint64_t iterations); \
+	\
+	ZUC_TEST(tcase, test) \
+	{ \
+		zucimpl_run_bench(__FILE__, __LINE__, \
+				  zucbench_##tcase##_##test); \
+	} \
+	\
+	static void zucbench_##tcase##_##test(uint64_t iterations)
+
+/**
+ * Keeps the compiler from optimizing away the computation of a value in
+ * a benchmark body, or the stores through it if it is a pointer.
+ *
+ * @param value the scalar or pointer value to keep.
+ */
+#define ZUC_BENCH_KEEP(value) \
+	__asm__ __volatile__("" : : "g" (value) : "memory")
 
 /**
  * Returns true if the currently executing test has encountered any skips.
@@ -66,6 +66,8 @@ typedef void (*zucimpl_test_fn)(void);
 
 typedef void (*zucimpl_test_fn_f)(void *);
 
+typedef void (*zucimpl_bench_fn)(uint64_t iterations);
+
 /**
  * Internal use structure for automatic test case registration.
  * Should not be used directly in code.
@@ -91,6 +93,9 @@ int
 zucimpl_tracepoint(char const *file, int line, const char *fmt, ...)
 	__attribute__ ((format (printf, 3, 4)));
 
+void
+zucimpl_run_bench(char const *file, int line, zucimpl_bench_fn fn);
+
 int
 zucimpl_expect_pred2(char const *file, int line,
 		     enum zuc_check_op, enum zuc_check_valtype valtype,
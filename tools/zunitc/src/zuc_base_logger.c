@@ -106,6 +106,10 @@ check_triggered(void *data, char const *file, int line,
 		intptr_t val1, intptr_t val2,
 		const char *expr1, const char *expr2);
 
+static void
+bench_reported(void *data, struct zuc_test *test,
+	       const struct zuc_bench *bench);
+
 struct zuc_event_listener *
 zuc_base_logger_create(void)
 {
@@ -122,6 +126,7 @@ zuc_base_logger_create(void)
 	listener->test_started = test_started;
 	listener->test_ended = test_ended;
 	listener->check_triggered = check_triggered;
+	listener->bench_reported = bench_reported;
 
 	return listener;
 }
@@ -305,6 +310,19 @@ test_ended(void *data, struct zuc_test *test)
 	}
 }
 
+void
+bench_reported(void *data, struct zuc_test *test,
+	       const struct zuc_bench *bench)
+{
+	struct base_data *bdata = data;
+	styled_printf(bdata->use_color, STYLE_GOOD, "[    BENCH ]");
+	printf(" %s.%s median %.1f ns, p99 %.1f ns, min %.1f ns, "
+	       "mean %.1f ns (%d x %"PRIu64" iterations)\n",
+	       test->test_case->name, test->name,
+	       bench->median_ns, bench->p99_ns, bench->min_ns, bench->mean_ns,
+	       bench->samples, bench->iterations);
+}
+
 const char *
 zuc_get_opstr(enum zuc_check_op op)
 {
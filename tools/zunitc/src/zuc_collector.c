@@ -152,6 +152,10 @@ check_triggered(void *data, char const *file, int line,
 static void
 collect_event(void *data, char const *file, int line, const char *expr1);
 
+static void
+bench_reported(void *data, struct zuc_test *test,
+	       const struct zuc_bench *bench);
+
 struct zuc_event_listener *
 zuc_collector_create(int *pipe_fd)
 {
@@ -165,6 +169,7 @@ zuc_collector_create(int *pipe_fd)
 	listener->test_ended = test_ended;
 	listener->check_triggered = check_triggered;
 	listener->collect_event = collect_event;
+	listener->bench_reported = bench_reported;
 
 	return listener;
 }
@@ -239,6 +244,37 @@ collect_event(void *data, char const *file, int line, const char *expr1)
 		    0, 0, expr1, "");
 }
 
+void
+bench_reported(void *data, struct zuc_test *test,
+	       const struct zuc_bench *bench)
+{
+	struct collector_data *cdata = data;
+
+	zuc_attach_bench(test, bench);
+
+	if (*cdata->fd != -1) {
+		/* Parent and child are the same binary, so the struct can be
+		 * passed as is. */
+		int len = sizeof(int32_t) * 2 + sizeof(*bench);
+		char *buf = zalloc(len);
+		char *ptr = pack_int32(buf, len - 4);
+		int sent = 0;
+		int count;
+
+		ptr = pack_int32(ptr, ZUC_EVENT_BENCH);
+		memcpy(ptr, bench, sizeof(*bench));
+
+		while (sent < len) {
+			count = write(*cdata->fd, buf + sent, len - sent);
+			if (count == -1)
+				break;
+			sent += count;
+		}
+
+		free(buf);
+	}
+}
+
 void
 store_event(struct collector_data *cdata,
 	    enum zuc_event_type event_type, char const *file, int line,
@@ -419,8 +455,16 @@ zuc_process_message(struct zuc_test *test, int fd)
 		tmp = unpack_int32(raw, &val);
 		event_type = val;
 
-		struct zuc_event *evt = unpack_event(tmp, len - (tmp - raw));
-		zuc_attach_event(test, evt, event_type, true);
+		if (event_type == ZUC_EVENT_BENCH) {
+			struct zuc_bench bench;
+
+			memcpy(&bench, tmp, sizeof(bench));
+			zuc_attach_bench(test, &bench);
+		} else {
+			struct zuc_event *evt =
+				unpack_event(tmp, len - (tmp - raw));
+			zuc_attach_event(test, evt, event_type, true);
+		}
 		free(raw);
 	}
 	return got;
@@ -46,6 +46,7 @@ struct zuc_context {
 	bool break_on_failure;
 	bool output_tap;
 	bool output_junit;
+	int bench_samples;
 	int fds[2];
 	char *filter;
 
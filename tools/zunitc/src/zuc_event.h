@@ -36,7 +36,8 @@
 enum zuc_event_type
 {
 	ZUC_EVENT_IMMEDIATE,
-	ZUC_EVENT_DEFERRED
+	ZUC_EVENT_DEFERRED,
+	ZUC_EVENT_BENCH
 };
 
 /**
@@ -83,4 +84,14 @@ void
 zuc_attach_event(struct zuc_test *test, struct zuc_event *event,
 		 enum zuc_event_type event_type, bool transferred);
 
+/**
+ * Stores the results of a benchmark on the specified test, replacing any
+ * previous ones.
+ *
+ * @param test the test to attach to.
+ * @param bench the results to copy.
+ */
+void
+zuc_attach_bench(struct zuc_test *test, const struct zuc_bench *bench);
+
 #endif /* ZUC_EVENT_H */
@@ -33,6 +33,7 @@
 
 struct zuc_test;
 struct zuc_case;
+struct zuc_bench;
 
 /**
  * Interface to allow components to process testing events as they occur.
@@ -153,6 +154,16 @@ struct zuc_event_listener {
 				const char *expr1,
 				const char *expr2);
 
+	/**
+	 * Handler for the results of a benchmark, reported before the
+	 * test ends.
+	 *
+	 * @param data the user data associated with this instance.
+	 */
+	void (*bench_reported)(void *data,
+			       struct zuc_test *test,
+			       const struct zuc_bench *bench);
+
 	/**
 	 * Handler for tracepoints and such that may be displayed later.
 	 *
@@ -33,6 +33,7 @@
 #include <inttypes.h>
 #include <libxml/parser.h>
 #include <memory.h>
+#include <stdarg.h>
 #include <stdio.h>
 #include <sys/stat.h>
 #include <sys/types.h>
@@ -262,6 +263,49 @@ get_test_status(struct zuc_test *test)
 		return "run";
 }
 
+static void
+emit_bench_property(xmlNodePtr parent, const char *name, const char *fmt, ...)
+{
+	char *value = NULL;
+	va_list argp;
+	xmlNodePtr node;
+
+	va_start(argp, fmt);
+	if (vasprintf(&value, fmt, argp) < 0)
+		value = NULL;
+	va_end(argp);
+
+	if (!value)
+		return;
+
+	node = xmlNewChild(parent, NULL, BAD_CAST "property", NULL);
+	xmlSetProp(node, BAD_CAST "name", BAD_CAST name);
+	xmlSetProp(node, BAD_CAST "value", BAD_CAST value);
+	free(value);
+}
+
+/**
+ * Output the results of a benchmark as properties of its test, the form
+ * CI result parsers pick up.
+ *
+ * @param parent the testcase node to add new content to.
+ * @param bench the results to write out.
+ */
+static void
+emit_bench(xmlNodePtr parent, const struct zuc_bench *bench)
+{
+	xmlNodePtr node = xmlNewChild(parent, NULL, BAD_CAST "properties",
+				      NULL);
+
+	emit_bench_property(node, "bench_median_ns", "%.3f", bench->median_ns);
+	emit_bench_property(node, "bench_p99_ns", "%.3f", bench->p99_ns);
+	emit_bench_property(node, "bench_min_ns", "%.3f", bench->min_ns);
+	emit_bench_property(node, "bench_mean_ns", "%.3f", bench->mean_ns);
+	emit_bench_property(node, "bench_samples", "%d", bench->samples);
+	emit_bench_property(node, "bench_iterations", "%"PRIu64,
+			    bench->iterations);
+}
+
 /**
  * Output the given test.
  *
@@ -286,6 +330,9 @@ emit_test(xmlNodePtr parent, struct zuc_test *test)
 
 	xmlSetProp(node, BAD_CAST "classname", BAD_CAST test->test_case->name);
 
+	if (test->bench)
+		emit_bench(node, test->bench);
+
 	if ((test->failed || test->fatal || test->skipped) && test->events) {
 		struct zuc_event *evt;
 		for (evt = test->events; evt; evt = evt->next)
@@ -26,10 +26,25 @@
 #ifndef ZUC_TYPES_H
 #define ZUC_TYPES_H
 
+#include <stdint.h>
+
 #include "zunitc/zunitc_impl.h"
 
 struct zuc_case;
 
+/**
+ * Timing results of a benchmark, per iteration of its body.
+ */
+struct zuc_bench
+{
+	uint64_t iterations;	/**< iterations of the body per sample. */
+	int32_t samples;	/**< number of timed samples. */
+	double min_ns;
+	double mean_ns;
+	double median_ns;
+	double p99_ns;
+};
+
 /**
  * Represents a specific test.
  */
@@ -47,6 +62,7 @@ struct zuc_test
 	long elapsed;
 	struct zuc_event *events;
 	struct zuc_event *deferred;
+	struct zuc_bench *bench;
 };
 
 /**
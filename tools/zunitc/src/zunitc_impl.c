@@ -67,6 +67,12 @@ static char const DISABLED_PREFIX[] = "DISABLED_";
 #define MS_PER_SEC 1000L
 #define NANO_PER_MS 1000000L
 
+/* Samples shorter than this are dominated by the clock resolution */
+#define ZUC_BENCH_SAMPLE_NS (1 * NANO_PER_MS)
+/* Minimum time the body runs before measuring starts */
+#define ZUC_BENCH_WARMUP_NS (20 * NANO_PER_MS)
+#define ZUC_BENCH_DEFAULT_SAMPLES 100
+
 /**
  * Simple single-linked list structure.
  */
@@ -159,6 +165,12 @@ zuc_set_output_junit(bool enable)
 	g_ctx.output_junit = enable;
 }
 
+void
+zuc_set_bench_samples(int samples)
+{
+	g_ctx.bench_samples = samples;
+}
+
 const char *
 zuc_get_program_name(void)
 {
@@ -351,6 +363,7 @@ free_test(struct zuc_test *test)
 	free(test->name);
 	free_events(&test->events);
 	free_events(&test->deferred);
+	free(test->bench);
 	free(test);
 }
 
@@ -529,6 +542,7 @@ zuc_initialize(int *argc, char *argv[], bool *help_flagged)
 	bool opt_list = false;
 	int opt_repeat = 0;
 	int opt_random = 0;
+	int opt_bench_samples = 0;
 	bool opt_break_on_failure = false;
 	bool opt_junit = false;
 	char *opt_filter = NULL;
@@ -541,6 +555,8 @@ zuc_initialize(int *argc, char *argv[], bool *help_flagged)
 		{ WESTON_OPTION_BOOLEAN, "zuc-list-tests", 0, &opt_list },
 		{ WESTON_OPTION_INTEGER, "zuc-repeat", 0, &opt_repeat },
 		{ WESTON_OPTION_INTEGER, "zuc-random", 0, &opt_random },
+		{ WESTON_OPTION_INTEGER, "zuc-bench-samples", 0,
+		  &opt_bench_samples },
 		{ WESTON_OPTION_BOOLEAN, "zuc-break-on-failure", 0,
 		  &opt_break_on_failure },
 #if ENABLE_JUNIT_XML
@@ -630,6 +646,7 @@ zuc_initialize(int *argc, char *argv[], bool *help_flagged)
 
 	if (opt_help) {
 		printf("Usage: %s [OPTIONS]\n"
+		       "  --zuc-bench-samples=N\n"
 		       "  --zuc-break-on-failure\n"
 		       "  --zuc-filter=FILTER\n"
 		       "  --zuc-list-tests\n"
@@ -650,6 +667,7 @@ zuc_initialize(int *argc, char *argv[], bool *help_flagged)
 	} else {
 		zuc_set_repeat(opt_repeat);
 		zuc_set_random(opt_random);
+		zuc_set_bench_samples(opt_bench_samples);
 		zuc_set_spawn(!opt_nofork);
 		zuc_set_break_on_failure(opt_break_on_failure);
 		zuc_set_output_junit(opt_junit);
@@ -802,6 +820,18 @@ dispatch_collect_event(struct zuc_context *ctx, char const *file, int line,
 	}
 }
 
+static void
+dispatch_bench_reported(struct zuc_context *ctx, struct zuc_test *test,
+			const struct zuc_bench *bench)
+{
+	struct zuc_slinked *curr;
+	for (curr = ctx->listeners; curr; curr = curr->next) {
+		struct zuc_event_listener *listener = curr->data;
+		if (listener->bench_reported)
+			listener->bench_reported(listener->data, test, bench);
+	}
+}
+
 static void
 migrate_deferred_events(struct zuc_test *test, bool transferred)
 {
@@ -909,6 +939,20 @@ zuc_attach_event(struct zuc_test *test, struct zuc_event *event,
 	}
 }
 
+void
+zuc_attach_bench(struct zuc_test *test, const struct zuc_bench *bench)
+{
+	if (!test) {
+		printf("%s:%d: error: No current test.\n", __FILE__, __LINE__);
+		return;
+	}
+
+	if (!test->bench)
+		test->bench = zalloc(sizeof(*test->bench));
+	if (test->bench)
+		*test->bench = *bench;
+}
+
 void
 zuc_add_event_listener(struct zuc_event_listener *event_listener)
 {
@@ -1249,6 +1293,8 @@ reset_test_values(struct zuc_case **cases, int case_count)
 
 			free_events(&test->events);
 			free_events(&test->deferred);
+			free(test->bench);
+			test->bench = NULL;
 		}
 	}
 }
@@ -1372,6 +1418,106 @@ zucimpl_tracepoint(char const *file, int line, char const *fmt, ...)
 	return rc;
 }
 
+static int64_t
+time_bench(zucimpl_bench_fn fn, uint64_t iterations)
+{
+	struct timespec begin, end;
+
+	clock_gettime(TARGET_TIMER, &begin);
+	fn(iterations);
+	clock_gettime(TARGET_TIMER, &end);
+
+	return (int64_t)(end.tv_sec - begin.tv_sec) * MS_PER_SEC * NANO_PER_MS +
+		(end.tv_nsec - begin.tv_nsec);
+}
+
+static int
+compare_double(const void *lhs, const void *rhs)
+{
+	double a = *(const double *)lhs;
+	double b = *(const double *)rhs;
+
+	return (a > b) - (a < b);
+}
+
+/**
+ * Runs a benchmark body and reports its timing.
+ *
+ * The iteration count is scaled until a call takes ZUC_BENCH_SAMPLE_NS,
+ * the scaling calls doubling as warmup, which carries on until
+ * ZUC_BENCH_WARMUP_NS have been spent. The samples are then timed with
+ * a fixed iteration count, so that they are comparable.
+ */
+void
+zucimpl_run_bench(char const *file, int line, zucimpl_bench_fn fn)
+{
+	int count = g_ctx.bench_samples > 0 ?
+		g_ctx.bench_samples : ZUC_BENCH_DEFAULT_SAMPLES;
+	struct zuc_bench bench = { .samples = count };
+	uint64_t iterations = 1;
+	int64_t warmup = 0;
+	int64_t ns;
+	double *samples;
+	double sum = 0;
+	int i;
+
+	for (;;) {
+		ns = time_bench(fn, iterations);
+		warmup += ns;
+		if (zuc_has_failure() || zuc_has_skip())
+			return;
+		if (ns >= ZUC_BENCH_SAMPLE_NS)
+			break;
+
+		/* Aim a bit past the target, at most a hundredfold */
+		if (ns <= ZUC_BENCH_SAMPLE_NS / 100)
+			iterations *= 100;
+		else
+			iterations = iterations * ZUC_BENCH_SAMPLE_NS * 6 /
+				     (ns * 5) + 1;
+	}
+
+	while (warmup < ZUC_BENCH_WARMUP_NS) {
+		warmup += time_bench(fn, iterations);
+		if (zuc_has_failure() || zuc_has_skip())
+			return;
+	}
+
+	samples = zalloc(count * sizeof(*samples));
+	if (!samples) {
+		zucimpl_terminate(file, line, true, true,
+				  "Out of memory for benchmark samples");
+		return;
+	}
+
+	for (i = 0; i < count; ++i) {
+		ns = time_bench(fn, iterations);
+		if (zuc_has_failure() || zuc_has_skip()) {
+			free(samples);
+			return;
+		}
+		samples[i] = (double)ns / iterations;
+		sum += samples[i];
+	}
+
+	qsort(samples, count, sizeof(*samples), compare_double);
+
+	bench.iterations = iterations;
+	bench.min_ns = samples[0];
+	bench.mean_ns = sum / count;
+	if (count % 2)
+		bench.median_ns = samples[count / 2];
+	else
+		bench.median_ns = (samples[count / 2 - 1] +
+				   samples[count / 2]) / 2;
+	/* nearest rank */
+	bench.p99_ns = samples[(count * 99 + 99) / 100 - 1];
+
+	free(samples);
+
+	dispatch_bench_reported(&g_ctx, g_ctx.curr_test, &bench);
+}
+
 void
 zucimpl_terminate(char const *file, int line,
 		  bool fail, bool fatal, const char *msg)
@@ -462,3 +462,18 @@ ZUC_TEST(base_test, zed)
 	/* an additional test for the same case but later in source */
 	ZUC_ASSERT_EQ(3, 5 - 2);
 }
+
+ZUC_BENCH(base_test, bench_is_scaled, iterations)
+{
+	static uint64_t calls;
+	uint64_t sum = 0;
+	uint64_t i;
+
+	/* the first call is with a single iteration, later ones scale up */
+	ZUC_ASSERT_TRUE(calls++ > 0 || iterations == 1);
+
+	for (i = 0; i < iterations; i++) {
+		sum += i;
+		ZUC_BENCH_KEEP(sum);
+	}
+}
@@ -40,6 +40,7 @@
 #include <cairo.h>
 
 #include "wcap-decode.h"
+#include "wcap-convert.h"
 
 static void
 write_png(struct wcap_decoder *decoder, const char *filename)
@@ -55,120 +56,6 @@ write_png(struct wcap_decoder *decoder, const char *filename)
 	cairo_surface_destroy(surface);
 }
 
-static inline int
-rgb_to_yuv(uint32_t format, uint32_t p, int *u, int *v)
-{
-	int r, g, b, y;
-
-	switch (format) {
-	case WCAP_FORMAT_XRGB8888:
-		r = (p >> 16) & 0xff;
-		g = (p >> 8) & 0xff;
-		b = (p >> 0) & 0xff;
-		break;
-	case WCAP_FORMAT_XBGR8888:
-		r = (p >> 0) & 0xff;
-		g = (p >> 8) & 0xff;
-		b = (p >> 16) & 0xff;
-		break;
-	default:
-		assert(0);
-	}
-
-	y = (19595 * r + 38469 * g + 7472 * b) >> 16;
-	if (y > 255)
-		y = 255;
-
-	*u += 46727 * (r - y);
-	*v += 36962 * (b - y);
-
-	return y;
-}
-
-static inline
-int clamp_uv(int u)
-{
-	int clamp = (u >> 18) + 128;
-
-	if (clamp < 0)
-		return 0;
-	else if (clamp > 255)
-		return 255;
-	else
-		return clamp;
-}
-
-static void
-convert_to_yv12(struct wcap_decoder *decoder, unsigned char *out)
-{
-	unsigned char *y1, *y2, *u, *v;
-	uint32_t *p1, *p2, *end;
-	int i, u_accum, v_accum, stride0, stride1;
-	uint32_t format = decoder->format;
-
-	stride0 = decoder->width;
-	stride1 = decoder->width / 2;
-	for (i = 0; i < decoder->height; i += 2) {
-		y1 = out + stride0 * i;
-		y2 = y1 + stride0;
-		v = out + stride0 * decoder->height + stride1 * i / 2;
-		u = v + stride1 * decoder->height / 2;
-		p1 = decoder->frame + decoder->width * i;
-		p2 = p1 + decoder->width;
-		end = p1 + decoder->width;
-
-		while (p1 < end) {
-			u_accum = 0;
-			v_accum = 0;
-			y1[0] = rgb_to_yuv(format, p1[0], &u_accum, &v_accum);
-			y1[1] = rgb_to_yuv(format, p1[1], &u_accum, &v_accum);
-			y2[0] = rgb_to_yuv(format, p2[0], &u_accum, &v_accum);
-			y2[1] = rgb_to_yuv(format, p2[1], &u_accum, &v_accum);
-			u[0] = clamp_uv(u_accum);
-			v[0] = clamp_uv(v_accum);
-
-			y1 += 2;
-			p1 += 2;
-			y2 += 2;
-			p2 += 2;
-			u++;
-			v++;
-		}
-	}
-}
-
-static void
-convert_to_yuv444(struct wcap_decoder *decoder, unsigned char *out)
-{
-
-	unsigned char *yp, *up, *vp;
-	uint32_t *rp, *end;
-	int u, v;
-	int i, stride, psize;
-	uint32_t format = decoder->format;
-
-	stride = decoder->width;
-	psize = stride * decoder->height;
-	for (i = 0; i < decoder->height; i++) {
-		yp = out + stride * i;
-		up = yp + (psize * 2);
-		vp = yp + (psize * 1);
-		rp = decoder->frame + decoder->width * i;
-		end = rp + decoder->width;
-		while (rp < end) {
-			u = 0;
-			v = 0;
-			yp[0] = rgb_to_yuv(format, rp[0], &u, &v);
-			up[0] = clamp_uv(u/.3);
-			vp[0] = clamp_uv(v/.3);
-			up++;
-			vp++;
-			yp++;
-			rp++;
-		}
-	}
-}
-
 static void
 output_yuv_frame(struct wcap_decoder *decoder, int depth)
 {
@@ -184,9 +71,11 @@ output_yuv_frame(struct wcap_decoder *decoder, int depth)
 		out = malloc(size);
 
 	if (depth == 444) {
-		convert_to_yuv444(decoder, out);
+		wcap_convert_to_yuv444(decoder->format, decoder->frame,
+				       decoder->width, decoder->height, out);
 	} else {
-		convert_to_yv12(decoder, out);
+		wcap_convert_to_yv12(decoder->format, decoder->frame,
+				     decoder->width, decoder->height, out);
 	}
 
 	printf("FRAME\n");
@@ -198,14 +87,16 @@ usage(int exit_code)
 {
 	fprintf(stderr, "usage: wcap-decode "
 		"[--help] [--yuv4mpeg2] [--frame=<frame>] [--all] \n"
-		"\t[--rate=<num:denom>] <wcap file>\n\n"
+		"\t[--rate=<num:denom>] [--threads=<n>] <wcap file>\n\n"
 		"\t--help\t\t\tthis help text\n"
 		"\t--yuv4mpeg2\t\tdump wcap file to stdout in yuv4mpeg2 format\n"
 		"\t--yuv4mpeg2-444\t\tdump wcap file to stdout in yuv4mpeg2 444 format\n"
 		"\t--frame=<frame>\t\twrite out the given frame number as png\n"
 		"\t--all\t\t\twrite all frames as pngs\n"
 		"\t--rate=<num:denom>\treplay frame rate for yuv4mpeg2,\n"
-		"\t\t\t\tspecified as an integer fraction\n\n");
+		"\t\t\t\tspecified as an integer fraction\n"
+		"\t--threads=<n>\t\tdecode damage rectangles on n threads,\n"
+		"\t\t\t\tdefaults to the number of CPUs\n\n");
 
 	exit(exit_code);
 }
@@ -215,6 +106,7 @@ int main(int argc, char *argv[])
 	struct wcap_decoder *decoder;
 	int i, j, output_frame = -1, yuv4mpeg2 = 0, all = 0, has_frame;
 	int num = 30, denom = 1;
+	int threads = sysconf(_SC_NPROCESSORS_ONLN);
 	char filename[200];
 	char *mode;
 	uint32_t msecs, frame_time;
@@ -234,6 +126,8 @@ int main(int argc, char *argv[])
 			;
 		} else if (sscanf(argv[i], "--rate=%d:%d", &num, &denom) == 2) {
 			;
+		} else if (sscanf(argv[i], "--threads=%d", &threads) == 1) {
+			;
 		} else if (strcmp(argv[i], "--") == 0) {
 			break;
 		} else if (argv[i][0] == '-') {
@@ -259,6 +153,9 @@ int main(int argc, char *argv[])
 		exit(EXIT_FAILURE);
 	}
 
+	if (threads > 1 && wcap_decoder_set_threads(decoder, threads) < 0)
+		fprintf(stderr, "Decoding on one thread only\n");
+
 	if (yuv4mpeg2 && isatty(1)) {
 		fprintf(stderr, "Not dumping yuv4mpeg2 data to terminal.  Pipe output to a file or a process.\n");
 		fprintf(stderr, "For example, to encode to webm, use something like\n\n");
@@ -283,6 +180,25 @@ int main(int argc, char *argv[])
 	has_frame = wcap_decoder_get_frame(decoder);
 	msecs = decoder->msecs;
 	frame_time = 1000 * denom / num;
+
+	/* v2 files can go straight to the keyframe before a single frame */
+	if (decoder->version == 2 && output_frame >= 0 && !all && !yuv4mpeg2) {
+		if (has_frame &&
+		    wcap_decoder_seek(decoder,
+				      msecs + output_frame * frame_time)) {
+			snprintf(filename, sizeof filename,
+				 "wcap-frame-%d.png", output_frame);
+			write_png(decoder, filename);
+			fprintf(stderr, "wrote %s\n", filename);
+		}
+
+		fprintf(stderr, "wcap file: size %dx%d, %u recorded frames\n",
+			decoder->width, decoder->height, decoder->n_frames);
+		wcap_decoder_destroy(decoder);
+
+		return EXIT_SUCCESS;
+	}
+
 	while (has_frame) {
 		if (all || i == output_frame) {
 			snprintf(filename, sizeof filename,
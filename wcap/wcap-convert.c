@@ -0,0 +1,306 @@
+/*
+ * Copyright © 2022 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define WCAP_SSE2 1
+#endif
+
+#include "wcap-decode.h"
+#include "wcap-convert.h"
+
+#if defined(WCAP_SSE2)
+static bool use_simd = true;
+#else
+static bool use_simd = false;
+#endif
+
+bool
+wcap_convert_simd_enable(bool enable)
+{
+#if defined(WCAP_SSE2)
+	use_simd = enable;
+#endif
+	return use_simd;
+}
+
+static inline int
+rgb_to_yuv(uint32_t format, uint32_t p, int *u, int *v)
+{
+	int r, g, b, y;
+
+	switch (format) {
+	case WCAP_FORMAT_XRGB8888:
+		r = (p >> 16) & 0xff;
+		g = (p >> 8) & 0xff;
+		b = (p >> 0) & 0xff;
+		break;
+	case WCAP_FORMAT_XBGR8888:
+		r = (p >> 0) & 0xff;
+		g = (p >> 8) & 0xff;
+		b = (p >> 16) & 0xff;
+		break;
+	default:
+		assert(0);
+	}
+
+	y = (19595 * r + 38469 * g + 7472 * b) >> 16;
+	if (y > 255)
+		y = 255;
+
+	*u += 46727 * (r - y);
+	*v += 36962 * (b - y);
+
+	return y;
+}
+
+static inline
+int clamp_uv(int u)
+{
+	int clamp = (u >> 18) + 128;
+
+	if (clamp < 0)
+		return 0;
+	else if (clamp > 255)
+		return 255;
+	else
+		return clamp;
+}
+
+#if defined(WCAP_SSE2)
+/*
+ * The coefficients above 32767 do not fit _mm_madd_epi16(), so they are
+ * split into 32768, done with a shift, and the remainder. All products
+ * stay exactly the integers rgb_to_yuv() computes.
+ */
+struct yuv_sse2 {
+	__m128i y, u, v;
+};
+
+static inline struct yuv_sse2
+rgb_to_yuv_sse2(uint32_t format, __m128i p)
+{
+	const __m128i mask = _mm_set1_epi32(0xff);
+	const __m128i low16 = _mm_set1_epi32(0xffff);
+	__m128i rb, g, r, b, d;
+	__m128i coef_rb;
+	struct yuv_sse2 out;
+
+	if (format == WCAP_FORMAT_XRGB8888) {
+		coef_rb = _mm_set1_epi32(19595 << 16 | 7472);
+		r = _mm_and_si128(_mm_srli_epi32(p, 16), mask);
+		b = _mm_and_si128(p, mask);
+	} else {
+		coef_rb = _mm_set1_epi32(7472 << 16 | 19595);
+		r = _mm_and_si128(p, mask);
+		b = _mm_and_si128(_mm_srli_epi32(p, 16), mask);
+	}
+
+	rb = _mm_and_si128(p, _mm_set1_epi32(0x00ff00ff));
+	g = _mm_and_si128(_mm_srli_epi32(p, 8), mask);
+
+	/* 38469 = 32768 + 5701 */
+	out.y = _mm_madd_epi16(rb, coef_rb);
+	out.y = _mm_add_epi32(out.y, _mm_madd_epi16(g, _mm_set1_epi32(5701)));
+	out.y = _mm_add_epi32(out.y, _mm_slli_epi32(g, 15));
+	out.y = _mm_srli_epi32(out.y, 16);
+
+	/* 46727 = 32768 + 13959, on r - y as a signed 16-bit value */
+	d = _mm_sub_epi32(r, out.y);
+	out.u = _mm_madd_epi16(_mm_and_si128(d, low16), _mm_set1_epi32(13959));
+	out.u = _mm_add_epi32(out.u, _mm_slli_epi32(d, 15));
+
+	/* 36962 = 32768 + 4194 */
+	d = _mm_sub_epi32(b, out.y);
+	out.v = _mm_madd_epi16(_mm_and_si128(d, low16), _mm_set1_epi32(4194));
+	out.v = _mm_add_epi32(out.v, _mm_slli_epi32(d, 15));
+
+	return out;
+}
+
+/* Saturates exactly like clamp_uv() on the packed result. */
+static inline __m128i
+clamp_uv_sse2(__m128i u)
+{
+	return _mm_add_epi32(_mm_srai_epi32(u, 18), _mm_set1_epi32(128));
+}
+
+static inline uint32_t
+pack_bytes_sse2(__m128i v)
+{
+	v = _mm_packs_epi32(v, v);
+	v = _mm_packus_epi16(v, v);
+
+	return _mm_cvtsi128_si32(v);
+}
+
+static inline void
+store4(unsigned char *dst, uint32_t v)
+{
+	memcpy(dst, &v, sizeof v);
+}
+
+static inline __m128i
+div_point3_sse2(__m128i u)
+{
+	const __m128d point3 = _mm_set1_pd(.3);
+	__m128i lo, hi;
+
+	lo = _mm_cvttpd_epi32(_mm_div_pd(_mm_cvtepi32_pd(u), point3));
+	hi = _mm_cvttpd_epi32(_mm_div_pd(_mm_cvtepi32_pd(_mm_srli_si128(u, 8)),
+					 point3));
+
+	return _mm_unpacklo_epi64(lo, hi);
+}
+#endif
+
+static void
+convert_yv12_rows(uint32_t format, const uint32_t *p1, const uint32_t *p2,
+		  int width, unsigned char *y1, unsigned char *y2,
+		  unsigned char *u, unsigned char *v)
+{
+	int x = 0, u_accum, v_accum;
+
+#if defined(WCAP_SSE2)
+	if (use_simd && (format == WCAP_FORMAT_XRGB8888 ||
+			 format == WCAP_FORMAT_XBGR8888)) {
+		struct yuv_sse2 a, b;
+		__m128i su, sv;
+		uint32_t uv;
+
+		for (; x + 4 <= width; x += 4) {
+			a = rgb_to_yuv_sse2(format,
+				_mm_loadu_si128((const __m128i *) &p1[x]));
+			b = rgb_to_yuv_sse2(format,
+				_mm_loadu_si128((const __m128i *) &p2[x]));
+			store4(&y1[x], pack_bytes_sse2(a.y));
+			store4(&y2[x], pack_bytes_sse2(b.y));
+
+			/* Sum each 2x2 block into lanes 0 and 2 */
+			su = _mm_add_epi32(a.u, b.u);
+			su = _mm_add_epi32(su, _mm_srli_epi64(su, 32));
+			su = _mm_shuffle_epi32(su, _MM_SHUFFLE(3, 1, 2, 0));
+			sv = _mm_add_epi32(a.v, b.v);
+			sv = _mm_add_epi32(sv, _mm_srli_epi64(sv, 32));
+			sv = _mm_shuffle_epi32(sv, _MM_SHUFFLE(3, 1, 2, 0));
+
+			uv = pack_bytes_sse2(clamp_uv_sse2(su));
+			u[x / 2] = uv & 0xff;
+			u[x / 2 + 1] = (uv >> 8) & 0xff;
+			uv = pack_bytes_sse2(clamp_uv_sse2(sv));
+			v[x / 2] = uv & 0xff;
+			v[x / 2 + 1] = (uv >> 8) & 0xff;
+		}
+	}
+#endif
+
+	for (; x < width; x += 2) {
+		u_accum = 0;
+		v_accum = 0;
+		y1[x] = rgb_to_yuv(format, p1[x], &u_accum, &v_accum);
+		y1[x + 1] = rgb_to_yuv(format, p1[x + 1], &u_accum, &v_accum);
+		y2[x] = rgb_to_yuv(format, p2[x], &u_accum, &v_accum);
+		y2[x + 1] = rgb_to_yuv(format, p2[x + 1], &u_accum, &v_accum);
+		u[x / 2] = clamp_uv(u_accum);
+		v[x / 2] = clamp_uv(v_accum);
+	}
+}
+
+void
+wcap_convert_to_yv12(uint32_t format, const uint32_t *frame,
+		     int width, int height, unsigned char *out)
+{
+	unsigned char *y1, *y2, *u, *v;
+	const uint32_t *p1, *p2;
+	int i, stride0, stride1;
+
+	stride0 = width;
+	stride1 = width / 2;
+	for (i = 0; i < height; i += 2) {
+		y1 = out + stride0 * i;
+		y2 = y1 + stride0;
+		v = out + stride0 * height + stride1 * i / 2;
+		u = v + stride1 * height / 2;
+		p1 = frame + width * i;
+		p2 = p1 + width;
+
+		convert_yv12_rows(format, p1, p2, width, y1, y2, u, v);
+	}
+}
+
+static void
+convert_yuv444_row(uint32_t format, const uint32_t *rp, int width,
+		   unsigned char *yp, unsigned char *up, unsigned char *vp)
+{
+	int x = 0, u, v;
+
+#if defined(WCAP_SSE2)
+	if (use_simd && (format == WCAP_FORMAT_XRGB8888 ||
+			 format == WCAP_FORMAT_XBGR8888)) {
+		struct yuv_sse2 a;
+
+		for (; x + 4 <= width; x += 4) {
+			a = rgb_to_yuv_sse2(format,
+				_mm_loadu_si128((const __m128i *) &rp[x]));
+			store4(&yp[x], pack_bytes_sse2(a.y));
+			store4(&up[x],
+			       pack_bytes_sse2(clamp_uv_sse2(div_point3_sse2(a.u))));
+			store4(&vp[x],
+			       pack_bytes_sse2(clamp_uv_sse2(div_point3_sse2(a.v))));
+		}
+	}
+#endif
+
+	for (; x < width; x++) {
+		u = 0;
+		v = 0;
+		yp[x] = rgb_to_yuv(format, rp[x], &u, &v);
+		up[x] = clamp_uv(u/.3);
+		vp[x] = clamp_uv(v/.3);
+	}
+}
+
+void
+wcap_convert_to_yuv444(uint32_t format, const uint32_t *frame,
+		       int width, int height, unsigned char *out)
+{
+	int i, stride, psize;
+
+	stride = width;
+	psize = stride * height;
+	for (i = 0; i < height; i++) {
+		convert_yuv444_row(format, frame + width * i, width,
+				   out + stride * i,
+				   out + stride * i + psize * 2,
+				   out + stride * i + psize);
+	}
+}
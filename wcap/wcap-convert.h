@@ -0,0 +1,56 @@
+/*
+ * Copyright © 2022 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _WCAP_CONVERT_
+#define _WCAP_CONVERT_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/** Select the SIMD or the scalar implementation
+ *
+ * SIMD is used by default when the build target has SSE2. Both paths
+ * produce identical results.
+ *
+ * \return True if the SIMD implementation is now in use.
+ */
+bool
+wcap_convert_simd_enable(bool enable);
+
+/** Convert a decoded frame to planar YV12
+ *
+ * out holds width * height luma bytes, followed by the V and the U plane
+ * at half resolution in both directions.
+ */
+void
+wcap_convert_to_yv12(uint32_t format, const uint32_t *frame,
+		     int width, int height, unsigned char *out);
+
+/** Convert a decoded frame to planar 4:4:4 in Y, V, U order */
+void
+wcap_convert_to_yuv444(uint32_t format, const uint32_t *frame,
+		       int width, int height, unsigned char *out);
+
+#endif
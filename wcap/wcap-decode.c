@@ -35,18 +35,33 @@
 #include <unistd.h>
 #include <string.h>
 #include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
 
-#include <cairo.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
 
 #include "wcap-decode.h"
 
-static void
+static inline int
+run_length(uint32_t v)
+{
+	int l = v >> 24;
+
+	if (l < 0xe0)
+		return l + 1;
+	else
+		return 1 << (l - 0xe0 + 7);
+}
+
+static uint32_t *
 wcap_decoder_decode_rectangle(struct wcap_decoder *decoder,
-			      struct wcap_rectangle *rect)
+			      struct wcap_rectangle *rect, uint32_t *p)
 {
-	uint32_t v, *p = decoder->p, *d;
+	uint32_t v, *d;
 	int width = rect->x2 - rect->x1, height = rect->y2 - rect->y1;
-	int x, i, j, k, l, count = width * height;
+	int x, i, j, k, count = width * height;
 	unsigned char r, g, b, dr, dg, db;
 
 	d = decoder->frame + (rect->y2 - 1) * decoder->width;
@@ -54,12 +69,7 @@ wcap_decoder_decode_rectangle(struct wcap_decoder *decoder,
 	i = 0;
 	while (i < count) {
 		v = *p++;
-		l = v >> 24;
-		if (l < 0xe0) {
-			j = l + 1;
-		} else {
-			j = 1 << (l - 0xe0 + 7);
-		}
+		j = run_length(v);
 
 		dr = (v >> 16);
 		dg = (v >>  8);
@@ -82,40 +92,477 @@ wcap_decoder_decode_rectangle(struct wcap_decoder *decoder,
 		printf("rle encoding longer than expected (%d expected %d)\n",
 		       i, count);
 
-	decoder->p = p;
+	return p;
+}
+
+/* Find where the next rectangle starts without touching the frame */
+static uint32_t *
+wcap_rectangle_skip(struct wcap_rectangle *rect, uint32_t *p)
+{
+	int count = (rect->x2 - rect->x1) * (rect->y2 - rect->y1);
+	int i = 0;
+
+	while (i < count)
+		i += run_length(*p++);
+
+	return p;
+}
+
+static bool
+wcap_rectangles_overlap(const struct wcap_rectangle *rects, uint32_t n)
+{
+	uint32_t i, j;
+
+	for (i = 0; i < n; i++) {
+		for (j = i + 1; j < n; j++) {
+			if (rects[i].x1 < rects[j].x2 &&
+			    rects[j].x1 < rects[i].x2 &&
+			    rects[i].y1 < rects[j].y2 &&
+			    rects[j].y1 < rects[i].y2)
+				return true;
+		}
+	}
+
+	return false;
+}
+
+struct wcap_decode_job {
+	struct wcap_rectangle *rect;
+	uint32_t *data;
+};
+
+/*
+ * Rectangles of a frame cover disjoint pixels, so once their start in the
+ * stream is known they can be decoded in any order. The calling thread
+ * takes jobs too; the workers only add throughput.
+ */
+struct wcap_decode_pool {
+	struct wcap_decoder *decoder;
+	pthread_t *threads;
+	int n_threads;
+
+	pthread_mutex_t mutex;
+	pthread_cond_t work_cond;
+	pthread_cond_t done_cond;
+	bool quit;
+
+	struct wcap_decode_job *jobs;
+	uint32_t jobs_size;
+	uint32_t n_jobs, next_job, done_jobs;
+};
+
+/* Called with the pool mutex held, returns with it held. */
+static void
+wcap_decode_pool_run_jobs(struct wcap_decode_pool *pool)
+{
+	struct wcap_decode_job *job;
+
+	while (pool->next_job < pool->n_jobs) {
+		job = &pool->jobs[pool->next_job++];
+
+		pthread_mutex_unlock(&pool->mutex);
+		wcap_decoder_decode_rectangle(pool->decoder, job->rect,
+					      job->data);
+		pthread_mutex_lock(&pool->mutex);
+
+		if (++pool->done_jobs == pool->n_jobs)
+			pthread_cond_signal(&pool->done_cond);
+	}
+}
+
+static void *
+wcap_decode_pool_worker(void *data)
+{
+	struct wcap_decode_pool *pool = data;
+
+	pthread_mutex_lock(&pool->mutex);
+	while (!pool->quit) {
+		if (pool->next_job >= pool->n_jobs) {
+			pthread_cond_wait(&pool->work_cond, &pool->mutex);
+			continue;
+		}
+
+		wcap_decode_pool_run_jobs(pool);
+	}
+	pthread_mutex_unlock(&pool->mutex);
+
+	return NULL;
+}
+
+static void
+wcap_decode_pool_destroy(struct wcap_decode_pool *pool)
+{
+	int i;
+
+	pthread_mutex_lock(&pool->mutex);
+	pool->quit = true;
+	pthread_cond_broadcast(&pool->work_cond);
+	pthread_mutex_unlock(&pool->mutex);
+
+	for (i = 0; i < pool->n_threads; i++)
+		pthread_join(pool->threads[i], NULL);
+
+	pthread_cond_destroy(&pool->done_cond);
+	pthread_cond_destroy(&pool->work_cond);
+	pthread_mutex_destroy(&pool->mutex);
+	free(pool->threads);
+	free(pool->jobs);
+	free(pool);
+}
+
+static struct wcap_decode_pool *
+wcap_decode_pool_create(struct wcap_decoder *decoder, int n_threads)
+{
+	struct wcap_decode_pool *pool;
+
+	pool = calloc(1, sizeof *pool);
+	if (pool == NULL)
+		return NULL;
+
+	pool->decoder = decoder;
+	pool->threads = calloc(n_threads, sizeof *pool->threads);
+	if (pool->threads == NULL) {
+		free(pool);
+		return NULL;
+	}
+
+	pthread_mutex_init(&pool->mutex, NULL);
+	pthread_cond_init(&pool->work_cond, NULL);
+	pthread_cond_init(&pool->done_cond, NULL);
+
+	for (pool->n_threads = 0; pool->n_threads < n_threads;
+	     pool->n_threads++) {
+		if (pthread_create(&pool->threads[pool->n_threads], NULL,
+				   wcap_decode_pool_worker, pool) != 0)
+			break;
+	}
+
+	if (pool->n_threads == 0) {
+		wcap_decode_pool_destroy(pool);
+		return NULL;
+	}
+
+	return pool;
+}
+
+/* Returns the end of the frame's data, or NULL if nothing was decoded. */
+static uint32_t *
+wcap_decode_pool_decode(struct wcap_decode_pool *pool,
+			struct wcap_rectangle *rects, uint32_t nrects,
+			uint32_t *p)
+{
+	struct wcap_decode_job *jobs;
+	uint32_t i;
+
+	if (nrects > pool->jobs_size) {
+		jobs = realloc(pool->jobs, nrects * sizeof *jobs);
+		if (jobs == NULL)
+			return NULL;
+		pool->jobs = jobs;
+		pool->jobs_size = nrects;
+	}
+
+	for (i = 0; i < nrects; i++) {
+		pool->jobs[i].rect = &rects[i];
+		pool->jobs[i].data = p;
+		p = wcap_rectangle_skip(&rects[i], p);
+	}
+
+	pthread_mutex_lock(&pool->mutex);
+	pool->n_jobs = nrects;
+	pool->next_job = 0;
+	pool->done_jobs = 0;
+	pthread_cond_broadcast(&pool->work_cond);
+
+	wcap_decode_pool_run_jobs(pool);
+	while (pool->done_jobs < pool->n_jobs)
+		pthread_cond_wait(&pool->done_cond, &pool->mutex);
+	pthread_mutex_unlock(&pool->mutex);
+
+	return p;
+}
+
+/* Returns the end of the frame's data. */
+static uint32_t *
+wcap_decoder_decode_frame(struct wcap_decoder *decoder,
+			  struct wcap_rectangle *rects, uint32_t nrects)
+{
+	uint32_t i, *p, *end = NULL;
+
+	p = (uint32_t *) (rects + nrects);
+
+	if (decoder->pool && nrects > 1 &&
+	    !wcap_rectangles_overlap(rects, nrects))
+		end = wcap_decode_pool_decode(decoder->pool, rects, nrects, p);
+
+	if (end == NULL) {
+		for (i = 0; i < nrects; i++)
+			p = wcap_decoder_decode_rectangle(decoder, &rects[i], p);
+		end = p;
+	}
+
+	return end;
+}
+
+static size_t
+wcap_frame_stored_size(const struct wcap_frame_header_v2 *header)
+{
+	return sizeof *header + ((header->size + 3) & ~3u);
+}
+
+static void *
+wcap_decoder_decompress(struct wcap_decoder *decoder,
+			const struct wcap_frame_header_v2 *header)
+{
+#ifdef HAVE_ZSTD
+	size_t ret;
+	void *raw;
+
+	if (header->raw_size > decoder->raw_size) {
+		raw = realloc(decoder->raw, header->raw_size);
+		if (raw == NULL)
+			return NULL;
+		decoder->raw = raw;
+		decoder->raw_size = header->raw_size;
+	}
+
+	ret = ZSTD_decompress(decoder->raw, header->raw_size,
+			      header + 1, header->size);
+	if (ZSTD_isError(ret)) {
+		fprintf(stderr, "frame %u: %s\n", decoder->count,
+			ZSTD_getErrorName(ret));
+		return NULL;
+	}
+	if (ret != header->raw_size) {
+		fprintf(stderr, "frame %u: decompressed to %zu bytes, "
+			"expected %u\n", decoder->count, ret, header->raw_size);
+		return NULL;
+	}
+
+	return decoder->raw;
+#else
+	return NULL;
+#endif
+}
+
+static int
+wcap_decoder_get_frame_v2(struct wcap_decoder *decoder)
+{
+	struct wcap_frame_header_v2 *header = decoder->p;
+	void *payload = header + 1;
+	size_t left = (char *) decoder->end - (char *) decoder->p;
+
+	if (left < sizeof *header || left < wcap_frame_stored_size(header))
+		return 0;
+
+	if (header->flags & WCAP_FRAME_COMPRESSED) {
+		payload = wcap_decoder_decompress(decoder, header);
+		if (payload == NULL)
+			return 0;
+	}
+
+	/* Keyframes are decoded against a blank frame, which is what makes
+	 * them a place to start from. */
+	if (header->flags & WCAP_FRAME_KEYFRAME)
+		memset(decoder->frame, 0,
+		       decoder->width * decoder->height * 4);
+
+	decoder->msecs = header->msecs;
+	decoder->count++;
+	wcap_decoder_decode_frame(decoder, payload, header->nrects);
+	decoder->p = (char *) header + wcap_frame_stored_size(header);
+
+	return 1;
 }
 
 int
 wcap_decoder_get_frame(struct wcap_decoder *decoder)
 {
-	struct wcap_rectangle *rects;
 	struct wcap_frame_header *header;
-	uint32_t i;
 
-	if (decoder->p == decoder->end)
+	if (decoder->p >= decoder->end)
 		return 0;
 
+	if (decoder->version == 2)
+		return wcap_decoder_get_frame_v2(decoder);
+
 	header = decoder->p;
 	decoder->msecs = header->msecs;
 	decoder->count++;
 
-	rects = (void *) (header + 1);
-	decoder->p = (uint32_t *) (rects + header->nrects);
-	for (i = 0; i < header->nrects; i++)
-		wcap_decoder_decode_rectangle(decoder, &rects[i]);
+	decoder->p = wcap_decoder_decode_frame(decoder, (void *) (header + 1),
+					       header->nrects);
+
+	return 1;
+}
+
+static void
+wcap_decoder_rewind(struct wcap_decoder *decoder)
+{
+	if (decoder->version == 2)
+		decoder->p = (struct wcap_header_v2 *) decoder->map + 1;
+	else
+		decoder->p = (struct wcap_header *) decoder->map + 1;
+
+	decoder->count = 0;
+	decoder->msecs = 0;
+	memset(decoder->frame, 0, decoder->width * decoder->height * 4);
+}
+
+/** Decode up to the first frame at or after msecs
+ *
+ * In v2 files this starts from the last keyframe before msecs, unless the
+ * current frame is already past it and still before msecs. v1 files have
+ * no keyframes, so seeking backwards replays them from the start.
+ *
+ * \return 1 if a frame was decoded, 0 if the recording ends before msecs.
+ */
+int
+wcap_decoder_seek(struct wcap_decoder *decoder, uint32_t msecs)
+{
+	const struct wcap_index_entry *entry = NULL;
+	bool moved = true;
+	uint32_t i;
+
+	for (i = 0; i < decoder->n_index; i++) {
+		if (decoder->index[i].msecs > msecs)
+			break;
+		entry = &decoder->index[i];
+	}
+
+	if (entry && (entry->frame >= decoder->count ||
+		      decoder->msecs > msecs)) {
+		decoder->p = (char *) decoder->map + entry->offset;
+		decoder->count = entry->frame;
+	} else if (decoder->count == 0 || decoder->msecs > msecs) {
+		wcap_decoder_rewind(decoder);
+	} else {
+		moved = false;
+	}
+
+	if (!moved && decoder->msecs >= msecs)
+		return 1;
+
+	do {
+		if (!wcap_decoder_get_frame(decoder))
+			return 0;
+	} while (decoder->msecs < msecs);
 
 	return 1;
 }
 
+int
+wcap_decoder_set_threads(struct wcap_decoder *decoder, int n_threads)
+{
+	if (decoder->pool) {
+		wcap_decode_pool_destroy(decoder->pool);
+		decoder->pool = NULL;
+	}
+
+	if (n_threads <= 1)
+		return 0;
+
+	decoder->pool = wcap_decode_pool_create(decoder, n_threads - 1);
+
+	return decoder->pool ? 0 : -1;
+}
+
+static int
+wcap_decoder_add_index_entry(struct wcap_decoder *decoder,
+			     const struct wcap_frame_header_v2 *header,
+			     uint32_t *alloc)
+{
+	struct wcap_index_entry *index, *entry;
+
+	if (decoder->n_index == *alloc) {
+		*alloc = *alloc ? *alloc * 2 : 16;
+		index = realloc(decoder->index, *alloc * sizeof *index);
+		if (index == NULL)
+			return -1;
+		decoder->index = index;
+	}
+
+	entry = &decoder->index[decoder->n_index++];
+	entry->offset = (const char *) header - (const char *) decoder->map;
+	entry->frame = decoder->n_frames;
+	entry->msecs = header->msecs;
+
+	return 0;
+}
+
+/*
+ * A recording which the compositor did not get to finish has no index.
+ * Walking the frame headers to rebuild it is cheap, since nothing gets
+ * decompressed, and it also drops a frame that was only partly written.
+ */
+static int
+wcap_decoder_scan_index(struct wcap_decoder *decoder)
+{
+	const struct wcap_frame_header_v2 *header;
+	char *p = decoder->p, *end = decoder->end;
+	uint32_t alloc = 0;
+
+	while ((size_t) (end - p) >= sizeof *header) {
+		header = (const void *) p;
+		if (wcap_frame_stored_size(header) > (size_t) (end - p))
+			break;
+
+		if ((header->flags & WCAP_FRAME_KEYFRAME) &&
+		    wcap_decoder_add_index_entry(decoder, header, &alloc) < 0)
+			return -1;
+
+		decoder->n_frames++;
+		p += wcap_frame_stored_size(header);
+	}
+	decoder->end = p;
+
+	return 0;
+}
+
+static int
+wcap_decoder_load_index(struct wcap_decoder *decoder)
+{
+	struct wcap_index_trailer trailer;
+	size_t index_size;
+
+	if (decoder->size < sizeof(struct wcap_header_v2) + sizeof trailer)
+		return wcap_decoder_scan_index(decoder);
+
+	memcpy(&trailer, (char *) decoder->end - sizeof trailer,
+	       sizeof trailer);
+	index_size = (size_t) trailer.n_entries * sizeof *decoder->index;
+	if (trailer.magic != WCAP_INDEX_MAGIC ||
+	    trailer.index_offset < sizeof(struct wcap_header_v2) ||
+	    trailer.index_offset + index_size + sizeof trailer != decoder->size) {
+		fprintf(stderr, "wcap file has no index, scanning it\n");
+		return wcap_decoder_scan_index(decoder);
+	}
+
+	if (trailer.n_entries > 0) {
+		decoder->index = malloc(index_size);
+		if (decoder->index == NULL)
+			return -1;
+		/* The index is only 4-byte aligned in the file */
+		memcpy(decoder->index,
+		       (char *) decoder->map + trailer.index_offset, index_size);
+	}
+	decoder->n_index = trailer.n_entries;
+	decoder->n_frames = trailer.n_frames;
+	decoder->end = (char *) decoder->map + trailer.index_offset;
+
+	return 0;
+}
+
 struct wcap_decoder *
 wcap_decoder_create(const char *filename)
 {
 	struct wcap_decoder *decoder;
 	struct wcap_header *header;
+	struct wcap_header_v2 *header_v2;
 	int frame_size;
 	struct stat buf;
 
-	decoder = malloc(sizeof *decoder);
+	decoder = calloc(1, sizeof *decoder);
 	if (decoder == NULL)
 		return NULL;
 
@@ -143,6 +590,27 @@ wcap_decoder_create(const char *filename)
 	decoder->height = header->height;
 	decoder->p = header + 1;
 	decoder->end = decoder->map + decoder->size;
+	decoder->version = 1;
+
+	if (header->magic == WCAP_HEADER_MAGIC_V2) {
+		header_v2 = decoder->map;
+		decoder->version = 2;
+		decoder->compression = header_v2->compression;
+		decoder->p = header_v2 + 1;
+
+#ifndef HAVE_ZSTD
+		if (decoder->compression == WCAP_COMPRESSION_ZSTD) {
+			fprintf(stderr, "wcap file is zstd compressed, "
+				"but zstd support is not built in\n");
+			wcap_decoder_destroy(decoder);
+			return NULL;
+		}
+#endif
+		if (wcap_decoder_load_index(decoder) < 0) {
+			wcap_decoder_destroy(decoder);
+			return NULL;
+		}
+	}
 
 	frame_size = header->width * header->height * 4;
 	decoder->frame = malloc(frame_size);
@@ -159,8 +627,11 @@ wcap_decoder_create(const char *filename)
 void
 wcap_decoder_destroy(struct wcap_decoder *decoder)
 {
+	wcap_decoder_set_threads(decoder, 1);
 	munmap(decoder->map, decoder->size);
 	close(decoder->fd);
+	free(decoder->index);
+	free(decoder->raw);
 	free(decoder->frame);
 	free(decoder);
 }
@@ -29,6 +29,8 @@
 #include <stdint.h>
 
 #define WCAP_HEADER_MAGIC	0x57434150
+#define WCAP_HEADER_MAGIC_V2	0x57434132
+#define WCAP_INDEX_MAGIC	0x57434958
 
 #define WCAP_FORMAT_XRGB8888	0x34325258
 #define WCAP_FORMAT_XBGR8888	0x34324258
@@ -41,11 +43,51 @@ struct wcap_header {
 	uint32_t width, height;
 };
 
+#define WCAP_COMPRESSION_NONE	0
+#define WCAP_COMPRESSION_ZSTD	1
+
+#define WCAP_FRAME_KEYFRAME	(1 << 0)
+#define WCAP_FRAME_COMPRESSED	(1 << 1)
+
+struct wcap_header_v2 {
+	uint32_t magic;
+	uint32_t format;
+	uint32_t width, height;
+	uint32_t compression;
+	uint32_t keyframe_interval;
+};
+
 struct wcap_frame_header {
 	uint32_t msecs;
 	uint32_t nrects;
 };
 
+/* Followed by size bytes of payload, padded to a multiple of 4. The
+ * payload, once decompressed, holds raw_size bytes laid out like a v1
+ * frame after its header: nrects rectangles and their runs. */
+struct wcap_frame_header_v2 {
+	uint32_t msecs;
+	uint32_t nrects;
+	uint32_t flags;
+	uint32_t size;
+	uint32_t raw_size;
+};
+
+struct wcap_index_entry {
+	uint64_t offset;
+	uint32_t frame;
+	uint32_t msecs;
+};
+
+/* Last bytes of a complete v2 file, after the keyframe index */
+struct wcap_index_trailer {
+	uint64_t index_offset;
+	uint32_t n_entries;
+	uint32_t n_frames;
+	uint32_t reserved;
+	uint32_t magic;
+};
+
 struct wcap_rectangle {
 	int32_t x1, y1, x2, y2;
 };
@@ -59,10 +101,25 @@ struct wcap_decoder {
 	uint32_t msecs;
 	uint32_t count;
 	int width, height;
+
+	/* v2 only: where each keyframe starts, and the scratch buffer for
+	 * decompressing a frame */
+	uint32_t version;
+	uint32_t compression;
+	struct wcap_index_entry *index;
+	uint32_t n_index;
+	uint32_t n_frames;
+	void *raw;
+	size_t raw_size;
+
+	/* Decodes the rectangles of a frame in parallel, if set */
+	struct wcap_decode_pool *pool;
 };
 
 int wcap_decoder_get_frame(struct wcap_decoder *decoder);
 struct wcap_decoder *wcap_decoder_create(const char *filename);
 void wcap_decoder_destroy(struct wcap_decoder *decoder);
+int wcap_decoder_set_threads(struct wcap_decoder *decoder, int n_threads);
+int wcap_decoder_seek(struct wcap_decoder *decoder, uint32_t msecs);
 
 #endif
@@ -1,4 +1,5 @@
 /*
+ * Copyright © 2022 Collabora, Ltd.
  * Copyright © 2009 Intel Corporation
  * Copyright © 1988-2004 Keith Packard and Bart Massey.
  *
@@ -39,83 +40,86 @@
 
 #include "hash.h"
 
+/*
+ * Robin Hood hashing with linear probing over a power-of-two table.
+ *
+ * Every entry records how far it sits from its home slot. Insertion
+ * takes the slot of any entry that is closer to home than the one being
+ * placed and carries that entry on instead, which keeps probe sequences
+ * short and even. Removal shifts the rest of the cluster back by one
+ * rather than leaving a tombstone, so a table with heavy insert and
+ * remove churn keeps its lookup cost.
+ */
+
 struct hash_entry {
 	uint32_t hash;
+	uint32_t dist; /* 1 + distance from the home slot, 0 if free */
 	void *data;
 };
 
 struct hash_table {
 	struct hash_entry *table;
-	uint32_t size;
-	uint32_t rehash;
-	uint32_t max_entries;
-	uint32_t size_index;
+	uint32_t mask; /* size - 1 */
 	uint32_t entries;
-	uint32_t deleted_entries;
 };
 
-#define ARRAY_SIZE(array) (sizeof(array) / sizeof(array[0]))
-
-/*
- * From Knuth -- a good choice for hash/rehash values is p, p-2 where
- * p and p-2 are both prime.  These tables are sized to have an extra 10%
- * free to avoid exponential performance degradation as the hash table fills
- */
-
-static const uint32_t deleted_data;
-
-static const struct {
-   uint32_t max_entries, size, rehash;
-} hash_sizes[] = {
-    { 2,		5,		3	  },
-    { 4,		7,		5	  },
-    { 8,		13,		11	  },
-    { 16,		19,		17	  },
-    { 32,		43,		41        },
-    { 64,		73,		71        },
-    { 128,		151,		149       },
-    { 256,		283,		281       },
-    { 512,		571,		569       },
-    { 1024,		1153,		1151      },
-    { 2048,		2269,		2267      },
-    { 4096,		4519,		4517      },
-    { 8192,		9013,		9011      },
-    { 16384,		18043,		18041     },
-    { 32768,		36109,		36107     },
-    { 65536,		72091,		72089     },
-    { 131072,		144409,		144407    },
-    { 262144,		288361,		288359    },
-    { 524288,		576883,		576881    },
-    { 1048576,		1153459,	1153457   },
-    { 2097152,		2307163,	2307161   },
-    { 4194304,		4613893,	4613891   },
-    { 8388608,		9227641,	9227639   },
-    { 16777216,		18455029,	18455027  },
-    { 33554432,		36911011,	36911009  },
-    { 67108864,		73819861,	73819859  },
-    { 134217728,	147639589,	147639587 },
-    { 268435456,	295279081,	295279079 },
-    { 536870912,	590559793,	590559791 },
-    { 1073741824,	1181116273,	1181116271},
-    { 2147483648ul,	2362232233ul,	2362232231ul}
-};
+#define HASH_TABLE_MIN_SIZE 8
 
-static int
-entry_is_free(struct hash_entry *entry)
+static uint32_t
+hash_home(uint32_t mask, uint32_t hash)
 {
-	return entry->data == NULL;
+	/* X resource ids are sequential within a client's id range,
+	 * scatter them so neighbours do not form one long cluster. */
+	hash *= 0x9e3779b1u;
+	hash ^= hash >> 16;
+
+	return hash & mask;
 }
 
-static int
-entry_is_deleted(struct hash_entry *entry)
+static void
+hash_table_place(struct hash_entry *table, uint32_t mask,
+		 uint32_t hash, void *data)
 {
-	return entry->data == &deleted_data;
+	struct hash_entry cur = { .hash = hash, .dist = 1, .data = data };
+	struct hash_entry tmp;
+	uint32_t i;
+
+	for (i = hash_home(mask, hash); ; i = (i + 1) & mask) {
+		if (table[i].dist == 0) {
+			table[i] = cur;
+			return;
+		}
+
+		if (table[i].dist < cur.dist) {
+			tmp = table[i];
+			table[i] = cur;
+			cur = tmp;
+		}
+		cur.dist++;
+	}
 }
 
 static int
-entry_is_present(struct hash_entry *entry)
+hash_table_resize(struct hash_table *ht, uint32_t size)
 {
-	return entry->data != NULL && entry->data != &deleted_data;
+	struct hash_entry *table;
+	uint32_t i;
+
+	table = calloc(size, sizeof(*table));
+	if (table == NULL)
+		return -1;
+
+	for (i = 0; i <= ht->mask; i++) {
+		if (ht->table[i].dist != 0)
+			hash_table_place(table, size - 1, ht->table[i].hash,
+					 ht->table[i].data);
+	}
+
+	free(ht->table);
+	ht->table = table;
+	ht->mask = size - 1;
+
+	return 0;
 }
 
 struct hash_table *
@@ -127,13 +131,9 @@ hash_table_create(void)
 	if (ht == NULL)
 		return NULL;
 
-	ht->size_index = 0;
-	ht->size = hash_sizes[ht->size_index].size;
-	ht->rehash = hash_sizes[ht->size_index].rehash;
-	ht->max_entries = hash_sizes[ht->size_index].max_entries;
-	ht->table = calloc(ht->size, sizeof(*ht->table));
+	ht->table = calloc(HASH_TABLE_MIN_SIZE, sizeof(*ht->table));
+	ht->mask = HASH_TABLE_MIN_SIZE - 1;
 	ht->entries = 0;
-	ht->deleted_entries = 0;
 
 	if (ht->table == NULL) {
 		free(ht);
@@ -157,47 +157,44 @@ hash_table_destroy(struct hash_table *ht)
 }
 
 /**
- * Finds a hash table entry with the given key and hash of that key.
+ * Finds the hash table entry with the given hash.
  *
- * Returns NULL if no entry is found.  Note that the data pointer may be
- * modified by the user.
+ * Returns NULL if no entry is found. The probe stops as soon as it meets
+ * an entry closer to its home slot than the searched one would be, since
+ * insertion would have placed the searched entry there.
  */
-static void *
+static struct hash_entry *
 hash_table_search(struct hash_table *ht, uint32_t hash)
 {
-	uint32_t hash_address;
-
-	hash_address = hash % ht->size;
-	do {
-		uint32_t double_hash;
+	uint32_t i = hash_home(ht->mask, hash);
+	uint32_t dist;
 
-		struct hash_entry *entry = ht->table + hash_address;
+	for (dist = 1; ; dist++) {
+		struct hash_entry *entry = ht->table + i;
 
-		if (entry_is_free(entry)) {
+		if (entry->dist < dist)
 			return NULL;
-		} else if (entry_is_present(entry) && entry->hash == hash) {
+		if (entry->hash == hash)
 			return entry;
-		}
-
-		double_hash = 1 + hash % ht->rehash;
 
-		hash_address = (hash_address + double_hash) % ht->size;
-	} while (hash_address != hash % ht->size);
-
-	return NULL;
+		i = (i + 1) & ht->mask;
+	}
 }
 
+/**
+ * Calls func for every element.
+ *
+ * The table must not be modified from func.
+ */
 void
 hash_table_for_each(struct hash_table *ht,
 		    hash_table_iterator_func_t func, void *data)
 {
-	struct hash_entry *entry;
 	uint32_t i;
 
-	for (i = 0; i < ht->size; i++) {
-		entry = ht->table + i;
-		if (entry_is_present(entry))
-			func(entry->data, data);
+	for (i = 0; i <= ht->mask; i++) {
+		if (ht->table[i].dist != 0)
+			func(ht->table[i].data, data);
 	}
 }
 
@@ -213,97 +210,69 @@ hash_table_lookup(struct hash_table *ht, uint32_t hash)
 	return NULL;
 }
 
-static void
-hash_table_rehash(struct hash_table *ht, unsigned int new_size_index)
-{
-	struct hash_table old_ht;
-	struct hash_entry *table, *entry;
-
-	if (new_size_index >= ARRAY_SIZE(hash_sizes))
-		return;
-
-	table = calloc(hash_sizes[new_size_index].size, sizeof(*ht->table));
-	if (table == NULL)
-		return;
-
-	old_ht = *ht;
-
-	ht->table = table;
-	ht->size_index = new_size_index;
-	ht->size = hash_sizes[ht->size_index].size;
-	ht->rehash = hash_sizes[ht->size_index].rehash;
-	ht->max_entries = hash_sizes[ht->size_index].max_entries;
-	ht->entries = 0;
-	ht->deleted_entries = 0;
-
-	for (entry = old_ht.table;
-	     entry != old_ht.table + old_ht.size;
-	     entry++) {
-		if (entry_is_present(entry)) {
-			hash_table_insert(ht, entry->hash, entry->data);
-		}
-	}
-
-	free(old_ht.table);
-}
-
 /**
- * Inserts the data with the given hash into the table.
+ * Inserts the data with the given hash into the table, replacing the
+ * data of an existing entry with the same hash.
  *
- * Note that insertion may rearrange the table on a resize or rehash,
- * so previously found hash_entries are no longer valid after this function.
+ * The table grows when it would get more than 7/8 full. Returns -1 if
+ * that fails.
  */
 int
 hash_table_insert(struct hash_table *ht, uint32_t hash, void *data)
 {
-	uint32_t hash_address;
+	struct hash_entry *entry;
+	uint64_t size = (uint64_t)ht->mask + 1;
 
-	if (ht->entries >= ht->max_entries) {
-		hash_table_rehash(ht, ht->size_index + 1);
-	} else if (ht->deleted_entries + ht->entries >= ht->max_entries) {
-		hash_table_rehash(ht, ht->size_index);
+	entry = hash_table_search(ht, hash);
+	if (entry != NULL) {
+		entry->data = data;
+		return 0;
 	}
 
-	hash_address = hash % ht->size;
-	do {
-		struct hash_entry *entry = ht->table + hash_address;
-		uint32_t double_hash;
-
-		if (!entry_is_present(entry)) {
-			if (entry_is_deleted(entry))
-				ht->deleted_entries--;
-			entry->hash = hash;
-			entry->data = data;
-			ht->entries++;
-			return 0;
-		}
-
-		double_hash = 1 + hash % ht->rehash;
+	if (((uint64_t)ht->entries + 1) * 8 > size * 7) {
+		if (size * 2 > UINT32_MAX ||
+		    hash_table_resize(ht, size * 2) < 0)
+			return -1;
+	}
 
-		hash_address = (hash_address + double_hash) % ht->size;
-	} while (hash_address != hash % ht->size);
+	hash_table_place(ht->table, ht->mask, hash, data);
+	ht->entries++;
 
-	/* We could hit here if a required resize failed. An unchecked-malloc
-	 * application could ignore this result.
-	 */
-	return -1;
+	return 0;
 }
 
 /**
- * This function deletes the given hash table entry.
+ * Deletes the entry with the given hash, if any.
  *
- * Note that deletion doesn't otherwise modify the table, so an iteration over
- * the table deleting entries is safe.
+ * The following entries of the probe cluster move back one slot and the
+ * table shrinks once it falls below 1/8 full, so previously found entries
+ * are no longer valid after this function.
  */
 void
 hash_table_remove(struct hash_table *ht, uint32_t hash)
 {
 	struct hash_entry *entry;
+	uint32_t i, next;
 
 	entry = hash_table_search(ht, hash);
-	if (entry != NULL) {
-		entry->data = (void *) &deleted_data;
-		ht->entries--;
-		ht->deleted_entries++;
+	if (entry == NULL)
+		return;
+
+	i = entry - ht->table;
+	for (;;) {
+		next = (i + 1) & ht->mask;
+		if (ht->table[next].dist <= 1)
+			break;
+
+		ht->table[i] = ht->table[next];
+		ht->table[i].dist--;
+		i = next;
 	}
+	ht->table[i].dist = 0;
+	ht->table[i].data = NULL;
+	ht->entries--;
+
+	if (ht->mask + 1 > HASH_TABLE_MIN_SIZE &&
+	    ht->entries < (ht->mask + 1) / 8)
+		hash_table_resize(ht, (ht->mask + 1) / 2);
 }
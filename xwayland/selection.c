@@ -42,6 +42,43 @@
 #define wm_log(...) do {} while (0)
 #endif
 
+/* Largest part of a selection property held in memory at a time; a
+ * multiple of 4 since property offsets are in 32-bit units. */
+static const uint32_t property_slice_size = 64 * 1024;
+
+/** Fetch the next slice of the wl_selection property
+ *
+ * Large properties are read in bounded slices as the data source fd
+ * drains, rather than in one reply holding the whole transfer. Outside
+ * of INCR transfers, the server deletes the property with its last
+ * slice, which tells the owner that the transfer is done.
+ */
+static xcb_get_property_reply_t *
+weston_wm_get_property_slice(struct weston_wm *wm)
+{
+	xcb_get_property_cookie_t cookie;
+	xcb_get_property_reply_t *reply;
+
+	cookie = xcb_get_property(wm->conn,
+				  !wm->incr, /* delete */
+				  wm->selection_window,
+				  wm->atom.wl_selection,
+				  XCB_GET_PROPERTY_TYPE_ANY,
+				  wm->property_offset,
+				  property_slice_size / 4);
+
+	reply = xcb_get_property_reply(wm->conn, cookie, NULL);
+	if (reply == NULL) {
+		wm->property_more = false;
+		return NULL;
+	}
+
+	wm->property_offset += xcb_get_property_value_length(reply) / 4;
+	wm->property_more = reply->bytes_after > 0;
+
+	return reply;
+}
+
 static int
 writable_callback(int fd, uint32_t mask, void *data)
 {
@@ -73,6 +110,14 @@ writable_callback(int fd, uint32_t mask, void *data)
 	if (len == remainder) {
 		free(wm->property_reply);
 		wm->property_reply = NULL;
+
+		if (wm->property_more) {
+			wm->property_start = 0;
+			wm->property_reply = weston_wm_get_property_slice(wm);
+			if (wm->property_reply)
+				return 1;
+		}
+
 		if (wm->property_source)
 			wl_event_source_remove(wm->property_source);
 		wm->property_source = NULL;
@@ -108,21 +153,13 @@ weston_wm_write_property(struct weston_wm *wm, xcb_get_property_reply_t *reply)
 static void
 weston_wm_get_incr_chunk(struct weston_wm *wm)
 {
-	xcb_get_property_cookie_t cookie;
 	xcb_get_property_reply_t *reply;
 	FILE *fp;
 	char *logstr;
 	size_t logsize;
 
-	cookie = xcb_get_property(wm->conn,
-				  0, /* delete */
-				  wm->selection_window,
-				  wm->atom.wl_selection,
-				  XCB_GET_PROPERTY_TYPE_ANY,
-				  0, /* offset */
-				  0x1fffffff /* length */);
-
-	reply = xcb_get_property_reply(wm->conn, cookie, NULL);
+	wm->property_offset = 0;
+	reply = weston_wm_get_property_slice(wm);
 	if (reply == NULL)
 		return;
 
@@ -256,21 +293,15 @@ weston_wm_get_selection_targets(struct weston_wm *wm)
 static void
 weston_wm_get_selection_data(struct weston_wm *wm)
 {
-	xcb_get_property_cookie_t cookie;
 	xcb_get_property_reply_t *reply;
 	FILE *fp;
 	char *logstr;
 	size_t logsize;
 
-	cookie = xcb_get_property(wm->conn,
-				  1, /* delete */
-				  wm->selection_window,
-				  wm->atom.wl_selection,
-				  XCB_GET_PROPERTY_TYPE_ANY,
-				  0, /* offset */
-				  0x1fffffff /* length */);
-
-	reply = xcb_get_property_reply(wm->conn, cookie, NULL);
+	/* Until the type says otherwise, this is a plain transfer. */
+	wm->incr = 0;
+	wm->property_offset = 0;
+	reply = weston_wm_get_property_slice(wm);
 
 	fp = open_memstream(&logstr, &logsize);
 	if (fp) {
@@ -284,9 +315,9 @@ weston_wm_get_selection_data(struct weston_wm *wm)
 		return;
 	} else if (reply->type == wm->atom.incr) {
 		wm->incr = 1;
+		wm->property_more = false;
 		free(reply);
 	} else {
-		wm->incr = 0;
 		/* reply's ownership is transferred to wm, which is responsible
 		 * for freeing it */
 		weston_wm_write_property(wm, reply);
@@ -414,8 +445,8 @@ weston_wm_read_data_source(int fd, uint32_t mask, void *data)
 		return 1;
 	}
 
-	weston_log("read %d (available %d, mask 0x%x) bytes: \"%.*s\"\n",
-		len, available, mask, len, (char *) p);
+	weston_log("read %d (available %d, mask 0x%x) bytes\n",
+		len, available, mask);
 
 	wm->source_data.size = current + len;
 	if (wm->source_data.size >= incr_chunk_size) {
@@ -133,12 +133,28 @@ struct weston_output_weak_ref {
 	struct wl_listener destroy_listener;
 };
 
+/* A frame decoration rendered into a server side pixmap */
+struct weston_wm_decor_cache {
+	xcb_pixmap_t pixmap;
+	cairo_surface_t *surface;
+	int width, height;
+	uint32_t flags; /* frame_get_flags() */
+	uint32_t buttons; /* frame_button_state() */
+	char *title;
+};
+
+/* Properties read by weston_wm_window_read_properties() */
+#define WM_WINDOW_PROPERTY_COUNT 11
+
 struct weston_wm_window {
 	struct weston_wm *wm;
 	xcb_window_t id;
 	xcb_window_t frame_id;
 	struct frame *frame;
 	cairo_surface_t *cairo_surface;
+	/* Decoration per focus state, indexed by FRAME_FLAG_ACTIVE */
+	struct weston_wm_decor_cache decor_cache[2];
+	struct weston_wm_decor_cache *decor_shown;
 	uint32_t surface_id;
 	struct weston_surface *surface;
 	struct weston_desktop_xwayland_surface *shsurf;
@@ -146,6 +162,9 @@ struct weston_wm_window {
 	struct wl_event_source *repaint_source;
 	struct wl_event_source *configure_source;
 	int properties_dirty;
+	xcb_get_property_cookie_t property_cookies[WM_WINDOW_PROPERTY_COUNT];
+	bool properties_requested;
+	uint32_t properties_batch; /* weston_wm::event_batch */
 	int pid;
 	char *machine;
 	char *class;
@@ -167,6 +186,13 @@ struct weston_wm_window {
 	int override_redirect;
 	int fullscreen;
 	int has_alpha;
+	/* Client window of the root depth and visual */
+	bool has_root_visual;
+	/* The frame has the depth and visual of the client window, so that
+	 * Xwayland can hand on the client's buffers as they are. Only for
+	 * windows mapped fullscreen without decorations, which then never
+	 * get any drawn. */
+	bool opaque_frame;
 	int delete_window;
 	int maximized_vert;
 	int maximized_horz;
@@ -500,17 +526,20 @@ read_and_dump_property(FILE *fp, struct weston_wm *wm,
 #define TYPE_NET_WM_STATE	XCB_ATOM_CUT_BUFFER2
 #define TYPE_WM_NORMAL_HINTS	XCB_ATOM_CUT_BUFFER3
 
+struct weston_wm_property_desc {
+	xcb_atom_t atom;
+	xcb_atom_t type;
+	void *ptr;
+};
+
 static void
-weston_wm_window_read_properties(struct weston_wm_window *window)
+weston_wm_window_get_property_descs(struct weston_wm_window *window,
+				    struct weston_wm_property_desc *props)
 {
 	struct weston_wm *wm = window->wm;
 
 #define F(field) (&window->field)
-	const struct {
-		xcb_atom_t atom;
-		xcb_atom_t type;
-		void *ptr;
-	} props[] = {
+	const struct weston_wm_property_desc descs[] = {
 		{ XCB_ATOM_WM_CLASS,           XCB_ATOM_STRING,            F(class) },
 		{ XCB_ATOM_WM_NAME,            XCB_ATOM_STRING,            F(name) },
 		{ XCB_ATOM_WM_TRANSIENT_FOR,   XCB_ATOM_WINDOW,            F(transient_for) },
@@ -525,7 +554,62 @@ weston_wm_window_read_properties(struct weston_wm_window *window)
 	};
 #undef F
 
-	xcb_get_property_cookie_t cookie[ARRAY_LENGTH(props)];
+	static_assert(ARRAY_LENGTH(descs) == WM_WINDOW_PROPERTY_COUNT,
+		      "WM_WINDOW_PROPERTY_COUNT out of date");
+	memcpy(props, descs, sizeof descs);
+}
+
+/** Send the property requests of a window without waiting for replies
+ *
+ * The replies are collected by weston_wm_window_read_properties(), so
+ * that windows prefetched together cost a single round-trip instead of
+ * one each. Requests sent in an earlier event batch than a later
+ * PropertyNotify of the window may be stale and get discarded, see
+ * weston_wm_handle_property_notify().
+ */
+static void
+weston_wm_window_prefetch_properties(struct weston_wm_window *window)
+{
+	struct weston_wm *wm = window->wm;
+	struct weston_wm_property_desc props[WM_WINDOW_PROPERTY_COUNT];
+	uint32_t i;
+
+	if (!window->properties_dirty || window->properties_requested)
+		return;
+
+	weston_wm_window_get_property_descs(window, props);
+	for (i = 0; i < ARRAY_LENGTH(props); i++)
+		window->property_cookies[i] =
+			xcb_get_property(wm->conn,
+					 0, /* delete */
+					 window->id,
+					 props[i].atom,
+					 XCB_ATOM_ANY, 0, 2048);
+
+	window->properties_requested = true;
+	window->properties_batch = wm->event_batch;
+}
+
+static void
+weston_wm_window_discard_properties(struct weston_wm_window *window)
+{
+	uint32_t i;
+
+	if (!window->properties_requested)
+		return;
+
+	for (i = 0; i < WM_WINDOW_PROPERTY_COUNT; i++)
+		xcb_discard_reply(window->wm->conn,
+				  window->property_cookies[i].sequence);
+
+	window->properties_requested = false;
+}
+
+static void
+weston_wm_window_read_properties(struct weston_wm_window *window)
+{
+	struct weston_wm *wm = window->wm;
+	struct weston_wm_property_desc props[WM_WINDOW_PROPERTY_COUNT];
 	xcb_get_property_reply_t *reply;
 	void *p;
 	uint32_t *xid;
@@ -535,14 +619,11 @@ weston_wm_window_read_properties(struct weston_wm_window *window)
 
 	if (!window->properties_dirty)
 		return;
-	window->properties_dirty = 0;
 
-	for (i = 0; i < ARRAY_LENGTH(props); i++)
-		cookie[i] = xcb_get_property(wm->conn,
-					     0, /* delete */
-					     window->id,
-					     props[i].atom,
-					     XCB_ATOM_ANY, 0, 2048);
+	weston_wm_window_prefetch_properties(window);
+	weston_wm_window_get_property_descs(window, props);
+	window->properties_dirty = 0;
+	window->properties_requested = false;
 
 	window->decorate = window->override_redirect ? 0 : MWM_DECOR_EVERYTHING;
 	window->size_hints.flags = 0;
@@ -550,7 +631,9 @@ weston_wm_window_read_properties(struct weston_wm_window *window)
 	window->delete_window = 0;
 
 	for (i = 0; i < ARRAY_LENGTH(props); i++)  {
-		reply = xcb_get_property_reply(wm->conn, cookie[i], NULL);
+		reply = xcb_get_property_reply(wm->conn,
+					       window->property_cookies[i],
+					       NULL);
 		if (!reply)
 			/* Bad window, typically */
 			continue;
@@ -630,6 +713,10 @@ weston_wm_window_read_properties(struct weston_wm_window *window)
 		free(reply);
 	}
 
+	/* Nothing can be drawn into an opaque frame. */
+	if (window->opaque_frame)
+		window->decorate = 0;
+
 	if (window->pid > 0) {
 		gethostname(name, sizeof(name));
 		for (i = 0; i < sizeof(name); i++) {
@@ -658,7 +745,7 @@ weston_wm_window_get_frame_size(struct weston_wm_window *window,
 {
 	struct theme *t = window->wm->theme;
 
-	if (window->fullscreen) {
+	if (window->fullscreen || window->opaque_frame) {
 		*width = window->width;
 		*height = window->height;
 	} else if (window->decorate && window->frame) {
@@ -676,7 +763,7 @@ weston_wm_window_get_child_position(struct weston_wm_window *window,
 {
 	struct theme *t = window->wm->theme;
 
-	if (window->fullscreen) {
+	if (window->fullscreen || window->opaque_frame) {
 		*x = 0;
 		*y = 0;
 	} else if (window->decorate && window->frame) {
@@ -1075,6 +1162,8 @@ weston_wm_window_create_frame(struct weston_wm_window *window)
 	uint32_t values[3];
 	int x, y, width, height;
 	int buttons = FRAME_BUTTON_CLOSE;
+	uint8_t depth = 32;
+	xcb_visualid_t visual = wm->visual_id;
 
 	if (window->decorate & MWM_DECOR_MAXIMIZE)
 		buttons |= FRAME_BUTTON_MAXIMIZE;
@@ -1088,6 +1177,17 @@ weston_wm_window_create_frame(struct weston_wm_window *window)
 
 	frame_resize_inside(window->frame, window->width, window->height);
 
+	/* A frame of another depth than the client window makes the X
+	 * server composite the client into it, and Xwayland attach a copy
+	 * with alpha instead of the client's own buffers; keep those for
+	 * fullscreen windows that will not need decorations. */
+	window->opaque_frame = window->fullscreen && !window->decorate &&
+			       window->has_root_visual;
+	if (window->opaque_frame) {
+		depth = wm->screen->root_depth;
+		visual = wm->screen->root_visual;
+	}
+
 	weston_wm_window_get_frame_size(window, &width, &height);
 	weston_wm_window_get_child_position(window, &x, &y);
 
@@ -1102,18 +1202,19 @@ weston_wm_window_create_frame(struct weston_wm_window *window)
 		XCB_EVENT_MASK_LEAVE_WINDOW |
 		XCB_EVENT_MASK_SUBSTRUCTURE_NOTIFY |
 		XCB_EVENT_MASK_SUBSTRUCTURE_REDIRECT;
-	values[2] = wm->colormap;
+	values[2] = window->opaque_frame ? wm->screen->default_colormap :
+					   wm->colormap;
 
 	window->frame_id = xcb_generate_id(wm->conn);
 	xcb_create_window(wm->conn,
-			  32,
+			  depth,
 			  window->frame_id,
 			  wm->screen->root,
 			  0, 0,
 			  width, height,
 			  0,
 			  XCB_WINDOW_CLASS_INPUT_OUTPUT,
-			  wm->visual_id,
+			  visual,
 			  XCB_CW_BORDER_PIXEL |
 			  XCB_CW_EVENT_MASK |
 			  XCB_CW_COLORMAP, values);
@@ -1124,12 +1225,13 @@ weston_wm_window_create_frame(struct weston_wm_window *window)
 	weston_wm_configure_window(wm, window->id,
 				   XCB_CONFIG_WINDOW_BORDER_WIDTH, values);
 
-	window->cairo_surface =
-		cairo_xcb_surface_create_with_xrender_format(wm->conn,
-							     wm->screen,
-							     window->frame_id,
-							     &wm->format_rgba,
-							     width, height);
+	if (!window->opaque_frame)
+		window->cairo_surface =
+			cairo_xcb_surface_create_with_xrender_format(wm->conn,
+								     wm->screen,
+								     window->frame_id,
+								     &wm->format_rgba,
+								     width, height);
 
 	hash_table_insert(wm->window_hash, window->frame_id, window);
 }
@@ -1192,6 +1294,13 @@ weston_wm_handle_map_request(struct weston_wm *wm, xcb_generic_event_t *event)
 	window->map_request_x = window->x;
 	window->map_request_y = window->y;
 
+	/* Before the frame, whose visual depends on it */
+	if (legacy_fullscreen(wm, window, &output)) {
+		window->fullscreen = 1;
+		weston_output_weak_ref_set(&window->legacy_fullscreen_output,
+					   output);
+	}
+
 	if (window->frame_id == XCB_WINDOW_NONE)
 		weston_wm_window_create_frame(window); /* sets frame_id */
 	assert(window->frame_id != XCB_WINDOW_NONE);
@@ -1206,14 +1315,9 @@ weston_wm_handle_map_request(struct weston_wm *wm, xcb_generic_event_t *event)
 	weston_wm_window_set_net_wm_state(window);
 	weston_wm_window_set_virtual_desktop(window, 0);
 
-	if (legacy_fullscreen(wm, window, &output)) {
-		window->fullscreen = 1;
-		weston_output_weak_ref_set(&window->legacy_fullscreen_output,
-					   output);
-	}
-
 	xcb_map_window(wm->conn, map_request->window);
 	xcb_map_window(wm->conn, window->frame_id);
+	window->decor_shown = NULL;
 
 	/* Mapped in the X server, we can draw immediately.
 	 * Cannot set pending state though, no weston_surface until
@@ -1278,6 +1382,128 @@ weston_wm_handle_unmap_notify(struct weston_wm *wm, xcb_generic_event_t *event)
 	weston_wm_window_set_virtual_desktop(window, -1);
 
 	xcb_unmap_window(wm->conn, window->frame_id);
+	window->decor_shown = NULL;
+}
+
+static void
+weston_wm_decor_cache_fini(struct weston_wm *wm,
+			   struct weston_wm_decor_cache *cache)
+{
+	if (cache->surface) {
+		cairo_surface_destroy(cache->surface);
+		xcb_free_pixmap(wm->conn, cache->pixmap);
+	}
+	free(cache->title);
+	memset(cache, 0, sizeof *cache);
+}
+
+static bool
+weston_wm_decor_cache_init(struct weston_wm_window *window,
+			   struct weston_wm_decor_cache *cache,
+			   int width, int height)
+{
+	struct weston_wm *wm = window->wm;
+
+	weston_wm_decor_cache_fini(wm, cache);
+
+	cache->pixmap = xcb_generate_id(wm->conn);
+	xcb_create_pixmap(wm->conn, 32, cache->pixmap, window->frame_id,
+			  width, height);
+	cache->surface =
+		cairo_xcb_surface_create_with_xrender_format(wm->conn,
+							     wm->screen,
+							     cache->pixmap,
+							     &wm->format_rgba,
+							     width, height);
+	if (cairo_surface_status(cache->surface) != CAIRO_STATUS_SUCCESS) {
+		cairo_surface_destroy(cache->surface);
+		xcb_free_pixmap(wm->conn, cache->pixmap);
+		cache->surface = NULL;
+		return false;
+	}
+	cache->width = width;
+	cache->height = height;
+
+	if (wm->decor_gc == XCB_NONE) {
+		wm->decor_gc = xcb_generate_id(wm->conn);
+		xcb_create_gc(wm->conn, wm->decor_gc, cache->pixmap, 0, NULL);
+	}
+
+	return true;
+}
+
+static bool
+title_equal(const char *a, const char *b)
+{
+	if (!a || !b)
+		return a == b;
+
+	return strcmp(a, b) == 0;
+}
+
+/** Draw the frame decoration through the per focus state cache
+ *
+ * A focus switch back to a state that is still up to date costs a single
+ * server side copy. When only the title text changed, just the title bar
+ * between the buttons is rendered again.
+ */
+static const char *
+weston_wm_window_draw_frame(struct weston_wm_window *window,
+			    int width, int height)
+{
+	struct weston_wm *wm = window->wm;
+	uint32_t flags = frame_get_flags(window->frame);
+	uint32_t buttons = frame_button_state(window->frame);
+	struct weston_wm_decor_cache *cache =
+		&window->decor_cache[flags & FRAME_FLAG_ACTIVE ? 1 : 0];
+	const char *how = "decorate, cached";
+	bool title_only;
+	cairo_t *cr;
+
+	frame_set_title(window->frame, window->name);
+
+	if (cache->surface && cache->width == width &&
+	    cache->height == height && cache->flags == flags &&
+	    cache->buttons == buttons &&
+	    title_equal(cache->title, window->name)) {
+		if (window->decor_shown == cache)
+			return "decorate, unchanged";
+		goto copy;
+	}
+
+	title_only = cache->surface && cache->width == width &&
+		     cache->height == height && cache->flags == flags &&
+		     cache->buttons == buttons &&
+		     cache->title && window->name;
+
+	if (!title_only &&
+	    (!cache->surface || cache->width != width ||
+	     cache->height != height) &&
+	    !weston_wm_decor_cache_init(window, cache, width, height))
+		return NULL;
+
+	cr = cairo_create(cache->surface);
+	if (title_only) {
+		how = "decorate, title";
+		frame_repaint_title(window->frame, cr);
+	} else {
+		how = "decorate";
+		frame_repaint(window->frame, cr);
+	}
+	cairo_destroy(cr);
+	cairo_surface_flush(cache->surface);
+
+	free(cache->title);
+	cache->title = window->name ? strdup(window->name) : NULL;
+	cache->flags = flags;
+	cache->buttons = buttons;
+
+copy:
+	xcb_copy_area(wm->conn, cache->pixmap, window->frame_id, wm->decor_gc,
+		      0, 0, 0, 0, width, height);
+	window->decor_shown = cache;
+
+	return how;
 }
 
 static void
@@ -1287,8 +1513,26 @@ weston_wm_window_draw_decoration(struct weston_wm_window *window)
 	int width, height;
 	const char *how;
 
+	/* The client window covers an opaque frame entirely. */
+	if (window->opaque_frame) {
+		window->decor_shown = NULL;
+		return;
+	}
+
 	weston_wm_window_get_frame_size(window, &width, &height);
 
+	if (window->decorate && !window->fullscreen) {
+		how = weston_wm_window_draw_frame(window, width, height);
+		if (how) {
+			wm_printf(window->wm, "XWM: draw decoration, win %d, %s\n",
+				  window->id, how);
+			xcb_flush(window->wm->conn);
+			return;
+		}
+		/* No pixmap, draw straight into the frame window. */
+	}
+
+	window->decor_shown = NULL;
 	cairo_xcb_surface_set_size(window->cairo_surface, width, height);
 	cr = cairo_create(window->cairo_surface);
 
@@ -1445,6 +1689,9 @@ weston_wm_handle_property_notify(struct weston_wm *wm, xcb_generic_event_t *even
 	if (!wm_lookup_window(wm, property_notify->window, &window))
 		return;
 
+	/* Replies requested before this batch may predate the change. */
+	if (window->properties_batch != wm->event_batch)
+		weston_wm_window_discard_properties(window);
 	window->properties_dirty = 1;
 
 	if (wm_debug_is_enabled(wm))
@@ -1487,6 +1734,8 @@ weston_wm_window_create(struct weston_wm *wm,
 	uint32_t values[1];
 	xcb_get_geometry_cookie_t geometry_cookie;
 	xcb_get_geometry_reply_t *geometry_reply;
+	xcb_get_window_attributes_cookie_t attributes_cookie;
+	xcb_get_window_attributes_reply_t *attributes_reply;
 
 	window = zalloc(sizeof *window);
 	if (window == NULL) {
@@ -1495,6 +1744,7 @@ weston_wm_window_create(struct weston_wm *wm,
 	}
 
 	geometry_cookie = xcb_get_geometry(wm->conn, id);
+	attributes_cookie = xcb_get_window_attributes(wm->conn, id);
 
 	values[0] = XCB_EVENT_MASK_PROPERTY_CHANGE |
 	            XCB_EVENT_MASK_FOCUS_CHANGE;
@@ -1512,12 +1762,21 @@ weston_wm_window_create(struct weston_wm *wm,
 	window->map_request_x = INT_MIN; /* out of range for valid positions */
 	window->map_request_y = INT_MIN; /* out of range for valid positions */
 	weston_output_weak_ref_init(&window->legacy_fullscreen_output);
+	weston_wm_window_prefetch_properties(window);
 
 	geometry_reply = xcb_get_geometry_reply(wm->conn, geometry_cookie, NULL);
 	/* technically we should use XRender and check the visual format's
 	alpha_mask, but checking depth is simpler and works in all known cases */
-	if (geometry_reply != NULL)
+	attributes_reply = xcb_get_window_attributes_reply(wm->conn,
+							   attributes_cookie,
+							   NULL);
+	if (geometry_reply != NULL) {
 		window->has_alpha = geometry_reply->depth == 32;
+		window->has_root_visual = attributes_reply &&
+			attributes_reply->visual == wm->screen->root_visual &&
+			geometry_reply->depth == wm->screen->root_depth;
+	}
+	free(attributes_reply);
 	free(geometry_reply);
 
 	hash_table_insert(wm->window_hash, id, window);
@@ -1529,6 +1788,7 @@ weston_wm_window_destroy(struct weston_wm_window *window)
 	struct weston_wm *wm = window->wm;
 
 	weston_output_weak_ref_clear(&window->legacy_fullscreen_output);
+	weston_wm_window_discard_properties(window);
 
 	if (window->configure_source)
 		wl_event_source_remove(window->configure_source);
@@ -1536,6 +1796,8 @@ weston_wm_window_destroy(struct weston_wm_window *window)
 		wl_event_source_remove(window->repaint_source);
 	if (window->cairo_surface)
 		cairo_surface_destroy(window->cairo_surface);
+	weston_wm_decor_cache_fini(wm, &window->decor_cache[0]);
+	weston_wm_decor_cache_fini(wm, &window->decor_cache[1]);
 
 	if (window->frame_id) {
 		xcb_reparent_window(wm->conn, window->id, wm->wm_window, 0, 0);
@@ -2253,81 +2515,135 @@ weston_wm_handle_focus_in(struct weston_wm *wm, xcb_generic_event_t *event)
 		weston_wm_send_focus_window(wm, wm->focus_window);
 }
 
-static int
-weston_wm_handle_event(int fd, uint32_t mask, void *data)
+static void
+weston_wm_dispatch_event(struct weston_wm *wm, xcb_generic_event_t *event)
 {
-	struct weston_wm *wm = data;
-	xcb_generic_event_t *event;
-	int count = 0;
+	if (weston_wm_handle_selection_event(wm, event))
+		return;
 
-	while (event = xcb_poll_for_event(wm->conn), event != NULL) {
-		if (weston_wm_handle_selection_event(wm, event)) {
-			free(event);
-			count++;
-			continue;
-		}
+	if (weston_wm_handle_dnd_event(wm, event))
+		return;
 
-		if (weston_wm_handle_dnd_event(wm, event)) {
-			free(event);
-			count++;
-			continue;
-		}
+	switch (EVENT_TYPE(event)) {
+	case XCB_BUTTON_PRESS:
+	case XCB_BUTTON_RELEASE:
+		weston_wm_handle_button(wm, event);
+		break;
+	case XCB_ENTER_NOTIFY:
+		weston_wm_handle_enter(wm, event);
+		break;
+	case XCB_LEAVE_NOTIFY:
+		weston_wm_handle_leave(wm, event);
+		break;
+	case XCB_MOTION_NOTIFY:
+		weston_wm_handle_motion(wm, event);
+		break;
+	case XCB_CREATE_NOTIFY:
+		weston_wm_handle_create_notify(wm, event);
+		break;
+	case XCB_MAP_REQUEST:
+		weston_wm_handle_map_request(wm, event);
+		break;
+	case XCB_MAP_NOTIFY:
+		weston_wm_handle_map_notify(wm, event);
+		break;
+	case XCB_UNMAP_NOTIFY:
+		weston_wm_handle_unmap_notify(wm, event);
+		break;
+	case XCB_REPARENT_NOTIFY:
+		weston_wm_handle_reparent_notify(wm, event);
+		break;
+	case XCB_CONFIGURE_REQUEST:
+		weston_wm_handle_configure_request(wm, event);
+		break;
+	case XCB_CONFIGURE_NOTIFY:
+		weston_wm_handle_configure_notify(wm, event);
+		break;
+	case XCB_DESTROY_NOTIFY:
+		weston_wm_handle_destroy_notify(wm, event);
+		break;
+	case XCB_MAPPING_NOTIFY:
+		wm_printf(wm, "XCB_MAPPING_NOTIFY\n");
+		break;
+	case XCB_PROPERTY_NOTIFY:
+		weston_wm_handle_property_notify(wm, event);
+		break;
+	case XCB_CLIENT_MESSAGE:
+		weston_wm_handle_client_message(wm, event);
+		break;
+	case XCB_FOCUS_IN:
+		weston_wm_handle_focus_in(wm, event);
+		break;
+	}
+}
 
-		switch (EVENT_TYPE(event)) {
-		case XCB_BUTTON_PRESS:
-		case XCB_BUTTON_RELEASE:
-			weston_wm_handle_button(wm, event);
-			break;
-		case XCB_ENTER_NOTIFY:
-			weston_wm_handle_enter(wm, event);
-			break;
-		case XCB_LEAVE_NOTIFY:
-			weston_wm_handle_leave(wm, event);
-			break;
-		case XCB_MOTION_NOTIFY:
-			weston_wm_handle_motion(wm, event);
-			break;
-		case XCB_CREATE_NOTIFY:
-			weston_wm_handle_create_notify(wm, event);
-			break;
+/** Request the properties an event batch is going to read
+ *
+ * Sends the GetProperty requests of every window that will be read while
+ * handling the batch up front, so their replies arrive together.
+ */
+static void
+weston_wm_prefetch_for_events(struct weston_wm *wm,
+			      xcb_generic_event_t **events, int count)
+{
+	xcb_map_request_event_t *map_request;
+	xcb_property_notify_event_t *property_notify;
+	struct weston_wm_window *window;
+	int i;
+
+	for (i = 0; i < count; i++) {
+		switch (EVENT_TYPE(events[i])) {
 		case XCB_MAP_REQUEST:
-			weston_wm_handle_map_request(wm, event);
-			break;
-		case XCB_MAP_NOTIFY:
-			weston_wm_handle_map_notify(wm, event);
-			break;
-		case XCB_UNMAP_NOTIFY:
-			weston_wm_handle_unmap_notify(wm, event);
-			break;
-		case XCB_REPARENT_NOTIFY:
-			weston_wm_handle_reparent_notify(wm, event);
-			break;
-		case XCB_CONFIGURE_REQUEST:
-			weston_wm_handle_configure_request(wm, event);
-			break;
-		case XCB_CONFIGURE_NOTIFY:
-			weston_wm_handle_configure_notify(wm, event);
-			break;
-		case XCB_DESTROY_NOTIFY:
-			weston_wm_handle_destroy_notify(wm, event);
-			break;
-		case XCB_MAPPING_NOTIFY:
-			wm_printf(wm, "XCB_MAPPING_NOTIFY\n");
+			map_request = (xcb_map_request_event_t *) events[i];
+			if (!our_resource(wm, map_request->window) &&
+			    wm_lookup_window(wm, map_request->window, &window))
+				weston_wm_window_prefetch_properties(window);
 			break;
 		case XCB_PROPERTY_NOTIFY:
-			weston_wm_handle_property_notify(wm, event);
-			break;
-		case XCB_CLIENT_MESSAGE:
-			weston_wm_handle_client_message(wm, event);
-			break;
-		case XCB_FOCUS_IN:
-			weston_wm_handle_focus_in(wm, event);
+			property_notify =
+				(xcb_property_notify_event_t *) events[i];
+			if (property_notify->atom != wm->atom.net_wm_name &&
+			    property_notify->atom != XCB_ATOM_WM_NAME)
+				break;
+			if (!wm_lookup_window(wm, property_notify->window,
+					      &window))
+				break;
+			if (window->properties_batch != wm->event_batch)
+				weston_wm_window_discard_properties(window);
+			window->properties_dirty = 1;
+			weston_wm_window_prefetch_properties(window);
 			break;
 		}
-
-		free(event);
-		count++;
 	}
+}
+
+/* Upper bound of X11 events handled as one batch */
+#define WM_EVENT_BATCH_MAX 64
+
+static int
+weston_wm_handle_event(int fd, uint32_t mask, void *data)
+{
+	struct weston_wm *wm = data;
+	xcb_generic_event_t *events[WM_EVENT_BATCH_MAX];
+	int count = 0;
+	int n, i;
+
+	/* Drain what is queued, then handle it as one batch. */
+	do {
+		n = 0;
+		while (n < WM_EVENT_BATCH_MAX &&
+		       (events[n] = xcb_poll_for_event(wm->conn)) != NULL)
+			n++;
+
+		wm->event_batch++;
+		weston_wm_prefetch_for_events(wm, events, n);
+
+		for (i = 0; i < n; i++) {
+			weston_wm_dispatch_event(wm, events[i]);
+			free(events[i]);
+		}
+		count += n;
+	} while (n > 0);
 
 	if (count != 0)
 		xcb_flush(wm->conn);
@@ -2671,6 +2987,8 @@ weston_wm_destroy(struct weston_wm *wm)
 {
 	/* FIXME: Free windows in hash. */
 	hash_table_destroy(wm->window_hash);
+	if (wm->decor_gc != XCB_NONE)
+		xcb_free_gc(wm->conn, wm->decor_gc);
 	weston_wm_destroy_cursors(wm);
 	theme_destroy(wm->theme);
 	xcb_disconnect(wm->conn);
@@ -75,6 +75,8 @@ struct weston_wm {
 	struct wl_listener activate_listener;
 	struct wl_listener kill_listener;
 	struct wl_list unpaired_window_list;
+	uint32_t event_batch;
+	xcb_gcontext_t decor_gc;
 
 	xcb_window_t selection_window;
 	xcb_window_t selection_owner;
@@ -83,6 +85,8 @@ struct weston_wm {
 	struct wl_event_source *property_source;
 	xcb_get_property_reply_t *property_reply;
 	int property_start;
+	uint32_t property_offset; /* in 32-bit units */
+	bool property_more;
 	struct wl_array source_data;
 	xcb_selection_request_event_t selection_request;
 	xcb_atom_t selection_target;